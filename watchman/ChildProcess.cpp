@@ -423,6 +423,16 @@ std::unique_ptr<Pipe> ChildProcess::takeStdin() {
   return pipe;
 }
 
+std::unique_ptr<Pipe> ChildProcess::takePipe(int targetFd) {
+  auto it = pipes_.find(targetFd);
+  if (it == pipes_.end()) {
+    return nullptr;
+  }
+  auto pipe = std::move(it->second);
+  pipes_.erase(it);
+  return pipe;
+}
+
 std::pair<w_string, w_string> ChildProcess::communicate(
     pipeWriteCallback writeCallback) {
 #ifdef _WIN32
@@ -432,9 +442,29 @@ std::pair<w_string, w_string> ChildProcess::communicate(
 #endif
 }
 
+w_string ChildProcess::streamStdout(
+    outputCallback onStdout,
+    pipeWriteCallback writeCallback) {
+#ifdef _WIN32
+  auto outputs = threadedCommunicate(writeCallback);
+  if (outputs.first) {
+    onStdout(outputs.first);
+  }
+  return std::move(outputs.second);
+#else
+  return pollingCommunicate(writeCallback, onStdout).second;
+#endif
+}
+
 #ifndef _WIN32
 std::pair<w_string, w_string> ChildProcess::pollingCommunicate(
     pipeWriteCallback writeCallback) {
+  return pollingCommunicate(writeCallback, nullptr);
+}
+
+std::pair<w_string, w_string> ChildProcess::pollingCommunicate(
+    pipeWriteCallback writeCallback,
+    const outputCallback& onStdout) {
   std::unordered_map<int, std::string> outputs;
 
   for (auto& it : pipes_) {
@@ -539,6 +569,10 @@ std::pair<w_string, w_string> ChildProcess::pollingCommunicate(
           pipes_.erase(revmap[pfd.fd]);
           continue;
         }
+        if (onStdout && revmap[pfd.fd] == STDOUT_FILENO) {
+          onStdout(w_string_piece{buf, size_t(l)});
+          continue;
+        }
         outputs[revmap[pfd.fd]].append(buf, l);
       }
 
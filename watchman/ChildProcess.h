@@ -8,6 +8,7 @@
 #pragma once
 
 #include <folly/futures/Future.h>
+#include <functional>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -155,6 +156,11 @@ class ChildProcess {
   // terminate.
   std::unique_ptr<Pipe> takeStdin();
 
+  // Extracts the pipe that was set up as targetFd in the child, for callers
+  // that talk to the child over it themselves rather than via communicate().
+  // Returns nullptr if there is no such pipe.
+  std::unique_ptr<Pipe> takePipe(int targetFd);
+
   // The pipeWriteCallback is called by communicate when it is safe to write
   // data to the pipe.  The callback should then attempt to write to it.
   // The callback must return true when it has nothing more
@@ -176,6 +182,17 @@ class ChildProcess {
         return true;
       });
 
+  // Called by streamStdout with each chunk of the child's stdout as it is
+  // read. The chunk is only valid for the duration of the call.
+  using outputCallback = std::function<void(w_string_piece)>;
+
+  /** Like communicate(), but rather than collecting the output stream,
+   * passes it to onStdout as it arrives, so that a large output can be
+   * consumed without being held in full. Returns the error stream. */
+  w_string streamStdout(
+      outputCallback onStdout,
+      pipeWriteCallback writeCallback = [](FileDescriptor&) { return true; });
+
   // these are public for the sake of testing.  You should use the
   // communicate() method instead of calling these directly.
   std::pair<w_string, w_string> pollingCommunicate(pipeWriteCallback writable);
@@ -195,5 +212,11 @@ class ChildProcess {
   std::unordered_map<int, std::unique_ptr<Pipe>> pipes_;
 
   folly::Future<w_string> readPipe(int fd);
+#ifndef _WIN32
+  // Collects the output streams, except for stdout if onStdout is set.
+  std::pair<w_string, w_string> pollingCommunicate(
+      pipeWriteCallback writable,
+      const outputCallback& onStdout);
+#endif
 };
 } // namespace watchman
@@ -8,14 +8,25 @@
 #include "watchman/Client.h"
 
 #include <folly/MapUtil.h>
+#include <folly/portability/Time.h>
 
+#include <algorithm>
+#include <map>
+
+#include "watchman/ClientReactor.h"
 #include "watchman/Command.h"
 #include "watchman/Errors.h"
+#include "watchman/HeapProfile.h"
 #include "watchman/Logging.h"
 #include "watchman/MapUtil.h"
+#include "watchman/Metrics.h"
 #include "watchman/Poison.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
+#include "watchman/ThreadClass.h"
+#include "watchman/Tracing.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/query/ChangePrefilter.h"
 #include "watchman/root/Root.h"
 #include "watchman/watchman_cmd.h"
 
@@ -38,6 +49,28 @@ constexpr size_t kResponseLogLimit = 0;
 
 folly::Synchronized<std::unordered_set<UserClient*>> clients;
 
+thread_local ClientUsage* currentUsage = nullptr;
+
+// The usage of the connections that have closed, by peer. The peers that
+// were seen least recently are forgotten first.
+struct RetiredUsage {
+  int64_t connections{0};
+  ClientUsageStatus usage;
+  std::chrono::steady_clock::time_point lastSeen;
+};
+constexpr size_t kMaxRetiredPeers = 256;
+folly::Synchronized<std::map<std::pair<pid_t, std::string>, RetiredUsage>>
+    retiredUsage;
+
+std::chrono::microseconds threadCpuTime() {
+  timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return std::chrono::microseconds{0};
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec});
+}
+
 // TODO: If used in a hot loop, EdenFS has a faster implementation.
 // https://github.com/facebookexperimental/eden/blob/c745d644d969dae1e4c0d184c19320fac7c27ae5/eden/fs/utils/IDGen.h
 std::atomic<uint64_t> id_generator{1};
@@ -81,6 +114,18 @@ void Client::enqueueResponse(UntypedResponse resp) {
   enqueueResponse(std::move(resp).toJson());
 }
 
+bool Client::sendResponseNow(json_ref resp) {
+  if (!stm || !responses.empty()) {
+    enqueueResponse(std::move(resp));
+    return true;
+  }
+  stm->setNonBlock(false);
+  TraceScope span{"encode", 0};
+  auto encodeResult = writer.pduEncodeToStream(format, resp, stm.get());
+  stm->setNonBlock(true);
+  return encodeResult.hasValue();
+}
+
 void Client::sendErrorResponse(std::string_view formatted) {
   UntypedResponse resp;
   resp.set("error", typed_string_to_json(formatted));
@@ -135,6 +180,12 @@ bool Client::dispatchCommand(const Command& command, CommandFlags mode) {
       return false;
     }
 
+    if (client_is_remote && !def->flags.contains(CMD_ALLOW_REMOTE)) {
+      sendErrorResponse(
+          "'{}' is not available to clients connected over TCP", def->name);
+      return false;
+    }
+
     // Scope for the perf sample
     {
       logf(DBG, "dispatch_command: {}\n", def->name);
@@ -146,7 +197,7 @@ bool Client::dispatchCommand(const Command& command, CommandFlags mode) {
       };
 
       sample.set_wall_time_thresh(
-          cfg_get_double("slow_command_log_threshold_seconds", 1.0));
+          cfg_get_snapshot()->slowCommandLogThresholdSeconds);
 
       // TODO: It's silly to convert a Command back into JSON after parsing it.
       // Let's change `func` to take a Command after Command knows what a root
@@ -177,6 +228,22 @@ bool Client::dispatchCommand(const Command& command, CommandFlags mode) {
   }
 }
 
+ClientUsage* ClientUsage::current() {
+  return currentUsage;
+}
+
+ClientUsageStatus ClientUsage::getStatus() const {
+  ClientUsageStatus status;
+  status.dispatch_cpu_us = dispatchCpuMicros.load(std::memory_order_relaxed);
+  status.bytes_received = bytesReceived.load(std::memory_order_relaxed);
+  status.bytes_sent = bytesSent.load(std::memory_order_relaxed);
+  status.queries = queries.load(std::memory_order_relaxed);
+  status.view_lock_us = viewLockMicros.load(std::memory_order_relaxed);
+  status.subscription_deliveries =
+      subscriptionDeliveries.load(std::memory_order_relaxed);
+  return status;
+}
+
 std::string ClientStatus::getName() const {
   switch (state_.load(std::memory_order_acquire)) {
     case THREAD_STARTING:
@@ -208,7 +275,12 @@ std::string ClientStatus::getName() const {
 void UserClient::create(std::unique_ptr<watchman_stream> stm) {
   auto uc = std::make_shared<UserClient>(PrivateBadge{}, std::move(stm));
 
-  // Start a thread for the client.
+  if (auto* reactor = ClientReactor::get()) {
+    reactor->add(std::move(uc));
+    return;
+  }
+
+  // Otherwise, start a thread for the client.
   //
   // We used to use libevent for this, but we have a low volume of concurrent
   // clients and the json parse/encode APIs are not easily used in a
@@ -230,6 +302,22 @@ UserClient::UserClient(PrivateBadge, std::unique_ptr<watchman_stream> stm)
 UserClient::~UserClient() {
   clients.wlock()->erase(this);
 
+  if (peerPid_) {
+    // May briefly, once, block on the ProcessNameCache thread.
+    auto key = std::make_pair(peerPid_, peerName_.get());
+    auto retired = retiredUsage.wlock();
+    auto& peer = (*retired)[key];
+    ++peer.connections;
+    peer.usage.add(usage.getStatus());
+    peer.lastSeen = std::chrono::steady_clock::now();
+    if (retired->size() > kMaxRetiredPeers) {
+      retired->erase(std::min_element(
+          retired->begin(), retired->end(), [](auto& a, auto& b) {
+            return a.second.lastSeen < b.second.lastSeen;
+          }));
+    }
+  }
+
   /* cancel subscriptions */
   subscriptions.clear();
 
@@ -267,6 +355,37 @@ ClientDebugStatus UserClient::getDebugStatus() const {
     rv.peer->name = peerName_.get();
   }
   rv.since = std::chrono::system_clock::to_time_t(since_);
+  rv.usage = usage.getStatus();
+  return rv;
+}
+
+std::vector<PeerUsageStatus> UserClient::getUsageByPeer() {
+  std::map<std::pair<pid_t, std::string>, PeerUsageStatus> peers;
+  for (auto& [key, retired] : *retiredUsage.rlock()) {
+    auto& peer = peers[key];
+    peer.connections += retired.connections;
+    peer.usage.add(retired.usage);
+  }
+  for (auto& client : getAllClients()) {
+    if (!client->peerPid_) {
+      continue;
+    }
+    auto& peer =
+        peers[std::make_pair(client->peerPid_, client->peerName_.get())];
+    ++peer.connections;
+    peer.usage.add(client->usage.getStatus());
+  }
+
+  std::vector<PeerUsageStatus> rv;
+  rv.reserve(peers.size());
+  for (auto& [key, peer] : peers) {
+    peer.peer.pid = key.first;
+    peer.peer.name = key.second;
+    rv.push_back(std::move(peer));
+  }
+  std::sort(rv.begin(), rv.end(), [](auto& a, auto& b) {
+    return a.usage.dispatch_cpu_us > b.usage.dispatch_cpu_us;
+  });
   return rv;
 }
 
@@ -294,192 +413,262 @@ void UserClient::vacateStates() {
   }
 }
 
-void UserClient::clientThread() noexcept {
+void UserClient::beginSession() {
   status_.transitionTo(ClientStatus::THREAD_STARTED);
-
-  // Keep a persistent vector around so that we can avoid allocating
-  // and releasing heap memory when we collect items from the publisher
-  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
-
   stm->setNonBlock(true);
-  w_set_thread_name(
-      "client=",
-      unique_id,
-      ":stm=",
-      uintptr_t(stm.get()),
-      ":pid=",
-      stm->getPeerProcessID());
-
   client_is_owner = stm->peerIsOwner();
+  client_is_remote = stm->peerIsRemote();
+  status_.transitionTo(ClientStatus::WAITING_FOR_REQUEST);
+}
 
-  EventPoll pfd[2];
-  pfd[0].evt = stm->getEvents();
-  pfd[1].evt = ping.get();
+bool UserClient::processEvents(bool inputReady, bool pinged) {
+  // Attribute what this does, on whichever thread, to this client.
+  setTraceClientId(unique_id);
+  currentUsage = &usage;
+  HeapTagScope heapTag{HeapTag::Clients};
+  auto cpuStart = threadCpuTime();
+  SCOPE_EXIT {
+    setTraceClientId(0);
+    currentUsage = nullptr;
+    auto cpu = threadCpuTime() - cpuStart;
+    if (cpu.count() > 0) {
+      ClientUsage::add(usage.dispatchCpuMicros, cpu.count());
+    }
+    usage.bytesReceived.store(reader.bytesRead, std::memory_order_relaxed);
+    usage.bytesSent.store(writer.bytesWritten, std::memory_order_relaxed);
+  };
 
-  bool client_alive = true;
-  while (!w_is_stopping() && client_alive) {
-    // Wait for input from either the client socket or
-    // via the ping pipe, which signals that some other
-    // thread wants to unilaterally send data to the client
+  // A single read may bring in more than one request, and the socket won't
+  // become readable again for those that are already buffered.
+  while (inputReady) {
+    status_.transitionTo(ClientStatus::DECODING_REQUEST);
+    json_error_t jerr;
+    auto request = reader.decodeNext(stm.get(), &jerr);
 
-    status_.transitionTo(ClientStatus::WAITING_FOR_REQUEST);
-    ignore_result(w_poll_events(pfd, 2, 2000));
-    if (w_is_stopping()) {
+    if (!request && errno == EAGAIN) {
+      // That's fine
       break;
+    } else if (!request) {
+      // Not so cool
+      if (reader.wpos == reader.rpos) {
+        // If they disconnected in between PDUs, no need to log
+        // any error
+        return false;
+      }
+      sendErrorResponse(
+          "invalid json at position {}: {}", jerr.position, jerr.text);
+      logf(ERR, "invalid data from client: {}\n", jerr.text);
+
+      return false;
     }
 
-    if (pfd[0].ready) {
-      status_.transitionTo(ClientStatus::DECODING_REQUEST);
-      json_error_t jerr;
-      auto request = reader.decodeNext(stm.get(), &jerr);
-
-      if (!request && errno == EAGAIN) {
-        // That's fine
-      } else if (!request) {
-        // Not so cool
-        if (reader.wpos == reader.rpos) {
-          // If they disconnected in between PDUs, no need to log
-          // any error
-          goto disconnected;
-        }
-        sendErrorResponse(
-            "invalid json at position {}: {}", jerr.position, jerr.text);
-        logf(ERR, "invalid data from client: {}\n", jerr.text);
-
-        goto disconnected;
-      } else if (request) {
-        format = reader.format;
-        status_.transitionTo(ClientStatus::DISPATCHING_COMMAND);
-        dispatchCommand(Command::parse(*request), CMD_DAEMON);
+    format = reader.format;
+    status_.transitionTo(ClientStatus::DISPATCHING_COMMAND);
+    dispatchCommand(Command::parse(*request), CMD_DAEMON);
+    inputReady = reader.wpos != reader.rpos;
+  }
+
+  if (pinged) {
+    while (ping->testAndClear()) {
+      status_.transitionTo(ClientStatus::PROCESSING_SUBSCRIPTION);
+      // Enqueue refs to pending log payloads
+      pending_.clear();
+      getPending(pending_, debugSub, errorSub);
+      for (auto& item : pending_) {
+        enqueueResponse(json_ref(item->payload));
       }
-    }
 
-    if (pfd[1].ready) {
-      while (ping->testAndClear()) {
-        status_.transitionTo(ClientStatus::PROCESSING_SUBSCRIPTION);
-        // Enqueue refs to pending log payloads
-        pending.clear();
-        getPending(pending, debugSub, errorSub);
-        for (auto& item : pending) {
+      for (auto& [rootPath, sub] : crawlProgressSubs) {
+        pending_.clear();
+        sub->getPending(pending_);
+        for (auto& item : pending_) {
           enqueueResponse(json_ref(item->payload));
         }
+      }
 
-        // Maybe we have subscriptions to dispatch?
-        std::vector<w_string> subsToDelete;
-        for (auto& [sub, subStream] : unilateralSub) {
+      // Maybe we have subscriptions to dispatch?
+      static auto& fanout = watchman::getHistogram(
+          "watchman_subscription_fanout",
+          "Subscriptions of a client evaluated on each of its wakeups");
+      std::vector<w_string> subsToDelete;
+      size_t numEvaluated = 0;
+      for (auto& [sub, subStream] : unilateralSub) {
+        watchman::log(watchman::DBG, "consider fan out sub ", sub->name, "\n");
+
+        pending_.clear();
+        bool seenSettle = false;
+        if (subStream->getPending(pending_)) {
+          // The client fell so far behind that some notifications were
+          // discarded. Whatever they were, catching up with a single
+          // evaluation since the subscription's last clock covers them.
           watchman::log(
-              watchman::DBG, "consider fan out sub ", sub->name, "\n");
-
-          pending.clear();
-          subStream->getPending(pending);
-          bool seenSettle = false;
-          for (auto& item : pending) {
-            auto dumped = json_dumps(item->payload, 0);
+              watchman::ERR,
+              "subscription ",
+              sub->name,
+              " fell behind; coalescing its missed notifications\n");
+          seenSettle = !sub->debug_paused;
+        }
+        for (auto& item : pending_) {
+          auto dumped = json_dumps(item->payload, 0);
+          watchman::log(
+              watchman::DBG,
+              "Unilateral payload for sub ",
+              sub->name,
+              " ",
+              dumped,
+              "\n");
+
+          if (item->payload.get_optional("canceled")) {
             watchman::log(
-                watchman::DBG,
-                "Unilateral payload for sub ",
+                watchman::ERR,
+                "Cancel subscription ",
                 sub->name,
-                " ",
-                dumped,
-                "\n");
-
-            if (item->payload.get_optional("canceled")) {
-              watchman::log(
-                  watchman::ERR,
-                  "Cancel subscription ",
-                  sub->name,
-                  " due to root cancellation\n");
-
-              UntypedResponse resp;
-              resp.set(
-                  {{"unilateral", json_true()},
-                   {"canceled", json_true()},
-                   {"subscription", w_string_to_json(sub->name)}});
-              if (auto root = item->payload.get_optional("root")) {
-                resp.set("root", *root);
-              }
-              enqueueResponse(std::move(resp));
-              // Remember to cancel this subscription.
-              // We can't do it in this loop because that would
-              // invalidate the iterators and cause a headache.
-              subsToDelete.push_back(sub->name);
-              continue;
+                " due to root cancellation\n");
+
+            UntypedResponse resp;
+            resp.set(
+                {{"unilateral", json_true()},
+                 {"canceled", json_true()},
+                 {"subscription", w_string_to_json(sub->name)}});
+            if (auto root = item->payload.get_optional("root")) {
+              resp.set("root", *root);
             }
+            enqueueResponse(std::move(resp));
+            // Remember to cancel this subscription.
+            // We can't do it in this loop because that would
+            // invalidate the iterators and cause a headache.
+            subsToDelete.push_back(sub->name);
+            continue;
+          }
 
-            if (item->payload.get_optional("state-enter") ||
-                item->payload.get_optional("state-leave")) {
-              UntypedResponse resp;
-              resp.insert(
-                  item->payload.object().begin(), item->payload.object().end());
-              // We have the opportunity to populate additional response
-              // fields here (since we don't want to block the command).
-              // We don't populate the fat clock for SCM aware queries
-              // because determination of mergeBase could add latency.
-              resp.set(
-                  {{"unilateral", json_true()},
-                   {"subscription", w_string_to_json(sub->name)}});
-              enqueueResponse(std::move(resp));
-
-              watchman::log(
-                  watchman::DBG,
-                  "Fan out subscription state change for ",
-                  sub->name,
-                  "\n");
-              continue;
-            }
+          if (item->payload.get_optional("state-enter") ||
+              item->payload.get_optional("state-leave")) {
+            UntypedResponse resp;
+            resp.insert(
+                item->payload.object().begin(), item->payload.object().end());
+            // We have the opportunity to populate additional response
+            // fields here (since we don't want to block the command).
+            // We don't populate the fat clock for SCM aware queries
+            // because determination of mergeBase could add latency.
+            resp.set(
+                {{"unilateral", json_true()},
+                 {"subscription", w_string_to_json(sub->name)}});
+            enqueueResponse(std::move(resp));
 
-            if (!sub->debug_paused && item->payload.get_optional("settled")) {
-              seenSettle = true;
-              continue;
-            }
+            watchman::log(
+                watchman::DBG,
+                "Fan out subscription state change for ",
+                sub->name,
+                "\n");
+            continue;
           }
 
-          if (seenSettle) {
-            sub->processSubscription();
+          if (!sub->debug_paused && item->payload.get_optional("settled")) {
+            // Unless nothing that the query could match has changed since
+            // it last ran
+            seenSettle = seenSettle || !sub->prefilter ||
+                sub->prefilter->matched.load(std::memory_order_acquire);
+            continue;
           }
         }
 
-        for (auto& name : subsToDelete) {
-          unsubByName(name);
+        if (seenSettle || sub->isDeliveryDue()) {
+          sub->processSubscription();
+          ++numEvaluated;
         }
       }
+      if (numEvaluated > 0) {
+        fanout.record(numEvaluated);
+      }
+
+      for (auto& name : subsToDelete) {
+        unsubByName(name);
+      }
     }
+  }
 
-    /* now send our response(s) */
-    while (!responses.empty() && client_alive) {
-      status_.transitionTo(ClientStatus::SENDING_SUBSCRIPTION_RESPONSES);
-      auto& response_to_send = responses.front();
-
-      stm->setNonBlock(false);
-      /* Return the data in the same format that was used to ask for it.
-       * Update client liveness based on send success.
-       */
-      auto encodeResult =
-          writer.pduEncodeToStream(this->format, response_to_send, stm.get());
+  bool client_alive = true;
+  /* now send our response(s) */
+  while (!responses.empty() && client_alive) {
+    status_.transitionTo(ClientStatus::SENDING_SUBSCRIPTION_RESPONSES);
+    auto& response_to_send = responses.front();
+
+    stm->setNonBlock(false);
+    /* Return the data in the same format that was used to ask for it.
+     * Update client liveness based on send success. The responses are
+     * accumulated in the writer's buffer and flushed together below, so
+     * that a burst of small ones costs a single write.
+     */
+    {
+      TraceScope span{"encode", 0};
+      auto encodeResult = writer.pduEncodeToStream(
+          this->format, response_to_send, stm.get(), /*flush=*/false);
       client_alive = encodeResult.hasValue();
-      stm->setNonBlock(true);
-
-      std::optional<json_ref> subscriptionValue =
-          response_to_send.get_optional("subscription");
-      if (kResponseLogLimit && subscriptionValue &&
-          subscriptionValue->isString() &&
-          json_string_value(*subscriptionValue)) {
-        auto subscriptionName = json_to_w_string(*subscriptionValue);
-        if (auto* sub = folly::get_ptr(subscriptions, subscriptionName)) {
-          if ((*sub)->lastResponses.size() >= kResponseLogLimit) {
-            (*sub)->lastResponses.pop_front();
-          }
-          (*sub)->lastResponses.push_back(ClientSubscription::LoggedResponse{
-              std::chrono::system_clock::now(), response_to_send});
+    }
+    stm->setNonBlock(true);
+
+    std::optional<json_ref> subscriptionValue =
+        response_to_send.get_optional("subscription");
+    if (kResponseLogLimit && subscriptionValue &&
+        subscriptionValue->isString() &&
+        json_string_value(*subscriptionValue)) {
+      auto subscriptionName = json_to_w_string(*subscriptionValue);
+      if (auto* sub = folly::get_ptr(subscriptions, subscriptionName)) {
+        if ((*sub)->lastResponses.size() >= kResponseLogLimit) {
+          (*sub)->lastResponses.pop_front();
         }
+        (*sub)->lastResponses.push_back(ClientSubscription::LoggedResponse{
+            std::chrono::system_clock::now(), response_to_send});
       }
-
-      responses.pop_front();
     }
+
+    responses.pop_front();
+  }
+  if (client_alive && writer.wpos != writer.rpos) {
+    stm->setNonBlock(false);
+    TraceScope span{"write", 0};
+    client_alive = writer.flushToStream(stm.get()).hasValue();
+    stm->setNonBlock(true);
   }
 
-disconnected:
+  status_.transitionTo(ClientStatus::WAITING_FOR_REQUEST);
+  return client_alive;
+}
+
+void UserClient::endSession() {
   status_.transitionTo(ClientStatus::THREAD_STOPPING);
+}
+
+void UserClient::clientThread() noexcept {
+  beginSession();
+  w_set_thread_name(
+      "client=",
+      unique_id,
+      ":stm=",
+      uintptr_t(stm.get()),
+      ":pid=",
+      stm->getPeerProcessID());
+  applyThreadClassPolicy(ThreadClass::Client);
+
+  EventPoll pfd[2];
+  pfd[0].evt = stm->getEvents();
+  pfd[1].evt = ping.get();
+
+  while (!w_is_stopping()) {
+    // Wait for input from either the client socket or
+    // via the ping pipe, which signals that some other
+    // thread wants to unilaterally send data to the client
+    ignore_result(w_poll_events(pfd, 2, 2000));
+    if (w_is_stopping()) {
+      break;
+    }
+
+    if (!processEvents(pfd[0].ready, pfd[1].ready)) {
+      break;
+    }
+  }
+
+  endSession();
   w_set_thread_name(
       "NOT_CONN:client=",
       unique_id,
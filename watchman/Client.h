@@ -10,9 +10,11 @@
 #include <eden/common/utils/ProcessNameCache.h>
 #include <fmt/format.h>
 
+#include <atomic>
 #include <chrono>
 #include <deque>
 #include <unordered_map>
+#include <vector>
 
 #include "watchman/Clock.h"
 #include "watchman/CommandRegistry.h"
@@ -23,12 +25,70 @@
 
 namespace watchman {
 
+class ClientReactor;
 class ClientStateAssertion;
 class Command;
 class Root;
 struct Query;
 struct QueryResult;
 
+struct ClientUsageStatus : serde::Object {
+  int64_t dispatch_cpu_us{0};
+  int64_t bytes_received{0};
+  int64_t bytes_sent{0};
+  int64_t queries{0};
+  int64_t view_lock_us{0};
+  int64_t subscription_deliveries{0};
+
+  void add(const ClientUsageStatus& other) {
+    dispatch_cpu_us += other.dispatch_cpu_us;
+    bytes_received += other.bytes_received;
+    bytes_sent += other.bytes_sent;
+    queries += other.queries;
+    view_lock_us += other.view_lock_us;
+    subscription_deliveries += other.subscription_deliveries;
+  }
+
+  template <typename X>
+  void map(X& x) {
+    x("dispatch_cpu_us", dispatch_cpu_us);
+    x("bytes_received", bytes_received);
+    x("bytes_sent", bytes_sent);
+    x("queries", queries);
+    x("view_lock_us", view_lock_us);
+    x("subscription_deliveries", subscription_deliveries);
+  }
+};
+
+/**
+ * What a client has cost the server, for finding the ones that cost the
+ * most. Updated by whichever thread is serving the client, and read by
+ * others.
+ */
+struct ClientUsage {
+  // CPU time of the threads that dispatched its commands
+  std::atomic<uint64_t> dispatchCpuMicros{0};
+  std::atomic<uint64_t> bytesReceived{0};
+  std::atomic<uint64_t> bytesSent{0};
+  // Queries run, including those of its subscriptions
+  std::atomic<uint64_t> queries{0};
+  // Time that those queries held the view lock while generating results
+  std::atomic<uint64_t> viewLockMicros{0};
+  std::atomic<uint64_t> subscriptionDeliveries{0};
+
+  /**
+   * The usage of the client that this thread is serving, if any, so that
+   * code that doesn't know the client can charge it.
+   */
+  static ClientUsage* current();
+
+  static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  ClientUsageStatus getStatus() const;
+};
+
 class Client : public std::enable_shared_from_this<Client> {
  public:
   Client();
@@ -40,6 +100,15 @@ class Client : public std::enable_shared_from_this<Client> {
   void enqueueResponse(json_ref resp);
   void enqueueResponse(UntypedResponse resp);
 
+  /**
+   * Writes resp to the client straight away instead of waiting for the
+   * current command to finish, for commands that stream part of their
+   * result. Falls back to enqueueResponse() if there is no stream or other
+   * responses are already waiting to be sent, to preserve their order.
+   * Returns false if the write failed.
+   */
+  bool sendResponseNow(json_ref resp);
+
   const uint64_t unique_id;
   std::unique_ptr<watchman_stream> stm;
   std::unique_ptr<watchman_event> ping;
@@ -47,6 +116,7 @@ class Client : public std::enable_shared_from_this<Client> {
   PduBuffer writer;
   bool client_mode = false;
   bool client_is_owner = false;
+  bool client_is_remote = false;
   PduFormat format;
 
   // The command currently being processed by dispatchCommand. Only set by the
@@ -59,6 +129,8 @@ class Client : public std::enable_shared_from_this<Client> {
   // Queue of things to send to the client.
   std::deque<json_ref> responses;
 
+  ClientUsage usage;
+
   // Logging Subscriptions
   std::shared_ptr<Publisher::Subscriber> debugSub;
   std::shared_ptr<Publisher::Subscriber> errorSub;
@@ -78,6 +150,7 @@ class Client : public std::enable_shared_from_this<Client> {
 
 enum class OnStateTransition { QueryAnyway, DontAdvance };
 
+class ChangePrefilter;
 class UserClient;
 
 class ClientSubscription
@@ -96,6 +169,27 @@ class ClientSubscription
       ClockSpec& position,
       OnStateTransition onStateTransition);
 
+  /**
+   * Enqueues a response from buildSubscriptionResults(). If the query sets
+   * results_chunk_size, the files are split across as many PDUs as needed,
+   * all but the last of them flagged with more_files.
+   */
+  void enqueueResults(Client* client, UntypedResponse&& response);
+
+  /**
+   * Returns whether a notification held back by min_interval_ms is now due,
+   * in which case processSubscription() should be called even if no new
+   * settle has been seen.
+   */
+  bool isDeliveryDue() const;
+
+  /**
+   * Folds response, if any, into the results held back by max_batch_files
+   * and returns the lot, for when they must be delivered straight away.
+   */
+  std::optional<UntypedResponse> takeBatchedResults(
+      std::optional<UntypedResponse> response);
+
  public:
   struct LoggedResponse {
     // TODO: also track the time when the response was enqueued
@@ -117,12 +211,43 @@ class ClientSubscription
 
   std::deque<LoggedResponse> lastResponses;
 
+  // min_interval_ms: the least time between two notifications with files.
+  // Settles within it are held back until it has passed.
+  std::chrono::milliseconds minInterval{0};
+  // max_batch_files: when set, the query runs at every settle and its
+  // results are merged into a batch, which is delivered once it has this
+  // many files or minInterval has passed.
+  size_t maxBatchFiles{0};
+  // notify_only: notifications carry the clock and a count of the changed
+  // files rather than the results of the query.
+  bool notifyOnly{false};
+  // Set if the view marks it when a file that the query could match has
+  // changed; settles that leave it unmarked don't wake the subscription.
+  std::shared_ptr<ChangePrefilter> prefilter;
+
  private:
   ClockSpec runSubscriptionRules(
       UserClient* client,
       const std::shared_ptr<Root>& root);
-  void updateSubscriptionTicks(QueryResult* res);
+  void updateSubscriptionTicks(const ClockSpec& clock);
   void processSubscriptionImpl();
+  std::optional<UntypedResponse> buildNotifyOnlyResults(
+      const std::shared_ptr<Root>& root,
+      ClockSpec& position);
+
+  bool intervalElapsed() const;
+  // Sets whether the next settle should wake the subscription, if it has a
+  // prefilter.
+  void setPrefilterMatched(bool matched);
+  // Remembers that a notification is owed and arranges for the client to
+  // be pinged when minInterval has passed.
+  void holdBack(UserClient* client);
+  void deliverResults(UserClient* client, UntypedResponse&& response);
+
+  std::chrono::steady_clock::time_point lastDelivery_;
+  bool heldBack_{false};
+  bool wakeupScheduled_{false};
+  std::optional<UntypedResponse> batch_;
 };
 
 class ClientStatus {
@@ -174,12 +299,31 @@ struct ClientDebugStatus : serde::Object {
   std::string state;
   std::optional<PeerInfo> peer;
   std::optional<int64_t> since;
+  ClientUsageStatus usage;
 
   template <typename X>
   void map(X& x) {
     x("state", state);
     x("peer", peer);
     x("since", since);
+    x("usage", usage);
+  }
+};
+
+/**
+ * The combined usage of the connections from a process, including those
+ * that have closed.
+ */
+struct PeerUsageStatus : serde::Object {
+  PeerInfo peer;
+  int64_t connections{0};
+  ClientUsageStatus usage;
+
+  template <typename X>
+  void map(X& x) {
+    x("peer", peer);
+    x("connections", connections);
+    x("usage", usage);
   }
 };
 
@@ -188,7 +332,9 @@ struct ClientDebugStatus : serde::Object {
  * the watchman per-user process.
  *
  * Each UserClient has a corresponding thread that reads and decodes json
- * packets and dispatches the commands that it finds.
+ * packets and dispatches the commands that it finds, unless the
+ * ClientReactor is enabled, in which case it waits for all of the clients
+ * and hands them to a pool of workers when they have something to do.
  */
 class UserClient final : public Client {
  public:
@@ -199,6 +345,12 @@ class UserClient final : public Client {
 
   static std::vector<ClientDebugStatus> getStatusForAllClients();
 
+  /**
+   * The usage of each peer process that has connected recently, most costly
+   * first.
+   */
+  static std::vector<PeerUsageStatus> getUsageByPeer();
+
   /* map of subscription name => struct watchman_client_subscription */
   std::unordered_map<w_string, std::shared_ptr<ClientSubscription>>
       subscriptions;
@@ -213,6 +365,10 @@ class UserClient final : public Client {
       std::shared_ptr<Publisher::Subscriber>>
       unilateralSub;
 
+  // Subscribers to Root::crawlProgress, by root path
+  std::unordered_map<w_string, std::shared_ptr<Publisher::Subscriber>>
+      crawlProgressSubs;
+
   bool unsubByName(const w_string& name);
 
  private:
@@ -227,11 +383,24 @@ class UserClient final : public Client {
   explicit UserClient(PrivateBadge, std::unique_ptr<watchman_stream> stm);
 
  private:
+  friend class ClientReactor;
+
   ClientDebugStatus getDebugStatus() const;
 
   // Abandon any states that haven't been explicit vacated.
   void vacateStates();
 
+  // Prepares the connection, before the first call to processEvents().
+  void beginSession();
+
+  // Handles whatever woke the client up: dispatches the requests that have
+  // arrived if inputReady is set, processes the pending subscription and
+  // log events if pinged is set, then sends the responses. Returns false
+  // once the client has disconnected, or can no longer be written to.
+  bool processEvents(bool inputReady, bool pinged);
+
+  void endSession();
+
   void clientThread() noexcept;
 
   const std::chrono::system_clock::time_point since_;
@@ -239,6 +408,10 @@ class UserClient final : public Client {
   const facebook::eden::ProcessNameHandle peerName_;
 
   ClientStatus status_;
+
+  // Kept between calls to processEvents() so that we can avoid allocating
+  // and releasing heap memory when we collect items from the publisher
+  std::vector<std::shared_ptr<const Publisher::Item>> pending_;
 };
 
 } // namespace watchman
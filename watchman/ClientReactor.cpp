@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ClientReactor.h"
+#include <folly/String.h>
+#include <algorithm>
+#include <limits>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include "watchman/Client.h"
+#include "watchman/Logging.h"
+#include "watchman/Shutdown.h"
+#include "watchman/ThreadClass.h"
+#include "watchman/WatchmanConfig.h"
+
+#ifdef HAVE_EPOLL_CREATE1
+#include <sys/epoll.h>
+#endif
+
+namespace watchman {
+
+namespace {
+
+#if defined(HAVE_EPOLL_CREATE1) || defined(HAVE_KQUEUE)
+constexpr bool kReactorSupported = true;
+#else
+constexpr bool kReactorSupported = false;
+#endif
+
+// Events are tagged with the client's id and which of its descriptors is
+// ready.
+uint64_t makeToken(uint64_t id, bool ping) {
+  return (id << 1) | (ping ? 1 : 0);
+}
+
+FileDescriptor::system_handle_type streamHandle(const UserClient& client) {
+  return client.stm->getFileDescriptor().system_handle();
+}
+
+FileDescriptor::system_handle_type pingHandle(const UserClient& client) {
+  return client.ping->system_handle();
+}
+
+} // namespace
+
+ClientReactor* ClientReactor::get() {
+  static ClientReactor* reactor = []() -> ClientReactor* {
+    if (!kReactorSupported || !cfg_get_bool("client_reactor", false)) {
+      return nullptr;
+    }
+    try {
+      // Never destroyed, as clients may be active until exit.
+      return new ClientReactor(
+          std::max<json_int_t>(1, cfg_get_int("client_reactor_workers", 32)));
+    } catch (const std::exception& exc) {
+      log(ERR,
+          "unable to start the client reactor, using a thread per client: ",
+          exc.what(),
+          "\n");
+      return nullptr;
+    }
+  }();
+  return reactor;
+}
+
+ClientReactor::ClientReactor(size_t numWorkers) {
+#ifdef HAVE_EPOLL_CREATE1
+  poller_ = FileDescriptor(
+      epoll_create1(EPOLL_CLOEXEC),
+      "epoll_create1",
+      FileDescriptor::FDType::Generic);
+#elif defined(HAVE_KQUEUE)
+  poller_ =
+      FileDescriptor(kqueue(), "kqueue", FileDescriptor::FDType::Generic);
+  poller_.setCloExec();
+#else
+  throw std::runtime_error("the client reactor is not supported");
+#endif
+  workers_.start(numWorkers, std::numeric_limits<size_t>::max());
+  std::thread{[this] { run(); }}.detach();
+}
+
+void ClientReactor::add(std::shared_ptr<UserClient> client) {
+  auto id = client->unique_id;
+  client->beginSession();
+  // Marked as running until both descriptors are armed, so that an event
+  // for one of them doesn't start a worker that would try to re-arm the
+  // other before it has been added.
+  clients_.wlock()->emplace(id, Registration{client, true});
+
+  if (!armClient(*client, true)) {
+    log(ERR,
+        "unable to watch client ",
+        id,
+        ", giving it a thread: ",
+        folly::errnoStr(errno),
+        "\n");
+    remove(id);
+    std::thread{[client] { client->clientThread(); }}.detach();
+    return;
+  }
+  release(id);
+}
+
+void ClientReactor::run() noexcept {
+  w_set_thread_name("client-reactor");
+  applyThreadClassPolicy(ThreadClass::Client);
+
+  while (true) {
+#ifdef HAVE_EPOLL_CREATE1
+    struct epoll_event events[64];
+    int n = epoll_wait(poller_.system_handle(), events, 64, -1);
+#elif defined(HAVE_KQUEUE)
+    struct kevent events[64];
+    int n = kevent(poller_.system_handle(), nullptr, 0, events, 64, nullptr);
+#else
+    int n = -1;
+    errno = ENOSYS;
+#endif
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      log(FATAL, "client reactor: ", folly::errnoStr(errno), "\n");
+    }
+
+    for (int i = 0; i < n; ++i) {
+#ifdef HAVE_EPOLL_CREATE1
+      uint64_t token = events[i].data.u64;
+#elif defined(HAVE_KQUEUE)
+      auto token = uint64_t(uintptr_t(events[i].udata));
+#else
+      uint64_t token = 0;
+#endif
+      wake(token >> 1, token & 1);
+    }
+  }
+}
+
+void ClientReactor::wake(uint64_t id, bool ping) {
+  {
+    auto clients = clients_.wlock();
+    auto it = clients->find(id);
+    if (it == clients->end()) {
+      // Removed since the event was reported
+      return;
+    }
+    auto& reg = it->second;
+    (ping ? reg.pinged : reg.inputReady) = true;
+    if (reg.running) {
+      return;
+    }
+    reg.running = true;
+  }
+  schedule(id);
+}
+
+void ClientReactor::release(uint64_t id) {
+  {
+    auto clients = clients_.wlock();
+    auto it = clients->find(id);
+    if (it == clients->end()) {
+      return;
+    }
+    auto& reg = it->second;
+    if (!reg.inputReady && !reg.pinged) {
+      reg.running = false;
+      return;
+    }
+  }
+  schedule(id);
+}
+
+void ClientReactor::schedule(uint64_t id) {
+  try {
+    workers_.add([this, id] { process(id); });
+  } catch (const std::exception& exc) {
+    log(ERR, "dropping client ", id, ": ", exc.what(), "\n");
+    remove(id);
+  }
+}
+
+void ClientReactor::process(uint64_t id) {
+  std::shared_ptr<UserClient> client;
+  {
+    auto clients = clients_.rlock();
+    auto it = clients->find(id);
+    if (it == clients->end()) {
+      return;
+    }
+    client = it->second.client;
+  }
+
+  while (true) {
+    bool inputReady;
+    bool pinged;
+    {
+      auto clients = clients_.wlock();
+      auto it = clients->find(id);
+      if (it == clients->end()) {
+        return;
+      }
+      auto& reg = it->second;
+      inputReady = std::exchange(reg.inputReady, false);
+      pinged = std::exchange(reg.pinged, false);
+      if (!inputReady && !pinged) {
+        reg.running = false;
+        return;
+      }
+    }
+
+    if (w_is_stopping() || !client->processEvents(inputReady, pinged)) {
+      client->endSession();
+      remove(id);
+      return;
+    }
+
+    // The descriptors that were reported are now disarmed. Anything that
+    // arrives once they are armed again either finds the client still
+    // running, and is picked up by the next iteration, or starts a new
+    // worker.
+    if (!armClient(*client, false)) {
+      log(ERR,
+          "unable to watch client ",
+          id,
+          ", disconnecting it: ",
+          folly::errnoStr(errno),
+          "\n");
+      client->endSession();
+      remove(id);
+      return;
+    }
+  }
+}
+
+void ClientReactor::remove(uint64_t id) {
+  std::shared_ptr<UserClient> client;
+  {
+    auto clients = clients_.wlock();
+    auto it = clients->find(id);
+    if (it == clients->end()) {
+      return;
+    }
+    client = std::move(it->second.client);
+    clients->erase(it);
+  }
+  disarmClient(*client);
+  // The client is destroyed here, outside of the lock, unless a
+  // subscription or command elsewhere still holds a reference.
+}
+
+bool ClientReactor::armClient(const UserClient& client, bool add) {
+  return arm(streamHandle(client), makeToken(client.unique_id, false), add) &&
+      arm(pingHandle(client), makeToken(client.unique_id, true), add);
+}
+
+void ClientReactor::disarmClient(const UserClient& client) {
+  disarm(streamHandle(client));
+  disarm(pingHandle(client));
+}
+
+bool ClientReactor::arm(
+    FileDescriptor::system_handle_type handle,
+    uint64_t token,
+    bool add) {
+#ifdef HAVE_EPOLL_CREATE1
+  struct epoll_event event {};
+  event.events = EPOLLIN | EPOLLONESHOT;
+  event.data.u64 = token;
+  return epoll_ctl(
+             poller_.system_handle(),
+             add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+             handle,
+             &event) == 0;
+#elif defined(HAVE_KQUEUE)
+  struct kevent event;
+  EV_SET(
+      &event,
+      handle,
+      EVFILT_READ,
+      (add ? EV_ADD : EV_ENABLE) | EV_DISPATCH,
+      0,
+      0,
+      reinterpret_cast<void*>(uintptr_t(token)));
+  return kevent(poller_.system_handle(), &event, 1, nullptr, 0, nullptr) == 0;
+#else
+  (void)handle;
+  (void)token;
+  (void)add;
+  errno = ENOSYS;
+  return false;
+#endif
+}
+
+void ClientReactor::disarm(FileDescriptor::system_handle_type handle) {
+  // Failures are of no consequence: the descriptor may never have been
+  // added, and closing it removes it anyway.
+#ifdef HAVE_EPOLL_CREATE1
+  (void)epoll_ctl(poller_.system_handle(), EPOLL_CTL_DEL, handle, nullptr);
+#elif defined(HAVE_KQUEUE)
+  struct kevent event;
+  EV_SET(&event, handle, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+  (void)kevent(poller_.system_handle(), &event, 1, nullptr, 0, nullptr);
+#else
+  (void)handle;
+#endif
+}
+
+} // namespace watchman
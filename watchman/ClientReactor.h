@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include "watchman/ThreadPool.h"
+#include "watchman/fs/FileDescriptor.h"
+
+namespace watchman {
+
+class UserClient;
+
+/**
+ * Waits for the requests and pings of all of the UserClients with a single
+ * thread, using epoll or kqueue, rather than with a thread for each client.
+ * When a client's socket becomes readable or its ping event is signalled,
+ * one of a pool of workers handles it with UserClient::processEvents and
+ * then hands it back to the reactor. A client is only ever handled by one
+ * worker at a time, so its state needs no more locking than it does with a
+ * thread of its own.
+ *
+ * Commands that block, for example to sync with the filesystem, occupy a
+ * worker until they finish, so the pool is sized for the number of commands
+ * that may run at once rather than for the number of clients.
+ */
+class ClientReactor {
+ public:
+  /**
+   * Returns the reactor if client_reactor is set in the global configuration
+   * and the platform supports it, starting it the first time. Returns
+   * nullptr if each client should have its own thread instead.
+   */
+  static ClientReactor* get();
+
+  /**
+   * Takes over the session of a client that has just connected. Falls back
+   * to a thread for the client if it cannot be watched.
+   */
+  void add(std::shared_ptr<UserClient> client);
+
+ private:
+  struct Registration {
+    std::shared_ptr<UserClient> client;
+    // Whether a worker has been given the client
+    bool running{false};
+    // What has woken the client up since the worker last looked
+    bool inputReady{false};
+    bool pinged{false};
+  };
+
+  explicit ClientReactor(size_t numWorkers);
+
+  // Waits for events and passes them to wake(), forever.
+  void run() noexcept;
+
+  // Records that the socket, or the ping event, of client id is ready and
+  // gives the client to a worker if none has it.
+  void wake(uint64_t id, bool ping);
+
+  // Clears running for client id, unless something woke it up in the
+  // meantime, in which case it is given to a worker again.
+  void release(uint64_t id);
+
+  // Queues process(id) for a worker.
+  void schedule(uint64_t id);
+
+  // Runs in a worker: handles client id until nothing more has woken it.
+  void process(uint64_t id);
+
+  // Stops watching client id and drops the reactor's reference to it.
+  void remove(uint64_t id);
+
+  // Asks for one notification, by token, when handle becomes readable.
+  // add is true the first time.
+  bool arm(FileDescriptor::system_handle_type handle, uint64_t token, bool add);
+  void disarm(FileDescriptor::system_handle_type handle);
+
+  bool armClient(const UserClient& client, bool add);
+  void disarmClient(const UserClient& client);
+
+  // The epoll or kqueue descriptor
+  FileDescriptor poller_;
+  ThreadPool workers_;
+  folly::Synchronized<std::unordered_map<uint64_t, Registration>> clients_;
+};
+
+} // namespace watchman
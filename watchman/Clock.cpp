@@ -10,12 +10,18 @@
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <folly/portability/SysTime.h>
+#include <atomic>
 #include <memory>
 
 using namespace watchman;
 
 static int proc_pid;
 static uint64_t proc_start_time;
+static std::atomic<ClockRoot> next_root_number{1};
+
+ClockRoot watchman::allocateClockRoot() {
+  return next_root_number++;
+}
 
 void ClockSpec::init() {
   struct timeval tv;
@@ -127,11 +133,15 @@ ClockSpec::ClockSpec() : spec{Timestamp{0}} {}
 ClockSpec::ClockSpec(const ClockPosition& position)
     : spec{Clock{proc_start_time, proc_pid, position}} {}
 
+ClockSpec::Clock ClockSpec::current(const ClockPosition& position) {
+  return Clock{proc_start_time, proc_pid, position};
+}
+
 QuerySince ClockSpec::evaluate(
     const ClockPosition& position,
     ClockTicks lastAgeOutTick,
-    folly::Synchronized<std::unordered_map<w_string, ClockTicks>>* cursorMap)
-    const {
+    folly::Synchronized<std::unordered_map<w_string, ClockTicks>>* cursorMap,
+    const std::optional<ClockPredecessor>& predecessor) const {
   return folly::variant_match(
       spec,
       [](const Timestamp& ts) -> QuerySince {
@@ -139,8 +149,16 @@ QuerySince ClockSpec::evaluate(
       },
       [&](const Clock& clock) -> QuerySince {
         QuerySince::Clock since_clock;
-        if (clock.start_time == proc_start_time && clock.pid == proc_pid &&
-            clock.position.rootNumber == position.rootNumber) {
+        // The current incarnation continues the tick sequence of its
+        // predecessor, so the predecessor's clocks can be used as-is.
+        bool fromPredecessor = predecessor &&
+            clock.start_time == predecessor->start_time &&
+            clock.pid == predecessor->pid &&
+            clock.position.rootNumber == predecessor->rootNumber &&
+            clock.position.ticks <= predecessor->lastTicks;
+        if ((clock.start_time == proc_start_time && clock.pid == proc_pid &&
+             clock.position.rootNumber == position.rootNumber) ||
+            fromPredecessor) {
           since_clock.is_fresh_instance = clock.position.ticks < lastAgeOutTick;
           if (since_clock.is_fresh_instance) {
             since_clock.ticks = 0;
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <folly/Synchronized.h>
+#include <optional>
 #include <unordered_map>
 #include <variant>
 #include "watchman/Logging.h"
@@ -68,6 +69,18 @@ struct ClockPosition {
   w_string toClockString() const;
 };
 
+/**
+ * Identifies an earlier incarnation of a root whose tick sequence the current
+ * one continues, such that the clocks it issued, up to lastTicks, may still be
+ * evaluated against the current one.
+ */
+struct ClockPredecessor {
+  uint64_t start_time{0};
+  int pid{0};
+  ClockRoot rootNumber{0};
+  ClockTicks lastTicks{0};
+};
+
 struct ClockSpec {
   struct Timestamp {
     time_t time;
@@ -108,12 +121,18 @@ struct ClockSpec {
   /** Evaluate the clockspec against the inputs, returning
    * the effective since parameter.
    * If cursorMap is passed in, it MUST be unlocked, as this method
-   * will acquire a lock to evaluate a named cursor. */
+   * will acquire a lock to evaluate a named cursor.
+   * If predecessor is set, clocks that it issued are evaluated as though
+   * they had been issued by the current incarnation. */
   QuerySince evaluate(
       const ClockPosition& position,
       const ClockTicks lastAgeOutTick,
       folly::Synchronized<std::unordered_map<w_string, ClockTicks>>* cursorMap =
-          nullptr) const;
+          nullptr,
+      const std::optional<ClockPredecessor>& predecessor = std::nullopt) const;
+
+  /** Returns the clock that the current incarnation issues for position. */
+  static Clock current(const ClockPosition& position);
 
   /** Initializes some global state needed for clockspec evaluation */
   static void init();
@@ -133,6 +152,13 @@ struct ClockSpec {
   json_ref toJson() const;
 };
 
+/**
+ * Returns a number that uniquely identifies a new root within the process,
+ * so that clocks issued by a root that is removed and then added again, or
+ * by another root, are not mistaken for its own.
+ */
+ClockRoot allocateClockRoot();
+
 } // namespace watchman
 
 bool clock_id_string(
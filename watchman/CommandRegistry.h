@@ -107,6 +107,9 @@ inline constexpr auto CMD_DAEMON = CommandFlags::raw(1);
 inline constexpr auto CMD_CLIENT = CommandFlags::raw(2);
 inline constexpr auto CMD_POISON_IMMUNE = CommandFlags::raw(4);
 inline constexpr auto CMD_ALLOW_ANY_USER = CommandFlags::raw(8);
+// Available to clients connected over TCP, who can't be identified. These
+// must only read from roots that are already watched.
+inline constexpr auto CMD_ALLOW_REMOTE = CommandFlags::raw(16);
 
 struct CommandDefinition {
   const std::string_view name;
@@ -191,7 +194,9 @@ class TypedCommand : public CommandDefinition {
     using Request = typename T::Request;
     auto encodedResponse = serde::encode(T::handle(
         client, serde::decode<Request>(json_array(std::move(adjusted_args)))));
-    return UntypedResponse{encodedResponse.object()};
+    auto& object = encodedResponse.object();
+    return UntypedResponse{
+        std::unordered_map<w_string, json_ref>{object.begin(), object.end()}};
   }
 };
 
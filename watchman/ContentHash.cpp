@@ -6,8 +6,12 @@
  */
 
 #include "watchman/ContentHash.h"
+#include <folly/Memory.h>
 #include <folly/ScopeGuard.h>
+#include <folly/hash/SpookyHashV2.h>
+#include <algorithm>
 #include <string>
+#include "watchman/ContentHashStore.h"
 #include "watchman/Logging.h"
 #include "watchman/ThreadPool.h"
 #include "watchman/fs/FileSystem.h"
@@ -27,36 +31,36 @@ using folly::to;
 
 namespace watchman {
 
-using HashValue = typename ContentHashCache::HashValue;
-using Node = typename ContentHashCache::Node;
+namespace {
 
-bool ContentHashCacheKey::operator==(const ContentHashCacheKey& other) const {
-  return fileSize == other.fileSize && mtime.tv_sec == other.mtime.tv_sec &&
-      mtime.tv_nsec == other.mtime.tv_nsec &&
-      relativePath == other.relativePath;
-}
+// Large enough that the cost of a read call is small next to the cost of
+// hashing what it returns.  Each thread that hashes keeps one.
+constexpr size_t kReadBufferSize = 256 * 1024;
+// Page aligned, so that the kernel can copy whole pages into it.
+constexpr size_t kReadBufferAlignment = 4096;
 
-std::size_t ContentHashCacheKey::hashValue() const {
-  return hash_128_to_64(
-      w_string_hval(relativePath),
-      hash_128_to_64(fileSize, hash_128_to_64(mtime.tv_sec, mtime.tv_nsec)));
-}
-
-ContentHashCache::ContentHashCache(
-    const w_string& rootPath,
-    size_t maxItems,
-    std::chrono::milliseconds errorTTL)
-    : cache_(maxItems, errorTTL), rootPath_(rootPath) {}
+uint8_t* getReadBuffer() {
+  struct Buffer {
+    void* ptr;
 
-folly::Future<std::shared_ptr<const Node>> ContentHashCache::get(
-    const ContentHashCacheKey& key) {
-  return cache_.get(
-      key, [this](const ContentHashCacheKey& k) { return computeHash(k); });
+    Buffer()
+        : ptr(folly::aligned_malloc(kReadBufferSize, kReadBufferAlignment)) {
+      if (!ptr) {
+        throw std::bad_alloc();
+      }
+    }
+    ~Buffer() {
+      folly::aligned_free(ptr);
+    }
+  };
+  static thread_local Buffer buffer;
+  return static_cast<uint8_t*>(buffer.ptr);
 }
 
-HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
-  HashValue result;
-  uint8_t buf[8192];
+// Reads the whole of fullPath, passing each chunk to update.
+template <typename Update>
+void readFileContents(const char* fullPath, Update&& update) {
+  auto buf = getReadBuffer();
 
   auto stm = w_stm_open(fullPath, O_RDONLY);
   if (!stm) {
@@ -66,12 +70,15 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
         to<std::string>("w_stm_open ", fullPath));
   }
 
-#ifndef _WIN32
-  SHA_CTX ctx;
-  SHA1_Init(&ctx);
+#ifdef POSIX_FADV_SEQUENTIAL
+  // Ask for more aggressive readahead.  This is only a hint, so a failure
+  // is of no consequence.
+  posix_fadvise(
+      stm->getFileDescriptor().system_handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
   while (true) {
-    auto n = stm->read(buf, sizeof(buf));
+    auto n = stm->read(buf, kReadBufferSize);
     if (n == 0) {
       break;
     }
@@ -81,8 +88,34 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
           std::generic_category(),
           to<std::string>("while reading from ", fullPath));
     }
-    SHA1_Update(&ctx, buf, n);
+    update(buf, size_t(n));
   }
+}
+
+} // namespace
+
+bool ContentHashCacheKey::operator==(const ContentHashCacheKey& other) const {
+  return fileSize == other.fileSize && mtime.tv_sec == other.mtime.tv_sec &&
+      mtime.tv_nsec == other.mtime.tv_nsec &&
+      relativePath == other.relativePath;
+}
+
+std::size_t ContentHashCacheKey::hashValue() const {
+  return hash_128_to_64(
+      w_string_hval(relativePath),
+      hash_128_to_64(fileSize, hash_128_to_64(mtime.tv_sec, mtime.tv_nsec)));
+}
+
+Sha1Hasher::HashValue Sha1Hasher::hashFile(const char* fullPath) {
+  HashValue result;
+
+#ifndef _WIN32
+  SHA_CTX ctx;
+  SHA1_Init(&ctx);
+
+  readFileContents(fullPath, [&](const uint8_t* buf, size_t n) {
+    SHA1_Update(&ctx, buf, n);
+  });
 
   SHA1_Final(result.data(), &ctx);
 #else
@@ -112,23 +145,12 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
     CryptDestroyHash(ctx);
   };
 
-  while (true) {
-    auto n = stm->read(buf, sizeof(buf));
-    if (n == 0) {
-      break;
-    }
-    if (n < 0) {
-      throw std::system_error(
-          errno,
-          std::generic_category(),
-          to<std::string>("while reading from ", fullPath));
-    }
-
+  readFileContents(fullPath, [&](const uint8_t* buf, size_t n) {
     if (!CryptHashData(ctx, buf, n, 0)) {
       throw std::system_error(
           GetLastError(), std::system_category(), "CryptHashData");
     }
-  }
+  });
 
   DWORD size = result.size();
   if (!CryptGetHashParam(ctx, HP_HASHVAL, result.data(), &size, 0)) {
@@ -139,9 +161,91 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
   return result;
 }
 
-HashValue ContentHashCache::computeHashImmediate(
-    const ContentHashCacheKey& key) const {
+Spooky128Hasher::HashValue Spooky128Hasher::hashFile(const char* fullPath) {
+  folly::hash::SpookyHashV2 spooky;
+  spooky.Init(0, 0);
+
+  readFileContents(fullPath, [&](const uint8_t* buf, size_t n) {
+    spooky.Update(buf, n);
+  });
+
+  uint64_t hash1;
+  uint64_t hash2;
+  spooky.Final(&hash1, &hash2);
+
+  // Big endian, so that the hex form reads as a single 128 bit number.
+  HashValue result;
+  for (size_t i = 0; i < 8; ++i) {
+    result[i] = uint8_t(hash1 >> (56 - 8 * i));
+    result[8 + i] = uint8_t(hash2 >> (56 - 8 * i));
+  }
+  return result;
+}
+
+template <typename Hasher>
+BasicContentHashCache<Hasher>::BasicContentHashCache(
+    const w_string& rootPath,
+    size_t maxItems,
+    std::chrono::milliseconds errorTTL,
+    size_t maxConcurrency,
+    std::shared_ptr<ContentHashStore> store,
+    size_t maxBytes,
+    CacheAdmission admission)
+    : cache_(
+          maxItems,
+          errorTTL,
+          16,
+          maxBytes,
+          [](const ContentHashCacheKey& key, const HashValue&) {
+            return sizeof(Node) + key.relativePath.size();
+          },
+          admission),
+      rootPath_(rootPath),
+      maxConcurrency_(std::max(maxConcurrency, size_t(1))),
+      store_(std::move(store)) {}
+
+template <typename Hasher>
+auto BasicContentHashCache<Hasher>::get(const ContentHashCacheKey& key)
+    -> folly::Future<std::shared_ptr<const Node>> {
+  return cache_.get(
+      key, [this](const ContentHashCacheKey& k) { return computeHash(k); });
+}
+
+template <typename Hasher>
+bool BasicContentHashCache<Hasher>::warm(const ContentHashCacheKey& key) {
+  bool computed = false;
+  cache_.get(key, [this, &computed](const ContentHashCacheKey& k) {
+    computed = true;
+    return folly::makeFutureWith([&] { return computeHashImmediate(k); });
+  });
+  return computed;
+}
+
+template <typename Hasher>
+auto BasicContentHashCache<Hasher>::computeHashImmediate(const char* fullPath)
+    -> HashValue {
+  return Hasher::hashFile(fullPath);
+}
+
+template <typename Hasher>
+auto BasicContentHashCache<Hasher>::computeHashImmediate(
+    const ContentHashCacheKey& key) const -> HashValue {
   auto fullPath = w_string::pathCat({rootPath_, key.relativePath});
+  auto matchesKey = [&key](const FileInformation& stat) {
+    return size_t(stat.size) == key.fileSize &&
+        stat.mtime.tv_sec == key.mtime.tv_sec &&
+        stat.mtime.tv_nsec == key.mtime.tv_nsec;
+  };
+
+  if (store_) {
+    auto stat = getFileInformation(fullPath.c_str());
+    HashValue stored;
+    if (matchesKey(stat) &&
+        store_->lookup(key, stat.ino, stat.dev, stored.data())) {
+      return stored;
+    }
+  }
+
   auto result = computeHashImmediate(fullPath.c_str());
 
   // Since TOCTOU is everywhere and everything, double check to make sure that
@@ -149,27 +253,74 @@ HashValue ContentHashCache::computeHashImmediate(
   // we want to throw an exception and avoid associating the hash of whatever
   // state we just read with this cache key.
   auto stat = getFileInformation(fullPath.c_str());
-  if (size_t(stat.size) != key.fileSize ||
-      stat.mtime.tv_sec != key.mtime.tv_sec ||
-      stat.mtime.tv_nsec != key.mtime.tv_nsec) {
+  if (!matchesKey(stat)) {
     throw std::runtime_error(
         "metadata changed during hashing; query again to get latest status");
   }
 
+  if (store_) {
+    store_->insert(key, stat.ino, stat.dev, result.data());
+  }
   return result;
 }
 
-folly::Future<HashValue> ContentHashCache::computeHash(
-    const ContentHashCacheKey& key) const {
-  return folly::via(
-      &getThreadPool(), [key, this] { return computeHashImmediate(key); });
+template <typename Hasher>
+auto BasicContentHashCache<Hasher>::computeHash(
+    const ContentHashCacheKey& key) const -> folly::Future<HashValue> {
+  PendingHash job{key, {}};
+  auto future = job.promise.getFuture();
+  {
+    auto queue = queue_.wlock();
+    if (queue->running >= maxConcurrency_) {
+      queue->pending.push_back(std::move(job));
+      return future;
+    }
+    ++queue->running;
+  }
+
+  try {
+    getThreadPool().add([this, job = std::move(job)]() mutable {
+      runHashWorker(std::move(job));
+    });
+  } catch (const std::exception&) {
+    // The task, and with it the promise, was destroyed, which fails the
+    // future.
+    --queue_.wlock()->running;
+  }
+  return future;
+}
+
+template <typename Hasher>
+void BasicContentHashCache<Hasher>::runHashWorker(PendingHash job) const {
+  while (true) {
+    job.promise.setWith([&] { return computeHashImmediate(job.key); });
+
+    auto queue = queue_.wlock();
+    if (queue->pending.empty()) {
+      --queue->running;
+      return;
+    }
+    job = std::move(queue->pending.front());
+    queue->pending.pop_front();
+  }
 }
 
-const w_string& ContentHashCache::rootPath() const {
+template <typename Hasher>
+const w_string& BasicContentHashCache<Hasher>::rootPath() const {
   return rootPath_;
 }
 
-CacheStats ContentHashCache::stats() const {
+template <typename Hasher>
+CacheStats BasicContentHashCache<Hasher>::stats() const {
   return cache_.stats();
 }
+
+template <typename Hasher>
+size_t BasicContentHashCache<Hasher>::eraseExpired() {
+  return cache_.eraseExpired();
+}
+
+template class BasicContentHashCache<Sha1Hasher>;
+template class BasicContentHashCache<Spooky128Hasher>;
+
 } // namespace watchman
@@ -6,7 +6,11 @@
  */
 
 #pragma once
+#include <folly/Synchronized.h>
+#include <folly/futures/Promise.h>
 #include <array>
+#include <deque>
+#include <memory>
 #include "watchman/LRUCache.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
@@ -36,18 +40,49 @@ struct hash<watchman::ContentHashCacheKey> {
 } // namespace std
 
 namespace watchman {
-class ContentHashCache {
- public:
+
+class ContentHashStore;
+
+// Computes the SHA-1 digest of a file's contents
+struct Sha1Hasher {
   using HashValue = std::array<uint8_t, 20>;
-  using Node = LRUCache<ContentHashCacheKey, HashValue>::NodeType;
+  static HashValue hashFile(const char* fullPath);
+};
+
+// Computes the 128 bit SpookyHash V2 of a file's contents.  It is not a
+// cryptographic digest, but it is several times faster to compute than
+// SHA-1, and is good enough to tell that the content has changed.
+struct Spooky128Hasher {
+  using HashValue = std::array<uint8_t, 16>;
+  static HashValue hashFile(const char* fullPath);
+};
+
+// Caches the hash of file contents, as computed by Hasher.
+// It is instantiated for the hashers above in ContentHash.cpp.
+template <typename Hasher>
+class BasicContentHashCache {
+ public:
+  using HashValue = typename Hasher::HashValue;
+  using Node =
+      typename ShardedLRUCache<ContentHashCacheKey, HashValue>::NodeType;
 
   // Construct a cache for a given root, holding the specified
   // maximum number of items, using the configured negative
-  // caching TTL.
-  ContentHashCache(
+  // caching TTL.  At most maxConcurrency hashes are computed
+  // at the same time; the rest wait their turn in a queue.
+  // If store is given, hashes are looked up in it before the
+  // file is read, and added to it once computed.  If maxBytes
+  // is not zero, it also limits the approximate memory used by
+  // the cached items.  admission selects which newly computed
+  // hashes are kept once the cache is full.
+  BasicContentHashCache(
       const w_string& rootPath,
       size_t maxItems,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      size_t maxConcurrency,
+      std::shared_ptr<ContentHashStore> store = nullptr,
+      size_t maxBytes = 0,
+      CacheAdmission admission = CacheAdmission::All);
 
   // Obtain the content hash for the given input.
   // If the result is in the cache it will return a ready future
@@ -57,6 +92,11 @@ class ContentHashCache {
   folly::Future<std::shared_ptr<const Node>> get(
       const ContentHashCacheKey& key);
 
+  // Like get, but a hash that isn't cached is computed on the calling
+  // thread, rather than in the thread pool.  Returns true if it had to be
+  // computed.
+  bool warm(const ContentHashCacheKey& key);
+
   // Compute the hash value for a given input.
   // This will block the calling thread while the I/O is performed.
   // Throws exceptions for any errors that may occur.
@@ -67,7 +107,8 @@ class ContentHashCache {
   // Throws exceptions for any errors that may occur.
   static HashValue computeHashImmediate(const char* fullPath);
 
-  // Compute the hash value for a given input via the thread pool.
+  // Compute the hash value for a given input via the thread pool,
+  // using no more than maxConcurrency of its workers.
   // Returns a future to operate on the result of this async operation
   folly::Future<HashValue> computeHash(const ContentHashCacheKey& key) const;
 
@@ -77,8 +118,33 @@ class ContentHashCache {
   // Returns cache statistics
   CacheStats stats() const;
 
+  // Erases the errors that have outlived their TTL; returns how many
+  size_t eraseExpired();
+
  private:
-  LRUCache<ContentHashCacheKey, HashValue> cache_;
+  struct PendingHash {
+    ContentHashCacheKey key;
+    folly::Promise<HashValue> promise;
+  };
+  struct HashQueue {
+    // The number of workers that are hashing files
+    size_t running{0};
+    std::deque<PendingHash> pending;
+  };
+
+  // Hashes job, then whatever is pending, on the calling thread
+  void runHashWorker(PendingHash job) const;
+
+  ShardedLRUCache<ContentHashCacheKey, HashValue> cache_;
   w_string rootPath_;
+  size_t maxConcurrency_;
+  std::shared_ptr<ContentHashStore> store_;
+  mutable folly::Synchronized<HashQueue> queue_;
 };
+
+extern template class BasicContentHashCache<Sha1Hasher>;
+extern template class BasicContentHashCache<Spooky128Hasher>;
+
+using ContentHashCache = BasicContentHashCache<Sha1Hasher>;
+using Spooky128HashCache = BasicContentHashCache<Spooky128Hasher>;
 } // namespace watchman
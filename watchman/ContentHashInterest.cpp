@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHashInterest.h"
+#include <algorithm>
+
+namespace watchman {
+
+namespace {
+
+// dirName and suffix return a null piece when there is none
+w_string keyOf(w_string_piece piece) {
+  return piece.size() ? piece.asWString() : w_string{""};
+}
+
+} // namespace
+
+ContentHashInterest::ContentHashInterest(size_t maxEntries)
+    : maxEntries_{std::max(maxEntries, size_t(1))} {}
+
+void ContentHashInterest::bump(Counts& counts, w_string name) const {
+  auto it = counts.find(name);
+  if (it != counts.end()) {
+    if (it->second < UINT32_MAX) {
+      ++it->second;
+    }
+    return;
+  }
+
+  if (counts.size() >= maxEntries_) {
+    for (auto entry = counts.begin(); entry != counts.end();) {
+      entry->second /= 2;
+      if (entry->second == 0) {
+        entry = counts.erase(entry);
+      } else {
+        ++entry;
+      }
+    }
+    if (counts.size() >= maxEntries_) {
+      // Everything else is asked about more often
+      return;
+    }
+  }
+  counts.emplace(std::move(name), 1);
+}
+
+void ContentHashInterest::noteRequested(
+    const std::vector<w_string>& relativePaths) {
+  if (relativePaths.empty()) {
+    return;
+  }
+  auto state = state_.wlock();
+  for (auto& path : relativePaths) {
+    auto piece = path.piece();
+    bump(state->dirs, keyOf(piece.dirName()));
+    bump(state->suffixes, keyOf(piece.baseName().suffix()));
+  }
+}
+
+bool ContentHashInterest::isWanted(
+    w_string_piece relativeDir,
+    w_string_piece name) const {
+  auto state = state_.rlock();
+  if (state->suffixes.find(keyOf(name.suffix())) == state->suffixes.end()) {
+    return false;
+  }
+
+  if (relativeDir.size() == 0) {
+    return state->dirs.find(w_string{""}) != state->dirs.end();
+  }
+  for (auto dir = relativeDir; dir.size() > 0; dir = dir.dirName()) {
+    if (state->dirs.find(keyOf(dir)) != state->dirs.end()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t ContentHashInterest::numDirs() const {
+  return state_.rlock()->dirs.size();
+}
+
+size_t ContentHashInterest::numSuffixes() const {
+  return state_.rlock()->suffixes.size();
+}
+
+} // namespace watchman
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Learns which dirs and suffixes clients ask for the content hashes of, so
+ * that warming the content hash cache after a settle can skip the files
+ * that no client is going to ask about.
+ *
+ * A file is wanted if a client has asked about a file with the same suffix,
+ * and about one in the same dir or in a dir that encloses it. The root dir
+ * only counts for the files directly in it, so that asking about a file at
+ * the top of the root doesn't make every file wanted.
+ *
+ * Each of the dirs and suffixes counts up to maxEntries of them. When one
+ * is full, every count is halved and those that reach zero are forgotten,
+ * so that interest which isn't renewed fades.
+ */
+class ContentHashInterest {
+ public:
+  explicit ContentHashInterest(size_t maxEntries = 1024);
+
+  /**
+   * Records that a client asked for the content hashes of the files at the
+   * given paths, relative to the root.
+   */
+  void noteRequested(const std::vector<w_string>& relativePaths);
+
+  /**
+   * Whether the file called name, in the dir at relativeDir, is like the
+   * files that clients have asked about. Nothing is wanted until a client
+   * has asked about something.
+   */
+  bool isWanted(w_string_piece relativeDir, w_string_piece name) const;
+
+  size_t numDirs() const;
+  size_t numSuffixes() const;
+
+ private:
+  using Counts = std::unordered_map<w_string, uint32_t>;
+  struct State {
+    Counts dirs;
+    Counts suffixes;
+  };
+
+  void bump(Counts& counts, w_string name) const;
+
+  const size_t maxEntries_;
+  folly::Synchronized<State> state_;
+};
+
+} // namespace watchman
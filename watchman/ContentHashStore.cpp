@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHashStore.h"
+#include <fmt/core.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <folly/portability/Fcntl.h>
+#include <folly/portability/Unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include "watchman/ContentHash.h"
+#include "watchman/Logging.h"
+#include "watchman/watchman_stream.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[4] = {'W', 'M', 'C', 'H'};
+constexpr uint32_t kVersion = 1;
+
+constexpr char kHashRecord = 'H';
+constexpr char kEndRecord = 'E';
+
+// Bounds each write, whose size is passed as an int.
+constexpr size_t kMaxWrite = 1024 * 1024;
+
+// Like the tick index, the store is only ever read back on the machine that
+// wrote it, so values are stored in native byte order.
+template <typename T>
+void put(std::string& buf, T value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putString(std::string& buf, w_string_piece str) {
+  put<uint32_t>(buf, static_cast<uint32_t>(str.size()));
+  buf.append(str.data(), str.size());
+}
+
+class Cursor {
+ public:
+  explicit Cursor(const std::string& data) : data_(data) {}
+
+  void read(void* buf, size_t size) {
+    if (data_.size() - pos_ < size) {
+      throw std::runtime_error("malformed content hash store: truncated");
+    }
+    memcpy(buf, data_.data() + pos_, size);
+    pos_ += size;
+  }
+
+  template <typename T>
+  T read() {
+    T value;
+    read(&value, sizeof(value));
+    return value;
+  }
+
+  std::string readBytes(size_t size) {
+    std::string str(size, '\0');
+    read(str.data(), size);
+    return str;
+  }
+
+  w_string readString() {
+    auto str = readBytes(read<uint32_t>());
+    return w_string{str.data(), str.size()};
+  }
+
+ private:
+  const std::string& data_;
+  size_t pos_{0};
+};
+
+} // namespace
+
+ContentHashStore::ContentHashStore(
+    w_string path,
+    w_string rootPath,
+    size_t hashSize,
+    size_t maxItems)
+    : path_(std::move(path)),
+      rootPath_(std::move(rootPath)),
+      hashSize_(hashSize),
+      maxItems_(maxItems) {}
+
+void ContentHashStore::load(State& state) const {
+  state.loaded = true;
+
+  std::string data;
+  if (!folly::readFile(path_.c_str(), data)) {
+    if (errno != ENOENT) {
+      logf(
+          ERR,
+          "unable to load content hashes {}: {}\n",
+          path_,
+          folly::errnoStr(errno));
+    }
+    return;
+  }
+
+  try {
+    Cursor cursor{data};
+    char magic[sizeof(kMagic)];
+    cursor.read(magic, sizeof(magic));
+    if (memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+      throw std::runtime_error("malformed content hash store: bad magic");
+    }
+    auto version = cursor.read<uint32_t>();
+    if (version != kVersion) {
+      throw std::runtime_error(
+          fmt::format("unsupported content hash store version {}", version));
+    }
+    auto rootPath = cursor.readString();
+    if (rootPath != rootPath_) {
+      logf(
+          ERR,
+          "ignoring content hashes {}: they were written for {}\n",
+          path_,
+          rootPath);
+      return;
+    }
+    if (cursor.read<uint32_t>() != hashSize_) {
+      throw std::runtime_error("malformed content hash store: hash size");
+    }
+
+    while (true) {
+      auto type = cursor.read<char>();
+      if (type == kEndRecord) {
+        break;
+      }
+      if (type != kHashRecord) {
+        throw std::runtime_error(
+            "malformed content hash store: unknown record type");
+      }
+      auto name = cursor.readString();
+      Entry entry;
+      entry.fileSize = cursor.read<uint64_t>();
+      entry.mtime.tv_sec = cursor.read<int64_t>();
+      entry.mtime.tv_nsec = cursor.read<int64_t>();
+      entry.ino = cursor.read<uint64_t>();
+      entry.dev = cursor.read<uint64_t>();
+      entry.hash = cursor.readBytes(hashSize_);
+      entry.used = false;
+      state.entries.emplace(std::move(name), std::move(entry));
+    }
+  } catch (const std::exception& exc) {
+    logf(ERR, "unable to load content hashes {}: {}\n", path_, exc.what());
+    state.entries.clear();
+  }
+}
+
+bool ContentHashStore::lookup(
+    const ContentHashCacheKey& key,
+    uint64_t ino,
+    uint64_t dev,
+    uint8_t* hash) {
+  auto state = state_.wlock();
+  if (!state->loaded) {
+    load(*state);
+  }
+
+  auto it = state->entries.find(key.relativePath);
+  if (it == state->entries.end()) {
+    return false;
+  }
+  auto& entry = it->second;
+  if (entry.fileSize != key.fileSize ||
+      entry.mtime.tv_sec != key.mtime.tv_sec ||
+      entry.mtime.tv_nsec != key.mtime.tv_nsec || entry.ino != ino ||
+      entry.dev != dev) {
+    // The file has changed since the entry was written
+    state->entries.erase(it);
+    state->dirty = true;
+    return false;
+  }
+  entry.used = true;
+  memcpy(hash, entry.hash.data(), hashSize_);
+  return true;
+}
+
+void ContentHashStore::insert(
+    const ContentHashCacheKey& key,
+    uint64_t ino,
+    uint64_t dev,
+    const uint8_t* hash) {
+  auto state = state_.wlock();
+  state->entries.insert_or_assign(
+      key.relativePath,
+      Entry{
+          key.fileSize,
+          key.mtime,
+          ino,
+          dev,
+          std::string(reinterpret_cast<const char*>(hash), hashSize_),
+          true});
+  state->dirty = true;
+}
+
+void ContentHashStore::save() {
+  std::lock_guard<std::mutex> saving{saveMutex_};
+
+  std::string buffer;
+  {
+    auto state = state_.wlock();
+    if (!state->dirty) {
+      return;
+    }
+    state->dirty = false;
+
+    buffer.append(kMagic, sizeof(kMagic));
+    put<uint32_t>(buffer, kVersion);
+    putString(buffer, rootPath_);
+    put<uint32_t>(buffer, static_cast<uint32_t>(hashSize_));
+
+    // Those used by this watch first, then whatever else fits.
+    size_t count = 0;
+    for (bool used : {true, false}) {
+      for (auto& [name, entry] : state->entries) {
+        if (entry.used != used || count >= maxItems_) {
+          continue;
+        }
+        buffer.push_back(kHashRecord);
+        putString(buffer, name);
+        put<uint64_t>(buffer, entry.fileSize);
+        put<int64_t>(buffer, entry.mtime.tv_sec);
+        put<int64_t>(buffer, entry.mtime.tv_nsec);
+        put<uint64_t>(buffer, entry.ino);
+        put<uint64_t>(buffer, entry.dev);
+        buffer.append(entry.hash);
+        ++count;
+      }
+    }
+    buffer.push_back(kEndRecord);
+  }
+
+  auto tempPath = w_string::build(path_, ".tmp");
+  try {
+    auto stream = w_stm_open(
+        tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (!stream) {
+      throw std::system_error(
+          errno,
+          std::generic_category(),
+          fmt::format("unable to open {} for write", tempPath));
+    }
+    size_t pos = 0;
+    while (pos < buffer.size()) {
+      int res = stream->write(
+          buffer.data() + pos,
+          static_cast<int>(std::min(buffer.size() - pos, kMaxWrite)));
+      if (res <= 0) {
+        throw std::system_error(
+            errno,
+            std::generic_category(),
+            fmt::format("writing to {}", tempPath));
+      }
+      pos += res;
+    }
+    stream.reset();
+
+    if (rename(tempPath.c_str(), path_.c_str()) != 0) {
+      // Windows will not rename over an existing file.
+      (void)unlink(path_.c_str());
+      if (rename(tempPath.c_str(), path_.c_str()) != 0) {
+        throw std::system_error(
+            errno,
+            std::generic_category(),
+            fmt::format("renaming {} to {}", tempPath, path_));
+      }
+    }
+  } catch (const std::exception& exc) {
+    logf(ERR, "failed to save content hashes {}: {}\n", path_, exc.what());
+    (void)unlink(tempPath.c_str());
+    state_.wlock()->dirty = true;
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+struct ContentHashCacheKey;
+
+/**
+ * Keeps the content hashes computed for a root in a file alongside its state
+ * file, so that the next watch of the root, for example after the server
+ * restarts, can reuse them rather than reading every file again. An entry is
+ * only used if the size, mtime, inode and device of the file are all
+ * unchanged.
+ *
+ * The file is read the first time that an entry is looked up, and is
+ * rewritten by save() if entries have been added since. Entries that were
+ * looked up or added are kept in preference to the others, up to maxItems.
+ */
+class ContentHashStore {
+ public:
+  ContentHashStore(
+      w_string path,
+      w_string rootPath,
+      size_t hashSize,
+      size_t maxItems);
+
+  /**
+   * Copies the stored hash for key to hash, which must hold hashSize bytes,
+   * and returns true, if the file with the given inode and device matches
+   * the stored entry.
+   */
+  bool lookup(
+      const ContentHashCacheKey& key,
+      uint64_t ino,
+      uint64_t dev,
+      uint8_t* hash);
+
+  void insert(
+      const ContentHashCacheKey& key,
+      uint64_t ino,
+      uint64_t dev,
+      const uint8_t* hash);
+
+  /**
+   * Writes the store if it has changed since it was read or last written.
+   * Failures are logged.
+   */
+  void save();
+
+ private:
+  struct Entry {
+    size_t fileSize;
+    struct timespec mtime;
+    uint64_t ino;
+    uint64_t dev;
+    std::string hash;
+    // Looked up or added by this watch of the root
+    bool used;
+  };
+  struct State {
+    bool loaded{false};
+    bool dirty{false};
+    std::unordered_map<w_string, Entry> entries;
+  };
+
+  void load(State& state) const;
+
+  const w_string path_;
+  const w_string rootPath_;
+  const size_t hashSize_;
+  const size_t maxItems_;
+  folly::Synchronized<State> state_;
+  // Serializes writers of the file.
+  std::mutex saveMutex_;
+};
+
+} // namespace watchman
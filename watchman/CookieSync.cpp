@@ -7,15 +7,75 @@
 
 #include "watchman/CookieSync.h"
 #include <folly/String.h>
+#include <condition_variable>
 #include <exception>
 #include <optional>
 #include "watchman/Logging.h"
+#include "watchman/ThreadPool.h"
 #include "watchman/watchman_stream.h"
 #include "watchman/watchman_system.h"
 
 namespace watchman {
 
-CookieSync::Cookie::Cookie(uint64_t numCookies) : numPending(numCookies) {}
+namespace {
+// An outstanding cookie that hasn't been observed within this may have been
+// lost, so callers stop waiting for it before writing their own.
+constexpr std::chrono::milliseconds kMaxOutstandingCookieWait{200};
+
+bool isAtOrBelow(w_string_piece path, w_string_piece dir) {
+  return path == dir ||
+      (path.size() > dir.size() && path.startsWith(dir) &&
+       is_slash(path.data()[dir.size()]));
+}
+
+// Touches each of paths, returning the error, if any, of each. Several are
+// written at once, on the thread pool as well as on this thread, so that a
+// slow filesystem doesn't make a sync wait for the sum of them. This thread
+// takes whichever the pool has yet to start, so a busy pool only makes it
+// slower.
+std::vector<std::optional<std::system_error>> touchAll(
+    FileSystem& fs,
+    const std::vector<w_string>& paths) {
+  struct State {
+    explicit State(size_t n) : errors(n) {}
+
+    std::atomic<size_t> next{0};
+    std::vector<std::optional<std::system_error>> errors;
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t done{0};
+  };
+  auto state = std::make_shared<State>(paths.size());
+  // fs and paths are only used while this thread waits for done
+  auto touchNext = [state, &fs, &paths] {
+    size_t i;
+    while ((i = state->next.fetch_add(1)) < paths.size()) {
+      try {
+        fs.touch(paths[i].c_str());
+      } catch (const std::system_error& e) {
+        state->errors[i] = e;
+      }
+      std::lock_guard<std::mutex> lock{state->mutex};
+      if (++state->done == paths.size()) {
+        state->cond.notify_all();
+      }
+    }
+  };
+
+  for (size_t i = 1; i < paths.size(); ++i) {
+    try {
+      getThreadPool().add(touchNext);
+    } catch (const std::exception&) {
+      break;
+    }
+  }
+  touchNext();
+
+  std::unique_lock<std::mutex> lock{state->mutex};
+  state->cond.wait(lock, [&] { return state->done == paths.size(); });
+  return std::move(state->errors);
+}
+} // namespace
 
 CookieSync::CookieSync(FileSystem& fs, const w_string& dir) : fileSystem_{fs} {
   char hostname[256];
@@ -31,6 +91,10 @@ CookieSync::CookieSync(FileSystem& fs, const w_string& dir) : fileSystem_{fs} {
 
 CookieSync::~CookieSync() {
   // Wake up anyone that might have been waiting on us
+  if (auto next = std::move(batch_.lock()->next)) {
+    next->promise.setException(
+        folly::make_exception_wrapper<CookieSyncAborted>());
+  }
   abortAllCookies();
 }
 
@@ -44,22 +108,38 @@ void CookieSync::removeCookieDir(const w_string& dir) {
     auto guard = cookieDirs_.wlock();
     guard->dirs_.erase(dir);
   }
+  latencies_.wlock()->erase(dir);
 
   // Cancel the cookies in the removed directory. These are considered to be
-  // serviced.
-  auto cookies = cookies_.wlock();
-  for (const auto& [cookiePath, cookie] : *cookies) {
-    if (w_string_startswith(cookiePath, dir)) {
-      cookie->notify();
-      cookies->erase(cookiePath);
+  // serviced. They are notified once cookies_ is released, as that may
+  // write the next cookie.
+  std::vector<std::shared_ptr<Cookie>> serviced;
+  {
+    auto cookies = cookies_.wlock();
+    for (auto it = cookies->begin(); it != cookies->end();) {
+      if (w_string_startswith(it->first, dir)) {
+        serviced.push_back(std::move(it->second));
+        it = cookies->erase(it);
+      } else {
+        ++it;
+      }
     }
   }
+  for (auto& cookie : serviced) {
+    cookie->notify();
+  }
 }
 
 void CookieSync::setCookieDir(const w_string& dir) {
-  auto guard = cookieDirs_.wlock();
-  guard->dirs_.clear();
-  guard->dirs_.insert(dir);
+  {
+    auto guard = cookieDirs_.wlock();
+    guard->dirs_.clear();
+    guard->dirs_.insert(dir);
+  }
+  auto latencies = latencies_.wlock();
+  for (auto it = latencies->begin(); it != latencies->end();) {
+    it = it->first == dir ? std::next(it) : latencies->erase(it);
+  }
 }
 
 std::vector<w_string> CookieSync::getOutstandingCookieFileList() const {
@@ -71,11 +151,47 @@ std::vector<w_string> CookieSync::getOutstandingCookieFileList() const {
   return result;
 }
 
-folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
-  auto prefixes = cookiePrefix();
+folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync(
+    const std::vector<w_string>& scope) {
+  auto dirs = dirsCovering(scope);
+  auto batch = batch_.lock();
+  if (!batch->next) {
+    batch->next = std::make_shared<Cookie>();
+    batch->next->dirs = std::move(dirs);
+  } else if (!dirs) {
+    batch->next->dirs.reset();
+  } else if (batch->next->dirs) {
+    batch->next->dirs->insert(dirs->begin(), dirs->end());
+  }
+  auto cookie = batch->next;
+  auto future = cookie->promise.getSemiFuture().deferValue(
+      [cookie](folly::Unit) { return SyncResult{cookie->fileNames}; });
+
+  if (batch->outstandingSince &&
+      std::chrono::steady_clock::now() - *batch->outstandingSince <
+          kMaxOutstandingCookieWait) {
+    // writeNextCookie will write it.
+    return future;
+  }
+
+  batch->next.reset();
+  try {
+    writeCookie(*batch, cookie);
+  } catch (const std::system_error&) {
+    cookie->promise.setException(
+        folly::exception_wrapper{std::current_exception()});
+    throw;
+  }
+  return future;
+}
+
+void CookieSync::writeCookie(
+    Batch& batch,
+    const std::shared_ptr<Cookie>& cookie) {
+  auto prefixes = cookiePrefixFor(cookie->dirs);
   auto serial = serial_++;
 
-  auto cookie = std::make_shared<Cookie>(prefixes.size());
+  cookie->numPending.store(prefixes.size(), std::memory_order_release);
 
   // Even though we only write to the cookie at the end of the function, we
   // need to hold it while the files are written on disk to avoid a race where
@@ -87,23 +203,23 @@ folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
   CookieMap pendingCookies;
   std::optional<std::tuple<w_string, int>> lastError;
 
-  std::vector<w_string> cookieFileNames;
-  cookieFileNames.reserve(prefixes.size());
+  cookie->fileNames.reserve(prefixes.size());
   for (const auto& prefix : prefixes) {
-    auto path_str = w_string::build(prefix, serial);
-    cookieFileNames.push_back(path_str);
+    cookie->fileNames.push_back(w_string::build(prefix, serial));
+  }
+  cookie->writtenAt = std::chrono::steady_clock::now();
+  auto errors = touchAll(fileSystem_, cookie->fileNames);
 
-    /* then touch the file */
-    try {
-      fileSystem_.touch(path_str.c_str());
-    } catch (const std::system_error& e) {
-      lastError = {path_str, e.code().value()};
+  for (size_t i = 0; i < prefixes.size(); ++i) {
+    const auto& path_str = cookie->fileNames[i];
+    if (const auto& e = errors[i]) {
+      lastError = {path_str, e->code().value()};
       cookie->numPending.fetch_sub(1, std::memory_order_acq_rel);
       logf(
           ERR,
           "sync cookie {} couldn't be created: {}\n",
           path_str,
-          folly::errnoStr(e.code().value()));
+          folly::errnoStr(e->code().value()));
       continue;
     }
 
@@ -125,22 +241,39 @@ folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
             folly::errnoStr(errCode)));
   }
 
+  // Attached while cookies_ is held, so that the cookie can't already have
+  // been observed and run this inline, under batch_.
+  cookie->promise.getSemiFuture().toUnsafeFuture().thenTry(
+      [this](folly::Try<folly::Unit>&&) { writeNextCookie(); });
+  batch.outstandingSince = std::chrono::steady_clock::now();
+
   cookiesLock->insert(pendingCookies.begin(), pendingCookies.end());
+}
 
-  return cookie->promise.getSemiFuture().deferValue(
-      [cookieFileNames = std::move(cookieFileNames)](folly::Unit) mutable {
-        return SyncResult{std::move(cookieFileNames)};
-      });
+void CookieSync::writeNextCookie() {
+  auto batch = batch_.lock();
+  batch->outstandingSince.reset();
+  auto cookie = std::move(batch->next);
+  if (!cookie) {
+    return;
+  }
+  try {
+    writeCookie(*batch, cookie);
+  } catch (const std::system_error&) {
+    cookie->promise.setException(
+        folly::exception_wrapper{std::current_exception()});
+  }
 }
 
 CookieSync::SyncResult CookieSync::syncToNow(
-    std::chrono::milliseconds timeout) {
+    std::chrono::milliseconds timeout,
+    const std::vector<w_string>& scope) {
   /* compute deadline */
   using namespace std::chrono;
   auto deadline = system_clock::now() + timeout;
 
   while (true) {
-    auto cookieFuture = sync();
+    auto cookieFuture = sync(scope);
 
     folly::Try<SyncResult> result;
     try {
@@ -214,6 +347,18 @@ void CookieSync::notifyCookie(const w_string& path) {
   }
 
   if (cookie) {
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - cookie->writtenAt);
+    {
+      auto dir = path.dirName();
+      auto latencies = latencies_.wlock();
+      auto& stats = (*latencies)[dir];
+      stats.dir = dir;
+      ++stats.observed;
+      stats.last = latency;
+      stats.max = std::max(stats.max, latency);
+      stats.total += latency;
+    }
     cookie->notify();
 
     // The file may not exist at this point; we're just taking this
@@ -253,6 +398,61 @@ std::unordered_set<w_string> CookieSync::cookiePrefix() const {
   return res;
 }
 
+std::optional<std::unordered_set<w_string>> CookieSync::dirsCovering(
+    const std::vector<w_string>& scope) const {
+  if (scope.empty()) {
+    return std::nullopt;
+  }
+  std::unordered_set<w_string> covering;
+  auto guard = cookieDirs_.rlock();
+  for (const auto& path : scope) {
+    const w_string* deepest = nullptr;
+    for (const auto& dir : guard->dirs_) {
+      if (isAtOrBelow(path, dir)) {
+        if (!deepest || dir.size() > deepest->size()) {
+          deepest = &dir;
+        }
+      } else if (isAtOrBelow(dir, path)) {
+        // Its watch sees the changes below it, which are part of the scope
+        covering.insert(dir);
+      }
+    }
+    if (!deepest) {
+      // As for a cookie dir that is only used for cookies, such as the VCS
+      // dir of a root
+      return std::nullopt;
+    }
+    covering.insert(*deepest);
+  }
+  return covering;
+}
+
+std::vector<w_string> CookieSync::cookiePrefixFor(
+    const std::optional<std::unordered_set<w_string>>& dirs) const {
+  std::vector<w_string> res;
+  auto guard = cookieDirs_.rlock();
+  for (const auto& dir : guard->dirs_) {
+    if (!dirs || dirs->count(dir)) {
+      res.push_back(w_string::build(dir, "/", guard->cookiePrefix_));
+    }
+  }
+  if (res.empty() && dirs) {
+    // The dirs were removed since the scope was resolved
+    for (const auto& dir : guard->dirs_) {
+      res.push_back(w_string::build(dir, "/", guard->cookiePrefix_));
+    }
+  }
+  return res;
+}
+
+std::vector<CookieSync::DirLatency> CookieSync::getDirLatencies() const {
+  std::vector<DirLatency> res;
+  for (const auto& [dir, stats] : *latencies_.rlock()) {
+    res.push_back(stats);
+  }
+  return res;
+}
+
 std::unordered_set<w_string> CookieSync::cookieDirs() const {
   std::unordered_set<w_string> res;
   auto guard = cookieDirs_.rlock();
@@ -8,6 +8,13 @@
 #pragma once
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "watchman/Cookie.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/watchman_string.h"
@@ -26,6 +33,16 @@ class CookieSync {
     std::vector<w_string> cookieFileNames;
   };
 
+  struct DirLatency {
+    w_string dir;
+    // The number of cookies observed in it
+    uint64_t observed{0};
+    // From writing a cookie to observing it
+    std::chrono::microseconds last{0};
+    std::chrono::microseconds max{0};
+    std::chrono::microseconds total{0};
+  };
+
   explicit CookieSync(FileSystem& fs, const w_string& dir);
   ~CookieSync();
 
@@ -44,11 +61,18 @@ class CookieSync {
    * provide such an ordering guarantee, and it's worth flushing all pending
    * notifications to be sure.)
    *
+   * If scope lists the full paths that the caller is about to look at, the
+   * cookies are only written to the cookie dirs whose watches cover them:
+   * for each path, the deepest cookie dir at or above it and every cookie
+   * dir below it. If it is empty, they are written to every cookie dir.
+   *
    * Throws a std::system_error with an ETIMEDOUT
    * error if the timeout expires before we observe the change, or a
    * runtime_error if the root has been deleted or rendered inaccessible.
    */
-  SyncResult syncToNow(std::chrono::milliseconds timeout);
+  SyncResult syncToNow(
+      std::chrono::milliseconds timeout,
+      const std::vector<w_string>& scope = {});
 
   /**
    * Touches a cookie file and returns a Future that will
@@ -58,8 +82,15 @@ class CookieSync {
    * will execute in the context of the IO thread.
    * It is recommended that you minimize the actions performed
    * in that context to avoid holding up the IO thread.
+   *
+   * Concurrent callers share cookies: while a cookie is waiting to be
+   * observed, callers join the next one, which is written once the
+   * outstanding one is observed. However many callers there are, at most
+   * one cookie is outstanding at a time, and each caller's cookie is
+   * written after it called. A shared cookie is written to the cookie dirs
+   * that cover the scopes, as for syncToNow, of all of its callers.
    **/
-  folly::SemiFuture<SyncResult> sync();
+  folly::SemiFuture<SyncResult> sync(const std::vector<w_string>& scope = {});
 
   /* If path is a valid cookie in the map, notify the waiter.
    * Returns true if the path matches the cookie prefix (not just
@@ -87,19 +118,45 @@ class CookieSync {
   // these has an associated waiting client.
   std::vector<w_string> getOutstandingCookieFileList() const;
 
+  // How long the cookies written to each cookie dir took to be observed.
+  std::vector<DirLatency> getDirLatencies() const;
+
  private:
   CookieSync(CookieSync&&) = delete;
   CookieSync& operator=(CookieSync&&) = delete;
 
   struct Cookie {
-    folly::Promise<folly::Unit> promise;
-    std::atomic<uint64_t> numPending;
-
-    explicit Cookie(uint64_t numCookies);
+    folly::SharedPromise<folly::Unit> promise;
+    std::atomic<uint64_t> numPending{0};
+    // The paths of the cookie files, set when they are written.
+    std::vector<w_string> fileNames;
+    // The cookie dirs to write it to, or every one if unset.
+    std::optional<std::unordered_set<w_string>> dirs;
+    std::chrono::steady_clock::time_point writtenAt;
 
     void notify();
   };
 
+  struct Batch {
+    // Joined by the callers of sync() until it is written.
+    std::shared_ptr<Cookie> next;
+    // When the last cookie was written, until it is observed.
+    std::optional<std::chrono::steady_clock::time_point> outstandingSince;
+  };
+
+  // Touches the cookie files for cookie, throwing if none could be.
+  void writeCookie(Batch& batch, const std::shared_ptr<Cookie>& cookie);
+  // Writes batch.next now that the outstanding cookie has been observed.
+  void writeNextCookie();
+
+  // The cookie dirs that cover scope, or std::nullopt for all of them.
+  std::optional<std::unordered_set<w_string>> dirsCovering(
+      const std::vector<w_string>& scope) const;
+  // The prefixes of the cookie files to write to dirs, or to every cookie
+  // dir if it is unset or none of them are still cookie dirs.
+  std::vector<w_string> cookiePrefixFor(
+      const std::optional<std::unordered_set<w_string>>& dirs) const;
+
   struct CookieDirectories {
     // paths to the query cookies directories. A cookie will be written to each
     // of these when calling `sync`.
@@ -115,5 +172,8 @@ class CookieSync {
   std::atomic<uint32_t> serial_{0};
   using CookieMap = std::unordered_map<w_string, std::shared_ptr<Cookie>>;
   folly::Synchronized<CookieMap> cookies_;
+  // Acquired before cookies_.
+  folly::Synchronized<Batch, std::mutex> batch_;
+  folly::Synchronized<std::unordered_map<w_string, DirLatency>> latencies_;
 };
 } // namespace watchman
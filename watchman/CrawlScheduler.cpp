@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CrawlScheduler.h"
+#include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+CrawlScheduler::Slot::~Slot() {
+  if (scheduler_) {
+    scheduler_->release(recrawl_);
+  }
+}
+
+void CrawlScheduler::setMaxConcurrent(size_t maxConcurrent) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  maxConcurrent_ = maxConcurrent;
+  cond_.notify_all();
+}
+
+void CrawlScheduler::setMaxConcurrentRecrawls(size_t maxConcurrent) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  maxConcurrentRecrawls_ = maxConcurrent;
+  cond_.notify_all();
+}
+
+void CrawlScheduler::addRestored(
+    const w_string& rootPath,
+    SystemClock::time_point lastUsed) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto [it, inserted] =
+      restored_.insert_or_assign(rootPath, Restored{lastUsed, nextOrder_++});
+  if (inserted) {
+    numRestored_.fetch_add(1, std::memory_order_release);
+  }
+}
+
+void CrawlScheduler::prioritize(const w_string& rootPath) {
+  if (numRestored_.load(std::memory_order_acquire) == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto it = restored_.find(rootPath);
+  if (it != restored_.end() && !it->second.interactive) {
+    it->second.interactive = true;
+    cond_.notify_all();
+  }
+}
+
+bool CrawlScheduler::mayCrawl(const Restored& restored) const {
+  if (restored.interactive || maxConcurrent_ == 0) {
+    return true;
+  }
+  if (crawling_ >= maxConcurrent_) {
+    return false;
+  }
+  // Only if no more recently used root is waiting too
+  for (auto& [path, other] : restored_) {
+    if (&other != &restored && other.waiting && !other.interactive &&
+        (other.lastUsed > restored.lastUsed ||
+         (other.lastUsed == restored.lastUsed &&
+          other.order < restored.order))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::optional<CrawlScheduler::Slot> CrawlScheduler::acquire(
+    const w_string& rootPath,
+    const std::atomic<bool>& stop,
+    bool recrawl) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  if (recrawl) {
+    return acquireRecrawl(rootPath, stop, lock);
+  }
+  auto it = restored_.find(rootPath);
+  if (it == restored_.end()) {
+    ++crawling_;
+    return Slot{this, false};
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  it->second.waiting = true;
+  // Stopping doesn't notify, so check for it now and then.
+  while (!mayCrawl(it->second)) {
+    if (stop.load(std::memory_order_acquire)) {
+      restored_.erase(it);
+      numRestored_.fetch_sub(1, std::memory_order_release);
+      cond_.notify_all();
+      return std::nullopt;
+    }
+    cond_.wait_for(lock, std::chrono::milliseconds(100));
+  }
+
+  logf(
+      DBG,
+      "crawling restored root {} after waiting {}ms for its turn\n",
+      rootPath,
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+  restored_.erase(it);
+  numRestored_.fetch_sub(1, std::memory_order_release);
+  ++crawling_;
+  return Slot{this, false};
+}
+
+std::optional<CrawlScheduler::Slot> CrawlScheduler::acquireRecrawl(
+    const w_string& rootPath,
+    const std::atomic<bool>& stop,
+    std::unique_lock<std::mutex>& lock) {
+  auto start = std::chrono::steady_clock::now();
+  while (maxConcurrentRecrawls_ > 0 &&
+         recrawling_ >= maxConcurrentRecrawls_) {
+    if (stop.load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    cond_.wait_for(lock, std::chrono::milliseconds(100));
+  }
+
+  logf(
+      DBG,
+      "recrawling {} after waiting {}ms for its turn\n",
+      rootPath,
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+  ++recrawling_;
+  return Slot{this, true};
+}
+
+void CrawlScheduler::release(bool recrawl) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (recrawl) {
+    --recrawling_;
+  } else {
+    --crawling_;
+  }
+  cond_.notify_all();
+}
+
+CrawlScheduler& getCrawlScheduler() {
+  static auto* scheduler = [] {
+    auto* scheduler = new CrawlScheduler;
+    auto maxRecrawls = cfg_get_int("recrawl_concurrency", 1);
+    scheduler->setMaxConcurrentRecrawls(
+        maxRecrawls > 0 ? size_t(maxRecrawls) : 0);
+    return scheduler;
+  }();
+  return *scheduler;
+}
+
+} // namespace watchman
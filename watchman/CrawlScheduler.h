@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Takes turns among the roots restored from the saved state at startup, so
+ * that their full crawls don't all compete at once, and the crawls that a
+ * client is waiting on don't queue behind them.
+ *
+ * At most maxConcurrent crawls run while restored roots are waiting. Those
+ * go in order of when a client last used them before the restart, so that
+ * long idle roots are crawled last. A restored root that a client asks
+ * about, and any root that was not restored, crawls straight away.
+ *
+ * Recrawls, which a watcher that dropped events asks for, also take turns:
+ * at most maxConcurrentRecrawls of them run at once across every root, so
+ * that a root caught in a storm of them doesn't starve the others of IO.
+ */
+class CrawlScheduler {
+ public:
+  using SystemClock = std::chrono::system_clock;
+
+  /**
+   * Releases its turn on destruction.
+   */
+  class Slot {
+   public:
+    Slot(CrawlScheduler* scheduler, bool recrawl)
+        : scheduler_{scheduler}, recrawl_{recrawl} {}
+    Slot(Slot&& other) noexcept
+        : scheduler_{std::exchange(other.scheduler_, nullptr)},
+          recrawl_{other.recrawl_} {}
+    Slot& operator=(Slot&&) = delete;
+    ~Slot();
+
+   private:
+    CrawlScheduler* scheduler_;
+    bool recrawl_;
+  };
+
+  /**
+   * 0 means that restored roots don't wait for a turn.
+   */
+  void setMaxConcurrent(size_t maxConcurrent);
+
+  /**
+   * 0 means that recrawls don't wait for a turn.
+   */
+  void setMaxConcurrentRecrawls(size_t maxConcurrent);
+
+  /**
+   * Marks rootPath as restored, so that its next crawl waits for its turn.
+   * lastUsed is when a client last used it before the restart.
+   */
+  void addRestored(const w_string& rootPath, SystemClock::time_point lastUsed);
+
+  /**
+   * Called when a client uses rootPath. If it is waiting for its turn, it
+   * crawls now.
+   */
+  void prioritize(const w_string& rootPath);
+
+  /**
+   * Waits until rootPath may crawl, and returns its turn. Returns nullopt
+   * if stop becomes true first. recrawl is set for any crawl of rootPath
+   * other than its first.
+   */
+  std::optional<Slot> acquire(
+      const w_string& rootPath,
+      const std::atomic<bool>& stop,
+      bool recrawl = false);
+
+ private:
+  struct Restored {
+    SystemClock::time_point lastUsed;
+    // Breaks ties between roots last used at the same time, in the order of
+    // the saved state.
+    uint64_t order;
+    bool waiting{false};
+    bool interactive{false};
+  };
+
+  bool mayCrawl(const Restored& restored) const;
+  std::optional<Slot> acquireRecrawl(
+      const w_string& rootPath,
+      const std::atomic<bool>& stop,
+      std::unique_lock<std::mutex>& lock);
+  void release(bool recrawl);
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::unordered_map<w_string, Restored> restored_;
+  // So prioritize() needn't lock once the restored roots have all crawled.
+  std::atomic<size_t> numRestored_{0};
+  size_t crawling_{0};
+  size_t maxConcurrent_{0};
+  size_t recrawling_{0};
+  size_t maxConcurrentRecrawls_{0};
+  uint64_t nextOrder_{0};
+};
+
+CrawlScheduler& getCrawlScheduler();
+
+} // namespace watchman
@@ -155,6 +155,15 @@ class QueryExecError : public WatchmanError<QueryExecError> {
   using WatchmanError::WatchmanError;
 };
 
+/**
+ * Thrown when a query runs for longer than its timeout_ms.
+ */
+class QueryTimeoutError : public WatchmanError<QueryTimeoutError> {
+ public:
+  static constexpr const char* prefix = "query failed";
+  using WatchmanError::WatchmanError;
+};
+
 /**
  * Represents an error resolving a root.
  */
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/GitFsmonitor.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+namespace watchman {
+
+namespace {
+
+constexpr size_t kHeaderSize = 4;
+// The largest packet that git reads, header included.
+constexpr size_t kMaxPacketSize = 65520;
+
+int hexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+} // namespace
+
+std::string encodeGitPktLines(std::string_view payload) {
+  constexpr size_t kMaxData = kMaxPacketSize - kHeaderSize;
+  std::string out;
+  out.reserve(
+      payload.size() + (payload.size() / kMaxData + 2) * kHeaderSize);
+  while (!payload.empty()) {
+    auto len = std::min(payload.size(), kMaxData);
+    fmt::format_to(std::back_inserter(out), "{:04x}", len + kHeaderSize);
+    out.append(payload.data(), len);
+    payload.remove_prefix(len);
+  }
+  out.append("0000");
+  return out;
+}
+
+bool decodeGitPktLines(std::string_view& input, std::string& payload) {
+  while (input.size() >= kHeaderSize) {
+    size_t len = 0;
+    for (size_t i = 0; i < kHeaderSize; ++i) {
+      auto digit = hexDigit(input[i]);
+      if (digit < 0) {
+        throw std::runtime_error("malformed pkt-line length");
+      }
+      len = len * 16 + size_t(digit);
+    }
+    if (len == 0) {
+      input.remove_prefix(kHeaderSize);
+      return true;
+    }
+    if (len <= kHeaderSize || len > kMaxPacketSize) {
+      throw std::runtime_error(
+          fmt::format("unexpected pkt-line length {}", len));
+    }
+    if (input.size() < len) {
+      return false;
+    }
+    payload.append(input.data() + kHeaderSize, len - kHeaderSize);
+    input.remove_prefix(len);
+  }
+  return false;
+}
+
+std::string renderGitFsmonitorResponse(
+    std::string_view token,
+    const std::vector<std::string>& paths,
+    bool trivial) {
+  std::string response{token};
+  response.push_back('\0');
+  if (trivial) {
+    response.append("/");
+    response.push_back('\0');
+    return response;
+  }
+  for (auto& path : paths) {
+    response.append(path);
+    response.push_back('\0');
+  }
+  return response;
+}
+
+} // namespace watchman
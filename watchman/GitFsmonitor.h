@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * The wire format of git's builtin fsmonitor daemon, which git talks to
+ * over <worktree>/.git/fsmonitor--daemon.ipc when core.fsmonitor is true.
+ *
+ * Each message is a run of pkt-lines ending with a flush packet. A request
+ * holds the token of the last response that the index recorded, and a
+ * response holds a new token and then the paths that changed since the
+ * requested one, each followed by a NUL.
+ */
+
+// The prefix of the tokens that git's builtin daemon issues; git sends
+// other tokens, such as those of hook versions, when it has none of these.
+constexpr std::string_view kGitFsmonitorTokenPrefix{"builtin:"};
+
+/**
+ * Frames payload as pkt-lines, followed by a flush packet.
+ */
+std::string encodeGitPktLines(std::string_view payload);
+
+/**
+ * Appends the data of the complete pkt-lines at the front of input to
+ * payload, and removes them from input. Returns true once the flush packet
+ * is consumed, and false if more input is needed.
+ *
+ * Throws std::runtime_error if input isn't made of pkt-lines.
+ */
+bool decodeGitPktLines(std::string_view& input, std::string& payload);
+
+/**
+ * Builds the payload of a response. A trivial response, which tells git
+ * that anything may have changed, is sent in place of paths when the
+ * requested token can't be answered for.
+ */
+std::string renderGitFsmonitorResponse(
+    std::string_view token,
+    const std::vector<std::string>& paths,
+    bool trivial);
+
+} // namespace watchman
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/HeapProfile.h"
+#include <atomic>
+
+namespace watchman {
+
+namespace {
+
+std::atomic<size_t> sampleInterval{0};
+
+// Live samples of each tag. The bytes are derived from the interval when they
+// are asked for, so that freeing a value needs only its tag.
+std::array<std::atomic<int64_t>, kNumHeapTags> liveSamples{};
+
+thread_local HeapTag currentTag = HeapTag::Json;
+thread_local int64_t bytesUntilSample = 0;
+
+} // namespace
+
+const char* heapTagName(HeapTag tag) {
+  switch (tag) {
+    case HeapTag::Json:
+      return "json";
+    case HeapTag::View:
+      return "view";
+    case HeapTag::Pending:
+      return "pending";
+    case HeapTag::Caches:
+      return "caches";
+    case HeapTag::Clients:
+      return "clients";
+    case HeapTag::Subscriptions:
+      return "subscriptions";
+  }
+  return "unknown";
+}
+
+HeapTagScope::HeapTagScope(HeapTag tag) : previous_{currentTag} {
+  currentTag = tag;
+}
+
+HeapTagScope::~HeapTagScope() {
+  currentTag = previous_;
+}
+
+void setHeapSampleInterval(size_t bytes) {
+  sampleInterval.store(bytes, std::memory_order_relaxed);
+}
+
+size_t getHeapSampleInterval() {
+  return sampleInterval.load(std::memory_order_relaxed);
+}
+
+uint8_t sampleHeapAllocation(size_t size) {
+  auto interval = int64_t(sampleInterval.load(std::memory_order_relaxed));
+  if (interval == 0) {
+    return 0;
+  }
+  bytesUntilSample -= int64_t(size);
+  if (bytesUntilSample > 0) {
+    return 0;
+  }
+  // Carry over the overshoot, so that the samples stay an interval of bytes
+  // apart.
+  bytesUntilSample = interval - (-bytesUntilSample % interval);
+
+  auto tag = uint8_t(currentTag);
+  liveSamples[tag].fetch_add(1, std::memory_order_relaxed);
+  return tag + 1;
+}
+
+void releaseHeapSample(uint8_t token) {
+  liveSamples[token - 1].fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::array<int64_t, kNumHeapTags> getSampledHeapBytes() {
+  auto interval = int64_t(getHeapSampleInterval());
+  std::array<int64_t, kNumHeapTags> bytes;
+  for (size_t i = 0; i < kNumHeapTags; ++i) {
+    bytes[i] = liveSamples[i].load(std::memory_order_relaxed) * interval;
+  }
+  return bytes;
+}
+
+} // namespace watchman
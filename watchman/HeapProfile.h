@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace watchman {
+
+// A sampling profiler of the JSON values that the server holds on to, for
+// the debug-heap-summary command. It works with any allocator: on average one
+// value is sampled for each heap_sample_interval bytes of values allocated,
+// and each live sample stands for that many bytes of the subsystem that was
+// tagged on the allocating thread when it was made.
+
+enum class HeapTag : uint8_t {
+  // Values made outside of any tagged scope
+  Json,
+  View,
+  Pending,
+  Caches,
+  Clients,
+  Subscriptions,
+};
+
+constexpr size_t kNumHeapTags = 6;
+
+const char* heapTagName(HeapTag tag);
+
+/**
+ * Attributes the values allocated on this thread to tag, until it is
+ * destroyed.
+ */
+class HeapTagScope {
+ public:
+  explicit HeapTagScope(HeapTag tag);
+  ~HeapTagScope();
+
+  HeapTagScope(const HeapTagScope&) = delete;
+  HeapTagScope& operator=(const HeapTagScope&) = delete;
+
+ private:
+  HeapTag previous_;
+};
+
+/**
+ * Sets the average number of bytes allocated between samples. 0, the default,
+ * disables sampling. This is meant to be set once, before any other threads
+ * are started.
+ */
+void setHeapSampleInterval(size_t bytes);
+size_t getHeapSampleInterval();
+
+/**
+ * Called as size bytes are allocated. Returns 0 if the allocation is not
+ * sampled, or else a token that must be passed to releaseHeapSample when it
+ * is freed.
+ */
+uint8_t sampleHeapAllocation(size_t size);
+void releaseHeapSample(uint8_t token);
+
+/**
+ * The estimated live bytes of the sampled allocations of each tag, indexed by
+ * HeapTag.
+ */
+std::array<int64_t, kNumHeapTags> getSampledHeapBytes();
+
+} // namespace watchman
@@ -6,100 +6,206 @@
  */
 
 #include "watchman/IgnoreSet.h"
-
-// The path and everything below it is ignored.
-#define FULL_IGNORE 0x1
-// The grand-children of the path are ignored, but not the path
-// or its direct children.
-#define VCS_IGNORE 0x2
+#include <algorithm>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
 
 namespace watchman {
 
-void IgnoreSet::add(const w_string& path, bool is_vcs_ignore) {
-  (is_vcs_ignore ? ignore_vcs : ignore_dirs).insert(path);
-
-  tree.insert(path, is_vcs_ignore ? VCS_IGNORE : FULL_IGNORE);
+namespace {
 
-  if (!is_vcs_ignore) {
-    dirs_vec.push_back(path);
+const char* findSlash(const char* begin, const char* end) {
+  while (begin != end && !is_slash(*begin)) {
+    ++begin;
   }
+  return begin;
 }
 
-bool IgnoreSet::isIgnored(const char* path, uint32_t pathlen) const {
-  const char* skip_prefix;
-  uint32_t len;
-  auto leaf = tree.longestMatch((const unsigned char*)path, (int)pathlen);
+bool hasWildcard(w_string_piece component) {
+  return std::any_of(
+      component.data(), component.data() + component.size(), [](char c) {
+        return c == '*' || c == '?' || c == '[';
+      });
+}
 
-  if (!leaf) {
-    // No entry -> not ignored.
-    return false;
-  }
+} // namespace
+
+IgnoreSet::IgnoreSet() : nodes_(1) {}
+
+uint32_t IgnoreSet::insert(const w_string& path, size_t globsFrom) {
+  rules_.push_back(path);
+  const char* begin = rules_.back().data();
+  const char* end = begin + rules_.back().size();
+  const char* patterns = begin + std::min(globsFrom, path.size());
+
+  uint32_t node = 0;
+  while (true) {
+    auto sep = findSlash(begin, end);
+    w_string_piece component{begin, size_t(sep - begin)};
+    bool glob = begin >= patterns;
+
+    uint32_t child = 0;
+    if (glob && component == w_string_piece{"**"}) {
+      child = nodes_[node].anyDepthChild;
+      if (!child) {
+        child = uint32_t(nodes_.size());
+        nodes_.emplace_back().anyDepth = true;
+        nodes_[node].anyDepthChild = child;
+      }
+      hasGlobs_ = true;
+    } else if (glob && hasWildcard(component)) {
+      auto& globs = nodes_[node].globs;
+      auto it = std::find_if(globs.begin(), globs.end(), [&](const auto& g) {
+        return w_string_piece{g.first} == component;
+      });
+      if (it != globs.end()) {
+        child = it->second;
+      } else {
+        child = uint32_t(nodes_.size());
+        nodes_.emplace_back();
+        nodes_[node].globs.emplace_back(component.string(), child);
+      }
+      hasGlobs_ = true;
+    } else {
+      auto it = nodes_[node].children.find(component);
+      if (it != nodes_[node].children.end()) {
+        child = it->second;
+      } else {
+        child = uint32_t(nodes_.size());
+        nodes_.emplace_back();
+        nodes_[node].children.emplace(component, child);
+      }
+    }
+    node = child;
 
-  if (pathlen < leaf->key.size()) {
-    // We wanted "buil" but matched "build"
-    return false;
+    if (sep == end) {
+      return node;
+    }
+    begin = sep + 1;
   }
+}
 
-  if (pathlen == leaf->key.size()) {
-    // Exact match.  This is an ignore if we are in FULL_IGNORE,
-    // but not in VCS_IGNORE mode.
-    return leaf->value == FULL_IGNORE ? true : false;
+void IgnoreSet::add(const w_string& path, bool is_vcs_ignore) {
+  auto node = insert(path, path.size() + 1);
+  if (is_vcs_ignore) {
+    nodes_[node].vcsIgnore = true;
+  } else {
+    nodes_[node].fullIgnore = true;
+    dirs_vec.push_back(path);
   }
+}
 
-  // Our input string was longer than the leaf key string.
-  // We need to ensure that we observe a directory separator at the
-  // character after the common prefix, otherwise we may be falsely
-  // matching a sibling entry.
-  skip_prefix = path + leaf->key.size();
-  len = pathlen - leaf->key.size();
-
-  if (!is_slash(*skip_prefix)) {
-    // we wanted "foo/bar" but we matched something like "food"
-    // this is not an ignore situation.
-    return false;
+void IgnoreSet::addGlob(const w_string& root, const w_string& pattern) {
+  if (root.empty()) {
+    nodes_[insert(pattern, 0)].fullIgnore = true;
+  } else {
+    nodes_[insert(w_string::pathCat({root, pattern}), root.size() + 1)]
+        .fullIgnore = true;
   }
+}
 
-  if (leaf->value == FULL_IGNORE) {
-    // Definitely ignoring this portion of the tree
-    return true;
+template <typename Visit>
+bool IgnoreSet::walk(w_string_piece path, Visit visit) const {
+  const char* begin = path.data();
+  const char* end = begin + path.size();
+
+  if (!hasGlobs_) {
+    // The common case: follow a single chain of literal components.
+    uint32_t node = 0;
+    while (true) {
+      auto sep = findSlash(begin, end);
+      auto& children = nodes_[node].children;
+      auto it = children.find(w_string_piece{begin, size_t(sep - begin)});
+      if (it == children.end()) {
+        return false;
+      }
+      node = it->second;
+      if (visit(nodes_[node], sep, end)) {
+        return true;
+      }
+      if (sep == end) {
+        return false;
+      }
+      begin = sep + 1;
+    }
   }
 
-  // we need to apply vcs_ignore style logic to determine if we are ignoring
-  // this path.  This devolves to: "is there a '/' character after the end of
-  // the leaf key prefix?"
-
-  if (pathlen <= leaf->key.size()) {
-    // There can't be a slash after this portion of the tree, therefore
-    // this is not ignored.
-    return false;
-  }
+  std::vector<uint32_t> active;
+  std::vector<uint32_t> next;
+  std::string text;
+  // Follows the "**" components that node leads to, which match nothing.
+  auto activate = [&](uint32_t node) {
+    next.push_back(node);
+    while ((node = nodes_[node].anyDepthChild) != 0) {
+      next.push_back(node);
+    }
+  };
+  // The root can lead to "**" too.
+  activate(0);
+  std::swap(active, next);
+
+  while (!active.empty()) {
+    auto sep = findSlash(begin, end);
+    w_string_piece component{begin, size_t(sep - begin)};
+    text.assign(component.data(), component.size());
+
+    next.clear();
+    for (auto node : active) {
+      auto& n = nodes_[node];
+      auto it = n.children.find(component);
+      if (it != n.children.end()) {
+        activate(it->second);
+      }
+      for (auto& [pattern, child] : n.globs) {
+        if (wildmatch(pattern.c_str(), text.c_str(), 0, nullptr) ==
+            WM_MATCH) {
+          activate(child);
+        }
+      }
+      if (n.anyDepth) {
+        activate(node);
+      }
+    }
+    std::sort(next.begin(), next.end());
+    next.erase(std::unique(next.begin(), next.end()), next.end());
 
-  // Skip over the '/'
-  skip_prefix++;
-  len--;
-
-#ifndef _WIN32
-  // If we find a '/' from this point, we are ignoring this path.
-  return memchr(skip_prefix, '/', len) != nullptr;
-#else
-  // On windows, both '/' and '\' are possible.
-  while (len > 0) {
-    if (is_slash(*skip_prefix)) {
-      return true;
+    for (auto node : next) {
+      if (visit(nodes_[node], sep, end)) {
+        return true;
+      }
+    }
+    if (sep == end) {
+      return false;
     }
-    skip_prefix++;
-    len--;
+    begin = sep + 1;
+    std::swap(active, next);
   }
   return false;
-#endif
 }
 
-bool IgnoreSet::isIgnoreVCS(const w_string& path) const {
-  return ignore_vcs.find(path) != ignore_vcs.end();
+bool IgnoreSet::isIgnored(const char* path, uint32_t pathlen) const {
+  return walk(
+      w_string_piece{path, pathlen},
+      [](const Node& node, const char* sep, const char* end) {
+        if (node.fullIgnore) {
+          // Definitely ignoring this portion of the tree
+          return true;
+        }
+        // The grandchildren of a vcs dir are ignored: is there another
+        // separator after the one that ends the vcs dir?
+        return node.vcsIgnore && sep != end && findSlash(sep + 1, end) != end;
+      });
+}
+
+bool IgnoreSet::isIgnoreVCS(w_string_piece path) const {
+  return walk(path, [](const Node& node, const char* sep, const char* end) {
+    return sep == end && node.vcsIgnore;
+  });
 }
 
-bool IgnoreSet::isIgnoreDir(const w_string& path) const {
-  return ignore_dirs.find(path) != ignore_dirs.end();
+bool IgnoreSet::isIgnoreDir(w_string_piece path) const {
+  return walk(path, [](const Node& node, const char* sep, const char* end) {
+    return sep == end && node.fullIgnore;
+  });
 }
 
 } // namespace watchman
@@ -7,41 +7,86 @@
 
 #pragma once
 
-#include <unordered_set>
-#include "watchman/thirdparty/libart/src/art.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include "watchman/watchman_string.h"
 
 namespace watchman {
 
+/**
+ * The ignore_dirs, ignore_globs and ignore_vcs rules of a root, compiled
+ * into a trie of path components. Testing a path walks it once, component
+ * by component, without copying it, so it costs O(depth) however many rules
+ * there are. The same trie is used on every platform.
+ */
 class IgnoreSet {
  public:
+  IgnoreSet();
+
   // Adds a string to the ignore list.
   // The is_vcs_ignore parameter indicates whether it is a full ignore
   // or a vcs-style grandchild ignore.
   void add(const w_string& path, bool is_vcs_ignore);
 
-  // Tests whether path is ignored.
+  // Adds a glob pattern relative to root, whose components are matched
+  // with wildmatch. A component of "**" matches any number of components.
+  // A dir that matches is ignored along with everything below it.
+  void addGlob(const w_string& root, const w_string& pattern);
+
+  // Tests whether path is ignored, either because it is below an ignored
+  // dir or because it is a grandchild of a vcs dir.
   // Returns true if the path is ignored, false otherwise.
   bool isIgnored(const char* path, uint32_t pathlen) const;
 
   // Test whether path is listed in ignore vcs config
-  bool isIgnoreVCS(const w_string& path) const;
+  bool isIgnoreVCS(w_string_piece path) const;
 
-  // Test whether path is listed in ignore dir config
-  bool isIgnoreDir(const w_string& path) const;
+  // Test whether path is listed in ignore dir config, or matches an ignore
+  // glob
+  bool isIgnoreDir(w_string_piece path) const;
 
   const std::vector<w_string>& getIgnoredDirs() const {
     return dirs_vec;
   }
 
  private:
-  // if the map has an entry for a given dir, we're ignoring it */
-  std::unordered_set<w_string> ignore_vcs;
-  std::unordered_set<w_string> ignore_dirs;
-  /* radix tree containing the same information as the ignore
-   * entries above.  This is used only on macOS and Windows because
-   * we cannot exclude these dirs using the kernel watching APIs */
-  art_tree<uint8_t, w_string> tree;
+  struct Node {
+    // The path and everything below it is ignored.
+    bool fullIgnore{false};
+    // The grand-children of the path are ignored, but not the path
+    // or its direct children.
+    bool vcsIgnore{false};
+    // This is a "**" component, which stays matched as components are
+    // consumed.
+    bool anyDepth{false};
+    // Keyed by the literal components, which point into rules_.
+    std::unordered_map<w_string_piece, uint32_t> children;
+    // Components that contain wildcards, as NUL-terminated patterns.
+    std::vector<std::pair<std::string, uint32_t>> globs;
+    // The "**" child, if any.
+    uint32_t anyDepthChild{0};
+  };
+
+  // Returns the node that the last component of path leads to. The
+  // components that start at or after globsFrom are patterns.
+  uint32_t insert(const w_string& path, size_t globsFrom);
+
+  // Calls visit(node, separator, end) for each node matched by a prefix of
+  // path, where separator follows the prefix and end is the end of path,
+  // until it returns true. Returns whether it did.
+  template <typename Visit>
+  bool walk(w_string_piece path, Visit visit) const;
+
+  // nodes_[0] is the root of the trie, so no child is 0.
+  std::vector<Node> nodes_;
+  // Without globs, a path matches at most one node at each depth.
+  bool hasGlobs_{false};
+  // The paths and patterns the trie was built from, which own the
+  // components it refers to.
+  std::vector<w_string> rules_;
   /* On macOS, we need to preserve the order of the ignore list so
    * that we can exclude things deterministically and fit within
    * system limits. */
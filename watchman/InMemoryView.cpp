@@ -6,48 +6,163 @@
  */
 
 #include "watchman/InMemoryView.h"
+#include <fmt/core.h>
 #include <folly/ScopeGuard.h>
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include "watchman/ContentHashStore.h"
 #include "watchman/Errors.h"
+#include "watchman/Options.h"
+#include "watchman/ThreadClass.h"
 #include "watchman/ThreadPool.h"
+#include "watchman/Tracing.h"
+#include "watchman/fs/FSDetect.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/query/ChangePrefilter.h"
 #include "watchman/query/GlobTree.h"
+#include "watchman/query/LocalFileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
 #include "watchman/query/eval.h"
 #include "watchman/root/Root.h"
+#include "watchman/scm/SCM.h"
 #include "watchman/thirdparty/wildmatch/wildmatch.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watchman_file.h"
 
-// Each root gets a number that uniquely identifies it within the process. This
-// helps avoid confusion if a root is removed and then added again.
-static std::atomic<watchman::ClockRoot> next_root_number{1};
-
 namespace watchman {
 
 namespace {
-/** Concatenate dir_name and name around a unix style directory
- * separator.
- * dir_name may be NULL in which case this returns a copy of name.
+std::vector<w_string> vcsLockPaths(const w_string& root_path) {
+  std::vector<w_string> paths;
+  for (auto& name : QueryableView::vcsLockFiles()) {
+    paths.push_back(w_string::pathCat({root_path, name}));
+  }
+  w_check(paths.size() <= 32, "vcsLockFilesPresent_ has a bit per lock file");
+  return paths;
+}
+
+/**
+ * Returns false if retain_stat_fields names none of the fields held in
+ * ExtendedFileInformation, in which case they needn't be stored per file.
+ * The fields in CompactFileInformation are always retained.
+ */
+bool shouldRetainExtendedStat(const Configuration& config) {
+  auto fields = config.get("retain_stat_fields");
+  if (!fields) {
+    return true;
+  }
+  if (!fields->isArray()) {
+    logf(ERR, "retain_stat_fields must be an array of strings\n");
+    return true;
+  }
+  for (auto& field : fields->array()) {
+    if (!field.isString()) {
+      logf(ERR, "retain_stat_fields must be an array of strings\n");
+      return true;
+    }
+    auto name = json_to_w_string(field);
+    if (name == "atime" || name == "dev" || name == "uid" || name == "gid" ||
+        name == "nlink") {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * The content hashes for a root are kept alongside the state file, like its
+ * tick index. Returns nullptr if state is not being saved.
+ */
+template <typename Cache>
+std::shared_ptr<ContentHashStore> makeContentHashStore(
+    const w_string& rootPath,
+    const char* hashName,
+    size_t maxItems) {
+  if (flags.dont_save_state || flags.watchman_state_file.empty()) {
+    return nullptr;
+  }
+  return std::make_shared<ContentHashStore>(
+      w_string::build(
+          flags.watchman_state_file,
+          ".",
+          fmt::format("{:08x}", w_string_piece(rootPath).stableHashValue()),
+          ".",
+          hashName),
+      rootPath,
+      std::tuple_size_v<typename Cache::HashValue>,
+      maxItems);
+}
+
+/**
+ * Hashing is CPU bound on local filesystems, so there is little to gain
+ * from more than a few workers, while reads from a network filesystem
+ * spend most of their time waiting for the server.
  */
-inline std::string make_path_name(
-    const char* dir_name,
-    uint32_t dlen,
-    const char* name,
-    uint32_t nlen) {
-  std::string result;
-  result.reserve(dlen + nlen + 1);
-
-  if (dlen) {
-    result.append(dir_name, dlen);
-    // wildmatch wants unix separators
-    result.push_back('/');
-  }
-  result.append(name, nlen);
-  return result;
+std::vector<w_string> scmPrefetchMergeBases(const Configuration& config) {
+  std::vector<w_string> commits;
+  auto configured = config.get("scm_prefetch_mergebase_with");
+  if (!configured) {
+    return commits;
+  }
+  if (!configured->isArray()) {
+    logf(ERR, "scm_prefetch_mergebase_with must be an array of strings\n");
+    return commits;
+  }
+  for (auto& commit : configured->array()) {
+    if (!commit.isString()) {
+      logf(ERR, "scm_prefetch_mergebase_with must be an array of strings\n");
+      return {};
+    }
+    commits.push_back(json_to_w_string(commit));
+  }
+  return commits;
+}
+
+size_t contentHashConcurrency(
+    const Configuration& config,
+    const w_string& rootPath) {
+  auto configured = config.getInt("content_hash_max_concurrency", 0);
+  if (configured > 0) {
+    return size_t(configured);
+  }
+  return is_network_fs_type(w_fstype(rootPath.c_str())) ? 16 : 4;
+}
+
+// Whether crawl_stat_policy asks to populate the view from the types that
+// readdir reports, leaving files unstat'd until a query needs more. That
+// relies on notifications to see changes to the files, so needs per-file
+// notifications, and a way to turn a dtype into a mode.
+bool shouldDeferFileStat(const Configuration& config, const Watcher& watcher) {
+  w_string_piece policy = config.getString("crawl_stat_policy", "full");
+  if (policy == "full") {
+    return false;
+  }
+  if (policy != "names") {
+    logf(
+        ERR,
+        "crawl_stat_policy must be \"full\" or \"names\", not \"{}\"\n",
+        policy);
+    return false;
+  }
+  if (!(watcher.flags & WATCHER_HAS_PER_FILE_NOTIFICATIONS)) {
+    logf(
+        ERR,
+        "crawl_stat_policy \"names\" needs per-file notifications, which "
+        "the {} watcher does not provide; stat'ing every file\n",
+        watcher.name);
+    return false;
+  }
+#ifdef DTTOIF
+  return true;
+#else
+  logf(ERR, "crawl_stat_policy \"names\" is not supported on this system\n");
+  return false;
+#endif
 }
 } // namespace
 
@@ -55,19 +170,78 @@ InMemoryViewCaches::InMemoryViewCaches(
     const w_string& rootPath,
     size_t maxHashes,
     size_t maxSymlinks,
-    std::chrono::milliseconds errorTTL)
-    : contentHashCache(rootPath, maxHashes, errorTTL),
-      symlinkTargetCache(rootPath, maxSymlinks, errorTTL) {}
+    size_t maxHashBytes,
+    size_t maxSymlinkBytes,
+    std::chrono::milliseconds errorTTL,
+    size_t maxHashConcurrency,
+    bool persistHashes,
+    CacheAdmission hashAdmission)
+    : sha1Store(
+          persistHashes ? makeContentHashStore<ContentHashCache>(
+                              rootPath, "sha1", maxHashes)
+                        : nullptr),
+      spookyStore(
+          persistHashes ? makeContentHashStore<Spooky128HashCache>(
+                              rootPath, "spooky128", maxHashes)
+                        : nullptr),
+      contentHashCache(
+          rootPath,
+          maxHashes,
+          errorTTL,
+          maxHashConcurrency,
+          sha1Store,
+          maxHashBytes,
+          hashAdmission),
+      spookyHashCache(
+          rootPath,
+          maxHashes,
+          errorTTL,
+          maxHashConcurrency,
+          spookyStore,
+          maxHashBytes,
+          hashAdmission),
+      symlinkTargetCache(rootPath, maxSymlinks, errorTTL, maxSymlinkBytes) {}
+
+void InMemoryViewCaches::saveContentHashes(bool async) {
+  for (auto& store : {sha1Store, spookyStore}) {
+    if (!store) {
+      continue;
+    }
+    if (!async) {
+      store->save();
+      continue;
+    }
+    try {
+      getThreadPool().addWithPriority(
+          [store] { store->save(); }, ThreadPool::kBackground);
+    } catch (const std::exception& exc) {
+      logf(ERR, "unable to schedule saving content hashes: {}\n", exc.what());
+    }
+  }
+}
+
+size_t InMemoryViewCaches::eraseExpired() {
+  return contentHashCache.eraseExpired() + spookyHashCache.eraseExpired() +
+      symlinkTargetCache.eraseExpired();
+}
 
 InMemoryFileResult::InMemoryFileResult(
     const watchman_file* file,
-    InMemoryViewCaches& caches)
-    : file_(file), caches_(caches) {}
+    InMemoryViewCaches& caches,
+    w_string dirName,
+    std::shared_ptr<const void> owner)
+    : file_(file),
+      dirName_(std::move(dirName)),
+      caches_(caches),
+      owner_(std::move(owner)) {}
 
 void InMemoryFileResult::batchFetchProperties(
     const std::vector<std::unique_ptr<FileResult>>& files) {
   std::vector<folly::Future<folly::Unit>> readlinkFutures;
   std::vector<folly::Future<folly::Unit>> sha1Futures;
+  std::vector<folly::Future<folly::Unit>> spookyFutures;
+  // What clients hash, for warming
+  std::vector<w_string> sha1Paths;
 
   // Since we may initiate some async work in the body of the function
   // below, we need to ensure that we wait for it to complete before
@@ -81,6 +255,9 @@ void InMemoryFileResult::batchFetchProperties(
     if (!sha1Futures.empty()) {
       folly::collectAll(sha1Futures.begin(), sha1Futures.end()).wait();
     }
+    if (!spookyFutures.empty()) {
+      folly::collectAll(spookyFutures.begin(), spookyFutures.end()).wait();
+    }
   };
 
   for (auto& f : files) {
@@ -123,51 +300,122 @@ void InMemoryFileResult::batchFetchProperties(
       }
     }
 
-    if (file->neededProperties() & FileResult::Property::ContentSha1) {
-      auto dir = file->dirName();
-      dir.advance(file->caches_.contentHashCache.rootPath().size());
-
-      // If dirName is the root, dir.size() will now be zero
-      if (dir.size() > 0) {
-        // if not at the root, skip the slash character at the
-        // front of dir
-        dir.advance(1);
+    if (file->neededProperties() & FileResult::Property::FullFileInformation) {
+      auto fullName = w_string::pathCat({file->dirName(), file->baseName()});
+      try {
+        auto fresh = getFileInformation(fullName.c_str());
+        if (file->file_->stat_deferred) {
+          // The view only knows the type, so there is nothing to prefer
+          file->fullStat_ = fresh;
+        } else {
+          // Prefer what the view knows for the fields that it retained, so
+          // that they stay consistent with the rest of the query results.
+          auto info = file->file_->getFileInformation();
+          info.atime = fresh.atime;
+          info.dev = fresh.dev;
+          info.uid = fresh.uid;
+          info.gid = fresh.gid;
+          info.nlink = fresh.nlink;
+          file->fullStat_ = info;
+        }
+      } catch (const std::system_error&) {
+        // The file may have been removed since we last observed it; report
+        // what we have.
+        file->fullStat_ = file->file_->getFileInformation();
       }
+    }
 
-      ContentHashCacheKey key{
-          w_string::pathCat({dir, file->baseName()}),
-          size_t(file->file_->stat.size),
-          file->file_->stat.mtime};
+    if (file->neededProperties() & FileResult::Property::ContentSha1) {
+      auto key = file->contentHashKey();
+      sha1Paths.push_back(key.relativePath);
+      sha1Futures.emplace_back(
+          caches_.contentHashCache.get(key)
+              .thenTry([file](folly::Try<std::shared_ptr<
+                                  const ContentHashCache::Node>>&& result) {
+                file->contentSha1_ =
+                    makeResultWith([&] { return result.value()->value(); });
+              }));
+    }
 
-      sha1Futures.emplace_back(caches_.contentHashCache.get(key).thenTry(
-          [file](folly::Try<std::shared_ptr<const ContentHashCache::Node>>&&
-                     result) {
-            file->contentSha1_ =
-                makeResultWith([&] { return result.value()->value(); });
-          }));
+    if (file->neededProperties() & FileResult::Property::ContentSpooky128) {
+      spookyFutures.emplace_back(
+          caches_.spookyHashCache.get(file->contentHashKey())
+              .thenTry([file](folly::Try<std::shared_ptr<
+                                  const Spooky128HashCache::Node>>&& result) {
+                file->contentSpooky128_ =
+                    makeResultWith([&] { return result.value()->value(); });
+              }));
     }
 
     file->clearNeededProperties();
   }
+
+  caches_.contentHashInterest.noteRequested(sha1Paths);
 }
 
 std::optional<FileInformation> InMemoryFileResult::stat() {
-  return file_->stat;
+  if (file_->has_extended_stat && !file_->stat_deferred) {
+    return file_->getFileInformation();
+  }
+  if (!fullStat_.has_value()) {
+    accessorNeedsProperties(FileResult::Property::FullFileInformation);
+  }
+  return fullStat_;
+}
+
+std::optional<DType> InMemoryFileResult::dtype() {
+  return file_->stat.dtype();
+}
+
+const void* InMemoryFileResult::identity() const {
+  // The files that are not part of the view are copies, of which there may
+  // be several for the same file.
+  return owner_ ? nullptr : file_;
 }
 
 std::optional<size_t> InMemoryFileResult::size() {
+  if (file_->stat_deferred) {
+    // Only the type was crawled; the size needs a stat
+    auto info = stat();
+    if (!info.has_value()) {
+      return std::nullopt;
+    }
+    return info->size;
+  }
   return file_->stat.size;
 }
 
 std::optional<struct timespec> InMemoryFileResult::accessedTime() {
-  return file_->stat.atime;
+  auto extended = file_->getExtendedStat();
+  if (extended && !file_->stat_deferred) {
+    return extended->atime;
+  }
+  auto info = stat();
+  if (!info.has_value()) {
+    return std::nullopt;
+  }
+  return info->atime;
 }
 
 std::optional<struct timespec> InMemoryFileResult::modifiedTime() {
+  if (file_->stat_deferred) {
+    auto info = stat();
+    if (!info.has_value()) {
+      return std::nullopt;
+    }
+    return info->mtime;
+  }
   return file_->stat.mtime;
 }
 
 std::optional<struct timespec> InMemoryFileResult::changedTime() {
+  if (file_->stat_deferred) {
+    auto info = stat();
+    if (!info.has_value()) {
+      return std::nullopt;
+    }
+    return info->ctime;
+  }
   return file_->stat.ctime;
 }
 
@@ -211,7 +459,7 @@ std::optional<w_string> InMemoryFileResult::readLink() {
   return symlinkTarget_;
 }
 
-std::optional<FileResult::ContentHash> InMemoryFileResult::getContentSha1() {
+void InMemoryFileResult::checkHashable() const {
   if (!file_->exists) {
     // Don't return hashes for files that we believe to be deleted.
     throw std::system_error(
@@ -222,7 +470,37 @@ std::optional<FileResult::ContentHash> InMemoryFileResult::getContentSha1() {
     // We only want to compute the hash for regular files
     throw std::system_error(std::make_error_code(std::errc::is_a_directory));
   }
+}
+
+ContentHashCacheKey InMemoryFileResult::contentHashKey() {
+  auto dir = dirName();
+  dir.advance(caches_.contentHashCache.rootPath().size());
+
+  // If dirName is the root, dir.size() will now be zero
+  if (dir.size() > 0) {
+    // if not at the root, skip the slash character at the
+    // front of dir
+    dir.advance(1);
+  }
+
+  if (file_->stat_deferred && fullStat_.has_value()) {
+    return ContentHashCacheKey{
+        w_string::pathCat({dir, baseName()}),
+        size_t(fullStat_->size),
+        fullStat_->mtime};
+  }
+  return ContentHashCacheKey{
+      w_string::pathCat({dir, baseName()}),
+      size_t(file_->stat.size),
+      file_->stat.mtime};
+}
 
+std::optional<FileResult::ContentHash> InMemoryFileResult::getContentSha1() {
+  checkHashable();
+  if (file_->stat_deferred && !stat().has_value()) {
+    // The cache key needs the size and mtime, which have not been fetched
+    return std::nullopt;
+  }
   if (contentSha1_.empty()) {
     accessorNeedsProperties(FileResult::Property::ContentSha1);
     return std::nullopt;
@@ -230,9 +508,56 @@ std::optional<FileResult::ContentHash> InMemoryFileResult::getContentSha1() {
   return contentSha1_.value();
 }
 
-ViewDatabase::ViewDatabase(const w_string& root_path)
+std::optional<FileResult::Spooky128Hash>
+InMemoryFileResult::getContentSpooky128() {
+  checkHashable();
+  if (file_->stat_deferred && !stat().has_value()) {
+    return std::nullopt;
+  }
+  if (contentSpooky128_.empty()) {
+    accessorNeedsProperties(FileResult::Property::ContentSpooky128);
+    return std::nullopt;
+  }
+  return contentSpooky128_.value();
+}
+
+ViewDatabase::ViewDatabase(
+    const w_string& root_path,
+    bool retainExtendedStat,
+    bool indexSuffixes,
+    bool foldCase,
+    bool hugePages,
+    bool dirTotals)
     : rootPath_{root_path},
-      rootDir_{std::make_unique<watchman_dir>(root_path, nullptr)} {}
+      retainExtendedStat_{retainExtendedStat},
+      indexSuffixes_{indexSuffixes},
+      foldCase_{foldCase},
+      dirTotals_{dirTotals},
+      allocator_{SlabAllocator::kDefaultSlabSize, hugePages},
+      rootDir_{watchman_dir::make(root_path, nullptr, &allocator_)} {
+  if (foldCase_) {
+    rootDir_->enableCaseFolding();
+  }
+}
+
+const std::unordered_set<watchman_file*>* ViewDatabase::getFilesWithSuffix(
+    const w_string& suffix) const {
+  auto it = suffixIndex_.find(suffix);
+  return it == suffixIndex_.end() ? nullptr : &it->second;
+}
+
+void ViewDatabase::clear() {
+  suffixIndex_.clear();
+  latestFile_ = nullptr;
+  numFiles_ = 0;
+  rootDir_.reset();
+  components_.prune();
+  allocator_.releaseSlabs();
+  rootDir_ = watchman_dir::make(rootPath_, nullptr, &allocator_);
+  if (foldCase_) {
+    rootDir_->enableCaseFolding();
+  }
+}
 
 watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
   if (dir_name == rootPath_) {
@@ -268,15 +593,7 @@ watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
       // we have another pending item for the parent.  We'll create the
       // parent dir now and our other machinery will populate its contents
       // later.
-      w_string child_name(dir_component, (uint32_t)(sep - dir_component));
-
-      // Careful! dir->dirs is keyed by non-owning string pieces so the
-      // child_name MUST be stored or otherwise kept alive by the watchman_dir
-      // instance constructed below!
-      auto& new_child = dir->dirs[child_name];
-      new_child.reset(new watchman_dir(child_name, dir));
-
-      child = new_child.get();
+      child = dir->getOrCreateChildDir(components_.intern(component));
     }
 
     parent = dir;
@@ -296,13 +613,8 @@ watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
     dir_component = sep + 1;
   }
 
-  w_string child_name(dir_component, (uint32_t)(dir_end - dir_component));
-  // Careful! parent->dirs is keyed by non-owning string pieces so the
-  // child_name MUST be stored or otherwise kept alive by the watchman_dir
-  // instance constructed below!
-  auto& new_child = parent->dirs[child_name];
-  new_child.reset(new watchman_dir(child_name, parent));
-  return new_child.get();
+  return parent->getOrCreateChildDir(components_.intern(
+      w_string_piece(dir_component, dir_end - dir_component)));
 }
 
 const watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name) const {
@@ -365,17 +677,148 @@ watchman_file* ViewDatabase::getOrCreateChildFile(
 
   // ... but take the shorter string from inside the file that
   // we create as the key.
-  auto file = watchman_file::make(file_name, dir);
+  auto file = watchman_file::make(file_name, dir, retainExtendedStat_);
   auto& file_ptr = dir->files[file->getName()];
   file_ptr = std::move(file);
+  dir->addFoldedChild(file_ptr.get());
+  ++numFiles_;
+  markTotalsStale(dir, true);
 
   file_ptr->ctime = ctime;
 
+  if (indexSuffixes_) {
+    if (auto suffix = file_ptr->getName().asLowerCaseSuffix()) {
+      suffixIndex_[suffix].insert(file_ptr.get());
+    }
+  }
+
   watcher.startWatchFile(file_ptr.get());
 
   return file_ptr.get();
 }
 
+void ViewDatabase::removeFile(watchman_file* file) {
+  markTotalsStale(file->parent, true);
+  unindexFile(file);
+  file->parent->removeFoldedChild(file);
+  file->parent->files.erase(file->getName());
+  --numFiles_;
+}
+
+void ViewDatabase::removeChildDir(watchman_dir* parent, w_string_piece name) {
+  auto it = parent->dirs.find(name);
+  if (it == parent->dirs.end()) {
+    return;
+  }
+  unindexDir(it->second.get());
+  parent->removeFoldedChild(it->second.get());
+  parent->dirs.erase(it);
+  markTotalsStale(parent, false);
+}
+
+void ViewDatabase::markTotalsStale(watchman_dir* dir, bool own) {
+  if (!dirTotals_) {
+    return;
+  }
+  if (own) {
+    dir->ownTotalsStale = true;
+  }
+  // Once we reach a dir whose subtree is stale, all of its ancestors are too.
+  for (; dir && !dir->subtreeTotalsStale; dir = dir->parent) {
+    dir->subtreeTotalsStale = true;
+  }
+}
+
+void ViewDatabase::updateDirTotals() {
+  if (!dirTotals_) {
+    return;
+  }
+  auto add = [](watchman_dir::Totals& into, const watchman_dir::Totals& t) {
+    into.files += t.files;
+    into.bytes += t.bytes;
+    into.unsized += t.unsized;
+  };
+  auto update = [&add](watchman_dir* dir, auto& recurse) -> void {
+    if (dir->ownTotalsStale) {
+      watchman_dir::Totals own;
+      for (auto& it : dir->files) {
+        auto file = it.second.get();
+        if (!file->exists) {
+          continue;
+        }
+        ++own.files;
+        if (file->stat_deferred) {
+          ++own.unsized;
+        } else {
+          own.bytes += file->stat.size;
+        }
+      }
+      dir->ownTotals = own;
+      dir->ownTotalsStale = false;
+    }
+
+    auto subtree = dir->ownTotals;
+    for (auto& it : dir->dirs) {
+      auto child = it.second.get();
+      if (child->subtreeTotalsStale) {
+        recurse(child, recurse);
+      }
+      add(subtree, child->subtreeTotals);
+    }
+    dir->subtreeTotals = subtree;
+    dir->subtreeTotalsStale = false;
+  };
+  if (rootDir_->subtreeTotalsStale) {
+    update(rootDir_.get(), update);
+  }
+}
+
+void ViewDatabase::unindexFile(watchman_file* file) {
+  if (!indexSuffixes_) {
+    return;
+  }
+  auto suffix = file->getName().asLowerCaseSuffix();
+  if (!suffix) {
+    return;
+  }
+  auto it = suffixIndex_.find(suffix);
+  if (it == suffixIndex_.end()) {
+    return;
+  }
+  it->second.erase(file);
+  if (it->second.empty()) {
+    suffixIndex_.erase(it);
+  }
+}
+
+void ViewDatabase::unindexDir(const watchman_dir* dir) {
+  if (!indexSuffixes_) {
+    return;
+  }
+  for (auto& it : dir->files) {
+    unindexFile(it.second.get());
+  }
+  for (auto& it : dir->dirs) {
+    unindexDir(it.second.get());
+  }
+}
+
+namespace {
+// Bubbles otime up to the subtree summaries of dir and its ancestors.  Each
+// summary is the maximum over a superset of its child's, so once we reach a
+// summary that already covers otime, all of its ancestors do too.
+void bubbleSubtreeLatest(watchman_dir* dir, ClockStamp otime) {
+  for (; dir; dir = dir->parent) {
+    auto& latest = dir->subtreeLatest;
+    if (latest.ticks >= otime.ticks && latest.timestamp >= otime.timestamp) {
+      break;
+    }
+    latest.ticks = std::max(latest.ticks, otime.ticks);
+    latest.timestamp = std::max(latest.timestamp, otime.timestamp);
+  }
+}
+} // namespace
+
 void ViewDatabase::markFileChanged(
     Watcher& watcher,
     watchman_file* file,
@@ -393,6 +836,48 @@ void ViewDatabase::markFileChanged(
     // and move to the head
     insertAtHeadOfFileList(file);
   }
+
+  if (file->parent->latestFile != file) {
+    file->removeFromDirFileList();
+    insertAtHeadOfDirFileList(file);
+  }
+
+  bubbleSubtreeLatest(file->parent, otime);
+  markTotalsStale(file->parent, true);
+}
+
+void ViewDatabase::sortRecencyLists() {
+  std::vector<watchman_file*> files;
+  files.reserve(numFiles_);
+
+  auto collect = [&files](watchman_dir* dir, auto& recurse) -> void {
+    dir->latestFile = nullptr;
+    dir->subtreeLatest = ClockStamp{0, 0};
+    // The files may have been loaded without being marked changed.
+    dir->ownTotalsStale = true;
+    dir->subtreeTotalsStale = true;
+    for (auto& it : dir->files) {
+      files.push_back(it.second.get());
+    }
+    for (auto& it : dir->dirs) {
+      recurse(it.second.get(), recurse);
+    }
+  };
+  collect(rootDir_.get(), collect);
+
+  // Stable, so that files sharing a tick keep a deterministic order.
+  std::stable_sort(files.begin(), files.end(), [](auto* a, auto* b) {
+    return a->otime.ticks < b->otime.ticks;
+  });
+
+  // Inserting in ascending order leaves the most recent file at the head.
+  // The old links are simply overwritten.
+  latestFile_ = nullptr;
+  for (auto* file : files) {
+    insertAtHeadOfFileList(file);
+    insertAtHeadOfDirFileList(file);
+    bubbleSubtreeLatest(file->parent, file->otime);
+  }
 }
 
 void ViewDatabase::markDirDeleted(
@@ -426,6 +911,138 @@ void ViewDatabase::markDirDeleted(
   }
 }
 
+bool ViewDatabase::relocateDir(
+    Watcher& watcher,
+    const w_string& from,
+    const w_string& to,
+    const FileInformation& toStat,
+    ClockStamp otime) {
+  auto fromParent = resolveDir(from.dirName(), false);
+  auto toParent = resolveDir(to.dirName(), false);
+  if (!fromParent || !toParent) {
+    return false;
+  }
+  auto fromName = from.baseName();
+  auto toName = to.baseName();
+  auto dir = fromParent->getChildDir(fromName);
+  auto entry = fromParent->getChildFile(fromName);
+  if (!dir || !dir->last_check_existed || !entry || !entry->exists ||
+      !toStat.isDir() || entry->stat.ino != toStat.ino ||
+      toParent->getChildDir(toName)) {
+    return false;
+  }
+  // A dir can't be moved below itself
+  for (auto d = toParent; d; d = d->parent) {
+    if (d == dir) {
+      return false;
+    }
+  }
+
+  auto moved = toParent->adoptChildDir(
+      fromParent->detachChildDir(fromName), components_.intern(toName));
+  relocateFiles(
+      watcher,
+      moved,
+      fromParent->getOrCreateChildDir(components_.intern(fromName)),
+      otime);
+
+  entry->exists = false;
+  markFileChanged(watcher, entry, otime);
+
+  auto toEntry = getOrCreateChildFile(watcher, toParent, toName, otime);
+  if (!toEntry->exists) {
+    toEntry->ctime = otime;
+    toEntry->exists = true;
+  }
+  toEntry->setStat(toStat);
+  markFileChanged(watcher, toEntry, otime);
+  return true;
+}
+
+void ViewDatabase::relocateFiles(
+    Watcher& watcher,
+    watchman_dir* moved,
+    watchman_dir* left,
+    ClockStamp otime) {
+  for (auto& it : moved->files) {
+    auto file = it.second.get();
+    if (!file->exists) {
+      continue;
+    }
+    auto deleted = getOrCreateChildFile(
+        watcher, left, file->getName().asWString(), otime);
+    deleted->setStat(file->getFileInformation());
+    deleted->exists = false;
+    markFileChanged(watcher, deleted, otime);
+
+    // As far as queries on to are concerned, it was just created there
+    file->ctime = otime;
+    markFileChanged(watcher, file, otime);
+  }
+  for (auto& it : moved->dirs) {
+    auto child = it.second.get();
+    if (child->last_check_existed) {
+      relocateFiles(
+          watcher, child, left->getOrCreateChildDir(child->name), otime);
+    }
+  }
+  left->last_check_existed = false;
+}
+
+namespace {
+// Approximates the bytes used by a dir's child map, excluding the children.
+template <typename Map>
+size_t childMapBytes(const Map& map) {
+#ifdef WATCHMAN_FLAT_DIR_CHILDREN
+  return map.capacity() * sizeof(typename Map::value_type);
+#else
+  // A bucket array, plus one node per entry holding the value, the next
+  // pointer and the cached hash.
+  return map.bucket_count() * sizeof(void*) +
+      map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*));
+#endif
+}
+
+template <typename Map>
+size_t foldedMapBytes(const Map& map) {
+  return map.bucket_count() * sizeof(void*) +
+      map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*));
+}
+
+void addDirMemoryStats(const watchman_dir* dir, ViewMemoryStats& stats) {
+  *stats.dirs += sizeof(watchman_dir);
+  *stats.child_maps += childMapBytes(dir->files) + childMapBytes(dir->dirs);
+  if (dir->folded) {
+    *stats.child_maps += sizeof(watchman_dir::FoldedChildren) +
+        foldedMapBytes(dir->folded->files) + foldedMapBytes(dir->folded->dirs);
+  }
+  for (auto& it : dir->files) {
+    auto nameBytes = sizeof(uint32_t) + it.first.size() + 1;
+    *stats.names += nameBytes;
+    *stats.files += it.second->getAllocationSize() - nameBytes;
+  }
+  for (auto& it : dir->dirs) {
+    addDirMemoryStats(it.second.get(), stats);
+  }
+}
+} // namespace
+
+void ViewDatabase::addMemoryStats(ViewMemoryStats& stats, bool detailed)
+    const {
+  stats.node_bytes_reserved += allocator_.getBytesReserved();
+  stats.node_bytes_in_use += allocator_.getBytesInUse();
+  if (!detailed) {
+    return;
+  }
+
+  stats.files = 0;
+  stats.dirs = 0;
+  stats.child_maps = 0;
+  // Dir names are shared through components_, so count them once from there.
+  stats.names = components_.getBytesUsed() + rootPath_.size();
+  addDirMemoryStats(rootDir_.get(), stats);
+}
+
 void ViewDatabase::insertAtHeadOfFileList(struct watchman_file* file) {
   file->next = latestFile_;
   if (file->next) {
@@ -435,6 +1052,16 @@ void ViewDatabase::insertAtHeadOfFileList(struct watchman_file* file) {
   file->prev = &latestFile_;
 }
 
+void ViewDatabase::insertAtHeadOfDirFileList(struct watchman_file* file) {
+  auto parent = file->parent;
+  file->dirNext = parent->latestFile;
+  if (file->dirNext) {
+    file->dirNext->dirPrev = &file->dirNext;
+  }
+  parent->latestFile = file;
+  file->dirPrev = &parent->latestFile;
+}
+
 InMemoryView::PendingChangeLogEntry::PendingChangeLogEntry(
     const PendingChange& pc,
     std::error_code errcode,
@@ -471,22 +1098,118 @@ InMemoryView::InMemoryView(
     : QueryableView{root_path, /*requiresCrawl=*/true},
       fileSystem_{fileSystem},
       config_(std::move(config)),
-      view_(folly::in_place, root_path),
-      rootNumber_(next_root_number++),
+      rootNumber_(allocateClockRoot()),
       rootPath_(root_path),
+      traceRootId_(getTraceRootId(root_path)),
+      ageOutSliceFiles_(size_t(config_.getInt("gc_max_files_per_slice", 0))),
+      compactDeletedFiles_(config_.getBool("compact_deleted_files", false)),
       watcher_(std::move(watcher)),
       caches_(
           root_path,
           config_.getInt("content_hash_max_items", 128 * 1024),
           config_.getInt("symlink_target_max_items", 32 * 1024),
+          config_.getInt("content_hash_max_bytes", 0),
+          config_.getInt("symlink_target_max_bytes", 0),
           std::chrono::milliseconds(
-              config_.getInt("content_hash_negative_cache_ttl_ms", 2000))),
+              config_.getInt("content_hash_negative_cache_ttl_ms", 2000)),
+          contentHashConcurrency(config_, root_path),
+          config_.getBool("persist_content_hashes", false),
+          config_.getBool("content_hash_admission_filter", false)
+              ? CacheAdmission::TinyLFU
+              : CacheAdmission::All),
+      parallelQueryFileThreshold_(
+          size_t(config_.getInt("parallel_query_file_threshold", 0))),
+      parallelQueryMaxWorkers_(
+          size_t(config_.getInt("parallel_query_max_workers", 8))),
       enableContentCacheWarming_(
           config_.getBool("content_hash_warming", false)),
       maxFilesToWarmInContentCache_(
           size_t(config_.getInt("content_hash_max_warm_per_settle", 1024))),
       syncContentCacheWarming_(
-          config_.getBool("content_hash_warm_wait_before_settle", false)) {
+          config_.getBool("content_hash_warm_wait_before_settle", false)),
+      warmOnlyRequestedContent_(
+          config_.getBool("content_hash_warm_only_requested", false)),
+      contentWarmBytesPerSec_(
+          config_.getInt("content_hash_warm_bytes_per_sec", 0)),
+      crawlProgressInterval_(
+          config_.getInt("crawl_progress_interval_ms", 1000)),
+      viewLockSlice_(config_.getInt("view_lock_slice_ms", 0)),
+      batchWindowMax_(config_.getInt("io_batch_window_max_ms", 0)),
+      batchMinItems_(size_t(config_.getInt("io_batch_min_items", 1000))),
+      notifyBatchDelay_(config_.getInt("notify_batch_delay_ms", 0)),
+      pendingDebounce_(config_.getInt("pending_debounce_ms", 0)),
+      parallelStatMinItems_(
+          size_t(config_.getInt("parallel_stat_min_items", 0))),
+      parallelStatMaxWorkers_(
+          size_t(config_.getInt("parallel_stat_max_workers", 8))),
+      trustWatcherStat_(
+          (watcher_->flags & WATCHER_SUPPLIES_STAT) &&
+          config_.getBool("trust_watcher_stat", true)),
+      parallelRecrawlMinDirs_(
+          size_t(config_.getInt("parallel_recrawl_min_dirs", 0))),
+      parallelCrawlBatchDirs_(
+          size_t(config_.getInt("parallel_crawl_batch_dirs", 1024))),
+      trustUnchangedDirMtime_(
+          config_.getBool("trust_unchanged_dir_mtime", false)),
+      deferFileStat_(shouldDeferFileStat(config_, *watcher_)),
+      prefetchSymlinkTargets_(
+          config_.getBool("symlink_target_prefetch", false)),
+      lazyCrawlDepth_(size_t(
+          std::max(json_int_t(0), config_.getInt("lazy_crawl_depth", 0)))),
+      vcsIgnoreCrawl_(config_.getBool("vcs_ignore_crawl", false)),
+      persistTickIndex_(config_.getBool("persist_tick_index", false)),
+      tickIndexSaveInterval_(
+          config_.getInt("tick_index_save_interval_seconds", 600)),
+      contentHashSaveInterval_(
+          config_.getInt("content_hash_save_interval_seconds", 60)),
+      warmStartFromTickIndex_(
+          persistTickIndex_ &&
+          config_.getBool("warm_start_from_tick_index", false)),
+      warmStartVerifyBatch_(std::max(
+          json_int_t(1),
+          config_.getInt("warm_start_verify_dirs_per_batch", 256))),
+      hibernateIdle_(config_.getInt("hibernate_idle_seconds", 0)),
+      hibernateJournalMaxItems_(size_t(std::max(
+          json_int_t(1),
+          config_.getInt("hibernate_journal_max_items", 100000)))),
+      indexSuffixes_(config_.getBool("suffix_index", false)),
+      changeLogMaxFiles_(size_t(std::max(
+          json_int_t(0),
+          config_.getInt("change_log_max_files", 0)))),
+      changeLogStateMaxFiles_(std::max(
+          changeLogMaxFiles_,
+          size_t(std::max(
+              json_int_t(0),
+              config_.getInt("change_log_state_max_files", 0))))),
+      changeLogUnsettled_(config_.getBool("change_log_unsettled", false)),
+      prefilterMaxFiles_(size_t(std::max(
+          json_int_t(0),
+          config_.getInt("subscription_prefilter_max_files", 0)))),
+      vcsLockPaths_(vcsLockPaths(root_path)),
+      cookielessSync_(
+          (watcher_->flags & WATCHER_SYNCS_WITHOUT_COOKIES) &&
+          config_.getBool("cookieless_sync", true)),
+      settleAdaptiveMax_(config_.getInt("settle_adaptive_max_ms", 0)),
+      settleMaxWait_(config_.getInt("settle_max_wait_ms", 0)),
+      scmPrefetchMergeBases_(scmPrefetchMergeBases(config_)) {
+  auto numShards = std::max(json_int_t(1), config_.getInt("view_shards", 1));
+  auto retainExtendedStat = shouldRetainExtendedStat(config_);
+  auto foldCase = getCaseSensitivityForPath(root_path.c_str()) ==
+      CaseSensitivity::CaseInSensitive;
+  auto hugePages = config_.getBool("view_huge_pages", false);
+  auto dirTotals = config_.getBool("dir_totals", false);
+  shards_.reserve(numShards);
+  for (json_int_t i = 0; i < numShards; ++i) {
+    shards_.push_back(std::make_unique<ViewShard>(
+        folly::in_place,
+        root_path,
+        retainExtendedStat,
+        indexSuffixes_,
+        foldCase,
+        hugePages,
+        dirTotals));
+  }
+
   json_int_t in_memory_view_ring_log_size =
       config_.getInt("in_memory_view_ring_log_size", 0);
   if (in_memory_view_ring_log_size) {
@@ -497,7 +1220,78 @@ InMemoryView::InMemoryView(
 
 InMemoryView::~InMemoryView() = default;
 
+size_t InMemoryView::shardIndex(w_string_piece path) const {
+  if (shards_.size() == 1) {
+    return 0;
+  }
+  w_assert(
+      path.size() > rootPath_.size() + 1, "the root dir spans every shard");
+
+  w_string_piece name{
+      path.data() + rootPath_.size() + 1, path.size() - rootPath_.size() - 1};
+  auto sep = (const char*)memchr(name.data(), '/', name.size());
+  if (sep) {
+    name = w_string_piece{name.data(), size_t(sep - name.data())};
+  }
+  return shardIndexForTopLevelName(name);
+}
+
+size_t InMemoryView::shardIndexForTopLevelName(w_string_piece name) const {
+  return shards_.size() == 1 ? 0 : name.hashValue() % shards_.size();
+}
+
+std::pair<size_t, size_t> InMemoryView::shardRangeForDir(
+    w_string_piece path) const {
+  if (path == rootPath_) {
+    return {0, shards_.size()};
+  }
+  auto idx = shardIndex(path);
+  return {idx, idx + 1};
+}
+
+std::vector<InMemoryView::ViewReadLock> InMemoryView::rlockAllShards() const {
+  std::vector<ViewReadLock> locks;
+  locks.reserve(shards_.size());
+  for (auto& shard : shards_) {
+    locks.push_back(std::as_const(*shard).rlock());
+  }
+  return locks;
+}
+
+namespace {
+// Removes the dirs that correspond to the file nodes that were freed, now
+// that all of them have been.
+void eraseDirsOfRemovedFiles(
+    ViewDatabase& view,
+    const std::unordered_set<w_string>& dirs_to_erase) {
+  for (auto& name : dirs_to_erase) {
+    auto parent = view.resolveDir(name.dirName(), false);
+    // If the file node has reappeared then the IO thread observed this
+    // entry again while we had released the lock; leave its dir alone.
+    if (parent && !parent->getChildFile(name.baseName())) {
+      view.removeChildDir(parent, name.baseName());
+    }
+  }
+  if (!dirs_to_erase.empty()) {
+    view.pruneInternedComponents();
+  }
+}
+
+bool hasFileNodes(const watchman_dir* dir) {
+  if (!dir->files.empty()) {
+    return true;
+  }
+  for (auto& it : dir->dirs) {
+    if (hasFileNodes(it.second.get())) {
+      return true;
+    }
+  }
+  return false;
+}
+} // namespace
+
 ClockStamp InMemoryView::ageOutFile(
+    ViewDatabase& view,
     std::unordered_set<w_string>& dirs_to_erase,
     watchman_file* file) {
   auto parent = file->parent;
@@ -514,95 +1308,877 @@ ClockStamp InMemoryView::ageOutFile(
   // Remove the entry from the containing file hash; this will free it.
   // We don't need to stop watching it, because we already stopped watching it
   // when we marked it as !exists.
-  parent->files.erase(file->getName());
+  view.removeFile(file);
 
   return ageOutOtime;
 }
 
 void InMemoryView::ageOut(PerfSample& sample, std::chrono::seconds minAge) {
+  std::lock_guard<std::mutex> ageOutGuard{ageOutMutex_};
+
   uint32_t num_aged_files = 0;
   uint32_t num_walked = 0;
-  std::unordered_set<w_string> dirs_to_erase;
+  uint32_t num_slices = 0;
+  bool complete = true;
 
   auto now = std::chrono::system_clock::now();
   lastAgeOutTimestamp_ = now;
-  auto view = view_.wlock();
-
-  watchman_file* file = view->getLatestFile();
-  watchman_file* prior = nullptr;
-  while (file) {
-    ++num_walked;
-    if (file->exists ||
-        std::chrono::system_clock::from_time_t(file->otime.timestamp) + minAge >
-            now) {
-      prior = file;
-      file = file->next;
-      continue;
-    }
 
-    auto agedOtime = ageOutFile(dirs_to_erase, file);
+  size_t num_aged_dirs = 0;
+  size_t released_bytes = 0;
+  for (auto& shard : shards_) {
+    std::unordered_set<w_string> dirs_to_erase;
+    auto view = shard->wlock();
+    ++num_slices;
+
+    watchman_file* file = view->getLatestFile();
+    watchman_file* prior = nullptr;
+    size_t walkedInSlice = 0;
+    while (file) {
+      if (ageOutSliceFiles_ && walkedInSlice >= ageOutSliceFiles_) {
+        // Let readers and the IO thread in before continuing.  Nothing else
+        // removes file nodes while we hold ageOutMutex_, so prior is still
+        // valid afterwards.  If it changed in the meantime, though, it has
+        // moved to the head of the recency list and no longer marks our
+        // position; leave the rest for the next pass rather than walking the
+        // list again.
+        auto priorTicks = prior ? prior->otime.ticks : 0;
+        view.unlock();
+        view = shard->wlock();
+        ++num_slices;
+        walkedInSlice = 0;
+
+        if (!prior) {
+          file = view->getLatestFile();
+        } else if (prior->otime.ticks == priorTicks) {
+          file = prior->next;
+        } else {
+          complete = false;
+          break;
+        }
+        if (!file) {
+          break;
+        }
+      }
 
-    // Revise tick for fresh instance reporting
-    lastAgeOutTick_ = std::max(lastAgeOutTick_, agedOtime.ticks);
+      ++num_walked;
+      ++walkedInSlice;
+      if (file->exists ||
+          std::chrono::system_clock::from_time_t(file->otime.timestamp) +
+                  minAge >
+              now) {
+        prior = file;
+        file = file->next;
+        continue;
+      }
 
-    num_aged_files++;
+      auto agedOtime = ageOutFile(*view, dirs_to_erase, file);
 
-    // Go back to last good file node; we can't trust that the
-    // value of file->next saved before age_out_file is a valid
-    // file node as anything past that point may have also been
-    // aged out along with it.
-    file = prior;
-  }
+      // Revise tick for fresh instance reporting
+      lastAgeOutTick_ = std::max(lastAgeOutTick_, agedOtime.ticks);
 
-  for (auto& name : dirs_to_erase) {
-    auto parent = view->resolveDir(name.dirName(), false);
-    if (parent) {
-      parent->dirs.erase(name.baseName());
+      num_aged_files++;
+
+      // The aged file has been unlinked from the recency list; resume from
+      // the last node that we kept.
+      file = prior ? prior->next : view->getLatestFile();
+    }
+
+    ClockTicks agedTick = 0;
+    auto agedTombstones = view->tombstones().ageOut(
+        std::chrono::system_clock::to_time_t(now - minAge), agedTick);
+    if (agedTombstones) {
+      lastAgeOutTick_ = std::max(lastAgeOutTick_, agedTick);
+      num_aged_files += agedTombstones;
     }
+
+    eraseDirsOfRemovedFiles(*view, dirs_to_erase);
+    view->updateDirTotals();
+    num_aged_dirs += dirs_to_erase.size();
+    // So that the memory use of the process shrinks after a mass deletion
+    released_bytes += view->releaseFreeStorage();
   }
 
-  if (num_aged_files + dirs_to_erase.size()) {
-    logf(ERR, "aged {} files, {} dirs\n", num_aged_files, dirs_to_erase.size());
+  if (num_aged_files + num_aged_dirs) {
+    logf(ERR, "aged {} files, {} dirs\n", num_aged_files, num_aged_dirs);
   }
   sample.add_meta(
       "age_out",
       json_object(
           {{"walked", json_integer(num_walked)},
            {"files", json_integer(num_aged_files)},
-           {"dirs", json_integer(dirs_to_erase.size())}}));
+           {"dirs", json_integer(num_aged_dirs)},
+           {"slices", json_integer(num_slices)},
+           {"released_bytes", json_integer(released_bytes)},
+           {"complete", json_boolean(complete)}}));
+}
+
+size_t InMemoryView::trimCaches() {
+  return caches_.eraseExpired();
+}
+
+void InMemoryView::compactDeletedFiles() {
+  if (!compactDeletedFiles_) {
+    return;
+  }
+  std::lock_guard<std::mutex> ageOutGuard{ageOutMutex_};
+
+  // Only the IO thread changes the view, so nothing newer can appear while
+  // we walk it.
+  auto tick = mostRecentTick_.load(std::memory_order_acquire);
+  size_t compacted = 0;
+  for (auto& shard : shards_) {
+    auto view = shard->wlock();
+
+    // The recency list is newest first, so this only walks the changes.
+    std::vector<watchman_file*> deleted;
+    for (auto* f = view->getLatestFile();
+         f && f->otime.ticks > lastCompactedTick_;
+         f = f->next) {
+      if (!f->exists) {
+        deleted.push_back(f);
+      }
+    }
+    if (deleted.empty()) {
+      continue;
+    }
+
+    std::unordered_set<w_string> dirs_to_erase;
+    std::unordered_map<const watchman_dir*, w_string> dirNames;
+    // Oldest first, to keep the tombstones in order.
+    for (auto it = deleted.rbegin(); it != deleted.rend(); ++it) {
+      auto* file = *it;
+      auto& dirName = dirNames[file->parent];
+      if (!dirName) {
+        dirName = file->parent->getFullPath();
+      }
+      auto name = file->getName().asWString();
+      dirs_to_erase.insert(w_string::pathCat({dirName, name}));
+      view->tombstones().add(Tombstone{
+          dirName,
+          std::move(name),
+          file->otime,
+          file->ctime,
+          mode_t(file->stat.mode & S_IFMT)});
+      view->removeFile(file);
+    }
+
+    // Unlike an age out, this follows the deletion closely, when parts of a
+    // deleted dir may not have been found to be deleted yet. Keep the dirs
+    // that still have file nodes below them.
+    for (auto it = dirs_to_erase.begin(); it != dirs_to_erase.end();) {
+      auto parent = view->resolveDir(it->dirName(), false);
+      auto dir = parent ? parent->getChildDir(it->baseName()) : nullptr;
+      if (dir && hasFileNodes(dir)) {
+        it = dirs_to_erase.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    eraseDirsOfRemovedFiles(*view, dirs_to_erase);
+    view->updateDirTotals();
+    view->releaseFreeStorage();
+    compacted += deleted.size();
+  }
+  lastCompactedTick_ = tick;
+
+  if (compacted) {
+    logf(DBG, "compacted {} deleted files into tombstones\n", compacted);
+  }
+}
+
+namespace {
+// Returns true if a change observed at `otime` is at or before the since
+// boundary of the query, and thus should not be reported.
+//
+// Note that we use <= for the time comparisons in here so that we
+// report the things that changed inclusive of the boundary presented.
+// This is especially important for clients using the coarse unix
+// timestamp as the since basis, as they would be much more
+// likely to miss out on changes if we didn't.
+bool isAtOrBeforeSince(const QueryContext* ctx, const ClockStamp& otime) {
+  if (auto* since_ts = std::get_if<QuerySince::Timestamp>(&ctx->since.since);
+      since_ts && otime.timestamp <= since_ts->time) {
+    return true;
+  }
+  if (auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since);
+      since_clock && otime.ticks <= since_clock->ticks) {
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Calls visit on the files of the recency lists of every shard, merged into
+ * order of most recent change, until visit returns false.
+ */
+template <typename Locks, typename Visit>
+void walkRecencyLists(const Locks& views, Visit&& visit) {
+  std::vector<watchman_file*> heads;
+  heads.reserve(views.size());
+  for (auto& view : views) {
+    heads.push_back(view->getLatestFile());
+  }
+
+  while (true) {
+    watchman_file** latest = nullptr;
+    for (auto& head : heads) {
+      if (head && (!latest || head->otime.ticks > (*latest)->otime.ticks)) {
+        latest = &head;
+      }
+    }
+    if (!latest) {
+      return;
+    }
+    auto file = *latest;
+    *latest = file->next;
+    if (!visit(file)) {
+      return;
+    }
+  }
+}
+
+// Whether dirName is dir or is below it
+bool isAtOrBelowDir(const w_string& dirName, const w_string& dir) {
+  return dirName == dir ||
+      (dirName.size() > dir.size() && dirName.piece().startsWith(dir) &&
+       is_slash(dirName.data()[dir.size()]));
+}
+
+/**
+ * Returns the tombstones of views that are newer than the query's boundary,
+ * and within relativeRoot unless it is null, most recent first. Those for a
+ * path that the view holds a node for again, which is newer, are left out,
+ * as are all but the newest of those for the same path.
+ */
+std::vector<const Tombstone*> collectTombstones(
+    const std::vector<const ViewDatabase*>& views,
+    const QueryContext* ctx,
+    const w_string& relativeRoot) {
+  std::vector<std::pair<const ViewDatabase*, const Tombstone*>> candidates;
+  for (auto* view : views) {
+    const auto& log = view->tombstones();
+    for (auto it = log.newest();
+         it != log.end() && !isAtOrBeforeSince(ctx, it->otime);
+         ++it) {
+      if (!relativeRoot || isAtOrBelowDir(it->dirName, relativeRoot)) {
+        candidates.emplace_back(view, &*it);
+      }
+    }
+  }
+  std::stable_sort(
+      candidates.begin(), candidates.end(), [](auto& a, auto& b) {
+        return a.second->otime.ticks > b.second->otime.ticks;
+      });
+
+  std::vector<const Tombstone*> tombstones;
+  std::unordered_set<w_string> seen;
+  for (auto& [view, tombstone] : candidates) {
+    auto dir = view->resolveDir(tombstone->dirName);
+    if ((dir && dir->getChildFile(tombstone->name)) ||
+        !seen.insert(w_string::pathCat({tombstone->dirName, tombstone->name}))
+             .second) {
+      continue;
+    }
+    tombstones.push_back(tombstone);
+  }
+  return tombstones;
+}
+} // namespace
+
+size_t InMemoryView::addRecentlyChangedDirs(
+    PendingChanges& pending,
+    std::chrono::system_clock::duration window) const {
+  auto now = std::chrono::system_clock::now();
+  auto since = std::chrono::system_clock::to_time_t(now - window);
+
+  std::unordered_set<w_string> dirs;
+  {
+    auto views = rlockAllShards();
+    walkRecencyLists(views, [&](watchman_file* f) {
+      if (f->otime.timestamp < since || dirs.size() >= kMaxRecoveryDirs) {
+        return false;
+      }
+      dirs.insert(f->parent->getFullPath());
+      return true;
+    });
+  }
+
+  for (auto& dir : dirs) {
+    pending.add(dir, now, W_PENDING_RECURSIVE | W_PENDING_IS_DESYNCED);
+  }
+  return dirs.size();
+}
+
+void InMemoryView::noteQueryScope(const Query* query) const {
+  const auto& relative_root =
+      query->relative_root ? query->relative_root : rootPath_;
+  if (relative_root != rootPath_) {
+    watcher_->noteActiveSubtree(relative_root);
+  }
+  if (query->paths.has_value()) {
+    for (const auto& path : *query->paths) {
+      auto full_name = w_string::pathCat({relative_root, path.name});
+      if (full_name != rootPath_) {
+        watcher_->noteActiveSubtree(full_name);
+      }
+    }
+  }
+}
+
+void InMemoryView::wakeFromHibernation() const {
+  if (!hibernated_.load(std::memory_order_acquire)) {
+    return;
+  }
+  // The IO thread restores the view before it fulfills any sync.
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  {
+    auto pending = pendingFromWatcher_.lock();
+    pending->addSync(std::move(p));
+    pending->ping();
+  }
+  std::move(f).get();
+}
+
+namespace {
+// Adds the paths below dirPath that the rules of node walk through to
+// scopes: the names of literal rules, and dirPath itself where a rule can
+// match any name in it.
+void collectGlobScopes(
+    const GlobTree* node,
+    const w_string& dirPath,
+    bool caseFold,
+    std::vector<w_string>& scopes) {
+  bool anyName = caseFold || !node->doublestar_children.empty();
+  for (const auto& child : node->children) {
+    anyName = anyName || child->had_specials;
+  }
+  if (anyName) {
+    scopes.push_back(dirPath);
+    return;
+  }
+  for (const auto& child : node->children) {
+    auto childPath = w_string::pathCat({dirPath, child->pattern});
+    if (child->is_leaf) {
+      scopes.push_back(std::move(childPath));
+    } else {
+      collectGlobScopes(child.get(), childPath, caseFold, scopes);
+    }
+  }
+}
+
+
+// Marks the unexplored dirs of lazyDirs that lie within or contain a scope
+// as requested, adding them to toCrawl. Returns whether any dir that is not
+// yet in the view lies there.
+template <typename LazyDirs>
+bool requestLazyDirs(
+    LazyDirs& lazyDirs,
+    const w_string& rootPath,
+    const std::vector<w_string>& scopes,
+    std::vector<w_string>& toCrawl) {
+  using State = typename LazyDirs::mapped_type;
+  bool found = false;
+  auto need = [&](typename LazyDirs::iterator it) {
+    if (it->second == State::Kept) {
+      return;
+    }
+    found = true;
+    if (it->second == State::Unexplored) {
+      it->second = State::Requested;
+      toCrawl.push_back(it->first);
+    }
+  };
+  for (const auto& scope : scopes) {
+    // The scope may lie within a lazy dir...
+    for (size_t i = rootPath.size() + 1; i <= scope.size(); ++i) {
+      if (i == scope.size() || scope.data()[i] == '/') {
+        auto it = lazyDirs.find(w_string{scope.data(), i});
+        if (it != lazyDirs.end()) {
+          need(it);
+        }
+      }
+    }
+    // ...or contain some.
+    auto prefix = w_string::build(scope, "/");
+    for (auto it = lazyDirs.lower_bound(prefix);
+         it != lazyDirs.end() && it->first.piece().startsWith(prefix);
+         ++it) {
+      need(it);
+    }
+  }
+  return found;
+}
+} // namespace
+
+void InMemoryView::crawlLazyScope(const Query* query) const {
+  const bool vcsIgnored = vcsIgnoreCrawl_ && query->includeVcsIgnored;
+  if (lazyCrawlDepth_ == 0 && !vcsIgnored) {
+    return;
+  }
+  const auto& relative_root =
+      query->relative_root ? query->relative_root : rootPath_;
+  std::vector<w_string> scopes;
+  if (query->paths.has_value()) {
+    for (const auto& path : *query->paths) {
+      scopes.push_back(w_string::pathCat({relative_root, path.name}));
+    }
+  } else if (query->glob_tree) {
+    collectGlobScopes(
+        query->glob_tree.get(),
+        relative_root,
+        query->case_sensitive != CaseSensitivity::CaseSensitive,
+        scopes);
+  } else if (relative_root != rootPath_) {
+    scopes.push_back(relative_root);
+  }
+
+  std::vector<w_string> toCrawl;
+  bool mustWait = false;
+  if (lazyCrawlDepth_ > 0) {
+    auto lazyDirs = lazyDirs_.wlock();
+    mustWait = !lazyDirs->empty() &&
+        requestLazyDirs(*lazyDirs, rootPath_, scopes, toCrawl);
+  }
+  if (vcsIgnored) {
+    // Asking for them is explicit, so a query over the whole root crawls
+    // all of them.
+    if (scopes.empty()) {
+      scopes.push_back(rootPath_);
+    }
+    auto vcsIgnoredDirs = vcsIgnoredDirs_.wlock();
+    if (!vcsIgnoredDirs->empty() &&
+        requestLazyDirs(*vcsIgnoredDirs, rootPath_, scopes, toCrawl)) {
+      mustWait = true;
+    }
+  }
+  if (!mustWait) {
+    return;
+  }
+
+  // Crawls that another query requested may still be in progress, so wait
+  // for the IO thread either way.
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  {
+    auto pending = pendingFromWatcher_.lock();
+    auto now = std::chrono::system_clock::now();
+    for (auto& dir : toCrawl) {
+      logf(DBG, "crawling lazy dir {} for a query\n", dir);
+      pending->add(dir, now, W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY);
+    }
+    pending->addSync(std::move(p));
+    pending->ping();
+  }
+  try {
+    if (query->sync_timeout.count() > 0) {
+      std::move(f).get(query->sync_timeout);
+    } else {
+      std::move(f).get();
+    }
+  } catch (folly::FutureTimeout&) {
+    auto why = fmt::format(
+        "timed out waiting for the lazy crawl of {} within {} milliseconds",
+        scopes.empty() ? rootPath_ : scopes.front(),
+        query->sync_timeout.count());
+    log(ERR, why, "\n");
+    throw std::system_error(ETIMEDOUT, std::generic_category(), why);
+  }
 }
 
 void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
+  wakeFromHibernation();
+  noteQueryScope(query);
+  crawlLazyScope(query);
+  if (changeLogGenerator(query, ctx)) {
+    ctx->noteGenerator("change_log");
+    return;
+  }
+
+  if (query->relative_root && query->relative_root != rootPath_) {
+    // Only walk the portion of the tree below the relative root, using the
+    // per-directory recency lists rather than the global one.  This keeps
+    // the cost proportional to the changes under relative_root.
+    auto view = std::as_const(*shards_[shardIndex(query->relative_root)])
+                    .rlock();
+    ctx->generationStarted();
+    if (const auto dir = view->resolveDir(query->relative_root)) {
+      timeGeneratorSubtree(query, ctx, dir);
+    }
+    // Even if the relative root itself has been compacted away
+    for (auto* tombstone :
+         collectTombstones({&*view}, ctx, query->relative_root)) {
+      ctx->bumpNumWalked();
+      w_query_process_file(
+          query, ctx, ctx->makeFileResult<TombstoneFileResult>(*tombstone));
+    }
+    return;
+  }
+
   // Walk back in time until we hit the boundary
-  auto view = view_.rlock();
+  auto views = rlockAllShards();
   ctx->generationStarted();
 
-  for (watchman_file* f = view->getLatestFile(); f; f = f->next) {
+  std::vector<const ViewDatabase*> databases;
+  for (auto& view : views) {
+    databases.push_back(&*view);
+  }
+  // A fresh instance walks the whole of the recency lists; otherwise how far
+  // back the boundary lies is only found by walking to it.
+  if (auto* since = std::get_if<QuerySince::Clock>(&ctx->since.since);
+      since && since->is_fresh_instance) {
+    size_t numFiles = 0;
+    for (auto* database : databases) {
+      numFiles += database->getFileCount();
+    }
+    ctx->expectResults(numFiles);
+  }
+  auto tombstones = collectTombstones(databases, ctx, w_string{});
+  auto nextTombstone = tombstones.begin();
+  // Generates the tombstones newer than ticks, so that they are merged into
+  // the walk in otime order. Returns false once the limit has been reached.
+  auto generateTombstonesAfter = [&](ClockTicks ticks) {
+    for (; nextTombstone != tombstones.end() &&
+         (*nextTombstone)->otime.ticks > ticks;
+         ++nextTombstone) {
+      if (ctx->isLimitReachedInOtimeOrder()) {
+        return false;
+      }
+      ctx->bumpNumWalked();
+      w_query_process_file(
+          query,
+          ctx,
+          ctx->makeFileResult<TombstoneFileResult>(**nextTombstone));
+    }
+    return true;
+  };
+
+  walkRecencyLists(views, [&](watchman_file* f) {
     ctx->bumpNumWalked();
-    // Note that we use <= for the time comparisons in here so that we
-    // report the things that changed inclusive of the boundary presented.
-    // This is especially important for clients using the coarse unix
-    // timestamp as the since basis, as they would be much more
-    // likely to miss out on changes if we didn't.
-    if (auto* since_ts = std::get_if<QuerySince::Timestamp>(&ctx->since.since);
-        since_ts && f->otime.timestamp <= since_ts->time) {
-      break;
+    if (isAtOrBeforeSince(ctx, f->otime)) {
+      return false;
     }
-    if (auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since);
-        since_clock && f->otime.ticks <= since_clock->ticks) {
-      break;
+    if (!generateTombstonesAfter(f->otime.ticks)) {
+      return false;
+    }
+    // The walk is newest first, so nothing after this could displace the
+    // results already held.
+    if (ctx->isLimitReachedInOtimeOrder()) {
+      return false;
     }
 
-    if (!ctx->fileMatchesRelativeRoot(f)) {
-      continue;
+    w_query_process_file(
+        query, ctx, ctx->makeFileResult<InMemoryFileResult>(f, caches_));
+    return true;
+  });
+  generateTombstonesAfter(0);
+}
+
+bool InMemoryView::changeLogGenerator(
+    const Query* query,
+    QueryContext* ctx) const {
+  auto* since = std::get_if<QuerySince::Clock>(&ctx->since.since);
+  if (!changeLogMaxFiles_ || !since || since->is_fresh_instance) {
+    return false;
+  }
+
+  // Newest first
+  std::vector<std::shared_ptr<const ChangeSet>> sets;
+  {
+    auto log = changeLog_.rlock();
+    if (!log->toTick || since->ticks < log->fromTick ||
+        ctx->clockAtStartOfQuery.position().ticks > log->toTick) {
+      return false;
+    }
+    for (auto it = log->sets.rbegin();
+         it != log->sets.rend() && (*it)->toTick > since->ticks;
+         ++it) {
+      sets.push_back(*it);
+    }
+  }
+  ctx->generationStarted();
+
+  const auto& relativeRoot =
+      query->relative_root ? query->relative_root : rootPath_;
+  if (relativeRoot == rootPath_) {
+    size_t numFiles = 0;
+    for (auto& set : sets) {
+      numFiles += set->files.size();
+    }
+    ctx->expectResults(numFiles);
+  }
+  auto isUnderRelativeRoot = [&](const w_string& dirName) {
+    return relativeRoot == rootPath_ || isAtOrBelowDir(dirName, relativeRoot);
+  };
+
+  // A file that changed again in a later set is only reported as it was
+  // then. The files of a single set are distinct.
+  const bool dedupe = sets.size() > 1;
+  std::unordered_set<w_string> seen;
+  for (auto& set : sets) {
+    for (auto& changed : set->files) {
+      ctx->bumpNumWalked();
+      if (isAtOrBeforeSince(ctx, changed.file->otime)) {
+        break;
+      }
+      if (ctx->isLimitReachedInOtimeOrder()) {
+        return true;
+      }
+      if (!isUnderRelativeRoot(changed.dirName) ||
+          (dedupe &&
+           !seen.insert(w_string::pathCat(
+                            {changed.dirName, changed.file->getName()}))
+                .second)) {
+        continue;
+      }
+      w_query_process_file(
+          query,
+          ctx,
+          ctx->makeFileResult<InMemoryFileResult>(
+              changed.file.get(), caches_, changed.dirName, set));
+    }
+  }
+  return true;
+}
+
+namespace {
+// A copy of f, detached from the view, for the change log
+watchman_dir::FilePtr copyChangedFile(const watchman_file* f) {
+  auto copy = watchman_file::make(
+      f->getName().asWString(), nullptr, f->has_extended_stat);
+  copy->otime = f->otime;
+  copy->ctime = f->ctime;
+  copy->exists = f->exists;
+  copy->maybe_deleted = f->maybe_deleted;
+  copy->setStat(f->getFileInformation());
+  copy->stat_deferred = f->stat_deferred;
+  return copy;
+}
+} // namespace
+
+void InMemoryView::recordChangeSet(bool stateAsserted, bool settled) {
+  if (!changeLogMaxFiles_) {
+    return;
+  }
+  auto maxFiles = stateAsserted ? changeLogStateMaxFiles_ : changeLogMaxFiles_;
+
+  // Only the IO thread writes the log, so it can be read without a lock
+  // held throughout.
+  auto lastTick = changeLog_.rlock()->toTick;
+  std::shared_ptr<ChangeSet> set;
+  bool complete = true;
+  {
+    auto views = rlockAllShards();
+    auto toTick = mostRecentTick_.load(std::memory_order_acquire);
+    if (toTick != lastTick) {
+      set = std::make_shared<ChangeSet>();
+      set->toTick = toTick;
+    }
+    if (set && lastTick) {
+      walkRecencyLists(views, [&](watchman_file* f) {
+        if (f->otime.ticks <= lastTick) {
+          return false;
+        }
+        if (set->files.size() >= maxFiles) {
+          complete = false;
+          return false;
+        }
+        set->files.push_back(
+            ChangeSet::File{f->parent->getFullPath(), copyChangedFile(f)});
+        return true;
+      });
+    }
+  }
+
+  auto log = changeLog_.wlock();
+  if (set) {
+    log->toTick = set->toTick;
+    if (!lastTick || !complete) {
+      // Start over from here: too much changed to be worth keeping.
+      log->sets.clear();
+      log->numFiles = 0;
+      log->fromTick = set->toTick;
+      log->stateFromTick.reset();
+      log->unsettledFromTick.reset();
+      if (stateAsserted) {
+        log->stateFromTick = log->toTick;
+      }
+      return;
+    }
+    log->numFiles += set->files.size();
+    log->sets.push_back(std::move(set));
+    if (!settled && !log->unsettledFromTick) {
+      log->unsettledFromTick = lastTick;
+    }
+  }
+
+  if (stateAsserted) {
+    if (!log->stateFromTick) {
+      log->stateFromTick = lastTick;
+    }
+  } else if (settled && log->stateFromTick) {
+    // The subscriptions that deferred during the state are about to catch
+    // up on everything that changed meanwhile; have them read it as one set,
+    // which is kept until the next settle however large it is.
+    mergeChangeSets(*log, *std::exchange(log->stateFromTick, std::nullopt));
+    maxFiles = changeLogStateMaxFiles_;
+  } else if (log->stateFromTick) {
+    // Hold on to the sets of the state until the settle that merges them
+    maxFiles = changeLogStateMaxFiles_;
+  }
+
+  if (settled && log->unsettledFromTick) {
+    // The subscriptions that run at this settle read the batches recorded
+    // since the last one as a single set.
+    mergeChangeSets(
+        *log, *std::exchange(log->unsettledFromTick, std::nullopt));
+  }
+
+  while (log->numFiles > maxFiles) {
+    log->numFiles -= log->sets.front()->files.size();
+    log->fromTick = log->sets.front()->toTick;
+    log->sets.pop_front();
+  }
+}
+
+bool InMemoryView::addChangePrefilter(
+    std::shared_ptr<ChangePrefilter> prefilter) {
+  if (!prefilterMaxFiles_) {
+    return false;
+  }
+  changePrefilters_.wlock()->push_back(std::move(prefilter));
+  return true;
+}
+
+void InMemoryView::markChangePrefilters() {
+  if (!prefilterMaxFiles_) {
+    return;
+  }
+
+  // Only the IO thread changes the view, so nothing newer can appear while
+  // we walk it.
+  auto lastTick = std::exchange(
+      lastPrefilterTick_, mostRecentTick_.load(std::memory_order_acquire));
+
+  // Those that were matched already stay so until their subscription runs
+  std::vector<std::shared_ptr<ChangePrefilter>> unmatched;
+  {
+    auto prefilters = changePrefilters_.wlock();
+    auto it = prefilters->begin();
+    while (it != prefilters->end()) {
+      auto prefilter = it->lock();
+      if (!prefilter) {
+        it = prefilters->erase(it);
+        continue;
+      }
+      if (!prefilter->matched.load(std::memory_order_acquire)) {
+        unmatched.push_back(std::move(prefilter));
+      }
+      ++it;
+    }
+  }
+  if (unmatched.empty() || lastTick == lastPrefilterTick_) {
+    return;
+  }
+
+  // Without nodes to walk, or without a boundary, anything may have changed
+  bool markAll = !lastTick || hibernated_.load(std::memory_order_acquire);
+  if (!markAll) {
+    auto views = rlockAllShards();
+    std::unordered_map<const watchman_dir*, w_string> dirNames;
+    size_t walked = 0;
+    walkRecencyLists(views, [&](watchman_file* f) {
+      if (f->otime.ticks <= lastTick) {
+        return false;
+      }
+      if (++walked > prefilterMaxFiles_) {
+        markAll = true;
+        return false;
+      }
+      auto& dirName = dirNames[f->parent];
+      if (!dirName) {
+        dirName = f->parent->getFullPath();
+      }
+      auto it = unmatched.begin();
+      while (it != unmatched.end()) {
+        if ((*it)->matches(dirName, f->getName())) {
+          (*it)->matched.store(true, std::memory_order_release);
+          it = unmatched.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      return !unmatched.empty();
+    });
+  }
+
+  if (markAll) {
+    for (auto& prefilter : unmatched) {
+      prefilter->matched.store(true, std::memory_order_release);
+    }
+  }
+}
+
+void InMemoryView::mergeChangeSets(ChangeLog& log, ClockTicks fromTick) {
+  auto first = std::find_if(log.sets.begin(), log.sets.end(), [&](auto& set) {
+    return set->toTick > fromTick;
+  });
+  if (log.sets.end() - first < 2) {
+    return;
+  }
+
+  // Each set is newer than the ones before it, so taking them newest first
+  // keeps the merged files most recently changed first, and the first copy
+  // of a file is the latest.
+  auto merged = std::make_shared<ChangeSet>();
+  merged->toTick = log.sets.back()->toTick;
+  std::unordered_set<w_string> seen;
+  for (auto it = log.sets.rbegin(); it.base() != first; ++it) {
+    for (auto& changed : (*it)->files) {
+      if (seen.insert(w_string::pathCat(
+                          {changed.dirName, changed.file->getName()}))
+              .second) {
+        merged->files.push_back(ChangeSet::File{
+            changed.dirName, copyChangedFile(changed.file.get())});
+      }
+    }
+  }
+
+  for (auto it = first; it != log.sets.end(); ++it) {
+    log.numFiles -= (*it)->files.size();
+  }
+  log.sets.erase(first, log.sets.end());
+  log.numFiles += merged->files.size();
+  log.sets.push_back(std::move(merged));
+}
+
+void InMemoryView::timeGeneratorSubtree(
+    const Query* query,
+    QueryContext* ctx,
+    const watchman_dir* dir) const {
+  if (isAtOrBeforeSince(ctx, dir->subtreeLatest)) {
+    // Nothing in this subtree changed since the boundary.
+    return;
+  }
+
+  for (watchman_file* f = dir->latestFile; f; f = f->dirNext) {
+    ctx->bumpNumWalked();
+    if (isAtOrBeforeSince(ctx, f->otime)) {
+      break;
     }
 
     w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+        query, ctx, ctx->makeFileResult<InMemoryFileResult>(f, caches_));
+  }
+
+  for (auto& it : dir->dirs) {
+    timeGeneratorSubtree(query, ctx, it.second.get());
   }
 }
 
 void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
+  wakeFromHibernation();
+  noteQueryScope(query);
+  crawlLazyScope(query);
   w_string_t* relative_root;
   struct watchman_file* f;
 
@@ -612,8 +2188,9 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
     relative_root = rootPath_;
   }
 
-  auto view = view_.rlock();
+  auto views = rlockAllShards();
   ctx->generationStarted();
+  ctx->expectResults(query->paths->size());
 
   for (const auto& path : *query->paths) {
     const watchman_dir* dir;
@@ -624,11 +2201,16 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
 
     // special case of root dir itself
     if (w_string_equal(rootPath_, full_name)) {
-      // dirname on the root is outside the root, which is useless
-      dir = view->resolveDir(full_name);
-      goto is_dir;
+      // dirname on the root is outside the root, which is useless.  Each
+      // shard holds a part of the root.
+      for (auto& view : views) {
+        dirGenerator(query, ctx, view->resolveDir(full_name), path.depth);
+      }
+      continue;
     }
 
+    const auto& view = views[shardIndex(full_name)];
+
     // Ideally, we'd just resolve it directly as a dir and be done.
     // It's not quite so simple though, because we may resolve a dir
     // that had been deleted and replaced by a file.
@@ -653,7 +2235,7 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
       if (f && (!f->exists || !f->stat.isDir())) {
         ctx->bumpNumWalked();
         w_query_process_file(
-            query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+            query, ctx, ctx->makeFileResult<InMemoryFileResult>(f, caches_));
         continue;
       }
     }
@@ -664,7 +2246,6 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
     }
 
     dir = dir->getChildDir(full_name.baseName());
-  is_dir:
     // We got a dir; process recursively to specified depth
     if (dir) {
       dirGenerator(query, ctx, dir, path.depth);
@@ -677,22 +2258,59 @@ void InMemoryView::dirGenerator(
     QueryContext* ctx,
     const watchman_dir* dir,
     uint32_t depth) const {
+  dirGenerator(query, ctx, dir, dir->getFullPath(), depth);
+}
+
+void InMemoryView::dirGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const watchman_dir* dir,
+    const w_string& dirPath,
+    uint32_t depth) const {
+  ctx->expectResults(dir->files.size());
+  QueryFileBatch batch{query, ctx};
   for (auto& it : dir->files) {
     auto file = it.second.get();
     ctx->bumpNumWalked();
 
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(file, caches_));
+    batch.add(ctx->makeFileResult<InMemoryFileResult>(file, caches_, dirPath));
   }
+  batch.flush();
 
   if (depth > 0) {
     for (auto& it : dir->dirs) {
       const auto child = it.second.get();
 
-      dirGenerator(query, ctx, child, depth - 1);
-    }
+      dirGenerator(
+          query,
+          ctx,
+          child,
+          w_string::build(dirPath, "/", child->name),
+          depth - 1);
+    }
+  }
+}
+
+namespace {
+int globMatchFlags(const Query* query) {
+  return query->glob_flags |
+      (query->case_sensitive == CaseSensitivity::CaseSensitive ? 0
+                                                               : WM_CASEFOLD);
+}
+
+// Matches a single path component against a non-doublestar node, without
+// calling wildmatch when the pattern has the common `*.ext` shape.
+bool globNodeMatches(
+    const GlobTree& node,
+    w_string_piece name,
+    const Query* query) {
+  auto flags = globMatchFlags(query);
+  if (node.star) {
+    return node.star->matches(name, flags);
   }
+  return wildmatch(node.pattern.c_str(), name.data(), flags, 0) == WM_MATCH;
 }
+} // namespace
 
 /** This is our specialized handler for the ** recursive glob pattern.
  * This is the unhappy path because we have no choice but to recursively
@@ -709,15 +2327,31 @@ void InMemoryView::dirGenerator(
 void InMemoryView::globGeneratorDoublestar(
     QueryContext* ctx,
     const struct watchman_dir* dir,
+    const w_string& dirPath,
     const GlobTree* node,
-    const char* dir_name,
-    uint32_t dir_name_len) const {
+    std::string& relativePath,
+    bool underDotDir) const {
   bool matched;
+  const auto dirLen = relativePath.size();
+  const int flags = globMatchFlags(ctx->query);
+  // A `**` can't pass through a dot dir unless dotfiles are included, so
+  // none of the star patterns can match anything below one.
+  const bool starCanMatch = !underDotDir || !(flags & WM_PERIOD);
+  // Replaces whatever follows the dir in relativePath with name.
+  auto setSubject = [&](w_string_piece name) {
+    relativePath.resize(dirLen);
+    if (dirLen) {
+      // wildmatch wants unix separators
+      relativePath.push_back('/');
+    }
+    relativePath.append(name.data(), name.size());
+  };
 
   // First step is to walk the set of files contained in this node
   for (auto& it : dir->files) {
     auto file = it.second.get();
     auto file_name = file->getName();
+    bool haveSubject = false;
 
     ctx->bumpNumWalked();
 
@@ -726,30 +2360,31 @@ void InMemoryView::globGeneratorDoublestar(
       continue;
     }
 
-    auto subject = make_path_name(
-        dir_name, dir_name_len, file_name.data(), file_name.size());
-
     // Now that we have computed the name of this candidate file node,
     // attempt to match against each of the possible doublestar patterns
     // in turn.  As soon as any one of them matches we can stop this loop
     // as it doesn't make a lot of sense to yield multiple results for
     // the same file.
     for (const auto& child_node : node->doublestar_children) {
-      matched =
-          wildmatch(
-              child_node->pattern.c_str(),
-              subject.c_str(),
-              ctx->query->glob_flags | WM_PATHNAME |
-                  (ctx->query->case_sensitive == CaseSensitivity::CaseSensitive
-                       ? 0
-                       : WM_CASEFOLD),
-              0) == WM_MATCH;
+      if (child_node->star) {
+        matched = starCanMatch && child_node->star->matches(file_name, flags);
+      } else {
+        if (!haveSubject) {
+          setSubject(file_name);
+          haveSubject = true;
+        }
+        matched = wildmatch(
+                      child_node->pattern.c_str(),
+                      relativePath.c_str(),
+                      flags | WM_PATHNAME,
+                      0) == WM_MATCH;
+      }
 
       if (matched) {
         w_query_process_file(
             ctx->query,
             ctx,
-            std::make_unique<InMemoryFileResult>(file, caches_));
+            ctx->makeFileResult<InMemoryFileResult>(file, caches_, dirPath));
         // No sense running multiple matches for this same file node
         // if this one succeeded.
         break;
@@ -766,19 +2401,28 @@ void InMemoryView::globGeneratorDoublestar(
       continue;
     }
 
-    auto subject = make_path_name(
-        dir_name, dir_name_len, child->name.data(), child->name.size());
-    globGeneratorDoublestar(ctx, child, node, subject.data(), subject.size());
+    setSubject(child->name);
+    globGeneratorDoublestar(
+        ctx,
+        child,
+        w_string::build(dirPath, "/", child->name),
+        node,
+        relativePath,
+        underDotDir || child->name.piece().startsWith("."));
   }
+
+  relativePath.resize(dirLen);
 }
 
 /* Match each child of node against the children of dir */
 void InMemoryView::globGeneratorTree(
     QueryContext* ctx,
     const GlobTree* node,
-    const struct watchman_dir* dir) const {
+    const struct watchman_dir* dir,
+    const w_string& dirPath) const {
   if (!node->doublestar_children.empty()) {
-    globGeneratorDoublestar(ctx, dir, node, nullptr, 0);
+    std::string relativePath;
+    globGeneratorDoublestar(ctx, dir, dirPath, node, relativePath, false);
   }
 
   for (const auto& child_node : node->children) {
@@ -797,8 +2441,26 @@ void InMemoryView::globGeneratorTree(
         const auto child_dir = dir->getChildDir(component);
 
         if (child_dir) {
-          globGeneratorTree(ctx, child_node.get(), child_dir);
+          globGeneratorTree(
+              ctx,
+              child_node.get(),
+              child_dir,
+              w_string::build(dirPath, "/", child_dir->name));
         }
+      } else if (!child_node->had_specials && dir->foldsCase()) {
+        // On a filesystem that is not case sensitive, the dir's case-folded
+        // index can be used instead.
+        w_string_piece component(
+            child_node->pattern.data(), child_node->pattern.size());
+        dir->forEachChildDirCaseless(component, [&](const watchman_dir* d) {
+          if (d->last_check_existed) {
+            globGeneratorTree(
+                ctx,
+                child_node.get(),
+                d,
+                w_string::build(dirPath, "/", d->name));
+          }
+        });
       } else {
         // Otherwise we have to walk and match
         for (auto& it : dir->dirs) {
@@ -809,16 +2471,13 @@ void InMemoryView::globGeneratorTree(
             continue;
           }
 
-          if (wildmatch(
-                  child_node->pattern.c_str(),
-                  child_dir->name.c_str(),
-                  ctx->query->glob_flags |
-                      (ctx->query->case_sensitive ==
-                               CaseSensitivity::CaseSensitive
-                           ? 0
-                           : WM_CASEFOLD),
-                  0) == WM_MATCH) {
-            globGeneratorTree(ctx, child_node.get(), child_dir);
+          if (globNodeMatches(
+                  *child_node, child_dir->name.piece(), ctx->query)) {
+            globGeneratorTree(
+                ctx,
+                child_node.get(),
+                child_dir,
+                w_string::build(dirPath, "/", child_dir->name));
           }
         }
       }
@@ -840,9 +2499,23 @@ void InMemoryView::globGeneratorTree(
             w_query_process_file(
                 ctx->query,
                 ctx,
-                std::make_unique<InMemoryFileResult>(file, caches_));
+                ctx->makeFileResult<InMemoryFileResult>(
+                    file, caches_, dirPath));
           }
         }
+      } else if (!child_node->had_specials && dir->foldsCase()) {
+        w_string_piece component(
+            child_node->pattern.data(), child_node->pattern.size());
+        dir->forEachChildFileCaseless(component, [&](watchman_file* file) {
+          ctx->bumpNumWalked();
+          if (file->exists) {
+            w_query_process_file(
+                ctx->query,
+                ctx,
+                ctx->makeFileResult<InMemoryFileResult>(
+                    file, caches_, dirPath));
+          }
+        });
       } else {
         for (auto& it : dir->files) {
           // Otherwise we have to walk and match
@@ -855,19 +2528,12 @@ void InMemoryView::globGeneratorTree(
             continue;
           }
 
-          if (wildmatch(
-                  child_node->pattern.c_str(),
-                  file_name.data(),
-                  ctx->query->glob_flags |
-                      (ctx->query->case_sensitive ==
-                               CaseSensitivity::CaseSensitive
-                           ? 0
-                           : WM_CASEFOLD),
-                  0) == WM_MATCH) {
+          if (globNodeMatches(*child_node, file_name, ctx->query)) {
             w_query_process_file(
                 ctx->query,
                 ctx,
-                std::make_unique<InMemoryFileResult>(file, caches_));
+                ctx->makeFileResult<InMemoryFileResult>(
+                    file, caches_, dirPath));
           }
         }
       }
@@ -876,6 +2542,9 @@ void InMemoryView::globGeneratorTree(
 }
 
 void InMemoryView::globGenerator(const Query* query, QueryContext* ctx) const {
+  wakeFromHibernation();
+  noteQueryScope(query);
+  crawlLazyScope(query);
   w_string relative_root;
 
   if (query->relative_root) {
@@ -884,43 +2553,400 @@ void InMemoryView::globGenerator(const Query* query, QueryContext* ctx) const {
     relative_root = rootPath_;
   }
 
-  auto view = view_.rlock();
+  // The shards are walked one at a time, so that the IO thread is only held
+  // off the shard that we are currently reading.
+  auto [begin, end] = shardRangeForDir(relative_root);
+  for (auto i = begin; i < end; ++i) {
+    auto view = std::as_const(*shards_[i]).rlock();
+
+    const auto dir = view->resolveDir(relative_root);
+    if (!dir) {
+      QueryExecError::throwf(
+          "glob_generator could not resolve {}, check your relative_root parameter!",
+          relative_root);
+    }
+
+    globGeneratorTree(ctx, query->glob_tree.get(), dir, dir->getFullPath());
+  }
+}
+
+bool InMemoryView::shouldGenerateInParallel(
+    const Query* query,
+    size_t fileCount) const {
+  if (parallelQueryMaxWorkers_ == 0) {
+    return false;
+  }
+  return query->parallel ||
+      (parallelQueryFileThreshold_ > 0 &&
+       fileCount >= parallelQueryFileThreshold_);
+}
+
+void InMemoryView::parallelDirGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const watchman_dir* dir) const {
+  // Split the tree into subtrees that can be walked independently.  Descend
+  // a couple of levels if the top is too narrow to keep the workers busy;
+  // the files of every dir we split are walked here.
+  constexpr int kMaxSplitDepth = 3;
+  const size_t targetSubtrees = parallelQueryMaxWorkers_ * 4;
+
+  std::vector<const watchman_dir*> subtrees{dir};
+  for (int level = 0; level < kMaxSplitDepth &&
+       !subtrees.empty() && subtrees.size() < targetSubtrees;
+       ++level) {
+    std::vector<const watchman_dir*> next;
+    for (auto d : subtrees) {
+      dirGenerator(query, ctx, d, 0);
+      for (auto& it : d->dirs) {
+        next.push_back(it.second.get());
+      }
+    }
+    subtrees = std::move(next);
+  }
+
+  if (subtrees.size() <= 1) {
+    for (auto d : subtrees) {
+      dirGenerator(query, ctx, d, UINT32_MAX);
+    }
+    return;
+  }
+
+  // State shared between this thread and the pool tasks.  Tasks that don't
+  // start running until after we've finished must not touch anything other
+  // than this state, so it is reference counted.
+  struct State {
+    std::vector<const watchman_dir*> subtrees;
+    std::atomic<size_t> nextSubtree{0};
+    std::vector<std::unique_ptr<QueryContext>> contexts;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool finished{false};
+    size_t active{0};
+    std::exception_ptr error;
+  };
+  auto state = std::make_shared<State>();
+  state->subtrees = std::move(subtrees);
+
+  auto walk = [this, query](State& state, QueryContext* walkCtx) {
+    while (true) {
+      auto idx = state.nextSubtree.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= state.subtrees.size()) {
+        return;
+      }
+      dirGenerator(query, walkCtx, state.subtrees[idx], UINT32_MAX);
+    }
+  };
+
+  auto numWorkers =
+      std::min(parallelQueryMaxWorkers_, state->subtrees.size() - 1);
+  for (size_t i = 0; i < numWorkers; ++i) {
+    state->contexts.push_back(ctx->makeWorkerContext());
+  }
+
+  for (size_t i = 0; i < numWorkers; ++i) {
+    try {
+      getThreadPool().add([state, walk, i] {
+        {
+          std::lock_guard<std::mutex> lock{state->mutex};
+          if (state->finished) {
+            return;
+          }
+          ++state->active;
+        }
+        try {
+          walk(*state, state->contexts[i].get());
+        } catch (...) {
+          state->nextSubtree.store(state->subtrees.size());
+          std::lock_guard<std::mutex> lock{state->mutex};
+          if (!state->error) {
+            state->error = std::current_exception();
+          }
+        }
+        {
+          std::lock_guard<std::mutex> lock{state->mutex};
+          --state->active;
+        }
+        state->cond.notify_all();
+      });
+    } catch (const std::exception& exc) {
+      // The pool is full or stopping; we'll just do more of the work here.
+      log(DBG, "parallelDirGenerator: ", exc.what(), "\n");
+      break;
+    }
+  }
+
+  std::exception_ptr error;
+  try {
+    walk(*state, ctx);
+  } catch (...) {
+    // Stop handing out work and propagate the error once the tasks that
+    // are running have finished.
+    state->nextSubtree.store(state->subtrees.size());
+    error = std::current_exception();
+  }
 
-  const auto dir = view->resolveDir(relative_root);
-  if (!dir) {
-    QueryExecError::throwf(
-        "glob_generator could not resolve {}, check your relative_root parameter!",
-        relative_root);
+  {
+    std::unique_lock<std::mutex> lock{state->mutex};
+    state->finished = true;
+    state->cond.wait(lock, [&] { return state->active == 0; });
+    if (!error) {
+      error = state->error;
+    }
   }
 
-  globGeneratorTree(ctx, query->glob_tree.get(), dir);
+  // Merge even if the walk failed, so that a query that ran out of time can
+  // return what the workers found.
+  for (auto& workerCtx : state->contexts) {
+    ctx->mergeWorkerContext(std::move(*workerCtx));
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
 }
 
 void InMemoryView::allFilesGenerator(const Query* query, QueryContext* ctx)
     const {
+  wakeFromHibernation();
+  noteQueryScope(query);
+  crawlLazyScope(query);
   struct watchman_file* f;
-  auto view = view_.rlock();
+  const auto& relative_root =
+      query->relative_root ? query->relative_root : rootPath_;
+
+  // The shards are walked one at a time, so that the IO thread is only held
+  // off the shard that we are currently reading.
+  auto [begin, end] = shardRangeForDir(relative_root);
+  for (auto i = begin; i < end; ++i) {
+    auto view = std::as_const(*shards_[i]).rlock();
+    if (i == begin) {
+      ctx->generationStarted();
+    }
+
+    if (shouldGenerateInParallel(query, view->getFileCount())) {
+      // The recency list can't be split, so walk the tree instead.  Every
+      // file in the view is reachable from the root, so this yields the same
+      // set.
+      const auto dir = view->resolveDir(relative_root);
+      if (dir) {
+        parallelDirGenerator(query, ctx, dir);
+      }
+      continue;
+    }
+
+    if (relative_root == rootPath_) {
+      ctx->expectResults(view->getFileCount());
+    }
+    QueryFileBatch batch{query, ctx};
+    for (f = view->getLatestFile(); f; f = f->next) {
+      ctx->bumpNumWalked();
+      if (!ctx->fileMatchesRelativeRoot(f)) {
+        continue;
+      }
+
+      batch.add(ctx->makeFileResult<InMemoryFileResult>(f, caches_));
+    }
+    batch.flush();
+  }
+}
+
+void InMemoryView::suffixGenerator(const Query* query, QueryContext* ctx)
+    const {
+  if (!indexSuffixes_) {
+    allFilesGenerator(query, ctx);
+    return;
+  }
+  wakeFromHibernation();
+  noteQueryScope(query);
+  crawlLazyScope(query);
+  const auto& relative_root =
+      query->relative_root ? query->relative_root : rootPath_;
+
+  auto [begin, end] = shardRangeForDir(relative_root);
+  for (auto i = begin; i < end; ++i) {
+    auto view = std::as_const(*shards_[i]).rlock();
+    if (i == begin) {
+      ctx->generationStarted();
+    }
+
+    QueryFileBatch batch{query, ctx};
+    for (const auto& suffix : *query->suffix_scope) {
+      auto files = view->getFilesWithSuffix(suffix);
+      if (!files) {
+        continue;
+      }
+      for (auto f : *files) {
+        ctx->bumpNumWalked();
+        if (!ctx->fileMatchesRelativeRoot(f)) {
+          continue;
+        }
+
+        batch.add(ctx->makeFileResult<InMemoryFileResult>(f, caches_));
+      }
+    }
+    batch.flush();
+  }
+}
+
+bool InMemoryView::dirTotalsGenerator(const Query* query, QueryContext* ctx)
+    const {
+  auto groupBy = query->aggregate->group_by;
+  if (groupBy == QueryAggregate::GroupBy::Suffix) {
+    return false;
+  }
+  wakeFromHibernation();
+  noteQueryScope(query);
+  crawlLazyScope(query);
+  const auto& relative_root =
+      query->relative_root ? query->relative_root : rootPath_;
+
+  // Nothing is added until every shard has been found to have usable
+  // totals, so that the caller can still walk the files instead.
+  std::vector<std::pair<w_string, watchman_dir::Totals>> groups;
+  auto collect = [&groups](
+                     const watchman_dir* dir,
+                     const w_string& dirName,
+                     auto& recurse) -> void {
+    if (dir->ownTotals.files) {
+      groups.emplace_back(dirName, dir->ownTotals);
+    }
+    for (auto& it : dir->dirs) {
+      auto child = it.second.get();
+      if (child->subtreeTotals.files) {
+        recurse(
+            child,
+            dirName.empty() ? child->name
+                            : w_string::pathCat({dirName, child->name}),
+            recurse);
+      }
+    }
+  };
+
+  auto [begin, end] = shardRangeForDir(relative_root);
+  for (auto i = begin; i < end; ++i) {
+    auto view = std::as_const(*shards_[i]).rlock();
+    if (i == begin) {
+      ctx->generationStarted();
+    }
+    if (!view->keepsDirTotals()) {
+      return false;
+    }
+    const auto dir = view->resolveDir(relative_root);
+    if (!dir) {
+      continue;
+    }
+    // The IO thread brings the totals up to date whenever it releases the
+    // shard; an age out may leave them stale for a moment.
+    if (dir->subtreeTotalsStale ||
+        (query->aggregate->size && dir->subtreeTotals.unsized)) {
+      return false;
+    }
+    if (groupBy == QueryAggregate::GroupBy::None) {
+      groups.emplace_back(w_string{}, dir->subtreeTotals);
+    } else {
+      collect(dir, w_string{""}, collect);
+    }
+  }
+
+  for (const auto& [dirName, totals] : groups) {
+    ctx->addToAggregate(totals.files, totals.bytes, dirName);
+  }
+  return true;
+}
+
+void InMemoryView::scmChangedFilesGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const std::vector<w_string>& paths,
+    ClockStamp clock) const {
+  wakeFromHibernation();
+  noteQueryScope(query);
+
+  // Grouped by dir, so that each dir is resolved, and checked against the
+  // relative root, once rather than once per file.
+  std::vector<std::pair<w_string_piece, w_string_piece>> byDir;
+  byDir.reserve(paths.size());
+  for (const auto& path : paths) {
+    w_string_piece piece{path};
+    byDir.emplace_back(piece.dirName(), piece.baseName());
+  }
+  std::sort(byDir.begin(), byDir.end(), [](const auto& a, const auto& b) {
+    auto dirA = a.first.view();
+    auto dirB = b.first.view();
+    return dirA != dirB ? dirA < dirB : a.second.view() < b.second.view();
+  });
+
+  // Once the query has synced, the view knows what the filesystem would say
+  // about each file, so only those that it doesn't hold need to be stat'd.
+  bool synced = query->sync_timeout.count() > 0;
+  auto caseSensitivity = ctx->root->case_sensitive;
+
+  auto views = rlockAllShards();
   ctx->generationStarted();
 
-  for (f = view->getLatestFile(); f; f = f->next) {
-    ctx->bumpNumWalked();
-    if (!ctx->fileMatchesRelativeRoot(f)) {
+  size_t end;
+  for (size_t begin = 0; begin < byDir.size(); begin = end) {
+    auto dirName = byDir[begin].first;
+    end = begin + 1;
+    while (end < byDir.size() && byDir[end].first == dirName) {
+      ++end;
+    }
+
+    auto fullDir =
+        dirName.empty() ? rootPath_ : w_string::pathCat({rootPath_, dirName});
+    if (!ctx->dirMatchesRelativeRoot(fullDir)) {
       continue;
     }
+    // Each shard holds a part of the root dir, so files in the root are
+    // resolved in their own shard below.
+    const watchman_dir* dir = !synced || dirName.empty()
+        ? nullptr
+        : views[shardIndex(fullDir)]->resolveDir(fullDir);
+
+    for (auto i = begin; i < end; ++i) {
+      auto baseName = byDir[i].second;
+      auto fullPath = w_string::pathCat({fullDir, baseName});
+      if (synced && dirName.empty()) {
+        dir = views[shardIndexForTopLevelName(baseName)]->resolveDir(rootPath_);
+      }
 
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+      const watchman_file* file = dir ? dir->getChildFile(baseName) : nullptr;
+      ctx->bumpNumWalked();
+      if (file && (!file->exists || !file->stat.isDir())) {
+        w_query_process_file(
+            query,
+            ctx,
+            ctx->makeFileResult<LocalFileResult>(
+                fullPath,
+                clock,
+                caseSensitivity,
+                file->exists ? file->stat
+                             : FileInformation::makeDeletedFileInformation(),
+                file->exists));
+      } else {
+        w_query_process_file(
+            query,
+            ctx,
+            ctx->makeFileResult<LocalFileResult>(
+                fullPath, clock, caseSensitivity));
+      }
+    }
   }
 }
 
 ClockPosition InMemoryView::getMostRecentRootNumberAndTickValue() const {
-  return ClockPosition(rootNumber_, mostRecentTick_);
+  return ClockPosition(
+      rootNumber_, publishedTick_.load(std::memory_order_acquire));
 }
 
 w_string InMemoryView::getCurrentClockString() const {
   char clockbuf[128];
   if (!clock_id_string(
-          rootNumber_, mostRecentTick_, clockbuf, sizeof(clockbuf))) {
+          rootNumber_,
+          publishedTick_.load(std::memory_order_acquire),
+          clockbuf,
+          sizeof(clockbuf))) {
     throw std::runtime_error("clock string exceeded clockbuf size");
   }
   return w_string(clockbuf, W_STRING_UNICODE);
@@ -930,6 +2956,82 @@ ClockTicks InMemoryView::getLastAgeOutTickValue() const {
   return lastAgeOutTick_;
 }
 
+std::optional<ClockPredecessor> InMemoryView::getClockPredecessor() const {
+  return *clockPredecessor_.rlock();
+}
+
+std::optional<ClockPosition> InMemoryView::getLastChangePosition(
+    const w_string& dir) const {
+  ClockTicks ticks = lastAgeOutTick_;
+  auto [begin, end] = shardRangeForDir(dir);
+  for (auto i = begin; i < end; ++i) {
+    auto view = std::as_const(*shards_[i]).rlock();
+    const watchman_dir* resolved = nullptr;
+    if (dir != rootPath_) {
+      resolved = view->resolveDir(dir);
+    }
+    if (resolved) {
+      // Changes bubble up to the subtree summary of every dir above them.
+      ticks = std::max(ticks, resolved->subtreeLatest.ticks);
+    } else if (auto latest = view->getLatestFile()) {
+      ticks = std::max(ticks, latest->otime.ticks);
+    }
+  }
+  return ClockPosition{rootNumber_, ticks};
+}
+
+namespace {
+size_t countChangedFilesBelow(const watchman_dir* dir, ClockTicks ticks) {
+  if (dir->subtreeLatest.ticks <= ticks) {
+    return 0;
+  }
+  size_t count = 0;
+  for (auto* f = dir->latestFile; f && f->otime.ticks > ticks;
+       f = f->dirNext) {
+    ++count;
+  }
+  for (auto& it : dir->dirs) {
+    count += countChangedFilesBelow(it.second.get(), ticks);
+  }
+  return count;
+}
+} // namespace
+
+std::optional<size_t> InMemoryView::countChangedFiles(
+    const w_string& dir,
+    ClockTicks ticks) const {
+  size_t count = 0;
+  auto countTombstones = [&](const ViewDatabase& view, const w_string& below) {
+    const auto& log = view.tombstones();
+    for (auto it = log.newest(); it != log.end() && it->otime.ticks > ticks;
+         ++it) {
+      if (!below || isAtOrBelowDir(it->dirName, below)) {
+        ++count;
+      }
+    }
+  };
+
+  if (dir != rootPath_) {
+    auto view = std::as_const(*shards_[shardIndex(dir)]).rlock();
+    if (const auto resolved = view->resolveDir(dir)) {
+      count = countChangedFilesBelow(resolved, ticks);
+    }
+    countTombstones(*view, dir);
+    return count;
+  }
+
+  // The recency lists are newest first, so this only walks the changes.
+  for (auto& shard : shards_) {
+    auto view = std::as_const(*shard).rlock();
+    for (auto* f = view->getLatestFile(); f && f->otime.ticks > ticks;
+         f = f->next) {
+      ++count;
+    }
+    countTombstones(*view, w_string{});
+  }
+  return count;
+}
+
 std::chrono::system_clock::time_point InMemoryView::getLastAgeOutTimeStamp()
     const {
   return lastAgeOutTimestamp_;
@@ -942,6 +3044,7 @@ void InMemoryView::startThreads(const std::shared_ptr<Root>& root) {
   std::thread notifyThreadInstance([self, root]() {
     w_set_thread_name(
         "notify ", uintptr_t(self.get()), " ", self->rootPath_.view());
+    applyThreadClassPolicy(ThreadClass::Notify);
     try {
       self->notifyThread(root);
     } catch (const std::exception& e) {
@@ -959,6 +3062,7 @@ void InMemoryView::startThreads(const std::shared_ptr<Root>& root) {
   std::thread ioThreadInstance([self, root]() {
     w_set_thread_name(
         "io ", uintptr_t(self.get()), " ", self->rootPath_.view());
+    applyThreadClassPolicy(ThreadClass::Io);
     try {
       self->ioThread(root);
     } catch (const std::exception& e) {
@@ -1008,47 +3112,63 @@ folly::SemiFuture<folly::Unit> InMemoryView::waitForSettle(
  * inaccessible. */
 CookieSync::SyncResult InMemoryView::syncToNow(
     const std::shared_ptr<Root>& root,
-    std::chrono::milliseconds timeout) {
-  auto syncResult = syncToNowCookies(root, timeout);
+    std::chrono::milliseconds timeout,
+    const std::vector<w_string>& scope) {
+  if (cookielessSync_) {
+    waitForWatcherFlush(watcher_->flushPendingEvents(), timeout);
+    return CookieSync::SyncResult{};
+  }
+
+  auto syncResult = syncToNowCookies(root, timeout, scope);
 
   // Some watcher implementations (notably, FSEvents) reorder change events
   // before they're reported, and cookie files are not sufficient. Instead, the
   // watcher supports direct synchronization. Once a cookie file has been
   // observed, ensure that all pending events have been flushed and wait until
   // the pending event queue is fully crawled.
-  auto result = watcher_->flushPendingEvents();
-  if (result.valid()) {
-    // The watcher has made all pending events available and inserted a promise
-    // into its PendingCollection. Wait for InMemoryView to observe it and
-    // everything prior.
-    //
-    // Would be nice to use a deadline rather than a timeout here.
-
-    try {
-      std::move(result).get(timeout);
-    } catch (folly::FutureTimeout&) {
-      auto why = folly::to<std::string>(
-          "syncToNow: timed out waiting for pending watcher events to be flushed within ",
-          timeout.count(),
-          " milliseconds");
-      log(ERR, why, "\n");
-      throw std::system_error(ETIMEDOUT, std::generic_category(), why);
-    }
-  }
+  waitForWatcherFlush(watcher_->flushPendingEvents(), timeout);
 
   return syncResult;
 }
 
+void InMemoryView::waitForWatcherFlush(
+    folly::SemiFuture<folly::Unit> flush,
+    std::chrono::milliseconds timeout) {
+  if (!flush.valid()) {
+    return;
+  }
+  // The watcher has made all pending events available and inserted a promise
+  // into its PendingCollection. Wait for InMemoryView to observe it and
+  // everything prior.
+  //
+  // Would be nice to use a deadline rather than a timeout here.
+  try {
+    std::move(flush).get(timeout);
+  } catch (folly::FutureTimeout&) {
+    auto why = folly::to<std::string>(
+        "syncToNow: timed out waiting for pending watcher events to be flushed within ",
+        timeout.count(),
+        " milliseconds");
+    log(ERR, why, "\n");
+    throw std::system_error(ETIMEDOUT, std::generic_category(), why);
+  }
+}
+
 folly::SemiFuture<CookieSync::SyncResult> InMemoryView::sync(
     const std::shared_ptr<Root>& root) {
+  if (cookielessSync_) {
+    return watcher_->flushPendingEvents().deferValue(
+        [](folly::Unit) { return CookieSync::SyncResult{}; });
+  }
   return root->cookies.sync();
 }
 
 CookieSync::SyncResult InMemoryView::syncToNowCookies(
     const std::shared_ptr<Root>& root,
-    std::chrono::milliseconds timeout) {
+    std::chrono::milliseconds timeout,
+    const std::vector<w_string>& scope) {
   try {
-    return root->cookies.syncToNow(timeout);
+    return root->cookies.syncToNow(timeout, scope);
   } catch (const std::system_error& exc) {
     auto cookieDirs = root->cookies.cookieDirs();
 
@@ -1072,7 +3192,7 @@ CookieSync::SyncResult InMemoryView::syncToNowCookies(
           // The cookie dir was a VCS subdir and it got deleted.  Let's
           // focus instead on the parent dir and recursively retry.
           root->cookies.setCookieDir(rootPath_);
-          return root->cookies.syncToNow(timeout);
+          return root->cookies.syncToNow(timeout, scope);
         }
       } else {
         // Split watchers have one watch on the root and watches for nested
@@ -1122,11 +3242,18 @@ CookieSync::SyncResult InMemoryView::syncToNowCookies(
   }
 }
 
+bool InMemoryView::isVCSOperationInProgress() const {
+  return vcsLockFilesPresent_.load(std::memory_order_acquire) != 0;
+}
+
 bool InMemoryView::doAnyOfTheseFilesExist(
     const std::vector<w_string>& fileNames) const {
-  auto view = view_.rlock();
   for (auto& name : fileNames) {
     auto fullName = w_string::pathCat({rootPath_, name});
+    if (fullName == rootPath_) {
+      continue;
+    }
+    auto view = std::as_const(*shards_[shardIndex(fullName)]).rlock();
     const auto dir = view->resolveDir(fullName.dirName());
     if (!dir) {
       continue;
@@ -1172,8 +3299,52 @@ json_ref InMemoryView::getViewDebugInfo() const {
     }
     processedPathsResult = json_array(std::move(paths));
   }
+  size_t vcsIgnoredDirs = 0;
+  for (auto& [path, state] : *vcsIgnoredDirs_.rlock()) {
+    if (state == LazyDirState::Unexplored) {
+      ++vcsIgnoredDirs;
+    }
+  }
+  size_t tombstones = 0;
+  for (auto& shard : shards_) {
+    tombstones += std::as_const(*shard).rlock()->tombstones().size();
+  }
+  size_t changeLogFiles = 0;
+  size_t changeLogSets = 0;
+  {
+    auto log = changeLog_.rlock();
+    changeLogFiles = log->numFiles;
+    changeLogSets = log->sets.size();
+  }
   return json_object({
       {"processed_paths", processedPathsResult},
+      {"view_lock_yields",
+       json_integer(viewLockYields_.load(std::memory_order_relaxed))},
+      {"io_batch_window_ms",
+       json_integer(batchWindowMs_.load(std::memory_order_relaxed))},
+      {"io_batches_extended",
+       json_integer(batchesExtended_.load(std::memory_order_relaxed))},
+      {"notify_batches_held",
+       json_integer(notifyBatchesHeld_.load(std::memory_order_relaxed))},
+      {"debounced_changes",
+       json_integer(debouncedChanges_.load(std::memory_order_relaxed))},
+      {"parallel_stat_batches",
+       json_integer(parallelStatBatches_.load(std::memory_order_relaxed))},
+      {"watcher_stat_count",
+       json_integer(watcherStats_.load(std::memory_order_relaxed))},
+      {"lazy_unexplored_dirs", json_integer(lazyDirs_.rlock()->size())},
+      {"hibernated",
+       json_boolean(hibernated_.load(std::memory_order_acquire))},
+      {"hibernations",
+       json_integer(hibernations_.load(std::memory_order_relaxed))},
+      {"lazy_crawls",
+       json_integer(lazyCrawls_.load(std::memory_order_relaxed))},
+      {"vcs_ignored_dirs", json_integer(vcsIgnoredDirs)},
+      {"vcs_ignored_crawls",
+       json_integer(vcsIgnoredCrawls_.load(std::memory_order_relaxed))},
+      {"change_log_files", json_integer(changeLogFiles)},
+      {"change_log_sets", json_integer(changeLogSets)},
+      {"tombstones", json_integer(tombstones)},
   });
 }
 
@@ -1183,24 +3354,174 @@ void InMemoryView::clearViewDebugInfo() {
   }
 }
 
+std::optional<ViewMemoryStats> InMemoryView::getMemoryStats(
+    bool detailed) const {
+  ViewMemoryStats stats;
+  for (auto& shard : shards_) {
+    std::as_const(*shard).rlock()->addMemoryStats(stats, detailed);
+  }
+
+  // The cache keys and symlink targets hold paths on the heap that are
+  // not accounted for here.
+  stats.caches = caches_.contentHashCache.stats().size *
+          (sizeof(ContentHashCache::Node) + 2 * sizeof(void*)) +
+      caches_.spookyHashCache.stats().size *
+          (sizeof(Spooky128HashCache::Node) + 2 * sizeof(void*)) +
+      caches_.symlinkTargetCache.stats().size *
+          (sizeof(SymlinkTargetCache::Node) + 2 * sizeof(void*));
+
+  stats.pending = pendingFromWatcher_.lockAndDrain()->getPendingItemCount() *
+      sizeof(watchman_pending_fs);
+  return stats;
+}
+
+std::optional<ViewLagStatus> InMemoryView::getLagStatus() const {
+  ViewLagStatus status;
+  status.pending_from_watcher =
+      pendingFromWatcher_.lockAndDrain()->getPendingItemCount();
+  status.pending_in_io_thread =
+      ioThreadBacklog_.load(std::memory_order_relaxed);
+  status.event_lag_ms = eventLagMicros_.load(std::memory_order_relaxed) / 1000;
+  status.max_event_lag_ms =
+      maxEventLagMicros_.load(std::memory_order_relaxed) / 1000;
+  return status;
+}
+
+std::optional<SettleStatus> InMemoryView::getSettleStatus() const {
+  if (settleAdaptiveMax_.count() == 0 && settleMaxWait_.count() == 0) {
+    return std::nullopt;
+  }
+  return *settleStatus_.rlock();
+}
+
+void InMemoryView::noteSavedStateLookup(SavedStateLookup lookup) {
+  // Enough for the few projects whose saved states a repository's clients
+  // typically look for.
+  constexpr size_t kMaxSavedStateLookups = 8;
+
+  auto key = json_dumps(lookup.config, JSON_COMPACT | JSON_SORT_KEYS);
+  auto lookups = savedStateLookups_.wlock();
+  auto it = std::find_if(lookups->begin(), lookups->end(), [&](auto& prior) {
+    return prior.factory == lookup.factory &&
+        prior.mergeBaseWith == lookup.mergeBaseWith &&
+        prior.storageType == lookup.storageType &&
+        json_dumps(prior.config, JSON_COMPACT | JSON_SORT_KEYS) == key;
+  });
+  if (it != lookups->end()) {
+    lookups->erase(it);
+  }
+  lookups->insert(lookups->begin(), std::move(lookup));
+  if (lookups->size() > kMaxSavedStateLookups) {
+    lookups->pop_back();
+  }
+}
+
+void InMemoryView::prefetchMergeBases() {
+  auto scm = getSCM();
+  // The parent state files are only in the view if the root is the whole
+  // repository.
+  if (!scm || scm->getSCMRoot() != rootPath_ ||
+      (scmPrefetchMergeBases_.empty() && savedStateLookups_.rlock()->empty())) {
+    return;
+  }
+
+  auto newest = lastScmStateTick_;
+  for (auto& name : scm->getParentStateFiles()) {
+    auto fullName = w_string::pathCat({rootPath_, name});
+    auto view = std::as_const(*shards_[shardIndex(fullName)]).rlock();
+    const auto dir = view->resolveDir(fullName.dirName());
+    if (!dir) {
+      continue;
+    }
+    auto file = dir->getChildFile(fullName.baseName());
+    if (file && file->otime.ticks > newest) {
+      newest = file->otime.ticks;
+    }
+  }
+  if (newest == lastScmStateTick_) {
+    return;
+  }
+  lastScmStateTick_ = newest;
+
+  auto self = std::static_pointer_cast<InMemoryView>(shared_from_this());
+  try {
+    getThreadPool().addWithPriority(
+        [self] {
+          auto scm = self->getSCM();
+          for (auto& commit : self->scmPrefetchMergeBases_) {
+            try {
+              auto mergeBase = scm->mergeBaseWith(commit);
+              log(DBG,
+                  "prefetched merge base with ",
+                  commit,
+                  ": ",
+                  mergeBase,
+                  "\n");
+            } catch (const std::exception& exc) {
+              log(DBG,
+                  "unable to prefetch merge base with ",
+                  commit,
+                  ": ",
+                  exc.what(),
+                  "\n");
+            }
+          }
+
+          auto lookups = self->savedStateLookups_.copy();
+          for (auto& lookup : lookups) {
+            try {
+              auto mergeBase = scm->mergeBaseWith(lookup.mergeBaseWith);
+              lookup
+                  .factory(
+                      lookup.storageType,
+                      lookup.config,
+                      scm,
+                      self->config_,
+                      [](PerfSample&) {})
+                  ->prefetchMostRecentSavedState(mergeBase);
+            } catch (const std::exception& exc) {
+              log(DBG,
+                  "unable to prefetch saved state for ",
+                  lookup.mergeBaseWith,
+                  ": ",
+                  exc.what(),
+                  "\n");
+            }
+          }
+        },
+        ThreadPool::kBackground);
+  } catch (const std::exception& exc) {
+    log(DBG, "not prefetching merge bases now: ", exc.what(), "\n");
+  }
+}
+
+namespace {
+constexpr std::chrono::milliseconds kWarmSleepSlice{100};
+} // namespace
+
 void InMemoryView::warmContentCache() {
   if (!enableContentCacheWarming_) {
     return;
   }
+  if (contentWarmRunning_.load(std::memory_order_acquire)) {
+    // lastWarmedTick_ stays put, so the next settle picks these files up
+    log(DBG, "warmContentCache: the previous warm is still running\n");
+    return;
+  }
 
   log(DBG, "considering files for content hash cache warming\n");
 
-  size_t n = 0;
-  std::deque<folly::Future<std::shared_ptr<const ContentHashCache::Node>>>
-      futures;
+  std::vector<ContentHashCacheKey> keys;
+  size_t skipped = 0;
 
   {
     // Walk back in time until we hit the boundary, or hit the limit
     // on the number of files we should warm up.
-    auto view = view_.rlock();
-    struct watchman_file* f;
-    for (f = view->getLatestFile(); f && n < maxFilesToWarmInContentCache_;
-         f = f->next) {
+    auto views = rlockAllShards();
+    walkRecencyLists(views, [&](watchman_file* f) {
+      if (keys.size() >= maxFilesToWarmInContentCache_) {
+        return false;
+      }
       if (f->otime.ticks <= lastWarmedTick_) {
         log(DBG,
             "warmContentCache: stop because file ticks ",
@@ -1208,14 +3529,10 @@ void InMemoryView::warmContentCache() {
             " is <= lastWarmedTick_ ",
             lastWarmedTick_,
             "\n");
-        break;
+        return false;
       }
 
       if (f->exists && f->stat.isFile()) {
-        // Note: we could also add an expression to further constrain
-        // the things we warm up here.  Let's see if we need it before
-        // going ahead and adding.
-
         auto dirStr = f->parent->getFullPath();
         w_string_piece dir(dirStr);
         dir.advance(caches_.contentHashCache.rootPath().size());
@@ -1226,19 +3543,20 @@ void InMemoryView::warmContentCache() {
           // front of dir
           dir.advance(1);
         }
-        ContentHashCacheKey key{
-            w_string::pathCat({dir, f->getName()}),
-            size_t(f->stat.size),
-            f->stat.mtime};
 
-        log(DBG, "warmContentCache: lookup ", key.relativePath, "\n");
-        auto f = caches_.contentHashCache.get(key);
-        if (syncContentCacheWarming_) {
-          futures.emplace_back(std::move(f));
+        if (warmOnlyRequestedContent_ &&
+            !caches_.contentHashInterest.isWanted(dir, f->getName())) {
+          ++skipped;
+          return true;
         }
-        ++n;
+
+        keys.push_back(ContentHashCacheKey{
+            w_string::pathCat({dir, f->getName()}),
+            size_t(f->stat.size),
+            f->stat.mtime});
       }
-    }
+      return true;
+    });
 
     lastWarmedTick_ = mostRecentTick_;
   }
@@ -1247,16 +3565,65 @@ void InMemoryView::warmContentCache() {
       "warmContentCache, lastWarmedTick_ now ",
       lastWarmedTick_,
       " scheduled ",
-      n,
-      " files for hashing, will wait for ",
-      futures.size(),
-      " lookups to finish\n");
+      keys.size(),
+      " files for hashing, skipped ",
+      skipped,
+      " that no client asks about\n");
+  if (keys.empty()) {
+    return;
+  }
+
+  // The files are hashed one at a time, at the idle IO priority, so that
+  // warming doesn't compete with crawling and with the hashes that
+  // clients are waiting on.
+  contentWarmRunning_.store(true, std::memory_order_release);
+  auto self = std::static_pointer_cast<InMemoryView>(shared_from_this());
+  auto warm = [self, keys = std::move(keys)] {
+    SCOPE_EXIT {
+      self->contentWarmRunning_.store(false, std::memory_order_release);
+    };
+    ScopedIdleIoPriority idleIo;
+    auto nextRead = std::chrono::steady_clock::now();
+    for (auto& key : keys) {
+      if (self->stopThreads_.load(std::memory_order_acquire)) {
+        return;
+      }
+      if (self->contentWarmBytesPerSec_ > 0) {
+        // Pace the reads to the budget, having charged each file read
+        // against it. Sleep in slices so that stopping isn't held up.
+        auto now = std::chrono::steady_clock::now();
+        nextRead = std::max(nextRead, now);
+        while (nextRead > now) {
+          if (self->stopThreads_.load(std::memory_order_acquire)) {
+            return;
+          }
+          /* sleep override */ std::this_thread::sleep_for(std::min(
+              std::chrono::steady_clock::duration(nextRead - now),
+              std::chrono::steady_clock::duration(kWarmSleepSlice)));
+          now = std::chrono::steady_clock::now();
+        }
+      }
+      log(DBG, "warmContentCache: lookup ", key.relativePath, "\n");
+      if (self->caches_.contentHashCache.warm(key) &&
+          self->contentWarmBytesPerSec_ > 0) {
+        nextRead += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>(
+                double(key.fileSize) / self->contentWarmBytesPerSec_));
+      }
+    }
+  };
 
   if (syncContentCacheWarming_) {
-    // Wait for them to finish, but don't use get() because we don't
-    // care about any errors that may have occurred.
-    folly::collectAll(futures.begin(), futures.end()).wait();
+    // Hash them before the settle is dispatched to clients
+    warm();
     log(DBG, "warmContentCache: hashing complete\n");
+    return;
+  }
+  try {
+    getThreadPool().addWithPriority(std::move(warm), ThreadPool::kBackground);
+  } catch (const std::exception& exc) {
+    contentWarmRunning_.store(false, std::memory_order_release);
+    log(DBG, "not warming the content hash cache now: ", exc.what(), "\n");
   }
 }
 
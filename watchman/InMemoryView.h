@@ -7,22 +7,33 @@
 
 #pragma once
 #include <folly/Synchronized.h>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
+#include <vector>
 #include "watchman/ContentHash.h"
+#include "watchman/ContentHashInterest.h"
 #include "watchman/CookieSync.h"
+#include "watchman/PathComponentTable.h"
 #include "watchman/PendingCollection.h"
 #include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Result.h"
 #include "watchman/RingBuffer.h"
+#include "watchman/SettleEstimator.h"
+#include "watchman/SlabAllocator.h"
 #include "watchman/SymlinkTargets.h"
+#include "watchman/TombstoneLog.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/query/FileResult.h"
+#include "watchman/watchman_dir.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
@@ -33,23 +44,55 @@ namespace watchman {
 class FileSystem;
 class RootConfig;
 struct GlobTree;
+class TickIndexReader;
+class VcsIgnoreRules;
 class Watcher;
+class ContentHashStore;
 
 // Helper struct to hold caches used by the InMemoryView
 struct InMemoryViewCaches {
+  // Null unless persistHashes is true and state is being saved.
+  std::shared_ptr<ContentHashStore> sha1Store;
+  std::shared_ptr<ContentHashStore> spookyStore;
   ContentHashCache contentHashCache;
+  Spooky128HashCache spookyHashCache;
   SymlinkTargetCache symlinkTargetCache;
+  // What clients ask for the content.sha1hex of, for warming
+  ContentHashInterest contentHashInterest;
 
   InMemoryViewCaches(
       const w_string& rootPath,
       size_t maxHashes,
       size_t maxSymlinks,
-      std::chrono::milliseconds errorTTL);
+      size_t maxHashBytes,
+      size_t maxSymlinkBytes,
+      std::chrono::milliseconds errorTTL,
+      size_t maxHashConcurrency,
+      bool persistHashes,
+      CacheAdmission hashAdmission = CacheAdmission::All);
+
+  // Writes the content hash stores that have changed, in the thread pool
+  // if async is true.
+  void saveContentHashes(bool async);
+
+  // Erases the errors that have outlived their TTL from each of the caches,
+  // and returns how many there were.
+  size_t eraseExpired();
 };
 
 class InMemoryFileResult final : public FileResult {
  public:
-  InMemoryFileResult(const watchman_file* file, InMemoryViewCaches& caches);
+  /**
+   * dirName, if given, is the full path to the file's parent. Generators
+   * that walk a dir pass it so that it is built once for the dir rather
+   * than once for each file in it. owner, if given, keeps file alive for
+   * files that are not part of the view.
+   */
+  InMemoryFileResult(
+      const watchman_file* file,
+      InMemoryViewCaches& caches,
+      w_string dirName = nullptr,
+      std::shared_ptr<const void> owner = nullptr);
   std::optional<FileInformation> stat() override;
   std::optional<struct timespec> accessedTime() override;
   std::optional<struct timespec> modifiedTime() override;
@@ -62,6 +105,9 @@ class InMemoryFileResult final : public FileResult {
   std::optional<ClockStamp> ctime() override;
   std::optional<ClockStamp> otime() override;
   std::optional<FileResult::ContentHash> getContentSha1() override;
+  std::optional<FileResult::Spooky128Hash> getContentSpooky128() override;
+  std::optional<DType> dtype() override;
+  const void* identity() const override;
   void batchFetchProperties(
       const std::vector<std::unique_ptr<FileResult>>& files) override;
 
@@ -69,8 +115,17 @@ class InMemoryFileResult final : public FileResult {
   const watchman_file* file_;
   w_string dirName_;
   InMemoryViewCaches& caches_;
+  std::shared_ptr<const void> owner_;
+  // Populated by batchFetchProperties for files whose extended stat fields
+  // were not retained in the view.
+  std::optional<FileInformation> fullStat_;
   std::optional<w_string> symlinkTarget_;
   Result<FileResult::ContentHash> contentSha1_;
+  Result<FileResult::Spooky128Hash> contentSpooky128_;
+
+  // Throws if the file has no content to hash
+  void checkHashable() const;
+  ContentHashCacheKey contentHashKey();
 };
 
 /**
@@ -80,7 +135,51 @@ class InMemoryFileResult final : public FileResult {
  */
 class ViewDatabase {
  public:
-  explicit ViewDatabase(const w_string& root_path);
+  /**
+   * If retainExtendedStat is false, files are stored with only their
+   * CompactFileInformation. If indexSuffixes is true, files are also indexed
+   * by the lowercased suffix of their name. If foldCase is true, the children
+   * of every dir are also indexed by their case-folded names, for roots on
+   * filesystems that are not case sensitive. If hugePages is true, the nodes
+   * are stored in slabs that are backed by huge pages, where supported. If
+   * dirTotals is true, every dir keeps totals over the files below it; see
+   * updateDirTotals().
+   */
+  explicit ViewDatabase(
+      const w_string& root_path,
+      bool retainExtendedStat = true,
+      bool indexSuffixes = false,
+      bool foldCase = false,
+      bool hugePages = false,
+      bool dirTotals = false);
+
+  bool retainsExtendedStat() const {
+    return retainExtendedStat_;
+  }
+
+  bool indexesSuffixes() const {
+    return indexSuffixes_;
+  }
+
+  bool keepsDirTotals() const {
+    return dirTotals_;
+  }
+
+  /**
+   * Brings the totals of the dirs that changed since the last call up to
+   * date, so that the ownTotals and subtreeTotals of every dir are valid.
+   * Only walks the dirs whose totals are stale, and only counts the files of
+   * the dirs whose own files changed. Does nothing unless keepsDirTotals().
+   */
+  void updateDirTotals();
+
+  /**
+   * Returns the files whose name has the lowercased suffix, including those
+   * that are believed to be deleted, or nullptr if there are none. Only
+   * populated if indexesSuffixes().
+   */
+  const std::unordered_set<watchman_file*>* getFilesWithSuffix(
+      const w_string& suffix) const;
 
   watchman_file* getLatestFile() const {
     return latestFile_;
@@ -94,6 +193,35 @@ class ViewDatabase {
     rootInode_ = ino;
   }
 
+  /**
+   * Number of file nodes in the view, including those that are believed to
+   * be deleted but are not yet aged out.
+   */
+  size_t getFileCount() const {
+    return numFiles_;
+  }
+
+  /**
+   * Number of distinct dir name components held in the intern table.
+   */
+  size_t getInternedComponentCount() const {
+    return components_.size();
+  }
+
+  /**
+   * Releases interned dir name components that are no longer used by any
+   * node in the view. Returns the number of components released.
+   */
+  size_t pruneInternedComponents() {
+    return components_.prune();
+  }
+
+  /**
+   * Adds the memory used by the nodes of this view to stats. If detailed is
+   * true, walks the tree to populate the per-category breakdown.
+   */
+  void addMemoryStats(ViewMemoryStats& stats, bool detailed) const;
+
   watchman_dir* resolveDir(const w_string& dirname, bool create);
 
   const watchman_dir* resolveDir(const w_string& dirname) const;
@@ -108,6 +236,17 @@ class ViewDatabase {
       const w_string& file_name,
       ClockStamp ctime);
 
+  /**
+   * Removes the file from its parent dir and frees it.
+   */
+  void removeFile(watchman_file* file);
+
+  /**
+   * Removes the child dir named name from parent and frees it, along with
+   * everything below it.
+   */
+  void removeChildDir(watchman_dir* parent, w_string_piece name);
+
   /**
    * Updates the otime for the file and bubbles it to the front of recency
    * index.
@@ -125,20 +264,102 @@ class ViewDatabase {
       ClockStamp otime,
       bool recursive);
 
+  /**
+   * Moves the dir at from, with everything below it, to to, as a rename of
+   * it would. toStat is the stat information of to. Changes nothing, and
+   * returns false, unless toStat is that of the dir that the view holds at
+   * from, the parent of to is in the view, and there is no dir at to yet.
+   *
+   * The files that existed below from are left there as deleted entries,
+   * and are reported as new at to, all at otime.
+   */
+  bool relocateDir(
+      Watcher& watcher,
+      const w_string& from,
+      const w_string& to,
+      const FileInformation& toStat,
+      ClockStamp otime);
+
+  /**
+   * Rebuilds the recency index, and the per-dir summaries derived from it,
+   * by ordering every file on its otime. Used after otimes have been
+   * assigned other than through markFileChanged.
+   */
+  void sortRecencyLists();
+
+  /**
+   * The deleted files whose nodes have been freed. Only populated if the
+   * view compacts deleted files.
+   */
+  TombstoneLog& tombstones() {
+    return tombstones_;
+  }
+  const TombstoneLog& tombstones() const {
+    return tombstones_;
+  }
+
+  /**
+   * Frees every node below the root dir, and returns the storage that held
+   * them to the system. The root inode and the tombstones are kept.
+   */
+  void clear();
+
+  /**
+   * Returns to the system the storage of nodes that have all been freed,
+   * as by an age out. Returns the number of bytes released.
+   */
+  size_t releaseFreeStorage() {
+    return allocator_.releaseFreeSlabs();
+  }
+
  private:
+  // Marks the files that exist below moved changed, and leaves a deleted
+  // entry for each in the matching place below left.
+  void relocateFiles(
+      Watcher& watcher,
+      watchman_dir* moved,
+      watchman_dir* left,
+      ClockStamp otime);
   void insertAtHeadOfFileList(struct watchman_file* file);
+  void insertAtHeadOfDirFileList(struct watchman_file* file);
+  // Marks the subtree totals of dir and its ancestors stale, and its own
+  // totals too if own is set.
+  void markTotalsStale(watchman_dir* dir, bool own);
+  void unindexFile(watchman_file* file);
+  void unindexDir(const watchman_dir* dir);
 
   const w_string rootPath_;
+  const bool retainExtendedStat_;
+  const bool indexSuffixes_;
+  const bool foldCase_;
+  const bool dirTotals_;
 
   /* the most recently changed file */
   watchman_file* latestFile_ = nullptr;
 
-  std::unique_ptr<watchman_dir> rootDir_;
+  size_t numFiles_{0};
+
+  // Backing storage for every watchman_file and watchman_dir in this view.
+  // Must be declared before rootDir_ so that it outlives the tree.
+  SlabAllocator allocator_;
+
+  // Shared storage for dir names. Declared before rootDir_ so that the
+  // table outlives the tree's references into it.
+  PathComponentTable components_;
+
+  watchman_dir::DirPtr rootDir_;
 
   // Inode number for the root dir.  This is used to detect what should
   // be impossible situations, but is needed in practice to workaround
   // eg: BTRFS not delivering all events for subvolumes
   ino_t rootInode_{0};
+
+  // Lowercased name suffix to the files that have it. Names without a
+  // suffix are not indexed.
+  std::unordered_map<w_string, std::unordered_set<watchman_file*>>
+      suffixIndex_;
+
+  TombstoneLog tombstones_;
 };
 
 /**
@@ -159,6 +380,12 @@ class InMemoryView final : public QueryableView {
 
   ClockPosition getMostRecentRootNumberAndTickValue() const override;
   ClockTicks getLastAgeOutTickValue() const override;
+  std::optional<ClockPredecessor> getClockPredecessor() const override;
+  std::optional<ClockPosition> getLastChangePosition(
+      const w_string& dir) const override;
+  std::optional<size_t> countChangedFiles(
+      const w_string& dir,
+      ClockTicks ticks) const override;
   std::chrono::system_clock::time_point getLastAgeOutTimeStamp() const override;
   w_string getCurrentClockString() const override;
 
@@ -170,12 +397,18 @@ class InMemoryView final : public QueryableView {
   }
 
   void ageOut(PerfSample& sample, std::chrono::seconds minAge) override;
+  size_t trimCaches() override;
+  bool isHibernated() const override {
+    return hibernated_.load(std::memory_order_acquire);
+  }
+  bool addChangePrefilter(std::shared_ptr<ChangePrefilter> prefilter) override;
 
   folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period) override;
   CookieSync::SyncResult syncToNow(
       const std::shared_ptr<Root>& root,
-      std::chrono::milliseconds timeout) override;
+      std::chrono::milliseconds timeout,
+      const std::vector<w_string>& scope) override;
 
   /**
    * Write cookies to the working copy and wait to see them.
@@ -189,6 +422,12 @@ class InMemoryView final : public QueryableView {
   bool doAnyOfTheseFilesExist(
       const std::vector<w_string>& fileNames) const override;
 
+  /**
+   * Tests, without taking the view lock, which of vcsLockFiles() the IO
+   * thread last found in the view.
+   */
+  bool isVCSOperationInProgress() const override;
+
   void timeGenerator(const Query* query, QueryContext* ctx) const override;
 
   void pathGenerator(const Query* query, QueryContext* ctx) const override;
@@ -197,6 +436,30 @@ class InMemoryView final : public QueryableView {
 
   void allFilesGenerator(const Query* query, QueryContext* ctx) const override;
 
+  void suffixGenerator(const Query* query, QueryContext* ctx) const override;
+  bool dirTotalsGenerator(const Query* query, QueryContext* ctx)
+      const override;
+  void scmChangedFilesGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const std::vector<w_string>& paths,
+      ClockStamp clock) const override;
+
+  /**
+   * Records the files that changed since the last call, so that since
+   * queries, and in particular the subscriptions that wake up at each
+   * settle, can be evaluated over them without walking or locking the view.
+   * While stateAsserted, as when source control is updating the working
+   * copy and subscriptions defer their notifications, the log holds up to
+   * change_log_state_max_files, and at the first settle after that the sets
+   * recorded meanwhile are merged into one, which the deferred
+   * subscriptions then share. Only called by the IO thread: when it has
+   * settled, and, with change_log_unsettled, after each batch of pending
+   * changes, in which case the sets recorded between two settles are
+   * merged into one at the second.
+   */
+  void recordChangeSet(bool stateAsserted, bool settled = true);
+
   /**
    * Returns a SemiFuture that completes when any pending recrawls are
    * completed. The primary use of this is so that "watch-project" doesn't send
@@ -218,10 +481,22 @@ class InMemoryView final : public QueryableView {
   void clearWatcherDebugInfo() override;
   json_ref getViewDebugInfo() const;
   void clearViewDebugInfo();
+  std::optional<ViewMemoryStats> getMemoryStats(bool detailed) const override;
+  std::optional<size_t> dumpView(const w_string& path) const override;
+  std::optional<SettleStatus> getSettleStatus() const override;
+  std::optional<ViewLagStatus> getLagStatus() const override;
 
   // If content cache warming is configured, do the warm up now
   void warmContentCache();
 
+  void noteSavedStateLookup(SavedStateLookup lookup) override;
+
+  // If the SCM's parent state files have changed since this was last called,
+  // computes the merge bases in scm_prefetch_mergebase_with, and repeats the
+  // recent saved state lookups, in the thread pool, so that SCM-aware
+  // queries find their answers cached.
+  void prefetchMergeBases();
+
   InMemoryViewCaches& debugAccessCaches() const {
     return caches_;
   }
@@ -229,35 +504,121 @@ class InMemoryView final : public QueryableView {
  private:
   CookieSync::SyncResult syncToNowCookies(
       const std::shared_ptr<Root>& root,
+      std::chrono::milliseconds timeout,
+      const std::vector<w_string>& scope);
+  // Waits for flush, if the watcher returned one, throwing ETIMEDOUT if it
+  // isn't fulfilled within timeout.
+  static void waitForWatcherFlush(
+      folly::SemiFuture<folly::Unit> flush,
       std::chrono::milliseconds timeout);
 
   // Returns the erased file's otime.
   ClockStamp ageOutFile(
+      ViewDatabase& view,
       std::unordered_set<w_string>& dirs_to_erase,
       watchman_file* file);
 
+  /**
+   * Frees the nodes of the files deleted since the last call, if
+   * compact_deleted_files is set, and adds a tombstone for each so that
+   * since queries still report them. Only called by the IO thread, when it
+   * has settled and recorded the change set.
+   */
+  void compactDeletedFiles();
+
+  /**
+   * Marks the change prefilters of subscriptions that match a file changed
+   * since the last call. All of them are marked if the view is hibernated,
+   * or if more than subscription_prefilter_max_files changed. Only called
+   * by the IO thread, when it has settled and before it compacts the
+   * deleted files.
+   */
+  void markChangePrefilters();
+
   // When a watcher is desynced, it sets the W_PENDING_IS_DESYNCED flag, and the
   // crawler will set these recursively. If one of these flag is set,
   // processPending will return IsDesynced::Yes and it is expected that the
   // caller will abort all pending cookies after processAllPending returns.
   enum class IsDesynced { Yes, No };
 
+  /**
+   * Tells the watcher which part of the tree the query is interested in.
+   */
+  void noteQueryScope(const Query* query) const;
+
+  /**
+   * Has the IO thread crawl the unexplored dirs within, containing or
+   * contained by the query's paths, glob or relative_root, and waits for it
+   * to have done so. Does nothing unless lazy_crawl_depth is set, or
+   * vcs_ignore_crawl is set and the query asks for include_vcs_ignored.
+   */
+  void crawlLazyScope(const Query* query) const;
+
+  /**
+   * Recursively walks the files under dir that changed since the query's
+   * boundary, pruning subtrees whose most recent change precedes it.
+   */
+  void timeGeneratorSubtree(
+      const Query* query,
+      QueryContext* ctx,
+      const watchman_dir* dir) const;
+
+  /**
+   * Generates the files that changed since the query's clock from the
+   * change log. Returns false, having generated nothing, if the log does
+   * not cover every change between that clock and the query's start.
+   */
+  bool changeLogGenerator(const Query* query, QueryContext* ctx) const;
+
   /** Recursively walks files under a specified dir */
   void dirGenerator(
       const Query* query,
       QueryContext* ctx,
       const watchman_dir* dir,
       uint32_t depth) const;
+  /** As above, where dirPath is the full path to dir. */
+  void dirGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const watchman_dir* dir,
+      const w_string& dirPath,
+      uint32_t depth) const;
+
+  /**
+   * Returns true if allFilesGenerator should fan out across the thread pool
+   * for a shard holding fileCount files, either because the query asked for
+   * it or because the shard is larger than parallel_query_file_threshold.
+   */
+  bool shouldGenerateInParallel(const Query* query, size_t fileCount) const;
+
+  /**
+   * Equivalent to dirGenerator(query, ctx, dir, UINT32_MAX), but the subtrees
+   * below dir are distributed across the thread pool, each evaluated into its
+   * own worker QueryContext and then merged into ctx. The calling thread
+   * participates in the walk, so this makes progress even if the pool is
+   * saturated. The caller must hold the view lock for the duration.
+   */
+  void parallelDirGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const watchman_dir* dir) const;
+  // dirPath is the full path to dir. Each dir's path is built from its
+  // parent's as the walk descends.
   void globGeneratorTree(
       QueryContext* ctx,
       const GlobTree* node,
-      const struct watchman_dir* dir) const;
+      const struct watchman_dir* dir,
+      const w_string& dirPath) const;
+  // relativePath holds the path to dir relative to where the doublestar
+  // walk began. The walk appends to it as it descends and restores it
+  // before returning, so one buffer serves the whole walk.
   void globGeneratorDoublestar(
       QueryContext* ctx,
       const struct watchman_dir* dir,
+      const w_string& dirPath,
       const GlobTree* node,
-      const char* dir_name,
-      uint32_t dir_name_len) const;
+      std::string& relativePath,
+      bool underDotDir) const;
 
   void notifyThread(const std::shared_ptr<Root>& root);
 
@@ -265,17 +626,117 @@ class InMemoryView final : public QueryableView {
 
   void ioThread(const std::shared_ptr<Root>& root);
 
+  /**
+   * The IO thread's write access to the view shards. Shards are locked as
+   * the pending items that touch them are processed: one at a time, or all
+   * of them, in index order, for items that touch the root dir itself.
+   *
+   * Every acquisition advances the tick, so that changes made while holding
+   * a shard are never reported with a tick that a reader may already have
+   * observed without seeing them. Releasing the shards publishes that tick
+   * as the view's clock; until then a reader of another shard could be
+   * handed a clock whose changes are still being applied.
+   */
+  class ViewWriter {
+   public:
+    explicit ViewWriter(InMemoryView& view);
+    ~ViewWriter();
+
+    struct ShardDir {
+      ViewDatabase& view;
+      watchman_dir* dir;
+    };
+
+    /**
+     * Locks and returns the shard that holds path, which must lie below the
+     * root. If every shard is already locked, returns it without changing
+     * the locks that are held.
+     */
+    ViewDatabase& forPath(w_string_piece path);
+
+    /**
+     * Resolves, creating it if necessary, the dir at path. Every dir other
+     * than the root has a node in exactly one shard. The root has a node in
+     * each shard, holding the top level entries that belong to it; these are
+     * returned in shard order, after locking every shard.
+     */
+    std::vector<ShardDir> resolveDir(const w_string& path);
+
+    /**
+     * Returns the entry of dirs, as returned by resolveDir, that holds the
+     * child named name.
+     */
+    const ShardDir& childDir(
+        const std::vector<ShardDir>& dirs,
+        w_string_piece name) const;
+
+    void lockAll();
+
+    /**
+     * If every shard is locked and there is more than one shard, releases
+     * them so that later pending items only hold what they touch.
+     */
+    void narrow();
+
+    /**
+     * Brings the dir totals of the locked shards up to date and releases
+     * them.
+     */
+    void unlock();
+
+   private:
+    InMemoryView& view_;
+    std::vector<folly::Synchronized<ViewDatabase>::WLockedPtr> locks_;
+    bool allLocked_{false};
+  };
+
   // Consume entries from `pending` and apply them to the InMemoryView. Any new
   // pending paths generated by processPath will be crawled before
   // processAllPending returns.
+  //
+  // If view lock slicing is enabled (see viewLockSlice_), the write locks held
+  // by `view` may be released between pending items so that queries are not
+  // starved by a large batch of changes.
   IsDesynced processAllPending(
       const std::shared_ptr<Root>& root,
-      ViewDatabase& view,
+      ViewWriter& view,
       PendingChanges& pending);
 
+  // Stat the files named by the list headed by `pending` on the thread pool,
+  // so that processAllPending only has to apply the results. Returns one
+  // entry per list item. Entries are left empty for items that statPath
+  // would not stat, and for those whose stat failed: statPath stats those
+  // again itself so that it can handle the error.
+  std::vector<std::optional<FileInformation>> preStatPending(
+      const Root& root,
+      const watchman_pending_fs* pending);
+
+  // Relocate, within the view, the dirs that the items of the list headed by
+  // `pending` report as renamed, where the view allows it. Returns the old
+  // and new paths of the dirs that were relocated; the others are left to
+  // statPath and the crawler.
+  std::vector<std::pair<w_string, w_string>> relocateMovedDirs(
+      const Root& root,
+      ViewWriter& view,
+      const watchman_pending_fs* pending);
+
+  // Publish a report of the full crawl's progress to root.crawlProgress.
+  // While the crawl is underway, reports are sent no more often than
+  // crawlProgressInterval_; `done` sends the final one.
+  void reportCrawlProgress(Root& root, bool done);
+
+  // Temporarily release the write locks to allow queued readers to make
+  // progress. They are reacquired, under a new tick, by the next pending item
+  // that needs them.
+  void yieldViewLock(ViewWriter& view);
+
+  // Updates vcsLockFilesPresent_ for the lock files at or below path, which
+  // the IO thread has just processed.
+  void updateVcsLockFiles(ViewWriter& view, const w_string& path);
+
   void processPath(
       const std::shared_ptr<Root>& root,
-      ViewDatabase& view,
+      ViewWriter& view,
       PendingChanges& coll,
       const PendingChange& pending,
       const FileInformation* pre_stat,
@@ -293,23 +754,80 @@ class InMemoryView final : public QueryableView {
    */
   void crawler(
       const std::shared_ptr<Root>& root,
-      ViewDatabase& view,
+      ViewWriter& view,
       PendingChanges& coll,
       const PendingChange& pending,
       std::vector<w_string>& pendingCookies);
 
+  /**
+   * Returns true if a recursive crawl of dirs, as returned by
+   * ViewWriter::resolveDir, should use crawlerParallel: always if
+   * enable_parallel_crawl is set, else if the view already holds at least
+   * parallel_recrawl_min_dirs dirs below them.
+   */
+  bool shouldCrawlInParallel(
+      const Root& root,
+      const std::vector<ViewWriter::ShardDir>& dirs) const;
+
+  // The number of path components of path below the root.
+  size_t depthBelowRoot(w_string_piece path) const;
+
+  /**
+   * Returns true if the crawl of the dir at path, as returned by
+   * ViewWriter::resolveDir, should wait until a query needs it: if it lies
+   * at lazy_crawl_depth and either is still unexplored or is newly
+   * registered by the initial crawl.
+   */
+  bool deferLazyCrawl(
+      const Root& root,
+      const w_string& path,
+      const std::vector<ViewWriter::ShardDir>& dirs);
+
+  // Re-reads the rules of what the VCS ignores for vcs_ignore_crawl.
+  void loadVcsIgnoreRules();
+
+  /**
+   * Returns true if the dir at path is the shallowest that the VCS ignores
+   * and no query has asked for it, so that it is neither crawled nor
+   * watched. known is whether the view already holds its entries, which
+   * are then kept up to date. Safe to call from the crawl threads, which
+   * pass onIoThread as false.
+   */
+  bool deferVcsIgnored(
+      const Root& root,
+      const w_string& path,
+      bool known,
+      bool onIoThread);
+
+  // Whether path lies below a dir that deferVcsIgnored has left unexplored.
+  bool isBelowVcsIgnoredDir(w_string_piece path) const;
+
   /**
    * Crawl the given directory recursively using ParallelWalker.
    *
-   * W_PENDING_RECURSIVE must be set.
+   * W_PENDING_RECURSIVE must be set. Results are applied in batches of up
+   * to parallel_crawl_batch_dirs dirs; after the initial crawl, the view
+   * write locks are released while waiting for the walker.
    */
   void crawlerParallel(
       const std::shared_ptr<Root>& root,
-      ViewDatabase& view,
+      ViewWriter& view,
       PendingChanges& coll,
       const PendingChange& pending,
       std::vector<w_string>& pendingCookies);
 
+  /**
+   * Called on the IO thread by crawls under crawl_stat_policy "names".
+   * Records the entry of dir named name as an existing file of type dtype,
+   * without stat'ing it, and marks it changed at now.
+   */
+  void addUnstatedFile(
+      ViewDatabase& view,
+      watchman_dir* dir,
+      const w_string& name,
+      DType dtype,
+      std::chrono::system_clock::time_point now);
+
   /**
    * Called on the IO thread. If `pending` is not in the ignored directory list,
    * lstat() the file and update the InMemoryView. This may insert work into
@@ -323,6 +841,14 @@ class InMemoryView final : public QueryableView {
       const PendingChange& pending,
       const FileInformation* pre_stat);
 
+  // Caches the target of the symlink at fullPath under the file's current
+  // otime, reading it unless target is given. Changes to the symlink give
+  // it a new otime, and so a new key, which invalidates the entry.
+  void prefetchSymlinkTarget(
+      const w_string& fullPath,
+      const watchman_file* file,
+      const w_string* target = nullptr);
+
   // END IOTHREAD
 
  public:
@@ -335,22 +861,38 @@ class InMemoryView final : public QueryableView {
   };
 
   struct IoThreadState {
-    explicit IoThreadState(std::chrono::milliseconds biggestTimeout)
-        : biggestTimeout{biggestTimeout} {}
+    explicit IoThreadState(
+        std::chrono::milliseconds biggestTimeout,
+        std::chrono::milliseconds debounceWindow = {},
+        SettleEstimator settle = SettleEstimator{})
+        : biggestTimeout{biggestTimeout},
+          debounce{debounceWindow},
+          settle{settle} {}
 
     const std::chrono::milliseconds biggestTimeout;
 
     PendingChanges localPending;
+    // Changes to paths that the watcher keeps reporting, held back from
+    // localPending until they settle down.
+    PendingDebounce debounce;
     std::chrono::milliseconds currentTimeout;
+    // Chooses the settle period from the pauses between bursts of changes.
+    SettleEstimator settle;
 
     // When the iothread last processed a pending event from the Watcher.
     std::optional<std::chrono::steady_clock::time_point> lastUnsettle;
+
+    // How long to wait for more events after a large batch arrives. Grows
+    // while large batches keep arriving and shrinks once they stop.
+    std::chrono::milliseconds batchWindow{0};
   };
 
-  // Returns a reference to the ViewDatabase without synchronizing on the mutex.
+  // Returns a reference to the first shard's ViewDatabase without
+  // synchronizing on its mutex. Unless view_shards is set, that is the whole
+  // view.
   // DO NOT USE OUTSIDE OF SINGLE-THREADED TESTS.
   ViewDatabase& unsafeAccessViewDatabase() {
-    return view_.unsafeGetUnlocked();
+    return shards_.front()->unsafeGetUnlocked();
   }
 
   // Used by tests to inject events into the iothread.
@@ -370,25 +912,185 @@ class InMemoryView final : public QueryableView {
       PendingCollection& pendingFromWatcher,
       PendingChanges& localPending);
 
+  /**
+   * For a recrawl that is being held back: the events that were dropped
+   * most likely belong to whatever was busy, so adds recursive, desynced
+   * crawls of the dirs that hold the files changed within window, up to
+   * kMaxRecoveryDirs of them. Returns how many were added.
+   */
+  size_t addRecentlyChangedDirs(
+      PendingChanges& pending,
+      std::chrono::system_clock::duration window) const;
+  static constexpr size_t kMaxRecoveryDirs = 4096;
+
+  /**
+   * Called with the number of items that the watcher produced since the last
+   * step. Adapts state.batchWindow to the event rate and, if this is part of
+   * a storm of events, waits for that long and takes what arrived meanwhile
+   * so that it can be applied under the same view lock. The wait ends early
+   * if a sync is requested or a cookie arrives.
+   */
+  void collectBatch(
+      IoThreadState& state,
+      PendingCollection& pendingFromWatcher,
+      size_t received);
+
   // Performs settle-time actions.
   // Returns whether the root was reaped and the IO thread should terminate.
-  Continue doSettleThings(Root& root, IoThreadState& state);
+  // Moves what the watcher reported into state.localPending, by way of
+  // state.debounce. Returns true if it included any syncs.
+  bool takePending(IoThreadState& state, PendingChanges& from);
+
+  Continue
+  doSettleThings(Root& root, IoThreadState& state, bool forced = false);
+
+  /**
+   * Opens the tick index left by the previous incarnation of this root.
+   * Returns nullptr if persist_tick_index is disabled, or there is no usable
+   * index.
+   */
+  std::unique_ptr<TickIndexReader> openTickIndex() const;
+
+  /**
+   * Called at the end of the initial crawl, with every shard locked. Carries
+   * the clocks recorded in index over to the files whose stat information
+   * shows that they have not changed, so that the previous incarnation's
+   * clocks remain valid. The predecessor is only published if the root dir
+   * is the same one that the index was written for.
+   */
+  void applyTickIndex(ViewWriter& view, TickIndexReader& index);
+
+  /**
+   * Called by the initial crawl, with every shard locked, in place of
+   * crawling the root. Populates the view from index and queues every dir
+   * that it holds for verification. Returns false if the index cannot be
+   * used, in which case the root must be crawled.
+   */
+  bool warmStart(const Root& root, ViewWriter& view, TickIndexReader& index);
+
+  /**
+   * Moves the next batch of dirs awaiting warm start verification to
+   * pending. Each is crawled without recursing, stat()ing its entries.
+   */
+  void queueWarmStartVerification(PendingChanges& pending);
+
+  /**
+   * Writes the tick index for the current state of the view. drained is
+   * true if the IO thread has no pending items of its own, in which case
+   * the watcher's event cursor may be recorded with it.
+   */
+  void saveTickIndex(bool drained);
+
+  /**
+   * Adds the nodes recorded in index to the view, with their clocks. Throws
+   * if the index is malformed, having added some of them. The caller must
+   * sort the recency lists of roots afterwards.
+   */
+  void loadTickIndex(
+      ViewWriter& view,
+      std::vector<ViewWriter::ShardDir>& roots,
+      TickIndexReader& index);
+
+  /**
+   * Writes the view to a tick index at path, with the given watcher cursor.
+   * Returns false, having logged why, if it could not be written.
+   */
+  bool writeTickIndex(const w_string& path, const w_string& watcherCursor);
+
+  /**
+   * Writes the view to a tick index at path, with the given watcher cursor,
+   * and returns the number of file nodes written. Throws if it could not be
+   * written.
+   */
+  size_t writeSnapshot(const w_string& path, const w_string& watcherCursor)
+      const;
+
+  /**
+   * Returns true if the root has had no commands for hibernate_idle_seconds
+   * and has no triggers or subscriptions, which evaluate queries on their
+   * own.
+   */
+  bool shouldHibernate(const Root& root) const;
+
+  /**
+   * Writes the view to the hibernation file and frees its nodes. From then
+   * on, the changes that the watcher reports are held in
+   * hibernationJournal_ rather than applied. Returns false if the view is
+   * left as it was, because it couldn't be written or the root is no longer
+   * idle.
+   */
+  bool hibernate(const Root& root);
+
+  /**
+   * Restores the view written by hibernate, and moves the changes held
+   * since then to state.localPending. If the hibernation file can't be
+   * read, the root is recrawled instead.
+   */
+  void rehydrate(Root& root, IoThreadState& state);
+
+  /**
+   * If the view is hibernating, has the IO thread restore it and waits for
+   * that. Called by the generators.
+   */
+  void wakeFromHibernation() const;
 
   FileSystem& fileSystem_;
   const Configuration config_;
 
-  folly::Synchronized<ViewDatabase> view_;
+  using ViewShard = folly::Synchronized<ViewDatabase>;
+  using ViewReadLock = ViewShard::ConstRLockedPtr;
+
+  /**
+   * Returns the index of the shard holding path, which must lie below the
+   * root. Entries are assigned to shards by their top level path component.
+   */
+  size_t shardIndex(w_string_piece path) const;
+  size_t shardIndexForTopLevelName(w_string_piece name) const;
+
+  /**
+   * Returns the half open range of shards that hold the dir at path: all of
+   * them for the root, else the one shard holding it.
+   */
+  std::pair<size_t, size_t> shardRangeForDir(w_string_piece path) const;
+
+  // Read locks every shard, in index order.
+  std::vector<ViewReadLock> rlockAllShards() const;
+
+  // The view is partitioned into view_shards independently locked parts, so
+  // that IO thread work under one top level dir does not block queries that
+  // need another. There is always at least one.
+  std::vector<std::unique_ptr<ViewShard>> shards_;
   // The most recently observed tick value of an item in the view
   // Only incremented by the iothread, but may be read by other threads.
   std::atomic<ClockTicks> mostRecentTick_{1};
+  // The tick as of the last time that the IO thread released the shards,
+  // and so the newest one whose changes are all visible. This is the clock
+  // that queries are answered with.
+  std::atomic<ClockTicks> publishedTick_{1};
   const ClockRoot rootNumber_{0};
   const w_string rootPath_;
+  // Identifies the IO thread's spans in the debug-trace output.
+  const uint32_t traceRootId_;
 
   ClockTicks lastAgeOutTick_{0};
   // This is system_clock instead of steady_clock because it's compared with a
   // file's otime.
   std::chrono::system_clock::time_point lastAgeOutTimestamp_{};
 
+  // When non-zero, ageOut releases the view write lock after examining this
+  // many files so that queries and the IO thread can make progress.
+  const size_t ageOutSliceFiles_;
+  // When set, the nodes of deleted files are freed when the IO thread
+  // settles, leaving only a tombstone for each.
+  const bool compactDeletedFiles_;
+  // Everything deleted up to this tick has been compacted. Only used by the
+  // IO thread.
+  ClockTicks lastCompactedTick_{0};
+  // Serializes ageOut and compactDeletedFiles. While a sliced age out has
+  // released the view lock it relies on being the only thing that can
+  // remove file nodes.
+  std::mutex ageOutMutex_;
+
   using PendingSettles =
       std::multimap<std::chrono::milliseconds, folly::Promise<folly::Unit>>;
 
@@ -405,8 +1107,10 @@ class InMemoryView final : public QueryableView {
    *
    * Populated by both the IO thread (fullCrawl), the notify thread (from the
    * watcher), and anything that calls waitUntilReadyToQuery.
+   *
+   * mutable because queries queue the crawls of lazy dirs.
    */
-  PendingCollection pendingFromWatcher_;
+  mutable PendingCollection pendingFromWatcher_;
 
   std::atomic<bool> stopThreads_{false};
   std::shared_ptr<Watcher> watcher_;
@@ -415,6 +1119,13 @@ class InMemoryView final : public QueryableView {
   // const methods
   mutable InMemoryViewCaches caches_;
 
+  // allFilesGenerator is parallelized for views with at least this many
+  // files. Zero disables the automatic switch.
+  const size_t parallelQueryFileThreshold_;
+  // Upper bound on the number of thread pool tasks used by a single
+  // parallel generator, in addition to the calling thread.
+  const size_t parallelQueryMaxWorkers_;
+
   // Should we warm the cache when we settle?
   bool enableContentCacheWarming_{false};
   // How many of the most recent files to warm up when settling?
@@ -422,8 +1133,15 @@ class InMemoryView final : public QueryableView {
   // If true, we will wait for the items to be hashed before
   // dispatching the settle to watchman clients
   bool syncContentCacheWarming_{false};
+  // Only warm the files like those that clients have asked to hash
+  bool warmOnlyRequestedContent_{false};
+  // The bytes per second that warming may read; zero means no limit
+  const int64_t contentWarmBytesPerSec_;
   // Remember what we've already warmed up
   uint32_t lastWarmedTick_{0};
+  // Set while the files of one settle are being warmed, so that the next
+  // settle leaves its files to the one after, rather than queueing more.
+  std::atomic<bool> contentWarmRunning_{false};
 
   struct PendingChangeLogEntry {
     PendingChangeLogEntry() noexcept {
@@ -458,6 +1176,262 @@ class InMemoryView final : public QueryableView {
 
   // Track statPath() count during fullCrawl(). Used to report progress.
   std::shared_ptr<std::atomic<size_t>> fullCrawlStatCount_;
+  // The number of dirs read during fullCrawl(), and when it started.
+  size_t fullCrawlDirCount_{0};
+  std::chrono::steady_clock::time_point fullCrawlStart_;
+  // Crawl progress is reported no more often than this.
+  const std::chrono::milliseconds crawlProgressInterval_;
+  std::chrono::steady_clock::time_point lastCrawlProgress_;
+  // The totals of the previous full crawl, from which the remaining time of
+  // the current one is estimated.
+  struct CrawlTotals {
+    size_t dirs;
+    size_t stats;
+  };
+  std::optional<CrawlTotals> lastCrawlTotals_;
+
+  // When non-zero, processAllPending releases the view write locks after
+  // holding them for this long so that queries can interleave with a large
+  // batch of changes. Such a query may see the batch half applied, in a state
+  // that never existed on disk; what it gets is a clock that covers every
+  // change it saw, so that the remainder of the batch is reported to its next
+  // since query.
+  const std::chrono::milliseconds viewLockSlice_;
+
+  // Number of times processAllPending yielded the view lock. Reported in
+  // debug info.
+  std::atomic<size_t> viewLockYields_{0};
+
+  // When non-zero, a step that receives at least batchMinItems_ items from
+  // the watcher waits up to this long for more before applying them.
+  const std::chrono::milliseconds batchWindowMax_;
+  const size_t batchMinItems_;
+  // The current batch window and the number of batches it has extended.
+  // Reported in debug info.
+  std::atomic<int64_t> batchWindowMs_{0};
+  std::atomic<size_t> batchesExtended_{0};
+
+  // When non-zero, the notify thread holds on to the changes it consumed for
+  // up to this long while the watcher reports that more are imminent.
+  const std::chrono::milliseconds notifyBatchDelay_;
+  // The number of batches that were held. Reported in debug info.
+  std::atomic<size_t> notifyBatchesHeld_{0};
+
+  // When non-zero, changes to a path that is reported again within this
+  // long are held back and applied once, when it stops changing.
+  const std::chrono::milliseconds pendingDebounce_;
+  // The number of reports that debouncing absorbed. Reported in debug info.
+  std::atomic<size_t> debouncedChanges_{0};
+
+  // Batches of at least this many pending items are stat'd on the thread
+  // pool before they are applied. Zero disables pre-stating.
+  const size_t parallelStatMinItems_;
+  // Upper bound on the number of thread pool tasks used to pre-stat a batch,
+  // in addition to the IO thread.
+  const size_t parallelStatMaxWorkers_;
+  // Whether the stat information that the watcher attaches to pending items
+  // is used instead of an lstat. Only watchers that set
+  // WATCHER_SUPPLIES_STAT are trusted.
+  const bool trustWatcherStat_;
+  // Number of batches that were pre-stat'd. Reported in debug info.
+  std::atomic<size_t> parallelStatBatches_{0};
+  // Number of pending items whose stat information came from the watcher.
+  // Reported in debug info.
+  std::atomic<size_t> watcherStats_{0};
+
+  // Recursive recrawls of subtrees with at least this many dirs use
+  // crawlerParallel. Zero leaves the choice to enable_parallel_crawl.
+  const size_t parallelRecrawlMinDirs_;
+  // The most ReadDirResults that crawlerParallel applies per batch. After
+  // the initial crawl, the view locks are released between batches.
+  const size_t parallelCrawlBatchDirs_;
+
+  // If true, recursive recrawls do not stat the existing files in dirs whose
+  // own stat information is unchanged.
+  const bool trustUnchangedDirMtime_;
+
+  // If true, crawls populate files from the type that readdir reports and
+  // leave them unstat'd until a query needs their stat information; see
+  // crawl_stat_policy.
+  const bool deferFileStat_;
+
+  // If true, the targets of symlinks are read as they are stat'd, and put
+  // in the symlink target cache; see symlink_target_prefetch.
+  const bool prefetchSymlinkTargets_;
+
+  // Dirs this many levels below the root are only registered by the initial
+  // crawl, and are crawled when a query first needs them. Zero crawls the
+  // whole tree up front.
+  const size_t lazyCrawlDepth_;
+  enum class LazyDirState {
+    // Neither read nor watched.
+    Unexplored,
+    // A query has queued its crawl.
+    Requested,
+    // Crawled by the batch that the IO thread is processing.
+    Crawled,
+    // Crawled for a query and kept in the view since. Only vcsIgnoredDirs_
+    // keeps entries once they are crawled.
+    Kept,
+  };
+  // The dirs at lazyCrawlDepth_ whose subtrees are not fully in the view.
+  mutable folly::Synchronized<std::map<w_string, LazyDirState>> lazyDirs_;
+  // The Crawled entries of lazyDirs_ and vcsIgnoredDirs_, which are removed
+  // or kept once their batch is done. Only accessed on the iothread.
+  std::vector<w_string> lazyCrawled_;
+  // Number of lazy dirs crawled. Reported in debug info.
+  std::atomic<size_t> lazyCrawls_{0};
+
+  // Orders w_strings without building one to look a piece up.
+  struct PieceLess {
+    using is_transparent = void;
+    bool operator()(w_string_piece a, w_string_piece b) const {
+      return a < b;
+    }
+  };
+  // If true, the dirs that the root's .gitignore, .git/info/exclude or
+  // .hgignore ignore are only crawled when a query asks for them.
+  const bool vcsIgnoreCrawl_;
+  // Loaded by each full crawl.
+  folly::Synchronized<std::shared_ptr<const VcsIgnoreRules>> vcsIgnoreRules_;
+  // The shallowest ignored dirs. Unlike lazyDirs_, entries are kept once
+  // crawled, so that recrawls keep them in the view.
+  mutable folly::Synchronized<std::map<w_string, LazyDirState, PieceLess>>
+      vcsIgnoredDirs_;
+  // Number of ignored dirs crawled for queries. Reported in debug info.
+  std::atomic<size_t> vcsIgnoredCrawls_{0};
+
+  // If true, the tick index is loaded by the initial crawl and saved
+  // periodically while settled and when the IO thread stops.
+  const bool persistTickIndex_;
+  const std::chrono::seconds tickIndexSaveInterval_;
+  // Only accessed on the iothread.
+  bool tickIndexLoaded_{false};
+  std::optional<std::chrono::steady_clock::time_point> lastTickIndexSave_;
+
+  // If persist_content_hashes is set, the content hashes computed since the
+  // last save are written in the thread pool while settled, at most once per
+  // interval, and when the IO thread stops.
+  const std::chrono::seconds contentHashSaveInterval_;
+  // Only accessed on the iothread.
+  std::optional<std::chrono::steady_clock::time_point> lastContentHashSave_;
+
+  // Set once the initial crawl has continued the tick sequence of an
+  // earlier incarnation.
+  folly::Synchronized<std::optional<ClockPredecessor>> clockPredecessor_;
+
+  // If true, the initial crawl populates the view from the tick index and
+  // the root is verified afterwards, warmStartVerifyBatch_ dirs at a time.
+  const bool warmStartFromTickIndex_;
+  const size_t warmStartVerifyBatch_;
+  // Dirs loaded by a warm start that have not yet been verified. Only
+  // accessed on the iothread.
+  std::deque<w_string> warmStartVerifyQueue_;
+
+  // When non-zero, the view is written to disk and freed once the root has
+  // been idle this long, and restored by the next query.
+  const std::chrono::seconds hibernateIdle_;
+  // The most changes held while hibernating. Beyond that, they are replaced
+  // by a recrawl of the root.
+  const size_t hibernateJournalMaxItems_;
+  std::atomic<bool> hibernated_{false};
+  // The changes reported while hibernating. Only accessed on the iothread.
+  PendingChanges hibernationJournal_;
+  // Number of times the view hibernated. Reported in debug info.
+  std::atomic<size_t> hibernations_{0};
+
+  // If true, the shards index their files by suffix for suffixGenerator.
+  const bool indexSuffixes_;
+
+  // The files that changed between two settles, as they were at the second.
+  // The copies are detached from the view, so they can be read without
+  // holding its locks.
+  struct ChangeSet {
+    struct File {
+      w_string dirName;
+      watchman_dir::FilePtr file;
+    };
+    ClockTicks toTick;
+    // Most recently changed first
+    std::vector<File> files;
+  };
+  struct ChangeLog {
+    // Every change with a tick in (fromTick, toTick] is in sets, which are
+    // oldest first. Both are zero until the first settle.
+    ClockTicks fromTick{0};
+    ClockTicks toTick{0};
+    std::deque<std::shared_ptr<const ChangeSet>> sets;
+    size_t numFiles{0};
+    // While a state is asserted, the toTick of the log when that was first
+    // seen; the sets after it are merged once no state is asserted.
+    std::optional<ClockTicks> stateFromTick;
+    // The toTick of the log before the first set that was recorded since
+    // the last settle; the sets after it are merged at the next one.
+    std::optional<ClockTicks> unsettledFromTick;
+  };
+  // Merges the sets of log recorded after fromTick into one
+  static void mergeChangeSets(ChangeLog& log, ClockTicks fromTick);
+  // The most files held by changeLog_. Zero disables it.
+  const size_t changeLogMaxFiles_;
+  // The most files held by changeLog_ while a state is asserted; at least
+  // changeLogMaxFiles_.
+  const size_t changeLogStateMaxFiles_;
+  // If true, a set is also recorded after each batch of pending changes.
+  const bool changeLogUnsettled_;
+  folly::Synchronized<ChangeLog> changeLog_;
+
+  // The most changed files that markChangePrefilters() matches against the
+  // prefilters. Zero disables them.
+  const size_t prefilterMaxFiles_;
+  // Released prefilters are pruned by markChangePrefilters()
+  folly::Synchronized<std::vector<std::weak_ptr<ChangePrefilter>>>
+      changePrefilters_;
+  // Every change up to this tick has been matched. Only used by the IO
+  // thread.
+  ClockTicks lastPrefilterTick_{0};
+
+  // The full paths of vcsLockFiles()
+  const std::vector<w_string> vcsLockPaths_;
+  // Bit i is set while vcsLockPaths_[i] exists in the view. Only written by
+  // the IO thread.
+  std::atomic<uint32_t> vcsLockFilesPresent_{0};
+
+  // Whether to sync through the watcher's flushPendingEvents() alone, if it
+  // is a barrier, instead of touching cookie files.
+  const bool cookielessSync_;
+
+  // When non-zero, the settle period adapts to the pauses between bursts of
+  // changes, up to settleAdaptiveMax_.
+  const std::chrono::milliseconds settleAdaptiveMax_;
+  // When non-zero, the root settles after changes have kept arriving for
+  // this long.
+  const std::chrono::milliseconds settleMaxWait_;
+  // What the IO thread's SettleEstimator last decided. Reported in
+  // debug-status.
+  folly::Synchronized<SettleStatus> settleStatus_;
+
+  // Written by the IO thread as it applies each batch, for getLagStatus.
+  std::atomic<size_t> ioThreadBacklog_{0};
+  std::atomic<int64_t> eventLagMicros_{0};
+  std::atomic<int64_t> maxEventLagMicros_{0};
+
+  // The commits whose merge base with the working copy's parent is computed
+  // in the background whenever that parent may have changed.
+  const std::vector<w_string> scmPrefetchMergeBases_;
+  // The newest tick at which a parent state file was seen to change.
+  uint32_t lastScmStateTick_{0};
+  // The saved state lookups of recent queries, most recent first.
+  folly::Synchronized<std::vector<SavedStateLookup>> savedStateLookups_;
+
+  // The watcher's event cursor as of the items most recently enqueued into
+  // pendingFromWatcher_. Updated after the items are enqueued, so whoever
+  // reads it and then finds pendingFromWatcher_ empty knows that those
+  // items have been taken.
+  folly::Synchronized<w_string> watcherCursor_;
+  // Set by the notify thread if the watcher is replaying the events that
+  // followed the cursor saved in the tick index, in which case a warm start
+  // needs no verification.
+  std::atomic<bool> watcherResumed_{false};
 };
 
 } // namespace watchman
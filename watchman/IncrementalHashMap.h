@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace watchman {
+
+/**
+ * A hash map that grows a little at a time once it is large.
+ *
+ * std::unordered_map rehashes every entry when it outgrows its buckets, so
+ * adding one entry to a dir of half a million files stalls for as long as
+ * it takes to relink all of them. This map instead moves the entries to the
+ * larger bucket array kBucketsPerStep old buckets at a time, as later
+ * entries are added and removed. Lookups consult both arrays until the move
+ * is done. Maps with fewer than kIncrementalBuckets buckets are cheap to
+ * rehash, and do so all at once.
+ *
+ * As with std::unordered_map, references to entries stay valid until the
+ * entry is erased, while insertions and erasures invalidate iterators.
+ */
+template <
+    typename Key,
+    typename Value,
+    typename Hash = std::hash<Key>,
+    typename KeyEqual = std::equal_to<Key>>
+class IncrementalHashMap {
+  struct Node;
+
+ public:
+  using key_type = Key;
+  using mapped_type = Value;
+  using value_type = std::pair<const Key, Value>;
+  using size_type = size_t;
+
+  static constexpr size_t kIncrementalBuckets = 4096;
+  static constexpr size_t kBucketsPerStep = 64;
+
+  template <bool Const>
+  class Iterator {
+    using Map =
+        std::conditional_t<Const, const IncrementalHashMap, IncrementalHashMap>;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = IncrementalHashMap::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+    using reference =
+        std::conditional_t<Const, const value_type&, value_type&>;
+
+    Iterator() = default;
+
+    template <bool C = Const, typename = std::enable_if_t<C>>
+    /* implicit */ Iterator(const Iterator<false>& other)
+        : map_{other.map_},
+          table_{other.table_},
+          bucket_{other.bucket_},
+          node_{other.node_} {}
+
+    reference operator*() const {
+      return node_->value;
+    }
+
+    pointer operator->() const {
+      return &node_->value;
+    }
+
+    Iterator& operator++() {
+      node_ = node_->next;
+      if (!node_) {
+        ++bucket_;
+        findNode();
+      }
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      auto prev = *this;
+      ++*this;
+      return prev;
+    }
+
+    template <bool C>
+    bool operator==(const Iterator<C>& other) const {
+      return node_ == other.node_;
+    }
+
+    template <bool C>
+    bool operator!=(const Iterator<C>& other) const {
+      return node_ != other.node_;
+    }
+
+   private:
+    friend class IncrementalHashMap;
+    template <bool>
+    friend class Iterator;
+
+    Iterator(Map* map, size_t table, size_t bucket, Node* node)
+        : map_{map}, table_{table}, bucket_{bucket}, node_{node} {}
+
+    // Moves to the first entry at or after bucket_ of table_, or to the end.
+    void findNode() {
+      for (; table_ < 2; ++table_, bucket_ = 0) {
+        auto& table = map_->table(table_);
+        for (; bucket_ < table.numBuckets; ++bucket_) {
+          if (table.buckets[bucket_]) {
+            node_ = table.buckets[bucket_];
+            return;
+          }
+        }
+      }
+      node_ = nullptr;
+    }
+
+    Map* map_{nullptr};
+    size_t table_{2};
+    size_t bucket_{0};
+    Node* node_{nullptr};
+  };
+
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  IncrementalHashMap() = default;
+
+  IncrementalHashMap(IncrementalHashMap&& other) noexcept
+      : main_{std::exchange(other.main_, Table{})},
+        old_{std::exchange(other.old_, Table{})},
+        moved_{std::exchange(other.moved_, 0)},
+        size_{std::exchange(other.size_, 0)} {}
+
+  IncrementalHashMap& operator=(IncrementalHashMap&& other) noexcept {
+    if (this != &other) {
+      clear();
+      main_ = std::exchange(other.main_, Table{});
+      old_ = std::exchange(other.old_, Table{});
+      moved_ = std::exchange(other.moved_, 0);
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+
+  IncrementalHashMap(const IncrementalHashMap&) = delete;
+  IncrementalHashMap& operator=(const IncrementalHashMap&) = delete;
+
+  ~IncrementalHashMap() {
+    clear();
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  // Counts the buckets of both arrays while entries are being moved.
+  size_t bucket_count() const {
+    return main_.numBuckets + old_.numBuckets;
+  }
+
+  // True until the entries of the previous bucket array have all been moved.
+  bool isRehashing() const {
+    return old_.numBuckets != 0;
+  }
+
+  iterator begin() {
+    iterator it{this, 0, 0, nullptr};
+    it.findNode();
+    return it;
+  }
+
+  const_iterator begin() const {
+    const_iterator it{this, 0, 0, nullptr};
+    it.findNode();
+    return it;
+  }
+
+  iterator end() {
+    return iterator{this, 2, 0, nullptr};
+  }
+
+  const_iterator end() const {
+    return const_iterator{this, 2, 0, nullptr};
+  }
+
+  iterator find(const Key& key) {
+    auto loc = locate(key, hasher_(key));
+    return loc.node ? iterator{this, loc.table, loc.bucket, loc.node} : end();
+  }
+
+  const_iterator find(const Key& key) const {
+    auto loc = locate(key, hasher_(key));
+    return loc.node ? const_iterator{this, loc.table, loc.bucket, loc.node}
+                    : end();
+  }
+
+  /**
+   * Inserts an entry for key, its value constructed from args, unless there
+   * already is one. Returns the entry and whether it was inserted.
+   */
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+    auto hash = hasher_(key);
+    auto loc = locate(key, hash);
+    if (loc.node) {
+      return {iterator{this, loc.table, loc.bucket, loc.node}, false};
+    }
+
+    prepareToInsert();
+    auto* node = new Node{
+        hash,
+        std::piecewise_construct,
+        std::forward_as_tuple(key),
+        std::forward_as_tuple(std::forward<Args>(args)...)};
+    auto bucket = hash & (main_.numBuckets - 1);
+    node->next = main_.buckets[bucket];
+    main_.buckets[bucket] = node;
+    ++size_;
+    return {iterator{this, 1, bucket, node}, true};
+  }
+
+  template <typename K, typename... Args>
+  std::pair<iterator, bool> emplace(K&& key, Args&&... args) {
+    return try_emplace(Key(std::forward<K>(key)), std::forward<Args>(args)...);
+  }
+
+  Value& operator[](const Key& key) {
+    return try_emplace(key).first->second;
+  }
+
+  size_t erase(const Key& key) {
+    auto hash = hasher_(key);
+    for (size_t t = 0; t < 2; ++t) {
+      auto& table = this->table(t);
+      if (!table.numBuckets) {
+        continue;
+      }
+      auto** link = &table.buckets[hash & (table.numBuckets - 1)];
+      for (; *link; link = &(*link)->next) {
+        auto* node = *link;
+        if (node->hash == hash && equal_(node->value.first, key)) {
+          *link = node->next;
+          delete node;
+          --size_;
+          moveBuckets(kBucketsPerStep);
+          return 1;
+        }
+      }
+    }
+    return 0;
+  }
+
+  // Unlike erasing by key, this moves no buckets, so that the returned
+  // iterator to the next entry remains valid.
+  iterator erase(const_iterator pos) {
+    iterator next{this, pos.table_, pos.bucket_, pos.node_};
+    ++next;
+    auto** link = &table(pos.table_).buckets[pos.bucket_];
+    while (*link != pos.node_) {
+      link = &(*link)->next;
+    }
+    *link = pos.node_->next;
+    delete pos.node_;
+    --size_;
+    return next;
+  }
+
+  void clear() {
+    for (auto* table : {&main_, &old_}) {
+      for (size_t i = 0; i < table->numBuckets; ++i) {
+        for (auto* node = table->buckets[i]; node;) {
+          auto* next = node->next;
+          delete node;
+          node = next;
+        }
+      }
+      *table = Table{};
+    }
+    moved_ = 0;
+    size_ = 0;
+  }
+
+  // Makes room for count entries without growing. This rehashes at once, so
+  // it is meant for a map that is still empty.
+  void reserve(size_t count) {
+    if (count <= main_.numBuckets) {
+      return;
+    }
+    moveBuckets(old_.numBuckets);
+    auto numBuckets = kMinBuckets;
+    while (numBuckets < count) {
+      numBuckets *= 2;
+    }
+    rehash(numBuckets, /*incremental=*/false);
+  }
+
+ private:
+  static constexpr size_t kMinBuckets = 8;
+
+  struct Node {
+    template <typename... Args>
+    explicit Node(size_t hash, Args&&... args)
+        : hash{hash}, value{std::forward<Args>(args)...} {}
+
+    Node* next{nullptr};
+    size_t hash;
+    value_type value;
+  };
+
+  struct Table {
+    std::unique_ptr<Node*[]> buckets;
+    // Zero or a power of two
+    size_t numBuckets{0};
+  };
+
+  struct Location {
+    size_t table;
+    size_t bucket;
+    Node* node;
+  };
+
+  Table& table(size_t index) {
+    return index == 0 ? old_ : main_;
+  }
+
+  const Table& table(size_t index) const {
+    return index == 0 ? old_ : main_;
+  }
+
+  Location locate(const Key& key, size_t hash) const {
+    for (size_t t = 0; t < 2; ++t) {
+      auto& table = this->table(t);
+      if (!table.numBuckets) {
+        continue;
+      }
+      auto bucket = hash & (table.numBuckets - 1);
+      for (auto* node = table.buckets[bucket]; node; node = node->next) {
+        if (node->hash == hash && equal_(node->value.first, key)) {
+          return Location{t, bucket, node};
+        }
+      }
+    }
+    return Location{0, 0, nullptr};
+  }
+
+  void prepareToInsert() {
+    moveBuckets(kBucketsPerStep);
+    if (size_ < main_.numBuckets) {
+      return;
+    }
+    // Only if entries were added faster than the move could keep up
+    moveBuckets(old_.numBuckets);
+    rehash(
+        main_.numBuckets ? main_.numBuckets * 2 : kMinBuckets,
+        /*incremental=*/true);
+  }
+
+  // Starts moving the entries to a new bucket array of numBuckets.
+  void rehash(size_t numBuckets, bool incremental) {
+    old_ = std::exchange(
+        main_, Table{std::make_unique<Node*[]>(numBuckets), numBuckets});
+    moved_ = 0;
+    if (!incremental || old_.numBuckets < kIncrementalBuckets) {
+      moveBuckets(old_.numBuckets);
+    }
+  }
+
+  // Moves the entries of up to count more of the old buckets.
+  void moveBuckets(size_t count) {
+    if (!old_.numBuckets) {
+      return;
+    }
+    for (; count > 0 && moved_ < old_.numBuckets; --count, ++moved_) {
+      auto* node = std::exchange(old_.buckets[moved_], nullptr);
+      while (node) {
+        auto* next = node->next;
+        auto bucket = node->hash & (main_.numBuckets - 1);
+        node->next = main_.buckets[bucket];
+        main_.buckets[bucket] = node;
+        node = next;
+      }
+    }
+    if (moved_ == old_.numBuckets) {
+      old_ = Table{};
+      moved_ = 0;
+    }
+  }
+
+  Table main_;
+  // The previous bucket array, while its entries are being moved to main_
+  Table old_;
+  // The number of old_ buckets that have been emptied
+  size_t moved_{0};
+  size_t size_{0};
+  Hash hasher_;
+  KeyEqual equal_;
+};
+
+} // namespace watchman
@@ -8,10 +8,17 @@
 #pragma once
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <folly/hash/Hash.h>
+#include <folly/lang/Bits.h>
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <deque>
+#include <functional>
 #include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include "watchman/WatchmanConfig.h"
 
 namespace watchman {
@@ -49,6 +56,15 @@ namespace watchman {
  * and its nodes.  Because the cache is LRU it needs to touch
  * a node as part of a lookup to ensure that it will not
  * be evicted prematurely.
+ *
+ * A cache constructed with CacheAdmission::TinyLFU protects its
+ * frequently used items from a burst of items that are used once,
+ * such as a scan of a large tree, in the style of W-TinyLFU: new
+ * items enter a small window that is LRU, and the least recently
+ * used item of a full window only stays in the cache if it has been
+ * looked up more often than the least recently used item of the rest
+ * of the cache, which it then replaces.  How often keys are looked up
+ * is approximated by a FrequencySketch.
  */
 
 template <typename KeyType, typename ValueType>
@@ -125,6 +141,13 @@ class Node {
 
   // Time after which this node is to be considered invalid
   std::chrono::steady_clock::time_point deadline_;
+
+  // What the cache's weigher returned for the value
+  size_t weight_{0};
+
+  // Whether the node is in the admission window rather than in the
+  // main part of the cache; see CacheAdmission::TinyLFU.
+  bool inWindow_{false};
 };
 
 // A doubly-linked intrusive list through the cache nodes.
@@ -138,6 +161,8 @@ class TailQHead {
   Node* first_;
   // Address of the "next" field in the last element
   Node** addressOfLastNext_;
+  // Number of elements
+  size_t size_{0};
 
  public:
   TailQHead() : first_(nullptr), addressOfLastNext_(&first_) {}
@@ -147,6 +172,7 @@ class TailQHead {
     node->addressOfPreviousNext_ = addressOfLastNext_;
     *addressOfLastNext_ = node;
     addressOfLastNext_ = &node->next_;
+    ++size_;
   }
 
   void remove(Node* node) {
@@ -161,6 +187,7 @@ class TailQHead {
       addressOfLastNext_ = node->addressOfPreviousNext_;
     }
     *node->addressOfPreviousNext_ = node->next_;
+    --size_;
   }
 
   // Bubble the node to the tail end of the list.
@@ -173,6 +200,7 @@ class TailQHead {
   void clear() {
     first_ = nullptr;
     addressOfLastNext_ = &first_;
+    size_ = 0;
   }
 
   // Returns a pointer to the first element.
@@ -180,6 +208,88 @@ class TailQHead {
   Node* head() {
     return first_;
   }
+
+  size_t size() const {
+    return size_;
+  }
+};
+
+/**
+ * Approximately counts how often each key has been seen recently, in
+ * the manner of a count-min sketch: a key's count is the smallest of the
+ * four saturating 4 bit counters that its hash selects.  Once there have
+ * been ten increments for every item that the cache can hold, all of the
+ * counts are halved, so that keys that were popular a long time ago give
+ * way to those that are popular now.
+ */
+class FrequencySketch {
+ public:
+  // Sizes the sketch for a cache of maxItems, with about 16 counters for
+  // each item, and zeroes it.
+  void resize(size_t maxItems) {
+    maxItems = std::max<size_t>(maxItems, 1);
+    table_.assign(folly::nextPowTwo(std::max<size_t>(maxItems, 8)), 0);
+    sampleSize_ = 10 * maxItems;
+    additions_ = 0;
+  }
+
+  void clear() {
+    std::fill(table_.begin(), table_.end(), 0);
+    additions_ = 0;
+  }
+
+  void increment(uint64_t hash) {
+    bool added = false;
+    for (size_t i = 0; i < kDepth; ++i) {
+      auto [index, shift] = counterFor(hash, i);
+      if (((table_[index] >> shift) & kMaxCount) != kMaxCount) {
+        table_[index] += uint64_t(1) << shift;
+        added = true;
+      }
+    }
+    if (added && ++additions_ >= sampleSize_) {
+      halve();
+    }
+  }
+
+  unsigned frequency(uint64_t hash) const {
+    unsigned frequency = kMaxCount;
+    for (size_t i = 0; i < kDepth; ++i) {
+      auto [index, shift] = counterFor(hash, i);
+      frequency =
+          std::min(frequency, unsigned(table_[index] >> shift) & kMaxCount);
+    }
+    return frequency;
+  }
+
+ private:
+  static constexpr size_t kDepth = 4;
+  static constexpr unsigned kMaxCount = 0xf;
+
+  // Returns the word and the bit offset within it of the i'th counter
+  // for hash.
+  std::pair<size_t, unsigned> counterFor(uint64_t hash, size_t i) const {
+    static constexpr uint64_t kSeeds[kDepth] = {
+        0xc3a5c85c97cb3127,
+        0xb492b66fbe98f273,
+        0x9ae16a3b2f90404f,
+        0xcbf29ce484222325};
+    uint64_t h = (hash + kSeeds[i]) * kSeeds[i];
+    h ^= h >> 32;
+    return {size_t(h) & (table_.size() - 1), unsigned(h >> 60) * 4};
+  }
+
+  void halve() {
+    for (auto& word : table_) {
+      word = (word >> 1) & 0x7777777777777777;
+    }
+    additions_ /= 2;
+  }
+
+  // Each word holds 16 counters
+  std::vector<uint64_t> table_;
+  size_t sampleSize_{0};
+  size_t additions_{0};
 };
 
 struct Stats {
@@ -199,6 +309,9 @@ struct Stats {
   size_t cacheErase{0};
   // Number of times that the cache has been clear()'d
   size_t clearCount{0};
+  // Number of evictions of a new item in favor of a more frequently
+  // used one, with CacheAdmission::TinyLFU
+  size_t cacheReject{0};
 
   void clear() {
     cacheHit = 0;
@@ -208,6 +321,7 @@ struct Stats {
     cacheStore = 0;
     cacheLoad = 0;
     cacheErase = 0;
+    cacheReject = 0;
     ++clearCount;
   }
 };
@@ -223,6 +337,9 @@ struct InternalState {
   // Maintain some stats for cache introspection
   Stats stats;
 
+  // The total weight of the nodes in the map
+  size_t bytes{0};
+
   // To manage eviction we categorize a node into one of
   // three sets and link it into the appropriate tailq
   // below.  A node belongs in only one set at a time.
@@ -242,6 +359,14 @@ struct InternalState {
   // most recently used.
   TailQHead<NodeType> evictionOrder;
 
+  // With CacheAdmission::TinyLFU, successful nodes start out
+  // here rather than in evictionOrder, which they only
+  // join if they are used often enough.  This is also LRU.
+  TailQHead<NodeType> windowOrder;
+
+  // Only used with CacheAdmission::TinyLFU
+  FrequencySketch sketch;
+
   // Nodes with an error result; these have a TTL
   // that we must respect as a way to manage load.
   // Nodes in this set are never touched; this means
@@ -253,8 +378,19 @@ struct InternalState {
 } // namespace lrucache
 
 struct CacheStats : public lrucache::Stats {
-  CacheStats(const lrucache::Stats s, size_t size) : Stats(s), size(size) {}
+  CacheStats(const lrucache::Stats s, size_t size, size_t bytes = 0)
+      : Stats(s), size(size), bytes(bytes) {}
   size_t size;
+  // The total weight of the items, if the cache has a weigher
+  size_t bytes;
+};
+
+// Which new items the cache retains when it is full
+enum class CacheAdmission {
+  // All of them, evicting the least recently used items
+  All,
+  // Those used more often than the least recently used items
+  TinyLFU,
 };
 
 // The cache.  More information on this can be found at the
@@ -263,6 +399,8 @@ template <typename KeyType, typename ValueType>
 class LRUCache {
  public:
   using NodeType = lrucache::Node<KeyType, ValueType>;
+  // Returns the approximate number of bytes used by an item
+  using Weigher = std::function<size_t(const KeyType&, const ValueType&)>;
 
  private:
   using State = lrucache::InternalState<KeyType, ValueType>;
@@ -278,6 +416,31 @@ class LRUCache {
       std::chrono::milliseconds fetchTimeout = std::chrono::seconds(300))
       : maxItems_(maxItems), errorTTL_(errorTTL), fetchTimeout_(fetchTimeout) {}
 
+  // Construct a cache that, in addition to maxItems, limits the total
+  // weight of its items, as returned by weigher, to maxBytes. Errors weigh
+  // nothing, and items that weigh more than maxBytes are not retained.
+  // A maxBytes of zero means no limit.
+  LRUCache(
+      size_t maxItems,
+      std::chrono::milliseconds errorTTL,
+      size_t maxBytes,
+      Weigher weigher,
+      CacheAdmission admission = CacheAdmission::All,
+      std::chrono::milliseconds fetchTimeout = std::chrono::seconds(300))
+      : maxItems_(maxItems),
+        errorTTL_(errorTTL),
+        fetchTimeout_(fetchTimeout),
+        maxBytes_(maxBytes),
+        weigher_(std::move(weigher)),
+        admission_(admission),
+        // As in W-TinyLFU, 1% of the cache is enough to retain items that
+        // are used a few times in quick succession.
+        windowMax_(std::max<size_t>(1, maxItems / 100)) {
+    if (admission_ == CacheAdmission::TinyLFU) {
+      state_.wlock()->sketch.resize(maxItems_);
+    }
+  }
+
   LRUCache(
       Configuration&& cfg,
       const char* configPrefix,
@@ -313,6 +476,7 @@ class LRUCache {
           std::chrono::steady_clock::now()) {
     auto state = state_.wlock();
     ++state->stats.cacheLoad;
+    recordAccess(state, key);
 
     auto it = state->map.find(key);
     if (it == state->map.end()) {
@@ -325,6 +489,7 @@ class LRUCache {
 
     // Remove expired item
     if (node->expired(now)) {
+      state->bytes -= node->weight_;
       state->map.erase(it);
       q->remove(node.get());
       ++state->stats.cacheMiss;
@@ -339,7 +504,7 @@ class LRUCache {
       throw std::runtime_error("mixing Future getter with direct getter");
     }
 
-    if (q == &state->evictionOrder) {
+    if (q == &state->evictionOrder || q == &state->windowOrder) {
       q->touch(node.get());
     }
 
@@ -382,6 +547,7 @@ class LRUCache {
     {
       auto state = state_.wlock();
       ++state->stats.cacheLoad;
+      recordAccess(state, key);
 
       auto it = state->map.find(key);
       if (it != state->map.end()) {
@@ -391,7 +557,7 @@ class LRUCache {
 
         if (!node->expired(now)) {
           // Only touch successful nodes
-          if (q == &state->evictionOrder) {
+          if (q == &state->evictionOrder || q == &state->windowOrder) {
             q->touch(node.get());
           }
 
@@ -410,12 +576,13 @@ class LRUCache {
         // We can't re-use it without introducing locking in
         // the node itself.
         q->remove(node.get());
+        state->bytes -= node->weight_;
         state->map.erase(it);
         ++state->stats.cacheEvict;
       }
 
       // Try to make a new node; this can fail if we are too full
-      node = makeNode(state, now, key);
+      node = makeNode(state, now, 0, key);
 
       // Insert into map and the appropriate tailq
       state->map.emplace(std::make_pair(node->key_, node));
@@ -451,6 +618,11 @@ class LRUCache {
         // correct bucket just before we release the lock below.
         state->lookupOrder.remove(node.get());
 
+        if (node->value_.hasValue() && weigher_) {
+          node->weight_ = weigher_(node->key_, node->value_.value());
+          state->bytes += node->weight_;
+        }
+
         // We only need a TTL for errors
         if (node->value_.hasException()) {
           // Note that we don't account for the time it takes to
@@ -469,16 +641,27 @@ class LRUCache {
           abort();
         }
 
-        // Now that the promises have been stolen, insert into
-        // the appropriate queue.
-        whichQ(node.get(), state)->insertTail(node.get());
+        if (maxBytes_ && node->weight_ > maxBytes_) {
+          // It would not fit even in an empty cache, so only the waiters
+          // get to see it.
+          state->bytes -= node->weight_;
+          auto it = state->map.find(node->key_);
+          if (it != state->map.end() && it->second == node) {
+            state->map.erase(it);
+          }
+          ++state->stats.cacheEvict;
+        } else {
+          // Now that the promises have been stolen, insert into
+          // the appropriate queue.
+          insertNode(state, node.get());
+        }
 
         // If we were saturated at the start of the query, we may
         // not have been able to make room and may have taken on
         // more requests than the cache limits allow.  Now that we're
         // done we should be able to free up some of those entries,
         // so take a stab at that now.
-        while (state->map.size() > maxItems_) {
+        while (overBudget(state, 0, 0)) {
           if (!evictOne(state, now, true)) {
             // We were not able to evict anything, so stop
             // trying.  We'll be over our cache size limit,
@@ -520,13 +703,22 @@ class LRUCache {
       // with some valid value.
       auto oldNode = it->second;
       whichQ(oldNode.get(), state)->remove(oldNode.get());
+      state->bytes -= oldNode->weight_;
       state->map.erase(it);
       ++state->stats.cacheEvict;
     }
+    recordAccess(state, key);
 
-    auto node = makeNode(state, now, key, std::move(value));
+    size_t weight = weigher_ ? weigher_(key, value) : 0;
+    if (maxBytes_ && weight > maxBytes_) {
+      // It would not fit even in an empty cache
+      return std::make_shared<NodeType>(key, std::move(value));
+    }
+    auto node = makeNode(state, now, weight, key, std::move(value));
+    node->weight_ = weight;
+    state->bytes += weight;
     state->map.emplace(std::make_pair(node->key_, node));
-    whichQ(node.get(), state)->insertTail(node.get());
+    insertNode(state, node.get());
     ++state->stats.cacheStore;
 
     return node;
@@ -546,12 +738,36 @@ class LRUCache {
     // we do in the get() path.  The assumption is that the
     // caller is deliberately invalidating an errored node.
     whichQ(node.get(), state)->remove(node.get());
+    state->bytes -= node->weight_;
     state->map.erase(it);
     ++state->stats.cacheErase;
 
     return node;
   }
 
+  // Erase the error results whose TTL has passed, rather than leaving them
+  // until they are looked up or evicted.  Returns how many were erased.
+  size_t eraseExpired(
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    auto state = state_.wlock();
+    size_t erased = 0;
+    // Errors all have the same TTL and are linked in the order that they
+    // were stored, so the expired ones are at the head.
+    while (auto node = state->erroredOrder.head()) {
+      if (!node->expired(now)) {
+        break;
+      }
+      state->erroredOrder.remove(node);
+      state->bytes -= node->weight_;
+      // Erase from the map last, as this will invalidate node
+      state->map.erase(node->key_);
+      ++state->stats.cacheEvict;
+      ++erased;
+    }
+    return erased;
+  }
+
   // Returns the number of cached items
   size_t size() const {
     auto state = state_.rlock();
@@ -561,38 +777,52 @@ class LRUCache {
   // Returns cache statistics
   CacheStats stats() const {
     auto state = state_.rlock();
-    return CacheStats(state->stats, state->map.size());
+    return CacheStats(state->stats, state->map.size(), state->bytes);
   }
 
   // Purge all of the entries from the cache
   void clear() {
     auto state = state_.wlock();
     state->evictionOrder.clear();
+    state->windowOrder.clear();
     state->erroredOrder.clear();
     state->lookupOrder.clear();
     state->map.clear();
+    state->bytes = 0;
+    state->sketch.clear();
     state->stats.clear();
   }
 
  private:
-  // Small helper for creating a new Node.  This checks for capacity
-  // and attempts to evict an item to make room if needed.
-  // The eviction may fail in some cases, which results in this method
-  // also throwing.
+  // Small helper for creating a new Node of the given weight.  This checks
+  // for capacity and attempts to evict items to make room if needed.
+  // The eviction may fail in some cases, in which case the cache goes over
+  // its limits.
   template <typename... Args>
   std::shared_ptr<NodeType> makeNode(
       LockedState& state,
       std::chrono::steady_clock::time_point now,
+      size_t weight,
       Args&&... args) {
-    // If we are too full, try to evict an item; this may throw if there are no
-    // evictable items!
-    if (state->map.size() + 1 > maxItems_) {
-      evictOne(state, now, true);
+    // If we are too full, try to evict items to make room.
+    while (overBudget(state, 1, weight)) {
+      if (!evictOne(state, now, true)) {
+        break;
+      }
     }
 
     return std::make_shared<NodeType>(std::forward<Args>(args)...);
   }
 
+  // Whether adding `items` more nodes, weighing `bytes` in total, would take
+  // the cache over its limits.
+  bool overBudget(const LockedState& state, size_t items, size_t bytes) const {
+    if (state->map.size() + items > maxItems_) {
+      return true;
+    }
+    return maxBytes_ && state->bytes + bytes > maxBytes_;
+  }
+
   // Returns the queue into which the node should be placed (for new nodes),
   // or should currently be linked into (for existing nodes).
   lrucache::TailQHead<NodeType>* whichQ(NodeType* node, LockedState& state) {
@@ -604,9 +834,74 @@ class LRUCache {
       return &state->erroredOrder;
     }
 
+    if (node->inWindow_) {
+      return &state->windowOrder;
+    }
+
     return &state->evictionOrder;
   }
 
+  static uint64_t hashKey(const KeyType& key) {
+    return folly::hash::twang_mix64(std::hash<KeyType>{}(key));
+  }
+
+  void recordAccess(LockedState& state, const KeyType& key) {
+    if (admission_ == CacheAdmission::TinyLFU) {
+      state->sketch.increment(hashKey(key));
+    }
+  }
+
+  // Links a node that is no longer being fetched into the appropriate
+  // queue.  With CacheAdmission::TinyLFU, a successful node starts out in
+  // the window, which passes its least recently used node on if the cache
+  // is not yet full; otherwise evictOne does that.
+  void insertNode(LockedState& state, NodeType* node) {
+    if (admission_ == CacheAdmission::TinyLFU && node->value_.hasValue()) {
+      node->inWindow_ = true;
+      state->windowOrder.insertTail(node);
+      if (state->windowOrder.size() > windowMax_ && !overBudget(state, 0, 0)) {
+        moveToMain(state, state->windowOrder.head());
+      }
+      return;
+    }
+    whichQ(node, state)->insertTail(node);
+  }
+
+  void moveToMain(LockedState& state, NodeType* node) {
+    state->windowOrder.remove(node);
+    node->inWindow_ = false;
+    state->evictionOrder.insertTail(node);
+  }
+
+  // Returns the successful node to evict, if any.  With
+  // CacheAdmission::TinyLFU, once the window is full, the least recently
+  // used node of the window is compared with that of the main part of the
+  // cache, and the one that has been used less often is evicted.
+  NodeType* chooseVictim(LockedState& state) {
+    auto victim = state->evictionOrder.head();
+    if (admission_ != CacheAdmission::TinyLFU) {
+      return victim;
+    }
+    auto candidate = state->windowOrder.head();
+    if (!candidate) {
+      return victim;
+    }
+    if (!victim) {
+      return candidate;
+    }
+    if (state->windowOrder.size() < windowMax_) {
+      // It is the main part of the cache that is over its share
+      return victim;
+    }
+    if (state->sketch.frequency(hashKey(candidate->key_)) >
+        state->sketch.frequency(hashKey(victim->key_))) {
+      moveToMain(state, candidate);
+      return victim;
+    }
+    ++state->stats.cacheReject;
+    return candidate;
+  }
+
   // Attempt to evict a single item to make space for a new Node.
   // if `forceRemoval` is true, then we're being called to flush
   // out any excess items that we were forced to absorb earlier,
@@ -622,6 +917,7 @@ class LRUCache {
     auto errorNode = state->erroredOrder.head();
     if (errorNode && errorNode->expired(now)) {
       state->erroredOrder.remove(errorNode);
+      state->bytes -= errorNode->weight_;
       // Erase from the map last, as this will invalidate node
       state->map.erase(errorNode->key_);
       ++state->stats.cacheEvict;
@@ -629,9 +925,10 @@ class LRUCache {
     }
 
     // Second choice is to evict a successful item
-    auto node = state->evictionOrder.head();
+    auto node = chooseVictim(state);
     if (node) {
-      state->evictionOrder.remove(node);
+      whichQ(node, state)->remove(node);
+      state->bytes -= node->weight_;
       // Erase from the map last, as this will invalidate node
       state->map.erase(node->key_);
       ++state->stats.cacheEvict;
@@ -643,6 +940,7 @@ class LRUCache {
     // that we found earlier.
     if (forceRemoval && errorNode) {
       state->erroredOrder.remove(errorNode);
+      state->bytes -= errorNode->weight_;
       // Erase from the map last, as this will invalidate node
       state->map.erase(errorNode->key_);
       ++state->stats.cacheEvict;
@@ -658,6 +956,149 @@ class LRUCache {
   // How long to cache items that have an error Result
   const std::chrono::milliseconds errorTTL_;
   const std::chrono::milliseconds fetchTimeout_;
+  // The maximum total weight of the items, or 0 for no limit
+  const size_t maxBytes_{0};
+  const Weigher weigher_;
+  const CacheAdmission admission_{CacheAdmission::All};
+  // The number of items in the window of CacheAdmission::TinyLFU
+  const size_t windowMax_{1};
   folly::Synchronized<State> state_;
 };
+
+/**
+ * ShardedLRUCache spreads its items over a number of independent
+ * LRUCache shards, chosen by the hash of the key, so that lookups of
+ * different keys from many threads rarely contend on the same lock.
+ *
+ * It has the same API and semantics as LRUCache, including the
+ * thundering herd protection and negative caching of get() with a
+ * getter, except that eviction is LRU within each shard rather than
+ * across the whole cache: each shard holds up to maxItems / numShards
+ * items, and maxBytes / numShards bytes.  Likewise, each shard applies
+ * the admission policy to its own items.
+ */
+template <typename KeyType, typename ValueType>
+class ShardedLRUCache {
+ public:
+  using Shard = LRUCache<KeyType, ValueType>;
+  using NodeType = typename Shard::NodeType;
+  using Weigher = typename Shard::Weigher;
+
+  ShardedLRUCache(
+      size_t maxItems,
+      std::chrono::milliseconds errorTTL,
+      size_t numShards = 16,
+      size_t maxBytes = 0,
+      Weigher weigher = nullptr,
+      CacheAdmission admission = CacheAdmission::All,
+      std::chrono::milliseconds fetchTimeout = std::chrono::seconds(300)) {
+    // Small caches are not worth splitting, and would hold only a few items
+    // per shard.
+    numShards = std::max<size_t>(1, std::min(numShards, maxItems / 64));
+    size_t shardItems = (maxItems + numShards - 1) / numShards;
+    size_t shardBytes = (maxBytes + numShards - 1) / numShards;
+    shards_.reserve(numShards);
+    for (size_t i = 0; i < numShards; ++i) {
+      shards_.push_back(std::make_unique<Shard>(
+          shardItems, errorTTL, shardBytes, weigher, admission, fetchTimeout));
+    }
+  }
+
+  // No moving or copying
+  ShardedLRUCache(const ShardedLRUCache&) = delete;
+  ShardedLRUCache& operator=(const ShardedLRUCache&) = delete;
+  ShardedLRUCache(ShardedLRUCache&&) = delete;
+  ShardedLRUCache& operator=(ShardedLRUCache&&) = delete;
+
+  std::shared_ptr<const NodeType> get(
+      const KeyType& key,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).get(key, now);
+  }
+
+  template <typename Func>
+  folly::Future<std::shared_ptr<const NodeType>> get(
+      const KeyType& key,
+      Func&& getter,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).get(key, std::forward<Func>(getter), now);
+  }
+
+  std::shared_ptr<const NodeType> set(
+      const KeyType& key,
+      ValueType&& value,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).set(key, std::move(value), now);
+  }
+
+  std::shared_ptr<const NodeType> erase(const KeyType& key) {
+    return shardFor(key).erase(key);
+  }
+
+  size_t eraseExpired(
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    size_t erased = 0;
+    for (auto& shard : shards_) {
+      erased += shard->eraseExpired(now);
+    }
+    return erased;
+  }
+
+  // Returns the number of cached items
+  size_t size() const {
+    size_t size = 0;
+    for (auto& shard : shards_) {
+      size += shard->size();
+    }
+    return size;
+  }
+
+  // Returns the statistics of all of the shards added together
+  CacheStats stats() const {
+    lrucache::Stats total;
+    size_t size = 0;
+    size_t bytes = 0;
+    for (auto& shard : shards_) {
+      auto stats = shard->stats();
+      total.cacheHit += stats.cacheHit;
+      total.cacheShare += stats.cacheShare;
+      total.cacheMiss += stats.cacheMiss;
+      total.cacheEvict += stats.cacheEvict;
+      total.cacheStore += stats.cacheStore;
+      total.cacheLoad += stats.cacheLoad;
+      total.cacheErase += stats.cacheErase;
+      total.cacheReject += stats.cacheReject;
+      // The shards are always cleared together
+      total.clearCount = stats.clearCount;
+      size += stats.size;
+      bytes += stats.bytes;
+    }
+    return CacheStats(total, size, bytes);
+  }
+
+  // Purge all of the entries from the cache
+  void clear() {
+    for (auto& shard : shards_) {
+      shard->clear();
+    }
+  }
+
+  size_t numShards() const {
+    return shards_.size();
+  }
+
+ private:
+  Shard& shardFor(const KeyType& key) {
+    // The shards' maps use the same hash to pick a bucket, so mix it to
+    // avoid each shard only using some of its buckets.
+    auto hash = folly::hash::twang_mix64(std::hash<KeyType>{}(key));
+    return *shards_[hash % shards_.size()];
+  }
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
 } // namespace watchman
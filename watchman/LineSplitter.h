@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Splits a stream that is read in chunks, such as the output of a child
+ * process, into the lines that end with separator, and calls onLine with
+ * each as soon as it is complete. Lines are split the way that
+ * w_string_piece::split splits them.
+ *
+ * The lines that are contained in a chunk are passed on as pieces of it,
+ * without being copied, and are only valid for the duration of the call.
+ * Only a line that spans chunks is copied, while the rest of it arrives.
+ */
+template <typename OnLine>
+class LineSplitter {
+ public:
+  LineSplitter(char separator, OnLine onLine)
+      : separator_{separator}, onLine_{std::move(onLine)} {}
+
+  void feed(w_string_piece chunk) {
+    const char* begin = chunk.data();
+    const char* end = begin + chunk.size();
+    for (const char* it = begin; it != end; ++it) {
+      if (*it != separator_) {
+        continue;
+      }
+      if (partial_.empty()) {
+        onLine_(w_string_piece{begin, size_t(it - begin)});
+      } else {
+        partial_.append(begin, it - begin);
+        onLine_(w_string_piece{partial_.data(), partial_.size()});
+        partial_.clear();
+      }
+      begin = it + 1;
+    }
+    partial_.append(begin, end - begin);
+  }
+
+  /**
+   * Passes on the unterminated line at the end of the stream, if there is
+   * one.
+   */
+  void finish() {
+    if (!partial_.empty()) {
+      onLine_(w_string_piece{partial_.data(), partial_.size()});
+      partial_.clear();
+    }
+  }
+
+ private:
+  const char separator_;
+  OnLine onLine_;
+  std::string partial_;
+};
+
+} // namespace watchman
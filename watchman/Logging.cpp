@@ -16,9 +16,12 @@
 #include "watchman/portability/Backtrace.h"
 
 #include <array>
+#include <condition_variable>
 #include <limits>
+#include <mutex>
 #include <optional>
 #include <sstream>
+#include <thread>
 
 #ifdef __APPLE__
 #include <pthread.h>
@@ -29,6 +32,10 @@ using namespace watchman;
 static folly::ThreadLocal<std::optional<std::string>> threadName;
 
 namespace {
+// Log lines kept for a client that has stopped reading them; beyond this
+// the oldest are dropped.
+constexpr size_t kLogBacklogSize = 16384;
+
 template <typename String>
 void write_stderr(const String& str) {
   w_string_piece piece = str;
@@ -96,8 +103,8 @@ LogLevel logLabelToLevel(const w_string& label) {
 }
 
 Log::Log()
-    : errorPub_(std::make_shared<Publisher>()),
-      debugPub_(std::make_shared<Publisher>()) {
+    : errorPub_(std::make_shared<Publisher>(kLogBacklogSize)),
+      debugPub_(std::make_shared<Publisher>(kLogBacklogSize)) {
   setStdErrLoggingLevel(ERR);
 }
 
@@ -124,7 +131,24 @@ char* Log::timeString(char* buf, size_t bufsize, timeval tv) {
 char* Log::currentTimeString(char* buf, size_t bufsize) {
   struct timeval tv;
   gettimeofday(&tv, NULL);
-  return timeString(buf, bufsize, tv);
+
+  // localtime_r can take a process-wide lock, so each thread reuses the
+  // date and time of the second it last logged in.
+  thread_local time_t cachedSeconds = -1;
+  thread_local char cachedTime[64];
+  if (tv.tv_sec != cachedSeconds) {
+    struct tm tm;
+#ifdef _WIN32
+    time_t seconds = (time_t)tv.tv_sec;
+    tm = *localtime(&seconds);
+#else
+    localtime_r(&tv.tv_sec, &tm);
+#endif
+    strftime(cachedTime, sizeof(cachedTime), "%Y-%m-%dT%H:%M:%S", &tm);
+    cachedSeconds = tv.tv_sec;
+  }
+  snprintf(buf, bufsize, "%s,%03d", cachedTime, (int)tv.tv_usec / 1000);
+  return buf;
 }
 
 namespace {
@@ -159,8 +183,32 @@ const char* Log::getThreadName() {
   return threadName->value().c_str();
 }
 
+struct Log::StdErrWriter {
+  const size_t maxDebugLinesPerSecond;
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool pending{false};
+
+  explicit StdErrWriter(size_t maxDebugLinesPerSecond)
+      : maxDebugLinesPerSecond{maxDebugLinesPerSecond} {}
+
+  void wake() {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      pending = true;
+    }
+    cond.notify_one();
+  }
+};
+
 void Log::setStdErrLoggingLevel(LogLevel level) {
-  auto notify = [this]() { doLogToStdErr(); };
+  auto notify = [this]() {
+    if (auto* writer = stdErrWriter_.load(std::memory_order_acquire)) {
+      writer->wake();
+    } else {
+      doLogToStdErr();
+    }
+  };
   auto subs = subscribers_.lock();
   auto& debugSub = subs->debugSub_;
   auto& errorSub = subs->errorSub_;
@@ -186,38 +234,122 @@ void Log::setStdErrLoggingLevel(LogLevel level) {
   }
 }
 
-void Log::doLogToStdErr() {
-  std::vector<std::shared_ptr<const watchman::Publisher::Item>> items;
+void Log::startStdErrWriter(size_t maxDebugLinesPerSecond) {
+  if (stdErrWriter_.load(std::memory_order_acquire)) {
+    return;
+  }
+  auto* writer = new StdErrWriter{maxDebugLinesPerSecond};
+  std::thread{[this, writer] { runStdErrWriter(*writer); }}.detach();
+  stdErrWriter_.store(writer, std::memory_order_release);
+}
 
-  {
-    auto subs = subscribers_.lock();
-    getPending(items, subs->errorSub_, subs->debugSub_);
+void Log::stopStdErrWriter() {
+  if (auto* writer =
+          stdErrWriter_.exchange(nullptr, std::memory_order_acq_rel)) {
+    writePendingToStdErr(writer->maxDebugLinesPerSecond);
+    // Reports what was dropped.
+    writePendingToStdErr(0);
   }
+}
+
+void Log::runStdErrWriter(StdErrWriter& writer) {
+  w_set_thread_name("logwriter");
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{writer.mutex};
+      writer.cond.wait(lock, [&] { return writer.pending; });
+      writer.pending = false;
+    }
+    // Fatal errors are acted on by the threads that logged them.
+    writePendingToStdErr(writer.maxDebugLinesPerSecond);
+  }
+}
 
-  bool doFatal = false;
-  bool doAbort = false;
+LogLevel Log::writePendingToStdErr(size_t maxDebugLinesPerSecond) {
+  std::vector<std::shared_ptr<const watchman::Publisher::Item>> items;
   static w_string kFatal("fatal");
   static w_string kAbort("abort");
+  static w_string kDebug("debug");
+  LogLevel severest = OFF;
+
+  // Held while writing, so that lines from different threads don't mix.
+  auto subs = subscribers_.lock();
+  getPending(items, subs->errorSub_, subs->debugSub_);
+
+  std::string buffer;
+  auto reportDropped = [&] {
+    if (subs->droppedDebugLines == 0) {
+      return;
+    }
+    char timebuf[64];
+    buffer.append(fmt::format(
+        "{}: [{}] dropped {} debug log lines to stay within "
+        "debug_log_rate_limit\n",
+        currentTimeString(timebuf, sizeof(timebuf)),
+        getThreadName(),
+        subs->droppedDebugLines));
+    subs->droppedDebugLines = 0;
+  };
+
+  if (maxDebugLinesPerSecond) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - subs->debugWindowStart >= std::chrono::seconds(1)) {
+      subs->debugWindowStart = now;
+      subs->debugLines = 0;
+      reportDropped();
+    }
+  }
 
   for (auto& item : items) {
+    auto level = json_to_w_string(item->payload.get("level"));
+    if (level == kDebug && maxDebugLinesPerSecond &&
+        subs->debugLines++ >= maxDebugLinesPerSecond) {
+      ++subs->droppedDebugLines;
+      continue;
+    }
     auto& log = json_to_w_string(item->payload.get("log"));
-    ignore_result(::write(STDERR_FILENO, log.data(), log.size()));
+    buffer.append(log.data(), log.size());
 
-    auto level = json_to_w_string(item->payload.get("level"));
-    if (level == kFatal) {
-      doFatal = true;
-    } else if (level == kAbort) {
-      doAbort = true;
+    if (level == kAbort) {
+      severest = ABORT;
+    } else if (level == kFatal && severest != ABORT) {
+      severest = FATAL;
     }
   }
+  if (!maxDebugLinesPerSecond) {
+    reportDropped();
+  }
 
-  if (doFatal || doAbort) {
-    log_stack_trace();
-    if (doAbort) {
-      abort();
-    } else {
-      _exit(1);
-    }
+  if (!buffer.empty()) {
+    ignore_result(::write(STDERR_FILENO, buffer.data(), buffer.size()));
+  }
+  return severest;
+}
+
+void Log::doLogToStdErr() {
+  auto severest = writePendingToStdErr(0);
+  if (severest <= FATAL) {
+    die(severest);
+  }
+}
+
+void Log::flushBeforeDying(LogLevel level) {
+  // Otherwise doLogToStdErr has already acted on it.
+  if (!stdErrWriter_.load(std::memory_order_acquire)) {
+    return;
+  }
+  writePendingToStdErr(0);
+  if (subscribers_.lock()->errorSub_) {
+    die(level);
+  }
+}
+
+void Log::die(LogLevel level) {
+  log_stack_trace();
+  if (level == ABORT) {
+    abort();
+  } else {
+    _exit(1);
   }
 }
 
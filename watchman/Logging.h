@@ -6,6 +6,8 @@
  */
 
 #pragma once
+#include <atomic>
+#include <chrono>
 #include "folly/Synchronized.h"
 #include "watchman/PubSub.h"
 #include "watchman/watchman_preprocessor.h"
@@ -33,6 +35,23 @@ class Log {
 
   void setStdErrLoggingLevel(LogLevel level);
 
+  /**
+   * From now on, stderr is written by a background thread rather than by the
+   * threads that log, so that they don't wait on it. If maxDebugLinesPerSecond
+   * is non-zero, the debug lines beyond that many each second are dropped
+   * from stderr, and the number dropped is logged instead. Fatal errors are
+   * still written before the thread that logged them dies.
+   *
+   * This must be called after any fork, as the thread is not inherited.
+   */
+  void startStdErrWriter(size_t maxDebugLinesPerSecond);
+
+  /**
+   * Writes whatever is pending and goes back to writing stderr on the
+   * threads that log.
+   */
+  void stopStdErrWriter();
+
   // Build a string and log it
   template <typename... Args>
   void log(LogLevel level, Args&&... args) {
@@ -57,6 +76,9 @@ class Log {
          {"level", typed_string_to_json(logLevelToLabel(level))}});
 
     pub.enqueue(std::move(payload));
+    if (level <= FATAL) {
+      flushBeforeDying(level);
+    }
   }
 
   // Format a string and log it
@@ -85,6 +107,9 @@ class Log {
          {"level", typed_string_to_json(logLevelToLabel(level))}});
 
     pub.enqueue(std::move(payload));
+    if (level <= FATAL) {
+      flushBeforeDying(level);
+    }
   }
 
   Log();
@@ -96,6 +121,12 @@ class Log {
   struct Subscribers {
     std::shared_ptr<Publisher::Subscriber> errorSub_;
     std::shared_ptr<Publisher::Subscriber> debugSub_;
+
+    // The debug lines written to stderr in the current second, and those
+    // dropped since the last were reported.
+    std::chrono::steady_clock::time_point debugWindowStart;
+    size_t debugLines{0};
+    size_t droppedDebugLines{0};
   };
   // The lock on the subscribers exists for 2 reasons:
   // 1. The standard reason: preventing multiple threads from clobbering over
@@ -110,7 +141,18 @@ class Log {
     return level == DBG ? *debugPub_ : *errorPub_;
   }
 
+  struct StdErrWriter;
+  // Set while the background thread writes stderr. It is never freed, as
+  // the thread lives until the process exits.
+  std::atomic<StdErrWriter*> stdErrWriter_{nullptr};
+
   void doLogToStdErr();
+  // Returns the most severe level of the items written, which is only
+  // acted on by the caller.
+  LogLevel writePendingToStdErr(size_t maxDebugLinesPerSecond);
+  void runStdErrWriter(StdErrWriter& writer);
+  void flushBeforeDying(LogLevel level);
+  [[noreturn]] void die(LogLevel level);
 };
 
 // Get the logger singleton
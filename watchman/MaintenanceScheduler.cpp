@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MaintenanceScheduler.h"
+#include <algorithm>
+#include <iterator>
+#include "watchman/Logging.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+MaintenanceScheduler::MaintenanceScheduler(Options options)
+    : options_{std::move(options)} {
+  w_check(options_.maxConcurrent > 0, "maxConcurrent must be at least 1");
+}
+
+MaintenanceScheduler::~MaintenanceScheduler() {
+  stop();
+}
+
+bool MaintenanceScheduler::isIdle(
+    Clock::time_point since,
+    Clock::time_point now) const {
+  auto seconds =
+      std::max(std::chrono::duration<double>(now - since).count(), 1.0);
+  auto queryRate = queries_.load(std::memory_order_relaxed) / seconds;
+  auto eventRate = events_.load(std::memory_order_relaxed) / seconds;
+  return queryRate <= options_.idleQueriesPerSecond &&
+      eventRate <= options_.idleEventsPerSecond;
+}
+
+void MaintenanceScheduler::start(
+    folly::Executor& executor,
+    std::function<std::vector<Task>()> listTasks) {
+  if (!enabled()) {
+    return;
+  }
+  executor_ = &executor;
+  listTasks_ = std::move(listTasks);
+  thread_ = std::thread([this] { run(); });
+}
+
+void MaintenanceScheduler::stop() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stopping_ = true;
+  }
+  cond_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  std::unique_lock<std::mutex> lock{mutex_};
+  cond_.wait(lock, [&] { return running_ == 0; });
+}
+
+void MaintenanceScheduler::run() {
+  w_set_thread_name("maintenance");
+
+  auto since = Clock::now();
+  auto lastPass = since;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      if (cond_.wait_for(lock, options_.interval, [&] { return stopping_; })) {
+        return;
+      }
+    }
+
+    auto now = Clock::now();
+    bool overdue = now - lastPass >= options_.maxDeferral;
+    if (overdue || isIdle(since, now)) {
+      if (pending_.empty()) {
+        auto tasks = listTasks_();
+        std::move(tasks.begin(), tasks.end(), std::back_inserter(pending_));
+      }
+      if (runPending(since, overdue)) {
+        lastPass = Clock::now();
+        passes_.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        deferrals_.fetch_add(1, std::memory_order_relaxed);
+      }
+    } else {
+      deferrals_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    since = Clock::now();
+    queries_.store(0, std::memory_order_relaxed);
+    events_.store(0, std::memory_order_relaxed);
+  }
+}
+
+bool MaintenanceScheduler::runPending(Clock::time_point since, bool overdue) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  while (!pending_.empty()) {
+    cond_.wait(lock, [&] {
+      return stopping_ || running_ < options_.maxConcurrent;
+    });
+    if (stopping_) {
+      return false;
+    }
+    if (!overdue && !isIdle(since, Clock::now())) {
+      // Leave the rest until it is quiet again
+      return false;
+    }
+
+    auto task = std::move(pending_.front());
+    pending_.pop_front();
+    ++running_;
+    lock.unlock();
+    try {
+      executor_->addWithPriority(
+          [this, task = std::move(task)]() mutable {
+            try {
+              task();
+            } catch (const std::exception& exc) {
+              logf(ERR, "maintenance task failed: {}\n", exc.what());
+            }
+            finished();
+          },
+          ThreadPool::kBackground);
+    } catch (const std::exception& exc) {
+      logf(ERR, "unable to schedule maintenance: {}\n", exc.what());
+      lock.lock();
+      --running_;
+      return false;
+    }
+    lock.lock();
+  }
+
+  // The pass is only over once every root has been maintained, so that a
+  // root's next task never runs alongside its previous one.
+  cond_.wait(lock, [&] { return running_ == 0; });
+  return true;
+}
+
+void MaintenanceScheduler::finished() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    --running_;
+  }
+  cond_.notify_all();
+}
+
+MaintenanceScheduler& getMaintenanceScheduler() {
+  static auto* scheduler = [] {
+    MaintenanceScheduler::Options options;
+    options.interval = std::chrono::milliseconds(
+        std::max<json_int_t>(0, cfg_get_int("maintenance_interval_ms", 0)));
+    options.idleQueriesPerSecond =
+        cfg_get_double("maintenance_idle_queries_per_second", 1);
+    options.idleEventsPerSecond =
+        cfg_get_double("maintenance_idle_events_per_second", 100);
+    options.maxConcurrent = size_t(
+        std::max<json_int_t>(1, cfg_get_int("maintenance_concurrency", 2)));
+    options.maxDeferral = std::chrono::milliseconds(
+        cfg_get_int("maintenance_max_deferral_ms", 3600 * 1000));
+    return new MaintenanceScheduler(std::move(options));
+  }();
+  return *scheduler;
+}
+
+} // namespace watchman
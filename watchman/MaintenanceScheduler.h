@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Executor.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Runs the upkeep of every root, such as aging out deleted files, trimming
+ * caches and deciding whether to reap it, together and while the daemon is
+ * idle, rather than on each root's own timers, where it lands at
+ * unpredictable times and on top of whatever clients are doing.
+ *
+ * Every interval, the scheduler looks at the rates of the queries and of
+ * the filesystem events that were noted since it last looked. While both
+ * are within their idle limits, it works through the tasks that listTasks
+ * returns, one for each root, in the background of the executor and at
+ * most maxConcurrent at a time. If traffic picks up, it stops handing out
+ * tasks and carries on with the rest in the next idle period. Once
+ * maxDeferral has passed since it last got through them all, it works
+ * through them regardless, so that a daemon that is never idle still
+ * maintains its roots.
+ */
+class MaintenanceScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Task = folly::Func;
+
+  struct Options {
+    // 0 disables the scheduler, and each root maintains itself.
+    std::chrono::milliseconds interval{0};
+    double idleQueriesPerSecond{1};
+    double idleEventsPerSecond{100};
+    size_t maxConcurrent{2};
+    std::chrono::milliseconds maxDeferral{std::chrono::hours(1)};
+  };
+
+  explicit MaintenanceScheduler(Options options);
+  ~MaintenanceScheduler();
+
+  MaintenanceScheduler(const MaintenanceScheduler&) = delete;
+  MaintenanceScheduler& operator=(const MaintenanceScheduler&) = delete;
+
+  bool enabled() const {
+    return options_.interval.count() > 0;
+  }
+
+  void noteQuery() {
+    queries_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void noteEvents(size_t count) {
+    events_.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  /**
+   * Returns true if the traffic that was noted since the scheduler last
+   * looked, at since, is within the idle limits at now. Less than a second
+   * is treated as a second, so that a burst just after it looked counts.
+   */
+  bool isIdle(Clock::time_point since, Clock::time_point now) const;
+
+  /**
+   * Starts the thread that looks at the traffic and hands out the tasks.
+   * Does nothing if the scheduler is disabled.
+   */
+  void start(
+      folly::Executor& executor,
+      std::function<std::vector<Task>()> listTasks);
+
+  /**
+   * Stops the thread, and waits for the tasks that it handed out.
+   */
+  void stop();
+
+  /** How many times it has got through the tasks of every root. */
+  size_t passes() const {
+    return passes_.load(std::memory_order_relaxed);
+  }
+
+  /** How many times it put the tasks off because of traffic. */
+  size_t deferrals() const {
+    return deferrals_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void run();
+  // Hands out the pending tasks until they are all done, or until traffic
+  // picks up and overdue is false. Returns true if they were all done.
+  bool runPending(Clock::time_point since, bool overdue);
+  void finished();
+
+  const Options options_;
+  folly::Executor* executor_{nullptr};
+  std::function<std::vector<Task>()> listTasks_;
+  std::thread thread_;
+
+  std::atomic<size_t> queries_{0};
+  std::atomic<size_t> events_{0};
+  std::atomic<size_t> passes_{0};
+  std::atomic<size_t> deferrals_{0};
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stopping_{false};
+  size_t running_{0};
+  // Only used by the thread
+  std::deque<Task> pending_;
+};
+
+MaintenanceScheduler& getMaintenanceScheduler();
+
+} // namespace watchman
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Metrics.h"
+#include <fmt/core.h>
+#include <folly/Synchronized.h>
+#include <folly/lang/Bits.h>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace watchman {
+
+namespace {
+
+struct Metric {
+  std::string help;
+  std::unique_ptr<Counter> counter;
+  std::unique_ptr<Histogram> histogram;
+};
+
+// Ordered, so that the output is too.
+folly::Synchronized<std::map<std::string, Metric, std::less<>>>& getMetrics() {
+  static auto* metrics =
+      new folly::Synchronized<std::map<std::string, Metric, std::less<>>>;
+  return *metrics;
+}
+
+// The map's nodes, and so the metrics, never move.
+template <typename T>
+T& getMetric(
+    std::string_view name,
+    std::string_view help,
+    std::unique_ptr<T> Metric::*kind) {
+  auto metrics = getMetrics().wlock();
+  auto it = metrics->find(name);
+  if (it == metrics->end()) {
+    it = metrics->emplace(std::string{name}, Metric{std::string{help}}).first;
+  }
+  auto& metric = it->second;
+  if (!(metric.*kind)) {
+    if (metric.counter || metric.histogram) {
+      throw std::logic_error(
+          fmt::format("{} is already a metric of another kind", name));
+    }
+    metric.*kind = std::make_unique<T>();
+  }
+  return *(metric.*kind);
+}
+
+} // namespace
+
+void Histogram::record(uint64_t value) {
+  // The index of the smallest power of two that is at least value
+  size_t bucket = value <= 1 ? 0 : folly::findLastSet(value - 1);
+  if (bucket >= kNumBuckets) {
+    bucket = kNumBuckets - 1;
+  }
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+  Snapshot snapshot;
+  snapshot.count = count_.load(std::memory_order_relaxed);
+  snapshot.sum = sum_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+Counter& getCounter(std::string_view name, std::string_view help) {
+  return getMetric(name, help, &Metric::counter);
+}
+
+Histogram& getHistogram(std::string_view name, std::string_view help) {
+  return getMetric(name, help, &Metric::histogram);
+}
+
+json_ref metricsToJson() {
+  auto counters = json_object();
+  auto histograms = json_object();
+  auto metrics = getMetrics().rlock();
+  for (auto& [name, metric] : *metrics) {
+    if (metric.counter) {
+      counters.set(name.c_str(), json_integer(metric.counter->value()));
+    } else if (metric.histogram) {
+      auto snapshot = metric.histogram->snapshot();
+      std::vector<json_ref> buckets;
+      for (size_t i = 0; i < Histogram::kNumBuckets; ++i) {
+        if (snapshot.buckets[i] == 0) {
+          continue;
+        }
+        buckets.push_back(json_array(
+            {i + 1 < Histogram::kNumBuckets
+                 ? json_integer(Histogram::bucketBound(i))
+                 : typed_string_to_json("+Inf"),
+             json_integer(snapshot.buckets[i])}));
+      }
+      histograms.set(
+          name.c_str(),
+          json_object(
+              {{"count", json_integer(snapshot.count)},
+               {"sum", json_integer(snapshot.sum)},
+               {"buckets", json_array(std::move(buckets))}}));
+    }
+  }
+  return json_object(
+      {{"counters", std::move(counters)},
+       {"histograms", std::move(histograms)}});
+}
+
+std::string metricsToOpenMetrics() {
+  std::string out;
+  auto metrics = getMetrics().rlock();
+  for (auto& [name, metric] : *metrics) {
+    if (metric.counter) {
+      // OpenMetrics names the counter without the _total that its sample
+      // carries.
+      std::string_view family{name};
+      if (family.size() > 6 &&
+          family.substr(family.size() - 6) == std::string_view{"_total"}) {
+        family.remove_suffix(6);
+      }
+      out += fmt::format("# TYPE {} counter\n", family);
+      out += fmt::format("# HELP {} {}\n", family, metric.help);
+      out += fmt::format("{}_total {}\n", family, metric.counter->value());
+    } else if (metric.histogram) {
+      auto snapshot = metric.histogram->snapshot();
+      out += fmt::format("# TYPE {} histogram\n", name);
+      out += fmt::format("# HELP {} {}\n", name, metric.help);
+      // The buckets are cumulative here.
+      uint64_t cumulative = 0;
+      for (size_t i = 0; i + 1 < Histogram::kNumBuckets; ++i) {
+        cumulative += snapshot.buckets[i];
+        out += fmt::format(
+            "{}_bucket{{le=\"{}\"}} {}\n",
+            name,
+            Histogram::bucketBound(i),
+            cumulative);
+      }
+      // The count was read apart from the buckets, so it may not agree.
+      cumulative += snapshot.buckets.back();
+      out += fmt::format("{}_bucket{{le=\"+Inf\"}} {}\n", name, cumulative);
+      out += fmt::format("{}_count {}\n", name, cumulative);
+      out += fmt::format("{}_sum {}\n", name, snapshot.sum);
+    }
+  }
+  out += "# EOF\n";
+  return out;
+}
+
+} // namespace watchman
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+// Process-wide counters and histograms of what the hot paths do, for the
+// debug-metrics command. Updating one is a few relaxed atomic increments.
+//
+// Metrics are created by name the first time they are asked for, which
+// takes a lock, so hot paths keep the reference in a static:
+//
+//   static auto& stats = getCounter("watchman_stat_path_total", "...");
+//   stats.add();
+
+class Counter {
+ public:
+  void add(uint64_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+// Counts values in buckets whose upper bounds are the powers of two from 1
+// to 2^31, plus one for anything larger.
+class Histogram {
+ public:
+  static constexpr size_t kNumBuckets = 33;
+
+  struct Snapshot {
+    uint64_t count{0};
+    uint64_t sum{0};
+    // Not cumulative: each counts the values that are greater than the
+    // previous bucket's bound and no greater than its own.
+    std::array<uint64_t, kNumBuckets> buckets{};
+  };
+
+  void record(uint64_t value);
+
+  template <typename Rep, typename Period>
+  void recordMicros(std::chrono::duration<Rep, Period> duration) {
+    auto micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(duration);
+    record(micros.count() > 0 ? uint64_t(micros.count()) : 0);
+  }
+
+  // The upper bound of bucket i; the last has none.
+  static uint64_t bucketBound(size_t i) {
+    return uint64_t(1) << i;
+  }
+
+  Snapshot snapshot() const;
+
+ private:
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::array<std::atomic<uint64_t>, kNumBuckets> buckets_{};
+};
+
+/**
+ * Return the metric with this name, creating it with the description help if
+ * it doesn't exist yet. Names follow the OpenMetrics conventions, such as
+ * watchman_query_render_ms. Throws if name is already a metric of the other
+ * kind.
+ */
+Counter& getCounter(std::string_view name, std::string_view help);
+Histogram& getHistogram(std::string_view name, std::string_view help);
+
+// {"counters": {name: value}, "histograms": {name: {"count", "sum",
+// "buckets"}}}, where the buckets are [upper bound, count] pairs, and only
+// those with values in them are listed.
+json_ref metricsToJson();
+
+// The metrics in the OpenMetrics text format.
+std::string metricsToOpenMetrics();
+
+} // namespace watchman
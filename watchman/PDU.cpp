@@ -7,9 +7,15 @@
 
 #include "watchman/PDU.h"
 #include <folly/Range.h>
+#include <folly/ScopeGuard.h>
 #include <folly/String.h>
+#include <folly/stop_watch.h>
+#include <algorithm>
+#include <limits>
+#include <string>
 #include "watchman/Constants.h"
 #include "watchman/Logging.h"
+#include "watchman/Metrics.h"
 #include "watchman/bser.h"
 #include "watchman/portability/WinError.h"
 #include "watchman/watchman_stream.h"
@@ -46,29 +52,61 @@ uint32_t PduBuffer::shuntDown() {
   return allocd - wpos;
 }
 
-bool PduBuffer::fillBuffer(watchman_stream* stm) {
-  uint32_t avail = shuntDown();
+bool PduBuffer::reserve(uint64_t size) {
+  if (allocd - rpos >= size) {
+    return true;
+  }
+  if (allocd >= size) {
+    shuntDown();
+    return true;
+  }
+  if (size > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
 
-  // Get some more space if we need it
-  if (avail == 0) {
-    char* newBuf = (char*)realloc(buf, allocd * 2);
-    if (!newBuf) {
-      return false;
-    }
+  uint64_t ideal = allocd;
+  while (ideal < size) {
+    ideal *= 2;
+  }
+  ideal = std::min<uint64_t>(ideal, std::numeric_limits<uint32_t>::max());
 
-    buf = newBuf;
-    allocd *= 2;
+  // Rather than realloc, which would copy the whole of the old buffer, copy
+  // only the data that is yet to be read, to the front of the new one.
+  auto newBuf = (char*)malloc(ideal);
+  if (!newBuf) {
+    return false;
+  }
+  memcpy(newBuf, buf + rpos, wpos - rpos);
+  free(buf);
+  buf = newBuf;
+  allocd = uint32_t(ideal);
+  wpos -= rpos;
+  rpos = 0;
+  return true;
+}
+
+bool PduBuffer::fillBuffer(watchman_stream* stm) {
+  if (rpos == wpos) {
+    clear();
+  } else if (allocd - wpos < allocd / 4) {
+    // Only move the unread data down once the room after it runs low, rather
+    // than on every read.
+    shuntDown();
+  }
 
-    avail = allocd - wpos;
+  // Get some more space if we need it
+  if (wpos == allocd && !reserve(uint64_t(allocd) * 2)) {
+    return false;
   }
 
   errno = 0;
-  int r = stm->read(buf + wpos, avail);
+  int r = stm->read(buf + wpos, allocd - wpos);
   if (r <= 0) {
     return false;
   }
 
   wpos += r;
+  bytesRead += r;
 
   return true;
 }
@@ -118,6 +156,9 @@ std::optional<json_ref> PduBuffer::readJsonPdu(
   /* look for a newline; that indicates the end of
    * a json packet */
   auto nl = (char*)memchr(buf + rpos, '\n', wpos - rpos);
+  // How much of the unread data has no newline, so that a large PDU is
+  // only scanned once as it arrives.
+  uint32_t scanned = wpos - rpos;
 
   // If we don't have a newline, we need to fill the
   // buffer
@@ -132,7 +173,8 @@ std::optional<json_ref> PduBuffer::readJsonPdu(
       }
       return std::nullopt;
     }
-    nl = (char*)memchr(buf + rpos, '\n', wpos - rpos);
+    nl = (char*)memchr(buf + rpos + scanned, '\n', wpos - rpos - scanned);
+    scanned = wpos - rpos;
   }
 
   // buflen
@@ -188,8 +230,8 @@ std::optional<json_ref> PduBuffer::readBserPdu(
     json_error_t* jerr) {
   json_int_t needed;
   json_int_t val;
-  json_int_t bser_capabilities;
-  uint32_t ideal;
+  // Only BSER v2 sends capabilities
+  json_int_t bser_capabilities = 0;
   int r;
 
   rpos += 2;
@@ -200,32 +242,24 @@ std::optional<json_ref> PduBuffer::readBserPdu(
     return std::nullopt;
   }
 
-  // val tells us exactly how much storage we need for this PDU
-  if (val > allocd - wpos) {
-    ideal = allocd;
-    while ((ideal - wpos) < (uint32_t)val) {
-      ideal *= 2;
-    }
-    if (ideal > allocd) {
-      auto newBuf = (char*)realloc(buf, ideal);
-
-      if (!newBuf) {
-        snprintf(
-            jerr->text,
-            sizeof(jerr->text),
-            "out of memory while allocating %" PRIu32 " bytes",
-            ideal);
-        return std::nullopt;
-      }
+  if (val < 0) {
+    snprintf(jerr->text, sizeof(jerr->text), "invalid PDU size");
+    return std::nullopt;
+  }
 
-      buf = newBuf;
-      allocd = ideal;
-    }
+  // val tells us exactly how much storage we need for this PDU
+  if (!reserve(uint64_t(val))) {
+    snprintf(
+        jerr->text,
+        sizeof(jerr->text),
+        "out of memory while allocating %" PRIi64 " bytes",
+        int64_t(val));
+    return std::nullopt;
   }
 
   // We have enough room for the whole thing, let's read it in
   while ((wpos - rpos) < val) {
-    r = stm->read(buf + wpos, allocd - wpos);
+    r = stm->read(buf + wpos, uint32_t(val - (wpos - rpos)));
     if (r <= 0) {
       jerr->position = wpos - rpos;
       snprintf(
@@ -233,7 +267,7 @@ std::optional<json_ref> PduBuffer::readBserPdu(
           sizeof(jerr->text),
           "error reading %" PRIu32 " bytes val=%" PRIu64 " wpos=%" PRIu32
           " rpos=%" PRIu32 " for PDU: %s",
-          uint32_t(allocd - wpos),
+          uint32_t(val - (wpos - rpos)),
           int64_t(val),
           wpos,
           rpos,
@@ -241,9 +275,18 @@ std::optional<json_ref> PduBuffer::readBserPdu(
       return std::nullopt;
     }
     wpos += r;
+    bytesRead += r;
   }
 
-  std::optional<json_ref> obj = bunser(buf + rpos, buf + wpos, &needed, jerr);
+  std::optional<json_ref> obj;
+  if (bser_capabilities & BSER_CAP_ZSTD) {
+    std::string value;
+    if (bunser_uncompress(buf + rpos, buf + rpos + val, value, jerr)) {
+      obj = bunser(value.data(), value.data() + value.size(), &needed, jerr);
+    }
+  } else {
+    obj = bunser(buf + rpos, buf + wpos, &needed, jerr);
+  }
   if (!obj) {
     // obj is a nullptr because deserialization failed. Log the message that
     // failed to deserialize to stderr
@@ -417,6 +460,7 @@ bool PduBuffer::streamN(
       return false;
     }
     wpos += r;
+    bytesRead += r;
     total += r;
   }
   return true;
@@ -489,6 +533,7 @@ struct jbuffer_write_data {
       }
 
       jr->rpos += x;
+      jr->bytesWritten += x;
     }
 
     jr->clear();
@@ -535,7 +580,8 @@ ResultErrno<folly::Unit> PduBuffer::bserEncodeToStream(
     uint32_t bser_version,
     uint32_t bser_capabilities,
     const json_ref& json,
-    watchman_stream* stm) {
+    watchman_stream* stm,
+    bool flush) {
   jbuffer_write_data data = {stm, this};
 
   int res = w_bser_write_pdu(
@@ -545,7 +591,7 @@ ResultErrno<folly::Unit> PduBuffer::bserEncodeToStream(
     return errno;
   }
 
-  if (!data.flush()) {
+  if (flush && !data.flush()) {
     return errno;
   }
 
@@ -555,7 +601,8 @@ ResultErrno<folly::Unit> PduBuffer::bserEncodeToStream(
 ResultErrno<folly::Unit> PduBuffer::jsonEncodeToStream(
     const json_ref& json,
     watchman_stream* stm,
-    int flags) {
+    int flags,
+    bool flush) {
   jbuffer_write_data data = {stm, this};
 
   int res = json_dump_callback(json, jbuffer_write_data::write, &data, flags);
@@ -567,7 +614,7 @@ ResultErrno<folly::Unit> PduBuffer::jsonEncodeToStream(
     return errno;
   }
 
-  if (!data.flush()) {
+  if (flush && !data.flush()) {
     return errno;
   }
 
@@ -577,22 +624,38 @@ ResultErrno<folly::Unit> PduBuffer::jsonEncodeToStream(
 ResultErrno<folly::Unit> PduBuffer::pduEncodeToStream(
     PduFormat format,
     const json_ref& json,
-    watchman_stream* stm) {
+    watchman_stream* stm,
+    bool flush) {
+  static auto& encodeTime = getHistogram(
+      "watchman_pdu_encode_us", "Time taken to encode and send a PDU");
+
+  folly::stop_watch<std::chrono::microseconds> stopWatch;
+  SCOPE_EXIT {
+    encodeTime.recordMicros(stopWatch.elapsed());
+  };
   switch (format.type) {
     case is_json_compact:
-      return jsonEncodeToStream(json, stm, JSON_COMPACT);
+      return jsonEncodeToStream(json, stm, JSON_COMPACT, flush);
     case is_json_pretty:
-      return jsonEncodeToStream(json, stm, JSON_INDENT(4));
+      return jsonEncodeToStream(json, stm, JSON_INDENT(4), flush);
     case is_bser:
-      return bserEncodeToStream(1, format.capabilities, json, stm);
+      return bserEncodeToStream(1, format.capabilities, json, stm, flush);
     case is_bser_v2:
-      return bserEncodeToStream(2, format.capabilities, json, stm);
+      return bserEncodeToStream(2, format.capabilities, json, stm, flush);
     case need_data:
     default:
       return EINVAL;
   }
 }
 
+ResultErrno<folly::Unit> PduBuffer::flushToStream(watchman_stream* stm) {
+  jbuffer_write_data data = {stm, this};
+  if (!data.flush()) {
+    return errno;
+  }
+  return folly::unit;
+}
+
 /* vim:ts=2:sw=2:et:
  */
 
@@ -41,6 +41,10 @@ class PduBuffer {
   uint32_t rpos = 0;
   uint32_t wpos = 0;
 
+  /// The bytes read from and written to streams through this buffer
+  uint64_t bytesRead = 0;
+  uint64_t bytesWritten = 0;
+
   /// The encoding format detected by decodeNext
   PduFormat format;
 
@@ -52,16 +56,33 @@ class PduBuffer {
   ~PduBuffer();
 
   void clear();
-  ResultErrno<folly::Unit>
-  jsonEncodeToStream(const json_ref& json, Stream* stm, int flags);
+
+  /**
+   * The encode functions write the encoded json to stm. If flush is false,
+   * they only write what does not fit in the buffer, and leave the rest to a
+   * later encode or flushToStream(), so that several small PDUs can be sent
+   * with one write.
+   */
+  ResultErrno<folly::Unit> jsonEncodeToStream(
+      const json_ref& json,
+      Stream* stm,
+      int flags,
+      bool flush = true);
   ResultErrno<folly::Unit> bserEncodeToStream(
       uint32_t bser_version,
       uint32_t bser_capabilities,
       const json_ref& json,
-      Stream* stm);
+      Stream* stm,
+      bool flush = true);
+
+  ResultErrno<folly::Unit> pduEncodeToStream(
+      PduFormat format,
+      const json_ref& json,
+      Stream* stm,
+      bool flush = true);
 
-  ResultErrno<folly::Unit>
-  pduEncodeToStream(PduFormat format, const json_ref& json, Stream* stm);
+  /// Writes anything that the encode functions left in the buffer.
+  ResultErrno<folly::Unit> flushToStream(Stream* stm);
 
   std::optional<json_ref> decodeNext(Stream* stm, json_error_t* jerr);
 
@@ -71,6 +92,12 @@ class PduBuffer {
 
  private:
   uint32_t shuntDown();
+  /**
+   * Makes room for size bytes from rpos, moving the unread data to the
+   * front of the buffer or into a larger one if needed. Returns false if
+   * the memory cannot be allocated.
+   */
+  bool reserve(uint64_t size);
   bool fillBuffer(Stream* stm);
   PduType detectPdu();
   std::optional<json_ref> readJsonPrettyPdu(Stream* stm, json_error_t* jerr);
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PathComponentTable.h"
+
+namespace watchman {
+
+w_string PathComponentTable::intern(w_string_piece component) {
+  auto it = table_.find(component);
+  if (it != table_.end()) {
+    return it->second;
+  }
+
+  w_string str{component.data(), component.size()};
+  table_.emplace(str.piece(), str);
+  return str;
+}
+
+size_t PathComponentTable::prune() {
+  size_t removed = 0;
+  for (auto it = table_.begin(); it != table_.end();) {
+    w_string_t* str = it->second;
+    if (str->refcnt.load(std::memory_order_acquire) == 1) {
+      it = table_.erase(it);
+      ++removed;
+    } else {
+      ++it;
+    }
+  }
+  return removed;
+}
+
+size_t PathComponentTable::getBytesUsed() const {
+  size_t bytes = table_.bucket_count() * sizeof(void*);
+  for (auto& entry : table_) {
+    // Node: the entry itself, plus the next pointer and cached hash.
+    bytes += sizeof(entry) + 2 * sizeof(void*);
+    bytes += sizeof(w_string_t) + entry.first.size() + 1;
+  }
+  return bytes;
+}
+
+} // namespace watchman
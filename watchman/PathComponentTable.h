@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * An interning table for path components.
+ *
+ * Directory names repeat heavily across large trees (`src`, `test`,
+ * `node_modules`, ...). Routing them through this table means that every
+ * watchman_dir with the same name shares one refcounted w_string, and that
+ * comparisons between two interned names are satisfied by the pointer
+ * equality check in w_string_piece::operator== without touching the bytes.
+ *
+ * Entries that are no longer referenced outside of the table are released by
+ * prune().
+ *
+ * PathComponentTable is not thread safe: the owner must provide
+ * synchronization.
+ */
+class PathComponentTable {
+ public:
+  /**
+   * Returns the canonical w_string for component, adding it to the table if
+   * it is not already present.
+   */
+  w_string intern(w_string_piece component);
+
+  /**
+   * Removes entries that are referenced only by the table itself.
+   * Returns the number of entries that were removed.
+   */
+  size_t prune();
+
+  size_t size() const {
+    return table_.size();
+  }
+
+  /**
+   * Approximate number of bytes used by the interned strings and the table.
+   */
+  size_t getBytesUsed() const;
+
+ private:
+  // Keys point into the storage of the corresponding value.
+  std::unordered_map<w_string_piece, w_string> table_;
+};
+
+} // namespace watchman
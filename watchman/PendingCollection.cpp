@@ -21,6 +21,8 @@ const PendingFlags::NameTable PendingFlags::table = {
     {W_PENDING_NONRECURSIVE_SCAN, "NONRECURSIVE_SCAN"},
     {W_PENDING_VIA_NOTIFY, "VIA_NOTIFY"},
     {W_PENDING_IS_DESYNCED, "IS_DESYNCED"},
+    {W_PENDING_DIR_UNCHANGED, "DIR_UNCHANGED"},
+    {W_PENDING_MOVED, "MOVED"},
 };
 
 bool is_path_prefix(
@@ -51,8 +53,188 @@ bool is_path_prefix(
 
 } // namespace watchman
 
+namespace {
+
+// Yields the slash-separated components of a path in turn.
+class PathComponents {
+ public:
+  explicit PathComponents(w_string_piece path)
+      : pos_(path.data()), end_(path.data() + path.size()) {
+    if (path.empty()) {
+      pos_ = nullptr;
+    }
+  }
+
+  // Stores the next component and returns true, or returns false once the
+  // path is exhausted.
+  bool next(w_string_piece& component) {
+    if (!pos_) {
+      return false;
+    }
+    auto start = pos_;
+    while (pos_ < end_ && !is_slash(*pos_)) {
+      ++pos_;
+    }
+    component = w_string_piece(start, pos_ - start);
+    if (pos_ < end_) {
+      ++pos_;
+    } else {
+      pos_ = nullptr;
+    }
+    return true;
+  }
+
+ private:
+  const char* pos_;
+  const char* end_;
+};
+
+} // namespace
+
+void PendingPathTrie::NodeDeleter::operator()(Node* node) const noexcept {
+  node->~Node();
+  PoolAllocator<Node>().deallocate(node, 1);
+}
+
+PendingPathTrie::NodePtr PendingPathTrie::newNode() {
+  PoolAllocator<Node> allocator;
+  auto mem = allocator.allocate(1);
+  try {
+    return NodePtr{new (mem) Node()};
+  } catch (...) {
+    allocator.deallocate(mem, 1);
+    throw;
+  }
+}
+
+PendingPathTrie::Node* PendingPathTrie::findNode(w_string_piece path) {
+  Node* node = &root_;
+  PathComponents components{path};
+  w_string_piece component;
+  while (components.next(component)) {
+    auto it = node->children.find(component);
+    if (it == node->children.end()) {
+      return nullptr;
+    }
+    node = it->second.get();
+  }
+  return node;
+}
+
+PendingPathTrie::Item* PendingPathTrie::find(w_string_piece path) {
+  auto node = findNode(path);
+  if (!node || !node->item) {
+    return nullptr;
+  }
+  return &node->item;
+}
+
+void PendingPathTrie::insert(const w_string& path, Item item) {
+  Node* node = &root_;
+  PathComponents components{path};
+  w_string_piece component;
+  while (components.next(component)) {
+    auto& child = node->children[component];
+    if (!child) {
+      // The key already points into path, which the node now keeps alive.
+      child = newNode();
+      child->keyOwner = path;
+    }
+    node = child.get();
+  }
+  w_check(!node->item, "PendingPathTrie::insert: path is already present");
+  node->item = std::move(item);
+  ++size_;
+}
+
+const PendingPathTrie::Item* PendingPathTrie::findAncestor(
+    w_string_piece path,
+    folly::FunctionRef<bool(const watchman_pending_fs&)> pred) {
+  const Item* found = nullptr;
+  Node* node = &root_;
+  PathComponents components{path};
+  w_string_piece component;
+  while (components.next(component)) {
+    if (node->item && pred(*node->item)) {
+      found = &node->item;
+    }
+    auto it = node->children.find(component);
+    if (it == node->children.end()) {
+      break;
+    }
+    node = it->second.get();
+  }
+  return found;
+}
+
+size_t PendingPathTrie::pruneDescendants(
+    w_string_piece path,
+    folly::FunctionRef<bool(Item&)> remove) {
+  auto node = findNode(path);
+  if (!node) {
+    return 0;
+  }
+  auto pruned = pruneSubtree(*node, remove);
+  size_ -= pruned;
+  trim(path);
+  return pruned;
+}
+
+size_t PendingPathTrie::pruneSubtree(
+    Node& node,
+    folly::FunctionRef<bool(Item&)> remove) {
+  size_t pruned = 0;
+  for (auto it = node.children.begin(); it != node.children.end();) {
+    auto& child = *it->second;
+    if (child.item && remove(child.item)) {
+      child.item.reset();
+      ++pruned;
+    }
+    pruned += pruneSubtree(child, remove);
+    if (child.empty()) {
+      it = node.children.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return pruned;
+}
+
+void PendingPathTrie::trim(w_string_piece path) {
+  // Find the deepest node along path that must stay, and cut the chain of
+  // otherwise empty nodes below it.
+  Node* keep = nullptr;
+  decltype(root_.children)::iterator cut;
+  Node* node = &root_;
+  PathComponents components{path};
+  w_string_piece component;
+  while (components.next(component)) {
+    auto it = node->children.find(component);
+    if (it == node->children.end()) {
+      return;
+    }
+    if (node == &root_ || node->item || node->children.size() > 1) {
+      keep = node;
+      cut = it;
+    }
+    node = it->second.get();
+  }
+  if (keep && node->empty()) {
+    keep->children.erase(cut);
+  }
+}
+
+void PendingPathTrie::clear() {
+  root_.item.reset();
+  root_.children.clear();
+  size_ = 0;
+}
+
 void PendingChanges::clear() {
-  pending_.reset();
+  for (size_t i = 0; i < kNumPriorities; ++i) {
+    pending_[i].reset();
+    tails_[i] = nullptr;
+  }
   tree_.clear();
   syncs_.clear();
 }
@@ -61,10 +243,34 @@ void PendingChanges::add(
     const w_string& path,
     std::chrono::system_clock::time_point now,
     PendingFlags flags) {
-  auto existing = tree_.search(path);
+  add(path, now, flags, nullptr);
+}
+
+void PendingChanges::add(
+    const w_string& path,
+    std::chrono::system_clock::time_point now,
+    PendingFlags flags,
+    std::unique_ptr<const FileInformation> preStat) {
+  addItem(path, now, flags, std::move(preStat), nullptr);
+}
+
+void PendingChanges::addMove(
+    const w_string& from,
+    const w_string& to,
+    std::chrono::system_clock::time_point now) {
+  addItem(to, now, W_PENDING_VIA_NOTIFY | W_PENDING_MOVED, nullptr, from);
+}
+
+void PendingChanges::addItem(
+    const w_string& path,
+    std::chrono::system_clock::time_point now,
+    PendingFlags flags,
+    std::unique_ptr<const FileInformation> preStat,
+    const w_string& movedFrom) {
+  auto existing = tree_.find(path);
   if (existing) {
     /* Entry already exists: consolidate */
-    consolidateItem(existing->get(), flags);
+    consolidateItem(*existing, flags, std::move(preStat), movedFrom);
     /* all done */
     return;
   }
@@ -74,7 +280,13 @@ void PendingChanges::add(
   }
 
   // Try to allocate the new node before we prune any children.
-  auto p = std::make_shared<watchman_pending_fs>(path, now, flags);
+  auto p = std::allocate_shared<watchman_pending_fs>(
+      PoolAllocator<watchman_pending_fs>(),
+      path,
+      now,
+      flags,
+      std::move(preStat),
+      movedFrom);
 
   maybePruneObsoletedChildren(path, flags);
 
@@ -101,11 +313,11 @@ void PendingChanges::append(
     std::vector<folly::Promise<folly::Unit>> syncs) {
   auto p = std::move(chain);
   while (p) {
-    auto target_p =
-        tree_.search((const uint8_t*)p->path.data(), p->path.size());
+    auto target_p = tree_.find(p->path);
     if (target_p) {
       /* Entry already exists: consolidate */
-      consolidateItem(target_p->get(), p->flags);
+      consolidateItem(
+          *target_p, p->flags, std::move(p->preStat), p->movedFrom);
       p = std::move(p->next);
       continue;
     }
@@ -131,7 +343,16 @@ void PendingChanges::append(
 
 std::shared_ptr<watchman_pending_fs> PendingChanges::stealItems() {
   tree_.clear();
-  return std::move(pending_);
+  // Chain the lists together, starting from the lowest priority.
+  std::shared_ptr<watchman_pending_fs> chain;
+  for (size_t i = kNumPriorities; i-- > 0;) {
+    if (pending_[i]) {
+      tails_[i]->next = std::move(chain);
+      chain = std::move(pending_[i]);
+    }
+    tails_[i] = nullptr;
+  }
+  return chain;
 }
 
 std::vector<folly::Promise<folly::Unit>> PendingChanges::stealSyncs() {
@@ -155,64 +376,25 @@ void PendingChanges::maybePruneObsoletedChildren(
     PendingFlags flags) {
   if ((flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
       W_PENDING_RECURSIVE) {
-    uint32_t pruned = 0;
-
-    // Since deletion invalidates the iterator, we need to repeatedly
-    // call this to prune out the nodes.  It will return 0 once no
-    // matching prefixes are found and deleted.
-    // Deletion is a bit awkward in this radix tree implementation.
-    // We can't recursively delete a given prefix as a built-in operation
-    // and it is non-trivial to add that functionality right now.
-    // When we lop-off a portion of a tree that we're going to analyze
-    // recursively, we have to iterate each leaf and explicitly delete
-    // that leaf.
-    // Since deletion invalidates the iteration state we have to signal
-    // to stop iteration after each deletion and then retry the prefix
-    // deletion.
-    //
-    // We need to compare the prefix to make sure that we don't delete
-    // a sibling node by mistake (see commentary on the is_path_prefix
-    // function for more on that).
-
-    auto callback = [&](const w_string& key,
-                        std::shared_ptr<watchman_pending_fs>& p) -> int {
-      w_check(
-          p,
-          "Pending changes should be removed from both the list and the tree.");
-
-      if (!p->flags.contains(W_PENDING_CRAWL_ONLY) &&
-          key.size() > path.size() &&
-          is_path_prefix(
-              (const char*)key.data(), key.size(), path.data(), path.size()) &&
-          !isPossiblyACookie(p->path)) {
-        logf(
-            DBG,
-            "delete_kids: removing ({}) {} from pending because it is "
-            "obsoleted by ({}) {}\n",
-            p->path.size(),
-            p->path,
-            path.size(),
-            path);
-
-        // Unlink the child from the pending index.
-        unlinkItem(p);
-
-        // Remove it from the art tree.
-        tree_.erase(key);
-
-        // Stop iteration because we just invalidated the iterator state
-        // by modifying the tree mid-iteration.
-        return 1;
-      }
-
-      return 0;
-    };
-
-    while (tree_.iterPrefix(
-        reinterpret_cast<const uint8_t*>(path.data()), path.size(), callback)) {
-      // OK; try again
-      ++pruned;
-    }
+    auto pruned = tree_.pruneDescendants(
+        path, [&](std::shared_ptr<watchman_pending_fs>& p) {
+          if (p->flags.contains(W_PENDING_CRAWL_ONLY) ||
+              isPossiblyACookie(p->path)) {
+            return false;
+          }
+          logf(
+              DBG,
+              "delete_kids: removing ({}) {} from pending because it is "
+              "obsoleted by ({}) {}\n",
+              p->path.size(),
+              p->path,
+              path.size(),
+              path);
+
+          // Unlink the child from the pending index; the trie drops it.
+          unlinkItem(p);
+          return true;
+        });
 
     if (pruned) {
       logf(
@@ -226,8 +408,10 @@ void PendingChanges::maybePruneObsoletedChildren(
 }
 
 void PendingChanges::consolidateItem(
-    watchman_pending_fs* p,
-    PendingFlags flags) {
+    std::shared_ptr<watchman_pending_fs>& p,
+    PendingFlags flags,
+    std::unique_ptr<const FileInformation> preStat,
+    const w_string& movedFrom) {
   // Increase the strength of the pending item if either of these
   // flags are set.
   // We upgrade crawl-only as well as recursive; it indicates that
@@ -237,6 +421,25 @@ void PendingChanges::consolidateItem(
       flags &
       (W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE |
        W_PENDING_NONRECURSIVE_SCAN | W_PENDING_IS_DESYNCED));
+  // The watcher knows better than the stat information.
+  if (flags.contains(W_PENDING_VIA_NOTIFY)) {
+    p->flags.clear(W_PENDING_DIR_UNCHANGED);
+  }
+  // Only the latest change's stat information can describe the file; if it
+  // came without any, the earlier one may be stale.
+  p->preStat = std::move(preStat);
+  // The latest rename to this path is the one that put the dir there.
+  if (flags.contains(W_PENDING_MOVED)) {
+    p->flags.set(W_PENDING_MOVED);
+    p->movedFrom = movedFrom;
+  }
+
+  // A path that is now to be crawled moves to the crawl list.
+  if (priorityOf(p->path, p->flags) != p->priority) {
+    auto item = p;
+    unlinkItem(item);
+    linkHead(std::move(item));
+  }
 
   maybePruneObsoletedChildren(p->path, p->flags);
 }
@@ -246,45 +449,57 @@ void PendingChanges::consolidateItem(
 // return true to indicate that there is no need to track this new path
 // due to the already scheduled higher level path.
 bool PendingChanges::isObsoletedByContainingDir(const w_string& path) {
-  auto leaf = tree_.longestMatch((const uint8_t*)path.data(), path.size());
-  if (!leaf) {
+  if (isPossiblyACookie(path)) {
     return false;
   }
-  auto p = leaf->value;
 
-  if ((p->flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
-          W_PENDING_RECURSIVE &&
-      is_path_prefix(
-          path.data(),
-          path.size(),
-          (const char*)leaf->key.data(),
-          leaf->key.size())) {
-    if (isPossiblyACookie(path)) {
-      return false;
-    }
+  auto p = tree_.findAncestor(path, [](const watchman_pending_fs& item) {
+    return (item.flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
+        W_PENDING_RECURSIVE;
+  });
+  if (!p) {
+    return false;
+  }
 
-    // Yes: the pre-existing entry higher up in the tree obsoletes this
-    // one that we would add now.
-    logf(DBG, "is_obsoleted: SKIP {} is obsoleted by {}\n", path, p->path);
-    return true;
+  // Yes: the pre-existing entry higher up in the tree obsoletes this
+  // one that we would add now.
+  logf(DBG, "is_obsoleted: SKIP {} is obsoleted by {}\n", path, (*p)->path);
+  return true;
+}
+
+PendingChanges::Priority PendingChanges::priorityOf(
+    const w_string& path,
+    PendingFlags flags) {
+  if (isPossiblyACookie(path)) {
+    return kCookie;
   }
-  return false;
+  if (flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) {
+    return kCrawl;
+  }
+  return kChange;
 }
 
-// Helper to doubly-link a pending item to the head of a collection.
+// Helper to doubly-link a pending item to the head of the list for its
+// priority.
 void PendingChanges::linkHead(std::shared_ptr<watchman_pending_fs>&& p) {
+  auto priority = priorityOf(p->path, p->flags);
+  auto& head = pending_[priority];
+  p->priority = priority;
   p->prev.reset();
-  p->next = pending_;
+  p->next = head;
   if (p->next) {
     p->next->prev = p;
+  } else {
+    tails_[priority] = p.get();
   }
-  pending_ = std::move(p);
+  head = std::move(p);
 }
 
 // Helper to un-doubly-link a pending item.
 void PendingChanges::unlinkItem(std::shared_ptr<watchman_pending_fs>& p) {
-  if (pending_ == p) {
-    pending_ = p->next;
+  auto& head = pending_[p->priority];
+  if (head == p) {
+    head = p->next;
   }
   auto prev = p->prev.lock();
 
@@ -294,6 +509,8 @@ void PendingChanges::unlinkItem(std::shared_ptr<watchman_pending_fs>& p) {
 
   if (p->next) {
     p->next->prev = prev;
+  } else {
+    tails_[p->priority] = prev.get();
   }
 
   p->next.reset();
@@ -309,7 +526,7 @@ void PendingCollectionBase::ping() {
 }
 
 bool PendingCollectionBase::checkAndResetPinged() {
-  if (pending_ || pinged_) {
+  if (tree_.size() || pinged_) {
     pinged_ = false;
     return true;
   }
@@ -321,23 +538,184 @@ PendingCollection::PendingCollection()
           folly::in_place,
           cond_} {}
 
+PendingCollection::~PendingCollection() {
+  auto node = ingest_.exchange(nullptr);
+  while (node) {
+    std::unique_ptr<Ingest> ingest{node};
+    node = ingest->next;
+  }
+}
+
+void PendingCollection::enqueue(
+    std::shared_ptr<watchman_pending_fs> chain,
+    std::vector<folly::Promise<folly::Unit>> syncs) {
+  auto node = new Ingest{std::move(chain), std::move(syncs), ingest_.load()};
+  while (!ingest_.compare_exchange_weak(node->next, node)) {
+  }
+
+  // Both this and lockAndWait() store before they load, so at least one of
+  // them sees the other: either the consumer finds the item before
+  // sleeping, or we find it waiting. The lock then keeps the wakeup from
+  // arriving before it starts to wait.
+  if (consumerWaiting_.load()) {
+    this->lock()->ping();
+  }
+}
+
+void PendingCollection::drain(LockedPtr& lock) {
+  auto node = ingest_.exchange(nullptr);
+
+  // The newest item is at the head; merge them in the order they came so
+  // that later changes are consolidated over earlier ones.
+  Ingest* oldest = nullptr;
+  while (node) {
+    auto next = node->next;
+    node->next = oldest;
+    oldest = node;
+    node = next;
+  }
+  while (oldest) {
+    std::unique_ptr<Ingest> ingest{oldest};
+    oldest = ingest->next;
+    lock->append(std::move(ingest->chain), std::move(ingest->syncs));
+  }
+}
+
+PendingCollection::LockedPtr PendingCollection::lockAndDrain() {
+  auto lock = this->lock();
+  drain(lock);
+  return lock;
+}
+
 PendingCollection::LockedPtr PendingCollection::lockAndWait(
     std::chrono::milliseconds timeoutms) {
-  auto lock = this->lock();
+  auto lock = lockAndDrain();
 
   if (lock->checkAndResetPinged()) {
     return lock;
   }
 
-  if (timeoutms.count() == -1) {
-    cond_.wait(lock.as_lock());
-  } else {
-    cond_.wait_for(lock.as_lock(), timeoutms);
+  consumerWaiting_.store(true);
+  if (!ingest_.load()) {
+    if (timeoutms.count() == -1) {
+      cond_.wait(lock.as_lock());
+    } else {
+      cond_.wait_for(lock.as_lock(), timeoutms);
+    }
   }
+  consumerWaiting_.store(false);
 
+  drain(lock);
   lock->checkAndResetPinged();
   return lock;
 }
 
+PendingDebounce::PendingDebounce(std::chrono::milliseconds window)
+    : window_{window} {}
+
+bool PendingDebounce::isDebounceable(const watchman_pending_fs& item) {
+  return item.flags.contains(W_PENDING_VIA_NOTIFY) &&
+      !(item.flags &
+        (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY | W_PENDING_IS_DESYNCED |
+         W_PENDING_DIR_UNCHANGED | W_PENDING_MOVED)) &&
+      !isPossiblyACookie(item.path);
+}
+
+bool PendingDebounce::isDue(const Held& held, Clock::time_point now) const {
+  return now - held.last >= window_ ||
+      now - held.first >= kMaxHoldWindows * window_;
+}
+
+std::shared_ptr<watchman_pending_fs> PendingDebounce::admit(
+    std::shared_ptr<watchman_pending_fs> chain,
+    bool flush,
+    Clock::time_point now) {
+  if (now - lastSweep_ >= window_) {
+    for (auto it = recent_.begin(); it != recent_.end();) {
+      if (now - it->second >= window_) {
+        it = recent_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    lastSweep_ = now;
+  }
+
+  std::shared_ptr<watchman_pending_fs> ready;
+  auto p = std::move(chain);
+  while (p) {
+    auto next = std::move(p->next);
+
+    if (!isDebounceable(*p)) {
+      flush = flush || isPossiblyACookie(p->path);
+      p->next = std::move(ready);
+      ready = std::move(p);
+    } else if (auto it = held_.find(p->path); it != held_.end()) {
+      auto& item = *it->second.item;
+      item.now = p->now;
+      item.flags.set(p->flags);
+      item.preStat = std::move(p->preStat);
+      it->second.last = now;
+      ++absorbed_;
+    } else if (auto recent = recent_.find(p->path);
+               recent != recent_.end() && now - recent->second < window_) {
+      auto path = p->path;
+      recent_.erase(recent);
+      held_.emplace(std::move(path), Held{std::move(p), now, now});
+    } else {
+      recent_.insert_or_assign(p->path, now);
+      p->next = std::move(ready);
+      ready = std::move(p);
+    }
+
+    p = std::move(next);
+  }
+
+  if (flush) {
+    for (auto& [path, held] : held_) {
+      recent_.insert_or_assign(path, held.last);
+      held.item->next = std::move(ready);
+      ready = std::move(held.item);
+    }
+    held_.clear();
+  }
+  return ready;
+}
+
+std::shared_ptr<watchman_pending_fs> PendingDebounce::release(
+    Clock::time_point now) {
+  std::shared_ptr<watchman_pending_fs> ready;
+  for (auto it = held_.begin(); it != held_.end();) {
+    if (!isDue(it->second, now)) {
+      ++it;
+      continue;
+    }
+    recent_.insert_or_assign(it->first, it->second.last);
+    it->second.item->next = std::move(ready);
+    ready = std::move(it->second.item);
+    it = held_.erase(it);
+  }
+  return ready;
+}
+
+std::optional<std::chrono::milliseconds> PendingDebounce::timeUntilRelease(
+    Clock::time_point now) const {
+  std::optional<Clock::time_point> due;
+  for (auto& [path, held] : held_) {
+    auto at = std::min(
+        held.last + window_, held.first + kMaxHoldWindows * window_);
+    if (!due || at < *due) {
+      due = at;
+    }
+  }
+  if (!due) {
+    return std::nullopt;
+  }
+  if (*due <= now) {
+    return std::chrono::milliseconds{0};
+  }
+  return std::chrono::ceil<std::chrono::milliseconds>(*due - now);
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -7,12 +7,18 @@
 
 #pragma once
 
+#include <folly/Function.h>
 #include <folly/Synchronized.h>
 #include <folly/futures/Promise.h>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <memory>
+#include <optional>
+#include <unordered_map>
 #include "watchman/OptionSet.h"
-#include "watchman/thirdparty/libart/src/art.h"
+#include "watchman/PoolAllocator.h"
+#include "watchman/fs/FileInformation.h"
 #include "watchman/watchman_string.h"
 
 struct watchman_dir;
@@ -82,6 +88,22 @@ constexpr inline auto W_PENDING_IS_DESYNCED = PendingFlags::raw(16);
  */
 constexpr inline auto W_PENDING_VIA_PWALK = PendingFlags::raw(32);
 
+/**
+ * Set by the IO thread on the recursive crawl of a dir whose stat information
+ * was unchanged when its parent was recrawled. With trust_unchanged_dir_mtime,
+ * the crawler then only examines the entries it does not already know about,
+ * or, on filesystems with reliable dir mtimes, does not read the dir at all.
+ * It is dropped when consolidated with a change reported by the watcher.
+ */
+constexpr inline auto W_PENDING_DIR_UNCHANGED = PendingFlags::raw(64);
+
+/**
+ * Set by watchers that pair both sides of a rename when the dir at movedFrom
+ * was renamed to this path. The IO thread then relocates the subtree in the
+ * view instead of marking it deleted and crawling it again.
+ */
+constexpr inline auto W_PENDING_MOVED = PendingFlags::raw(128);
+
 /**
  * Represents a change notification from the Watcher.
  */
@@ -96,21 +118,119 @@ struct watchman_pending_fs : watchman::PendingChange {
   // are destroyed.
   std::shared_ptr<watchman_pending_fs> next;
 
+  // The stat information that the watcher reported along with the change,
+  // if any. The IO thread uses it instead of stat()ing the path again.
+  std::unique_ptr<const FileInformation> preStat;
+
+  // If W_PENDING_MOVED is set, the path that the dir was renamed from.
+  w_string movedFrom;
+
   watchman_pending_fs(
       w_string path,
       std::chrono::system_clock::time_point now,
-      PendingFlags flags)
-      : PendingChange{std::move(path), now, flags} {}
+      PendingFlags flags,
+      std::unique_ptr<const FileInformation> preStat = nullptr,
+      w_string movedFrom = nullptr)
+      : PendingChange{std::move(path), now, flags},
+        preStat(std::move(preStat)),
+        movedFrom(std::move(movedFrom)) {}
 
  private:
   // Only used for unlinking during pruning.
   std::weak_ptr<watchman_pending_fs> prev;
+  // The PendingChanges list that this item is linked into.
+  uint8_t priority{0};
   friend class PendingChanges;
 };
 
 /**
- * Holds a linked list of watchman_pending_fs instances and a trie that
+ * Indexes pending items by path component.
+ *
+ * Finding the items above a path takes time proportional to its depth, and
+ * finding or removing the items below it takes time proportional to the size
+ * of that subtree, regardless of how many other items share a string prefix
+ * with it. Nodes name themselves with a piece of the path of the item whose
+ * insertion created them; w_string is refcounted, so no bytes are copied.
+ */
+class PendingPathTrie {
+ public:
+  using Item = std::shared_ptr<watchman_pending_fs>;
+
+  /**
+   * Returns the item at exactly path, or nullptr if there is none.
+   */
+  Item* find(w_string_piece path);
+
+  /**
+   * Adds item at path, which must not already have one.
+   */
+  void insert(const w_string& path, Item item);
+
+  /**
+   * Returns the nearest item above path for which pred returns true, or
+   * nullptr if there is none.
+   */
+  const Item* findAncestor(
+      w_string_piece path,
+      folly::FunctionRef<bool(const watchman_pending_fs&)> pred);
+
+  /**
+   * Removes each item below path for which remove returns true, and returns
+   * how many were removed.
+   */
+  size_t pruneDescendants(
+      w_string_piece path,
+      folly::FunctionRef<bool(Item&)> remove);
+
+  void clear();
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  struct Node;
+  // Nodes come from a PoolAllocator, as do the entries of their maps.
+  struct NodeDeleter {
+    void operator()(Node* node) const noexcept;
+  };
+  using NodePtr = std::unique_ptr<Node, NodeDeleter>;
+
+  struct Node {
+    // Holds the storage that this node's key in its parent refers to.
+    w_string keyOwner;
+    Item item;
+    std::unordered_map<
+        w_string_piece,
+        NodePtr,
+        std::hash<w_string_piece>,
+        std::equal_to<w_string_piece>,
+        PoolAllocator<std::pair<const w_string_piece, NodePtr>>>
+        children;
+
+    bool empty() const {
+      return !item && children.empty();
+    }
+  };
+
+  static NodePtr newNode();
+  Node* findNode(w_string_piece path);
+  size_t pruneSubtree(Node& node, folly::FunctionRef<bool(Item&)> remove);
+  // Removes the nodes along path that no longer hold anything.
+  void trim(w_string_piece path);
+
+  Node root_;
+  size_t size_{0};
+};
+
+/**
+ * Holds linked lists of watchman_pending_fs instances and a trie that
  * efficiently prunes redundant changes.
+ *
+ * Items are kept in one list per priority class: cookies, then other paths,
+ * then recursive and crawl-only dirs. stealItems() hands them out in that
+ * order so that cookie files, which syncs wait on, and the paths that the
+ * watcher reported are never queued behind crawls.
  */
 class PendingChanges {
  public:
@@ -133,12 +253,31 @@ class PendingChanges {
       const w_string& path,
       std::chrono::system_clock::time_point now,
       PendingFlags flags);
+  /**
+   * As above, but with the path's stat information as reported by the
+   * watcher, so that the IO thread need not stat it again.
+   */
+  void add(
+      const w_string& path,
+      std::chrono::system_clock::time_point now,
+      PendingFlags flags,
+      std::unique_ptr<const FileInformation> preStat);
   void add(
       watchman_dir* dir,
       const char* name,
       std::chrono::system_clock::time_point now,
       PendingFlags flags);
 
+  /**
+   * Add a pending entry for a dir that was renamed from `from` to `to`. It is
+   * at `to`, with W_PENDING_VIA_NOTIFY and W_PENDING_MOVED set. The caller
+   * must own the collection lock.
+   */
+  void addMove(
+      const w_string& from,
+      const w_string& to,
+      std::chrono::system_clock::time_point now);
+
   /**
    * Add a sync request. The consumer of this sync should fulfill it after
    * processing all of the pending items.
@@ -155,7 +294,7 @@ class PendingChanges {
       std::shared_ptr<watchman_pending_fs> chain,
       std::vector<folly::Promise<folly::Unit>> syncs);
 
-  /* Moves the head of the chain of items to the caller.
+  /* Moves the head of the chain of items to the caller, in priority order.
    * The tree is cleared and the caller owns the whole chain */
   std::shared_ptr<watchman_pending_fs> stealItems();
 
@@ -172,15 +311,41 @@ class PendingChanges {
    */
   uint32_t getPendingItemCount() const;
 
+  bool hasSyncs() const {
+    return !syncs_.empty();
+  }
+
+  /**
+   * Returns true if any of the items may be a cookie file.
+   */
+  bool hasCookies() const {
+    return pending_[kCookie] != nullptr;
+  }
+
  protected:
-  art_tree<std::shared_ptr<watchman_pending_fs>, w_string> tree_;
-  std::shared_ptr<watchman_pending_fs> pending_;
+  enum Priority : uint8_t { kCookie, kChange, kCrawl, kNumPriorities };
+
+  PendingPathTrie tree_;
+  // The head and tail of the list for each Priority.
+  std::shared_ptr<watchman_pending_fs> pending_[kNumPriorities];
+  watchman_pending_fs* tails_[kNumPriorities]{};
   std::vector<folly::Promise<folly::Unit>> syncs_;
 
  private:
+  void addItem(
+      const w_string& path,
+      std::chrono::system_clock::time_point now,
+      PendingFlags flags,
+      std::unique_ptr<const FileInformation> preStat,
+      const w_string& movedFrom);
   void maybePruneObsoletedChildren(w_string path, PendingFlags flags);
-  inline void consolidateItem(watchman_pending_fs* p, PendingFlags flags);
+  inline void consolidateItem(
+      std::shared_ptr<watchman_pending_fs>& p,
+      PendingFlags flags,
+      std::unique_ptr<const FileInformation> preStat,
+      const w_string& movedFrom);
   bool isObsoletedByContainingDir(const w_string& path);
+  static Priority priorityOf(const w_string& path, PendingFlags flags);
   inline void linkHead(std::shared_ptr<watchman_pending_fs>&& p);
   inline void unlinkItem(std::shared_ptr<watchman_pending_fs>& p);
 };
@@ -211,18 +376,126 @@ class PendingCollection
     : public folly::Synchronized<PendingCollectionBase, std::mutex> {
  public:
   PendingCollection();
+  ~PendingCollection();
+
+  /**
+   * Queues a chain of items, as returned by PendingChanges::stealItems(), and
+   * syncs without taking the lock, then wakes the consumer. They are merged
+   * into the collection by the next lockAndWait() or lockAndDrain(), so that
+   * a producer never waits for the consumer to finish with the lock.
+   */
+  void enqueue(
+      std::shared_ptr<watchman_pending_fs> chain,
+      std::vector<folly::Promise<folly::Unit>> syncs);
+
+  /**
+   * Returns the locked PendingCollectionBase, after merging in everything
+   * that was enqueue()d.
+   */
+  LockedPtr lockAndDrain();
 
   /**
    * If previously pinged or non-empty, returns a locked PendingCollectionBase.
-   * Otherwise, waits up to timeoutms (or indefinitely if -1 ms) for a ping().
+   * Otherwise, waits up to timeoutms (or indefinitely if -1 ms) for a ping()
+   * or an enqueue().
    *
-   * The internal pinged state is always false after this call.
+   * Either way, everything that was enqueue()d is merged in, and the
+   * internal pinged state is always false after this call.
    */
   LockedPtr lockAndWait(std::chrono::milliseconds timeoutms);
 
  private:
+  struct Ingest {
+    std::shared_ptr<watchman_pending_fs> chain;
+    std::vector<folly::Promise<folly::Unit>> syncs;
+    Ingest* next;
+  };
+
+  void drain(LockedPtr& lock);
+
   // Notified on ping().
   std::condition_variable cond_;
+  // The most recently enqueue()d items; each links to the ones before it.
+  std::atomic<Ingest*> ingest_{nullptr};
+  // Set while lockAndWait() may be about to sleep, so that enqueue() knows
+  // to take the lock and wake it.
+  std::atomic<bool> consumerWaiting_{false};
+};
+
+/**
+ * Holds back changes to files that the watcher keeps reporting, such as the
+ * outputs of a build step that rewrites them many times in quick succession.
+ *
+ * The first report of a path passes straight through. A path that is
+ * reported again within the window is held, and each further report only
+ * refreshes it, until it has been quiet for the window, or has been held for
+ * kMaxHoldWindows windows if it never goes quiet. Crawls, cookies and desync
+ * recoveries are never held, and a cookie or a sync releases everything that
+ * is held, so that a query that synchronizes sees every earlier change.
+ *
+ * PendingDebounce is not thread safe; it belongs to the IO thread.
+ */
+class PendingDebounce {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr int kMaxHoldWindows = 8;
+
+  explicit PendingDebounce(std::chrono::milliseconds window = {});
+
+  bool enabled() const {
+    return window_.count() > 0;
+  }
+
+  bool empty() const {
+    return held_.empty();
+  }
+
+  /**
+   * Returns the items from chain that should be processed now, and keeps the
+   * rest. If flush is set, or chain contains a cookie, everything that is
+   * held is returned as well.
+   */
+  std::shared_ptr<watchman_pending_fs> admit(
+      std::shared_ptr<watchman_pending_fs> chain,
+      bool flush,
+      Clock::time_point now);
+
+  /**
+   * Returns the held items that are due to be processed at now.
+   */
+  std::shared_ptr<watchman_pending_fs> release(Clock::time_point now);
+
+  /**
+   * Returns how long until the next held item is due, or nullopt if nothing
+   * is held.
+   */
+  std::optional<std::chrono::milliseconds> timeUntilRelease(
+      Clock::time_point now) const;
+
+  /**
+   * The number of reports that were absorbed into an item already held.
+   */
+  size_t getAbsorbedCount() const {
+    return absorbed_;
+  }
+
+ private:
+  struct Held {
+    std::shared_ptr<watchman_pending_fs> item;
+    Clock::time_point first;
+    Clock::time_point last;
+  };
+
+  static bool isDebounceable(const watchman_pending_fs& item);
+  bool isDue(const Held& held, Clock::time_point now) const;
+
+  const std::chrono::milliseconds window_;
+  std::unordered_map<w_string, Held> held_;
+  // When each recently reported path that is not held was last reported.
+  std::unordered_map<w_string, Clock::time_point> recent_;
+  Clock::time_point lastSweep_;
+  size_t absorbed_{0};
 };
 
 // Since the tree has no internal knowledge about path structures, when we
@@ -6,14 +6,23 @@
  */
 
 #include "watchman/PerfSample.h"
+#include <fmt/core.h>
+#include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <folly/portability/Fcntl.h>
+#include <algorithm>
 #include <condition_variable>
+#include <memory>
+#include <system_error>
 #include <thread>
+#include <utility>
 #include "watchman/ChildProcess.h"
 #include "watchman/Logging.h"
+#include "watchman/Metrics.h"
 #include "watchman/Options.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/sockname.h"
+#include "watchman/watchman_stream.h"
 #include "watchman/watchman_system.h"
 #include "watchman/watchman_time.h"
 
@@ -27,6 +36,8 @@ class PerfLogThread {
 
     bool running;
     std::vector<json_ref> samples;
+    // Samples discarded because the queue was full, since the last report
+    size_t dropped{0};
   };
 
   folly::Synchronized<State, std::mutex> state_;
@@ -59,12 +70,142 @@ class PerfLogThread {
   }
 
   void addSample(json_ref&& sample) {
+    static auto& dropped = getCounter(
+        "watchman_perf_samples_dropped_total",
+        "Perf samples discarded because the logger fell behind");
+    // Bounded so that a logger that can't keep up doesn't cost unbounded
+    // memory.
+    auto maxQueued = cfg_get_int("perf_logger_max_queued_samples", 1024);
+
     auto wlock = state_.lock();
+    if (maxQueued > 0 && wlock->samples.size() >= size_t(maxQueued)) {
+      ++wlock->dropped;
+      dropped.add();
+      return;
+    }
     wlock->samples.push_back(std::move(sample));
     cond_.notify_one();
   }
 };
 
+ChildProcess::Options loggerOptions(const w_string& stateDir) {
+  ChildProcess::Options opts;
+  opts.environment().set(
+      {{"WATCHMAN_STATE_DIR", stateDir},
+       {"WATCHMAN_SOCK", get_sock_name_legacy()}});
+  opts.open(STDOUT_FILENO, "/dev/null", O_WRONLY, 0666);
+  opts.open(STDERR_FILENO, "/dev/null", O_WRONLY, 0666);
+  return opts;
+}
+
+/**
+ * Writes batches of samples, each encoded as a line of JSON, to a stream that
+ * stays open between them: the stdin of a perf_logger_command that keeps
+ * running, or perf_logger_file. Either is opened again if writing to it
+ * fails.
+ */
+class SampleStream {
+ public:
+  SampleStream(json_ref perfCmd, w_string file, w_string stateDir)
+      : perfCmd_(std::move(perfCmd)),
+        file_(std::move(file)),
+        stateDir_(std::move(stateDir)) {}
+
+  ~SampleStream() {
+    close();
+  }
+
+  void write(const std::vector<json_ref>& samples) {
+    std::string buffer;
+    for (auto& sample : samples) {
+      buffer.append(json_dumps(sample, 0));
+      buffer.push_back('\n');
+    }
+
+    // A logger that has exited since the last batch is replaced once.
+    for (int attempt = 0; attempt < 2; ++attempt) {
+      if (!stream_ && !open()) {
+        return;
+      }
+      if (writeAll(buffer)) {
+        return;
+      }
+      log(ERR,
+          "failed to send ",
+          samples.size(),
+          " samples to the perf logger: ",
+          folly::errnoStr(errno),
+          "\n");
+      close();
+    }
+  }
+
+ private:
+  bool open() {
+    try {
+      if (!file_.empty()) {
+        stream_ = w_stm_open(
+            file_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (!stream_) {
+          throw std::system_error(
+              errno,
+              std::generic_category(),
+              fmt::format("unable to open {}", file_));
+        }
+      } else {
+        std::vector<std::string_view> cmd;
+        for (auto& c : perfCmd_.array()) {
+          cmd.push_back(json_to_w_string(c).view());
+        }
+        auto opts = loggerOptions(stateDir_);
+        opts.pipeStdin();
+        proc_ = std::make_unique<ChildProcess>(cmd, std::move(opts));
+        stream_ = w_stm_fdopen(std::move(proc_->takeStdin()->write));
+      }
+      return true;
+    } catch (const std::exception& exc) {
+      log(ERR, "failed to start perf logger: ", exc.what(), "\n");
+      close();
+      return false;
+    }
+  }
+
+  void close() {
+    // Closing its stdin tells the logger to exit once it has read the rest.
+    stream_.reset();
+    if (proc_) {
+      try {
+        proc_->wait();
+      } catch (const std::exception& exc) {
+        log(ERR, "waiting for the perf logger: ", exc.what(), "\n");
+      }
+      proc_.reset();
+    }
+  }
+
+  bool writeAll(const std::string& buffer) {
+    // Bounds each write, whose size is passed as an int.
+    constexpr size_t kMaxWrite = 1024 * 1024;
+    size_t pos = 0;
+    while (pos < buffer.size()) {
+      int res = stream_->write(
+          buffer.data() + pos,
+          static_cast<int>(std::min(buffer.size() - pos, kMaxWrite)));
+      if (res <= 0) {
+        return false;
+      }
+      pos += res;
+    }
+    return true;
+  }
+
+  const json_ref perfCmd_;
+  const w_string file_;
+  const w_string stateDir_;
+  std::unique_ptr<ChildProcess> proc_;
+  std::unique_ptr<watchman_stream> stream_;
+};
+
 PerfLogThread& getPerfThread(bool start = true) {
   // Get the perf logging thread, starting it on the first call.
   // Meyer's singleton!
@@ -79,28 +220,31 @@ void processSamples(
     std::vector<json_ref>& samples,
     std::function<void(std::vector<std::string>)> command_line,
     std::function<void(std::string)> single_large_sample) {
-  while (samples.size() > 0) {
-    std::string encoded_sample = json_dumps(samples.front(), 0);
-    samples.erase(samples.begin()); // O(N^2)
-
-    if (encoded_sample.size() > argv_limit) {
-      single_large_sample(std::move(encoded_sample));
-    } else {
-      std::vector<std::string> args;
-      args.push_back(std::move(encoded_sample));
-      size_t arg_size = encoded_sample.size() + 1;
-
-      while (args.size() < maximum_batch_size && samples.size() > 0) {
-        encoded_sample = json_dumps(samples[0], 0);
-        if (arg_size + encoded_sample.size() + 1 > argv_limit) {
-          break;
-        }
-        samples.erase(samples.begin()); // O(N^2)
-        arg_size += encoded_sample.size() + 1;
-        args.push_back(std::move(encoded_sample));
+  std::vector<std::string> encoded;
+  encoded.reserve(samples.size());
+  for (auto& sample : samples) {
+    encoded.push_back(json_dumps(sample, 0));
+  }
+  samples.clear();
+
+  size_t next = 0;
+  while (next < encoded.size()) {
+    if (encoded[next].size() > argv_limit) {
+      single_large_sample(std::move(encoded[next++]));
+      continue;
+    }
+
+    std::vector<std::string> args;
+    size_t arg_size = 0;
+    while (next < encoded.size() && args.size() < maximum_batch_size) {
+      size_t size = encoded[next].size() + 1;
+      if (!args.empty() && arg_size + size > argv_limit) {
+        break;
       }
-      command_line(std::move(args));
+      arg_size += size;
+      args.push_back(std::move(encoded[next++]));
     }
+    command_line(std::move(args));
   }
 }
 
@@ -140,7 +284,8 @@ bool PerfSample::finish() {
 
   if (!will_log) {
     if (wall_time_elapsed_thresh == 0) {
-      auto thresh = cfg_get_json("perf_sampling_thresh");
+      auto config = cfg_get_snapshot();
+      auto& thresh = config->perfSamplingThresh;
       if (thresh) {
         if (thresh->isNumber()) {
           wall_time_elapsed_thresh = json_number_value(*thresh);
@@ -181,19 +326,28 @@ void PerfLogThread::loop() noexcept {
   auto stateDir =
       w_string_piece(flags.watchman_state_file).dirName().asWString();
 
+  // A file takes the place of the command.
+  w_string perfFile{cfg_get_string("perf_logger_file", "")};
   json_ref perf_cmd = cfg_get_json("perf_logger_command").value_or(json_null());
   if (perf_cmd.isString()) {
     perf_cmd = json_array({perf_cmd});
   }
-  if (!perf_cmd.isArray()) {
+  if (perfFile.empty() && !perf_cmd.isArray()) {
     logf(
         FATAL,
         "perf_logger_command must be either a string or an array of strings\n");
   }
 
+  std::unique_ptr<SampleStream> stream;
+  if (!perfFile.empty() ||
+      cfg_get_bool("perf_logger_command_persistent", false)) {
+    stream = std::make_unique<SampleStream>(perf_cmd, perfFile, stateDir);
+  }
+
   sample_batch = cfg_get_int("perf_logger_command_max_samples_per_call", 4);
 
   while (true) {
+    size_t dropped;
     {
       auto state = state_.lock();
       while (true) {
@@ -210,6 +364,21 @@ void PerfLogThread::loop() noexcept {
 
       samples.clear();
       std::swap(samples, state->samples);
+      dropped = std::exchange(state->dropped, 0);
+    }
+
+    if (dropped > 0) {
+      log(ERR,
+          "the perf logger fell behind; dropped ",
+          dropped,
+          " samples\n");
+    }
+
+    if (stream) {
+      // Everything that queued up while the last batch was written goes in
+      // a single write.
+      stream->write(samples);
+      continue;
     }
 
     if (!samples.empty()) {
@@ -235,13 +404,8 @@ void PerfLogThread::loop() noexcept {
               cmd.push_back(sample);
             }
 
-            ChildProcess::Options opts;
-            opts.environment().set(
-                {{"WATCHMAN_STATE_DIR", stateDir},
-                 {"WATCHMAN_SOCK", get_sock_name_legacy()}});
+            auto opts = loggerOptions(stateDir);
             opts.open(STDIN_FILENO, "/dev/null", O_RDONLY, 0666);
-            opts.open(STDOUT_FILENO, "/dev/null", O_WRONLY, 0666);
-            opts.open(STDERR_FILENO, "/dev/null", O_WRONLY, 0666);
 
             try {
               ChildProcess proc(cmd, std::move(opts));
@@ -251,13 +415,8 @@ void PerfLogThread::loop() noexcept {
             }
           },
           [&](std::string sample_stdin) {
-            ChildProcess::Options opts;
-            opts.environment().set(
-                {{"WATCHMAN_STATE_DIR", stateDir},
-                 {"WATCHMAN_SOCK", get_sock_name_legacy()}});
+            auto opts = loggerOptions(stateDir);
             opts.pipeStdin();
-            opts.open(STDOUT_FILENO, "/dev/null", O_WRONLY, 0666);
-            opts.open(STDERR_FILENO, "/dev/null", O_WRONLY, 0666);
 
             try {
               ChildProcess proc({perf_cmd}, std::move(opts));
@@ -324,7 +483,8 @@ void PerfSample::log() {
   auto dumped = json_dumps(info, 0);
   watchman::log(ERR, "PERF: ", dumped, "\n");
 
-  if (!cfg_get_json("perf_logger_command")) {
+  if (!cfg_get_json("perf_logger_command") &&
+      !cfg_get_json("perf_logger_file")) {
     return;
   }
 
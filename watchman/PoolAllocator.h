@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace watchman {
+
+namespace detail {
+
+/**
+ * Recycles fixed-size blocks through a free list per thread, topped up from
+ * and spilled to a shared list a batch at a time.
+ *
+ * Nodes that are created on one thread and destroyed on another, such as
+ * pending changes that the notify thread produces and the IO thread
+ * consumes, flow back to the producer a batch at a time, so the shared lock
+ * is taken once per kBatchSize allocations.
+ */
+template <size_t Size>
+class NodePool {
+ public:
+  static void* allocate() {
+    auto& local = getLocal();
+    if (!local.head) {
+      refill(local);
+      if (!local.head) {
+        return ::operator new(kBlockSize);
+      }
+    }
+    auto node = local.head;
+    local.head = node->next;
+    --local.count;
+    return node;
+  }
+
+  static void deallocate(void* ptr) noexcept {
+    auto& local = getLocal();
+    auto node = static_cast<FreeNode*>(ptr);
+    node->next = local.head;
+    local.head = node;
+    if (++local.count >= 2 * kBatchSize) {
+      spill(local);
+    }
+  }
+
+ private:
+  struct FreeNode {
+    FreeNode* next;
+  };
+
+  static constexpr size_t kBlockSize = std::max(Size, sizeof(FreeNode));
+  static constexpr size_t kBatchSize = 64;
+  // Bounds what a burst leaves behind once it has been processed.
+  static constexpr size_t kMaxSharedBatches = 1024;
+
+  struct Local {
+    FreeNode* head{nullptr};
+    size_t count{0};
+
+    ~Local() {
+      while (head) {
+        auto next = head->next;
+        ::operator delete(head);
+        head = next;
+      }
+    }
+  };
+
+  struct Shared {
+    std::mutex mutex;
+    // Each is a list of kBatchSize nodes.
+    std::vector<FreeNode*> batches;
+  };
+
+  static Local& getLocal() {
+    static thread_local Local local;
+    return local;
+  }
+
+  static Shared& getShared() {
+    // Leaked so that threads exiting during shutdown can still use it.
+    static auto* shared = new Shared;
+    return *shared;
+  }
+
+  static void refill(Local& local) {
+    auto& shared = getShared();
+    std::lock_guard<std::mutex> lock{shared.mutex};
+    if (shared.batches.empty()) {
+      return;
+    }
+    local.head = shared.batches.back();
+    local.count = kBatchSize;
+    shared.batches.pop_back();
+  }
+
+  static void spill(Local& local) {
+    // Detach the first kBatchSize nodes.
+    auto batch = local.head;
+    auto tail = batch;
+    for (size_t i = 1; i < kBatchSize; ++i) {
+      tail = tail->next;
+    }
+    local.head = tail->next;
+    local.count -= kBatchSize;
+    tail->next = nullptr;
+
+    {
+      auto& shared = getShared();
+      std::lock_guard<std::mutex> lock{shared.mutex};
+      if (shared.batches.size() < kMaxSharedBatches) {
+        shared.batches.push_back(batch);
+        return;
+      }
+    }
+    while (batch) {
+      auto next = batch->next;
+      ::operator delete(batch);
+      batch = next;
+    }
+  }
+};
+
+} // namespace detail
+
+/**
+ * A std allocator that recycles single-object allocations, for node types
+ * that are created and destroyed at high rates. Use it with
+ * std::allocate_shared or as a node container's allocator; allocations of
+ * more than one object go straight to operator new.
+ *
+ * Memory that is returned to the pool is not released to the system except
+ * when the pool is holding more than it is likely to need again.
+ */
+template <typename T>
+class PoolAllocator {
+ public:
+  using value_type = T;
+
+  PoolAllocator() noexcept = default;
+  template <typename U>
+  /* implicit */ PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    if (n != 1) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(Pool::allocate());
+  }
+
+  void deallocate(T* ptr, size_t n) noexcept {
+    if (n != 1) {
+      ::operator delete(ptr);
+      return;
+    }
+    Pool::deallocate(ptr);
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>&) const noexcept {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const PoolAllocator<U>&) const noexcept {
+    return false;
+  }
+
+ private:
+  static_assert(
+      alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+      "PoolAllocator does not support over-aligned types");
+
+  using Pool = detail::NodePool<sizeof(T)>;
+};
+
+} // namespace watchman
@@ -8,17 +8,86 @@
 #include "watchman/PubSub.h"
 #include <algorithm>
 #include <iterator>
+#include <thread>
 
 namespace watchman {
 
+Publisher::Publisher(size_t maxBacklog)
+    : ring_(maxBacklog ? std::make_unique<Ring>(maxBacklog) : nullptr) {}
+
+Publisher::Ring::Ring(size_t size)
+    : size_(size),
+      slots_(std::make_unique<folly::atomic_shared_ptr<const Item>[]>(size)) {}
+
+uint64_t Publisher::Ring::publish(json_ref&& payload) {
+  auto serial = reserved_.fetch_add(1, std::memory_order_relaxed) + 1;
+  slots_[serial % size_].store(
+      std::make_shared<const Item>(serial, std::move(payload)),
+      std::memory_order_release);
+
+  // Readers only look as far as published_, so it must not pass an Item
+  // that another thread is still storing. That window is a handful of
+  // instructions, so waiting for it is cheaper than a lock would be.
+  auto expected = serial - 1;
+  while (!published_.compare_exchange_weak(
+      expected, serial, std::memory_order_release, std::memory_order_relaxed)) {
+    expected = serial - 1;
+    std::this_thread::yield();
+  }
+  return serial;
+}
+
+bool Publisher::Ring::read(
+    std::atomic<uint64_t>& serial,
+    uint64_t firstSerial,
+    std::vector<std::shared_ptr<const Item>>& pending) const {
+  auto last = published_.load(std::memory_order_acquire);
+  auto next = serial.load(std::memory_order_relaxed) + 1;
+  if (next > last) {
+    return false;
+  }
+
+  bool missed = false;
+  // Anything older than this has been replaced already
+  auto oldest = last >= size_ ? last - size_ + 1 : 1;
+  if (next < oldest) {
+    missed = oldest - 1 >= firstSerial;
+    next = oldest;
+  }
+
+  for (; next <= last; ++next) {
+    auto item = slots_[next % size_].load(std::memory_order_acquire);
+    if (item && item->serial == next) {
+      pending.push_back(std::move(item));
+    } else if (next >= firstSerial) {
+      // Replaced while we were reading
+      missed = true;
+    }
+  }
+
+  serial.store(last, std::memory_order_relaxed);
+  return missed;
+}
+
 Publisher::Subscriber::Subscriber(
     std::shared_ptr<Publisher> pub,
     Notifier notify,
-    const std::optional<json_ref>& info)
+    const std::optional<json_ref>& info,
+    Filter filter)
     : serial_(0),
+      firstSerial_(
+          pub->ring_ ? pub->ring_->nextSerial()
+                     : pub->state_.rlock()->nextSerial),
       publisher_(std::move(pub)),
       notify_(notify),
-      info_(std::move(info)) {}
+      filter_(std::move(filter)),
+      info_(std::move(info)) {
+  if (publisher_->ring_) {
+    // The ring holds onto Items long after they were published; those that
+    // predate us are not ours to see.
+    serial_.store(firstSerial_ - 1, std::memory_order_relaxed);
+  }
+}
 
 Publisher::Subscriber::~Subscriber() {
   // In the loop below we may own a reference to some other
@@ -54,21 +123,27 @@ Publisher::Subscriber::~Subscriber() {
   // any references we took ownership of in the loop above.
 }
 
-void Publisher::Subscriber::getPending(
+bool Publisher::Subscriber::getPending(
     std::vector<std::shared_ptr<const Item>>& pending) {
+  if (publisher_->ring_) {
+    return publisher_->ring_->read(serial_, firstSerial_, pending);
+  }
+
   {
     auto rlock = publisher_->state_.rlock();
     auto& items = rlock->items;
 
     if (items.empty()) {
-      return;
+      return false;
     }
 
+    auto serial = serial_.load(std::memory_order_relaxed);
+
     // First we walk back to find the end of the range that
     // we have seen previously.
     int firstIndex;
     for (firstIndex = int(items.size()) - 1; firstIndex >= 0; --firstIndex) {
-      if (items[firstIndex]->serial <= serial_) {
+      if (items[firstIndex]->serial <= serial) {
         break;
       }
     }
@@ -85,11 +160,23 @@ void Publisher::Subscriber::getPending(
     }
 
     if (updated) {
-      serial_ = pending.back()->serial;
+      serial_.store(pending.back()->serial, std::memory_order_relaxed);
     }
 
-    return;
+    return false;
+  }
+}
+
+bool Publisher::Subscriber::accept(uint64_t serial, const json_ref& payload) {
+  if (!filter_ || filter_(payload)) {
+    return true;
   }
+  // Only if nothing else is waiting to be read; the subscriber's own reads
+  // only ever move serial_ to the newest Item that they saw, so this can't
+  // take it backwards or past anything it has yet to see.
+  auto expected = serial - 1;
+  return !serial_.compare_exchange_strong(
+      expected, serial, std::memory_order_relaxed);
 }
 
 void getPending(
@@ -106,9 +193,10 @@ void getPending(
 
 std::shared_ptr<Publisher::Subscriber> Publisher::subscribe(
     Notifier notify,
-    const std::optional<json_ref>& info) {
-  auto sub =
-      std::make_shared<Publisher::Subscriber>(shared_from_this(), notify, info);
+    const std::optional<json_ref>& info,
+    Filter filter) {
+  auto sub = std::make_shared<Publisher::Subscriber>(
+      shared_from_this(), notify, info, std::move(filter));
   state_.wlock()->subscribers.emplace_back(sub);
   return sub;
 }
@@ -137,8 +225,26 @@ void Publisher::state::collectGarbage() {
 
 bool Publisher::enqueue(json_ref&& payload) {
   std::vector<std::shared_ptr<Subscriber>> subscribers;
-
-  {
+  // Filters look at the payload after it has been moved into its Item
+  json_ref published = payload;
+  uint64_t serial{0};
+
+  if (ring_) {
+    {
+      // Only shared, so that publishers don't wait for one another here.
+      // Vacated weak_ptr's are pruned by ~Subscriber.
+      auto rlock = state_.rlock();
+      for (auto& it : rlock->subscribers) {
+        if (auto sub = it.lock()) {
+          subscribers.emplace_back(std::move(sub));
+        }
+      }
+    }
+    if (subscribers.empty()) {
+      return false;
+    }
+    serial = ring_->publish(std::move(payload));
+  } else {
     auto wlock = state_.wlock();
 
     // We need to collect live references for the notify portion,
@@ -164,14 +270,15 @@ bool Publisher::enqueue(json_ref&& payload) {
       return false;
     }
 
+    serial = wlock->nextSerial++;
     wlock->items.emplace_back(
-        std::make_shared<Item>(wlock->nextSerial++, std::move(payload)));
+        std::make_shared<Item>(serial, std::move(payload)));
   }
 
   // and notify them outside of the lock
   for (auto& sub : subscribers) {
     auto& n = sub->getNotify();
-    if (n) {
+    if (sub->accept(serial, published) && n) {
       n();
     }
   }
@@ -182,7 +289,9 @@ json_ref Publisher::getDebugInfo() const {
   auto ret = json_object();
 
   auto rlock = state_.rlock();
-  ret.set("next_serial", json_integer(rlock->nextSerial));
+  ret.set(
+      "next_serial",
+      json_integer(ring_ ? ring_->nextSerial() : rlock->nextSerial));
 
   std::vector<json_ref> subscribers_arr;
 
@@ -206,7 +315,15 @@ json_ref Publisher::getDebugInfo() const {
 
   std::vector<json_ref> items_arr;
 
-  for (auto& item : rlock->items) {
+  std::vector<std::shared_ptr<const Item>> items;
+  if (ring_) {
+    std::atomic<uint64_t> serial{0};
+    ring_->read(serial, 0, items);
+  } else {
+    items.assign(rlock->items.begin(), rlock->items.end());
+  }
+
+  for (auto& item : items) {
     auto item_json = json_object(
         {{"serial", json_integer(item->serial)}, {"payload", item->payload}});
     items_arr.emplace_back(item_json);
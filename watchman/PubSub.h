@@ -7,18 +7,29 @@
 
 #pragma once
 #include <folly/Synchronized.h>
+#include <folly/concurrency/AtomicSharedPtr.h>
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
+#include <atomic>
 #include <deque>
 #include <functional>
+#include <memory>
 #include <vector>
 
 namespace watchman {
 
 class Publisher : public std::enable_shared_from_this<Publisher> {
  public:
+  // If maxBacklog is non-zero, the most recent maxBacklog items are kept in
+  // a ring, which is published to and consumed from without locking. Older
+  // items are discarded, so that a subscriber that stops consuming can't make
+  // the publisher grow without bound, and getPending() tells that subscriber
+  // what happened. Otherwise items are kept until every subscriber has seen
+  // them.
+  explicit Publisher(size_t maxBacklog = 0);
+
   struct Item {
     Item(uint64_t s, json_ref p) : serial{s}, payload{std::move(p)} {}
 
@@ -33,16 +44,25 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
   // to be woken up when something is published
   using Notifier = std::function<void()>;
 
+  // Decides whether a payload is worth waking a subscriber for
+  using Filter = std::function<bool(const json_ref&)>;
+
   // Each subscriber is represented by one of these
   class Subscriber : public std::enable_shared_from_this<Subscriber> {
     // The serial of the last Item to be consumed by
-    // this subscriber.
-    uint64_t serial_;
+    // this subscriber. Written by the subscriber's own thread, and advanced
+    // by enqueue over the Items that the filter skips.
+    std::atomic<uint64_t> serial_;
+    // The serial of the first Item published after this subscriber was
+    // registered; discarding those before it is of no concern.
+    uint64_t firstSerial_;
     // Subscriber keeps the publisher alive so that no Items are lost
     // if the Publisher is released before all of the subscribers.
     std::shared_ptr<Publisher> publisher_;
     // Advising the subscriber that there may be more items available
     Notifier notify_;
+    // Payloads that this rejects are skipped rather than notified
+    Filter filter_;
     // Information for debugging purposes
     const std::optional<json_ref> info_;
 
@@ -51,14 +71,17 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     Subscriber(
         std::shared_ptr<Publisher> pub,
         Notifier notify,
-        const std::optional<json_ref>& info);
+        const std::optional<json_ref>& info,
+        Filter filter = nullptr);
     Subscriber(const Subscriber&) = delete;
 
     // Returns all as yet unseen published items for this subscriber.
-    void getPending(std::vector<std::shared_ptr<const Item>>& pending);
+    // Returns true if some of the items this subscriber had not yet seen
+    // were discarded because it fell too far behind.
+    bool getPending(std::vector<std::shared_ptr<const Item>>& pending);
 
     uint64_t getSerial() const {
-      return serial_;
+      return serial_.load(std::memory_order_relaxed);
     }
 
     Notifier& getNotify() {
@@ -68,14 +91,26 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     const std::optional<json_ref>& getInfo() const {
       return info_;
     }
+
+   private:
+    // Called by enqueue once the Item with the given serial is published.
+    // Returns true if the subscriber should be notified of it.
+    bool accept(uint64_t serial, const json_ref& payload);
+
+    friend class Publisher;
   };
 
   // Register a new subscriber.
   // When the Subscriber object is released, the registration is
   // automatically removed.
+  // If filter is set, a payload that it rejects doesn't wake the subscriber.
+  // If the subscriber had consumed everything before it, the Item is skipped
+  // and never returned by getPending(); otherwise the subscriber is notified
+  // as usual, and it sees the Item along with those it has yet to read.
   std::shared_ptr<Subscriber> subscribe(
       Notifier notify,
-      const std::optional<json_ref>& info = std::nullopt);
+      const std::optional<json_ref>& info = std::nullopt,
+      Filter filter = nullptr);
 
   // Returns true if there are any subscribers.
   // This is racy and intended to be used to gate building a payload
@@ -95,7 +130,7 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     state(const state&) = delete;
     // Serial number to use for the next Item
     uint64_t nextSerial{1};
-    // The stream of Items
+    // The stream of Items, unless there is a ring
     std::deque<std::shared_ptr<const Item>> items;
     // The subscribers
     std::vector<std::weak_ptr<Subscriber>> subscribers;
@@ -103,6 +138,38 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     void collectGarbage();
     void enqueue(json_ref&& payload);
   };
+
+  // The Item with serial s is stored in slot s % size, until the Item with
+  // serial s + size replaces it.
+  class Ring {
+   public:
+    explicit Ring(size_t size);
+
+    uint64_t nextSerial() const {
+      return published_.load(std::memory_order_acquire) + 1;
+    }
+
+    // Returns the serial of the new Item.
+    uint64_t publish(json_ref&& payload);
+
+    // Appends the Items published after serial and advances serial past
+    // them. Returns true if any that were published at or after firstSerial
+    // had already been replaced.
+    bool read(
+        std::atomic<uint64_t>& serial,
+        uint64_t firstSerial,
+        std::vector<std::shared_ptr<const Item>>& pending) const;
+
+   private:
+    const size_t size_;
+    std::unique_ptr<folly::atomic_shared_ptr<const Item>[]> slots_;
+    // Serials are handed out by reserved_, and published_ follows once the
+    // Items up to it are in their slots.
+    std::atomic<uint64_t> reserved_{0};
+    std::atomic<uint64_t> published_{0};
+  };
+
+  const std::unique_ptr<Ring> ring_;
   folly::Synchronized<state> state_;
 
   friend class Subscriber;
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/QueryAdmission.h"
+#include <algorithm>
+#include <utility>
+
+namespace watchman {
+
+QueryAdmission::Ticket::Ticket(Ticket&& other) noexcept
+    : admission_{std::exchange(other.admission_, nullptr)} {}
+
+QueryAdmission::Ticket& QueryAdmission::Ticket::operator=(
+    Ticket&& other) noexcept {
+  if (this != &other) {
+    if (admission_) {
+      admission_->release();
+    }
+    admission_ = std::exchange(other.admission_, nullptr);
+  }
+  return *this;
+}
+
+QueryAdmission::Ticket::~Ticket() {
+  if (admission_) {
+    admission_->release();
+  }
+}
+
+void QueryAdmission::Queue::push(int64_t client, Waiter* waiter) {
+  auto& queued = byClient[client];
+  if (queued.empty()) {
+    turns.push_back(client);
+  }
+  queued.push_back(waiter);
+  ++size;
+}
+
+QueryAdmission::Waiter* QueryAdmission::Queue::pop() {
+  if (turns.empty()) {
+    return nullptr;
+  }
+  auto client = turns.front();
+  turns.pop_front();
+
+  auto it = byClient.find(client);
+  auto* waiter = it->second.front();
+  it->second.pop_front();
+  if (it->second.empty()) {
+    byClient.erase(it);
+  } else {
+    // Its next query waits for the other clients to have had their turn
+    turns.push_back(client);
+  }
+  --size;
+  return waiter;
+}
+
+void QueryAdmission::Queue::remove(int64_t client, Waiter* waiter) {
+  auto it = byClient.find(client);
+  auto& queued = it->second;
+  queued.erase(std::find(queued.begin(), queued.end(), waiter));
+  --size;
+  if (queued.empty()) {
+    byClient.erase(it);
+    turns.erase(std::find(turns.begin(), turns.end(), client));
+  }
+}
+
+QueryAdmission::QueryAdmission(size_t maxRunning) : maxRunning_{maxRunning} {}
+
+QueryAdmission::Ticket QueryAdmission::admit(
+    Lane lane,
+    int64_t client,
+    std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  if (maxRunning_ == 0 ||
+      (running_ < maxRunning_ && cheap_.size == 0 && heavy_.size == 0)) {
+    ++running_;
+    return Ticket{this};
+  }
+
+  Waiter waiter;
+  auto& queue = lane == Lane::Cheap ? cheap_ : heavy_;
+  queue.push(client, &waiter);
+  auto isAdmitted = [&] { return waiter.admitted; };
+  if (deadline == std::chrono::steady_clock::time_point::max()) {
+    cond_.wait(lock, isAdmitted);
+  } else if (!cond_.wait_until(lock, deadline, isAdmitted)) {
+    queue.remove(client, &waiter);
+    return Ticket{};
+  }
+  // Whoever admitted it took the slot on its behalf
+  return Ticket{this};
+}
+
+void QueryAdmission::release() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    --running_;
+    while (maxRunning_ != 0 && running_ < maxRunning_) {
+      auto* next = cheap_.pop();
+      if (!next) {
+        next = heavy_.pop();
+      }
+      if (!next) {
+        break;
+      }
+      next->admitted = true;
+      ++running_;
+    }
+  }
+  cond_.notify_all();
+}
+
+size_t QueryAdmission::running() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return running_;
+}
+
+size_t QueryAdmission::waiting() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return cheap_.size + heavy_.size;
+}
+
+} // namespace watchman
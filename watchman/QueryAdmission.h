@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace watchman {
+
+/**
+ * Limits how many queries run against a root at once. Queries beyond the
+ * limit wait in one of two lanes: the cheap lane, for queries that are
+ * expected to finish quickly, is always served first. Within a lane, the
+ * clients that are waiting take turns, so that a client with many queries
+ * queued doesn't hold up a client with one.
+ */
+class QueryAdmission {
+ public:
+  enum class Lane { Cheap, Heavy };
+
+  /**
+   * Holds one of the slots, if it was admitted, until it is destroyed.
+   */
+  class Ticket {
+   public:
+    Ticket() = default;
+    Ticket(Ticket&& other) noexcept;
+    Ticket& operator=(Ticket&& other) noexcept;
+    ~Ticket();
+
+    explicit operator bool() const {
+      return admission_ != nullptr;
+    }
+
+   private:
+    friend class QueryAdmission;
+    explicit Ticket(QueryAdmission* admission) : admission_{admission} {}
+
+    QueryAdmission* admission_{nullptr};
+  };
+
+  /** At most maxRunning queries run at once; 0 means no limit. */
+  explicit QueryAdmission(size_t maxRunning);
+
+  QueryAdmission(const QueryAdmission&) = delete;
+  QueryAdmission& operator=(const QueryAdmission&) = delete;
+
+  /**
+   * Waits until the query may run, in lane, on behalf of client. Returns an
+   * empty ticket if deadline passes first.
+   */
+  Ticket admit(
+      Lane lane,
+      int64_t client,
+      std::chrono::steady_clock::time_point deadline =
+          std::chrono::steady_clock::time_point::max());
+
+  size_t running() const;
+  size_t waiting() const;
+
+ private:
+  struct Waiter {
+    bool admitted{false};
+  };
+  struct Queue {
+    // The waiting queries of each client, in arrival order
+    std::unordered_map<int64_t, std::deque<Waiter*>> byClient;
+    // The clients with waiting queries, in the order of their turns
+    std::deque<int64_t> turns;
+    size_t size{0};
+
+    void push(int64_t client, Waiter* waiter);
+    Waiter* pop();
+    void remove(int64_t client, Waiter* waiter);
+  };
+
+  void release();
+
+  const size_t maxRunning_;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  size_t running_{0};
+  Queue cheap_;
+  Queue heavy_;
+};
+
+} // namespace watchman
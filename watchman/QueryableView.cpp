@@ -7,6 +7,10 @@
 
 #include "watchman/QueryableView.h"
 #include "watchman/Errors.h"
+#include "watchman/query/LocalFileResult.h"
+#include "watchman/query/QueryContext.h"
+#include "watchman/query/eval.h"
+#include "watchman/root/Root.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
@@ -35,10 +39,59 @@ void QueryableView::allFilesGenerator(const Query*, QueryContext*) const {
   throw QueryExecError("allFilesGenerator not implemented");
 }
 
+void QueryableView::suffixGenerator(const Query* query, QueryContext* ctx)
+    const {
+  allFilesGenerator(query, ctx);
+}
+
+bool QueryableView::dirTotalsGenerator(const Query*, QueryContext*) const {
+  return false;
+}
+
+void QueryableView::scmChangedFilesGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const std::vector<w_string>& paths,
+    ClockStamp clock) const {
+  for (const auto& path : paths) {
+    auto fullPath = w_string::pathCat({ctx->root->root_path, path});
+    if (!ctx->fileMatchesRelativeRoot(fullPath)) {
+      continue;
+    }
+    // Note well!  At the time of writing the LocalFileResult class
+    // assumes that removed entries must have been regular files.
+    // We don't have enough information returned from
+    // getFilesChangedSinceMergeBaseWith() to distinguish between
+    // deleted files and deleted symlinks.  Also, it is not possible
+    // to see a directory returned from that call; we're only going
+    // to enumerate !dirs for this case.
+    w_query_process_file(
+        query,
+        ctx,
+        std::make_unique<LocalFileResult>(
+            fullPath, clock, ctx->root->case_sensitive));
+  }
+}
+
 ClockTicks QueryableView::getLastAgeOutTickValue() const {
   return 0;
 }
 
+std::optional<ClockPredecessor> QueryableView::getClockPredecessor() const {
+  return std::nullopt;
+}
+
+std::optional<ClockPosition> QueryableView::getLastChangePosition(
+    const w_string&) const {
+  return std::nullopt;
+}
+
+std::optional<size_t> QueryableView::countChangedFiles(
+    const w_string&,
+    ClockTicks) const {
+  return std::nullopt;
+}
+
 std::chrono::system_clock::time_point QueryableView::getLastAgeOutTimeStamp()
     const {
   return std::chrono::system_clock::time_point{};
@@ -46,9 +99,47 @@ std::chrono::system_clock::time_point QueryableView::getLastAgeOutTimeStamp()
 
 void QueryableView::ageOut(PerfSample&, std::chrono::seconds) {}
 
+size_t QueryableView::trimCaches() {
+  return 0;
+}
+
+bool QueryableView::isHibernated() const {
+  return false;
+}
+
+bool QueryableView::addChangePrefilter(std::shared_ptr<ChangePrefilter>) {
+  return false;
+}
+
+std::optional<ViewMemoryStats> QueryableView::getMemoryStats(bool) const {
+  return std::nullopt;
+}
+
+std::optional<size_t> QueryableView::dumpView(const w_string&) const {
+  return std::nullopt;
+}
+
+std::optional<SettleStatus> QueryableView::getSettleStatus() const {
+  return std::nullopt;
+}
+
+std::optional<ViewLagStatus> QueryableView::getLagStatus() const {
+  return std::nullopt;
+}
+
+void QueryableView::noteSavedStateLookup(SavedStateLookup) {}
+
+std::shared_ptr<Root> QueryableView::getEnclosingRoot() const {
+  return nullptr;
+}
+
 bool QueryableView::isVCSOperationInProgress() const {
+  return doAnyOfTheseFilesExist(vcsLockFiles());
+}
+
+const std::vector<w_string>& QueryableView::vcsLockFiles() {
   static const std::vector<w_string> lockFiles{".hg/wlock", ".git/index.lock"};
-  return doAnyOfTheseFilesExist(lockFiles);
+  return lockFiles;
 }
 
 } // namespace watchman
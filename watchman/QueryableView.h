@@ -12,10 +12,15 @@
 #include "watchman/Clock.h"
 #include "watchman/CookieSync.h"
 #include "watchman/PerfSample.h"
+#include "watchman/SettleEstimator.h"
+#include "watchman/ViewLagStatus.h"
+#include "watchman/ViewMemoryStats.h"
+#include "watchman/saved_state/SavedStateInterface.h"
 #include "watchman/watchman_string.h"
 
 namespace watchman {
 
+class ChangePrefilter;
 struct Query;
 struct QueryContext;
 class Root;
@@ -46,17 +51,88 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
 
   virtual void allFilesGenerator(const Query* query, QueryContext* ctx) const;
 
+  /**
+   * Produces the files whose names end in one of query->suffix_scope. Views
+   * without a suffix index walk all files instead.
+   */
+  virtual void suffixGenerator(const Query* query, QueryContext* ctx) const;
+
+  /**
+   * Answers a query that only aggregates the files below its relative root
+   * from totals that the view keeps per dir, without walking the files.
+   * Returns false, having produced nothing, if the view has no such totals
+   * or they can't answer this query. The default returns false.
+   */
+  virtual bool dirTotalsGenerator(const Query* query, QueryContext* ctx)
+      const;
+
+  /**
+   * Produces the files named by paths, which are relative to the root and
+   * were reported by source control, that lie within the query's relative
+   * root. clock is reported as their otime and ctime. The default stats each
+   * file.
+   */
+  virtual void scmChangedFilesGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const std::vector<w_string>& paths,
+      ClockStamp clock) const;
+
   virtual ClockPosition getMostRecentRootNumberAndTickValue() const = 0;
   virtual w_string getCurrentClockString() const = 0;
   virtual ClockTicks getLastAgeOutTickValue() const;
+  /**
+   * Returns the earlier incarnation of this root whose clocks are still
+   * valid against this one, if any.
+   */
+  virtual std::optional<ClockPredecessor> getClockPredecessor() const;
+  /**
+   * Returns the clock position at which the files below dir, a full path,
+   * last changed, counting files aged out of the view as a change. Returns
+   * nullopt if the view doesn't track this.
+   */
+  virtual std::optional<ClockPosition> getLastChangePosition(
+      const w_string& dir) const;
+  /**
+   * Returns how many files below dir, a full path, changed after ticks,
+   * without evaluating a query. Returns nullopt if the view doesn't track
+   * this.
+   */
+  virtual std::optional<size_t> countChangedFiles(
+      const w_string& dir,
+      ClockTicks ticks) const;
   virtual std::chrono::system_clock::time_point getLastAgeOutTimeStamp() const;
   virtual void ageOut(PerfSample& sample, std::chrono::seconds minAge);
+  /**
+   * Drops what the view's caches hold that is no longer of use, such as
+   * errors that have outlived their TTL. Returns how many entries it
+   * dropped.
+   */
+  virtual size_t trimCaches();
+  /**
+   * Returns true if the view has freed its nodes until a client next uses
+   * it, so that there is nothing to age out.
+   */
+  virtual bool isHibernated() const;
+  /**
+   * Has the view mark prefilter when a file that it matches changes, until
+   * the prefilter is released. Returns false if the view doesn't, in which
+   * case the subscription must be evaluated at every settle.
+   */
+  virtual bool addChangePrefilter(std::shared_ptr<ChangePrefilter> prefilter);
 
   virtual folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period) = 0;
+  /**
+   * Waits until the view has seen every change made before it was called.
+   * scope, if not empty, holds the full paths that the caller is about to
+   * look at, which views that sync with cookies use to only write them
+   * where they need to.
+   */
   virtual CookieSync::SyncResult syncToNow(
       const std::shared_ptr<Root>& root,
-      std::chrono::milliseconds timeout) = 0;
+      std::chrono::milliseconds timeout,
+      const std::vector<w_string>& scope) = 0;
 
   /**
    * Synchronize this view with the working copy.
@@ -74,7 +150,18 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
   virtual bool doAnyOfTheseFilesExist(
       const std::vector<w_string>& fileNames) const = 0;
 
-  bool isVCSOperationInProgress() const;
+  /**
+   * Returns true if one of vcsLockFiles() exists, which means that source
+   * control is changing the working copy. The default tests them with
+   * doAnyOfTheseFilesExist.
+   */
+  virtual bool isVCSOperationInProgress() const;
+
+  /**
+   * The files, relative to the root, that source control holds while it
+   * changes the working copy.
+   */
+  static const std::vector<w_string>& vcsLockFiles();
 
   /**
    * Start up any helper threads.
@@ -89,6 +176,47 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
    */
   virtual void wakeThreads() {}
 
+  /**
+   * Returns the approximate memory used by this view, or std::nullopt if the
+   * view does not track it. If detailed is true, the breakdown that requires
+   * walking the view is included.
+   */
+  virtual std::optional<ViewMemoryStats> getMemoryStats(bool detailed) const;
+
+  /**
+   * Writes every file node of the view to path, in the format that
+   * TickIndexReader reads, and returns how many it wrote. Returns
+   * std::nullopt if the view can't be dumped. Throws if path can't be
+   * written.
+   */
+  virtual std::optional<size_t> dumpView(const w_string& path) const;
+
+  /**
+   * Returns how the view is deciding that it has settled, or std::nullopt if
+   * it only uses the fixed settle period.
+   */
+  virtual std::optional<SettleStatus> getSettleStatus() const;
+
+  /**
+   * Returns how far the view is behind the filesystem, or std::nullopt if
+   * the view does not measure it.
+   */
+  virtual std::optional<ViewLagStatus> getLagStatus() const;
+
+  /**
+   * Notes that a query looked up saved state, so that the view can repeat
+   * the lookup in the background when the merge base may have changed. The
+   * default does nothing.
+   */
+  virtual void noteSavedStateLookup(SavedStateLookup lookup);
+
+  /**
+   * Returns the root whose view this view presents a subtree of, or nullptr
+   * if this view holds its own files. Queries of a root with such a view are
+   * confined to its subtree of the enclosing root.
+   */
+  virtual std::shared_ptr<Root> getEnclosingRoot() const;
+
   virtual const w_string& getName() const = 0;
   virtual json_ref getWatcherDebugInfo() const = 0;
   virtual void clearWatcherDebugInfo() = 0;
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ScopedView.h"
+#include "watchman/root/Root.h"
+
+namespace watchman {
+
+ScopedView::ScopedView(const w_string& root_path, std::shared_ptr<Root> parent)
+    : QueryableView{root_path, /*requiresCrawl=*/false},
+      parent_{std::move(parent)},
+      parentView_{parent_->view()},
+      prefix_{w_string_piece{
+                  root_path.data() + parent_->root_path.size() + 1,
+                  root_path.size() - parent_->root_path.size() - 1}
+                  .asWString()},
+      rootNumber_{allocateClockRoot()} {}
+
+void ScopedView::timeGenerator(const Query* query, QueryContext* ctx) const {
+  parentView_->timeGenerator(query, ctx);
+}
+
+void ScopedView::pathGenerator(const Query* query, QueryContext* ctx) const {
+  parentView_->pathGenerator(query, ctx);
+}
+
+void ScopedView::globGenerator(const Query* query, QueryContext* ctx) const {
+  parentView_->globGenerator(query, ctx);
+}
+
+void ScopedView::allFilesGenerator(const Query* query, QueryContext* ctx)
+    const {
+  parentView_->allFilesGenerator(query, ctx);
+}
+
+void ScopedView::suffixGenerator(const Query* query, QueryContext* ctx) const {
+  parentView_->suffixGenerator(query, ctx);
+}
+
+bool ScopedView::dirTotalsGenerator(const Query* query, QueryContext* ctx)
+    const {
+  return parentView_->dirTotalsGenerator(query, ctx);
+}
+
+ClockPosition ScopedView::getMostRecentRootNumberAndTickValue() const {
+  return ClockPosition{
+      rootNumber_, parentView_->getMostRecentRootNumberAndTickValue().ticks};
+}
+
+w_string ScopedView::getCurrentClockString() const {
+  return getMostRecentRootNumberAndTickValue().toClockString();
+}
+
+ClockTicks ScopedView::getLastAgeOutTickValue() const {
+  return parentView_->getLastAgeOutTickValue();
+}
+
+std::optional<ClockPosition> ScopedView::getLastChangePosition(
+    const w_string& dir) const {
+  auto position = parentView_->getLastChangePosition(dir);
+  if (position) {
+    position->rootNumber = rootNumber_;
+  }
+  return position;
+}
+
+std::optional<size_t> ScopedView::countChangedFiles(
+    const w_string& dir,
+    ClockTicks ticks) const {
+  return parentView_->countChangedFiles(dir, ticks);
+}
+
+std::chrono::system_clock::time_point ScopedView::getLastAgeOutTimeStamp()
+    const {
+  return parentView_->getLastAgeOutTimeStamp();
+}
+
+void ScopedView::ageOut(PerfSample&, std::chrono::seconds) {}
+
+folly::SemiFuture<folly::Unit> ScopedView::waitForSettle(
+    std::chrono::milliseconds settle_period) {
+  return parentView_->waitForSettle(settle_period);
+}
+
+CookieSync::SyncResult ScopedView::syncToNow(
+    const std::shared_ptr<Root>&,
+    std::chrono::milliseconds timeout,
+    const std::vector<w_string>& scope) {
+  // The cookies have to be written where the enclosing root's watcher
+  // will see them.
+  touchParent();
+  return parentView_->syncToNow(parent_, timeout, scope);
+}
+
+folly::SemiFuture<CookieSync::SyncResult> ScopedView::sync(
+    const std::shared_ptr<Root>&) {
+  touchParent();
+  return parentView_->sync(parent_);
+}
+
+bool ScopedView::doAnyOfTheseFilesExist(
+    const std::vector<w_string>& fileNames) const {
+  std::vector<w_string> names;
+  names.reserve(fileNames.size());
+  for (auto& name : fileNames) {
+    names.push_back(w_string::pathCat({prefix_, name}));
+  }
+  return parentView_->doAnyOfTheseFilesExist(names);
+}
+
+void ScopedView::startThreads(const std::shared_ptr<Root>& root) {
+  std::weak_ptr<QueryableView> weakSelf = shared_from_this();
+  std::weak_ptr<Root> weakRoot = root;
+  auto sub = parent_->unilateralResponses->subscribe(
+      [weakSelf, weakRoot] {
+        auto self = weakSelf.lock();
+        auto root = weakRoot.lock();
+        if (self && root) {
+          static_cast<ScopedView*>(self.get())->forwardSettle(*root);
+        }
+      },
+      json_object({{"settle-forwarder", w_string_to_json(root->root_path)}}));
+
+  std::lock_guard<std::mutex> lock{settleMutex_};
+  settleSub_ = std::move(sub);
+}
+
+void ScopedView::stopThreads() {
+  std::lock_guard<std::mutex> lock{settleMutex_};
+  settleSub_.reset();
+}
+
+void ScopedView::forwardSettle(Root& root) {
+  std::vector<std::shared_ptr<const Publisher::Item>> pending;
+  {
+    std::lock_guard<std::mutex> lock{settleMutex_};
+    if (!settleSub_) {
+      return;
+    }
+    settleSub_->getPending(pending);
+  }
+
+  // Several settles that queued up while we were busy amount to one
+  for (auto& item : pending) {
+    if (item->payload.get_optional("settled")) {
+      root.unilateralResponses->enqueue(
+          json_object({{"settled", json_true()}}));
+      return;
+    }
+  }
+}
+
+std::optional<SettleStatus> ScopedView::getSettleStatus() const {
+  return parentView_->getSettleStatus();
+}
+
+std::optional<ViewLagStatus> ScopedView::getLagStatus() const {
+  return parentView_->getLagStatus();
+}
+
+std::shared_ptr<Root> ScopedView::getEnclosingRoot() const {
+  return parent_;
+}
+
+const w_string& ScopedView::getName() const {
+  return parentView_->getName();
+}
+
+json_ref ScopedView::getWatcherDebugInfo() const {
+  return json_object(
+      {{"enclosing_root", w_string_to_json(parent_->root_path)},
+       {"watcher", parentView_->getWatcherDebugInfo()}});
+}
+
+void ScopedView::clearWatcherDebugInfo() {}
+
+folly::SemiFuture<folly::Unit> ScopedView::waitUntilReadyToQuery() {
+  touchParent();
+  return parentView_->waitUntilReadyToQuery();
+}
+
+void ScopedView::touchParent() const {
+  parent_->inner.last_cmd_timestamp.store(
+      std::chrono::steady_clock::now(), std::memory_order_release);
+}
+
+} // namespace watchman
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <memory>
+#include <mutex>
+#include "watchman/PubSub.h"
+#include "watchman/QueryableView.h"
+
+namespace watchman {
+
+/**
+ * The view of a root that lies within another watched root, presenting the
+ * subtree of the enclosing root's view rather than crawling and watching the
+ * same files again. Queries are evaluated against the enclosing view and are
+ * confined to the subtree by their relative root. Clocks carry a root number
+ * of their own, but the enclosing view's ticks.
+ */
+class ScopedView final : public QueryableView {
+ public:
+  /**
+   * root_path is the full path of the nested root, and parent the watched
+   * root that encloses it.
+   */
+  ScopedView(const w_string& root_path, std::shared_ptr<Root> parent);
+
+  void timeGenerator(const Query* query, QueryContext* ctx) const override;
+  void pathGenerator(const Query* query, QueryContext* ctx) const override;
+  void globGenerator(const Query* query, QueryContext* ctx) const override;
+  void allFilesGenerator(const Query* query, QueryContext* ctx) const override;
+  void suffixGenerator(const Query* query, QueryContext* ctx) const override;
+  bool dirTotalsGenerator(const Query* query, QueryContext* ctx)
+      const override;
+
+  ClockPosition getMostRecentRootNumberAndTickValue() const override;
+  w_string getCurrentClockString() const override;
+  ClockTicks getLastAgeOutTickValue() const override;
+  std::optional<ClockPosition> getLastChangePosition(
+      const w_string& dir) const override;
+  std::optional<size_t> countChangedFiles(
+      const w_string& dir,
+      ClockTicks ticks) const override;
+  std::chrono::system_clock::time_point getLastAgeOutTimeStamp() const override;
+  // The enclosing root ages out its own files.
+  void ageOut(PerfSample& sample, std::chrono::seconds minAge) override;
+
+  folly::SemiFuture<folly::Unit> waitForSettle(
+      std::chrono::milliseconds settle_period) override;
+  CookieSync::SyncResult syncToNow(
+      const std::shared_ptr<Root>& root,
+      std::chrono::milliseconds timeout,
+      const std::vector<w_string>& scope) override;
+  folly::SemiFuture<CookieSync::SyncResult> sync(
+      const std::shared_ptr<Root>& root) override;
+
+  bool doAnyOfTheseFilesExist(
+      const std::vector<w_string>& fileNames) const override;
+
+  /**
+   * Forwards the enclosing root's settle notifications to root, so that its
+   * subscriptions and triggers fire when the enclosing view settles.
+   */
+  void startThreads(const std::shared_ptr<Root>& root) override;
+  void stopThreads() override;
+
+  std::optional<SettleStatus> getSettleStatus() const override;
+  std::optional<ViewLagStatus> getLagStatus() const override;
+  std::shared_ptr<Root> getEnclosingRoot() const override;
+
+  const w_string& getName() const override;
+  json_ref getWatcherDebugInfo() const override;
+  void clearWatcherDebugInfo() override;
+  folly::SemiFuture<folly::Unit> waitUntilReadyToQuery() override;
+
+ private:
+  // Notes a use of the enclosing root, so that it isn't reaped while the
+  // nested root is being queried.
+  void touchParent() const;
+  // Passes the settle notifications that settleSub_ has pending on to root
+  void forwardSettle(Root& root);
+
+  const std::shared_ptr<Root> parent_;
+  const std::shared_ptr<QueryableView> parentView_;
+  // The path of the nested root relative to the enclosing root
+  const w_string prefix_;
+  const ClockRoot rootNumber_;
+
+  // Guards settleSub_, which is reset by stopThreads while its notify
+  // callback may be running on the enclosing root's IO thread, and
+  // serializes consuming its items.
+  std::mutex settleMutex_;
+  std::shared_ptr<Publisher::Subscriber> settleSub_;
+};
+
+} // namespace watchman
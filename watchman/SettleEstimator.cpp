@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SettleEstimator.h"
+#include <algorithm>
+
+namespace watchman {
+
+SettleEstimator::SettleEstimator(
+    std::chrono::milliseconds adaptiveMax,
+    std::chrono::milliseconds maxWait)
+    : adaptiveMax_{adaptiveMax}, maxWait_{maxWait} {}
+
+void SettleEstimator::noteChanges(Clock::time_point now) {
+  if (settled_ && lastChange_ && adaptiveMax_.count() > 0) {
+    auto pause = std::chrono::duration<double, std::milli>(now - *lastChange_);
+    if (pause <= adaptiveMax_) {
+      // The settle came in the middle of the activity.
+      ++prematureSettles_;
+      gapEstimateMs_ += kSmoothing * (pause.count() - gapEstimateMs_);
+    } else {
+      gapEstimateMs_ *= 1 - kSmoothing;
+    }
+  }
+  settled_ = false;
+  lastChange_ = now;
+  if (!unsettledSince_) {
+    unsettledSince_ = now;
+  }
+}
+
+void SettleEstimator::noteSettled(bool forced) {
+  unsettledSince_.reset();
+  if (forced) {
+    // Changes are still arriving, so what follows is not a pause.
+    ++forcedSettles_;
+    return;
+  }
+  settled_ = true;
+}
+
+std::chrono::milliseconds SettleEstimator::settlePeriod(
+    std::chrono::milliseconds settle) const {
+  if (adaptiveMax_ <= settle) {
+    return settle;
+  }
+  auto estimate =
+      std::chrono::milliseconds(int64_t(kHeadroom * gapEstimateMs_));
+  return std::clamp(estimate, settle, adaptiveMax_);
+}
+
+bool SettleEstimator::mustSettle(Clock::time_point now) const {
+  return maxWait_.count() > 0 && unsettledSince_ &&
+      now - *unsettledSince_ >= maxWait_;
+}
+
+SettleStatus SettleEstimator::getStatus(
+    std::chrono::milliseconds settle) const {
+  SettleStatus status;
+  status.settle_ms = settlePeriod(settle).count();
+  status.gap_estimate_ms = int64_t(gapEstimateMs_);
+  status.premature_settles = prematureSettles_;
+  status.forced_settles = forcedSettles_;
+  return status;
+}
+
+} // namespace watchman
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include "watchman/Serde.h"
+
+namespace watchman {
+
+/**
+ * How the IO thread is currently deciding that a root has settled.
+ */
+struct SettleStatus : serde::Object {
+  // The quiet period that currently counts as settled.
+  int64_t settle_ms = 0;
+  // The estimated pause between bursts of changes.
+  int64_t gap_estimate_ms = 0;
+  // Settles that were followed by more changes within settle_adaptive_max_ms.
+  int64_t premature_settles = 0;
+  // Settles forced by settle_max_wait_ms while changes kept arriving.
+  int64_t forced_settles = 0;
+
+  template <typename X>
+  void map(X& x) {
+    x("settle_ms", settle_ms);
+    x("gap_estimate_ms", gap_estimate_ms);
+    x("premature_settles", premature_settles);
+    x("forced_settles", forced_settles);
+  }
+};
+
+/**
+ * Chooses how long the IO thread waits without changes before it considers
+ * a root settled, from the pauses that it has seen between bursts.
+ *
+ * A build or a checkout tends to write in bursts separated by short pauses.
+ * When a fixed settle period is shorter than those pauses, subscribers see
+ * every burst as a separate settle. Each time changes arrive soon after a
+ * settle, within the adaptive maximum, the pause is folded into an
+ * exponentially weighted average, and the settle period becomes kHeadroom
+ * times that average, between the configured settle and the maximum. Longer
+ * pauses decay the average, so that the period shrinks back once the
+ * activity stops.
+ *
+ * Independently, if a max wait is set and changes keep arriving without a
+ * pause for that long, a settle is due anyway, so that subscribers are not
+ * starved by continuous churn.
+ *
+ * SettleEstimator is not thread safe; it belongs to the IO thread.
+ */
+class SettleEstimator {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // The weight of each new pause in the average.
+  static constexpr double kSmoothing = 0.25;
+  // How many times the average pause to wait.
+  static constexpr int kHeadroom = 2;
+
+  explicit SettleEstimator(
+      std::chrono::milliseconds adaptiveMax = {},
+      std::chrono::milliseconds maxWait = {});
+
+  bool enabled() const {
+    return adaptiveMax_.count() > 0 || maxWait_.count() > 0;
+  }
+
+  /**
+   * Records that changes were processed at now.
+   */
+  void noteChanges(Clock::time_point now);
+
+  /**
+   * Records that the root settled. forced is set if mustSettle caused it.
+   */
+  void noteSettled(bool forced);
+
+  /**
+   * Returns how long to wait without changes before settling, given the
+   * configured settle period.
+   */
+  std::chrono::milliseconds settlePeriod(
+      std::chrono::milliseconds settle) const;
+
+  /**
+   * Returns whether changes have been arriving for the max wait since the
+   * root last settled.
+   */
+  bool mustSettle(Clock::time_point now) const;
+
+  SettleStatus getStatus(std::chrono::milliseconds settle) const;
+
+ private:
+  const std::chrono::milliseconds adaptiveMax_;
+  const std::chrono::milliseconds maxWait_;
+
+  double gapEstimateMs_{0};
+  std::optional<Clock::time_point> lastChange_;
+  // Set by a settle that no change has followed yet.
+  bool settled_{false};
+  // The first change since the root last settled.
+  std::optional<Clock::time_point> unsettledSince_;
+  int64_t prematureSettles_{0};
+  int64_t forcedSettles_{0};
+};
+
+} // namespace watchman
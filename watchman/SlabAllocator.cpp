@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SlabAllocator.h"
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <numeric>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+namespace watchman {
+
+bool SlabAllocator::supportsHugePages() {
+#ifdef MADV_HUGEPAGE
+  return true;
+#else
+  return false;
+#endif
+}
+
+SlabAllocator::SlabAllocator(size_t slabSize, bool hugePages)
+    : hugePages_{hugePages && supportsHugePages()},
+      slabSize_{
+          hugePages_ ? kHugePageSize
+                     : std::max(roundUp(slabSize), kMaxSlabObjectSize)} {}
+
+SlabAllocator::~SlabAllocator() {
+  releaseSlabs();
+}
+
+std::byte* SlabAllocator::allocateSlab() {
+#ifdef MADV_HUGEPAGE
+  if (hugePages_) {
+    // Map twice the size, so that an aligned slab can be cut out of it.
+    auto mapSize = 2 * slabSize_;
+    void* map = mmap(
+        nullptr,
+        mapSize,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+    if (map == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    auto start = reinterpret_cast<uintptr_t>(map);
+    auto begin = (start + slabSize_ - 1) & ~(slabSize_ - 1);
+    auto end = begin + slabSize_;
+    if (begin > start) {
+      munmap(map, begin - start);
+    }
+    if (start + mapSize > end) {
+      munmap(reinterpret_cast<void*>(end), start + mapSize - end);
+    }
+    // Only advice: the kernel falls back to regular pages if it has no huge
+    // pages to spare, or if transparent huge pages are disabled.
+    madvise(reinterpret_cast<void*>(begin), slabSize_, MADV_HUGEPAGE);
+    return reinterpret_cast<std::byte*>(begin);
+  }
+#endif
+  return new std::byte[slabSize_];
+}
+
+void SlabAllocator::freeSlab(std::byte* slab) noexcept {
+#ifdef MADV_HUGEPAGE
+  if (hugePages_) {
+    munmap(slab, slabSize_);
+    return;
+  }
+#endif
+  delete[] slab;
+}
+
+void* SlabAllocator::allocate(size_t size) {
+  if (size == 0) {
+    size = 1;
+  }
+  if (size > kMaxSlabObjectSize) {
+    bytesInUse_ += size;
+    bytesReserved_ += size;
+    return ::operator new(size);
+  }
+
+  size = roundUp(size);
+  bytesInUse_ += size;
+
+  auto& freeList = freeLists_[size / kGranularity - 1];
+  if (freeList) {
+    auto node = freeList;
+    freeList = node->next;
+    return node;
+  }
+
+  if (bumpPos_ == nullptr || size_t(bumpEnd_ - bumpPos_) < size) {
+    // Abandon whatever is left of the current slab; it is smaller than
+    // kMaxSlabObjectSize so the waste is bounded.
+    auto* slab = allocateSlab();
+    if (!slabs_.empty()) {
+      slabs_.back().used = size_t(bumpPos_ - slabs_.back().begin);
+    }
+    slabs_.push_back(Slab{slab, 0});
+    bytesReserved_ += slabSize_;
+    bumpPos_ = slab;
+    bumpEnd_ = bumpPos_ + slabSize_;
+  }
+
+  auto result = bumpPos_;
+  bumpPos_ += size;
+  return result;
+}
+
+void SlabAllocator::deallocate(void* ptr, size_t size) noexcept {
+  if (!ptr) {
+    return;
+  }
+  if (size == 0) {
+    size = 1;
+  }
+  if (size > kMaxSlabObjectSize) {
+    bytesInUse_ -= size;
+    bytesReserved_ -= size;
+    ::operator delete(ptr);
+    return;
+  }
+
+  size = roundUp(size);
+  bytesInUse_ -= size;
+
+  auto& freeList = freeLists_[size / kGranularity - 1];
+  auto node = static_cast<FreeNode*>(ptr);
+  node->next = freeList;
+  freeList = node;
+}
+
+void SlabAllocator::releaseSlabs() noexcept {
+  bytesReserved_ -= slabs_.size() * slabSize_;
+  for (auto& slab : slabs_) {
+    freeSlab(slab.begin);
+  }
+  slabs_.clear();
+  slabs_.shrink_to_fit();
+  freeLists_.fill(nullptr);
+  bumpPos_ = nullptr;
+  bumpEnd_ = nullptr;
+}
+
+size_t SlabAllocator::releaseFreeSlabs() {
+  if (slabs_.size() < 2) {
+    return 0;
+  }
+
+  // The slabs by address, to find the one that holds each free block
+  std::vector<size_t> byAddress(slabs_.size());
+  std::iota(byAddress.begin(), byAddress.end(), 0);
+  std::sort(byAddress.begin(), byAddress.end(), [&](size_t a, size_t b) {
+    return slabs_[a].begin < slabs_[b].begin;
+  });
+  auto slabOf = [&](const void* block) {
+    auto it = std::upper_bound(
+        byAddress.begin(),
+        byAddress.end(),
+        static_cast<const std::byte*>(block),
+        [&](const std::byte* p, size_t i) { return p < slabs_[i].begin; });
+    return *(it - 1);
+  };
+
+  std::vector<size_t> freeBytes(slabs_.size());
+  for (size_t i = 0; i < kNumSizeClasses; ++i) {
+    for (auto* node = freeLists_[i]; node; node = node->next) {
+      freeBytes[slabOf(node)] += (i + 1) * kGranularity;
+    }
+  }
+
+  // Leave the current slab to carry on with
+  std::vector<bool> release(slabs_.size());
+  bool any = false;
+  for (size_t i = 0; i + 1 < slabs_.size(); ++i) {
+    if (freeBytes[i] == slabs_[i].used) {
+      release[i] = true;
+      any = true;
+    }
+  }
+  if (!any) {
+    return 0;
+  }
+
+  for (auto& head : freeLists_) {
+    FreeNode** link = &head;
+    while (*link) {
+      if (release[slabOf(*link)]) {
+        *link = (*link)->next;
+      } else {
+        link = &(*link)->next;
+      }
+    }
+  }
+
+  size_t released = 0;
+  size_t kept = 0;
+  for (size_t i = 0; i < slabs_.size(); ++i) {
+    if (release[i]) {
+      freeSlab(slabs_[i].begin);
+      released += slabSize_;
+    } else {
+      slabs_[kept++] = slabs_[i];
+    }
+  }
+  slabs_.resize(kept);
+  bytesReserved_ -= released;
+  return released;
+}
+
+} // namespace watchman
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * A size-class slab allocator for the small, numerous nodes that make up the
+ * in-memory view (watchman_file and watchman_dir).
+ *
+ * Requests are rounded up to a multiple of kGranularity and served from
+ * large, contiguously allocated slabs. Freed blocks are kept on a per-size
+ * class free list and reused by subsequent allocations of the same class.
+ * Nodes created together during a crawl therefore end up adjacent in memory,
+ * and we avoid paying the per-allocation overhead of the system allocator
+ * millions of times over.
+ *
+ * Requests larger than kMaxSlabObjectSize fall through to operator new.
+ *
+ * With hugePages, where the platform supports transparent huge pages, the
+ * slabs are instead kHugePageSize and aligned to it, and are mapped with the
+ * advice that they be backed by huge pages. A walk of a large view then
+ * takes far fewer TLB misses.
+ *
+ * SlabAllocator is not thread safe: the owner must provide synchronization.
+ * For the view this is the ViewDatabase lock.
+ */
+class SlabAllocator {
+ public:
+  static constexpr size_t kGranularity = 16;
+  static constexpr size_t kMaxSlabObjectSize = 512;
+  static constexpr size_t kDefaultSlabSize = 64 * 1024;
+  static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+  explicit SlabAllocator(
+      size_t slabSize = kDefaultSlabSize,
+      bool hugePages = false);
+
+  /** Whether hugePages has any effect on this platform. */
+  static bool supportsHugePages();
+  ~SlabAllocator();
+
+  SlabAllocator(const SlabAllocator&) = delete;
+  SlabAllocator(SlabAllocator&&) = delete;
+  SlabAllocator& operator=(const SlabAllocator&) = delete;
+  SlabAllocator& operator=(SlabAllocator&&) = delete;
+
+  /**
+   * Returns uninitialized storage for at least `size` bytes, aligned to
+   * kGranularity.
+   */
+  void* allocate(size_t size);
+
+  /**
+   * Returns storage obtained from allocate() to the allocator. `size` must be
+   * the same value that was passed to allocate().
+   */
+  void deallocate(void* ptr, size_t size) noexcept;
+
+  /**
+   * Returns the slabs to the system. Every block allocated from them must
+   * have been deallocated.
+   */
+  void releaseSlabs() noexcept;
+
+  /**
+   * Returns to the system the slabs, other than the one currently being
+   * carved up, whose every block has been deallocated, as after many nodes
+   * were aged out. Returns the number of bytes released. Huge page slabs are
+   * unmapped, so the memory leaves the process at once.
+   */
+  size_t releaseFreeSlabs();
+
+  /// Total number of bytes obtained from the system, including slack.
+  size_t getBytesReserved() const {
+    return bytesReserved_;
+  }
+
+  /// Number of bytes currently handed out to callers, after rounding.
+  size_t getBytesInUse() const {
+    return bytesInUse_;
+  }
+
+ private:
+  struct FreeNode {
+    FreeNode* next;
+  };
+
+  static constexpr size_t kNumSizeClasses = kMaxSlabObjectSize / kGranularity;
+
+  static size_t roundUp(size_t size) {
+    return (size + kGranularity - 1) & ~(kGranularity - 1);
+  }
+
+  struct Slab {
+    std::byte* begin;
+    // How much of it has been carved into blocks; only maintained for the
+    // slabs before the current one.
+    size_t used;
+  };
+
+  std::byte* allocateSlab();
+  void freeSlab(std::byte* slab) noexcept;
+
+  const bool hugePages_;
+  const size_t slabSize_;
+  // The current slab is the last
+  std::vector<Slab> slabs_;
+  std::array<FreeNode*, kNumSizeClasses> freeLists_{};
+
+  // The unused tail of the most recently allocated slab.
+  std::byte* bumpPos_{nullptr};
+  std::byte* bumpEnd_{nullptr};
+
+  size_t bytesReserved_{0};
+  size_t bytesInUse_{0};
+};
+
+} // namespace watchman
@@ -29,8 +29,17 @@ std::size_t SymlinkTargetCacheKey::hashValue() const {
 SymlinkTargetCache::SymlinkTargetCache(
     const w_string& rootPath,
     size_t maxItems,
-    std::chrono::milliseconds errorTTL)
-    : cache_(maxItems, errorTTL), rootPath_(rootPath) {}
+    std::chrono::milliseconds errorTTL,
+    size_t maxBytes)
+    : cache_(
+          maxItems,
+          errorTTL,
+          16,
+          maxBytes,
+          [](const SymlinkTargetCacheKey& key, const w_string& target) {
+            return sizeof(Node) + key.relativePath.size() + target.size();
+          }),
+      rootPath_(rootPath) {}
 
 folly::Future<std::shared_ptr<const Node>> SymlinkTargetCache::get(
     const SymlinkTargetCacheKey& key) {
@@ -38,6 +47,12 @@ folly::Future<std::shared_ptr<const Node>> SymlinkTargetCache::get(
       key, [this](const SymlinkTargetCacheKey& k) { return readLink(k); });
 }
 
+void SymlinkTargetCache::set(
+    const SymlinkTargetCacheKey& key,
+    w_string target) {
+  cache_.set(key, std::move(target));
+}
+
 w_string SymlinkTargetCache::readLinkImmediate(
     const SymlinkTargetCacheKey& key) const {
   auto fullPath = w_string::pathCat({rootPath_, key.relativePath});
@@ -59,4 +74,8 @@ const w_string& SymlinkTargetCache::rootPath() const {
 CacheStats SymlinkTargetCache::stats() const {
   return cache_.stats();
 }
+
+size_t SymlinkTargetCache::eraseExpired() {
+  return cache_.eraseExpired();
+}
 } // namespace watchman
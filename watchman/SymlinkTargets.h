@@ -38,15 +38,17 @@ struct hash<watchman::SymlinkTargetCacheKey> {
 namespace watchman {
 class SymlinkTargetCache {
  public:
-  using Node = LRUCache<SymlinkTargetCacheKey, w_string>::NodeType;
+  using Node = ShardedLRUCache<SymlinkTargetCacheKey, w_string>::NodeType;
 
   // Construct a cache for a given root, holding the specified
   // maximum number of items, using the configured negative
-  // caching TTL.
+  // caching TTL.  If maxBytes is not zero, it also limits the
+  // approximate memory used by the cached items.
   SymlinkTargetCache(
       const w_string& rootPath,
       size_t maxItems,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      size_t maxBytes = 0);
 
   // Obtain the content hash for the given input.
   // If the result is in the cache it will return a ready future
@@ -56,6 +58,10 @@ class SymlinkTargetCache {
   folly::Future<std::shared_ptr<const Node>> get(
       const SymlinkTargetCacheKey& key);
 
+  // Caches a target that the caller has already read, as the crawler does
+  // when symlink_target_prefetch is set.
+  void set(const SymlinkTargetCacheKey& key, w_string target);
+
   // Read the symlink target.
   // This will block the calling thread while the I/O is performed.
   // Throws exceptions for any errors that may occur.
@@ -71,8 +77,11 @@ class SymlinkTargetCache {
   // Returns cache statistics
   CacheStats stats() const;
 
+  // Erases the errors that have outlived their TTL; returns how many
+  size_t eraseExpired();
+
  private:
-  LRUCache<SymlinkTargetCacheKey, w_string> cache_;
+  ShardedLRUCache<SymlinkTargetCacheKey, w_string> cache_;
   w_string rootPath_;
 };
 } // namespace watchman
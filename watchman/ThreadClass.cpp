@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadClass.h"
+#include <folly/Conv.h>
+#include <folly/String.h>
+#include <atomic>
+#include <stdexcept>
+#include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace watchman {
+
+namespace {
+
+constexpr size_t kNumThreadClasses = size_t(ThreadClass::Walker) + 1;
+
+// So that a misconfigured class logs once rather than per client
+std::atomic<bool> reportedFailure[kNumThreadClasses];
+
+void reportFailure(ThreadClass cls, std::string_view what) {
+  if (!reportedFailure[size_t(cls)].exchange(true, std::memory_order_acq_rel)) {
+    log(ERR,
+        "thread_classes: cannot apply the policy for ",
+        threadClassName(cls),
+        " threads: ",
+        what,
+        "\n");
+  }
+}
+
+int parseInt(const json_ref& value, const char* name, int min, int max) {
+  if (!value.isInt()) {
+    throw std::domain_error(
+        folly::to<std::string>(name, " must be an integer"));
+  }
+  auto n = value.asInt();
+  if (n < min || n > max) {
+    throw std::domain_error(folly::to<std::string>(
+        name, " must be between ", min, " and ", max));
+  }
+  return int(n);
+}
+
+#ifdef __linux__
+// From linux/ioprio.h, which not every libc installs
+constexpr int kIoPrioClassShift = 13;
+constexpr int kIoPrioClassRealTime = 1;
+constexpr int kIoPrioClassBestEffort = 2;
+constexpr int kIoPrioClassIdle = 3;
+constexpr int kIoPrioWhoProcess = 1;
+
+int ioPrioClassValue(IoPriorityClass cls) {
+  switch (cls) {
+    case IoPriorityClass::RealTime:
+      return kIoPrioClassRealTime;
+    case IoPriorityClass::BestEffort:
+      return kIoPrioClassBestEffort;
+    case IoPriorityClass::Idle:
+      return kIoPrioClassIdle;
+  }
+  return 0;
+}
+
+void applyPolicy(ThreadClass cls, const ThreadClassPolicy& policy) {
+  // Each of these is per thread on Linux, given the thread's id.
+  auto tid = pid_t(syscall(SYS_gettid));
+
+  if (policy.nice && setpriority(PRIO_PROCESS, tid, *policy.nice) != 0) {
+    reportFailure(
+        cls, folly::to<std::string>("nice: ", folly::errnoStr(errno)));
+  }
+
+  if (policy.ioPriorityClass) {
+    int prio = (ioPrioClassValue(*policy.ioPriorityClass)
+                << kIoPrioClassShift) |
+        policy.ioPriorityLevel;
+    if (syscall(SYS_ioprio_set, kIoPrioWhoProcess, tid, prio) != 0) {
+      reportFailure(
+          cls, folly::to<std::string>("ioprio: ", folly::errnoStr(errno)));
+    }
+  }
+
+  if (!policy.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : policy.cpus) {
+      if (cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+      }
+    }
+    if (sched_setaffinity(tid, sizeof(set), &set) != 0) {
+      reportFailure(
+          cls, folly::to<std::string>("cpus: ", folly::errnoStr(errno)));
+    }
+  }
+}
+#else
+void applyPolicy(ThreadClass, const ThreadClassPolicy&) {}
+#endif
+
+} // namespace
+
+std::string_view threadClassName(ThreadClass cls) {
+  switch (cls) {
+    case ThreadClass::Notify:
+      return "notify";
+    case ThreadClass::Io:
+      return "io";
+    case ThreadClass::Accept:
+      return "accept";
+    case ThreadClass::Client:
+      return "client";
+    case ThreadClass::Worker:
+      return "worker";
+    case ThreadClass::Walker:
+      return "walker";
+  }
+  return "unknown";
+}
+
+ThreadClassPolicy ThreadClassPolicy::parse(const json_ref& value) {
+  if (!value.isObject()) {
+    throw std::domain_error("must be an object");
+  }
+
+  ThreadClassPolicy policy;
+  if (auto nice = value.get_optional("nice")) {
+    policy.nice = parseInt(*nice, "nice", -20, 19);
+  }
+  if (auto cls = value.get_optional("ioprio_class")) {
+    auto name = cls->isString() ? cls->asString().view() : std::string_view{};
+    if (name == "realtime") {
+      policy.ioPriorityClass = IoPriorityClass::RealTime;
+    } else if (name == "best-effort") {
+      policy.ioPriorityClass = IoPriorityClass::BestEffort;
+    } else if (name == "idle") {
+      policy.ioPriorityClass = IoPriorityClass::Idle;
+    } else {
+      throw std::domain_error(
+          "ioprio_class must be one of realtime, best-effort or idle");
+    }
+  }
+  if (auto level = value.get_optional("ioprio_level")) {
+    policy.ioPriorityLevel = parseInt(*level, "ioprio_level", 0, 7);
+  }
+  if (auto cpus = value.get_optional("cpus")) {
+    if (!cpus->isArray()) {
+      throw std::domain_error("cpus must be an array of CPU numbers");
+    }
+    for (auto& cpu : cpus->array()) {
+      policy.cpus.push_back(unsigned(parseInt(cpu, "cpus", 0, 1 << 16)));
+    }
+  }
+  return policy;
+}
+
+void applyThreadClassPolicy(ThreadClass cls) {
+  auto classes = cfg_get_json("thread_classes");
+  if (!classes || !classes->isObject()) {
+    return;
+  }
+  auto value = classes->get_optional(std::string(threadClassName(cls)).c_str());
+  if (!value) {
+    return;
+  }
+
+  ThreadClassPolicy policy;
+  try {
+    policy = ThreadClassPolicy::parse(*value);
+  } catch (const std::domain_error& e) {
+    reportFailure(cls, e.what());
+    return;
+  }
+  applyPolicy(cls, policy);
+}
+
+#ifdef __linux__
+ScopedIdleIoPriority::ScopedIdleIoPriority() {
+  int previous = int(syscall(SYS_ioprio_get, kIoPrioWhoProcess, 0));
+  if (previous == -1) {
+    return;
+  }
+  if (syscall(
+          SYS_ioprio_set,
+          kIoPrioWhoProcess,
+          0,
+          kIoPrioClassIdle << kIoPrioClassShift) == 0) {
+    previous_ = previous;
+  }
+}
+
+ScopedIdleIoPriority::~ScopedIdleIoPriority() {
+  if (previous_ != -1) {
+    syscall(SYS_ioprio_set, kIoPrioWhoProcess, 0, previous_);
+  }
+}
+#else
+ScopedIdleIoPriority::ScopedIdleIoPriority() {}
+
+ScopedIdleIoPriority::~ScopedIdleIoPriority() {}
+#endif
+
+} // namespace watchman
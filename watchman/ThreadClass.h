@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+/**
+ * The kinds of threads that the "thread_classes" config can run at their
+ * own scheduling priority, so that a background content hash warm doesn't
+ * delay the thread that drains the kernel's event queue until it overflows.
+ */
+enum class ThreadClass {
+  // Reads events from the watcher, e.g. inotify-reader and notify
+  Notify,
+  // Crawls and applies pending changes
+  Io,
+  // Listens for connections
+  Accept,
+  // Serves one client
+  Client,
+  // ThreadPool workers, which hash, stat and read symlinks
+  Worker,
+  // ParallelWalker readdir threads
+  Walker,
+};
+
+std::string_view threadClassName(ThreadClass cls);
+
+enum class IoPriorityClass {
+  RealTime,
+  BestEffort,
+  Idle,
+};
+
+/**
+ * How a thread class is scheduled. Unset fields leave the thread as it was
+ * created, which is the default for every class.
+ */
+struct ThreadClassPolicy {
+  // setpriority(2) nice value, from -20 to 19
+  std::optional<int> nice;
+  // ioprio_set(2) class
+  std::optional<IoPriorityClass> ioPriorityClass;
+  // The level within the ioprio class, from 0 (most favoured) to 7
+  int ioPriorityLevel{4};
+  // CPUs the thread may run on; empty means any of them
+  std::vector<unsigned> cpus;
+
+  /**
+   * Parses an object of the form
+   * {"nice": 5, "ioprio_class": "idle", "ioprio_level": 7, "cpus": [0, 1]}.
+   * Throws std::domain_error if a field is of the wrong type or range.
+   */
+  static ThreadClassPolicy parse(const json_ref& value);
+};
+
+/**
+ * Applies the policy that the global "thread_classes" config has for cls to
+ * the calling thread. Call it from the thread itself, next to where it names
+ * itself. Failures, e.g. EPERM when raising priority without CAP_SYS_NICE,
+ * are logged once per class and otherwise ignored.
+ *
+ * Nothing is applied outside of Linux, where these would change the whole
+ * process rather than the calling thread.
+ */
+void applyThreadClassPolicy(ThreadClass cls);
+
+/**
+ * Runs the calling thread at the idle IO priority, which only gets the disk
+ * when nothing else wants it, until destroyed. The thread then goes back to
+ * the IO priority it had. Does nothing outside of Linux.
+ */
+class ScopedIdleIoPriority {
+ public:
+  ScopedIdleIoPriority();
+  ~ScopedIdleIoPriority();
+
+  ScopedIdleIoPriority(const ScopedIdleIoPriority&) = delete;
+  ScopedIdleIoPriority& operator=(const ScopedIdleIoPriority&) = delete;
+
+ private:
+  // -1 if the priority could not be read or set
+  int previous_{-1};
+};
+
+} // namespace watchman
@@ -7,9 +7,17 @@
 
 #include "watchman/ThreadPool.h"
 #include "watchman/Logging.h"
+#include "watchman/ThreadClass.h"
 
 namespace watchman {
 
+namespace {
+// The pool, and the index of the worker, that the current thread is running
+// tasks for, if any.
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+} // namespace
+
 ThreadPool& getThreadPool() {
   static ThreadPool pool;
   return pool;
@@ -19,7 +27,10 @@ ThreadPool::~ThreadPool() {
   stop();
 }
 
-void ThreadPool::start(size_t numWorkers, size_t maxItems) {
+void ThreadPool::start(
+    size_t numWorkers,
+    size_t maxItems,
+    size_t maxBackgroundWorkers) {
   std::unique_lock<std::mutex> lock(mutex_);
   if (!workers_.empty()) {
     throw std::runtime_error("ThreadPool already started");
@@ -28,33 +39,123 @@ void ThreadPool::start(size_t numWorkers, size_t maxItems) {
     throw std::runtime_error("Cannot restart a stopped pool");
   }
   maxItems_ = maxItems;
+  maxBackground_ = maxBackgroundWorkers == 0
+      ? numWorkers
+      : std::min(maxBackgroundWorkers, numWorkers);
 
+  for (auto i = 0U; i < numWorkers; ++i) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
   for (auto i = 0U; i < numWorkers; ++i) {
     workers_.emplace_back([this, i]() noexcept {
       w_set_thread_name("ThreadPool-", i);
-      runWorker();
+      applyThreadClassPolicy(ThreadClass::Worker);
+      currentPool = this;
+      currentWorker = i;
+      runWorker(i);
     });
   }
 }
 
-void ThreadPool::runWorker() {
-  while (true) {
-    folly::Func task;
+uint8_t ThreadPool::getNumPriorities() const {
+  return kNumClasses;
+}
 
+bool ThreadPool::canRun(TaskClass taskClass) const {
+  if (queued_[taskClass].load() == 0) {
+    return false;
+  }
+  return taskClass == Interactive || runningBackground_.load() < maxBackground_;
+}
+
+bool ThreadPool::take(size_t index, TaskClass taskClass, folly::Func& task) {
+  // Our own queue first, oldest task first, and then the newest tasks of the
+  // others, which their owners are the least likely to get to soon.
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    auto& queue = *queues_[(index + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    auto& tasks = queue.tasks[taskClass];
+    if (tasks.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    } else {
+      task = std::move(tasks.back());
+      tasks.pop_back();
+    }
+    --queued_[taskClass];
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::wake(bool all) {
+  // A worker counts itself as sleeping before it checks for work, under the
+  // lock, so if there is none, it can't miss the work that was just added.
+  if (sleepers_.load() > 0) {
     {
       std::unique_lock<std::mutex> lock(mutex_);
-      condition_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
-      if (stopping_ && tasks_.empty()) {
-        return;
+    }
+    if (all) {
+      condition_.notify_all();
+    } else {
+      condition_.notify_one();
+    }
+  }
+}
+
+void ThreadPool::runWorker(size_t index) {
+  while (true) {
+    folly::Func task;
+    bool background = false;
+
+    if (!take(index, Interactive, task)) {
+      // Reserve our place among the background workers before looking for a
+      // background task, so that no more than maxBackground_ ever run.
+      if (++runningBackground_ <= maxBackground_ &&
+          take(index, Background, task)) {
+        background = true;
+      } else if (--runningBackground_ < maxBackground_ &&
+                 queued_[Background].load() > 0) {
+        // Someone may have waited on the place that we didn't use.
+        wake(false);
       }
-      task = std::move(tasks_.front());
-      tasks_.pop_front();
     }
 
-    task();
+    if (task) {
+      task();
+      if (background) {
+        --runningBackground_;
+        if (queued_[Background].load() > 0) {
+          wake(false);
+        }
+      }
+      if (stopping_ && idle()) {
+        // Let the others see that there is nothing left, and exit.
+        wake(true);
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++sleepers_;
+    condition_.wait(lock, [this] {
+      return (stopping_ && idle()) || canRun(Interactive) ||
+          canRun(Background);
+    });
+    --sleepers_;
+    if (stopping_ && idle()) {
+      return;
+    }
   }
 }
 
+bool ThreadPool::idle() const {
+  return queued_[Interactive].load() == 0 && queued_[Background].load() == 0;
+}
+
 void ThreadPool::stop(bool join) {
   {
     std::unique_lock<std::mutex> lock(mutex_);
@@ -69,19 +170,39 @@ void ThreadPool::stop(bool join) {
   }
 }
 
-void ThreadPool::add(folly::Func func) {
-  {
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (stopping_) {
-      throw std::runtime_error("cannot add tasks after pool has stopped");
-    }
-    if (tasks_.size() + 1 >= maxItems_) {
-      throw std::runtime_error("thread pool queue is full");
-    }
+void ThreadPool::enqueue(folly::Func func, TaskClass taskClass) {
+  if (stopping_) {
+    throw std::runtime_error("cannot add tasks after pool has stopped");
+  }
+  if (queues_.empty()) {
+    throw std::runtime_error("thread pool has not been started");
+  }
+  if (queued_[Interactive].load() + queued_[Background].load() + 1 >=
+      maxItems_) {
+    throw std::runtime_error("thread pool queue is full");
+  }
 
-    tasks_.emplace_back(std::move(func));
+  // Tasks added by a worker are likely to be related to the one that it is
+  // running, so it is best placed to run them.
+  size_t index = currentPool == this
+      ? currentWorker
+      : nextQueue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+  {
+    auto& queue = *queues_[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks[taskClass].emplace_back(std::move(func));
+    ++queued_[taskClass];
   }
+  wake(false);
+}
+
+void ThreadPool::add(folly::Func func) {
+  enqueue(std::move(func), Interactive);
+}
 
-  condition_.notify_one();
+void ThreadPool::addWithPriority(folly::Func func, int8_t priority) {
+  enqueue(
+      std::move(func),
+      priority < folly::Executor::MID_PRI ? Background : Interactive);
 }
 } // namespace watchman
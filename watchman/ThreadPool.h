@@ -7,8 +7,10 @@
 
 #pragma once
 #include <folly/Executor.h>
+#include <atomic>
 #include <condition_variable>
 #include <deque>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -16,17 +18,30 @@
 
 namespace watchman {
 
-// Almost the dumbest possible thread pool implementation.
-// This allows us to set an upper bound on the number of concurrent
-// tasks that are executed in the thread pool.  Contrast with
+// A small thread pool that allows us to set an upper bound on the number of
+// concurrent tasks that are executed in the pool.  Contrast with
 // std::async which leaves it to the implementation to decide
 // whether each async invocation spawns a thread or uses a
 // thread pool with an unspecified number of threads.
 // Constraining the concurrency is important for watchman so
 // that we can limit the amount of I/O that we might induce.
+//
+// Each worker has its own queue, which tasks added from that worker go to,
+// and takes tasks from the other workers' queues when its own is empty, so
+// that adding and taking tasks rarely contend on a lock.
+//
+// Tasks are either interactive, which is the default, or background, for
+// work that nothing is waiting on, such as saving caches. Background tasks
+// only run when there are no interactive tasks to run, and no more than
+// maxBackgroundWorkers of them run at once, so that a burst of them can't
+// occupy every worker.
 
 class ThreadPool : public folly::Executor {
  public:
+  // The priority to pass to addWithPriority for background tasks.
+  // Lower priorities are background too.
+  static constexpr int8_t kBackground = folly::Executor::LO_PRI;
+
   ThreadPool() = default;
   ~ThreadPool() override;
 
@@ -36,8 +51,12 @@ class ThreadPool : public folly::Executor {
   // is under a heavy backlog, and can also help surface issues
   // where there a task executing in the pool is blocking on
   // the results of some other task also running in the thread
-  // pool.
-  void start(size_t numWorkers, size_t maxItems);
+  // pool.  If maxBackgroundWorkers is 0, background tasks may use
+  // every worker.
+  void start(
+      size_t numWorkers,
+      size_t maxItems,
+      size_t maxBackgroundWorkers = 0);
 
   // Request that the worker threads terminate.
   // If `join` is true, wait for the worker threads to terminate.
@@ -49,16 +68,44 @@ class ThreadPool : public folly::Executor {
   // If the thread pool has been stopped, throws a runtime_error.
   void add(folly::Func func) override;
 
+  // Like add(), but priorities below MID_PRI make func a background task.
+  void addWithPriority(folly::Func func, int8_t priority) override;
+
+  uint8_t getNumPriorities() const override;
+
  private:
+  enum TaskClass : size_t { Interactive, Background };
+  static constexpr size_t kNumClasses = 2;
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<folly::Func> tasks[kNumClasses];
+  };
+
   std::vector<std::thread> workers_;
-  std::deque<folly::Func> tasks_;
+  std::vector<std::unique_ptr<Queue>> queues_;
+
+  // Queued tasks in each class
+  std::atomic<size_t> queued_[kNumClasses]{};
+  std::atomic<size_t> runningBackground_{0};
+  std::atomic<size_t> nextQueue_{0};
 
+  // Only used by workers that have nothing to do, and to wake them.
   std::mutex mutex_;
   std::condition_variable condition_;
-  bool stopping_{false};
-  size_t maxItems_;
+  std::atomic<size_t> sleepers_{0};
+  std::atomic<bool> stopping_{false};
+  size_t maxItems_{0};
+  size_t maxBackground_{0};
 
-  void runWorker();
+  void enqueue(folly::Func func, TaskClass taskClass);
+  bool canRun(TaskClass taskClass) const;
+  bool idle() const;
+  void wake(bool all);
+  // Takes a task of taskClass from the queue of worker index, or else from
+  // another worker's queue.
+  bool take(size_t index, TaskClass taskClass, folly::Func& task);
+  void runWorker(size_t index);
 };
 
 // Return a reference to the shared thread pool for the watchman process.
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/TickIndex.h"
+#include <fmt/core.h>
+#include <folly/portability/Fcntl.h>
+#include <folly/portability/Unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include "watchman/watchman_stream.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[4] = {'W', 'M', 'T', 'I'};
+constexpr uint32_t kVersion = 3;
+constexpr size_t kBufferSize = 64 * 1024;
+
+constexpr char kDirRecord = 'D';
+constexpr char kFileRecord = 'F';
+constexpr char kEndRecord = 'E';
+
+// The index is only ever read back on the machine that wrote it, so values
+// are stored in native byte order.
+template <typename T>
+void put(std::string& buf, T value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putString(std::string& buf, w_string_piece str) {
+  put<uint32_t>(buf, static_cast<uint32_t>(str.size()));
+  buf.append(str.data(), str.size());
+}
+
+void putTimespec(std::string& buf, const struct timespec& ts) {
+  put<int64_t>(buf, ts.tv_sec);
+  put<int64_t>(buf, ts.tv_nsec);
+}
+
+void putClockStamp(std::string& buf, const ClockStamp& stamp) {
+  put<uint64_t>(buf, stamp.ticks);
+  put<int64_t>(buf, stamp.timestamp);
+}
+
+[[noreturn]] void throwMalformed(const char* what) {
+  throw std::runtime_error(fmt::format("malformed tick index: {}", what));
+}
+
+} // namespace
+
+TickIndexWriter::TickIndexWriter(w_string path, const TickIndexHeader& header)
+    : path_(std::move(path)), tempPath_(w_string::build(path_, ".tmp")) {
+  stream_ = w_stm_open(
+      tempPath_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (!stream_) {
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        fmt::format("unable to open {} for write", tempPath_));
+  }
+
+  buffer_.reserve(kBufferSize);
+  buffer_.append(kMagic, sizeof(kMagic));
+  put<uint32_t>(buffer_, kVersion);
+  putString(buffer_, header.rootPath);
+  put<uint64_t>(buffer_, header.clock.start_time);
+  put<int32_t>(buffer_, header.clock.pid);
+  put<uint64_t>(buffer_, header.clock.rootNumber);
+  put<uint64_t>(buffer_, header.clock.lastTicks);
+  put<uint64_t>(buffer_, header.lastAgeOutTicks);
+  put<uint64_t>(buffer_, header.rootInode);
+  putString(buffer_, header.watcherCursor);
+}
+
+TickIndexWriter::~TickIndexWriter() {
+  if (!committed_) {
+    stream_.reset();
+    (void)unlink(tempPath_.c_str());
+  }
+}
+
+void TickIndexWriter::addDir(w_string_piece path) {
+  buffer_.push_back(kDirRecord);
+  putString(buffer_, path);
+  if (buffer_.size() >= kBufferSize) {
+    flush();
+  }
+}
+
+void TickIndexWriter::addFile(const TickIndexFile& file) {
+  buffer_.push_back(kFileRecord);
+  putString(buffer_, file.name);
+  putClockStamp(buffer_, file.otime);
+  putClockStamp(buffer_, file.ctime);
+  put<uint8_t>(buffer_, file.exists ? 1 : 0);
+  putTimespec(buffer_, file.stat.mtime);
+  putTimespec(buffer_, file.stat.ctime);
+  put<int64_t>(buffer_, file.stat.size);
+  put<uint64_t>(buffer_, file.stat.ino);
+  put<uint32_t>(buffer_, file.stat.mode);
+  put<uint64_t>(buffer_, file.stat.extraDigest);
+#ifdef _WIN32
+  put<uint32_t>(buffer_, file.stat.fileAttributes);
+#endif
+  if (buffer_.size() >= kBufferSize) {
+    flush();
+  }
+}
+
+void TickIndexWriter::flush() {
+  size_t pos = 0;
+  while (pos < buffer_.size()) {
+    int res = stream_->write(
+        buffer_.data() + pos, static_cast<int>(buffer_.size() - pos));
+    if (res <= 0) {
+      throw std::system_error(
+          errno,
+          std::generic_category(),
+          fmt::format("writing to {}", tempPath_));
+    }
+    pos += res;
+  }
+  buffer_.clear();
+}
+
+void TickIndexWriter::commit() {
+  buffer_.push_back(kEndRecord);
+  flush();
+  stream_.reset();
+
+  if (rename(tempPath_.c_str(), path_.c_str()) != 0) {
+    // Windows will not rename over an existing file.
+    (void)unlink(path_.c_str());
+    if (rename(tempPath_.c_str(), path_.c_str()) != 0) {
+      throw std::system_error(
+          errno,
+          std::generic_category(),
+          fmt::format("renaming {} to {}", tempPath_, path_));
+    }
+  }
+  committed_ = true;
+}
+
+TickIndexReader::TickIndexReader(const char* path) {
+  stream_ = w_stm_open(path, O_RDONLY | O_CLOEXEC);
+  if (!stream_) {
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        fmt::format("unable to open {} for read", path));
+  }
+
+  char magic[sizeof(kMagic)];
+  read(magic, sizeof(magic));
+  if (memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+    throwMalformed("bad magic");
+  }
+  uint32_t version;
+  read(&version, sizeof(version));
+  if (version != kVersion) {
+    throw std::runtime_error(
+        fmt::format("unsupported tick index version {}", version));
+  }
+
+  uint64_t start_time, rootNumber, lastTicks, lastAgeOutTicks, rootInode;
+  int32_t pid;
+  header_.rootPath = readString();
+  read(&start_time, sizeof(start_time));
+  read(&pid, sizeof(pid));
+  read(&rootNumber, sizeof(rootNumber));
+  read(&lastTicks, sizeof(lastTicks));
+  read(&lastAgeOutTicks, sizeof(lastAgeOutTicks));
+  read(&rootInode, sizeof(rootInode));
+  header_.clock.start_time = start_time;
+  header_.clock.pid = pid;
+  header_.clock.rootNumber = rootNumber;
+  header_.clock.lastTicks = lastTicks;
+  header_.lastAgeOutTicks = lastAgeOutTicks;
+  header_.rootInode = rootInode;
+  header_.watcherCursor = readString();
+}
+
+TickIndexReader::~TickIndexReader() = default;
+
+void TickIndexReader::read(void* buf, size_t size) {
+  auto* out = static_cast<char*>(buf);
+  while (size > 0) {
+    if (bufferPos_ == buffer_.size()) {
+      buffer_.resize(kBufferSize);
+      int res = stream_->read(buffer_.data(), static_cast<int>(kBufferSize));
+      if (res < 0) {
+        throw std::system_error(
+            errno, std::generic_category(), "reading tick index");
+      }
+      if (res == 0) {
+        throwMalformed("unexpected end of file");
+      }
+      buffer_.resize(res);
+      bufferPos_ = 0;
+    }
+    size_t avail = std::min(size, buffer_.size() - bufferPos_);
+    memcpy(out, buffer_.data() + bufferPos_, avail);
+    bufferPos_ += avail;
+    out += avail;
+    size -= avail;
+  }
+}
+
+w_string TickIndexReader::readString() {
+  uint32_t len;
+  read(&len, sizeof(len));
+  std::string str(len, '\0');
+  read(str.data(), len);
+  return w_string{str.data(), str.size()};
+}
+
+TickIndexReader::Record TickIndexReader::next() {
+  auto readTimespec = [this](struct timespec& ts) {
+    int64_t sec, nsec;
+    read(&sec, sizeof(sec));
+    read(&nsec, sizeof(nsec));
+    ts.tv_sec = sec;
+    ts.tv_nsec = nsec;
+  };
+  auto readClockStamp = [this](ClockStamp& stamp) {
+    uint64_t ticks;
+    int64_t timestamp;
+    read(&ticks, sizeof(ticks));
+    read(&timestamp, sizeof(timestamp));
+    stamp.ticks = ticks;
+    stamp.timestamp = timestamp;
+  };
+
+  char type;
+  read(&type, sizeof(type));
+  switch (type) {
+    case kDirRecord:
+      dir_ = readString();
+      return Record::Dir;
+
+    case kFileRecord: {
+      file_.name = readString();
+      readClockStamp(file_.otime);
+      readClockStamp(file_.ctime);
+      uint8_t exists;
+      read(&exists, sizeof(exists));
+      file_.exists = exists != 0;
+      readTimespec(file_.stat.mtime);
+      readTimespec(file_.stat.ctime);
+      int64_t size;
+      uint64_t ino;
+      uint32_t mode;
+      read(&size, sizeof(size));
+      read(&ino, sizeof(ino));
+      read(&mode, sizeof(mode));
+      read(&file_.stat.extraDigest, sizeof(file_.stat.extraDigest));
+#ifdef _WIN32
+      read(&file_.stat.fileAttributes, sizeof(file_.stat.fileAttributes));
+#endif
+      file_.stat.size = size;
+      file_.stat.ino = ino;
+      file_.stat.mode = mode;
+      return Record::File;
+    }
+
+    case kEndRecord:
+      return Record::End;
+
+    default:
+      throwMalformed("unknown record type");
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include "watchman/Clock.h"
+#include "watchman/fs/CompactFileInformation.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class Stream;
+
+/**
+ * The on-disk tick index records, for every file node in a view, the clocks
+ * at which it last changed and was created along with its stat information.
+ * It is written by one incarnation of a root and read back by the next, which
+ * uses it to continue the previous tick sequence for the files whose stat
+ * information shows that they did not change in the meantime. That allows
+ * since queries against the previous incarnation's clocks to be answered
+ * without reporting a fresh instance.
+ *
+ * The index is a sequence of dir records, each followed by records for the
+ * files directly within it. Names are stored relative to the dir, so the
+ * index is considerably smaller than a list of full paths. The recency order
+ * is not stored; it is recovered by sorting on the ticks.
+ */
+struct TickIndexHeader {
+  w_string rootPath;
+  // The incarnation of the root that wrote the index, and the most recent
+  // tick that it had issued.
+  ClockPredecessor clock;
+  ClockTicks lastAgeOutTicks{0};
+  ino_t rootInode{0};
+  // An opaque position in the watcher's event stream, as returned by
+  // Watcher::getEventCursor(), up to which every change is reflected in the
+  // index. Empty if the watcher can't replay its events.
+  w_string watcherCursor;
+};
+
+struct TickIndexFile {
+  w_string name;
+  ClockStamp otime{0, 0};
+  ClockStamp ctime{0, 0};
+  bool exists{false};
+  CompactFileInformation stat;
+};
+
+/**
+ * Writes a tick index to a temporary file alongside path. commit() replaces
+ * path with it; if the writer is destroyed without committing, the
+ * temporary file is removed and path is left untouched.
+ *
+ * Throws std::system_error if the file cannot be created or written.
+ */
+class TickIndexWriter {
+ public:
+  TickIndexWriter(w_string path, const TickIndexHeader& header);
+  ~TickIndexWriter();
+
+  TickIndexWriter(const TickIndexWriter&) = delete;
+  TickIndexWriter& operator=(const TickIndexWriter&) = delete;
+
+  /**
+   * Starts a dir record. path is relative to the root, and is empty for the
+   * root itself. A dir may be started more than once.
+   */
+  void addDir(w_string_piece path);
+
+  /** Adds a file record for the dir most recently passed to addDir(). */
+  void addFile(const TickIndexFile& file);
+
+  void commit();
+
+ private:
+  void flush();
+
+  w_string path_;
+  w_string tempPath_;
+  std::unique_ptr<Stream> stream_;
+  std::string buffer_;
+  bool committed_{false};
+};
+
+/**
+ * Reads a tick index written by TickIndexWriter.
+ *
+ * Throws std::system_error if the file cannot be opened, and
+ * std::runtime_error if it is malformed or was written by an incompatible
+ * version.
+ */
+class TickIndexReader {
+ public:
+  explicit TickIndexReader(const char* path);
+  ~TickIndexReader();
+
+  const TickIndexHeader& header() const {
+    return header_;
+  }
+
+  enum class Record { Dir, File, End };
+
+  /**
+   * Reads the next record. After Dir, dir() returns its path; after File,
+   * file() returns its contents.
+   */
+  Record next();
+
+  const w_string& dir() const {
+    return dir_;
+  }
+
+  const TickIndexFile& file() const {
+    return file_;
+  }
+
+ private:
+  void read(void* buf, size_t size);
+  w_string readString();
+
+  std::unique_ptr<Stream> stream_;
+  std::string buffer_;
+  size_t bufferPos_{0};
+  TickIndexHeader header_;
+  w_string dir_;
+  TickIndexFile file_;
+};
+
+} // namespace watchman
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/TombstoneLog.h"
+#include <system_error>
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+void TombstoneLog::add(Tombstone tombstone) {
+  w_assert(
+      tombstones_.empty() ||
+          tombstones_.back().otime.ticks <= tombstone.otime.ticks,
+      "tombstones must be added in tick order");
+  tombstones_.push_back(std::move(tombstone));
+}
+
+size_t TombstoneLog::ageOut(time_t oldest, ClockTicks& lastTick) {
+  size_t aged = 0;
+  while (!tombstones_.empty() &&
+         tombstones_.front().otime.timestamp <= oldest) {
+    lastTick = tombstones_.front().otime.ticks;
+    tombstones_.pop_front();
+    ++aged;
+  }
+  if (aged) {
+    tombstones_.shrink_to_fit();
+  }
+  return aged;
+}
+
+TombstoneFileResult::TombstoneFileResult(const Tombstone& tombstone)
+    : tombstone_{tombstone} {}
+
+std::optional<FileInformation> TombstoneFileResult::stat() {
+  FileInformation info;
+  info.mode = tombstone_.type;
+  return info;
+}
+
+std::optional<struct timespec> TombstoneFileResult::accessedTime() {
+  return timespec{};
+}
+
+std::optional<struct timespec> TombstoneFileResult::modifiedTime() {
+  return timespec{};
+}
+
+std::optional<struct timespec> TombstoneFileResult::changedTime() {
+  return timespec{};
+}
+
+std::optional<size_t> TombstoneFileResult::size() {
+  return 0;
+}
+
+w_string_piece TombstoneFileResult::baseName() {
+  return tombstone_.name;
+}
+
+w_string_piece TombstoneFileResult::dirName() {
+  return tombstone_.dirName;
+}
+
+std::optional<bool> TombstoneFileResult::exists() {
+  return false;
+}
+
+std::optional<w_string> TombstoneFileResult::readLink() {
+  // As for any file that isn't a symlink; the target wasn't kept.
+  return w_string();
+}
+
+std::optional<ClockStamp> TombstoneFileResult::ctime() {
+  return tombstone_.ctime;
+}
+
+std::optional<ClockStamp> TombstoneFileResult::otime() {
+  return tombstone_.otime;
+}
+
+std::optional<FileResult::ContentHash> TombstoneFileResult::getContentSha1() {
+  // Don't return hashes for files that we believe to be deleted.
+  throw std::system_error(
+      std::make_error_code(std::errc::no_such_file_or_directory));
+}
+
+std::optional<FileResult::Spooky128Hash>
+TombstoneFileResult::getContentSpooky128() {
+  throw std::system_error(
+      std::make_error_code(std::errc::no_such_file_or_directory));
+}
+
+std::optional<DType> TombstoneFileResult::dtype() {
+  return stat()->dtype();
+}
+
+void TombstoneFileResult::batchFetchProperties(
+    const std::vector<std::unique_ptr<FileResult>>& files) {
+  // Everything is known up front
+  for (auto& f : files) {
+    static_cast<TombstoneFileResult*>(f.get())->clearNeededProperties();
+  }
+}
+
+} // namespace watchman
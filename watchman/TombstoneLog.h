@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <ctime>
+#include <deque>
+#include "watchman/Clock.h"
+#include "watchman/query/FileResult.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * What the view remembers of a file that was deleted, once the node for it
+ * has been freed: enough to report the deletion to since queries.
+ */
+struct Tombstone {
+  // The full path of the dir that held the file; shared by the tombstones of
+  // a dir.
+  w_string dirName;
+  w_string name;
+  ClockStamp otime;
+  ClockStamp ctime;
+  // Only the file type bits of the mode
+  mode_t type;
+};
+
+/**
+ * The tombstones of a view, oldest first. Tombstones must be added in
+ * order of their otime ticks, so that since queries can walk back from the
+ * newest until they reach their boundary.
+ */
+class TombstoneLog {
+ public:
+  using const_reverse_iterator = std::deque<Tombstone>::const_reverse_iterator;
+
+  void add(Tombstone tombstone);
+
+  /**
+   * Forgets the tombstones with an otime timestamp at or before oldest.
+   * Returns how many were forgotten, and sets lastTick to the otime ticks of
+   * the newest of them.
+   */
+  size_t ageOut(time_t oldest, ClockTicks& lastTick);
+
+  const_reverse_iterator newest() const {
+    return tombstones_.rbegin();
+  }
+  const_reverse_iterator end() const {
+    return tombstones_.rend();
+  }
+
+  /** The otime ticks of the newest tombstone, or 0 if there are none. */
+  ClockTicks newestTick() const {
+    return tombstones_.empty() ? 0 : tombstones_.back().otime.ticks;
+  }
+
+  size_t size() const {
+    return tombstones_.size();
+  }
+
+ private:
+  std::deque<Tombstone> tombstones_;
+};
+
+/** A FileResult for a file that is only known through its tombstone. */
+class TombstoneFileResult : public FileResult {
+ public:
+  explicit TombstoneFileResult(const Tombstone& tombstone);
+
+  std::optional<FileInformation> stat() override;
+  std::optional<struct timespec> accessedTime() override;
+  std::optional<struct timespec> modifiedTime() override;
+  std::optional<struct timespec> changedTime() override;
+  std::optional<size_t> size() override;
+  w_string_piece baseName() override;
+  w_string_piece dirName() override;
+  std::optional<bool> exists() override;
+  std::optional<w_string> readLink() override;
+  std::optional<ClockStamp> ctime() override;
+  std::optional<ClockStamp> otime() override;
+  std::optional<FileResult::ContentHash> getContentSha1() override;
+  std::optional<FileResult::Spooky128Hash> getContentSpooky128() override;
+  std::optional<DType> dtype() override;
+  void batchFetchProperties(
+      const std::vector<std::unique_ptr<FileResult>>& files) override;
+
+ private:
+  Tombstone tombstone_;
+};
+
+} // namespace watchman
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Tracing.h"
+#include <folly/Synchronized.h>
+#include <folly/system/ThreadId.h>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "watchman/Logging.h"
+#include "watchman/RingBuffer.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+namespace {
+
+thread_local uint64_t currentClientId = 0;
+
+struct TraceIds {
+  std::unordered_map<w_string, uint32_t> rootIds;
+  std::unordered_map<uint32_t, w_string> rootPaths;
+  std::unordered_map<uint64_t, std::string> threadNames;
+};
+
+folly::Synchronized<TraceIds>& getTraceIds() {
+  static auto* ids = new folly::Synchronized<TraceIds>;
+  return *ids;
+}
+
+// nullptr if trace_ring_size is 0.
+RingBuffer<TraceSpan>* getSpans() {
+  static auto* spans = []() -> RingBuffer<TraceSpan>* {
+    auto size = cfg_get_int("trace_ring_size", 16384);
+    if (size <= 0) {
+      return nullptr;
+    }
+    return new RingBuffer<TraceSpan>(uint32_t(size));
+  }();
+  return spans;
+}
+
+uint64_t toMicros(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+uint32_t getTraceRootId(const w_string& rootPath) {
+  auto ids = getTraceIds().wlock();
+  auto [it, inserted] = ids->rootIds.emplace(rootPath, 0);
+  if (inserted) {
+    // 0 is for spans with no root.
+    it->second = uint32_t(ids->rootIds.size());
+    ids->rootPaths.emplace(it->second, rootPath);
+  }
+  return it->second;
+}
+
+void setTraceClientId(uint64_t clientId) {
+  currentClientId = clientId;
+}
+
+void recordSpan(
+    const char* name,
+    uint32_t rootId,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end) {
+  auto* spans = getSpans();
+  if (!spans) {
+    return;
+  }
+
+  // Whatever the thread is called when it records its first span
+  thread_local const uint64_t threadId = [] {
+    auto id = folly::getOSThreadID();
+    getTraceIds().wlock()->threadNames.insert_or_assign(
+        id, Log::getThreadName());
+    return id;
+  }();
+
+  TraceSpan span;
+  span.name = name;
+  span.rootId = rootId;
+  span.clientId = currentClientId;
+  span.threadId = threadId;
+  span.start = toMicros(start);
+  span.duration = end > start ? toMicros(end) - span.start : 0;
+  spans->write(span);
+}
+
+json_ref traceToChromeJson(std::optional<uint32_t> rootId) {
+  std::vector<json_ref> events;
+  std::set<uint32_t> roots;
+  std::set<std::pair<uint32_t, uint64_t>> threads;
+
+  if (auto* spans = getSpans()) {
+    for (auto& span : spans->readAll()) {
+      if (rootId && span.rootId != *rootId && span.rootId != 0) {
+        continue;
+      }
+      roots.insert(span.rootId);
+      threads.emplace(span.rootId, span.threadId);
+
+      auto event = json_object(
+          {{"name", typed_string_to_json(span.name)},
+           {"ph", typed_string_to_json("X")},
+           {"ts", json_integer(span.start)},
+           {"dur", json_integer(span.duration)},
+           {"pid", json_integer(span.rootId)},
+           {"tid", json_integer(span.threadId)}});
+      if (span.clientId) {
+        event.set(
+            "args", json_object({{"client", json_integer(span.clientId)}}));
+      }
+      events.push_back(std::move(event));
+    }
+  }
+
+  // Name the processes after their roots and the threads as watchman does.
+  auto ids = getTraceIds().rlock();
+  auto metadata = [](const char* name, uint32_t pid, json_ref value) {
+    return json_object(
+        {{"name", typed_string_to_json(name)},
+         {"ph", typed_string_to_json("M")},
+         {"pid", json_integer(pid)},
+         {"args", json_object({{"name", std::move(value)}})}});
+  };
+  for (auto root : roots) {
+    auto it = ids->rootPaths.find(root);
+    events.push_back(metadata(
+        "process_name",
+        root,
+        it == ids->rootPaths.end() ? typed_string_to_json("watchman")
+                                   : w_string_to_json(it->second)));
+  }
+  for (auto& [root, thread] : threads) {
+    auto it = ids->threadNames.find(thread);
+    if (it == ids->threadNames.end()) {
+      continue;
+    }
+    auto event =
+        metadata("thread_name", root, typed_string_to_json(it->second));
+    event.set("tid", json_integer(thread));
+    events.push_back(std::move(event));
+  }
+
+  return json_object(
+      {{"traceEvents", json_array(std::move(events))},
+       {"displayTimeUnit", typed_string_to_json("ms")}});
+}
+
+} // namespace watchman
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+// Always-on tracing of where queries and IO threads spend their time, for
+// the debug-trace command. The most recent spans are kept in a process-wide
+// lock-free ring buffer of trace_ring_size entries; recording one copies a
+// few integers into it.
+
+/**
+ * A timed stage of some work. name must be a string literal, so that
+ * recording a span doesn't copy it.
+ */
+struct TraceSpan {
+  TraceSpan() noexcept {}
+
+  const char* name{nullptr};
+  // From getTraceRootId, or 0 if the work is not for a particular root.
+  uint32_t rootId{0};
+  // The client on whose thread the work ran, or 0.
+  uint64_t clientId{0};
+  uint64_t threadId{0};
+  // Microseconds on the steady clock
+  uint64_t start{0};
+  uint64_t duration{0};
+};
+
+/**
+ * Returns the id that identifies spans of the root at rootPath, which is
+ * the same each time it is asked for.
+ */
+uint32_t getTraceRootId(const w_string& rootPath);
+
+/**
+ * Attributes the spans that are subsequently recorded on this thread to the
+ * client with the given unique_id.
+ */
+void setTraceClientId(uint64_t clientId);
+
+void recordSpan(
+    const char* name,
+    uint32_t rootId,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end);
+
+/**
+ * Records a span from its construction to its destruction.
+ */
+class TraceScope {
+ public:
+  TraceScope(const char* name, uint32_t rootId)
+      : name_{name},
+        rootId_{rootId},
+        start_{std::chrono::steady_clock::now()} {}
+
+  ~TraceScope() {
+    recordSpan(name_, rootId_, start_, std::chrono::steady_clock::now());
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  const char* name_;
+  uint32_t rootId_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * The recorded spans in the Chrome trace event format, which Perfetto and
+ * chrome://tracing load. Each root is shown as a process and each thread as
+ * a thread of it. If rootId is set, only that root's spans and those of no
+ * root, such as clients encoding responses, are included.
+ */
+json_ref traceToChromeJson(std::optional<uint32_t> rootId = std::nullopt);
+
+} // namespace watchman
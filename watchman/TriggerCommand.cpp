@@ -6,12 +6,16 @@
  */
 
 #include "watchman/TriggerCommand.h"
+#include <folly/ScopeGuard.h>
 #include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <unordered_map>
 #include "watchman/Errors.h"
 #include "watchman/PDU.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
 #include "watchman/UserDir.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -23,6 +27,53 @@ namespace watchman {
 
 namespace {
 
+// How often the trigger thread checks whether its command has exited, or
+// whether there is now a slot to run it in.
+constexpr int kBusyPollMs = 50;
+
+// Counts the trigger commands that are running, so that no more than
+// trigger_max_concurrent run at once, nor more than
+// trigger_max_concurrent_per_root in any one root.
+class TriggerSlots {
+ public:
+  bool tryAcquire(const Root& root) {
+    auto globalMax = cfg_get_snapshot()->triggerMaxConcurrent;
+    auto rootMax = root.trigger_max_concurrent_per_root;
+
+    auto state = state_.wlock();
+    auto it = state->byRoot.find(root.root_path);
+    size_t inRoot = it == state->byRoot.end() ? 0 : it->second;
+    if ((globalMax > 0 && state->total >= size_t(globalMax)) ||
+        (rootMax > 0 && inRoot >= size_t(rootMax))) {
+      return false;
+    }
+    ++state->total;
+    ++state->byRoot[root.root_path];
+    return true;
+  }
+
+  void release(const Root& root) {
+    auto state = state_.wlock();
+    --state->total;
+    auto it = state->byRoot.find(root.root_path);
+    if (--it->second == 0) {
+      state->byRoot.erase(it);
+    }
+  }
+
+ private:
+  struct State {
+    size_t total{0};
+    std::unordered_map<w_string, size_t> byRoot;
+  };
+  folly::Synchronized<State> state_;
+};
+
+TriggerSlots& getTriggerSlots() {
+  static TriggerSlots slots;
+  return slots;
+}
+
 void parse_redirection(
     json_ref trig,
     std::string& name,
@@ -63,66 +114,42 @@ void parse_redirection(
   }
 }
 
-ResultErrno<std::unique_ptr<watchman_stream>> prepare_stdin(
-    TriggerCommand* cmd,
-    QueryResult* res) {
-  char stdin_file_name[WATCHMAN_NAME_MAX];
-
-  if (cmd->stdin_style == trigger_input_style::input_dev_null) {
-    return w_stm_open("/dev/null", O_RDONLY | O_CLOEXEC);
-  }
-
-  // Adjust result to fit within the specified limit
+// Adjust result to fit within the specified limit
+void limit_stdin_results(TriggerCommand* cmd, QueryResult* res) {
   if (cmd->max_files_stdin > 0) {
     auto& fileList = res->resultsArray.results;
     if (fileList.size() > cmd->max_files_stdin) {
       fileList.erase(fileList.begin() + cmd->max_files_stdin, fileList.end());
     }
   }
+}
 
-  /* prepare the input stream for the child process */
-  snprintf(
-      stdin_file_name,
-      sizeof(stdin_file_name),
-      "%s/wmanXXXXXX",
-      getTemporaryDirectory().c_str());
-  auto stdin_file = w_mkstemp(stdin_file_name);
-  if (!stdin_file) {
-    int err = errno;
-    logf(
-        ERR,
-        "unable to create a temporary file: {} {}\n",
-        stdin_file_name,
-        folly::errnoStr(err));
-    return err;
-  }
-
-  /* unlink the file, we don't need it in the filesystem;
-   * we'll pass the fd on to the child as stdin */
-  unlink(stdin_file_name); // FIXME: windows path translation
-
+// Writes the stdin that cmd wants for res to stm.
+ResultErrno<folly::Unit> write_stdin(
+    TriggerCommand* cmd,
+    QueryResult* res,
+    watchman_stream* stm) {
   switch (cmd->stdin_style) {
     case input_json: {
       PduBuffer buffer;
 
       logf(DBG, "input_json: sending json object to stm\n");
       auto encodeResult = buffer.jsonEncodeToStream(
-          std::move(res->resultsArray).toJson(), stdin_file.get(), 0);
+          std::move(res->resultsArray).toJson(), stm, 0);
       if (encodeResult.hasError()) {
         logf(
             ERR,
             "input_json: failed to write json data to stream: {}\n",
             folly::errnoStr(encodeResult.error()));
-        return encodeResult.error();
+        return encodeResult;
       }
       break;
     }
     case input_name_list:
       for (auto& name : res->resultsArray.results) {
         auto& nameStr = json_to_w_string(name);
-        if (stdin_file->write(nameStr.data(), nameStr.size()) !=
-                (int)nameStr.size() ||
-            stdin_file->write("\n", 1) != 1) {
+        if (stm->write(nameStr.data(), nameStr.size()) != (int)nameStr.size() ||
+            stm->write("\n", 1) != 1) {
           int err = errno;
           logf(
               ERR,
@@ -133,19 +160,105 @@ ResultErrno<std::unique_ptr<watchman_stream>> prepare_stdin(
       }
       break;
     case input_dev_null:
-      // already handled above
       break;
   }
+  return folly::unit;
+}
+
+ResultErrno<std::unique_ptr<watchman_stream>> prepare_stdin(
+    TriggerCommand* cmd,
+    QueryResult* res) {
+  char stdin_file_name[WATCHMAN_NAME_MAX];
+
+  if (cmd->stdin_style == trigger_input_style::input_dev_null) {
+    return w_stm_open("/dev/null", O_RDONLY | O_CLOEXEC);
+  }
+
+  limit_stdin_results(cmd, res);
+
+  /* prepare the input stream for the child process */
+  snprintf(
+      stdin_file_name,
+      sizeof(stdin_file_name),
+      "%s/wmanXXXXXX",
+      getTemporaryDirectory().c_str());
+  auto stdin_file = w_mkstemp(stdin_file_name);
+  if (!stdin_file) {
+    int err = errno;
+    logf(
+        ERR,
+        "unable to create a temporary file: {} {}\n",
+        stdin_file_name,
+        folly::errnoStr(err));
+    return err;
+  }
+
+  /* unlink the file, we don't need it in the filesystem;
+   * we'll pass the fd on to the child as stdin */
+  unlink(stdin_file_name); // FIXME: windows path translation
+
+  auto written = write_stdin(cmd, res, stdin_file.get());
+  if (written.hasError()) {
+    return written.error();
+  }
 
   stdin_file->rewind();
   return stdin_file;
 }
 
+// The options for spawning cmd, other than its stdin.
+ChildProcess::Options spawn_options(
+    const std::shared_ptr<Root>& root,
+    TriggerCommand* cmd) {
+  ChildProcess::Options opts;
+  opts.environment() = cmd->env;
+#ifndef _WIN32
+  sigset_t mask;
+  sigemptyset(&mask);
+  opts.setSigMask(mask);
+#endif
+  opts.setFlags(POSIX_SPAWN_SETPGROUP);
+
+  if (!cmd->stdout_name.empty()) {
+    opts.open(STDOUT_FILENO, cmd->stdout_name.c_str(), cmd->stdout_flags, 0666);
+  } else {
+    opts.dup2(FileDescriptor::stdOut(), STDOUT_FILENO);
+  }
+
+  if (!cmd->stderr_name.empty()) {
+    opts.open(STDERR_FILENO, cmd->stderr_name.c_str(), cmd->stderr_flags, 0666);
+  } else {
+    opts.dup2(FileDescriptor::stdErr(), STDERR_FILENO);
+  }
+
+  // Figure out the appropriate cwd
+  w_string working_dir(cmd->query->relative_root);
+  if (!working_dir) {
+    working_dir = root->root_path;
+  }
+
+  auto cwd = cmd->definition.get_optional("chdir");
+  if (cwd) {
+    auto target = json_to_w_string(*cwd);
+    if (w_is_path_absolute_cstr_len(target.data(), target.size())) {
+      working_dir = target;
+    } else {
+      working_dir = w_string::pathCat({working_dir, target});
+    }
+  }
+
+  log(DBG, "using ", working_dir, " for working dir\n");
+  opts.chdir(working_dir.c_str());
+
+  return opts;
+}
+
 void spawn_command(
     const std::shared_ptr<Root>& root,
     TriggerCommand* cmd,
     QueryResult* res,
-    ClockSpec* since_spec) {
+    ClockSpec* since_spec,
+    std::mutex& procMutex) {
   bool file_overflow = false;
 
   size_t arg_max = ChildProcess::getArgMax();
@@ -162,19 +275,26 @@ void spawn_command(
     file_overflow = true;
   }
 
-  auto stdin_file_res = prepare_stdin(cmd, res);
-  if (stdin_file_res.hasError()) {
-    logf(
-        ERR,
-        "trigger {}:{} {}\n",
-        root->root_path,
-        cmd->triggername,
-        folly::errnoStr(stdin_file_res.error()));
-    return;
+  // A streamed stdin is written to a pipe once the command is running,
+  // rather than to a temporary file before it is spawned.
+  bool stream = cmd->stream_stdin && cmd->stdin_style != input_dev_null;
+  std::unique_ptr<watchman_stream> stdin_file;
+  if (stream) {
+    limit_stdin_results(cmd, res);
+  } else {
+    auto stdin_file_res = prepare_stdin(cmd, res);
+    if (stdin_file_res.hasError()) {
+      logf(
+          ERR,
+          "trigger {}:{} {}\n",
+          root->root_path,
+          cmd->triggername,
+          folly::errnoStr(stdin_file_res.error()));
+      return;
+    }
+    stdin_file = std::move(stdin_file_res).value();
   }
 
-  auto stdin_file = std::move(stdin_file_res).value();
-
   // Assumption: that only one thread will be executing on a given
   // cmd instance so that mutation of cmd->env is safe.
   // This is guaranteed in the current architecture.
@@ -231,55 +351,26 @@ void spawn_command(
 
   cmd->env.setBool("WATCHMAN_FILES_OVERFLOW", file_overflow);
 
-  ChildProcess::Options opts;
-  opts.environment() = cmd->env;
-#ifndef _WIN32
-  sigset_t mask;
-  sigemptyset(&mask);
-  opts.setSigMask(mask);
-#endif
-  opts.setFlags(POSIX_SPAWN_SETPGROUP);
-
-  opts.dup2(stdin_file->getFileDescriptor(), STDIN_FILENO);
-
-  if (!cmd->stdout_name.empty()) {
-    opts.open(STDOUT_FILENO, cmd->stdout_name.c_str(), cmd->stdout_flags, 0666);
+  auto opts = spawn_options(root, cmd);
+  if (stream) {
+    opts.pipeStdin();
   } else {
-    opts.dup2(FileDescriptor::stdOut(), STDOUT_FILENO);
+    opts.dup2(stdin_file->getFileDescriptor(), STDIN_FILENO);
   }
 
-  if (!cmd->stderr_name.empty()) {
-    opts.open(STDERR_FILENO, cmd->stderr_name.c_str(), cmd->stderr_flags, 0666);
-  } else {
-    opts.dup2(FileDescriptor::stdErr(), STDERR_FILENO);
-  }
-
-  // Figure out the appropriate cwd
-  w_string working_dir(cmd->query->relative_root);
-  if (!working_dir) {
-    working_dir = root->root_path;
-  }
-
-  auto cwd = cmd->definition.get_optional("chdir");
-  if (cwd) {
-    auto target = json_to_w_string(*cwd);
-    if (w_is_path_absolute_cstr_len(target.data(), target.size())) {
-      working_dir = target;
-    } else {
-      working_dir = w_string::pathCat({working_dir, target});
-    }
-  }
-
-  log(DBG, "using ", working_dir, " for working dir\n");
-  opts.chdir(working_dir.c_str());
-
+  std::unique_ptr<watchman_stream> stdin_pipe;
   try {
+    std::lock_guard<std::mutex> lock{procMutex};
     if (cmd->current_proc) {
       cmd->current_proc->kill();
       cmd->current_proc->wait();
     }
     cmd->current_proc = std::make_unique<ChildProcess>(
         json_array(std::move(args)), std::move(opts));
+    if (stream) {
+      stdin_pipe =
+          w_stm_fdopen(std::move(cmd->current_proc->takeStdin()->write));
+    }
   } catch (const std::exception& exc) {
     log(ERR,
         "trigger ",
@@ -293,6 +384,13 @@ void spawn_command(
 
   // We have integration tests that check for this string
   log(cmd->current_proc ? DBG : ERR, "posix_spawnp: ", cmd->triggername, "\n");
+
+  if (stdin_pipe) {
+    // The writes block while the command is behind in reading them, and
+    // closing the pipe afterwards tells it that there is no more. Failures
+    // have been logged.
+    (void)write_stdin(cmd, res, stdin_pipe.get());
+  }
 }
 
 } // namespace
@@ -305,6 +403,8 @@ TriggerCommand::TriggerCommand(
       append_files(false),
       stdin_style(input_dev_null),
       max_files_stdin(0),
+      stream_stdin(false),
+      persistent(false),
       stdout_flags(0),
       stderr_flags(0),
       savedStateFactory_{savedStateFactory},
@@ -346,6 +446,7 @@ TriggerCommand::TriggerCommand(
     // "easy" workaround, we'll capture the list of names from the deduping
     // mechanism.
     query->dedup_results = true;
+    query->collect_deduped_names = true;
   }
 
   auto ele = definition.get_optional("stdin");
@@ -369,6 +470,24 @@ TriggerCommand::TriggerCommand(
     throw CommandValidationError("invalid value for stdin");
   }
 
+  stream_stdin = trig.get_default("stream_stdin", json_false()).asBool();
+
+  persistent = trig.get_default("persistent", json_false()).asBool();
+  if (persistent) {
+    if (append_files) {
+      throw CommandValidationError(
+          "append_files cannot be used with a persistent trigger");
+    }
+    if (!ele) {
+      stdin_style = input_json;
+      parse_field_list(
+          json_array({typed_string_to_json("name")}), &query->fieldList);
+    } else if (stdin_style != input_json) {
+      throw CommandValidationError(
+          "the stdin of a persistent trigger must be a list of fields");
+    }
+  }
+
   // unlimited unless specified
   auto ival = trig.get_default("max_files_stdin", json_integer(0)).asInt();
   if (ival < 0) {
@@ -405,35 +524,82 @@ void TriggerCommand::run(const std::shared_ptr<Root>& root) {
 
     log(DBG, "waiting for settle\n");
 
+    // Whether this trigger's command counts towards the concurrency limits
+    bool holdsSlot = false;
+    auto releaseSlot = [&] {
+      if (holdsSlot) {
+        getTriggerSlots().release(*root);
+        holdsSlot = false;
+      }
+    };
+    SCOPE_EXIT {
+      releaseSlot();
+    };
+    // Set by settles that have yet to be run for. However many of them there
+    // are, one run covers them all, since its query starts from the clock of
+    // the previous run.
+    bool runPending = false;
+
     while (!w_is_stopping() && !stopTrigger_) {
-      ignore_result(w_poll_events(pfd, 1, 86400));
+      // Nothing says when the command exits, so check on it until it does.
+      bool busy = current_proc || runPending;
+      ignore_result(w_poll_events(pfd, 1, busy ? kBusyPollMs : 86400));
       if (w_is_stopping() || stopTrigger_) {
         break;
       }
       while (ping_->testAndClear()) {
         pending.clear();
-        subscriber_->getPending(pending);
-        bool seenSettle = false;
+        // If settles were discarded while we were running the command,
+        // we must still run it again for them.
+        bool seenSettle = subscriber_->getPending(pending);
         for (auto& item : pending) {
           if (item->payload.get_optional("settled")) {
             seenSettle = true;
             break;
           }
         }
-
         if (seenSettle) {
-          if (!maybeSpawn(root)) {
-            continue;
-          }
-          waitNoIntr();
+          runPending = true;
+        }
+      }
+
+      if (current_proc) {
+        if (!current_proc->terminated()) {
+          continue;
+        }
+        {
+          std::lock_guard<std::mutex> lock{procMutex_};
+          current_proc.reset();
         }
+        releaseSlot();
+      }
+
+      if (!runPending) {
+        continue;
+      }
+      // A persistent trigger's command is always running, and isn't limited.
+      if (!persistent && !holdsSlot) {
+        holdsSlot = getTriggerSlots().tryAcquire(*root);
+        if (!holdsSlot) {
+          continue;
+        }
+      }
+      runPending = false;
+      maybeSpawn(root);
+      if (!current_proc) {
+        // There was nothing to run, or it failed to start.
+        releaseSlot();
       }
     }
 
-    if (current_proc) {
-      current_proc->kill();
-      current_proc->wait();
+    {
+      std::lock_guard<std::mutex> lock{procMutex_};
+      if (current_proc) {
+        current_proc->kill();
+        current_proc->wait();
+      }
     }
+    stopWorker();
   } catch (const std::exception& exc) {
     log(ERR, "Uncaught exception in trigger thread: ", exc.what(), "\n");
   }
@@ -443,6 +609,17 @@ void TriggerCommand::run(const std::shared_ptr<Root>& root) {
 
 void TriggerCommand::stop() {
   stopTrigger_ = true;
+  {
+    // The trigger thread may be blocked writing to a command that has
+    // stopped reading.
+    std::lock_guard<std::mutex> lock{procMutex_};
+    if (current_proc) {
+      current_proc->kill();
+    }
+    if (worker_) {
+      worker_->kill();
+    }
+  }
   if (triggerThread_.joinable()) {
     ping_->notify();
     triggerThread_.join();
@@ -514,7 +691,11 @@ bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
 
     if (!res.resultsArray.results.empty()) {
       didRun = true;
-      spawn_command(root, this, &res, saved_spec.get());
+      if (persistent) {
+        sendToWorker(root, &res, saved_spec.get());
+      } else {
+        spawn_command(root, this, &res, saved_spec.get(), procMutex_);
+      }
     }
     return didRun;
   } catch (const QueryExecError& e) {
@@ -528,14 +709,102 @@ bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
   }
 }
 
-bool TriggerCommand::waitNoIntr() {
-  if (!w_is_stopping() && !stopTrigger_) {
-    if (current_proc && current_proc->terminated()) {
-      current_proc.reset();
-      return true;
+bool TriggerCommand::startWorker(const std::shared_ptr<Root>& root) {
+  std::lock_guard<std::mutex> lock{procMutex_};
+  if (stopTrigger_) {
+    return false;
+  }
+  if (worker_ && !worker_->terminated()) {
+    return true;
+  }
+  workerStdin_.reset();
+  worker_.reset();
+
+  // The clocks of each run are sent along with its files instead.
+  env.unset("WATCHMAN_SINCE");
+  env.unset("WATCHMAN_CLOCK");
+  env.unset("WATCHMAN_FILES_OVERFLOW");
+  if (query->relative_root) {
+    env.set("WATCHMAN_RELATIVE_ROOT", query->relative_root);
+  } else {
+    env.unset("WATCHMAN_RELATIVE_ROOT");
+  }
+
+  auto opts = spawn_options(root, this);
+  opts.pipeStdin();
+  try {
+    worker_ = std::make_unique<ChildProcess>(command.value(), std::move(opts));
+    workerStdin_ = w_stm_fdopen(std::move(worker_->takeStdin()->write));
+  } catch (const std::exception& exc) {
+    log(ERR,
+        "trigger ",
+        root->root_path,
+        ":",
+        triggername,
+        " failed: ",
+        exc.what(),
+        "\n");
+    worker_.reset();
+  }
+
+  // We have integration tests that check for this string
+  log(worker_ ? DBG : ERR, "posix_spawnp: ", triggername, "\n");
+  return worker_ != nullptr;
+}
+
+void TriggerCommand::stopWorker() {
+  std::lock_guard<std::mutex> lock{procMutex_};
+  // Closing its stdin tells the worker to exit, which is all that there is
+  // on Windows, where kill() does nothing.
+  workerStdin_.reset();
+  if (worker_) {
+    worker_->kill();
+    worker_->wait();
+    worker_.reset();
+  }
+}
+
+void TriggerCommand::sendToWorker(
+    const std::shared_ptr<Root>& root,
+    QueryResult* res,
+    ClockSpec* since_spec) {
+  bool file_overflow = max_files_stdin > 0 &&
+      res->resultsArray.results.size() > max_files_stdin;
+  limit_stdin_results(this, res);
+
+  auto pdu = json_object({
+      {"trigger", w_string_to_json(triggername)},
+      {"root", w_string_to_json(root->root_path)},
+      {"clock",
+       w_string_to_json(res->clockAtStartOfQuery.position().toClockString())},
+      {"files_overflow", json_boolean(file_overflow)},
+      {"files", std::move(res->resultsArray).toJson()},
+  });
+  if (const auto* clock = since_spec
+          ? std::get_if<ClockSpec::Clock>(&since_spec->spec)
+          : nullptr) {
+    pdu.set("since", w_string_to_json(clock->position.toClockString()));
+  }
+
+  // A worker that has exited since the last run, or that exits while the
+  // PDU is being written, is replaced once.
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (!startWorker(root)) {
+      return;
     }
+    PduBuffer buffer;
+    auto result = buffer.bserEncodeToStream(1, 0, pdu, workerStdin_.get());
+    if (!result.hasError()) {
+      return;
+    }
+    logf(
+        ERR,
+        "trigger {}:{} failed to write to its command: {}\n",
+        root->root_path,
+        triggername,
+        folly::errnoStr(result.error()));
+    stopWorker();
   }
-  return false;
 }
 
 } // namespace watchman
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <mutex>
 #include <thread>
 
 #include "watchman/ChildProcess.h"
@@ -15,9 +16,12 @@
 
 namespace watchman {
 
+struct ClockSpec;
 class Event;
 class Root;
+class Stream;
 struct Query;
+struct QueryResult;
 
 enum trigger_input_style { input_dev_null, input_json, input_name_list };
 
@@ -31,6 +35,12 @@ struct TriggerCommand {
   bool append_files;
   enum trigger_input_style stdin_style;
   uint32_t max_files_stdin;
+  // Write stdin to a pipe while the command runs, rather than to a temporary
+  // file before it is spawned.
+  bool stream_stdin;
+  // Rather than spawning the command for each run, keep one running and
+  // send it each run's files as a BSER PDU on its stdin.
+  bool persistent;
 
   int stdout_flags;
   int stderr_flags;
@@ -59,13 +69,27 @@ struct TriggerCommand {
 
   void run(const std::shared_ptr<Root>& root);
   bool maybeSpawn(const std::shared_ptr<Root>& root);
-  bool waitNoIntr();
+  void sendToWorker(
+      const std::shared_ptr<Root>& root,
+      QueryResult* res,
+      ClockSpec* since_spec);
+  bool startWorker(const std::shared_ptr<Root>& root);
+  void stopWorker();
 
   const SavedStateFactory savedStateFactory_;
   std::thread triggerThread_;
   std::shared_ptr<Publisher::Subscriber> subscriber_;
   std::unique_ptr<Event> ping_;
   bool stopTrigger_{false};
+
+  // Held while current_proc or worker_ is started or stopped, so that stop()
+  // can kill a command that has stopped reading its stdin.
+  std::mutex procMutex_;
+
+  // The running command of a persistent trigger and the stream that it
+  // reads.
+  std::unique_ptr<ChildProcess> worker_;
+  std::unique_ptr<Stream> workerStdin_;
 };
 
 } // namespace watchman
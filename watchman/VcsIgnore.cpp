@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/VcsIgnore.h"
+#include <folly/FileUtil.h>
+#include <cstring>
+#include "watchman/Logging.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+namespace watchman {
+
+namespace {
+
+template <typename Fn>
+void forEachLine(w_string_piece contents, Fn fn) {
+  std::vector<w_string_piece> lines;
+  contents.split(lines, '\n');
+  for (auto line : lines) {
+    if (line.size() > 0 && line[line.size() - 1] == '\r') {
+      line = w_string_piece{line.data(), line.size() - 1};
+    }
+    fn(std::string{line.view()});
+  }
+}
+
+bool startsWith(const std::string& s, const char* prefix) {
+  return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+void trim(std::string& s) {
+  auto begin = s.find_first_not_of(" \t");
+  if (begin == std::string::npos) {
+    s.clear();
+    return;
+  }
+  s = s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+}
+
+// Escapes the wildcards in a literal path.
+std::string escapeGlob(const std::string& path) {
+  std::string escaped;
+  for (char c : path) {
+    if (c == '*' || c == '?' || c == '[' || c == '\\') {
+      escaped.push_back('\\');
+    }
+    escaped.push_back(c);
+  }
+  return escaped;
+}
+
+} // namespace
+
+VcsIgnoreRules VcsIgnoreRules::load(const w_string& rootPath) {
+  VcsIgnoreRules rules;
+  std::string contents;
+  // In increasing order of precedence.
+  for (auto name : {".git/info/exclude", ".gitignore"}) {
+    auto path = w_string::pathCat({rootPath, name});
+    if (folly::readFile(path.c_str(), contents)) {
+      rules.addGitIgnore(contents);
+    }
+  }
+  auto hgignore = w_string::pathCat({rootPath, ".hgignore"});
+  if (folly::readFile(hgignore.c_str(), contents)) {
+    rules.addHgIgnore(contents);
+  }
+  logf(DBG, "{} has {} VCS ignore rules\n", rootPath, rules.size());
+  return rules;
+}
+
+void VcsIgnoreRules::addGitIgnore(w_string_piece contents) {
+  forEachLine(contents, [&](std::string line) {
+    if (line.empty() || line[0] == '#') {
+      return;
+    }
+    // Trailing spaces are dropped unless they are escaped.
+    while (!line.empty() && line.back() == ' ' &&
+           !(line.size() > 1 && line[line.size() - 2] == '\\')) {
+      line.pop_back();
+    }
+
+    Rule rule;
+    if (line[0] == '!') {
+      rule.negate = true;
+      line.erase(0, 1);
+    } else if (startsWith(line, "\\!") || startsWith(line, "\\#")) {
+      line.erase(0, 1);
+    }
+    // Only dirs are matched, so a pattern that is limited to them is the
+    // same as one that is not.
+    if (!line.empty() && line.back() == '/') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      return;
+    }
+    // A separator anywhere but at the end anchors the pattern to the root.
+    if (line.find('/') != std::string::npos) {
+      rule.syntax = Syntax::RootGlob;
+      if (line[0] == '/') {
+        line.erase(0, 1);
+      }
+    } else {
+      rule.syntax = Syntax::BaseGlob;
+    }
+    rule.pattern = std::move(line);
+    rules_.push_back(std::move(rule));
+  });
+}
+
+void VcsIgnoreRules::addHgIgnore(w_string_piece contents) {
+  auto syntax = Syntax::Regex;
+  forEachLine(contents, [&](std::string line) {
+    // Comments start at any '#' that is not escaped.
+    for (size_t i = 0; i < line.size(); ++i) {
+      if (line[i] == '\\') {
+        ++i;
+      } else if (line[i] == '#') {
+        line.resize(i);
+        break;
+      }
+    }
+    size_t pos = 0;
+    while ((pos = line.find("\\#", pos)) != std::string::npos) {
+      line.erase(pos, 1);
+      ++pos;
+    }
+    trim(line);
+    if (line.empty()) {
+      return;
+    }
+
+    if (startsWith(line, "syntax:")) {
+      auto name = line.substr(strlen("syntax:"));
+      trim(name);
+      if (name == "re" || name == "regexp") {
+        syntax = Syntax::Regex;
+      } else if (name == "glob") {
+        syntax = Syntax::AnyGlob;
+      } else if (name == "rootglob") {
+        syntax = Syntax::RootGlob;
+      } else {
+        logf(ERR, ".hgignore: ignoring unknown syntax {}\n", name);
+      }
+      return;
+    }
+
+    Rule rule;
+    rule.syntax = syntax;
+    if (startsWith(line, "re:") || startsWith(line, "regexp:")) {
+      rule.syntax = Syntax::Regex;
+      line.erase(0, line.find(':') + 1);
+    } else if (startsWith(line, "glob:")) {
+      rule.syntax = Syntax::AnyGlob;
+      line.erase(0, strlen("glob:"));
+    } else if (startsWith(line, "rootglob:")) {
+      rule.syntax = Syntax::RootGlob;
+      line.erase(0, strlen("rootglob:"));
+    } else if (startsWith(line, "path:")) {
+      rule.syntax = Syntax::RootGlob;
+      line = escapeGlob(line.substr(strlen("path:")));
+    } else if (
+        startsWith(line, "include:") || startsWith(line, "subinclude:")) {
+      logf(ERR, ".hgignore: {} is not supported\n", line);
+      return;
+    }
+    if (rule.syntax == Syntax::Regex) {
+      try {
+        rule.regex = std::regex{line, std::regex::optimize};
+      } catch (const std::regex_error& exc) {
+        logf(ERR, ".hgignore: ignoring regexp {}: {}\n", line, exc.what());
+        return;
+      }
+    }
+    rule.pattern = std::move(line);
+    rules_.push_back(std::move(rule));
+  });
+}
+
+bool VcsIgnoreRules::matches(std::string& text, size_t len) const {
+  bool ignored = false;
+  for (auto& rule : rules_) {
+    bool match = false;
+    if (rule.syntax == Syntax::Regex) {
+      // hg patterns for a dir are often written to match what is in it,
+      // with a trailing separator.
+      match =
+          std::regex_search(text.data(), text.data() + len, rule.regex) ||
+          std::regex_search(text.data(), text.data() + len + 1, rule.regex);
+    } else {
+      text[len] = '\0';
+      const char* path = text.c_str();
+      if (rule.syntax == Syntax::RootGlob) {
+        match = wildmatch(rule.pattern.c_str(), path, WM_PATHNAME, nullptr) ==
+            WM_MATCH;
+      } else {
+        // Try the suffixes of the path that start at a component, from the
+        // basename up.
+        size_t start = len;
+        while (true) {
+          while (start > 0 && path[start - 1] != '/') {
+            --start;
+          }
+          match = wildmatch(
+                      rule.pattern.c_str(),
+                      path + start,
+                      WM_PATHNAME,
+                      nullptr) == WM_MATCH;
+          if (match || rule.syntax == Syntax::BaseGlob || start == 0) {
+            break;
+          }
+          // Step over the separator.
+          --start;
+        }
+      }
+      text[len] = '/';
+    }
+    if (match) {
+      ignored = !rule.negate;
+    }
+  }
+  return ignored;
+}
+
+size_t VcsIgnoreRules::ignoredPrefix(w_string_piece relativePath) const {
+  if (rules_.empty()) {
+    return 0;
+  }
+  // Each prefix is followed by a separator, for the regexps.
+  std::string text{relativePath.view()};
+  text.push_back('/');
+  for (size_t i = 1; i < text.size(); ++i) {
+    if (text[i] == '/' && matches(text, i)) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+} // namespace watchman
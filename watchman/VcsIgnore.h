@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <regex>
+#include <string>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * The rules by which a root's version control system ignores paths, as
+ * read from its .gitignore, .git/info/exclude and .hgignore. Only dirs are
+ * tested against them, to decide which subtrees need not be crawled.
+ *
+ * .gitignore files below the root, and the include and subinclude
+ * directives of .hgignore, are not supported.
+ */
+class VcsIgnoreRules {
+ public:
+  /**
+   * Reads whichever of the root's ignore files exist.
+   */
+  static VcsIgnoreRules load(const w_string& rootPath);
+
+  // Adds the rules of a .gitignore, or of .git/info/exclude, at the root.
+  // The rules added later take precedence.
+  void addGitIgnore(w_string_piece contents);
+
+  // Adds the rules of a .hgignore, whose patterns default to regexps.
+  void addHgIgnore(w_string_piece contents);
+
+  bool empty() const {
+    return rules_.empty();
+  }
+
+  size_t size() const {
+    return rules_.size();
+  }
+
+  /**
+   * Returns the length of the shortest prefix of relativePath, which is
+   * relative to the root and separated by '/', that names a dir the VCS
+   * ignores; or 0 if it ignores none of them. The VCS never looks inside an
+   * ignored dir, so neither its rules nor its negations apply below it.
+   */
+  size_t ignoredPrefix(w_string_piece relativePath) const;
+
+ private:
+  enum class Syntax {
+    // Matched against the path, relative to the root.
+    RootGlob,
+    // Matched against the basename of the path.
+    BaseGlob,
+    // Matched against each suffix of the path that starts at a component,
+    // as hg glob patterns are.
+    AnyGlob,
+    // Searched for anywhere in the path.
+    Regex,
+  };
+
+  struct Rule {
+    Syntax syntax;
+    std::string pattern;
+    bool negate{false};
+    std::regex regex;
+  };
+
+  // Whether the first len bytes of text, a path relative to the root that
+  // is followed by a separator, are ignored by the rules alone. The
+  // separator is briefly replaced with a NUL for wildmatch.
+  bool matches(std::string& text, size_t len) const;
+
+  std::vector<Rule> rules_;
+};
+
+} // namespace watchman
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "watchman/Serde.h"
+
+namespace watchman {
+
+/**
+ * How far a view is behind the filesystem.
+ *
+ * The lags run from when the watcher received a change to when the IO thread
+ * applied it to the view, and are only measured for the changes the watcher
+ * reported.
+ */
+struct ViewLagStatus : serde::Object {
+  // Changes the watcher has queued that the IO thread has yet to take.
+  int64_t pending_from_watcher = 0;
+  // Changes the IO thread has taken and is yet to apply.
+  int64_t pending_in_io_thread = 0;
+  // The lag of the most recently applied change.
+  int64_t event_lag_ms = 0;
+  // The largest lag of the changes applied in the most recent batch.
+  int64_t max_event_lag_ms = 0;
+
+  template <typename X>
+  void map(X& x) {
+    x("pending_from_watcher", pending_from_watcher);
+    x("pending_in_io_thread", pending_in_io_thread);
+    x("event_lag_ms", event_lag_ms);
+    x("max_event_lag_ms", max_event_lag_ms);
+  }
+};
+
+} // namespace watchman
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <optional>
+#include "watchman/Serde.h"
+
+namespace watchman {
+
+/**
+ * Approximate memory used by a view, in bytes.
+ *
+ * The optional fields require a walk over the whole view and are only
+ * populated when a detailed breakdown is requested.
+ */
+struct ViewMemoryStats : serde::Object {
+  // Storage obtained from the system for file and dir nodes.
+  int64_t node_bytes_reserved = 0;
+  // The portion of node_bytes_reserved that is in use.
+  int64_t node_bytes_in_use = 0;
+  int64_t caches = 0;
+  int64_t pending = 0;
+
+  // File nodes, excluding their names.
+  std::optional<int64_t> files;
+  // Dir nodes, excluding their names.
+  std::optional<int64_t> dirs;
+  // File and dir names.
+  std::optional<int64_t> names;
+  // Per-dir child maps.
+  std::optional<int64_t> child_maps;
+
+  template <typename X>
+  void map(X& x) {
+    x("node_bytes_reserved", node_bytes_reserved);
+    x("node_bytes_in_use", node_bytes_in_use);
+    x("caches", caches);
+    x("pending", pending);
+    x.skip_if_default("files", files);
+    x.skip_if_default("dirs", dirs);
+    x.skip_if_default("names", names);
+    x.skip_if_default("child_maps", child_maps);
+  }
+};
+
+} // namespace watchman
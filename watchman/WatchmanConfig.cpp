@@ -8,6 +8,7 @@
 #include "watchman/WatchmanConfig.h"
 #include <folly/ExceptionString.h>
 #include <folly/Synchronized.h>
+#include <folly/concurrency/AtomicSharedPtr.h>
 #include <optional>
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
@@ -22,6 +23,52 @@ struct ConfigState {
 };
 folly::Synchronized<ConfigState> configState;
 
+// Published while configState is write locked, so that the snapshots are
+// replaced in the order that the config changes.
+folly::atomic_shared_ptr<const GlobalConfigSnapshot> configSnapshot{
+    std::make_shared<const GlobalConfigSnapshot>()};
+
+std::shared_ptr<const GlobalConfigSnapshot> parseSnapshot(
+    const std::optional<json_ref>& cfg) {
+  auto snapshot = std::make_shared<GlobalConfigSnapshot>();
+  if (!cfg) {
+    return snapshot;
+  }
+  auto get = [&](const char* name,
+                 bool (json_ref::*hasType)() const,
+                 const char* typeName) -> std::optional<json_ref> {
+    auto val = cfg->get_optional(name);
+    if (val && !((*val).*hasType)()) {
+      logf(ERR, "Expected config value {} to be {}\n", name, typeName);
+      return std::nullopt;
+    }
+    return val;
+  };
+
+  if (auto val = get(
+          "slow_command_log_threshold_seconds",
+          &json_ref::isNumber,
+          "a number")) {
+    snapshot->slowCommandLogThresholdSeconds = json_number_value(*val);
+  }
+  snapshot->perfSamplingThresh = cfg->get_optional("perf_sampling_thresh");
+  if (auto val = get("_use_bulkstat", &json_ref::isBool, "a boolean")) {
+    snapshot->useBulkStat = val->asBool();
+  }
+  if (auto val = get("io_uring_statx", &json_ref::isBool, "a boolean")) {
+    snapshot->ioUringStatx = val->asBool();
+  }
+  if (auto val =
+          get("trigger_max_concurrent", &json_ref::isInt, "an integer")) {
+    snapshot->triggerMaxConcurrent = val->asInt();
+  }
+  return snapshot;
+}
+
+void publishSnapshot(const ConfigState& state) {
+  configSnapshot.store(parseSnapshot(state.global_cfg));
+}
+
 std::optional<std::pair<json_ref, w_string>> loadSystemConfig() {
   const char* cfg_file = getenv("WATCHMAN_CONFIG_FILE");
 #ifdef WATCHMAN_CONFIG_FILE
@@ -126,6 +173,7 @@ std::optional<json_ref> loadUserConfig() {
 void cfg_shutdown() {
   auto state = configState.wlock();
   state->global_cfg.reset();
+  publishSnapshot(*state);
 }
 
 w_string cfg_get_global_config_file_path() {
@@ -150,6 +198,7 @@ void cfg_load_global_config_file() {
       json_object_set(*lockedState->global_cfg, key.c_str(), value);
     }
   }
+  publishSnapshot(*lockedState);
 }
 
 void cfg_set_global(const char* name, const json_ref& val) {
@@ -159,6 +208,7 @@ void cfg_set_global(const char* name, const json_ref& val) {
   }
 
   state->global_cfg->set(name, json_ref(val));
+  publishSnapshot(*state);
 }
 
 std::optional<json_ref> cfg_get_json(const char* name) {
@@ -170,6 +220,10 @@ std::optional<json_ref> cfg_get_json(const char* name) {
   }
 }
 
+std::shared_ptr<const GlobalConfigSnapshot> cfg_get_snapshot() {
+  return configSnapshot.load();
+}
+
 const char* cfg_get_string(const char* name, const char* defval) {
   auto val = cfg_get_json(name);
   if (!val) {
@@ -7,14 +7,42 @@
 
 #pragma once
 
+#include <memory>
+#include <optional>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 class w_string;
 
+namespace watchman {
+
+/**
+ * The global config values that are read per command, per event or per dir,
+ * parsed into plain fields each time the global config changes. Reading one
+ * takes neither the config lock nor a lookup by name.
+ *
+ * A value of the wrong type is logged and leaves its field at the default.
+ */
+struct GlobalConfigSnapshot {
+  // slow_command_log_threshold_seconds
+  double slowCommandLogThresholdSeconds{1.0};
+  // perf_sampling_thresh: a number, or an object keyed by sample name.
+  std::optional<json_ref> perfSamplingThresh;
+  // _use_bulkstat; when unset, the platform's default applies.
+  std::optional<bool> useBulkStat;
+  // io_uring_statx
+  bool ioUringStatx{false};
+  // trigger_max_concurrent
+  json_int_t triggerMaxConcurrent{0};
+};
+
+} // namespace watchman
+
 void cfg_shutdown();
 void cfg_load_global_config_file();
 w_string cfg_get_global_config_file_path();
 std::optional<json_ref> cfg_get_json(const char* name);
+// The current snapshot, which is replaced rather than changed on reload.
+std::shared_ptr<const watchman::GlobalConfigSnapshot> cfg_get_snapshot();
 const char* cfg_get_string(const char* name, const char* defval);
 json_int_t cfg_get_int(const char* name, json_int_t defval);
 bool cfg_get_bool(const char* name, bool defval);
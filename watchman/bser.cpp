@@ -6,6 +6,11 @@
  */
 
 #include "watchman/bser.h"
+#include <folly/io/Compression.h>
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <string>
 #include "watchman/Logging.h"
 #include "watchman/thirdparty/jansson/jansson_private.h"
 
@@ -278,6 +283,23 @@ static int bser_template(
   for (size_t i = 0; i < n; i++) {
     auto& obj = array_arr[i];
 
+    if (obj.isArray()) {
+      // The values are already in template order
+      auto& values = obj.array();
+      for (size_t pi = 0; pi < pn; pi++) {
+        if (pi >= values.size()) {
+          if (ctx->dump(&bser_skip, sizeof(bser_skip), data)) {
+            return -1;
+          }
+          continue;
+        }
+        if (w_bser_dump(ctx, values[pi], data)) {
+          return -1;
+        }
+      }
+      continue;
+    }
+
     // For each factored key
     for (size_t pi = 0; pi < pn; pi++) {
       const char* key = json_string_value(templ_arr[pi]);
@@ -401,32 +423,68 @@ int w_bser_dump(const bser_ctx_t* ctx, const json_ref& json, void* data) {
   }
 }
 
-static int measure(const char*, size_t size, void* ptr) {
-  auto tot = (json_int_t*)ptr;
-  *tot += size;
+static int append_to_string(const char* buffer, size_t size, void* ptr) {
+  static_cast<std::string*>(ptr)->append(buffer, size);
   return 0;
 }
 
+// Returns the compressed form of value, as it is sent in a PDU with
+// BSER_CAP_ZSTD set, or nothing if it cannot be made any smaller.
+static std::optional<std::string> bser_compress(const std::string& value) {
+  if (!folly::io::hasCodec(folly::io::CodecType::ZSTD)) {
+    return std::nullopt;
+  }
+
+  std::string compressed;
+  bser_ctx_t ctx{2, 0, append_to_string};
+  if (bser_int(&ctx, json_int_t(value.size()), &compressed)) {
+    return std::nullopt;
+  }
+  try {
+    compressed.append(
+        folly::io::getCodec(folly::io::CodecType::ZSTD)->compress(value));
+  } catch (const std::exception& exc) {
+    watchman::logf(watchman::ERR, "failed to compress PDU: {}\n", exc.what());
+    return std::nullopt;
+  }
+
+  if (compressed.size() >= value.size()) {
+    return std::nullopt;
+  }
+  return compressed;
+}
+
 int w_bser_write_pdu(
     const uint32_t bser_version,
     const uint32_t bser_capabilities,
     json_dump_callback_t dump,
     const json_ref& json,
     void* data) {
-  json_int_t m_size = 0;
-  bser_ctx_t ctx{bser_version, bser_capabilities, measure};
+  // The length of the value precedes it, so encode it into a buffer first,
+  // rather than encoding it once to measure it and again to write it.
+  std::string encoded;
+  bser_ctx_t ctx{bser_version, bser_capabilities, append_to_string};
 
   if (!is_bser_version_supported(&ctx)) {
     return -1;
   }
 
-  if (w_bser_dump(&ctx, json, &m_size)) {
+  if (w_bser_dump(&ctx, json, &encoded)) {
     return -1;
   }
 
-  // To actually write the contents
   ctx.dump = dump;
 
+  // The capabilities word describes this PDU, not the one it replies to.
+  uint32_t pdu_capabilities = bser_capabilities & ~BSER_CAP_ZSTD;
+  if (bser_version == 2 && (bser_capabilities & BSER_CAP_ACCEPT_ZSTD) &&
+      encoded.size() >= BSER_COMPRESS_MIN_SIZE) {
+    if (auto compressed = bser_compress(encoded)) {
+      encoded = std::move(*compressed);
+      pdu_capabilities |= BSER_CAP_ZSTD;
+    }
+  }
+
   if (bser_version == 2) {
     if (dump(BSER_V2_MAGIC, 2, data)) {
       return -1;
@@ -439,22 +497,66 @@ int w_bser_write_pdu(
 
   if (bser_version == 2) {
     if (dump(
-            (const char*)&bser_capabilities, sizeof(bser_capabilities), data)) {
+            (const char*)&pdu_capabilities, sizeof(pdu_capabilities), data)) {
       return -1;
     }
   }
 
-  if (bser_int(&ctx, m_size, data)) {
+  if (bser_int(&ctx, json_int_t(encoded.size()), data)) {
     return -1;
   }
 
-  if (w_bser_dump(&ctx, json, data)) {
+  if (dump(encoded.data(), encoded.size(), data)) {
     return -1;
   }
 
   return 0;
 }
 
+bool bunser_uncompress(
+    const char* buf,
+    const char* end,
+    std::string& value,
+    json_error_t* jerr) {
+  json_int_t needed;
+  json_int_t len;
+  if (!bunser_int(buf, end - buf, &needed, &len) || len < 0 ||
+      uint64_t(len) > std::numeric_limits<uint32_t>::max()) {
+    snprintf(
+        jerr->text,
+        sizeof(jerr->text),
+        "invalid uncompressed length for compressed PDU");
+    return false;
+  }
+  buf += needed;
+
+  if (!folly::io::hasCodec(folly::io::CodecType::ZSTD)) {
+    snprintf(
+        jerr->text, sizeof(jerr->text), "zstd compression is not available");
+    return false;
+  }
+  try {
+    value = folly::io::getCodec(folly::io::CodecType::ZSTD)
+                ->uncompress(
+                    folly::StringPiece{buf, size_t(end - buf)}, uint64_t(len));
+  } catch (const std::exception& exc) {
+    snprintf(
+        jerr->text,
+        sizeof(jerr->text),
+        "failed to uncompress PDU: %s",
+        exc.what());
+    return false;
+  }
+  if (value.size() != size_t(len)) {
+    snprintf(
+        jerr->text,
+        sizeof(jerr->text),
+        "compressed PDU has the wrong uncompressed length");
+    return false;
+  }
+  return true;
+}
+
 static std::optional<json_ref> bunser_array(
     const char* buf,
     const char* end,
@@ -491,7 +593,10 @@ static std::optional<json_ref> bunser_array(
   total += needed;
   buf += needed;
 
+  // Every element takes at least one byte, which bounds the reservation for
+  // a malformed count.
   std::vector<json_ref> arrval;
+  arrval.reserve(size_t(std::min(nelems, json_int_t(end - buf))));
   for (i = 0; i < nelems; i++) {
     needed = 0;
     auto item = bunser(buf, end, &needed, jerr);
@@ -559,12 +664,20 @@ static std::optional<json_ref> bunser_template(
 
   auto& templ_arr = templ->array();
   size_t np = templ_arr.size();
+  for (auto& name : templ_arr) {
+    if (!name.isString()) {
+      *used = total;
+      snprintf(
+          jerr->text, sizeof(jerr->text), "template keys must be strings");
+      return std::nullopt;
+    }
+  }
 
   // Now load up the array with object values
   std::vector<json_ref> arrval;
-  arrval.reserve((size_t)nelems);
+  arrval.reserve(size_t(std::min(nelems, json_int_t(end - buf))));
   for (i = 0; i < nelems; i++) {
-    std::unordered_map<w_string, json_ref> item;
+    json_object_map item;
     item.reserve(np);
     for (size_t ip = 0; ip < np; ip++) {
       if (*buf == BSER_SKIP) {
@@ -582,7 +695,8 @@ static std::optional<json_ref> bunser_template(
       buf += needed;
       total += needed;
 
-      item.insert_or_assign(json_string_value(templ_arr[ip]), std::move(*val));
+      // Each row shares the key strings of the template
+      item.insert_or_assign(json_to_w_string(templ_arr[ip]), std::move(*val));
     }
 
     arrval.push_back(json_object(std::move(item)));
@@ -600,7 +714,6 @@ static std::optional<json_ref> bunser_object(
   json_int_t needed;
   json_int_t total = 0;
   json_int_t i, nelems;
-  char keybuf[128];
 
   total = 1;
   buf++;
@@ -617,7 +730,10 @@ static std::optional<json_ref> bunser_object(
   total += needed;
   buf += needed;
 
-  auto objval = json_object();
+  // Every property takes at least two bytes, which bounds the reservation
+  // for a malformed count.
+  json_object_map objval;
+  objval.reserve(size_t(std::min(nelems, json_int_t(end - buf) / 2)));
   for (i = 0; i < nelems; i++) {
     const char* start;
     json_int_t slen;
@@ -631,15 +747,7 @@ static std::optional<json_ref> bunser_object(
     }
     total += needed;
     buf += needed;
-
-    // Saves us allocating a string when the library is going to
-    // do that anyway
-    if ((uint16_t)slen > sizeof(keybuf) - 1) {
-      snprintf(jerr->text, sizeof(jerr->text), "object key is too long");
-      return std::nullopt;
-    }
-    memcpy(keybuf, start, (size_t)slen);
-    keybuf[slen] = '\0';
+    w_string key{start, size_t(slen), W_STRING_BYTE};
 
     // Read value
     auto item = bunser(buf, end, &needed, jerr);
@@ -651,15 +759,11 @@ static std::optional<json_ref> bunser_object(
       return std::nullopt;
     }
 
-    if (json_object_set_new_nocheck(objval, keybuf, std::move(*item))) {
-      *used = total;
-      snprintf(jerr->text, sizeof(jerr->text), "failed to add object property");
-      return std::nullopt;
-    }
+    objval.insert_or_assign(std::move(key), std::move(*item));
   }
 
   *used = total;
-  return objval;
+  return json_object(std::move(objval));
 }
 
 std::optional<json_ref> bunser(
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <string>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 typedef struct bser_ctx {
@@ -21,6 +22,15 @@ typedef struct bser_ctx {
 // BSERv2 capabilities. Must be powers of 2.
 #define BSER_CAP_DISABLE_UNICODE 0x1
 #define BSER_CAP_DISABLE_UNICODE_FOR_ERRORS 0x2
+// Sent by a peer that can read zstd compressed PDUs. Those of the replies
+// to it whose value encodes to at least BSER_COMPRESS_MIN_SIZE bytes are
+// compressed.
+#define BSER_CAP_ACCEPT_ZSTD 0x4
+// Set on a PDU whose value is zstd compressed. The value is then the
+// uncompressed length, as an encoded integer, followed by a zstd frame.
+#define BSER_CAP_ZSTD 0x8
+
+#define BSER_COMPRESS_MIN_SIZE (64 * 1024)
 
 int w_bser_write_pdu(
     const uint32_t bser_version,
@@ -39,3 +49,14 @@ std::optional<json_ref> bunser(
     const char* end,
     json_int_t* needed,
     json_error_t* jerr);
+
+/**
+ * Uncompresses the value of a PDU that has BSER_CAP_ZSTD set, which spans
+ * buf to end, into value. Returns false, with jerr describing the problem,
+ * if it cannot be uncompressed.
+ */
+bool bunser_uncompress(
+    const char* buf,
+    const char* end,
+    std::string& value,
+    json_error_t* jerr);
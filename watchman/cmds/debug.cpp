@@ -14,8 +14,10 @@
 #include "watchman/InMemoryView.h"
 #include "watchman/LRUCache.h"
 #include "watchman/Logging.h"
+#include "watchman/Metrics.h"
 #include "watchman/Poison.h"
 #include "watchman/QueryableView.h"
+#include "watchman/Tracing.h"
 #include "watchman/root/Root.h"
 #include "watchman/watchman_cmd.h"
 
@@ -81,9 +83,10 @@ static UntypedResponse cmd_debug_ageout(Client* client, const json_ref& args) {
   std::chrono::seconds min_age(args.array()[2].asInt());
 
   UntypedResponse resp;
-  root->performAgeOut(min_age);
+  auto stats = root->performAgeOut(min_age);
 
   resp.set("ageout", json_true());
+  resp.set("age_out", std::move(stats));
   return resp;
 }
 W_CMD_REG("debug-ageout", cmd_debug_ageout, CMD_DAEMON, w_cmd_realpath_root);
@@ -292,12 +295,14 @@ struct DebugStatusCommand : PrettyCommand<DebugStatusCommand> {
   struct Response : BaseResponse {
     std::vector<RootDebugStatus> roots;
     std::vector<ClientDebugStatus> clients;
+    std::vector<PeerUsageStatus> peers;
 
     template <typename X>
     void map(X& x) {
       BaseResponse::map(x);
       x("roots", roots);
       x("clients", clients);
+      x("peers", peers);
     }
   };
 
@@ -306,6 +311,7 @@ struct DebugStatusCommand : PrettyCommand<DebugStatusCommand> {
     res.version = w_string{PACKAGE_VERSION, W_STRING_UNICODE};
     res.roots = Root::getStatusForAllRoots();
     res.clients = UserClient::getStatusForAllClients();
+    res.peers = UserClient::getUsageByPeer();
     return res;
   }
 
@@ -323,6 +329,22 @@ struct DebugStatusCommand : PrettyCommand<DebugStatusCommand> {
       fmt::print("  - uptime: {} s\n", root.uptime);
       fmt::print("  - crawl_status: {}\n", root.crawl_status);
       fmt::print("  - done_initial: {}\n", root.done_initial);
+      if (root.settle) {
+        fmt::print(
+            "  - settle: {} ms ({} premature, {} forced)\n",
+            root.settle->settle_ms,
+            root.settle->premature_settles,
+            root.settle->forced_settles);
+      }
+      if (root.lag) {
+        fmt::print(
+            "  - lag: {} ms (max {} ms), {} pending from watcher, "
+            "{} in io thread\n",
+            root.lag->event_lag_ms,
+            root.lag->max_event_lag_ms,
+            root.lag->pending_from_watcher,
+            root.lag->pending_in_io_thread);
+      }
       fmt::print("\n");
     }
 
@@ -340,9 +362,33 @@ struct DebugStatusCommand : PrettyCommand<DebugStatusCommand> {
             std::chrono::system_clock::from_time_t(client.since.value()));
       }
       fmt::print("  - state: {}\n", client.state);
+      printUsage(client.usage);
+      fmt::print("\n");
+    }
+
+    fmt::print("PEERS\n-----\n");
+    for (auto& peer : response.peers) {
+      fmt::print("{}: {}\n", peer.peer.pid, shellQuoteCommand(peer.peer.name));
+      fmt::print("  - connections: {}\n", peer.connections);
+      printUsage(peer.usage);
       fmt::print("\n");
     }
   }
+
+  static void printUsage(const ClientUsageStatus& usage) {
+    fmt::print(
+        "  - dispatch cpu: {:.3f} s\n", usage.dispatch_cpu_us / 1000000.0);
+    fmt::print(
+        "  - bytes: {} received, {} sent\n",
+        usage.bytes_received,
+        usage.bytes_sent);
+    fmt::print(
+        "  - queries: {} (view lock held {:.3f} s)\n",
+        usage.queries,
+        usage.view_lock_us / 1000000.0);
+    fmt::print(
+        "  - subscription deliveries: {}\n", usage.subscription_deliveries);
+  }
 };
 WATCHMAN_COMMAND(debug_status, DebugStatusCommand);
 
@@ -372,6 +418,36 @@ struct DebugRootStatusCommand : TypedCommand<DebugRootStatusCommand> {
 };
 WATCHMAN_COMMAND(debug_root_status, DebugRootStatusCommand);
 
+struct DebugMemoryCommand : TypedCommand<DebugMemoryCommand> {
+  static constexpr std::string_view name = "debug-memory";
+  static constexpr CommandFlags flags = CMD_DAEMON;
+
+  using Request = serde::Array<1, w_string>;
+
+  struct Response : BaseResponse {
+    ViewMemoryStats memory;
+
+    template <typename X>
+    void map(X& x) {
+      BaseResponse::map(x);
+      x("memory", memory);
+    }
+  };
+
+  static Response handle(Client* client, const Request& req) {
+    Response res;
+    res.version = w_string{PACKAGE_VERSION, W_STRING_UNICODE};
+    auto root = resolveRootByName(client, std::get<0>(req).c_str());
+    auto stats = root->view()->getMemoryStats(true);
+    if (!stats) {
+      throw ErrorResponse("debug-memory is not supported by this watcher");
+    }
+    res.memory = std::move(*stats);
+    return res;
+  }
+};
+WATCHMAN_COMMAND(debug_memory, DebugMemoryCommand);
+
 static UntypedResponse cmd_debug_watcher_info(
     Client* clientbase,
     const json_ref& args) {
@@ -409,8 +485,10 @@ void addCacheStats(UntypedResponse& resp, const CacheStats& stats) {
        {"cacheStore", json_integer(stats.cacheStore)},
        {"cacheLoad", json_integer(stats.cacheLoad)},
        {"cacheErase", json_integer(stats.cacheErase)},
+       {"cacheReject", json_integer(stats.cacheReject)},
        {"clearCount", json_integer(stats.clearCount)},
-       {"size", json_integer(stats.size)}});
+       {"size", json_integer(stats.size)},
+       {"bytes", json_integer(stats.bytes)}});
 }
 
 UntypedResponse debugContentHashCache(Client* client, const json_ref& args) {
@@ -426,9 +504,13 @@ UntypedResponse debugContentHashCache(Client* client, const json_ref& args) {
     throw ErrorResponse("root is not an InMemoryView watcher");
   }
 
-  auto stats = view->debugAccessCaches().contentHashCache.stats();
+  auto& caches = view->debugAccessCaches();
   UntypedResponse resp;
-  addCacheStats(resp, stats);
+  addCacheStats(resp, caches.contentHashCache.stats());
+  resp.set(
+      {{"warmDirs", json_integer(caches.contentHashInterest.numDirs())},
+       {"warmSuffixes",
+        json_integer(caches.contentHashInterest.numSuffixes())}});
   return resp;
 }
 W_CMD_REG(
@@ -462,5 +544,58 @@ W_CMD_REG(
     CMD_DAEMON,
     w_cmd_realpath_root);
 
+// The server's counters and histograms. With {"format": "openmetrics"},
+// they are rendered as OpenMetrics text in the "openmetrics" field instead,
+// for collectors that scrape that format.
+UntypedResponse debugMetrics(Client*, const json_ref& args) {
+  bool openMetrics = false;
+  if (json_array_size(args) == 2) {
+    const auto& options = args.at(1);
+    if (!options.isObject()) {
+      throw ErrorResponse(
+          "expected the 'debug-metrics' options to be an object");
+    }
+    if (auto format = options.get_optional("format")) {
+      if (!format->isString() ||
+          (format->asString() != "json" &&
+           format->asString() != "openmetrics")) {
+        throw ErrorResponse(
+            "'format' must be either \"json\" or \"openmetrics\"");
+      }
+      openMetrics = format->asString() == "openmetrics";
+    }
+  } else if (json_array_size(args) != 1) {
+    throw ErrorResponse("wrong number of arguments for 'debug-metrics'");
+  }
+
+  UntypedResponse resp;
+  if (openMetrics) {
+    resp.set("openmetrics", typed_string_to_json(metricsToOpenMetrics()));
+  } else {
+    auto metrics = metricsToJson();
+    resp.set(
+        {{"counters", metrics.get("counters")},
+         {"histograms", metrics.get("histograms")}});
+  }
+  return resp;
+}
+W_CMD_REG("debug-metrics", debugMetrics, CMD_DAEMON, NULL);
+
+// The recent trace spans, optionally only those of a root, in the Chrome
+// trace event format.
+UntypedResponse debugTrace(Client* client, const json_ref& args) {
+  std::optional<uint32_t> rootId;
+  if (json_array_size(args) == 2) {
+    rootId = resolveRoot(client, args)->traceId;
+  } else if (json_array_size(args) != 1) {
+    throw ErrorResponse("wrong number of arguments for 'debug-trace'");
+  }
+
+  UntypedResponse resp;
+  resp.set("trace", traceToChromeJson(rootId));
+  return resp;
+}
+W_CMD_REG("debug-trace", debugTrace, CMD_DAEMON, NULL);
+
 } // namespace
 } // namespace watchman
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+#include "watchman/Client.h"
+#include "watchman/QueryableView.h"
+#include "watchman/root/Root.h"
+#include "watchman/watchman_cmd.h"
+
+using namespace watchman;
+
+/* dump-view /root /path/to/file [{"sync_timeout": ms}]
+ * Writes a snapshot of every file in the view of the root to the file, for
+ * tools that need the full file list without rendering it as a query */
+static UntypedResponse cmd_dump_view(Client* client, const json_ref& args) {
+  int sync_timeout = 0;
+
+  if (json_array_size(args) == 4) {
+    auto& opts = args.at(3);
+    if (!opts.isObject()) {
+      throw ErrorResponse(
+          "the fourth argument to 'dump-view' must be an optional object");
+    }
+
+    auto sync = opts.get_optional("sync_timeout");
+    if (sync) {
+      if (!sync->isInt()) {
+        throw ErrorResponse(
+            "the sync_timeout option passed to 'dump-view' must be an "
+            "integer");
+      }
+      sync_timeout = sync->asInt();
+    }
+  } else if (json_array_size(args) != 3) {
+    throw ErrorResponse("wrong number of arguments to 'dump-view'");
+  }
+
+  auto& pathArg = args.at(2);
+  if (!pathArg.isString()) {
+    throw ErrorResponse("the third argument to 'dump-view' must be a path");
+  }
+  auto path = json_to_w_string(pathArg);
+  if (!path.piece().pathIsAbsolute()) {
+    throw ErrorResponse("the path passed to 'dump-view' must be absolute");
+  }
+
+  auto root = resolveRoot(client, args);
+
+  if (sync_timeout) {
+    root->syncToNow(std::chrono::milliseconds(sync_timeout));
+  }
+
+  // Every change up to this clock is in the dump
+  UntypedResponse resp;
+  resp.set("clock", w_string_to_json(root->view()->getCurrentClockString()));
+
+  std::optional<size_t> files;
+  try {
+    files = root->view()->dumpView(path);
+  } catch (const std::exception& exc) {
+    throw ErrorResponse("failed to write {}: {}", path, exc.what());
+  }
+  if (!files) {
+    throw ErrorResponse(
+        "the {} watcher can't dump its view", root->view()->getName());
+  }
+
+  resp.set({{"path", w_string_to_json(path)}, {"files", json_integer(*files)}});
+  return resp;
+}
+W_CMD_REG("dump-view", cmd_dump_view, CMD_DAEMON, w_cmd_realpath_root);
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -5,11 +5,23 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <fmt/core.h>
 #include <folly/String.h>
 #include <folly/memory/Malloc.h>
+#include <algorithm>
+#include <optional>
+#include <vector>
 #include "watchman/Client.h"
+#include "watchman/HeapProfile.h"
+#include "watchman/QueryableView.h"
+#include "watchman/root/Root.h"
+#include "watchman/root/watchlist.h"
 #include "watchman/watchman_cmd.h"
 
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
 using namespace watchman;
 
 #if defined(FOLLY_USE_JEMALLOC)
@@ -34,3 +46,155 @@ static UntypedResponse cmd_debug_prof_dump(Client*, const json_ref&) {
 W_CMD_REG("debug-prof-dump", cmd_debug_prof_dump, CMD_DAEMON, NULL);
 
 #endif
+
+namespace {
+
+// The bytes the allocator has handed out and not had back, if it says.
+std::optional<int64_t> getAllocatedBytes() {
+#if defined(FOLLY_USE_JEMALLOC)
+  if (folly::usingJEMalloc()) {
+    // The statistics are only refreshed when the epoch is advanced.
+    uint64_t epoch = 1;
+    size_t epochSize = sizeof(epoch);
+    size_t allocated = 0;
+    size_t allocatedSize = sizeof(allocated);
+    if (mallctl("epoch", &epoch, &epochSize, &epoch, epochSize) == 0 &&
+        mallctl("stats.allocated", &allocated, &allocatedSize, nullptr, 0) ==
+            0) {
+      return int64_t(allocated);
+    }
+    return std::nullopt;
+  }
+#endif
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  auto info = mallinfo2();
+  return int64_t(info.uordblks + info.hblkhd);
+#else
+  return std::nullopt;
+#endif
+}
+
+struct HeapSubsystemStatus : serde::Object {
+  w_string tag;
+  // Accounted for from the sizes of the subsystem's structures
+  int64_t estimated_bytes = 0;
+  // Live JSON values made while the subsystem was tagged, from the samples
+  int64_t json_bytes = 0;
+  int64_t total_bytes = 0;
+
+  template <typename X>
+  void map(X& x) {
+    x("tag", tag);
+    x("estimated_bytes", estimated_bytes);
+    x("json_bytes", json_bytes);
+    x("total_bytes", total_bytes);
+  }
+};
+
+class DebugHeapSummaryCommand
+    : public PrettyCommand<DebugHeapSummaryCommand> {
+ public:
+  static constexpr std::string_view name = "debug-heap-summary";
+  static constexpr CommandFlags flags = CMD_DAEMON;
+
+  using Request = serde::Array<0>;
+
+  struct Response : BaseResponse {
+    json_int_t sample_interval = 0;
+    // Largest first
+    std::vector<HeapSubsystemStatus> subsystems;
+    std::optional<json_int_t> allocated_bytes;
+    std::optional<json_int_t> unattributed_bytes;
+
+    template <typename X>
+    void map(X& x) {
+      BaseResponse::map(x);
+      x("sample_interval", sample_interval);
+      x("subsystems", subsystems);
+      x.skip_if_default("allocated_bytes", allocated_bytes);
+      x.skip_if_default("unattributed_bytes", unattributed_bytes);
+    }
+  };
+
+  static Response handle(Client*, const Request&) {
+    Response res;
+    res.version = w_string{PACKAGE_VERSION, W_STRING_UNICODE};
+    res.sample_interval = getHeapSampleInterval();
+
+    std::array<int64_t, kNumHeapTags> estimated{};
+    auto add = [&](HeapTag tag, int64_t bytes) {
+      estimated[size_t(tag)] += bytes;
+    };
+
+    std::vector<std::shared_ptr<Root>> roots;
+    for (const auto& it : *watched_roots.rlock()) {
+      roots.push_back(it.second);
+    }
+    for (auto& root : roots) {
+      if (auto stats = root->view()->getMemoryStats(false)) {
+        add(HeapTag::View, stats->node_bytes_in_use);
+        add(HeapTag::Pending, stats->pending);
+        add(HeapTag::Caches, stats->caches);
+      }
+    }
+
+    for (auto& client : UserClient::getAllClients()) {
+      add(HeapTag::Clients,
+          sizeof(UserClient) + client->reader.allocd + client->writer.allocd);
+      add(HeapTag::Subscriptions,
+          client->subscriptions.size() * sizeof(ClientSubscription));
+    }
+
+    auto sampled = getSampledHeapBytes();
+    int64_t attributed = 0;
+    for (size_t i = 0; i < kNumHeapTags; ++i) {
+      HeapSubsystemStatus subsystem;
+      subsystem.tag = w_string{heapTagName(HeapTag(i)), W_STRING_UNICODE};
+      subsystem.estimated_bytes = estimated[i];
+      subsystem.json_bytes = sampled[i];
+      subsystem.total_bytes = estimated[i] + sampled[i];
+      attributed += subsystem.total_bytes;
+      res.subsystems.push_back(std::move(subsystem));
+    }
+    std::stable_sort(
+        res.subsystems.begin(),
+        res.subsystems.end(),
+        [](const auto& a, const auto& b) {
+          return a.total_bytes > b.total_bytes;
+        });
+
+    res.allocated_bytes = getAllocatedBytes();
+    if (res.allocated_bytes) {
+      res.unattributed_bytes =
+          std::max<int64_t>(0, *res.allocated_bytes - attributed);
+    }
+    return res;
+  }
+
+  static void printResult(const Response& response) {
+    for (auto& subsystem : response.subsystems) {
+      fmt::print(
+          "{:<14} {:>14} bytes ({} estimated, {} json)\n",
+          subsystem.tag.view(),
+          subsystem.total_bytes,
+          subsystem.estimated_bytes,
+          subsystem.json_bytes);
+    }
+    if (response.unattributed_bytes) {
+      fmt::print(
+          "{:<14} {:>14} bytes\n",
+          "unattributed",
+          *response.unattributed_bytes);
+    }
+    if (response.allocated_bytes) {
+      fmt::print(
+          "{:<14} {:>14} bytes\n", "allocated", *response.allocated_bytes);
+    }
+    if (response.sample_interval == 0) {
+      fmt::print("json values are not being sampled\n");
+    }
+  }
+};
+WATCHMAN_COMMAND(debug_heap_summary, DebugHeapSummaryCommand);
+
+} // namespace
@@ -29,7 +29,7 @@ class VersionCommand : public PrettyCommand<VersionCommand> {
   static constexpr std::string_view name = "version";
 
   static constexpr CommandFlags flags =
-      CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER;
+      CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER | CMD_ALLOW_REMOTE;
 
   struct RequestOptions : serde::Object {
     std::vector<w_string> required;
@@ -115,7 +115,7 @@ static UntypedResponse cmd_list_capabilities(Client*, const json_ref&) {
 W_CMD_REG(
     "list-capabilities",
     cmd_list_capabilities,
-    CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER,
+    CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER | CMD_ALLOW_REMOTE,
     NULL);
 
 /* get-sockname */
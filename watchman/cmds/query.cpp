@@ -6,50 +6,336 @@
  */
 
 #include "watchman/query/Query.h"
+#include <folly/stop_watch.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
 #include "watchman/Client.h"
+#include "watchman/Command.h"
+#include "watchman/Errors.h"
+#include "watchman/Logging.h"
+#include "watchman/QueryableView.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/bser.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
+#include "watchman/root/Root.h"
+#include "watchman/root/watchlist.h"
 #include "watchman/saved_state/SavedStateFactory.h"
 #include "watchman/watchman_cmd.h"
 
 using namespace watchman;
 
-/* query /root {query} */
-static UntypedResponse cmd_query(Client* client, const json_ref& args) {
-  if (json_array_size(args) != 3) {
-    throw ErrorResponse("wrong number of arguments for 'query'");
-  }
-
-  auto root = resolveRoot(client, args);
+namespace {
 
-  const auto& query_spec = args.at(2);
+std::shared_ptr<Query> parseClientQuery(
+    Client* client,
+    const std::shared_ptr<Root>& root,
+    const json_ref& query_spec) {
   auto query = parseQuery(root, query_spec);
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->use_result_cache = true;
 
   if (client->client_mode) {
     query->sync_timeout = std::chrono::milliseconds(0);
   }
+  if (query->front_coded_names && client->format.type != is_bser &&
+      client->format.type != is_bser_v2) {
+    throw ErrorResponse("name_encoding requires a BSER connection");
+  }
+  return query;
+}
 
-  auto res = w_query_execute(query.get(), root, nullptr, getInterface);
-  UntypedResponse response;
+json_ref renderFiles(const Query& query, RenderResult&& results) {
+  return query.front_coded_names ? std::move(results).toFrontCodedNames()
+                                 : std::move(results).toJson();
+}
+
+// Encodes response as it will be sent in format, counting the bytes rather
+// than keeping them. Sets the time taken and the size in explain.
+void setEncodingCost(
+    PduFormat format,
+    const UntypedResponse& response,
+    json_ref& explain) {
+  auto json = json_object(std::unordered_map<w_string, json_ref>{response});
+  uint64_t bytes = 0;
+  auto count = [](const char*, size_t size, void* data) {
+    *static_cast<uint64_t*>(data) += size;
+    return 0;
+  };
+
+  folly::stop_watch<std::chrono::microseconds> stopWatch;
+  switch (format.type) {
+    case is_bser:
+    case is_bser_v2:
+      w_bser_write_pdu(
+          format.type == is_bser ? 1 : 2,
+          format.capabilities,
+          count,
+          json,
+          &bytes);
+      break;
+    case is_json_pretty:
+      json_dump_callback(json, count, &bytes, JSON_INDENT(4));
+      break;
+    default:
+      json_dump_callback(json, count, &bytes, JSON_COMPACT);
+      break;
+  }
+  explain.set("encode_us", json_integer(stopWatch.elapsed().count()));
+  explain.set("bytes", json_integer(bytes));
+}
+
+// Sets the fields that describe the outcome of a query of root.
+void setQueryResult(
+    UntypedResponse& response,
+    PduFormat format,
+    const Query& query,
+    const std::shared_ptr<Root>& root,
+    QueryResult&& res) {
   response.set(
       {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
        {"clock", res.clockAtStartOfQuery.toJson()},
-       {"files", std::move(res.resultsArray).toJson()},
        {"debug", res.debugInfo.render()}});
+  if (res.aggregate) {
+    response.set("aggregate", std::move(*res.aggregate));
+  } else {
+    response.set("files", renderFiles(query, std::move(res.resultsArray)));
+  }
+  if (res.timedOut) {
+    response.set("timed_out", json_true());
+  }
   if (res.savedStateInfo) {
     response.set("saved-state-info", std::move(*res.savedStateInfo));
   }
+  if (query.include_lag) {
+    if (auto lag = root->view()->getLagStatus()) {
+      response.set("lag", serde::encode(*lag));
+    }
+  }
 
   add_root_warnings_to_response(response, root);
 
+  // Measured last, so that it covers the rest of the response.
+  if (res.explain) {
+    setEncodingCost(format, response, *res.explain);
+    response.set("explain", std::move(*res.explain));
+  }
+}
+
+} // namespace
+
+/* query /root {query} */
+static UntypedResponse cmd_query(Client* client, const json_ref& args) {
+  if (json_array_size(args) != 3) {
+    throw ErrorResponse("wrong number of arguments for 'query'");
+  }
+
+  auto root = resolveRoot(client, args);
+
+  auto query = parseClientQuery(client, root, args.at(2));
+  query->use_admission = true;
+
+  // Chunks are written while the query runs so that neither side has to
+  // hold the whole result set. A client that stops reading stalls the query,
+  // and the view lock that it holds, until the write completes.
+  QueryResultsChunkSink sendChunk = [client, &query](RenderResult&& chunk) {
+    UntypedResponse response;
+    response.set(
+        {{"files", renderFiles(*query, std::move(chunk))},
+         {"more_files", json_true()}});
+    if (!client->sendResponseNow(std::move(response).toJson())) {
+      throw QueryExecError("failed to send results chunk to client");
+    }
+  };
+
+  auto res = w_query_execute(
+      query.get(), root, nullptr, getInterface, std::move(sendChunk));
+  UntypedResponse response;
+  setQueryResult(response, client->format, *query, root, std::move(res));
   return response;
 }
 W_CMD_REG(
     "query",
     cmd_query,
-    CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER,
+    CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER | CMD_ALLOW_REMOTE,
     w_cmd_realpath_root);
 
+namespace {
+
+// The state of a multi-query, shared with the thread pool tasks that help
+// to run it. Whichever thread claims a root runs its query to completion.
+struct MultiQuery {
+  struct Entry {
+    std::shared_ptr<Root> root;
+    std::shared_ptr<Query> query;
+    std::optional<QueryResult> result;
+    std::exception_ptr error;
+  };
+  std::vector<Entry> entries;
+  std::atomic<size_t> nextEntry{0};
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  // Indices of entries whose query has finished, in that order
+  std::deque<size_t> finished;
+
+  // Claims and runs queries until there are none left. Returns after
+  // running at most one if once is set.
+  void run(bool once) {
+    while (true) {
+      auto idx = nextEntry.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= entries.size()) {
+        return;
+      }
+      auto& entry = entries[idx];
+      try {
+        entry.result = w_query_execute(
+            entry.query.get(), entry.root, nullptr, getInterface);
+      } catch (...) {
+        entry.error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lock{mutex};
+        finished.push_back(idx);
+      }
+      cond.notify_all();
+      if (once) {
+        return;
+      }
+    }
+  }
+};
+
+// Resolves the roots that a multi-query names, or every watched root if
+// there is no list
+std::vector<std::shared_ptr<Root>> resolveMultiQueryRoots(
+    Client* client,
+    const json_ref& args) {
+  std::vector<w_string> names;
+  if (json_array_size(args) == 2) {
+    auto map = watched_roots.rlock();
+    for (const auto& it : *map) {
+      names.push_back(it.second->root_path);
+    }
+  } else {
+    const auto& list = args.at(1);
+    if (!list.isArray()) {
+      throw ErrorResponse(
+          "expected the second argument of 'multi-query' to be an array of "
+          "roots");
+    }
+    for (const auto& ele : list.array()) {
+      if (!ele.isString()) {
+        throw ErrorResponse(
+            "expected the roots of 'multi-query' to be strings");
+      }
+      names.push_back(json_to_w_string(ele));
+    }
+  }
+
+  std::vector<std::shared_ptr<Root>> roots;
+  roots.reserve(names.size());
+  for (const auto& name : names) {
+    roots.push_back(resolveRootByName(client, name.c_str()));
+  }
+  return roots;
+}
+
+} // namespace
+
+/* multi-query [/root, ...] {query}
+ * multi-query {query}
+ * Runs the same query against each of the roots, or against every watched
+ * root, concurrently. The results of each root are sent as they complete,
+ * flagged with more_results, and the final response lists the roots in the
+ * order that their results were sent. */
+static UntypedResponse cmd_multi_query(Client* client, const json_ref& args) {
+  auto nargs = json_array_size(args);
+  if (nargs != 2 && nargs != 3) {
+    throw ErrorResponse("wrong number of arguments for 'multi-query'");
+  }
+
+  auto state = std::make_shared<MultiQuery>();
+  const auto& query_spec = args.at(nargs - 1);
+  for (auto& root : resolveMultiQueryRoots(client, args)) {
+    auto query = parseClientQuery(client, root, query_spec);
+    state->entries.push_back(
+        MultiQuery::Entry{std::move(root), std::move(query), {}, {}});
+  }
+
+  // Each root syncs and is queried on its own thread, so that the cookie
+  // syncs overlap. Tasks that only start once this thread has claimed every
+  // root do nothing, so a busy pool can't stall the command.
+  for (size_t i = 1; i < state->entries.size(); ++i) {
+    try {
+      getThreadPool().add([state] { state->run(false); });
+    } catch (const std::exception& exc) {
+      // The pool is full or stopping; run more of them here instead.
+      log(DBG, "multi-query: ", exc.what(), "\n");
+      break;
+    }
+  }
+
+  // Only this thread writes to the client. It sends each result as soon as
+  // it is available, and otherwise helps to run the queries.
+  std::vector<json_ref> order;
+  for (size_t sent = 0; sent < state->entries.size(); ++sent) {
+    size_t idx;
+    {
+      std::unique_lock<std::mutex> lock{state->mutex};
+      while (state->finished.empty()) {
+        if (state->nextEntry.load(std::memory_order_relaxed) <
+            state->entries.size()) {
+          lock.unlock();
+          state->run(true);
+          lock.lock();
+        } else {
+          state->cond.wait(lock);
+        }
+      }
+      idx = state->finished.front();
+      state->finished.pop_front();
+    }
+
+    auto& entry = state->entries[idx];
+    UntypedResponse response;
+    response.set("root", w_string_to_json(entry.root->root_path));
+    if (entry.error) {
+      try {
+        std::rethrow_exception(entry.error);
+      } catch (const std::exception& exc) {
+        response.set("error", typed_string_to_json(exc.what()));
+      }
+    } else {
+      setQueryResult(
+          response,
+          client->format,
+          *entry.query,
+          entry.root,
+          std::move(*entry.result));
+      entry.result.reset();
+    }
+    response.set("more_results", json_true());
+    if (!client->sendResponseNow(std::move(response).toJson())) {
+      // Let the queries that are still to run finish quickly.
+      state->nextEntry.store(state->entries.size());
+      throw QueryExecError("failed to send results to client");
+    }
+    order.push_back(w_string_to_json(entry.root->root_path));
+  }
+
+  UntypedResponse response;
+  response.set("roots", json_array(std::move(order)));
+  return response;
+}
+W_CMD_REG(
+    "multi-query",
+    cmd_multi_query,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    w_cmd_realpath_roots);
+
 /* vim:ts=2:sw=2:et:
  */
@@ -52,7 +52,7 @@ static UntypedResponse cmd_since(Client* client, const json_ref& args) {
 W_CMD_REG(
     "since",
     cmd_since,
-    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER | CMD_ALLOW_REMOTE,
     w_cmd_realpath_root);
 
 /* vim:ts=2:sw=2:et:
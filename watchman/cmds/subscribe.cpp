@@ -6,11 +6,18 @@
  */
 
 #include <folly/MapUtil.h>
+#include <folly/ScopeGuard.h>
+#include <folly/futures/Future.h>
+#include <folly/stop_watch.h>
 #include "watchman/Client.h"
 #include "watchman/Errors.h"
+#include "watchman/HeapProfile.h"
+#include "watchman/LRUCache.h"
 #include "watchman/Logging.h"
 #include "watchman/MapUtil.h"
+#include "watchman/Metrics.h"
 #include "watchman/QueryableView.h"
+#include "watchman/query/ChangePrefilter.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -21,6 +28,169 @@
 
 using namespace watchman;
 
+namespace {
+
+// What a subscription's query produced, as needed to build its response
+struct SubscriptionResult {
+  ClockSpec clockAtStartOfQuery;
+  bool isFreshInstance;
+  uint32_t stateTransCountAtStartOfQuery;
+  json_ref files;
+  std::optional<json_ref> savedStateInfo;
+};
+
+// When many clients keep byte-identical subscriptions on a root, typically
+// instances of the same editor or tool, they are all pinged at each settle
+// and would each run the same query from the same clock. Their results are
+// shared through this cache instead, keyed by the root, the query, the
+// since clock and the root's current position, so that the first of them
+// to get there runs the query and the others wait for its results.
+using SharedSubscriptionResults =
+    LRUCache<std::string, std::shared_ptr<const SubscriptionResult>>;
+
+SharedSubscriptionResults* getSharedSubscriptionResults() {
+  // Leaked so that subscriptions processed during shutdown can still use it.
+  static auto* cache = []() -> SharedSubscriptionResults* {
+    auto size = Configuration().getInt("subscription_result_share_size", 64);
+    if (size <= 0) {
+      return nullptr;
+    }
+    return new SharedSubscriptionResults(size, std::chrono::milliseconds(0));
+  }();
+  return cache;
+}
+
+// Returns the key under which query's results may be shared, or nullopt
+// for queries whose results depend on more than the key: those that advance
+// a named cursor or consult the SCM.
+std::optional<std::string> sharedSubscriptionKey(
+    const Query* query,
+    const std::shared_ptr<Root>& root) {
+  const auto* since = query->since_spec.get();
+  if (!query->query_spec || !since ||
+      !std::holds_alternative<ClockSpec::Clock>(since->spec) ||
+      since->hasScmParams()) {
+    return std::nullopt;
+  }
+  auto now = root->view()->getMostRecentRootNumberAndTickValue();
+  return folly::to<std::string>(
+      root->root_path.view(),
+      '\0',
+      now.rootNumber,
+      ':',
+      now.ticks,
+      '\0',
+      json_dumps(since->toJson(), JSON_COMPACT),
+      '\0',
+      json_dumps(*query->query_spec, JSON_COMPACT | JSON_SORT_KEYS));
+}
+
+std::shared_ptr<const SubscriptionResult> runSubscriptionQuery(
+    const Query* query,
+    const std::shared_ptr<Root>& root,
+    const w_string& name) {
+  auto res = w_query_execute(query, root, time_generator, getInterface);
+
+  logf(
+      DBG,
+      "subscription {} generated {} results\n",
+      name,
+      res.resultsArray.results.size());
+
+  return std::make_shared<const SubscriptionResult>(SubscriptionResult{
+      std::move(res.clockAtStartOfQuery),
+      res.isFreshInstance,
+      res.stateTransCountAtStartOfQuery,
+      std::move(res.resultsArray).toJson(),
+      std::move(res.savedStateInfo)});
+}
+
+// The position of "name" in the rows of a templated files array, if its
+// fields include it.
+std::optional<size_t> templateNameIndex(const json_ref& files) {
+  auto templ = json_array_get_template(files);
+  if (!templ) {
+    return std::nullopt;
+  }
+  const auto& fields = templ->array();
+  for (size_t i = 0; i < fields.size(); ++i) {
+    if (fields[i].isString() && json_to_w_string(fields[i]) == "name") {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+// The name of a file in a subscription's results, if its fields include it.
+// nameIndex is the position of the name in the rows of a templated array.
+std::optional<w_string> resultFileName(
+    const json_ref& file,
+    std::optional<size_t> nameIndex) {
+  if (file.isString()) {
+    return json_to_w_string(file);
+  }
+  if (file.isObject()) {
+    auto name = file.get_optional("name");
+    if (name && name->isString()) {
+      return json_to_w_string(*name);
+    }
+  }
+  if (file.isArray() && nameIndex && *nameIndex < file.array().size()) {
+    const auto& name = file.array()[*nameIndex];
+    if (name.isString()) {
+      return json_to_w_string(name);
+    }
+  }
+  return std::nullopt;
+}
+
+// Folds next into batch, which then covers the changes from batch's since
+// clock to next's clock. A file reported by both is reported as next saw
+// it.
+void mergeSubscriptionResults(UntypedResponse& batch, UntypedResponse&& next) {
+  if (next.at("is_fresh_instance").asBool()) {
+    // Lists every file, superseding whatever was held.
+    batch = std::move(next);
+    return;
+  }
+
+  const auto& held = batch.at("files");
+  const auto& incoming = next.at("files");
+  std::vector<json_ref> files = held.array();
+  std::unordered_map<w_string, size_t> index;
+  auto heldNameIndex = templateNameIndex(held);
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (auto name = resultFileName(files[i], heldNameIndex)) {
+      index.emplace(std::move(*name), i);
+    }
+  }
+  auto incomingNameIndex = templateNameIndex(incoming);
+  for (auto& file : incoming.array()) {
+    auto name = resultFileName(file, incomingNameIndex);
+    auto it = name ? index.find(*name) : index.end();
+    if (it != index.end()) {
+      files[it->second] = file;
+      continue;
+    }
+    if (name) {
+      index.emplace(std::move(*name), files.size());
+    }
+    files.push_back(file);
+  }
+
+  auto merged = json_array(std::move(files));
+  if (auto templ = json_array_get_template(held)) {
+    json_array_set_template_new(merged, json_ref(*templ));
+  }
+  batch.set("files", std::move(merged));
+  batch.set("clock", next.at("clock"));
+  if (auto* savedStateInfo = folly::get_ptr(next, "saved-state-info")) {
+    batch.set("saved-state-info", *savedStateInfo);
+  }
+}
+
+} // namespace
+
 ClientSubscription::ClientSubscription(
     const std::shared_ptr<Root>& root,
     std::weak_ptr<Client> client)
@@ -115,6 +285,15 @@ static std::tuple<sub_action, w_string> get_subscription_action(
 }
 
 void ClientSubscription::processSubscription() {
+  static auto& evaluation = getHistogram(
+      "watchman_subscription_evaluation_us",
+      "Time taken to evaluate a subscription and queue its results");
+
+  HeapTagScope heapTag{HeapTag::Subscriptions};
+  folly::stop_watch<std::chrono::microseconds> stopWatch;
+  SCOPE_EXIT {
+    evaluation.recordMicros(stopWatch.elapsed());
+  };
   try {
     processSubscriptionImpl();
   } catch (const std::system_error& exc) {
@@ -145,6 +324,9 @@ void ClientSubscription::processSubscriptionImpl() {
 
   sub_action action;
   w_string policy_name;
+  // Whatever the IO thread matches from here on is within position, or
+  // wakes the subscription again.
+  setPrefilterMatched(false);
   auto position = root->view()->getMostRecentRootNumberAndTickValue();
   std::tie(action, policy_name) = get_subscription_action(this, root, position);
 
@@ -171,12 +353,25 @@ void ClientSubscription::processSubscriptionImpl() {
           " until state ",
           policy_name,
           " is vacated\n");
+      // The changes are still owed
+      setPrefilterMatched(true);
       executeQuery = false;
     } else if (vcs_defer && root->view()->isVCSOperationInProgress()) {
       log(DBG,
           "deferring subscription notifications for ",
           name,
           " until VCS operations complete\n");
+      // The changes are still owed
+      setPrefilterMatched(true);
+      executeQuery = false;
+    } else if (maxBatchFiles == 0 && !intervalElapsed()) {
+      log(DBG,
+          "holding back subscription notifications for ",
+          name,
+          " until min_interval_ms has passed\n");
+      holdBack(client.get());
+      // The changes are still owed
+      setPrefilterMatched(true);
       executeQuery = false;
     }
 
@@ -200,20 +395,86 @@ void ClientSubscription::processSubscriptionImpl() {
             ". Deferring until next change.\n");
       }
     }
+  } else if (batch_ && intervalElapsed()) {
+    deliverResults(client.get(), std::move(*std::exchange(batch_, {})));
   } else {
     log(DBG, "subscription ", name, " is up to date\n");
+    if (!batch_) {
+      heldBack_ = false;
+    }
+  }
+}
+
+void ClientSubscription::setPrefilterMatched(bool matched) {
+  if (prefilter) {
+    prefilter->matched.store(matched, std::memory_order_release);
   }
 }
 
-void ClientSubscription::updateSubscriptionTicks(QueryResult* res) {
+bool ClientSubscription::intervalElapsed() const {
+  return std::chrono::steady_clock::now() - lastDelivery_ >= minInterval;
+}
+
+bool ClientSubscription::isDeliveryDue() const {
+  return heldBack_ && !debug_paused && intervalElapsed();
+}
+
+void ClientSubscription::holdBack(UserClient* client) {
+  heldBack_ = true;
+  if (wakeupScheduled_) {
+    return;
+  }
+  wakeupScheduled_ = true;
+
+  auto delay = std::chrono::duration_cast<std::chrono::microseconds>(
+      lastDelivery_ + minInterval - std::chrono::steady_clock::now());
+  std::weak_ptr<Client> clientRef(client->shared_from_this());
+  folly::futures::sleepUnsafe(delay).thenValue([clientRef](folly::Unit) {
+    if (auto client = clientRef.lock()) {
+      client->ping->notify();
+    }
+  });
+}
+
+void ClientSubscription::deliverResults(
+    UserClient* client,
+    UntypedResponse&& response) {
+  add_root_warnings_to_response(response, root);
+  enqueueResults(client, std::move(response));
+  lastDelivery_ = std::chrono::steady_clock::now();
+  heldBack_ = false;
+  wakeupScheduled_ = false;
+}
+
+std::optional<UntypedResponse> ClientSubscription::takeBatchedResults(
+    std::optional<UntypedResponse> response) {
+  heldBack_ = false;
+  if (batch_) {
+    if (response) {
+      mergeSubscriptionResults(*batch_, std::move(*response));
+    }
+    response = std::exchange(batch_, {});
+  }
+  if (response) {
+    lastDelivery_ = std::chrono::steady_clock::now();
+    wakeupScheduled_ = false;
+  }
+  return response;
+}
+
+void ClientSubscription::updateSubscriptionTicks(const ClockSpec& clock) {
   // create a new spec that will be used the next time
-  query->since_spec = std::make_unique<ClockSpec>(res->clockAtStartOfQuery);
+  query->since_spec = std::make_unique<ClockSpec>(clock);
 }
 
 std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
     const std::shared_ptr<Root>& root,
     ClockSpec& position,
     OnStateTransition onStateTransition) {
+  if (notifyOnly) {
+    return buildNotifyOnlyResults(root, position);
+  }
+
   auto since_spec = query->since_spec.get();
 
   if (const auto* clock = since_spec
@@ -235,18 +496,33 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
   // We're called by the io thread, so there's little chance that the root
   // could be legitimately blocked by something else.  That means that we
   // can use a short lock_timeout
-  query->lock_timeout =
-      uint32_t(root->config.getInt("subscription_lock_timeout_ms", 100));
+  query->lock_timeout = root->subscription_lock_timeout_ms;
   logf(DBG, "running subscription {} {}\n", name, fmt::ptr(this));
 
   try {
-    auto res = w_query_execute(query.get(), root, time_generator, getInterface);
-
-    logf(
-        DBG,
-        "subscription {} generated {} results\n",
-        name,
-        res.resultsArray.results.size());
+    std::shared_ptr<const SubscriptionResult> result;
+    auto* shared = getSharedSubscriptionResults();
+    auto sharedKey =
+        shared ? sharedSubscriptionKey(query.get(), root) : std::nullopt;
+    if (sharedKey) {
+      result = shared
+                   ->get(
+                       *sharedKey,
+                       [&](const std::string&) {
+                         return folly::makeFutureWith([&] {
+                           return runSubscriptionQuery(query.get(), root, name);
+                         });
+                       })
+                   .get()
+                   ->value();
+      if (result->isFreshInstance) {
+        // These list every file, so are too large to keep around.
+        shared->erase(*sharedKey);
+      }
+    } else {
+      result = runSubscriptionQuery(query.get(), root, name);
+    }
+    const auto& res = *result;
 
     position = res.clockAtStartOfQuery;
 
@@ -267,9 +543,9 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
     // and the mergeBase has changed or this is a fresh instance.
     bool mergeBaseChanged = scmAwareQuery &&
         res.clockAtStartOfQuery.scmMergeBase != query->since_spec->scmMergeBase;
-    if (res.resultsArray.results.empty() && !mergeBaseChanged &&
+    if (res.files.array().empty() && !mergeBaseChanged &&
         !res.isFreshInstance) {
-      updateSubscriptionTicks(&res);
+      updateSubscriptionTicks(res.clockAtStartOfQuery);
       return std::nullopt;
     }
 
@@ -282,17 +558,22 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
         std::holds_alternative<ClockSpec::Clock>(since_spec->spec)) {
       response.set("since", since_spec->toJson());
     }
-    updateSubscriptionTicks(&res);
+    updateSubscriptionTicks(res.clockAtStartOfQuery);
 
     response.set(
         {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
          {"clock", res.clockAtStartOfQuery.toJson()},
-         {"files", std::move(res.resultsArray).toJson()},
+         {"files", json_ref(res.files)},
          {"root", w_string_to_json(root->root_path)},
          {"subscription", w_string_to_json(name)},
          {"unilateral", json_true()}});
     if (res.savedStateInfo) {
-      response.set({{"saved-state-info", std::move(*res.savedStateInfo)}});
+      response.set({{"saved-state-info", json_ref(*res.savedStateInfo)}});
+    }
+    if (query->include_lag) {
+      if (auto lag = root->view()->getLagStatus()) {
+        response.set("lag", serde::encode(*lag));
+      }
     }
 
     return response;
@@ -302,6 +583,98 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
   }
 }
 
+std::optional<UntypedResponse> ClientSubscription::buildNotifyOnlyResults(
+    const std::shared_ptr<Root>& root,
+    ClockSpec& position) {
+  auto view = root->view();
+  position = ClockSpec(view->getMostRecentRootNumberAndTickValue());
+  auto since = query->since_spec
+      ? query->since_spec->evaluate(
+            position.position(),
+            view->getLastAgeOutTickValue(),
+            &root->inner.cursors,
+            view->getClockPredecessor())
+      : QuerySince{};
+
+  bool isFreshInstance = false;
+  std::optional<size_t> changed;
+  if (const auto* clock = std::get_if<QuerySince::Clock>(&since.since)) {
+    isFreshInstance = clock->is_fresh_instance;
+    if (!isFreshInstance) {
+      changed = view->countChangedFiles(
+          query->relative_root ? query->relative_root : root->root_path,
+          clock->ticks);
+    }
+  }
+  logf(
+      DBG,
+      "notify_only subscription {} counted {} changes\n",
+      name,
+      changed ? int64_t(*changed) : -1);
+
+  UntypedResponse response;
+  const auto* since_spec = query->since_spec.get();
+  if (since_spec &&
+      std::holds_alternative<ClockSpec::Clock>(since_spec->spec)) {
+    response.set("since", since_spec->toJson());
+  }
+  updateSubscriptionTicks(position);
+  if (changed && *changed == 0) {
+    // The changes were all outside of relative_root.
+    return std::nullopt;
+  }
+
+  response.set(
+      {{"is_fresh_instance", json_boolean(isFreshInstance)},
+       {"clock", position.toJson()},
+       {"root", w_string_to_json(root->root_path)},
+       {"subscription", w_string_to_json(name)},
+       {"unilateral", json_true()}});
+  if (changed) {
+    response.set("changed_count", json_integer(*changed));
+  }
+  return response;
+}
+
+void ClientSubscription::enqueueResults(
+    Client* client,
+    UntypedResponse&& response) {
+  ClientUsage::add(client->usage.subscriptionDeliveries, 1);
+  auto chunkSize = size_t(query->results_chunk_size);
+  auto* files = folly::get_ptr(response, "files");
+  if (chunkSize == 0 || !files || !files->isArray() ||
+      files->array().size() <= chunkSize) {
+    client->enqueueResponse(std::move(response));
+    return;
+  }
+
+  const auto& all = files->array();
+  auto templ = json_array_get_template(*files);
+  auto slice = [&](size_t begin, size_t end) {
+    auto chunk = json_array(
+        std::vector<json_ref>{all.begin() + begin, all.begin() + end});
+    if (templ) {
+      json_array_set_template_new(chunk, json_ref(*templ));
+    }
+    return chunk;
+  };
+
+  size_t begin = 0;
+  for (; all.size() - begin > chunkSize; begin += chunkSize) {
+    UntypedResponse chunk;
+    chunk.set(
+        {{"files", slice(begin, begin + chunkSize)},
+         {"is_fresh_instance", response.at("is_fresh_instance")},
+         {"root", response.at("root")},
+         {"subscription", response.at("subscription")},
+         {"unilateral", json_true()},
+         {"more_files", json_true()}});
+    client->enqueueResponse(std::move(chunk));
+  }
+  response.set("files", slice(begin, all.size()));
+  client->enqueueResponse(std::move(response));
+}
+
 ClockSpec ClientSubscription::runSubscriptionRules(
     UserClient* client,
     const std::shared_ptr<Root>& root) {
@@ -310,9 +683,30 @@ ClockSpec ClientSubscription::runSubscriptionRules(
   auto response =
       buildSubscriptionResults(root, position, OnStateTransition::DontAdvance);
 
+  if (maxBatchFiles > 0) {
+    if (response) {
+      if (batch_) {
+        mergeSubscriptionResults(*batch_, std::move(*response));
+      } else {
+        batch_ = std::move(response);
+      }
+    }
+    if (!batch_) {
+      heldBack_ = false;
+      return position;
+    }
+    if (batch_->at("files").array().size() < maxBatchFiles &&
+        !intervalElapsed()) {
+      holdBack(client);
+      return position;
+    }
+    response = std::exchange(batch_, {});
+  }
+
   if (response) {
-    add_root_warnings_to_response(*response, root);
-    client->enqueueResponse(std::move(*response));
+    deliverResults(client, std::move(*response));
+  } else {
+    heldBack_ = false;
   }
   return position;
 }
@@ -417,10 +811,10 @@ static UntypedResponse cmd_flush_subscriptions(
           "(flush-subscriptions) executing subscription ",
           sub->name,
           "\n");
-      auto sub_result = sub->buildSubscriptionResults(
-          root, out_position, OnStateTransition::QueryAnyway);
+      auto sub_result = sub->takeBatchedResults(sub->buildSubscriptionResults(
+          root, out_position, OnStateTransition::QueryAnyway));
       if (sub_result) {
-        client->enqueueResponse(std::move(*sub_result));
+        sub->enqueueResults(client, std::move(*sub_result));
         synced.push_back(w_string_to_json(sub_name_str));
       } else {
         no_sync_needed.push_back(w_string_to_json(sub_name_str));
@@ -438,7 +832,7 @@ static UntypedResponse cmd_flush_subscriptions(
 W_CMD_REG(
     "flush-subscriptions",
     cmd_flush_subscriptions,
-    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER | CMD_ALLOW_REMOTE,
     w_cmd_realpath_root);
 
 /* unsubscribe /root subname
@@ -468,7 +862,7 @@ static UntypedResponse cmd_unsubscribe(
 W_CMD_REG(
     "unsubscribe",
     cmd_unsubscribe,
-    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER | CMD_ALLOW_REMOTE,
     w_cmd_realpath_root);
 
 /* subscribe /root subname {query}
@@ -490,6 +884,16 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
   json_ref query_spec = args.at(3);
 
   auto query = parseQuery(root, query_spec);
+  if (query->aggregate) {
+    throw ErrorResponse("aggregate is not supported by subscriptions");
+  }
+  if (query->partial_results) {
+    // Files left out of a notification would never be reported.
+    throw ErrorResponse("partial_results is not supported by subscriptions");
+  }
+  if (query->front_coded_names) {
+    throw ErrorResponse("name_encoding is not supported by subscriptions");
+  }
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
   query->subscriptionName = json_to_w_string(jname);
 
@@ -520,6 +924,43 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
   }
   sub->vcs_defer = defer.asBool();
 
+  auto min_interval =
+      query_spec.get_default("min_interval_ms", json_integer(0));
+  if (!min_interval.isInt() || min_interval.asInt() < 0) {
+    throw ErrorResponse("min_interval_ms must be a non-negative integer");
+  }
+  sub->minInterval = std::chrono::milliseconds(min_interval.asInt());
+
+  auto max_batch_files =
+      query_spec.get_default("max_batch_files", json_integer(0));
+  if (!max_batch_files.isInt() || max_batch_files.asInt() < 0) {
+    throw ErrorResponse("max_batch_files must be a non-negative integer");
+  }
+  sub->maxBatchFiles = size_t(max_batch_files.asInt());
+  if (sub->maxBatchFiles > 0 && sub->minInterval.count() == 0) {
+    throw ErrorResponse("max_batch_files requires min_interval_ms");
+  }
+
+  auto notify_only = query_spec.get_default("notify_only", json_false());
+  if (!notify_only.isBool()) {
+    throw ErrorResponse("notify_only must be boolean");
+  }
+  sub->notifyOnly = notify_only.asBool();
+  if (sub->notifyOnly) {
+    if (query->expr) {
+      throw ErrorResponse(
+          "notify_only subscriptions count every change, so cannot take an "
+          "expression");
+    }
+    if (query->since_spec && query->since_spec->hasScmParams()) {
+      throw ErrorResponse(
+          "notify_only is not supported with an SCM aware since");
+    }
+    if (sub->maxBatchFiles > 0) {
+      throw ErrorResponse("max_batch_files is not supported with notify_only");
+    }
+  }
+
   if (defer_array) {
     for (auto& elt : *defer_array) {
       sub->drop_or_defer[json_to_w_string(elt)] = false;
@@ -544,6 +985,13 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
     }
   }
 
+  // Before the initial results, so that nothing that changes after them is
+  // missed
+  if (auto prefilter = ChangePrefilter::compile(*query, root->root_path);
+      prefilter && root->view()->addChangePrefilter(prefilter)) {
+    sub->prefilter = std::move(prefilter);
+  }
+
   // Connect the root to our subscription
   {
     auto client_id = w_string::build(client->unique_id);
@@ -558,6 +1006,15 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
       info_json.set("query", json_ref(*sub->query->query_spec));
     }
 
+    // Settles that the prefilter didn't match don't wake the client
+    Publisher::Filter filter;
+    if (sub->prefilter) {
+      filter = [prefilter = sub->prefilter](const json_ref& payload) {
+        return prefilter->matched.load(std::memory_order_acquire) ||
+            !payload.get_optional("settled");
+      };
+    }
+
     std::weak_ptr<Client> clientRef(client->shared_from_this());
     client->unilateralSub.insert(std::make_pair(
         sub,
@@ -568,7 +1025,8 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
                 client->ping->notify();
               }
             },
-            info_json)));
+            info_json,
+            std::move(filter))));
   }
 
   client->subscriptions[sub->name] = sub;
@@ -605,14 +1063,14 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
   // return null.
   client->enqueueResponse(std::move(resp));
   if (initial_subscription_results) {
-    client->enqueueResponse(std::move(*initial_subscription_results));
+    sub->enqueueResults(client, std::move(*initial_subscription_results));
   }
   throw ResponseWasHandledManually{};
 }
 W_CMD_REG(
     "subscribe",
     cmd_subscribe,
-    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER | CMD_ALLOW_REMOTE,
     w_cmd_realpath_root);
 
 /* vim:ts=2:sw=2:et:
@@ -42,6 +42,33 @@ void w_cmd_realpath_root(Command& command) {
 
   command.args() = json_array(std::move(args));
 }
+
+void w_cmd_realpath_roots(Command& command) {
+  std::vector<json_ref> args = command.args().array();
+  if (args.empty() || !args[0].isArray()) {
+    return;
+  }
+
+  std::vector<json_ref> roots;
+  for (const auto& ele : args[0].array()) {
+    const char* path = json_string_value(ele);
+    if (!path) {
+      throw CommandValidationError(
+          "second argument must be an array of paths to watches");
+    }
+    try {
+      roots.push_back(w_string_to_json(realPath(path)));
+    } catch (const std::exception& exc) {
+      CommandValidationError::throwf(
+          "Could not resolve {} to the canonical watch path: {}",
+          path,
+          exc.what());
+    }
+  }
+  args[0] = json_array(std::move(roots));
+
+  command.args() = json_array(std::move(args));
+}
 W_CAP_REG("clock-sync-timeout")
 
 /* Add the current clock value to the response */
@@ -95,6 +122,56 @@ static UntypedResponse cmd_clock(Client* client, const json_ref& args) {
 W_CMD_REG(
     "clock",
     cmd_clock,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER | CMD_ALLOW_REMOTE,
+    w_cmd_realpath_root);
+
+/* crawl-progress /root [enable]
+ * Sends the client a unilateral crawl-progress PDU as each full crawl of the
+ * root progresses, or stops doing so if enable is false */
+static UntypedResponse cmd_crawl_progress(
+    Client* clientbase,
+    const json_ref& args) {
+  UserClient* client = (UserClient*)clientbase;
+
+  bool enable = true;
+  if (json_array_size(args) == 3) {
+    auto& arg = args.at(2);
+    if (!arg.isBool()) {
+      throw ErrorResponse(
+          "the third argument to 'crawl-progress' must be a boolean");
+    }
+    enable = arg.asBool();
+  } else if (json_array_size(args) != 2) {
+    throw ErrorResponse("wrong number of arguments to 'crawl-progress'");
+  }
+
+  auto root = resolveRoot(client, args);
+
+  if (enable) {
+    std::weak_ptr<Client> clientRef(client->shared_from_this());
+    client->crawlProgressSubs[root->root_path] =
+        root->crawlProgress->subscribe([clientRef]() {
+          auto client = clientRef.lock();
+          if (client) {
+            client->ping->notify();
+          }
+        });
+  } else {
+    client->crawlProgressSubs.erase(root->root_path);
+  }
+
+  UntypedResponse resp;
+  resp.set(
+      {{"crawl-progress", json_boolean(enable)},
+       {"root", w_string_to_json(root->root_path)},
+       {"crawling",
+        json_boolean(
+            !root->inner.done_initial.load(std::memory_order_acquire))}});
+  return resp;
+}
+W_CMD_REG(
+    "crawl-progress",
+    cmd_crawl_progress,
     CMD_DAEMON | CMD_ALLOW_ANY_USER,
     w_cmd_realpath_root);
 
@@ -223,11 +300,11 @@ static w_string resolve_projpath(
 
   // See if we're requesting something in a pre-existing watch
 
-  w_string_piece prefix;
+  w_string prefix;
   w_string_piece relpiece;
   if (findEnclosingRoot(resolved, prefix, relpiece)) {
     relpath = relpiece.asWString();
-    resolved = prefix.asWString();
+    resolved = prefix;
     args[1] = w_string_to_json(resolved);
     return resolved;
   }
@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "BserRowDecoder.h"
+
+#include <stdexcept>
+
+#include <folly/Conv.h>
+
+namespace watchman {
+
+using namespace folly;
+using folly::io::Cursor;
+
+namespace {
+
+enum : int8_t {
+  kArray = 0x00,
+  kObject = 0x01,
+  kByteString = 0x02,
+  kInt8 = 0x03,
+  kInt16 = 0x04,
+  kInt32 = 0x05,
+  kInt64 = 0x06,
+  kReal = 0x07,
+  kTrue = 0x08,
+  kFalse = 0x09,
+  kNull = 0x0a,
+  kTemplate = 0x0b,
+  kSkip = 0x0c,
+  kUtf8String = 0x0d,
+};
+
+[[noreturn]] void throwInvalid(const char* what, int8_t type) {
+  throw std::runtime_error(
+      folly::to<std::string>("invalid BSER ", what, " type ", int(type)));
+}
+
+int64_t decodeInt(int8_t type, Cursor& cursor) {
+  switch (type) {
+    case kInt8:
+      return cursor.read<int8_t>();
+    case kInt16:
+      return cursor.read<int16_t>();
+    case kInt32:
+      return cursor.read<int32_t>();
+    case kInt64:
+      return cursor.read<int64_t>();
+    default:
+      throwInvalid("integer", type);
+  }
+}
+
+size_t decodeLength(Cursor& cursor) {
+  auto len = decodeInt(cursor.read<int8_t>(), cursor);
+  if (len < 0) {
+    throw std::runtime_error("negative BSER length");
+  }
+  return size_t(len);
+}
+
+std::string decodeString(Cursor& cursor) {
+  auto type = cursor.read<int8_t>();
+  if (type != kByteString && type != kUtf8String) {
+    throwInvalid("string", type);
+  }
+  return cursor.readFixedString(decodeLength(cursor));
+}
+
+std::vector<std::string> decodeTemplateKeys(Cursor& cursor) {
+  auto type = cursor.read<int8_t>();
+  if (type != kArray) {
+    throwInvalid("template keys", type);
+  }
+  auto nkeys = decodeLength(cursor);
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < nkeys; ++i) {
+    keys.push_back(decodeString(cursor));
+  }
+  return keys;
+}
+
+dynamic decodeValue(int8_t type, Cursor& cursor);
+
+dynamic decodeTemplateRow(
+    const std::vector<std::string>& keys,
+    Cursor& cursor) {
+  dynamic row = dynamic::object;
+  for (const auto& key : keys) {
+    auto type = cursor.read<int8_t>();
+    if (type != kSkip) {
+      row.insert(key, decodeValue(type, cursor));
+    }
+  }
+  return row;
+}
+
+dynamic decodeValue(int8_t type, Cursor& cursor) {
+  switch (type) {
+    case kArray: {
+      auto nitems = decodeLength(cursor);
+      dynamic arr = dynamic::array;
+      for (size_t i = 0; i < nitems; ++i) {
+        arr.push_back(decodeValue(cursor.read<int8_t>(), cursor));
+      }
+      return arr;
+    }
+    case kObject: {
+      auto nitems = decodeLength(cursor);
+      dynamic obj = dynamic::object;
+      for (size_t i = 0; i < nitems; ++i) {
+        auto key = decodeString(cursor);
+        obj.insert(std::move(key), decodeValue(cursor.read<int8_t>(), cursor));
+      }
+      return obj;
+    }
+    case kByteString:
+    case kUtf8String:
+      return cursor.readFixedString(decodeLength(cursor));
+    case kInt8:
+    case kInt16:
+    case kInt32:
+    case kInt64:
+      return decodeInt(type, cursor);
+    case kReal:
+      return cursor.read<double>();
+    case kTrue:
+      return true;
+    case kFalse:
+      return false;
+    case kNull:
+      return nullptr;
+    case kTemplate: {
+      auto keys = decodeTemplateKeys(cursor);
+      auto nitems = decodeLength(cursor);
+      dynamic arr = dynamic::array;
+      for (size_t i = 0; i < nitems; ++i) {
+        arr.push_back(decodeTemplateRow(keys, cursor));
+      }
+      return arr;
+    }
+    default:
+      throwInvalid("value", type);
+  }
+}
+
+// Steps over a value without decoding it
+void skipValue(int8_t type, Cursor& cursor) {
+  switch (type) {
+    case kArray: {
+      auto nitems = decodeLength(cursor);
+      for (size_t i = 0; i < nitems; ++i) {
+        skipValue(cursor.read<int8_t>(), cursor);
+      }
+      return;
+    }
+    case kObject: {
+      auto nitems = decodeLength(cursor);
+      for (size_t i = 0; i < nitems; ++i) {
+        skipValue(cursor.read<int8_t>(), cursor);
+        skipValue(cursor.read<int8_t>(), cursor);
+      }
+      return;
+    }
+    case kByteString:
+    case kUtf8String:
+      cursor.skip(decodeLength(cursor));
+      return;
+    case kInt8:
+    case kInt16:
+    case kInt32:
+    case kInt64:
+      decodeInt(type, cursor);
+      return;
+    case kReal:
+      cursor.skip(sizeof(double));
+      return;
+    case kTrue:
+    case kFalse:
+    case kNull:
+      return;
+    case kTemplate: {
+      auto nkeys = decodeTemplateKeys(cursor).size();
+      auto nitems = decodeLength(cursor);
+      for (size_t i = 0; i < nitems; ++i) {
+        for (size_t k = 0; k < nkeys; ++k) {
+          auto fieldType = cursor.read<int8_t>();
+          if (fieldType != kSkip) {
+            skipValue(fieldType, cursor);
+          }
+        }
+      }
+      return;
+    }
+    default:
+      throwInvalid("value", type);
+  }
+}
+
+} // namespace
+
+BserRowDecoder::BserRowDecoder(
+    std::unique_ptr<IOBuf> pdu,
+    std::string rowsField)
+    : pdu_(std::move(pdu)),
+      rowsField_(std::move(rowsField)),
+      header_(dynamic::object),
+      rows_(pdu_.get()) {
+  Cursor cursor(pdu_.get());
+
+  // The magic, which gives the version; version 2 is followed by the
+  // capabilities, and both by the length
+  auto magic = cursor.readFixedString(2);
+  if (magic == std::string("\x00\x02", 2)) {
+    cursor.skip(sizeof(uint32_t));
+  } else if (magic != std::string("\x00\x01", 2)) {
+    throw std::runtime_error("invalid BSER PDU header");
+  }
+  decodeLength(cursor);
+
+  auto type = cursor.read<int8_t>();
+  if (type != kObject) {
+    throwInvalid("response", type);
+  }
+  auto nitems = decodeLength(cursor);
+  for (size_t i = 0; i < nitems; ++i) {
+    auto key = decodeString(cursor);
+    auto valueType = cursor.read<int8_t>();
+    if (key != rowsField_) {
+      header_.insert(std::move(key), decodeValue(valueType, cursor));
+      continue;
+    }
+
+    rows_ = cursor;
+    if (valueType == kTemplate) {
+      keys_ = decodeTemplateKeys(rows_);
+      isTemplate_ = true;
+    } else if (valueType != kArray) {
+      throwInvalid(rowsField_.c_str(), valueType);
+    }
+    remaining_ = decodeLength(rows_);
+    hasRows_ = true;
+    // This also checks that the rows are all there, so that decoding them
+    // later can't fail part of the way through
+    skipValue(valueType, cursor);
+  }
+}
+
+void BserRowDecoder::decodeRows(size_t maxRows, const RowCallback& callback) {
+  for (; maxRows > 0 && remaining_ > 0; --maxRows) {
+    --remaining_;
+    if (isTemplate_) {
+      callback(decodeTemplateRow(keys_, rows_));
+    } else {
+      callback(decodeValue(rows_.read<int8_t>(), rows_));
+    }
+  }
+}
+
+void BserRowDecoder::collectRows() {
+  if (!hasRows_) {
+    return;
+  }
+  dynamic rows = dynamic::array;
+  decodeRows(
+      remaining_, [&](dynamic&& row) { rows.push_back(std::move(row)); });
+  header_[rowsField_] = std::move(rows);
+}
+} // namespace watchman
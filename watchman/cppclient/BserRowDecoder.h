@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <folly/dynamic.h>
+#include <folly/io/Cursor.h>
+#include <folly/io/IOBuf.h>
+
+namespace watchman {
+
+// Decodes a complete BSER PDU that holds an object, but rather than
+// decoding the elements of one of its array fields, such as the "files" of
+// a query result, into the object, hands them over a batch at a time.
+// The rows are never all decoded at once.
+class BserRowDecoder {
+ public:
+  using RowCallback = std::function<void(folly::dynamic&&)>;
+
+  // Decodes the fields of the PDU's object other than rowsField, and finds
+  // its rows.  Throws std::out_of_range if the PDU is truncated and
+  // std::runtime_error if it is not valid BSER.
+  BserRowDecoder(std::unique_ptr<folly::IOBuf> pdu, std::string rowsField);
+
+  // The PDU's object, without rowsField
+  folly::dynamic& header() {
+    return header_;
+  }
+
+  // The number of rows that have not been handed over yet; zero if the
+  // object has no rowsField
+  size_t remainingRows() const {
+    return remaining_;
+  }
+
+  // Decodes up to maxRows more rows, passing each to callback
+  void decodeRows(size_t maxRows, const RowCallback& callback);
+
+  // Decodes the remaining rows into the rowsField of the header, leaving
+  // it as parseBser would have decoded the PDU
+  void collectRows();
+
+ private:
+  std::unique_ptr<folly::IOBuf> pdu_;
+  std::string rowsField_;
+  folly::dynamic header_;
+  // Positioned at the next row
+  folly::io::Cursor rows_;
+  // The keys of a template encoded array
+  std::vector<std::string> keys_;
+  bool isTemplate_{false};
+  bool hasRows_{false};
+  size_t remaining_{0};
+};
+} // namespace watchman
@@ -121,6 +121,22 @@ SemiFuture<QueryResult> WatchmanClient::query(
           [](folly::dynamic&& res) { return QueryResult{std::move(res)}; });
 }
 
+SemiFuture<QueryResult> WatchmanClient::query(
+    dynamic queryObj,
+    WatchPathPtr path,
+    WatchmanConnection::RowCallback rowCallback) {
+  if (path->relativePath_) {
+    queryObj["relative_root"] = *path->relativePath_;
+  }
+  return conn_
+      ->runStreaming(
+          dynamic::array("query", path->root_, std::move(queryObj)),
+          std::move(rowCallback))
+      .semi()
+      .deferValue(
+          [](folly::dynamic&& res) { return QueryResult{std::move(res)}; });
+}
+
 SemiFuture<SubscriptionPtr> WatchmanClient::subscribe(
     dynamic query,
     WatchPathPtr path,
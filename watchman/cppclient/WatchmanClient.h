@@ -203,6 +203,16 @@ struct WatchmanClient {
       folly::dynamic queryObj,
       WatchPathPtr path);
 
+  /**
+   * As query() above, but rather than collecting the files that match into
+   * the QueryResult, passes each to rowCallback as it is decoded, via the
+   * cpuExecutor. The QueryResult has no "files" field.
+   */
+  folly::SemiFuture<QueryResult> query(
+      folly::dynamic queryObj,
+      WatchPathPtr path,
+      WatchmanConnection::RowCallback rowCallback);
+
   /**
    * Establishes a subscription that will trigger callback (via your specified
    * executor) whenever matching files change.
@@ -7,7 +7,9 @@
 
 #include "WatchmanConnection.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <vector>
 
 #include <folly/ExceptionWrapper.h>
 #include <folly/SocketAddress.h>
@@ -31,8 +33,28 @@ using facebook::eden::SpawnedProcess;
 // Ordered with the most likely kind first
 static const std::vector<dynamic> kUnilateralLabels{"subscription", "log"};
 
+static bool isUnilateral(const dynamic& response) {
+  for (const auto& k : kUnilateralLabels) {
+    if (response.get_ptr(k)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 static const dynamic kError("error");
 static const dynamic kCapabilities("capabilities");
+static const dynamic kSubscription("subscription");
+static const std::string kFiles("files");
+
+// Rows are passed to a RowCallback in batches of this many, and other work
+// queued on the executor, or on the event base when decoding inline, runs
+// between the batches
+static constexpr size_t kRowsPerBatch = 1024;
+
+// Once this much has been read but not yet decoded, reading stops until
+// the decoding catches up with it
+static constexpr size_t kMaxBufferedBytes = 32 * 1024 * 1024;
 
 // We'll just dispatch bser decodes and callbacks inline unless they
 // give us an alternative environment
@@ -201,11 +223,19 @@ void WatchmanConnection::connectErr(
   connectPromise_.setException(ex);
 }
 
-WatchmanConnection::QueuedCommand::QueuedCommand(const dynamic& command)
-    : cmd(command) {}
+WatchmanConnection::QueuedCommand::QueuedCommand(
+    const dynamic& command,
+    RowCallback rowCallback)
+    : cmd(command), rowCallback(std::move(rowCallback)) {}
 
 Future<dynamic> WatchmanConnection::run(const dynamic& command) noexcept {
-  auto cmd = std::make_shared<QueuedCommand>(command);
+  return runStreaming(command, nullptr);
+}
+
+Future<dynamic> WatchmanConnection::runStreaming(
+    const dynamic& command,
+    RowCallback rowCallback) noexcept {
+  auto cmd = std::make_shared<QueuedCommand>(command, std::move(rowCallback));
   if (broken_) {
     cmd->promise.setException(WatchmanError("The connection was broken"));
     return cmd->promise.getFuture();
@@ -219,27 +249,39 @@ Future<dynamic> WatchmanConnection::run(const dynamic& command) noexcept {
   bool shouldWrite;
   {
     std::lock_guard<std::mutex> g(mutex_);
-    // We only need to call sendCommand if we don't have a command in
-    // progress; the completion handler will trigger it once we receive
-    // the response
-    shouldWrite = commandQ_.empty();
+    // We only need to call sendCommands if fewer than maxInFlight_
+    // commands are awaiting responses; otherwise the completion handler
+    // will trigger it once we receive one
+    shouldWrite = sent_ < maxInFlight_;
     commandQ_.push_back(cmd);
   }
 
   if (shouldWrite) {
     eventBase_->runInEventBaseThread(
-        [shared_this = shared_from_this()] { shared_this->sendCommand(); });
+        [shared_this = shared_from_this()] { shared_this->sendCommands(); });
   }
 
   return cmd->promise.getFuture();
 }
 
+void WatchmanConnection::setSubscriptionRowCallback(
+    const std::string& name,
+    RowCallback rowCallback) {
+  std::lock_guard<std::mutex> g(mutex_);
+  if (rowCallback) {
+    subscriptionRowCallbacks_[name] = std::move(rowCallback);
+  } else {
+    subscriptionRowCallbacks_.erase(name);
+  }
+}
+
 // Generate a failure for all queued commands
 void WatchmanConnection::failQueuedCommands(
     const folly::exception_wrapper& ex) {
   std::lock_guard<std::mutex> g(mutex_);
   auto q = commandQ_;
   commandQ_.clear();
+  sent_ = 0;
 
   broken_ = true;
   for (auto& cmd : q) {
@@ -256,29 +298,58 @@ void WatchmanConnection::failQueuedCommands(
   }
 }
 
-// Sends the next eligible command to the Watchman service
-void WatchmanConnection::sendCommand(bool pop) {
-  std::shared_ptr<QueuedCommand> cmd;
-
+void WatchmanConnection::setMaxCommandsInFlight(size_t maxInFlight) {
+  CHECK_GT(maxInFlight, 0);
+  bool shouldWrite;
   {
     std::lock_guard<std::mutex> g(mutex_);
+    maxInFlight_ = maxInFlight;
+    shouldWrite = sent_ < std::min(maxInFlight_, commandQ_.size());
+  }
+  if (shouldWrite && sock_) {
+    eventBase_->runInEventBaseThread(
+        [shared_this = shared_from_this()] { shared_this->sendCommands(); });
+  }
+}
 
-    if (pop) {
-      // We finished processing this one, discard it and focus
-      // on the next item, if any.
-      commandQ_.pop_front();
+// Sends the queued commands that are eligible to the Watchman service.
+// This only runs in the event base thread, so that the commands are
+// written in the order that they were queued, which is the order that
+// their responses will arrive in.
+void WatchmanConnection::sendCommands() {
+  std::vector<std::shared_ptr<QueuedCommand>> cmds;
+
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    while (sent_ < commandQ_.size() && sent_ < maxInFlight_) {
+      cmds.push_back(commandQ_[sent_++]);
     }
-    if (commandQ_.empty()) {
+  }
+
+  for (auto& cmd : cmds) {
+    if (!sock_) {
       return;
     }
-    cmd = commandQ_.front();
+    sock_->writeChain(this, toBserIOBuf(cmd->cmd, serialization_opts()));
   }
-
-  sock_->writeChain(this, toBserIOBuf(cmd->cmd, serialization_opts()));
 }
 
 void WatchmanConnection::popAndSendCommand() {
-  sendCommand(/* pop = */ true);
+  bool shouldWrite;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    // We finished processing this one, discard it and focus
+    // on the next item, if any.
+    if (!commandQ_.empty()) {
+      commandQ_.pop_front();
+      --sent_;
+    }
+    shouldWrite = sent_ < commandQ_.size();
+  }
+  if (shouldWrite) {
+    eventBase_->runInEventBaseThread(
+        [shared_this = shared_from_this()] { shared_this->sendCommands(); });
+  }
 }
 
 // Called when AsyncSocket::writeChain completes
@@ -303,19 +374,29 @@ void WatchmanConnection::getReadBuffer(void** bufReturn, size_t* lenReturn) {
 
 // Called when AsyncSocket gave us data
 void WatchmanConnection::readDataAvailable(size_t len) noexcept {
+  size_t buffered;
   {
     std::lock_guard<std::mutex> g(mutex_);
     bufQ_.postallocate(len);
+    buffered = bufQ_.chainLength();
+  }
+  // If the decoding is busy and falling behind, stop reading until it is
+  // done, rather than buffering without bound.  A decoding pass that is
+  // waiting for more of a PDU never leaves reading paused.
+  if (buffered >= kMaxBufferedBytes && decoding_.load()) {
+    readPaused_.store(true);
+    sock_->setReadCB(nullptr);
   }
   cpuExecutor_->add([shared_this = shared_from_this()] {
     shared_this->decodeNextResponse();
   });
 }
 
-std::unique_ptr<folly::IOBuf> WatchmanConnection::splitNextPdu() {
-  std::lock_guard<std::mutex> g(mutex_);
+// Returns the length of the PDU at the front of bufQ_, or zero if it has
+// not all arrived yet.  mutex_ must be held.
+size_t WatchmanConnection::completePduLength() {
   if (!bufQ_.front()) {
-    return nullptr;
+    return 0;
   }
 
   // Do we have enough data to decode the next item?
@@ -324,11 +405,20 @@ std::unique_ptr<folly::IOBuf> WatchmanConnection::splitNextPdu() {
     pdu_len = decodePduLength(bufQ_.front());
   } catch (const std::out_of_range&) {
     // Don't have enough data yet
-    return nullptr;
+    return 0;
   }
 
   if (pdu_len > bufQ_.chainLength()) {
     // Don't have enough data yet
+    return 0;
+  }
+  return pdu_len;
+}
+
+std::unique_ptr<folly::IOBuf> WatchmanConnection::splitNextPdu() {
+  std::lock_guard<std::mutex> g(mutex_);
+  auto pdu_len = completePduLength();
+  if (pdu_len == 0) {
     return nullptr;
   }
 
@@ -350,67 +440,181 @@ void WatchmanConnection::decodeNextResponse() {
   if (decoding_.exchange(true)) {
     return;
   }
-  SCOPE_EXIT {
-    decoding_.store(false);
-  };
+  decodeResponses();
+}
 
+// Carries on decoding while holding decoding_, which it eventually
+// releases
+void WatchmanConnection::decodeResponses() {
   while (true) {
-    auto pdu = splitNextPdu();
-    if (!pdu) {
+    if (decodeSomeResponses()) {
+      // We stopped between batches of rows; keep holding decoding_ so that
+      // nothing can be dispatched ahead of them, and carry on after the
+      // other work that is waiting
+      auto next = [shared_this = shared_from_this()] {
+        shared_this->decodeResponses();
+      };
+      if (cpuExecutor_.get() == &inlineExecutor) {
+        eventBase_->runInEventBaseThread(std::move(next));
+      } else {
+        cpuExecutor_->add(std::move(next));
+      }
       return;
     }
 
-    try {
-      auto decoded = parseBser(pdu.get());
-
-      bool is_unilateral = false;
-      // Check for a unilateral response
-      for (const auto& k : kUnilateralLabels) {
-        if (decoded.get_ptr(k)) {
-          // This is a unilateral response
-          if (callback_.has_value()) {
-            callback_.value()(watchmanResponseToTry(std::move(decoded)));
-            is_unilateral = true;
-            break;
-          }
-          // No callback; usage error :-/
-          failQueuedCommands(
-              std::runtime_error("No unilateral callback has been installed"));
-          return;
-        }
+    decoding_.store(false);
+    resumeReading();
+
+    // Data that arrived after we last looked was left to us by its decode
+    // task, which found decoding_ set
+    {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (broken_ || completePduLength() == 0) {
+        return;
       }
-      if (is_unilateral) {
+    }
+    if (decoding_.exchange(true)) {
+      return;
+    }
+  }
+}
+
+// Returns true if it stopped with rows left to pass to a RowCallback, or
+// false once it has run out of complete PDUs
+bool WatchmanConnection::decodeSomeResponses() {
+  try {
+    while (true) {
+      if (streaming_) {
+        if (broken_) {
+          // The command's promise has already been failed
+          streaming_.reset();
+          return false;
+        }
+        auto& decoder = *streaming_->decoder;
+        decoder.decodeRows(kRowsPerBatch, streaming_->rowCallback);
+        if (decoder.remainingRows() > 0) {
+          return true;
+        }
+        auto streamed = std::move(streaming_);
+        if (!dispatchResponse(
+                std::move(streamed->decoder->header()),
+                std::move(streamed->cmd))) {
+          return false;
+        }
         continue;
       }
 
-      // It's actually a command response; get the cmd so that we
-      // can fulfil its promise
-      std::shared_ptr<QueuedCommand> cmd;
-      {
-        std::lock_guard<std::mutex> g(mutex_);
-        if (commandQ_.empty()) {
-          failQueuedCommands(
-              std::runtime_error("No commands have been queued"));
-          return;
+      auto pdu = splitNextPdu();
+      if (!pdu) {
+        return false;
+      }
+      bool ok = wantsRows() ? startStreaming(std::move(pdu))
+                            : dispatchResponse(parseBser(pdu.get()), nullptr);
+      if (!ok) {
+        return false;
+      }
+    }
+  } catch (const std::exception& ex) {
+    streaming_.reset();
+    failQueuedCommands(folly::exception_wrapper{std::current_exception(), ex});
+    return false;
+  }
+}
+
+// Returns true if a RowCallback may want the rows of the next response
+bool WatchmanConnection::wantsRows() {
+  std::lock_guard<std::mutex> g(mutex_);
+  return !subscriptionRowCallbacks_.empty() ||
+      (!commandQ_.empty() && commandQ_.front()->rowCallback);
+}
+
+// Decodes all of the PDU but its rows, and if a RowCallback wants them,
+// sets up streaming_ to pass them to it; otherwise dispatches the whole
+// response.  Returns false if the connection failed.
+bool WatchmanConnection::startStreaming(std::unique_ptr<folly::IOBuf> pdu) {
+  auto decoder = std::make_unique<BserRowDecoder>(std::move(pdu), kFiles);
+  const auto& header = decoder->header();
+  RowCallback rowCallback;
+  std::shared_ptr<QueuedCommand> cmd;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    if (isUnilateral(header)) {
+      auto name = header.get_ptr(kSubscription);
+      if (callback_.has_value() && name && name->isString()) {
+        auto it = subscriptionRowCallbacks_.find(name->getString());
+        if (it != subscriptionRowCallbacks_.end()) {
+          rowCallback = it->second;
         }
-        cmd = commandQ_.front();
       }
+    } else if (!commandQ_.empty()) {
+      cmd = commandQ_.front();
+      rowCallback = cmd->rowCallback;
+    }
+  }
 
-      // Dispatch outside of the lock in case it tries to send another
-      // command
-      cmd->promise.setTry(watchmanResponseToTry(std::move(decoded)));
+  if (!rowCallback) {
+    decoder->collectRows();
+    return dispatchResponse(std::move(decoder->header()), nullptr);
+  }
+  streaming_ = std::make_unique<StreamingResponse>(StreamingResponse{
+      std::move(decoder), std::move(rowCallback), std::move(cmd)});
+  return true;
+}
 
-      // Now we're in a position to send the next queued command.
-      // We remove it after dispatching the try above in case that
-      // queued up more commands; we want to be the one thing that
-      // is responsible for sending the next queued command here
-      popAndSendCommand();
-    } catch (const std::exception& ex) {
+// Passes a response to the callback_ if it is unilateral, and otherwise to
+// the promise of cmd, or of the command at the front of the queue if cmd
+// is null.  Returns false if the connection failed.
+bool WatchmanConnection::dispatchResponse(
+    dynamic&& decoded,
+    std::shared_ptr<QueuedCommand> cmd) {
+  if (!cmd) {
+    if (isUnilateral(decoded)) {
+      if (callback_.has_value()) {
+        callback_.value()(watchmanResponseToTry(std::move(decoded)));
+        return true;
+      }
+      // No callback; usage error :-/
       failQueuedCommands(
-          folly::exception_wrapper{std::current_exception(), ex});
-      return;
+          std::runtime_error("No unilateral callback has been installed"));
+      return false;
+    }
+
+    // It's actually a command response; get the cmd so that we
+    // can fulfil its promise
+    {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (!commandQ_.empty()) {
+        cmd = commandQ_.front();
+      }
+    }
+    if (!cmd) {
+      failQueuedCommands(std::runtime_error("No commands have been queued"));
+      return false;
     }
   }
+
+  // Dispatch outside of the lock in case it tries to send another
+  // command
+  cmd->promise.setTry(watchmanResponseToTry(std::move(decoded)));
+
+  // Now we're in a position to send the next queued command.
+  // We remove it after dispatching the try above in case that
+  // queued up more commands; we want to be the one thing that
+  // is responsible for sending the next queued command here
+  popAndSendCommand();
+  return true;
+}
+
+// Undoes readDataAvailable pausing reads once the decoding catches up
+void WatchmanConnection::resumeReading() {
+  if (!readPaused_.exchange(false)) {
+    return;
+  }
+  eventBase_->runInEventBaseThread([shared_this = shared_from_this()] {
+    if (shared_this->sock_ && !shared_this->closing_) {
+      shared_this->sock_->setReadCB(shared_this.get());
+    }
+  });
 }
 
 // Called when AsyncSocket hits EOF
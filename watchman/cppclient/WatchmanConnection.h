@@ -11,6 +11,7 @@
 #include <deque>
 #include <memory>
 #include <optional>
+#include <unordered_map>
 
 #include <folly/ExceptionWrapper.h>
 #include <folly/dynamic.h>
@@ -19,6 +20,8 @@
 #include <folly/io/async/AsyncSocket.h>
 #include <folly/io/async/EventBase.h>
 
+#include "BserRowDecoder.h"
+
 namespace watchman {
 
 // General watchman error
@@ -47,6 +50,9 @@ class WatchmanConnection
       public std::enable_shared_from_this<WatchmanConnection> {
  public:
   using Callback = std::function<void(folly::Try<folly::dynamic>)>;
+  using RowCallback = BserRowDecoder::RowCallback;
+
+  static constexpr size_t kDefaultMaxCommandsInFlight = 16;
 
   explicit WatchmanConnection(
       folly::EventBase* eventBase,
@@ -72,6 +78,28 @@ class WatchmanConnection
   // If the connection was terminated, will throw immediately
   folly::Future<folly::dynamic> run(const folly::dynamic& command) noexcept;
 
+  // As run(), but rather than decoding the "files" of the response into
+  // it, passes them to rowCallback one at a time as they are decoded, via
+  // the cpuExecutor and before the response is yielded without them.
+  // This is the way to run queries that may match a great many files.
+  folly::Future<folly::dynamic> runStreaming(
+      const folly::dynamic& command,
+      RowCallback rowCallback) noexcept;
+
+  // Passes the "files" of each unilateral response for the named
+  // subscription to rowCallback as they are decoded, before the Callback
+  // receives the rest of the response.  An empty rowCallback goes back to
+  // passing the Callback the whole response.
+  void setSubscriptionRowCallback(
+      const std::string& name,
+      RowCallback rowCallback);
+
+  // Commands are written without waiting for the responses to those
+  // written before them, up to this many at a time, and the service
+  // answers them in order.  1 sends each only once the previous command
+  // has been answered.
+  void setMaxCommandsInFlight(size_t maxInFlight);
+
   // Close the connection.  All queued commands will be cancelled
   void close();
 
@@ -90,16 +118,37 @@ class WatchmanConnection
   struct QueuedCommand {
     folly::dynamic cmd;
     folly::Promise<folly::dynamic> promise;
+    RowCallback rowCallback;
+
+    explicit QueuedCommand(
+        const folly::dynamic& command,
+        RowCallback rowCallback = {});
+  };
 
-    explicit QueuedCommand(const folly::dynamic& command);
+  // A response whose rows are being passed to a RowCallback.  They are
+  // decoded in batches, letting other work run in between.
+  struct StreamingResponse {
+    std::unique_ptr<BserRowDecoder> decoder;
+    RowCallback rowCallback;
+    // The command that this responds to; null for a unilateral response
+    std::shared_ptr<QueuedCommand> cmd;
   };
 
   folly::Future<std::string> getSockPath();
   void failQueuedCommands(const folly::exception_wrapper& ex);
-  void sendCommand(bool pop = false);
+  void sendCommands();
   void popAndSendCommand();
   void decodeNextResponse();
+  void decodeResponses();
+  bool decodeSomeResponses();
+  bool wantsRows();
+  bool startStreaming(std::unique_ptr<folly::IOBuf> pdu);
+  bool dispatchResponse(
+      folly::dynamic&& decoded,
+      std::shared_ptr<QueuedCommand> cmd);
+  void resumeReading();
   folly::Try<folly::dynamic> watchmanResponseToTry(folly::dynamic&& value);
+  size_t completePduLength();
   std::unique_ptr<folly::IOBuf> splitNextPdu();
 
   // ConnectCallback
@@ -126,10 +175,19 @@ class WatchmanConnection
   folly::dynamic versionCmd_;
   std::shared_ptr<folly::AsyncSocket> sock_;
   std::mutex mutex_;
+  // The commands awaiting responses, of which the first sent_ have been
+  // written
   std::deque<std::shared_ptr<QueuedCommand>> commandQ_;
+  size_t sent_{0};
+  size_t maxInFlight_{kDefaultMaxCommandsInFlight};
+  std::unordered_map<std::string, RowCallback> subscriptionRowCallbacks_;
   folly::IOBufQueue bufQ_{folly::IOBufQueue::cacheChainLength()};
   bool broken_{false};
   bool closing_{false};
   std::atomic<bool> decoding_{false};
+  // Only accessed by whoever holds decoding_
+  std::unique_ptr<StreamingResponse> streaming_;
+  // Set while reading from sock_ is paused to let the decoding catch up
+  std::atomic<bool> readPaused_{false};
 };
 } // namespace watchman
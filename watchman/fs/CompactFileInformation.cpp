@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/CompactFileInformation.h"
+#include <folly/hash/Hash.h>
+
+namespace watchman {
+
+namespace {
+// The link count of a dir changes whenever a child dir is added or removed,
+// so, as with size, it is not considered for dirs.
+uint64_t digestExtraFields(const FileInformation& info) {
+  return folly::hash::hash_combine(
+      uint64_t(info.dev),
+      uint64_t(info.uid),
+      uint64_t(info.gid),
+      info.isDir() ? uint64_t(0) : uint64_t(info.nlink));
+}
+
+bool timespecEqual(const struct timespec& a, const struct timespec& b) {
+  // Can't compare with memcmp due to padding and garbage in the struct
+  // on OpenBSD, which has a 32-bit tv_sec + 64-bit tv_nsec
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+} // namespace
+
+CompactFileInformation::CompactFileInformation(const FileInformation& info)
+    : mtime(info.mtime),
+      ctime(info.ctime),
+      size(info.size),
+      ino(info.ino),
+      mode(info.mode),
+      extraDigest(digestExtraFields(info))
+#ifdef _WIN32
+      ,
+      fileAttributes(info.fileAttributes)
+#endif
+{
+}
+
+DType CompactFileInformation::dtype() const {
+  return expandFileInformation(*this, nullptr).dtype();
+}
+
+bool CompactFileInformation::isSymlink() const {
+#ifdef _WIN32
+  // We treat all reparse points as equivalent to symlinks
+  return fileAttributes & FILE_ATTRIBUTE_REPARSE_POINT;
+#else
+  return S_ISLNK(mode);
+#endif
+}
+
+bool CompactFileInformation::isDir() const {
+#ifdef _WIN32
+  // See FileInformation::isDir for why both bits are checked.
+  return (fileAttributes &
+          (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) ==
+      FILE_ATTRIBUTE_DIRECTORY;
+#else
+  return S_ISDIR(mode);
+#endif
+}
+
+bool CompactFileInformation::isFile() const {
+#ifdef _WIN32
+  return (fileAttributes &
+          (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) == 0;
+#else
+  return S_ISREG(mode);
+#endif
+}
+
+bool CompactFileInformation::differsFrom(const FileInformation& info) const {
+  if (mode != info.mode) {
+    return true;
+  }
+  if (!isDir() && size != info.size) {
+    return true;
+  }
+  // Don't care about st_blocks
+  // Don't care about st_blksize
+  // Don't care about st_atimespec
+  return ino != info.ino || extraDigest != digestExtraFields(info) ||
+      !timespecEqual(mtime, info.mtime) || !timespecEqual(ctime, info.ctime);
+}
+
+bool CompactFileInformation::differsFrom(
+    const CompactFileInformation& other) const {
+  if (mode != other.mode) {
+    return true;
+  }
+  if (!isDir() && size != other.size) {
+    return true;
+  }
+  return ino != other.ino || extraDigest != other.extraDigest ||
+      !timespecEqual(mtime, other.mtime) || !timespecEqual(ctime, other.ctime);
+}
+
+ExtendedFileInformation::ExtendedFileInformation(const FileInformation& info)
+    : atime(info.atime),
+      dev(info.dev),
+      uid(info.uid),
+      gid(info.gid),
+      nlink(info.nlink) {}
+
+bool ExtendedFileInformation::differsFrom(const FileInformation& info) const {
+  return dev != info.dev || uid != info.uid || gid != info.gid ||
+      (!info.isDir() && nlink != info.nlink);
+}
+
+FileInformation expandFileInformation(
+    const CompactFileInformation& compact,
+    const ExtendedFileInformation* extended) {
+  FileInformation info;
+  info.mode = compact.mode;
+  info.size = compact.size;
+  info.ino = compact.ino;
+  info.mtime = compact.mtime;
+  info.ctime = compact.ctime;
+#ifdef _WIN32
+  info.fileAttributes = compact.fileAttributes;
+#endif
+  if (extended) {
+    info.atime = extended->atime;
+    info.dev = extended->dev;
+    info.uid = extended->uid;
+    info.gid = extended->gid;
+    info.nlink = extended->nlink;
+  }
+  return info;
+}
+
+} // namespace watchman
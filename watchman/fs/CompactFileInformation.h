@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "watchman/fs/FileInformation.h"
+
+namespace watchman {
+
+/**
+ * The subset of FileInformation that the in-memory view always retains for
+ * each file: enough to answer the common query fields and to classify the
+ * file by type.
+ *
+ * The remaining change-relevant fields (dev, uid, gid and nlink) are folded
+ * into extraDigest so that change detection does not depend on whether the
+ * ExtendedFileInformation for the file is retained. A change to them only
+ * goes unnoticed here if the digests collide, so where the fields are
+ * retained, ExtendedFileInformation::differsFrom compares them as well.
+ */
+struct CompactFileInformation {
+  struct timespec mtime {
+    0, 0
+  };
+  struct timespec ctime {
+    0, 0
+  };
+  off_t size{0};
+  ino_t ino{0};
+  mode_t mode{0};
+  uint64_t extraDigest{0};
+#ifdef _WIN32
+  uint32_t fileAttributes{0};
+#endif
+
+  CompactFileInformation() = default;
+  explicit CompactFileInformation(const FileInformation& info);
+
+  // These have the same meaning as their FileInformation counterparts.
+  DType dtype() const;
+  bool isSymlink() const;
+  bool isDir() const;
+  bool isFile() const;
+
+  /**
+   * Returns true if info describes a different file state than this one, in
+   * the sense that matters to the view. atime is deliberately not considered.
+   */
+  bool differsFrom(const FileInformation& info) const;
+  bool differsFrom(const CompactFileInformation& other) const;
+};
+
+/**
+ * The fields of FileInformation that are not part of CompactFileInformation.
+ * The view only stores these for files when they are configured to be
+ * retained; see the retain_stat_fields configuration option.
+ */
+struct ExtendedFileInformation {
+  struct timespec atime {
+    0, 0
+  };
+  dev_t dev{0};
+  uid_t uid{0};
+  gid_t gid{0};
+  nlink_t nlink{0};
+
+  ExtendedFileInformation() = default;
+  explicit ExtendedFileInformation(const FileInformation& info);
+
+  /**
+   * Returns true if info has a different dev, uid, gid or nlink, the fields
+   * that CompactFileInformation only keeps a digest of. As there, nlink is
+   * not considered for dirs.
+   */
+  bool differsFrom(const FileInformation& info) const;
+};
+
+/**
+ * Reassembles a FileInformation from its stored parts. If extended is
+ * nullptr, the fields that it would have provided are left zeroed.
+ */
+FileInformation expandFileInformation(
+    const CompactFileInformation& compact,
+    const ExtendedFileInformation* extended);
+
+} // namespace watchman
@@ -15,6 +15,9 @@ namespace watchman {
 struct DirEntry {
   bool has_stat;
   const char* d_name;
+  // The type of the entry as reported by the directory listing, if known.
+  // Unlike stat, this may be available even when has_stat is false.
+  DType dtype{DType::Unknown};
   FileInformation stat;
 };
 
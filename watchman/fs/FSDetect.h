@@ -28,3 +28,10 @@ w_string find_fstype_in_linux_proc_mounts(
 inline bool is_edenfs_fs_type(w_string_piece fs_type) {
   return fs_type == "edenfs" || fs_type.startsWith("edenfs:");
 }
+
+// Returns true for filesystems whose reads may wait on a remote server,
+// where it pays to have more of them in flight.
+inline bool is_network_fs_type(w_string_piece fs_type) {
+  return fs_type == "nfs" || fs_type == "cifs" || fs_type == "smb" ||
+      fs_type == "smbfs" || fs_type == "fuse" || is_edenfs_fs_type(fs_type);
+}
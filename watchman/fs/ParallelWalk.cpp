@@ -8,7 +8,9 @@
 #include "watchman/fs/ParallelWalk.h"
 #include <folly/concurrency/UnboundedQueue.h>
 #include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/executors/thread_factory/InitThreadFactory.h>
 #include <folly/system/HardwareConcurrency.h>
+#include "watchman/ThreadClass.h"
 
 namespace watchman {
 
@@ -19,6 +21,7 @@ struct ParallelWalkerContext {
   // Input.
   std::shared_ptr<FileSystem> fileSystem;
   folly::Executor* executor;
+  bool readSymlinkTargets;
 
   // Task tracking. Other task states live in the Executor.
   std::atomic<size_t> readDirTaskCount{0};
@@ -30,8 +33,11 @@ struct ParallelWalkerContext {
 
   ParallelWalkerContext(
       std::shared_ptr<FileSystem> fileSystem,
-      folly::Executor* executor)
-      : fileSystem{std::move(fileSystem)}, executor{executor} {}
+      folly::Executor* executor,
+      bool readSymlinkTargets)
+      : fileSystem{std::move(fileSystem)},
+        executor{executor},
+        readSymlinkTargets{readSymlinkTargets} {}
 
   // Helper for (resultQueue or errorQueue).dequeue.
   // If no tasks are running, return nullopt.
@@ -60,7 +66,10 @@ folly::Executor::KeepAlive<> createExecutor(size_t threadCountHint) {
       ? std::min(threadCountHint, hwThreadCount)
       : hwThreadCount;
   return new folly::CPUThreadPoolExecutor(
-      threadCount, std::make_unique<folly::NamedThreadFactory>("pwalk"));
+      threadCount,
+      std::make_shared<folly::InitThreadFactory>(
+          std::make_shared<folly::NamedThreadFactory>("pwalk"),
+          [] { applyThreadClassPolicy(ThreadClass::Walker); }));
 }
 
 // Executor used by the readDir tasks. The executor is global to avoid spawning
@@ -200,11 +209,20 @@ void readDirTask(
     if (st.isDir()) {
       subdirCount += 1;
     }
+    std::optional<w_string> symlinkTarget;
+    if (context->readSymlinkTargets && st.isSymlink()) {
+      try {
+        symlinkTarget = readSymbolicLink(pathJoin(dirFullPath, name).c_str());
+      } catch (const std::system_error&) {
+        // Left for whoever wants the target to read, and report.
+      }
+    }
     DirEntryOwned entry{
         std::move(name),
         st,
+        std::move(symlinkTarget),
     };
-    entries.push_back(entry);
+    entries.push_back(std::move(entry));
   }
 
   // Figure out subdirs to read before losing ownership of entries.
@@ -242,10 +260,11 @@ void readDirTask(
 ParallelWalker::ParallelWalker(
     std::shared_ptr<FileSystem> fileSystem,
     AbsolutePath rootPath,
-    size_t threadCountHint) {
+    size_t threadCountHint,
+    bool readSymlinkTargets) {
   auto executor = getExecutor(threadCountHint);
-  context_ =
-      std::make_shared<ParallelWalkerContext>(std::move(fileSystem), executor);
+  context_ = std::make_shared<ParallelWalkerContext>(
+      std::move(fileSystem), executor, readSymlinkTargets);
   auto task = [context = context_,
                path = std::move(rootPath),
                counter = ReadDirTaskCounter(context_)]() mutable {
@@ -262,6 +281,25 @@ std::optional<ReadDirResult> ParallelWalker::nextResult() {
   return context_->taskAwareDequeue(context_->resultQueue);
 }
 
+std::vector<ReadDirResult> ParallelWalker::nextResults(size_t maxResults) {
+  std::vector<ReadDirResult> results;
+  auto first = nextResult();
+  if (!first.has_value()) {
+    return results;
+  }
+  results.push_back(std::move(first).value());
+  while (results.size() < maxResults) {
+    auto maybe = context_->resultQueue.try_dequeue();
+    // An empty inner value marks the end of the walk. Once it is consumed,
+    // nextResult() sees that no tasks remain and does not block.
+    if (!maybe || !maybe->has_value()) {
+      break;
+    }
+    results.push_back(std::move(maybe).value().value());
+  }
+  return results;
+}
+
 std::optional<IoErrorWithPath> ParallelWalker::nextError() {
   return context_->taskAwareDequeue(context_->errorQueue);
 }
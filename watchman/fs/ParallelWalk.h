@@ -24,6 +24,8 @@ using AbsolutePath = folly::fbstring;
 struct DirEntryOwned {
   PathComponent name;
   FileInformation stat;
+  // The target of a symlink, if the walker was asked to read them and could
+  std::optional<w_string> symlinkTarget;
 };
 
 /** ReadDir result: names and stats of direct children of a directory. */
@@ -62,13 +64,17 @@ class ParallelWalker final {
    * threadCountHint can be 0, which means the hardware concurrency.
    * threadCountHint caps at hardware concurrency.
    *
+   * If readSymlinkTargets is true, the target of each symlink is read along
+   * with its stat.
+   *
    * Use nextResult() to obtain ReadDirResults.
    * Use nextError() to obtain IoErrorWithPaths.
    */
   explicit ParallelWalker(
       std::shared_ptr<FileSystem> fileSystem,
       AbsolutePath rootPath,
-      size_t threadCountHint = 0);
+      size_t threadCountHint = 0,
+      bool readSymlinkTargets = false);
 
   /**
    * Obtain the next ReadDirResult. Might block.
@@ -78,6 +84,15 @@ class ParallelWalker final {
    */
   std::optional<ReadDirResult> nextResult();
 
+  /**
+   * Obtain up to maxResults ReadDirResults. Blocks until at least one is
+   * available, then takes whichever others are ready without blocking.
+   *
+   * Results are in the same order as nextResult() would return them. After
+   * completion, always return an empty vector without blocking.
+   */
+  std::vector<ReadDirResult> nextResults(size_t maxResults);
+
   /**
    * Obtain an occured error. Might block.
    *
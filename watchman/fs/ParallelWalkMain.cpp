@@ -5,74 +5,377 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+/*
+  Crawl benchmark. Walks each given tree with a serial walker, like the
+  crawler of InMemoryView, and with ParallelWalker at each of --threads,
+  using each of the --backends that read directories, with warm and/or cold
+  caches. Reports dirs/s, entries/s, how many opendir and stat calls each
+  entry cost, and peak memory, for choosing parallel_crawl_thread_count.
+
+  For example:
+  $ ParallelWalkMain --threads=1,4,16 --backends=default,io_uring \
+      --cache=warm,cold /data/repo
+
+  ParallelWalker's thread pool is created once per process, so each run
+  happens in a child process of its own; that also makes its peak memory
+  its own. Dropping the caches for cold runs needs root on Linux.
+*/
+
+#include <fmt/core.h>
+#include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
+#include <folly/String.h>
+#include <folly/Subprocess.h>
 #include <folly/init/Init.h>
+#include <folly/json.h>
+#include <folly/portability/SysResource.h>
+#include <folly/portability/Unistd.h>
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdlib>
+#include <deque>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/fs/ParallelWalk.h"
 
-void walk(watchman::AbsolutePath path, size_t threadCountHint) {
-  std::cout << path << std::endl;
-
-  auto start_time = std::chrono::steady_clock::now();
-  std::shared_ptr<watchman::FileSystem> fileSystem(
-      std::shared_ptr<watchman::FileSystem>{}, &watchman::realFileSystem);
-  auto walker = watchman::ParallelWalker(fileSystem, path, threadCountHint);
-  size_t directory_count = 0;
-  size_t path_count = 0;
-  off_t size = 0;
-  while (true) {
-    auto result = walker.nextResult();
-    if (!result.has_value()) {
-      break;
+DEFINE_string(
+    threads,
+    "1,2,4,8,0",
+    "ParallelWalker thread counts to compare; 0 is the hardware concurrency");
+DEFINE_bool(serial, true, "Also walk serially, as InMemoryView::crawler does");
+DEFINE_string(
+    backends,
+    "default",
+    "How directories are read: default, bulkstat or io_uring. The latter "
+    "two are Linux only and fall back to lstat where unsupported");
+DEFINE_string(cache, "warm", "warm, cold, or both as warm,cold");
+DEFINE_int32(repeat, 3, "How many times each configuration is measured");
+DEFINE_bool(json, false, "Print each run as a line of JSON");
+DEFINE_string(child_run, "", "Internal: walker:threads to measure");
+DEFINE_string(child_root, "", "Internal: the tree to walk");
+
+namespace {
+
+using namespace watchman;
+
+// Counts the calls the walkers make to the filesystem, a proxy for the
+// syscalls they cost: reading a directory takes a few more, and the bulk
+// backends' batched stats are not counted as calls at all.
+class CountingFileSystem : public FileSystem {
+ public:
+  std::unique_ptr<DirHandle> openDir(const char* path, bool strict)
+      override {
+    openDirs.fetch_add(1, std::memory_order_relaxed);
+    return realFileSystem.openDir(path, strict);
+  }
+
+  FileInformation getFileInformation(
+      const char* path,
+      CaseSensitivity caseSensitive) override {
+    stats.fetch_add(1, std::memory_order_relaxed);
+    return realFileSystem.getFileInformation(path, caseSensitive);
+  }
+
+  void touch(const char* path) override {
+    realFileSystem.touch(path);
+  }
+
+  std::atomic<size_t> openDirs{0};
+  std::atomic<size_t> stats{0};
+};
+
+struct WalkCounts {
+  size_t dirs{0};
+  size_t entries{0};
+  size_t errors{0};
+};
+
+folly::fbstring pathJoin(const folly::fbstring& dir, const char* name) {
+  return folly::to<folly::fbstring>(dir, '/', name);
+}
+
+// Reads and stats each directory in turn, parents before children.
+WalkCounts walkSerially(FileSystem& fs, const AbsolutePath& root) {
+  WalkCounts counts;
+  std::deque<AbsolutePath> dirs{root};
+  while (!dirs.empty()) {
+    auto dirPath = std::move(dirs.front());
+    dirs.pop_front();
+    std::unique_ptr<DirHandle> dir;
+    try {
+      dir = fs.openDir(dirPath.c_str());
+    } catch (const std::system_error&) {
+      ++counts.errors;
+      continue;
     }
-    directory_count += 1;
-    auto& entries = result.value().entries;
-    path_count += entries.size();
-    for (const auto& entry : entries) {
-      size += entry.stat.size;
+    ++counts.dirs;
+    while (const DirEntry* dirent = dir->readDir()) {
+      const char* name = dirent->d_name;
+      if (name[0] == '.' &&
+          (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+        continue;
+      }
+      auto fullPath = pathJoin(dirPath, name);
+      FileInformation st;
+      if (dirent->has_stat) {
+        st = dirent->stat;
+      } else {
+        try {
+          st = fs.getFileInformation(fullPath.c_str());
+        } catch (const std::system_error&) {
+          ++counts.errors;
+          continue;
+        }
+      }
+      ++counts.entries;
+      if (st.isDir()) {
+        dirs.push_back(std::move(fullPath));
+      }
     }
   }
-  auto end_time = std::chrono::steady_clock::now();
-  auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
-      end_time - start_time);
-  double seconds = milliseconds.count() / 1000.;
+  return counts;
+}
 
-  while (true) {
-    auto maybe_error = walker.nextError();
-    if (!maybe_error) {
-      break;
-    }
-    auto error = maybe_error.value();
-    std::cout << "  Error: " << error.fullPath << ": " << error.error.what()
-              << std::endl;
+WalkCounts walkInParallel(
+    std::shared_ptr<FileSystem> fs,
+    const AbsolutePath& root,
+    size_t threads) {
+  WalkCounts counts;
+  ParallelWalker walker{std::move(fs), root, threads};
+  while (auto result = walker.nextResult()) {
+    ++counts.dirs;
+    counts.entries += result->entries.size();
+  }
+  while (walker.nextError()) {
+    ++counts.errors;
+  }
+  return counts;
+}
+
+uint64_t peakRssBytes() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss;
+#else
+  return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+// Runs in the child: one walk, printed as a line of JSON.
+int childMain() {
+  cfg_load_global_config_file();
+
+  std::string walkerName;
+  size_t threads = 0;
+  if (!folly::split(':', FLAGS_child_run, walkerName, threads)) {
+    std::cerr << "bad --child_run " << FLAGS_child_run << std::endl;
+    return 1;
+  }
+  AbsolutePath root{FLAGS_child_root};
+  auto fs = std::make_shared<CountingFileSystem>();
+
+  auto start = std::chrono::steady_clock::now();
+  auto counts = walkerName == "serial" ? walkSerially(*fs, root)
+                                       : walkInParallel(fs, root, threads);
+  auto seconds = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+
+  std::cout << folly::toJson(folly::dynamic::object("dirs", counts.dirs)(
+                   "entries", counts.entries)("errors", counts.errors)(
+                   "seconds", seconds)("opendirs", fs->openDirs.load())(
+                   "stats", fs->stats.load())("peak_rss_bytes", peakRssBytes()))
+            << std::endl;
+  return 0;
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+  std::vector<std::string> items;
+  folly::split(',', list, items, true);
+  return items;
+}
+
+// The global config that selects each backend, as UnixDirHandle reads it.
+std::string backendConfig(const std::string& backend) {
+  if (backend == "bulkstat") {
+    return R"({"_use_bulkstat": true})";
+  }
+  if (backend == "io_uring") {
+    return R"({"io_uring_statx": true})";
+  }
+  if (backend == "default") {
+    return "{}";
   }
+  throw std::invalid_argument(fmt::format("unknown backend {}", backend));
+}
+
+bool dropCaches() {
+#ifdef __linux__
+  sync();
+  return folly::writeFile(std::string{"3"}, "/proc/sys/vm/drop_caches");
+#else
+  return false;
+#endif
+}
+
+struct Run {
+  std::string root;
+  std::string walker;
+  size_t threads;
+  std::string backend;
+  std::string cache;
+};
 
-  std::cout << "  Dir#:  " << directory_count << std::endl;
-  std::cout << "  Path#: " << path_count << std::endl;
-  std::cout << "  Size:  " << size << std::endl;
-  std::cout << "  Time:  " << seconds << " seconds" << std::endl;
+std::optional<folly::dynamic> measure(
+    const char* self,
+    const Run& run,
+    const std::string& configPath) {
+  std::vector<std::string> env;
+  for (char** var = environ; *var; ++var) {
+    env.emplace_back(*var);
+  }
+  env.push_back("WATCHMAN_CONFIG_FILE=" + configPath);
+
+  folly::Subprocess proc{
+      {self,
+       fmt::format("--child_run={}:{}", run.walker, run.threads),
+       "--child_root=" + run.root},
+      folly::Subprocess::Options().pipeStdout().usePath(),
+      nullptr,
+      &env};
+  auto out = proc.communicate().first;
+  auto status = proc.wait();
+  if (!status.exited() || status.exitStatus() != 0) {
+    std::cerr << run.walker << " walk failed: " << status.str() << std::endl;
+    return std::nullopt;
+  }
+  return folly::parseJson(out);
 }
 
+void report(const Run& run, const folly::dynamic& result) {
+  auto seconds = result["seconds"].asDouble();
+  auto dirs = result["dirs"].asInt();
+  auto entries = result["entries"].asInt();
+  double perEntry = entries ? 1.0 / entries : 0;
+  auto opendirsPerEntry = result["opendirs"].asInt() * perEntry;
+  auto statsPerEntry = result["stats"].asInt() * perEntry;
+  auto dirsPerS = seconds > 0 ? dirs / seconds : 0;
+  auto entriesPerS = seconds > 0 ? entries / seconds : 0;
+
+  if (FLAGS_json) {
+    auto line = result;
+    line["root"] = run.root;
+    line["walker"] = run.walker;
+    line["threads"] = run.threads;
+    line["backend"] = run.backend;
+    line["cache"] = run.cache;
+    line["dirs_per_s"] = dirsPerS;
+    line["entries_per_s"] = entriesPerS;
+    line["opendirs_per_entry"] = opendirsPerEntry;
+    line["stats_per_entry"] = statsPerEntry;
+    std::cout << folly::toJson(line) << std::endl;
+    return;
+  }
+  fmt::print(
+      "{:<8} {:>7} {:<9} {:<5} {:>8} {:>10} {:>8.3f} {:>10.0f} {:>11.0f} "
+      "{:>6.3f} {:>6.3f} {:>7}\n",
+      run.walker,
+      run.walker == "serial" ? "-" : fmt::format("{}", run.threads),
+      run.backend,
+      run.cache,
+      dirs,
+      entries,
+      seconds,
+      dirsPerS,
+      entriesPerS,
+      opendirsPerEntry,
+      statsPerEntry,
+      result["peak_rss_bytes"].asInt() >> 20);
+}
+
+} // namespace
+
 int main(int argc, char* argv[]) {
   folly::init(&argc, &argv);
 
+  if (!FLAGS_child_run.empty()) {
+    return childMain();
+  }
   if (argc == 1) {
     std::cerr << "Provide at least a root path to walk" << std::endl;
-  } else {
-    size_t thread_count_hint = 0;
-    const char* env = std::getenv("PWALK_THREAD");
-    if (env) {
-      thread_count_hint = atoi(env);
-      if (thread_count_hint) {
-        std::cerr << "Using min(" << thread_count_hint << ", nproc) threads"
-                  << std::endl;
+    return 1;
+  }
+
+  std::vector<std::pair<std::string, size_t>> walkers;
+  if (FLAGS_serial) {
+    walkers.emplace_back("serial", 1);
+  }
+  for (auto& threads : splitList(FLAGS_threads)) {
+    walkers.emplace_back("parallel", folly::to<size_t>(threads));
+  }
+
+  char configTemplate[] = "/tmp/pwalk-config-XXXXXX";
+  int configFd = mkstemp(configTemplate);
+  if (configFd == -1) {
+    std::cerr << "unable to create a config file" << std::endl;
+    return 1;
+  }
+  close(configFd);
+  std::string configPath{configTemplate};
+  SCOPE_EXIT {
+    unlink(configPath.c_str());
+  };
+
+  if (!FLAGS_json) {
+    fmt::print(
+        "{:<8} {:>7} {:<9} {:<5} {:>8} {:>10} {:>8} {:>10} {:>11} "
+        "{:>6} {:>6} {:>7}\n",
+        "walker",
+        "threads",
+        "backend",
+        "cache",
+        "dirs",
+        "entries",
+        "seconds",
+        "dirs/s",
+        "entries/s",
+        "odir/e",
+        "stat/e",
+        "peak MB");
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    for (auto& backend : splitList(FLAGS_backends)) {
+      folly::writeFile(backendConfig(backend), configPath.c_str());
+      for (auto& cache : splitList(FLAGS_cache)) {
+        for (auto& [walker, threads] : walkers) {
+          Run run{argv[i], walker, threads, backend, cache};
+          if (cache == "warm") {
+            // Fill the caches first.
+            measure(argv[0], run, configPath);
+          }
+          for (int r = 0; r < FLAGS_repeat; ++r) {
+            if (cache == "cold" && !dropCaches()) {
+              std::cerr << "unable to drop the caches, skipping cold runs"
+                        << std::endl;
+              break;
+            }
+            if (auto result = measure(argv[0], run, configPath)) {
+              report(run, *result);
+            }
+          }
+        }
       }
     }
-    for (int i = 1; i < argc; ++i) {
-      walk(watchman::AbsolutePath(argv[i]), thread_count_hint);
-    }
   }
   return 0;
 }
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/StatxRing.h"
+
+#ifdef HAVE_IO_URING_STATX
+#include <folly/String.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+StatxRing* StatxRing::get() {
+  static std::atomic<bool> unsupported{false};
+  if (unsupported.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  thread_local std::unique_ptr<StatxRing> ring = create();
+  if (!ring || ring->broken_) {
+    unsupported.store(true, std::memory_order_relaxed);
+    return nullptr;
+  }
+  return ring.get();
+}
+
+StatxRing::StatxRing(int fd)
+    : fd_(fd),
+      enter_([](int fd,
+                unsigned toSubmit,
+                unsigned minComplete,
+                unsigned flags) {
+        return syscall(
+            __NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+      }) {}
+
+StatxRing::~StatxRing() {
+  if (sqes_) {
+    munmap(sqes_, sqesSize_);
+  }
+  if (cqRing_ && cqRing_ != sqRing_) {
+    munmap(cqRing_, cqRingSize_);
+  }
+  if (sqRing_) {
+    munmap(sqRing_, sqRingSize_);
+  }
+  close(fd_);
+}
+
+void StatxRing::statBatch(int dirFd, StatxEntry* entries, size_t count) {
+  const unsigned start = *sqTail_;
+  unsigned tail = start;
+  for (size_t i = 0; i < count; ++i) {
+    unsigned index = tail & *sqMask_;
+    auto& sqe = sqes_[index];
+    sqe = io_uring_sqe{};
+    sqe.opcode = IORING_OP_STATX;
+    sqe.fd = dirFd;
+    sqe.addr = reinterpret_cast<uintptr_t>(entries[i].name);
+    sqe.len = STATX_BASIC_STATS;
+    sqe.off = reinterpret_cast<uintptr_t>(&entries[i].stx);
+    sqe.statx_flags = kStatxFlags;
+    sqe.user_data = i;
+    sqArray_[index] = index;
+    entries[i].err = EIO;
+    ++tail;
+  }
+  __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+
+  size_t unsubmitted = count;
+  size_t outstanding = count;
+  bool failed = false;
+  while (outstanding > 0) {
+    auto res = enter_(fd_, unsubmitted, 1, IORING_ENTER_GETEVENTS);
+    if (res < 0) {
+      int err = errno;
+      if (err == EINTR || err == EAGAIN || err == EBUSY) {
+        continue;
+      }
+      log(ERR,
+          "io_uring_enter failed: ",
+          folly::errnoStr(err),
+          "; falling back to lstat\n");
+      failed = true;
+      // The requests that were never submitted will never complete, so
+      // withdraw them, lest the next batch submit them with indices into
+      // entries, and let the caller stat them the slow way. Those that are
+      // in flight refer to entries, so we must still wait for them.
+      size_t submitted = count - unsubmitted;
+      __atomic_store_n(
+          sqTail_, start + unsigned(submitted), __ATOMIC_RELEASE);
+      for (size_t i = submitted; i < count; ++i) {
+        entries[i].err = EIO;
+      }
+      outstanding -= unsubmitted;
+      unsubmitted = 0;
+      continue;
+    }
+    unsubmitted -= std::min<size_t>(unsubmitted, res);
+
+    unsigned head = *cqHead_;
+    unsigned cqTail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != cqTail; ++head) {
+      const auto& cqe = cqes_[head & *cqMask_];
+      entries[cqe.user_data].err = cqe.res < 0 ? -cqe.res : 0;
+      --outstanding;
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+  }
+
+  // Only now that nothing is in flight is it safe to give up on the ring
+  if (failed) {
+    broken_ = true;
+  }
+}
+
+std::unique_ptr<StatxRing> StatxRing::create() {
+  io_uring_params params{};
+  int fd = static_cast<int>(syscall(__NR_io_uring_setup, kEntries, &params));
+  if (fd < 0) {
+    logf(DBG, "io_uring_setup failed: {}\n", folly::errnoStr(errno));
+    return nullptr;
+  }
+  std::unique_ptr<StatxRing> ring{new StatxRing(fd)};
+  if (!ring->supportsStatx() || !ring->map(params)) {
+    return nullptr;
+  }
+  return ring;
+}
+
+bool StatxRing::supportsStatx() const {
+  constexpr unsigned kProbeOps = 256;
+  std::vector<uint64_t> buf(
+      (sizeof(io_uring_probe) + kProbeOps * sizeof(io_uring_probe_op)) /
+          sizeof(uint64_t) +
+      1);
+  auto* probe = reinterpret_cast<io_uring_probe*>(buf.data());
+  if (syscall(
+          __NR_io_uring_register,
+          fd_,
+          IORING_REGISTER_PROBE,
+          probe,
+          kProbeOps) < 0) {
+    logf(DBG, "io_uring probe failed: {}\n", folly::errnoStr(errno));
+    return false;
+  }
+  return probe->ops_len > IORING_OP_STATX &&
+      (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+}
+
+bool StatxRing::map(const io_uring_params& params) {
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMmap) {
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+  }
+
+  auto mapRing = [this](size_t size, off_t offset) -> char* {
+    void* ptr = mmap(
+        nullptr,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        fd_,
+        offset);
+    if (ptr == MAP_FAILED) {
+      logf(DBG, "io_uring mmap failed: {}\n", folly::errnoStr(errno));
+      return nullptr;
+    }
+    return static_cast<char*>(ptr);
+  };
+
+  sqRing_ = mapRing(sqRingSize_, IORING_OFF_SQ_RING);
+  if (!sqRing_) {
+    return false;
+  }
+  cqRing_ = singleMmap ? sqRing_ : mapRing(cqRingSize_, IORING_OFF_CQ_RING);
+  if (!cqRing_) {
+    return false;
+  }
+  sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ =
+      reinterpret_cast<io_uring_sqe*>(mapRing(sqesSize_, IORING_OFF_SQES));
+  if (!sqes_) {
+    return false;
+  }
+
+  sqHead_ = reinterpret_cast<unsigned*>(sqRing_ + params.sq_off.head);
+  sqTail_ = reinterpret_cast<unsigned*>(sqRing_ + params.sq_off.tail);
+  sqMask_ = reinterpret_cast<unsigned*>(sqRing_ + params.sq_off.ring_mask);
+  sqArray_ = reinterpret_cast<unsigned*>(sqRing_ + params.sq_off.array);
+  cqHead_ = reinterpret_cast<unsigned*>(cqRing_ + params.cq_off.head);
+  cqTail_ = reinterpret_cast<unsigned*>(cqRing_ + params.cq_off.tail);
+  cqMask_ = reinterpret_cast<unsigned*>(cqRing_ + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cqRing_ + params.cq_off.cqes);
+  return true;
+}
+
+} // namespace watchman
+#endif
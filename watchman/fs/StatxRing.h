@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "watchman/watchman_system.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#if defined(STATX_BASIC_STATS) && defined(SYS_getdents64)
+#define HAVE_LINUX_BULKSTAT 1
+#endif
+#endif
+
+#if defined(HAVE_LINUX_BULKSTAT) && defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+// IORING_OP_STATX is an enum value; IORING_FEAT_RW_CUR_POS was introduced in
+// the same kernel release, so we use it to detect headers that know about it.
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING_STATX 1
+#endif
+#endif
+
+#ifdef HAVE_LINUX_BULKSTAT
+#include <functional>
+#include <memory>
+#include "watchman/fs/DirHandle.h"
+
+namespace watchman {
+
+// Equivalent to lstat(), except that on network filesystems, attributes that
+// the kernel has cached are used without revalidating them with the server.
+// Our own changes to the filesystem are always reflected in that cache.
+constexpr int kStatxFlags = AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC;
+
+struct StatxEntry {
+  // Points into the getdents64 buffer.
+  const char* name;
+  DType dtype;
+  struct statx stx;
+  // 0, or the errno value; the caller lstats the entry itself if it is set.
+  int err;
+};
+
+#ifdef HAVE_IO_URING_STATX
+/**
+ * A minimal io_uring, driven directly through the syscalls, that is used to
+ * lstat all of the entries of a directory with one submission rather than
+ * one syscall per entry.  On network filesystems the kernel can have many of
+ * those requests outstanding at once, which hides most of the round trip
+ * latency of a cold cache.
+ *
+ * Each thread that reads directories has its own ring, so there is no
+ * locking; only one batch is ever in flight on a ring.
+ */
+class StatxRing {
+ public:
+  // The size of the ring, and thus of the batches passed to statBatch().
+  static constexpr unsigned kEntries = 256;
+
+  // Calls io_uring_enter; returns its result, with errno set on failure.
+  using Enter = std::function<
+      long(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)>;
+
+  /**
+   * Returns the ring for the calling thread, or nullptr if the kernel does
+   * not support io_uring or IORING_OP_STATX, if we are not permitted to use
+   * it, or if a ring has failed.
+   */
+  static StatxRing* get();
+
+  /**
+   * Makes a new ring, or returns nullptr for the reasons that get() does.
+   */
+  static std::unique_ptr<StatxRing> create();
+
+  ~StatxRing();
+
+  StatxRing(const StatxRing&) = delete;
+  StatxRing& operator=(const StatxRing&) = delete;
+
+  /**
+   * Stats each of the count entries relative to dirFd, with kStatxFlags,
+   * filling in stx or setting err to the errno value.  count must not exceed
+   * kEntries.  If the ring fails, the entries that it didn't stat are left
+   * with err set to EIO, and the ring is broken.
+   */
+  void statBatch(int dirFd, StatxEntry* entries, size_t count);
+
+  /** Set once io_uring_enter has failed; the ring is no longer used. */
+  bool broken() const {
+    return broken_;
+  }
+
+  /** For tests, to make io_uring_enter fail. */
+  void setEnterForTesting(Enter enter) {
+    enter_ = std::move(enter);
+  }
+
+ private:
+  explicit StatxRing(int fd);
+
+  bool supportsStatx() const;
+  bool map(const io_uring_params& params);
+
+  int fd_;
+  bool broken_{false};
+  Enter enter_;
+  char* sqRing_{nullptr};
+  char* cqRing_{nullptr};
+  io_uring_sqe* sqes_{nullptr};
+  size_t sqRingSize_{0};
+  size_t cqRingSize_{0};
+  size_t sqesSize_{0};
+  unsigned* sqHead_{nullptr};
+  unsigned* sqTail_{nullptr};
+  unsigned* sqMask_{nullptr};
+  unsigned* sqArray_{nullptr};
+  unsigned* cqHead_{nullptr};
+  unsigned* cqTail_{nullptr};
+  unsigned* cqMask_{nullptr};
+  io_uring_cqe* cqes_{nullptr};
+};
+#endif
+
+} // namespace watchman
+#endif
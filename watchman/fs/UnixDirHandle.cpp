@@ -8,11 +8,15 @@
 #include "watchman/fs/DirHandle.h"
 
 #include <folly/String.h>
+#include <algorithm>
+#include <memory>
 #include <system_error>
+#include <vector>
 #include "watchman/Logging.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/fs/StatxRing.h"
 
 #ifndef _WIN32
 #include <dirent.h>
@@ -24,6 +28,10 @@
 #include <sys/vnode.h> // @manual
 #endif
 
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
 namespace watchman {
 
 #ifdef HAVE_GETATTRLISTBULK
@@ -59,6 +67,33 @@ typedef struct {
 } __attribute__((packed)) bulk_attr_item;
 #endif
 
+#ifdef HAVE_LINUX_BULKSTAT
+namespace {
+
+// Large enough for several hundred entries per getdents64 call.
+constexpr size_t kDentBufSize = 64 * 1024;
+
+FileInformation statxToFileInformation(const struct statx& stx) {
+  FileInformation info;
+  info.mode = stx.stx_mode;
+  info.size = off_t(stx.stx_size);
+  info.uid = stx.stx_uid;
+  info.gid = stx.stx_gid;
+  info.ino = stx.stx_ino;
+  info.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+  info.nlink = stx.stx_nlink;
+  info.atime.tv_sec = stx.stx_atime.tv_sec;
+  info.atime.tv_nsec = stx.stx_atime.tv_nsec;
+  info.mtime.tv_sec = stx.stx_mtime.tv_sec;
+  info.mtime.tv_nsec = stx.stx_mtime.tv_nsec;
+  info.ctime.tv_sec = stx.stx_ctime.tv_sec;
+  info.ctime.tv_nsec = stx.stx_ctime.tv_nsec;
+  return info;
+}
+
+} // namespace
+#endif
+
 #ifndef _WIN32
 class UnixDirHandle : public DirHandle {
 #ifdef HAVE_GETATTRLISTBULK
@@ -68,6 +103,19 @@ class UnixDirHandle : public DirHandle {
   int retcount_{0};
   char buf_[64 * (sizeof(bulk_attr_item) + NAME_MAX * 3 + 1)];
   char* cursor_{nullptr};
+#endif
+#ifdef HAVE_LINUX_BULKSTAT
+  bool bulkStat_{false};
+  bool useRing_{false};
+  // Filled by getdents64 rather than readdir, so that the entries of a batch
+  // can refer to their names in place.
+  std::unique_ptr<char[]> dentBuf_;
+  // Entries read by one getdents64 call and stat'd together;
+  // batch_[batchPos_] is the next one to return.
+  std::vector<StatxEntry> batch_;
+  size_t batchPos_{0};
+
+  void readBatch();
 #endif
   DIR* d_{nullptr};
   struct DirEntry ent_;
@@ -179,7 +227,7 @@ UnixDirHandle::UnixDirHandle(const char* path, bool strict)
 {
 #ifdef HAVE_GETATTRLISTBULK
   dirName_ = path;
-  if (cfg_get_bool("_use_bulkstat", use_bulkstat_by_default())) {
+  if (cfg_get_snapshot()->useBulkStat.value_or(use_bulkstat_by_default())) {
     auto opts = strict ? OpenFileHandleOptions::strictOpenDir()
                        : OpenFileHandleOptions::openDir();
 
@@ -215,7 +263,55 @@ UnixDirHandle::UnixDirHandle(const char* path, bool strict)
         std::generic_category(),
         std::string(strict ? "opendir_nofollow: " : "opendir: ") + path);
   }
+#ifdef HAVE_LINUX_BULKSTAT
+  auto config = cfg_get_snapshot();
+  useRing_ = config->ioUringStatx;
+  bulkStat_ = useRing_ || config->useBulkStat.value_or(false);
+#endif
+}
+
+#ifdef HAVE_LINUX_BULKSTAT
+void UnixDirHandle::readBatch() {
+  batch_.clear();
+  batchPos_ = 0;
+  if (!dentBuf_) {
+    dentBuf_ = std::make_unique<char[]>(kDentBufSize);
+  }
+
+  int fd = dirfd(d_);
+  auto len = syscall(SYS_getdents64, fd, dentBuf_.get(), kDentBufSize);
+  if (len < 0) {
+    throw std::system_error(errno, std::generic_category(), "getdents64");
+  }
+  for (long pos = 0; pos < len;) {
+    // glibc's dirent64 has the same layout as the kernel's linux_dirent64.
+    auto* dent = reinterpret_cast<struct dirent64*>(dentBuf_.get() + pos);
+    pos += dent->d_reclen;
+    StatxEntry entry;
+    entry.name = dent->d_name;
+    entry.dtype = static_cast<DType>(dent->d_type);
+    batch_.push_back(entry);
+  }
+
+#ifdef HAVE_IO_URING_STATX
+  if (auto* ring = useRing_ ? StatxRing::get() : nullptr) {
+    for (size_t i = 0; i < batch_.size(); i += StatxRing::kEntries) {
+      ring->statBatch(
+          fd,
+          batch_.data() + i,
+          std::min<size_t>(StatxRing::kEntries, batch_.size() - i));
+    }
+    return;
+  }
+#endif
+  for (auto& entry : batch_) {
+    entry.err =
+        statx(fd, entry.name, kStatxFlags, STATX_BASIC_STATS, &entry.stx) == 0
+        ? 0
+        : errno;
+  }
 }
+#endif
 
 const DirEntry* UnixDirHandle::readDir() {
 #ifdef HAVE_GETATTRLISTBULK
@@ -269,6 +365,7 @@ const DirEntry* UnixDirHandle::readDir() {
     }
 
     w_string_piece name{};
+    ent_.dtype = DType::Unknown;
 
     if (item->returned.commonattr & ATTR_CMN_NAME) {
       ent_.d_name = ((char*)&item->name) + item->name.attr_dataoffset;
@@ -375,6 +472,7 @@ const DirEntry* UnixDirHandle::readDir() {
         ent_.stat.mode |= S_IFSOCK;
         break;
     }
+    ent_.dtype = ent_.stat.dtype();
     ent_.has_stat = true;
     return &ent_;
   }
@@ -383,6 +481,28 @@ const DirEntry* UnixDirHandle::readDir() {
   if (!d_) {
     return nullptr;
   }
+#ifdef HAVE_LINUX_BULKSTAT
+  if (bulkStat_) {
+    if (batchPos_ == batch_.size()) {
+      readBatch();
+      if (batch_.empty()) {
+        return nullptr;
+      }
+    }
+    const auto& entry = batch_[batchPos_++];
+    ent_.d_name = entry.name;
+    ent_.dtype = entry.dtype;
+    if (entry.err == 0) {
+      ent_.stat = statxToFileInformation(entry.stx);
+      ent_.has_stat = true;
+    } else {
+      // Leave it to the caller to stat the entry again and report the error
+      // with its full path.
+      ent_.has_stat = false;
+    }
+    return &ent_;
+  }
+#endif
   errno = 0;
   auto dent = readdir(d_);
   if (!dent) {
@@ -393,6 +513,9 @@ const DirEntry* UnixDirHandle::readDir() {
   }
 
   ent_.d_name = dent->d_name;
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(__APPLE__)
+  ent_.dtype = static_cast<DType>(dent->d_type);
+#endif
   ent_.has_stat = false;
   return &ent_;
 }
@@ -405,7 +528,7 @@ UnixDirHandle::~UnixDirHandle() {
 
 int UnixDirHandle::getFd() const {
 #ifdef HAVE_GETATTRLISTBULK
-  if (cfg_get_bool("_use_bulkstat", use_bulkstat_by_default())) {
+  if (cfg_get_snapshot()->useBulkStat.value_or(use_bulkstat_by_default())) {
     return fd_.fd();
   }
 #endif
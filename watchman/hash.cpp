@@ -10,6 +10,11 @@
 // Origin: http://www.burtleburtle.net/bob/c/lookup3.c
 
 #include "watchman/watchman_system.h"
+#include <cstring>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
 
 #if HAVE_SYS_PARAM_H
 #include <sys/param.h> /* attempt to define endianness */
@@ -346,5 +351,106 @@ uint32_t w_hash_bytes(const void* key, size_t length, uint32_t initval) {
   return c;
 }
 
+// wyhash (final version 4) by Wang Yi, released into the public domain.
+// Origin: https://github.com/wangyi-fudan/wyhash
+// It consumes 8 or 16 bytes per step with 64x64->128 bit multiplies, and
+// has no per-byte tail loop, so it is much faster than lookup3 for the
+// short, unaligned path components that we hash.
+
+namespace {
+
+const uint64_t kWyp[4] = {
+    0x2d358dccaa6c78a5ull,
+    0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull,
+    0x4d5a2da51de1aa47ull};
+
+inline void wymum(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = *a;
+  r *= *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  *a = _umul128(*a, *b, b);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), lo = t + (rm1 << 32);
+  uint64_t carry = (t < rl) + (lo < t);
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+  *a = lo;
+  *b = hi;
+#endif
+}
+
+inline uint64_t wymix(uint64_t a, uint64_t b) {
+  wymum(&a, &b);
+  return a ^ b;
+}
+
+// The byte order only affects which hash a string gets, which is never
+// compared across machines.
+inline uint64_t wyr8(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+inline uint64_t wyr4(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint64_t wyr3(const uint8_t* p, size_t k) {
+  return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+} // namespace
+
+uint64_t w_wyhash_bytes(const void* key, size_t len, uint64_t seed) {
+  const uint8_t* p = (const uint8_t*)key;
+  uint64_t a, b;
+  seed ^= wymix(seed ^ kWyp[0], kWyp[1]);
+
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+      b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = wyr3(p, len);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i >= 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = wymix(wyr8(p) ^ kWyp[1], wyr8(p + 8) ^ seed);
+        see1 = wymix(wyr8(p + 16) ^ kWyp[2], wyr8(p + 24) ^ see1);
+        see2 = wymix(wyr8(p + 32) ^ kWyp[3], wyr8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i >= 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = wymix(wyr8(p) ^ kWyp[1], wyr8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = wyr8(p + i - 16);
+    b = wyr8(p + i - 8);
+  }
+
+  a ^= kWyp[1];
+  b ^= seed;
+  wymum(&a, &b);
+  return wymix(a ^ kWyp[0] ^ len, b ^ kWyp[1]);
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -12,6 +12,7 @@
 #include <condition_variable>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include <folly/experimental/TestUtil.h>
 #include <folly/experimental/io/FsUtil.h>
@@ -140,6 +141,23 @@ int main(int argc, char** argv) {
     LOG(INFO) << "PASS: one-off query saw the touched hit file";
   }
 
+  LOG(INFO) << "Testing streaming query";
+  std::vector<std::string> streamed;
+  auto streamed_data =
+      c.query(
+           dynamic::object("expression", dynamic::array("name", "hit"))(
+               "fields", dynamic::array("name"))("since", clock_before_hit),
+           current_dir_ptr,
+           [&](dynamic&& row) { streamed.push_back(row.getString()); })
+          .get();
+  if (streamed_data.raw_.get_ptr("files") || streamed.size() != 1 ||
+      streamed[0].find("hit") == std::string::npos) {
+    LOG(ERROR) << "FAIL: streaming query got " << toJson(streamed_data.raw_)
+               << " and " << streamed.size() << " rows";
+    return 1;
+  }
+  LOG(INFO) << "PASS: streaming query passed the hit file to its callback";
+
   LOG(INFO) << "Flushing subscription";
   auto flush_res =
       c.flushSubscription(sub, std::chrono::milliseconds(1000)).wait().value();
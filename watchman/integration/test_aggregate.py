@@ -0,0 +1,73 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestAggregate(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "sub"))
+        for name, size in [
+            ("a.c", 1),
+            ("b.H", 2),
+            ("README", 4),
+            (os.path.join("sub", "c.c"), 8),
+        ]:
+            with open(os.path.join(root, name), "w") as f:
+                f.write("x" * size)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a.c", "b.H", "README", "sub", "sub/c.c"])
+        return root
+
+    def aggregate(self, root, aggregate):
+        res = self.watchmanCommand(
+            "query", root, {"expression": ["type", "f"], "aggregate": aggregate}
+        )
+        self.assertNotIn("files", res)
+        return res["aggregate"]
+
+    def test_count(self) -> None:
+        root = self.makeRoot()
+        self.assertEqual(self.aggregate(root, {}), {"count": 4})
+        self.assertEqual(self.aggregate(root, {"size": True}), {"count": 4, "size": 15})
+
+    def test_group_by_suffix(self) -> None:
+        root = self.makeRoot()
+        self.assertEqual(
+            self.aggregate(root, {"size": True, "group_by": "suffix"}),
+            {
+                "count": 4,
+                "size": 15,
+                "groups": {
+                    "c": {"count": 2, "size": 9},
+                    "h": {"count": 1, "size": 2},
+                    "": {"count": 1, "size": 4},
+                },
+            },
+        )
+
+    def test_group_by_dirname(self) -> None:
+        root = self.makeRoot()
+        self.assertEqual(
+            self.aggregate(root, {"group_by": "dirname"}),
+            {"count": 4, "groups": {"": {"count": 3}, "sub": {"count": 1}}},
+        )
+
+    def test_invalid_aggregate(self) -> None:
+        root = self.makeRoot()
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.aggregate(root, {"group_by": "size"})
+        self.assertIn("must be dirname or suffix", str(ctx.exception))
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("query", root, {"aggregate": {}, "order_by": "name"})
+        self.assertIn("cannot be combined", str(ctx.exception))
@@ -95,3 +95,41 @@ class TestDashJCliOption(unittest.TestCase):
             sockpath.unix_domain,
             binascii.hexlify(stdout).decode("ascii"),
         )
+
+
+@unittest.skipIf(os.name == "nt", "the fast CLI path is not used on Windows")
+class TestFastCli(unittest.TestCase):
+    def runFastCli(self, args, input=None):
+        sockpath = WatchmanInstance.getSharedInstance().getSockPath()
+        env = dict(os.environ)
+        env["WATCHMAN_FAST_CLI"] = "1"
+        env["WATCHMAN_SOCK"] = sockpath.unix_domain
+        proc = subprocess.Popen(
+            [os.environ.get("WATCHMAN_BINARY", "watchman")] + args,
+            env=env,
+            stdin=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+        )
+        stdout, stderr = proc.communicate(input=input)
+        self.assertEqual(proc.poll(), 0, stderr.decode(errors="replace"))
+        return sockpath, stdout
+
+    def test_args(self) -> None:
+        sockpath, stdout = self.runFastCli(["--no-pretty", "get-sockname"])
+        result = json.loads(stdout.decode("utf-8"))
+        self.assertEqual(result["unix_domain"], sockpath.unix_domain)
+
+    def test_jsonInput(self) -> None:
+        sockpath, stdout = self.runFastCli(["-j"], b'["get-sockname"]\n')
+        result = json.loads(stdout.decode("utf-8"))
+        self.assertEqual(result["unix_domain"], sockpath.unix_domain)
+
+    def test_bserInput(self) -> None:
+        # pyre-fixme[16]: Module `pywatchman` has no attribute `bser`.
+        sockpath, stdout = self.runFastCli(["-j"], bser.dumps(["get-sockname"]))
+        # pyre-fixme[16]: Module `pywatchman` has no attribute `bser`.
+        result = bser.loads(stdout)
+        self.assertEqual(
+            encoding.decode_local(result["unix_domain"]), sockpath.unix_domain
+        )
@@ -36,3 +36,20 @@ class TestBulkStat(WatchmanTestCase.WatchmanTestCase):
             self.touchRelative(root, "foo")
             self.touchRelative(root, "bar")
             self.assertFileList(root, ["foo", "bar"])
+
+    def test_io_uring_statx_on(self) -> None:
+        # Falls back to lstat where io_uring is unavailable, so this passes
+        # regardless of platform.
+        config = {"io_uring_statx": True}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            self.getClient(inst, replace_cached=True)
+
+            root = self.mkdtemp()
+            self.touchRelative(root, "existing")
+            # pyre-fixme[16]: `TestBulkStat` has no attribute `client`.
+            self.client.query("watch", root)
+
+            self.touchRelative(root, "foo")
+            self.touchRelative(root, "bar")
+            self.assertFileList(root, ["existing", "foo", "bar"])
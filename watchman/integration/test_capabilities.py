@@ -100,14 +100,20 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
         res = client.listCapabilities()
 
         expected = {
+            "aggregate",
             "bser-v2",
+            "bser-v2-zstd",
             "clock-sync-timeout",
             "cmd-clock",
+            "cmd-crawl-progress",
             "cmd-debug-ageout",
             "cmd-debug-contenthash",
             "cmd-debug-drop-privs",
             "cmd-debug-get-asserted-states",
             "cmd-debug-get-subscriptions",
+            "cmd-debug-heap-summary",
+            "cmd-debug-memory",
+            "cmd-debug-metrics",
             "cmd-debug-poison",
             "cmd-debug-recrawl",
             "cmd-debug-root-status",
@@ -116,6 +122,7 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "cmd-debug-show-cursors",
             "cmd-debug-status",
             "cmd-debug-symlink-target-cache",
+            "cmd-debug-trace",
             "cmd-debug-watcher-info",
             "cmd-debug-watcher-info-clear",
             "cmd-find",
@@ -151,6 +158,7 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "field-atime_us",
             "field-cclock",
             "field-content.sha1hex",
+            "field-content.spooky128hex",
             "field-ctime",
             "field-ctime_f",
             "field-ctime_ms",
@@ -175,7 +183,13 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "field-type",
             "field-uid",
             "glob_generator",
+            "limit-order-by",
+            "name-encoding",
+            "parallel-generators",
+            "query-lag",
+            "query-timeout",
             "relative_root",
+            "results-chunking",
             "saved-state-local",
             "scm-git",
             "scm-hg",
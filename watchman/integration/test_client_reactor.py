@@ -0,0 +1,61 @@
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+import unittest
+
+import pywatchman
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+
+
+@unittest.skipIf(os.name == "nt", "the client reactor is not used on Windows")
+@WatchmanTestCase.expand_matrix
+class TestClientReactor(WatchmanTestCase.WatchmanTestCase):
+    def test_commands_and_subscriptions(self) -> None:
+        config = {"client_reactor": True, "client_reactor_workers": 2}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            self.getClient(inst, replace_cached=True)
+
+            root = self.mkdtemp()
+            self.touchRelative(root, "a")
+            self.watchmanCommand("watch", root)
+            self.assertFileList(root, ["a"])
+
+            self.watchmanCommand("subscribe", root, "sub", {"fields": ["name"]})
+            dat = self.waitForSub("sub", root=root)[0]
+            self.assertTrue(dat["is_fresh_instance"])
+
+            # More clients than workers, all of them connected at once
+            clients = []
+            for _ in range(8):
+                client = pywatchman.client(
+                    timeout=self.socketTimeout,
+                    transport=self.transport,
+                    sendEncoding=self.encoding,
+                    recvEncoding=self.encoding,
+                    sockpath=inst.getSockPath(),
+                )
+                self.addCleanup(client.close)
+                clients.append(client)
+            for client in clients:
+                res = client.query("query", root, {"fields": ["name"]})
+                self.assertFileListsEqual(res["files"], ["a"])
+
+            # Unilateral responses are still delivered
+            self.touchRelative(root, "b")
+            dat = self.waitForSub(
+                "sub",
+                root=root,
+                accept=lambda x: self.findSubscriptionContainingFile(x, "b"),
+            )
+            self.assertNotEqual(None, dat)
+
+            # Closing clients doesn't disturb the others
+            for client in clients[:4]:
+                client.close()
+            for client in clients[4:]:
+                self.assertEqual(inst.pid, client.query("get-pid")["pid"])
@@ -0,0 +1,38 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestClientUsage(WatchmanTestCase.WatchmanTestCase):
+    def test_debugStatusReportsUsage(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a"])
+        self.watchmanCommand("query", root, {"fields": ["name"]})
+
+        status = self.watchmanCommand("debug-status")
+        mine = [
+            client
+            for client in status["clients"]
+            if client.get("peer", {}).get("pid") == os.getpid()
+            and client["usage"]["queries"] > 0
+        ]
+        self.assertEqual(1, len(mine))
+        usage = mine[0]["usage"]
+        self.assertGreater(usage["bytes_received"], 0)
+        self.assertGreater(usage["bytes_sent"], 0)
+
+        peers = [
+            peer for peer in status["peers"] if peer["peer"]["pid"] == os.getpid()
+        ]
+        self.assertEqual(1, len(peers))
+        self.assertGreaterEqual(peers[0]["usage"]["queries"], usage["queries"])
@@ -142,6 +142,44 @@ class TestContentHash(WatchmanTestCase.WatchmanTestCase):
         )
         self.assertEqual(expect_hex, res["files"][0]["content.sha1hex"])
 
+    def test_contentHashWarmingOnlyRequested(self) -> None:
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "src"))
+        os.mkdir(os.path.join(root, "docs"))
+        self.write_file_and_hash(os.path.join(root, "src", "a.c"), "a\n")
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(
+                json.dumps(
+                    {
+                        "content_hash_warming": True,
+                        "content_hash_warm_only_requested": True,
+                        "content_hash_warm_wait_before_settle": True,
+                    }
+                )
+            )
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, [".watchmanconfig", "docs", "src", "src/a.c"])
+        self.watchmanCommand(
+            "query",
+            root,
+            {"path": ["src/a.c"], "fields": ["name", "content.sha1hex"]},
+        )
+        stats = self.watchmanCommand("debug-contenthash", root)
+        self.assertEqual(stats["warmDirs"], 1)
+        self.assertEqual(stats["warmSuffixes"], 1)
+
+        self.write_file_and_hash(os.path.join(root, "src", "b.c"), "b\n")
+        self.write_file_and_hash(os.path.join(root, "docs", "c.c"), "c\n")
+        self.write_file_and_hash(os.path.join(root, "src", "d.txt"), "d\n")
+
+        def warmed():
+            return self.watchmanCommand("debug-contenthash", root)["size"] >= 2
+
+        self.waitFor(warmed)
+        # Only src/b.c is like what was asked about
+        self.assertEqual(self.watchmanCommand("debug-contenthash", root)["size"], 2)
+
     def test_cacheLimit(self) -> None:
         root = self.mkdtemp()
 
@@ -176,3 +214,65 @@ class TestContentHash(WatchmanTestCase.WatchmanTestCase):
         self.assertEqual(stats["cacheMiss"], 2)
         self.assertEqual(stats["cacheStore"], 2)
         self.assertEqual(stats["cacheLoad"], 2)
+
+    def test_limitedConcurrency(self) -> None:
+        root = self.mkdtemp()
+
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"content_hash_max_concurrency": 1}))
+
+        names = ["f%d" % i for i in range(20)]
+        expect = {
+            name: self.write_file_and_hash(os.path.join(root, name), name * 1000)
+            for name in names
+        }
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, [".watchmanconfig"] + names)
+
+        # The hashes wait in line for the one worker, and all arrive
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"path": names, "fields": ["name", "content.sha1hex"]},
+        )
+        self.assertEqual(
+            expect, {f["name"]: f["content.sha1hex"] for f in res["files"]}
+        )
+
+        stats = self.watchmanCommand("debug-contenthash", root)
+        self.assertEqual(stats["cacheMiss"], len(names))
+        self.assertEqual(stats["cacheStore"], len(names))
+
+    def test_spookyHash(self) -> None:
+        root = self.mkdtemp()
+
+        self.write_file_and_hash(os.path.join(root, "foo"), "hello\n")
+        self.write_file_and_hash(os.path.join(root, "bar"), "hello\n")
+        self.write_file_and_hash(os.path.join(root, "baz"), "goodbye\n")
+        os.mkdir(os.path.join(root, "dir"))
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["foo", "bar", "baz", "dir"])
+
+        def query():
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "path": ["foo", "bar", "baz", "dir"],
+                    "fields": ["name", "content.spooky128hex"],
+                },
+            )
+            return {f["name"]: f["content.spooky128hex"] for f in res["files"]}
+
+        hashes = query()
+        self.assertEqual(len(hashes["foo"]), 32)
+        self.assertEqual(hashes["foo"], hashes["bar"])
+        self.assertNotEqual(hashes["foo"], hashes["baz"])
+        self.assertIsNone(hashes["dir"])
+
+        # It has its own cache entries
+        stats = self.watchmanCommand("debug-contenthash", root)
+        self.assertEqual(stats["size"], 0)
+
+        self.write_file_and_hash(os.path.join(root, "bar"), "changed\n")
+        self.assertWaitFor(lambda: query()["bar"] != hashes["bar"])
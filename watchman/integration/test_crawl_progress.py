@@ -0,0 +1,60 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+import time
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestCrawlProgress(WatchmanTestCase.WatchmanTestCase):
+    def requiresPersistentSession(self) -> bool:
+        return True
+
+    def test_invalidArgs(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("crawl-progress", root, True, "extra")
+        self.assertIn("wrong number of arguments", str(ctx.exception))
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("crawl-progress", root, "yes")
+        self.assertIn("must be a boolean", str(ctx.exception))
+
+    def test_recrawlReportsProgress(self) -> None:
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "dir"))
+        self.touchRelative(root, "a")
+        self.touchRelative(root, "dir", "b")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a", "dir", "dir/b"])
+
+        client = self.getClient(no_cache=True)
+        res = client.query("crawl-progress", root)
+        self.assertTrue(res["crawl-progress"])
+        self.assertFalse(res["crawling"])
+
+        self.watchmanCommand("debug-recrawl", root)
+
+        deadline = time.time() + self.getTimeout(None)
+        progress = None
+        while time.time() < deadline:
+            client.setTimeout(deadline - time.time())
+            pdu = client.receive()
+            if "crawl-progress" in pdu and pdu["crawl-progress"]["done"]:
+                progress = pdu["crawl-progress"]
+                break
+
+        self.assertIsNotNone(progress)
+        self.assertGreaterEqual(progress["dirs"], 2)
+        self.assertGreaterEqual(progress["stats"], 3)
+        # The initial crawl is the previous one.
+        self.assertGreaterEqual(progress["previous_stats"], 3)
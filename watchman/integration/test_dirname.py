@@ -112,3 +112,59 @@ class TestDirName(WatchmanTestCase.WatchmanTestCase):
             )
 
             self.assertFileListsEqual(results["files"], expect, label)
+
+    def test_dirname_scopes_the_walk(self) -> None:
+        root = self.mkdtemp()
+        os.makedirs(os.path.join(root, "src", "foo", "sub"))
+        os.makedirs(os.path.join(root, "src", "foobar"))
+        self.touchRelative(root, "top")
+        self.touchRelative(root, "src", "foo", "a")
+        self.touchRelative(root, "src", "foo", "sub", "b")
+        self.touchRelative(root, "src", "foobar", "c")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root,
+            [
+                "top",
+                "src",
+                "src/foo",
+                "src/foo/a",
+                "src/foo/sub",
+                "src/foo/sub/b",
+                "src/foobar",
+                "src/foobar/c",
+            ],
+        )
+
+        # These expressions confine the walk to a few subtrees, which must
+        # not change what they match.
+        tests = [
+            [["dirname", "src/foo"], ["src/foo/a", "src/foo/sub", "src/foo/sub/b"]],
+            [["dirname", "src/foo", ["depth", "eq", 0]], ["src/foo/a", "src/foo/sub"]],
+            [
+                ["anyof", ["dirname", "src/foo/sub"], ["dirname", "src/foo"]],
+                ["src/foo/a", "src/foo/sub", "src/foo/sub/b"],
+            ],
+            [
+                ["anyof", ["name", "src/foobar/c", "wholename"], ["name", "top"]],
+                ["src/foobar/c", "top"],
+            ],
+            [["name", ["top", "src/foo"], "wholename"], ["top", "src/foo"]],
+            [
+                ["match", "src/foo*/*", "wholename"],
+                ["src/foo/a", "src/foo/sub", "src/foobar/c"],
+            ],
+            [
+                ["allof", ["dirname", "src"], ["match", "*/foo/**", "wholename"]],
+                ["src/foo/a", "src/foo/sub", "src/foo/sub/b"],
+            ],
+        ]
+
+        for expr, expect in tests:
+            results = self.watchmanCommand(
+                "query",
+                root,
+                {"expression": expr, "fields": ["name"], "case_sensitive": True},
+            )
+            self.assertFileListsEqual(results["files"], expect, repr(expr))
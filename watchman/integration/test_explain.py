@@ -0,0 +1,90 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestExplain(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "sub"))
+        self.touchRelative(root, "a.c")
+        self.touchRelative(root, "b.h")
+        self.touchRelative(root, "README")
+        self.touchRelative(root, "sub", "c.c")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a.c", "b.h", "README", "sub", "sub/c.c"])
+        return root
+
+    def test_explain_counts_each_term(self) -> None:
+        root = self.makeRoot()
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "expression": ["allof", ["type", "f"], ["match", "*.c"]],
+                "fields": ["name"],
+                "explain": True,
+            },
+        )
+        self.assertFileListsEqual(res["files"], ["a.c", "sub/c.c"])
+
+        explain = res["explain"]
+        self.assertEqual(explain["generators"], ["all"])
+        self.assertEqual(explain["files_matched"], 2)
+        self.assertGreaterEqual(explain["files_walked"], 5)
+
+        terms = explain["terms"]
+        self.assertEqual(
+            [term["term"] for term in terms],
+            [
+                ["allof", ["type", "f"], ["match", "*.c"]],
+                ["type", "f"],
+                ["match", "*.c"],
+            ],
+        )
+        self.assertGreaterEqual(terms[0]["evaluated"], 5)
+        self.assertLessEqual(terms[0]["evaluated"], explain["files_walked"])
+        self.assertEqual(terms[0]["matched"], 2)
+        self.assertGreaterEqual(terms[1]["matched"], 4)
+        self.assertEqual(terms[2]["matched"], 2)
+        for term in terms:
+            self.assertEqual(term["deferred"], 0)
+            self.assertLessEqual(term["selectivity"], 1.0)
+
+        for key in (
+            "cookie_sync_ms",
+            "view_lock_wait_ms",
+            "generation_ms",
+            "render_ms",
+            "encode_us",
+        ):
+            self.assertGreaterEqual(explain[key], 0)
+        self.assertGreater(explain["bytes"], 0)
+
+    def test_since_generator(self) -> None:
+        root = self.makeRoot()
+        clock = self.watchmanCommand("clock", root)["clock"]
+        self.touchRelative(root, "d.c")
+        self.assertFileList(root, ["a.c", "b.h", "README", "sub", "sub/c.c", "d.c"])
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"since": clock, "fields": ["name"], "explain": True},
+        )
+        self.assertFileListsEqual(res["files"], ["d.c"])
+        self.assertEqual(res["explain"]["generators"][0], "since")
+        self.assertEqual(res["explain"]["terms"], [])
+
+    def test_not_explained_by_default(self) -> None:
+        root = self.makeRoot()
+        res = self.watchmanCommand("query", root, {"fields": ["name"]})
+        self.assertNotIn("explain", res)
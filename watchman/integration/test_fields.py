@@ -80,3 +80,27 @@ class TestFields(WatchmanTestCase.WatchmanTestCase):
 
         for field in ["cclock", "oclock"]:
             self.assertRegex(file[field], "^c:\\d+:\\d+:\\d+:\\d+$")
+
+    def test_common_field_lists(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        os.mkdir(os.path.join(root, "b"))
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["a", "b"])
+
+        def query(fields):
+            res = self.watchmanCommand("query", root, {"fields": fields})
+            if fields == ["name"]:
+                return sorted(res["files"])
+            return sorted(res["files"], key=lambda f: f["name"])
+
+        # These lists are rendered by specialized code; they must agree with
+        # the same fields in an order that isn't.
+        default = ["name", "exists", "new", "size", "mode"]
+        reordered = list(reversed(default))
+        for fields in [["name", "exists"], default]:
+            self.assertEqual(
+                query(fields),
+                [{k: f[k] for k in fields} for f in query(reordered)],
+            )
+        self.assertEqual(query(["name"]), [f["name"] for f in query(reordered)])
@@ -0,0 +1,45 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+LAG_FIELDS = {
+    "pending_from_watcher",
+    "pending_in_io_thread",
+    "event_lag_ms",
+    "max_event_lag_ms",
+}
+
+
+@WatchmanTestCase.expand_matrix
+class TestLag(WatchmanTestCase.WatchmanTestCase):
+    def test_queryIncludesLag(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.touchRelative(root, "a")
+        self.assertFileList(root, ["a"])
+
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name"], "include_lag": True}
+        )
+        self.assertEqual(LAG_FIELDS, set(res["lag"].keys()))
+        self.assertGreaterEqual(res["lag"]["event_lag_ms"], 0)
+
+        res = self.watchmanCommand("query", root, {"fields": ["name"]})
+        self.assertNotIn("lag", res)
+
+    def test_debugStatusReportsLag(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.touchRelative(root, "a")
+        self.assertFileList(root, ["a"])
+
+        status = self.watchmanCommand("debug-status")
+        roots = [r for r in status["roots"] if r["path"] == root]
+        self.assertEqual(1, len(roots))
+        self.assertEqual(LAG_FIELDS, set(roots[0]["lag"].keys()))
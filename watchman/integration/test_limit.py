@@ -0,0 +1,70 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestLimit(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self, names):
+        root = self.mkdtemp()
+        for name in names:
+            self.touchRelative(root, name)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, names)
+        return root
+
+    def query(self, root, **kwargs):
+        query = {"expression": ["type", "f"], "fields": ["name"]}
+        query.update(kwargs)
+        return self.watchmanCommand("query", root, query)["files"]
+
+    def test_limit_by_name(self) -> None:
+        root = self.makeRoot(["e", "c", "a", "d", "b"])
+        self.assertEqual(self.query(root, order_by="name"), ["a", "b", "c", "d", "e"])
+        self.assertEqual(self.query(root, order_by="name", limit=3), ["a", "b", "c"])
+
+    def test_limit_without_order(self) -> None:
+        root = self.makeRoot(["a", "b", "c", "d", "e"])
+        files = self.query(root, limit=2)
+        self.assertEqual(len(files), 2)
+        self.assertFileListContains(["a", "b", "c", "d", "e"], files)
+
+    def test_limit_by_mtime(self) -> None:
+        root = self.makeRoot(["a", "b", "c"])
+        for i, name in enumerate(["b", "c", "a"]):
+            mtime = 1000000 + i * 100
+            os.utime(os.path.join(root, name), (mtime, mtime))
+        self.assertWaitForEqual(
+            ["a", "c"],
+            lambda: self.query(root, order_by="mtime", limit=2),
+        )
+
+    def test_limit_by_otime(self) -> None:
+        root = self.makeRoot([])
+        clock = self.watchmanCommand("clock", root)["clock"]
+        for name in ["a", "b", "c"]:
+            self.touchRelative(root, name)
+            self.waitForSync(root)
+
+        self.assertEqual(
+            self.query(root, since=clock, order_by="otime", limit=2), ["c", "b"]
+        )
+        self.assertEqual(self.query(root, since=clock, limit=1), ["c"])
+
+    def test_invalid_order_by(self) -> None:
+        root = self.makeRoot([])
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.query(root, order_by="size")
+        self.assertIn("order_by must be one of", str(ctx.exception))
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.query(root, limit=0)
+        self.assertIn("limit must be an integer value > 0", str(ctx.exception))
@@ -113,3 +113,63 @@ class TestMatch(WatchmanTestCase.WatchmanTestCase):
             },
         )
         self.assertFileListsEqual(res["files"], ["foo/baz.c"])
+
+    def test_anyof_match_sets(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "foo.c")
+        self.touchRelative(root, "bar.txt")
+        self.touchRelative(root, "Makefile")
+        os.mkdir(os.path.join(root, "foo"))
+        self.touchRelative(root, "foo", ".bar.c")
+        self.touchRelative(root, "foo", "baz.h")
+        self.touchRelative(root, "foo", "qux.C")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root,
+            [
+                "bar.txt",
+                "foo.c",
+                "Makefile",
+                "foo",
+                "foo/.bar.c",
+                "foo/baz.h",
+                "foo/qux.C",
+            ],
+        )
+
+        # Literals, `*suffix` patterns and general patterns, interleaved
+        # with other terms, evaluate as they would one at a time.
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "expression": [
+                    "anyof",
+                    ["match", "*.c"],
+                    ["type", "d"],
+                    ["match", "Makefile"],
+                    ["imatch", "*.c"],
+                    ["match", "ba?.h"],
+                    ["match", "*.c", "wholename"],
+                ],
+                "fields": ["name"],
+            },
+        )
+        self.assertFileListsEqual(
+            res["files"], ["foo.c", "Makefile", "foo", "foo/baz.h", "foo/qux.C"]
+        )
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "expression": [
+                    "anyof",
+                    ["match", "*.c", "basename", {"includedotfiles": True}],
+                    ["match", "*.txt", "basename", {"includedotfiles": True}],
+                ],
+                "fields": ["name"],
+            },
+        )
+        self.assertFileListsEqual(res["files"], ["bar.txt", "foo.c", "foo/.bar.c"])
@@ -0,0 +1,101 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+import threading
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestMultiQuery(WatchmanTestCase.WatchmanTestCase):
+    def requiresPersistentSession(self) -> bool:
+        return True
+
+    def makeRoot(self, name):
+        root = self.mkdtemp()
+        self.touchRelative(root, name)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, [name])
+        return root
+
+    def receiveResults(self, *args):
+        # pywatchman raises on the error of a root, which would leave the PDUs
+        # after it unread, so send the command and read them off the
+        # connection directly once it is up.
+        client = self.getClient()
+        client.query("version")
+        client.sendConn.send(["multi-query", *args])
+        pdus = [client.recvConn.receive()]
+        while pdus[-1].get("more_results"):
+            pdus.append(client.recvConn.receive())
+
+        # Every root's PDU comes before the response, which lists them in the
+        # order that they were sent.
+        self.assertNotIn("more_results", pdus[-1])
+        self.assertEqual(pdus[-1]["roots"], [pdu["root"] for pdu in pdus[:-1]])
+        return pdus
+
+    def test_listed_roots(self) -> None:
+        one = self.makeRoot("one")
+        two = self.makeRoot("two")
+
+        pdus = self.receiveResults([one, two], {"fields": ["name"]})
+        results = {pdu["root"]: pdu for pdu in pdus[:-1]}
+        self.assertEqual(set(results), {one, two})
+        self.assertFileListsEqual(results[one]["files"], ["one"])
+        self.assertFileListsEqual(results[two]["files"], ["two"])
+        for pdu in results.values():
+            self.assertIn("clock", pdu)
+
+    def test_all_roots(self) -> None:
+        one = self.makeRoot("one")
+        two = self.makeRoot("two")
+
+        pdus = self.receiveResults({"fields": ["name"]})
+        results = {pdu["root"]: pdu for pdu in pdus[:-1]}
+        self.assertFileListsEqual(results[one]["files"], ["one"])
+        self.assertFileListsEqual(results[two]["files"], ["two"])
+
+    def test_root_error(self) -> None:
+        quiet = self.makeRoot("quiet")
+        busy = self.makeRoot("busy")
+
+        # Changing a file more often than the settle period keeps the busy
+        # root from settling, so that its query times out.
+        stop = threading.Event()
+
+        def churn():
+            while not stop.wait(0.05):
+                with open(os.path.join(busy, "busy"), "a") as f:
+                    f.write("x")
+
+        thread = threading.Thread(target=churn)
+        thread.start()
+        try:
+            pdus = self.receiveResults(
+                [quiet, busy],
+                {"fields": ["name"], "settle_period": 2000, "settle_timeout": 4000},
+            )
+        finally:
+            stop.set()
+            thread.join()
+
+        # The quiet root's results don't wait for the busy root to fail.
+        self.assertEqual(pdus[-1]["roots"], [quiet, busy])
+        self.assertFileListsEqual(pdus[0]["files"], ["quiet"])
+        self.assertNotIn("files", pdus[1])
+        self.assertIn("timed out waiting for settle", pdus[1]["error"])
+
+    def test_unwatched_root(self) -> None:
+        one = self.makeRoot("one")
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand(
+                "multi-query", [one, self.mkdtemp()], {"fields": ["name"]}
+            )
+        self.assertIn("unable to resolve root", str(ctx.exception))
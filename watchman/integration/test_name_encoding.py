@@ -0,0 +1,63 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestNameEncoding(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        os.makedirs(os.path.join(root, "a", "b"))
+        os.mkdir(os.path.join(root, "ab"))
+        names = ["top", "a/one", "a/b/two", "a/b/three", "ab/four"]
+        for name in names:
+            self.touchRelative(root, name)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, names + ["a", "a/b", "ab"])
+        return root
+
+    def query(self, root, **kwargs):
+        query = {"expression": ["type", "f"], "fields": ["name"]}
+        query.update(kwargs)
+        return self.watchmanCommand("query", root, query)
+
+    @WatchmanTestCase.skip_for(codecs=["json"])
+    def test_front_coded_names(self) -> None:
+        root = self.makeRoot()
+        for kwargs in [{}, {"order_by": "name"}]:
+            expected = self.query(root, **kwargs)["files"]
+            res = self.query(root, name_encoding="front_coded", **kwargs)
+            self.assertEqual(
+                list(pywatchman.decode_front_coded_names(res["files"])), expected
+            )
+
+        res = self.query(root, name_encoding="front_coded", order_by="name")
+        self.assertEqual(
+            res["files"], "0:a/b/three\x002:two\x001:one\x000:ab/four\x000:top\x00"
+        )
+
+    # The CLI talks to the server in BSER whatever it is asked to print.
+    @WatchmanTestCase.skip_for(transports=["cli"], codecs=["bser"])
+    def test_requires_bser(self) -> None:
+        root = self.makeRoot()
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.query(root, name_encoding="front_coded")
+        self.assertIn("requires a BSER connection", str(ctx.exception))
+
+    def test_invalid_name_encoding(self) -> None:
+        root = self.makeRoot()
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.query(root, name_encoding="gzip")
+        self.assertIn('name_encoding must be "front_coded"', str(ctx.exception))
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.query(root, name_encoding="front_coded", fields=["name", "size"])
+        self.assertIn("requires fields to be", str(ctx.exception))
@@ -0,0 +1,49 @@
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+import threading
+import unittest
+
+import pywatchman
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+
+
+@unittest.skipIf(os.name != "nt", "named pipes are only used on Windows")
+@WatchmanTestCase.expand_matrix
+class TestNamedPipeAccept(WatchmanTestCase.WatchmanTestCase):
+    def test_more_clients_than_instances_connect_at_once(self) -> None:
+        config = {"win32_concurrent_accepts": 2}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+
+            pids = []
+            errors = []
+
+            def connect() -> None:
+                try:
+                    client = pywatchman.client(
+                        timeout=self.socketTimeout,
+                        transport=self.transport,
+                        sendEncoding=self.encoding,
+                        recvEncoding=self.encoding,
+                        sockpath=inst.getSockPath(),
+                    )
+                    try:
+                        pids.append(client.query("get-pid")["pid"])
+                    finally:
+                        client.close()
+                except Exception as e:
+                    errors.append(e)
+
+            threads = [threading.Thread(target=connect) for _ in range(16)]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+
+            self.assertEqual([], errors)
+            self.assertEqual([inst.pid] * 16, pids)
@@ -0,0 +1,103 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import os.path
+import sys
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestOptInWatchers(WatchmanTestCase.WatchmanTestCase):
+    """The watchers that are only used when a root's config asks for them.
+
+    Some of them need privileges that CI machines don't always grant, in
+    which case the root falls back to the default watcher and the test is
+    skipped."""
+
+    def watchWith(self, config, watcher):
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "dir"))
+        self.touchRelative(root, "dir", "existing")
+        self.touchRelative(root, "dir", "leaving")
+        self.touchRelative(root, "dir", "removed")
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps(config))
+
+        res = self.watchmanCommand("watch", root)
+        if res["watcher"] != watcher:
+            self.skipTest("the %s watcher is not available here" % watcher)
+        self.assertFileList(
+            root,
+            [".watchmanconfig", "dir", "dir/existing", "dir/leaving", "dir/removed"],
+        )
+        return root
+
+    def assertReportsChanges(self, root) -> None:
+        outside = self.mkdtemp()
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        self.touchRelative(root, "dir", "added")
+        with open(os.path.join(root, "dir", "existing"), "a") as f:
+            f.write("modified")
+        os.unlink(os.path.join(root, "dir", "removed"))
+        os.rename(
+            os.path.join(root, "dir", "leaving"), os.path.join(outside, "leaving")
+        )
+
+        self.assertFileList(
+            root, [".watchmanconfig", "dir", "dir/added", "dir/existing"]
+        )
+
+        def changedSince():
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "since": clock,
+                    "expression": ["type", "f"],
+                    "fields": ["name", "exists"],
+                },
+            )
+            return sorted((f["name"], f["exists"]) for f in res["files"])
+
+        # The modified file does not change its dir, so the poll watcher only
+        # finds it once its dir comes up in the sweep.
+        self.assertWaitForEqual(
+            [
+                ("dir/added", True),
+                ("dir/existing", True),
+                ("dir/leaving", False),
+                ("dir/removed", False),
+            ],
+            changedSince,
+        )
+
+    def test_poll(self) -> None:
+        root = self.watchWith(
+            {
+                "watcher": "poll",
+                "poll_interval_ms": 100,
+                "poll_full_scan_seconds": 1,
+            },
+            "poll",
+        )
+        self.assertReportsChanges(root)
+
+    def test_fanotify(self) -> None:
+        if not sys.platform.startswith("linux"):
+            self.skipTest("N/A unless Linux")
+        root = self.watchWith({"prefer_fanotify_watcher": True}, "fanotify")
+        self.assertReportsChanges(root)
+
+    def test_usn(self) -> None:
+        if sys.platform != "win32":
+            self.skipTest("N/A unless Windows")
+        root = self.watchWith({"prefer_usn_watcher": True}, "usn")
+        self.assertReportsChanges(root)
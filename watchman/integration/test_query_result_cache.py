@@ -0,0 +1,45 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryResultCache(WatchmanTestCase.WatchmanTestCase):
+    def test_repeated_since_query(self) -> None:
+        config = {"query_result_cache_size": 8}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            self.getClient(inst, replace_cached=True)
+
+            root = self.mkdtemp()
+            self.watchmanCommand("watch", root)
+            clock = self.watchmanCommand("clock", root)["clock"]
+
+            self.touchRelative(root, "a")
+            self.assertFileList(root, ["a"])
+
+            query = {"since": clock, "fields": ["name"]}
+            first = self.watchmanCommand("query", root, query)
+            second = self.watchmanCommand("query", root, query)
+            self.assertFalse(second["is_fresh_instance"])
+            self.assertFileListsEqual(first["files"], ["a"])
+            self.assertFileListsEqual(second["files"], ["a"])
+
+            # A change invalidates the cached result.
+            self.touchRelative(root, "b")
+            self.assertFileList(root, ["a", "b"])
+            third = self.watchmanCommand("query", root, query)
+            self.assertFileListsEqual(third["files"], ["a", "b"])
+
+            # The returned clock still reflects the time of the query.
+            res = self.watchmanCommand("query", root, query)
+            self.assertFileListsEqual(res["files"], ["a", "b"])
+            since = self.watchmanCommand(
+                "query", root, {"since": res["clock"], "fields": ["name"]}
+            )
+            self.assertFileListsEqual(since["files"], [])
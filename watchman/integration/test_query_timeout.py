@@ -0,0 +1,66 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryTimeout(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        for name in ["a", "b", "c"]:
+            self.touchRelative(root, name)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a", "b", "c"])
+        return root
+
+    def query(self, root, **kwargs):
+        query = {"expression": ["type", "f"], "fields": ["name"]}
+        query.update(kwargs)
+        return self.watchmanCommand("query", root, query)
+
+    def test_within_timeout(self) -> None:
+        root = self.makeRoot()
+        res = self.query(root, timeout_ms=60000, partial_results=True)
+        self.assertNotIn("timed_out", res)
+        self.assertFileListsEqual(res["files"], ["a", "b", "c"])
+
+    def test_timed_out(self) -> None:
+        root = self.makeRoot()
+        # Waiting for the root to settle uses up the whole timeout before the
+        # view is walked.
+        settle = {"settle_period": 500, "settle_timeout": 30000}
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.query(root, timeout_ms=1, **settle)
+        self.assertIn("timed out after 1ms", str(ctx.exception))
+
+        res = self.query(root, timeout_ms=1, partial_results=True, **settle)
+        self.assertTrue(res["timed_out"])
+        self.assertEqual(res["files"], [])
+
+    def test_invalid_timeout(self) -> None:
+        root = self.makeRoot()
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.query(root, timeout_ms=0)
+        self.assertIn("timeout_ms must be an integer value > 0", str(ctx.exception))
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.query(root, partial_results=True)
+        self.assertIn("partial_results requires timeout_ms", str(ctx.exception))
+
+    def test_subscription_rejects_partial_results(self) -> None:
+        root = self.makeRoot()
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand(
+                "subscribe",
+                root,
+                "partial",
+                {"fields": ["name"], "timeout_ms": 1000, "partial_results": True},
+            )
+        self.assertIn("not supported by subscriptions", str(ctx.exception))
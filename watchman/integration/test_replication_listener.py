@@ -0,0 +1,68 @@
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+import socket
+import unittest
+
+import pywatchman
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+
+
+def find_free_port() -> int:
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+@unittest.skipIf(os.name == "nt", "the replication listener is POSIX only")
+@WatchmanTestCase.expand_matrix
+class TestReplicationListener(WatchmanTestCase.WatchmanTestCase):
+    def test_remote_client_subscribes(self) -> None:
+        port = find_free_port()
+        config = {"replication_listen_address": str(port)}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            self.getClient(inst, replace_cached=True)
+
+            root = self.mkdtemp()
+            self.touchRelative(root, "a")
+            self.watchmanCommand("watch", root)
+            self.assertFileList(root, ["a"])
+
+            remote = pywatchman.client(
+                timeout=self.socketTimeout,
+                transport="tcp",
+                tcpAddress=("127.0.0.1", port),
+                sendEncoding=self.encoding,
+                recvEncoding=self.encoding,
+            )
+            self.addCleanup(remote.close)
+
+            remote.query("subscribe", root, "remote", {"fields": ["name"]})
+            dat = remote.getSubscription("remote", root=root)
+            while dat is None:
+                remote.receive()
+                dat = remote.getSubscription("remote", root=root)
+            self.assertTrue(dat[0]["is_fresh_instance"])
+
+            self.touchRelative(root, "b")
+            names = set()
+            while "b" not in names:
+                remote.receive()
+                for sub in remote.getSubscription("remote", root=root) or []:
+                    names.update(sub.get("files", []))
+
+            # Remote clients can only read from roots that are already watched
+            for cmd in [
+                ["trigger", root, "t", "*.c", "--", "true"],
+                ["watch-project", self.mkdtemp()],
+                ["log", "error", "hello"],
+                ["debug-status"],
+            ]:
+                with self.assertRaises(pywatchman.CommandError) as ctx:
+                    remote.query(*cmd)
+                self.assertIn("connected over TCP", str(ctx.exception))
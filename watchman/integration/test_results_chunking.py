@@ -0,0 +1,81 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestResultsChunking(WatchmanTestCase.WatchmanTestCase):
+    def requiresPersistentSession(self) -> bool:
+        return True
+
+    def makeRoot(self):
+        root = self.mkdtemp()
+        for i in range(5):
+            self.touchRelative(root, "file%d" % i)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["file%d" % i for i in range(5)])
+        return root
+
+    def test_query_chunks(self) -> None:
+        root = self.makeRoot()
+        client = self.getClient()
+
+        pdus = [
+            client.query(
+                "query",
+                root,
+                {
+                    "expression": ["type", "f"],
+                    "fields": ["name"],
+                    "results_chunk_size": 2,
+                },
+            )
+        ]
+        while pdus[-1].get("more_files"):
+            pdus.append(client.receive())
+
+        self.assertEqual([len(pdu["files"]) for pdu in pdus], [2, 2, 1])
+        self.assertNotIn("clock", pdus[0])
+        self.assertIn("clock", pdus[-1])
+        self.assertFileListsEqual(
+            [name for pdu in pdus for name in pdu["files"]],
+            ["file%d" % i for i in range(5)],
+        )
+
+    def test_query_chunk_size_validation(self) -> None:
+        root = self.makeRoot()
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("query", root, {"results_chunk_size": -1})
+        self.assertIn("results_chunk_size must be an integer", str(ctx.exception))
+
+    def test_subscription_chunks(self) -> None:
+        root = self.makeRoot()
+        self.watchmanCommand(
+            "subscribe",
+            root,
+            "chunked",
+            {
+                "expression": ["type", "f"],
+                "fields": ["name"],
+                "results_chunk_size": 2,
+            },
+        )
+
+        def complete(pdus):
+            return not pdus[-1].get("more_files")
+
+        pdus = self.waitForSub("chunked", root=root, accept=complete)
+        self.assertEqual([len(pdu["files"]) for pdu in pdus], [2, 2, 1])
+        self.assertTrue(all(pdu["more_files"] for pdu in pdus[:-1]))
+        self.assertTrue(all(pdu["is_fresh_instance"] for pdu in pdus))
+        self.assertIn("clock", pdus[-1])
+        self.assertFileListsEqual(
+            [name for pdu in pdus for name in pdu["files"]],
+            ["file%d" % i for i in range(5)],
+        )
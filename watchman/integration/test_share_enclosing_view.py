@@ -0,0 +1,59 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import os.path
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestShareEnclosingView(WatchmanTestCase.WatchmanTestCase):
+    def makeNestedRoots(self):
+        root = self.mkdtemp()
+        nested = os.path.join(root, "nested")
+        os.mkdir(nested)
+        with open(os.path.join(nested, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"share_enclosing_view": True}))
+        self.touchRelative(root, "outer")
+        self.touchRelative(nested, "inner")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root, ["outer", "nested", "nested/.watchmanconfig", "nested/inner"]
+        )
+        self.watchmanCommand("watch", nested)
+        return root, nested
+
+    def test_queries_see_only_the_subtree(self) -> None:
+        root, nested = self.makeNestedRoots()
+        self.assertFileList(nested, [".watchmanconfig", "inner"])
+
+        res = self.watchmanCommand(
+            "query", nested, {"relative_root": "", "fields": ["name"]}
+        )
+        self.assertFileListsEqual(res["files"], [".watchmanconfig", "inner"])
+
+    def test_since_query(self) -> None:
+        root, nested = self.makeNestedRoots()
+        clock = self.watchmanCommand("clock", nested)["clock"]
+
+        self.touchRelative(root, "outer2")
+        self.touchRelative(nested, "inner2")
+        self.assertFileList(nested, [".watchmanconfig", "inner", "inner2"])
+
+        res = self.watchmanCommand(
+            "query", nested, {"since": clock, "fields": ["name"]}
+        )
+        self.assertFalse(res["is_fresh_instance"])
+        self.assertFileListsEqual(res["files"], ["inner2"])
+
+    def test_removing_enclosing_watch_removes_nested(self) -> None:
+        root, nested = self.makeNestedRoots()
+        self.watchmanCommand("watch-del", root)
+        self.assertWaitFor(lambda: not self.rootIsWatched(nested))
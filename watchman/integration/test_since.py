@@ -262,3 +262,30 @@ class TestSince(WatchmanTestCase.WatchmanTestCase):
         self.assertFalse(res["is_fresh_instance"])
         self.assertFileListsEqual(res["files"], ["111", "222"])
         self.assertTrue("warning" not in res)
+
+    def test_repeatedSpecWithNewClock(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.touchRelative(root, "a.txt")
+        self.touchRelative(root, "b.txt")
+        self.assertFileList(root, ["a.txt", "b.txt"])
+
+        # The same spec with only its clock and request id changed must be
+        # evaluated against the clock that it carries each time.
+        spec = {"expression": ["suffix", "txt"], "fields": ["name"]}
+        clock = self.watchmanCommand("clock", root)["clock"]
+        self.touchRelative(root, "c.txt")
+        res = self.watchmanCommand(
+            "query", root, dict(spec, since=clock, request_id="first")
+        )
+        self.assertFileListsEqual(res["files"], ["c.txt"])
+
+        clock = res["clock"]
+        self.touchRelative(root, "d.txt")
+        res = self.watchmanCommand(
+            "query", root, dict(spec, since=clock, request_id="second")
+        )
+        self.assertFileListsEqual(res["files"], ["d.txt"])
+
+        res = self.watchmanCommand("query", root, spec)
+        self.assertFileListsEqual(res["files"], ["a.txt", "b.txt", "c.txt", "d.txt"])
@@ -614,6 +614,171 @@ class TestSubscribe(WatchmanTestCase.WatchmanTestCase):
             for client in clients:
                 client.close()
 
+    def test_identical_subscriptions(self) -> None:
+        """Clients with the same subscription query and clock share a single
+        evaluation of it; each must still see the results under its own name."""
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        clock = self.watchmanCommand("clock", root)["clock"]
+        query = {"fields": ["name"], "since": clock}
+
+        self.watchmanCommand("subscribe", root, "sub1", query)
+        other = self.getClient(no_cache=True)
+        self.addCleanup(other.close)
+        other.query("subscribe", root, "sub2", query)
+
+        self.touchRelative(root, "b")
+        dat = self.waitForSub(
+            "sub1",
+            root=root,
+            accept=lambda x: self.findSubscriptionContainingFile(x, "b"),
+        )
+        self.assertNotEqual(None, dat)
+
+        other.setTimeout(self.getTimeout(None))
+        while True:
+            dat = other.getSubscription("sub2", root=root)
+            if dat and self.findSubscriptionContainingFile(dat, "b"):
+                break
+            other.receive()
+        self.assertEqual("sub2", dat[-1]["subscription"])
+
+    def test_min_interval_batching(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        with self.assertRaises(pywatchman.CommandError) as ctx:
+            self.watchmanCommand(
+                "subscribe", root, "bad", {"fields": ["name"], "max_batch_files": 2}
+            )
+        self.assertIn("max_batch_files requires min_interval_ms", str(ctx.exception))
+
+        self.watchmanCommand(
+            "subscribe",
+            root,
+            "batched",
+            {
+                "fields": ["name"],
+                "since": clock,
+                "min_interval_ms": 3000,
+                "max_batch_files": 100,
+            },
+        )
+
+        # The first change is delivered straight away
+        self.touchRelative(root, "a")
+        dat = self.waitForSub(
+            "batched",
+            root=root,
+            accept=lambda x: self.findSubscriptionContainingFile(x, "a"),
+        )
+        self.assertNotEqual(None, dat)
+
+        # Those that settle within the interval arrive together
+        self.touchRelative(root, "b")
+        self.assertWaitFor(
+            lambda: "b" in self.watchmanCommand("query", root, {"fields": ["name"]})[
+                "files"
+            ]
+        )
+        self.touchRelative(root, "c")
+        dat = self.waitForSub(
+            "batched",
+            root=root,
+            accept=lambda x: self.findSubscriptionContainingFile(x, "c"),
+        )
+        batch = self.findSubscriptionContainingFile(dat, "c")
+        self.assertFileListsEqual(batch["files"], ["b", "c"])
+
+    def test_min_interval_batching_multiple_fields(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        self.watchmanCommand(
+            "subscribe",
+            root,
+            "batched",
+            {
+                "fields": ["name", "exists"],
+                "since": clock,
+                "min_interval_ms": 3000,
+                "max_batch_files": 100,
+            },
+        )
+
+        def names(dat):
+            return [norm_relative_path(f["name"]) for f in dat.get("files", [])]
+
+        self.touchRelative(root, "a")
+        dat = self.waitForSub(
+            "batched", root=root, accept=lambda x: self.anyNamed(x, "a")
+        )
+        self.assertNotEqual(None, dat)
+
+        # Each change to b lands in a separate result, which the batch
+        # merges by name, whatever the shape of the rows.
+        self.touchRelative(root, "b")
+        self.assertWaitFor(
+            lambda: "b" in self.watchmanCommand("query", root, {"fields": ["name"]})[
+                "files"
+            ]
+        )
+        self.touch(os.path.join(root, "b"), (1, 1))
+        self.assertWaitFor(
+            lambda: 1
+            in [
+                f["mtime"]
+                for f in self.watchmanCommand(
+                    "query", root, {"fields": ["name", "mtime"]}
+                )["files"]
+                if f["name"] == "b"
+            ]
+        )
+        self.touchRelative(root, "c")
+        dat = self.waitForSub(
+            "batched", root=root, accept=lambda x: self.anyNamed(x, "c")
+        )
+        batch = [d for d in dat if "c" in names(d)][0]
+        self.assertEqual(sorted(names(batch)), ["b", "c"])
+        self.assertTrue(all(f["exists"] for f in batch["files"]))
+
+    def test_notify_only(self) -> None:
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "dir"))
+        self.watchmanCommand("watch", root)
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        with self.assertRaises(pywatchman.CommandError) as ctx:
+            self.watchmanCommand(
+                "subscribe",
+                root,
+                "bad",
+                {"notify_only": True, "expression": ["type", "f"]},
+            )
+        self.assertIn("cannot take an expression", str(ctx.exception))
+
+        self.watchmanCommand(
+            "subscribe",
+            root,
+            "notify",
+            {"notify_only": True, "relative_root": "dir", "since": clock},
+        )
+
+        # Changes outside of relative_root are not counted
+        self.touchRelative(root, "outside")
+        self.touchRelative(root, "dir", "a")
+        self.touchRelative(root, "dir", "b")
+        changed = 0
+        while changed < 2:
+            for dat in self.waitForSub("notify", root=root, remove=True):
+                self.assertNotIn("files", dat)
+                self.assertFalse(dat["is_fresh_instance"])
+                changed += dat["changed_count"]
+        self.assertEqual(2, changed)
+
     def test_subscription_cleanup(self) -> None:
         """Verify that subscriptions get cleaned up from internal state on
         unsubscribes and socket disconnects. This test failing usually
@@ -718,6 +883,13 @@ class TestSubscribe(WatchmanTestCase.WatchmanTestCase):
                 break
         self.assertRegex(warn, r"Recrawled this watch")
 
+    def anyNamed(self, subdata, filename) -> bool:
+        filename = norm_relative_path(filename)
+        return any(
+            filename in [norm_relative_path(f["name"]) for f in dat.get("files", [])]
+            for dat in subdata
+        )
+
     def findSubscriptionContainingFile(self, subdata, filename):
         filename = norm_relative_path(filename)
         for dat in subdata:
@@ -5,6 +5,7 @@
 # LICENSE file in the root directory of this source tree.
 
 
+import json
 import os
 
 import pywatchman
@@ -155,3 +156,39 @@ class TestMatch(WatchmanTestCase.WatchmanTestCase):
             self.watchmanCommand("query", root, {"expression": "suffix"})
 
         self.assertRegex(str(ctx.exception), "Expected array for 'suffix' term")
+
+    def test_suffix_index(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"suffix_index": True}))
+        self.touchRelative(root, "foo.c")
+        self.touchRelative(root, "bar.H")
+        self.touchRelative(root, "baz.txt")
+        os.mkdir(os.path.join(root, "sub"))
+        self.touchRelative(root, "sub", "qux.c")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root, [".watchmanconfig", "foo.c", "bar.H", "baz.txt", "sub", "sub/qux.c"]
+        )
+
+        def query(expression, **kwargs):
+            query = {"expression": expression, "fields": ["name"]}
+            query.update(kwargs)
+            return self.watchmanCommand("query", root, query)["files"]
+
+        self.assertFileListsEqual(
+            query(["suffix", ["c", "h"]]), ["foo.c", "bar.H", "sub/qux.c"]
+        )
+        self.assertFileListsEqual(
+            query(["allof", ["suffix", "c"], ["type", "f"]], relative_root="sub"),
+            ["qux.c"],
+        )
+
+        os.unlink(os.path.join(root, "foo.c"))
+        self.assertFileList(
+            root, [".watchmanconfig", "bar.H", "baz.txt", "sub", "sub/qux.c"]
+        )
+        self.assertFileListsEqual(
+            query(["allof", ["suffix", "c"], ["exists"]]), ["sub/qux.c"]
+        )
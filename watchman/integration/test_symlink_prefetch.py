@@ -0,0 +1,65 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import unittest
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@unittest.skipIf(os.name == "nt", "symlinks need privileges on Windows")
+@WatchmanTestCase.expand_matrix
+class TestSymlinkPrefetch(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"symlink_target_prefetch": True}))
+        os.mkdir(os.path.join(root, "out"))
+        self.touchRelative(root, "target")
+        os.symlink("../target", os.path.join(root, "out", "a"))
+        os.symlink("missing", os.path.join(root, "out", "b"))
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root, [".watchmanconfig", "target", "out", "out/a", "out/b"]
+        )
+        return root
+
+    def queryTargets(self, root):
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "expression": ["type", "l"],
+                "fields": ["name", "symlink_target"],
+            },
+        )
+        return {f["name"]: f["symlink_target"] for f in res["files"]}
+
+    def test_crawl_caches_targets(self) -> None:
+        root = self.makeRoot()
+        stats = self.watchmanCommand("debug-symlink-target-cache", root)
+        self.assertEqual(stats["size"], 2)
+
+        self.assertEqual(
+            self.queryTargets(root), {"out/a": "../target", "out/b": "missing"}
+        )
+        stats = self.watchmanCommand("debug-symlink-target-cache", root)
+        self.assertEqual(stats["cacheHit"], 2)
+        self.assertEqual(stats["cacheLoad"], 2)
+
+    def test_changed_symlinks_are_read_again(self) -> None:
+        root = self.makeRoot()
+        os.unlink(os.path.join(root, "out", "b"))
+        os.symlink("elsewhere", os.path.join(root, "out", "b"))
+        self.assertFileList(
+            root, [".watchmanconfig", "target", "out", "out/a", "out/b"]
+        )
+
+        self.assertEqual(
+            self.queryTargets(root), {"out/a": "../target", "out/b": "elsewhere"}
+        )
@@ -240,3 +240,36 @@ class TestTrigger(WatchmanTestCase.WatchmanTestCase):
 
         triggers = self.watchmanCommand("trigger-list", root)
         self.assertEqual(0, len(triggers["triggers"]))
+
+    def test_streamedStdin(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"settle": 200}, f)
+        self.watchmanCommand("watch", root)
+
+        trigger_json = os.path.join(root, "trigger.json")
+        self.watchmanCommand(
+            "trigger",
+            root,
+            {
+                "name": "streamed",
+                "command": [
+                    sys.executable,
+                    os.path.join(HELPER_ROOT, "trigjson.py"),
+                    trigger_json,
+                ],
+                "expression": ["suffix", "c"],
+                "stdin": ["name", "exists"],
+                "stream_stdin": True,
+            },
+        )
+
+        def names_seen():
+            if not os.path.exists(trigger_json):
+                return set()
+            with open(trigger_json) as f:
+                return {item["name"] for line in f for item in json.loads(line)}
+
+        self.touchRelative(root, "foo.c")
+        self.touchRelative(root, "bar.c")
+        self.assertWaitFor(lambda: names_seen() == {"foo.c", "bar.c"})
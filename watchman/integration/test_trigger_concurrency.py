@@ -0,0 +1,119 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import os.path
+import sys
+import time
+
+from watchman.integration.lib import HELPER_ROOT, WatchmanInstance, WatchmanTestCase
+
+
+TRIG_SLOW = os.path.join(HELPER_ROOT, "trig-slow.py")
+
+
+@WatchmanTestCase.expand_matrix
+class TestTriggerConcurrency(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self, client):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"settle": 200}))
+        client.query("watch", root)
+        return root
+
+    def addTrigger(self, client, root, name, log_file, duration, suffix="txt"):
+        client.query(
+            "trigger",
+            root,
+            {
+                "name": name,
+                "command": [sys.executable, TRIG_SLOW, log_file, str(duration)],
+                "expression": ["suffix", suffix],
+                "stdin": "NAME_PER_LINE",
+            },
+        )
+
+    def readRuns(self, log_file):
+        """Returns the runs that trig-slow.py logged, in the order they
+        started, each with its trigger, files, start and end time."""
+        runs = {}
+        if os.path.exists(log_file):
+            with open(log_file) as f:
+                for line in f:
+                    data = json.loads(line)
+                    run = runs.setdefault(data["pid"], {"trigger": data["trigger"]})
+                    if data["event"] == "start":
+                        run["files"] = sorted(data["files"])
+                    run[data["event"]] = data["time"]
+        return sorted(runs.values(), key=lambda run: run["start"])
+
+    def waitForRuns(self, log_file, count):
+        self.assertWaitFor(
+            lambda: len([r for r in self.readRuns(log_file) if "end" in r]) >= count,
+            message="%d trigger runs should finish" % count,
+        )
+        return self.readRuns(log_file)
+
+    def test_settlesWhileRunningCoalesce(self) -> None:
+        client = self.getClient()
+        root = self.makeRoot(client)
+        log_file = os.path.join(self.mkdtemp(), "trig.log")
+        self.addTrigger(client, root, "slow", log_file, 3)
+
+        self.touchRelative(root, "a.txt")
+        self.assertWaitFor(lambda: self.readRuns(log_file))
+
+        # Two settles while the first run is still going
+        self.touchRelative(root, "b.txt")
+        time.sleep(1)
+        self.touchRelative(root, "c.txt")
+
+        first, second = self.waitForRuns(log_file, 2)
+        self.assertEqual(first["files"], ["a.txt"])
+        self.assertEqual(second["files"], ["b.txt", "c.txt"])
+        self.assertGreaterEqual(second["start"], first["end"])
+
+        # and no more than the one run for both of them
+        time.sleep(1)
+        self.assertEqual(2, len(self.readRuns(log_file)))
+
+    def test_maxConcurrent(self) -> None:
+        with WatchmanInstance.Instance(config={"trigger_max_concurrent": 1}) as inst:
+            inst.start()
+            client = self.getClient(inst)
+            root = self.makeRoot(client)
+            log_file = os.path.join(self.mkdtemp(), "trig.log")
+            self.addTrigger(client, root, "one", log_file, 2)
+            self.addTrigger(client, root, "two", log_file, 2)
+
+            self.touchRelative(root, "a.txt")
+            first, second = self.waitForRuns(log_file, 2)
+            self.assertEqual({"one", "two"}, {first["trigger"], second["trigger"]})
+            self.assertEqual(first["files"], ["a.txt"])
+            self.assertEqual(second["files"], ["a.txt"])
+            self.assertGreaterEqual(second["start"], first["end"])
+
+    def test_nothingToRunReleasesSlot(self) -> None:
+        with WatchmanInstance.Instance(config={"trigger_max_concurrent": 1}) as inst:
+            inst.start()
+            client = self.getClient(inst)
+            root = self.makeRoot(client)
+            log_file = os.path.join(self.mkdtemp(), "trig.log")
+            self.addTrigger(client, root, "idle", log_file, 0, suffix="never")
+            self.addTrigger(client, root, "busy", log_file, 0)
+
+            # Each of these settles has the idle trigger take the only slot
+            # and find nothing to run; if it kept the slot, the busy trigger
+            # would never run again.
+            for i in range(3):
+                self.touchRelative(root, "%d.dat" % i)
+                time.sleep(0.5)
+                self.touchRelative(root, "%d.txt" % i)
+                runs = self.waitForRuns(log_file, i + 1)
+                self.assertEqual(runs[-1]["trigger"], "busy")
+                self.assertEqual(runs[-1]["files"], ["%d.txt" % i])
@@ -74,6 +74,30 @@ class TestTriggerError(WatchmanTestCase.WatchmanTestCase):
             {"name": "oink", "command": ["cat"], "max_files_stdin": -1},
         )
 
+        self.assertTriggerRegError(
+            "append_files cannot be used with a persistent trigger",
+            "trigger",
+            root,
+            {
+                "name": "oink",
+                "command": ["cat"],
+                "append_files": True,
+                "persistent": True,
+            },
+        )
+
+        self.assertTriggerRegError(
+            "the stdin of a persistent trigger must be a list of fields",
+            "trigger",
+            root,
+            {
+                "name": "oink",
+                "command": ["cat"],
+                "stdin": "NAME_PER_LINE",
+                "persistent": True,
+            },
+        )
+
         self.assertTriggerRegError(
             "stdout: must be prefixed with either > or >>, got out",
             "trigger",
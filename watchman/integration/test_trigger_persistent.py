@@ -0,0 +1,62 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import os.path
+import sys
+
+from watchman.integration.lib import HELPER_ROOT, WatchmanTestCase
+
+
+TRIG_BSER = os.path.join(HELPER_ROOT, "trig-bser.py")
+
+
+@WatchmanTestCase.expand_matrix
+class TestTriggerPersistent(WatchmanTestCase.WatchmanTestCase):
+    def readRuns(self, file_name):
+        if not os.path.exists(file_name):
+            return []
+        with open(file_name, "r") as f:
+            return [json.loads(line) for line in f]
+
+    def test_persistentTriggerRunsOneProcess(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"settle": 200}))
+        log_file = os.path.join(self.mkdtemp(), "trig.log")
+        self.watchmanCommand("watch", root)
+
+        self.watchmanCommand(
+            "trigger",
+            root,
+            {
+                "name": "worker",
+                "command": [sys.executable, TRIG_BSER, log_file],
+                "expression": ["suffix", "txt"],
+                "stdin": ["name", "exists"],
+                "persistent": True,
+            },
+        )
+
+        def ranFor(name):
+            return any(
+                name in [f["name"] for f in run["files"]]
+                for run in self.readRuns(log_file)
+            )
+
+        self.touchRelative(root, "A.txt")
+        self.assertWaitFor(lambda: ranFor("A.txt"))
+        self.touchRelative(root, "B.txt")
+        self.assertWaitFor(lambda: ranFor("B.txt"))
+
+        runs = self.readRuns(log_file)
+        # The same process heard about both changes
+        self.assertEqual(1, len({run["pid"] for run in runs}))
+        self.assertEqual("worker", runs[-1]["trigger"])
+        self.assertIn("since", runs[-1])
+        self.assertFalse(runs[-1]["files_overflow"])
@@ -0,0 +1,42 @@
+#!/usr/bin/env python
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import sys
+
+from pywatchman import bser
+
+
+log_file_name = sys.argv[1]
+
+# The sizes of the BSER integer types that can hold a PDU length
+INT_SIZES = {3: 1, 4: 2, 5: 4, 6: 8}
+
+
+def read_exactly(size):
+    data = b""
+    while len(data) < size:
+        chunk = sys.stdin.buffer.read(size - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+# Log each PDU that a persistent trigger sends as a line of json, until
+# watchman closes stdin
+while True:
+    header = read_exactly(3)
+    if header is None:
+        break
+    header += read_exactly(INT_SIZES[header[2]])
+    pdu = header + read_exactly(bser.pdu_len(header) - len(header))
+    data = bser.loads(pdu, value_encoding="utf-8")
+    data["pid"] = os.getpid()
+    with open(log_file_name, "a") as f:
+        f.write(json.dumps(data) + "\n")
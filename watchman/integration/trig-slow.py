@@ -0,0 +1,30 @@
+#!/usr/bin/env python
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import sys
+import time
+
+
+log_file_name = sys.argv[1]
+duration = float(sys.argv[2])
+
+
+def log(data):
+    data["trigger"] = os.environ["WATCHMAN_TRIGGER"]
+    data["pid"] = os.getpid()
+    data["time"] = time.time()
+    with open(log_file_name, "a") as f:
+        f.write(json.dumps(data) + "\n")
+
+
+# Log the names on stdin as the command starts, and again when it exits
+# after taking duration seconds to run
+log({"event": "start", "files": sys.stdin.read().splitlines()})
+time.sleep(duration)
+log({"event": "end"})
@@ -12,18 +12,26 @@
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <folly/net/NetworkSocket.h>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <optional>
 #include <thread>
+#include <unordered_map>
 #include "watchman/Client.h"
 #include "watchman/Constants.h"
+#include "watchman/GitFsmonitor.h"
 #include "watchman/GroupLookup.h"
 #include "watchman/SanityCheck.h"
 #include "watchman/Shutdown.h"
 #include "watchman/SignalHandler.h"
+#include "watchman/ThreadClass.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/portability/WinError.h"
+#include "watchman/query/eval.h"
+#include "watchman/query/parse.h"
+#include "watchman/root/Root.h"
+#include "watchman/saved_state/SavedStateFactory.h"
 #include "watchman/sockname.h"
 #include "watchman/state.h"
 #include "watchman/watchman_cmd.h"
@@ -155,6 +163,62 @@ static FileDescriptor get_listener_unix_domain_socket(const char* path) {
   return listener_fd;
 }
 
+#ifndef _WIN32
+// Listens on address, a "host:port" pair, or just a port on the loopback
+// interface, for clients on other machines. They can't be identified, so
+// they are only allowed the commands flagged CMD_ALLOW_REMOTE.
+static FileDescriptor get_listener_tcp_socket(const char* address) {
+  std::string hostPort{address};
+  if (hostPort.find(':') == std::string::npos) {
+    hostPort = "127.0.0.1:" + hostPort;
+  } else if (hostPort.front() == ':') {
+    hostPort = "127.0.0.1" + hostPort;
+  }
+  folly::SocketAddress addr;
+  try {
+    addr.setFromHostPort(hostPort);
+  } catch (const std::exception& exc) {
+    logf(ERR, "replication_listen_address {}: {}\n", address, exc.what());
+    return FileDescriptor();
+  }
+  if (!addr.isLoopbackAddress()) {
+    logf(
+        ERR,
+        "replication_listen_address {} is reachable from other machines, "
+        "whose clients can query any watched root\n",
+        address);
+  }
+
+  FileDescriptor listener_fd(
+      ::socket(addr.getFamily(), SOCK_STREAM, 0),
+      "socket",
+      FileDescriptor::FDType::Socket);
+
+  int one = 1;
+  ::setsockopt(
+      listener_fd.system_handle(),
+      SOL_SOCKET,
+      SO_REUSEADDR,
+      (char*)&one,
+      sizeof(one));
+
+  struct sockaddr_storage storage;
+  auto len = addr.getAddress(&storage);
+  if (::bind(listener_fd.system_handle(), (struct sockaddr*)&storage, len) !=
+      0) {
+    logf(ERR, "bind({}): {}\n", address, folly::errnoStr(errno));
+    return FileDescriptor();
+  }
+  if (::listen(listener_fd.system_handle(), 200) != 0) {
+    logf(ERR, "listen({}): {}\n", address, folly::errnoStr(errno));
+    return FileDescriptor();
+  }
+
+  logf(ERR, "listening for remote clients on {}\n", addr.describe());
+  return listener_fd;
+}
+#endif
+
 #ifdef _WIN32
 
 static FileDescriptor create_pipe_server(const char* path) {
@@ -171,72 +235,164 @@ static FileDescriptor create_pipe_server(const char* path) {
       FileDescriptor::FDType::Pipe);
 }
 
-static void named_pipe_accept_loop_internal(
-    std::shared_ptr<watchman_event> listener_event) {
-  HANDLE handles[2];
-  auto olap = OVERLAPPED();
-  HANDLE connected_event = CreateEvent(NULL, FALSE, TRUE, NULL);
-  auto path = get_named_pipe_sock_path();
+namespace {
 
-  if (!connected_event) {
-    logf(
-        ERR,
-        "named_pipe_accept_loop_internal: CreateEvent failed: {}\n",
-        win32_strerror(GetLastError()));
-    return;
+// A pipe instance that waits for a client to connect to it. The acceptor
+// keeps a pool of these listening, so that a client finds an instance to
+// connect to rather than failing with ERROR_PIPE_BUSY while the acceptor
+// replaces the one that the previous client took.
+class PipeInstance {
+ public:
+  PipeInstance() : olap_{} {
+    // Manual reset, so that it stays signalled until the connect completes
+    olap_.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
   }
 
-  handles[0] = connected_event;
-  handles[1] = (HANDLE)listener_event->system_handle();
-  olap.hEvent = connected_event;
+  PipeInstance(const PipeInstance&) = delete;
+  PipeInstance& operator=(const PipeInstance&) = delete;
 
-  logf(ERR, "waiting for pipe clients on {}\n", get_named_pipe_sock_path());
-  while (!w_is_stopping()) {
-    FileDescriptor client_fd;
-    DWORD res;
+  ~PipeInstance() {
+    if (listening_) {
+      // The OVERLAPPED must outlive the connect, so wait for it to go
+      DWORD bytes;
+      CancelIoEx((HANDLE)pipe_.handle(), &olap_);
+      GetOverlappedResult((HANDLE)pipe_.handle(), &olap_, &bytes, TRUE);
+    }
+    if (olap_.hEvent) {
+      CloseHandle(olap_.hEvent);
+    }
+  }
 
-    client_fd = create_pipe_server(path.c_str());
-    if (!client_fd) {
+  bool isListening() const {
+    return listening_;
+  }
+
+  // Signalled when a client has connected to the instance
+  HANDLE event() const {
+    return olap_.hEvent;
+  }
+
+  // Creates a new instance and starts waiting for a client to connect to
+  // it. Returns the pipe if a client connected right away; the instance
+  // then needs to listen again.
+  FileDescriptor listen(const std::string& path) {
+    if (!olap_.hEvent) {
+      logf(ERR, "PipeInstance: CreateEvent failed\n");
+      return FileDescriptor();
+    }
+    pipe_ = create_pipe_server(path.c_str());
+    if (!pipe_) {
       logf(
           ERR,
-          "CreateNamedPipe(%s) failed: %s\n",
+          "CreateNamedPipe({}) failed: {}\n",
           path,
           win32_strerror(GetLastError()));
-      continue;
+      return FileDescriptor();
     }
 
-    ResetEvent(connected_event);
-    if (!ConnectNamedPipe((HANDLE)client_fd.handle(), &olap)) {
-      res = GetLastError();
+    ResetEvent(olap_.hEvent);
+    if (ConnectNamedPipe((HANDLE)pipe_.handle(), &olap_)) {
+      return std::move(pipe_);
+    }
+    auto err = GetLastError();
+    if (err == ERROR_IO_PENDING) {
+      listening_ = true;
+      return FileDescriptor();
+    }
+    if (err == ERROR_PIPE_CONNECTED) {
+      return std::move(pipe_);
+    }
+    logf(ERR, "ConnectNamedPipe: {}\n", win32_strerror(err));
+    pipe_.close();
+    return FileDescriptor();
+  }
 
-      if (res == ERROR_PIPE_CONNECTED) {
-        UserClient::create(w_stm_fdopen(std::move(client_fd)));
-        continue;
-      }
+  // Called once event() is signalled. Returns the connected pipe, unless
+  // the connect failed.
+  FileDescriptor connected() {
+    listening_ = false;
+    DWORD bytes;
+    if (!GetOverlappedResult((HANDLE)pipe_.handle(), &olap_, &bytes, FALSE)) {
+      logf(ERR, "ConnectNamedPipe: {}\n", win32_strerror(GetLastError()));
+      pipe_.close();
+      return FileDescriptor();
+    }
+    return std::move(pipe_);
+  }
 
-      if (res != ERROR_IO_PENDING) {
-        logf(ERR, "ConnectNamedPipe: {}\n", win32_strerror(GetLastError()));
-        continue;
-      }
+ private:
+  OVERLAPPED olap_;
+  FileDescriptor pipe_;
+  bool listening_{false};
+};
 
-      res = WaitForMultipleObjectsEx(2, handles, false, INFINITE, true);
-      if (res == WAIT_OBJECT_0 + 1) {
-        // Signalled to stop
-        CancelIoEx((HANDLE)client_fd.handle(), &olap);
-        continue;
-      }
+// WaitForMultipleObjectsEx waits for at most MAXIMUM_WAIT_OBJECTS handles,
+// one of which is the listener event.
+constexpr size_t kMaxPipeInstancesPerAcceptor = MAXIMUM_WAIT_OBJECTS - 1;
 
-      if (res != WAIT_OBJECT_0) {
-        logf(
-            ERR,
-            "WaitForMultipleObjectsEx: ConnectNamedPipe: "
-            "unexpected status {}\n",
-            res);
-        CancelIoEx((HANDLE)client_fd.handle(), &olap);
-        continue;
+} // namespace
+
+static void named_pipe_accept_loop_internal(
+    std::shared_ptr<watchman_event> listener_event,
+    size_t numInstances) {
+  auto path = get_named_pipe_sock_path();
+  std::vector<std::unique_ptr<PipeInstance>> instances;
+  for (size_t i = 0; i < numInstances; ++i) {
+    instances.push_back(std::make_unique<PipeInstance>());
+  }
+  auto listen = [&](PipeInstance& instance) {
+    while (auto client_fd = instance.listen(path)) {
+      UserClient::create(w_stm_fdopen(std::move(client_fd)));
+    }
+  };
+
+  logf(ERR, "waiting for pipe clients on {}\n", path);
+  std::vector<HANDLE> handles;
+  std::vector<PipeInstance*> listening;
+  while (!w_is_stopping()) {
+    handles.assign(1, (HANDLE)listener_event->system_handle());
+    listening.clear();
+    for (auto& instance : instances) {
+      if (!instance->isListening()) {
+        listen(*instance);
+      }
+      if (instance->isListening()) {
+        handles.push_back(instance->event());
+        listening.push_back(instance.get());
       }
     }
-    UserClient::create(w_stm_fdopen(std::move(client_fd)));
+
+    // Instances that failed to listen are retried after a while
+    auto res = WaitForMultipleObjectsEx(
+        DWORD(handles.size()),
+        handles.data(),
+        false,
+        listening.size() < instances.size() ? 1000 : INFINITE,
+        true);
+    if (res == WAIT_OBJECT_0) {
+      // Signalled to stop
+      break;
+    }
+    if (res == WAIT_TIMEOUT || res == WAIT_IO_COMPLETION) {
+      continue;
+    }
+    if (res < WAIT_OBJECT_0 + 1 || res >= WAIT_OBJECT_0 + handles.size()) {
+      logf(
+          ERR,
+          "WaitForMultipleObjectsEx: ConnectNamedPipe: "
+          "unexpected status {}\n",
+          res);
+      continue;
+    }
+
+    auto& instance = *listening[res - WAIT_OBJECT_0 - 1];
+    auto client_fd = instance.connected();
+    // Put a new instance in its place before handing the client off, so
+    // that the pool doesn't run short while clients are connecting.
+    listen(instance);
+    if (client_fd) {
+      UserClient::create(w_stm_fdopen(std::move(client_fd)));
+    }
   }
   logf(ERR, "is_stopping is true, so acceptor is done\n");
 }
@@ -247,11 +403,18 @@ static void named_pipe_accept_loop() {
   std::shared_ptr<watchman_event> listener_event = w_event_make_named_pipe();
   w_push_listener_thread_event(listener_event);
 
+  // Each acceptor thread waits on as many of the instances as it can
+  auto numInstances = size_t(
+      std::max(json_int_t(1), cfg_get_int("win32_concurrent_accepts", 32)));
   std::vector<std::thread> acceptors;
-  for (json_int_t i = 0; i < cfg_get_int("win32_concurrent_accepts", 32); ++i) {
-    acceptors.push_back(std::thread([i, listener_event]() {
+  for (size_t i = 0; i * kMaxPipeInstancesPerAcceptor < numInstances; ++i) {
+    auto count = std::min(
+        kMaxPipeInstancesPerAcceptor,
+        numInstances - i * kMaxPipeInstancesPerAcceptor);
+    acceptors.push_back(std::thread([i, count, listener_event]() {
       w_set_thread_name("accept", i);
-      named_pipe_accept_loop_internal(listener_event);
+      applyThreadClassPolicy(ThreadClass::Accept);
+      named_pipe_accept_loop_internal(listener_event, count);
     }));
   }
   for (auto& thr : acceptors) {
@@ -279,6 +442,7 @@ class AcceptLoop {
                            name = std::move(name),
                            listener_event]() mutable {
       w_set_thread_name(name);
+      applyThreadClassPolicy(ThreadClass::Accept);
       accept_thread(std::move(listener_fd), listener_event);
     });
   }
@@ -370,6 +534,304 @@ class AcceptLoop {
   bool joined_{false};
 };
 
+#ifndef _WIN32
+
+namespace {
+
+// Stands in for a token that no query can answer for, such as one issued
+// by git's own daemon: its pid is no watchman's, so the query is a fresh
+// instance and the response is trivial.
+constexpr const char* kUnknownGitFsmonitorClock = "c:0:0:0:0";
+
+std::string answerGitFsmonitorRequest(
+    const std::shared_ptr<Root>& root,
+    std::string_view request) {
+  std::string since{kUnknownGitFsmonitorClock};
+  if (request.substr(0, kGitFsmonitorTokenPrefix.size()) ==
+      kGitFsmonitorTokenPrefix) {
+    since = request.substr(kGitFsmonitorTokenPrefix.size());
+  }
+
+  try {
+    // git reads its own dir without asking.
+    auto gitDir = json_array(
+        {typed_string_to_json("anyof"),
+         json_array(
+             {typed_string_to_json("name"),
+              typed_string_to_json(".git"),
+              typed_string_to_json("wholename")}),
+         json_array(
+             {typed_string_to_json("dirname"), typed_string_to_json(".git")})});
+    auto query = parseQuery(
+        root,
+        json_object(
+            {{"since", typed_string_to_json(since.c_str())},
+             {"expression", json_array({typed_string_to_json("not"), gitDir})},
+             {"fields",
+              json_array(
+                  {typed_string_to_json("name"),
+                   typed_string_to_json("type")})},
+             {"empty_on_fresh_instance", json_true()}}));
+    auto res = w_query_execute(query.get(), root, nullptr, getInterface);
+
+    std::string token{kGitFsmonitorTokenPrefix};
+    token.append(json_to_w_string(res.clockAtStartOfQuery.toJson()).view());
+    bool trivial = res.isFreshInstance || res.timedOut;
+    std::vector<std::string> paths;
+    if (!trivial) {
+      paths.reserve(res.resultsArray.results.size());
+      for (auto& file : res.resultsArray.results) {
+        auto& fields = file.array();
+        std::string path{json_to_w_string(fields[0]).view()};
+        // git tells the dirs that changed by their trailing slash.
+        if (json_to_w_string(fields[1]) == "d") {
+          path.push_back('/');
+        }
+        paths.push_back(std::move(path));
+      }
+    }
+    return renderGitFsmonitorResponse(token, paths, trivial);
+  } catch (const std::exception& exc) {
+    logf(
+        ERR,
+        "{}: answering git fsmonitor with a trivial response: {}\n",
+        root->root_path,
+        exc.what());
+    std::string token{kGitFsmonitorTokenPrefix};
+    token.append(kUnknownGitFsmonitorClock);
+    return renderGitFsmonitorResponse(token, {}, true);
+  }
+}
+
+// Serves git's builtin fsmonitor protocol for one root, answering its
+// clients one at a time on a thread of its own.
+class GitFsmonitorListener {
+ public:
+  GitFsmonitorListener(
+      const std::shared_ptr<Root>& root,
+      std::string path,
+      FileDescriptor&& fd)
+      : root_{root}, path_{std::move(path)}, stop_{w_event_make_sockets()} {
+    fd.setCloExec();
+    fd.setNonBlock();
+    thread_ = std::thread([this,
+                           listener = w_stm_fdopen(std::move(fd)),
+                           rootPath = root->root_path]() mutable {
+      w_set_thread_name("git-fsmonitor ", rootPath);
+      run(*listener);
+    });
+  }
+
+  GitFsmonitorListener(const GitFsmonitorListener&) = delete;
+  GitFsmonitorListener& operator=(const GitFsmonitorListener&) = delete;
+
+  ~GitFsmonitorListener() {
+    stopping_ = true;
+    stop_->notify();
+    thread_.join();
+    (void)unlink(path_.c_str());
+  }
+
+ private:
+  void run(watchman_stream& listener) {
+    while (!stopping_ && !w_is_stopping()) {
+      EventPoll pfd[2];
+      pfd[0].evt = listener.getEvents();
+      pfd[1].evt = stop_.get();
+
+      if (w_poll_events(pfd, 2, 60000) == 0 || !pfd[0].ready || stopping_) {
+        continue;
+      }
+
+#ifdef HAVE_ACCEPT4
+      FileDescriptor client_fd(
+          accept4(
+              listener.getFileDescriptor().system_handle(),
+              nullptr,
+              0,
+              SOCK_CLOEXEC),
+          FileDescriptor::FDType::Socket);
+#else
+      FileDescriptor client_fd(
+          ::accept(listener.getFileDescriptor().system_handle(), nullptr, 0),
+          FileDescriptor::FDType::Socket);
+#endif
+      if (!client_fd) {
+        continue;
+      }
+      client_fd.setCloExec();
+      client_fd.clearNonBlock();
+      serve(client_fd);
+    }
+  }
+
+  void serve(const FileDescriptor& client_fd) {
+    // git waits for its answer, but a client that goes quiet mustn't hold
+    // up the ones after it for long.
+    timeval timeout{};
+    timeout.tv_sec = 5;
+    ::setsockopt(
+        client_fd.system_handle(),
+        SOL_SOCKET,
+        SO_RCVTIMEO,
+        &timeout,
+        sizeof(timeout));
+    ::setsockopt(
+        client_fd.system_handle(),
+        SOL_SOCKET,
+        SO_SNDTIMEO,
+        &timeout,
+        sizeof(timeout));
+
+    std::string buffer;
+    std::string request;
+    char chunk[4096];
+    while (true) {
+      auto n = ::read(client_fd.system_handle(), chunk, sizeof(chunk));
+      if (n <= 0) {
+        return;
+      }
+      buffer.append(chunk, size_t(n));
+      std::string_view input{buffer};
+      try {
+        if (decodeGitPktLines(input, request)) {
+          break;
+        }
+      } catch (const std::exception& exc) {
+        logf(ERR, "{}: bad git fsmonitor request: {}\n", path_, exc.what());
+        return;
+      }
+      buffer.erase(0, buffer.size() - input.size());
+    }
+
+    auto root = root_.lock();
+    if (!root) {
+      return;
+    }
+    auto response =
+        encodeGitPktLines(answerGitFsmonitorRequest(root, request));
+    const char* data = response.data();
+    size_t remaining = response.size();
+    while (remaining > 0) {
+      auto n = ::write(client_fd.system_handle(), data, remaining);
+      if (n <= 0) {
+        logf(
+            DBG,
+            "{}: writing git fsmonitor response: {}\n",
+            path_,
+            folly::errnoStr(errno));
+        return;
+      }
+      data += n;
+      remaining -= size_t(n);
+    }
+  }
+
+  std::weak_ptr<Root> root_;
+  std::string path_;
+  std::unique_ptr<watchman_event> stop_;
+  std::atomic<bool> stopping_{false};
+  std::thread thread_;
+};
+
+folly::Synchronized<
+    std::unordered_map<w_string, std::unique_ptr<GitFsmonitorListener>>>
+    gitFsmonitorListeners;
+
+FileDescriptor get_git_fsmonitor_socket(const std::string& path) {
+  struct sockaddr_un un {};
+  if (path.size() >= sizeof(un.sun_path) - 1) {
+    logf(ERR, "{}: path is too long\n", path);
+    return FileDescriptor();
+  }
+  un.sun_family = PF_LOCAL;
+  memcpy(un.sun_path, path.c_str(), path.size() + 1);
+
+  FileDescriptor fd(
+      ::socket(PF_LOCAL, SOCK_STREAM, 0),
+      "socket",
+      FileDescriptor::FDType::Socket);
+
+  // Leave the socket to git's own daemon if one is serving it.
+  if (::connect(fd.system_handle(), (struct sockaddr*)&un, sizeof(un)) ==
+      0) {
+    logf(ERR, "{}: in use by another fsmonitor daemon\n", path);
+    return FileDescriptor();
+  }
+  fd = FileDescriptor(
+      ::socket(PF_LOCAL, SOCK_STREAM, 0),
+      "socket",
+      FileDescriptor::FDType::Socket);
+
+  (void)unlink(path.c_str());
+  if (::bind(fd.system_handle(), (struct sockaddr*)&un, sizeof(un)) != 0) {
+    logf(ERR, "bind({}): {}\n", path, folly::errnoStr(errno));
+    return FileDescriptor();
+  }
+  // As with git's own daemon, only the owner may ask it about the tree.
+  if (chmod(path.c_str(), 0600) == -1) {
+    logf(ERR, "chmod({}, 0600): {}\n", path, folly::errnoStr(errno));
+    (void)unlink(path.c_str());
+    return FileDescriptor();
+  }
+  if (::listen(fd.system_handle(), 16) != 0) {
+    logf(ERR, "listen({}): {}\n", path, folly::errnoStr(errno));
+    (void)unlink(path.c_str());
+    return FileDescriptor();
+  }
+  return fd;
+}
+
+} // namespace
+
+void w_start_git_fsmonitor_listener(const std::shared_ptr<Root>& root) {
+  if (!root->config.getBool("git_fsmonitor_ipc", false)) {
+    return;
+  }
+  // The socket is only looked for at the top of a worktree whose .git is a
+  // dir, rather than a file pointing elsewhere.
+  auto gitDir = w_string::pathCat({root->root_path, ".git"});
+  struct stat st;
+  if (lstat(gitDir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+    logf(DBG, "{} has no .git dir to serve fsmonitor from\n", root->root_path);
+    return;
+  }
+
+  std::string path{
+      w_string::pathCat({gitDir, "fsmonitor--daemon.ipc"}).view()};
+  auto fd = get_git_fsmonitor_socket(path);
+  if (!fd) {
+    return;
+  }
+  logf(ERR, "serving git fsmonitor requests on {}\n", path);
+  auto listener = std::make_unique<GitFsmonitorListener>(
+      root, std::move(path), std::move(fd));
+  gitFsmonitorListeners.wlock()->insert_or_assign(
+      root->root_path, std::move(listener));
+}
+
+void w_stop_git_fsmonitor_listener(const Root& root) {
+  std::unique_ptr<GitFsmonitorListener> listener;
+  {
+    auto listeners = gitFsmonitorListeners.wlock();
+    auto it = listeners->find(root.root_path);
+    if (it == listeners->end()) {
+      return;
+    }
+    listener = std::move(it->second);
+    listeners->erase(it);
+  }
+  // Its thread is joined here, without holding the lock.
+}
+
+#else
+
+void w_start_git_fsmonitor_listener(const std::shared_ptr<Root>&) {}
+
+void w_stop_git_fsmonitor_listener(const Root&) {}
+
+#endif
+
 bool w_start_listener() {
 #ifndef _WIN32
   struct sigaction sa;
@@ -487,6 +949,14 @@ bool w_start_listener() {
     unix_loop = AcceptLoop("unix-listener", std::move(listener_fd));
   }
 
+#ifndef _WIN32
+  if (auto address = cfg_get_string("replication_listen_address", nullptr)) {
+    if (auto tcp_fd = get_listener_tcp_socket(address)) {
+      tcp_loop = AcceptLoop("tcp-listener", std::move(tcp_fd));
+    }
+  }
+#endif
+
   if (Configuration().getBool("enable-sanity-check", true)) {
     startSanityCheckThread();
   }
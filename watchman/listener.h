@@ -7,10 +7,22 @@
 
 #pragma once
 
+#include <memory>
 #include "watchman/fs/FileDescriptor.h"
 
+namespace watchman {
+class Root;
+}
+
 #ifdef __APPLE__
 watchman::FileDescriptor w_get_listener_socket_from_launchd();
 #endif
 void w_listener_prep_inetd();
 bool w_start_listener();
+
+// Serves git's builtin fsmonitor protocol from <root>/.git, when the root
+// sets git_fsmonitor_ipc and is the top of a git worktree. Not supported on
+// Windows, where git talks to its daemon over a named pipe.
+void w_start_git_fsmonitor_listener(
+    const std::shared_ptr<watchman::Root>& root);
+void w_stop_git_fsmonitor_listener(const watchman::Root& root);
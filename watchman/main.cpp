@@ -23,6 +23,7 @@
 #include "watchman/Command.h"
 #include "watchman/Connect.h"
 #include "watchman/GroupLookup.h"
+#include "watchman/HeapProfile.h"
 #include "watchman/LogConfig.h"
 #include "watchman/Logging.h"
 #include "watchman/Options.h"
@@ -33,6 +34,7 @@
 #include "watchman/UserDir.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/DirHandle.h"
+#include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/listener.h"
 #include "watchman/root/watchlist.h"
@@ -78,6 +80,7 @@ const std::string& get_pid_file() {
 } // namespace
 
 W_CAP_REG("bser-v2")
+W_CAP_REG("bser-v2-zstd")
 
 /**
  * Log and fatal if Watchman was started with a low priority, which can cause a
@@ -170,18 +173,33 @@ void detect_low_process_priority() {
   }
 #endif
 
+  if (cfg_get_bool("log_async", true)) {
+    watchman::getLog().startStdErrWriter(
+        cfg_get_int("debug_log_rate_limit", 0));
+  }
+
+  watchman::setHeapSampleInterval(
+      cfg_get_int("heap_sample_interval", 256 * 1024));
+
+  auto threadPoolWorkers = cfg_get_int("thread_pool_worker_threads", 16);
   watchman::getThreadPool().start(
-      cfg_get_int("thread_pool_worker_threads", 16),
-      cfg_get_int("thread_pool_max_items", 1024 * 1024));
+      threadPoolWorkers,
+      cfg_get_int("thread_pool_max_items", 1024 * 1024),
+      cfg_get_int(
+          "thread_pool_max_background_threads",
+          std::max<json_int_t>(1, threadPoolWorkers / 2)));
 
   ClockSpec::init();
   w_state_load();
+  w_root_start_maintenance();
   bool res = w_start_listener();
+  w_root_stop_maintenance();
   w_root_free_watched_roots();
   perf_shutdown();
   cfg_shutdown();
 
   log(ERR, "Exiting from service with res=", res, "\n");
+  watchman::getLog().stopStdErrWriter();
 
   if (res) {
     exit(0);
@@ -852,6 +870,108 @@ static bool try_client_mode_command(const Command& command, bool pretty) {
   return res;
 }
 
+#ifndef _WIN32
+// When WATCHMAN_FAST_CLI is set, for hook scripts and the like that run the
+// CLI over and over, sends a simply given command straight to the socket
+// named by WATCHMAN_SOCK, or else to the default one, and copies the
+// daemon's response to stdout byte for byte.  That skips loading the
+// config file, checking the state dir, validating and re-encoding.
+// Returns nothing, having done nothing, if the command needs more than that
+// or the daemon can't be reached, which the usual path then deals with.
+static std::optional<int> try_fast_cli_command(int argc, char** argv) {
+  if (!getenv("WATCHMAN_FAST_CLI")) {
+    return std::nullopt;
+  }
+
+  bool json_input = false;
+  bool no_pretty = false;
+  int first = 1;
+  for (; first < argc && argv[first][0] == '-'; ++first) {
+    std::string_view opt{argv[first]};
+    if (opt == "-j" || opt == "--json-command") {
+      json_input = true;
+    } else if (opt == "--no-pretty") {
+      no_pretty = true;
+    } else if (opt != "--no-spawn" && opt != "--no-local") {
+      // Those two only matter if the daemon can't be reached, in which
+      // case the usual path sees them.
+      return std::nullopt;
+    }
+  }
+  if (json_input ? first != argc : first == argc) {
+    return std::nullopt;
+  }
+  // The daemon's JSON is compact, which is what the usual path prints when
+  // it isn't pretty printing.
+  if (!no_pretty && FileDescriptor::stdOut().isatty()) {
+    return std::nullopt;
+  }
+
+  std::string sockname;
+  if (auto sock = getenv("WATCHMAN_SOCK"); sock && *sock) {
+    sockname = sock;
+  } else {
+    sockname = folly::to<std::string>(
+        computeWatchmanStateDirectory(computeUserName()), "/sock");
+  }
+  auto stmResult = w_stm_connect_unix(sockname.c_str(), 0);
+  if (stmResult.hasError()) {
+    return std::nullopt;
+  }
+  auto stream = std::move(stmResult).value();
+
+  // From here on, stdin may have been consumed, so there is no going back.
+  PduBuffer buffer;
+  PduFormat format{is_json_compact};
+  std::optional<json_ref> request;
+  if (json_input) {
+    json_error_t err;
+    auto cmd = buffer.decodeNext(w_stm_stdin(), &err);
+    if (!cmd) {
+      fprintf(
+          stderr,
+          "failed to parse command from stdin: "
+          "line %d, column %d, position %d: %s\n",
+          err.line,
+          err.column,
+          err.position,
+          err.text);
+      return 1;
+    }
+    // The response comes back in the encoding of the request, which is
+    // what the output would be.
+    if (buffer.format.type == is_bser || buffer.format.type == is_bser_v2) {
+      format = buffer.format;
+    }
+    request = std::move(*cmd);
+  } else {
+    std::vector<json_ref> args;
+    for (int i = first; i < argc; i++) {
+      args.push_back(typed_string_to_json(argv[i], W_STRING_UNICODE));
+    }
+    request = json_array(std::move(args));
+  }
+
+  stream->setNonBlock(false);
+  buffer.clear();
+  auto res = buffer.pduEncodeToStream(format, *request, stream.get());
+  if (res.hasError()) {
+    logf(
+        ERR, "error sending PDU to server: {}\n", folly::errnoStr(res.error()));
+    return 1;
+  }
+
+  buffer.clear();
+  json_error_t jerr;
+  if (!buffer.readAndDetectPdu(stream.get(), &jerr) ||
+      !buffer.streamPdu(stream.get(), &jerr)) {
+    logf(ERR, "failed to pass on the response: {}\n", jerr.text);
+    return 1;
+  }
+  return 0;
+}
+#endif
+
 static std::vector<std::string> parse_cmdline(int* argcp, char*** argvp) {
   cfg_load_global_config_file();
 
@@ -986,6 +1106,12 @@ static int inner_main(int argc, char** argv) {
     folly::SingletonVault::singleton()->destroyInstances();
   };
 
+#ifndef _WIN32
+  if (auto status = try_fast_cli_command(argc, argv)) {
+    return *status;
+  }
+#endif
+
   auto daemon_argv = parse_cmdline(&argc, &argv);
 
 #ifdef _WIN32
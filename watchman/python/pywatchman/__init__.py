@@ -110,6 +110,31 @@ def _win32_strerror(err):
         LocalFree(buf)
 
 
+def decode_front_coded_names(packed):
+    """Yields the names in the files of a query response that set
+    "name_encoding": "front_coded", in order.
+
+    Each name is recorded as the number of leading directory components that
+    it shares with the name before it, a colon, the rest of the name and a NUL.
+    The names are decoded as they are iterated, and are of the same type,
+    bytes or str, as packed."""
+    if isinstance(packed, bytes):
+        nul, colon, slash = b"\0", b":", b"/"
+    else:
+        nul, colon, slash = "\0", ":", "/"
+
+    prev = []
+    pos = 0
+    while pos < len(packed):
+        end = packed.index(nul, pos)
+        sep = packed.index(colon, pos, end)
+        shared = int(packed[pos:sep])
+        name = slash.join(prev[:shared] + [packed[sep + 1 : end]])
+        prev = name.split(slash)
+        pos = end + 1
+        yield name
+
+
 class WatchmanError(Exception):
     def __init__(self, msg=None, cmd=None):
         self.msg = msg
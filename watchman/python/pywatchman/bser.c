@@ -228,6 +228,9 @@ typedef struct loads_ctx {
   const char* value_errors;
   uint32_t bser_version;
   uint32_t bser_capabilities;
+  // When set, the bserLazyBuffer that arrays and objects are decoded from
+  // on access, rather than when they are loaded.
+  PyObject* lazy;
 } unser_ctx_t;
 
 static PyObject*
@@ -865,6 +868,841 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   return arrval;
 }
 
+// Lazy decoding.
+// With loads(lazy=True), arrays and objects are not decoded when the PDU is
+// loaded: they are represented by proxies that point into a private copy of
+// the PDU, and their members are decoded each time they are accessed.  An
+// array is indexed by a single walk over its encoding that allocates no
+// Python objects, and a template-encoded array (the usual encoding of a
+// query's files) can decode one of its fields for each of its rows with
+// column(), without building the rows at all.  This is much cheaper than
+// eager decoding for the consumers of large results that look at only a
+// few of the fields.
+
+// clang-format off
+typedef struct {
+  PyObject_HEAD
+  PyObject *data;           // bytes; the PDU
+  PyObject *value_encoding; // bytes or NULL; owns ctx.value_encoding
+  PyObject *value_errors;   // bytes or NULL; owns ctx.value_errors
+  unser_ctx_t ctx;          // ctx.lazy is this buffer
+} bserLazyBuffer;
+
+// An array, or a template-encoded array, of a lazily decoded PDU.
+typedef struct {
+  PyObject_HEAD
+  PyObject *buffer;     // the bserLazyBuffer
+  PyObject *keys;       // tuple of field names as bytes for a template;
+                        // otherwise NULL
+  Py_ssize_t nitems;
+  Py_ssize_t *offsets;  // where each item, or each row, starts in the PDU
+} bserLazyArray;
+
+// An object, or one row of a template, of a lazily decoded PDU.
+typedef struct {
+  PyObject_HEAD
+  PyObject *buffer;     // the bserLazyBuffer
+  PyObject *keys;       // the template's field names; NULL for an object,
+                        // whose keys precede each of its values
+  Py_ssize_t nitems;
+  Py_ssize_t offset;    // where the first key, or value, starts in the PDU
+} bserLazyObject;
+// clang-format on
+
+static void bserlazybuf_dealloc(PyObject* o) {
+  bserLazyBuffer* buf = (bserLazyBuffer*)o;
+
+  Py_CLEAR(buf->data);
+  Py_CLEAR(buf->value_encoding);
+  Py_CLEAR(buf->value_errors);
+  PyObject_Del(o);
+}
+
+// clang-format off
+PyTypeObject bserLazyBufferType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "bser_lazy_buffer",        /* tp_name */
+  sizeof(bserLazyBuffer),    /* tp_basicsize */
+  0,                         /* tp_itemsize */
+  bserlazybuf_dealloc,       /* tp_dealloc */
+  0,                         /* tp_print */
+  0,                         /* tp_getattr */
+  0,                         /* tp_setattr */
+  0,                         /* tp_compare */
+  0,                         /* tp_repr */
+  0,                         /* tp_as_number */
+  0,                         /* tp_as_sequence */
+  0,                         /* tp_as_mapping */
+  0,                         /* tp_hash  */
+  0,                         /* tp_call */
+  0,                         /* tp_str */
+  0,                         /* tp_getattro */
+  0,                         /* tp_setattro */
+  0,                         /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,        /* tp_flags */
+  "bser lazy buffer",        /* tp_doc */
+};
+// clang-format on
+
+static inline const char* lazy_data(PyObject* buffer) {
+  return PyBytes_AS_STRING(((bserLazyBuffer*)buffer)->data);
+}
+
+static inline const char* lazy_end(PyObject* buffer) {
+  bserLazyBuffer* buf = (bserLazyBuffer*)buffer;
+  return PyBytes_AS_STRING(buf->data) + PyBytes_GET_SIZE(buf->data);
+}
+
+static inline const unser_ctx_t* lazy_ctx(PyObject* buffer) {
+  return &((bserLazyBuffer*)buffer)->ctx;
+}
+
+// Steps over the value at *ptr without decoding it.
+static int bunser_skip(const char** ptr, const char* end) {
+  const char* buf = *ptr;
+  const char* start;
+  int64_t nitems, nkeys, len, i;
+
+  if (buf >= end) {
+    PyErr_SetString(PyExc_ValueError, "bser data ended early");
+    return 0;
+  }
+
+  switch (buf[0]) {
+    case BSER_INT8:
+    case BSER_INT16:
+    case BSER_INT32:
+    case BSER_INT64:
+      return bunser_int(ptr, end, &len);
+
+    case BSER_REAL:
+      if (end - buf < 1 + (Py_ssize_t)sizeof(double)) {
+        PyErr_SetString(PyExc_ValueError, "bser data ended early");
+        return 0;
+      }
+      *ptr = buf + 1 + sizeof(double);
+      return 1;
+
+    case BSER_TRUE:
+    case BSER_FALSE:
+    case BSER_NULL:
+    case BSER_SKIP:
+      *ptr = buf + 1;
+      return 1;
+
+    case BSER_BYTESTRING:
+    case BSER_UTF8STRING:
+      return bunser_bytestring(ptr, end, &start, &len);
+
+    case BSER_ARRAY:
+    case BSER_OBJECT:
+      buf++;
+      if (!bunser_int(&buf, end, &nitems)) {
+        return 0;
+      }
+      // An object's keys are strings.
+      if (**ptr == BSER_OBJECT) {
+        nitems *= 2;
+      }
+      for (i = 0; i < nitems; i++) {
+        if (!bunser_skip(&buf, end)) {
+          return 0;
+        }
+      }
+      *ptr = buf;
+      return 1;
+
+    case BSER_TEMPLATE:
+      buf++;
+      if (buf >= end || buf[0] != BSER_ARRAY) {
+        PyErr_Format(PyExc_ValueError, "Expect ARRAY to follow TEMPLATE");
+        return 0;
+      }
+      buf++;
+      if (!bunser_int(&buf, end, &nkeys)) {
+        return 0;
+      }
+      for (i = 0; i < nkeys; i++) {
+        if (!bunser_skip(&buf, end)) {
+          return 0;
+        }
+      }
+      if (!bunser_int(&buf, end, &nitems)) {
+        return 0;
+      }
+      for (i = 0; i < nitems * nkeys; i++) {
+        if (!bunser_skip(&buf, end)) {
+          return 0;
+        }
+      }
+      *ptr = buf;
+      return 1;
+
+    default:
+      PyErr_Format(PyExc_ValueError, "unhandled bser opcode 0x%02x", buf[0]);
+      return 0;
+  }
+}
+
+// Decodes the value at ptr, which a template row may have left out.
+static PyObject* lazy_decode(PyObject* buffer, const char* ptr) {
+  if (*ptr == BSER_SKIP) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  return bser_loads_recursive(&ptr, lazy_end(buffer), lazy_ctx(buffer));
+}
+
+// Finds the value of a lazy object's field, either by name, or by index
+// when name is NULL.  Returns 1 and points *value at its encoding if it
+// is found, 0 if it is not, and -1 if the data is invalid.
+static int lazy_find(
+    PyObject* buffer,
+    PyObject* keys,
+    Py_ssize_t nitems,
+    Py_ssize_t offset,
+    const char* name,
+    Py_ssize_t namelen,
+    Py_ssize_t index,
+    const char** value) {
+  const char* ptr = lazy_data(buffer) + offset;
+  const char* end = lazy_end(buffer);
+  Py_ssize_t i;
+
+  if (!name && keys) {
+    // A template row's values are all present, if only as BSER_SKIP.
+    if (index >= nitems) {
+      return 0;
+    }
+    for (i = 0; i < index; i++) {
+      if (!bunser_skip(&ptr, end)) {
+        return -1;
+      }
+    }
+    *value = ptr;
+    return 1;
+  }
+
+  for (i = 0; i < nitems; i++) {
+    int match;
+
+    if (keys) {
+      PyObject* key = PyTuple_GET_ITEM(keys, i);
+      match = PyBytes_GET_SIZE(key) == namelen &&
+          !memcmp(PyBytes_AS_STRING(key), name, namelen);
+    } else {
+      const char* keystr;
+      int64_t keylen;
+
+      if (!bunser_bytestring(&ptr, end, &keystr, &keylen)) {
+        return -1;
+      }
+      if (name) {
+        match = keylen == namelen && !memcmp(keystr, name, namelen);
+      } else {
+        match = i == index;
+      }
+    }
+
+    if (match) {
+      *value = ptr;
+      return 1;
+    }
+    if (!bunser_skip(&ptr, end)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Gets the UTF-8 of a field name, which may be either unicode or bytes.
+// *name_bytes must be released by the caller.
+static const char*
+lazy_field_name(PyObject* name, PyObject** name_bytes, Py_ssize_t* namelen) {
+  char* namestr = NULL;
+
+  *name_bytes = NULL;
+  if (PyUnicode_Check(name)) {
+    *name_bytes = PyUnicode_AsUTF8String(name);
+    if (*name_bytes == NULL) {
+      return NULL;
+    }
+    name = *name_bytes;
+  }
+  if (PyBytes_AsStringAndSize(name, &namestr, namelen) == -1) {
+    return NULL;
+  }
+  return namestr;
+}
+
+static Py_ssize_t bserlazyobj_length(PyObject* o) {
+  return ((bserLazyObject*)o)->nitems;
+}
+
+static PyObject* bserlazyobj_item(PyObject* o, Py_ssize_t i) {
+  bserLazyObject* obj = (bserLazyObject*)o;
+  const char* value;
+  int found = -1;
+
+  if (i >= 0) {
+    found = lazy_find(
+        obj->buffer, obj->keys, obj->nitems, obj->offset, NULL, 0, i, &value);
+  }
+  if (found == 1) {
+    return lazy_decode(obj->buffer, value);
+  }
+  if (found == 0 || i < 0) {
+    PyErr_SetString(PyExc_IndexError, "bser_lazy_object index out of range");
+  }
+  return NULL;
+}
+
+// Looks a field up by name, returning NULL without an error if there is no
+// such field.
+static PyObject*
+bserlazyobj_lookup(bserLazyObject* obj, PyObject* name, int st_prefix) {
+  PyObject* name_bytes;
+  PyObject* ret = NULL;
+  const char* namestr;
+  const char* value;
+  Py_ssize_t namelen;
+  int found;
+
+  namestr = lazy_field_name(name, &name_bytes, &namelen);
+  if (namestr == NULL) {
+    return NULL;
+  }
+  // hack^Wfeature to allow mercurial to use "st_size" to reference "size"
+  if (st_prefix && !strncmp(namestr, "st_", 3)) {
+    namestr += 3;
+    namelen -= 3;
+  }
+
+  found = lazy_find(
+      obj->buffer,
+      obj->keys,
+      obj->nitems,
+      obj->offset,
+      namestr,
+      namelen,
+      0,
+      &value);
+  if (found == 1) {
+    ret = lazy_decode(obj->buffer, value);
+  }
+  Py_XDECREF(name_bytes);
+  return ret;
+}
+
+static PyObject* bserlazyobj_subscript(PyObject* o, PyObject* key) {
+  PyObject* ret;
+  Py_ssize_t i;
+
+  if (PyIndex_Check(key)) {
+    i = PyNumber_AsSsize_t(key, PyExc_IndexError);
+    if (i == -1 && PyErr_Occurred()) {
+      return NULL;
+    }
+    if (i < 0) {
+      i += ((bserLazyObject*)o)->nitems;
+    }
+    return bserlazyobj_item(o, i);
+  }
+
+  ret = bserlazyobj_lookup((bserLazyObject*)o, key, 0);
+  if (!ret && !PyErr_Occurred()) {
+    PyErr_SetObject(PyExc_KeyError, key);
+  }
+  return ret;
+}
+
+static PyObject* bserlazyobj_getattrro(PyObject* o, PyObject* name) {
+  // Fields are found before methods, as bserobject only has fields.
+  PyObject* ret = bserlazyobj_lookup((bserLazyObject*)o, name, 1);
+  if (ret || PyErr_Occurred()) {
+    return ret;
+  }
+  return PyObject_GenericGetAttr(o, name);
+}
+
+static PyObject* bserlazyobj_get(PyObject* o, PyObject* args) {
+  PyObject* key;
+  PyObject* def = Py_None;
+  PyObject* ret;
+
+  if (!PyArg_ParseTuple(args, "O|O:get", &key, &def)) {
+    return NULL;
+  }
+  ret = bserlazyobj_lookup((bserLazyObject*)o, key, 0);
+  if (!ret && !PyErr_Occurred()) {
+    Py_INCREF(def);
+    ret = def;
+  }
+  return ret;
+}
+
+// Decodes a template's field names, which are kept as bytes.
+static PyObject* lazy_template_keys(PyObject* keys) {
+  Py_ssize_t i, n = PyTuple_GET_SIZE(keys);
+  PyObject* res = PyList_New(n);
+
+  if (!res) {
+    return NULL;
+  }
+  for (i = 0; i < n; i++) {
+    PyObject* key = PyTuple_GET_ITEM(keys, i);
+    key = PyUnicode_FromStringAndSize(
+        PyBytes_AS_STRING(key), PyBytes_GET_SIZE(key));
+    if (!key) {
+      Py_DECREF(res);
+      return NULL;
+    }
+    PyList_SET_ITEM(res, i, key);
+  }
+  return res;
+}
+
+static PyObject* bserlazyobj_keys(PyObject* o, PyObject* unused) {
+  bserLazyObject* obj = (bserLazyObject*)o;
+  const char* ptr = lazy_data(obj->buffer) + obj->offset;
+  const char* end = lazy_end(obj->buffer);
+  const char* keystr;
+  int64_t keylen;
+  PyObject* res;
+  PyObject* key;
+  Py_ssize_t i;
+
+  (void)unused;
+
+  if (obj->keys) {
+    return lazy_template_keys(obj->keys);
+  }
+  res = PyList_New(obj->nitems);
+  if (!res) {
+    return NULL;
+  }
+  for (i = 0; i < obj->nitems; i++) {
+    if (!bunser_bytestring(&ptr, end, &keystr, &keylen) ||
+        !bunser_skip(&ptr, end)) {
+      Py_DECREF(res);
+      return NULL;
+    }
+    key = PyUnicode_FromStringAndSize(keystr, (Py_ssize_t)keylen);
+    if (!key) {
+      Py_DECREF(res);
+      return NULL;
+    }
+    PyList_SET_ITEM(res, i, key);
+  }
+  return res;
+}
+
+static void bserlazyobj_dealloc(PyObject* o) {
+  bserLazyObject* obj = (bserLazyObject*)o;
+
+  Py_CLEAR(obj->buffer);
+  Py_CLEAR(obj->keys);
+  PyObject_Del(o);
+}
+
+static PyObject* bserlazyobj_new(
+    PyObject* buffer,
+    PyObject* keys,
+    Py_ssize_t nitems,
+    Py_ssize_t offset);
+
+// clang-format off
+static PySequenceMethods bserlazyobj_sq = {
+  bserlazyobj_length,        /* sq_length */
+  0,                         /* sq_concat */
+  0,                         /* sq_repeat */
+  bserlazyobj_item,          /* sq_item */
+};
+
+static PyMappingMethods bserlazyobj_map = {
+  bserlazyobj_length,        /* mp_length */
+  bserlazyobj_subscript,     /* mp_subscript */
+  0                          /* mp_ass_subscript */
+};
+
+static PyMethodDef bserlazyobj_methods[] = {
+  {"get", (PyCFunction)bserlazyobj_get, METH_VARARGS,
+   "Decode the value of a field, or return a default."},
+  {"keys", (PyCFunction)bserlazyobj_keys, METH_NOARGS,
+   "Return the names of the fields."},
+  {NULL, NULL, 0, NULL}
+};
+
+PyTypeObject bserLazyObjectType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "bser_lazy_object",        /* tp_name */
+  sizeof(bserLazyObject),    /* tp_basicsize */
+  0,                         /* tp_itemsize */
+  bserlazyobj_dealloc,       /* tp_dealloc */
+  0,                         /* tp_print */
+  0,                         /* tp_getattr */
+  0,                         /* tp_setattr */
+  0,                         /* tp_compare */
+  0,                         /* tp_repr */
+  0,                         /* tp_as_number */
+  &bserlazyobj_sq,           /* tp_as_sequence */
+  &bserlazyobj_map,          /* tp_as_mapping */
+  0,                         /* tp_hash  */
+  0,                         /* tp_call */
+  0,                         /* tp_str */
+  bserlazyobj_getattrro,     /* tp_getattro */
+  0,                         /* tp_setattro */
+  0,                         /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,        /* tp_flags */
+  "bser object, decoded as its fields are accessed", /* tp_doc */
+  0,                         /* tp_traverse */
+  0,                         /* tp_clear */
+  0,                         /* tp_richcompare */
+  0,                         /* tp_weaklistoffset */
+  0,                         /* tp_iter */
+  0,                         /* tp_iternext */
+  bserlazyobj_methods,       /* tp_methods */
+};
+// clang-format on
+
+static PyObject* bserlazyobj_new(
+    PyObject* buffer,
+    PyObject* keys,
+    Py_ssize_t nitems,
+    Py_ssize_t offset) {
+  bserLazyObject* obj = PyObject_New(bserLazyObject, &bserLazyObjectType);
+  if (!obj) {
+    return NULL;
+  }
+  Py_INCREF(buffer);
+  obj->buffer = buffer;
+  Py_XINCREF(keys);
+  obj->keys = keys;
+  obj->nitems = nitems;
+  obj->offset = offset;
+  return (PyObject*)obj;
+}
+
+static Py_ssize_t bserlazyarr_length(PyObject* o) {
+  return ((bserLazyArray*)o)->nitems;
+}
+
+static PyObject* bserlazyarr_item(PyObject* o, Py_ssize_t i) {
+  bserLazyArray* arr = (bserLazyArray*)o;
+
+  if (i < 0 || i >= arr->nitems) {
+    PyErr_SetString(PyExc_IndexError, "bser_lazy_array index out of range");
+    return NULL;
+  }
+  if (arr->keys) {
+    return bserlazyobj_new(
+        arr->buffer, arr->keys, PyTuple_GET_SIZE(arr->keys), arr->offsets[i]);
+  }
+  return lazy_decode(arr->buffer, lazy_data(arr->buffer) + arr->offsets[i]);
+}
+
+// Decodes one field of every row, leaving None for the rows without it.
+static PyObject* bserlazyarr_column(PyObject* o, PyObject* name) {
+  bserLazyArray* arr = (bserLazyArray*)o;
+  const char* data = lazy_data(arr->buffer);
+  const char* end = lazy_end(arr->buffer);
+  PyObject* name_bytes;
+  PyObject* res = NULL;
+  const char* namestr;
+  Py_ssize_t namelen, keyidx = -1, i;
+
+  namestr = lazy_field_name(name, &name_bytes, &namelen);
+  if (namestr == NULL) {
+    return NULL;
+  }
+
+  if (arr->keys) {
+    for (i = 0; i < PyTuple_GET_SIZE(arr->keys); i++) {
+      PyObject* key = PyTuple_GET_ITEM(arr->keys, i);
+      if (PyBytes_GET_SIZE(key) == namelen &&
+          !memcmp(PyBytes_AS_STRING(key), namestr, namelen)) {
+        keyidx = i;
+        break;
+      }
+    }
+  }
+
+  res = PyList_New(arr->nitems);
+  if (!res) {
+    goto bail;
+  }
+  for (i = 0; i < arr->nitems; i++) {
+    const char* ptr = data + arr->offsets[i];
+    const char* value;
+    PyObject* ele;
+    int64_t nitems;
+    int found;
+
+    if (arr->keys) {
+      found = keyidx < 0 ? 0
+                         : lazy_find(
+                               arr->buffer,
+                               arr->keys,
+                               PyTuple_GET_SIZE(arr->keys),
+                               arr->offsets[i],
+                               NULL,
+                               0,
+                               keyidx,
+                               &value);
+    } else if (*ptr == BSER_OBJECT) {
+      ptr++;
+      if (!bunser_int(&ptr, end, &nitems)) {
+        goto fail;
+      }
+      found = lazy_find(
+          arr->buffer,
+          NULL,
+          (Py_ssize_t)nitems,
+          ptr - data,
+          namestr,
+          namelen,
+          0,
+          &value);
+    } else {
+      PyErr_SetString(PyExc_TypeError, "column() needs an array of objects");
+      goto fail;
+    }
+
+    if (found == 1) {
+      ele = lazy_decode(arr->buffer, value);
+    } else if (found == 0) {
+      Py_INCREF(Py_None);
+      ele = Py_None;
+    } else {
+      ele = NULL;
+    }
+    if (!ele) {
+      goto fail;
+    }
+    PyList_SET_ITEM(res, i, ele);
+  }
+  goto bail;
+
+fail:
+  Py_CLEAR(res);
+bail:
+  Py_XDECREF(name_bytes);
+  return res;
+}
+
+static PyObject* bserlazyarr_keys(PyObject* o, void* unused) {
+  bserLazyArray* arr = (bserLazyArray*)o;
+
+  (void)unused;
+
+  if (!arr->keys) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  return lazy_template_keys(arr->keys);
+}
+
+static void bserlazyarr_dealloc(PyObject* o) {
+  bserLazyArray* arr = (bserLazyArray*)o;
+
+  Py_CLEAR(arr->buffer);
+  Py_CLEAR(arr->keys);
+  PyMem_Free(arr->offsets);
+  PyObject_Del(o);
+}
+
+// clang-format off
+static PySequenceMethods bserlazyarr_sq = {
+  bserlazyarr_length,        /* sq_length */
+  0,                         /* sq_concat */
+  0,                         /* sq_repeat */
+  bserlazyarr_item,          /* sq_item */
+};
+
+static PyMethodDef bserlazyarr_methods[] = {
+  {"column", (PyCFunction)bserlazyarr_column, METH_O,
+   "Decode one field of each of the rows into a list."},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef bserlazyarr_getset[] = {
+  {"keys", (getter)bserlazyarr_keys, NULL,
+   "The field names of a template-encoded array, or None.", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+PyTypeObject bserLazyArrayType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "bser_lazy_array",         /* tp_name */
+  sizeof(bserLazyArray),     /* tp_basicsize */
+  0,                         /* tp_itemsize */
+  bserlazyarr_dealloc,       /* tp_dealloc */
+  0,                         /* tp_print */
+  0,                         /* tp_getattr */
+  0,                         /* tp_setattr */
+  0,                         /* tp_compare */
+  0,                         /* tp_repr */
+  0,                         /* tp_as_number */
+  &bserlazyarr_sq,           /* tp_as_sequence */
+  0,                         /* tp_as_mapping */
+  0,                         /* tp_hash  */
+  0,                         /* tp_call */
+  0,                         /* tp_str */
+  0,                         /* tp_getattro */
+  0,                         /* tp_setattro */
+  0,                         /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,        /* tp_flags */
+  "bser array, decoded as its items are accessed", /* tp_doc */
+  0,                         /* tp_traverse */
+  0,                         /* tp_clear */
+  0,                         /* tp_richcompare */
+  0,                         /* tp_weaklistoffset */
+  0,                         /* tp_iter */
+  0,                         /* tp_iternext */
+  bserlazyarr_methods,       /* tp_methods */
+  0,                         /* tp_members */
+  bserlazyarr_getset,        /* tp_getset */
+};
+// clang-format on
+
+// Indexes nitems values, or rows of nkeys values, that start at *ptr.
+static PyObject* bunser_lazy_items(
+    const char** ptr,
+    const char* end,
+    const unser_ctx_t* ctx,
+    PyObject* keys,
+    int64_t nitems) {
+  const char* data = lazy_data(ctx->lazy);
+  Py_ssize_t nvalues = keys ? PyTuple_GET_SIZE(keys) : 1;
+  bserLazyArray* arr;
+  int64_t i;
+  Py_ssize_t j;
+
+  if (nitems > LONG_MAX || nitems < 0) {
+    PyErr_Format(PyExc_ValueError, "too many items for python array");
+    return NULL;
+  }
+
+  arr = PyObject_New(bserLazyArray, &bserLazyArrayType);
+  if (!arr) {
+    return NULL;
+  }
+  Py_INCREF(ctx->lazy);
+  arr->buffer = ctx->lazy;
+  Py_XINCREF(keys);
+  arr->keys = keys;
+  arr->nitems = (Py_ssize_t)nitems;
+  arr->offsets = PyMem_Malloc(sizeof(Py_ssize_t) * (size_t)(nitems + 1));
+  if (!arr->offsets) {
+    Py_DECREF(arr);
+    return PyErr_NoMemory();
+  }
+
+  for (i = 0; i < nitems; i++) {
+    arr->offsets[i] = *ptr - data;
+    for (j = 0; j < nvalues; j++) {
+      if (!bunser_skip(ptr, end)) {
+        Py_DECREF(arr);
+        return NULL;
+      }
+    }
+  }
+  return (PyObject*)arr;
+}
+
+static PyObject*
+bunser_lazy_array(const char** ptr, const char* end, const unser_ctx_t* ctx) {
+  const char* buf = *ptr;
+  int64_t nitems;
+
+  // skip array header
+  buf++;
+  if (!bunser_int(&buf, end, &nitems)) {
+    return NULL;
+  }
+  *ptr = buf;
+  return bunser_lazy_items(ptr, end, ctx, NULL, nitems);
+}
+
+static PyObject*
+bunser_lazy_object(const char** ptr, const char* end, const unser_ctx_t* ctx) {
+  const char* buf = *ptr;
+  int64_t nitems;
+
+  // skip object header
+  buf++;
+  if (!bunser_int(&buf, end, &nitems)) {
+    return NULL;
+  }
+  if (nitems > LONG_MAX || nitems < 0) {
+    PyErr_Format(PyExc_ValueError, "too many items for python object");
+    return NULL;
+  }
+  if (!bunser_skip(ptr, end)) {
+    return NULL;
+  }
+  return bserlazyobj_new(
+      ctx->lazy, NULL, (Py_ssize_t)nitems, buf - lazy_data(ctx->lazy));
+}
+
+static PyObject* bunser_lazy_template(
+    const char** ptr,
+    const char* end,
+    const unser_ctx_t* ctx) {
+  const char* buf = *ptr;
+  int64_t numkeys, nitems, i;
+  PyObject* keys;
+  PyObject* res;
+
+  if (buf + 1 >= end || buf[1] != BSER_ARRAY) {
+    PyErr_Format(PyExc_ValueError, "Expect ARRAY to follow TEMPLATE");
+    return NULL;
+  }
+
+  // skip the template and array headers
+  buf += 2;
+  if (!bunser_int(&buf, end, &numkeys)) {
+    return NULL;
+  }
+  if (numkeys > LONG_MAX || numkeys < 0) {
+    PyErr_Format(PyExc_ValueError, "Too many items for python");
+    return NULL;
+  }
+
+  // The keys are compared with the names they are looked up by as bytes.
+  keys = PyTuple_New((Py_ssize_t)numkeys);
+  if (!keys) {
+    return NULL;
+  }
+  for (i = 0; i < numkeys; i++) {
+    const char* keystr;
+    int64_t keylen;
+    PyObject* key;
+
+    if (!bunser_bytestring(&buf, end, &keystr, &keylen)) {
+      Py_DECREF(keys);
+      return NULL;
+    }
+    key = PyBytes_FromStringAndSize(keystr, (Py_ssize_t)keylen);
+    if (!key) {
+      Py_DECREF(keys);
+      return NULL;
+    }
+    PyTuple_SET_ITEM(keys, (Py_ssize_t)i, key);
+  }
+
+  // Load number of array elements
+  if (!bunser_int(&buf, end, &nitems)) {
+    Py_DECREF(keys);
+    return NULL;
+  }
+  *ptr = buf;
+
+  res = bunser_lazy_items(ptr, end, ctx, keys, nitems);
+  Py_DECREF(keys);
+  return res;
+}
+
 static PyObject* bser_loads_recursive(
     const char** ptr,
     const char* end,
@@ -951,12 +1789,21 @@ static PyObject* bser_loads_recursive(
     }
 
     case BSER_ARRAY:
+      if (ctx->lazy) {
+        return bunser_lazy_array(ptr, end, ctx);
+      }
       return bunser_array(ptr, end, ctx);
 
     case BSER_OBJECT:
+      if (ctx->lazy) {
+        return bunser_lazy_object(ptr, end, ctx);
+      }
       return bunser_object(ptr, end, ctx);
 
     case BSER_TEMPLATE:
+      if (ctx->lazy) {
+        return bunser_lazy_template(ptr, end, ctx);
+      }
       return bunser_template(ptr, end, ctx);
 
     default:
@@ -1082,23 +1929,27 @@ static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
   PyObject* mutable_obj = NULL;
   const char* value_encoding = NULL;
   const char* value_errors = NULL;
+  PyObject* lazy_obj = NULL;
+  bserLazyBuffer* lazy;
+  PyObject* res;
   unser_ctx_t ctx = {1, 0};
 
   static char* kw_list[] = {
-      "buf", "mutable", "value_encoding", "value_errors", NULL};
+      "buf", "mutable", "value_encoding", "value_errors", "lazy", NULL};
 
   (void)self;
 
   if (!PyArg_ParseTupleAndKeywords(
           args,
           kw,
-          "s#|Ozz:loads",
+          "s#|OzzO:loads",
           kw_list,
           &start,
           &datalen,
           &mutable_obj,
           &value_encoding,
-          &value_errors)) {
+          &value_errors,
+          &lazy_obj)) {
     return NULL;
   }
 
@@ -1133,7 +1984,41 @@ static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
     return NULL;
   }
 
-  return bser_loads_recursive(&data, end, &ctx);
+  if (!lazy_obj || PyObject_IsTrue(lazy_obj) <= 0) {
+    return bser_loads_recursive(&data, end, &ctx);
+  }
+
+  // The proxies outlive buf and the encoding arguments, so decode from
+  // copies of them.
+  lazy = PyObject_New(bserLazyBuffer, &bserLazyBufferType);
+  if (!lazy) {
+    return NULL;
+  }
+  lazy->data = PyBytes_FromStringAndSize(start, datalen);
+  lazy->value_encoding = NULL;
+  lazy->value_errors = NULL;
+  lazy->ctx = ctx;
+  lazy->ctx.mutable = 0;
+  lazy->ctx.lazy = (PyObject*)lazy;
+  if (ctx.value_encoding) {
+    lazy->value_encoding = PyBytes_FromString(ctx.value_encoding);
+    lazy->value_errors = PyBytes_FromString(ctx.value_errors);
+    if (!lazy->value_encoding || !lazy->value_errors) {
+      Py_DECREF(lazy);
+      return NULL;
+    }
+    lazy->ctx.value_encoding = PyBytes_AS_STRING(lazy->value_encoding);
+    lazy->ctx.value_errors = PyBytes_AS_STRING(lazy->value_errors);
+  }
+  if (!lazy->data) {
+    Py_DECREF(lazy);
+    return NULL;
+  }
+
+  data = PyBytes_AS_STRING(lazy->data) + (data - start);
+  res = bser_loads_recursive(&data, lazy_end((PyObject*)lazy), &lazy->ctx);
+  Py_DECREF(lazy);
+  return res;
 }
 
 static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
@@ -1146,21 +2031,23 @@ static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
   PyObject* mutable_obj = NULL;
   PyObject* value_encoding = NULL;
   PyObject* value_errors = NULL;
+  PyObject* lazy_obj = NULL;
 
   static char* kw_list[] = {
-      "fp", "mutable", "value_encoding", "value_errors", NULL};
+      "fp", "mutable", "value_encoding", "value_errors", "lazy", NULL};
 
   (void)self;
 
   if (!PyArg_ParseTupleAndKeywords(
           args,
           kw,
-          "O|OOO:load",
+          "O|OOOO:load",
           kw_list,
           &fp,
           &mutable_obj,
           &value_encoding,
-          &value_errors)) {
+          &value_errors,
+          &lazy_obj)) {
     return NULL;
   }
 
@@ -1191,6 +2078,9 @@ static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
   if (value_errors) {
     PyDict_SetItemString(load_method_kwargs, "value_errors", value_errors);
   }
+  if (lazy_obj) {
+    PyDict_SetItemString(load_method_kwargs, "lazy", lazy_obj);
+  }
   string = PyObject_Call(load_method, load_method_args, load_method_kwargs);
   Py_DECREF(load_method_kwargs);
   Py_DECREF(load_method_args);
@@ -1229,6 +2119,9 @@ PyMODINIT_FUNC PyInit_bser(void) {
 
   mod = PyModule_Create(&bser_module);
   PyType_Ready(&bserObjectType);
+  PyType_Ready(&bserLazyBufferType);
+  PyType_Ready(&bserLazyObjectType);
+  PyType_Ready(&bserLazyArrayType);
 
   return mod;
 }
@@ -1237,6 +2130,9 @@ PyMODINIT_FUNC PyInit_bser(void) {
 PyMODINIT_FUNC initbser(void) {
   (void)Py_InitModule("bser", bser_methods);
   PyType_Ready(&bserObjectType);
+  PyType_Ready(&bserLazyBufferType);
+  PyType_Ready(&bserLazyObjectType);
+  PyType_Ready(&bserLazyArrayType);
 }
 #endif // PY_MAJOR_VERSION >= 3
 
@@ -463,7 +463,9 @@ def pdu_len(buf):
     return info[2] + info[3]
 
 
-def loads(buf, mutable: bool = True, value_encoding=None, value_errors=None):
+def loads(
+    buf, mutable: bool = True, value_encoding=None, value_errors=None, lazy=False
+):
     """Deserialize a BSER-encoded blob.
 
     @param buf: The buffer to deserialize.
@@ -480,6 +482,11 @@ def loads(buf, mutable: bool = True, value_encoding=None, value_errors=None):
                          The other most common argument is 'surrogateescape' on
                          Python 3. If value_encoding is None, this is ignored.
     @type value_errors: str
+
+    @param lazy: Whether to decode arrays and objects as they are accessed.
+                 This module decodes them eagerly, but returns immutable
+                 results, to offer the same interface to lookups.
+    @type lazy: bool
     """
 
     info = _pdu_info_helper(buf)
@@ -491,6 +498,9 @@ def loads(buf, mutable: bool = True, value_encoding=None, value_errors=None):
             "bser data len %d != header len %d" % (expected_len + pos, len(buf))
         )
 
+    if lazy:
+        mutable = False
+
     bunser = Bunser(
         mutable=mutable, value_encoding=value_encoding, value_errors=value_errors
     )
@@ -498,7 +508,9 @@ def loads(buf, mutable: bool = True, value_encoding=None, value_errors=None):
     return bunser.loads_recursive(buf, pos)[0]
 
 
-def load(fp, mutable: bool = True, value_encoding=None, value_errors=None):
+def load(
+    fp, mutable: bool = True, value_encoding=None, value_errors=None, lazy=False
+):
     from . import load
 
-    return load.load(fp, mutable, value_encoding, value_errors)
+    return load.load(fp, mutable, value_encoding, value_errors, lazy)
@@ -363,6 +363,46 @@ class TestBSERDump(unittest.TestCase):
         for i in range(0, len(exp)):
             self.assertItemAttributes(exp[i], res[i])
 
+        res = self.bser_mod.loads(templ, lazy=True)
+        self.assertEqual(len(exp), len(res))
+        for i in range(0, len(exp)):
+            self.assertItemAttributes(exp[i], res[i])
+            self.assertEqual(exp[i]["age"], res[i]["age"])
+        if self.bser_mod is bser:
+            self.assertEqual(["name", "age"], res.keys)
+            self.assertEqual([b"fred", b"pete", None], res.column("name"))
+            self.assertEqual([None, None, None], res.column("size"))
+
+    def test_lazy(self):
+        val = {
+            "clock": "c:0:1",
+            "files": [
+                {"name": "a", "size": 10, "mtime": 1.5, "exists": True},
+                {"name": "b", "size": -70000, "sub": [1, {"x": None}]},
+            ],
+        }
+        enc = self.bser_mod.dumps(val)
+        for res in (
+            self.bser_mod.loads(enc, lazy=True, value_encoding="utf8"),
+            self.bser_mod.load(FakeFile(enc), lazy=True, value_encoding="utf8"),
+        ):
+            self.assertEqual("c:0:1", res.clock)
+            files = res["files"]
+            # The proxies keep the data they are decoded from alive.
+            del res
+            self.assertEqual(2, len(files))
+            self.assertItemAttributes(val["files"][0], files[0])
+            self.assertEqual("a", files[0]["name"])
+            self.assertEqual(-70000, files[-1].st_size)
+            self.assertEqual(None, files[1]["sub"][1].x)
+            self.assertRaises(KeyError, lambda: files[0]["sub"])
+            self.assertRaises(IndexError, lambda: files[2])
+            if self.bser_mod is bser:
+                self.assertEqual(["a", "b"], files.column("name"))
+                self.assertEqual([10, -70000], files.column("size"))
+                self.assertEqual(None, files[0].get("sub"))
+                self.assertEqual(["name", "size", "sub"], files[1].keys())
+
     def test_pdu_info(self):
         enc = self.bser_mod.dumps(1)
         DEFAULT_BSER_VERSION = 1
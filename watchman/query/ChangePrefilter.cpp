@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/ChangePrefilter.h"
+#include "watchman/Clock.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryExpr.h"
+
+namespace watchman {
+
+ChangePrefilter::ChangePrefilter(
+    std::vector<w_string> dirs,
+    std::vector<w_string> suffixes)
+    : dirs_{std::move(dirs)}, suffixes_{std::move(suffixes)} {}
+
+std::shared_ptr<ChangePrefilter> ChangePrefilter::compile(
+    const Query& query,
+    const w_string& rootPath) {
+  if (query.alwaysIncludeDirectories ||
+      (query.since_spec && query.since_spec->hasScmParams())) {
+    return nullptr;
+  }
+
+  const auto& relativeRoot =
+      query.relative_root ? query.relative_root : rootPath;
+  std::vector<w_string> dirs;
+  // Results must match the expression, whereas the files that a path or
+  // glob generator produces are only added to those that changed.
+  if (query.paths && query.paths_from_expression) {
+    for (const auto& path : *query.paths) {
+      dirs.push_back(w_string::pathCat({relativeRoot, path.name}));
+    }
+  } else if (relativeRoot != rootPath) {
+    dirs.push_back(relativeRoot);
+  }
+  for (const auto& dir : dirs) {
+    if (dir == rootPath) {
+      // Anything in the root may match
+      dirs.clear();
+      break;
+    }
+  }
+
+  std::vector<w_string> suffixes;
+  if (query.expr) {
+    if (auto scope = query.expr->computeSuffixScope()) {
+      suffixes = std::move(*scope);
+    }
+  }
+
+  if (dirs.empty() && suffixes.empty()) {
+    return nullptr;
+  }
+  return std::make_shared<ChangePrefilter>(
+      std::move(dirs), std::move(suffixes));
+}
+
+bool ChangePrefilter::matches(
+    w_string_piece dirName,
+    w_string_piece baseName) const {
+  if (!suffixes_.empty()) {
+    bool found = false;
+    for (const auto& suffix : suffixes_) {
+      if (baseName.hasSuffix(suffix)) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  if (dirs_.empty()) {
+    return true;
+  }
+
+  for (const auto& dir : dirs_) {
+    if (dirName.startsWithCaseInsensitive(dir) &&
+        (dirName.size() == dir.size() ||
+         is_slash(dirName.data()[dir.size()]))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace watchman
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+struct Query;
+
+/**
+ * A cheap test, compiled from the query of a subscription, for whether a
+ * changed file could possibly be among its results: the file must lie
+ * within one of dirs, if there are any, and have one of suffixes, if there
+ * are any. Both are compared case insensitively, so as to err on the side
+ * of a match.
+ *
+ * The IO thread sets matched when a file that passes the test has changed
+ * since the subscription last cleared it, so that a subscription whose
+ * query can't have new results is neither woken nor evaluated at a settle.
+ */
+class ChangePrefilter {
+ public:
+  /**
+   * dirs are full paths, and suffixes are lowercased and without the dot.
+   */
+  ChangePrefilter(std::vector<w_string> dirs, std::vector<w_string> suffixes);
+
+  /**
+   * Returns nullptr if the query can't be narrowed down this way, such as
+   * when it has no path scope or suffix scope, or when it is SCM aware or
+   * reports directories regardless of what changed within them.
+   */
+  static std::shared_ptr<ChangePrefilter> compile(
+      const Query& query,
+      const w_string& rootPath);
+
+  /**
+   * Whether the file called baseName in the dir at the full path dirName
+   * passes the test.
+   */
+  bool matches(w_string_piece dirName, w_string_piece baseName) const;
+
+  const std::vector<w_string>& dirs() const {
+    return dirs_;
+  }
+
+  const std::vector<w_string>& suffixes() const {
+    return suffixes_;
+  }
+
+  // Starts out set, so that a new subscription is evaluated at the first
+  // settle after it was made whatever changed, in case its initial results
+  // were held back.
+  std::atomic<bool> matched{true};
+
+ private:
+  std::vector<w_string> dirs_;
+  std::vector<w_string> suffixes_;
+};
+
+} // namespace watchman
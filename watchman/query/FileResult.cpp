@@ -6,11 +6,61 @@
  */
 
 #include "watchman/query/FileResult.h"
+#include <new>
+#include <system_error>
+#include "watchman/SlabAllocator.h"
 
 namespace watchman {
 
+namespace {
+
+// Keeps the FileResult that follows it aligned as operator new would.
+struct alignas(std::max_align_t) AllocationHeader {
+  // nullptr if the FileResult is on the heap.
+  SlabAllocator* allocator;
+  size_t size;
+};
+
+AllocationHeader* getHeader(void* ptr) {
+  return static_cast<AllocationHeader*>(ptr) - 1;
+}
+
+} // namespace
+
 FileResult::~FileResult() {}
 
+void* FileResult::operator new(size_t size) {
+  auto header = static_cast<AllocationHeader*>(
+      ::operator new(sizeof(AllocationHeader) + size));
+  header->allocator = nullptr;
+  header->size = sizeof(AllocationHeader) + size;
+  return header + 1;
+}
+
+void* FileResult::operator new(size_t size, SlabAllocator& allocator) {
+  auto total = sizeof(AllocationHeader) + size;
+  auto header = static_cast<AllocationHeader*>(allocator.allocate(total));
+  header->allocator = &allocator;
+  header->size = total;
+  return header + 1;
+}
+
+void FileResult::operator delete(void* ptr) noexcept {
+  if (!ptr) {
+    return;
+  }
+  auto header = getHeader(ptr);
+  if (header->allocator) {
+    header->allocator->deallocate(header, header->size);
+  } else {
+    ::operator delete(header);
+  }
+}
+
+void FileResult::operator delete(void* ptr, SlabAllocator&) noexcept {
+  FileResult::operator delete(ptr);
+}
+
 std::optional<DType> FileResult::dtype() {
   auto statInfo = stat();
   if (!statInfo.has_value()) {
@@ -19,4 +69,14 @@ std::optional<DType> FileResult::dtype() {
   return statInfo->dtype();
 }
 
+const void* FileResult::identity() const {
+  return nullptr;
+}
+
+std::optional<FileResult::Spooky128Hash> FileResult::getContentSpooky128() {
+  throw std::system_error(
+      std::make_error_code(std::errc::operation_not_supported),
+      "content.spooky128hex is not available for this watcher");
+}
+
 } // namespace watchman
@@ -15,6 +15,8 @@
 
 namespace watchman {
 
+class SlabAllocator;
+
 // A View-independent way of accessing file properties in the
 // query engine.  A FileResult is not intended to be accessed
 // concurrently from multiple threads and may be unsafe to
@@ -23,6 +25,16 @@ class FileResult {
  public:
   virtual ~FileResult();
 
+  // A FileResult is allocated either on the heap, as by std::make_unique,
+  // or from an allocator by QueryContext::makeFileResult. Each is preceded
+  // by a header that names its allocator, so that one deleted through a
+  // std::unique_ptr<FileResult> is returned to the right place.
+  static void* operator new(size_t size);
+  static void* operator new(size_t size, SlabAllocator& allocator);
+  static void operator delete(void* ptr) noexcept;
+  // Called if a constructor throws.
+  static void operator delete(void* ptr, SlabAllocator& allocator) noexcept;
+
   // Maybe returns the file information.
   // Returns folly::none if the file information is not yet known.
   virtual std::optional<FileInformation> stat() = 0;
@@ -65,6 +77,11 @@ class FileResult {
   using ContentHash = std::array<uint8_t, 20>;
   virtual std::optional<ContentHash> getContentSha1() = 0;
 
+  // Returns the 128 bit SpookyHash V2 of the file contents.
+  // Views that can't compute it throw.
+  using Spooky128Hash = std::array<uint8_t, 16>;
+  virtual std::optional<Spooky128Hash> getContentSpooky128();
+
   // Maybe return the dtype.
   // Returns folly::none if the dtype is not currently known.
   // Returns DType::Unknown if we have dtype data but it doesn't
@@ -72,6 +89,12 @@ class FileResult {
   // on linux).
   virtual std::optional<DType> dtype();
 
+  // Returns a pointer that is the same for every FileResult of a file in
+  // its view and differs between files, or nullptr if the view doesn't have
+  // one. dedup_results compares these, when it can, rather than the names
+  // of the files.
+  virtual const void* identity() const;
+
   // A bitset of Property values
   using Properties = uint_least16_t;
 
@@ -103,6 +126,8 @@ class FileResult {
     SymlinkTarget = 1 << 8,
     // Need full stat metadata
     FullFileInformation = 1 << 9,
+    // The getContentSpooky128() method will be called
+    ContentSpooky128 = 1 << 10,
   };
 
   // Perform a batch fetch to fill in some missing data.
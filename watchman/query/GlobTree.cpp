@@ -8,14 +8,59 @@
 #include "watchman/query/GlobTree.h"
 #include <folly/Conv.h>
 #include <folly/Range.h>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
 
 namespace watchman {
 
+namespace {
+std::optional<GlobTree::StarPattern> compileStarPattern(
+    std::string_view pattern) {
+  if (pattern.substr(0, 3) == "**/") {
+    pattern.remove_prefix(3);
+  }
+  auto star = pattern.find('*');
+  if (star == std::string_view::npos ||
+      pattern.find_first_of("*?[\\/", star + 1) != std::string_view::npos ||
+      pattern.find_first_of("?[\\/", 0) < star) {
+    return std::nullopt;
+  }
+  auto prefix = pattern.substr(0, star);
+  if (!prefix.empty() && prefix[0] == '.') {
+    // A literal leading dot interacts with the dot dir rules for `**`;
+    // leave those to wildmatch.
+    return std::nullopt;
+  }
+  return GlobTree::StarPattern{
+      std::string{prefix}, std::string{pattern.substr(star + 1)}};
+}
+} // namespace
+
 GlobTree::GlobTree(const char* pattern, uint32_t pattern_len)
     : pattern(pattern, pattern_len),
       is_leaf(0),
       had_specials(0),
-      is_doublestar(0) {}
+      is_doublestar(0),
+      star(compileStarPattern(this->pattern)) {}
+
+bool GlobTree::StarPattern::matches(w_string_piece name, int flags) const {
+  if (name.size() < prefix.size() + suffix.size()) {
+    return false;
+  }
+  if ((flags & WM_PERIOD) && prefix.empty() && name.size() > 0 &&
+      name[0] == '.') {
+    return false;
+  }
+  w_string_piece head{name.data(), prefix.size()};
+  w_string_piece tail{
+      name.data() + name.size() - suffix.size(), suffix.size()};
+  w_string_piece wantHead{prefix.data(), prefix.size()};
+  w_string_piece wantTail{suffix.data(), suffix.size()};
+  if (flags & WM_CASEFOLD) {
+    return w_string_equal_caseless(head, wantHead) &&
+        w_string_equal_caseless(tail, wantTail);
+  }
+  return head == wantHead && tail == wantTail;
+}
 
 std::vector<std::string> GlobTree::unparse() const {
   std::vector<std::string> result;
@@ -8,8 +8,10 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
+#include "watchman/watchman_string.h"
 
 namespace watchman {
 
@@ -28,6 +30,21 @@ struct GlobTree {
   unsigned had_specials : 1; // if false, can do simple string compare
   unsigned is_doublestar : 1; // pattern begins with **
 
+  // A pattern of the form `<prefix>*<suffix>` with no other specials, such
+  // as `*.ts`, which can be matched against a name without wildmatch.
+  struct StarPattern {
+    std::string prefix;
+    std::string suffix;
+
+    // Matches a single path component; `flags` are the wildmatch flags,
+    // of which WM_CASEFOLD and WM_PERIOD are honored.
+    bool matches(w_string_piece name, int flags) const;
+  };
+  // Set when the pattern, less any leading `**/`, is a StarPattern.
+  // Doublestar nodes must additionally reject paths that pass through a
+  // dot dir when WM_PERIOD is set.
+  std::optional<StarPattern> star;
+
   GlobTree(const char* pattern, uint32_t pattern_len);
 
   // Produces a list of globs from the glob tree, effectively
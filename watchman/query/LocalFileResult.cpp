@@ -18,6 +18,18 @@ LocalFileResult::LocalFileResult(
       clock_(clock),
       caseSensitivity_(caseSensitivity) {}
 
+LocalFileResult::LocalFileResult(
+    w_string fullPath,
+    ClockStamp clock,
+    CaseSensitivity caseSensitivity,
+    FileInformation info,
+    bool exists)
+    : exists_(exists),
+      info_(std::move(info)),
+      fullPath_(std::move(fullPath)),
+      clock_(clock),
+      caseSensitivity_(caseSensitivity) {}
+
 void LocalFileResult::getInfo() {
   if (info_.has_value()) {
     return;
@@ -112,6 +124,15 @@ std::optional<FileResult::ContentHash> LocalFileResult::getContentSha1() {
   return contentSha1_.value();
 }
 
+std::optional<FileResult::Spooky128Hash>
+LocalFileResult::getContentSpooky128() {
+  if (contentSpooky128_.empty()) {
+    accessorNeedsProperties(FileResult::Property::ContentSpooky128);
+    return std::nullopt;
+  }
+  return contentSpooky128_.value();
+}
+
 void LocalFileResult::batchFetchProperties(
     const std::vector<std::unique_ptr<FileResult>>& files) {
   for (auto& f : files) {
@@ -140,6 +161,14 @@ void LocalFileResult::batchFetchProperties(
       });
     }
 
+    if (localFile->neededProperties() &
+        FileResult::Property::ContentSpooky128) {
+      localFile->contentSpooky128_ = makeResultWith([&] {
+        return Spooky128HashCache::computeHashImmediate(
+            localFile->fullPath_.c_str());
+      });
+    }
+
     localFile->clearNeededProperties();
   }
 }
@@ -33,6 +33,16 @@ class LocalFileResult : public FileResult {
       ClockStamp clock,
       CaseSensitivity caseSensitivity);
 
+  // Uses info, which the caller knows to be current, rather than querying
+  // the filesystem for it. A file that doesn't exist is given
+  // FileInformation::makeDeletedFileInformation() and exists = false.
+  LocalFileResult(
+      w_string fullPath,
+      ClockStamp clock,
+      CaseSensitivity caseSensitivity,
+      FileInformation info,
+      bool exists);
+
   // Returns stat-like information about this file.  If the file doesn't
   // exist the stat information will be largely useless (it will be zeroed
   // out), but will report itself as being a regular file.  This is fine
@@ -61,6 +71,9 @@ class LocalFileResult : public FileResult {
   // Returns the SHA-1 hash of the file contents
   std::optional<FileResult::ContentHash> getContentSha1() override;
 
+  // Returns the SpookyHash V2 of the file contents
+  std::optional<FileResult::Spooky128Hash> getContentSpooky128() override;
+
   void batchFetchProperties(
       const std::vector<std::unique_ptr<FileResult>>& files) override;
 
@@ -75,6 +88,7 @@ class LocalFileResult : public FileResult {
   CaseSensitivity caseSensitivity_;
   std::optional<w_string> symlinkTarget_;
   Result<FileResult::ContentHash> contentSha1_;
+  Result<FileResult::Spooky128Hash> contentSpooky128_;
 };
 
 } // namespace watchman
@@ -7,9 +7,11 @@
 
 #pragma once
 
+#include <memory>
 #include <optional>
 #include "watchman/Clock.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/query/QueryExpr.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 
@@ -27,17 +29,51 @@ struct QueryFieldRenderer {
 
 class QueryFieldList : public std::vector<QueryFieldRenderer*> {
  public:
+  using RowRenderer =
+      std::optional<json_ref> (*)(FileResult* file, const QueryContext* ctx);
+
   /**
    * Adds the specified field to the list of those requested by the query.
    *
    * Throws QueryParseError if the name is invalid.
    */
   void add(const w_string& name);
+
+  void clear() {
+    std::vector<QueryFieldRenderer*>::clear();
+    rowRenderer_ = nullptr;
+  }
+
+  /**
+   * If the fields are one of the commonly requested lists, returns a
+   * function that renders a whole result with them, as rendering each field
+   * in turn would, but without calling through a pointer for every field.
+   */
+  RowRenderer rowRenderer() const {
+    return rowRenderer_;
+  }
+
+ private:
+  RowRenderer rowRenderer_{nullptr};
 };
 
-struct QueryPath {
-  w_string name;
-  int depth;
+enum class QueryOrder {
+  // Results are produced in whatever order the generators find them
+  None,
+  // Most recently changed first, by observed clock
+  Otime,
+  // Most recently modified first
+  Mtime,
+  // By wholename
+  Name,
+};
+
+struct QueryAggregate {
+  enum class GroupBy { None, Dirname, Suffix };
+
+  // Whether to total the sizes of the files as well as count them
+  bool size = false;
+  GroupBy group_by = GroupBy::None;
 };
 
 struct Query {
@@ -45,8 +81,42 @@ struct Query {
   bool fail_if_no_saved_state = false;
   bool empty_on_fresh_instance = false;
   bool omit_changed_files = false;
+  // If true, the response reports how far the view is behind the filesystem.
+  bool include_lag = false;
   bool dedup_results = false;
+  // If true, dedup_results also collects the names of the results into
+  // QueryResult::dedupedFileNames. Set by triggers that append_files.
+  bool collect_deduped_names = false;
+  // If true, generators that support it fan the walk out across the
+  // thread pool.
+  bool parallel = false;
   uint32_t bench_iterations = 0;
+  // If true, the results may be answered from, and are added to, the
+  // result cache. Set by the query command.
+  bool use_result_cache = false;
+  // If true, the query waits for its turn among the root's queries when
+  // query_max_concurrency of them are already running. Set by the query
+  // command.
+  bool use_admission = false;
+  // If non-zero, results are sent in chunks of this many files as they are
+  // produced, ahead of the response that carries the rest.
+  uint32_t results_chunk_size = 0;
+  // If non-zero, at most this many results are returned: the first ones in
+  // order_by order, or whichever are found first if that is None.
+  uint32_t limit = 0;
+  QueryOrder order_by = QueryOrder::None;
+  // If set, the query reports totals over the matching files rather than
+  // the files themselves.
+  std::optional<QueryAggregate> aggregate;
+  // If set, the names of the results are sent as one front coded string
+  // rather than as an array; see RenderResult::toFrontCodedNames().
+  bool front_coded_names = false;
+  // If true, the response explains how the query was answered: which
+  // generators ran, and the counts and time spent on each term.
+  bool explain = false;
+  // When explain is set, each term of the expression as it was written,
+  // nested terms included. TermStats are kept in this order.
+  std::vector<json_ref> explainTerms;
 
   /**
    * Optional full path to relative root, without and with trailing slash.
@@ -55,8 +125,17 @@ struct Query {
   w_string relative_root_slash;
 
   std::optional<std::vector<QueryPath>> paths;
+  // Set when paths was not given by the query but inferred from its
+  // expression. It then only narrows the walk when no other generator
+  // applies.
+  bool paths_from_expression = false;
 
-  std::unique_ptr<GlobTree> glob_tree;
+  // Set when no other generator applies and the expression can only match
+  // names with these suffixes, lowercased. Views that index names by suffix
+  // produce just those files instead of walking all of them.
+  std::optional<std::vector<w_string>> suffix_scope;
+
+  std::shared_ptr<GlobTree> glob_tree;
   // Additional flags to pass to wildmatch in the glob_generator
   int glob_flags = 0;
 
@@ -81,13 +160,19 @@ struct Query {
 
   uint32_t lock_timeout = 0;
 
+  // If set, the query stops generating and rendering results once it has
+  // run for this long. It then fails, or if partial_results is set, returns
+  // the results found so far and reports that it timed out.
+  std::optional<std::chrono::milliseconds> timeout;
+  bool partial_results = false;
+
   // We can't (and mustn't!) evaluate the clockspec
   // fully until we execute query, because we have
   // to evaluate named cursors and determine fresh
   // instance at the time we execute
-  std::unique_ptr<ClockSpec> since_spec;
+  std::shared_ptr<ClockSpec> since_spec;
 
-  std::unique_ptr<QueryExpr> expr;
+  std::shared_ptr<QueryExpr> expr;
 
   // The query that we parsed into this struct
   std::optional<json_ref> query_spec;
@@ -100,6 +185,14 @@ struct Query {
 
   bool alwaysIncludeDirectories{false};
 
+  // If the root sets vcs_ignore_crawl, the dirs that the VCS ignores within
+  // the scope of the query are crawled before it runs.
+  bool includeVcsIgnored{false};
+
+  Query() = default;
+  // Copies share glob_tree, since_spec and expr, none of which are modified
+  // in place after parsing; since_spec is replaced rather than updated.
+  Query(const Query&) = default;
   ~Query();
 
   /** Returns true if the supplied name is contained in
@@ -7,6 +7,11 @@
 
 #include "watchman/query/QueryContext.h"
 
+#include <algorithm>
+#include <limits>
+
+#include "watchman/Errors.h"
+#include "watchman/SlabAllocator.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -18,15 +23,42 @@ using namespace watchman;
 namespace {
 
 constexpr size_t kMaximumRenderBatchSize = 1024;
+constexpr size_t kFileResultSlabSize = 16 * 1024;
+
+// Makes room in v for count more elements, up to most, at least doubling it
+// when it has to grow, so that a generator that expects results for each of
+// many dirs doesn't reallocate for each one.
+template <typename T>
+void reserveMore(std::vector<T>& v, size_t count, size_t most) {
+  auto wanted = std::min(v.size() + count, most);
+  if (wanted > v.capacity()) {
+    v.reserve(std::max(wanted, std::min(2 * v.capacity(), most)));
+  }
+}
+
+template <typename T>
+void reserveMore(std::unordered_set<T>& set, size_t count, size_t most) {
+  auto wanted = std::min(set.size() + count, most);
+  auto room = size_t(set.bucket_count() * set.max_load_factor());
+  if (wanted > room) {
+    set.reserve(std::max(wanted, std::min(2 * room, most)));
+  }
+}
 
 std::optional<json_ref> file_result_to_json(
     const QueryFieldList& fieldList,
     const std::unique_ptr<FileResult>& file,
     const QueryContext* ctx) {
+  if (auto renderRow = fieldList.rowRenderer()) {
+    return renderRow(file.get(), ctx);
+  }
   if (fieldList.size() == 1) {
     return fieldList.front()->make(file.get(), ctx);
   }
-  std::unordered_map<w_string, json_ref> value;
+  // The values are held in field order rather than as an object; the
+  // template that renderResults() puts on the array names them, so that
+  // each row costs one vector instead of a map and a copy of every key.
+  std::vector<json_ref> value;
   value.reserve(fieldList.size());
 
   for (auto& f : fieldList) {
@@ -35,34 +67,48 @@ std::optional<json_ref> file_result_to_json(
       // Need data to be loaded
       return std::nullopt;
     }
-    value.insert_or_assign(f->name, std::move(ele.value()));
+    value.push_back(std::move(ele.value()));
   }
-  return json_object(std::move(value));
+  return json_array(std::move(value));
 }
 
 } // namespace
 
 void QueryContext::resetWholeName() {
-  wholename_.reset();
+  wholenameValid_ = false;
 }
 
-const w_string& QueryContext::getWholeName() {
-  if (!wholename_) {
-    wholename_ = computeWholeName(file.get());
+w_string_piece QueryContext::getWholeName(FileResult* f) {
+  if (!wholenameValid_ || wholenameFile_ != f) {
+    // Assigning into the same string reuses its capacity, so this only
+    // allocates when a name is longer than any before it.
+    wholename_.clear();
+    auto parent = f->dirName();
+    auto name_start = wholeNameStart();
+    if (name_start <= parent.size()) {
+      parent.advance(name_start);
+      wholename_.append(parent.data(), parent.size());
+      wholename_.push_back('/');
+    }
+    auto base = f->baseName();
+    wholename_.append(base.data(), base.size());
+    wholenameFile_ = f;
+    wholenameValid_ = true;
   }
   return wholename_;
 }
 
-w_string QueryContext::computeWholeName(FileResult* file) const {
-  uint32_t name_start;
-
+uint32_t QueryContext::wholeNameStart() const {
   if (query->relative_root) {
     // At this point every path should start with the relative root, so this is
     // legal
-    name_start = query->relative_root.size() + 1;
-  } else {
-    name_start = root->root_path.size() + 1;
+    return query->relative_root.size() + 1;
   }
+  return root->root_path.size() + 1;
+}
+
+w_string QueryContext::computeWholeName(FileResult* file) const {
+  auto name_start = wholeNameStart();
 
   // Record the name relative to the root
   auto parent = file->dirName();
@@ -112,7 +158,20 @@ QueryContext::QueryContext(
     : created(std::chrono::steady_clock::now()),
       query(q),
       root(root),
-      disableFreshInstance{disableFreshInstance} {}
+      disableFreshInstance{disableFreshInstance} {
+  termStats.resize(q->explainTerms.size());
+}
+
+QueryContext::~QueryContext() = default;
+
+SlabAllocator& QueryContext::getFileResultAllocator() {
+  if (!fileResultAllocator_) {
+    // Most queries produce a few results; the slabs are sized for them.
+    fileResultAllocator_ =
+        std::make_unique<SlabAllocator>(kFileResultSlabSize);
+  }
+  return *fileResultAllocator_;
+}
 
 void QueryContext::addToEvalBatch(std::unique_ptr<FileResult>&& file) {
   evalBatch_.emplace_back(std::move(file));
@@ -120,22 +179,64 @@ void QueryContext::addToEvalBatch(std::unique_ptr<FileResult>&& file) {
   // Find a balance between local memory usage, latency in fetching
   // and the cost of fetching the data needed to re-evaluate this batch.
   // TODO: maybe allow passing this number in via the query?
-  if (evalBatch_.size() >= 20480) {
+  if (!deferBatchFetches_ && evalBatch_.size() >= 20480) {
     fetchEvalBatchNow();
   }
 }
 
+void QueryContext::checkDeadline() const {
+  if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+    QueryTimeoutError::throwf(
+        "timed out after {}ms",
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            *query->timeout)
+            .count());
+  }
+}
+
+void QueryContext::noteGenerator(std::string_view name) {
+  if (query->explain) {
+    generators.push_back(name);
+  }
+}
+
+void QueryContext::expectResults(size_t count) {
+  if (query->expr || query->aggregate) {
+    return;
+  }
+  size_t most = std::numeric_limits<size_t>::max();
+  if (query->limit) {
+    most = query->limit;
+  }
+
+  if (query->order_by != QueryOrder::None) {
+    reserveMore(orderedResults_, count, most);
+  } else if (resultsChunkSink) {
+    reserveMore(
+        resultsArray,
+        count,
+        std::min(most, size_t(query->results_chunk_size)));
+  } else {
+    reserveMore(resultsArray, count, most);
+  }
+
+  if (query->dedup_results) {
+    reserveMore(dedupIdentities, count, most);
+    if (query->collect_deduped_names) {
+      reserveMore(dedup, count, most);
+    }
+  }
+}
+
 void QueryContext::fetchEvalBatchNow() {
   if (evalBatch_.empty()) {
     return;
   }
+  checkDeadline();
   evalBatch_.front()->batchFetchProperties(evalBatch_);
 
   auto toProcess = std::move(evalBatch_);
-
-  for (auto& file : toProcess) {
-    w_query_process_file(query, this, std::move(file));
-  }
+  w_query_process_files(query, this, toProcess);
 
   w_assert(evalBatch_.empty(), "should have no files that NeedDataLoad");
 }
@@ -152,17 +253,225 @@ RenderResult QueryContext::renderResults() {
 void QueryContext::maybeRender(std::unique_ptr<FileResult>&& file) {
   auto maybeRendered = file_result_to_json(query->fieldList, file, this);
   if (maybeRendered.has_value()) {
-    resultsArray.push_back(std::move(maybeRendered.value()));
+    addResult(std::move(maybeRendered.value()));
     return;
   }
 
   addToRenderBatch(std::move(file));
 }
 
+void QueryContext::addResult(json_ref&& result) {
+  if (query->limit && getNumResults() >= query->limit) {
+    return;
+  }
+  resultsArray.push_back(std::move(result));
+  if (resultsChunkSink && resultsArray.size() >= query->results_chunk_size) {
+    numResultsSent_ += resultsArray.size();
+    auto chunk = renderResults();
+    resultsArray.clear();
+    resultsChunkSink(std::move(chunk));
+  }
+}
+
+std::optional<QueryContext::OrderKey> QueryContext::getOrderKey() {
+  OrderKey key;
+  switch (query->order_by) {
+    case QueryOrder::None:
+      break;
+    case QueryOrder::Otime: {
+      auto otime = file->otime();
+      if (!otime.has_value()) {
+        return std::nullopt;
+      }
+      key.time = otime->ticks;
+      break;
+    }
+    case QueryOrder::Mtime: {
+      auto mtime = file->modifiedTime();
+      if (!mtime.has_value()) {
+        return std::nullopt;
+      }
+      key.time = int64_t(mtime->tv_sec) * 1000000000 + mtime->tv_nsec;
+      break;
+    }
+    case QueryOrder::Name:
+      key.name = getWholeName().asWString();
+      break;
+  }
+  return key;
+}
+
+bool QueryContext::ranksAhead(
+    const OrderedResult& a,
+    const OrderedResult& b) const {
+  if (query->order_by == QueryOrder::Name) {
+    return a.key.name.view() < b.key.name.view();
+  }
+  // Times rank most recent first.
+  return a.key.time > b.key.time;
+}
+
+void QueryContext::addOrderedResult(
+    std::unique_ptr<FileResult>&& file,
+    OrderKey&& key) {
+  OrderedResult result{std::move(key), std::move(file)};
+  size_t limit = query->limit;
+  if (limit == 0) {
+    orderedResults_.push_back(std::move(result));
+    return;
+  }
+
+  auto ranks = [this](const OrderedResult& a, const OrderedResult& b) {
+    return ranksAhead(a, b);
+  };
+  if (orderedResults_.size() < limit) {
+    orderedResults_.push_back(std::move(result));
+    std::push_heap(orderedResults_.begin(), orderedResults_.end(), ranks);
+    return;
+  }
+  if (!ranksAhead(result, orderedResults_.front())) {
+    return;
+  }
+  // Replace the lowest ranked result.
+  std::pop_heap(orderedResults_.begin(), orderedResults_.end(), ranks);
+  orderedResults_.back() = std::move(result);
+  std::push_heap(orderedResults_.begin(), orderedResults_.end(), ranks);
+}
+
+void QueryContext::renderOrderedResults() {
+  if (orderedResults_.empty()) {
+    return;
+  }
+  std::stable_sort(
+      orderedResults_.begin(),
+      orderedResults_.end(),
+      [this](const OrderedResult& a, const OrderedResult& b) {
+        return ranksAhead(a, b);
+      });
+
+  std::vector<std::unique_ptr<FileResult>> files;
+  files.reserve(orderedResults_.size());
+  for (auto& result : orderedResults_) {
+    files.push_back(std::move(result.file));
+  }
+  orderedResults_.clear();
+
+  // Anything that the fields still need is loaded for all of the files
+  // at once here rather than via the render batch, which would emit those
+  // files out of order.
+  std::vector<std::optional<json_ref>> rendered(files.size());
+  for (;;) {
+    bool complete = true;
+    for (size_t i = 0; i < files.size(); ++i) {
+      if (!rendered[i].has_value()) {
+        rendered[i] = file_result_to_json(query->fieldList, files[i], this);
+        complete = complete && rendered[i].has_value();
+      }
+    }
+    if (complete) {
+      break;
+    }
+    files.front()->batchFetchProperties(files);
+  }
+
+  for (auto& result : rendered) {
+    addResult(std::move(*result));
+  }
+}
+
+bool QueryContext::isLimitReachedInOtimeOrder() const {
+  if (query->limit == 0) {
+    return false;
+  }
+  switch (query->order_by) {
+    case QueryOrder::None:
+      return getNumResults() >= query->limit;
+    case QueryOrder::Otime:
+      return orderedResults_.size() >= query->limit;
+    default:
+      return false;
+  }
+}
+
+std::optional<int64_t> QueryContext::getAggregateSize() {
+  if (!query->aggregate->size) {
+    return 0;
+  }
+  auto size = file->size();
+  if (!size.has_value()) {
+    return std::nullopt;
+  }
+  return int64_t(*size);
+}
+
+void QueryContext::addToAggregate(int64_t size) {
+  aggregateTotals_.count += 1;
+  aggregateTotals_.size += size;
+
+  auto group_by = query->aggregate->group_by;
+  if (group_by == QueryAggregate::GroupBy::None) {
+    return;
+  }
+
+  auto name = getWholeName();
+  bool bySuffix = group_by == QueryAggregate::GroupBy::Suffix;
+  auto key = bySuffix ? name.suffix() : name.dirName();
+  if (!key.data()) {
+    key = w_string_piece{""};
+  }
+
+  // Files tend to arrive a directory at a time, so the group of the file
+  // before is checked before building a key to look up.
+  bool sameGroup = lastGroup_ &&
+      (bySuffix ? w_string_equal_caseless(key, lastGroupKey_)
+                : key == lastGroupKey_);
+  if (!sameGroup) {
+    lastGroupKey_ = bySuffix ? key.asLowerCase() : key.asWString();
+    lastGroup_ = &aggregateGroups_[lastGroupKey_];
+  }
+  lastGroup_->count += 1;
+  lastGroup_->size += size;
+}
+
+void QueryContext::addToAggregate(
+    int64_t count,
+    int64_t size,
+    w_string_piece dirName) {
+  aggregateTotals_.count += count;
+  aggregateTotals_.size += size;
+  if (query->aggregate->group_by == QueryAggregate::GroupBy::Dirname) {
+    auto& group = aggregateGroups_[dirName.asWString()];
+    group.count += count;
+    group.size += size;
+  }
+}
+
+json_ref QueryContext::renderAggregate() const {
+  bool withSize = query->aggregate->size;
+  auto render = [withSize](const AggregateTotals& totals) {
+    auto result = json_object({{"count", json_integer(totals.count)}});
+    if (withSize) {
+      result.set("size", json_integer(totals.size));
+    }
+    return result;
+  };
+
+  auto result = render(aggregateTotals_);
+  if (query->aggregate->group_by != QueryAggregate::GroupBy::None) {
+    std::unordered_map<w_string, json_ref> groups;
+    groups.reserve(aggregateGroups_.size());
+    for (const auto& [key, totals] : aggregateGroups_) {
+      groups.emplace(key, render(totals));
+    }
+    result.set("groups", json_object(std::move(groups)));
+  }
+  return result;
+}
+
 void QueryContext::addToRenderBatch(std::unique_ptr<FileResult>&& file) {
   renderBatch_.emplace_back(std::move(file));
   // TODO: maybe allow passing this number in via the query?
-  if (renderBatch_.size() >= kMaximumRenderBatchSize) {
+  if (!deferBatchFetches_ && renderBatch_.size() >= kMaximumRenderBatchSize) {
     fetchRenderBatchNow();
   }
 }
@@ -171,6 +480,7 @@ bool QueryContext::fetchRenderBatchNow() {
   if (renderBatch_.empty()) {
     return true;
   }
+  checkDeadline();
   renderBatch_.front()->batchFetchProperties(renderBatch_);
 
   auto toProcess = std::move(renderBatch_);
@@ -178,7 +488,7 @@ bool QueryContext::fetchRenderBatchNow() {
   for (auto& file : toProcess) {
     auto maybeRendered = file_result_to_json(query->fieldList, file, this);
     if (maybeRendered.has_value()) {
-      resultsArray.push_back(std::move(maybeRendered.value()));
+      addResult(std::move(maybeRendered.value()));
     } else {
       renderBatch_.emplace_back(std::move(file));
     }
@@ -186,3 +496,77 @@ bool QueryContext::fetchRenderBatchNow() {
 
   return renderBatch_.empty();
 }
+
+std::unique_ptr<QueryContext> QueryContext::makeWorkerContext() const {
+  auto worker = std::make_unique<QueryContext>(query, root, disableFreshInstance);
+  worker->clockAtStartOfQuery = clockAtStartOfQuery;
+  worker->lastAgeOutTickValueAtStartOfQuery = lastAgeOutTickValueAtStartOfQuery;
+  worker->since = since;
+  worker->deadline = deadline;
+  worker->deferBatchFetches_ = true;
+  return worker;
+}
+
+void QueryContext::mergeWorkerContext(QueryContext&& worker) {
+  numWalked_ += worker.numWalked_;
+  num_deduped += worker.num_deduped;
+  for (size_t i = 0; i < worker.termStats.size(); ++i) {
+    termStats[i] += worker.termStats[i];
+  }
+
+  if (!resultsChunkSink) {
+    resultsArray.reserve(resultsArray.size() + worker.resultsArray.size());
+  }
+  for (auto& result : worker.resultsArray) {
+    addResult(std::move(result));
+  }
+  worker.resultsArray.clear();
+
+  for (auto& result : worker.orderedResults_) {
+    addOrderedResult(std::move(result.file), std::move(result.key));
+  }
+  worker.orderedResults_.clear();
+
+  aggregateTotals_.count += worker.aggregateTotals_.count;
+  aggregateTotals_.size += worker.aggregateTotals_.size;
+  for (const auto& [key, totals] : worker.aggregateGroups_) {
+    auto& group = aggregateGroups_[key];
+    group.count += totals.count;
+    group.size += totals.size;
+  }
+  worker.aggregateGroups_.clear();
+  worker.lastGroup_ = nullptr;
+
+  dedupIdentities.insert(
+      worker.dedupIdentities.begin(), worker.dedupIdentities.end());
+  worker.dedupIdentities.clear();
+
+  for (auto& name : worker.dedup) {
+    dedup.insert(name);
+  }
+  worker.dedup.clear();
+
+  for (auto& name : worker.namesToLog) {
+    namesToLog.push_back(std::move(name));
+  }
+  worker.namesToLog.clear();
+
+  for (auto& file : worker.evalBatch_) {
+    addToEvalBatch(std::move(file));
+  }
+  worker.evalBatch_.clear();
+
+  for (auto& file : worker.renderBatch_) {
+    addToRenderBatch(std::move(file));
+  }
+  worker.renderBatch_.clear();
+
+  // This context now holds the worker's FileResults, which may outlive it.
+  if (worker.fileResultAllocator_) {
+    mergedAllocators_.push_back(std::move(worker.fileResultAllocator_));
+  }
+  for (auto& allocator : worker.mergedAllocators_) {
+    mergedAllocators_.push_back(std::move(allocator));
+  }
+  worker.mergedAllocators_.clear();
+}
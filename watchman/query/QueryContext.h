@@ -8,7 +8,12 @@
 #pragma once
 
 #include <folly/stop_watch.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include "watchman/Clock.h"
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/QueryResult.h"
@@ -20,10 +25,12 @@ namespace watchman {
 class FileResult;
 struct Query;
 class Root;
+class SlabAllocator;
 
 enum class QueryContextState {
   NotStarted,
   WaitingForCookieSync,
+  WaitingForAdmission,
   WaitingForViewLock,
   Generating,
   Rendering,
@@ -44,11 +51,28 @@ struct QueryContext : QueryContextBase {
   std::atomic<std::chrono::milliseconds> renderDuration{
       std::chrono::milliseconds(0)};
 
+  // When the first generator got the view lock, for the trace.
+  std::chrono::steady_clock::time_point generationStart;
+
   void generationStarted() {
     viewLockWaitDuration = stopWatch.lap();
+    if (generationStart == std::chrono::steady_clock::time_point{}) {
+      generationStart = std::chrono::steady_clock::now();
+    }
     state = QueryContextState::Generating;
+    // The sync and the wait for the view lock count against the timeout.
+    checkDeadline();
   }
 
+ private:
+  // Declared ahead of every member that holds a FileResult, so that the
+  // storage outlives them. Created by the first call to makeFileResult.
+  std::unique_ptr<SlabAllocator> fileResultAllocator_;
+  // Those of the worker contexts merged into this one, whose FileResults
+  // this context now holds.
+  std::vector<std::unique_ptr<SlabAllocator>> mergedAllocators_;
+
+ public:
   const Query* query;
   std::shared_ptr<Root> root;
   std::unique_ptr<FileResult> file;
@@ -57,8 +81,13 @@ struct QueryContext : QueryContextBase {
   // Rendered results
   std::vector<json_ref> resultsArray;
 
-  // When deduping the results, set<wholename> of
-  // the files held in results
+  // When deduping the results, the identities of the files held in results
+  // whose FileResult has one
+  std::unordered_set<const void*> dedupIdentities;
+
+  // When deduping the results, set<wholename> of the files held in results
+  // that have no identity, and of all of them if the query is set to
+  // collect_deduped_names
   std::unordered_set<w_string> dedup;
 
   // When unconditional_log_if_results_contain_file_prefixes is set
@@ -73,30 +102,89 @@ struct QueryContext : QueryContextBase {
   // Disable fresh instance queries
   bool disableFreshInstance{false};
 
+  // Only populated if the query is being explained: the generators that
+  // produced its files, in the order that they ran.
+  std::vector<std::string_view> generators;
+
+  // If set, resultsArray is handed to this each time it reaches the query's
+  // results_chunk_size, rather than holding every result until the end.
+  QueryResultsChunkSink resultsChunkSink;
+
+  // If set, the query's timeout_ms expires at this point. Generators notice
+  // as they walk files, through bumpNumWalked(), and so do the batch
+  // fetches.
+  std::optional<std::chrono::steady_clock::time_point> deadline;
+
   QueryContext(
       const Query* q,
       const std::shared_ptr<Root>& root,
       bool disableFreshInstance);
   QueryContext(const QueryContext&) = delete;
   QueryContext& operator=(const QueryContext&) = delete;
+  ~QueryContext();
+
+  /**
+   * Makes a FileResult for a generator to pass to w_query_process_file.
+   * Its storage comes from slabs that this context frees in bulk at the end
+   * of the query, and is recycled as earlier results are dropped, so a scan
+   * of millions of files doesn't pay for a malloc and free for each one.
+   * Only the thread that runs this context may call it.
+   */
+  template <typename T, typename... Args>
+  std::unique_ptr<T> makeFileResult(Args&&... args) {
+    return std::unique_ptr<T>{
+        new (getFileResultAllocator()) T(std::forward<Args>(args)...)};
+  }
 
   // Increment numWalked_ by the specified amount
   inline void bumpNumWalked(int64_t amount = 1) {
     numWalked_ += amount;
+    if (deadline) {
+      walkedSinceDeadlineCheck_ += amount;
+      if (walkedSinceDeadlineCheck_ >= kDeadlineCheckInterval) {
+        walkedSinceDeadlineCheck_ = 0;
+        checkDeadline();
+      }
+    }
   }
 
+  // Throws QueryTimeoutError if the deadline has passed.
+  void checkDeadline() const;
+
+  // Records that the named generator ran, if the query is being explained.
+  void noteGenerator(std::string_view name);
+
+  /**
+   * Called by a generator that is about to produce count files, so that the
+   * results can be sized for them up front rather than grown one
+   * reallocation at a time. Does nothing if the query has an expression, as
+   * then only some of them are expected to be results.
+   */
+  void expectResults(size_t count);
+
   int64_t getNumWalked() const {
     return numWalked_;
   }
 
+  // The number of results produced so far, including any that have already
+  // been handed to resultsChunkSink.
+  size_t getNumResults() const {
+    return numResultsSent_ + resultsArray.size();
+  }
+
   void resetWholeName();
 
   /**
-   * Returns a shared reference to the wholename
-   * of the file.  The caller must not delref
-   * the reference.
+   * Returns the wholename of f. It is built in a buffer that is reused from
+   * one file to the next, so the piece is only valid until the next call to
+   * resetWholeName() or for another file.
    */
-  const w_string& getWholeName() override;
+  w_string_piece getWholeName(FileResult* f) override;
+
+  // Returns the wholename of the current file.
+  w_string_piece getWholeName() {
+    return getWholeName(file.get());
+  }
 
   /**
    * Returns a JSON array containing the query results. Also returns an optional
@@ -114,11 +202,50 @@ struct QueryContext : QueryContextBase {
   void addToEvalBatch(std::unique_ptr<FileResult>&& file);
 
   // Perform an immediate fetch of data for the items in the
-  // evalBatch_ set, and then re-evaluate each of them by passing
-  // them to w_query_process_file().
+  // evalBatch_ set, and then re-evaluate them by passing them
+  // to w_query_process_files().
   void fetchEvalBatchNow();
 
   void maybeRender(std::unique_ptr<FileResult>&& file);
+
+  // The value by which a result is ranked for the query's order_by.
+  struct OrderKey {
+    int64_t time{0};
+    w_string name;
+  };
+
+  // Returns the order_by key of the current file, or std::nullopt if the
+  // data it needs has yet to be loaded.
+  std::optional<OrderKey> getOrderKey();
+
+  // Holds `file` back until generation is done, keeping only those that
+  // rank within the query's limit.
+  void addOrderedResult(std::unique_ptr<FileResult>&& file, OrderKey&& key);
+
+  // Renders the results held by addOrderedResult(), in order.
+  void renderOrderedResults();
+
+  /**
+   * Returns true if the query has a limit and this context already holds
+   * enough results that a generator producing files most recently changed
+   * first can stop.
+   */
+  bool isLimitReachedInOtimeOrder() const;
+
+  // Returns the size to add to the aggregate totals for the current file,
+  // or std::nullopt if it has yet to be loaded.
+  std::optional<int64_t> getAggregateSize();
+
+  // Counts the current file in the aggregate totals and its group.
+  void addToAggregate(int64_t size);
+
+  // Counts count files, of size bytes in total, in the aggregate totals and,
+  // if the query groups by dirname, in the group of dirName, which is
+  // relative to the relative root. Used by generators that keep totals.
+  void addToAggregate(int64_t count, int64_t size, w_string_piece dirName);
+
+  // Returns the aggregate totals in the form reported by the query.
+  json_ref renderAggregate() const;
   void addToRenderBatch(std::unique_ptr<FileResult>&& file);
 
   // Perform a batch load of the items in the render batch,
@@ -127,8 +254,24 @@ struct QueryContext : QueryContextBase {
   // the items, false if still more data is needed.
   bool fetchRenderBatchNow();
 
+  // Returns a copy of the wholename of file, for rendering.
   w_string computeWholeName(FileResult* file) const;
 
+  /**
+   * Creates a context that evaluates the same query, with the same evaluated
+   * since clause and clocks, for use by a generator running on another
+   * thread. The worker context never fetches its eval or render batches
+   * itself; those are handed back to this context by mergeWorkerContext() so
+   * that any blocking fetches happen on the query's own thread.
+   */
+  std::unique_ptr<QueryContext> makeWorkerContext() const;
+
+  /**
+   * Moves the results, pending batches and accounting of a worker context
+   * produced by makeWorkerContext() into this context.
+   */
+  void mergeWorkerContext(QueryContext&& worker);
+
   // Returns true if the filename associated with `f` matches
   // the relative_root constraint set on the query.
   // Delegates to dirMatchesRelativeRoot().
@@ -147,11 +290,57 @@ struct QueryContext : QueryContextBase {
   bool dirMatchesRelativeRoot(w_string_piece fullDirectoryPath);
 
  private:
-  w_string wholename_;
+  SlabAllocator& getFileResultAllocator();
+
+  // Returns the offset into the full path of a file's dir at which its
+  // wholename begins.
+  uint32_t wholeNameStart() const;
+
+  // Appends a rendered result, passing a full chunk to resultsChunkSink.
+  void addResult(json_ref&& result);
+
+  std::string wholename_;
+  // The file that wholename_ was built for
+  const FileResult* wholenameFile_{nullptr};
+  bool wholenameValid_{false};
 
   // Number of files considered as part of running this query
   int64_t numWalked_{0};
 
+  // Reading the clock for every file would be measurable, so the deadline
+  // is checked once per this many files walked.
+  static constexpr int64_t kDeadlineCheckInterval = 1024;
+  int64_t walkedSinceDeadlineCheck_{0};
+
+  // Number of results already handed to resultsChunkSink
+  size_t numResultsSent_{0};
+
+  struct OrderedResult {
+    OrderKey key;
+    std::unique_ptr<FileResult> file;
+  };
+
+  // Returns true if a ranks ahead of b in the query's order_by.
+  bool ranksAhead(const OrderedResult& a, const OrderedResult& b) const;
+
+  // When the query has an order_by; a heap with the lowest ranked result at
+  // the front if it also has a limit.
+  std::vector<OrderedResult> orderedResults_;
+
+  struct AggregateTotals {
+    int64_t count{0};
+    int64_t size{0};
+  };
+
+  AggregateTotals aggregateTotals_;
+  std::unordered_map<w_string, AggregateTotals> aggregateGroups_;
+  // The group of the last file added to the aggregate
+  w_string lastGroupKey_;
+  AggregateTotals* lastGroup_{nullptr};
+
+  // Set on contexts created by makeWorkerContext().
+  bool deferBatchFetches_{false};
+
   // Files for which we encountered NeedMoreData and that we
   // will re-evaluate once we have enough of them accumulated
   // to batch fetch the required data
@@ -7,7 +7,11 @@
 
 #pragma once
 
+#include <folly/lang/Bits.h>
+#include <chrono>
+#include <cstdint>
 #include <optional>
+#include <vector>
 #include "watchman/Clock.h"
 #include "watchman/watchman_string.h"
 
@@ -16,23 +20,175 @@ namespace watchman {
 using EvaluateResult = std::optional<bool>;
 class FileResult;
 
+/**
+ * How a term of a query that is being explained has fared so far.
+ */
+struct TermStats {
+  // Files that the term was evaluated against, counting again those that
+  // are re-evaluated once their data arrives.
+  uint64_t evaluated{0};
+  uint64_t matched{0};
+  uint64_t deferred{0};
+  // Including the time spent in the terms nested within it
+  std::chrono::nanoseconds duration{0};
+
+  TermStats& operator+=(const TermStats& other) {
+    evaluated += other.evaluated;
+    matched += other.matched;
+    deferred += other.deferred;
+    duration += other.duration;
+    return *this;
+  }
+};
+
 class QueryContextBase {
  public:
   // root number, ticks at start of query execution
   ClockSpec clockAtStartOfQuery;
   uint32_t lastAgeOutTickValueAtStartOfQuery;
 
+  // Only populated if the query is being explained: one entry for each of
+  // its terms, in the order of Query::explainTerms.
+  std::vector<TermStats> termStats;
+
   virtual ~QueryContextBase() = default;
 
   /**
-   * Returns the wholename of this query's current file.
+   * Returns the wholename of file, which need not be this query's current
+   * file, so that a batch of files can be evaluated together.
 
-   * Note: The wholename is lazily computed and the returned reference is valid
-   * until the next file is set.
+   * Note: The wholename is lazily computed and the returned piece is valid
+   * until the wholename of another file is requested.
    */
-  virtual const w_string& getWholeName() = 0;
+  virtual w_string_piece getWholeName(FileResult* file) = 0;
+};
+
+struct QueryPath {
+  w_string name;
+  int depth;
 };
 
+/**
+ * The expected cost of evaluating a term against one file, from cheapest to
+ * most expensive. The terms of allof and anyof are evaluated cheapest first,
+ * so that a cheap term can decide the result before an expensive one runs.
+ */
+enum class EvaluateCost {
+  // Decided without looking at the file.
+  Constant,
+  // Compares a field that views have on hand, such as the type or clock.
+  Field,
+  // Compares the name or a part of it against strings.
+  Name,
+  // Matches the name against a wildcard pattern.
+  Pattern,
+  // Matches the name against a regular expression.
+  Regex,
+  // Needs metadata, such as the size, that some views load on demand. The
+  // result may be deferred until the data arrives, so these run last.
+  Metadata,
+};
+
+/**
+ * A set of the files of a batch that is being evaluated, held as one bit per
+ * file in the order of the batch.
+ */
+class EvaluateMask {
+ public:
+  explicit EvaluateMask(size_t size, bool all = false)
+      : words_((size + kWordBits - 1) / kWordBits, all ? ~uint64_t{0} : 0) {
+    if (all && size % kWordBits) {
+      words_.back() >>= kWordBits - size % kWordBits;
+    }
+  }
+
+  bool test(size_t i) const {
+    return (words_[i / kWordBits] >> (i % kWordBits)) & 1;
+  }
+
+  void set(size_t i) {
+    words_[i / kWordBits] |= uint64_t{1} << (i % kWordBits);
+  }
+
+  bool any() const {
+    for (auto word : words_) {
+      if (word) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Returns the number of files in the set.
+  size_t count() const {
+    size_t n = 0;
+    for (auto word : words_) {
+      n += folly::popcount(word);
+    }
+    return n;
+  }
+
+  EvaluateMask& operator|=(const EvaluateMask& other) {
+    for (size_t i = 0; i < words_.size(); ++i) {
+      words_[i] |= other.words_[i];
+    }
+    return *this;
+  }
+
+  EvaluateMask& operator&=(const EvaluateMask& other) {
+    for (size_t i = 0; i < words_.size(); ++i) {
+      words_[i] &= other.words_[i];
+    }
+    return *this;
+  }
+
+  // Removes the files that are in other.
+  EvaluateMask& subtract(const EvaluateMask& other) {
+    for (size_t i = 0; i < words_.size(); ++i) {
+      words_[i] &= ~other.words_[i];
+    }
+    return *this;
+  }
+
+  // Calls func with the index of each file in the set, in order.
+  template <typename Func>
+  void forEach(Func&& func) const {
+    for (size_t i = 0; i < words_.size(); ++i) {
+      for (auto word = words_[i]; word; word &= word - 1) {
+        func(i * kWordBits + folly::findFirstSet(word) - 1);
+      }
+    }
+  }
+
+ private:
+  static constexpr size_t kWordBits = 64;
+  std::vector<uint64_t> words_;
+};
+
+/**
+ * Evaluates each file of a batch that is in active with eval, which takes a
+ * FileResult* and returns an EvaluateResult, recording the outcome in
+ * matched and deferred. Terms implement evaluateBatch() with this, passing a
+ * non-virtual call to their own evaluation, so that walking the batch
+ * doesn't dispatch once per file.
+ */
+template <typename Eval>
+void evaluateEach(
+    const std::vector<FileResult*>& files,
+    const EvaluateMask& active,
+    EvaluateMask& matched,
+    EvaluateMask& deferred,
+    Eval&& eval) {
+  active.forEach([&](size_t i) {
+    EvaluateResult res = eval(files[i]);
+    if (!res.has_value()) {
+      deferred.set(i);
+    } else if (*res) {
+      matched.set(i);
+    }
+  });
+}
+
 /**
  * Describes how terms are being aggregated.
  */
@@ -46,6 +202,22 @@ class QueryExpr {
   virtual ~QueryExpr() = default;
   virtual EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) = 0;
 
+  // Evaluates this expression against the files of a batch that are in
+  // active, adding each one that matches to matched, and each one whose
+  // result waits on data that has yet to be loaded to deferred. Both masks
+  // are passed in empty. Terms that are commonly evaluated over many files
+  // implement this natively; the rest are evaluated one file at a time.
+  virtual void evaluateBatch(
+      QueryContextBase* ctx,
+      const std::vector<FileResult*>& files,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask& deferred) {
+    evaluateEach(files, active, matched, deferred, [&](FileResult* file) {
+      return evaluate(ctx, file);
+    });
+  }
+
   // If OTHER can be aggregated with THIS, returns a new expression instance
   // representing the combined state.  Op provides information on the containing
   // query and can be used to determine how aggregation is done.
@@ -55,6 +227,41 @@ class QueryExpr {
       const AggregateOp /*op*/) const {
     return nullptr;
   }
+
+  // Returns the expected cost of evaluating this expression. Terms that
+  // don't say are assumed to be expensive.
+  virtual EvaluateCost cost() const {
+    return EvaluateCost::Metadata;
+  }
+
+  // If every file that this expression can match lies within a set of
+  // paths, returns them in the form of the query's "path" generator, so that
+  // a query that names no generator of its own can walk just those.
+  // Returns nullopt if the expression may match anywhere.
+  virtual std::optional<std::vector<QueryPath>> computePathScope() const {
+    return std::nullopt;
+  }
+
+  // If every file that this expression can match has a name ending in one
+  // of a set of suffixes, returns them lowercased and without the dot, so
+  // that a view with a suffix index can produce just those files. Returns
+  // nullopt if the expression may match other names.
+  virtual std::optional<std::vector<w_string>> computeSuffixScope() const {
+    return std::nullopt;
+  }
 };
 
+/**
+ * Returns paths without the entries that another entry already covers, so
+ * that the path generator produces each file once.
+ */
+std::vector<QueryPath> mergePathScopes(std::vector<QueryPath> paths);
+
+/**
+ * Returns true if path can be used as a path generator entry exactly as it
+ * is written in an expression: relative, with single forward slashes and no
+ * trailing slash.
+ */
+bool isPlainScopePath(w_string_piece path);
+
 } // namespace watchman
@@ -7,6 +7,9 @@
 
 #include "watchman/query/QueryResult.h"
 
+#include <string>
+#include <string_view>
+
 namespace watchman {
 
 json_ref RenderResult::toJson() && {
@@ -17,14 +20,52 @@ json_ref RenderResult::toJson() && {
   return arr;
 }
 
+json_ref RenderResult::toFrontCodedNames() && {
+  std::string packed;
+  // The previous name, which results still holds
+  std::string_view prev;
+  for (auto& result : results) {
+    auto name = result.asString().view();
+    auto rest = name;
+    auto prevRest = prev;
+
+    // Only whole directory components are shared, so that decoders can
+    // count them whether they see the names as bytes or as text.
+    size_t shared = 0;
+    for (auto slash = prevRest.find('/'); slash != std::string_view::npos;
+         slash = prevRest.find('/')) {
+      if (rest.size() <= slash || rest[slash] != '/' ||
+          rest.substr(0, slash) != prevRest.substr(0, slash)) {
+        break;
+      }
+      ++shared;
+      rest.remove_prefix(slash + 1);
+      prevRest.remove_prefix(slash + 1);
+    }
+
+    packed.append(std::to_string(shared));
+    packed.push_back(':');
+    packed.append(rest);
+    packed.push_back('\0');
+    prev = name;
+  }
+  results.clear();
+  return w_string_to_json(
+      w_string{packed.data(), packed.size(), W_STRING_BYTE});
+}
+
 json_ref QueryDebugInfo::render() const {
   std::vector<json_ref> arr;
   for (auto& fn : cookieFileNames) {
     arr.push_back(w_string_to_json(fn));
   }
-  return json_object({
+  auto debug = json_object({
       {"cookie_files", json_array(std::move(arr))},
   });
+  if (queuedTime) {
+    debug.set("queued_ms", json_integer(queuedTime->count()));
+  }
+  return debug;
 }
 
 } // namespace watchman
@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <optional>
 #include <unordered_set>
 #include <vector>
 #include "watchman/Clock.h"
@@ -17,25 +20,50 @@ namespace watchman {
 
 struct QueryDebugInfo {
   std::vector<w_string> cookieFileNames;
+  // How long the query waited for its turn among the root's queries, if it
+  // had to.
+  std::optional<std::chrono::milliseconds> queuedTime;
 
   json_ref render() const;
 };
 
 struct RenderResult {
+  // When templ is set, each result is an array of values in the order of
+  // the field names in templ. The encoders render those as objects.
   std::vector<json_ref> results;
   std::optional<json_ref> templ;
 
   json_ref toJson() &&;
+
+  /**
+   * Packs results that are names into a single string. Each name is
+   * written as the number of leading directory components that it shares
+   * with the name before it, in decimal, then a colon, then the rest of the
+   * name, then a NUL byte. As the NULs can't be carried by JSON, this is
+   * only for BSER responses.
+   */
+  json_ref toFrontCodedNames() &&;
 };
 
+// Receives the results of a query that sets results_chunk_size a chunk at a
+// time, as each chunk fills up. The last, partially filled chunk is left in
+// the QueryResult.
+using QueryResultsChunkSink = std::function<void(RenderResult&& chunk)>;
+
 struct QueryResult {
   bool isFreshInstance;
   RenderResult resultsArray;
-  // Only populated if the query was set to dedup_results
+  // Only populated if the query was set to collect_deduped_names
   std::unordered_set<w_string> dedupedFileNames;
   ClockSpec clockAtStartOfQuery;
   uint32_t stateTransCountAtStartOfQuery;
   std::optional<json_ref> savedStateInfo;
+  // Only populated if the query set aggregate, in place of resultsArray
+  std::optional<json_ref> aggregate;
+  // Set if the query ran out of time and returned partial results.
+  bool timedOut{false};
+  // Only populated if the query set explain
+  std::optional<json_ref> explain;
   QueryDebugInfo debugInfo;
 };
 
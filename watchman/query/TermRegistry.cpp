@@ -8,6 +8,7 @@
 #include "watchman/query/TermRegistry.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
+#include "watchman/query/Query.h"
 #include "watchman/query/QueryExpr.h"
 
 namespace watchman {
@@ -36,6 +37,73 @@ static struct Init {
   }
 } init;
 
+// Wraps each term of a query that is being explained, counting what the
+// term does in the TermStats that the query context keeps for it.
+class ExplainExpr : public QueryExpr {
+ public:
+  ExplainExpr(size_t index, std::unique_ptr<QueryExpr> inner)
+      : index_{index}, inner_{std::move(inner)} {}
+
+  EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
+    auto start = std::chrono::steady_clock::now();
+    auto res = inner_->evaluate(ctx, file);
+    auto& stats = ctx->termStats[index_];
+    stats.duration += std::chrono::steady_clock::now() - start;
+    ++stats.evaluated;
+    if (!res.has_value()) {
+      ++stats.deferred;
+    } else if (*res) {
+      ++stats.matched;
+    }
+    return res;
+  }
+
+  void evaluateBatch(
+      QueryContextBase* ctx,
+      const std::vector<FileResult*>& files,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask& deferred) override {
+    auto start = std::chrono::steady_clock::now();
+    inner_->evaluateBatch(ctx, files, active, matched, deferred);
+    auto& stats = ctx->termStats[index_];
+    stats.duration += std::chrono::steady_clock::now() - start;
+    stats.evaluated += active.count();
+    stats.matched += matched.count();
+    stats.deferred += deferred.count();
+  }
+
+  // The combined term is counted as this one; the other reports nothing.
+  std::unique_ptr<QueryExpr> aggregate(
+      const QueryExpr* other,
+      const AggregateOp op) const override {
+    if (auto* explained = dynamic_cast<const ExplainExpr*>(other)) {
+      other = explained->inner_.get();
+    }
+    auto combined = inner_->aggregate(other, op);
+    if (!combined) {
+      return nullptr;
+    }
+    return std::make_unique<ExplainExpr>(index_, std::move(combined));
+  }
+
+  EvaluateCost cost() const override {
+    return inner_->cost();
+  }
+
+  std::optional<std::vector<QueryPath>> computePathScope() const override {
+    return inner_->computePathScope();
+  }
+
+  std::optional<std::vector<w_string>> computeSuffixScope() const override {
+    return inner_->computeSuffixScope();
+  }
+
+ private:
+  size_t index_;
+  std::unique_ptr<QueryExpr> inner_;
+};
+
 } // namespace
 
 QueryExprParser getQueryExprParser(const w_string& name) {
@@ -68,7 +136,16 @@ std::unique_ptr<QueryExpr> parseQueryExpr(Query* query, const json_ref& exp) {
     throw QueryParseError("expected array or string for an expression");
   }
 
-  return getQueryExprParser(name)(query, exp);
+  auto parser = getQueryExprParser(name);
+  if (!query->explain) {
+    return parser(query, exp);
+  }
+
+  // Numbered before the nested terms are parsed, so that a term is listed
+  // ahead of those within it.
+  auto index = query->explainTerms.size();
+  query->explainTerms.push_back(exp);
+  return std::make_unique<ExplainExpr>(index, parser(query, exp));
 }
 
 } // namespace watchman
@@ -9,11 +9,59 @@
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
 #include <vector>
 
 using namespace watchman;
 
+namespace watchman {
+
+std::vector<QueryPath> mergePathScopes(std::vector<QueryPath> paths) {
+  // An unlimited entry covers itself and everything below it.
+  auto covers = [](const QueryPath& outer, const QueryPath& inner) {
+    if (outer.depth != -1) {
+      return false;
+    }
+    if (outer.name.empty() || outer.name == inner.name) {
+      return true;
+    }
+    auto prefix = outer.name.piece();
+    auto name = inner.name.piece();
+    return name.size() > prefix.size() && name.startsWith(prefix) &&
+        name.data()[prefix.size()] == '/';
+  };
+
+  std::vector<QueryPath> merged;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    bool redundant = false;
+    for (size_t j = 0; j < paths.size() && !redundant; ++j) {
+      if (i == j) {
+        continue;
+      }
+      auto& other = paths[j];
+      bool same = other.name == paths[i].name && other.depth == paths[i].depth;
+      // Of identical entries, keep the first.
+      redundant = same ? j < i : covers(other, paths[i]);
+    }
+    if (!redundant) {
+      merged.push_back(paths[i]);
+    }
+  }
+  return merged;
+}
+
+bool isPlainScopePath(w_string_piece path) {
+  if (path.empty() || path.data()[0] == '/' ||
+      path.data()[path.size() - 1] == '/' || path.contains("//")) {
+    return false;
+  }
+  return !memchr(path.data(), '\\', path.size());
+}
+
+} // namespace watchman
+
 /* Basic boolean and compound expressions */
 
 class NotExpr : public QueryExpr {
@@ -31,6 +79,22 @@ class NotExpr : public QueryExpr {
     return !*res;
   }
 
+  void evaluateBatch(
+      QueryContextBase* ctx,
+      const std::vector<FileResult*>& files,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask& deferred) override {
+    EvaluateMask innerMatched{files.size()};
+    expr->evaluateBatch(ctx, files, active, innerMatched, deferred);
+    matched = active;
+    matched.subtract(innerMatched).subtract(deferred);
+  }
+
+  EvaluateCost cost() const override {
+    return expr->cost();
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query* query, const json_ref& term) {
     /* rigidly require ["not", expr] */
     if (!term.isArray() || json_array_size(term) != 2) {
@@ -51,6 +115,19 @@ class TrueExpr : public QueryExpr {
     return true;
   }
 
+  void evaluateBatch(
+      QueryContextBase*,
+      const std::vector<FileResult*>&,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask&) override {
+    matched = active;
+  }
+
+  EvaluateCost cost() const override {
+    return EvaluateCost::Constant;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref&) {
     return std::make_unique<TrueExpr>();
   }
@@ -64,6 +141,25 @@ class FalseExpr : public QueryExpr {
     return false;
   }
 
+  void evaluateBatch(
+      QueryContextBase*,
+      const std::vector<FileResult*>&,
+      const EvaluateMask&,
+      EvaluateMask&,
+      EvaluateMask&) override {}
+
+  EvaluateCost cost() const override {
+    return EvaluateCost::Constant;
+  }
+
+  std::optional<std::vector<QueryPath>> computePathScope() const override {
+    return std::vector<QueryPath>{};
+  }
+
+  std::optional<std::vector<w_string>> computeSuffixScope() const override {
+    return std::vector<w_string>{};
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref&) {
     return std::make_unique<FalseExpr>();
   }
@@ -113,6 +209,113 @@ class ListExpr : public QueryExpr {
     return allof;
   }
 
+  // Runs each term over the files that it can still decide, and combines
+  // the results the way evaluate() does for one file.
+  void evaluateBatch(
+      QueryContextBase* ctx,
+      const std::vector<FileResult*>& files,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask& deferred) override {
+    // The files that the terms evaluated so far have neither matched, for
+    // anyof, nor failed to match, for allof.
+    EvaluateMask remaining = active;
+    EvaluateMask needData{files.size()};
+    EvaluateMask anyMatched{files.size()};
+
+    for (auto& expr : exprs) {
+      if (!remaining.any()) {
+        break;
+      }
+      EvaluateMask termMatched{files.size()};
+      EvaluateMask termDeferred{files.size()};
+      expr->evaluateBatch(ctx, files, remaining, termMatched, termDeferred);
+      needData |= termDeferred;
+
+      if (allof) {
+        remaining = termMatched;
+        remaining |= termDeferred;
+      } else {
+        remaining.subtract(termMatched);
+        anyMatched |= termMatched;
+      }
+    }
+
+    if (allof) {
+      // Every term matched, or is waiting on data
+      deferred = remaining;
+      deferred &= needData;
+      matched = remaining;
+      matched.subtract(needData);
+    } else {
+      matched = anyMatched;
+      deferred = needData;
+      deferred.subtract(anyMatched);
+    }
+  }
+
+  EvaluateCost cost() const override {
+    // Evaluation may reach the most expensive term.
+    auto cost = EvaluateCost::Constant;
+    for (auto& expr : exprs) {
+      cost = std::max(cost, expr->cost());
+    }
+    return cost;
+  }
+
+  std::optional<std::vector<QueryPath>> computePathScope() const override {
+    if (allof) {
+      // Every term must match, so any one of them bounds the results; use
+      // the one with the fewest paths.
+      std::optional<std::vector<QueryPath>> best;
+      for (auto& expr : exprs) {
+        auto scope = expr->computePathScope();
+        if (scope && (!best || scope->size() < best->size())) {
+          best = std::move(scope);
+        }
+      }
+      return best;
+    }
+
+    // A file may match any of the terms, so all of them must be bounded.
+    std::vector<QueryPath> paths;
+    for (auto& expr : exprs) {
+      auto scope = expr->computePathScope();
+      if (!scope) {
+        return std::nullopt;
+      }
+      paths.insert(paths.end(), scope->begin(), scope->end());
+    }
+    return mergePathScopes(std::move(paths));
+  }
+
+  std::optional<std::vector<w_string>> computeSuffixScope() const override {
+    if (allof) {
+      std::optional<std::vector<w_string>> best;
+      for (auto& expr : exprs) {
+        auto scope = expr->computeSuffixScope();
+        if (scope && (!best || scope->size() < best->size())) {
+          best = std::move(scope);
+        }
+      }
+      return best;
+    }
+
+    std::vector<w_string> suffixes;
+    for (auto& expr : exprs) {
+      auto scope = expr->computeSuffixScope();
+      if (!scope) {
+        return std::nullopt;
+      }
+      suffixes.insert(suffixes.end(), scope->begin(), scope->end());
+    }
+    // Each file is produced once for its suffix, so drop repeats.
+    std::sort(suffixes.begin(), suffixes.end());
+    suffixes.erase(
+        std::unique(suffixes.begin(), suffixes.end()), suffixes.end());
+    return suffixes;
+  }
+
   static std::unique_ptr<QueryExpr>
   parse(Query* query, const json_ref& term, bool allof) {
     std::vector<std::unique_ptr<QueryExpr>> list;
@@ -133,19 +336,29 @@ class ListExpr : public QueryExpr {
 
       auto op = allof ? AggregateOp::AllOf : AggregateOp::AnyOf;
       auto parsed = parseQueryExpr(query, exp);
-      if (list.empty()) {
-        list.emplace_back(std::move(parsed));
-      } else {
-        // Try to aggregate with previous expression
-        auto aggExpr = list.back().get()->aggregate(parsed.get(), op);
+      // Try to aggregate with an earlier expression. The terms have no side
+      // effects, so their order only affects which gets evaluated first, and
+      // terms of the same kind need not be adjacent.
+      bool aggregated = false;
+      for (auto it = list.rbegin(); it != list.rend(); ++it) {
+        auto aggExpr = (*it)->aggregate(parsed.get(), op);
         if (aggExpr) {
-          list.back() = std::move(aggExpr);
-        } else {
-          list.emplace_back(std::move(parsed));
+          *it = std::move(aggExpr);
+          aggregated = true;
+          break;
         }
       }
+      if (!aggregated) {
+        list.emplace_back(std::move(parsed));
+      }
     }
 
+    // Whichever term decides the result stops the evaluation, so try the
+    // cheapest first. Keep the given order among terms of equal cost.
+    std::stable_sort(list.begin(), list.end(), [](auto& a, auto& b) {
+      return a->cost() < b->cost();
+    });
+
     return std::make_unique<ListExpr>(allof, std::move(list));
   }
 
@@ -22,7 +22,7 @@ static inline bool is_dir_sep(int c) {
 class DirNameExpr : public QueryExpr {
   w_string dirname;
   struct w_query_int_compare depth;
-  using StartsWith = bool (*)(w_string_t* str, w_string_t* prefix);
+  using StartsWith = bool (w_string_piece::*)(w_string_piece prefix) const;
   StartsWith startswith;
 
  public:
@@ -32,8 +32,8 @@ class DirNameExpr : public QueryExpr {
       StartsWith startswith)
       : dirname(dirname), depth(depth), startswith(startswith) {}
 
-  EvaluateResult evaluate(QueryContextBase* ctx, FileResult*) override {
-    auto& str = ctx->getWholeName();
+  EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
+    auto str = ctx->getWholeName(file);
 
     if (str.size() <= dirname.size()) {
       // Either it doesn't prefix match, or file name is == dirname.
@@ -52,7 +52,7 @@ class DirNameExpr : public QueryExpr {
       return false;
     }
 
-    if (!startswith(str, dirname)) {
+    if (!(str.*startswith)(dirname)) {
       return false;
     }
 
@@ -68,6 +68,33 @@ class DirNameExpr : public QueryExpr {
     return eval_int_compare(actual_depth, &depth);
   }
 
+  void evaluateBatch(
+      QueryContextBase* ctx,
+      const std::vector<FileResult*>& files,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask& deferred) override {
+    evaluateEach(files, active, matched, deferred, [&](FileResult* file) {
+      return DirNameExpr::evaluate(ctx, file);
+    });
+  }
+
+  EvaluateCost cost() const override {
+    return EvaluateCost::Name;
+  }
+
+  std::optional<std::vector<QueryPath>> computePathScope() const override {
+    // The path generator resolves names case sensitively.
+    if (startswith != &w_string_piece::startsWith ||
+        !isPlainScopePath(dirname)) {
+      return std::nullopt;
+    }
+    // Only the direct children, if that is all the depth term allows.
+    bool childrenOnly = depth.operand == 0 &&
+        (depth.op == W_QUERY_ICMP_EQ || depth.op == W_QUERY_ICMP_LE);
+    return std::vector<QueryPath>{{dirname, childrenOnly ? 0 : -1}};
+  }
+
   // ["dirname", "foo"] -> ["dirname", "foo", ["depth", "ge", 0]]
   static std::unique_ptr<QueryExpr>
   parse(Query*, const json_ref& term, CaseSensitivity case_sensitive) {
@@ -119,8 +146,8 @@ class DirNameExpr : public QueryExpr {
         json_to_w_string(name),
         depth_comp,
         case_sensitive == CaseSensitivity::CaseInSensitive
-            ? w_string_startswith_caseless
-            : w_string_startswith);
+            ? &w_string_piece::startsWithCaseInsensitive
+            : &w_string_piece::startsWith);
   }
   static std::unique_ptr<QueryExpr> parseDirName(
       Query* query,
@@ -21,6 +21,10 @@ class ExistsExpr : public QueryExpr {
     return file->exists();
   }
 
+  EvaluateCost cost() const override {
+    return EvaluateCost::Metadata;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref&) {
     return std::make_unique<ExistsExpr>();
   }
@@ -56,6 +60,10 @@ class EmptyExpr : public QueryExpr {
     return false;
   }
 
+  EvaluateCost cost() const override {
+    return EvaluateCost::Metadata;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref&) {
     return std::make_unique<EmptyExpr>();
   }
@@ -7,14 +7,19 @@
 
 #include "watchman/query/eval.h"
 #include <fmt/chrono.h>
+#include <folly/Conv.h>
 #include <folly/ScopeGuard.h>
+#include "watchman/Client.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
+#include "watchman/LRUCache.h"
+#include "watchman/MaintenanceScheduler.h"
+#include "watchman/Metrics.h"
 #include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
+#include "watchman/Tracing.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/query/GlobTree.h"
-#include "watchman/query/LocalFileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
 #include "watchman/root/Root.h"
@@ -45,6 +50,181 @@ const std::vector<w_string>& getUnconditionalLogFilePrefixes() {
       computeUnconditionalLogFilePrefixes();
   return names;
 }
+
+// Tools that poll send the same query with the same since clock over and
+// over. Until something below the query's relative root changes, each of
+// those gets the same results, so the results of recent since queries are
+// kept along with the position of the last change that they reflect.
+struct CachedQueryResult {
+  ClockPosition lastChange;
+  RenderResult results;
+  std::optional<json_ref> aggregate;
+};
+
+using QueryResultCache =
+    LRUCache<std::string, std::shared_ptr<const CachedQueryResult>>;
+
+QueryResultCache* getQueryResultCache() {
+  // Leaked so that queries run during shutdown can still use it.
+  static auto* cache = []() -> QueryResultCache* {
+    auto size = Configuration().getInt("query_result_cache_size", 0);
+    if (size <= 0) {
+      return nullptr;
+    }
+    return new QueryResultCache(size, std::chrono::milliseconds(0));
+  }();
+  return cache;
+}
+
+// Returns the cache key for query, or nullopt if its results can't be
+// reused: those of queries that advance a named cursor, consult the SCM or
+// have their results streamed to the client as they are produced.
+std::optional<std::string> queryResultCacheKey(
+    const Query* query,
+    const std::shared_ptr<Root>& root) {
+  if (!query->use_result_cache || !query->since_spec ||
+      !query->query_spec || !query->query_spec->isObject() ||
+      std::holds_alternative<ClockSpec::NamedCursor>(
+          query->since_spec->spec) ||
+      query->since_spec->hasScmParams() || query->omit_changed_files ||
+      query->results_chunk_size > 0 || query->bench_iterations > 0) {
+    return std::nullopt;
+  }
+  std::unordered_map<w_string, json_ref> fields;
+  for (const auto& [name, value] : query->query_spec->object()) {
+    if (name == "request_id") {
+      continue;
+    }
+    fields.emplace(name, value);
+  }
+  return folly::to<std::string>(
+      root->root_path.view(),
+      '\0',
+      json_dumps(
+          json_object(std::move(fields)), JSON_COMPACT | JSON_SORT_KEYS));
+}
+
+// Since queries with a recent clock only look at the few files that changed
+// since, so they go in the cheap lane. A named cursor could be anywhere, so
+// those are treated as heavy.
+QueryAdmission::Lane queryAdmissionLane(
+    const Query* query,
+    const Root& root,
+    const ClockPosition& now) {
+  if (query->since_spec && !query->since_spec->hasScmParams()) {
+    if (auto* clock = std::get_if<ClockSpec::Clock>(&query->since_spec->spec)) {
+      if (clock->position.rootNumber == now.rootNumber &&
+          clock->position.ticks <= now.ticks &&
+          now.ticks - clock->position.ticks <= root.query_cheap_since_ticks) {
+        return QueryAdmission::Lane::Cheap;
+      }
+    }
+  }
+  return QueryAdmission::Lane::Heavy;
+}
+
+// The full paths that the query's generators look at, so that its sync only
+// writes cookies to the cookie dirs whose watches see them. Empty for the
+// whole root.
+std::vector<w_string> syncScope(const Query* query, const Root& root) {
+  const auto& base =
+      query->relative_root ? query->relative_root : root.root_path;
+  std::vector<w_string> scope;
+  if (query->paths) {
+    for (const auto& path : *query->paths) {
+      scope.push_back(
+          path.name.empty() ? base : w_string::pathCat({base, path.name}));
+    }
+  } else if (query->relative_root) {
+    scope.push_back(query->relative_root);
+  }
+  return scope;
+}
+
+bool isUnorderedLimitReached(const Query* query, QueryContext* ctx) {
+  // Without an order, the results that were found first are kept.
+  return query->order_by == QueryOrder::None && query->limit &&
+      ctx->getNumResults() >= query->limit;
+}
+
+// For fresh instances, only return files that currently exist. Returns
+// std::nullopt if that has yet to be loaded.
+// TODO: shift this clause to execute_common and generate
+// a wrapped query: ["allof", "exists", EXPR] and execute that
+// instead of query->expr so that the lazy evaluation logic can
+// be automatically applied and avoid fetching the exists flag
+// for every file.  See also related TODO in batchFetchNow.
+std::optional<bool> passesFreshInstanceFilter(
+    QueryContext* ctx,
+    FileResult* file) {
+  if (!ctx->disableFreshInstance &&
+      std::holds_alternative<QuerySince::Clock>(ctx->since.since) &&
+      std::get<QuerySince::Clock>(ctx->since.since).is_fresh_instance) {
+    return file->exists();
+  }
+  return true;
+}
+
+// Produces an output for ctx->file, which the expression has matched.
+void processMatchedFile(const Query* query, QueryContext* ctx) {
+  std::optional<int64_t> aggregateSize;
+  if (query->aggregate) {
+    aggregateSize = ctx->getAggregateSize();
+    if (!aggregateSize.has_value()) {
+      // Reconsider this one later
+      ctx->addToEvalBatch(std::move(ctx->file));
+      return;
+    }
+  }
+
+  std::optional<QueryContext::OrderKey> orderKey;
+  if (query->order_by != QueryOrder::None) {
+    orderKey = ctx->getOrderKey();
+    if (!orderKey.has_value()) {
+      // Reconsider this one later
+      ctx->addToEvalBatch(std::move(ctx->file));
+      return;
+    }
+  }
+
+  if (ctx->query->dedup_results) {
+    // Comparing identities spares building and hashing the name of every
+    // duplicate, which can be most of the files of a path or glob query.
+    bool inserted;
+    if (auto* identity = ctx->file->identity()) {
+      inserted = ctx->dedupIdentities.insert(identity).second;
+      if (inserted && ctx->query->collect_deduped_names) {
+        ctx->dedup.insert(ctx->getWholeName().asWString());
+      }
+    } else {
+      inserted = ctx->dedup.insert(ctx->getWholeName().asWString()).second;
+    }
+    if (!inserted) {
+      // Already present in the results, no need to emit it again
+      ctx->num_deduped++;
+      return;
+    }
+  }
+
+  auto logPrefixes = getUnconditionalLogFilePrefixes();
+  if (!logPrefixes.empty()) {
+    auto name = ctx->getWholeName();
+    for (auto& prefix : logPrefixes) {
+      if (name.startsWith(prefix)) {
+        ctx->namesToLog.push_back(name.asWString());
+      }
+    }
+  }
+
+  if (aggregateSize.has_value()) {
+    ctx->addToAggregate(*aggregateSize);
+  } else if (orderKey.has_value()) {
+    ctx->addOrderedResult(std::move(ctx->file), std::move(*orderKey));
+  } else {
+    ctx->maybeRender(std::move(ctx->file));
+  }
+}
+
 } // namespace
 
 /* Query evaluator */
@@ -52,6 +232,10 @@ void w_query_process_file(
     const Query* query,
     QueryContext* ctx,
     std::unique_ptr<FileResult> file) {
+  if (isUnorderedLimitReached(query, ctx)) {
+    return;
+  }
+
   // TODO: Should this be implicit by assigning a file to the QueryContext? It
   // could be cleared when resetting the file.
   ctx->resetWholeName();
@@ -60,24 +244,14 @@ void w_query_process_file(
     ctx->file.reset();
   };
 
-  // For fresh instances, only return files that currently exist
-  // TODO: shift this clause to execute_common and generate
-  // a wrapped query: ["allof", "exists", EXPR] and execute that
-  // instead of query->expr so that the lazy evaluation logic can
-  // be automatically applied and avoid fetching the exists flag
-  // for every file.  See also related TODO in batchFetchNow.
-  if (!ctx->disableFreshInstance &&
-      std::holds_alternative<QuerySince::Clock>(ctx->since.since) &&
-      std::get<QuerySince::Clock>(ctx->since.since).is_fresh_instance) {
-    auto exists = ctx->file->exists();
-    if (!exists.has_value()) {
-      // Reconsider this one later
-      ctx->addToEvalBatch(std::move(ctx->file));
-      return;
-    }
-    if (!exists.value()) {
-      return;
-    }
+  auto exists = passesFreshInstanceFilter(ctx, ctx->file.get());
+  if (!exists.has_value()) {
+    // Reconsider this one later
+    ctx->addToEvalBatch(std::move(ctx->file));
+    return;
+  }
+  if (!exists.value()) {
+    return;
   }
 
   // We produce an output for this file if there is no expression,
@@ -94,28 +268,65 @@ void w_query_process_file(
     }
   }
 
-  if (ctx->query->dedup_results) {
-    auto name = ctx->getWholeName();
+  processMatchedFile(query, ctx);
+}
 
-    auto inserted = ctx->dedup.insert(name);
-    if (!inserted.second) {
-      // Already present in the results, no need to emit it again
-      ctx->num_deduped++;
-      return;
+void w_query_process_files(
+    const Query* query,
+    QueryContext* ctx,
+    std::vector<std::unique_ptr<FileResult>>& files) {
+  SCOPE_EXIT {
+    files.clear();
+  };
+  if (!query->expr || files.size() == 1) {
+    for (auto& file : files) {
+      w_query_process_file(query, ctx, std::move(file));
     }
+    return;
+  }
+  if (isUnorderedLimitReached(query, ctx)) {
+    return;
   }
 
-  auto logPrefixes = getUnconditionalLogFilePrefixes();
-  if (!logPrefixes.empty()) {
-    auto name = ctx->getWholeName();
-    for (auto& prefix : logPrefixes) {
-      if (name.piece().startsWith(prefix)) {
-        ctx->namesToLog.push_back(name);
-      }
+  std::vector<FileResult*> batch;
+  batch.reserve(files.size());
+  EvaluateMask active{files.size()};
+  for (size_t i = 0; i < files.size(); ++i) {
+    batch.push_back(files[i].get());
+    auto exists = passesFreshInstanceFilter(ctx, files[i].get());
+    if (!exists.has_value()) {
+      // Reconsider this one later
+      ctx->addToEvalBatch(std::move(files[i]));
+    } else if (exists.value()) {
+      active.set(i);
     }
   }
 
-  ctx->maybeRender(std::move(ctx->file));
+  // A file of this batch may have been allocated where one that was
+  // evaluated before it used to be.
+  ctx->resetWholeName();
+  EvaluateMask matched{files.size()};
+  EvaluateMask deferred{files.size()};
+  query->expr->evaluateBatch(ctx, batch, active, matched, deferred);
+
+  auto decided = matched;
+  decided |= deferred;
+  decided.forEach([&](size_t i) {
+    if (deferred.test(i)) {
+      // Reconsider this one later
+      ctx->addToEvalBatch(std::move(files[i]));
+      return;
+    }
+    if (isUnorderedLimitReached(query, ctx)) {
+      return;
+    }
+    ctx->resetWholeName();
+    ctx->file = std::move(files[i]);
+    SCOPE_EXIT {
+      ctx->file.reset();
+    };
+    processMatchedFile(query, ctx);
+  });
 }
 
 void time_generator(
@@ -133,33 +344,117 @@ static void default_generators(
 
   // Time based query
   if (ctx->since.is_timestamp() || !ctx->since.is_fresh_instance()) {
+    ctx->noteGenerator("since");
     time_generator(query, root, ctx);
     generated = true;
   }
 
-  if (query->paths.has_value()) {
+  // Paths inferred from the expression only stand in for walking all files.
+  if (query->paths.has_value() &&
+      !(generated && query->paths_from_expression)) {
+    ctx->noteGenerator("path");
     root->view()->pathGenerator(query, ctx);
     generated = true;
   }
 
   if (query->glob_tree) {
+    ctx->noteGenerator("glob");
     root->view()->globGenerator(query, ctx);
     generated = true;
   }
 
   // And finally, if there were no other generators, we walk all known
-  // files
+  // files, or those with the suffixes that the expression is limited to.
   if (!generated) {
-    root->view()->allFilesGenerator(query, ctx);
+    if (query->suffix_scope) {
+      ctx->noteGenerator("suffix");
+      root->view()->suffixGenerator(query, ctx);
+    } else if (
+        query->aggregate && !query->expr && !ctx->disableFreshInstance &&
+        getUnconditionalLogFilePrefixes().empty() &&
+        root->view()->dirTotalsGenerator(query, ctx)) {
+      // Every existing file below the relative root matches, so the totals
+      // that the view keeps answer it without walking them.
+      ctx->noteGenerator("dir_totals");
+    } else {
+      ctx->noteGenerator("all");
+      root->view()->allFilesGenerator(query, ctx);
+    }
   }
 }
 
+// Aggregates the phase durations that QueryDebugInfo reports per query.
+static void record_query_metrics(const QueryContext& ctx) {
+  static auto& cookieSync = getHistogram(
+      "watchman_query_cookie_sync_ms",
+      "Time that queries spent waiting for cookies to sync");
+  static auto& viewLockWait = getHistogram(
+      "watchman_query_view_lock_wait_ms",
+      "Time that queries spent waiting for the view lock");
+  static auto& generation = getHistogram(
+      "watchman_query_generation_ms", "Time that queries spent generating");
+  static auto& render = getHistogram(
+      "watchman_query_render_ms", "Time that queries spent rendering");
+
+  if (ctx.query->sync_timeout.count()) {
+    cookieSync.record(ctx.cookieSyncDuration.load().count());
+  }
+  viewLockWait.record(ctx.viewLockWaitDuration.load().count());
+  generation.record(ctx.generationDuration.load().count());
+  render.record(ctx.renderDuration.load().count());
+}
+
+static json_ref milliseconds_to_json(
+    const std::atomic<std::chrono::milliseconds>& duration) {
+  return json_integer(duration.load().count());
+}
+
+// Describes how the query was answered, for a query that sets explain.
+static json_ref render_explain(const QueryContext& ctx) {
+  std::vector<json_ref> generators;
+  for (auto name : ctx.generators) {
+    generators.push_back(typed_string_to_json(name));
+  }
+
+  std::vector<json_ref> terms;
+  for (size_t i = 0; i < ctx.termStats.size(); ++i) {
+    const auto& stats = ctx.termStats[i];
+    auto selectivity = stats.evaluated
+        ? double(stats.matched) / double(stats.evaluated)
+        : 0.0;
+    terms.push_back(json_object(
+        {{"term", ctx.query->explainTerms[i]},
+         {"evaluated", json_integer(stats.evaluated)},
+         {"matched", json_integer(stats.matched)},
+         {"deferred", json_integer(stats.deferred)},
+         {"selectivity", json_real(selectivity)},
+         {"time_us",
+          json_integer(
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                  stats.duration)
+                  .count())}}));
+  }
+
+  return json_object(
+      {{"generators", json_array(std::move(generators))},
+       {"files_walked", json_integer(ctx.getNumWalked())},
+       {"files_matched", json_integer(ctx.getNumResults())},
+       {"files_deduped", json_integer(ctx.num_deduped)},
+       {"terms", json_array(std::move(terms))},
+       {"cookie_sync_ms", milliseconds_to_json(ctx.cookieSyncDuration)},
+       {"view_lock_wait_ms", milliseconds_to_json(ctx.viewLockWaitDuration)},
+       {"generation_ms", milliseconds_to_json(ctx.generationDuration)},
+       {"render_ms", milliseconds_to_json(ctx.renderDuration)}});
+}
+
 static void execute_common(
     QueryContext* ctx,
     PerfSample* sample,
     QueryResult* res,
     QueryGenerator generator) {
   ctx->stopWatch.reset();
+  auto start = std::chrono::steady_clock::now();
+  auto generationEnd = start;
 
   if (ctx->query->dedup_results) {
     ctx->dedup.reserve(64);
@@ -171,27 +466,68 @@ static void execute_common(
     res->isFreshInstance = since_clock && since_clock->is_fresh_instance;
   }
 
-  if (!(res->isFreshInstance && ctx->query->empty_on_fresh_instance)) {
-    if (!generator) {
-      generator = default_generators;
+  try {
+    if (!(res->isFreshInstance && ctx->query->empty_on_fresh_instance)) {
+      if (!generator) {
+        generator = default_generators;
+      }
+      generator(ctx->query, ctx->root, ctx);
+    }
+    ctx->generationDuration = ctx->stopWatch.lap();
+    generationEnd = std::chrono::steady_clock::now();
+    ctx->state = QueryContextState::Rendering;
+
+    // We may have some file results pending re-evaluation,
+    // so make sure that we process them before we get to
+    // the render phase below.
+    ctx->fetchEvalBatchNow();
+    ctx->renderOrderedResults();
+    while (!ctx->fetchRenderBatchNow()) {
+      // Depending on the implementation of the query terms and
+      // the field renderers, we may need to do a couple of fetches
+      // to get all that we need, so we loop until we get them all.
+    }
+  } catch (const QueryTimeoutError&) {
+    if (!ctx->query->partial_results) {
+      throw;
+    }
+    // Keep what has been rendered so far; files still waiting on data are
+    // left out.
+    res->timedOut = true;
+    ctx->state = QueryContextState::Rendering;
+    if (generationEnd == start) {
+      generationEnd = std::chrono::steady_clock::now();
     }
-    generator(ctx->query, ctx->root, ctx);
-  }
-  ctx->generationDuration = ctx->stopWatch.lap();
-  ctx->state = QueryContextState::Rendering;
-
-  // We may have some file results pending re-evaluation,
-  // so make sure that we process them before we get to
-  // the render phase below.
-  ctx->fetchEvalBatchNow();
-  while (!ctx->fetchRenderBatchNow()) {
-    // Depending on the implementation of the query terms and
-    // the field renderers, we may need to do a couple of fetches
-    // to get all that we need, so we loop until we get them all.
   }
 
   ctx->renderDuration = ctx->stopWatch.lap();
   ctx->state = QueryContextState::Completed;
+  // Benchmark iterations, which have no sample, would skew the metrics.
+  if (sample) {
+    record_query_metrics(*ctx);
+  }
+  {
+    auto traceId = ctx->root->traceId;
+    auto generationStart = start;
+    if (ctx->generationStart != std::chrono::steady_clock::time_point{}) {
+      generationStart = ctx->generationStart;
+      recordSpan("view_lock_wait", traceId, start, generationStart);
+    }
+    recordSpan("generate", traceId, generationStart, generationEnd);
+    recordSpan(
+        "render", traceId, generationEnd, std::chrono::steady_clock::now());
+
+    // The generators hold the view lock while they run.
+    auto* usage = ClientUsage::current();
+    if (usage && sample) {
+      ClientUsage::add(usage->queries, 1);
+      ClientUsage::add(
+          usage->viewLockMicros,
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              generationEnd - generationStart)
+              .count());
+    }
+  }
 
   // For Eden instances it is possible that when running the query it was
   // discovered that it is actually a fresh instance [e.g. mount generation
@@ -225,7 +561,7 @@ static void execute_common(
     auto meta = json_object({
         {"fresh_instance", json_boolean(res->isFreshInstance)},
         {"num_deduped", json_integer(ctx->num_deduped)},
-        {"num_results", json_integer(ctx->resultsArray.size())},
+        {"num_results", json_integer(ctx->getNumResults())},
         {"num_walked", json_integer(ctx->getNumWalked())},
     });
     if (ctx->query->query_spec) {
@@ -235,8 +571,16 @@ static void execute_common(
     sample->log();
   }
 
+  if (ctx->query->explain) {
+    res->explain = render_explain(*ctx);
+  }
+  if (ctx->query->aggregate) {
+    res->aggregate = ctx->renderAggregate();
+  }
   res->resultsArray = ctx->renderResults();
-  res->dedupedFileNames = std::move(ctx->dedup);
+  if (ctx->query->collect_deduped_names) {
+    res->dedupedFileNames = std::move(ctx->dedup);
+  }
 }
 
 // Capability indicating support for scm-aware since queries
@@ -246,11 +590,20 @@ QueryResult w_query_execute(
     const Query* query,
     const std::shared_ptr<Root>& root,
     QueryGenerator generator,
-    SavedStateFactory savedStateFactory) {
+    SavedStateFactory savedStateFactory,
+    QueryResultsChunkSink resultsChunkSink) {
+  TraceScope span{"query", root->traceId};
   QueryResult res;
   ClockSpec resultClock(ClockPosition{});
   bool disableFreshInstance{false};
   auto requestId = query->request_id;
+  getMaintenanceScheduler().noteQuery();
+
+  // An explained query has to run to be explained.
+  auto resultCache =
+      generator || query->explain ? nullptr : getQueryResultCache();
+  auto cacheKey =
+      resultCache ? queryResultCacheKey(query, root) : std::nullopt;
 
   PerfSample sample("query_execute");
   if (requestId && !requestId.empty()) {
@@ -280,6 +633,11 @@ QueryResult w_query_execute(
       resultClock.savedStateStorageType =
           query->since_spec->savedStateStorageType;
       resultClock.savedStateConfig = query->since_spec->savedStateConfig;
+      root->view()->noteSavedStateLookup(SavedStateLookup{
+          savedStateFactory,
+          resultClock.scmMergeBaseWith,
+          query->since_spec->savedStateStorageType,
+          query->since_spec->savedStateConfig.value()});
     }
 
     if (resultClock.scmMergeBase != query->since_spec->scmMergeBase) {
@@ -334,24 +692,8 @@ QueryResult w_query_execute(
                   modifiedMergebase, position.toClockString(), requestId);
 
           ClockStamp clock{position.ticks, ::time(nullptr)};
-          for (const auto& path : changedFiles) {
-            auto fullPath = w_string::pathCat({r->root_path, path});
-            if (!c->fileMatchesRelativeRoot(fullPath)) {
-              continue;
-            }
-            // Note well!  At the time of writing the LocalFileResult class
-            // assumes that removed entries must have been regular files.
-            // We don't have enough information returned from
-            // getFilesChangedSinceMergeBaseWith() to distinguish between
-            // deleted files and deleted symlinks.  Also, it is not possible
-            // to see a directory returned from that call; we're only going
-            // to enumerate !dirs for this case.
-            w_query_process_file(
-                q,
-                c,
-                std::make_unique<LocalFileResult>(
-                    fullPath, clock, r->case_sensitive));
-          }
+          c->noteGenerator("scm");
+          r->view()->scmChangedFilesGenerator(q, c, changedFiles, clock);
         };
       } else if (query->fail_if_no_saved_state) {
         throw QueryExecError(
@@ -398,7 +740,8 @@ QueryResult w_query_execute(
     ctx.state = QueryContextState::WaitingForCookieSync;
     ctx.stopWatch.reset();
     try {
-      auto result = root->syncToNow(query->sync_timeout);
+      auto result =
+          root->syncToNow(query->sync_timeout, syncScope(query, *root));
       res.debugInfo.cookieFileNames = std::move(result.cookieFileNames);
     } catch (const std::exception& exc) {
       QueryExecError::throwf("synchronization failed: {}", exc.what());
@@ -432,9 +775,54 @@ QueryResult w_query_execute(
   ctx.since = query->since_spec ? query->since_spec->evaluate(
                                       ctx.clockAtStartOfQuery.position(),
                                       ctx.lastAgeOutTickValueAtStartOfQuery,
-                                      &root->inner.cursors)
+                                      &root->inner.cursors,
+                                      root->view()->getClockPredecessor())
                                 : QuerySince{};
 
+  if (query->timeout) {
+    ctx.deadline = ctx.created + *query->timeout;
+  }
+
+  // Read after the clock, so that a change made in between is seen here and
+  // prevents an earlier result from being reused with the newer clock.
+  std::optional<ClockPosition> lastChange;
+  auto* sinceClock = std::get_if<QuerySince::Clock>(&ctx.since.since);
+  if (cacheKey && !(sinceClock && sinceClock->is_fresh_instance)) {
+    lastChange = root->view()->getLastChangePosition(
+        query->relative_root ? query->relative_root : root->root_path);
+  }
+  if (lastChange) {
+    if (auto node = resultCache->get(*cacheKey)) {
+      const auto& cached = *node->value();
+      if (cached.lastChange.rootNumber == lastChange->rootNumber &&
+          cached.lastChange.ticks == lastChange->ticks) {
+        res.isFreshInstance = false;
+        res.resultsArray = cached.results;
+        res.aggregate = cached.aggregate;
+        return res;
+      }
+    }
+  }
+
+  // Answered from the cache above without waiting, as a cached result is
+  // even cheaper than a cheap query.
+  QueryAdmission::Ticket admission;
+  if (query->use_admission) {
+    ctx.state = QueryContextState::WaitingForAdmission;
+    ctx.stopWatch.reset();
+    admission = root->queryAdmission.admit(
+        queryAdmissionLane(query, *root, ctx.clockAtStartOfQuery.position()),
+        query->clientPid,
+        ctx.deadline.value_or(std::chrono::steady_clock::time_point::max()));
+    if (!admission) {
+      ctx.checkDeadline();
+    }
+    auto queued = ctx.stopWatch.lap();
+    if (queued.count() > 0) {
+      res.debugInfo.queuedTime = queued;
+    }
+  }
+
   if (query->bench_iterations > 0) {
     for (uint32_t i = 0; i < query->bench_iterations; ++i) {
       QueryContext c{query, root, ctx.disableFreshInstance};
@@ -445,7 +833,18 @@ QueryResult w_query_execute(
     }
   }
 
+  if (query->results_chunk_size > 0) {
+    ctx.resultsChunkSink = std::move(resultsChunkSink);
+  }
   execute_common(&ctx, &sample, &res, generator);
+
+  // Fresh instance results list every file, so are too large to keep.
+  if (lastChange && !res.isFreshInstance && !res.timedOut) {
+    resultCache->set(
+        *cacheKey,
+        std::make_shared<const CachedQueryResult>(CachedQueryResult{
+            *lastChange, res.resultsArray, res.aggregate}));
+  }
   return res;
 }
 
@@ -9,6 +9,7 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 #include "watchman/query/FileResult.h"
 #include "watchman/query/QueryResult.h"
 #include "watchman/saved_state/SavedStateInterface.h"
@@ -33,12 +34,16 @@ using QueryGenerator = std::function<void(
  *
  * savedStateFactory allows testing this function without pulling in a wide
  * set of dependencies.
+ *
+ * If the query sets results_chunk_size, resultsChunkSink is handed the
+ * results as each chunk fills; the rest are returned as usual.
  */
 watchman::QueryResult w_query_execute(
     const watchman::Query* query,
     const std::shared_ptr<watchman::Root>& root,
     watchman::QueryGenerator generator,
-    watchman::SavedStateFactory savedStateFactory);
+    watchman::SavedStateFactory savedStateFactory,
+    watchman::QueryResultsChunkSink resultsChunkSink = nullptr);
 
 // Allows a generator to process a file node
 // through the query engine
@@ -47,6 +52,47 @@ void w_query_process_file(
     watchman::QueryContext* ctx,
     std::unique_ptr<watchman::FileResult> file);
 
+// Processes a batch of files as w_query_process_file() does, evaluating the
+// query's expression over all of them at once. Leaves files empty.
+void w_query_process_files(
+    const watchman::Query* query,
+    watchman::QueryContext* ctx,
+    std::vector<std::unique_ptr<watchman::FileResult>>& files);
+
+namespace watchman {
+
+/**
+ * Collects the files that a generator produces and passes them to
+ * w_query_process_files() a batch at a time. The files must remain valid
+ * until they are processed, so a generator calls flush() before it releases
+ * the view lock that they were produced under.
+ */
+class QueryFileBatch {
+ public:
+  QueryFileBatch(const Query* query, QueryContext* ctx)
+      : query_(query), ctx_(ctx) {}
+
+  void add(std::unique_ptr<FileResult> file) {
+    files_.push_back(std::move(file));
+    if (files_.size() >= kBatchSize) {
+      flush();
+    }
+  }
+
+  void flush() {
+    w_query_process_files(query_, ctx_, files_);
+  }
+
+ private:
+  static constexpr size_t kBatchSize = 1024;
+
+  const Query* query_;
+  QueryContext* ctx_;
+  std::vector<std::unique_ptr<FileResult>> files_;
+};
+
+} // namespace watchman
+
 void time_generator(
     const watchman::Query* query,
     const std::shared_ptr<watchman::Root>& root,
@@ -28,14 +28,17 @@ std::optional<json_ref> make_symlink(FileResult* file, const QueryContext*) {
   return *target ? w_string_to_json(*target) : json_null();
 }
 
-std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
+// Renders the hash returned by getHash as lowercase hex
+template <typename GetHash>
+std::optional<json_ref> make_content_hex(GetHash getHash) {
   try {
-    auto hash = file->getContentSha1();
+    auto hash = getHash();
     if (!hash.has_value()) {
       // Need to load it still
       return std::nullopt;
     }
-    char buf[40];
+    using Hash = typename decltype(hash)::value_type;
+    char buf[2 * std::tuple_size_v<Hash>];
     static const char* hexDigit = "0123456789abcdef";
     for (size_t i = 0; i < hash->size(); ++i) {
       auto& digit = (*hash)[i];
@@ -62,6 +65,16 @@ std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
   }
 }
 
+std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
+  return make_content_hex([file] { return file->getContentSha1(); });
+}
+
+std::optional<json_ref> make_spooky128_hex(
+    FileResult* file,
+    const QueryContext*) {
+  return make_content_hex([file] { return file->getContentSpooky128(); });
+}
+
 std::optional<json_ref> make_size(FileResult* file, const QueryContext*) {
   auto size = file->size();
   if (!size.has_value()) {
@@ -289,6 +302,7 @@ std::unordered_map<w_string, QueryFieldRenderer> build_defs() {
       {"cclock", make_cclock},
       {"type", make_type_field},
       {"content.sha1hex", make_sha1_hex},
+      {"content.spooky128hex", make_spooky128_hex},
   };
   std::unordered_map<w_string, QueryFieldRenderer> map;
   for (auto& def : defs) {
@@ -306,6 +320,65 @@ std::unordered_map<w_string, QueryFieldRenderer>& field_defs() {
   return map;
 }
 
+using FieldMaker =
+    std::optional<json_ref> (*)(FileResult* file, const QueryContext* ctx);
+
+// Appends a field to a row, returning false if it needs data to be loaded.
+template <FieldMaker Make>
+bool appendField(
+    std::vector<json_ref>& row,
+    FileResult* file,
+    const QueryContext* ctx) {
+  auto value = Make(file, ctx);
+  if (!value.has_value()) {
+    return false;
+  }
+  row.push_back(std::move(*value));
+  return true;
+}
+
+// Renders a result with a field list that is known at compile time.
+template <FieldMaker... Makes>
+std::optional<json_ref> make_row(FileResult* file, const QueryContext* ctx) {
+  if constexpr (sizeof...(Makes) == 1) {
+    // A single field is rendered as the value itself.
+    return (Makes(file, ctx), ...);
+  } else {
+    std::vector<json_ref> row;
+    row.reserve(sizeof...(Makes));
+    if (!(appendField<Makes>(row, file, ctx) && ...)) {
+      return std::nullopt;
+    }
+    return json_array(std::move(row));
+  }
+}
+
+QueryFieldList::RowRenderer find_row_renderer(const QueryFieldList& fields) {
+  // The field lists that most queries ask for, including the default one.
+  static const struct {
+    std::vector<const char*> names;
+    QueryFieldList::RowRenderer render;
+  } shapes[] = {
+      {{"name"}, make_row<make_name>},
+      {{"name", "exists"}, make_row<make_name, make_exists>},
+      {{"name", "exists", "new", "size", "mode"},
+       make_row<make_name, make_exists, make_new, make_size, make_mode>},
+  };
+  for (auto& shape : shapes) {
+    if (shape.names.size() != fields.size()) {
+      continue;
+    }
+    bool same = true;
+    for (size_t i = 0; i < fields.size() && same; ++i) {
+      same = fields[i]->name == shape.names[i];
+    }
+    if (same) {
+      return shape.render;
+    }
+  }
+  return nullptr;
+}
+
 } // namespace
 
 void QueryFieldList::add(const w_string& name) {
@@ -315,6 +388,7 @@ void QueryFieldList::add(const w_string& name) {
     QueryParseError::throwf("unknown field name '{}'", name);
   }
   this->push_back(&it->second);
+  rowRenderer_ = find_row_renderer(*this);
 }
 
 json_ref field_list_to_json_name_array(const QueryFieldList& fieldList) {
@@ -111,6 +111,21 @@ class SizeExpr : public QueryExpr {
     return eval_int_compare(size.value(), &comp);
   }
 
+  void evaluateBatch(
+      QueryContextBase* ctx,
+      const std::vector<FileResult*>& files,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask& deferred) override {
+    evaluateEach(files, active, matched, deferred, [&](FileResult* file) {
+      return SizeExpr::evaluate(ctx, file);
+    });
+  }
+
+  EvaluateCost cost() const override {
+    return EvaluateCost::Metadata;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     if (!term.isArray()) {
       throw QueryParseError("Expected array for 'size' term");
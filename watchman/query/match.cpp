@@ -5,8 +5,13 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <cstring>
+#include <map>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/query/FileResult.h"
@@ -17,13 +22,100 @@
 
 namespace watchman {
 
+/**
+ * Matches against any of a set of wildmatch patterns that share the same
+ * options. Sibling match terms of an anyof are aggregated into one of these.
+ *
+ * Patterns without wildcards, and patterns that are a single leading `*`
+ * followed by a literal, are looked up in hash sets, so a file is tested
+ * against those once, however many there are. Other patterns are passed to
+ * wildmatch one at a time.
+ */
 class WildMatchExpr : public QueryExpr {
-  std::string pattern;
   CaseSensitivity caseSensitive;
   bool wholename;
   bool noescape;
   bool includedotfiles;
 
+  // Owns the bytes that the pieces in literals_ and suffixes_ refer to.
+  // Copies share the refcounted strings, so the pieces remain valid.
+  std::vector<w_string> storage_;
+  // Patterns that must match the whole subject.
+  std::unordered_set<w_string_piece> literals_;
+  // For `*literal` patterns, the literals, by length.
+  std::map<size_t, std::unordered_set<w_string_piece>> suffixes_;
+  // Everything else.
+  std::vector<std::string> patterns_;
+
+  int flags() const {
+    return (includedotfiles ? 0 : WM_PERIOD) | (noescape ? WM_NOESCAPE : 0) |
+        (wholename ? WM_PATHNAME : 0) |
+        (caseSensitive == CaseSensitivity::CaseInSensitive ? WM_CASEFOLD : 0);
+  }
+
+  static bool isPlainLiteral(std::string_view text) {
+    return text.find_first_of("*?[\\/") == std::string_view::npos;
+  }
+
+  void addPattern(const char* pat) {
+    std::string_view pattern{pat};
+    bool literal = isPlainLiteral(pattern);
+    bool suffix = !literal && pattern.size() > 1 && pattern[0] == '*' &&
+        isPlainLiteral(pattern.substr(1));
+    if (!literal && !suffix) {
+      patterns_.emplace_back(pattern);
+      return;
+    }
+
+    if (suffix) {
+      pattern.remove_prefix(1);
+    }
+    w_string_piece piece{pattern};
+    storage_.push_back(
+        caseSensitive == CaseSensitivity::CaseInSensitive ? piece.asLowerCase()
+                                                          : piece.asWString());
+    auto& stored = storage_.back();
+    if (literal) {
+      literals_.insert(stored.piece());
+    } else {
+      suffixes_[stored.size()].insert(stored.piece());
+    }
+  }
+
+  bool matchesLookup(w_string_piece str) const {
+    w_string folded;
+    if (caseSensitive == CaseSensitivity::CaseInSensitive) {
+      folded = str.asLowerCase();
+      str = folded;
+    }
+
+    if (literals_.find(str) != literals_.end()) {
+      return true;
+    }
+    if (suffixes_.empty()) {
+      return false;
+    }
+
+    // The `*` may not match a leading period, unless dotfiles are included,
+    // or a slash, since wholename patterns match with WM_PATHNAME.
+    if (!includedotfiles && str.size() > 0 && str.data()[0] == '.') {
+      return false;
+    }
+    if (memchr(str.data(), '/', str.size())) {
+      return false;
+    }
+    for (auto& [len, set] : suffixes_) {
+      if (str.size() < len) {
+        continue;
+      }
+      w_string_piece tail{str.data() + str.size() - len, len};
+      if (set.find(tail) != set.end()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
  public:
   WildMatchExpr(
       const char* pat,
@@ -31,18 +123,18 @@ class WildMatchExpr : public QueryExpr {
       bool wholename,
       bool noescape,
       bool includedotfiles)
-      : pattern(pat),
-        caseSensitive(caseSensitive),
+      : caseSensitive(caseSensitive),
         wholename(wholename),
         noescape(noescape),
-        includedotfiles(includedotfiles) {}
+        includedotfiles(includedotfiles) {
+    addPattern(pat);
+  }
 
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
     w_string_piece str;
-    bool res;
 
     if (wholename) {
-      str = ctx->getWholeName();
+      str = ctx->getWholeName(file);
     } else {
       str = file->baseName();
     }
@@ -53,17 +145,96 @@ class WildMatchExpr : public QueryExpr {
     str = normBuf;
 #endif
 
-    res =
-        wildmatch(
-            pattern.c_str(),
-            str.data(),
-            (includedotfiles ? 0 : WM_PERIOD) | (noescape ? WM_NOESCAPE : 0) |
-                (wholename ? WM_PATHNAME : 0) |
-                (caseSensitive == CaseSensitivity::CaseInSensitive ? WM_CASEFOLD
-                                                                   : 0),
-            0) == WM_MATCH;
-
-    return res;
+    if ((!literals_.empty() || !suffixes_.empty()) && matchesLookup(str)) {
+      return true;
+    }
+
+    auto matchFlags = flags();
+    for (auto& pattern : patterns_) {
+      if (wildmatch(pattern.c_str(), str.data(), matchFlags, 0) == WM_MATCH) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void evaluateBatch(
+      QueryContextBase* ctx,
+      const std::vector<FileResult*>& files,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask& deferred) override {
+    evaluateEach(files, active, matched, deferred, [&](FileResult* file) {
+      return WildMatchExpr::evaluate(ctx, file);
+    });
+  }
+
+  EvaluateCost cost() const override {
+    return patterns_.empty() ? EvaluateCost::Name : EvaluateCost::Pattern;
+  }
+
+  std::optional<std::vector<QueryPath>> computePathScope() const override {
+    // The path generator resolves names case sensitively.
+    if (!wholename || caseSensitive == CaseSensitivity::CaseInSensitive) {
+      return std::nullopt;
+    }
+    std::vector<QueryPath> paths;
+    for (auto& literal : literals_) {
+      if (!isPlainScopePath(literal)) {
+        return std::nullopt;
+      }
+      // The parent's direct children include the literal itself.
+      auto parent = literal.dirName();
+      paths.push_back(
+          QueryPath{parent.empty() ? w_string{""} : parent.asWString(), 0});
+    }
+    if (!suffixes_.empty()) {
+      // The `*` cannot match a slash, so these only match in the root.
+      paths.push_back(QueryPath{w_string{""}, 0});
+    }
+    for (auto& pattern : patterns_) {
+      // Everything that matches lies below the dir that the literal start
+      // of the pattern names.
+      std::string_view prefix{pattern};
+      prefix = prefix.substr(0, prefix.find_first_of("*?[\\"));
+      auto slash = prefix.rfind('/');
+      if (slash == std::string_view::npos) {
+        return std::nullopt;
+      }
+      w_string_piece dir{prefix.substr(0, slash)};
+      if (!isPlainScopePath(dir)) {
+        return std::nullopt;
+      }
+      paths.push_back(QueryPath{dir.asWString(), -1});
+    }
+    return mergePathScopes(std::move(paths));
+  }
+
+  std::unique_ptr<QueryExpr> aggregate(
+      const QueryExpr* other,
+      const AggregateOp op) const override {
+    if (op != AggregateOp::AnyOf) {
+      return nullptr;
+    }
+    auto otherExpr = dynamic_cast<const WildMatchExpr*>(other);
+    if (otherExpr == nullptr || otherExpr->flags() != flags()) {
+      return nullptr;
+    }
+    auto merged = std::make_unique<WildMatchExpr>(*this);
+    merged->storage_.insert(
+        merged->storage_.end(),
+        otherExpr->storage_.begin(),
+        otherExpr->storage_.end());
+    merged->literals_.insert(
+        otherExpr->literals_.begin(), otherExpr->literals_.end());
+    for (auto& [len, set] : otherExpr->suffixes_) {
+      merged->suffixes_[len].insert(set.begin(), set.end());
+    }
+    merged->patterns_.insert(
+        merged->patterns_.end(),
+        otherExpr->patterns_.begin(),
+        otherExpr->patterns_.end());
+    return merged;
   }
 
   static std::unique_ptr<QueryExpr>
@@ -11,6 +11,7 @@
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 
+#include <algorithm>
 #include <unordered_set>
 
 using namespace watchman;
@@ -18,52 +19,125 @@ using namespace watchman;
 class NameExpr : public QueryExpr {
   w_string name;
   std::unordered_set<w_string> set;
+  // Views of set, so that names can be looked up without copying them into
+  // a w_string.
+  std::unordered_set<w_string_piece> lookup;
+  size_t maxLen{0};
   CaseSensitivity caseSensitive;
   bool wholename;
+
+  // Names up to this long are lowercased on the stack.
+  static constexpr size_t kMaxInlineName = 256;
+
   explicit NameExpr(
       std::unordered_set<w_string>&& set,
       CaseSensitivity caseSensitive,
       bool wholename)
       : set(std::move(set)),
         caseSensitive(caseSensitive),
-        wholename(wholename) {}
+        wholename(wholename) {
+    lookup.reserve(this->set.size());
+    for (auto& str : this->set) {
+      lookup.insert(str.piece());
+      maxLen = std::max(maxLen, size_t(str.size()));
+    }
+  }
 
  public:
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
-    if (!set.empty()) {
-      bool matched;
-      w_string str;
-
-      if (wholename) {
-        str = ctx->getWholeName();
-        if (caseSensitive == CaseSensitivity::CaseInSensitive) {
-          str = str.piece().asLowerCase();
-        }
-      } else {
-        str = caseSensitive == CaseSensitivity::CaseInSensitive
-            ? file->baseName().asLowerCase()
-            : file->baseName().asWString();
-      }
-
-      matched = set.find(str) != set.end();
-
-      return matched;
-    }
-
     w_string_piece str;
 
     if (wholename) {
-      str = ctx->getWholeName();
+      str = ctx->getWholeName(file);
     } else {
       str = file->baseName();
     }
 
+    if (!set.empty()) {
+      if (caseSensitive != CaseSensitivity::CaseInSensitive) {
+        return lookup.count(str) > 0;
+      }
+      // A name longer than every entry in the set matches none of them.
+      if (str.size() > maxLen) {
+        return false;
+      }
+      if (str.size() > kMaxInlineName) {
+        return lookup.count(str.asLowerCase()) > 0;
+      }
+      char buf[kMaxInlineName];
+      str.copyLowerCase(buf);
+      return lookup.count(w_string_piece(buf, str.size())) > 0;
+    }
+
     if (caseSensitive == CaseSensitivity::CaseInSensitive) {
       return w_string_equal_caseless(str, name);
     }
     return str == name;
   }
 
+  EvaluateCost cost() const override {
+    return EvaluateCost::Name;
+  }
+
+  std::optional<std::vector<QueryPath>> computePathScope() const override {
+    // The path generator resolves names case sensitively.
+    if (!wholename || caseSensitive != CaseSensitivity::CaseSensitive) {
+      return std::nullopt;
+    }
+    std::vector<QueryPath> paths;
+    auto addParent = [&](const w_string& path) {
+      if (!isPlainScopePath(path)) {
+        return false;
+      }
+      // The parent's direct children include path itself, whether it is a
+      // file or a dir.
+      auto parent = path.dirName();
+      paths.push_back(QueryPath{parent.empty() ? w_string{""} : parent, 0});
+      return true;
+    };
+    if (set.empty()) {
+      if (name && !addParent(name)) {
+        return std::nullopt;
+      }
+    } else {
+      for (auto& path : set) {
+        if (!addParent(path)) {
+          return std::nullopt;
+        }
+      }
+    }
+    return mergePathScopes(std::move(paths));
+  }
+
+  std::unique_ptr<QueryExpr> aggregate(
+      const QueryExpr* other,
+      const AggregateOp op) const override {
+    if (op != AggregateOp::AnyOf) {
+      return nullptr;
+    }
+    auto otherExpr = dynamic_cast<const NameExpr*>(other);
+    if (otherExpr == nullptr || otherExpr->caseSensitive != caseSensitive ||
+        otherExpr->wholename != wholename) {
+      return nullptr;
+    }
+    std::unordered_set<w_string> merged;
+    merged.reserve(set.size() + otherExpr->set.size() + 2);
+    for (auto expr : {this, otherExpr}) {
+      if (expr->set.empty() && expr->name) {
+        // A single name is held as given; lower case it as the parser does
+        // for the elements of a set.
+        merged.insert(
+            caseSensitive == CaseSensitivity::CaseInSensitive
+                ? expr->name.piece().asLowerCase(expr->name.type())
+                : expr->name);
+      } else {
+        merged.insert(expr->set.begin(), expr->set.end());
+      }
+    }
+    return std::unique_ptr<QueryExpr>(
+        new NameExpr(std::move(merged), caseSensitive, wholename));
+  }
+
   static std::unique_ptr<QueryExpr>
   parse(Query*, const json_ref& term, CaseSensitivity caseSensitive) {
     const char *pattern = nullptr, *scope = "basename";
@@ -8,6 +8,7 @@
 #include "watchman/query/parse.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
+#include "watchman/LRUCache.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryExpr.h"
@@ -86,8 +87,18 @@ void parse_relative_root(
     const std::shared_ptr<Root>& root,
     Query* res,
     const json_ref& query) {
+  // A root that shares the view of its enclosing root sees only its own
+  // subtree of that view.
+  auto scopeToRoot = [&] {
+    if (root->view()->getEnclosingRoot()) {
+      res->relative_root = root->root_path;
+      res->relative_root_slash = w_string::build(root->root_path, "/");
+    }
+  };
+
   auto relative_root = query.get_optional("relative_root");
   if (!relative_root) {
+    scopeToRoot();
     return;
   }
 
@@ -101,6 +112,7 @@ void parse_relative_root(
     // a relative root.  Importantly, we want to avoid setting
     // relative_root to "" because that introduces some complexities
     // in handling that case for eg: eden.
+    scopeToRoot();
     return;
   }
 
@@ -119,6 +131,29 @@ void parse_query_expression(Query* res, const json_ref& query) {
   res->expr = parseQueryExpr(res, *exp);
 }
 
+// A query without a generator of its own walks every file in the root. If
+// its expression can only match within some paths, walk just those instead.
+void infer_path_scope(Query* res) {
+  if (res->paths || res->glob_tree || !res->expr) {
+    return;
+  }
+  auto scope = res->expr->computePathScope();
+  if (!scope) {
+    return;
+  }
+  res->paths = std::move(scope);
+  res->paths_from_expression = true;
+}
+
+// Failing that, if its expression can only match some suffixes, a view that
+// indexes names by suffix can produce just those files.
+void infer_suffix_scope(Query* res) {
+  if (res->paths || res->glob_tree || !res->expr) {
+    return;
+  }
+  res->suffix_scope = res->expr->computeSuffixScope();
+}
+
 void parse_request_id(Query* res, const json_ref& query) {
   auto request_id = query.get_optional("request_id");
   if (!request_id) {
@@ -206,12 +241,135 @@ bool parse_bool_param(
   return value.asBool();
 }
 
+W_CAP_REG("query-timeout")
+
+void parse_timeout(Query* res, const json_ref& query) {
+  auto timeout = query.get_optional("timeout_ms");
+  if (timeout) {
+    if (!timeout->isInt() || timeout->asInt() <= 0) {
+      throw QueryParseError("timeout_ms must be an integer value > 0");
+    }
+    res->timeout = std::chrono::milliseconds(timeout->asInt());
+  }
+
+  res->partial_results = parse_bool_param(query, "partial_results", false);
+  if (res->partial_results && !res->timeout) {
+    throw QueryParseError("partial_results requires timeout_ms");
+  }
+}
+
 W_CAP_REG("dedup_results")
 
 void parse_dedup(Query* res, const json_ref& query) {
   res->dedup_results = parse_bool_param(query, "dedup_results", false);
 }
 
+W_CAP_REG("parallel-generators")
+
+void parse_parallel(Query* res, const json_ref& query) {
+  res->parallel = parse_bool_param(query, "parallel", false);
+}
+
+W_CAP_REG("results-chunking")
+
+void parse_results_chunk_size(Query* res, const json_ref& query) {
+  auto chunk_size = query.get_optional("results_chunk_size");
+  if (!chunk_size) {
+    return;
+  }
+  if (!chunk_size->isInt() || chunk_size->asInt() < 0) {
+    throw QueryParseError(
+        "results_chunk_size must be an integer value >= 0");
+  }
+  res->results_chunk_size = chunk_size->asInt();
+}
+
+W_CAP_REG("limit-order-by")
+
+void parse_limit(Query* res, const json_ref& query) {
+  auto limit = query.get_optional("limit");
+  if (limit) {
+    if (!limit->isInt() || limit->asInt() <= 0) {
+      throw QueryParseError("limit must be an integer value > 0");
+    }
+    res->limit = limit->asInt();
+  }
+
+  auto order_by = query.get_optional("order_by");
+  if (!order_by) {
+    return;
+  }
+  if (!order_by->isString()) {
+    throw QueryParseError("order_by must be a string");
+  }
+  auto order = json_to_w_string(*order_by);
+  if (order == "otime") {
+    res->order_by = QueryOrder::Otime;
+  } else if (order == "mtime") {
+    res->order_by = QueryOrder::Mtime;
+  } else if (order == "name") {
+    res->order_by = QueryOrder::Name;
+  } else {
+    QueryParseError::throwf(
+        "order_by must be one of otime, mtime or name, not {}", order);
+  }
+}
+
+W_CAP_REG("aggregate")
+
+void parse_aggregate(Query* res, const json_ref& query) {
+  auto aggregate = query.get_optional("aggregate");
+  if (!aggregate) {
+    return;
+  }
+  if (!aggregate->isObject()) {
+    throw QueryParseError("aggregate must be an object");
+  }
+  if (res->limit || res->order_by != QueryOrder::None ||
+      res->results_chunk_size) {
+    throw QueryParseError(
+        "aggregate cannot be combined with limit, order_by or "
+        "results_chunk_size");
+  }
+
+  QueryAggregate result;
+  result.size = parse_bool_param(*aggregate, "size", false);
+
+  auto group_by = aggregate->get_optional("group_by");
+  if (group_by) {
+    if (!group_by->isString()) {
+      throw QueryParseError("aggregate.group_by must be a string");
+    }
+    auto name = json_to_w_string(*group_by);
+    if (name == "dirname") {
+      result.group_by = QueryAggregate::GroupBy::Dirname;
+    } else if (name == "suffix") {
+      result.group_by = QueryAggregate::GroupBy::Suffix;
+    } else {
+      QueryParseError::throwf(
+          "aggregate.group_by must be dirname or suffix, not {}", name);
+    }
+  }
+  res->aggregate = result;
+}
+
+W_CAP_REG("name-encoding")
+
+void parse_name_encoding(Query* res, const json_ref& query) {
+  auto encoding = query.get_optional("name_encoding");
+  if (!encoding) {
+    return;
+  }
+  if (!encoding->isString() ||
+      json_to_w_string(*encoding) != "front_coded") {
+    throw QueryParseError("name_encoding must be \"front_coded\"");
+  }
+  if (res->fieldList.size() != 1 || res->fieldList.front()->name != "name") {
+    throw QueryParseError("name_encoding requires fields to be [\"name\"]");
+  }
+  res->front_coded_names = true;
+}
+
 void parse_fail_if_no_saved_state(Query* res, const json_ref& query) {
   res->fail_if_no_saved_state =
       parse_bool_param(query, "fail_if_no_saved_state", false);
@@ -222,6 +380,12 @@ void parse_omit_changed_files(Query* res, const json_ref& query) {
       parse_bool_param(query, "omit_changed_files", false);
 }
 
+W_CAP_REG("query-lag")
+
+void parse_include_lag(Query* res, const json_ref& query) {
+  res->include_lag = parse_bool_param(query, "include_lag", false);
+}
+
 void parse_empty_on_fresh_instance(Query* res, const json_ref& query) {
   res->empty_on_fresh_instance =
       parse_bool_param(query, "empty_on_fresh_instance", false);
@@ -232,6 +396,19 @@ void parse_always_include_directories(Query* res, const json_ref& query) {
       parse_bool_param(query, "always_include_directories", false);
 }
 
+W_CAP_REG("query-include-vcs-ignored")
+
+void parse_include_vcs_ignored(Query* res, const json_ref& query) {
+  res->includeVcsIgnored =
+      parse_bool_param(query, "include_vcs_ignored", false);
+}
+
+W_CAP_REG("query-explain")
+
+void parse_explain(Query* res, const json_ref& query) {
+  res->explain = parse_bool_param(query, "explain", false);
+}
+
 void parse_benchmark(Query* res, const json_ref& query) {
   // Preserve behavior by supporting a boolean value. Also support int values.
   auto bench = query.get_optional("bench");
@@ -257,24 +434,74 @@ void parse_case_sensitive(
                                        : CaseSensitivity::CaseInSensitive;
 }
 
-} // namespace
+// Tools and subscriptions send the same query spec over and over. Parsing
+// it builds the expression tree, compiles its patterns and builds the glob
+// tree, so the parsed form of recent specs is kept and each call is handed
+// a copy that shares those parts.
+using QueryPlanCache = LRUCache<std::string, std::shared_ptr<const Query>>;
+
+QueryPlanCache* getQueryPlanCache() {
+  // Leaked so that queries parsed during shutdown can still use it.
+  static auto* cache = []() -> QueryPlanCache* {
+    auto size = Configuration().getInt("query_plan_cache_size", 256);
+    if (size <= 0) {
+      return nullptr;
+    }
+    return new QueryPlanCache(size, std::chrono::milliseconds(0));
+  }();
+  return cache;
+}
 
-std::shared_ptr<Query> parseQuery(
+// The key covers everything that parsing depends upon except the fields
+// that tend to change from one call to the next, which are parsed on every
+// call instead. That includes whether the root shares the view of an
+// enclosing root, which scopes the query to it, as the same path can be
+// watched either way over time.
+std::optional<std::string> queryPlanKey(
+    const std::shared_ptr<Root>& root,
+    const json_ref& query) {
+  if (!query.isObject()) {
+    return std::nullopt;
+  }
+  std::unordered_map<w_string, json_ref> fields;
+  for (const auto& [name, value] : query.object()) {
+    if (name == "since" || name == "request_id") {
+      continue;
+    }
+    fields.emplace(name, value);
+  }
+  return folly::to<std::string>(
+      root->root_path.view(),
+      '\0',
+      root->view()->getEnclosingRoot() ? 's' : 'r',
+      json_dumps(
+          json_object(std::move(fields)), JSON_COMPACT | JSON_SORT_KEYS));
+}
+
+std::shared_ptr<Query> compileQuery(
     const std::shared_ptr<Root>& root,
     const json_ref& query) {
   auto result = std::make_shared<Query>();
   auto res = result.get();
 
   parse_benchmark(res, query);
+  parse_explain(res, query);
   parse_case_sensitive(res, root, query);
   parse_sync(res, query);
   parse_dedup(res, query);
+  parse_parallel(res, query);
+  parse_results_chunk_size(res, query);
+  parse_limit(res, query);
+  parse_aggregate(res, query);
   parse_lock_timeout(res, query);
+  parse_timeout(res, query);
   parse_relative_root(root, res, query);
   parse_empty_on_fresh_instance(res, query);
   parse_fail_if_no_saved_state(res, query);
   parse_omit_changed_files(res, query);
+  parse_include_lag(res, query);
   parse_always_include_directories(res, query);
+  parse_include_vcs_ignored(res, query);
 
   /* Look for path generators */
   parse_paths(res, query);
@@ -285,15 +512,43 @@ std::shared_ptr<Query> parseQuery(
   /* Look for suffix generators */
   parse_suffixes(res, query);
 
+  parse_query_expression(res, query);
+  infer_path_scope(res);
+  infer_suffix_scope(res);
+
+  parse_field_list(query.get_optional("fields"), &res->fieldList);
+  parse_name_encoding(res, query);
+
+  return result;
+}
+
+} // namespace
+
+std::shared_ptr<Query> parseQuery(
+    const std::shared_ptr<Root>& root,
+    const json_ref& query) {
+  auto cache = getQueryPlanCache();
+  auto key = cache ? queryPlanKey(root, query) : std::nullopt;
+
+  std::shared_ptr<Query> result;
+  if (key) {
+    if (auto node = cache->get(*key)) {
+      result = std::make_shared<Query>(*node->value());
+    }
+  }
+  if (!result) {
+    result = compileQuery(root, query);
+    if (key) {
+      cache->set(*key, std::make_shared<const Query>(*result));
+    }
+  }
+  auto res = result.get();
+
   /* Look for since generator */
   parse_since(res, query);
 
-  parse_query_expression(res, query);
-
   parse_request_id(res, query);
 
-  parse_field_list(query.get_optional("fields"), &res->fieldList);
-
   res->query_spec = query;
 
   return result;
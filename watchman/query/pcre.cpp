@@ -43,7 +43,7 @@ class PcreExpr : public QueryExpr {
     int rc;
 
     if (wholename) {
-      str = ctx->getWholeName();
+      str = ctx->getWholeName(file);
     } else {
       str = file->baseName();
     }
@@ -60,6 +60,10 @@ class PcreExpr : public QueryExpr {
     return false;
   }
 
+  EvaluateCost cost() const override {
+    return EvaluateCost::Regex;
+  }
+
   static std::unique_ptr<QueryExpr>
   parse(Query*, const json_ref& term, CaseSensitivity caseSensitive) {
     const char *pattern, *scope = "basename";
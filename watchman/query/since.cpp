@@ -37,16 +37,15 @@ class SinceExpr : public QueryExpr {
   std::unique_ptr<ClockSpec> spec;
   enum since_what field;
 
- public:
-  explicit SinceExpr(std::unique_ptr<ClockSpec> spec, enum since_what field)
-      : spec(std::move(spec)), field(field) {}
-
-  EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
-    time_t tval = 0;
-
-    auto since = spec->evaluate(
+  QuerySince evaluateSpec(QueryContextBase* ctx) const {
+    return spec->evaluate(
         ctx->clockAtStartOfQuery.position(),
         ctx->lastAgeOutTickValueAtStartOfQuery);
+  }
+
+  EvaluateResult evaluateAgainst(const QuerySince& since, FileResult* file)
+      const {
+    time_t tval = 0;
 
     // Note that we use >= for the time comparisons in here so that we
     // report the things that changed inclusive of the boundary presented.
@@ -76,19 +75,19 @@ class SinceExpr : public QueryExpr {
             });
       }
       case since_what::SINCE_MTIME: {
-        auto stat = file->stat();
-        if (!stat.has_value()) {
+        auto mtime = file->modifiedTime();
+        if (!mtime.has_value()) {
           return std::nullopt;
         }
-        tval = stat->mtime.tv_sec;
+        tval = mtime->tv_sec;
         break;
       }
       case since_what::SINCE_CTIME: {
-        auto stat = file->stat();
-        if (!stat.has_value()) {
+        auto ctime = file->changedTime();
+        if (!ctime.has_value()) {
           return std::nullopt;
         }
-        tval = stat->ctime.tv_sec;
+        tval = ctime->tv_sec;
         break;
       }
     }
@@ -98,6 +97,36 @@ class SinceExpr : public QueryExpr {
     return tval >= since_ts->time;
   }
 
+ public:
+  explicit SinceExpr(std::unique_ptr<ClockSpec> spec, enum since_what field)
+      : spec(std::move(spec)), field(field) {}
+
+  EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
+    return evaluateAgainst(evaluateSpec(ctx), file);
+  }
+
+  // The spec is the same for every file, so evaluate it once for the batch.
+  void evaluateBatch(
+      QueryContextBase* ctx,
+      const std::vector<FileResult*>& files,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask& deferred) override {
+    auto since = evaluateSpec(ctx);
+    evaluateEach(files, active, matched, deferred, [&](FileResult* file) {
+      return evaluateAgainst(since, file);
+    });
+  }
+
+  EvaluateCost cost() const override {
+    if (field == since_what::SINCE_OCLOCK ||
+        field == since_what::SINCE_CCLOCK) {
+      return EvaluateCost::Field;
+    }
+    // The times come from the file's stat.
+    return EvaluateCost::Metadata;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     auto selected_field = since_what::SINCE_OCLOCK;
     const char* fieldname = "oclock";
@@ -12,31 +12,193 @@
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 
+#include <folly/lang/Bits.h>
+#include <algorithm>
+#include <cstring>
 #include <memory>
 #include <unordered_set>
+#include <vector>
 
 using namespace watchman;
 
+namespace {
+
+constexpr uint64_t kEachByte = 0x0101010101010101;
+
+// Lowers the ASCII letters among the bytes of a word.
+uint64_t lowerWord(uint64_t word) {
+  // With the top bit of each byte cleared, adding to a byte can't carry into
+  // its neighbor; the sums set the top bit where the byte is >= 'A' and
+  // where it is > 'Z' respectively.
+  auto low = word & (0x7f * kEachByte);
+  auto atLeastA = low + (0x80 - 'A') * kEachByte;
+  auto pastZ = low + (0x7f - 'Z') * kEachByte;
+  auto letters = atLeastA & ~pastZ & ~word & (0x80 * kEachByte);
+  return word | (letters >> 2);
+}
+
+// Packs the last 8 bytes of name into a word, lowercased, with the last
+// byte of name in the top byte. Shorter names leave the low bytes as zero.
+uint64_t packTail(w_string_piece name) {
+  uint64_t word = 0;
+  auto len = std::min(name.size(), sizeof(word));
+  memcpy(
+      reinterpret_cast<char*>(&word) + sizeof(word) - len,
+      name.data() + name.size() - len,
+      len);
+  return lowerWord(folly::Endian::little(word));
+}
+
+} // namespace
+
 class SuffixExpr : public QueryExpr {
   std::unordered_set<w_string> suffixSet_;
+  // Views of suffixSet_, so that a name's suffix can be looked up without
+  // copying it into a w_string.
+  std::unordered_set<w_string_piece> lookup_;
+  size_t maxSuffixLen_{0};
+
+  // If every suffix fits in a word with its dot, the word and the mask of
+  // the bytes it occupies, as packTail() produces them.
+  struct PackedSuffix {
+    uint64_t value;
+    uint64_t mask;
+  };
+  std::vector<PackedSuffix> packed_;
+
+  // Sets with up to this many suffixes are compared a word at a time.
+  static constexpr size_t kMaxPacked = 16;
+  // Longer suffixes are lowercased on the heap.
+  static constexpr size_t kMaxInlineSuffix = 64;
+
+  // Both ways of evaluating agree on suffixes with no dot or separator in
+  // them, so only those are packed. The dot takes one of the bytes.
+  static bool isPackable(w_string_piece suffix) {
+    if (suffix.size() == 0 || suffix.size() >= sizeof(uint64_t)) {
+      return false;
+    }
+    for (auto c : suffix.view()) {
+      if (c == '.' || c == 0 || is_slash(c)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void packSuffixes() {
+    if (suffixSet_.size() > kMaxPacked) {
+      return;
+    }
+    for (auto& suffix : suffixSet_) {
+      if (!isPackable(suffix)) {
+        packed_.clear();
+        return;
+      }
+      auto dotted = w_string::build(".", suffix);
+      packed_.push_back(PackedSuffix{
+          packTail(dotted), ~uint64_t(0) << (64 - 8 * dotted.size())});
+    }
+  }
+
+  bool matchesSet(w_string_piece name) const {
+    auto suffix = name.suffix();
+    if (suffix == nullptr || suffix.size() > maxSuffixLen_) {
+      return false;
+    }
+    if (suffix.size() > kMaxInlineSuffix) {
+      return lookup_.count(suffix.asLowerCase()) > 0;
+    }
+    char buf[kMaxInlineSuffix];
+    suffix.copyLowerCase(buf);
+    return lookup_.count(w_string_piece(buf, suffix.size())) > 0;
+  }
+
+  bool matchesPacked(w_string_piece name) const {
+    auto tail = packTail(name);
+    for (auto& suffix : packed_) {
+      if ((tail & suffix.mask) == suffix.value) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool matchesEach(w_string_piece name) const {
+    for (auto const& suffix : suffixSet_) {
+      if (name.hasSuffix(suffix)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // For small suffix sets, benchmarks indicated that iteration provides
+  // better performance than hashing the suffix.
+  bool isSmallSet() const {
+    return suffixSet_.size() < 3;
+  }
 
  public:
   explicit SuffixExpr(std::unordered_set<w_string>&& suffixSet)
-      : suffixSet_(std::move(suffixSet)) {}
+      : suffixSet_(std::move(suffixSet)) {
+    lookup_.reserve(suffixSet_.size());
+    for (auto& suffix : suffixSet_) {
+      lookup_.insert(suffix.piece());
+      maxSuffixLen_ = std::max(maxSuffixLen_, size_t(suffix.size()));
+    }
+    packSuffixes();
+  }
 
   EvaluateResult evaluate(QueryContextBase*, FileResult* file) override {
-    if (suffixSet_.size() < 3) {
-      // For small suffix sets, benchmarks indicated that iteration provides
-      // better performance since no suffix allocation is necessary.
-      for (auto const& suffix : suffixSet_) {
-        if (file->baseName().hasSuffix(suffix)) {
-          return true;
+    auto name = file->baseName();
+    if (!packed_.empty()) {
+      return matchesPacked(name);
+    }
+    if (isSmallSet()) {
+      return matchesEach(name);
+    }
+    return matchesSet(name);
+  }
+
+  // Chooses how to compare the names once for the whole batch.
+  void evaluateBatch(
+      QueryContextBase*,
+      const std::vector<FileResult*>& files,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask& deferred) override {
+    auto evaluateWith = [&](auto matches) {
+      evaluateEach(files, active, matched, deferred, [&](FileResult* file) {
+        return EvaluateResult{matches(file->baseName())};
+      });
+    };
+    if (!packed_.empty()) {
+      evaluateWith([this](w_string_piece name) { return matchesPacked(name); });
+    } else if (isSmallSet()) {
+      evaluateWith([this](w_string_piece name) { return matchesEach(name); });
+    } else {
+      evaluateWith([this](w_string_piece name) { return matchesSet(name); });
+    }
+  }
+
+  EvaluateCost cost() const override {
+    return EvaluateCost::Name;
+  }
+
+  std::optional<std::vector<w_string>> computeSuffixScope() const override {
+    // A suffix index is keyed on what follows the last dot of a name, which
+    // is only the same test for suffixes that have no dot of their own.
+    for (auto& suffix : suffixSet_) {
+      if (suffix.size() == 0) {
+        return std::nullopt;
+      }
+      for (auto c : suffix.view()) {
+        if (c == '.' || c == 0 || is_slash(c)) {
+          return std::nullopt;
         }
       }
-      return false;
     }
-    auto suffix = file->baseName().asLowerCaseSuffix();
-    return suffix && (suffixSet_.find(suffix) != suffixSet_.end());
+    return std::vector<w_string>{suffixSet_.begin(), suffixSet_.end()};
   }
 
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
@@ -77,6 +77,21 @@ class TypeExpr : public QueryExpr {
     }
   }
 
+  void evaluateBatch(
+      QueryContextBase* ctx,
+      const std::vector<FileResult*>& files,
+      const EvaluateMask& active,
+      EvaluateMask& matched,
+      EvaluateMask& deferred) override {
+    evaluateEach(files, active, matched, deferred, [&](FileResult* file) {
+      return TypeExpr::evaluate(ctx, file);
+    });
+  }
+
+  EvaluateCost cost() const override {
+    return EvaluateCost::Field;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     const char *typestr, *found;
     char arg;
@@ -9,12 +9,16 @@
 
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include "watchman/Clock.h"
 #include "watchman/CookieSync.h"
 #include "watchman/IgnoreSet.h"
 #include "watchman/PendingCollection.h"
 #include "watchman/PubSub.h"
+#include "watchman/QueryAdmission.h"
 #include "watchman/Serde.h"
+#include "watchman/ViewLagStatus.h"
+#include "watchman/ViewMemoryStats.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/thirdparty/jansson/jansson.h"
@@ -64,6 +68,11 @@ class ClientStateAssertions {
   /** Returns true if `assertion` currently has an Asserted disposition */
   bool isStateAsserted(w_string stateName) const;
 
+  /** Returns true if any state is asserted, or pending enter or leave */
+  bool hasAssertions() const {
+    return !states_.empty();
+  }
+
   /** Add assertion to the queue of assertions for assertion->name.
    * Throws if the named state is already asserted or if there is
    * a pending assertion for that state. */
@@ -101,8 +110,8 @@ class RootConfig {
 };
 
 /**
- * Given the ignore_dirs and ignore_vcs configuration arrays, return a
- * configured IgnoreSet.
+ * Given the ignore_dirs, ignore_globs and ignore_vcs configuration arrays,
+ * return a configured IgnoreSet.
  *
  * Normally an implementation detail, but exposed for testing.
  */
@@ -118,6 +127,10 @@ struct RootRecrawlInfo : serde::Object {
   std::optional<int64_t> started_at;
   std::optional<int64_t> completed_at;
   std::optional<int64_t> stat_count;
+  std::optional<int64_t> scoped_dirs;
+  std::optional<int64_t> backoff_ms;
+  std::optional<int64_t> deferred_ms;
+  std::optional<bool> waiting_for_turn;
 
   template <typename X>
   void map(X& x) {
@@ -128,6 +141,10 @@ struct RootRecrawlInfo : serde::Object {
     x("started", started_at);
     x("completed", completed_at);
     x("stats", stat_count);
+    x("scoped-dirs", scoped_dirs);
+    x("backoff-ms", backoff_ms);
+    x("deferred-ms", deferred_ms);
+    x("waiting-for-turn", waiting_for_turn);
   }
 };
 
@@ -159,6 +176,24 @@ struct RootQueryInfo : serde::Object {
   }
 };
 
+// How long the cookies written to a cookie dir took to be observed
+struct CookieDirLatency : serde::Object {
+  w_string dir;
+  int64_t observed;
+  int64_t last_us;
+  int64_t max_us;
+  int64_t mean_us;
+
+  template <typename X>
+  void map(X& x) {
+    x("dir", dir);
+    x("observed", observed);
+    x("last_us", last_us);
+    x("max_us", max_us);
+    x("mean_us", mean_us);
+  }
+};
+
 struct RootDebugStatus : serde::Object {
   w_string path;
   w_string fstype;
@@ -168,12 +203,16 @@ struct RootDebugStatus : serde::Object {
   std::vector<w_string> cookie_prefix;
   std::vector<w_string> cookie_dir;
   std::vector<w_string> cookie_list;
+  std::vector<CookieDirLatency> cookie_latency;
   RootRecrawlInfo recrawl_info;
   std::vector<RootQueryInfo> queries;
   bool done_initial;
   bool cancelled;
   bool enable_parallel_crawl;
   w_string crawl_status;
+  std::optional<ViewMemoryStats> memory;
+  std::optional<SettleStatus> settle;
+  std::optional<ViewLagStatus> lag;
 
   template <typename X>
   void map(X& x) {
@@ -185,12 +224,18 @@ struct RootDebugStatus : serde::Object {
     x("cookie_prefix", cookie_prefix);
     x("cookie_dir", cookie_dir);
     x("cookie_list", cookie_list);
+    x.skip_if("cookie_latency", cookie_latency, [](const auto& l) {
+      return l.empty();
+    });
     x("recrawl_info", recrawl_info);
     x("queries", queries);
     x("done_initial", done_initial);
     x("cancelled", cancelled);
     x("crawl-status", crawl_status);
     x("enable_parallel_crawl", enable_parallel_crawl);
+    x.skip_if("memory", memory, [](const auto& m) { return !m.has_value(); });
+    x.skip_if("settle", settle, [](const auto& s) { return !s.has_value(); });
+    x.skip_if("lag", lag, [](const auto& l) { return !l.has_value(); });
   }
 };
 
@@ -216,6 +261,9 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   const std::chrono::steady_clock::time_point startTime =
       std::chrono::steady_clock::now();
 
+  // Identifies this root's spans in the debug-trace output.
+  const uint32_t traceId;
+
   CookieSync cookies;
 
   /* mutable config items */
@@ -238,8 +286,24 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   const std::chrono::seconds gc_age{DEFAULT_GC_AGE};
   const std::chrono::seconds idle_reap_age{0};
 
+  // The config values that are read per dir, per event or per dispatch,
+  // parsed once rather than looked up each time.
+  const bool suppress_recrawl_warnings{false};
+  const uint32_t hint_num_files_per_dir{64};
+  const uint32_t subscription_lock_timeout_ms{100};
+  const json_int_t trigger_max_concurrent_per_root{0};
+  // Since queries whose clock is at most this many ticks old are let in
+  // ahead of the other queries that wait for queryAdmission.
+  const ClockTicks query_cheap_since_ticks{128};
+
+  // Limits how many query commands run against this root at once
+  QueryAdmission queryAdmission;
+
   // Stream of broadcast unilateral items emitted by this root
   std::shared_ptr<Publisher> unilateralResponses;
+  // Stream of crawl progress reports, sent to the clients that asked for them
+  // with the crawl-progress command
+  std::shared_ptr<Publisher> crawlProgress;
 
   struct RecrawlInfo {
     /* how many times we've had to recrawl */
@@ -255,6 +319,21 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
     std::chrono::steady_clock::time_point crawlFinish;
     // Number of statPath() called during recrawl
     std::shared_ptr<std::atomic<size_t>> statCount;
+    // If the last recrawl covered only some dirs, how many
+    std::optional<size_t> scopedDirs;
+    // Set once scheduleRecrawl has been called; the initial crawl is never
+    // held back.
+    bool recrawlScheduled = false;
+    // How long the pending recrawl is held back for, doubling each time one
+    // is scheduled soon after the previous one completed.
+    std::chrono::milliseconds backoff{0};
+    // When the pending recrawl may start
+    std::chrono::steady_clock::time_point notBefore;
+    // Set when a recrawl is scheduled while one is held back, until the IO
+    // thread recrawls the recently changed dirs in the meantime.
+    bool scopedRecoveryPending = false;
+    // Set while the recrawl waits for its turn among the roots' crawls
+    bool waitingForTurn = false;
   };
   folly::Synchronized<RecrawlInfo> recrawlInfo;
 
@@ -288,6 +367,12 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
     std::atomic<std::chrono::steady_clock::time_point> last_cmd_timestamp{
         std::chrono::steady_clock::time_point{}};
 
+    /// If the root was restored from the saved state and no client has
+    /// used it since, when one last did before the restart; otherwise the
+    /// epoch. Saved in the state, so that an idle root stays idle.
+    std::atomic<std::chrono::system_clock::time_point> restored_last_used{
+        std::chrono::system_clock::time_point{}};
+
     /// Only accessed on the iothread.
     std::chrono::steady_clock::time_point last_reap_timestamp;
   } inner;
@@ -317,12 +402,30 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   ~Root();
 
   void considerAgeOut();
-  void performAgeOut(std::chrono::seconds min_age);
+  /**
+   * Prunes deleted nodes older than min_age from the view. Returns the
+   * statistics that the view recorded for the operation, which are also
+   * attached to the age_out perf sample.
+   */
+  json_ref performAgeOut(std::chrono::seconds min_age);
   folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period);
-  CookieSync::SyncResult syncToNow(std::chrono::milliseconds timeout);
+  /**
+   * scope, if given, holds the full paths that the caller is about to look
+   * at; for roots with several cookie dirs, only those that cover them are
+   * synced.
+   */
+  CookieSync::SyncResult syncToNow(
+      std::chrono::milliseconds timeout,
+      const std::vector<w_string>& scope = {});
   void scheduleRecrawl(const char* why);
   void recrawlTriggered(const char* why);
+  /**
+   * Records a recrawl of only num_dirs subtrees of the root, which the
+   * watcher has queued itself with W_PENDING_IS_DESYNCED after losing
+   * events within them.
+   */
+  void scheduleScopedRecrawl(const char* why, size_t num_dirs);
 
   // Requests cancellation of the root.
   // Returns true if this request caused the root cancellation, false
@@ -331,6 +434,12 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
 
   // Returns true if the caller should stop the watch.
   bool considerReap();
+  /**
+   * Reaps the root if it has been idle for long enough, and otherwise ages
+   * it out and trims its caches when they are due. The maintenance
+   * scheduler calls this, in place of the IO thread, when it is enabled.
+   */
+  void performMaintenance();
   bool removeFromWatched();
   void stopThreads();
   bool stopWatch();
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/root/RootPathTrie.h"
+#include <vector>
+
+namespace watchman {
+
+namespace {
+
+// Calls func with each of the non-empty components of path, in order,
+// until it returns false.
+template <typename Func>
+void forEachComponent(w_string_piece path, Func&& func) {
+  const char* end = path.data() + path.size();
+  const char* start = path.data();
+  while (start < end) {
+    const char* p = start;
+    while (p < end && !is_slash(*p)) {
+      ++p;
+    }
+    if (p > start && !func(w_string_piece{start, size_t(p - start)})) {
+      return;
+    }
+    start = p + 1;
+  }
+}
+
+} // namespace
+
+void RootPathTrie::insert(const w_string& path) {
+  Node* node = &root_;
+  forEachComponent(path.piece(), [&](w_string_piece component) {
+    auto it = node->children.find(component);
+    if (it == node->children.end()) {
+      auto child = std::make_unique<Node>();
+      child->name = w_string{component.data(), component.size()};
+      it = node->children.emplace(child->name.piece(), std::move(child)).first;
+    }
+    node = it->second.get();
+    return true;
+  });
+  if (!node->path) {
+    ++size_;
+  }
+  node->path = path;
+}
+
+bool RootPathTrie::erase(w_string_piece path) {
+  std::vector<Node*> nodes{&root_};
+  bool found = true;
+  forEachComponent(path, [&](w_string_piece component) {
+    auto& children = nodes.back()->children;
+    auto it = children.find(component);
+    if (it == children.end()) {
+      found = false;
+      return false;
+    }
+    nodes.push_back(it->second.get());
+    return true;
+  });
+  if (!found || !nodes.back()->path) {
+    return false;
+  }
+
+  nodes.back()->path = w_string();
+  --size_;
+  // Prune the nodes that no longer lead to any path.
+  while (nodes.size() > 1) {
+    auto node = nodes.back();
+    if (node->path || !node->children.empty()) {
+      break;
+    }
+    nodes.pop_back();
+    auto& children = nodes.back()->children;
+    children.erase(children.find(node->name.piece()));
+  }
+  return true;
+}
+
+const w_string* RootPathTrie::findEnclosing(w_string_piece path) const {
+  const Node* node = &root_;
+  const w_string* found = root_.path ? &root_.path : nullptr;
+  forEachComponent(path, [&](w_string_piece component) {
+    auto it = node->children.find(component);
+    if (it == node->children.end()) {
+      return false;
+    }
+    node = it->second.get();
+    if (node->path) {
+      found = &node->path;
+    }
+    return true;
+  });
+  return found;
+}
+
+} // namespace watchman
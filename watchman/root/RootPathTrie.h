@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A trie of the paths of the watched roots, keyed by path component.
+ *
+ * Finding the root that encloses a path then takes a lookup per component of
+ * that path, rather than a comparison against every root, and does not
+ * allocate.
+ *
+ * RootPathTrie is not thread safe: the owner must provide synchronization.
+ */
+class RootPathTrie {
+ public:
+  /**
+   * Adds path, which must be absolute and canonical.
+   */
+  void insert(const w_string& path);
+
+  /**
+   * Removes path. Returns false if it was not present.
+   */
+  bool erase(w_string_piece path);
+
+  /**
+   * Returns the longest of the paths that were added that is either path
+   * itself or one of its parent dirs, or nullptr if there is none. The
+   * result remains valid until that path is erased.
+   */
+  const w_string* findEnclosing(w_string_piece path) const;
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  struct Node {
+    // The component that leads to this node from its parent
+    w_string name;
+    // Set if an added path ends at this node
+    w_string path;
+    // Keys point into the name of the corresponding node.
+    std::unordered_map<w_string_piece, std::unique_ptr<Node>> children;
+  };
+
+  Node root_;
+  size_t size_{0};
+};
+
+} // namespace watchman
@@ -24,7 +24,7 @@ void Root::considerAgeOut() {
   performAgeOut(gc_age);
 }
 
-void Root::performAgeOut(std::chrono::seconds min_age) {
+json_ref Root::performAgeOut(std::chrono::seconds min_age) {
   // Find deleted nodes older than the gc_age setting.
   // This is particularly useful in cases where your tree observes a
   // large number of creates and deletes for many unique filenames in
@@ -46,10 +46,12 @@ void Root::performAgeOut(std::chrono::seconds min_age) {
       }
     }
   }
+  auto stats = sample.meta_data.get_default("age_out", json_object());
   if (sample.finish()) {
     addPerfSampleMetadata(sample);
     sample.log();
   }
+  return stats;
 }
 
 /* vim:ts=2:sw=2:et:
@@ -6,14 +6,105 @@
  */
 
 #include "watchman/watchman_dir.h"
+#include <type_traits>
+#include "watchman/Logging.h"
+#include "watchman/SlabAllocator.h"
 #include "watchman/watchman_file.h"
 
 void watchman_dir::Deleter::operator()(watchman_file* file) const {
   free_file_node(file);
 }
 
-watchman_dir::watchman_dir(w_string name, watchman_dir* parent)
-    : name(std::move(name)), parent(parent) {}
+void watchman_dir::DirDeleter::operator()(watchman_dir* dir) const {
+  auto allocator = dir->allocator;
+  dir->~watchman_dir();
+  if (allocator) {
+    allocator->deallocate(dir, sizeof(watchman_dir));
+  } else {
+    ::operator delete(dir);
+  }
+}
+
+watchman_dir::watchman_dir(
+    w_string name,
+    watchman_dir* parent,
+    watchman::SlabAllocator* allocator)
+    : name(std::move(name)), parent(parent), allocator(allocator) {}
+
+watchman_dir::DirPtr watchman_dir::make(
+    w_string name,
+    watchman_dir* parent,
+    watchman::SlabAllocator* allocator) {
+  void* storage = allocator ? allocator->allocate(sizeof(watchman_dir))
+                            : ::operator new(sizeof(watchman_dir));
+  try {
+    return DirPtr{new (storage) watchman_dir(std::move(name), parent, allocator)};
+  } catch (...) {
+    if (allocator) {
+      allocator->deallocate(storage, sizeof(watchman_dir));
+    } else {
+      ::operator delete(storage);
+    }
+    throw;
+  }
+}
+
+namespace {
+
+// Removes the entry of map that holds child, which is one of those keyed
+// by its name.
+template <typename V>
+void eraseFolded(
+    watchman_dir::FoldedMap<V>& map,
+    w_string_piece name,
+    const std::remove_pointer_t<V>* child) {
+  auto range = map.equal_range(watchman_dir::FoldedKey{name});
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == child) {
+      map.erase(it);
+      return;
+    }
+  }
+}
+
+} // namespace
+
+watchman_dir::FoldedKey::FoldedKey(w_string_piece name) : name(name) {
+  // FNV-1a over the bytes as w_string_equal_caseless compares them.
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < name.size(); ++i) {
+    auto c = uint8_t(name[i]);
+    if (c >= 'A' && c <= 'Z') {
+      c |= 0x20;
+    }
+    h = (h ^ c) * 16777619u;
+  }
+  hash = h;
+}
+
+void watchman_dir::enableCaseFolding() {
+  if (!folded) {
+    folded = std::make_unique<FoldedChildren>();
+  }
+}
+
+void watchman_dir::addFoldedChild(watchman_file* file) {
+  if (folded) {
+    folded->files.emplace(FoldedKey{file->getName()}, file);
+  }
+}
+
+void watchman_dir::removeFoldedChild(const watchman_file* file) {
+  if (folded) {
+    eraseFolded(folded->files, file->getName(), file);
+  }
+}
+
+void watchman_dir::removeFoldedChild(const watchman_dir* dir) {
+  if (folded) {
+    eraseFolded(folded->dirs, dir->name, dir);
+  }
+}
 
 w_string watchman_dir::getFullPath() const {
   return getFullPathToChild(w_string_piece());
@@ -35,6 +126,52 @@ watchman_dir* watchman_dir::getChildDir(w_string_piece name) const {
   return it->second.get();
 }
 
+watchman_dir* watchman_dir::getOrCreateChildDir(const w_string& name) {
+  auto it = dirs.find(name);
+  if (it != dirs.end()) {
+    return it->second.get();
+  }
+
+  // The key must point into storage owned by the child, so create the child
+  // before inserting it.
+  auto child = make(name, this, allocator);
+  auto* result = child.get();
+  if (folded) {
+    result->enableCaseFolding();
+  }
+  dirs.emplace(result->name, std::move(child));
+  if (folded) {
+    folded->dirs.emplace(FoldedKey{result->name}, result);
+  }
+  return result;
+}
+
+watchman_dir::DirPtr watchman_dir::detachChildDir(w_string_piece name) {
+  auto it = dirs.find(name);
+  if (it == dirs.end()) {
+    return nullptr;
+  }
+  auto child = std::move(it->second);
+  removeFoldedChild(child.get());
+  dirs.erase(it);
+  return child;
+}
+
+watchman_dir* watchman_dir::adoptChildDir(DirPtr child, w_string name) {
+  w_check(
+      child->allocator == allocator,
+      "dirs can only move within the allocator that owns them\n");
+  w_check(!getChildDir(name), "adoptChildDir: ", name, " is already taken\n");
+  auto* result = child.get();
+  result->name = std::move(name);
+  result->parent = this;
+  dirs.emplace(result->name, std::move(child));
+  if (folded) {
+    folded->dirs.emplace(FoldedKey{result->name}, result);
+  }
+  return result;
+}
+
 w_string watchman_dir::getFullPathToChild(w_string_piece extra) const {
   uint32_t length = 0;
   w_string_t* s;
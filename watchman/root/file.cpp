@@ -6,6 +6,7 @@
  */
 
 #include "watchman/watchman_file.h"
+#include "watchman/SlabAllocator.h"
 #ifdef __APPLE__
 #include <sys/attr.h> // @manual
 #endif
@@ -24,6 +25,17 @@ void watchman_file::removeFromFileList() {
   }
 }
 
+void watchman_file::removeFromDirFileList() {
+  if (dirNext) {
+    dirNext->dirPrev = dirPrev;
+  }
+  if (dirPrev) {
+    *dirPrev = dirNext;
+  }
+  dirPrev = nullptr;
+  dirNext = nullptr;
+}
+
 /* We embed our name string in the tail end of the struct that we're
  * allocating here.  This turns out to be more memory efficient due
  * to the way that the allocator bins sizeof(watchman_file); there's
@@ -31,12 +43,76 @@ void watchman_file::removeFromFileList() {
  * to be about the right size to fit a typical filename.
  * Embedding the name in the end allows us to make the most of this
  * memory and free up the separate heap allocation for file_name.
+ *
+ * When the parent dir has a SlabAllocator, the node is carved out of
+ * one of its slabs so that siblings are laid out next to each other.
+ *
+ * If the extended stat fields are retained, they follow the name, suitably
+ * aligned.
  */
+static size_t extended_stat_offset(size_t name_len) {
+  auto align = alignof(watchman::ExtendedFileInformation);
+  auto end = sizeof(watchman_file) + sizeof(uint32_t) + name_len + 1;
+  return (end + align - 1) & ~(align - 1);
+}
+
+static size_t file_node_size(size_t name_len, bool with_extended_stat) {
+  if (with_extended_stat) {
+    return extended_stat_offset(name_len) +
+        sizeof(watchman::ExtendedFileInformation);
+  }
+  return sizeof(watchman_file) + sizeof(uint32_t) + name_len + 1;
+}
+
+const watchman::ExtendedFileInformation* watchman_file::getExtendedStat()
+    const {
+  if (!has_extended_stat) {
+    return nullptr;
+  }
+  return reinterpret_cast<const watchman::ExtendedFileInformation*>(
+      reinterpret_cast<const char*>(this) +
+      extended_stat_offset(getName().size()));
+}
+
+void watchman_file::setStat(const watchman::FileInformation& info) {
+  stat = watchman::CompactFileInformation(info);
+  stat_deferred = false;
+  if (has_extended_stat) {
+    auto extended = reinterpret_cast<watchman::ExtendedFileInformation*>(
+        reinterpret_cast<char*>(this) + extended_stat_offset(getName().size()));
+    *extended = watchman::ExtendedFileInformation(info);
+  }
+}
+
+size_t watchman_file::getAllocationSize() const {
+  return file_node_size(getName().size(), has_extended_stat);
+}
+
+watchman::FileInformation watchman_file::getFileInformation() const {
+  return watchman::expandFileInformation(stat, getExtendedStat());
+}
+
+bool watchman_file::statDiffersFrom(
+    const watchman::FileInformation& info) const {
+  if (stat.differsFrom(info)) {
+    return true;
+  }
+  auto extended = getExtendedStat();
+  return extended && extended->differsFrom(info);
+}
+
 std::unique_ptr<watchman_file, watchman_dir::Deleter> watchman_file::make(
     const w_string& name,
-    watchman_dir* parent) {
-  auto file = (watchman_file*)calloc(
-      1, sizeof(watchman_file) + sizeof(uint32_t) + name.size() + 1);
+    watchman_dir* parent,
+    bool withExtendedStat) {
+  auto size = file_node_size(name.size(), withExtendedStat);
+  auto allocator = parent ? parent->allocator : nullptr;
+  auto file = (watchman_file*)(allocator ? allocator->allocate(size)
+                                         : malloc(size));
+  if (!file) {
+    throw std::bad_alloc();
+  }
+  memset(file, 0, size);
   std::unique_ptr<watchman_file, watchman_dir::Deleter> filePtr(
       file, watchman_dir::Deleter());
 
@@ -49,17 +125,25 @@ std::unique_ptr<watchman_file, watchman_dir::Deleter> watchman_file::make(
 
   file->parent = parent;
   file->exists = true;
+  file->has_extended_stat = withExtendedStat;
 
   return filePtr;
 }
 
 watchman_file::~watchman_file() {
   removeFromFileList();
+  removeFromDirFileList();
 }
 
 void free_file_node(struct watchman_file* file) {
+  auto size = file->getAllocationSize();
+  auto allocator = file->parent ? file->parent->allocator : nullptr;
   file->~watchman_file();
-  free(file);
+  if (allocator) {
+    allocator->deallocate(file, size);
+  } else {
+    free(file);
+  }
 }
 
 /* vim:ts=2:sw=2:et:
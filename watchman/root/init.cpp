@@ -6,8 +6,10 @@
  */
 
 #include <folly/String.h>
+#include <algorithm>
 #include "watchman/Logging.h"
 #include "watchman/QueryableView.h"
+#include "watchman/Tracing.h"
 #include "watchman/TriggerCommand.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/fs/FSDetect.h"
@@ -20,6 +22,14 @@ namespace {
 /// Idle out watches that haven't had activity in several days
 inline constexpr json_int_t kDefaultReapAge = 86400 * 5;
 inline constexpr json_int_t kDefaultSettlePeriod = 20;
+/// Notifications kept for a subscriber that has stopped reading them
+inline constexpr json_int_t kDefaultSubscriptionBacklog = 1024;
+
+size_t subscriptionBacklogSize(const Configuration& config) {
+  return size_t(std::max<json_int_t>(
+      0,
+      config.getInt("subscription_backlog_size", kDefaultSubscriptionBacklog)));
+}
 } // namespace
 
 void ClientStateAssertions::queueAssertion(
@@ -217,6 +227,23 @@ IgnoreSet computeIgnoreSet(
     }
   }
 
+  if (auto globs = config.get("ignore_globs")) {
+    if (!globs->isArray()) {
+      logf(ERR, "ignore_globs must be an array of strings\n");
+    } else {
+      for (auto& jglob : globs->array()) {
+        if (!jglob.isString()) {
+          logf(ERR, "ignore_globs must be an array of strings\n");
+          continue;
+        }
+
+        auto pattern = json_to_w_string(jglob);
+        result.addGlob(root_path, pattern);
+        logf(DBG, "ignoring {} below {}\n", pattern, root_path);
+      }
+    }
+  }
+
   auto ignores = getIgnoreVcs(config);
   for (auto& jignore : ignores.array()) {
     if (!jignore.isString()) {
@@ -245,6 +272,7 @@ Root::Root(
     std::shared_ptr<QueryableView> view,
     SaveGlobalStateHook saveGlobalStateHook)
     : RootConfig{root_path, fs_type, getCaseSensitivityForPath(root_path.c_str()), computeIgnoreSet(root_path, config_)},
+      traceId(getTraceRootId(root_path)),
       cookies(
           fileSystem,
           computeCookieDir(root_path, config_, case_sensitive, ignore)),
@@ -257,7 +285,22 @@ Root::Root(
       gc_age(int(config.getInt("gc_age_seconds", DEFAULT_GC_AGE))),
       idle_reap_age(
           int(config.getInt("idle_reap_age_seconds", kDefaultReapAge))),
-      unilateralResponses(std::make_shared<Publisher>()),
+      suppress_recrawl_warnings(
+          config.getBool("suppress_recrawl_warnings", false)),
+      hint_num_files_per_dir(
+          uint32_t(config.getInt("hint_num_files_per_dir", 64))),
+      subscription_lock_timeout_ms(
+          uint32_t(config.getInt("subscription_lock_timeout_ms", 100))),
+      trigger_max_concurrent_per_root(
+          config.getInt("trigger_max_concurrent_per_root", 0)),
+      query_cheap_since_ticks(ClockTicks(std::max<json_int_t>(
+          0, config.getInt("query_cheap_since_ticks", 128)))),
+      queryAdmission(size_t(
+          std::max<json_int_t>(0, config.getInt("query_max_concurrency", 0)))),
+      unilateralResponses(
+          std::make_shared<Publisher>(subscriptionBacklogSize(config))),
+      crawlProgress(
+          std::make_shared<Publisher>(subscriptionBacklogSize(config))),
       view_{std::move(view)},
       saveGlobalStateHook_{std::move(saveGlobalStateHook)} {
   // This just opens and releases the dir.  If an exception is thrown
@@ -6,9 +6,28 @@
  */
 
 #include <fmt/chrono.h>
+#include <folly/portability/Unistd.h>
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include "watchman/CrawlScheduler.h"
+#include "watchman/MaintenanceScheduler.h"
 #include "watchman/Errors.h"
+#include "watchman/HeapProfile.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/Metrics.h"
+#include "watchman/Options.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/TickIndex.h"
+#include "watchman/Tracing.h"
+#include "watchman/VcsIgnore.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/fs/ParallelWalk.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/warnerr.h"
@@ -30,22 +49,76 @@ void InMemoryView::fullCrawl(
     const std::shared_ptr<Root>& root,
     PendingCollection& pendingFromWatcher,
     PendingChanges& localPending) {
+  // After a restart, the restored roots take turns, and so do recrawls.
+  bool isRecrawl = root->recrawlInfo.rlock()->recrawlScheduled;
+  root->recrawlInfo.wlock()->waitingForTurn = true;
+  auto crawlTurn =
+      getCrawlScheduler().acquire(rootPath_, stopThreads_, isRecrawl);
+  root->recrawlInfo.wlock()->waitingForTurn = false;
+  if (!crawlTurn) {
+    return;
+  }
   root->recrawlInfo.wlock()->crawlStart = std::chrono::steady_clock::now();
 
   PerfSample sample("full-crawl");
+  TraceScope span{"full_crawl", traceRootId_};
+
+  // Only the first crawl of this incarnation can pick up where the previous
+  // one left off.
+  std::unique_ptr<TickIndexReader> tickIndex;
+  if (!tickIndexLoaded_) {
+    tickIndexLoaded_ = true;
+    tickIndex = openTickIndex();
+  }
+  if (tickIndex) {
+    // Every change observed by this crawl must have a tick that the previous
+    // incarnation did not issue.
+    auto lastTicks = tickIndex->header().clock.lastTicks;
+    if (mostRecentTick_.load(std::memory_order_acquire) <= lastTicks) {
+      mostRecentTick_.store(lastTicks + 1, std::memory_order_release);
+      publishedTick_.store(lastTicks + 1, std::memory_order_release);
+    }
+  }
 
-  auto view = view_.wlock();
-  // Ensure that we observe these files with a new, distinct clock,
-  // otherwise a fresh subscription established immediately after a watch
-  // can get stuck with an empty view until another change is observed
-  mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+  // Locking advances the tick, which ensures that we observe these files
+  // with a new, distinct clock, otherwise a fresh subscription established
+  // immediately after a watch can get stuck with an empty view until another
+  // change is observed
+  ViewWriter view{*this};
+  view.lockAll();
 
   fullCrawlStatCount_ = std::make_shared<std::atomic<size_t>>(0);
   root->recrawlInfo.wlock()->statCount = fullCrawlStatCount_;
+  fullCrawlDirCount_ = 0;
+  fullCrawlStart_ = std::chrono::steady_clock::now();
+  lastCrawlProgress_ = fullCrawlStart_;
+
+  // Any verification left over from a warm start is subsumed by this crawl.
+  warmStartVerifyQueue_.clear();
+  bool warmStarted = false;
+  // The index doesn't say which dirs were left unexplored.
+  if (tickIndex && warmStartFromTickIndex_ && lazyCrawlDepth_ == 0) {
+    warmStarted = warmStart(*root, view, *tickIndex);
+    // Either way, the index has been used up.
+    tickIndex.reset();
+  }
+  if (watcherResumed_.exchange(false, std::memory_order_acq_rel) &&
+      warmStarted) {
+    // The watcher is replaying every change made since the index was
+    // written, so there is nothing left to verify.
+    logf(
+        ERR,
+        "{}: resumed the watcher's event stream, skipping verification\n",
+        rootPath_);
+    warmStartVerifyQueue_.clear();
+  }
 
   auto start = std::chrono::system_clock::now();
-  pendingFromWatcher.lock()->add(root->root_path, start, W_PENDING_RECURSIVE);
-  while (true) {
+  if (!warmStarted) {
+    pendingFromWatcher.lock()->add(
+        root->root_path, start, W_PENDING_RECURSIVE);
+  }
+  while (!warmStarted) {
     // There is the potential for a subtle race condition here.  Since we now
     // coalesce overlaps we must consume our outstanding set before we merge
     // in any new kernel notification information or we risk missing out on
@@ -54,14 +127,25 @@ void InMemoryView::fullCrawl(
     // inotify, then the inner loop processes it and any dirs that we pick up
     // from recursive processing.
     {
-      auto lock = pendingFromWatcher.lock();
+      auto lock = pendingFromWatcher.lockAndDrain();
       localPending.append(lock->stealItems(), lock->stealSyncs());
     }
     if (localPending.empty()) {
       break;
     }
 
-    (void)processAllPending(root, *view, localPending);
+    (void)processAllPending(root, view, localPending);
+  }
+
+  if (tickIndex) {
+    applyTickIndex(view, *tickIndex);
+  }
+
+  reportCrawlProgress(*root, true);
+  if (!warmStarted) {
+    lastCrawlTotals_ = CrawlTotals{
+        fullCrawlDirCount_,
+        fullCrawlStatCount_->load(std::memory_order_acquire)};
   }
 
   auto recrawlInfo = root->recrawlInfo.wlock();
@@ -85,25 +169,100 @@ void InMemoryView::fullCrawl(
   sample.force_log();
   sample.log();
 
-  logf(ERR, "{}crawl complete\n", recrawlCount ? "re" : "");
+  if (warmStarted) {
+    logf(
+        ERR,
+        "warm start complete, verifying {} dirs\n",
+        warmStartVerifyQueue_.size());
+  } else {
+    logf(ERR, "{}crawl complete\n", recrawlCount ? "re" : "");
+  }
+}
+
+void InMemoryView::reportCrawlProgress(Root& root, bool done) {
+  if (!fullCrawlStatCount_) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (!done && now - lastCrawlProgress_ < crawlProgressInterval_) {
+    return;
+  }
+  lastCrawlProgress_ = now;
+  if (!root.crawlProgress->hasSubscribers()) {
+    return;
+  }
+
+  size_t stats = fullCrawlStatCount_->load(std::memory_order_acquire);
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     now - fullCrawlStart_)
+                     .count();
+  auto progress = json_object(
+      {{"dirs", json_integer(fullCrawlDirCount_)},
+       {"stats", json_integer(stats)},
+       {"elapsed_ms", json_integer(elapsed)},
+       {"stats_per_second",
+        json_integer(elapsed > 0 ? stats * 1000 / elapsed : 0)},
+       {"done", json_boolean(done)}});
+  // Assume that the tree is about the size that it was last time, and that
+  // the rest of it will be crawled at the rate seen so far.
+  if (lastCrawlTotals_ && !done && stats > 0) {
+    auto remaining = lastCrawlTotals_->stats > stats
+        ? (lastCrawlTotals_->stats - stats) * elapsed / stats
+        : 0;
+    progress.set("estimated_remaining_ms", json_integer(remaining));
+  }
+  if (lastCrawlTotals_) {
+    progress.set(
+        {{"previous_dirs", json_integer(lastCrawlTotals_->dirs)},
+         {"previous_stats", json_integer(lastCrawlTotals_->stats)}});
+  }
+
+  root.crawlProgress->enqueue(json_object(
+      {{"unilateral", json_true()},
+       {"root", w_string_to_json(root.root_path)},
+       {"crawl-progress", std::move(progress)}}));
 }
 
 InMemoryView::Continue InMemoryView::doSettleThings(
     Root& root,
-    IoThreadState& state) {
+    IoThreadState& state,
+    bool forced) {
   // No new pending items were given to us, so consider that
-  // we may now be settled.
+  // we may now be settled.  If forced, they are still arriving, but have
+  // been for settle_max_wait_ms.
+
+  state.settle.noteSettled(forced);
+  if (state.settle.enabled()) {
+    *settleStatus_.wlock() = state.settle.getStatus(root.trigger_settle);
+  }
 
   std::chrono::milliseconds sinceUnsettle = state.lastUnsettle
       ? std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::steady_clock::now() - *state.lastUnsettle)
       : std::chrono::milliseconds{0};
 
-  warmContentCache();
+  const bool hibernated = hibernated_.load(std::memory_order_acquire);
+  if (!hibernated) {
+    warmContentCache();
+    prefetchMergeBases();
+    recordChangeSet(root.assertedStates.rlock()->hasAssertions());
+  }
+  // Ahead of the settle, so that it only wakes the subscriptions whose
+  // prefilters matched, and of the compaction, which frees the nodes of the
+  // deleted files that they need to see.
+  markChangePrefilters();
+  if (!hibernated) {
+    // After the change set has copied the deleted files that it needs
+    compactDeletedFiles();
+  }
 
   root.unilateralResponses->enqueue(json_object({{"settled", json_true()}}));
 
-  if (root.considerReap()) {
+  // Otherwise the maintenance scheduler reaps and ages out the root when
+  // the daemon is idle.
+  const bool maintainSelf = !getMaintenanceScheduler().enabled();
+
+  if (maintainSelf && root.considerReap()) {
     root.stopWatch();
     return Continue::Stop;
   }
@@ -131,10 +290,536 @@ InMemoryView::Continue InMemoryView::doSettleThings(
         std::min(state.biggestTimeout, state.currentTimeout * 2);
   }
 
-  root.considerAgeOut();
+  if (hibernated) {
+    return Continue::Continue;
+  }
+
+  if (maintainSelf) {
+    root.considerAgeOut();
+  }
+
+  if (persistTickIndex_ && tickIndexSaveInterval_.count() > 0 &&
+      (!lastTickIndexSave_ ||
+       std::chrono::steady_clock::now() - *lastTickIndexSave_ >=
+           tickIndexSaveInterval_)) {
+    saveTickIndex(true);
+  }
+
+  if ((caches_.sha1Store || caches_.spookyStore) &&
+      (!lastContentHashSave_ ||
+       std::chrono::steady_clock::now() - *lastContentHashSave_ >=
+           contentHashSaveInterval_)) {
+    lastContentHashSave_ = std::chrono::steady_clock::now();
+    caches_.saveContentHashes(/*async=*/true);
+  }
+
+  if (hibernateIdle_.count() > 0 &&
+      !(shouldHibernate(root) && hibernate(root))) {
+    // Wake up in time to hibernate.
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        root.inner.last_cmd_timestamp.load(std::memory_order_acquire) +
+        hibernateIdle_ - std::chrono::steady_clock::now());
+    if (remaining.count() > 0) {
+      state.currentTimeout = std::min(state.currentTimeout, remaining);
+    }
+  }
   return Continue::Continue;
 }
 
+namespace {
+
+// The tick index for a root is kept alongside the state file. Returns an
+// empty string if state is not being saved.
+w_string statePathForRoot(const w_string& rootPath, const char* suffix) {
+  if (flags.dont_save_state || flags.watchman_state_file.empty()) {
+    return w_string{};
+  }
+  return w_string::build(
+      flags.watchman_state_file,
+      ".",
+      fmt::format("{:08x}", w_string_piece(rootPath).stableHashValue()),
+      suffix);
+}
+
+w_string tickIndexPathForRoot(const w_string& rootPath) {
+  return statePathForRoot(rootPath, ".ticks");
+}
+
+// Where a hibernating view is kept, in the tick index format.
+w_string hibernationPathForRoot(const w_string& rootPath) {
+  return statePathForRoot(rootPath, ".hibernated");
+}
+
+// Walks the dirs below the given ones, as loaded from a tick index, parents
+// first. Those whose node says they no longer exist are marked as such;
+// visit is called with the others.
+template <typename Visit>
+void markLoadedDirs(std::deque<watchman_dir*> dirs, Visit visit) {
+  while (!dirs.empty()) {
+    auto parent = dirs.front();
+    dirs.pop_front();
+    for (auto& it : parent->dirs) {
+      auto child = it.second.get();
+      auto node = parent->getChildFile(child->name);
+      if (parent->last_check_existed && node && node->exists) {
+        visit(child);
+      } else {
+        child->last_check_existed = false;
+      }
+      dirs.push_back(child);
+    }
+  }
+}
+
+} // namespace
+
+std::unique_ptr<TickIndexReader> InMemoryView::openTickIndex() const {
+  if (!persistTickIndex_) {
+    return nullptr;
+  }
+  auto path = tickIndexPathForRoot(rootPath_);
+  if (path.empty()) {
+    return nullptr;
+  }
+
+  try {
+    auto index = std::make_unique<TickIndexReader>(path.c_str());
+    if (index->header().rootPath != rootPath_) {
+      logf(
+          ERR,
+          "ignoring tick index {}: it was written for {}\n",
+          path,
+          index->header().rootPath);
+      return nullptr;
+    }
+    return index;
+  } catch (const std::system_error& exc) {
+    if (exc.code() != std::errc::no_such_file_or_directory) {
+      logf(ERR, "unable to load tick index {}: {}\n", path, exc.what());
+    }
+  } catch (const std::exception& exc) {
+    logf(ERR, "unable to load tick index {}: {}\n", path, exc.what());
+  }
+  return nullptr;
+}
+
+void InMemoryView::applyTickIndex(ViewWriter& view, TickIndexReader& index) {
+  const auto& header = index.header();
+  auto roots = view.resolveDir(rootPath_);
+  if (roots.front().view.getRootInode() != header.rootInode) {
+    logf(
+        ERR,
+        "not using tick index for {}: the root dir has been replaced\n",
+        rootPath_);
+    return;
+  }
+
+  // Entries that existed when the index was written but are gone now were
+  // deleted at some point after then.
+  auto deletionClock = getClock(std::chrono::system_clock::now());
+  bool complete = false;
+  size_t restored = 0;
+
+  try {
+    w_string dirPath;
+    ViewDatabase* dirShard = nullptr;
+    watchman_dir* dir = nullptr;
+
+    while (true) {
+      auto record = index.next();
+      if (record == TickIndexReader::Record::End) {
+        break;
+      }
+      if (record == TickIndexReader::Record::Dir) {
+        dirPath = index.dir().empty()
+            ? rootPath_
+            : w_string::pathCat({rootPath_, index.dir()});
+        dirShard = nullptr;
+        dir = nullptr;
+        continue;
+      }
+
+      const auto& entry = index.file();
+      ViewDatabase* shard;
+      watchman_dir* parent;
+      if (dirPath == rootPath_) {
+        auto& rootDir = view.childDir(roots, entry.name);
+        shard = &rootDir.view;
+        parent = rootDir.dir;
+      } else {
+        if (!dirShard) {
+          dirShard = &view.forPath(dirPath);
+          dir = dirShard->resolveDir(dirPath, false);
+        }
+        shard = dirShard;
+        parent = dir;
+      }
+
+      auto file = parent ? parent->getChildFile(entry.name) : nullptr;
+      if (file) {
+        // The same inode has existed throughout, so the file was not created
+        // since; it only changed if its stat information did.
+        if (file->exists && entry.exists && file->stat.ino == entry.stat.ino) {
+          file->ctime = entry.ctime;
+          if (!file->stat.differsFrom(entry.stat)) {
+            file->otime = entry.otime;
+          }
+          ++restored;
+        }
+        continue;
+      }
+
+      // Keep a deleted node for the entry, so that it is reported as deleted
+      // to clients that saw it exist.
+      if (!parent) {
+        parent = shard->resolveDir(dirPath, true);
+        // Neither the dir nor the ancestors created along with it exist.
+        for (auto d = parent; d->parent; d = d->parent) {
+          auto node = d->parent->getChildFile(d->name);
+          if (node && node->exists) {
+            break;
+          }
+          d->last_check_existed = false;
+        }
+        if (dirPath != rootPath_) {
+          dir = parent;
+        }
+      }
+      file = shard->getOrCreateChildFile(
+          *watcher_, parent, entry.name, entry.ctime);
+      file->exists = false;
+      file->stat = entry.stat;
+      file->otime = entry.exists ? deletionClock : entry.otime;
+    }
+    complete = true;
+  } catch (const std::exception& exc) {
+    logf(ERR, "failed to apply tick index for {}: {}\n", rootPath_, exc.what());
+  }
+
+  // The restored otimes are out of order with respect to the recency index.
+  for (auto& rootDir : roots) {
+    rootDir.view.sortRecencyLists();
+  }
+
+  if (!complete) {
+    return;
+  }
+
+  lastAgeOutTick_ = std::max(lastAgeOutTick_, header.lastAgeOutTicks);
+  *clockPredecessor_.wlock() = header.clock;
+  logf(
+      ERR,
+      "continued the tick sequence of the previous watch of {}, "
+      "{} files unchanged\n",
+      rootPath_,
+      restored);
+}
+
+bool InMemoryView::warmStart(
+    const Root& root,
+    ViewWriter& view,
+    TickIndexReader& index) {
+  const auto& header = index.header();
+  try {
+    auto st =
+        fileSystem_.getFileInformation(rootPath_.c_str(), root.case_sensitive);
+    if (st.ino != header.rootInode) {
+      logf(
+          ERR,
+          "not warm starting {}: the root dir has been replaced\n",
+          rootPath_);
+      return false;
+    }
+  } catch (const std::system_error& exc) {
+    logf(ERR, "not warm starting {}: {}\n", rootPath_, exc.what());
+    return false;
+  }
+
+  auto roots = view.resolveDir(rootPath_);
+  bool complete = true;
+  try {
+    loadTickIndex(view, roots, index);
+  } catch (const std::exception& exc) {
+    logf(ERR, "not warm starting {}: {}\n", rootPath_, exc.what());
+    complete = false;
+  }
+
+  for (auto& rootDir : roots) {
+    rootDir.view.sortRecencyLists();
+  }
+  if (!complete) {
+    // The full crawl treats whatever was loaded like the remains of an
+    // earlier crawl: nodes that are still accurate keep their clocks, which
+    // are older than any clock that this incarnation has issued.
+    return false;
+  }
+  roots.front().view.setRootInode(header.rootInode);
+  lastAgeOutTick_ = std::max(lastAgeOutTick_, header.lastAgeOutTicks);
+  *clockPredecessor_.wlock() = header.clock;
+
+  // Visit every dir that existed, parents first, to re-establish the
+  // watches and to find what changed while the root was not watched.
+  // The root is split across the shards; it only needs one visit.
+  warmStartVerifyQueue_.push_back(rootPath_);
+  std::deque<watchman_dir*> dirs;
+  for (auto& rootDir : roots) {
+    dirs.push_back(rootDir.dir);
+  }
+  markLoadedDirs(std::move(dirs), [&](const watchman_dir* dir) {
+    warmStartVerifyQueue_.push_back(dir->getFullPath());
+  });
+  return true;
+}
+
+void InMemoryView::loadTickIndex(
+    ViewWriter& view,
+    std::vector<ViewWriter::ShardDir>& roots,
+    TickIndexReader& index) {
+  // Null while in the root dir, whose entries are spread across shards.
+  ViewDatabase* dirShard = nullptr;
+  watchman_dir* dir = nullptr;
+
+  while (true) {
+    auto record = index.next();
+    if (record == TickIndexReader::Record::End) {
+      break;
+    }
+    if (record == TickIndexReader::Record::Dir) {
+      if (index.dir().empty()) {
+        dirShard = nullptr;
+        dir = nullptr;
+      } else {
+        auto dirPath = w_string::pathCat({rootPath_, index.dir()});
+        dirShard = &view.forPath(dirPath);
+        dir = dirShard->resolveDir(dirPath, true);
+      }
+      continue;
+    }
+
+    const auto& entry = index.file();
+    ViewDatabase* shard = dirShard;
+    watchman_dir* parent = dir;
+    if (!dir) {
+      auto& rootDir = view.childDir(roots, entry.name);
+      shard = &rootDir.view;
+      parent = rootDir.dir;
+    }
+    auto file = shard->getOrCreateChildFile(
+        *watcher_, parent, entry.name, entry.ctime);
+    file->otime = entry.otime;
+    file->exists = entry.exists;
+    file->stat = entry.stat;
+  }
+}
+
+void InMemoryView::queueWarmStartVerification(PendingChanges& pending) {
+  auto now = std::chrono::system_clock::now();
+  for (size_t i = 0;
+       i < warmStartVerifyBatch_ && !warmStartVerifyQueue_.empty();
+       ++i) {
+    pending.add(
+        warmStartVerifyQueue_.front(),
+        now,
+        W_PENDING_CRAWL_ONLY | W_PENDING_NONRECURSIVE_SCAN);
+    warmStartVerifyQueue_.pop_front();
+  }
+  if (warmStartVerifyQueue_.empty()) {
+    logf(ERR, "warm start verification of {} complete\n", rootPath_);
+  }
+}
+
+void InMemoryView::saveTickIndex(bool drained) {
+  lastTickIndexSave_ = std::chrono::steady_clock::now();
+  auto path = tickIndexPathForRoot(rootPath_);
+  if (path.empty()) {
+    return;
+  }
+
+  // The cursor only describes the view if everything that the watcher
+  // reported up to it has been processed, and the view has been verified.
+  w_string watcherCursor;
+  if (drained && warmStartVerifyQueue_.empty()) {
+    auto cursor = *watcherCursor_.rlock();
+    auto pending = pendingFromWatcher_.lockAndDrain();
+    if (pending->empty()) {
+      watcherCursor = std::move(cursor);
+    }
+  }
+
+  writeTickIndex(path, watcherCursor);
+}
+
+bool InMemoryView::writeTickIndex(
+    const w_string& path,
+    const w_string& watcherCursor) {
+  try {
+    writeSnapshot(path, watcherCursor);
+  } catch (const std::exception& exc) {
+    logf(ERR, "failed to save tick index {}: {}\n", path, exc.what());
+    return false;
+  }
+  return true;
+}
+
+size_t InMemoryView::writeSnapshot(
+    const w_string& path,
+    const w_string& watcherCursor) const {
+  auto views = rlockAllShards();
+
+  TickIndexHeader header;
+  header.rootPath = rootPath_;
+  auto clock = ClockSpec::current(getMostRecentRootNumberAndTickValue());
+  header.clock.start_time = clock.start_time;
+  header.clock.pid = clock.pid;
+  header.clock.rootNumber = clock.position.rootNumber;
+  header.clock.lastTicks = clock.position.ticks;
+  header.lastAgeOutTicks = lastAgeOutTick_;
+  // Tombstones aren't saved, so the deletions that they record can't be
+  // reported from the index.
+  for (auto& view : views) {
+    header.lastAgeOutTicks =
+        std::max(header.lastAgeOutTicks, view->tombstones().newestTick());
+  }
+  header.rootInode = views.front()->getRootInode();
+  header.watcherCursor = watcherCursor;
+
+  TickIndexWriter writer{path, header};
+  size_t numFiles = 0;
+
+  auto writeDir = [&writer, &numFiles](
+                      const watchman_dir* dir,
+                      const w_string& relPath,
+                      auto& recurse) -> void {
+    writer.addDir(relPath);
+    for (auto& it : dir->files) {
+      auto file = it.second.get();
+      writer.addFile(TickIndexFile{
+          file->getName().asWString(),
+          file->otime,
+          file->ctime,
+          file->exists,
+          file->stat});
+      ++numFiles;
+    }
+    for (auto& it : dir->dirs) {
+      recurse(
+          it.second.get(),
+          relPath.empty() ? it.second->name
+                          : w_string::pathCat({relPath, it.second->name}),
+          recurse);
+    }
+  };
+  // Each shard holds a part of the root dir; the reader doesn't mind the
+  // root dir being started more than once.
+  for (auto& view : views) {
+    writeDir(view->resolveDir(rootPath_), w_string{}, writeDir);
+  }
+
+  writer.commit();
+  return numFiles;
+}
+
+std::optional<size_t> InMemoryView::dumpView(const w_string& path) const {
+  wakeFromHibernation();
+  // Without a cursor, a root that finds the dump where its tick index
+  // belongs still verifies what it loads.
+  return writeSnapshot(path, w_string{});
+}
+
+bool InMemoryView::shouldHibernate(const Root& root) const {
+  if (hibernateIdle_.count() == 0 ||
+      hibernated_.load(std::memory_order_acquire) ||
+      !warmStartVerifyQueue_.empty()) {
+    return false;
+  }
+  auto idle = std::chrono::steady_clock::now() -
+      root.inner.last_cmd_timestamp.load(std::memory_order_acquire);
+  return idle >= hibernateIdle_ && root.triggers.rlock()->empty() &&
+      !root.unilateralResponses->hasSubscribers();
+}
+
+bool InMemoryView::hibernate(const Root& root) {
+  auto path = hibernationPathForRoot(rootPath_);
+  if (path.empty()) {
+    return false;
+  }
+  TraceScope span{"hibernate", traceRootId_};
+  // Only the IO thread changes the view, so it is written as it is freed.
+  if (!writeTickIndex(path, w_string{})) {
+    return false;
+  }
+
+  {
+    // A sliced age out relies on nothing else removing nodes.
+    std::lock_guard<std::mutex> ageOutLock{ageOutMutex_};
+    ViewWriter view{*this};
+    view.lockAll();
+    // A query that arrived meanwhile has already looked at hibernated_.
+    if (!shouldHibernate(root)) {
+      (void)unlink(path.c_str());
+      return false;
+    }
+    hibernated_.store(true, std::memory_order_release);
+    for (auto& rootDir : view.resolveDir(rootPath_)) {
+      rootDir.view.clear();
+    }
+  }
+  *changeLog_.wlock() = ChangeLog{};
+  hibernations_.fetch_add(1, std::memory_order_relaxed);
+  logf(
+      ERR,
+      "{} has been idle for {}, hibernating\n",
+      rootPath_,
+      hibernateIdle_);
+  return true;
+}
+
+void InMemoryView::rehydrate(Root& root, IoThreadState& state) {
+  TraceScope span{"rehydrate", traceRootId_};
+  auto path = hibernationPathForRoot(rootPath_);
+  bool complete = false;
+  {
+    ViewWriter view{*this};
+    view.lockAll();
+    auto roots = view.resolveDir(rootPath_);
+    try {
+      TickIndexReader index{path.c_str()};
+      loadTickIndex(view, roots, index);
+      complete = true;
+    } catch (const std::exception& exc) {
+      logf(
+          ERR,
+          "unable to restore the hibernated view of {}: {}\n",
+          rootPath_,
+          exc.what());
+    }
+    for (auto& rootDir : roots) {
+      rootDir.view.sortRecencyLists();
+    }
+    std::deque<watchman_dir*> dirs;
+    for (auto& rootDir : roots) {
+      dirs.push_back(rootDir.dir);
+    }
+    markLoadedDirs(std::move(dirs), [](const watchman_dir*) {});
+    if (!complete) {
+      // Whatever is missing can't be reported as deleted, so no earlier
+      // clock can be answered from the view.
+      lastAgeOutTick_ = mostRecentTick_.load(std::memory_order_acquire);
+      lastAgeOutTimestamp_ = std::chrono::system_clock::now();
+    }
+    hibernated_.store(false, std::memory_order_release);
+  }
+  (void)unlink(path.c_str());
+
+  if (complete) {
+    logf(ERR, "restored the hibernated view of {}\n", rootPath_);
+  } else {
+    root.scheduleRecrawl("the hibernated view could not be restored");
+  }
+  state.localPending.append(
+      hibernationJournal_.stealItems(), hibernationJournal_.stealSyncs());
+}
+
 void InMemoryView::clientModeCrawl(const std::shared_ptr<Root>& root) {
   PendingChanges pending;
   fullCrawl(root, pendingFromWatcher_, pending);
@@ -158,12 +843,84 @@ std::chrono::milliseconds getBiggestTimeout(const Root& root) {
 
 } // namespace
 
+void InMemoryView::collectBatch(
+    IoThreadState& state,
+    PendingCollection& pendingFromWatcher,
+    size_t received) {
+  if (received < batchMinItems_) {
+    // Isolated changes are applied straight away.
+    state.batchWindow /= 2;
+    batchWindowMs_.store(state.batchWindow.count(), std::memory_order_relaxed);
+    return;
+  }
+
+  state.batchWindow = std::min(
+      batchWindowMax_,
+      std::max(std::chrono::milliseconds{1}, state.batchWindow * 2));
+  batchWindowMs_.store(state.batchWindow.count(), std::memory_order_relaxed);
+  batchesExtended_.fetch_add(1, std::memory_order_relaxed);
+  logf(
+      DBG,
+      "received {} items, waiting {}ms for more\n",
+      received,
+      state.batchWindow.count());
+
+  // Take changes as they arrive rather than sleeping through the window, so
+  // that a sync, or a cookie that a query is waiting on, can end it early.
+  auto deadline = std::chrono::steady_clock::now() + state.batchWindow;
+  for (auto now = std::chrono::steady_clock::now(); now < deadline;
+       now = std::chrono::steady_clock::now()) {
+    auto lock = pendingFromWatcher.lockAndWait(
+        std::chrono::ceil<std::chrono::milliseconds>(deadline - now));
+    bool awaited = lock->hasSyncs() || lock->hasCookies();
+    takePending(state, *lock);
+    if (awaited) {
+      break;
+    }
+  }
+}
+
+bool InMemoryView::takePending(IoThreadState& state, PendingChanges& from) {
+  auto syncs = from.stealSyncs();
+  bool syncRequested = !syncs.empty();
+  auto items = from.stealItems();
+  if (state.debounce.enabled()) {
+    auto now = std::chrono::steady_clock::now();
+    items = state.debounce.admit(std::move(items), syncRequested, now);
+    state.localPending.append(state.debounce.release(now), {});
+    debouncedChanges_.store(
+        state.debounce.getAbsorbedCount(), std::memory_order_relaxed);
+  }
+  state.localPending.append(std::move(items), std::move(syncs));
+  return syncRequested;
+}
+
 void InMemoryView::ioThread(const std::shared_ptr<Root>& root) {
-  IoThreadState state{getBiggestTimeout(*root)};
+  HeapTagScope heapTag{HeapTag::View};
+  IoThreadState state{
+      getBiggestTimeout(*root),
+      pendingDebounce_,
+      SettleEstimator{settleAdaptiveMax_, settleMaxWait_}};
   state.currentTimeout = root->trigger_settle;
 
   while (Continue::Continue == stepIoThread(root, state, pendingFromWatcher_)) {
   }
+
+  if (hibernated_.load(std::memory_order_acquire)) {
+    // The view was saved when it hibernated, without a watcher cursor, so
+    // it is still a valid tick index.
+    auto path = hibernationPathForRoot(rootPath_);
+    auto tickIndexPath = tickIndexPathForRoot(rootPath_);
+    if (!persistTickIndex_ ||
+        rename(path.c_str(), tickIndexPath.c_str()) != 0) {
+      (void)unlink(path.c_str());
+    }
+  } else if (
+      persistTickIndex_ &&
+      root->inner.done_initial.load(std::memory_order_acquire)) {
+    saveTickIndex(state.localPending.empty() && state.debounce.empty());
+  }
+  caches_.saveContentHashes(/*async=*/false);
 }
 
 InMemoryView::Continue InMemoryView::stepIoThread(
@@ -176,9 +933,10 @@ InMemoryView::Continue InMemoryView::stepIoThread(
 
   auto markUnsettled = [&](IoThreadState& state) {
     state.lastUnsettle = std::chrono::steady_clock::now();
+    state.settle.noteChanges(*state.lastUnsettle);
     // Reduce sleep timeout to the settle duration ready for the next loop
     // through.
-    state.currentTimeout = root->trigger_settle;
+    state.currentTimeout = state.settle.settlePeriod(root->trigger_settle);
   };
 
   if (!root->inner.done_initial.load(std::memory_order_acquire)) {
@@ -190,14 +948,39 @@ InMemoryView::Continue InMemoryView::stepIoThread(
   }
 
   // Wait for the notify thread to give us pending items, or for
-  // the settle period to expire
+  // the settle period to expire. Warm start verification continues as soon
+  // as the items that arrived meanwhile have been processed.
+  size_t received = 0;
+  bool syncRequested = false;
   {
-    logf(DBG, "poll_events timeout={}ms\n", state.currentTimeout);
-    auto targetPendingLock =
-        pendingFromWatcher.lockAndWait(state.currentTimeout);
+    auto timeout = warmStartVerifyQueue_.empty() ? state.currentTimeout
+                                                 : std::chrono::milliseconds{0};
+    // Wake up in time to apply the changes that are being held back.
+    if (auto due = state.debounce.timeUntilRelease(
+            std::chrono::steady_clock::now())) {
+      timeout = std::min(timeout, *due);
+    }
+    // And in time to start a recrawl that is being held back.
+    {
+      auto info = root->recrawlInfo.rlock();
+      auto now = std::chrono::steady_clock::now();
+      if (info->shouldRecrawl && info->notBefore > now) {
+        timeout = std::min(
+            timeout,
+            std::chrono::ceil<std::chrono::milliseconds>(
+                info->notBefore - now));
+      }
+    }
+    logf(DBG, "poll_events timeout={}ms\n", timeout);
+    auto targetPendingLock = pendingFromWatcher.lockAndWait(timeout);
     logf(DBG, " ... wake up\n");
-    state.localPending.append(
-        targetPendingLock->stealItems(), targetPendingLock->stealSyncs());
+    received = targetPendingLock->getPendingItemCount();
+    syncRequested = takePending(state, *targetPendingLock);
+  }
+
+  // A query that is waiting to synchronize would rather we got on with it.
+  if (batchWindowMax_.count() > 0 && !syncRequested) {
+    collectBatch(state, pendingFromWatcher, received);
   }
 
   if (root->inner.cancelled.load(std::memory_order_acquire)) {
@@ -206,15 +989,50 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     return Continue::Stop;
   }
 
+  if (hibernated_.load(std::memory_order_acquire)) {
+    // Syncs and cookies mean that a query wants the view.
+    if (state.localPending.hasSyncs() || state.localPending.hasCookies()) {
+      rehydrate(*root, state);
+    } else {
+      // Hold on to the changes until then. A recrawl, including one that
+      // the watcher asked for, waits too.
+      hibernationJournal_.append(state.localPending.stealItems(), {});
+      if (hibernationJournal_.getPendingItemCount() >
+          hibernateJournalMaxItems_) {
+        // This prunes the rest.
+        hibernationJournal_.add(
+            rootPath_, std::chrono::system_clock::now(), W_PENDING_RECURSIVE);
+      }
+      return doSettleThings(*root, state);
+    }
+  }
+
   // Has a Watcher indicated this root needs a recrawl?
   // TODO: scheduleRecrawl should be replaced with a regular event published in
   // the PendingCollection.
   if (root->recrawlInfo.rlock()->shouldRecrawl) {
     auto info = root->recrawlInfo.wlock();
-    info->recrawlCount++;
-    root->inner.done_initial.store(false, std::memory_order_release);
-    // Now that done_initial is false, the next pass will recrawl.
-    return Continue::Continue;
+    if (std::chrono::steady_clock::now() >= info->notBefore) {
+      info->recrawlCount++;
+      root->inner.done_initial.store(false, std::memory_order_release);
+      // Now that done_initial is false, the next pass will recrawl.
+      return Continue::Continue;
+    }
+    // Held back; meanwhile, keep applying the changes that the watcher does
+    // report, and recrawl the dirs that were busy.
+    if (std::exchange(info->scopedRecoveryPending, false)) {
+      info.unlock();
+      auto numDirs = addRecentlyChangedDirs(
+          state.localPending,
+          std::chrono::milliseconds(
+              config_.getInt("recrawl_backoff_window_ms", 60000)));
+      root->recrawlInfo.wlock()->scopedDirs = numDirs;
+      logf(
+          ERR,
+          "{}: recrawl held back, recrawling {} recently changed dirs\n",
+          rootPath_,
+          numDirs);
+    }
   }
 
   // fullCrawl unconditionally sets done_initial to true and if
@@ -224,9 +1042,18 @@ InMemoryView::Continue InMemoryView::stepIoThread(
       root->inner.done_initial.load(std::memory_order_acquire),
       "A full crawl should not be pending at this point in the loop.");
 
+  // The root is not settled until it has been verified, but keep the batches
+  // small so that queries are not held up behind the whole tree.
+  if (!warmStartVerifyQueue_.empty()) {
+    queueWarmStartVerification(state.localPending);
+  }
+
   // Waiting for an event timed out or we were woken with a ping, so still
-  // consider the root settled.
+  // consider the root settled, unless changes are still being held back.
   if (state.localPending.empty()) {
+    if (!state.debounce.empty()) {
+      return Continue::Continue;
+    }
     return doSettleThings(*root, state);
   }
 
@@ -244,11 +1071,9 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     std::this_thread::sleep_for(std::chrono::milliseconds(notify_sleep_ms));
   }
 
-  auto view = view_.wlock();
-
-  mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+  ViewWriter view{*this};
 
-  auto isDesynced = processAllPending(root, *view, state.localPending);
+  auto isDesynced = processAllPending(root, view, state.localPending);
   if (isDesynced == IsDesynced::Yes) {
     logf(ERR, "recrawl complete, aborting all pending cookies\n");
     root->cookies.abortAllCookies();
@@ -257,15 +1082,153 @@ InMemoryView::Continue InMemoryView::stepIoThread(
   // Always mark unsettled after processing events because settle durations
   // should only include idle time, not time spent processing events.
   markUnsettled(state);
+
+  if (state.settle.mustSettle(*state.lastUnsettle)) {
+    // Let subscribers see what has accumulated rather than waiting for a
+    // pause that may never come, but still settle again after the usual
+    // period if the changes stop.
+    auto settlePeriod = state.currentTimeout;
+    auto result = doSettleThings(*root, state, /*forced=*/true);
+    state.currentTimeout = std::min(state.currentTimeout, settlePeriod);
+    return result;
+  }
   return Continue::Continue;
 }
 
+InMemoryView::ViewWriter::ViewWriter(InMemoryView& view)
+    : view_{view}, locks_(view.shards_.size()) {}
+
+ViewDatabase& InMemoryView::ViewWriter::forPath(w_string_piece path) {
+  auto idx = view_.shardIndex(path);
+  if (!locks_[idx]) {
+    unlock();
+    locks_[idx] = view_.shards_[idx]->wlock();
+    view_.mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+  }
+  return *locks_[idx];
+}
+
+std::vector<InMemoryView::ViewWriter::ShardDir>
+InMemoryView::ViewWriter::resolveDir(const w_string& path) {
+  std::vector<ShardDir> dirs;
+  if (path == view_.rootPath_) {
+    lockAll();
+    dirs.reserve(locks_.size());
+    for (auto& lock : locks_) {
+      dirs.push_back(ShardDir{*lock, lock->resolveDir(path, true)});
+    }
+  } else {
+    auto& shard = forPath(path);
+    dirs.push_back(ShardDir{shard, shard.resolveDir(path, true)});
+  }
+  return dirs;
+}
+
+const InMemoryView::ViewWriter::ShardDir& InMemoryView::ViewWriter::childDir(
+    const std::vector<ShardDir>& dirs,
+    w_string_piece name) const {
+  return dirs.size() == 1 ? dirs.front()
+                          : dirs[view_.shardIndexForTopLevelName(name)];
+}
+
+void InMemoryView::ViewWriter::lockAll() {
+  if (allLocked_) {
+    return;
+  }
+  unlock();
+  for (size_t i = 0; i < locks_.size(); ++i) {
+    locks_[i] = view_.shards_[i]->wlock();
+  }
+  allLocked_ = true;
+  view_.mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void InMemoryView::ViewWriter::narrow() {
+  if (allLocked_ && locks_.size() > 1) {
+    unlock();
+  }
+}
+
+InMemoryView::ViewWriter::~ViewWriter() {
+  unlock();
+}
+
+void InMemoryView::ViewWriter::unlock() {
+  bool released = false;
+  for (auto& lock : locks_) {
+    if (lock) {
+      // So that queries never see totals that miss the changes we made
+      lock->updateDirTotals();
+      lock.unlock();
+      released = true;
+    }
+  }
+  allLocked_ = false;
+  // Only now are the changes stamped with the tick that we took visible in
+  // every shard that they touched.
+  if (released) {
+    view_.publishedTick_.store(
+        view_.mostRecentTick_.load(std::memory_order_acquire),
+        std::memory_order_release);
+  }
+}
+
+void InMemoryView::yieldViewLock(ViewWriter& view) {
+  view.unlock();
+  viewLockYields_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void InMemoryView::updateVcsLockFiles(ViewWriter& view, const w_string& path) {
+  for (size_t i = 0; i < vcsLockPaths_.size(); ++i) {
+    const auto& lockPath = vcsLockPaths_[i];
+    // A crawl of one of the dirs above the lock file may have found or
+    // removed it too.
+    if (lockPath != path &&
+        !(path.size() < lockPath.size() && lockPath.piece().startsWith(path) &&
+          is_slash(lockPath.data()[path.size()]))) {
+      continue;
+    }
+
+    // The shard holding the lock file is the one that path was processed in,
+    // so this doesn't take another lock.
+    const auto& shard = std::as_const(view.forPath(lockPath));
+    const auto* dir = shard.resolveDir(lockPath.dirName());
+    const auto* file = dir ? dir->getChildFile(lockPath.baseName()) : nullptr;
+    const uint32_t bit = uint32_t(1) << i;
+    if (file && file->exists) {
+      vcsLockFilesPresent_.fetch_or(bit, std::memory_order_acq_rel);
+    } else {
+      vcsLockFilesPresent_.fetch_and(~bit, std::memory_order_acq_rel);
+    }
+  }
+}
+
 InMemoryView::IsDesynced InMemoryView::processAllPending(
     const std::shared_ptr<Root>& root,
-    ViewDatabase& view,
+    ViewWriter& view,
     PendingChanges& coll) {
+  static auto& batchItems = getHistogram(
+      "watchman_pending_batch_items",
+      "Pending items in each batch taken by the IO thread");
+  static auto& batchTime = getHistogram(
+      "watchman_pending_batch_us",
+      "Time taken to process all pending items, including their cookies");
+  static auto& eventLag = getHistogram(
+      "watchman_event_lag_us",
+      "The largest time in each batch from the watcher receiving a change "
+      "to it being applied to the view");
+
   auto desyncState = IsDesynced::No;
 
+  // Slicing is only meaningful once the initial crawl is done: until then,
+  // queries wait for the crawl to complete regardless.  The same goes for
+  // releasing shards.
+  const bool initialCrawlDone =
+      root->inner.done_initial.load(std::memory_order_acquire);
+  const bool sliceLock = viewLockSlice_.count() > 0 && initialCrawlDone;
+  auto sliceStart = std::chrono::steady_clock::now();
+  const auto processStart = sliceStart;
+
   // Don't resolve any of these until any recursive crawls are done.
   std::vector<std::vector<folly::Promise<folly::Unit>>> allSyncs;
 
@@ -278,11 +1241,13 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
   std::vector<w_string> pendingCookies;
 
   while (!coll.empty()) {
-    logf(
-        DBG,
-        "processing {} events in {}\n",
-        coll.getPendingItemCount(),
-        rootPath_);
+    auto itemCount = coll.getPendingItemCount();
+    logf(DBG, "processing {} events in {}\n", itemCount, rootPath_);
+    batchItems.record(itemCount);
+    ioThreadBacklog_.store(itemCount, std::memory_order_relaxed);
+    // When the watcher received the changes it reported in this batch
+    std::optional<std::chrono::system_clock::time_point> oldestReceived;
+    std::optional<std::chrono::system_clock::time_point> newestReceived;
 
     auto pending = coll.stealItems();
     auto syncs = coll.stealSyncs();
@@ -294,6 +1259,17 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
       allSyncs.push_back(std::move(syncs));
     }
 
+    std::vector<std::optional<FileInformation>> preStats;
+    if (parallelStatMinItems_ > 0 && itemCount >= parallelStatMinItems_) {
+      preStats = preStatPending(*root, pending.get());
+    }
+
+    // Renamed dirs are relocated before anything else in the batch is
+    // examined, so that the changes reported on either side of the rename
+    // find the view as it is after it.
+    auto relocated = relocateMovedDirs(*root, view, pending.get());
+    size_t itemIndex = 0;
+
     while (pending) {
       if (!stopThreads_.load(std::memory_order_acquire)) {
         if (pending->flags & W_PENDING_IS_DESYNCED) {
@@ -310,15 +1286,88 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
           }
         }
 
+        const FileInformation* preStat =
+            trustWatcherStat_ ? pending->preStat.get() : nullptr;
+        if (preStat) {
+          watcherStats_.fetch_add(1, std::memory_order_relaxed);
+        } else if (itemIndex < preStats.size() && preStats[itemIndex]) {
+          preStat = &*preStats[itemIndex];
+        }
+
+        if (pending->flags & W_PENDING_VIA_NOTIFY) {
+          if (!oldestReceived || pending->now < *oldestReceived) {
+            oldestReceived = pending->now;
+          }
+          if (!newestReceived || pending->now > *newestReceived) {
+            newestReceived = pending->now;
+          }
+        }
+
         // processPath may insert new pending items into `coll`
-        processPath(root, view, coll, *pending, nullptr, pendingCookies);
+        processPath(root, view, coll, *pending, preStat, pendingCookies);
+        updateVcsLockFiles(view, pending->path);
+
+        // A change below a relocated dir that was reported before the rename
+        // names the old path; examine what it named where it is now.
+        for (auto& [from, to] : relocated) {
+          auto& path = pending->path;
+          if (path.size() > from.size() + 1 && path.piece().startsWith(from) &&
+              is_slash(path.data()[from.size()])) {
+            PendingChange moved{
+                w_string::pathCat(
+                    {to,
+                     w_string_piece{
+                         path.data() + from.size() + 1,
+                         path.size() - from.size() - 1}}),
+                pending->now,
+                pending->flags};
+            processPath(root, view, coll, moved, nullptr, pendingCookies);
+          }
+        }
+
+        if (initialCrawlDone) {
+          view.narrow();
+        }
+        if (sliceLock &&
+            std::chrono::steady_clock::now() - sliceStart >= viewLockSlice_) {
+          yieldViewLock(view);
+          sliceStart = std::chrono::steady_clock::now();
+        }
       }
 
       // TODO: Document that continuing to run this loop when stopThreads_ is
       // true fixes a stack overflow when pending is long.
       pending = std::move(pending->next);
+      ++itemIndex;
+    }
+
+    if (oldestReceived) {
+      auto applied = std::chrono::system_clock::now();
+      auto micros = [&](std::chrono::system_clock::time_point received) {
+        return std::max<int64_t>(
+            0,
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                applied - received)
+                .count());
+      };
+      auto maxLag = micros(*oldestReceived);
+      eventLagMicros_.store(micros(*newestReceived), std::memory_order_relaxed);
+      maxEventLagMicros_.store(maxLag, std::memory_order_relaxed);
+      eventLag.record(maxLag);
     }
   }
+  ioThreadBacklog_.store(0, std::memory_order_relaxed);
+
+  // Publish the tick before waking the queries that synced to these
+  // changes, so that the clock they are answered with covers them.
+  view.unlock();
+
+  // Ahead of the cookies, so that the queries that synced to these changes
+  // find them in the change log rather than walking the view.
+  if (changeLogUnsettled_ && initialCrawlDone) {
+    recordChangeSet(
+        root->assertedStates.rlock()->hasAssertions(), /*settled=*/false);
+  }
 
   for (auto& pendingCookie : pendingCookies) {
     if (processedPaths_) {
@@ -336,18 +1385,188 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
     root->cookies.notifyCookie(pendingCookie);
   }
 
+  // The queries waiting for these dirs can find them in the view now.
+  if (!lazyCrawled_.empty()) {
+    auto lazyDirs = lazyDirs_.wlock();
+    auto vcsIgnoredDirs = vcsIgnoredDirs_.wlock();
+    for (auto& dir : lazyCrawled_) {
+      lazyDirs->erase(dir);
+      auto it = vcsIgnoredDirs->find(dir);
+      if (it != vcsIgnoredDirs->end()) {
+        it->second = LazyDirState::Kept;
+      }
+    }
+    lazyCrawled_.clear();
+  }
+
   for (auto& outer : allSyncs) {
     for (auto& sync : outer) {
       sync.setValue();
     }
   }
 
+  auto processEnd = std::chrono::steady_clock::now();
+  batchTime.recordMicros(processEnd - processStart);
+  recordSpan("process_pending", traceRootId_, processStart, processEnd);
   return desyncState;
 }
 
+std::vector<std::pair<w_string, w_string>> InMemoryView::relocateMovedDirs(
+    const Root& root,
+    ViewWriter& view,
+    const watchman_pending_fs* pending) {
+  static auto& relocations = getCounter(
+      "watchman_dir_relocations_total",
+      "Renamed dirs that were moved within the view rather than recrawled");
+
+  std::vector<std::pair<w_string, w_string>> relocated;
+  // The lazily crawled dirs are tracked by path, so leave renames of those
+  // to the crawler.
+  if (lazyCrawlDepth_ > 0 || vcsIgnoreCrawl_) {
+    return relocated;
+  }
+  for (auto p = pending; p; p = p->next.get()) {
+    if (!p->flags.contains(W_PENDING_MOVED) ||
+        p->flags.contains(W_PENDING_RECURSIVE) || !p->movedFrom) {
+      continue;
+    }
+    const auto& from = p->movedFrom;
+    const auto& to = p->path;
+    // Each shard has its own nodes, and the children of ignored dirs are
+    // not in the view.
+    if (from == rootPath_ || to == rootPath_ ||
+        shardIndex(from) != shardIndex(to) || root.ignore.isIgnoreDir(from) ||
+        root.ignore.isIgnoreDir(to) ||
+        root.ignore.isIgnoreVCS(from.dirName()) ||
+        root.ignore.isIgnoreVCS(to.dirName())) {
+      continue;
+    }
+
+    // Checks that to is the dir that the view has at from; this is all that
+    // the whole subtree costs.
+    FileInformation st;
+    try {
+      st = fileSystem_.getFileInformation(to.c_str(), root.case_sensitive);
+    } catch (const std::system_error& exc) {
+      logf(DBG, "not relocating {} to {}: {}\n", from, to, exc.what());
+      continue;
+    }
+
+    auto& shard = view.forPath(to);
+    if (shard.relocateDir(*watcher_, from, to, st, getClock(p->now))) {
+      logf(DBG, "relocated {} to {}\n", from, to);
+      relocations.add();
+      relocated.emplace_back(from, to);
+    }
+  }
+  return relocated;
+}
+
+std::vector<std::optional<FileInformation>> InMemoryView::preStatPending(
+    const Root& root,
+    const watchman_pending_fs* pending) {
+  // State shared between this thread and the pool tasks.  Tasks that don't
+  // start running until after we've finished must not touch anything other
+  // than this state, so it is reference counted.
+  struct State {
+    FileSystem* fileSystem;
+    CaseSensitivity caseSensitive;
+    // The paths to stat, and the index of the result for each.
+    std::vector<std::pair<w_string, size_t>> paths;
+    std::vector<std::optional<FileInformation>> results;
+    std::atomic<size_t> nextPath{0};
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool finished{false};
+    size_t active{0};
+  };
+  auto state = std::make_shared<State>();
+  state->fileSystem = &fileSystem_;
+  state->caseSensitive = root.case_sensitive;
+
+  // Only pick the items that processPath will hand to statPath without
+  // pre_stat, and that statPath won't ignore.
+  size_t count = 0;
+  for (auto item = pending; item; item = item->next.get(), ++count) {
+    if ((trustWatcherStat_ && item->preStat) ||
+        item->flags.contains(W_PENDING_CRAWL_ONLY) ||
+        item->flags.contains(W_PENDING_VIA_PWALK) ||
+        w_string_equal(item->path, rootPath_) ||
+        root.cookies.isCookiePrefix(item->path) ||
+        root.ignore.isIgnoreDir(item->path)) {
+      continue;
+    }
+    state->paths.emplace_back(item->path, count);
+  }
+  state->results.resize(count);
+
+  if (state->paths.size() < 2) {
+    return std::move(state->results);
+  }
+
+  auto stat = [](State& state) {
+    while (true) {
+      auto idx = state.nextPath.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= state.paths.size()) {
+        return;
+      }
+      auto& [path, resultIndex] = state.paths[idx];
+      try {
+        state.results[resultIndex] = state.fileSystem->getFileInformation(
+            path.c_str(), state.caseSensitive);
+      } catch (const std::exception&) {
+        // statPath will stat it again and deal with the failure.
+      }
+    }
+  };
+
+  auto numWorkers = std::min(parallelStatMaxWorkers_, state->paths.size() - 1);
+  for (size_t i = 0; i < numWorkers; ++i) {
+    try {
+      getThreadPool().add([state, stat] {
+        {
+          std::lock_guard<std::mutex> lock{state->mutex};
+          if (state->finished) {
+            return;
+          }
+          ++state->active;
+        }
+        stat(*state);
+        {
+          std::lock_guard<std::mutex> lock{state->mutex};
+          --state->active;
+        }
+        state->cond.notify_all();
+      });
+    } catch (const std::exception& exc) {
+      // The pool is full or stopping; we'll just do more of the work here.
+      log(DBG, "preStatPending: ", exc.what(), "\n");
+      break;
+    }
+  }
+
+  stat(*state);
+
+  {
+    std::unique_lock<std::mutex> lock{state->mutex};
+    state->finished = true;
+    state->cond.wait(lock, [&] { return state->active == 0; });
+  }
+
+  parallelStatBatches_.fetch_add(1, std::memory_order_relaxed);
+  logf(
+      DBG,
+      "pre-stat'd {} of {} pending items in {}\n",
+      state->paths.size(),
+      count,
+      rootPath_);
+  return std::move(state->results);
+}
+
 void InMemoryView::processPath(
     const std::shared_ptr<Root>& root,
-    ViewDatabase& view,
+    ViewWriter& view,
     PendingChanges& coll,
     const PendingChange& pending,
     const FileInformation* pre_stat,
@@ -405,12 +1624,39 @@ void InMemoryView::processPath(
       (pending.flags & W_PENDING_CRAWL_ONLY)) {
     crawler(root, view, coll, pending, pendingCookies);
   } else {
-    statPath(*root, root->cookies, view, coll, pending, pre_stat);
+    statPath(
+        *root,
+        root->cookies,
+        view.forPath(pending.path),
+        coll,
+        pending,
+        pre_stat);
   }
 }
 
 namespace {
 
+// Returns the number of dirs below the given ones, counting no further than
+// limit.
+size_t countDirsUpTo(std::vector<const watchman_dir*> stack, size_t limit) {
+  size_t count = 0;
+  while (!stack.empty() && count < limit) {
+    auto dir = stack.back();
+    stack.pop_back();
+    count += dir->dirs.size();
+    for (auto& it : dir->dirs) {
+      stack.push_back(it.second.get());
+    }
+  }
+  return count;
+}
+
+// Filesystems that update a dir's mtime and ctime, with sub-second precision,
+// whenever an entry is added, removed or renamed.
+bool isDirMtimeReliable(const w_string& fsType) {
+  return fsType == "ext4" || fsType == "xfs" || fsType == "btrfs";
+}
+
 void apply_dir_size_hint(watchman_dir* dir, uint32_t ndirs, uint32_t nfiles) {
   if (dir->files.empty() && nfiles > 0) {
     dir->files.reserve(nfiles);
@@ -422,16 +1668,166 @@ void apply_dir_size_hint(watchman_dir* dir, uint32_t ndirs, uint32_t nfiles) {
 
 } // namespace
 
+bool InMemoryView::shouldCrawlInParallel(
+    const Root& root,
+    const std::vector<ViewWriter::ShardDir>& dirs) const {
+  if (deferFileStat_) {
+    // ParallelWalker stats every entry that it reads.
+    return false;
+  }
+  if (root.enable_parallel_crawl.load(std::memory_order_acquire)) {
+    return true;
+  }
+  if (parallelRecrawlMinDirs_ == 0) {
+    return false;
+  }
+  // What the view already holds is the best available estimate of the size
+  // of the subtree, and also means this is a recrawl.
+  std::vector<const watchman_dir*> stack;
+  for (auto& sd : dirs) {
+    stack.push_back(sd.dir);
+  }
+  return countDirsUpTo(std::move(stack), parallelRecrawlMinDirs_) >=
+      parallelRecrawlMinDirs_;
+}
+
+size_t InMemoryView::depthBelowRoot(w_string_piece path) const {
+  return std::count(
+      path.data() + rootPath_.size(), path.data() + path.size(), '/');
+}
+
+bool InMemoryView::deferLazyCrawl(
+    const Root& root,
+    const w_string& path,
+    const std::vector<ViewWriter::ShardDir>& dirs) {
+  if (path == rootPath_ || depthBelowRoot(path) != lazyCrawlDepth_) {
+    return false;
+  }
+  auto lazyDirs = lazyDirs_.wlock();
+  auto it = lazyDirs->find(path);
+  if (it != lazyDirs->end()) {
+    if (it->second == LazyDirState::Unexplored) {
+      return true;
+    }
+    if (it->second == LazyDirState::Requested) {
+      it->second = LazyDirState::Crawled;
+      lazyCrawled_.push_back(path);
+      lazyCrawls_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return false;
+  }
+  // Dirs that have been crawled are kept up to date, including by
+  // recrawls. The cookie and VCS dirs must always be watched.
+  if (root.inner.done_initial.load(std::memory_order_acquire) ||
+      !dirs.front().dir->files.empty() || root.cookies.isCookieDir(path) ||
+      root.ignore.isIgnoreVCS(path)) {
+    return false;
+  }
+  lazyDirs->emplace(path, LazyDirState::Unexplored);
+  return true;
+}
+
+namespace {
+w_string_piece relativeTo(const w_string& rootPath, w_string_piece path) {
+  return w_string_piece{
+      path.data() + rootPath.size() + 1, path.size() - rootPath.size() - 1};
+}
+} // namespace
+
+void InMemoryView::loadVcsIgnoreRules() {
+  auto rules =
+      std::make_shared<const VcsIgnoreRules>(VcsIgnoreRules::load(rootPath_));
+  {
+    // The dirs that are no longer ignored are crawled like any other.
+    auto vcsIgnoredDirs = vcsIgnoredDirs_.wlock();
+    for (auto it = vcsIgnoredDirs->begin(); it != vcsIgnoredDirs->end();) {
+      auto relative = relativeTo(rootPath_, it->first);
+      if (it->second == LazyDirState::Unexplored &&
+          rules->ignoredPrefix(relative) != relative.size()) {
+        it = vcsIgnoredDirs->erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  *vcsIgnoreRules_.wlock() = std::move(rules);
+}
+
+bool InMemoryView::deferVcsIgnored(
+    const Root& root,
+    const w_string& path,
+    bool known,
+    bool onIoThread) {
+  if (path.size() <= rootPath_.size()) {
+    return false;
+  }
+  auto rules = vcsIgnoreRules_.copy();
+  if (!rules || rules->empty()) {
+    return false;
+  }
+  auto vcsIgnoredDirs = vcsIgnoredDirs_.wlock();
+  auto it = vcsIgnoredDirs->find(path);
+  if (it != vcsIgnoredDirs->end()) {
+    if (it->second == LazyDirState::Unexplored) {
+      return true;
+    }
+    // Only the IO thread tracks the batch that crawls it.
+    if (it->second == LazyDirState::Requested && onIoThread) {
+      it->second = LazyDirState::Crawled;
+      lazyCrawled_.push_back(path);
+      vcsIgnoredCrawls_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return false;
+  }
+  // The cookie and VCS dirs must always be watched.
+  if (known || root.cookies.isCookieDir(path) ||
+      root.ignore.isIgnoreVCS(path)) {
+    return false;
+  }
+  auto relative = relativeTo(rootPath_, path);
+  if (rules->ignoredPrefix(relative) != relative.size()) {
+    return false;
+  }
+  vcsIgnoredDirs->emplace(path, LazyDirState::Unexplored);
+  return true;
+}
+
+bool InMemoryView::isBelowVcsIgnoredDir(w_string_piece path) const {
+  auto vcsIgnoredDirs = vcsIgnoredDirs_.rlock();
+  if (vcsIgnoredDirs->empty()) {
+    return false;
+  }
+  for (size_t i = rootPath_.size() + 1; i < path.size(); ++i) {
+    if (path[i] == '/') {
+      auto it = vcsIgnoredDirs->find(w_string_piece{path.data(), i});
+      if (it != vcsIgnoredDirs->end() &&
+          it->second == LazyDirState::Unexplored) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 void InMemoryView::crawler(
     const std::shared_ptr<Root>& root,
-    ViewDatabase& view,
+    ViewWriter& view,
     PendingChanges& coll,
     const PendingChange& pending,
     std::vector<w_string>& pendingCookies) {
   bool recursive = pending.flags.contains(W_PENDING_RECURSIVE);
   bool stat_all = pending.flags.contains(W_PENDING_NONRECURSIVE_SCAN);
-
-  auto dir = view.resolveDir(pending.path, true);
+  // The dir's entries are the ones we already know, so only the subdirs need
+  // to be examined further. See trust_unchanged_dir_mtime.
+  bool dirUnchanged = pending.flags.contains(W_PENDING_DIR_UNCHANGED);
+
+  // Every shard holds a node for the root; any other dir has just one.
+  auto dirs = view.resolveDir(pending.path);
+  auto markDirsDeleted = [&] {
+    for (auto& sd : dirs) {
+      sd.view.markDirDeleted(*watcher_, sd.dir, getClock(pending.now), true);
+    }
+  };
 
   // Detect root directory replacement.
   // The inode number check is handled more generally by the sister code
@@ -444,37 +1840,55 @@ void InMemoryView::crawler(
   // root has been replaced and we got no notifications at all and this has
   // left the cookie sync mechanism broken forever.
   if (pending.path == root->root_path) {
+    // The root inode is tracked by the first shard.
+    auto& rootView = dirs.front().view;
     try {
       auto st = fileSystem_.getFileInformation(
           pending.path.c_str(), root->case_sensitive);
-      if (st.ino != view.getRootInode()) {
+      if (st.ino != rootView.getRootInode()) {
         // If it still exists and the inode doesn't match, then we need
         // to force recrawl to make sure we're in sync.
         // We're lazily initializing the rootInode to 0 here, so we don't
         // need to do this the first time through (we're already crawling
         // everything in that case).
-        if (view.getRootInode() != 0) {
+        if (rootView.getRootInode() != 0) {
           root->scheduleRecrawl(
               "root was replaced and we didn't get notified by the kernel");
           return;
         }
         recursive = true;
-        view.setRootInode(st.ino);
+        rootView.setRootInode(st.ino);
       }
     } catch (const std::system_error& err) {
       handle_open_errno(
-          *root,
-          dir->getFullPath(),
-          pending.now,
-          "getFileInformation",
-          err.code());
-      view.markDirDeleted(*watcher_, dir, getClock(pending.now), true);
+          *root, pending.path, pending.now, "getFileInformation", err.code());
+      markDirsDeleted();
       return;
     }
   }
 
+  if (vcsIgnoreCrawl_ && recursive && pending.path == root->root_path) {
+    // Pick up any edits to the ignore files.
+    loadVcsIgnoreRules();
+  }
+
+  if (lazyCrawlDepth_ > 0 && deferLazyCrawl(*root, pending.path, dirs)) {
+    logf(DBG, "leaving {} to be crawled when it is queried\n", pending.path);
+    return;
+  }
+
+  if (vcsIgnoreCrawl_ &&
+      deferVcsIgnored(
+          *root, pending.path, !dirs.front().dir->files.empty(), true)) {
+    logf(DBG, "{} is ignored by the VCS, not crawling it\n", pending.path);
+    return;
+  }
+
+  // ParallelWalker would read the dirs that are to be left unexplored.
   if (recursive &&
-      root->enable_parallel_crawl.load(std::memory_order_acquire)) {
+      (lazyCrawlDepth_ == 0 ||
+       depthBelowRoot(pending.path) >= lazyCrawlDepth_) &&
+      shouldCrawlInParallel(*root, dirs)) {
     return crawlerParallel(root, view, coll, pending, pendingCookies);
   }
 
@@ -483,6 +1897,9 @@ void InMemoryView::crawler(
   logf(
       DBG, "opendir({}) recursive={} stat_all={}\n", path, recursive, stat_all);
 
+  ++fullCrawlDirCount_;
+  reportCrawlProgress(*root, false);
+
   /* Start watching and open the dir for crawling.
    * Whether we open the dir prior to watching or after is watcher specific,
    * so the operations are rolled together in our abstraction */
@@ -492,13 +1909,38 @@ void InMemoryView::crawler(
     osdir = watcher_->startWatchDir(root, path.c_str());
   } catch (const std::system_error& err) {
     logf(DBG, "startWatchDir({}) threw {}\n", path, err.what());
-    handle_open_errno(
-        *root, dir->getFullPath(), pending.now, "opendir", err.code());
-    view.markDirDeleted(*watcher_, dir, getClock(pending.now), true);
+    handle_open_errno(*root, pending.path, pending.now, "opendir", err.code());
+    markDirsDeleted();
     return;
   }
 
-  if (dir->files.empty()) {
+  if (dirUnchanged && isDirMtimeReliable(root->fs_type)) {
+    // No entry can have been added, removed or renamed, so there is no need
+    // to read the dir. Its subdirs may still hold changes.
+    // Examine them as a recursive read of the dir would have; queueing them
+    // as recursive changes instead would prune any changes pending below
+    // them.
+    logf(DBG, "{} is unchanged, not reading it\n", path);
+    std::vector<w_string> subdirs;
+    for (auto& sd : dirs) {
+      for (auto& it : sd.dir->files) {
+        auto file = it.second.get();
+        if (file->exists && file->stat.isDir()) {
+          subdirs.push_back(sd.dir->getFullPathToChild(file->getName()));
+        }
+      }
+    }
+    for (auto& subdir : subdirs) {
+      PendingChange subdirPending{
+          std::move(subdir),
+          pending.now,
+          W_PENDING_RECURSIVE | (pending.flags & W_PENDING_IS_DESYNCED)};
+      processPath(root, view, coll, subdirPending, nullptr, pendingCookies);
+    }
+    return;
+  }
+
+  if (dirs.size() == 1 && dirs.front().dir->files.empty()) {
     // Pre-size our hash(es) if we can, so that we can avoid collisions
     // and re-hashing during initial crawl
     uint32_t num_dirs = 0;
@@ -514,16 +1956,18 @@ void InMemoryView::crawler(
     // We just pass it through for the dir size hint and the hash
     // table implementation will round that up to the next power of 2
     apply_dir_size_hint(
-        dir,
+        dirs.front().dir,
         num_dirs,
-        uint32_t(root->config.getInt("hint_num_files_per_dir", 64)));
+        root->hint_num_files_per_dir);
   }
 
   /* flag for delete detection */
-  for (auto& it : dir->files) {
-    auto file = it.second.get();
-    if (file->exists) {
-      file->maybe_deleted = true;
+  for (auto& sd : dirs) {
+    for (auto& it : sd.dir->files) {
+      auto file = it.second.get();
+      if (file->exists) {
+        file->maybe_deleted = true;
+      }
     }
   }
 
@@ -537,10 +1981,36 @@ void InMemoryView::crawler(
 
       // Queue it up for analysis if the file is newly existing
       w_string name(dirent->d_name, W_STRING_BYTE);
+      auto dir = view.childDir(dirs, name).dir;
       struct watchman_file* file = dir->getChildFile(name);
       if (file) {
         file->maybe_deleted = false;
       }
+      if (dirUnchanged && file && file->exists && !dirent->has_stat &&
+          dirent->dtype != DType::Unknown && dirent->dtype != DType::Dir &&
+          !file->stat.isDir()) {
+        // A file that is still of the same type; trust that its stat
+        // information is unchanged too rather than stat'ing it again.
+        continue;
+      }
+      if (deferFileStat_ && !dirent->has_stat &&
+          dirent->dtype != DType::Unknown && dirent->dtype != DType::Dir) {
+        if (file && file->exists && file->stat.dtype() == dirent->dtype) {
+          // Notifications would have told us if it had changed.
+          continue;
+        }
+        auto full_path = dir->getFullPathToChild(name);
+        if (!root->cookies.isCookiePrefix(full_path) &&
+            !root->ignore.isIgnoreDir(full_path)) {
+          addUnstatedFile(
+              view.childDir(dirs, name).view,
+              dir,
+              name,
+              dirent->dtype,
+              pending.now);
+          continue;
+        }
+      }
       if (!file || !file->exists || stat_all || recursive) {
         auto full_path = dir->getFullPathToChild(name);
 
@@ -582,15 +2052,17 @@ void InMemoryView::crawler(
 
   // Anything still in maybe_deleted is actually deleted.
   // Arrange to re-process it shortly
-  for (auto& it : dir->files) {
-    auto file = it.second.get();
-    if (file->exists &&
-        (file->maybe_deleted || (file->stat.isDir() && recursive))) {
-      coll.add(
-          dir,
-          file->getName().data(),
-          pending.now,
-          recursive ? W_PENDING_RECURSIVE : PendingFlags{});
+  for (auto& sd : dirs) {
+    for (auto& it : sd.dir->files) {
+      auto file = it.second.get();
+      if (file->exists &&
+          (file->maybe_deleted || (file->stat.isDir() && recursive))) {
+        coll.add(
+            sd.dir,
+            file->getName().data(),
+            pending.now,
+            recursive ? W_PENDING_RECURSIVE : PendingFlags{});
+      }
     }
   }
 }
@@ -611,10 +2083,14 @@ class CrawlerFileSystem : public FileSystem {
       return nullptr;
     }
     if ((root_->root_path != fullPath &&
-         root_->ignore.isIgnoreVCS(fullPath.dirName())) &&
+         root_->ignore.isIgnoreVCS(w_string_piece{fullPath}.dirName())) &&
         !root_->cookies.isCookieDir(fullPath)) {
       return nullptr;
     }
+    // Match the deferral of dirs that the VCS ignores in crawler().
+    if (deferDir_ && deferDir_(fullPath)) {
+      return nullptr;
+    }
     // Use watcher->startWatchDir to ensure side effects are applied
     // in the right order (ex. inotify_add_watch before opendir).
     // This requires startWatchDir to be thread-safe.
@@ -634,10 +2110,12 @@ class CrawlerFileSystem : public FileSystem {
   CrawlerFileSystem(
       FileSystem& fileSystem,
       std::shared_ptr<Root> root,
-      std::shared_ptr<Watcher> watcher)
+      std::shared_ptr<Watcher> watcher,
+      std::function<bool(const w_string&)> deferDir)
       : fileSystem_{fileSystem},
         root_{std::move(root)},
-        watcher_{std::move(watcher)} {}
+        watcher_{std::move(watcher)},
+        deferDir_{std::move(deferDir)} {}
 
   CrawlerFileSystem() = delete;
   CrawlerFileSystem(CrawlerFileSystem&&) = delete;
@@ -649,13 +2127,15 @@ class CrawlerFileSystem : public FileSystem {
   FileSystem& fileSystem_;
   std::shared_ptr<Root> root_;
   std::shared_ptr<Watcher> watcher_;
+  // Called from the walker's threads.
+  std::function<bool(const w_string&)> deferDir_;
 };
 
 } // namespace
 
 void InMemoryView::crawlerParallel(
     const std::shared_ptr<Root>& root,
-    ViewDatabase& view,
+    ViewWriter& view,
     PendingChanges& coll,
     const PendingChange& pending,
     std::vector<w_string>& pendingCookies) {
@@ -674,71 +2154,124 @@ void InMemoryView::crawlerParallel(
   // Unlike crawler(), do not call the crawler function recursively
   // (via W_PENDING_RECURSIVE), and avoid extra syscalls.
 
-  std::shared_ptr<CrawlerFileSystem> fs =
-      std::make_shared<CrawlerFileSystem>(fileSystem_, root, watcher_);
+  std::function<bool(const w_string&)> deferDir;
+  if (vcsIgnoreCrawl_) {
+    deferDir = [this, root](const w_string& dir) {
+      return deferVcsIgnored(*root, dir, false, false);
+    };
+  }
+  std::shared_ptr<CrawlerFileSystem> fs = std::make_shared<CrawlerFileSystem>(
+      fileSystem_, root, watcher_, std::move(deferDir));
   size_t threadCountHint = config_.getInt("parallel_crawl_thread_count", 0);
-  ParallelWalker walker{std::move(fs), path, threadCountHint};
+  ParallelWalker walker{
+      std::move(fs), path, threadCountHint, prefetchSymlinkTargets_};
+
+  // Results are applied in batches of up to parallel_crawl_batch_dirs dirs,
+  // taking whatever the walker has produced so far. Once the initial crawl is
+  // done, the view write locks are released while waiting for the walker, so
+  // that queries can make progress between batches. Each result is applied
+  // in full under one lock, so the dir is never observed half updated.
+  const size_t batchSize = parallelCrawlBatchDirs_ > 0
+      ? parallelCrawlBatchDirs_
+      : std::numeric_limits<size_t>::max();
+  const bool yieldBetweenBatches = parallelCrawlBatchDirs_ > 0 &&
+      root->inner.done_initial.load(std::memory_order_acquire);
+
+  struct PreparedEntry {
+    w_string name;
+    w_string fullPath;
+  };
+  std::vector<PreparedEntry> prepared;
 
   // Step 1: Process readDir results.
   while (true) {
-    auto result = walker.nextResult();
-    if (!result.has_value()) {
+    if (yieldBetweenBatches) {
+      yieldViewLock(view);
+    }
+    auto batch = walker.nextResults(batchSize);
+    if (batch.empty()) {
       break;
     }
-    ReadDirResult& dirResult = result.value();
 
-    // Step 1a: Prepare the dirView.
-    w_string dirPath{dirResult.dirFullPath.c_str()};
-    auto dirView = view.resolveDir(dirPath, true);
-    if (dirView->files.empty()) {
-      dirView->files.reserve(dirResult.entries.size());
-      dirView->dirs.reserve(dirResult.subdirCount);
-    }
-    for (auto& it : dirView->files) {
-      auto fileView = it.second.get();
-      if (fileView->exists) {
-        fileView->maybe_deleted = true;
+    for (auto& dirResult : batch) {
+      ++fullCrawlDirCount_;
+      reportCrawlProgress(*root, false);
+
+      // Step 1a: Prepare the names, and then the dirView.  The root has one
+      // in every shard.
+      w_string dirPath{dirResult.dirFullPath.c_str()};
+      prepared.clear();
+      prepared.reserve(dirResult.entries.size());
+      for (auto& entry : dirResult.entries) {
+        w_string name{entry.name.c_str(), W_STRING_BYTE};
+        auto fullPath = w_string::pathCat({dirPath, name});
+        prepared.push_back(PreparedEntry{std::move(name), std::move(fullPath)});
       }
-    }
 
-    // Step 1b: Update files in the dirView via statPath().
-    // Prepare the stat so statPath can avoid syscall.
-    for (auto& entry : dirResult.entries) {
-      w_string name{entry.name.c_str(), W_STRING_BYTE};
-      watchman_file* fileView = dirView->getChildFile(name);
-      if (fileView) {
-        fileView->maybe_deleted = false;
+      auto dirViews = view.resolveDir(dirPath);
+      if (dirViews.size() == 1 && dirViews.front().dir->files.empty()) {
+        dirViews.front().dir->files.reserve(dirResult.entries.size());
+        dirViews.front().dir->dirs.reserve(dirResult.subdirCount);
+      }
+      for (auto& sd : dirViews) {
+        for (auto& it : sd.dir->files) {
+          auto fileView = it.second.get();
+          if (fileView->exists) {
+            fileView->maybe_deleted = true;
+          }
+        }
       }
-      auto fullPath = dirView->getFullPathToChild(name);
-      processPath(
-          root,
-          view,
-          coll,
-          PendingChange{
-              std::move(fullPath),
-              pending.now,
-              inheritFlags,
-          },
-          &entry.stat,
-          pendingCookies);
-    }
 
-    // Step 1c: Mark for deletion.
-    for (auto& it : dirView->files) {
-      auto fileView = it.second.get();
-      if (fileView->exists && fileView->maybe_deleted) {
-        auto fullPath = dirView->getFullPathToChild(fileView->getName());
+      // Step 1b: Update files in the dirView via statPath().
+      // Prepare the stat so statPath can avoid syscall.
+      for (size_t i = 0; i < prepared.size(); ++i) {
+        auto& entry = prepared[i];
+        auto dirView = view.childDir(dirViews, entry.name).dir;
+        watchman_file* fileView = dirView->getChildFile(entry.name);
+        if (fileView) {
+          fileView->maybe_deleted = false;
+        }
+        auto& symlinkTarget = dirResult.entries[i].symlinkTarget;
+        auto fullPath = symlinkTarget ? entry.fullPath : w_string{};
         processPath(
             root,
             view,
             coll,
             PendingChange{
-                std::move(fullPath),
+                std::move(entry.fullPath),
                 pending.now,
                 inheritFlags,
             },
-            nullptr,
+            &dirResult.entries[i].stat,
             pendingCookies);
+        if (symlinkTarget) {
+          // processPath created the node, or gave it a new otime
+          fileView = dirView->getChildFile(entry.name);
+          if (fileView && fileView->exists && fileView->stat.isSymlink()) {
+            prefetchSymlinkTarget(fullPath, fileView, &*symlinkTarget);
+          }
+        }
+      }
+
+      // Step 1c: Mark for deletion.
+      for (auto& sd : dirViews) {
+        for (auto& it : sd.dir->files) {
+          auto fileView = it.second.get();
+          if (fileView->exists && fileView->maybe_deleted) {
+            auto fullPath = sd.dir->getFullPathToChild(fileView->getName());
+            processPath(
+                root,
+                view,
+                coll,
+                PendingChange{
+                    std::move(fullPath),
+                    pending.now,
+                    inheritFlags,
+                },
+                nullptr,
+                pendingCookies);
+          }
+        }
       }
     }
   }
@@ -766,49 +2299,65 @@ void InMemoryView::crawlerParallel(
   }
 }
 
-namespace {
-bool did_file_change(
-    const FileInformation* saved,
-    const FileInformation* fresh) {
-  /* we have to compare this way because the stat structure
-   * may contain fields that vary and that don't impact our
-   * understanding of the file */
-
-#define FIELD_CHG(name)             \
-  if (saved->name != fresh->name) { \
-    return true;                    \
-  }
-
-  // Can't compare with memcmp due to padding and garbage in the struct
-  // on OpenBSD, which has a 32-bit tv_sec + 64-bit tv_nsec
-#define TIMESPEC_FIELD_CHG(wat)                           \
-  {                                                       \
-    struct timespec a = saved->wat##time;                 \
-    struct timespec b = fresh->wat##time;                 \
-    if (a.tv_sec != b.tv_sec || a.tv_nsec != b.tv_nsec) { \
-      return true;                                        \
-    }                                                     \
-  }
-
-  FIELD_CHG(mode);
-
-  if (!saved->isDir()) {
-    FIELD_CHG(size);
-    FIELD_CHG(nlink);
-  }
-  FIELD_CHG(dev);
-  FIELD_CHG(ino);
-  FIELD_CHG(uid);
-  FIELD_CHG(gid);
-  // Don't care about st_blocks
-  // Don't care about st_blksize
-  // Don't care about st_atimespec
-  TIMESPEC_FIELD_CHG(m);
-  TIMESPEC_FIELD_CHG(c);
+void InMemoryView::addUnstatedFile(
+    ViewDatabase& view,
+    watchman_dir* dir,
+    const w_string& name,
+    DType dtype,
+    std::chrono::system_clock::time_point now) {
+  static auto& unstatedFiles = getCounter(
+      "watchman_crawl_unstated_files_total",
+      "Files that a crawl recorded from their dtype alone");
+  unstatedFiles.add();
+
+  auto file = view.getOrCreateChildFile(*watcher_, dir, name, getClock(now));
+  if (!file->exists) {
+    // As in statPath, transitioning from deleted to existing makes it new
+    file->ctime.ticks = mostRecentTick_;
+    file->ctime.timestamp = std::chrono::system_clock::to_time_t(now);
+    file->exists = true;
+  }
 
-  return false;
+  FileInformation st;
+#ifdef DTTOIF
+  st.mode = DTTOIF(static_cast<int>(dtype));
+#else
+  (void)dtype;
+#endif
+  file->setStat(st);
+  file->stat_deferred = true;
+  view.markFileChanged(*watcher_, file, getClock(now));
+
+  if (auto dir_ent = dir->getChildDir(name)) {
+    // It was a dir (see fishy.php); prune the former tree
+    view.markDirDeleted(*watcher_, dir_ent, getClock(now), true);
+  }
+}
+
+void InMemoryView::prefetchSymlinkTarget(
+    const w_string& fullPath,
+    const watchman_file* file,
+    const w_string* target) {
+  auto& rootPath = caches_.symlinkTargetCache.rootPath();
+  if (fullPath.size() <= rootPath.size() + 1) {
+    return;
+  }
+  SymlinkTargetCacheKey key{
+      w_string{
+          fullPath.data() + rootPath.size() + 1,
+          fullPath.size() - rootPath.size() - 1},
+      file->otime};
+  if (target) {
+    caches_.symlinkTargetCache.set(key, *target);
+    return;
+  }
+  try {
+    caches_.symlinkTargetCache.set(key, readSymbolicLink(fullPath.c_str()));
+  } catch (const std::system_error& exc) {
+    // A query will read it again, and report the error
+    logf(DBG, "not prefetching the target of {}: {}\n", fullPath, exc.what());
+  }
 }
-} // namespace
 
 void InMemoryView::statPath(
     const RootConfig& root,
@@ -817,6 +2366,10 @@ void InMemoryView::statPath(
     PendingChanges& coll,
     const PendingChange& pending,
     const FileInformation* pre_stat) {
+  static auto& statPaths = getCounter(
+      "watchman_stat_path_total", "Paths examined by the IO thread");
+  statPaths.add();
+
   bool recursive = pending.flags.contains(W_PENDING_RECURSIVE);
   const bool via_notify = pending.flags.contains(W_PENDING_VIA_NOTIFY);
   const PendingFlags desynced_flag = pending.flags & W_PENDING_IS_DESYNCED;
@@ -829,6 +2382,13 @@ void InMemoryView::statPath(
     return;
   }
 
+  // Watchers that report the whole tree report what happens in the dirs
+  // that were left unexplored too.
+  if (vcsIgnoreCrawl_ && isBelowVcsIgnoredDir(pending.path)) {
+    logf(DBG, "{} is below a dir that the VCS ignores\n", pending.path);
+    return;
+  }
+
   auto& path = pending.path;
   w_check(path, "must have path");
   auto dir_name = pending.path.dirName();
@@ -961,6 +2521,11 @@ void InMemoryView::statPath(
           *watcher_, parentDir, file_name, getClock(pending.now));
     }
 
+    // Whether a dir that we already knew about still has the same stat
+    // information, and thus the same set of entries.
+    bool dirUnchanged = trustUnchangedDirMtime_ && !via_notify && dir_ent &&
+        file->exists && !file->statDiffersFrom(st);
+
     if (!file->exists) {
       /* we're transitioning from deleted to existing,
        * so we're effectively new again */
@@ -970,7 +2535,9 @@ void InMemoryView::statPath(
        * to crawl it again */
       recursive = true;
     }
-    if (!file->exists || via_notify || did_file_change(&file->stat, &st)) {
+    const bool changed =
+        !file->exists || via_notify || file->statDiffersFrom(st);
+    if (changed) {
       logf(
           DBG,
           "file changed exists={} via_notify={} stat-changed={} isdir={} size={} {}\n",
@@ -992,7 +2559,12 @@ void InMemoryView::statPath(
       }
     }
 
-    memcpy(&file->stat, &st, sizeof(file->stat));
+    file->setStat(st);
+
+    // crawlerParallel caches the targets that the walker read.
+    if (prefetchSymlinkTargets_ && changed && !viaPwalk && st.isSymlink()) {
+      prefetchSymlinkTarget(path, file);
+    }
 
     if (st.isDir()) {
       if (dir_ent == NULL) {
@@ -1015,7 +2587,8 @@ void InMemoryView::statPath(
           coll.add(
               pending.path,
               pending.now,
-              desynced_flag | W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY);
+              desynced_flag | W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY |
+                  (dirUnchanged ? W_PENDING_DIR_UNCHANGED : PendingFlags{}));
         } else if (pending.flags & W_PENDING_NONRECURSIVE_SCAN) {
           /* on file changes, we receive a notification on the directory and
            * thus we just need to crawl this one directory to consider all
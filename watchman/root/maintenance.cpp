@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <vector>
+#include "watchman/Logging.h"
+#include "watchman/MaintenanceScheduler.h"
+#include "watchman/QueryableView.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/root/Root.h"
+#include "watchman/root/watchlist.h"
+
+namespace watchman {
+
+void Root::performMaintenance() {
+  if (inner.cancelled.load(std::memory_order_acquire)) {
+    return;
+  }
+  if (considerReap()) {
+    stopWatch();
+    return;
+  }
+  if (view()->isHibernated()) {
+    return;
+  }
+
+  considerAgeOut();
+  if (auto trimmed = view()->trimCaches()) {
+    logf(DBG, "trimmed {} expired cache entries of {}\n", trimmed, root_path);
+  }
+}
+
+void w_root_start_maintenance() {
+  getMaintenanceScheduler().start(getThreadPool(), [] {
+    std::vector<MaintenanceScheduler::Task> tasks;
+    auto map = watched_roots.rlock();
+    tasks.reserve(map->size());
+    for (const auto& it : *map) {
+      // So that a root that stops being watched in the meantime is freed
+      tasks.emplace_back([weak = std::weak_ptr<Root>{it.second}] {
+        if (auto root = weak.lock()) {
+          root->performMaintenance();
+        }
+      });
+    }
+    return tasks;
+  });
+}
+
+void w_root_stop_maintenance() {
+  getMaintenanceScheduler().stop();
+}
+
+} // namespace watchman
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -5,8 +5,12 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <chrono>
 #include "watchman/Constants.h"
+#include "watchman/HeapProfile.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/MaintenanceScheduler.h"
+#include "watchman/TickIndex.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/Watcher.h"
 
@@ -18,8 +22,20 @@ namespace watchman {
 // descriptor and then queues the filesystem IO work until after
 // we have drained the inotify descriptor
 void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
+  HeapTagScope heapTag{HeapTag::Pending};
   PendingChanges fromWatcher;
 
+  // Replaying the watcher's events only helps if the view can be populated
+  // from the tick index that recorded where they stopped.
+  if (warmStartFromTickIndex_) {
+    if (auto index = openTickIndex()) {
+      if (const auto& cursor = index->header().watcherCursor;
+          !cursor.empty()) {
+        watcher_->setResumeCursor(cursor);
+      }
+    }
+  }
+
   if (!watcher_->start(root)) {
     logf(
         ERR,
@@ -29,6 +45,8 @@ void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
     root->cancel();
     return;
   }
+  watcherResumed_.store(
+      watcher_->resumedFromCursor(), std::memory_order_release);
 
   // signal that we're done here, so that we can start the
   // io thread after this point
@@ -40,22 +58,54 @@ void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
     if (!watcher_->waitNotify(86400)) {
       continue;
     }
-    do {
-      auto resultFlags = watcher_->consumeNotify(root, fromWatcher);
+    // While the watcher expects more events, keep consuming them into the
+    // same batch for up to notifyBatchDelay_, so that during a storm the IO
+    // thread wakes for fewer, larger batches. A full batch, or one that a
+    // sync is waiting for, is handed over straight away.
+    auto holdUntil = std::chrono::steady_clock::now() + notifyBatchDelay_;
+    bool held = false;
+    while (true) {
+      bool cancelled = false;
+      bool moreLikely = false;
+      do {
+        auto resultFlags = watcher_->consumeNotify(root, fromWatcher);
+
+        if (resultFlags.cancelSelf) {
+          root->cancel();
+          cancelled = true;
+          break;
+        }
+        moreLikely |= resultFlags.moreLikely;
+        if (fromWatcher.getPendingItemCount() >= WATCHMAN_BATCH_LIMIT) {
+          moreLikely = false;
+          break;
+        }
+      } while (watcher_->waitNotify(0));
 
-      if (resultFlags.cancelSelf) {
-        root->cancel();
+      if (cancelled || !moreLikely || fromWatcher.hasSyncs()) {
         break;
       }
-      if (fromWatcher.getPendingItemCount() >= WATCHMAN_BATCH_LIMIT) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          holdUntil - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0) {
         break;
       }
-    } while (watcher_->waitNotify(0));
+      held = true;
+      if (!watcher_->waitNotify(int(remaining.count()))) {
+        break;
+      }
+    }
+    if (held) {
+      notifyBatchesHeld_.fetch_add(1, std::memory_order_relaxed);
+    }
 
     if (!fromWatcher.empty()) {
-      auto lock = pendingFromWatcher_.lock();
-      lock->append(fromWatcher.stealItems(), fromWatcher.stealSyncs());
-      lock->ping();
+      getMaintenanceScheduler().noteEvents(fromWatcher.getPendingItemCount());
+      // Hand the batch over without waiting for the IO thread, which may be
+      // holding the lock while it takes the previous one.
+      pendingFromWatcher_.enqueue(
+          fromWatcher.stealItems(), fromWatcher.stealSyncs());
+      *watcherCursor_.wlock() = watcher_->getEventCursor();
     }
   }
 }
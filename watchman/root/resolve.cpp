@@ -6,10 +6,13 @@
  */
 
 #include <folly/String.h>
+#include "watchman/CrawlScheduler.h"
 #include "watchman/Errors.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/ScopedView.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/listener.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/watchlist.h"
 #include "watchman/state.h"
@@ -126,6 +129,50 @@ std::optional<json_ref> load_root_config(const char* path) {
   return json_load_file(cfgfilename, 0);
 }
 
+// Returns the watched root that encloses root_str and whose view can
+// answer for it, if the config of the new root asks for that rather than
+// for a crawl and watch of its own.
+std::shared_ptr<Root> find_view_to_share(
+    const w_string& root_str,
+    const Configuration& config) {
+  if (!config.getBool("share_enclosing_view", false)) {
+    return nullptr;
+  }
+
+  w_string prefix;
+  w_string_piece relativePath;
+  if (!findEnclosingRoot(root_str, prefix, relativePath) ||
+      relativePath.empty()) {
+    return nullptr;
+  }
+
+  std::shared_ptr<Root> parent;
+  {
+    auto map = watched_roots.rlock();
+    auto it = map->find(prefix);
+    if (it != map->end()) {
+      parent = it->second;
+    }
+  }
+  if (!parent || parent->inner.cancelled.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+
+  // Only a view that holds the files itself can be shared, and only if
+  // it keeps the files below the new root.
+  if (!std::dynamic_pointer_cast<InMemoryView>(parent->view()) ||
+      parent->ignore.isIgnored(root_str.data(), root_str.size())) {
+    return nullptr;
+  }
+
+  logf(
+      ERR,
+      "resolve_root: {} shares the view of enclosing root {}\n",
+      root_str,
+      parent->root_path);
+  return parent;
+}
+
 } // namespace
 
 std::shared_ptr<Root>
@@ -204,6 +251,8 @@ root_resolve(const char* filename, bool auto_watch, bool* created) {
     // are typically on the order of days.
     root->inner.last_cmd_timestamp.store(
         std::chrono::steady_clock::now(), std::memory_order_release);
+    root->inner.restored_last_used.store({}, std::memory_order_release);
+    getCrawlScheduler().prioritize(root->root_path);
     return root;
   }
 
@@ -232,13 +281,19 @@ root_resolve(const char* filename, bool auto_watch, bool* created) {
 
   auto config_file = load_root_config(root_str.c_str());
   Configuration config{config_file};
+  std::shared_ptr<QueryableView> view;
+  if (auto parent = find_view_to_share(root_str, config)) {
+    view = std::make_shared<ScopedView>(root_str, std::move(parent));
+  } else {
+    view = WatcherRegistry::initWatcher(root_str, fs_type, config);
+  }
   root = std::make_shared<Root>(
       realFileSystem,
       root_str,
       fs_type,
       config_file,
       config,
-      WatcherRegistry::initWatcher(root_str, fs_type, config),
+      std::move(view),
       &w_state_save);
 
   {
@@ -251,6 +306,7 @@ root_resolve(const char* filename, bool auto_watch, bool* created) {
       *created = false;
     } else {
       existing = root;
+      watched_root_paths.wlock()->insert(root->root_path);
       *created = true;
     }
   }
@@ -270,6 +326,7 @@ std::shared_ptr<Root> w_root_resolve(const char* filename, bool auto_watch) {
       root->cancel();
       throw;
     }
+    w_start_git_fsmonitor_listener(root);
     w_state_save();
   }
   return root;
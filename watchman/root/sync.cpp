@@ -5,8 +5,11 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/stop_watch.h>
+#include "watchman/Metrics.h"
 #include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
+#include "watchman/Tracing.h"
 #include "watchman/root/Root.h"
 
 using namespace watchman;
@@ -16,11 +19,22 @@ folly::SemiFuture<folly::Unit> Root::waitForSettle(
   return view()->waitForSettle(settle_period);
 }
 
-CookieSync::SyncResult Root::syncToNow(std::chrono::milliseconds timeout) {
+CookieSync::SyncResult Root::syncToNow(
+    std::chrono::milliseconds timeout,
+    const std::vector<w_string>& scope) {
+  static auto& latency = getHistogram(
+      "watchman_cookie_sync_us", "Time taken to sync to now with a cookie");
+  static auto& failures = getCounter(
+      "watchman_cookie_sync_failures_total",
+      "Cookie syncs that failed or timed out");
+
   PerfSample sample("sync_to_now");
+  TraceScope span{"cookie_sync", traceId};
+  folly::stop_watch<std::chrono::microseconds> stopWatch;
   auto root = shared_from_this();
   try {
-    auto result = view()->syncToNow(root, timeout);
+    auto result = view()->syncToNow(root, timeout, scope);
+    latency.recordMicros(stopWatch.elapsed());
     if (sample.finish()) {
       root->addPerfSampleMetadata(sample);
       sample.add_meta(
@@ -32,6 +46,7 @@ CookieSync::SyncResult Root::syncToNow(std::chrono::milliseconds timeout) {
     }
     return result;
   } catch (const std::exception& exc) {
+    failures.add();
     sample.force_log();
     sample.finish();
     root->addPerfSampleMetadata(sample);
@@ -7,7 +7,9 @@
 
 #include "watchman/QueryableView.h"
 #include "watchman/TriggerCommand.h"
+#include "watchman/listener.h"
 #include "watchman/root/Root.h"
+#include "watchman/root/watchlist.h"
 
 using namespace watchman;
 
@@ -17,14 +19,60 @@ void Root::recrawlTriggered(const char* why) {
   log(ERR, root_path, ": ", why, ": tree recrawl triggered\n");
 }
 
+void Root::scheduleScopedRecrawl(const char* why, size_t num_dirs) {
+  auto info = recrawlInfo.wlock();
+  info->recrawlCount++;
+  info->reason = why;
+  info->scopedDirs = num_dirs;
+  if (!suppress_recrawl_warnings) {
+    info->warning = w_string::build(
+        "Recrawled ",
+        num_dirs,
+        " dirs of this watch, most recently because:\n",
+        why,
+        "To resolve, please review the information on\n",
+        cfg_get_trouble_url(),
+        "#recrawl");
+  }
+
+  log(ERR,
+      root_path,
+      ": ",
+      why,
+      ": scheduling a recrawl of ",
+      num_dirs,
+      " recently active dirs\n");
+}
+
 void Root::scheduleRecrawl(const char* why) {
+  auto window = std::chrono::milliseconds(
+      config.getInt("recrawl_backoff_window_ms", 60000));
+  auto initialBackoff = std::chrono::milliseconds(
+      config.getInt("recrawl_backoff_initial_ms", 1000));
+  auto maxBackoff = std::chrono::milliseconds(
+      config.getInt("recrawl_backoff_max_ms", 300000));
   {
     auto info = recrawlInfo.wlock();
+    auto now = std::chrono::steady_clock::now();
 
     if (!info->shouldRecrawl) {
+      // A tool that keeps overflowing the watcher would otherwise have us
+      // recrawling back to back, so one that follows soon after the last
+      // is held back, for longer each time.
+      if (window.count() > 0 && info->recrawlScheduled &&
+          now - info->crawlFinish < window) {
+        info->backoff = info->backoff.count()
+            ? std::min(info->backoff * 2, maxBackoff)
+            : std::min(initialBackoff, maxBackoff);
+      } else {
+        info->backoff = std::chrono::milliseconds(0);
+      }
+      info->recrawlScheduled = true;
+      info->notBefore = now + info->backoff;
       info->recrawlCount++;
       info->reason = why;
-      if (!config.getBool("suppress_recrawl_warnings", false)) {
+      info->scopedDirs.reset();
+      if (!suppress_recrawl_warnings) {
         info->warning = w_string::build(
             "Recrawled this watch ",
             info->recrawlCount,
@@ -35,7 +83,21 @@ void Root::scheduleRecrawl(const char* why) {
             "#recrawl");
       }
 
-      log(ERR, root_path, ": ", why, ": scheduling a tree recrawl\n");
+      if (info->backoff.count()) {
+        log(ERR,
+            root_path,
+            ": ",
+            why,
+            ": scheduling a tree recrawl in ",
+            info->backoff.count(),
+            "ms\n");
+      } else {
+        log(ERR, root_path, ": ", why, ": scheduling a tree recrawl\n");
+      }
+    }
+    if (now < info->notBefore) {
+      // Until then, recover what we can from the dirs that were busy.
+      info->scopedRecoveryPending = true;
     }
     info->shouldRecrawl = true;
   }
@@ -62,6 +124,21 @@ bool Root::cancel() {
 
   stopThreads();
   removeFromWatched();
+  w_stop_git_fsmonitor_listener(*this);
+
+  // The roots that share our view can't outlive it
+  std::vector<std::shared_ptr<Root>> nested;
+  {
+    auto map = watched_roots.rlock();
+    for (const auto& it : *map) {
+      if (it.second->view()->getEnclosingRoot().get() == this) {
+        nested.push_back(it.second);
+      }
+    }
+  }
+  for (auto& root : nested) {
+    root->cancel();
+  }
 
   {
     auto map = triggers.rlock();
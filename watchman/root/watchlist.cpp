@@ -18,6 +18,7 @@ namespace watchman {
 
 folly::Synchronized<std::unordered_map<w_string, std::shared_ptr<Root>>>
     watched_roots;
+folly::Synchronized<RootPathTrie> watched_root_paths;
 std::atomic<long> live_roots{0};
 
 bool Root::removeFromWatched() {
@@ -30,44 +31,40 @@ bool Root::removeFromWatched() {
   // another, so make sure we're removing the right object
   if (it->second.get() == this) {
     map->erase(it);
+    watched_root_paths.wlock()->erase(root_path);
     return true;
   }
   return false;
 }
 
-// Given a filename, walk the current set of watches.
-// If a watch is a prefix match for filename then we consider it to
-// be an enclosing watch and we'll return the root path and the relative
-// path to filename.
-// Returns NULL if there were no matches.
-// If multiple watches have the same prefix, it is undefined which one will
-// match.
+// Given a filename, find the watch that encloses it: the one whose root is
+// either filename itself or the nearest of its parent dirs.  Sets prefix to
+// the root path and relativePath to the path of filename relative to it.
+// Returns false if there were no matches.
 bool findEnclosingRoot(
     const w_string& fileName,
-    w_string_piece& prefix,
+    w_string& prefix,
     w_string_piece& relativePath) {
-  std::shared_ptr<Root> root;
   auto name = fileName.piece();
   {
-    auto map = watched_roots.rlock();
-    for (const auto& it : *map) {
-      auto root_name = it.first;
-      if (name.startsWith(root_name.piece()) &&
-          (name.size() == root_name.size() /* exact match */ ||
-           is_slash(name[root_name.size()] /* dir container matches */))) {
-        root = it.second;
-        prefix = root_name.piece();
-        if (name.size() == root_name.size()) {
-          relativePath = w_string_piece();
-        } else {
-          relativePath = name;
-          relativePath.advance(root_name.size() + 1);
-        }
-        return true;
-      }
+    auto paths = watched_root_paths.rlock();
+    auto root_name = paths->findEnclosing(name);
+    if (!root_name) {
+      return false;
     }
+    prefix = *root_name;
   }
-  return false;
+  if (name.size() <= prefix.size()) {
+    relativePath = w_string_piece();
+  } else {
+    relativePath = name;
+    relativePath.advance(prefix.size());
+    // The root is "/" on its own, or its components are followed by a slash
+    while (relativePath.size() > 0 && is_slash(relativePath[0])) {
+      relativePath.advance(1);
+    }
+  }
+  return true;
 }
 
 json_ref w_root_stop_watch_all() {
@@ -158,6 +155,21 @@ RootDebugStatus Root::getStatus() const {
     if (stat_count) {
       recrawl_info.stat_count = stat_count->load(std::memory_order_acquire);
     }
+    if (info->scopedDirs) {
+      recrawl_info.scoped_dirs = *info->scopedDirs;
+    }
+    if (info->backoff.count()) {
+      recrawl_info.backoff_ms = info->backoff.count();
+    }
+    if (info->shouldRecrawl && info->notBefore > now) {
+      recrawl_info.deferred_ms =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              info->notBefore - now)
+              .count();
+    }
+    if (info->waitingForTurn) {
+      recrawl_info.waiting_for_turn = true;
+    }
 
     int64_t finish_ago = std::chrono::duration_cast<std::chrono::milliseconds>(
                              now - info->crawlFinish)
@@ -203,6 +215,9 @@ RootDebugStatus Root::getStatus() const {
         case QueryContextState::WaitingForCookieSync:
           queryState = "WaitingForCookieSync";
           break;
+        case QueryContextState::WaitingForAdmission:
+          queryState = "WaitingForAdmission";
+          break;
         case QueryContextState::WaitingForViewLock:
           queryState = "WaitingForViewLock";
           break;
@@ -261,12 +276,26 @@ RootDebugStatus Root::getStatus() const {
   obj.cookie_prefix = cookiePrefix;
   obj.cookie_dir = cookieDirs;
   obj.cookie_list = cookie_array;
+  for (const auto& latency : cookies.getDirLatencies()) {
+    CookieDirLatency entry;
+    entry.dir = latency.dir;
+    entry.observed = latency.observed;
+    entry.last_us = latency.last.count();
+    entry.max_us = latency.max.count();
+    entry.mean_us = latency.observed
+        ? latency.total.count() / int64_t(latency.observed)
+        : 0;
+    obj.cookie_latency.push_back(std::move(entry));
+  }
   obj.recrawl_info = std::move(recrawl_info);
   obj.queries = std::move(query_info);
   obj.done_initial = inner.done_initial;
   obj.cancelled = inner.cancelled;
   obj.crawl_status = w_string{crawl_status.data(), crawl_status.size()};
   obj.enable_parallel_crawl = enable_parallel_crawl;
+  obj.memory = view()->getMemoryStats(false);
+  obj.settle = view()->getSettleStatus();
+  obj.lag = view()->getLagStatus();
   return obj;
 }
 
@@ -11,6 +11,7 @@
 #include <atomic>
 #include <memory>
 #include <unordered_map>
+#include "watchman/root/RootPathTrie.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 
 namespace watchman {
@@ -22,12 +23,23 @@ extern std::atomic<long> live_roots;
 extern folly::Synchronized<std::unordered_map<w_string, std::shared_ptr<Root>>>
     watched_roots;
 
+// The paths of the roots in watched_roots, for findEnclosingRoot. Only
+// modified while holding the wlock of watched_roots, which is acquired
+// first.
+extern folly::Synchronized<RootPathTrie> watched_root_paths;
+
 bool findEnclosingRoot(
     const w_string& fileName,
-    w_string_piece& prefix,
+    w_string& prefix,
     w_string_piece& relativePath);
 
 void w_root_free_watched_roots();
+/**
+ * Starts and stops having the maintenance scheduler look after every
+ * watched root, if it is enabled.
+ */
+void w_root_start_maintenance();
+void w_root_stop_maintenance();
 json_ref w_root_stop_watch_all();
 json_ref w_root_watch_list_to_json();
 
@@ -7,7 +7,12 @@
 
 use std::ffi::OsString;
 use std::fmt::Write;
+use std::path::Path;
 use std::path::PathBuf;
+use std::str::Utf8Error;
+
+use serde::de;
+use serde::ser;
 
 /// The ByteString type represents values encoded using BSER_BYTESTRING.
 /// The purpose of this encoding is to represent bytestrings with an arbitrary
@@ -69,33 +74,36 @@ impl ByteString {
     /// string, with invalid sequences escaped using `\xXX` hex notation.
     /// This is for diagnostic and display purposes.
     pub fn as_escaped_string(&self) -> String {
-        let mut input = self.0.as_slice();
-        let mut output = String::new();
+        escape_bytes(self.0.as_slice())
+    }
+}
 
-        loop {
-            match ::std::str::from_utf8(input) {
-                Ok(valid) => {
-                    output.push_str(valid);
-                    break;
-                }
-                Err(error) => {
-                    let (valid, after_valid) = input.split_at(error.valid_up_to());
-                    unsafe { output.push_str(::std::str::from_utf8_unchecked(valid)) }
-
-                    if let Some(invalid_sequence_length) = error.error_len() {
-                        for b in &after_valid[..invalid_sequence_length] {
-                            write!(output, "\\x{:x}", b).unwrap();
-                        }
-                        input = &after_valid[invalid_sequence_length..];
-                    } else {
-                        break;
+fn escape_bytes(mut input: &[u8]) -> String {
+    let mut output = String::new();
+
+    loop {
+        match ::std::str::from_utf8(input) {
+            Ok(valid) => {
+                output.push_str(valid);
+                break;
+            }
+            Err(error) => {
+                let (valid, after_valid) = input.split_at(error.valid_up_to());
+                unsafe { output.push_str(::std::str::from_utf8_unchecked(valid)) }
+
+                if let Some(invalid_sequence_length) = error.error_len() {
+                    for b in &after_valid[..invalid_sequence_length] {
+                        write!(output, "\\x{:x}", b).unwrap();
                     }
+                    input = &after_valid[invalid_sequence_length..];
+                } else {
+                    break;
                 }
             }
         }
-
-        output
     }
+
+    output
 }
 
 /// Guaranteed conversion from an owned byte vector to a ByteString
@@ -183,3 +191,131 @@ impl TryInto<ByteString> for PathBuf {
         Ok(self.into_os_string().try_into()?)
     }
 }
+
+/// The ByteStr type is a ByteString that borrows its bytes from the buffer
+/// holding the PDU, so that file names can be deserialized without
+/// allocating. It can only be deserialized by `from_slice` and
+/// `rows_from_slice`, which decode from such a buffer; use ByteString with
+/// `from_reader`.
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+pub struct ByteStr<'a>(&'a [u8]);
+
+impl<'a> std::fmt::Debug for ByteStr<'a> {
+    fn fmt(&self, fmt: &mut std::fmt::Formatter<'_>) -> Result<(), std::fmt::Error> {
+        let escaped = self.as_escaped_string();
+        write!(fmt, "\"{}\"", escaped.escape_debug())
+    }
+}
+
+impl<'a> std::fmt::Display for ByteStr<'a> {
+    fn fmt(&self, fmt: &mut std::fmt::Formatter<'_>) -> Result<(), std::fmt::Error> {
+        let escaped = self.as_escaped_string();
+        write!(fmt, "\"{}\"", escaped.escape_default())
+    }
+}
+
+impl<'a> std::ops::Deref for ByteStr<'a> {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        self.0
+    }
+}
+
+impl<'a> ByteStr<'a> {
+    /// Returns the raw bytes, with the lifetime of the buffer
+    pub fn as_bytes(&self) -> &'a [u8] {
+        self.0
+    }
+
+    /// Returns a version of the bytestring encoded as a mostly-utf-8
+    /// string, with invalid sequences escaped using `\xXX` hex notation.
+    /// This is for diagnostic and display purposes.
+    pub fn as_escaped_string(&self) -> String {
+        escape_bytes(self.0)
+    }
+
+    /// Attempts to view the bytestring as a UTF-8 str
+    pub fn to_str(&self) -> Result<&'a str, Utf8Error> {
+        std::str::from_utf8(self.0)
+    }
+
+    /// Views the bytestring as a Path. This is subject to the same rules as
+    /// the conversion of a ByteString to an OsString: it is guaranteed to
+    /// succeed on unix systems but can fail on Windows systems.
+    #[cfg(unix)]
+    pub fn to_path(&self) -> Result<&'a Path, Utf8Error> {
+        let os = <std::ffi::OsStr as std::os::unix::ffi::OsStrExt>::from_bytes(self.0);
+        Ok(Path::new(os))
+    }
+
+    #[cfg(windows)]
+    pub fn to_path(&self) -> Result<&'a Path, Utf8Error> {
+        Ok(Path::new(self.to_str()?))
+    }
+
+    /// Copies the bytes into an owned ByteString
+    pub fn to_byte_string(&self) -> ByteString {
+        ByteString(self.0.to_vec())
+    }
+}
+
+impl<'a> From<&'a [u8]> for ByteStr<'a> {
+    fn from(bytes: &'a [u8]) -> Self {
+        Self(bytes)
+    }
+}
+
+impl<'a> From<&'a str> for ByteStr<'a> {
+    fn from(s: &'a str) -> Self {
+        Self(s.as_bytes())
+    }
+}
+
+impl<'a> From<ByteStr<'a>> for ByteString {
+    fn from(s: ByteStr<'a>) -> Self {
+        s.to_byte_string()
+    }
+}
+
+impl<'a> PartialEq<[u8]> for ByteStr<'a> {
+    fn eq(&self, rhs: &[u8]) -> bool {
+        self.0 == rhs
+    }
+}
+
+impl<'de: 'a, 'a> de::Deserialize<'de> for ByteStr<'a> {
+    fn deserialize<D>(deserializer: D) -> Result<Self, D::Error>
+    where
+        D: de::Deserializer<'de>,
+    {
+        struct ByteStrVisitor;
+
+        impl<'de> de::Visitor<'de> for ByteStrVisitor {
+            type Value = ByteStr<'de>;
+
+            fn expecting(&self, fmt: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+                fmt.write_str("a bytestring borrowed from the PDU")
+            }
+
+            fn visit_borrowed_bytes<E>(self, v: &'de [u8]) -> Result<Self::Value, E> {
+                Ok(ByteStr(v))
+            }
+
+            fn visit_borrowed_str<E>(self, v: &'de str) -> Result<Self::Value, E> {
+                Ok(ByteStr(v.as_bytes()))
+            }
+        }
+
+        deserializer.deserialize_bytes(ByteStrVisitor)
+    }
+}
+
+impl<'a> ser::Serialize for ByteStr<'a> {
+    fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
+    where
+        S: ser::Serializer,
+    {
+        serializer.serialize_bytes(self.0)
+    }
+}
@@ -9,6 +9,7 @@ mod bunser;
 mod map;
 mod read;
 mod reentrant;
+mod rows;
 mod seq;
 mod template;
 #[cfg(test)]
@@ -30,6 +31,8 @@ pub use self::read::DeRead;
 pub use self::read::Reference;
 pub use self::read::SliceRead;
 use self::reentrant::ReentrantLimit;
+pub use self::rows::rows_from_slice;
+pub use self::rows::RowIter;
 
 pub struct Deserializer<R> {
     bunser: Bunser<R>,
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+//! Incremental deserialization of the rows of a response, such as the files
+//! of a query result.
+
+use std::marker::PhantomData;
+use std::rc::Rc;
+
+use serde::de;
+use serde::Deserialize;
+
+use crate::errors::*;
+use crate::header::*;
+
+use super::read::SliceRead;
+use super::reentrant::ReentrantGuard;
+use super::template;
+use super::Deserializer;
+
+/// An iterator over the rows of an array field of a PDU, which deserializes a
+/// row each time it is advanced rather than collecting them all up front.
+///
+/// The rows borrow from the PDU, so with borrowed types such as `&str`,
+/// `ByteStr` and `Cow` with `#[serde(borrow)]`, no row needs to allocate.
+/// The iterator ends after the first error.
+pub struct RowIter<'de, T> {
+    de: Deserializer<SliceRead<'de>>,
+    /// The keys of a template-encoded array; `None` for a plain array.
+    keys: Option<Rc<Vec<template::Key<'de>>>>,
+    remaining: usize,
+    _guard: ReentrantGuard,
+    _marker: PhantomData<fn() -> T>,
+}
+
+/// Finds `field` in the object that `slice`'s PDU holds, and returns an
+/// iterator over the rows of its array. For a query result, `field` is
+/// `"files"`.
+///
+/// The other fields are skipped, without allocating. They can be read by
+/// deserializing the PDU again with `from_slice` into a type that does not
+/// name `field`.
+pub fn rows_from_slice<'de, T>(slice: &'de [u8], field: &str) -> Result<RowIter<'de, T>>
+where
+    T: de::Deserialize<'de>,
+{
+    let mut de = Deserializer::new(SliceRead::new(slice))?;
+    match de.bunser.peek()? {
+        BSER_OBJECT => de.bunser.discard(),
+        ch => {
+            return Err(Error::DeInvalidStartByte {
+                kind: "object holding rows".into(),
+                byte: ch,
+            });
+        }
+    }
+    let nitems = de.bunser.check_next_int()?;
+
+    for _ in 0..nitems {
+        match de.bunser.peek()? {
+            BSER_BYTESTRING | BSER_UTF8STRING => {}
+            ch => {
+                return Err(Error::DeInvalidStartByte {
+                    kind: "map key".into(),
+                    byte: ch,
+                });
+            }
+        }
+        let key = <&'de str>::deserialize(&mut de)?;
+        if key != field {
+            de::IgnoredAny::deserialize(&mut de)?;
+            continue;
+        }
+
+        return match de.bunser.peek()? {
+            BSER_ARRAY => {
+                let guard = de.remaining_depth.acquire("array")?;
+                de.bunser.discard();
+                let nitems = de.bunser.check_next_int()?;
+                Ok(RowIter::new(de, None, nitems as usize, guard))
+            }
+            BSER_TEMPLATE => {
+                let guard = de.remaining_depth.acquire("template")?;
+                de.bunser.discard();
+                let keys = de.template_keys()?;
+                let nitems = de.bunser.check_next_int()?;
+                Ok(RowIter::new(
+                    de,
+                    Some(Rc::new(keys)),
+                    nitems as usize,
+                    guard,
+                ))
+            }
+            ch => Err(Error::DeInvalidStartByte {
+                kind: format!("rows of '{}'", field),
+                byte: ch,
+            }),
+        };
+    }
+
+    Err(de::Error::custom(format_args!("missing field `{}`", field)))
+}
+
+impl<'de, T> RowIter<'de, T> {
+    fn new(
+        de: Deserializer<SliceRead<'de>>,
+        keys: Option<Rc<Vec<template::Key<'de>>>>,
+        remaining: usize,
+        guard: ReentrantGuard,
+    ) -> Self {
+        RowIter {
+            de,
+            keys,
+            remaining,
+            _guard: guard,
+            _marker: PhantomData,
+        }
+    }
+
+    /// The number of rows that have not been deserialized yet.
+    #[inline]
+    pub fn remaining(&self) -> usize {
+        self.remaining
+    }
+}
+
+impl<'de, T> Iterator for RowIter<'de, T>
+where
+    T: de::Deserialize<'de>,
+{
+    type Item = Result<T>;
+
+    fn next(&mut self) -> Option<Result<T>> {
+        if self.remaining == 0 {
+            return None;
+        }
+        self.remaining -= 1;
+        let row = match self.keys {
+            Some(ref keys) => T::deserialize(template::ObjectDeserializer::new(
+                &mut self.de,
+                keys.clone(),
+            )),
+            None => T::deserialize(&mut self.de),
+        };
+        if row.is_err() {
+            // The position of the next row is unknown.
+            self.remaining = 0;
+        }
+        Some(row)
+    }
+
+    #[inline]
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        (0, Some(self.remaining))
+    }
+}
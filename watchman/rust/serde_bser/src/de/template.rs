@@ -85,21 +85,25 @@ where
             Ok(None)
         } else {
             self.remaining -= 1;
-            let obj_de = ObjectDeserializer {
-                de: &mut *self.de,
-                keys: self.keys.clone(),
-            };
+            let obj_de = ObjectDeserializer::new(&mut *self.de, self.keys.clone());
             let value = seed.deserialize(obj_de)?;
             Ok(Some(value))
         }
     }
 }
 
-struct ObjectDeserializer<'a, 'de, R> {
+/// Deserializes one row of a template, whose values are next in `de`.
+pub(super) struct ObjectDeserializer<'a, 'de, R> {
     de: &'a mut Deserializer<R>,
     keys: Rc<Vec<Key<'de>>>,
 }
 
+impl<'a, 'de, R> ObjectDeserializer<'a, 'de, R> {
+    pub(super) fn new(de: &'a mut Deserializer<R>, keys: Rc<Vec<Key<'de>>>) -> Self {
+        ObjectDeserializer { de, keys }
+    }
+}
+
 impl<'a, 'de, R> de::Deserializer<'de> for ObjectDeserializer<'a, 'de, R>
 where
     R: 'a + DeRead<'de>,
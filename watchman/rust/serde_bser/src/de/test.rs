@@ -11,8 +11,10 @@ use std::borrow::Cow;
 use std::collections::HashMap;
 use std::io::Cursor;
 
+use crate::bytestring::ByteStr;
 use crate::from_reader;
 use crate::from_slice;
+use crate::rows_from_slice;
 
 // For "from_reader" data in owned and for "from_slice" data is borrowed
 
@@ -504,3 +506,44 @@ fn test_arrays_untagged_enum() {
         })
     );
 }
+
+#[derive(Debug, Deserialize, PartialEq)]
+pub struct BorrowedFileInfo<'a> {
+    #[serde(borrow)]
+    name: ByteStr<'a>,
+    size: u32,
+}
+
+#[test]
+fn test_rows_from_slice() {
+    // The files of test_compact_arrays, as a template followed by the other
+    // fields, and of test_arrays, as an array preceded by them.
+    let compact = b"\x00\x02\x00\x00\x00\x00\x04\xeb\x00\x01\x03\x04\x02\x03\x05files\x0b\x00\x03\x02\x0d\x03\x04name\x0d\x03\x04size\x03\x02\x02\x038fbcode/scm/hg/lib/hg_watchman_client/tester/target/debug\x04\x80\x01\x02\x03\x3dfbcode/scm/hg/lib/hg_watchman_client/tester/target/debug/deps\x04\x80\x0c\x02\x03\x05clock\x0d\x03\x19c\x3a1525428959\x3a45796\x3a2\x3a7717\x02\x03\x11is_fresh_instance\x09\x02\x03\x07version\x0d\x03\x054.9.1";
+    let arrays = b"\x00\x02\x00\x00\x00\x00\x04\xea\x00\x01\x03\x04\x02\x03\x07version\x02\x03\x054.9.1\x02\x03\x11is_fresh_instance\x09\x02\x03\x05clock\x02\x03\x19c\x3a1525428959\x3a45796\x3a2\x3a9642\x02\x03\x05files\x00\x03\x02\x01\x03\x02\x02\x03\x04size\x04\x80\x01\x02\x03\x04name\x02\x038fbcode/scm/hg/lib/hg_watchman_client/tester/target/debug\x01\x03\x02\x02\x03\x04size\x04\xe0\x00\x02\x03\x04name\x02\x03\x2bfbcode/scm/hg/lib/hg_watchman_client/tester";
+
+    for bser_v2 in [&compact[..], &arrays[..]] {
+        let expected = from_slice::<BytestringFiles<'_>>(bser_v2).unwrap().files;
+        let rows = rows_from_slice::<BorrowedFileInfo<'_>>(bser_v2, "files").unwrap();
+        assert_eq!(rows.remaining(), 2);
+        let decoded: Vec<_> = rows.map(|row| row.unwrap()).collect();
+        assert_eq!(decoded.len(), expected.len());
+        for (row, file) in decoded.iter().zip(expected.iter()) {
+            assert_eq!(file.name, row.name.as_bytes());
+            assert_eq!(file.size, row.size);
+            // The name points into the PDU.
+            assert!(bser_v2.as_ptr_range().contains(&row.name.as_ptr()));
+        }
+        assert_eq!(
+            decoded[0].name.to_str().unwrap(),
+            "fbcode/scm/hg/lib/hg_watchman_client/tester/target/debug"
+        );
+
+        // The sizes are not strings, and the rows end at the first error.
+        let mut names = rows_from_slice::<HashMap<&str, &str>>(bser_v2, "files").unwrap();
+        assert!(names.next().unwrap().is_err());
+        assert!(names.next().is_none());
+
+        assert!(rows_from_slice::<BorrowedFileInfo<'_>>(bser_v2, "dirs").is_err());
+        assert!(rows_from_slice::<BorrowedFileInfo<'_>>(bser_v2, "clock").is_err());
+    }
+}
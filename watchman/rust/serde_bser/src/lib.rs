@@ -15,3 +15,4 @@ pub mod value;
 
 pub use crate::de::from_reader;
 pub use crate::de::from_slice;
+pub use crate::de::rows_from_slice;
@@ -6,10 +6,16 @@
  */
 
 #include "watchman/saved_state/LocalSavedStateInterface.h"
+#include <folly/Synchronized.h>
+#include <ctime>
+#include <unordered_map>
+#include <unordered_set>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
+#include "watchman/fs/DirHandle.h"
 #include "watchman/fs/FileInformation.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/scm/SCM.h"
 
 static const int kDefaultMaxCommits{10};
@@ -18,6 +24,80 @@ W_CAP_REG("saved-state-local")
 
 namespace watchman {
 
+namespace {
+
+// The names in each project directory that has been looked in, so that
+// finding the saved state for a commit costs one stat of the directory
+// rather than one per candidate commit. A directory is listed again when
+// its mtime changes.
+class SavedStateIndex {
+ public:
+  bool contains(const w_string& dir, const w_string& name) {
+    struct timespec mtime;
+    try {
+      auto info = getFileInformation(dir.c_str());
+      if (info.isSymlink()) {
+        info = getFileInformation(realPath(dir.c_str()).c_str());
+      }
+      mtime = info.mtime;
+    } catch (const std::system_error&) {
+      listings_.wlock()->erase(dir);
+      return false;
+    }
+
+    {
+      auto listings = listings_.rlock();
+      auto it = listings->find(dir);
+      if (it != listings->end() && !it->second.racy &&
+          it->second.mtime.tv_sec == mtime.tv_sec &&
+          it->second.mtime.tv_nsec == mtime.tv_nsec) {
+        return it->second.names.count(name) > 0;
+      }
+    }
+
+    Listing listing;
+    listing.mtime = mtime;
+    // An entry added in the same tick of the mtime clock as the listing
+    // would not change the mtime, so a listing taken that soon after the
+    // last change can't be trusted next time.
+    listing.racy = mtime.tv_sec + 1 >= time(nullptr);
+    try {
+      auto handle = openDir(dir.c_str(), /*strict=*/false);
+      while (auto entry = handle->readDir()) {
+        listing.names.emplace(entry->d_name);
+      }
+    } catch (const std::system_error& exc) {
+      log(DBG,
+          "unable to list saved states in ",
+          dir,
+          ": ",
+          exc.what(),
+          "\n");
+      listings_.wlock()->erase(dir);
+      return false;
+    }
+
+    bool found = listing.names.count(name) > 0;
+    listings_.wlock()->insert_or_assign(dir, std::move(listing));
+    return found;
+  }
+
+ private:
+  struct Listing {
+    struct timespec mtime;
+    bool racy;
+    std::unordered_set<w_string> names;
+  };
+  folly::Synchronized<std::unordered_map<w_string, Listing>> listings_;
+};
+
+SavedStateIndex& savedStateIndex() {
+  static SavedStateIndex index;
+  return index;
+}
+
+} // namespace
+
 LocalSavedStateInterface::LocalSavedStateInterface(
     const json_ref& savedStateConfig,
     const SCM* scm)
@@ -69,7 +149,7 @@ LocalSavedStateInterface::getMostRecentSavedStateImpl(
     // return the state without additional safety guarantees, and leave it to
     // the client to ensure GC happens only after states are no longer likely
     // to be used.
-    if (w_path_exists(path.c_str())) {
+    if (savedStateIndex().contains(path.dirName(), path.baseName())) {
       log(DBG, "Found saved state for commit ", commitId, "\n");
       SavedStateInterface::SavedStateResult result;
       result.commitId = commitId;
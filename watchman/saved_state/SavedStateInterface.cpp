@@ -6,13 +6,32 @@
  */
 
 #include "watchman/saved_state/SavedStateInterface.h"
+#include <folly/Synchronized.h>
 #include <memory>
+#include <unordered_map>
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
 #include "watchman/saved_state/LocalSavedStateInterface.h"
 
 namespace watchman {
 
+namespace {
+
+struct PrefetchedResult {
+  SavedStateInterface::SavedStateResult result;
+  std::chrono::steady_clock::time_point fetched;
+};
+
+// Keyed by the config and the lookup commit.
+folly::Synchronized<std::unordered_map<w_string, PrefetchedResult>>&
+prefetchedResults() {
+  static folly::Synchronized<std::unordered_map<w_string, PrefetchedResult>>
+      results;
+  return results;
+}
+
+} // namespace
+
 SavedStateInterface::~SavedStateInterface() = default;
 
 SavedStateInterface::SavedStateInterface(const json_ref& savedStateConfig) {
@@ -33,11 +52,23 @@ SavedStateInterface::SavedStateInterface(const json_ref& savedStateConfig) {
   } else {
     projectMetadata_ = w_string();
   }
+  configKey_ =
+      w_string{json_dumps(savedStateConfig, JSON_COMPACT | JSON_SORT_KEYS)};
 }
 
 SavedStateInterface::SavedStateResult
 SavedStateInterface::getMostRecentSavedState(
     w_string_piece lookupCommitId) const {
+  {
+    auto results = prefetchedResults().rlock();
+    auto it =
+        results->find(w_string::build(configKey_, ":", lookupCommitId.view()));
+    if (it != results->end() &&
+        std::chrono::steady_clock::now() - it->second.fetched < kPrefetchTTL) {
+      return it->second.result;
+    }
+  }
+
   try {
     return getMostRecentSavedStateImpl(lookupCommitId);
   } catch (const std::exception& ex) {
@@ -52,4 +83,28 @@ SavedStateInterface::getMostRecentSavedState(
     return result;
   }
 }
+
+void SavedStateInterface::prefetchMostRecentSavedState(
+    w_string_piece lookupCommitId) const {
+  PrefetchedResult prefetched;
+  try {
+    prefetched.result = getMostRecentSavedStateImpl(lookupCommitId);
+  } catch (const std::exception& ex) {
+    log(ERR, "Exception while prefetching saved state: ", ex.what(), "\n");
+    return;
+  }
+  prefetched.fetched = std::chrono::steady_clock::now();
+
+  auto results = prefetchedResults().wlock();
+  for (auto it = results->begin(); it != results->end();) {
+    if (prefetched.fetched - it->second.fetched >= kPrefetchTTL) {
+      it = results->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  results->insert_or_assign(
+      w_string::build(configKey_, ":", lookupCommitId.view()),
+      std::move(prefetched));
+}
 } // namespace watchman
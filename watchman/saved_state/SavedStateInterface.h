@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <memory>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 namespace watchman {
@@ -23,6 +26,16 @@ using SavedStateFactory = std::unique_ptr<SavedStateInterface> (*)(
     Configuration config,
     std::function<void(PerfSample&)> extraSampleMetadata);
 
+// The parameters of a query's saved state lookup, which a view keeps so
+// that it can repeat the lookup in the background when the merge base with
+// mergeBaseWith may have changed.
+struct SavedStateLookup {
+  SavedStateFactory factory;
+  w_string mergeBaseWith;
+  w_string storageType;
+  json_ref config;
+};
+
 // An interface that returns information about saved states associated with
 // specific source control commits. Clients using scm-aware queries can
 // receive information about the most recent known good saved state when the
@@ -45,11 +58,22 @@ class SavedStateInterface {
   // including lookupCommitId that has a valid saved state for the specified
   // storage key. The contents of the storage key and the return value vary with
   // the storage type.
+  // A result that prefetchMostRecentSavedState found for the same config and
+  // commit in the last kPrefetchTTL is returned without looking again.
   SavedStateResult getMostRecentSavedState(w_string_piece lookupCommitId) const;
 
+  // Looks up the saved state for lookupCommitId ahead of the queries that
+  // will need it, and keeps the result for kPrefetchTTL. Failures are
+  // logged and not kept.
+  void prefetchMostRecentSavedState(w_string_piece lookupCommitId) const;
+
+  static constexpr std::chrono::seconds kPrefetchTTL{30};
+
  protected:
   w_string project_;
   w_string projectMetadata_;
+  // Identifies the saved state config, to match prefetched results.
+  w_string configKey_;
 
   explicit SavedStateInterface(const json_ref& savedStateConfig);
   virtual SavedStateResult getMostRecentSavedStateImpl(
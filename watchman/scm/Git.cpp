@@ -9,8 +9,10 @@
 #include <folly/String.h>
 #include "watchman/ChildProcess.h"
 #include "watchman/CommandRegistry.h"
+#include "watchman/LineSplitter.h"
 #include "watchman/Logging.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/scm/SCMResultStore.h"
 
 // Capability indicating support for the git SCM
 W_CAP_REG("scm-git")
@@ -33,6 +35,26 @@ struct GitResult {
   w_string output;
 };
 
+[[noreturn]] void throwGitFailure(
+    const std::vector<std::string_view>& cmdline,
+    std::string_view description,
+    w_string_piece stdoutData,
+    w_string_piece stderrData,
+    int status) {
+  auto output = std::string{stdoutData.view()};
+  auto error = std::string{stderrData.view()};
+  replaceEmbeddedNulls(output);
+  replaceEmbeddedNulls(error);
+
+  SCMError::throwf(
+      "failed to {}\ncmd = {}\nstdout = {}\nstderr = {}\nstatus = {}",
+      description,
+      folly::join(" ", cmdline),
+      output,
+      error,
+      status);
+}
+
 GitResult runGit(
     std::vector<std::string_view> cmdline,
     ChildProcess::Options options,
@@ -41,50 +63,66 @@ GitResult runGit(
   auto outputs = proc.communicate();
   auto status = proc.wait();
   if (status) {
-    auto output = std::string{outputs.first.view()};
-    auto error = std::string{outputs.second.view()};
-    replaceEmbeddedNulls(output);
-    replaceEmbeddedNulls(error);
-
-    SCMError::throwf(
-        "failed to {}\ncmd = {}\nstdout = {}\nstderr = {}\nstatus = {}",
-        description,
-        folly::join(" ", cmdline),
-        output,
-        error,
-        status);
+    throwGitFailure(
+        cmdline, description, outputs.first, outputs.second, status);
   }
 
   return GitResult{std::move(outputs.first)};
 }
 
+// Like runGit, but rather than collecting the output, passes each of the
+// NUL separated fields of it to onLine as git writes them. The fields are
+// only valid for the duration of the call.
+template <typename OnLine>
+void streamGit(
+    std::vector<std::string_view> cmdline,
+    ChildProcess::Options options,
+    std::string_view description,
+    OnLine&& onLine) {
+  LineSplitter lines{'\0', [&](w_string_piece line) { onLine(line); }};
+  ChildProcess proc{cmdline, std::move(options)};
+  auto error =
+      proc.streamStdout([&](w_string_piece chunk) { lines.feed(chunk); });
+  auto status = proc.wait();
+  if (status) {
+    // What git wrote to stdout has already been consumed
+    throwGitFailure(cmdline, description, w_string_piece{}, error, status);
+  }
+  lines.finish();
+}
+
 } // namespace
 
 namespace watchman {
 
 void GitStatusAccumulator::add(w_string_piece status) {
-  std::vector<w_string_piece> lines;
-  status.split(lines, '\0');
+  LineSplitter lines{'\0', [this](w_string_piece line) { addLine(line); }};
+  lines.feed(status);
+  lines.finish();
+}
 
-  log(DBG, "processing ", lines.size(), " status lines\n");
+void GitStatusAccumulator::addLine(w_string_piece line) {
+  if (line.size() < 4) {
+    return;
+  }
 
-  for (auto& line : lines) {
-    if (line.size() < 4) {
-      continue;
-    }
+  w_string name{line.data() + 3, line.size() - 3};
+  switch (line.data()[1]) {
+    case 'A':
+      // Should remove + add be considered new? Treat it as changed for now.
+      byFile_[name] += 1;
+      break;
+    case 'D':
+      byFile_[name] += -1;
+      break;
+    default:
+      byFile_[name]; // just insert an entry
+  }
+}
 
-    w_string name{line.data() + 3, line.size() - 3};
-    switch (line.data()[1]) {
-      case 'A':
-        // Should remove + add be considered new? Treat it as changed for now.
-        byFile_[name] += 1;
-        break;
-      case 'D':
-        byFile_[name] += -1;
-        break;
-      default:
-        byFile_[name]; // just insert an entry
-    }
+void GitStatusAccumulator::merge(const GitStatusAccumulator& other) {
+  for (auto& [name, count] : other.byFile_) {
+    byFile_[name] += count;
   }
 }
 
@@ -116,7 +154,12 @@ Git::Git(w_string_piece rootPath, w_string_piece scmRoot)
           Configuration(),
           "scm_git_files_since_mergebase",
           32,
-          10) {}
+          10),
+      native_(
+          cfg_get_bool("scm_git_native", true)
+              ? GitRepository::open(getSCMRoot())
+              : nullptr),
+      resultStore_(SCMResultStore::get(getSCMRoot())) {}
 
 ChildProcess::Options Git::makeGitOptions(w_string requestId) const {
   ChildProcess::Options opt;
@@ -154,6 +197,14 @@ w_string Git::mergeBaseWith(w_string_piece commitId, w_string requestId) const {
       .get(
           key,
           [this, commit, requestId](const std::string&) {
+            if (native_) {
+              try {
+                return folly::makeFuture(native_->mergeBaseWithHead(commit));
+              } catch (const std::exception& exc) {
+                log(DBG, "running git merge-base: ", exc.what(), "\n");
+              }
+            }
+
             auto result = runGit(
                 {gitExecutablePath(), "merge-base", commit, "HEAD"},
                 makeGitOptions(requestId),
@@ -188,13 +239,22 @@ std::vector<w_string> Git::getFilesChangedSinceMergeBaseWith(
           key,
           [this, commit = std::move(commitCopy), requestId](
               const std::string&) {
-            auto result = runGit(
-                {gitExecutablePath(), "diff", "--name-only", "-z", commit},
-                makeGitOptions(requestId),
-                "query for files changed since merge base");
+            if (native_) {
+              try {
+                return folly::makeFuture(native_->getFilesChangedSince(commit));
+              } catch (const std::exception& exc) {
+                log(DBG, "running git diff: ", exc.what(), "\n");
+              }
+            }
 
             std::vector<w_string> lines;
-            w_string_piece(result.output).split(lines, '\0');
+            streamGit(
+                {gitExecutablePath(), "diff", "--name-only", "-z", commit},
+                makeGitOptions(requestId),
+                "query for files changed since merge base",
+                [&](w_string_piece line) {
+                  lines.emplace_back(line.data(), line.size());
+                });
             return folly::makeFuture(lines);
           })
       .get()
@@ -213,24 +273,41 @@ SCM::StatusResult Git::getFilesChangedBetweenCommits(
     auto key = folly::to<std::string>(
         commitA, ":", commitB, ":", mtime.tv_sec, ":", mtime.tv_nsec);
 
-    result.add(filesChangedBetweenCommits_
-                   .get(
-                       key,
-                       [&](const std::string&) {
-                         auto gitresult = runGit(
-                             {gitExecutablePath(),
-                              "diff",
-                              "--name-status",
-                              "-z",
-                              commitA,
-                              commitB},
-                             makeGitOptions(requestId),
-                             "get files changed between commits");
-
-                         return folly::makeFuture(gitresult.output);
-                       })
-                   .get()
-                   ->value());
+    auto git = gitExecutablePath();
+    std::vector<std::string_view> cmdline{
+        git, "diff", "--name-status", "-z", commitA, commitB};
+    const char* description = "get files changed between commits";
+    result.merge(
+        filesChangedBetweenCommits_
+            .get(
+                key,
+                [&](const std::string&) {
+                  GitStatusAccumulator changes;
+                  // What changed between two commit hashes never changes,
+                  // so it is kept across restarts as well. That needs all
+                  // of the output; otherwise it is parsed as git writes it.
+                  if (resultStore_ && SCMResultStore::isCommitHash(commitA) &&
+                      SCMResultStore::isCommitHash(commitB)) {
+                    changes.add(resultStore_->getOrCompute(
+                        w_string::build("git:diff:", commitA, ":", commitB),
+                        [&] {
+                          return runGit(
+                                     cmdline,
+                                     makeGitOptions(requestId),
+                                     description)
+                              .output;
+                        }));
+                  } else {
+                    streamGit(
+                        cmdline,
+                        makeGitOptions(requestId),
+                        description,
+                        [&](w_string_piece line) { changes.addLine(line); });
+                  }
+                  return folly::makeFuture(std::move(changes));
+                })
+            .get()
+            ->value());
   }
   return result.finalize();
 }
@@ -266,22 +343,56 @@ std::vector<w_string> Git::getCommitsPriorToAndIncluding(
           key,
           [this, commit = std::move(commitCopy), numCommits, requestId](
               const std::string&) {
-            auto result = runGit(
-                {gitExecutablePath(),
-                 "log",
-                 "-n",
-                 to<std::string>(numCommits),
-                 "--format=%H",
-                 commit},
-                makeGitOptions(requestId),
-                "get prior commits");
+            auto run = [&]() -> std::vector<w_string> {
+              if (native_) {
+                try {
+                  return native_->getCommitsPriorToAndIncluding(
+                      commit, numCommits);
+                } catch (const std::exception& exc) {
+                  log(DBG, "running git log: ", exc.what(), "\n");
+                }
+              }
+
+              auto result = runGit(
+                  {gitExecutablePath(),
+                   "log",
+                   "-n",
+                   to<std::string>(numCommits),
+                   "--format=%H",
+                   commit},
+                  makeGitOptions(requestId),
+                  "get prior commits");
+
+              std::vector<w_string> lines;
+              w_string_piece(result.output).split(lines, '\n');
+              return lines;
+            };
+            if (!resultStore_ || !SCMResultStore::isCommitHash(commit)) {
+              return folly::makeFuture(run());
+            }
 
+            // The history of a commit hash never changes.
+            auto stored = resultStore_->getOrCompute(
+                w_string::build("git:prior:", commit, ":", numCommits), [&] {
+                  std::string joined;
+                  for (auto& line : run()) {
+                    joined.append(line.data(), line.size());
+                    joined.push_back('\n');
+                  }
+                  return w_string{joined};
+                });
             std::vector<w_string> lines;
-            w_string_piece(result.output).split(lines, '\n');
+            stored.piece().split(lines, '\n');
             return folly::makeFuture(lines);
           })
       .get()
       ->value();
 }
 
+std::vector<w_string> Git::getParentStateFiles() const {
+  // HEAD names the branch that is checked out, and the index is rewritten
+  // when a commit moves that branch.
+  return {".git/HEAD", ".git/index"};
+}
+
 } // namespace watchman
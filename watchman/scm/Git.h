@@ -12,14 +12,24 @@
 #include <vector>
 #include "watchman/ChildProcess.h"
 #include "watchman/LRUCache.h"
+#include "watchman/scm/GitRepository.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
 
+class SCMResultStore;
+
 class GitStatusAccumulator {
  public:
+  // Adds the NUL separated fields of `git diff --name-status -z`.
   void add(w_string_piece status);
 
+  // Adds a single field of git diff output.
+  void addLine(w_string_piece line);
+
+  // Adds the changes accumulated by other.
+  void merge(const GitStatusAccumulator& other);
+
   SCM::StatusResult finalize() const;
 
  private:
@@ -53,14 +63,23 @@ class Git : public SCM {
       w_string_piece commitId,
       int numCommits,
       w_string requestId = nullptr) const override;
+  std::vector<w_string> getParentStateFiles() const override;
 
  private:
   std::string indexPath_;
   mutable LRUCache<std::string, std::vector<w_string>> commitsPrior_;
   mutable LRUCache<std::string, w_string> mergeBases_;
-  mutable LRUCache<std::string, w_string> filesChangedBetweenCommits_;
+  mutable LRUCache<std::string, GitStatusAccumulator>
+      filesChangedBetweenCommits_;
   mutable LRUCache<std::string, std::vector<w_string>>
       filesChangedSinceMergeBaseWith_;
+  // Answers mergeBaseWith, getFilesChangedSinceMergeBaseWith and
+  // getCommitsPriorToAndIncluding without running git, when it can. Null
+  // if watchman was built without libgit2 or scm_git_native is false.
+  std::unique_ptr<GitRepository> native_;
+  // Keeps the results that can't change across restarts. Null if they
+  // aren't kept.
+  std::shared_ptr<SCMResultStore> resultStore_;
 
   ChildProcess::Options makeGitOptions(w_string requestId) const;
   struct timespec getIndexMtime() const;
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/GitRepository.h"
+#include <algorithm>
+#include <cstring>
+#include "watchman/Logging.h"
+#include "watchman/scm/SCM.h"
+#include "watchman/watchman_system.h"
+
+#ifdef HAVE_LIBGIT2
+#include <git2.h>
+#endif
+
+namespace watchman {
+
+#ifdef HAVE_LIBGIT2
+
+namespace {
+
+struct GitFree {
+  void operator()(git_object* obj) const {
+    git_object_free(obj);
+  }
+  void operator()(git_diff* diff) const {
+    git_diff_free(diff);
+  }
+  void operator()(git_revwalk* walk) const {
+    git_revwalk_free(walk);
+  }
+};
+
+template <typename T>
+using GitPtr = std::unique_ptr<T, GitFree>;
+
+void check(int result, std::string_view what) {
+  if (result >= 0) {
+    return;
+  }
+  const git_error* error = git_error_last();
+  SCMError::throwf(
+      "libgit2 failed to {}: {}",
+      what,
+      error && error->message ? error->message : "unknown error");
+}
+
+// Resolves rev, as git rev-parse would, and peels it to an object of the
+// given type.
+GitPtr<git_object>
+resolve(git_repository* repo, w_string_piece rev, git_object_t type) {
+  git_object* obj = nullptr;
+  check(
+      git_revparse_single(&obj, repo, std::string{rev.view()}.c_str()),
+      "resolve a revision");
+  GitPtr<git_object> revision{obj};
+
+  git_object* peeled = nullptr;
+  check(git_object_peel(&peeled, obj, type), "peel a revision");
+  return GitPtr<git_object>{peeled};
+}
+
+w_string oidToString(const git_oid* oid) {
+  return w_string{git_oid_tostr_s(oid)};
+}
+
+} // namespace
+
+std::unique_ptr<GitRepository> GitRepository::open(w_string_piece scmRoot) {
+  static int initialized = git_libgit2_init();
+  if (initialized < 0) {
+    return nullptr;
+  }
+
+  git_repository* repo = nullptr;
+  if (git_repository_open_ext(
+          &repo,
+          std::string{scmRoot.view()}.c_str(),
+          GIT_REPOSITORY_OPEN_NO_SEARCH,
+          nullptr) < 0) {
+    const git_error* error = git_error_last();
+    log(DBG,
+        "unable to open ",
+        scmRoot.view(),
+        " with libgit2, will run git instead: ",
+        error && error->message ? error->message : "unknown error",
+        "\n");
+    return nullptr;
+  }
+  return std::unique_ptr<GitRepository>{new GitRepository{repo}};
+}
+
+GitRepository::GitRepository(git_repository* repo) : repo_{repo} {}
+
+GitRepository::~GitRepository() {
+  git_repository_free(repo_);
+}
+
+w_string GitRepository::mergeBaseWithHead(w_string_piece commitId) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto commit = resolve(repo_, commitId, GIT_OBJECT_COMMIT);
+  auto head = resolve(repo_, "HEAD", GIT_OBJECT_COMMIT);
+
+  git_oid base;
+  check(
+      git_merge_base(
+          &base, repo_, git_object_id(commit.get()), git_object_id(head.get())),
+      "find the merge base");
+  return oidToString(&base);
+}
+
+std::vector<w_string> GitRepository::getFilesChangedSince(
+    w_string_piece commitId) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto tree = resolve(repo_, commitId, GIT_OBJECT_TREE);
+
+  git_diff_options options = GIT_DIFF_OPTIONS_INIT;
+  git_diff* rawDiff = nullptr;
+  check(
+      git_diff_tree_to_workdir_with_index(
+          &rawDiff, repo_, reinterpret_cast<git_tree*>(tree.get()), &options),
+      "diff against the working copy");
+  GitPtr<git_diff> diff{rawDiff};
+
+  std::vector<w_string> files;
+  auto numDeltas = git_diff_num_deltas(diff.get());
+  files.reserve(numDeltas);
+  for (size_t i = 0; i < numDeltas; ++i) {
+    auto delta = git_diff_get_delta(diff.get(), i);
+    files.emplace_back(delta->new_file.path);
+    if (strcmp(delta->old_file.path, delta->new_file.path) != 0) {
+      files.emplace_back(delta->old_file.path);
+    }
+  }
+  return files;
+}
+
+std::vector<w_string> GitRepository::getCommitsPriorToAndIncluding(
+    w_string_piece commitId,
+    int numCommits) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto commit = resolve(repo_, commitId, GIT_OBJECT_COMMIT);
+
+  git_revwalk* rawWalk = nullptr;
+  check(git_revwalk_new(&rawWalk, repo_), "walk the history");
+  GitPtr<git_revwalk> walk{rawWalk};
+  // git log shows the most recent commits first.
+  git_revwalk_sorting(walk.get(), GIT_SORT_TIME);
+  check(
+      git_revwalk_push(walk.get(), git_object_id(commit.get())),
+      "walk the history");
+
+  std::vector<w_string> commits;
+  git_oid oid;
+  while (commits.size() < size_t(std::max(numCommits, 0))) {
+    auto result = git_revwalk_next(&oid, walk.get());
+    if (result == GIT_ITEROVER) {
+      break;
+    }
+    check(result, "walk the history");
+    commits.push_back(oidToString(&oid));
+  }
+  return commits;
+}
+
+#else
+
+std::unique_ptr<GitRepository> GitRepository::open(w_string_piece) {
+  return nullptr;
+}
+
+GitRepository::GitRepository(git_repository* repo) : repo_{repo} {}
+
+GitRepository::~GitRepository() = default;
+
+w_string GitRepository::mergeBaseWithHead(w_string_piece) {
+  SCMError::throwf("watchman was built without libgit2");
+}
+
+std::vector<w_string> GitRepository::getFilesChangedSince(w_string_piece) {
+  SCMError::throwf("watchman was built without libgit2");
+}
+
+std::vector<w_string> GitRepository::getCommitsPriorToAndIncluding(
+    w_string_piece,
+    int) {
+  SCMError::throwf("watchman was built without libgit2");
+}
+
+#endif
+
+} // namespace watchman
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+struct git_repository;
+
+namespace watchman {
+
+/**
+ * Reads a git repository in process with libgit2, to answer the questions
+ * that Git would otherwise spawn a git process for.
+ *
+ * Every method throws SCMError if libgit2 cannot answer, for instance
+ * because a revision uses syntax that it doesn't understand, so that the
+ * caller can fall back to running git. libgit2 repositories must not be
+ * used from several threads at once, so every call holds a lock.
+ */
+class GitRepository {
+ public:
+  /**
+   * Opens the repository whose working copy is at scmRoot. Returns nullptr
+   * if watchman was built without libgit2 or the repository can't be
+   * opened.
+   */
+  static std::unique_ptr<GitRepository> open(w_string_piece scmRoot);
+
+  ~GitRepository();
+
+  GitRepository(const GitRepository&) = delete;
+  GitRepository& operator=(const GitRepository&) = delete;
+
+  /**
+   * `git merge-base commitId HEAD`
+   */
+  w_string mergeBaseWithHead(w_string_piece commitId);
+
+  /**
+   * `git diff --name-only commitId`, without rename detection, so both the
+   * old and the new name of a renamed file are listed.
+   */
+  std::vector<w_string> getFilesChangedSince(w_string_piece commitId);
+
+  /**
+   * `git log -n numCommits --format=%H commitId`
+   */
+  std::vector<w_string> getCommitsPriorToAndIncluding(
+      w_string_piece commitId,
+      int numCommits);
+
+ private:
+  explicit GitRepository(git_repository* repo);
+
+  std::mutex mutex_;
+  git_repository* repo_;
+};
+
+} // namespace watchman
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/HgCommandServer.h"
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <folly/lang/Bits.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include "watchman/Logging.h"
+#include "watchman/fs/Pipe.h"
+
+namespace watchman {
+
+namespace {
+
+// Bounds each read and write, whose size is passed as an int.
+constexpr size_t kMaxIO = 1024 * 1024;
+
+ChildProcess::Options withPipes(ChildProcess::Options options) {
+  options.pipeStdin();
+  options.pipeStdout();
+  return options;
+}
+
+} // namespace
+
+HgCommandServer::HgCommandServer(
+    std::string_view hgPath,
+    ChildProcess::Options options)
+    : proc_{
+          std::vector<std::string_view>{
+              hgPath, "serve", "--cmdserver", "pipe"},
+          withPipes(std::move(options))} {
+  try {
+    in_ = proc_.takePipe(STDIN_FILENO);
+    out_ = proc_.takePipe(STDOUT_FILENO);
+
+    // The server starts by describing itself on the output channel.
+    auto [channel, length] = readHeader();
+    std::string hello(length, '\0');
+    readExactly(hello.data(), hello.size());
+    if (channel != 'o') {
+      throw std::runtime_error(fmt::format(
+          "expected the hg command server to say hello, got channel {}",
+          channel));
+    }
+
+    std::vector<folly::StringPiece> lines;
+    folly::split('\n', hello, lines);
+    for (auto line : lines) {
+      if (line.startsWith("capabilities:")) {
+        std::vector<folly::StringPiece> capabilities;
+        folly::split(' ', line, capabilities);
+        if (std::find(
+                capabilities.begin(), capabilities.end(), "runcommand") !=
+            capabilities.end()) {
+          return;
+        }
+      }
+    }
+    throw std::runtime_error(
+        "the hg command server does not support runcommand");
+  } catch (const std::exception&) {
+    broken_ = true;
+    proc_.kill();
+    in_.reset();
+    out_.reset();
+    proc_.wait();
+    throw;
+  }
+}
+
+HgCommandServer::~HgCommandServer() {
+  if (broken_) {
+    proc_.kill();
+  }
+  // The server exits once its stdin is closed.
+  in_.reset();
+  out_.reset();
+  try {
+    proc_.wait();
+  } catch (const std::exception& exc) {
+    log(ERR, "waiting for the hg command server: ", exc.what(), "\n");
+  }
+}
+
+void HgCommandServer::readExactly(void* buf, size_t size) {
+  auto dest = static_cast<char*>(buf);
+  while (size > 0) {
+    auto result = out_->read.read(dest, int(std::min(size, kMaxIO)));
+    if (result.hasError()) {
+      throw std::system_error(
+          result.error(), "reading from the hg command server");
+    }
+    if (result.value() == 0) {
+      throw std::runtime_error("the hg command server went away");
+    }
+    dest += result.value();
+    size -= result.value();
+  }
+}
+
+void HgCommandServer::writeExactly(const void* buf, size_t size) {
+  auto src = static_cast<const char*>(buf);
+  while (size > 0) {
+    auto result = in_->write.write(src, int(std::min(size, kMaxIO)));
+    if (result.hasError()) {
+      throw std::system_error(
+          result.error(), "writing to the hg command server");
+    }
+    src += result.value();
+    size -= result.value();
+  }
+}
+
+std::pair<char, uint32_t> HgCommandServer::readHeader() {
+  char channel;
+  uint32_t length;
+  readExactly(&channel, sizeof(channel));
+  readExactly(&length, sizeof(length));
+  return {channel, folly::Endian::big(length)};
+}
+
+HgCommandServer::Result HgCommandServer::runCommand(
+    const std::vector<std::string_view>& args) {
+  if (broken_) {
+    throw std::runtime_error("the hg command server is not usable");
+  }
+
+  try {
+    std::string request{"runcommand\n"};
+    auto joined = folly::join('\0', args);
+    auto length = folly::Endian::big(uint32_t(joined.size()));
+    request.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    request.append(joined);
+    writeExactly(request.data(), request.size());
+
+    std::string output;
+    std::string error;
+    while (true) {
+      auto [channel, length] = readHeader();
+      switch (channel) {
+        case 'o':
+        case 'e': {
+          auto& dest = channel == 'o' ? output : error;
+          auto pos = dest.size();
+          dest.resize(pos + length);
+          readExactly(dest.data() + pos, length);
+          break;
+        }
+        case 'r': {
+          int32_t code;
+          if (length != sizeof(code)) {
+            throw std::runtime_error(
+                "malformed result from the hg command server");
+          }
+          readExactly(&code, sizeof(code));
+          return Result{
+              folly::Endian::big(code), w_string{output}, w_string{error}};
+        }
+        case 'I':
+        case 'L': {
+          // The command wants input, which it gets none of. An empty reply
+          // means end of file.
+          uint32_t none = 0;
+          writeExactly(&none, sizeof(none));
+          break;
+        }
+        default: {
+          if (channel >= 'A' && channel <= 'Z') {
+            // The protocol requires that unknown required channels be
+            // treated as errors.
+            throw std::runtime_error(fmt::format(
+                "unexpected channel {} from the hg command server", channel));
+          }
+          // Anything else, such as debug output, is skipped.
+          std::string ignored(length, '\0');
+          readExactly(ignored.data(), ignored.size());
+        }
+      }
+    }
+  } catch (const std::exception&) {
+    broken_ = true;
+    throw;
+  }
+}
+
+HgCommandServerPool::HgCommandServerPool(size_t maxIdle, Start start)
+    : maxIdle_{maxIdle}, start_{std::move(start)} {}
+
+HgCommandServer::Result HgCommandServerPool::run(
+    const std::vector<std::string_view>& args) {
+  std::unique_ptr<HgCommandServer> server;
+  {
+    auto idle = idle_.wlock();
+    if (!idle->empty()) {
+      server = std::move(idle->back());
+      idle->pop_back();
+    }
+  }
+
+  HgCommandServer::Result result;
+  if (server) {
+    try {
+      result = server->runCommand(args);
+    } catch (const std::exception& exc) {
+      // It may have been killed while it was idle; start another.
+      log(DBG, "restarting the hg command server: ", exc.what(), "\n");
+      server.reset();
+    }
+  }
+  if (!server) {
+    server = start_();
+    result = server->runCommand(args);
+  }
+
+  auto idle = idle_.wlock();
+  if (idle->size() < maxIdle_) {
+    idle->push_back(std::move(server));
+  }
+  return result;
+}
+
+} // namespace watchman
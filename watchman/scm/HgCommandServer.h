@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "watchman/ChildProcess.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class Pipe;
+
+/**
+ * A running `hg serve --cmdserver pipe`, which runs hg commands without
+ * paying for Python to start up each time. See
+ * https://www.mercurial-scm.org/wiki/CommandServer for the protocol.
+ *
+ * A server runs one command at a time. The environment that the commands
+ * see is the one that the server was started with.
+ */
+class HgCommandServer {
+ public:
+  struct Result {
+    int exitCode;
+    w_string output;
+    w_string error;
+  };
+
+  /**
+   * Starts the server and reads its hello message. options must not set
+   * up stdin or stdout, which are used to talk to the server. Throws if the
+   * server can't be started or doesn't support runcommand.
+   */
+  HgCommandServer(std::string_view hgPath, ChildProcess::Options options);
+  ~HgCommandServer();
+
+  HgCommandServer(const HgCommandServer&) = delete;
+  HgCommandServer& operator=(const HgCommandServer&) = delete;
+
+  /**
+   * Runs the hg command whose arguments, not including hg itself, are args
+   * and returns its result. A command that fails is not an error; losing
+   * the connection to the server is, and throws, after which the server
+   * must not be used again.
+   */
+  Result runCommand(const std::vector<std::string_view>& args);
+
+ private:
+  // Reads a channel header, returning the channel and its length.
+  std::pair<char, uint32_t> readHeader();
+  void readExactly(void* buf, size_t size);
+  void writeExactly(const void* buf, size_t size);
+
+  ChildProcess proc_;
+  std::unique_ptr<Pipe> in_;
+  std::unique_ptr<Pipe> out_;
+  bool broken_{false};
+};
+
+/**
+ * Hands out command servers, so that concurrent commands each get one, and
+ * keeps up to maxIdle of them running between commands.
+ */
+class HgCommandServerPool {
+ public:
+  using Start = std::function<std::unique_ptr<HgCommandServer>()>;
+
+  HgCommandServerPool(size_t maxIdle, Start start);
+
+  /**
+   * Runs args in an idle server, or in one that is started for it. A server
+   * that has gone away since its last command is replaced. Throws if a new
+   * server can't run the command either.
+   */
+  HgCommandServer::Result run(const std::vector<std::string_view>& args);
+
+ private:
+  const size_t maxIdle_;
+  const Start start_;
+  folly::Synchronized<std::vector<std::unique_ptr<HgCommandServer>>> idle_;
+};
+
+} // namespace watchman
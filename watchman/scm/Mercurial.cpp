@@ -7,13 +7,22 @@
 
 #include "Mercurial.h"
 #include <folly/String.h>
+#include <folly/portability/Fcntl.h>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
+#include <exception>
+#include <mutex>
+#include <optional>
 #include "watchman/ChildProcess.h"
 #include "watchman/CommandRegistry.h"
+#include "watchman/LineSplitter.h"
 #include "watchman/Logging.h"
+#include "watchman/ThreadPool.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/scm/SCMResultStore.h"
 #include "watchman/sockname.h"
 
 // Capability indicating support for the mercurial SCM
@@ -45,56 +54,127 @@ struct MercurialResult {
   w_string output;
 };
 
+[[noreturn]] void throwMercurialFailure(
+    const std::vector<std::string_view>& cmdline,
+    std::string_view description,
+    w_string_piece stdoutData,
+    w_string_piece stderrData) {
+  auto output = std::string{stdoutData.view()};
+  auto error = std::string{stderrData.view()};
+  replaceEmbeddedNulls(output);
+  replaceEmbeddedNulls(error);
+  SCMError::throwf(
+      "failed to {}\ncmd = {}\nstdout = {}\nstderr = {}",
+      description,
+      folly::join(" ", cmdline),
+      output,
+      error);
+}
+
+// Runs cmdline in one of servers, if it is set and one can be used.
+std::optional<HgCommandServer::Result> runInCommandServer(
+    HgCommandServerPool* servers,
+    const std::vector<std::string_view>& cmdline,
+    std::string_view description) {
+  if (!servers) {
+    return std::nullopt;
+  }
+  std::optional<HgCommandServer::Result> result;
+  try {
+    result = servers->run({cmdline.begin() + 1, cmdline.end()});
+  } catch (const std::exception& exc) {
+    log(ERR,
+        "unable to use the hg command server, running hg instead: ",
+        exc.what(),
+        "\n");
+  }
+  if (result && result->exitCode) {
+    throwMercurialFailure(cmdline, description, result->output, result->error);
+  }
+  return result;
+}
+
+// Runs cmdline in one of servers if it is set, or else in a new hg process.
 MercurialResult runMercurial(
+    HgCommandServerPool* servers,
     std::vector<std::string_view> cmdline,
     ChildProcess::Options options,
     std::string_view description) {
+  if (auto result = runInCommandServer(servers, cmdline, description)) {
+    return MercurialResult{std::move(result->output)};
+  }
+
   ChildProcess proc{cmdline, std::move(options)};
   auto outputs = proc.communicate();
   auto status = proc.wait();
   if (status) {
-    auto output = std::string{outputs.first.view()};
-    auto error = std::string{outputs.second.view()};
-    replaceEmbeddedNulls(output);
-    replaceEmbeddedNulls(error);
-    SCMError::throwf(
-        "failed to {}\ncmd = {}\nstdout = {}\nstderr = {}",
-        description,
-        folly::join(" ", cmdline),
-        output,
-        error);
+    throwMercurialFailure(cmdline, description, outputs.first, outputs.second);
   }
 
   return MercurialResult{std::move(outputs.first)};
 }
 
+// Like runMercurial, but rather than collecting the output, splits it into
+// the lines that end with separator and passes each to onLine as hg writes
+// them. The lines are only valid for the duration of the call.
+template <typename OnLine>
+void streamMercurial(
+    HgCommandServerPool* servers,
+    std::vector<std::string_view> cmdline,
+    ChildProcess::Options options,
+    std::string_view description,
+    char separator,
+    OnLine&& onLine) {
+  LineSplitter lines{separator, [&](w_string_piece line) { onLine(line); }};
+  if (auto result = runInCommandServer(servers, cmdline, description)) {
+    lines.feed(result->output);
+    lines.finish();
+    return;
+  }
+
+  ChildProcess proc{cmdline, std::move(options)};
+  auto error =
+      proc.streamStdout([&](w_string_piece chunk) { lines.feed(chunk); });
+  auto status = proc.wait();
+  if (status) {
+    // What hg wrote to stdout has already been consumed
+    throwMercurialFailure(cmdline, description, w_string_piece{}, error);
+  }
+  lines.finish();
+}
+
 } // namespace
 
 namespace watchman {
 
 void StatusAccumulator::add(w_string_piece status) {
-  std::vector<w_string_piece> lines;
-  status.split(lines, '\0');
+  LineSplitter lines{'\0', [this](w_string_piece line) { addLine(line); }};
+  lines.feed(status);
+  lines.finish();
+}
 
-  log(DBG, "processing ", lines.size(), " status lines\n");
+void StatusAccumulator::addLine(w_string_piece line) {
+  if (line.size() < 3) {
+    return;
+  }
 
-  for (auto& line : lines) {
-    if (line.size() < 3) {
-      continue;
-    }
+  w_string name{line.data() + 2, line.size() - 2};
+  switch (line.data()[0]) {
+    case 'A':
+      // Should remove + add be considered new? Treat it as changed for now.
+      byFile_[name] += 1;
+      break;
+    case 'R':
+      byFile_[name] += -1;
+      break;
+    default:
+      byFile_[name]; // just insert an entry
+  }
+}
 
-    w_string name{line.data() + 2, line.size() - 2};
-    switch (line.data()[0]) {
-      case 'A':
-        // Should remove + add be considered new? Treat it as changed for now.
-        byFile_[name] += 1;
-        break;
-      case 'R':
-        byFile_[name] += -1;
-        break;
-      default:
-        byFile_[name]; // just insert an entry
-    }
+void StatusAccumulator::merge(const StatusAccumulator& other) {
+  for (auto& [name, count] : other.byFile_) {
+    byFile_[name] += count;
   }
 }
 
@@ -112,7 +192,9 @@ SCM::StatusResult StatusAccumulator::finalize() const {
   return combined;
 }
 
-ChildProcess::Options Mercurial::makeHgOptions(w_string requestId) const {
+ChildProcess::Options Mercurial::makeHgOptions(
+    w_string requestId,
+    bool commandServer) const {
   ChildProcess::Options opt;
   // Ensure that the hgrc doesn't mess with the behavior
   // of the commands that we're runing.
@@ -153,9 +235,19 @@ ChildProcess::Options Mercurial::makeHgOptions(w_string requestId) const {
   // rather than whatever is hardcoded in its config.
   opt.environment().set("WATCHMAN_SOCK", get_sock_name_legacy());
 
-  opt.nullStdin();
-  opt.pipeStdout();
-  opt.pipeStderr();
+  if (commandServer) {
+    // The server is talked to over stdin and stdout, and sends the output
+    // of the commands that it runs over stdout as well.
+#ifdef _WIN32
+    opt.open(STDERR_FILENO, "NUL", O_WRONLY, 0);
+#else
+    opt.open(STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+#endif
+  } else {
+    opt.nullStdin();
+    opt.pipeStdout();
+    opt.pipeStderr();
+  }
   opt.chdir(getRootPath());
 
   return opt;
@@ -175,7 +267,17 @@ Mercurial::Mercurial(w_string_piece rootPath, w_string_piece scmRoot)
           Configuration(),
           "scm_hg_files_since_mergebase",
           32,
-          10) {}
+          10),
+      resultStore_(SCMResultStore::get(getSCMRoot())) {
+  auto servers = cfg_get_int("scm_hg_command_servers", 0);
+  if (servers > 0) {
+    hgServers_ =
+        std::make_unique<HgCommandServerPool>(size_t(servers), [this] {
+          return std::make_unique<HgCommandServer>(
+              hgExecutablePath(), makeHgOptions(nullptr, true));
+        });
+  }
+}
 
 struct timespec Mercurial::getDirStateMtime() const {
   try {
@@ -206,6 +308,7 @@ w_string Mercurial::mergeBaseWith(w_string_piece commitId, w_string requestId)
           [this, commit, requestId](const std::string&) {
             auto revset = to<std::string>("ancestor(.,", commit, ")");
             auto result = runMercurial(
+                hgServers_.get(),
                 {hgExecutablePath(), "log", "-T", "{node}", "-r", revset},
                 makeHgOptions(requestId),
                 "query for the merge base");
@@ -245,7 +348,9 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
           key,
           [this, commit = std::move(commitCopy), requestId](
               const std::string&) {
-            auto result = runMercurial(
+            std::vector<w_string> lines;
+            streamMercurial(
+                hgServers_.get(),
                 {hgExecutablePath(),
                  "--traceback",
                  "status",
@@ -256,76 +361,124 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
                  // relative to the cwd (set to root path above).
                  ""},
                 makeHgOptions(requestId),
-                "query for files changed since merge base");
-
-            std::vector<w_string> lines;
-            result.output.piece().split(lines, '\n');
+                "query for files changed since merge base",
+                '\n',
+                [&](w_string_piece line) {
+                  lines.emplace_back(line.data(), line.size());
+                });
             return folly::makeFuture(lines);
           })
       .get()
       ->value();
 }
 
-SCM::StatusResult Mercurial::getFilesChangedBetweenCommits(
-    std::vector<std::string> commits,
-    w_string requestId,
-    bool includeDirectories) const {
-  StatusAccumulator result;
-  for (size_t i = 0; i + 1 < commits.size(); ++i) {
-    auto mtime = getDirStateMtime();
-    auto& commitA = commits[i];
-    auto& commitB = commits[i + 1];
-    if (commitA == commitB) {
-      // Older versions of EdenFS could report "commit transitions" from A to A,
-      // in which case we shouldn't ask Mercurial for the difference.
-      continue;
+StatusAccumulator Mercurial::getStatusBetween(
+    const std::string& commitA,
+    const std::string& commitB,
+    const w_string& requestId,
+    bool includeDirectories,
+    std::shared_mutex* hgLock) const {
+  // Runs attempt, which runs hg, under hgLock if it is set.
+  auto underHgLock = [&](auto&& attempt) {
+    if (!hgLock) {
+      return attempt();
+    }
+    try {
+      std::shared_lock<std::shared_mutex> lock{*hgLock};
+      return attempt();
+    } catch (const SCMError& exc) {
+      // hg may have failed to get one of its locks while another of the
+      // concurrent calls held it, so try again once they have finished.
+      log(DBG, "retrying on its own: ", exc.what(), "\n");
+      std::unique_lock<std::shared_mutex> lock{*hgLock};
+      return attempt();
+    }
+  };
+
+  // Runs cmdline, whose output is made of lines that end with separator,
+  // and accumulates them. The output is parsed as hg writes it, unless it
+  // is to be kept in resultStore_, which needs all of it.
+  auto status = [&](std::string_view kind,
+                    std::vector<std::string_view> cmdline,
+                    std::string_view description,
+                    char separator) {
+    // What changed between two commit hashes never changes, so it is kept
+    // across restarts as well. hg prints the paths relative to the root.
+    if (resultStore_ && SCMResultStore::isCommitHash(commitA) &&
+        SCMResultStore::isCommitHash(commitB)) {
+      StatusAccumulator stored;
+      stored.add(resultStore_->getOrCompute(
+          w_string::build(
+              "hg:", kind, ":", getRootPath(), ":", commitA, ":", commitB),
+          [&] {
+            auto output = underHgLock([&] {
+              return runMercurial(
+                         hgServers_.get(),
+                         cmdline,
+                         makeHgOptions(requestId),
+                         description)
+                  .output;
+            });
+            if (separator == '\0') {
+              return output;
+            }
+            auto lines = std::string{output.view()};
+            replaceEmbeddedNewLines(lines);
+            return w_string{lines};
+          }));
+      return stored;
     }
-    auto key = folly::to<std::string>(
-        commitA, ":", commitB, ":", mtime.tv_sec, ":", mtime.tv_nsec);
-    auto dirkey = folly::to<std::string>(
-        "dirs:", commitA, ":", commitB, ":", mtime.tv_sec, ":", mtime.tv_nsec);
-
-    // This loop runs `hg status` commands sequentially. There's an opportunity
-    // to run them concurrently, but:
-    // 1. In practice since each transition in `commits` corresponds to an
-    //    `hg update` call, the list is almost always short.
-    // 2. For debugging Watchman performance issues, it's nice to have the
-    //    subprocess call on the same stack.
-    // 3. If `hg status` acquires a lock on the backing storage, there may not
-    //    be much actual concurrency.
-    // 4. This codepath is most frequently executed under very fast checkout
-    //    operations between close commits, where the cost isn't that high.
-
-    result.add(
-        filesChangedBetweenCommits_
-            .get(
-                key,
-                [&](const std::string&) {
-                  auto hgresult = runMercurial(
-                      {hgExecutablePath(),
-                       "--traceback",
-                       "status",
-                       "--print0",
-                       "--rev",
-                       commitA,
-                       "--rev",
-                       commitB,
-                       // The "" argument at the end causes paths to be printed
-                       // out relative to the cwd (set to root path above).
-                       ""},
-                      makeHgOptions(requestId),
-                      "get files changed between commits");
-
-                  return folly::makeFuture(hgresult.output);
-                })
-            .get()
-            ->value());
-    if (includeDirectories) {
-      result.add(filesChangedBetweenCommits_
+
+    return underHgLock([&] {
+      StatusAccumulator streamed;
+      streamMercurial(
+          hgServers_.get(),
+          cmdline,
+          makeHgOptions(requestId),
+          description,
+          separator,
+          [&](w_string_piece line) { streamed.addLine(line); });
+      return streamed;
+    });
+  };
+
+  auto mtime = getDirStateMtime();
+  auto key = folly::to<std::string>(
+      commitA, ":", commitB, ":", mtime.tv_sec, ":", mtime.tv_nsec);
+  auto dirkey = folly::to<std::string>(
+      "dirs:", commitA, ":", commitB, ":", mtime.tv_sec, ":", mtime.tv_nsec);
+
+  StatusAccumulator result;
+  result.merge(filesChangedBetweenCommits_
+                   .get(
+                       key,
+                       [&](const std::string&) {
+                         return folly::makeFuture(status(
+                             "status",
+                             {hgExecutablePath(),
+                              "--traceback",
+                              "status",
+                              "--print0",
+                              "--rev",
+                              commitA,
+                              "--rev",
+                              commitB,
+                              // The "" argument at the end causes paths to be
+                              // printed out relative to the cwd (set to root
+                              // path above).
+                              ""},
+                             "get files changed between commits",
+                             '\0'));
+                       })
+                   .get()
+                   ->value());
+  if (includeDirectories) {
+    result.merge(filesChangedBetweenCommits_
                      .get(
                          dirkey,
                          [&](const std::string&) {
-                           auto hgresult = runMercurial(
+                           return folly::makeFuture(status(
+                               "dirs",
                                {hgExecutablePath(),
                                 "--traceback",
                                 "debugdiffdirs",
@@ -333,20 +486,138 @@ SCM::StatusResult Mercurial::getFilesChangedBetweenCommits(
                                 commitA,
                                 "--rev",
                                 commitB,
-                                // The "" argument at the end causes paths to be
-                                // printed out relative to the cwd (set to root
-                                // path above).
+                                // The "" argument at the end causes paths to
+                                // be printed out relative to the cwd (set to
+                                // root path above).
                                 ""},
-                               makeHgOptions(requestId),
-                               "get dirs changed between commits");
-                           auto output = std::string{hgresult.output.view()};
-                           replaceEmbeddedNewLines(output);
-                           return folly::makeFuture(w_string{output});
+                               "get dirs changed between commits",
+                               '\n'));
                          })
                      .get()
                      ->value());
+  }
+  return result;
+}
+
+SCM::StatusResult Mercurial::getFilesChangedBetweenCommits(
+    std::vector<std::string> commits,
+    w_string requestId,
+    bool includeDirectories) const {
+  std::vector<std::pair<std::string, std::string>> transitions;
+  for (size_t i = 0; i + 1 < commits.size(); ++i) {
+    if (commits[i] == commits[i + 1]) {
+      // Older versions of EdenFS could report "commit transitions" from A to A,
+      // in which case we shouldn't ask Mercurial for the difference.
+      continue;
+    }
+    transitions.emplace_back(commits[i], commits[i + 1]);
+  }
+
+  // Each transition in `commits` usually corresponds to an `hg update` call,
+  // so the list is almost always short, and a single `hg status` is run here,
+  // on the same stack, which is nicer when debugging. Saved state queries can
+  // span many commits, though, so longer lists are spread over the thread
+  // pool, scm_hg_status_concurrency at a time.
+  auto concurrency = size_t(
+      std::max(json_int_t(1), cfg_get_int("scm_hg_status_concurrency", 4)));
+  StatusAccumulator result;
+  if (concurrency == 1 || transitions.size() <= 1) {
+    for (auto& [commitA, commitB] : transitions) {
+      result.merge(getStatusBetween(
+          commitA, commitB, requestId, includeDirectories, nullptr));
+    }
+    return result.finalize();
+  }
+
+  // State shared between this thread and the pool tasks.  Tasks that don't
+  // start running until after we've finished must not touch anything other
+  // than this state, so it is reference counted.
+  struct State {
+    std::vector<std::pair<std::string, std::string>> transitions;
+    std::atomic<size_t> nextTransition{0};
+    std::vector<StatusAccumulator> results;
+    std::shared_mutex hgLock;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool finished{false};
+    size_t active{0};
+    std::exception_ptr error;
+  };
+  auto state = std::make_shared<State>();
+  state->transitions = std::move(transitions);
+  state->results.resize(state->transitions.size());
+
+  auto status = [this, requestId, includeDirectories](State& state) {
+    while (true) {
+      auto idx = state.nextTransition.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= state.transitions.size()) {
+        return;
+      }
+      auto& [commitA, commitB] = state.transitions[idx];
+      state.results[idx] = getStatusBetween(
+          commitA, commitB, requestId, includeDirectories, &state.hgLock);
+    }
+  };
+
+  auto numWorkers = std::min(concurrency - 1, state->transitions.size() - 1);
+  for (size_t i = 0; i < numWorkers; ++i) {
+    try {
+      getThreadPool().add([state, status] {
+        {
+          std::lock_guard<std::mutex> lock{state->mutex};
+          if (state->finished) {
+            return;
+          }
+          ++state->active;
+        }
+        try {
+          status(*state);
+        } catch (...) {
+          state->nextTransition.store(state->transitions.size());
+          std::lock_guard<std::mutex> lock{state->mutex};
+          if (!state->error) {
+            state->error = std::current_exception();
+          }
+        }
+        {
+          std::lock_guard<std::mutex> lock{state->mutex};
+          --state->active;
+        }
+        state->cond.notify_all();
+      });
+    } catch (const std::exception& exc) {
+      // The pool is full or stopping; we'll just do more of the work here.
+      log(DBG, "getFilesChangedBetweenCommits: ", exc.what(), "\n");
+      break;
+    }
+  }
+
+  std::exception_ptr error;
+  try {
+    status(*state);
+  } catch (...) {
+    // Stop handing out work and propagate the error once the tasks that
+    // are running have finished.
+    state->nextTransition.store(state->transitions.size());
+    error = std::current_exception();
+  }
+
+  {
+    std::unique_lock<std::mutex> lock{state->mutex};
+    state->finished = true;
+    state->cond.wait(lock, [&] { return state->active == 0; });
+    if (!error) {
+      error = state->error;
     }
   }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  for (auto& transition : state->results) {
+    result.merge(transition);
+  }
   return result.finalize();
 }
 
@@ -354,6 +625,7 @@ time_point<system_clock> Mercurial::getCommitDate(
     w_string_piece commitId,
     w_string requestId) const {
   auto result = runMercurial(
+      hgServers_.get(),
       {hgExecutablePath(),
        "--traceback",
        "log",
@@ -389,29 +661,43 @@ std::vector<w_string> Mercurial::getCommitsPriorToAndIncluding(
           key,
           [this, commit = std::move(commitCopy), numCommits, requestId](
               const std::string&) {
-            auto revset = to<std::string>(
-                "reverse(last(_firstancestors(",
-                commit,
-                "), ",
-                numCommits,
-                "))\n");
-            auto result = runMercurial(
-                {hgExecutablePath(),
-                 "--traceback",
-                 "log",
-                 "-r",
-                 revset,
-                 "-T",
-                 "{node}\n"},
-                makeHgOptions(requestId),
-                "get prior commits");
+            auto run = [&] {
+              auto revset = to<std::string>(
+                  "reverse(last(_firstancestors(",
+                  commit,
+                  "), ",
+                  numCommits,
+                  "))\n");
+              return runMercurial(
+                         hgServers_.get(),
+                         {hgExecutablePath(),
+                          "--traceback",
+                          "log",
+                          "-r",
+                          revset,
+                          "-T",
+                          "{node}\n"},
+                         makeHgOptions(requestId),
+                         "get prior commits")
+                  .output;
+            };
+            // The history of a commit hash never changes.
+            auto output = resultStore_ && SCMResultStore::isCommitHash(commit)
+                ? resultStore_->getOrCompute(
+                      w_string::build("hg:prior:", commit, ":", numCommits),
+                      run)
+                : run();
 
             std::vector<w_string> lines;
-            w_string_piece(result.output).split(lines, '\n');
+            w_string_piece(output).split(lines, '\n');
             return folly::makeFuture(lines);
           })
       .get()
       ->value();
 }
 
+std::vector<w_string> Mercurial::getParentStateFiles() const {
+  return {".hg/dirstate"};
+}
+
 } // namespace watchman
@@ -9,19 +9,30 @@
 #include "watchman/watchman_system.h"
 
 #include <folly/Synchronized.h>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 #include "watchman/ChildProcess.h"
 #include "watchman/LRUCache.h"
 #include "watchman/fs/FileInformation.h"
+#include "watchman/scm/HgCommandServer.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
 
+class SCMResultStore;
+
 class StatusAccumulator {
  public:
+  // Adds the NUL separated lines of `hg status --print0`.
   void add(w_string_piece status);
 
+  // Adds a single line of hg status output.
+  void addLine(w_string_piece line);
+
+  // Adds the changes accumulated by other.
+  void merge(const StatusAccumulator& other);
+
   SCM::StatusResult finalize() const;
 
  private:
@@ -54,17 +65,36 @@ class Mercurial : public SCM {
       w_string_piece commitId,
       int numCommits,
       w_string requestId = nullptr) const override;
+  std::vector<w_string> getParentStateFiles() const override;
 
  private:
   std::string dirStatePath_;
   mutable LRUCache<std::string, std::vector<w_string>> commitsPrior_;
   mutable LRUCache<std::string, w_string> mergeBases_;
-  mutable LRUCache<std::string, w_string> filesChangedBetweenCommits_;
+  mutable LRUCache<std::string, StatusAccumulator> filesChangedBetweenCommits_;
   mutable LRUCache<std::string, std::vector<w_string>>
       filesChangedSinceMergeBaseWith_;
+  // Keeps the results that can't change across restarts. Null if they
+  // aren't kept.
+  std::shared_ptr<SCMResultStore> resultStore_;
+  // Runs hg commands without starting a process for each. Null unless
+  // scm_hg_command_servers is set.
+  std::unique_ptr<HgCommandServerPool> hgServers_;
 
-  // Returns options for invoking hg
-  ChildProcess::Options makeHgOptions(w_string requestId) const;
+  // Returns options for invoking hg, or for starting an hg command server.
+  ChildProcess::Options makeHgOptions(
+      w_string requestId,
+      bool commandServer = false) const;
+  // Returns the files changed between commitA and commitB. If hgLock is
+  // set, other calls are running concurrently, and hg runs under a shared
+  // lock on it. An hg command that fails is then run again under an
+  // exclusive lock, in case it failed because of the others.
+  StatusAccumulator getStatusBetween(
+      const std::string& commitA,
+      const std::string& commitB,
+      const w_string& requestId,
+      bool includeDirectories,
+      std::shared_mutex* hgLock) const;
   struct timespec getDirStateMtime() const;
 };
 
@@ -111,6 +111,11 @@ class SCM {
       int numCommits,
       w_string requestId = nullptr) const = 0;
 
+  // Returns the files, relative to the SCM root, that are written whenever
+  // the working copy's parent commit may have changed, and so whenever the
+  // merge base with a commit may have.
+  virtual std::vector<w_string> getParentStateFiles() const = 0;
+
  private:
   w_string rootPath_;
   w_string scmRoot_;
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/SCMResultStore.h"
+#include <fmt/core.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <folly/portability/Fcntl.h>
+#include <folly/portability/Unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include "watchman/Logging.h"
+#include "watchman/Options.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/watchman_stream.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[4] = {'W', 'M', 'S', 'C'};
+constexpr uint32_t kVersion = 1;
+
+constexpr char kResultRecord = 'R';
+constexpr char kEndRecord = 'E';
+
+// Bounds each write, whose size is passed as an int.
+constexpr size_t kMaxWrite = 1024 * 1024;
+
+// Like the content hash store, this is only ever read back on the machine
+// that wrote it, so values are stored in native byte order.
+template <typename T>
+void put(std::string& buf, T value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putString(std::string& buf, w_string_piece str) {
+  put<uint32_t>(buf, static_cast<uint32_t>(str.size()));
+  buf.append(str.data(), str.size());
+}
+
+class Cursor {
+ public:
+  explicit Cursor(const std::string& data) : data_(data) {}
+
+  void read(void* buf, size_t size) {
+    if (data_.size() - pos_ < size) {
+      throw std::runtime_error("malformed scm result store: truncated");
+    }
+    memcpy(buf, data_.data() + pos_, size);
+    pos_ += size;
+  }
+
+  template <typename T>
+  T read() {
+    T value;
+    read(&value, sizeof(value));
+    return value;
+  }
+
+  w_string readString() {
+    auto size = read<uint32_t>();
+    if (data_.size() - pos_ < size) {
+      throw std::runtime_error("malformed scm result store: truncated");
+    }
+    w_string str{data_.data() + pos_, size};
+    pos_ += size;
+    return str;
+  }
+
+ private:
+  const std::string& data_;
+  size_t pos_{0};
+};
+
+} // namespace
+
+std::shared_ptr<SCMResultStore> SCMResultStore::get(const w_string& scmRoot) {
+  if (flags.dont_save_state || flags.watchman_state_file.empty()) {
+    return nullptr;
+  }
+  auto maxItems = cfg_get_int("scm_persist_max_entries", 1024);
+  if (maxItems <= 0) {
+    return nullptr;
+  }
+
+  static folly::Synchronized<
+      std::unordered_map<w_string, std::weak_ptr<SCMResultStore>>>
+      stores;
+  auto locked = stores.wlock();
+  auto& weak = (*locked)[scmRoot];
+  auto store = weak.lock();
+  if (!store) {
+    store = std::make_shared<SCMResultStore>(
+        w_string::build(
+            flags.watchman_state_file,
+            ".",
+            fmt::format("{:08x}", w_string_piece(scmRoot).stableHashValue()),
+            ".scm"),
+        scmRoot,
+        size_t(maxItems),
+        true);
+    weak = store;
+  }
+  return store;
+}
+
+SCMResultStore::SCMResultStore(
+    w_string path,
+    w_string scmRoot,
+    size_t maxItems,
+    bool saveInBackground)
+    : path_(std::move(path)),
+      scmRoot_(std::move(scmRoot)),
+      maxItems_(maxItems),
+      saveInBackground_(saveInBackground) {}
+
+bool SCMResultStore::isCommitHash(std::string_view commit) {
+  // SHA-1 or SHA-256
+  return (commit.size() == 40 || commit.size() == 64) &&
+      std::all_of(commit.begin(), commit.end(), [](char c) {
+           return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+         });
+}
+
+void SCMResultStore::load(State& state) const {
+  state.loaded = true;
+
+  std::string data;
+  if (!folly::readFile(path_.c_str(), data)) {
+    if (errno != ENOENT) {
+      logf(
+          ERR,
+          "unable to load scm results {}: {}\n",
+          path_,
+          folly::errnoStr(errno));
+    }
+    return;
+  }
+
+  try {
+    Cursor cursor{data};
+    char magic[sizeof(kMagic)];
+    cursor.read(magic, sizeof(magic));
+    if (memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+      throw std::runtime_error("malformed scm result store: bad magic");
+    }
+    auto version = cursor.read<uint32_t>();
+    if (version != kVersion) {
+      throw std::runtime_error(
+          fmt::format("unsupported scm result store version {}", version));
+    }
+    auto scmRoot = cursor.readString();
+    if (scmRoot != scmRoot_) {
+      logf(
+          ERR,
+          "ignoring scm results {}: they were written for {}\n",
+          path_,
+          scmRoot);
+      return;
+    }
+
+    while (true) {
+      auto type = cursor.read<char>();
+      if (type == kEndRecord) {
+        break;
+      }
+      if (type != kResultRecord) {
+        throw std::runtime_error(
+            "malformed scm result store: unknown record type");
+      }
+      auto key = cursor.readString();
+      auto value = cursor.readString();
+      // Entries added before the load are newer.
+      state.entries.emplace(std::move(key), Entry{std::move(value), false});
+    }
+  } catch (const std::exception& exc) {
+    logf(ERR, "unable to load scm results {}: {}\n", path_, exc.what());
+    state.entries.clear();
+  }
+}
+
+std::optional<w_string> SCMResultStore::lookup(const w_string& key) {
+  auto state = state_.wlock();
+  if (!state->loaded) {
+    load(*state);
+  }
+
+  auto it = state->entries.find(key);
+  if (it == state->entries.end()) {
+    return std::nullopt;
+  }
+  if (!it->second.used) {
+    it->second.used = true;
+    // So that it is preferred when the store is next written.
+    state->dirty = true;
+  }
+  return it->second.value;
+}
+
+void SCMResultStore::insert(const w_string& key, w_string value) {
+  {
+    auto state = state_.wlock();
+    state->entries.insert_or_assign(key, Entry{std::move(value), true});
+    state->dirty = true;
+    if (!saveInBackground_ || state->saveScheduled) {
+      return;
+    }
+    state->saveScheduled = true;
+  }
+
+  try {
+    getThreadPool().addWithPriority(
+        [self = shared_from_this()] { self->save(); }, ThreadPool::kBackground);
+  } catch (const std::exception& exc) {
+    log(DBG, "not saving scm results now: ", exc.what(), "\n");
+    state_.wlock()->saveScheduled = false;
+  }
+}
+
+void SCMResultStore::save() {
+  std::lock_guard<std::mutex> saving{saveMutex_};
+
+  std::string buffer;
+  {
+    auto state = state_.wlock();
+    state->saveScheduled = false;
+    if (!state->dirty) {
+      return;
+    }
+    if (!state->loaded) {
+      // Keep what an earlier server wrote.
+      load(*state);
+    }
+    state->dirty = false;
+
+    buffer.append(kMagic, sizeof(kMagic));
+    put<uint32_t>(buffer, kVersion);
+    putString(buffer, scmRoot_);
+
+    // Those used since the store was read first, then whatever else fits.
+    size_t count = 0;
+    for (bool used : {true, false}) {
+      for (auto& [key, entry] : state->entries) {
+        if (entry.used != used || count >= maxItems_) {
+          continue;
+        }
+        buffer.push_back(kResultRecord);
+        putString(buffer, key);
+        putString(buffer, entry.value);
+        ++count;
+      }
+    }
+    buffer.push_back(kEndRecord);
+  }
+
+  auto tempPath = w_string::build(path_, ".tmp");
+  try {
+    auto stream = w_stm_open(
+        tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (!stream) {
+      throw std::system_error(
+          errno,
+          std::generic_category(),
+          fmt::format("unable to open {} for write", tempPath));
+    }
+    size_t pos = 0;
+    while (pos < buffer.size()) {
+      int res = stream->write(
+          buffer.data() + pos,
+          static_cast<int>(std::min(buffer.size() - pos, kMaxWrite)));
+      if (res <= 0) {
+        throw std::system_error(
+            errno,
+            std::generic_category(),
+            fmt::format("writing to {}", tempPath));
+      }
+      pos += res;
+    }
+    stream.reset();
+
+    if (rename(tempPath.c_str(), path_.c_str()) != 0) {
+      // Windows will not rename over an existing file.
+      (void)unlink(path_.c_str());
+      if (rename(tempPath.c_str(), path_.c_str()) != 0) {
+        throw std::system_error(
+            errno,
+            std::generic_category(),
+            fmt::format("renaming {} to {}", tempPath, path_));
+      }
+    }
+  } catch (const std::exception& exc) {
+    logf(ERR, "failed to save scm results {}: {}\n", path_, exc.what());
+    (void)unlink(tempPath.c_str());
+    state_.wlock()->dirty = true;
+  }
+}
+
+} // namespace watchman
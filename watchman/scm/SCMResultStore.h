@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Keeps the results of SCM commands that can never change, such as the
+ * files changed between two commits named by their hashes, in a file
+ * alongside the state file, so that the first SCM-aware queries after the
+ * server restarts don't have to run them again. The roots of a repository
+ * share its store.
+ *
+ * The file is read the first time that an entry is looked up. Entries that
+ * were looked up or added are kept in preference to the others, up to
+ * maxItems.
+ */
+class SCMResultStore : public std::enable_shared_from_this<SCMResultStore> {
+ public:
+  /**
+   * Returns the store for the repository at scmRoot, or nullptr if state is
+   * not being saved or scm_persist_max_entries is 0. A store that this
+   * returns is saved in the thread pool whenever entries are added.
+   */
+  static std::shared_ptr<SCMResultStore> get(const w_string& scmRoot);
+
+  SCMResultStore(
+      w_string path,
+      w_string scmRoot,
+      size_t maxItems,
+      bool saveInBackground = false);
+
+  /**
+   * Returns whether commit is a full commit hash, which is what makes a
+   * result that derives from it immutable.
+   */
+  static bool isCommitHash(std::string_view commit);
+
+  std::optional<w_string> lookup(const w_string& key);
+
+  void insert(const w_string& key, w_string value);
+
+  /**
+   * Returns the stored value for key, or else stores and returns the result
+   * of compute().
+   */
+  template <typename Compute>
+  w_string getOrCompute(const w_string& key, Compute&& compute) {
+    if (auto value = lookup(key)) {
+      return std::move(*value);
+    }
+    w_string value = compute();
+    insert(key, value);
+    return value;
+  }
+
+  /**
+   * Writes the store if it has changed since it was read or last written.
+   * Failures are logged.
+   */
+  void save();
+
+ private:
+  struct Entry {
+    w_string value;
+    // Looked up or added since the store was read
+    bool used;
+  };
+  struct State {
+    bool loaded{false};
+    bool dirty{false};
+    bool saveScheduled{false};
+    std::unordered_map<w_string, Entry> entries;
+  };
+
+  void load(State& state) const;
+
+  const w_string path_;
+  const w_string scmRoot_;
+  const size_t maxItems_;
+  const bool saveInBackground_;
+  folly::Synchronized<State> state_;
+  // Serializes writers of the file.
+  std::mutex saveMutex_;
+};
+
+} // namespace watchman
@@ -25,3 +25,22 @@ TEST(Git, add_then_remove_reports_as_change) {
   EXPECT_THAT(result.changedFiles, ElementsAre("bar"));
   EXPECT_THAT(result.removedFiles, ElementsAre("baz"));
 }
+
+TEST(Git, merge_matches_adding_in_sequence) {
+  GitStatusAccumulator first;
+  first.addLine(" A foo");
+  first.addLine(" A bar");
+  first.addLine(" M qux");
+  GitStatusAccumulator second;
+  second.add(" D bar\0 D baz\0"s);
+
+  GitStatusAccumulator merged;
+  merged.merge(second);
+  merged.merge(first);
+
+  auto result = merged.finalize();
+
+  EXPECT_THAT(result.addedFiles, ElementsAre("foo"));
+  EXPECT_THAT(result.changedFiles, UnorderedElementsAre("bar", "qux"));
+  EXPECT_THAT(result.removedFiles, ElementsAre("baz"));
+}
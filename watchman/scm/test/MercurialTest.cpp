@@ -25,3 +25,33 @@ TEST(Mercurial, add_then_remove_reports_as_change) {
   EXPECT_THAT(result.changedFiles, ElementsAre("bar"));
   EXPECT_THAT(result.removedFiles, ElementsAre("baz"));
 }
+
+TEST(Mercurial, merge_matches_adding_in_sequence) {
+  StatusAccumulator first;
+  first.add("A foo\0A bar\0M qux\0"s);
+  StatusAccumulator second;
+  second.add("R bar\0R baz\0"s);
+
+  StatusAccumulator merged;
+  merged.merge(second);
+  merged.merge(first);
+
+  auto result = merged.finalize();
+
+  EXPECT_THAT(result.addedFiles, ElementsAre("foo"));
+  EXPECT_THAT(result.changedFiles, UnorderedElementsAre("bar", "qux"));
+  EXPECT_THAT(result.removedFiles, ElementsAre("baz"));
+}
+
+TEST(Mercurial, lines_match_whole_output) {
+  StatusAccumulator accumulator;
+  accumulator.addLine("A foo");
+  accumulator.addLine("R baz");
+  accumulator.addLine("");
+
+  auto result = accumulator.finalize();
+
+  EXPECT_THAT(result.addedFiles, ElementsAre("foo"));
+  EXPECT_THAT(result.changedFiles, IsEmpty());
+  EXPECT_THAT(result.removedFiles, ElementsAre("baz"));
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/SCMResultStore.h"
+#include <folly/testing/TestUtil.h>
+#include <gtest/gtest.h>
+#include <fstream>
+
+using namespace watchman;
+using namespace std::literals::string_literals;
+
+TEST(SCMResultStore, round_trip) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "scm"});
+
+  {
+    SCMResultStore store{path, "/some/repo", 100};
+    store.insert("status:a:b", w_string{"M foo\0A bar\0"s});
+    store.insert("prior:a:2", "a\nb\n");
+    store.save();
+  }
+
+  SCMResultStore store{path, "/some/repo", 100};
+  EXPECT_EQ(w_string{"M foo\0A bar\0"s}, store.lookup("status:a:b"));
+  EXPECT_EQ(w_string{"a\nb\n"}, store.lookup("prior:a:2"));
+  EXPECT_EQ(std::nullopt, store.lookup("status:b:c"));
+}
+
+TEST(SCMResultStore, get_or_compute_only_computes_once) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "scm"});
+
+  int computed = 0;
+  auto compute = [&] {
+    ++computed;
+    return w_string{"result"};
+  };
+  {
+    SCMResultStore store{path, "/some/repo", 100};
+    EXPECT_EQ(w_string{"result"}, store.getOrCompute("key", compute));
+    EXPECT_EQ(w_string{"result"}, store.getOrCompute("key", compute));
+    store.save();
+  }
+  SCMResultStore store{path, "/some/repo", 100};
+  EXPECT_EQ(w_string{"result"}, store.getOrCompute("key", compute));
+  EXPECT_EQ(1, computed);
+}
+
+TEST(SCMResultStore, ignores_other_repositories) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "scm"});
+
+  {
+    SCMResultStore store{path, "/some/repo", 100};
+    store.insert("key", "value");
+    store.save();
+  }
+
+  SCMResultStore store{path, "/other/repo", 100};
+  EXPECT_EQ(std::nullopt, store.lookup("key"));
+}
+
+TEST(SCMResultStore, keeps_used_entries_first) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "scm"});
+
+  {
+    SCMResultStore store{path, "/some/repo", 2};
+    store.insert("a", "1");
+    store.insert("b", "2");
+    store.save();
+  }
+  {
+    SCMResultStore store{path, "/some/repo", 2};
+    EXPECT_TRUE(store.lookup("a").has_value());
+    store.insert("c", "3");
+    store.save();
+  }
+
+  SCMResultStore store{path, "/some/repo", 2};
+  EXPECT_TRUE(store.lookup("a").has_value());
+  EXPECT_TRUE(store.lookup("c").has_value());
+  EXPECT_FALSE(store.lookup("b").has_value());
+}
+
+TEST(SCMResultStore, malformed_files_are_ignored) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "scm"});
+  std::ofstream{path.c_str()} << "not a store";
+
+  SCMResultStore store{path, "/some/repo", 100};
+  EXPECT_EQ(std::nullopt, store.lookup("key"));
+}
+
+TEST(SCMResultStore, recognizes_commit_hashes) {
+  EXPECT_TRUE(SCMResultStore::isCommitHash(std::string(40, 'a')));
+  EXPECT_TRUE(SCMResultStore::isCommitHash(std::string(64, '0')));
+  EXPECT_FALSE(SCMResultStore::isCommitHash(std::string(40, 'A')));
+  EXPECT_FALSE(SCMResultStore::isCommitHash(std::string(39, 'a')));
+  EXPECT_FALSE(SCMResultStore::isCommitHash("."));
+  EXPECT_FALSE(SCMResultStore::isCommitHash("main"));
+}
@@ -8,6 +8,11 @@
 #include "watchman/state.h"
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "watchman/CrawlScheduler.h"
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
 #include "watchman/Options.h"
@@ -15,6 +20,7 @@
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
 #include "watchman/TriggerCommand.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/resolve.h"
 #include "watchman/root/watchlist.h"
@@ -170,6 +176,23 @@ bool w_root_save_state(json_ref& state) {
       auto triggers = root->triggerListToJson();
       json_object_set_new(obj, "triggers", std::move(triggers));
 
+      // In system time, as the steady clock doesn't survive a reboot.
+      auto lastUsed =
+          root->inner.restored_last_used.load(std::memory_order_acquire);
+      if (lastUsed == std::chrono::system_clock::time_point{}) {
+        lastUsed = std::chrono::system_clock::now() -
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                       std::chrono::steady_clock::now() -
+                       root->inner.last_cmd_timestamp.load(
+                           std::memory_order_acquire));
+      }
+      json_object_set_new(
+          obj,
+          "last_used",
+          json_integer(std::chrono::duration_cast<std::chrono::seconds>(
+                           lastUsed.time_since_epoch())
+                           .count()));
+
       watched_dirs.push_back(std::move(obj));
     }
   }
@@ -191,20 +214,67 @@ bool w_root_load_state(const json_ref& state) {
     return false;
   }
 
-  for (i = 0; i < json_array_size(*watched); i++) {
+  auto maxCrawls = cfg_get_int("startup_crawl_concurrency", 4);
+  getCrawlScheduler().setMaxConcurrent(maxCrawls > 0 ? size_t(maxCrawls) : 0);
+  logf(
+      DBG,
+      "restoring {} roots, crawling up to {} at a time\n",
+      json_array_size(*watched),
+      maxCrawls);
+
+  // Resolving a root examines its filesystem and starts its watcher, which
+  // can be slow, so the roots are resolved concurrently. Not in the thread
+  // pool, as some watchers wait on it while starting.
+  struct Resolved {
+    std::shared_ptr<Root> root;
+    bool created{false};
+  };
+  std::vector<Resolved> results(json_array_size(*watched));
+  std::atomic<size_t> next{0};
+  auto resolve = [&] {
+    for (size_t index; (index = next.fetch_add(1)) < results.size();) {
+      auto path = json_object_get(watched->at(index), "path");
+      if (!path || !path->isString()) {
+        continue;
+      }
+      try {
+        auto& resolved = results[index];
+        resolved.root = root_resolve(
+            json_to_w_string(*path).c_str(), true, &resolved.created);
+      } catch (const std::exception&) {
+        // As ever, a root that can no longer be watched is dropped.
+      }
+    }
+  };
+  std::vector<std::thread> resolvers;
+  for (size_t t = 1; t < std::min<size_t>(results.size(), 8); ++t) {
+    resolvers.emplace_back(resolve);
+  }
+  resolve();
+  for (auto& resolver : resolvers) {
+    resolver.join();
+  }
+
+  for (i = 0; i < results.size(); i++) {
     const auto& obj = watched->at(i);
-    bool created = false;
     size_t j;
 
+    auto root = results[i].root;
+    bool created = results[i].created;
+    if (!root) {
+      continue;
+    }
+
     auto triggers = obj.get("triggers");
-    auto path = json_object_get(obj, "path");
-    const char* filename = path ? json_string_value(*path) : nullptr;
 
-    std::shared_ptr<Root> root;
-    try {
-      root = root_resolve(filename, true, &created);
-    } catch (const std::exception&) {
-      continue;
+    if (created) {
+      std::chrono::system_clock::time_point lastUsed{};
+      if (auto lastUsedSecs = obj.get_optional("last_used")) {
+        lastUsed += std::chrono::seconds(lastUsedSecs->asInt());
+      }
+      root->inner.restored_last_used.store(
+          lastUsed, std::memory_order_release);
+      getCrawlScheduler().addRestored(root->root_path, lastUsed);
     }
 
     {
@@ -118,6 +118,10 @@ class UnixStream : public watchman_stream {
   std::unique_ptr<ucred_t, ucred_deleter> cred;
 #endif
   bool credvalid{false};
+#ifndef _WIN32
+  // The address family of the socket, or AF_UNSPEC if it isn't one.
+  sa_family_t family_{AF_UNSPEC};
+#endif
   bool blocking_{false};
 
   explicit UnixStream(FileDescriptor&& descriptor)
@@ -148,6 +152,19 @@ class UnixStream : public watchman_stream {
     ucred_t* peer_cred{nullptr};
     credvalid = getpeerucred(fd.fd(), &peer_cred) == 0;
     cred.reset(peer_cred);
+#endif
+#ifndef _WIN32
+    struct sockaddr_storage local;
+    socklen_t localLen = sizeof(local);
+    if (fd.fdType() == FileDescriptor::FDType::Socket &&
+        getsockname(fd.fd(), (struct sockaddr*)&local, &localLen) == 0) {
+      family_ = local.ss_family;
+    }
+    // Only the peer of a local socket has credentials; whatever is reported
+    // for a TCP peer says nothing about who is at the other end.
+    if (family_ != AF_UNIX) {
+      credvalid = false;
+    }
 #endif
   }
 
@@ -285,6 +302,14 @@ class UnixStream : public watchman_stream {
 #endif
   }
 
+  bool peerIsRemote() const override {
+#ifdef _WIN32
+    return false;
+#else
+    return family_ == AF_INET || family_ == AF_INET6;
+#endif
+  }
+
   pid_t getPeerProcessID() const override {
     if (!credvalid) {
       return 0;
@@ -13,6 +13,10 @@
 #include "watchman/watchman_hash.h"
 #include "watchman/watchman_string.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // Filename mapping and handling strategy
 // We'll track the utf-8 rendition of the underlying filesystem names
 // in the watchman datastructures.  We'll convert to Wide Char at the
@@ -35,6 +39,64 @@ static void w_string_delref(w_string_t* str);
 static w_string_t*
 w_string_new_len_typed(const char* str, uint32_t len, w_string_type_t type);
 
+namespace {
+
+// Lowers ASCII letters and leaves every other byte alone, which is what
+// tolower() does in the C locale that we run in.
+inline char lowerAscii(char c) {
+  return (c >= 'A' && c <= 'Z') ? char(c | 0x20) : c;
+}
+
+#ifdef __SSE2__
+inline __m128i lowerAscii16(__m128i v) {
+  // Bytes above 0x7f compare as negative, so they are never letters.
+  auto letters = _mm_and_si128(
+      _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+      _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+  return _mm_or_si128(v, _mm_and_si128(letters, _mm_set1_epi8(0x20)));
+}
+#endif
+
+void copyLowerAscii(const char* src, size_t len, char* dest) {
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 16 <= len; i += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), lowerAscii16(v));
+  }
+#endif
+  for (; i < len; ++i) {
+    dest[i] = lowerAscii(src[i]);
+  }
+}
+
+// Returns true if a, lowercased, equals b. b is lowercased first only if
+// lowerB is set.
+bool equalLowerAscii(const char* a, const char* b, size_t len, bool lowerB) {
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 16 <= len; i += 16) {
+    auto va = lowerAscii16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+    auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    if (lowerB) {
+      vb = lowerAscii16(vb);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff) {
+      return false;
+    }
+  }
+#endif
+  for (; i < len; ++i) {
+    if (lowerAscii(a[i]) != (lowerB ? lowerAscii(b[i]) : b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
 // string piece
 
 w_string_piece::w_string_piece() : s_(nullptr), e_(nullptr) {}
@@ -63,17 +125,16 @@ w_string w_string_piece::asLowerCase(w_string_type_t stringType) const {
   buf = const_cast<char*>(s->buf);
   s->type = stringType;
 
-  auto cursor = s_;
-  while (cursor < e_) {
-    *buf = (char)tolower((uint8_t)*cursor);
-    ++cursor;
-    ++buf;
-  }
-  *buf = 0;
+  copyLowerAscii(s_, size(), buf);
+  buf[size()] = 0;
 
   return w_string(s, false);
 }
 
+void w_string_piece::copyLowerCase(char* dest) const {
+  copyLowerAscii(s_, size(), dest);
+}
+
 w_string w_string_piece::asLowerCaseSuffix(w_string_type_t stringType) const {
   char* buf;
   w_string_t* s;
@@ -92,13 +153,8 @@ w_string w_string_piece::asLowerCaseSuffix(w_string_type_t stringType) const {
   buf = const_cast<char*>(s->buf);
   s->type = stringType;
 
-  auto cursor = suffixPiece.s_;
-  while (cursor < suffixPiece.e_) {
-    *buf = (char)tolower((uint8_t)*cursor);
-    ++cursor;
-    ++buf;
-  }
-  *buf = 0;
+  copyLowerAscii(suffixPiece.s_, suffixPiece.size(), buf);
+  buf[suffixPiece.size()] = 0;
 
   return w_string(s, false);
 }
@@ -256,17 +312,7 @@ bool w_string_piece::startsWithCaseInsensitive(w_string_piece prefix) const {
     return false;
   }
 
-  auto me = s_;
-  auto pref = prefix.s_;
-
-  while (pref < prefix.e_) {
-    if (tolower((uint8_t)*me) != tolower((uint8_t)*pref)) {
-      return false;
-    }
-    ++pref;
-    ++me;
-  }
-  return true;
+  return equalLowerAscii(s_, prefix.s_, prefix.size(), true);
 }
 
 // string
@@ -513,13 +559,32 @@ w_string w_string::pathCat(std::initializer_list<w_string_piece> elems) {
   return w_string(s, false);
 }
 
+namespace {
+
+// The hash that keys w_strings and pieces of them in hash tables. Both must
+// agree, so that either can be used to look up the other.
+inline uint32_t hashStringBytes(const char* data, size_t len) {
+#ifdef WATCHMAN_FAST_STRING_HASH
+  auto h = w_wyhash_bytes(data, len, 0);
+  return uint32_t(h ^ (h >> 32));
+#else
+  return w_hash_bytes(data, len, 0);
+#endif
+}
+
+} // namespace
+
 uint32_t w_string_compute_hval(w_string_t* str) {
-  str->_hval = w_hash_bytes(str->buf, str->len, 0);
+  str->_hval = hashStringBytes(str->buf, str->len);
   str->hval_computed = 1;
   return str->_hval;
 }
 
 uint32_t w_string_piece::hashValue() const {
+  return hashStringBytes(data(), size());
+}
+
+uint32_t w_string_piece::stableHashValue() const {
   return w_hash_bytes(data(), size(), 0);
 }
 
@@ -687,21 +752,14 @@ bool w_string_equal(const w_string_t* a, const w_string_t* b) {
 }
 
 bool w_string_equal_caseless(w_string_piece a, w_string_piece b) {
-  uint32_t i;
-
   if (a.size() != b.size()) {
     return false;
   }
-  for (i = 0; i < a.size(); i++) {
-    if (tolower((uint8_t)a[i]) != tolower((uint8_t)b[i])) {
-      return false;
-    }
-  }
-  return true;
+  return equalLowerAscii(a.data(), b.data(), a.size(), true);
 }
 
 bool w_string_piece::hasSuffix(w_string_piece suffix) const {
-  unsigned int base, i;
+  unsigned int base;
 
   if (size() < suffix.size() + 1) {
     return false;
@@ -713,13 +771,7 @@ bool w_string_piece::hasSuffix(w_string_piece suffix) const {
     return false;
   }
 
-  for (i = 0; i < suffix.size(); i++) {
-    if (tolower((uint8_t)s_[base + i]) != suffix[i]) {
-      return false;
-    }
-  }
-
-  return true;
+  return equalLowerAscii(s_ + base, suffix.data(), suffix.size(), false);
 }
 
 bool w_string_startswith(w_string_t* str, w_string_t* prefix) {
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <folly/FileUtil.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "watchman/PDU.h"
+#include "watchman/bser.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_stream.h"
+
+// Compares encoding and decoding BSER with JSON, for the shapes of value
+// that watchman sends and receives.
+//
+// If WATCHMAN_BSER_CORPUS names a directory, each file in it is read as a
+// stream of PDUs, such as the inputs saved by a fuzzer or captured from a
+// client, and decoding it is measured too.
+
+namespace {
+
+using namespace watchman;
+
+// Reads what it was given and collects what is written to it.
+class StringStream : public Stream {
+ public:
+  explicit StringStream(std::string data = {}) : data_{std::move(data)} {}
+
+  int read(void* buf, int size) override {
+    auto n = std::min(size_t(size), data_.size() - pos_);
+    memcpy(buf, data_.data() + pos_, n);
+    pos_ += n;
+    errno = 0;
+    return int(n);
+  }
+  int write(const void* buf, int size) override {
+    data_.append(static_cast<const char*>(buf), size);
+    return size;
+  }
+  Event* getEvents() override {
+    return nullptr;
+  }
+  void setNonBlock(bool) override {}
+  bool rewind() override {
+    pos_ = 0;
+    return true;
+  }
+  bool shutdown() override {
+    return true;
+  }
+  bool peerIsOwner() override {
+    return true;
+  }
+  pid_t getPeerProcessID() const override {
+    return 0;
+  }
+  const FileDescriptor& getFileDescriptor() const override {
+    return fd_;
+  }
+
+  std::string& data() {
+    return data_;
+  }
+
+ private:
+  std::string data_;
+  size_t pos_{0};
+  FileDescriptor fd_;
+};
+
+int dumpToString(const char* buffer, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buffer, size);
+  return 0;
+}
+
+struct Payload {
+  json_ref value;
+  // How many times value is sent in a row
+  size_t pdus;
+};
+
+using PayloadFn = const Payload& (*)();
+
+json_ref fileName(size_t i) {
+  return typed_string_to_json(
+      fmt::format(
+          "fbcode/some/project/directory{}/source_file_{}.cpp", i % 97, i)
+          .c_str(),
+      W_STRING_BYTE);
+}
+
+json_ref withResultFields(json_ref files) {
+  return json_object(
+      {{"version", typed_string_to_json("2024.01.01.00")},
+       {"clock", typed_string_to_json("c:1700000000:1234:1:5678")},
+       {"is_fresh_instance", json_boolean(false)},
+       {"files", std::move(files)}});
+}
+
+// The result of a query for name, exists, new, size and mode over a large
+// tree, as an object for each file.
+const Payload& queryResult() {
+  static const Payload payload = [] {
+    std::vector<json_ref> files;
+    for (size_t i = 0; i < 100000; ++i) {
+      files.push_back(json_object(
+          {{"name", fileName(i)},
+           {"exists", json_boolean(true)},
+           {"new", json_boolean(false)},
+           {"size", json_integer(i * 4096)},
+           {"mode", json_integer(0100644)}}));
+    }
+    return Payload{withResultFields(json_array(std::move(files))), 1};
+  }();
+  return payload;
+}
+
+// As above, but rendered as rows of a template, as BSER v2 clients get it.
+const Payload& templatedResult() {
+  static const Payload payload = [] {
+    std::vector<json_ref> rows;
+    for (size_t i = 0; i < 100000; ++i) {
+      rows.push_back(json_array(
+          {fileName(i),
+           json_boolean(true),
+           json_boolean(false),
+           json_integer(i * 4096),
+           json_integer(0100644)}));
+    }
+    auto files = json_array(std::move(rows));
+    json_array_set_template_new(
+        files,
+        json_array(
+            {typed_string_to_json("name", W_STRING_UNICODE),
+             typed_string_to_json("exists", W_STRING_UNICODE),
+             typed_string_to_json("new", W_STRING_UNICODE),
+             typed_string_to_json("size", W_STRING_UNICODE),
+             typed_string_to_json("mode", W_STRING_UNICODE)}));
+    return Payload{withResultFields(std::move(files)), 1};
+  }();
+  return payload;
+}
+
+// Nested objects, like the expressions of a complicated query or the
+// debug commands' output.
+const Payload& deepObject() {
+  static const Payload payload = [] {
+    auto value = json_object({{"leaf", json_integer(0)}});
+    for (int depth = 1; depth < 200; ++depth) {
+      value = json_object(
+          {{"depth", json_integer(depth)},
+           {"name", typed_string_to_json("allof", W_STRING_UNICODE)},
+           {"siblings",
+            json_array(
+                {json_integer(1),
+                 json_real(2.5),
+                 json_null(),
+                 fileName(depth)})},
+           {"child", std::move(value)}});
+    }
+    return Payload{std::move(value), 100};
+  }();
+  return payload;
+}
+
+// Subscription notifications about a single file each.
+const Payload& smallPdus() {
+  static const Payload payload{
+      json_object(
+          {{"unilateral", json_boolean(true)},
+           {"subscription", typed_string_to_json("sub1", W_STRING_UNICODE)},
+           {"root", typed_string_to_json("/home/user/repo", W_STRING_BYTE)},
+           {"clock", typed_string_to_json("c:1700000000:1234:1:5678")},
+           {"files", json_array({fileName(1)})}}),
+      10000};
+  return payload;
+}
+
+std::string encodeBserPdus(const Payload& payload, uint32_t capabilities) {
+  std::string encoded;
+  for (size_t i = 0; i < payload.pdus; ++i) {
+    w_bser_write_pdu(2, capabilities, dumpToString, payload.value, &encoded);
+  }
+  return encoded;
+}
+
+std::string encodeJsonPdus(const Payload& payload) {
+  std::string encoded;
+  for (size_t i = 0; i < payload.pdus; ++i) {
+    encoded.append(json_dumps(payload.value, JSON_COMPACT));
+    encoded.push_back('\n');
+  }
+  return encoded;
+}
+
+void bser_write_pdu(benchmark::State& state, PayloadFn get) {
+  auto& payload = get();
+  size_t bytes = 0;
+  for (auto _ : state) {
+    std::string encoded;
+    for (size_t i = 0; i < payload.pdus; ++i) {
+      w_bser_write_pdu(2, 0, dumpToString, payload.value, &encoded);
+    }
+    bytes = encoded.size();
+    benchmark::DoNotOptimize(encoded);
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+  state.SetItemsProcessed(state.iterations() * payload.pdus);
+}
+
+// What a client's thread does to send a response, through its buffer.
+void encode_to_stream(
+    benchmark::State& state,
+    PayloadFn get,
+    PduFormat format) {
+  auto& payload = get();
+  PduBuffer buffer;
+  StringStream stream;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    stream.data().clear();
+    for (size_t i = 0; i < payload.pdus; ++i) {
+      buffer.pduEncodeToStream(format, payload.value, &stream, false);
+    }
+    buffer.flushToStream(&stream);
+    bytes = stream.data().size();
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+  state.SetItemsProcessed(state.iterations() * payload.pdus);
+}
+
+void bser_encode(benchmark::State& state, PayloadFn get) {
+  encode_to_stream(state, get, PduFormat{is_bser_v2, 0});
+}
+
+void bser_zstd_encode(benchmark::State& state, PayloadFn get) {
+  encode_to_stream(state, get, PduFormat{is_bser_v2, BSER_CAP_ACCEPT_ZSTD});
+}
+
+void json_encode(benchmark::State& state, PayloadFn get) {
+  encode_to_stream(state, get, PduFormat{is_json_compact, 0});
+}
+
+// Decodes the value of a single PDU, without its header.
+void bunser_value(benchmark::State& state, PayloadFn get) {
+  auto& payload = get();
+  std::string encoded;
+  bser_ctx_t ctx{2, 0, dumpToString};
+  w_bser_dump(&ctx, payload.value, &encoded);
+  for (auto _ : state) {
+    json_int_t needed;
+    json_error_t jerr;
+    benchmark::DoNotOptimize(bunser(
+        encoded.data(), encoded.data() + encoded.size(), &needed, &jerr));
+  }
+  state.SetBytesProcessed(state.iterations() * encoded.size());
+}
+
+void json_loads_value(benchmark::State& state, PayloadFn get) {
+  auto encoded = json_dumps(get().value, JSON_COMPACT);
+  for (auto _ : state) {
+    json_error_t jerr;
+    benchmark::DoNotOptimize(json_loads(encoded.c_str(), 0, &jerr));
+  }
+  state.SetBytesProcessed(state.iterations() * encoded.size());
+}
+
+// What a client's thread does to read requests from its stream, including
+// detecting the format of each PDU.
+void decode_stream(benchmark::State& state, const std::string& encoded) {
+  StringStream stream{encoded};
+  size_t pdus = 0;
+  for (auto _ : state) {
+    stream.rewind();
+    PduBuffer buffer;
+    pdus = 0;
+    json_error_t jerr;
+    while (buffer.decodeNext(&stream, &jerr)) {
+      ++pdus;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * encoded.size());
+  state.SetItemsProcessed(state.iterations() * pdus);
+}
+
+void bser_decode(benchmark::State& state, PayloadFn get) {
+  decode_stream(state, encodeBserPdus(get(), 0));
+}
+
+void bser_zstd_decode(benchmark::State& state, PayloadFn get) {
+  decode_stream(state, encodeBserPdus(get(), BSER_CAP_ACCEPT_ZSTD));
+}
+
+void json_decode(benchmark::State& state, PayloadFn get) {
+  decode_stream(state, encodeJsonPdus(get()));
+}
+
+#define PAYLOAD_BENCHMARKS(name)                                        \
+  BENCHMARK_CAPTURE(name, query_result, &queryResult)                   \
+      ->Unit(benchmark::kMillisecond);                                  \
+  BENCHMARK_CAPTURE(name, templated_result, &templatedResult)           \
+      ->Unit(benchmark::kMillisecond);                                  \
+  BENCHMARK_CAPTURE(name, deep_object, &deepObject)                     \
+      ->Unit(benchmark::kMillisecond);                                  \
+  BENCHMARK_CAPTURE(name, small_pdus, &smallPdus)                       \
+      ->Unit(benchmark::kMillisecond)
+
+PAYLOAD_BENCHMARKS(bser_write_pdu);
+PAYLOAD_BENCHMARKS(bser_encode);
+PAYLOAD_BENCHMARKS(json_encode);
+PAYLOAD_BENCHMARKS(bunser_value);
+PAYLOAD_BENCHMARKS(json_loads_value);
+PAYLOAD_BENCHMARKS(bser_decode);
+PAYLOAD_BENCHMARKS(json_decode);
+BENCHMARK_CAPTURE(bser_zstd_encode, query_result, &queryResult)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(bser_zstd_decode, query_result, &queryResult)
+    ->Unit(benchmark::kMillisecond);
+
+void registerCorpus(const char* dir) {
+  for (auto& entry : std::filesystem::directory_iterator{dir}) {
+    std::string encoded;
+    if (!entry.is_regular_file() ||
+        !folly::readFile(entry.path().c_str(), encoded)) {
+      continue;
+    }
+    benchmark::RegisterBenchmark(
+        fmt::format("corpus_decode/{}", entry.path().filename().string())
+            .c_str(),
+        [encoded](benchmark::State& state) { decode_stream(state, encoded); });
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (auto* corpus = getenv("WATCHMAN_BSER_CORPUS")) {
+    registerCorpus(corpus);
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
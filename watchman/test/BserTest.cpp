@@ -6,6 +6,7 @@
  */
 
 #include "watchman/bser.h"
+#include <fmt/core.h>
 #include <folly/ScopeGuard.h>
 #include <folly/logging/xlog.h>
 #include <folly/portability/GTest.h>
@@ -295,5 +296,111 @@ TEST(Bser, bser_tests) {
   check_bser_typed_strings();
 }
 
+TEST(Bser, template_rows_in_template_order) {
+  json_error_t jerr;
+  const char* objects_text =
+      "[{\"age\": 20, \"name\": \"fred\"}, {\"age\": 30, \"name\": \"pete\"}]";
+  const char* rows_text = "[[\"fred\", 20], [\"pete\", 30]]";
+  auto objects = json_loads(objects_text, 0, &jerr).value();
+  auto rows = json_loads(rows_text, 0, &jerr).value();
+  for (auto* arr : {&objects, &rows}) {
+    json_array_set_template_new(
+        *arr, json_loads("[\"name\", \"age\"]", 0, &jerr).value());
+  }
+
+  // A row of values encodes the same as the object it stands for
+  for (uint32_t version : {1, 2}) {
+    EXPECT_EQ(*bdumps(version, 0, objects), *bdumps(version, 0, rows));
+  }
+  EXPECT_EQ(
+      json_dumps(objects, JSON_SORT_KEYS), json_dumps(rows, JSON_SORT_KEYS));
+  EXPECT_EQ(
+      "[{\"name\":\"fred\",\"age\":20},{\"name\":\"pete\",\"age\":30}]",
+      json_dumps(rows, JSON_COMPACT));
+}
+
+TEST(Bser, decodes_long_object_keys) {
+  std::string key(300, 'k');
+  auto obj = json_object({{key.c_str(), json_integer(1)}});
+  auto encoded = bdumps(2, 0, obj);
+
+  json_int_t needed;
+  json_error_t jerr;
+  auto decoded = bunser(
+      encoded->data(), encoded->data() + encoded->size(), &needed, &jerr);
+  ASSERT_TRUE(decoded);
+  EXPECT_EQ(json_int_t(encoded->size()), needed);
+  EXPECT_EQ(1, decoded->get(key.c_str()).asInt());
+}
+
+TEST(Bser, rejects_template_with_non_string_keys) {
+  // A template with the keys [1] and one row of [2]
+  auto encoded = S("\x0b\x00\x03\x01\x03\x01\x03\x01\x03\x02");
+
+  json_int_t needed;
+  json_error_t jerr;
+  auto decoded = bunser(
+      encoded.data(), encoded.data() + encoded.size(), &needed, &jerr);
+  EXPECT_FALSE(decoded);
+  EXPECT_STREQ("template keys must be strings", jerr.text);
+}
+
+TEST(Bser, pdu_length_header) {
+  // Lengths that need each of the int8, int16 and int32 encodings
+  for (size_t len : {10, 200, 40000, 70000}) {
+    auto json = json_array(
+        {typed_string_to_json(std::string(len, 'x').c_str(), W_STRING_BYTE)});
+    auto value = bdumps(2, 0, json);
+    auto pdu = bdumps_pdu(2, 0, json);
+
+    EXPECT_EQ(S("\x00\x02\x00\x00\x00\x00"), pdu->substr(0, 6));
+    json_int_t needed;
+    json_int_t length;
+    ASSERT_TRUE(
+        bunser_int(pdu->data() + 6, pdu->size() - 6, &needed, &length));
+    EXPECT_EQ(json_int_t(value->size()), length);
+    EXPECT_EQ(*value, pdu->substr(6 + needed));
+  }
+}
+
+TEST(Bser, compressed_pdu_round_trip) {
+  std::vector<json_ref> names;
+  for (int i = 0; i < 10000; ++i) {
+    names.push_back(typed_string_to_json(
+        fmt::format("some/dir/file{}.txt", i).c_str(), W_STRING_BYTE));
+  }
+  auto json = json_array(std::move(names));
+  auto value = bdumps(2, 0, json);
+  ASSERT_GE(value->size(), size_t(BSER_COMPRESS_MIN_SIZE));
+
+  // Only replies to peers that accept compression are compressed
+  EXPECT_EQ(
+      *value, bdumps_pdu(2, 0, json)->substr(6 + 5 /* int32 length */));
+
+  auto pdu = bdumps_pdu(2, BSER_CAP_ACCEPT_ZSTD | BSER_CAP_ZSTD, json);
+  uint32_t capabilities;
+  memcpy(&capabilities, pdu->data() + 2, sizeof(capabilities));
+  EXPECT_EQ(BSER_CAP_ACCEPT_ZSTD | BSER_CAP_ZSTD, capabilities);
+
+  json_int_t needed;
+  json_int_t length;
+  ASSERT_TRUE(bunser_int(pdu->data() + 6, pdu->size() - 6, &needed, &length));
+  auto start = pdu->data() + 6 + needed;
+  ASSERT_EQ(pdu->data() + pdu->size(), start + length);
+  EXPECT_LT(length, json_int_t(value->size()));
+
+  std::string uncompressed;
+  json_error_t jerr;
+  ASSERT_TRUE(bunser_uncompress(start, start + length, uncompressed, &jerr))
+      << jerr.text;
+  EXPECT_EQ(*value, uncompressed);
+
+  // Small values are not worth compressing
+  auto small = json_array({json_integer(1)});
+  auto smallPdu = bdumps_pdu(2, BSER_CAP_ACCEPT_ZSTD | BSER_CAP_ZSTD, small);
+  memcpy(&capabilities, smallPdu->data() + 2, sizeof(capabilities));
+  EXPECT_EQ(BSER_CAP_ACCEPT_ZSTD, capabilities);
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -151,6 +151,147 @@ TEST(CacheTest, future) {
       << "cache should still be full (no excess) but has " << cache.size();
 }
 
+TEST(CacheTest, weighted) {
+  using Cache = LRUCache<std::string, std::string>;
+  Cache cache(
+      100, kErrorTTL, 10, [](const std::string&, const std::string& value) {
+        return value.size();
+      });
+
+  cache.set("a", "1234");
+  cache.set("b", "1234");
+  EXPECT_EQ(cache.stats().bytes, 8);
+  EXPECT_TRUE(cache.get("a")) << "touch a so that b is evicted first";
+
+  cache.set("c", "123");
+  EXPECT_EQ(cache.size(), 2) << "b was evicted to stay within 10 bytes";
+  EXPECT_EQ(cache.get("b"), nullptr);
+  EXPECT_EQ(cache.stats().bytes, 7);
+
+  cache.set("a", "1");
+  EXPECT_EQ(cache.stats().bytes, 4) << "replacing an item replaces its weight";
+  EXPECT_NE(cache.erase("c"), nullptr);
+  EXPECT_EQ(cache.stats().bytes, 1);
+
+  auto big = cache.set("big", "12345678901");
+  EXPECT_EQ(big->value(), "12345678901");
+  EXPECT_EQ(cache.get("big"), nullptr) << "too heavy to be retained";
+  EXPECT_TRUE(cache.get("a")) << "and nothing was evicted for it";
+
+  cache.clear();
+  EXPECT_EQ(cache.stats().bytes, 0);
+}
+
+TEST(CacheTest, admission) {
+  using Cache = LRUCache<int, int>;
+  constexpr int kHot = 100;
+  constexpr int kScan = 300;
+
+  // Returns how many of the frequently used items survive a scan
+  auto hotAfterScan = [&](CacheAdmission admission) {
+    Cache cache(kHot, kErrorTTL, 0, nullptr, admission);
+    for (int i = 0; i < kHot; ++i) {
+      cache.set(i, int(i));
+    }
+    for (int round = 0; round < 5; ++round) {
+      for (int i = 0; i < kHot; ++i) {
+        cache.get(i);
+      }
+    }
+    for (int i = 0; i < kScan; ++i) {
+      cache.set(1000 + i, int(i));
+    }
+    EXPECT_EQ(cache.size(), kHot);
+    EXPECT_TRUE(cache.get(1000 + kScan - 1))
+        << "the most recent item is kept in the window";
+
+    int hot = 0;
+    for (int i = 0; i < kHot; ++i) {
+      if (cache.get(i)) {
+        ++hot;
+      }
+    }
+    return hot;
+  };
+
+  EXPECT_EQ(hotAfterScan(CacheAdmission::All), 0);
+  // The sketch is approximate, so the odd hot item may lose out
+  EXPECT_GE(hotAfterScan(CacheAdmission::TinyLFU), kHot - 5);
+}
+
+TEST(CacheTest, sharded) {
+  using Cache = ShardedLRUCache<int, int>;
+  Cache cache(1024, kErrorTTL, 4);
+  folly::ManualExecutor exec;
+  EXPECT_EQ(cache.numShards(), 4);
+
+  auto now = std::chrono::steady_clock::now();
+  for (int i = 0; i < 2048; ++i) {
+    EXPECT_EQ(cache.set(i, i * 2, now)->value(), i * 2);
+  }
+  EXPECT_EQ(cache.size(), 1024) << "each shard is limited to its share";
+  EXPECT_EQ(cache.get(2047, now)->value(), 4094);
+  EXPECT_NE(cache.erase(2047), nullptr);
+  EXPECT_EQ(cache.get(2047, now), nullptr);
+
+  // The getter and negative caching work as they do for a single shard
+  auto failures = 0;
+  auto failGetter = [&](int k) {
+    ++failures;
+    return folly::makeFuture(k).via(&exec).thenTry(
+        [](folly::Try<int>&&) -> int { throw std::runtime_error("bleet"); });
+  };
+  auto f = cache.get(5000, failGetter, now);
+  auto f2 = cache.get(5000, failGetter, now);
+  exec.drain();
+  EXPECT_TRUE(f.value()->result().hasException());
+  EXPECT_EQ(f.value(), f2.value()) << "the second get shared the first";
+
+  auto f3 = cache.get(5000, failGetter, now + kErrorTTL / 2);
+  exec.drain();
+  EXPECT_EQ(failures, 1) << "the error is cached until its TTL expires";
+  EXPECT_TRUE(f3.value()->result().hasException());
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.size, cache.size());
+  EXPECT_EQ(stats.cacheStore, 2048 + 1);
+
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.stats().clearCount, 1);
+
+  EXPECT_EQ(Cache(10, kErrorTTL).numShards(), 1)
+      << "small caches are not split";
+}
+
+TEST(CacheTest, expired) {
+  using Cache = LRUCache<int, int>;
+  Cache cache(5, kErrorTTL);
+  folly::ManualExecutor exec;
+
+  auto failGetter = [&exec](int k) {
+    return folly::makeFuture(k).via(&exec).thenTry(
+        [](folly::Try<int>&&) -> int { throw std::runtime_error("bleet"); });
+  };
+
+  auto now = std::chrono::steady_clock::now();
+  EXPECT_TRUE(cache.set(0, 0, now)) << "inserted";
+  auto f1 = cache.get(1, failGetter, now);
+  exec.drain();
+  auto f2 = cache.get(2, failGetter, now + kErrorTTL / 2);
+  exec.drain();
+  EXPECT_EQ(cache.size(), 3);
+
+  EXPECT_EQ(cache.eraseExpired(now + kErrorTTL / 2), 0)
+      << "neither error has outlived its TTL";
+  EXPECT_EQ(cache.eraseExpired(now + kErrorTTL), 1)
+      << "only the first error has";
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.eraseExpired(now + kErrorTTL * 2), 1);
+  EXPECT_EQ(cache.size(), 1) << "successful results are kept";
+  EXPECT_TRUE(cache.get(0, now + kErrorTTL * 2));
+}
+
 int main(int argc, char* argv[]) {
   testing::InitGoogleTest(&argc, argv);
   folly::init(&argc, &argv);
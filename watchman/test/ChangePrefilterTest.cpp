@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/ChangePrefilter.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+TEST(ChangePrefilter, matches_within_dirs) {
+  ChangePrefilter prefilter{{"/root/foo", "/root/bar/baz"}, {}};
+
+  EXPECT_TRUE(prefilter.matches("/root/foo", "a.txt"));
+  EXPECT_TRUE(prefilter.matches("/root/foo/deep/er", "a.txt"));
+  EXPECT_TRUE(prefilter.matches("/root/bar/baz", "a.txt"));
+  // Erring on the side of a match
+  EXPECT_TRUE(prefilter.matches("/root/FOO", "a.txt"));
+
+  EXPECT_FALSE(prefilter.matches("/root", "a.txt"));
+  EXPECT_FALSE(prefilter.matches("/root", "foo"));
+  EXPECT_FALSE(prefilter.matches("/root/foobar", "a.txt"));
+  EXPECT_FALSE(prefilter.matches("/root/bar", "a.txt"));
+}
+
+TEST(ChangePrefilter, matches_suffixes) {
+  ChangePrefilter prefilter{{}, {"ts", "js"}};
+
+  EXPECT_TRUE(prefilter.matches("/root", "a.ts"));
+  EXPECT_TRUE(prefilter.matches("/root/deep", "a.b.JS"));
+
+  EXPECT_FALSE(prefilter.matches("/root", "a.tsx"));
+  EXPECT_FALSE(prefilter.matches("/root", "ts"));
+  EXPECT_FALSE(prefilter.matches("/root/a.ts", "b"));
+}
+
+TEST(ChangePrefilter, matches_both) {
+  ChangePrefilter prefilter{{"/root/src"}, {"cpp"}};
+
+  EXPECT_TRUE(prefilter.matches("/root/src", "a.cpp"));
+  EXPECT_FALSE(prefilter.matches("/root/src", "a.h"));
+  EXPECT_FALSE(prefilter.matches("/root/test", "a.cpp"));
+}
+
+TEST(ChangePrefilter, starts_out_matched) {
+  ChangePrefilter prefilter{{"/root/src"}, {}};
+  EXPECT_TRUE(prefilter.matched.load());
+}
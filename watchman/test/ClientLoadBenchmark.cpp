@@ -0,0 +1,519 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+  Measures the latency of a watchman daemon under load from many concurrent
+  clients while its tree changes. It starts a private daemon on a synthetic
+  tree, connects --clients clients through WatchmanClient, and has each run
+  a weighted --mix of commands for --duration_s seconds while another thread
+  modifies, creates and removes files at --mutations_per_s. It reports the
+  p50/p99/p999 latency of each command, and the daemon's CPU time and RSS.
+
+  For example:
+  $ ClientLoadBenchmark --watchman_binary=_build/watchman --clients=64 \
+      --files=500000 --mix=query=70,clock=20,subscribe=10 --json
+*/
+
+#include "watchman/cppclient/WatchmanClient.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <folly/Subprocess.h>
+#include <folly/experimental/TestUtil.h>
+#include <folly/experimental/io/FsUtil.h>
+#include <folly/init/Init.h>
+#include <folly/io/async/EventBaseThread.h>
+#include <folly/json.h>
+#include <folly/portability/Unistd.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+DEFINE_string(watchman_binary, "watchman", "The watchman to measure");
+DEFINE_int32(clients, 16, "The number of concurrent clients");
+DEFINE_int32(duration_s, 30, "How long to apply the load for");
+DEFINE_int32(files, 100000, "The number of files in the synthetic tree");
+DEFINE_string(
+    mix,
+    "query=60,clock=20,subscribe=10,watch-project=10",
+    "The relative weights of the commands the clients run");
+DEFINE_int32(
+    mutations_per_s,
+    200,
+    "How many files are modified, created or removed each second");
+DEFINE_int32(sync_timeout_ms, 1000, "The sync_timeout of queries and clocks");
+DEFINE_bool(json, false, "Print the results as JSON");
+
+using namespace folly;
+using namespace watchman;
+using namespace std::chrono;
+
+namespace {
+
+enum class Op { Query, Subscribe, Clock, WatchProject };
+constexpr size_t kNumOps = 4;
+constexpr const char* kOpNames[kNumOps] = {
+    "query", "subscribe", "clock", "watch-project"};
+
+constexpr size_t kFilesPerDir = 100;
+constexpr size_t kDirsPerTopDir = 100;
+
+// The cumulative weights of --mix, in the order of Op.
+std::vector<uint32_t> parseMix(const std::string& spec) {
+  std::vector<uint32_t> weights(kNumOps, 0);
+  std::vector<std::string> entries;
+  folly::split(',', spec, entries, true);
+  for (auto& entry : entries) {
+    std::string name;
+    uint32_t weight;
+    if (!folly::split('=', entry, name, weight)) {
+      throw std::invalid_argument(fmt::format("bad --mix entry {}", entry));
+    }
+    auto it = std::find(std::begin(kOpNames), std::end(kOpNames), name);
+    if (it == std::end(kOpNames)) {
+      throw std::invalid_argument(fmt::format("unknown command {}", name));
+    }
+    weights[it - std::begin(kOpNames)] = weight;
+  }
+  for (size_t i = 1; i < kNumOps; ++i) {
+    weights[i] += weights[i - 1];
+  }
+  if (weights.back() == 0) {
+    throw std::invalid_argument("--mix has no commands");
+  }
+  return weights;
+}
+
+fs::path filePath(const fs::path& root, size_t index) {
+  auto dir = index / kFilesPerDir;
+  return root / fmt::format("top{}", dir / kDirsPerTopDir) /
+      fmt::format("dir{}", dir) / fmt::format("file{}.txt", index);
+}
+
+void makeTree(const fs::path& root, size_t files) {
+  for (size_t i = 0; i < files; ++i) {
+    auto path = filePath(root, i);
+    if (i % kFilesPerDir == 0) {
+      fs::create_directories(path.parent_path());
+    }
+    if (!folly::writeFile(std::string{}, path.c_str())) {
+      throw std::runtime_error(
+          fmt::format("unable to create {}", path.string()));
+    }
+  }
+  fs::create_directories(root / "churn");
+}
+
+// A daemon of our own, so that the load is all that it sees.
+class Daemon {
+ public:
+  explicit Daemon(const fs::path& stateDir)
+      : sockPath_{(stateDir / "sock").string()} {
+    auto configPath = (stateDir / "config.json").string();
+    if (!folly::writeFile(std::string{"{}"}, configPath.c_str())) {
+      throw std::runtime_error("unable to write the daemon config");
+    }
+
+    std::vector<std::string> env;
+    for (char** var = environ; *var; ++var) {
+      env.emplace_back(*var);
+    }
+    env.push_back("WATCHMAN_CONFIG_FILE=" + configPath);
+
+    proc_ = std::make_unique<Subprocess>(
+        std::vector<std::string>{
+            FLAGS_watchman_binary,
+            "--foreground",
+            "--log-level=0",
+            "--unix-listener-path=" + sockPath_,
+            "--logfile=" + (stateDir / "log").string(),
+            "--statefile=" + (stateDir / "state").string(),
+            "--pidfile=" + (stateDir / "pid").string()},
+        Subprocess::Options().closeOtherFds(),
+        nullptr,
+        &env);
+  }
+
+  ~Daemon() {
+    proc_->terminate();
+    proc_->wait();
+  }
+
+  const std::string& sockPath() const {
+    return sockPath_;
+  }
+
+  pid_t pid() const {
+    return proc_->pid();
+  }
+
+ private:
+  std::string sockPath_;
+  std::unique_ptr<Subprocess> proc_;
+};
+
+struct ProcessStats {
+  double cpuSeconds{0};
+  uint64_t rssBytes{0};
+  uint64_t peakRssBytes{0};
+};
+
+// Only available on Linux, from /proc.
+std::optional<ProcessStats> readProcessStats(pid_t pid) {
+  std::string stat;
+  if (!folly::readFile(fmt::format("/proc/{}/stat", pid).c_str(), stat)) {
+    return std::nullopt;
+  }
+  // The command name may contain spaces, but not a closing parenthesis.
+  std::vector<StringPiece> fields;
+  folly::split(' ', StringPiece{stat}.subpiece(stat.rfind(')') + 2), fields);
+  if (fields.size() < 13) {
+    return std::nullopt;
+  }
+  ProcessStats stats;
+  // utime and stime, the 14th and 15th fields
+  stats.cpuSeconds =
+      double(to<uint64_t>(fields[11]) + to<uint64_t>(fields[12])) /
+      sysconf(_SC_CLK_TCK);
+
+  std::ifstream status{fmt::format("/proc/{}/status", pid)};
+  std::string line;
+  while (std::getline(status, line)) {
+    uint64_t kb;
+    if (sscanf(line.c_str(), "VmRSS: %" SCNu64, &kb) == 1) {
+      stats.rssBytes = kb * 1024;
+    } else if (sscanf(line.c_str(), "VmHWM: %" SCNu64, &kb) == 1) {
+      stats.peakRssBytes = kb * 1024;
+    }
+  }
+  return stats;
+}
+
+struct Results {
+  std::vector<std::vector<double>> latenciesMs =
+      std::vector<std::vector<double>>(kNumOps);
+  std::vector<size_t> errors = std::vector<size_t>(kNumOps, 0);
+
+  void merge(Results&& other) {
+    for (size_t i = 0; i < kNumOps; ++i) {
+      latenciesMs[i].insert(
+          latenciesMs[i].end(),
+          other.latenciesMs[i].begin(),
+          other.latenciesMs[i].end());
+      errors[i] += other.errors[i];
+    }
+  }
+};
+
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+class Worker {
+ public:
+  Worker(EventBase* eb, const std::string& sockPath, const fs::path& root)
+      : eb_{eb},
+        client_{eb, std::optional<std::string>{sockPath}},
+        root_{root.string()},
+        rng_{std::random_device{}()} {}
+
+  Results run(
+      const std::vector<uint32_t>& mix,
+      steady_clock::time_point deadline) {
+    client_.connect().get();
+    watch_ = client_.watch(root_).get();
+    clock_ = client_.getClock(watch_).get();
+
+    Results results;
+    std::uniform_int_distribution<uint32_t> pick{0, mix.back() - 1};
+    while (steady_clock::now() < deadline) {
+      auto choice = pick(rng_);
+      auto op = size_t(std::upper_bound(mix.begin(), mix.end(), choice) -
+                       mix.begin());
+      auto start = steady_clock::now();
+      try {
+        runOp(Op(op));
+      } catch (const std::exception& exc) {
+        LOG(ERROR) << kOpNames[op] << " failed: " << exc.what();
+        ++results.errors[op];
+        continue;
+      }
+      results.latenciesMs[op].push_back(
+          duration<double, std::milli>(steady_clock::now() - start).count());
+    }
+    client_.close();
+    return results;
+  }
+
+ private:
+  void runOp(Op op) {
+    switch (op) {
+      case Op::Query: {
+        // Changes since this client last asked, as a build tool would.
+        auto result =
+            client_
+                .query(
+                    dynamic::object("fields", dynamic::array("name"))(
+                        "since", clock_)("sync_timeout", FLAGS_sync_timeout_ms),
+                    watch_)
+                .get();
+        clock_ = result.raw_["clock"].asString();
+        return;
+      }
+      case Op::Subscribe: {
+        // Until the initial results arrive
+        auto [promise, future] = makePromiseContract<Unit>();
+        auto sub = client_
+                       .subscribe(
+                           dynamic::object("fields", dynamic::array("name"))(
+                               "since", clock_),
+                           watch_,
+                           eb_,
+                           [promise = std::make_shared<Promise<Unit>>(
+                                std::move(promise))](Try<dynamic>&& data) {
+                             if (promise->isFulfilled()) {
+                               return;
+                             }
+                             if (data.hasException()) {
+                               promise->setException(data.exception());
+                             } else if (data->get_ptr("files")) {
+                               promise->setValue();
+                             }
+                           })
+                       .get();
+        std::move(future).get(seconds(30));
+        client_.unsubscribe(sub).get();
+        return;
+      }
+      case Op::Clock:
+        client_
+            .run(dynamic::array(
+                "clock",
+                root_,
+                dynamic::object("sync_timeout", FLAGS_sync_timeout_ms)))
+            .get();
+        return;
+      case Op::WatchProject: {
+        std::uniform_int_distribution<size_t> pickDir{
+            0, (FLAGS_files - 1) / kFilesPerDir};
+        auto dir = filePath(root_, pickDir(rng_) * kFilesPerDir).parent_path();
+        client_.run(dynamic::array("watch-project", dir.string())).get();
+        return;
+      }
+    }
+  }
+
+  EventBase* eb_;
+  WatchmanClient client_;
+  std::string root_;
+  std::mt19937 rng_;
+  WatchPathPtr watch_;
+  Clock clock_;
+};
+
+// Modifies existing files, and creates and removes others, at a steady rate.
+void mutate(const fs::path& root, steady_clock::time_point deadline) {
+  if (FLAGS_mutations_per_s <= 0) {
+    return;
+  }
+  std::mt19937 rng{0};
+  std::uniform_int_distribution<size_t> pickFile{0, size_t(FLAGS_files) - 1};
+  auto interval = duration_cast<steady_clock::duration>(
+      duration<double>(1.0 / FLAGS_mutations_per_s));
+  auto next = steady_clock::now();
+  std::vector<fs::path> created;
+  size_t serial = 0;
+  while (next < deadline) {
+    std::this_thread::sleep_until(next);
+    next += interval;
+
+    // Four modifications to each creation or removal
+    auto action = serial++ % 5;
+    if (action == 0) {
+      created.push_back(root / "churn" / fmt::format("new{}.txt", serial));
+      folly::writeFile(std::string{"new"}, created.back().c_str());
+    } else if (action == 1 && !created.empty()) {
+      fs::remove(created.back());
+      created.pop_back();
+    } else {
+      folly::writeFile(
+          fmt::format("{}", serial), filePath(root, pickFile(rng)).c_str());
+    }
+  }
+}
+
+void report(
+    const Results& results,
+    const std::optional<ProcessStats>& before,
+    const std::optional<ProcessStats>& after,
+    double elapsedS) {
+  auto json = dynamic::object("clients", FLAGS_clients)("files", FLAGS_files)(
+      "duration_s", elapsedS)("mutations_per_s", FLAGS_mutations_per_s);
+  if (!FLAGS_json) {
+    fmt::print(
+        "{} clients, {} files, {:.1f}s, {} mutations/s\n\n",
+        FLAGS_clients,
+        FLAGS_files,
+        elapsedS,
+        FLAGS_mutations_per_s);
+    fmt::print(
+        "{:<14} {:>9} {:>7} {:>10} {:>10} {:>10}\n",
+        "command",
+        "count",
+        "errors",
+        "p50 ms",
+        "p99 ms",
+        "p999 ms");
+  }
+
+  auto commands = dynamic::object();
+  for (size_t i = 0; i < kNumOps; ++i) {
+    auto sorted = results.latenciesMs[i];
+    if (sorted.empty() && results.errors[i] == 0) {
+      continue;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    auto p50 = percentile(sorted, 0.5);
+    auto p99 = percentile(sorted, 0.99);
+    auto p999 = percentile(sorted, 0.999);
+    commands[kOpNames[i]] = dynamic::object("count", sorted.size())(
+        "errors", results.errors[i])("p50_ms", p50)("p99_ms", p99)(
+        "p999_ms", p999);
+    if (!FLAGS_json) {
+      fmt::print(
+          "{:<14} {:>9} {:>7} {:>10.2f} {:>10.2f} {:>10.2f}\n",
+          kOpNames[i],
+          sorted.size(),
+          results.errors[i],
+          p50,
+          p99,
+          p999);
+    }
+  }
+  json["commands"] = std::move(commands);
+
+  if (before && after) {
+    auto cpuS = after->cpuSeconds - before->cpuSeconds;
+    json["daemon"] = dynamic::object("cpu_s", cpuS)(
+        "cpu_percent", 100 * cpuS / elapsedS)("rss_bytes", after->rssBytes)(
+        "peak_rss_bytes", after->peakRssBytes);
+    if (!FLAGS_json) {
+      fmt::print(
+          "\ndaemon: {:.1f}s cpu ({:.0f}%), {} MB rss, {} MB peak\n",
+          cpuS,
+          100 * cpuS / elapsedS,
+          after->rssBytes >> 20,
+          after->peakRssBytes >> 20);
+    }
+  }
+
+  if (FLAGS_json) {
+    std::cout << folly::toPrettyJson(json) << std::endl;
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  auto mix = parseMix(FLAGS_mix);
+
+  folly::test::TemporaryDirectory stateDir{"wmload-state"};
+  folly::test::TemporaryDirectory treeDir{"wmload-tree"};
+  auto root = fs::canonical(treeDir.path());
+  LOG(INFO) << "Creating " << FLAGS_files << " files in " << root;
+  makeTree(root, FLAGS_files);
+
+  Daemon daemon{stateDir.path()};
+  // The clients share a few event bases, as they would in a tool that has
+  // many connections.
+  std::vector<std::unique_ptr<EventBaseThread>> ebts;
+  for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency());
+       ++i) {
+    ebts.push_back(std::make_unique<EventBaseThread>());
+  }
+
+  {
+    WatchmanClient client{
+        ebts[0]->getEventBase(),
+        std::optional<std::string>{daemon.sockPath()}};
+    auto deadline = steady_clock::now() + seconds(60);
+    while (true) {
+      try {
+        client.connect().get();
+        break;
+      } catch (const std::exception& exc) {
+        if (steady_clock::now() > deadline) {
+          LOG(ERROR) << "The daemon did not start: " << exc.what();
+          return 1;
+        }
+        /* sleep override */ std::this_thread::sleep_for(milliseconds(100));
+      }
+    }
+    LOG(INFO) << "Crawling " << root;
+    // Waits for the initial crawl.
+    client.getClock(client.watch(root.string()).get()).get();
+    client.close();
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (int i = 0; i < FLAGS_clients; ++i) {
+    workers.push_back(std::make_unique<Worker>(
+        ebts[i % ebts.size()]->getEventBase(), daemon.sockPath(), root));
+  }
+
+  LOG(INFO) << "Running " << FLAGS_clients << " clients for "
+            << FLAGS_duration_s << "s";
+  auto before = readProcessStats(daemon.pid());
+  auto start = steady_clock::now();
+  auto deadline = start + seconds(FLAGS_duration_s);
+
+  std::vector<Results> workerResults(workers.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    threads.emplace_back([&, i] {
+      try {
+        workerResults[i] = workers[i]->run(mix, deadline);
+      } catch (const std::exception& exc) {
+        LOG(ERROR) << "client " << i << " failed: " << exc.what();
+      }
+    });
+  }
+  std::thread mutator{[&] { mutate(root, deadline); }};
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  mutator.join();
+  auto elapsedS = duration<double>(steady_clock::now() - start).count();
+  auto after = readProcessStats(daemon.pid());
+
+  Results results;
+  for (auto& workerResult : workerResults) {
+    results.merge(std::move(workerResult));
+  }
+  report(results, before, after, elapsedS);
+  return 0;
+}
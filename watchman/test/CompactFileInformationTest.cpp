@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+using namespace watchman;
+
+namespace {
+FileInformation makeFileInfo() {
+  FileInformation info;
+#ifndef _WIN32
+  info.mode = S_IFREG | 0644;
+#else
+  info.mode = _S_IFREG | 0644;
+#endif
+  info.size = 42;
+  info.ino = 7;
+  info.dev = 3;
+  info.uid = 1000;
+  info.gid = 100;
+  info.nlink = 1;
+  info.atime = {1, 0};
+  info.mtime = {2, 0};
+  info.ctime = {3, 0};
+  return info;
+}
+} // namespace
+
+TEST(CompactFileInformationTest, detects_changes_to_dropped_fields) {
+  auto info = makeFileInfo();
+  CompactFileInformation compact{info};
+  EXPECT_FALSE(compact.differsFrom(info));
+
+  auto atime = info;
+  atime.atime = {10, 0};
+  EXPECT_FALSE(compact.differsFrom(atime));
+
+  auto uid = info;
+  uid.uid = 0;
+  EXPECT_TRUE(compact.differsFrom(uid));
+
+  auto nlink = info;
+  nlink.nlink = 2;
+  EXPECT_TRUE(compact.differsFrom(nlink));
+
+  auto mtime = info;
+  mtime.mtime = {2, 1};
+  EXPECT_TRUE(compact.differsFrom(mtime));
+}
+
+TEST(CompactFileInformationTest, file_nodes_optionally_keep_extended_stat) {
+  auto root = watchman_dir::make(w_string{"/root"}, nullptr, nullptr);
+  auto info = makeFileInfo();
+
+  auto full = watchman_file::make(w_string{"full"}, root.get(), true);
+  full->setStat(info);
+  ASSERT_NE(nullptr, full->getExtendedStat());
+  EXPECT_EQ(1000, full->getFileInformation().uid);
+  EXPECT_EQ(1, full->getFileInformation().atime.tv_sec);
+  EXPECT_EQ(w_string_piece("full"), full->getName());
+
+  auto compact = watchman_file::make(w_string{"compact"}, root.get(), false);
+  compact->setStat(info);
+  EXPECT_EQ(nullptr, compact->getExtendedStat());
+  EXPECT_EQ(0, compact->getFileInformation().uid);
+  EXPECT_EQ(42, compact->getFileInformation().size);
+  EXPECT_TRUE(compact->stat.isFile());
+}
+
+TEST(CompactFileInformationTest, retained_fields_are_compared_directly) {
+  auto root = watchman_dir::make(w_string{"/root"}, nullptr, nullptr);
+  auto info = makeFileInfo();
+  auto file = watchman_file::make(w_string{"file"}, root.get(), true);
+  file->setStat(info);
+  EXPECT_FALSE(file->statDiffersFrom(info));
+
+  // As though the new gid happened to produce the same digest.
+  auto gid = info;
+  gid.gid = 200;
+  file->stat.extraDigest = CompactFileInformation{gid}.extraDigest;
+  EXPECT_FALSE(file->stat.differsFrom(gid));
+  EXPECT_TRUE(file->statDiffersFrom(gid));
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+
+#include "watchman/ContentHashInterest.h"
+
+using namespace watchman;
+
+TEST(ContentHashInterestTest, nothing_is_wanted_until_asked_about) {
+  ContentHashInterest interest;
+  EXPECT_FALSE(interest.isWanted("src", "a.c"));
+  EXPECT_FALSE(interest.isWanted("", "a.c"));
+}
+
+TEST(ContentHashInterestTest, wants_the_suffixes_in_and_below_asked_dirs) {
+  ContentHashInterest interest;
+  interest.noteRequested({w_string{"src/lib/a.c"}, w_string{"src/b.h"}});
+
+  EXPECT_TRUE(interest.isWanted("src/lib", "other.c"));
+  EXPECT_TRUE(interest.isWanted("src", "other.h"));
+  EXPECT_TRUE(interest.isWanted("src/lib/new", "other.c"));
+  EXPECT_FALSE(interest.isWanted("src/lib", "big.bin"));
+  EXPECT_FALSE(interest.isWanted("docs", "a.c"));
+  EXPECT_FALSE(interest.isWanted("", "a.c"));
+  EXPECT_EQ(2, interest.numDirs());
+  EXPECT_EQ(2, interest.numSuffixes());
+}
+
+TEST(ContentHashInterestTest, files_at_the_root_only_want_the_root) {
+  ContentHashInterest interest;
+  interest.noteRequested({w_string{"BUCK"}});
+
+  EXPECT_TRUE(interest.isWanted("", "TARGETS"));
+  EXPECT_FALSE(interest.isWanted("src", "TARGETS"));
+}
+
+TEST(ContentHashInterestTest, interest_that_is_not_renewed_fades) {
+  ContentHashInterest interest{2};
+  for (int i = 0; i < 3; ++i) {
+    interest.noteRequested({w_string{"hot/a.c"}});
+  }
+  interest.noteRequested({w_string{"cold/a.c"}});
+  interest.noteRequested({w_string{"new/a.c"}});
+
+  EXPECT_TRUE(interest.isWanted("hot", "a.c"));
+  EXPECT_FALSE(interest.isWanted("cold", "a.c"));
+  EXPECT_TRUE(interest.isWanted("new", "a.c"));
+  EXPECT_EQ(2, interest.numDirs());
+}
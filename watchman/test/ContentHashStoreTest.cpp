@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHashStore.h"
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <array>
+#include <fstream>
+#include "watchman/ContentHash.h"
+
+using namespace watchman;
+
+namespace {
+
+using Hash = std::array<uint8_t, 4>;
+
+ContentHashCacheKey makeKey(const char* name, size_t size) {
+  return ContentHashCacheKey{name, size, {100, 200}};
+}
+
+} // namespace
+
+TEST(ContentHashStoreTest, round_trip) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "hashes"});
+
+  {
+    ContentHashStore store{path, "/some/root", 4, 100};
+    Hash hash{1, 2, 3, 4};
+    store.insert(makeKey("a", 10), 5, 6, hash.data());
+    store.insert(makeKey("sub/b", 20), 7, 6, hash.data());
+    store.save();
+  }
+
+  ContentHashStore store{path, "/some/root", 4, 100};
+  Hash hash{};
+  EXPECT_TRUE(store.lookup(makeKey("a", 10), 5, 6, hash.data()));
+  EXPECT_EQ((Hash{1, 2, 3, 4}), hash);
+  EXPECT_TRUE(store.lookup(makeKey("sub/b", 20), 7, 6, hash.data()));
+  EXPECT_FALSE(store.lookup(makeKey("c", 10), 5, 6, hash.data()));
+}
+
+TEST(ContentHashStoreTest, changed_files_are_not_used) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "hashes"});
+
+  {
+    ContentHashStore store{path, "/some/root", 4, 100};
+    Hash hash{1, 2, 3, 4};
+    store.insert(makeKey("size", 10), 5, 6, hash.data());
+    store.insert(makeKey("inode", 10), 5, 6, hash.data());
+    store.insert(makeKey("dev", 10), 5, 6, hash.data());
+    store.save();
+  }
+
+  ContentHashStore store{path, "/some/root", 4, 100};
+  Hash hash{};
+  EXPECT_FALSE(store.lookup(makeKey("size", 11), 5, 6, hash.data()));
+  EXPECT_FALSE(store.lookup(makeKey("inode", 10), 8, 6, hash.data()));
+  EXPECT_FALSE(store.lookup(makeKey("dev", 10), 5, 9, hash.data()));
+  // A mismatch discards the entry.
+  EXPECT_FALSE(store.lookup(makeKey("size", 10), 5, 6, hash.data()));
+}
+
+TEST(ContentHashStoreTest, keeps_used_entries_first) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "hashes"});
+  Hash hash{1, 2, 3, 4};
+
+  {
+    ContentHashStore store{path, "/some/root", 4, 2};
+    store.insert(makeKey("a", 10), 5, 6, hash.data());
+    store.insert(makeKey("b", 10), 5, 6, hash.data());
+    store.save();
+  }
+  {
+    ContentHashStore store{path, "/some/root", 4, 2};
+    EXPECT_TRUE(store.lookup(makeKey("b", 10), 5, 6, hash.data()));
+    store.insert(makeKey("c", 10), 5, 6, hash.data());
+    store.save();
+  }
+
+  ContentHashStore store{path, "/some/root", 4, 2};
+  EXPECT_FALSE(store.lookup(makeKey("a", 10), 5, 6, hash.data()));
+  EXPECT_TRUE(store.lookup(makeKey("b", 10), 5, 6, hash.data()));
+  EXPECT_TRUE(store.lookup(makeKey("c", 10), 5, 6, hash.data()));
+}
+
+TEST(ContentHashStoreTest, ignores_other_roots_and_bad_files) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "hashes"});
+  Hash hash{1, 2, 3, 4};
+
+  {
+    ContentHashStore store{path, "/some/root", 4, 100};
+    store.insert(makeKey("a", 10), 5, 6, hash.data());
+    store.save();
+  }
+  {
+    ContentHashStore store{path, "/other/root", 4, 100};
+    EXPECT_FALSE(store.lookup(makeKey("a", 10), 5, 6, hash.data()));
+  }
+
+  {
+    std::ofstream out{path.c_str(), std::ios::binary | std::ios::trunc};
+    out << "WMCH garbage";
+  }
+  ContentHashStore store{path, "/some/root", 4, 100};
+  EXPECT_FALSE(store.lookup(makeKey("a", 10), 5, 6, hash.data()));
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CookieSync.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <map>
+#include "watchman/test/lib/FakeFileSystem.h"
+
+using namespace watchman;
+
+void w_request_shutdown(void) {}
+
+namespace {
+
+class CookieSyncTest : public testing::Test {
+ protected:
+  CookieSyncTest() {
+    fs.defineContents({FAKEFS_ROOT "root/"});
+  }
+
+  // Notifies the one outstanding cookie and returns its path.
+  w_string observeOutstandingCookie() {
+    auto outstanding = sync.getOutstandingCookieFileList();
+    EXPECT_EQ(1, outstanding.size());
+    sync.notifyCookie(outstanding.at(0));
+    return outstanding.at(0);
+  }
+
+  FakeFileSystem fs;
+  CookieSync sync{fs, FAKEFS_ROOT "root"};
+};
+
+} // namespace
+
+TEST_F(CookieSyncTest, single_sync) {
+  auto future = sync.sync();
+  auto path = observeOutstandingCookie();
+
+  auto result = std::move(future).get(std::chrono::seconds(1));
+  ASSERT_EQ(1, result.cookieFileNames.size());
+  EXPECT_EQ(path, result.cookieFileNames[0]);
+  EXPECT_TRUE(sync.getOutstandingCookieFileList().empty());
+}
+
+TEST_F(CookieSyncTest, concurrent_syncs_share_the_next_cookie) {
+  auto first = sync.sync();
+  std::vector<folly::SemiFuture<CookieSync::SyncResult>> waiters;
+  for (int i = 0; i < 10; ++i) {
+    waiters.push_back(sync.sync());
+  }
+
+  // The waiters joined a cookie that is only written once the first one has
+  // been observed, as the first was written before they called.
+  auto firstPath = observeOutstandingCookie();
+  EXPECT_EQ(
+      firstPath,
+      std::move(first).get(std::chrono::seconds(1)).cookieFileNames.at(0));
+  for (auto& waiter : waiters) {
+    EXPECT_FALSE(waiter.isReady());
+  }
+
+  auto nextPath = observeOutstandingCookie();
+  EXPECT_NE(firstPath, nextPath);
+  for (auto& waiter : waiters) {
+    auto result = std::move(waiter).get(std::chrono::seconds(1));
+    ASSERT_EQ(1, result.cookieFileNames.size());
+    EXPECT_EQ(nextPath, result.cookieFileNames[0]);
+  }
+  EXPECT_TRUE(sync.getOutstandingCookieFileList().empty());
+}
+
+TEST_F(CookieSyncTest, abort_fails_every_waiter) {
+  auto first = sync.sync();
+  auto waiter = sync.sync();
+
+  // Aborting the outstanding cookie writes the next one, which is aborted
+  // in turn.
+  sync.abortAllCookies();
+  EXPECT_THROW(
+      std::move(first).get(std::chrono::seconds(1)), CookieSyncAborted);
+  sync.abortAllCookies();
+  EXPECT_THROW(
+      std::move(waiter).get(std::chrono::seconds(1)), CookieSyncAborted);
+}
+
+TEST_F(CookieSyncTest, scoped_syncs_only_write_to_the_dirs_that_cover_them) {
+  fs.defineContents({FAKEFS_ROOT "root/a/", FAKEFS_ROOT "root/b/"});
+  sync.addCookieDir(FAKEFS_ROOT "root/a");
+  sync.addCookieDir(FAKEFS_ROOT "root/b");
+
+  auto syncAndObserve = [&](const std::vector<w_string>& scope) {
+    auto future = sync.sync(scope);
+    for (auto& path : sync.getOutstandingCookieFileList()) {
+      sync.notifyCookie(path);
+    }
+    auto names = std::move(future).get(std::chrono::seconds(1)).cookieFileNames;
+    std::vector<w_string> dirs;
+    for (auto& name : names) {
+      dirs.push_back(name.dirName());
+    }
+    std::sort(dirs.begin(), dirs.end());
+    return dirs;
+  };
+
+  EXPECT_EQ(
+      std::vector<w_string>{FAKEFS_ROOT "root/a"},
+      syncAndObserve({FAKEFS_ROOT "root/a/dir/file.txt"}));
+  // The root's own watch covers c, but not a or b.
+  EXPECT_EQ(
+      std::vector<w_string>{FAKEFS_ROOT "root"},
+      syncAndObserve({FAKEFS_ROOT "root/c"}));
+  auto all = std::vector<w_string>{
+      FAKEFS_ROOT "root", FAKEFS_ROOT "root/a", FAKEFS_ROOT "root/b"};
+  EXPECT_EQ(all, syncAndObserve({FAKEFS_ROOT "root"}));
+  EXPECT_EQ(all, syncAndObserve({}));
+
+  std::map<w_string, uint64_t> observed;
+  for (auto& latency : sync.getDirLatencies()) {
+    observed[latency.dir] = latency.observed;
+  }
+  EXPECT_EQ(3, observed[FAKEFS_ROOT "root/a"]);
+  EXPECT_EQ(3, observed[FAKEFS_ROOT "root"]);
+  EXPECT_EQ(2, observed[FAKEFS_ROOT "root/b"]);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CrawlScheduler.h"
+#include <folly/portability/GTest.h>
+#include <folly/synchronization/Baton.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+CrawlScheduler::SystemClock::time_point daysAgo(int days) {
+  return CrawlScheduler::SystemClock::now() - std::chrono::hours(24 * days);
+}
+
+} // namespace
+
+TEST(CrawlScheduler, roots_that_were_not_restored_crawl_straight_away) {
+  CrawlScheduler scheduler;
+  scheduler.setMaxConcurrent(1);
+  std::atomic<bool> stop{false};
+  auto first = scheduler.acquire(w_string{"/a"}, stop);
+  auto second = scheduler.acquire(w_string{"/b"}, stop);
+  EXPECT_TRUE(first);
+  EXPECT_TRUE(second);
+}
+
+TEST(CrawlScheduler, restored_roots_crawl_most_recently_used_first) {
+  CrawlScheduler scheduler;
+  scheduler.setMaxConcurrent(1);
+  std::atomic<bool> stop{false};
+  scheduler.addRestored(w_string{"/idle"}, daysAgo(30));
+  scheduler.addRestored(w_string{"/recent"}, daysAgo(1));
+
+  // Occupies the only turn until both restored roots are waiting.
+  auto busy = scheduler.acquire(w_string{"/other"}, stop);
+
+  std::mutex mutex;
+  std::vector<std::string> order;
+  std::vector<std::thread> threads;
+  for (auto* path : {"/idle", "/recent"}) {
+    threads.emplace_back([&, path] {
+      auto turn = scheduler.acquire(w_string{path}, stop);
+      std::lock_guard<std::mutex> lock{mutex};
+      order.push_back(path);
+    });
+  }
+  /* sleep override */ std::this_thread::sleep_for(200ms);
+  busy.reset();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ((std::vector<std::string>{"/recent", "/idle"}), order);
+}
+
+TEST(CrawlScheduler, a_root_a_client_asks_about_does_not_wait) {
+  CrawlScheduler scheduler;
+  scheduler.setMaxConcurrent(1);
+  std::atomic<bool> stop{false};
+  scheduler.addRestored(w_string{"/wanted"}, daysAgo(1));
+  auto busy = scheduler.acquire(w_string{"/other"}, stop);
+
+  folly::Baton<> crawled;
+  std::thread thread{[&] {
+    auto turn = scheduler.acquire(w_string{"/wanted"}, stop);
+    crawled.post();
+  }};
+  EXPECT_FALSE(crawled.try_wait_for(200ms));
+  scheduler.prioritize(w_string{"/wanted"});
+  EXPECT_TRUE(crawled.try_wait_for(10s));
+  thread.join();
+}
+
+TEST(CrawlScheduler, stopping_gives_up_the_wait) {
+  CrawlScheduler scheduler;
+  scheduler.setMaxConcurrent(1);
+  std::atomic<bool> stop{false};
+  scheduler.addRestored(w_string{"/stopped"}, daysAgo(1));
+  auto busy = scheduler.acquire(w_string{"/other"}, stop);
+
+  bool acquired = true;
+  std::thread thread{[&] {
+    acquired = scheduler.acquire(w_string{"/stopped"}, stop).has_value();
+  }};
+  stop = true;
+  thread.join();
+  EXPECT_FALSE(acquired);
+}
+
+TEST(CrawlScheduler, recrawls_take_turns_across_roots) {
+  CrawlScheduler scheduler;
+  scheduler.setMaxConcurrentRecrawls(1);
+  std::atomic<bool> stop{false};
+  auto busy = scheduler.acquire(w_string{"/stormy"}, stop, true);
+
+  // First crawls don't count against the recrawls.
+  EXPECT_TRUE(scheduler.acquire(w_string{"/new"}, stop));
+
+  folly::Baton<> recrawled;
+  std::thread thread{[&] {
+    auto turn = scheduler.acquire(w_string{"/other"}, stop, true);
+    recrawled.post();
+  }};
+  EXPECT_FALSE(recrawled.try_wait_for(200ms));
+  busy.reset();
+  EXPECT_TRUE(recrawled.try_wait_for(10s));
+  thread.join();
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/GitFsmonitor.h"
+#include <folly/portability/GTest.h>
+#include <stdexcept>
+
+using namespace watchman;
+
+TEST(GitFsmonitor, pkt_lines_round_trip) {
+  std::string payload{"builtin:c:1:2:3:4"};
+  auto encoded = encodeGitPktLines(payload);
+  EXPECT_EQ(std::string{"0015builtin:c:1:2:3:40000"}, encoded);
+
+  std::string_view input{encoded};
+  std::string decoded;
+  EXPECT_TRUE(decodeGitPktLines(input, decoded));
+  EXPECT_EQ(payload, decoded);
+  EXPECT_TRUE(input.empty());
+}
+
+TEST(GitFsmonitor, large_payloads_span_packets) {
+  std::string payload(100000, 'x');
+  auto encoded = encodeGitPktLines(payload);
+  EXPECT_EQ(std::string{"fff0"}, encoded.substr(0, 4));
+
+  std::string_view input{encoded};
+  std::string decoded;
+  EXPECT_TRUE(decodeGitPktLines(input, decoded));
+  EXPECT_EQ(payload, decoded);
+}
+
+TEST(GitFsmonitor, partial_input_waits_for_more) {
+  auto encoded = encodeGitPktLines("builtin:c:1:2:3:4");
+  std::string decoded;
+
+  std::string_view input{encoded.data(), 10};
+  EXPECT_FALSE(decodeGitPktLines(input, decoded));
+  EXPECT_EQ(10, input.size());
+  EXPECT_TRUE(decoded.empty());
+
+  input = std::string_view{encoded.data(), encoded.size() - 2};
+  EXPECT_FALSE(decodeGitPktLines(input, decoded));
+  EXPECT_EQ(2, input.size());
+  EXPECT_EQ(std::string{"builtin:c:1:2:3:4"}, decoded);
+}
+
+TEST(GitFsmonitor, malformed_lengths_throw) {
+  std::string decoded;
+  std::string_view notHex{"00zzabc"};
+  EXPECT_THROW(decodeGitPktLines(notHex, decoded), std::runtime_error);
+  std::string_view tooShort{"0003"};
+  EXPECT_THROW(decodeGitPktLines(tooShort, decoded), std::runtime_error);
+}
+
+TEST(GitFsmonitor, responses) {
+  using namespace std::string_literals;
+  EXPECT_EQ(
+      "builtin:t\0a/b\0dir/\0"s,
+      renderGitFsmonitorResponse("builtin:t", {"a/b", "dir/"}, false));
+  EXPECT_EQ(
+      "builtin:t\0/\0"s,
+      renderGitFsmonitorResponse("builtin:t", {"a/b"}, true));
+}
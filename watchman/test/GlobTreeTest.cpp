@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/GlobTree.h"
+#include <folly/portability/GTest.h>
+#include <string.h>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+using namespace watchman;
+
+namespace {
+
+GlobTree makeTree(const char* pattern) {
+  return GlobTree{pattern, static_cast<uint32_t>(strlen(pattern))};
+}
+
+} // namespace
+
+TEST(GlobTree, compiles_star_patterns) {
+  EXPECT_TRUE(makeTree("*.ts").star);
+  EXPECT_TRUE(makeTree("**/*.ts").star);
+  EXPECT_TRUE(makeTree("foo*").star);
+  EXPECT_TRUE(makeTree("*").star);
+
+  EXPECT_FALSE(makeTree("foo").star);
+  EXPECT_FALSE(makeTree("*.t?").star);
+  EXPECT_FALSE(makeTree("*.[ch]").star);
+  EXPECT_FALSE(makeTree("*.*").star);
+  EXPECT_FALSE(makeTree("\\**").star);
+  EXPECT_FALSE(makeTree("**/foo/*.ts").star);
+  EXPECT_FALSE(makeTree("**.ts").star);
+  EXPECT_FALSE(makeTree(".eslintrc*").star);
+}
+
+TEST(GlobTree, star_patterns_agree_with_wildmatch) {
+  const char* patterns[] = {"*.ts", "*", "a*", "ab*b", "*.A", "A*.b"};
+  const char* names[] = {
+      "a.ts", ".ts", "ts", "a.TS", "ab", "abb", "aBb", ".a", "b.a", "A.b"};
+  const int flagSets[] = {0, WM_PERIOD, WM_CASEFOLD, WM_PERIOD | WM_CASEFOLD};
+
+  for (auto pattern : patterns) {
+    auto tree = makeTree(pattern);
+    ASSERT_TRUE(tree.star) << pattern;
+    for (auto name : names) {
+      for (auto flags : flagSets) {
+        EXPECT_EQ(
+            wildmatch(pattern, name, flags, nullptr) == WM_MATCH,
+            tree.star->matches(name, flags))
+            << "pattern " << pattern << " name " << name << " flags "
+            << flags;
+      }
+    }
+  }
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+#include "watchman/watchman_hash.h"
+#include "watchman/watchman_string.h"
+
+// Compares lookup3, which w_string hash values use by default, with wyhash,
+// which they use when built with WATCHMAN_FAST_STRING_HASH, over names and
+// paths shaped like those of a source tree, and measures the child lookups
+// of watchman_dir that the hash values key.
+
+namespace {
+
+using namespace watchman;
+
+// Words are picked with a skew towards the front of each list, as names in
+// real trees are.
+const std::vector<std::string> kDirWords{
+    "src",     "lib",   "test",     "include",  "utils", "internal",
+    "common",  "core",  "platform", "api",      "impl",  "components",
+    "service", "proto", "fixtures", "generated"};
+const std::vector<std::string> kFileWords{
+    "index", "main", "util", "types",   "config", "handler", "client",
+    "model", "view", "test", "helpers", "server", "parser",  "README"};
+const std::vector<std::string> kSuffixes{
+    "cpp", "h", "py", "js", "ts", "json", "md", "txt", "rs", "java"};
+
+template <typename T>
+const T& pickSkewed(std::mt19937& rng, const std::vector<T>& items) {
+  std::uniform_int_distribution<size_t> dist{0, items.size() - 1};
+  return items[std::min(dist(rng), dist(rng))];
+}
+
+// Basenames such as "handler_17.py", which are what dir lookups hash.
+std::vector<std::string> makeNames(size_t count) {
+  std::mt19937 rng{0};
+  std::vector<std::string> names;
+  names.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    names.push_back(fmt::format(
+        "{}_{}.{}",
+        pickSkewed(rng, kFileWords),
+        i,
+        pickSkewed(rng, kSuffixes)));
+  }
+  return names;
+}
+
+// Paths relative to the root, two to twelve dirs deep, which is what the
+// pending collections and caches hash.
+std::vector<std::string> makePaths(size_t count) {
+  std::mt19937 rng{0};
+  std::uniform_int_distribution<size_t> depthDist{2, 12};
+  std::vector<std::string> paths;
+  paths.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    std::string path;
+    auto depth = depthDist(rng);
+    for (size_t d = 0; d < depth; ++d) {
+      fmt::format_to(
+          std::back_inserter(path), "{}/", pickSkewed(rng, kDirWords));
+    }
+    fmt::format_to(
+        std::back_inserter(path),
+        "{}_{}.{}",
+        pickSkewed(rng, kFileWords),
+        i,
+        pickSkewed(rng, kSuffixes));
+    paths.push_back(std::move(path));
+  }
+  return paths;
+}
+
+struct Lookup3 {
+  size_t operator()(w_string_piece s) const {
+    return w_hash_bytes(s.data(), s.size(), 0);
+  }
+};
+
+struct WyHash {
+  size_t operator()(w_string_piece s) const {
+    auto h = w_wyhash_bytes(s.data(), s.size(), 0);
+    return uint32_t(h ^ (h >> 32));
+  }
+};
+
+template <typename Hash>
+void hash_names(benchmark::State& state) {
+  auto names = makeNames(state.range(0));
+  Hash hash;
+  for (auto _ : state) {
+    for (auto& name : names) {
+      benchmark::DoNotOptimize(hash(std::string_view{name}));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * names.size());
+}
+BENCHMARK_TEMPLATE(hash_names, Lookup3)->Arg(100000);
+BENCHMARK_TEMPLATE(hash_names, WyHash)->Arg(100000);
+
+template <typename Hash>
+void hash_paths(benchmark::State& state) {
+  auto paths = makePaths(state.range(0));
+  Hash hash;
+  size_t bytes = 0;
+  for (auto& path : paths) {
+    bytes += path.size();
+  }
+  for (auto _ : state) {
+    for (auto& path : paths) {
+      benchmark::DoNotOptimize(hash(std::string_view{path}));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * paths.size());
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK_TEMPLATE(hash_paths, Lookup3)->Arg(100000);
+BENCHMARK_TEMPLATE(hash_paths, WyHash)->Arg(100000);
+
+// Probes a map keyed as the children of a dir are, with names that are
+// found and names that are not, in a shuffled order.
+template <typename Hash>
+void probe_child_map(benchmark::State& state) {
+  auto names = makeNames(state.range(0));
+  std::unordered_map<w_string_piece, size_t, Hash> map;
+  for (size_t i = 0; i < names.size(); ++i) {
+    map.emplace(std::string_view{names[i]}, i);
+  }
+  auto probes = names;
+  for (auto& probe : makeNames(names.size())) {
+    probes.push_back(probe + "~");
+  }
+  std::shuffle(probes.begin(), probes.end(), std::mt19937{1});
+  for (auto _ : state) {
+    for (auto& probe : probes) {
+      benchmark::DoNotOptimize(map.find(std::string_view{probe}));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * probes.size());
+}
+BENCHMARK_TEMPLATE(probe_child_map, Lookup3)->Arg(16)->Arg(1000)->Arg(100000);
+BENCHMARK_TEMPLATE(probe_child_map, WyHash)->Arg(16)->Arg(1000)->Arg(100000);
+
+// getChildFile itself, with whichever hash this build uses.
+void get_child_file(benchmark::State& state) {
+  auto names = makeNames(state.range(0));
+  auto dir = watchman_dir::make(w_string{"/root"}, nullptr, nullptr);
+  for (auto& name : names) {
+    auto file = watchman_file::make(
+        w_string{std::string_view{name}}, dir.get(), false);
+    auto key = file->getName();
+    dir->files.emplace(key, std::move(file));
+  }
+  std::vector<w_string> probes;
+  for (auto& name : names) {
+    probes.emplace_back(std::string_view{name});
+  }
+  std::shuffle(probes.begin(), probes.end(), std::mt19937{1});
+  for (auto _ : state) {
+    for (auto& probe : probes) {
+      benchmark::DoNotOptimize(dir->getChildFile(probe));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * probes.size());
+  state.SetLabel(
+#ifdef WATCHMAN_FAST_STRING_HASH
+      "wyhash"
+#else
+      "lookup3"
+#endif
+  );
+}
+BENCHMARK(get_child_file)->Arg(16)->Arg(1000)->Arg(100000);
+
+} // namespace
+
+BENCHMARK_MAIN();
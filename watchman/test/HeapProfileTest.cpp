@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/HeapProfile.h"
+#include <folly/portability/GTest.h>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+using namespace watchman;
+
+namespace {
+
+int64_t sampledBytes(HeapTag tag) {
+  return getSampledHeapBytes()[size_t(tag)];
+}
+
+class HeapProfileTest : public testing::Test {
+ protected:
+  void TearDown() override {
+    setHeapSampleInterval(0);
+  }
+};
+
+} // namespace
+
+TEST_F(HeapProfileTest, nothing_is_sampled_by_default) {
+  auto before = getSampledHeapBytes();
+  HeapTagScope scope{HeapTag::Clients};
+  std::vector<json_ref> values;
+  for (int i = 0; i < 1000; ++i) {
+    values.push_back(json_integer(i));
+  }
+  EXPECT_EQ(before, getSampledHeapBytes());
+}
+
+TEST_F(HeapProfileTest, live_values_are_attributed_to_the_scope_tag) {
+  setHeapSampleInterval(1);
+  auto before = sampledBytes(HeapTag::Subscriptions);
+  std::vector<json_ref> values;
+  {
+    HeapTagScope scope{HeapTag::Subscriptions};
+    for (int i = 0; i < 100; ++i) {
+      values.push_back(json_integer(i));
+    }
+  }
+  // Every value is sampled, and each is at least a byte.
+  EXPECT_EQ(before + 100, sampledBytes(HeapTag::Subscriptions));
+
+  // Made after the scope ended
+  values.push_back(json_integer(100));
+  EXPECT_EQ(before + 100, sampledBytes(HeapTag::Subscriptions));
+
+  values.clear();
+  EXPECT_EQ(before, sampledBytes(HeapTag::Subscriptions));
+}
+
+TEST_F(HeapProfileTest, scopes_nest) {
+  setHeapSampleInterval(1);
+  auto viewBefore = sampledBytes(HeapTag::View);
+  auto clientsBefore = sampledBytes(HeapTag::Clients);
+
+  HeapTagScope outer{HeapTag::View};
+  json_ref innerValue;
+  {
+    HeapTagScope inner{HeapTag::Clients};
+    innerValue = json_integer(1);
+  }
+  auto outerValue = json_integer(2);
+
+  EXPECT_EQ(viewBefore + 1, sampledBytes(HeapTag::View));
+  EXPECT_EQ(clientsBefore + 1, sampledBytes(HeapTag::Clients));
+}
+
+TEST_F(HeapProfileTest, samples_stand_for_an_interval_of_bytes) {
+  setHeapSampleInterval(1024);
+  auto before = sampledBytes(HeapTag::Caches);
+  HeapTagScope scope{HeapTag::Caches};
+  std::vector<json_ref> values;
+  int64_t allocated = 0;
+  while (allocated < 1024 * 1024) {
+    values.push_back(json_integer(allocated));
+    allocated += sizeof(json_t) + sizeof(json_int_t);
+  }
+  auto estimate = sampledBytes(HeapTag::Caches) - before;
+  EXPECT_NEAR(allocated, estimate, allocated / 20);
+}
@@ -107,6 +107,49 @@ TEST(Ignore, correctness) {
   run_correctness_test(&state, tests, sizeof(tests) / sizeof(tests[0]));
 }
 
+TEST(Ignore, vcs_and_dir_lookups_are_exact) {
+  IgnoreSet state;
+  init_state(&state);
+
+  EXPECT_TRUE(state.isIgnoreDir("baz/foo/bar/qux"));
+  EXPECT_FALSE(state.isIgnoreDir("baz/foo/bar"));
+  EXPECT_FALSE(state.isIgnoreDir("baz/foo/bar/qux/child"));
+  EXPECT_FALSE(state.isIgnoreDir(".hg"));
+  EXPECT_TRUE(state.isIgnoreVCS(".hg"));
+  EXPECT_FALSE(state.isIgnoreVCS(".hg/store"));
+  EXPECT_FALSE(state.isIgnoreVCS("build"));
+}
+
+TEST(Ignore, globs) {
+  IgnoreSet state;
+  init_state(&state);
+  state.addGlob(w_string{"/root[1]"}, w_string{"*.tmp"});
+  state.addGlob(w_string{"/root[1]"}, w_string{"out/**/cache"});
+  state.addGlob(w_string{}, w_string{"**/node_modules"});
+
+  static const struct test_case tests[] = {
+      {"/root[1]/scratch.tmp", true},
+      {"/root[1]/scratch.tmp/below", true},
+      {"/root[1]/dir/scratch.tmp", false},
+      {"/root1/scratch.tmp", false},
+      {"/root[1]/scratch.txt", false},
+      {"/root[1]/out/cache", true},
+      {"/root[1]/out/a/b/cache/file", true},
+      {"/root[1]/out/a/b/not-cache", false},
+      {"lib/node_modules/left-pad", true},
+      {"node_modules", true},
+      {"buck-out/gen/foo", true},
+      {".hg/store/foo", true},
+      {".hg/wlock", false},
+      {"some/path", false},
+  };
+  run_correctness_test(&state, tests, std::size(tests));
+
+  EXPECT_TRUE(state.isIgnoreDir("/root[1]/out/x/cache"));
+  EXPECT_FALSE(state.isIgnoreDir("/root[1]/out/x/cache/y"));
+  EXPECT_TRUE(state.isIgnoreVCS(".hg"));
+}
+
 // Load up the words data file and build a list of strings from that list.
 // Each of those strings is prefixed with the supplied string.
 // If there are fewer than limit entries available in the data file, we will
@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "watchman/InMemoryView.h"
+#include "watchman/Metrics.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryContext.h"
+#include "watchman/query/parse.h"
+#include "watchman/root/Root.h"
+#include "watchman/test/lib/FakeFileSystem.h"
+#include "watchman/test/lib/FakeWatcher.h"
+
+// Measures the query generators of InMemoryView over large synthetic trees,
+// and how quickly its IO thread applies storms of changes to them.
+// Building a tree of ten million files takes several minutes and around
+// 10GB; use --benchmark_filter=/1000000 to only run the smaller one.
+
+namespace {
+
+using namespace watchman;
+
+const w_string kRootPath{FAKEFS_ROOT "root"};
+
+// Words are picked with a skew towards the front of each list, as names in
+// real trees are.
+const std::vector<std::string> kDirWords{
+    "src",     "lib",   "test",     "include",  "utils", "internal",
+    "common",  "core",  "platform", "api",      "impl",  "components",
+    "service", "proto", "fixtures", "generated"};
+const std::vector<std::string> kFileWords{
+    "index", "main", "util", "types",   "config", "handler", "client",
+    "model", "view", "test", "helpers", "server", "parser",  "README"};
+const std::vector<std::string> kSuffixes{
+    "cpp", "h", "py", "js", "ts", "json", "md", "txt", "rs", "java"};
+
+template <typename T>
+const T& pickSkewed(std::mt19937& rng, const std::vector<T>& items) {
+  std::uniform_int_distribution<size_t> dist{0, items.size() - 1};
+  return items[std::min(dist(rng), dist(rng))];
+}
+
+struct Fixture {
+  FakeFileSystem fs;
+  Configuration config;
+  std::shared_ptr<FakeWatcher> watcher = std::make_shared<FakeWatcher>(fs);
+  std::shared_ptr<InMemoryView> view =
+      std::make_shared<InMemoryView>(fs, kRootPath, config, watcher);
+  std::shared_ptr<Root> root;
+  // After the crawl, before about 1% of the files were changed
+  ClockPosition beforeChanges;
+  // Directories for pathGenerator
+  std::vector<w_string> someDirs;
+  // Relative to the root
+  std::vector<std::string> filePaths;
+  size_t numFiles;
+
+  explicit Fixture(size_t files) : numFiles{files} {
+    std::mt19937 rng{0};
+    std::vector<std::pair<std::string, size_t>> dirs{{"", 0}};
+    filePaths.reserve(files);
+
+    // Each file either starts a new directory under an existing one, or
+    // goes into one, so the depths are spread as in a source tree.
+    std::uniform_int_distribution<size_t> newDir{0, 15};
+    size_t serial = 0;
+    while (filePaths.size() < files) {
+      auto parent =
+          dirs[std::uniform_int_distribution<size_t>{0, dirs.size() - 1}(
+              rng)];
+      if (newDir(rng) == 0 && parent.second < 12) {
+        dirs.emplace_back(
+            fmt::format(
+                "{}{}{}_{}",
+                parent.first,
+                parent.first.empty() ? "" : "/",
+                pickSkewed(rng, kDirWords),
+                ++serial),
+            parent.second + 1);
+        continue;
+      }
+      filePaths.push_back(fmt::format(
+          "{}{}{}_{}.{}",
+          parent.first,
+          parent.first.empty() ? "" : "/",
+          pickSkewed(rng, kFileWords),
+          ++serial,
+          pickSkewed(rng, kSuffixes)));
+    }
+
+    fs.addNode(kRootPath.c_str(), fs.fakeDir());
+    for (auto& dir : dirs) {
+      if (!dir.first.empty()) {
+        fs.addNode(
+            fmt::format("{}/{}", kRootPath, dir.first).c_str(), fs.fakeDir());
+      }
+    }
+    for (auto& path : filePaths) {
+      fs.addNode(fmt::format("{}/{}", kRootPath, path).c_str(), fs.fakeFile());
+    }
+    for (size_t i = 1; i < dirs.size() && someDirs.size() < 100;
+         i += dirs.size() / 100 + 1) {
+      someDirs.emplace_back(dirs[i].first);
+    }
+
+    root = std::make_shared<Root>(
+        fs, kRootPath, "fs_type", w_string_to_json("{}"), config, view, [] {});
+    auto& pending = view->unsafeAccessPendingFromWatcher();
+    InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+    pending.lock()->ping();
+    view->stepIoThread(root, state, pending);
+
+    beforeChanges = view->getMostRecentRootNumberAndTickValue();
+    for (size_t i = 0; i < filePaths.size(); i += 100) {
+      auto path = fmt::format("{}/{}", kRootPath, filePaths[i]);
+      fs.updateMetadata(
+          path.c_str(), [](FileInformation& fi) { fi.size = 100; });
+      pending.lock()->add(
+          w_string{std::string_view{path}}, {}, W_PENDING_VIA_NOTIFY);
+    }
+    pending.lock()->ping();
+    view->stepIoThread(root, state, pending);
+  }
+};
+
+Fixture& getFixture(size_t files) {
+  // Built once for each size, and shared by the benchmarks.
+  static std::map<size_t, std::unique_ptr<Fixture>> fixtures;
+  auto& fixture = fixtures[files];
+  if (!fixture) {
+    fixture = std::make_unique<Fixture>(files);
+  }
+  return *fixture;
+}
+
+std::shared_ptr<Query> makeQuery(Fixture& fixture, const char* spec) {
+  json_error_t err;
+  return parseQuery(fixture.root, json_loads(spec, 0, &err).value());
+}
+
+template <typename Generate>
+void runQuery(
+    benchmark::State& state,
+    Fixture& fixture,
+    const Query& query,
+    Generate generate) {
+  size_t results = 0;
+  for (auto _ : state) {
+    QueryContext ctx{&query, fixture.root, false};
+    generate(ctx);
+    ctx.fetchEvalBatchNow();
+    while (!ctx.fetchRenderBatchNow()) {
+    }
+    results = ctx.resultsArray.size();
+    benchmark::DoNotOptimize(ctx.resultsArray);
+  }
+  state.counters["results"] = double(results);
+  state.SetItemsProcessed(state.iterations() * fixture.numFiles);
+}
+
+void sizes(benchmark::internal::Benchmark* benchmark) {
+  benchmark->Arg(1000000)->Arg(10000000)->Unit(benchmark::kMillisecond);
+}
+
+void all_files_generator(benchmark::State& state) {
+  auto& fixture = getFixture(state.range(0));
+  auto query = makeQuery(fixture, R"({"fields": ["name"]})");
+  runQuery(state, fixture, *query, [&](QueryContext& ctx) {
+    fixture.view->allFilesGenerator(query.get(), &ctx);
+  });
+}
+BENCHMARK(all_files_generator)->Apply(sizes);
+
+void time_generator(benchmark::State& state) {
+  auto& fixture = getFixture(state.range(0));
+  auto query = makeQuery(fixture, R"({"fields": ["name"]})");
+  runQuery(state, fixture, *query, [&](QueryContext& ctx) {
+    ctx.since = QuerySince::Clock{false, fixture.beforeChanges.ticks};
+    fixture.view->timeGenerator(query.get(), &ctx);
+  });
+}
+BENCHMARK(time_generator)->Apply(sizes);
+
+void glob_generator(benchmark::State& state) {
+  auto& fixture = getFixture(state.range(0));
+  auto query = makeQuery(
+      fixture, R"({"fields": ["name"], "glob": ["**/*.cpp", "src_*/**/*.h"]})");
+  runQuery(state, fixture, *query, [&](QueryContext& ctx) {
+    fixture.view->globGenerator(query.get(), &ctx);
+  });
+}
+BENCHMARK(glob_generator)->Apply(sizes);
+
+void path_generator(benchmark::State& state) {
+  auto& fixture = getFixture(state.range(0));
+  std::vector<json_ref> paths;
+  for (auto& dir : fixture.someDirs) {
+    paths.push_back(json_object(
+        {{"path", w_string_to_json(dir)}, {"depth", json_integer(1)}}));
+  }
+  auto spec = json_object(
+      {{"fields", json_array({typed_string_to_json("name")})},
+       {"path", json_array(std::move(paths))}});
+  auto query = parseQuery(fixture.root, spec);
+  runQuery(state, fixture, *query, [&](QueryContext& ctx) {
+    fixture.view->pathGenerator(query.get(), &ctx);
+  });
+}
+BENCHMARK(path_generator)->Apply(sizes);
+
+// Common expressions, evaluated over every file.
+void expression(benchmark::State& state, const char* spec) {
+  auto& fixture = getFixture(state.range(0));
+  auto query = makeQuery(fixture, spec);
+  runQuery(state, fixture, *query, [&](QueryContext& ctx) {
+    fixture.view->allFilesGenerator(query.get(), &ctx);
+  });
+}
+BENCHMARK_CAPTURE(
+    expression,
+    suffix,
+    R"({"fields": ["name"], "expression": ["suffix", "cpp"]})")
+    ->Apply(sizes);
+BENCHMARK_CAPTURE(
+    expression,
+    suffix_set,
+    R"({"fields": ["name"],
+        "expression": ["suffix", ["cpp", "h", "py", "js"]]})")
+    ->Apply(sizes);
+BENCHMARK_CAPTURE(
+    expression,
+    match_basename,
+    R"({"fields": ["name"], "expression": ["match", "index_*.ts"]})")
+    ->Apply(sizes);
+BENCHMARK_CAPTURE(
+    expression,
+    match_wholename,
+    R"({"fields": ["name"],
+        "expression": ["match", "**/test_*/**", "wholename"]})")
+    ->Apply(sizes);
+BENCHMARK_CAPTURE(
+    expression,
+    type_and_not_dirname,
+    R"({"fields": ["name", "size", "mtime_ms"],
+        "expression": ["allof", ["type", "f"],
+                       ["not", ["dirname", "src_1"]]]})")
+    ->Apply(sizes);
+BENCHMARK_CAPTURE(
+    expression,
+    anyof_suffix_or_name,
+    R"({"fields": ["name"],
+        "expression": ["anyof", ["suffix", "json"],
+                       ["name", ["README_1.md", "main_2.cpp"]]]})")
+    ->Apply(sizes);
+
+// Applies a storm of changes to files picked at random from a tree of 100k,
+// which the pending collection consolidates before the IO thread sees them.
+// One change in recursiveEvery, if set, is instead to a directory, which the
+// IO thread crawls. Reports the rate at which the watcher's events were
+// taken in, and from watchman_pending_batch_us, how long the IO thread held
+// the view lock for each batch.
+void io_thread_ingest(benchmark::State& state, size_t recursiveEvery) {
+  auto& fixture = getFixture(100000);
+  size_t numEvents = state.range(0);
+
+  std::mt19937 rng{0};
+  std::uniform_int_distribution<size_t> pickFile{
+      0, fixture.filePaths.size() - 1};
+  std::vector<std::pair<w_string, PendingFlags>> events;
+  events.reserve(numEvents);
+  for (size_t i = 0; i < numEvents; ++i) {
+    if (recursiveEvery && i % recursiveEvery == 0) {
+      events.emplace_back(
+          w_string::pathCat(
+              {kRootPath, fixture.someDirs[i / recursiveEvery %
+                                           fixture.someDirs.size()]}),
+          W_PENDING_RECURSIVE | W_PENDING_VIA_NOTIFY);
+    } else {
+      events.emplace_back(
+          w_string::pathCat({kRootPath, fixture.filePaths[pickFile(rng)]}),
+          W_PENDING_VIA_NOTIFY);
+    }
+  }
+
+  auto& pending = fixture.view->unsafeAccessPendingFromWatcher();
+  InMemoryView::IoThreadState ioState{std::chrono::minutes(5)};
+  auto& batchTime = getHistogram(
+      "watchman_pending_batch_us",
+      "Time taken to process all pending items, including their cookies");
+  auto before = batchTime.snapshot();
+  size_t items = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto now = std::chrono::system_clock::now();
+    {
+      auto locked = pending.lock();
+      for (auto& [path, flags] : events) {
+        locked->add(path, now, flags);
+      }
+      items = locked->getPendingItemCount();
+      locked->ping();
+    }
+    state.ResumeTiming();
+
+    fixture.view->stepIoThread(fixture.root, ioState, pending);
+  }
+  auto after = batchTime.snapshot();
+
+  state.SetItemsProcessed(state.iterations() * numEvents);
+  state.counters["items"] = double(items);
+  state.counters["consolidated"] = double(numEvents - items);
+  if (after.count > before.count) {
+    state.counters["lock_hold_us_avg"] = double(after.sum - before.sum) /
+        double(after.count - before.count);
+  }
+}
+BENCHMARK_CAPTURE(io_thread_ingest, files, 0)
+    ->Arg(10000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(io_thread_ingest, files_and_dirs, 100)
+    ->Arg(10000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMillisecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -6,12 +6,23 @@
  */
 
 #include "watchman/InMemoryView.h"
+#include <folly/ScopeGuard.h>
 #include <folly/executors/ManualExecutor.h>
 #include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "watchman/Options.h"
+#include "watchman/TickIndex.h"
+#include "watchman/bser.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/query/GlobTree.h"
+#include "watchman/query/LocalFileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/query/parse.h"
 #include "watchman/root/Root.h"
 #include "watchman/test/lib/FakeFileSystem.h"
 #include "watchman/test/lib/FakeWatcher.h"
@@ -23,9 +34,16 @@ namespace {
 
 using namespace watchman;
 
-Configuration getConfiguration(bool usePwalk) {
+using ConfigOptions = std::vector<std::pair<const char*, json_ref>>;
+
+Configuration getConfiguration(
+    bool usePwalk,
+    const ConfigOptions& options = {}) {
   json_ref json = json_object();
   json_object_set(json, "enable_parallel_crawl", json_boolean(usePwalk));
+  for (auto& [name, value] : options) {
+    json_object_set(json, name, value);
+  }
   return Configuration{std::move(json)};
 }
 
@@ -46,6 +64,46 @@ class InMemoryViewTest : public testing::TestWithParam<bool /* pwalk */> {
   InMemoryViewTest() {
     pending.lock()->ping();
   }
+
+  /**
+   * For tests of optional behavior: a view with options set on top of the
+   * fixture's configuration, along with the root and IO thread state that
+   * drive it.
+   */
+  struct ConfiguredView {
+    ConfiguredView(
+        InMemoryViewTest& test,
+        const ConfigOptions& options,
+        std::shared_ptr<FakeWatcher> watcher = nullptr,
+        const char* fsType = "fs_type")
+        : config{getConfiguration(GetParam(), options)},
+          view{std::make_shared<InMemoryView>(
+              test.fs,
+              test.root_path,
+              config,
+              watcher ? std::move(watcher) : test.watcher)},
+          pending{view->unsafeAccessPendingFromWatcher()} {
+      pending.lock()->ping();
+      root = std::make_shared<Root>(
+          test.fs,
+          test.root_path,
+          fsType,
+          w_string_to_json("{}"),
+          config,
+          view,
+          [] {});
+    }
+
+    Continue step() {
+      return view->stepIoThread(root, state, pending);
+    }
+
+    Configuration config;
+    std::shared_ptr<InMemoryView> view;
+    PendingCollection& pending;
+    std::shared_ptr<Root> root;
+    InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  };
 };
 
 TEST_P(InMemoryViewTest, can_construct) {
@@ -103,12 +161,13 @@ TEST_P(InMemoryViewTest, respond_to_watcher_events) {
 
   EXPECT_EQ(2, ctx1.resultsArray.size());
 
+  // Each result holds the values of the fields in the order they were added.
   auto one = ctx1.resultsArray.at(0);
-  EXPECT_STREQ("dir", one.get("name").asCString());
-  EXPECT_EQ(0, one.get("size").asInt());
+  EXPECT_STREQ("dir", one.at(0).asCString());
+  EXPECT_EQ(0, one.at(1).asInt());
   auto two = ctx1.resultsArray.at(1);
-  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
-  EXPECT_EQ(0, two.get("size").asInt());
+  EXPECT_STREQ("dir/file.txt", two.at(0).asCString());
+  EXPECT_EQ(0, two.at(1).asInt());
 
   // Update filesystem and ensure the query results don't update.
 
@@ -122,11 +181,11 @@ TEST_P(InMemoryViewTest, respond_to_watcher_events) {
   view->pathGenerator(&query, &ctx2);
 
   one = ctx2.resultsArray.at(0);
-  EXPECT_STREQ("dir", one.get("name").asCString());
-  EXPECT_EQ(0, one.get("size").asInt());
+  EXPECT_STREQ("dir", one.at(0).asCString());
+  EXPECT_EQ(0, one.at(1).asInt());
   two = ctx2.resultsArray.at(1);
-  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
-  EXPECT_EQ(0, two.get("size").asInt());
+  EXPECT_STREQ("dir/file.txt", two.at(0).asCString());
+  EXPECT_EQ(0, two.at(1).asInt());
 
   // Now notify the iothread of the change, process events, and assert the view
   // updates.
@@ -139,11 +198,11 @@ TEST_P(InMemoryViewTest, respond_to_watcher_events) {
   view->pathGenerator(&query, &ctx3);
 
   one = ctx3.resultsArray.at(0);
-  EXPECT_STREQ("dir", one.get("name").asCString());
-  EXPECT_EQ(0, one.get("size").asInt());
+  EXPECT_STREQ("dir", one.at(0).asCString());
+  EXPECT_EQ(0, one.at(1).asInt());
   two = ctx3.resultsArray.at(1);
-  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
-  EXPECT_EQ(100, two.get("size").asInt());
+  EXPECT_STREQ("dir/file.txt", two.at(0).asCString());
+  EXPECT_EQ(100, two.at(1).asInt());
 }
 
 TEST_P(InMemoryViewTest, wait_for_respond_to_watcher_events) {
@@ -168,12 +227,13 @@ TEST_P(InMemoryViewTest, wait_for_respond_to_watcher_events) {
 
   EXPECT_EQ(2, ctx1.resultsArray.size());
 
+  // Each result holds the values of the fields in the order they were added.
   auto one = ctx1.resultsArray.at(0);
-  EXPECT_STREQ("dir", one.get("name").asCString());
-  EXPECT_EQ(0, one.get("size").asInt());
+  EXPECT_STREQ("dir", one.at(0).asCString());
+  EXPECT_EQ(0, one.at(1).asInt());
   auto two = ctx1.resultsArray.at(1);
-  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
-  EXPECT_EQ(0, two.get("size").asInt());
+  EXPECT_STREQ("dir/file.txt", two.at(0).asCString());
+  EXPECT_EQ(0, two.at(1).asInt());
 
   // Update filesystem and ensure the query results don't update.
 
@@ -187,11 +247,11 @@ TEST_P(InMemoryViewTest, wait_for_respond_to_watcher_events) {
   view->pathGenerator(&query, &ctx2);
 
   one = ctx2.resultsArray.at(0);
-  EXPECT_STREQ("dir", one.get("name").asCString());
-  EXPECT_EQ(0, one.get("size").asInt());
+  EXPECT_STREQ("dir", one.at(0).asCString());
+  EXPECT_EQ(0, one.at(1).asInt());
   two = ctx2.resultsArray.at(1);
-  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
-  EXPECT_EQ(0, two.get("size").asInt());
+  EXPECT_STREQ("dir/file.txt", two.at(0).asCString());
+  EXPECT_EQ(0, two.at(1).asInt());
 
   // Now notify the iothread of the change, process events, and assert the view
   // updates.
@@ -204,11 +264,11 @@ TEST_P(InMemoryViewTest, wait_for_respond_to_watcher_events) {
   view->pathGenerator(&query, &ctx3);
 
   one = ctx3.resultsArray.at(0);
-  EXPECT_STREQ("dir", one.get("name").asCString());
-  EXPECT_EQ(0, one.get("size").asInt());
+  EXPECT_STREQ("dir", one.at(0).asCString());
+  EXPECT_EQ(0, one.at(1).asInt());
   two = ctx3.resultsArray.at(1);
-  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
-  EXPECT_EQ(100, two.get("size").asInt());
+  EXPECT_STREQ("dir/file.txt", two.at(0).asCString());
+  EXPECT_EQ(100, two.at(1).asInt());
 }
 
 TEST_P(
@@ -246,8 +306,8 @@ TEST_P(
     EXPECT_EQ(1, ctx.resultsArray.size());
 
     auto one = ctx.resultsArray.at(0);
-    EXPECT_STREQ("file.txt", one.get("name").asCString());
-    EXPECT_EQ(0, one.get("size").asInt());
+    EXPECT_STREQ("file.txt", one.at(0).asCString());
+    EXPECT_EQ(0, one.at(1).asInt());
   }
 
   // A query starts, but the watcher has not notified us.
@@ -327,8 +387,8 @@ TEST_P(
     EXPECT_EQ(1, ctx.resultsArray.size());
 
     auto one = ctx.resultsArray.at(0);
-    EXPECT_STREQ("dir/file.txt", one.get("name").asCString());
-    EXPECT_EQ(0, one.get("size").asInt());
+    EXPECT_STREQ("dir/file.txt", one.at(0).asCString());
+    EXPECT_EQ(0, one.at(1).asInt());
   }
 
   // A query starts, but the watcher has not notified us.
@@ -524,6 +584,1552 @@ TEST_P(InMemoryViewTest, directory_removal_does_not_report_parent) {
   // notification from the watcher for that directory.
 }
 
+TEST_P(InMemoryViewTest, since_with_relative_root_only_walks_subtree) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/file.txt",
+      FAKEFS_ROOT "root/b/file.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto beforeChanges = view->getMostRecentRootNumberAndTickValue();
+
+  for (const char* path :
+       {FAKEFS_ROOT "root/a/file.txt", FAKEFS_ROOT "root/b/file.txt"}) {
+    fs.updateMetadata(path, [&](FileInformation& fi) { fi.size = 100; });
+    pending.lock()->add(path, {}, W_PENDING_VIA_NOTIFY);
+  }
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.relative_root = w_string{FAKEFS_ROOT "root/b"};
+  query.relative_root_slash = w_string{FAKEFS_ROOT "root/b/"};
+
+  QueryContext ctx{&query, root, false};
+  ctx.since = QuerySince::Clock{false, beforeChanges.ticks};
+  view->timeGenerator(&query, &ctx);
+
+  ASSERT_EQ(1, ctx.resultsArray.size());
+  EXPECT_EQ("file.txt", ctx.resultsArray.at(0).asString());
+  // Only the file under b/ was considered.
+  EXPECT_EQ(1, ctx.getNumWalked());
+}
+
+TEST_P(InMemoryViewTest, parallel_all_files_matches_serial) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/a/sub/two.txt",
+      FAKEFS_ROOT "root/b/three.txt",
+      FAKEFS_ROOT "root/c/d/e/four.txt",
+      FAKEFS_ROOT "root/five.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto collect = [&](bool parallel) {
+    Query query;
+    query.fieldList.add("name");
+    query.parallel = parallel;
+
+    QueryContext ctx{&query, root, false};
+    view->allFilesGenerator(&query, &ctx);
+    ctx.fetchEvalBatchNow();
+    while (!ctx.fetchRenderBatchNow()) {
+    }
+
+    std::vector<w_string> names;
+    for (auto& result : ctx.resultsArray) {
+      names.push_back(result.asString());
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  };
+
+  auto serial = collect(false);
+  EXPECT_EQ(11, serial.size());
+  EXPECT_EQ(serial, collect(true));
+}
+
+TEST_P(InMemoryViewTest, overlapping_paths_are_deduped_by_file) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/a/sub/two.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto collect = [&](bool collectNames) {
+    Query query;
+    query.fieldList.add("name");
+    query.dedup_results = true;
+    query.collect_deduped_names = collectNames;
+    query.paths.emplace();
+    query.paths->emplace_back(QueryPath{"a", 1});
+    query.paths->emplace_back(QueryPath{"a/one.txt", 0});
+    query.paths->emplace_back(QueryPath{"a/sub", 0});
+
+    QueryContext ctx{&query, root, false};
+    view->pathGenerator(&query, &ctx);
+
+    std::vector<w_string> names;
+    for (auto& result : ctx.resultsArray) {
+      names.push_back(result.asString());
+    }
+    std::sort(names.begin(), names.end());
+    EXPECT_EQ(
+        (std::vector<w_string>{"a/one.txt", "a/sub", "a/sub/two.txt"}),
+        names);
+    EXPECT_EQ(2, ctx.num_deduped);
+    EXPECT_EQ(3, ctx.dedupIdentities.size());
+    return ctx.dedup.size();
+  };
+
+  // The names are only built when they are to be reported
+  EXPECT_EQ(0, collect(false));
+  EXPECT_EQ(3, collect(true));
+}
+
+TEST_P(InMemoryViewTest, sliced_age_out_removes_deleted_files) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/one.txt",
+      FAKEFS_ROOT "root/dir/two.txt",
+      FAKEFS_ROOT "root/keep.txt",
+  });
+
+  ConfiguredView sliced{*this, {{"gc_max_files_per_slice", json_integer(1)}}};
+  auto& root = sliced.root;
+  EXPECT_EQ(Continue::Continue, sliced.step());
+
+  fs.removeRecursively(FAKEFS_ROOT "root/dir");
+  sliced.pending.lock()->add(
+      FAKEFS_ROOT "root/dir",
+      {},
+      W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+  sliced.pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, sliced.step());
+
+  PerfSample sample{"age_out"};
+  sliced.view->ageOut(sample, std::chrono::seconds(0));
+
+  auto stats = sample.meta_data.get("age_out");
+  EXPECT_EQ(3, stats.get("files").asInt());
+  EXPECT_LT(1, stats.get("slices").asInt());
+  EXPECT_TRUE(stats.get("complete").asBool());
+
+  const auto& viewdb = sliced.view->unsafeAccessViewDatabase();
+  EXPECT_EQ(1, viewdb.getFileCount());
+  EXPECT_EQ(nullptr, viewdb.resolveDir(w_string{FAKEFS_ROOT "root/dir"}));
+}
+
+TEST_P(InMemoryViewTest, memory_stats_account_for_nodes) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/one.txt",
+      FAKEFS_ROOT "root/dir/two.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto summary = view->getMemoryStats(false);
+  ASSERT_TRUE(summary.has_value());
+  EXPECT_FALSE(summary->files.has_value());
+
+  auto detailed = view->getMemoryStats(true);
+  ASSERT_TRUE(detailed.has_value());
+  EXPECT_LT(0, detailed->node_bytes_in_use);
+  EXPECT_LE(detailed->node_bytes_in_use, detailed->node_bytes_reserved);
+  // Three file nodes (dir, one.txt, two.txt) and two dir nodes.
+  EXPECT_LE(3 * sizeof(watchman_file), detailed->files.value());
+  EXPECT_EQ(2 * sizeof(watchman_dir), detailed->dirs.value());
+  EXPECT_LT(0, detailed->names.value());
+  EXPECT_LT(0, detailed->child_maps.value());
+}
+
+TEST_P(InMemoryViewTest, sharded_view_reports_changes_across_shards) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/b/two.txt",
+      FAKEFS_ROOT "root/c/d/three.txt",
+      FAKEFS_ROOT "root/four.txt",
+      FAKEFS_ROOT "root/five.txt",
+  });
+
+  ConfiguredView sharded{*this, {{"view_shards", json_integer(4)}}};
+  auto& root = sharded.root;
+  EXPECT_EQ(Continue::Continue, sharded.step());
+
+  auto names = [](QueryContext& ctx) {
+    std::vector<w_string> result;
+    for (auto& name : ctx.resultsArray) {
+      result.push_back(name.asString());
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+
+  Query query;
+  query.fieldList.add("name");
+
+  {
+    QueryContext ctx{&query, root, false};
+    sharded.view->allFilesGenerator(&query, &ctx);
+    EXPECT_EQ(
+        (std::vector<w_string>{
+            "a",
+            "a/one.txt",
+            "b",
+            "b/two.txt",
+            "c",
+            "c/d",
+            "c/d/three.txt",
+            "five.txt",
+            "four.txt"}),
+        names(ctx));
+  }
+
+  {
+    Query pathQuery;
+    pathQuery.fieldList.add("name");
+    pathQuery.paths.emplace();
+    pathQuery.paths->emplace_back(QueryPath{"", 0});
+
+    QueryContext ctx{&pathQuery, root, false};
+    sharded.view->pathGenerator(&pathQuery, &ctx);
+    EXPECT_EQ(
+        (std::vector<w_string>{"a", "b", "c", "five.txt", "four.txt"}),
+        names(ctx));
+  }
+
+  auto beforeChanges = sharded.view->getMostRecentRootNumberAndTickValue();
+
+  for (const char* path :
+       {FAKEFS_ROOT "root/a/one.txt",
+        FAKEFS_ROOT "root/c/d/three.txt",
+        FAKEFS_ROOT "root/four.txt"}) {
+    fs.updateMetadata(path, [&](FileInformation& fi) { fi.size = 100; });
+    sharded.pending.lock()->add(path, {}, W_PENDING_VIA_NOTIFY);
+  }
+  sharded.pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, sharded.step());
+
+  {
+    QueryContext ctx{&query, root, false};
+    ctx.since = QuerySince::Clock{false, beforeChanges.ticks};
+    sharded.view->timeGenerator(&query, &ctx);
+    EXPECT_EQ(
+        (std::vector<w_string>{"a/one.txt", "c/d/three.txt", "four.txt"}),
+        names(ctx));
+  }
+
+  // The clock was published once every shard that the batch touched had
+  // been released, and so covers all of the changes.
+  {
+    auto afterChanges = sharded.view->getMostRecentRootNumberAndTickValue();
+    EXPECT_GT(afterChanges.ticks, beforeChanges.ticks);
+    QueryContext ctx{&query, root, false};
+    ctx.since = QuerySince::Clock{false, afterChanges.ticks};
+    sharded.view->timeGenerator(&query, &ctx);
+    EXPECT_EQ((std::vector<w_string>{}), names(ctx));
+  }
+
+  {
+    Query relativeQuery;
+    relativeQuery.fieldList.add("name");
+    relativeQuery.relative_root = w_string{FAKEFS_ROOT "root/c"};
+    relativeQuery.relative_root_slash = w_string{FAKEFS_ROOT "root/c/"};
+
+    QueryContext ctx{&relativeQuery, root, false};
+    ctx.since = QuerySince::Clock{false, beforeChanges.ticks};
+    sharded.view->timeGenerator(&relativeQuery, &ctx);
+    EXPECT_EQ((std::vector<w_string>{"d/three.txt"}), names(ctx));
+  }
+
+  EXPECT_TRUE(sharded.view->doAnyOfTheseFilesExist({"b/two.txt"}));
+  EXPECT_FALSE(sharded.view->doAnyOfTheseFilesExist({"b/missing.txt"}));
+}
+
+TEST_P(InMemoryViewTest, warm_start_continues_previous_clock) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/b/two.txt",
+      FAKEFS_ROOT "root/three.txt",
+  });
+
+  folly::test::TemporaryDirectory stateDir;
+  auto oldStateFile = flags.watchman_state_file;
+  flags.watchman_state_file = (stateDir.path() / "state").string();
+  SCOPE_EXIT {
+    flags.watchman_state_file = oldStateFile;
+  };
+
+  const ConfigOptions warmOptions{
+      {"persist_tick_index", json_true()},
+      {"warm_start_from_tick_index", json_true()}};
+
+  ClockPosition previousClock;
+  {
+    ConfiguredView first{*this, warmOptions};
+    // The initial crawl, then a settle, which writes the tick index.
+    EXPECT_EQ(Continue::Continue, first.step());
+    EXPECT_EQ(Continue::Continue, first.step());
+    previousClock = first.view->getMostRecentRootNumberAndTickValue();
+  }
+
+  fs.updateMetadata(FAKEFS_ROOT "root/b/two.txt", [&](FileInformation& fi) {
+    fi.size = 100;
+  });
+
+  ConfiguredView second{*this, warmOptions};
+  auto& root = second.root;
+
+  auto names = [](QueryContext& ctx) {
+    std::vector<w_string> result;
+    for (auto& name : ctx.resultsArray) {
+      result.push_back(name.asString());
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+
+  Query query;
+  query.fieldList.add("name");
+
+  // The warm start populates the view without crawling it.
+  EXPECT_EQ(Continue::Continue, second.step());
+  {
+    QueryContext ctx{&query, root, false};
+    second.view->allFilesGenerator(&query, &ctx);
+    EXPECT_EQ(
+        (std::vector<w_string>{
+            "a", "a/one.txt", "b", "b/two.txt", "three.txt"}),
+        names(ctx));
+  }
+  auto predecessor = second.view->getClockPredecessor();
+  ASSERT_TRUE(predecessor.has_value());
+  EXPECT_EQ(previousClock.ticks, predecessor->lastTicks);
+  EXPECT_GT(
+      second.view->getMostRecentRootNumberAndTickValue().ticks,
+      previousClock.ticks);
+
+  // Verification finds the change made while nothing was watching.
+  EXPECT_EQ(Continue::Continue, second.step());
+  {
+    QueryContext ctx{&query, root, false};
+    ctx.since = QuerySince::Clock{false, previousClock.ticks};
+    second.view->timeGenerator(&query, &ctx);
+    EXPECT_EQ((std::vector<w_string>{"b/two.txt"}), names(ctx));
+  }
+}
+
+TEST_P(InMemoryViewTest, dumped_view_lists_every_file) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/three.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  folly::test::TemporaryDirectory dumpDir;
+  auto path = w_string{(dumpDir.path() / "dump").string().c_str()};
+  auto written = view->dumpView(path);
+  ASSERT_TRUE(written.has_value());
+  EXPECT_EQ(3, *written);
+
+  TickIndexReader reader{path.c_str()};
+  EXPECT_EQ(root_path, reader.header().rootPath);
+  EXPECT_EQ(
+      view->getMostRecentRootNumberAndTickValue().ticks,
+      reader.header().clock.lastTicks);
+
+  std::vector<w_string> names;
+  w_string dir;
+  for (auto record = reader.next(); record != TickIndexReader::Record::End;
+       record = reader.next()) {
+    if (record == TickIndexReader::Record::Dir) {
+      dir = reader.dir();
+    } else {
+      EXPECT_TRUE(reader.file().exists);
+      names.push_back(
+          dir.empty() ? reader.file().name
+                      : w_string::pathCat({dir, reader.file().name}));
+    }
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<w_string>{"a", "a/one.txt", "three.txt"}), names);
+}
+
+TEST_P(InMemoryViewTest, large_recrawls_use_parallel_walker_in_batches) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/b/c/one.txt",
+      FAKEFS_ROOT "root/a/d/two.txt",
+      FAKEFS_ROOT "root/e/three.txt",
+  });
+
+  ConfiguredView recrawl{
+      *this,
+      {{"parallel_recrawl_min_dirs", json_integer(2)},
+       {"parallel_crawl_batch_dirs", json_integer(1)}}};
+  auto& root = recrawl.root;
+  EXPECT_EQ(Continue::Continue, recrawl.step());
+  auto yieldsAfterCrawl =
+      recrawl.view->getViewDebugInfo().get("view_lock_yields").asInt();
+  auto beforeRecrawl = recrawl.view->getMostRecentRootNumberAndTickValue();
+
+  // A change that was not reported, found by a recrawl of the subtree.
+  fs.defineContents({FAKEFS_ROOT "root/a/b/c/new.txt"});
+  recrawl.pending.lock()->add(
+      FAKEFS_ROOT "root/a", {}, W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY);
+  recrawl.pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, recrawl.step());
+
+  // a holds three dirs, so the recrawl was walked in parallel and applied a
+  // dir at a time.
+  EXPECT_GT(
+      recrawl.view->getViewDebugInfo().get("view_lock_yields").asInt(),
+      yieldsAfterCrawl);
+
+  Query query;
+  query.fieldList.add("name");
+  QueryContext ctx{&query, root, false};
+  ctx.since = QuerySince::Clock{false, beforeRecrawl.ticks};
+  recrawl.view->timeGenerator(&query, &ctx);
+  std::vector<w_string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asString());
+  }
+  EXPECT_NE(
+      names.end(), std::find(names.begin(), names.end(), "a/b/c/new.txt"));
+}
+
+TEST_P(InMemoryViewTest, recrawl_trusts_unchanged_dir_mtime) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/a/b/two.txt",
+  });
+
+  // The parallel crawler always stats every entry.
+  ConfiguredView trust{
+      *this,
+      {{"enable_parallel_crawl", json_false()},
+       {"trust_unchanged_dir_mtime", json_true()}}};
+  auto& root = trust.root;
+  EXPECT_EQ(Continue::Continue, trust.step());
+
+  auto recrawlAndGetChanges = [&] {
+    auto before = trust.view->getMostRecentRootNumberAndTickValue();
+    trust.pending.lock()->add(
+        root_path, {}, W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY);
+    trust.pending.lock()->ping();
+    EXPECT_EQ(Continue::Continue, trust.step());
+
+    Query query;
+    query.fieldList.add("name");
+    QueryContext ctx{&query, root, false};
+    ctx.since = QuerySince::Clock{false, before.ticks};
+    trust.view->timeGenerator(&query, &ctx);
+    std::vector<w_string> names;
+    for (auto& name : ctx.resultsArray) {
+      names.push_back(name.asString());
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  };
+
+  // Modified in place, which the dirs do not reflect, alongside an addition,
+  // which the listing of b finds.
+  fs.updateMetadata(FAKEFS_ROOT "root/a/one.txt", [](FileInformation& fi) {
+    fi.size = 42;
+  });
+  fs.defineContents({FAKEFS_ROOT "root/a/b/new.txt"});
+  EXPECT_EQ(std::vector<w_string>{"a/b/new.txt"}, recrawlAndGetChanges());
+
+  // Once a changes, its files are stat'd again.
+  fs.updateMetadata(FAKEFS_ROOT "root/a", [](FileInformation& fi) {
+    fi.mtime.tv_sec += 1;
+  });
+  EXPECT_EQ(
+      (std::vector<w_string>{"a", "a/one.txt"}), recrawlAndGetChanges());
+}
+
+TEST_P(InMemoryViewTest, recrawl_does_not_read_unchanged_dirs_on_ext4) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/a/b/two.txt",
+  });
+
+  ConfiguredView trust{
+      *this,
+      {{"enable_parallel_crawl", json_false()},
+       {"trust_unchanged_dir_mtime", json_true()}},
+      nullptr,
+      "ext4"};
+  auto& root = trust.root;
+  EXPECT_EQ(Continue::Continue, trust.step());
+
+  auto recrawlAndGetChanges = [&] {
+    auto before = trust.view->getMostRecentRootNumberAndTickValue();
+    trust.pending.lock()->add(
+        root_path, {}, W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY);
+    trust.pending.lock()->ping();
+    EXPECT_EQ(Continue::Continue, trust.step());
+
+    Query query;
+    query.fieldList.add("name");
+    QueryContext ctx{&query, root, false};
+    ctx.since = QuerySince::Clock{false, before.ticks};
+    trust.view->timeGenerator(&query, &ctx);
+    std::vector<w_string> names;
+    for (auto& name : ctx.resultsArray) {
+      names.push_back(name.asString());
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  };
+
+  // The fake filesystem does not update b when an entry is added to it, so
+  // the new entry is only found once b is seen to change.
+  fs.defineContents({FAKEFS_ROOT "root/a/b/new.txt"});
+  EXPECT_EQ(std::vector<w_string>{}, recrawlAndGetChanges());
+
+  fs.updateMetadata(FAKEFS_ROOT "root/a/b", [](FileInformation& fi) {
+    fi.mtime.tv_sec += 1;
+  });
+  EXPECT_EQ(
+      (std::vector<w_string>{"a/b", "a/b/new.txt"}), recrawlAndGetChanges());
+}
+
+TEST_P(InMemoryViewTest, storms_of_changes_extend_the_batch_window) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a",
+      FAKEFS_ROOT "root/b",
+      FAKEFS_ROOT "root/c",
+  });
+
+  ConfiguredView batch{
+      *this,
+      {{"io_batch_window_max_ms", json_integer(4)},
+       {"io_batch_min_items", json_integer(3)}}};
+  auto& root = batch.root;
+  EXPECT_EQ(Continue::Continue, batch.step());
+
+  auto addChanges = [&](std::initializer_list<const char*> paths) {
+    auto lock = batch.pending.lock();
+    for (auto path : paths) {
+      lock->add(w_string{path}, {}, W_PENDING_VIA_NOTIFY);
+    }
+    lock->ping();
+  };
+  auto debugInfo = [&](const char* key) {
+    return batch.view->getViewDebugInfo().get(key).asInt();
+  };
+
+  addChanges(
+      {FAKEFS_ROOT "root/a", FAKEFS_ROOT "root/b", FAKEFS_ROOT "root/c"});
+  EXPECT_EQ(Continue::Continue, batch.step());
+  EXPECT_EQ(1, debugInfo("io_batch_window_ms"));
+  EXPECT_EQ(1, debugInfo("io_batches_extended"));
+
+  addChanges(
+      {FAKEFS_ROOT "root/a", FAKEFS_ROOT "root/b", FAKEFS_ROOT "root/c"});
+  EXPECT_EQ(Continue::Continue, batch.step());
+  EXPECT_EQ(2, debugInfo("io_batch_window_ms"));
+  EXPECT_EQ(2, debugInfo("io_batches_extended"));
+
+  // A single edit is applied without waiting, and the window shrinks.
+  addChanges({FAKEFS_ROOT "root/a"});
+  EXPECT_EQ(Continue::Continue, batch.step());
+  EXPECT_EQ(1, debugInfo("io_batch_window_ms"));
+  EXPECT_EQ(2, debugInfo("io_batches_extended"));
+}
+
+TEST_P(InMemoryViewTest, sync_ends_the_batch_window_early) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a",
+      FAKEFS_ROOT "root/b",
+      FAKEFS_ROOT "root/c",
+  });
+
+  ConfiguredView batch{
+      *this,
+      {{"io_batch_window_max_ms", json_integer(600000)},
+       {"io_batch_min_items", json_integer(3)}}};
+  EXPECT_EQ(Continue::Continue, batch.step());
+
+  {
+    auto lock = batch.pending.lock();
+    for (auto path :
+         {FAKEFS_ROOT "root/a", FAKEFS_ROOT "root/b", FAKEFS_ROOT "root/c"}) {
+      lock->add(w_string{path}, {}, W_PENDING_VIA_NOTIFY);
+    }
+    lock->ping();
+  }
+  batch.state.batchWindow = std::chrono::minutes{5};
+
+  folly::Promise<folly::Unit> promise;
+  auto synced = promise.getSemiFuture();
+  std::thread syncThread{[&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    auto lock = batch.pending.lock();
+    lock->addSync(std::move(promise));
+    lock->ping();
+  }};
+  SCOPE_EXIT {
+    syncThread.join();
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(Continue::Continue, batch.step());
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::minutes{1});
+  EXPECT_TRUE(synced.isReady());
+}
+
+TEST_P(InMemoryViewTest, large_batches_are_stat_d_in_parallel) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a",
+      FAKEFS_ROOT "root/b",
+      FAKEFS_ROOT "root/c",
+  });
+
+  ConfiguredView parallel{
+      *this, {{"parallel_stat_min_items", json_integer(3)}}};
+  auto& root = parallel.root;
+  EXPECT_EQ(Continue::Continue, parallel.step());
+  auto batches = [&] {
+    return parallel.view->getViewDebugInfo()
+        .get("parallel_stat_batches")
+        .asInt();
+  };
+  EXPECT_EQ(0, batches());
+
+  fs.updateMetadata(
+      FAKEFS_ROOT "root/a", [&](FileInformation& fi) { fi.size = 10; });
+  fs.updateMetadata(
+      FAKEFS_ROOT "root/c", [&](FileInformation& fi) { fi.size = 30; });
+  {
+    auto lock = parallel.pending.lock();
+    lock->add(FAKEFS_ROOT "root/a", {}, W_PENDING_VIA_NOTIFY);
+    lock->add(FAKEFS_ROOT "root/b", {}, W_PENDING_VIA_NOTIFY);
+    lock->add(FAKEFS_ROOT "root/c", {}, W_PENDING_VIA_NOTIFY);
+    lock->add(FAKEFS_ROOT "root/gone", {}, W_PENDING_VIA_NOTIFY);
+    lock->ping();
+  }
+  EXPECT_EQ(Continue::Continue, parallel.step());
+  EXPECT_EQ(1, batches());
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("exists");
+  query.fieldList.add("size");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  // Include deleted files in the results.
+  QueryContext ctx{&query, root, true};
+  parallel.view->pathGenerator(&query, &ctx);
+  std::map<std::string, std::pair<bool, json_int_t>> results;
+  for (auto& result : ctx.resultsArray) {
+    results[result.at(0).asCString()] = {
+        result.at(1).asBool(), result.at(2).asInt()};
+  }
+  EXPECT_EQ((std::pair<bool, json_int_t>{true, 10}), results["a"]);
+  EXPECT_EQ((std::pair<bool, json_int_t>{true, 0}), results["b"]);
+  EXPECT_EQ((std::pair<bool, json_int_t>{true, 30}), results["c"]);
+  // The failed stat was retried by statPath, which recorded the deletion.
+  EXPECT_EQ((std::pair<bool, json_int_t>{false, 0}), results["gone"]);
+}
+
+TEST_P(InMemoryViewTest, full_crawls_report_progress) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/1",
+      FAKEFS_ROOT "root/a/2",
+      FAKEFS_ROOT "root/b/3",
+  });
+
+  ConfiguredView progress{
+      *this, {{"crawl_progress_interval_ms", json_integer(0)}}};
+  auto& root = progress.root;
+  auto sub = root->crawlProgress->subscribe([] {});
+
+  auto crawl = [&] {
+    EXPECT_EQ(Continue::Continue, progress.step());
+    std::vector<std::shared_ptr<const Publisher::Item>> items;
+    sub->getPending(items);
+    std::vector<json_ref> reports;
+    for (auto& item : items) {
+      reports.push_back(item->payload.get("crawl-progress"));
+    }
+    return reports;
+  };
+
+  // One report as each dir is read, and a final one.
+  auto reports = crawl();
+  ASSERT_EQ(4, reports.size());
+  EXPECT_FALSE(reports[1].get("done").asBool());
+  EXPECT_FALSE(reports[1].get_optional("estimated_remaining_ms").has_value());
+  auto& last = reports.back();
+  EXPECT_TRUE(last.get("done").asBool());
+  EXPECT_EQ(3, last.get("dirs").asInt());
+  EXPECT_EQ(5, last.get("stats").asInt());
+  EXPECT_FALSE(last.get_optional("previous_stats").has_value());
+
+  // The next crawl is measured against this one.
+  root->scheduleRecrawl("test");
+  progress.pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, progress.step());
+  reports = crawl();
+  ASSERT_EQ(4, reports.size());
+  EXPECT_TRUE(reports[1].get_optional("estimated_remaining_ms").has_value());
+  EXPECT_EQ(5, reports[1].get("previous_stats").asInt());
+  EXPECT_EQ(5, reports.back().get("stats").asInt());
+}
+
+TEST_P(InMemoryViewTest, batch_evaluation_matches_per_file_evaluation) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/a/two.c",
+      FAKEFS_ROOT "root/b/three.txt",
+      FAKEFS_ROOT "root/b/sub/four.txt",
+      FAKEFS_ROOT "root/five.c",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto query = parseQuery(
+      root,
+      w_string_to_json(R"({
+        "fields": ["name"],
+        "expression": ["allof",
+          ["type", "f"],
+          ["anyof", ["suffix", "txt"], ["match", "five.*"]],
+          ["not", ["dirname", "b/sub"]]
+        ]
+      })"));
+
+  // allFilesGenerator evaluates a batch at a time,
+  QueryContext batchCtx{query.get(), root, false};
+  view->allFilesGenerator(query.get(), &batchCtx);
+  batchCtx.fetchEvalBatchNow();
+
+  // while timeGenerator evaluates one file at a time.
+  QueryContext fileCtx{query.get(), root, false};
+  fileCtx.since = QuerySince::Clock{false, 0};
+  view->timeGenerator(query.get(), &fileCtx);
+  fileCtx.fetchEvalBatchNow();
+
+  auto names = [](QueryContext& ctx) {
+    while (!ctx.fetchRenderBatchNow()) {
+    }
+    std::vector<w_string> names;
+    for (auto& result : ctx.resultsArray) {
+      names.push_back(result.asString());
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  };
+
+  std::vector<w_string> expected{"a/one.txt", "b/three.txt", "five.c"};
+  EXPECT_EQ(expected, names(batchCtx));
+  EXPECT_EQ(expected, names(fileCtx));
+}
+
+TEST_P(InMemoryViewTest, multiple_fields_render_as_bser_template) {
+  fs.defineContents({FAKEFS_ROOT "root/dir/file.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  QueryContext ctx{&query, root, false};
+  view->pathGenerator(&query, &ctx);
+  auto files = ctx.renderResults().toJson();
+
+  auto templ = json_array_get_template(files);
+  ASSERT_TRUE(templ);
+  EXPECT_EQ("[\"name\", \"size\"]", json_dumps(*templ, 0));
+
+  // The field names are sent once, rather than once per file
+  std::string encoded;
+  bser_ctx_t bser{
+      2, 0, [](const char* buffer, size_t size, void* data) {
+        static_cast<std::string*>(data)->append(buffer, size);
+        return 0;
+      }};
+  ASSERT_EQ(0, w_bser_dump(&bser, files, &encoded));
+  EXPECT_EQ(0x0b, encoded[0]);
+}
+
+TEST_P(InMemoryViewTest, since_queries_use_the_change_log) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/file.txt",
+      FAKEFS_ROOT "root/b/file.txt",
+  });
+
+  ConfiguredView changeLog{
+      *this, {{"change_log_max_files", json_integer(100)}}};
+  auto& root = changeLog.root;
+  // The initial crawl, then a settle, which starts the log.
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+
+  auto beforeChanges = changeLog.view->getMostRecentRootNumberAndTickValue();
+  auto change = [&](const char* path) {
+    fs.updateMetadata(path, [&](FileInformation& fi) { fi.size += 100; });
+    auto lock = changeLog.pending.lock();
+    lock->add(w_string{path}, {}, W_PENDING_VIA_NOTIFY);
+    lock->ping();
+  };
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  auto runQuery = [&] {
+    auto ctx = std::make_unique<QueryContext>(&query, root, false);
+    ctx->clockAtStartOfQuery =
+        ClockSpec(changeLog.view->getMostRecentRootNumberAndTickValue());
+    ctx->since = QuerySince::Clock{false, beforeChanges.ticks};
+    changeLog.view->timeGenerator(&query, ctx.get());
+    return ctx;
+  };
+
+  // Two settles' worth of changes, with one file changed in both.
+  change(FAKEFS_ROOT "root/a/file.txt");
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+  change(FAKEFS_ROOT "root/a/file.txt");
+  change(FAKEFS_ROOT "root/b/file.txt");
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+
+  auto ctx = runQuery();
+  ASSERT_EQ(2, ctx->resultsArray.size());
+  std::map<std::string, json_int_t> sizes;
+  for (auto& result : ctx->resultsArray) {
+    sizes[result.at(0).asString().string()] = result.at(1).asInt();
+  }
+  // The file that changed twice is reported once, as it is now.
+  EXPECT_EQ(200, sizes["a/file.txt"]);
+  EXPECT_EQ(100, sizes["b/file.txt"]);
+
+  // Changes that have yet to settle are not in the log, so the view is
+  // walked instead.
+  change(FAKEFS_ROOT "root/b/file.txt");
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+  ctx = runQuery();
+  ASSERT_EQ(2, ctx->resultsArray.size());
+  sizes.clear();
+  for (auto& result : ctx->resultsArray) {
+    sizes[result.at(0).asString().string()] = result.at(1).asInt();
+  }
+  EXPECT_EQ(200, sizes["b/file.txt"]);
+}
+
+TEST_P(InMemoryViewTest, change_log_records_unsettled_batches) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/file.txt",
+      FAKEFS_ROOT "root/b/file.txt",
+  });
+
+  ConfiguredView changeLog{
+      *this,
+      {{"change_log_max_files", json_integer(100)},
+       {"change_log_unsettled", json_true()}}};
+  auto& root = changeLog.root;
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+
+  auto beforeChanges = changeLog.view->getMostRecentRootNumberAndTickValue();
+  auto changeWithoutSettling = [&](const char* path) {
+    fs.updateMetadata(path, [&](FileInformation& fi) { fi.size += 100; });
+    {
+      auto lock = changeLog.pending.lock();
+      lock->add(w_string{path}, {}, W_PENDING_VIA_NOTIFY);
+      lock->ping();
+    }
+    EXPECT_EQ(Continue::Continue, changeLog.step());
+  };
+  auto logged = [&](const char* key) {
+    return changeLog.view->getViewDebugInfo().get(key).asInt();
+  };
+
+  changeWithoutSettling(FAKEFS_ROOT "root/a/file.txt");
+  changeWithoutSettling(FAKEFS_ROOT "root/b/file.txt");
+  EXPECT_EQ(2, logged("change_log_sets"));
+  EXPECT_EQ(2, logged("change_log_files"));
+
+  // The batches are in the log before the root settles.
+  Query query;
+  query.fieldList.add("name");
+  query.explain = true;
+  auto ctx = std::make_unique<QueryContext>(&query, root, false);
+  ctx->clockAtStartOfQuery =
+      ClockSpec(changeLog.view->getMostRecentRootNumberAndTickValue());
+  ctx->since = QuerySince::Clock{false, beforeChanges.ticks};
+  changeLog.view->timeGenerator(&query, ctx.get());
+  EXPECT_EQ(2, ctx->resultsArray.size());
+  EXPECT_EQ(std::vector<std::string_view>{"change_log"}, ctx->generators);
+
+  // And are merged into one set when it does.
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+  EXPECT_EQ(1, logged("change_log_sets"));
+  EXPECT_EQ(2, logged("change_log_files"));
+}
+
+TEST_P(InMemoryViewTest, change_log_merges_the_changes_made_during_a_state) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/file.txt",
+      FAKEFS_ROOT "root/b/file.txt",
+      FAKEFS_ROOT "root/c/file.txt",
+  });
+
+  ConfiguredView changeLog{
+      *this,
+      {{"change_log_max_files", json_integer(1)},
+       {"change_log_state_max_files", json_integer(100)}}};
+  auto& root = changeLog.root;
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+  EXPECT_EQ(Continue::Continue, changeLog.step());
+
+  auto beforeChanges = changeLog.view->getMostRecentRootNumberAndTickValue();
+  auto changeAndSettle = [&](std::vector<const char*> paths) {
+    for (auto* path : paths) {
+      fs.updateMetadata(path, [&](FileInformation& fi) { fi.size += 100; });
+      auto lock = changeLog.pending.lock();
+      lock->add(w_string{path}, {}, W_PENDING_VIA_NOTIFY);
+      lock->ping();
+    }
+    EXPECT_EQ(Continue::Continue, changeLog.step());
+    EXPECT_EQ(Continue::Continue, changeLog.step());
+  };
+  auto logged = [&](const char* key) {
+    return changeLog.view->getViewDebugInfo().get(key).asInt();
+  };
+
+  auto assertion = std::make_shared<ClientStateAssertion>(root, "hg.update");
+  root->assertedStates.wlock()->queueAssertion(assertion);
+
+  // Past change_log_max_files, but the state keeps every set.
+  changeAndSettle({FAKEFS_ROOT "root/a/file.txt"});
+  changeAndSettle(
+      {FAKEFS_ROOT "root/a/file.txt", FAKEFS_ROOT "root/b/file.txt"});
+  EXPECT_EQ(2, logged("change_log_sets"));
+  EXPECT_EQ(3, logged("change_log_files"));
+
+  // The first settle after the state merges them, once per file.
+  root->assertedStates.wlock()->removeAssertion(assertion);
+  changeAndSettle({FAKEFS_ROOT "root/c/file.txt"});
+  EXPECT_EQ(1, logged("change_log_sets"));
+  EXPECT_EQ(3, logged("change_log_files"));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  auto ctx = std::make_unique<QueryContext>(&query, root, false);
+  ctx->clockAtStartOfQuery =
+      ClockSpec(changeLog.view->getMostRecentRootNumberAndTickValue());
+  ctx->since = QuerySince::Clock{false, beforeChanges.ticks};
+  changeLog.view->timeGenerator(&query, ctx.get());
+  ASSERT_EQ(3, ctx->resultsArray.size());
+  std::map<std::string, json_int_t> sizes;
+  for (auto& result : ctx->resultsArray) {
+    sizes[result.at(0).asString().string()] = result.at(1).asInt();
+  }
+  EXPECT_EQ(200, sizes["a/file.txt"]);
+  EXPECT_EQ(100, sizes["b/file.txt"]);
+  EXPECT_EQ(100, sizes["c/file.txt"]);
+
+  // Back within change_log_max_files at the next settle.
+  changeAndSettle({FAKEFS_ROOT "root/b/file.txt"});
+  EXPECT_EQ(1, logged("change_log_sets"));
+  EXPECT_EQ(1, logged("change_log_files"));
+}
+
+TEST_P(InMemoryViewTest, vcs_lock_files_are_tracked_as_they_change) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/.hg/wlock",
+      FAKEFS_ROOT "root/file.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_FALSE(view->isVCSOperationInProgress());
+  // Found by the crawl of the root.
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_TRUE(view->isVCSOperationInProgress());
+
+  auto notify = [&](const char* path) {
+    auto lock = pending.lock();
+    lock->add(w_string{path}, {}, W_PENDING_VIA_NOTIFY);
+    lock->ping();
+  };
+
+  fs.removeRecursively(FAKEFS_ROOT "root/.hg/wlock");
+  notify(FAKEFS_ROOT "root/.hg/wlock");
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_FALSE(view->isVCSOperationInProgress());
+
+  // Other changes leave it alone.
+  fs.addNode(FAKEFS_ROOT "root/.git/index.lock", fs.fakeFile());
+  notify(FAKEFS_ROOT "root/file.txt");
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_FALSE(view->isVCSOperationInProgress());
+
+  // Found by the crawl of the new dir.
+  notify(FAKEFS_ROOT "root/.git");
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_TRUE(view->isVCSOperationInProgress());
+}
+
+TEST_P(InMemoryViewTest, recrawls_in_quick_succession_are_held_back) {
+  fs.defineContents({FAKEFS_ROOT "root/dir/file.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  // The first recrawl starts straight away.
+  root->scheduleRecrawl("test");
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_FALSE(root->inner.done_initial.load());
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_TRUE(root->inner.done_initial.load());
+
+  // One straight after it is held back, and the dirs that changed recently
+  // are recrawled instead.
+  root->scheduleRecrawl("test");
+  EXPECT_EQ(
+      std::chrono::milliseconds(1000), root->recrawlInfo.rlock()->backoff);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_TRUE(root->inner.done_initial.load());
+  {
+    auto info = root->recrawlInfo.rlock();
+    EXPECT_TRUE(info->shouldRecrawl);
+    EXPECT_FALSE(info->scopedRecoveryPending);
+    ASSERT_TRUE(info->scopedDirs.has_value());
+    EXPECT_EQ(2, *info->scopedDirs);
+  }
+
+  // Asking again during the backoff doesn't extend it.
+  root->scheduleRecrawl("test");
+  EXPECT_EQ(
+      std::chrono::milliseconds(1000), root->recrawlInfo.rlock()->backoff);
+  EXPECT_TRUE(root->recrawlInfo.rlock()->scopedRecoveryPending);
+}
+
+TEST_P(InMemoryViewTest, scm_changed_files_are_resolved_in_the_view) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/1",
+      FAKEFS_ROOT "root/a/2",
+      FAKEFS_ROOT "root/b/3",
+      FAKEFS_ROOT "root/top",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  // The view doesn't hear about this, so a synced query doesn't see it.
+  fs.updateMetadata(
+      FAKEFS_ROOT "root/a/1", [&](FileInformation& fi) { fi.size = 100; });
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("exists");
+  query.fieldList.add("size");
+  query.sync_timeout = std::chrono::milliseconds{60000};
+
+  auto run = [&] {
+    QueryContext ctx{&query, root, true};
+    view->scmChangedFilesGenerator(
+        &query,
+        &ctx,
+        {"b/3", "a/2", "top", "a/missing", "a/1"},
+        ClockStamp{1, 0});
+    std::map<std::string, std::pair<bool, json_int_t>> results;
+    for (auto& result : ctx.resultsArray) {
+      results[result.at(0).asString().string()] = {
+          result.at(1).asBool(), result.at(2).asInt()};
+    }
+    return results;
+  };
+
+  auto results = run();
+  EXPECT_EQ(5, results.size());
+  EXPECT_EQ((std::pair<bool, json_int_t>{true, 0}), results["a/1"]);
+  EXPECT_EQ((std::pair<bool, json_int_t>{true, 0}), results["top"]);
+  // Files that the view doesn't hold are looked up on disk.
+  EXPECT_EQ((std::pair<bool, json_int_t>{false, 0}), results["a/missing"]);
+
+  query.relative_root = w_string{FAKEFS_ROOT "root/a"};
+  query.relative_root_slash = w_string{FAKEFS_ROOT "root/a/"};
+  results = run();
+  EXPECT_EQ(3, results.size());
+  EXPECT_EQ(1, results.count("1"));
+  EXPECT_EQ(0, results.count("3"));
+}
+
+TEST_P(InMemoryViewTest, lazy_dirs_are_crawled_when_queried) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/a/deeper/two.txt",
+      FAKEFS_ROOT "root/b/three.txt",
+  });
+
+  ConfiguredView lazy{*this, {{"lazy_crawl_depth", json_integer(1)}}};
+  auto& root = lazy.root;
+  EXPECT_EQ(Continue::Continue, lazy.step());
+
+  auto allFiles = [&] {
+    Query query;
+    query.fieldList.add("name");
+    QueryContext ctx{&query, root, false};
+    lazy.view->allFilesGenerator(&query, &ctx);
+    std::vector<w_string> names;
+    for (auto& name : ctx.resultsArray) {
+      names.push_back(name.asString());
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  };
+
+  // Only the dirs below the root are known.
+  EXPECT_EQ((std::vector<w_string>{"a", "b"}), allFiles());
+
+  // A query within a blocks until the IO thread has crawled it.
+  Query query;
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"a/deeper", 1});
+  QueryContext ctx{&query, root, false};
+  std::atomic<bool> done{false};
+  std::thread queryThread{[&] {
+    lazy.view->pathGenerator(&query, &ctx);
+    done = true;
+  }};
+  while (!done) {
+    EXPECT_EQ(Continue::Continue, lazy.step());
+  }
+  queryThread.join();
+  ASSERT_EQ(1, ctx.resultsArray.size());
+  EXPECT_STREQ("a/deeper/two.txt", ctx.resultsArray.at(0).asCString());
+
+  // b is still left alone.
+  EXPECT_EQ(
+      (std::vector<w_string>{
+          "a", "a/deeper", "a/deeper/two.txt", "a/one.txt", "b"}),
+      allFiles());
+}
+
+TEST_P(InMemoryViewTest, idle_views_hibernate_and_wake_on_query) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/b/two.txt",
+  });
+
+  folly::test::TemporaryDirectory stateDir;
+  auto oldStateFile = flags.watchman_state_file;
+  flags.watchman_state_file = (stateDir.path() / "state").string();
+  SCOPE_EXIT {
+    flags.watchman_state_file = oldStateFile;
+  };
+
+  ConfiguredView idle{*this, {{"hibernate_idle_seconds", json_integer(60)}}};
+  auto& root = idle.root;
+  EXPECT_EQ(Continue::Continue, idle.step());
+  auto previousClock = idle.view->getMostRecentRootNumberAndTickValue();
+
+  // Nobody has asked about the root for an hour, so it hibernates once it
+  // settles.
+  root->inner.last_cmd_timestamp.store(
+      std::chrono::steady_clock::now() - std::chrono::hours(1));
+  idle.pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, idle.step());
+  EXPECT_TRUE(idle.view->getViewDebugInfo().get("hibernated").asBool());
+
+  // Changes are held back rather than waking it.
+  fs.updateMetadata(FAKEFS_ROOT "root/b/two.txt", [&](FileInformation& fi) {
+    fi.size = 100;
+  });
+  idle.pending.lock()->add(
+      FAKEFS_ROOT "root/b/two.txt", {}, W_PENDING_VIA_NOTIFY);
+  idle.pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, idle.step());
+  EXPECT_TRUE(idle.view->getViewDebugInfo().get("hibernated").asBool());
+
+  // A query restores the view, with the changes, before it is answered.
+  root->inner.last_cmd_timestamp.store(std::chrono::steady_clock::now());
+  Query query;
+  query.fieldList.add("name");
+  QueryContext ctx{&query, root, false};
+  ctx.since = QuerySince::Clock{false, previousClock.ticks};
+  std::atomic<bool> done{false};
+  std::thread queryThread{[&] {
+    idle.view->timeGenerator(&query, &ctx);
+    done = true;
+  }};
+  while (!done) {
+    EXPECT_EQ(Continue::Continue, idle.step());
+  }
+  queryThread.join();
+  EXPECT_FALSE(idle.view->getViewDebugInfo().get("hibernated").asBool());
+  EXPECT_EQ(1, idle.view->getViewDebugInfo().get("hibernations").asInt());
+  ASSERT_EQ(1, ctx.resultsArray.size());
+  EXPECT_STREQ("b/two.txt", ctx.resultsArray.at(0).asCString());
+}
+
+TEST_P(InMemoryViewTest, renamed_dirs_are_relocated_without_a_recrawl) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/sub/deep/file.txt",
+      FAKEFS_ROOT "root/a/sub/top.txt",
+      FAKEFS_ROOT "root/b/",
+  });
+
+  // Like inotify, which reports changes to each file and pairs renames.
+  auto moveWatcher =
+      std::make_shared<FakeWatcher>(fs, WATCHER_HAS_PER_FILE_NOTIFICATIONS);
+  ConfiguredView moving{*this, {}, moveWatcher};
+  auto& root = moving.root;
+  EXPECT_EQ(Continue::Continue, moving.step());
+  auto beforeMove = moving.view->getMostRecentRootNumberAndTickValue();
+
+  fs.rename(FAKEFS_ROOT "root/a/sub", FAKEFS_ROOT "root/b/moved");
+  // Not reported, so only a recrawl of the moved dir would find it.
+  fs.defineContents({FAKEFS_ROOT "root/b/moved/unreported.txt"});
+  {
+    auto lock = moving.pending.lock();
+    lock->add(w_string{FAKEFS_ROOT "root/a/sub"}, {}, W_PENDING_VIA_NOTIFY);
+    lock->addMove(
+        w_string{FAKEFS_ROOT "root/a/sub"},
+        w_string{FAKEFS_ROOT "root/b/moved"},
+        {});
+    lock->ping();
+  }
+  EXPECT_EQ(Continue::Continue, moving.step());
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("exists");
+  QueryContext ctx{&query, root, false};
+  ctx.since = QuerySince::Clock{false, beforeMove.ticks};
+  moving.view->timeGenerator(&query, &ctx);
+
+  std::map<std::string, bool> exists;
+  for (auto& result : ctx.resultsArray) {
+    exists[result.at(0).asString().string()] = result.at(1).asBool();
+  }
+  std::map<std::string, bool> expected{
+      {"a/sub", false},
+      {"a/sub/deep", false},
+      {"a/sub/deep/file.txt", false},
+      {"a/sub/top.txt", false},
+      {"b/moved", true},
+      {"b/moved/deep", true},
+      {"b/moved/deep/file.txt", true},
+      {"b/moved/top.txt", true},
+  };
+  EXPECT_EQ(expected, exists);
+}
+
+TEST_P(InMemoryViewTest, names_crawl_policy_defers_file_stats) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/two.txt",
+  });
+  fs.updateMetadata(FAKEFS_ROOT "root/a/one.txt", [](FileInformation& fi) {
+    fi.size = 42;
+  });
+
+  auto namesWatcher =
+      std::make_shared<FakeWatcher>(fs, WATCHER_HAS_PER_FILE_NOTIFICATIONS);
+  // The parallel crawler, when the fixture picks it, ignores the policy and
+  // stats every entry.
+  ConfiguredView namesOnly{
+      *this, {{"crawl_stat_policy", w_string_to_json("names")}}, namesWatcher};
+  auto& root = namesOnly.root;
+  EXPECT_EQ(Continue::Continue, namesOnly.step());
+
+  // Not reported, but the crawl never stat'd the file, so the stat that the
+  // query needs sees it.
+  fs.updateMetadata(FAKEFS_ROOT "root/a/one.txt", [](FileInformation& fi) {
+    fi.size = 7;
+  });
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("type");
+  query.fieldList.add("size");
+  QueryContext ctx{&query, root, false};
+  namesOnly.view->allFilesGenerator(&query, &ctx);
+  ctx.fetchEvalBatchNow();
+  while (!ctx.fetchRenderBatchNow()) {
+  }
+
+  std::map<std::string, std::pair<std::string, int64_t>> files;
+  for (auto& result : ctx.resultsArray) {
+    files[result.at(0).asString().string()] = {
+        result.at(1).asString().string(), result.at(2).asInt()};
+  }
+  EXPECT_EQ("d", files["a"].first);
+  EXPECT_EQ("f", files["a/one.txt"].first);
+  EXPECT_EQ(7, files["a/one.txt"].second);
+  EXPECT_EQ("f", files["two.txt"].first);
+}
+
+TEST_P(InMemoryViewTest, deleted_files_are_compacted_into_tombstones) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/one.txt",
+      FAKEFS_ROOT "root/dir/two.txt",
+      FAKEFS_ROOT "root/keep.txt",
+  });
+
+  ConfiguredView compact{*this, {{"compact_deleted_files", json_true()}}};
+  auto& root = compact.root;
+  auto stepAndSettle = [&] {
+    EXPECT_EQ(Continue::Continue, compact.step());
+    EXPECT_EQ(Continue::Continue, compact.step());
+  };
+  stepAndSettle();
+  auto beforeChanges = compact.view->getMostRecentRootNumberAndTickValue();
+
+  fs.removeRecursively(FAKEFS_ROOT "root/dir");
+  compact.pending.lock()->add(
+      FAKEFS_ROOT "root/dir",
+      {},
+      W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+  compact.pending.lock()->ping();
+  stepAndSettle();
+
+  const auto& viewdb = compact.view->unsafeAccessViewDatabase();
+  EXPECT_EQ(1, viewdb.getFileCount());
+  EXPECT_EQ(nullptr, viewdb.resolveDir(w_string{FAKEFS_ROOT "root/dir"}));
+  EXPECT_EQ(3, compact.view->getViewDebugInfo().get("tombstones").asInt());
+
+  auto changedSince = [&] {
+    Query query;
+    query.fieldList.add("name");
+    query.fieldList.add("exists");
+    QueryContext ctx{&query, root, false};
+    ctx.since = QuerySince::Clock{false, beforeChanges.ticks};
+    compact.view->timeGenerator(&query, &ctx);
+
+    std::map<std::string, bool> exists;
+    for (auto& result : ctx.resultsArray) {
+      auto name = result.at(0).asString().string();
+      EXPECT_TRUE(exists.emplace(name, result.at(1).asBool()).second) << name;
+    }
+    return exists;
+  };
+  EXPECT_EQ(
+      (std::map<std::string, bool>{
+          {"dir", false}, {"dir/one.txt", false}, {"dir/two.txt", false}}),
+      changedSince());
+
+  // A file that comes back is only reported as it is now.
+  fs.defineContents({FAKEFS_ROOT "root/dir/one.txt"});
+  compact.pending.lock()->add(
+      FAKEFS_ROOT "root/dir", {}, W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE);
+  compact.pending.lock()->ping();
+  stepAndSettle();
+  EXPECT_EQ(
+      (std::map<std::string, bool>{
+          {"dir", true}, {"dir/one.txt", true}, {"dir/two.txt", false}}),
+      changedSince());
+}
+
+TEST_P(InMemoryViewTest, dir_totals_answer_aggregate_queries) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/one.txt",
+      FAKEFS_ROOT "root/dir/sub/two.txt",
+      FAKEFS_ROOT "root/top.txt",
+  });
+  auto setSize = [&](const char* path, size_t size) {
+    fs.updateMetadata(path, [&](FileInformation& fi) { fi.size = size; });
+  };
+  setSize(FAKEFS_ROOT "root/dir/one.txt", 10);
+  setSize(FAKEFS_ROOT "root/dir/sub/two.txt", 20);
+  setSize(FAKEFS_ROOT "root/top.txt", 40);
+
+  ConfiguredView totals{*this, {{"dir_totals", json_true()}}};
+  auto& root = totals.root;
+  EXPECT_EQ(Continue::Continue, totals.step());
+
+  Query query;
+  query.aggregate = QueryAggregate{true, QueryAggregate::GroupBy::Dirname};
+
+  // The totals must agree with walking the files.
+  auto expectSameAsWalking = [&] {
+    QueryContext fromTotals{&query, root, false};
+    ASSERT_TRUE(totals.view->dirTotalsGenerator(&query, &fromTotals));
+    QueryContext walked{&query, root, false};
+    totals.view->allFilesGenerator(&query, &walked);
+    EXPECT_TRUE(
+        json_equal(walked.renderAggregate(), fromTotals.renderAggregate()))
+        << "totals differ from walking the files";
+  };
+
+  {
+    QueryContext ctx{&query, root, false};
+    ASSERT_TRUE(totals.view->dirTotalsGenerator(&query, &ctx));
+    auto result = ctx.renderAggregate();
+    // dir, sub and the three files
+    EXPECT_EQ(5, result.get("count").asInt());
+    EXPECT_EQ(70, result.get("size").asInt());
+    auto groups = result.get("groups");
+    EXPECT_EQ(2, groups.get("").get("count").asInt());
+    EXPECT_EQ(2, groups.get("dir").get("count").asInt());
+    EXPECT_EQ(1, groups.get("dir/sub").get("count").asInt());
+  }
+  expectSameAsWalking();
+
+  query.relative_root = w_string{FAKEFS_ROOT "root/dir"};
+  query.relative_root_slash = w_string{FAKEFS_ROOT "root/dir/"};
+  expectSameAsWalking();
+
+  fs.removeRecursively(FAKEFS_ROOT "root/dir/sub");
+  setSize(FAKEFS_ROOT "root/dir/one.txt", 15);
+  totals.pending.lock()->add(
+      FAKEFS_ROOT "root/dir", {}, W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE);
+  totals.pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, totals.step());
+  expectSameAsWalking();
+
+  query.relative_root = nullptr;
+  query.relative_root_slash = nullptr;
+  expectSameAsWalking();
+
+  // Grouping by suffix needs the names of the files
+  query.aggregate->group_by = QueryAggregate::GroupBy::Suffix;
+  QueryContext bySuffix{&query, root, false};
+  EXPECT_FALSE(totals.view->dirTotalsGenerator(&query, &bySuffix));
+
+  // Views that don't keep totals leave the query to be walked
+  query.aggregate->group_by = QueryAggregate::GroupBy::None;
+  QueryContext withoutTotals{&query, root, false};
+  EXPECT_FALSE(view->dirTotalsGenerator(&query, &withoutTotals));
+}
+
+TEST(ViewDatabaseTest, case_folded_children_follow_inserts_and_removals) {
+  FakeFileSystem fs;
+  FakeWatcher watcher{fs};
+  const w_string root_path{FAKEFS_ROOT "root"};
+  ViewDatabase db{root_path, true, false, /*foldCase=*/true};
+
+  auto dir = db.resolveDir(w_string::pathCat({root_path, "Src"}), true);
+  ASSERT_TRUE(dir->foldsCase());
+  auto file = db.getOrCreateChildFile(watcher, dir, w_string{"ReadMe.md"}, {});
+
+  std::vector<const watchman_dir*> dirs;
+  db.resolveDir(root_path)->forEachChildDirCaseless(
+      "sRC", [&](const watchman_dir* d) { dirs.push_back(d); });
+  EXPECT_EQ(std::vector<const watchman_dir*>{dir}, dirs);
+
+  std::vector<watchman_file*> files;
+  auto findReadme = [&] {
+    files.clear();
+    dir->forEachChildFileCaseless(
+        "README.MD", [&](watchman_file* f) { files.push_back(f); });
+  };
+  findReadme();
+  EXPECT_EQ(std::vector<watchman_file*>{file}, files);
+
+  // A rename that changes the case holds both names for a while.
+  auto renamed =
+      db.getOrCreateChildFile(watcher, dir, w_string{"README.md"}, {});
+  findReadme();
+  EXPECT_EQ(2, files.size());
+  db.removeFile(file);
+  findReadme();
+  EXPECT_EQ(std::vector<watchman_file*>{renamed}, files);
+
+  db.removeChildDir(db.resolveDir(root_path, false), "Src");
+  dirs.clear();
+  db.resolveDir(root_path)->forEachChildDirCaseless(
+      "src", [&](const watchman_dir* d) { dirs.push_back(d); });
+  EXPECT_TRUE(dirs.empty());
+}
+
+TEST(ViewDatabaseTest, children_are_not_case_folded_by_default) {
+  ViewDatabase db{w_string{FAKEFS_ROOT "root"}};
+  EXPECT_FALSE(db.resolveDir(w_string{FAKEFS_ROOT "root"})->foldsCase());
+}
+
+TEST(QueryContextTest, file_results_of_merged_workers_outlive_them) {
+  Query query;
+  QueryContext ctx{&query, nullptr, false};
+  auto make = [](QueryContext& c, const char* path) {
+    return c.makeFileResult<LocalFileResult>(
+        w_string{path},
+        ClockStamp{},
+        CaseSensitivity::CaseSensitive,
+        FileInformation::makeDeletedFileInformation(),
+        false);
+  };
+
+  std::vector<std::unique_ptr<FileResult>> held;
+  held.push_back(std::make_unique<LocalFileResult>(
+      w_string{FAKEFS_ROOT "heap"},
+      ClockStamp{},
+      CaseSensitivity::CaseSensitive,
+      FileInformation::makeDeletedFileInformation(),
+      false));
+  for (int i = 0; i < 1000; ++i) {
+    held.push_back(make(ctx, FAKEFS_ROOT "a"));
+  }
+  // Dropping results makes room for the next ones.
+  held.resize(10);
+  {
+    auto worker = ctx.makeWorkerContext();
+    held.push_back(make(*worker, FAKEFS_ROOT "b"));
+    ctx.mergeWorkerContext(std::move(*worker));
+  }
+  held.push_back(make(ctx, FAKEFS_ROOT "c"));
+
+  EXPECT_EQ(w_string_piece{"heap"}, held.front()->baseName());
+  EXPECT_EQ(w_string_piece{"a"}, held[1]->baseName());
+  EXPECT_EQ(w_string_piece{"b"}, held[10]->baseName());
+  EXPECT_EQ(w_string_piece{"c"}, held[11]->baseName());
+  EXPECT_EQ(std::optional<bool>{false}, held[10]->exists());
+}
+
 INSTANTIATE_TEST_CASE_P(
     InMemoryViewTests,
     InMemoryViewTest,
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <memory>
+#include <set>
+
+#include "watchman/IncrementalHashMap.h"
+
+using namespace watchman;
+
+namespace {
+
+using Map = IncrementalHashMap<int, std::unique_ptr<int>>;
+
+std::set<int> keysOf(const Map& map) {
+  std::set<int> keys;
+  for (auto& it : map) {
+    EXPECT_EQ(it.first, *it.second);
+    keys.insert(it.first);
+  }
+  return keys;
+}
+
+} // namespace
+
+TEST(IncrementalHashMapTest, inserts_finds_and_erases) {
+  Map map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.end(), map.find(1));
+
+  EXPECT_TRUE(map.emplace(1, std::make_unique<int>(1)).second);
+  EXPECT_FALSE(map.emplace(1, std::make_unique<int>(2)).second);
+  map[2] = std::make_unique<int>(2);
+  EXPECT_EQ(2, map.size());
+  EXPECT_EQ(1, *map.find(1)->second);
+  EXPECT_EQ((std::set<int>{1, 2}), keysOf(map));
+
+  EXPECT_EQ(1, map.erase(1));
+  EXPECT_EQ(0, map.erase(1));
+  EXPECT_EQ(map.end(), map.find(1));
+  EXPECT_EQ(1, map.size());
+}
+
+TEST(IncrementalHashMapTest, large_maps_rehash_over_several_insertions) {
+  Map map;
+  int n = 0;
+  while (!map.isRehashing()) {
+    map.emplace(n, std::make_unique<int>(n));
+    ++n;
+  }
+  EXPECT_GE(n, int(Map::kIncrementalBuckets));
+
+  // Every entry can be found, and is visited once, while they are moved.
+  int insertions = 0;
+  while (map.isRehashing()) {
+    map.emplace(n, std::make_unique<int>(n));
+    ++n;
+    ++insertions;
+    if (insertions % 16 == 0) {
+      for (int i = 0; i < n; ++i) {
+        ASSERT_NE(map.end(), map.find(i)) << i;
+      }
+      EXPECT_EQ(size_t(n), keysOf(map).size());
+    }
+  }
+  EXPECT_GT(insertions, 1);
+  EXPECT_EQ(size_t(n), map.size());
+  EXPECT_EQ(size_t(n), keysOf(map).size());
+}
+
+TEST(IncrementalHashMapTest, entries_erased_while_rehashing_are_gone) {
+  Map map;
+  int n = 0;
+  while (!map.isRehashing()) {
+    map.emplace(n, std::make_unique<int>(n));
+    ++n;
+  }
+  for (int i = 0; i < n; i += 2) {
+    EXPECT_EQ(1, map.erase(i));
+  }
+  EXPECT_EQ(size_t(n / 2), map.size());
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(i % 2 == 1, map.find(i) != map.end()) << i;
+  }
+}
+
+TEST(IncrementalHashMapTest, erasing_through_an_iterator_continues_the_walk) {
+  Map map;
+  for (int i = 0; i < 100; ++i) {
+    map.emplace(i, std::make_unique<int>(i));
+  }
+  size_t visited = 0;
+  for (auto it = map.begin(); it != map.end();) {
+    ++visited;
+    if (it->first % 3 == 0) {
+      it = map.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  EXPECT_EQ(100, visited);
+  EXPECT_EQ(66, map.size());
+}
+
+TEST(IncrementalHashMapTest, references_survive_rehashing) {
+  Map map;
+  auto& first = map[0];
+  first = std::make_unique<int>(0);
+  for (int i = 1; i < 3 * int(Map::kIncrementalBuckets); ++i) {
+    map.emplace(i, std::make_unique<int>(i));
+  }
+  EXPECT_EQ(&first, &map.find(0)->second);
+}
@@ -6,6 +6,7 @@
  */
 
 #include <benchmark/benchmark.h>
+#include <fmt/core.h>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 namespace {
@@ -50,6 +51,59 @@ void encode_zero_point_zero(benchmark::State& state) {
 }
 BENCHMARK(encode_zero_point_zero);
 
+// Names like those in the results of a query over a large tree.
+std::vector<json_ref> make_file_names(size_t n) {
+  std::vector<json_ref> names;
+  names.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    names.push_back(typed_string_to_json(
+        fmt::format(
+            "fbcode/some/project/directory{}/source_file_{}.cpp", i % 97, i)
+            .c_str(),
+        W_STRING_BYTE));
+  }
+  return names;
+}
+
+void encode_file_names(benchmark::State& state) {
+  json_ref array = json_array(make_file_names(10000));
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(json_dumps(array, JSON_COMPACT));
+  }
+}
+BENCHMARK(encode_file_names);
+
+void encode_query_result_rows(benchmark::State& state) {
+  auto names = make_file_names(10000);
+
+  // Rows of values in the order of the template, as a query renders them
+  std::vector<json_ref> rows;
+  rows.reserve(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    rows.push_back(json_array(
+        {names[i],
+         json_boolean(true),
+         json_boolean(false),
+         json_integer(i * 4096),
+         json_integer(0100644)}));
+  }
+  json_ref array = json_array(std::move(rows));
+  json_array_set_template_new(
+      array,
+      json_array(
+          {typed_string_to_json("name", W_STRING_UNICODE),
+           typed_string_to_json("exists", W_STRING_UNICODE),
+           typed_string_to_json("new", W_STRING_UNICODE),
+           typed_string_to_json("size", W_STRING_UNICODE),
+           typed_string_to_json("mode", W_STRING_UNICODE)}));
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(json_dumps(array, JSON_COMPACT));
+  }
+}
+BENCHMARK(encode_query_result_rows);
+
 void decode_doubles(benchmark::State& state) {
   // 3.7 ^ 500 still fits in a double.
   constexpr size_t N = 500;
@@ -55,4 +55,58 @@ TEST(JsonTest, double_round_trip) {
   }
 }
 
+TEST(JsonTest, string_escapes) {
+  auto dump = [](const char* str, size_t flags = 0) {
+    return json_dumps(
+        typed_string_to_json(str, W_STRING_BYTE),
+        JSON_ENCODE_ANY | JSON_COMPACT | flags);
+  };
+  EXPECT_EQ("\"some/long/path/name.txt\"", dump("some/long/path/name.txt"));
+  EXPECT_EQ(
+      "\"a long \\\"quoted\\\" name\\twith\\\\escapes\\n\"",
+      dump("a long \"quoted\" name\twith\\escapes\n"));
+  EXPECT_EQ("\"\\u0001\\u001f\"", dump("\x01\x1f"));
+  EXPECT_EQ("\"a\\/b\"", dump("a/b", JSON_ESCAPE_SLASH));
+  EXPECT_EQ("\"caf\xc3\xa9 names\"", dump("caf\xc3\xa9 names"));
+  EXPECT_EQ(
+      "\"caf\\u00e9 \\ud83d\\ude00\"",
+      dump("caf\xc3\xa9 \xf0\x9f\x98\x80", JSON_ENSURE_ASCII));
+  // Invalid UTF-8 cannot be encoded
+  EXPECT_THROW(dump("abcdefgh\xff"), std::runtime_error);
+}
+
+TEST(JsonTest, small_objects_keep_insertion_order) {
+  auto obj = json_object({{"name", json_integer(1)}, {"exists", json_true()}});
+  obj.set("size", json_integer(3));
+  obj.set("name", json_integer(4));
+  EXPECT_EQ(3, json_object_size(obj));
+  EXPECT_EQ(
+      "{\"name\":4,\"exists\":true,\"size\":3}",
+      json_dumps(obj, JSON_COMPACT));
+  EXPECT_EQ(4, obj.get("name").asInt());
+  EXPECT_FALSE(obj.get_optional("missing"));
+  EXPECT_THROW(obj.object().at("missing"), std::out_of_range);
+}
+
+TEST(JsonTest, large_objects_are_indexed) {
+  auto obj = json_object();
+  constexpr size_t kKeys = json_object_map::kIndexThreshold * 4;
+  for (size_t i = 0; i < kKeys; ++i) {
+    obj.set(w_string{fmt::format("key{}", i)}, json_integer(i));
+  }
+  obj.set("key7", json_integer(-7));
+  EXPECT_EQ(kKeys, json_object_size(obj));
+  for (size_t i = 0; i < kKeys; ++i) {
+    auto key = fmt::format("key{}", i);
+    EXPECT_EQ(i == 7 ? -7 : json_int_t(i), obj.get(key.c_str()).asInt());
+  }
+
+  // Copies get their own index.
+  auto copy = json_deep_copy(obj);
+  EXPECT_TRUE(json_equal(obj, copy));
+  copy.set("extra", json_null());
+  EXPECT_EQ(1, copy.object().count("extra"));
+  EXPECT_EQ(0, obj.object().count("extra"));
+}
+
 } // namespace
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <string>
+#include <vector>
+
+#include "watchman/LineSplitter.h"
+
+using namespace watchman;
+
+namespace {
+
+std::vector<std::string> splitChunks(
+    char separator,
+    const std::vector<std::string>& chunks) {
+  std::vector<std::string> lines;
+  LineSplitter splitter{separator, [&](w_string_piece line) {
+                          lines.emplace_back(line.data(), line.size());
+                        }};
+  for (auto& chunk : chunks) {
+    splitter.feed(w_string_piece{chunk.data(), chunk.size()});
+  }
+  splitter.finish();
+  return lines;
+}
+
+} // namespace
+
+TEST(LineSplitterTest, splits_a_single_chunk) {
+  EXPECT_EQ(
+      (std::vector<std::string>{"a", "bc", "def"}),
+      splitChunks('\n', {"a\nbc\ndef\n"}));
+}
+
+TEST(LineSplitterTest, joins_lines_that_span_chunks) {
+  EXPECT_EQ(
+      (std::vector<std::string>{"abc", "de", "f"}),
+      splitChunks('\n', {"a", "b", "c\nd", "e\n", "f\n"}));
+}
+
+TEST(LineSplitterTest, passes_on_the_unterminated_remainder) {
+  EXPECT_EQ(
+      (std::vector<std::string>{"a", "bc"}),
+      splitChunks('\0', {std::string{"a\0b", 3}, "c"}));
+}
+
+TEST(LineSplitterTest, keeps_empty_lines_but_not_an_empty_remainder) {
+  EXPECT_EQ(
+      (std::vector<std::string>{"", "a", ""}),
+      splitChunks('\n', {"\na\n", "\n"}));
+  EXPECT_EQ((std::vector<std::string>{}), splitChunks('\n', {"", ""}));
+}
@@ -8,12 +8,64 @@
 #include "watchman/saved_state/LocalSavedStateInterface.h"
 #include <folly/portability/GTest.h>
 #include <folly/test/TestUtils.h>
+#include <folly/portability/SysStat.h>
+#include <folly/portability/Unistd.h>
+#include <folly/testing/TestUtil.h>
+#include <algorithm>
+#include <fstream>
 #include "watchman/Errors.h"
+#include "watchman/scm/SCM.h"
 #include "watchman/test/lib/FakeFileSystem.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 
 using namespace watchman;
 
+namespace {
+
+// Only knows the history that saved state lookups ask for.
+class FakeSCM : public SCM {
+ public:
+  explicit FakeSCM(std::vector<w_string> history)
+      : SCM("/repo", "/repo"), history_(std::move(history)) {}
+
+  w_string mergeBaseWith(w_string_piece, w_string) const override {
+    return history_.front();
+  }
+  std::vector<w_string> getFilesChangedSinceMergeBaseWith(
+      w_string_piece,
+      w_string_piece,
+      w_string) const override {
+    return {};
+  }
+  StatusResult getFilesChangedBetweenCommits(
+      std::vector<std::string>,
+      w_string,
+      bool) const override {
+    return {};
+  }
+  std::chrono::time_point<std::chrono::system_clock> getCommitDate(
+      w_string_piece,
+      w_string) const override {
+    return {};
+  }
+  std::vector<w_string> getCommitsPriorToAndIncluding(
+      w_string_piece,
+      int numCommits,
+      w_string) const override {
+    return {
+        history_.begin(),
+        history_.begin() + std::min(size_t(numCommits), history_.size())};
+  }
+  std::vector<w_string> getParentStateFiles() const override {
+    return {};
+  }
+
+ private:
+  std::vector<w_string> history_;
+};
+
+} // namespace
+
 void expect_query_parse_error(
     const json_ref& config,
     const char* expectedError) {
@@ -137,3 +189,45 @@ TEST(LocalSavedStateInterfaceTest, path) {
   expectedPath = FAKEFS_ROOT "absolute/path/foo/hash_meta";
   EXPECT_EQ(path, expectedPath);
 }
+
+TEST(LocalSavedStateInterfaceTest, finds_saved_states_added_later) {
+  folly::test::TemporaryDirectory dir;
+  auto storage = w_string{dir.path().string()};
+  auto project = w_string::pathCat({storage, "foo"});
+  ASSERT_EQ(0, mkdir(project.c_str(), 0700));
+  std::ofstream{w_string::pathCat({project, "a"}).c_str()};
+
+  FakeSCM scm{{"c", "b", "a"}};
+  LocalSavedStateInterface interface(
+      json_object(
+          {{"local-storage-path", w_string_to_json(storage)},
+           {"project", w_string_to_json("foo")}}),
+      &scm);
+  EXPECT_EQ(w_string{"a"}, interface.getMostRecentSavedState("c").commitId);
+
+  std::ofstream{w_string::pathCat({project, "b"}).c_str()};
+  EXPECT_EQ(w_string{"b"}, interface.getMostRecentSavedState("c").commitId);
+}
+
+TEST(LocalSavedStateInterfaceTest, reuses_prefetched_saved_state) {
+  folly::test::TemporaryDirectory dir;
+  auto storage = w_string{dir.path().string()};
+  auto project = w_string::pathCat({storage, "foo"});
+  ASSERT_EQ(0, mkdir(project.c_str(), 0700));
+  auto statePath = w_string::pathCat({project, "b"});
+  std::ofstream{statePath.c_str()};
+
+  FakeSCM scm{{"c", "b", "a"}};
+  LocalSavedStateInterface interface(
+      json_object(
+          {{"local-storage-path", w_string_to_json(storage)},
+           {"project", w_string_to_json("foo")},
+           {"max-commits", json_integer(3)}}),
+      &scm);
+  interface.prefetchMostRecentSavedState("c");
+
+  // Until the prefetched result expires, it is returned as it was found.
+  ASSERT_EQ(0, unlink(statePath.c_str()));
+  EXPECT_EQ(w_string{"b"}, interface.getMostRecentSavedState("c").commitId);
+  EXPECT_EQ(w_string{}, interface.getMostRecentSavedState("b").commitId);
+}
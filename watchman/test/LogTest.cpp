@@ -5,7 +5,10 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/FileUtil.h>
 #include <folly/portability/GTest.h>
+#include <folly/portability/Unistd.h>
+#include <folly/testing/TestUtil.h>
 #include "watchman/Logging.h"
 
 using namespace watchman;
@@ -30,5 +33,31 @@ TEST(Log, logging) {
   EXPECT_TRUE(logged);
 }
 
+TEST(Log, background_writer_limits_debug_lines) {
+  folly::test::TemporaryFile file;
+  int savedStdErr = dup(STDERR_FILENO);
+  dup2(file.fd(), STDERR_FILENO);
+
+  getLog().setStdErrLoggingLevel(DBG);
+  getLog().startStdErrWriter(2);
+  for (int i = 0; i < 10; ++i) {
+    logf(DBG, "debug {}\n", i);
+  }
+  logf(ERR, "error\n");
+  getLog().stopStdErrWriter();
+  getLog().setStdErrLoggingLevel(ERR);
+
+  dup2(savedStdErr, STDERR_FILENO);
+  close(savedStdErr);
+
+  std::string output;
+  ASSERT_TRUE(folly::readFile(file.path().c_str(), output));
+  EXPECT_NE(std::string::npos, output.find("debug 0\n"));
+  EXPECT_NE(std::string::npos, output.find("debug 1\n"));
+  EXPECT_EQ(std::string::npos, output.find("debug 9\n"));
+  EXPECT_NE(std::string::npos, output.find("error\n"));
+  EXPECT_NE(std::string::npos, output.find("dropped"));
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MaintenanceScheduler.h"
+#include <folly/portability/GTest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "watchman/ThreadPool.h"
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+MaintenanceScheduler::Options options(
+    std::chrono::milliseconds maxDeferral = std::chrono::hours(1)) {
+  MaintenanceScheduler::Options options;
+  options.interval = 10ms;
+  options.idleQueriesPerSecond = 0;
+  options.idleEventsPerSecond = 0;
+  options.maxConcurrent = 2;
+  options.maxDeferral = maxDeferral;
+  return options;
+}
+
+// Makes count tasks that each increment ran.
+std::vector<MaintenanceScheduler::Task> countingTasks(
+    size_t count,
+    std::atomic<size_t>& ran) {
+  std::vector<MaintenanceScheduler::Task> tasks;
+  for (size_t i = 0; i < count; ++i) {
+    tasks.emplace_back([&] { ++ran; });
+  }
+  return tasks;
+}
+
+template <typename Pred>
+bool waitFor(Pred pred) {
+  auto deadline = std::chrono::steady_clock::now() + 10s;
+  while (!pred()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    /* sleep override */ std::this_thread::sleep_for(5ms);
+  }
+  return true;
+}
+
+} // namespace
+
+TEST(MaintenanceScheduler, is_disabled_without_an_interval) {
+  MaintenanceScheduler scheduler{MaintenanceScheduler::Options{}};
+  EXPECT_FALSE(scheduler.enabled());
+}
+
+TEST(MaintenanceScheduler, idle_until_traffic_exceeds_the_limits) {
+  auto opts = options();
+  opts.idleQueriesPerSecond = 2;
+  opts.idleEventsPerSecond = 100;
+  MaintenanceScheduler scheduler{opts};
+  auto now = MaintenanceScheduler::Clock::now();
+
+  EXPECT_TRUE(scheduler.isIdle(now - 1s, now));
+  scheduler.noteQuery();
+  scheduler.noteQuery();
+  EXPECT_TRUE(scheduler.isIdle(now - 1s, now));
+  scheduler.noteQuery();
+  EXPECT_FALSE(scheduler.isIdle(now - 1s, now));
+  // The same queries over a longer period are a lower rate
+  EXPECT_TRUE(scheduler.isIdle(now - 2s, now));
+  // Less than a second counts as a second
+  EXPECT_FALSE(scheduler.isIdle(now - 1ms, now));
+
+  scheduler.noteEvents(1000);
+  EXPECT_FALSE(scheduler.isIdle(now - 2s, now));
+  EXPECT_TRUE(scheduler.isIdle(now - 10s, now));
+}
+
+TEST(MaintenanceScheduler, runs_every_task_a_few_at_a_time) {
+  ThreadPool pool;
+  pool.start(4, 1024);
+  MaintenanceScheduler scheduler{options()};
+
+  std::atomic<size_t> ran{0};
+  std::atomic<size_t> running{0};
+  std::atomic<size_t> mostRunning{0};
+  scheduler.start(pool, [&] {
+    std::vector<MaintenanceScheduler::Task> tasks;
+    for (int i = 0; i < 6; ++i) {
+      tasks.emplace_back([&] {
+        auto now = ++running;
+        auto most = mostRunning.load();
+        while (now > most && !mostRunning.compare_exchange_weak(most, now)) {
+        }
+        /* sleep override */ std::this_thread::sleep_for(20ms);
+        --running;
+        ++ran;
+      });
+    }
+    return tasks;
+  });
+
+  EXPECT_TRUE(waitFor([&] { return scheduler.passes() > 0; }));
+  scheduler.stop();
+  EXPECT_GE(ran.load(), 6u);
+  EXPECT_LE(mostRunning.load(), 2u);
+}
+
+TEST(MaintenanceScheduler, traffic_defers_maintenance) {
+  ThreadPool pool;
+  pool.start(2, 1024);
+  auto opts = options();
+  // Long enough that the client always notes a query within it
+  opts.interval = 50ms;
+  MaintenanceScheduler scheduler{opts};
+
+  std::atomic<bool> busy{true};
+  std::thread client([&] {
+    while (busy) {
+      scheduler.noteQuery();
+      /* sleep override */ std::this_thread::sleep_for(1ms);
+    }
+  });
+
+  std::atomic<size_t> ran{0};
+  scheduler.start(pool, [&] { return countingTasks(3, ran); });
+  EXPECT_TRUE(waitFor([&] { return scheduler.deferrals() >= 5; }));
+  EXPECT_EQ(0u, ran.load());
+
+  busy = false;
+  client.join();
+  EXPECT_TRUE(waitFor([&] { return ran.load() >= 3u; }));
+  scheduler.stop();
+}
+
+TEST(MaintenanceScheduler, overdue_maintenance_runs_despite_traffic) {
+  ThreadPool pool;
+  pool.start(2, 1024);
+  MaintenanceScheduler scheduler{options(50ms)};
+
+  std::atomic<bool> busy{true};
+  std::thread client([&] {
+    while (busy) {
+      scheduler.noteQuery();
+      /* sleep override */ std::this_thread::sleep_for(1ms);
+    }
+  });
+
+  std::atomic<size_t> ran{0};
+  scheduler.start(pool, [&] { return countingTasks(3, ran); });
+  EXPECT_TRUE(waitFor([&] { return scheduler.passes() > 0; }));
+  EXPECT_GE(ran.load(), 3u);
+
+  busy = false;
+  client.join();
+  scheduler.stop();
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Metrics.h"
+#include <folly/portability/GTest.h>
+#include <stdexcept>
+#include <string>
+
+using namespace watchman;
+
+// The metrics are process-wide, so each test uses its own names.
+
+TEST(Metrics, counters_add_up) {
+  auto& counter = getCounter("test_counted_total", "counted");
+  counter.add();
+  counter.add(2);
+  EXPECT_EQ(3, counter.value());
+  EXPECT_EQ(&counter, &getCounter("test_counted_total", "counted"));
+}
+
+TEST(Metrics, values_land_in_power_of_two_buckets) {
+  auto& histogram = getHistogram("test_buckets", "buckets");
+  for (uint64_t value : {0, 1, 2, 3, 4, 5, 1024}) {
+    histogram.record(value);
+  }
+  histogram.record(uint64_t(1) << 40);
+
+  auto snapshot = histogram.snapshot();
+  EXPECT_EQ(8, snapshot.count);
+  EXPECT_EQ(1039 + (uint64_t(1) << 40), snapshot.sum);
+  // 0 and 1
+  EXPECT_EQ(2, snapshot.buckets[0]);
+  // 2
+  EXPECT_EQ(1, snapshot.buckets[1]);
+  // 3 and 4
+  EXPECT_EQ(2, snapshot.buckets[2]);
+  // 5
+  EXPECT_EQ(1, snapshot.buckets[3]);
+  // 1024
+  EXPECT_EQ(1, snapshot.buckets[10]);
+  // 2^40 is past the last bound.
+  EXPECT_EQ(1, snapshot.buckets[Histogram::kNumBuckets - 1]);
+}
+
+TEST(Metrics, records_durations_in_microseconds) {
+  auto& histogram = getHistogram("test_durations_us", "durations");
+  histogram.recordMicros(std::chrono::milliseconds(3));
+  histogram.recordMicros(std::chrono::microseconds(-5));
+  EXPECT_EQ(3000, histogram.snapshot().sum);
+  EXPECT_EQ(1, histogram.snapshot().buckets[0]);
+}
+
+TEST(Metrics, a_name_has_one_kind) {
+  getCounter("test_kind_total", "kind");
+  EXPECT_THROW(getHistogram("test_kind_total", "kind"), std::logic_error);
+}
+
+TEST(Metrics, json_lists_the_used_buckets) {
+  getCounter("test_json_total", "json").add(7);
+  auto& histogram = getHistogram("test_json", "json");
+  histogram.record(3);
+  histogram.record(4);
+
+  auto metrics = metricsToJson();
+  EXPECT_EQ(7, metrics.get("counters").get("test_json_total").asInt());
+
+  auto& json = metrics.get("histograms").get("test_json");
+  EXPECT_EQ(2, json.get("count").asInt());
+  EXPECT_EQ(7, json.get("sum").asInt());
+  auto& buckets = json.get("buckets").array();
+  ASSERT_EQ(1, buckets.size());
+  EXPECT_EQ(4, buckets[0].at(0).asInt());
+  EXPECT_EQ(2, buckets[0].at(1).asInt());
+}
+
+TEST(Metrics, openmetrics_buckets_are_cumulative) {
+  getCounter("test_text_lines_total", "Some text").add(2);
+  auto& histogram = getHistogram("test_text", "More text");
+  histogram.record(1);
+  histogram.record(3);
+  histogram.record(uint64_t(1) << 40);
+
+  auto text = metricsToOpenMetrics();
+  auto contains = [&](const char* line) {
+    return text.find(line) != std::string::npos;
+  };
+  EXPECT_TRUE(contains("# TYPE test_text_lines counter\n"));
+  EXPECT_TRUE(contains("# HELP test_text_lines Some text\n"));
+  EXPECT_TRUE(contains("test_text_lines_total 2\n"));
+  EXPECT_TRUE(contains("# TYPE test_text histogram\n"));
+  EXPECT_TRUE(contains("test_text_bucket{le=\"1\"} 1\n"));
+  EXPECT_TRUE(contains("test_text_bucket{le=\"2\"} 1\n"));
+  EXPECT_TRUE(contains("test_text_bucket{le=\"4\"} 2\n"));
+  EXPECT_TRUE(contains("test_text_bucket{le=\"+Inf\"} 3\n"));
+  EXPECT_TRUE(contains("test_text_count 3\n"));
+  EXPECT_TRUE(contains("test_text_sum 1099511627780\n"));
+  EXPECT_EQ(text.size() - 6, text.rfind("# EOF\n"));
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+
+#include "watchman/PathComponentTable.h"
+
+using namespace watchman;
+
+TEST(PathComponentTableTest, equal_components_share_storage) {
+  PathComponentTable table;
+  auto a = table.intern("node_modules");
+  auto b = table.intern(w_string{"node_modules"});
+  EXPECT_EQ(a.data(), b.data());
+  EXPECT_EQ(1, table.size());
+
+  auto c = table.intern("src");
+  EXPECT_NE(a.data(), c.data());
+  EXPECT_EQ(2, table.size());
+}
+
+TEST(PathComponentTableTest, prune_releases_unreferenced_components) {
+  PathComponentTable table;
+  auto kept = table.intern("kept");
+  table.intern("dropped");
+  EXPECT_EQ(2, table.size());
+
+  EXPECT_EQ(1, table.prune());
+  EXPECT_EQ(1, table.size());
+  EXPECT_EQ(kept.data(), table.intern("kept").data());
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+#include "watchman/PendingCollection.h"
+
+// Measures how quickly the pending collection takes in storms of events, as
+// the notify thread hands them to the IO thread.
+
+namespace {
+
+using namespace watchman;
+
+struct Event {
+  w_string path;
+  PendingFlags flags;
+};
+
+struct Storm {
+  // Each path is reported this many times, spread through the storm.
+  size_t repeats;
+  // One event in this many is a recursive change to a directory, which
+  // obsoletes the changes below it.
+  size_t recursiveEvery;
+  // Directories have this many subdirectories, so fewer share more of their
+  // prefixes.
+  size_t fanout;
+  size_t maxDepth;
+};
+
+constexpr Storm kUniqueFiles{1, 0, 16, 8};
+constexpr Storm kRepeatedFiles{8, 0, 16, 8};
+constexpr Storm kRecursiveDirs{1, 100, 16, 8};
+constexpr Storm kDeepPrefixes{1, 0, 2, 20};
+
+std::vector<Event> makeEvents(const Storm& storm, size_t count) {
+  std::mt19937 rng{0};
+  std::uniform_int_distribution<size_t> depthDist{1, storm.maxDepth};
+  std::uniform_int_distribution<size_t> dirDist{0, storm.fanout - 1};
+
+  std::vector<Event> events;
+  events.reserve(count);
+  size_t serial = 0;
+  while (events.size() < count) {
+    std::string dir = "/root";
+    auto depth = depthDist(rng);
+    for (size_t i = 0; i < depth; ++i) {
+      fmt::format_to(std::back_inserter(dir), "/dir{}", dirDist(rng));
+    }
+    if (storm.recursiveEvery && serial % storm.recursiveEvery == 0) {
+      events.push_back(
+          Event{w_string{std::string_view{dir}}, W_PENDING_RECURSIVE});
+    } else {
+      auto path = fmt::format("{}/file{}.cpp", dir, serial);
+      for (size_t i = 0; i < storm.repeats && events.size() < count; ++i) {
+        events.push_back(
+            Event{w_string{std::string_view{path}}, W_PENDING_VIA_NOTIFY});
+      }
+    }
+    ++serial;
+  }
+  std::shuffle(events.begin(), events.end(), rng);
+  return events;
+}
+
+const std::vector<Event>& getEvents(const Storm& storm, size_t count) {
+  // Generating millions of paths takes longer than adding them, so each storm
+  // is made once.
+  static std::map<std::pair<const Storm*, size_t>, std::vector<Event>> cache;
+  auto& events = cache[{&storm, count}];
+  if (events.empty()) {
+    events = makeEvents(storm, count);
+  }
+  return events;
+}
+
+void sizes(benchmark::internal::Benchmark* benchmark) {
+  benchmark->Arg(1000000)->Arg(4000000)->Unit(benchmark::kMillisecond);
+}
+
+// The cost of adding, including consolidating repeated paths and pruning
+// those below recursive changes.
+void add_events(benchmark::State& state, const Storm* storm) {
+  auto& events = getEvents(*storm, state.range(0));
+  auto now = std::chrono::system_clock::now();
+  size_t items = 0;
+  for (auto _ : state) {
+    PendingChanges changes;
+    for (auto& event : events) {
+      changes.add(event.path, now, event.flags);
+    }
+    items = changes.getPendingItemCount();
+
+    state.PauseTiming();
+    changes.clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * events.size());
+  state.counters["items"] = double(items);
+  state.counters["consolidated"] = double(events.size() - items);
+}
+BENCHMARK_CAPTURE(add_events, unique_files, &kUniqueFiles)->Apply(sizes);
+BENCHMARK_CAPTURE(add_events, repeated_files, &kRepeatedFiles)->Apply(sizes);
+BENCHMARK_CAPTURE(add_events, recursive_dirs, &kRecursiveDirs)->Apply(sizes);
+BENCHMARK_CAPTURE(add_events, deep_prefixes, &kDeepPrefixes)->Apply(sizes);
+
+// A producer that adds batches to the shared collection under its lock,
+// reporting how long the lock is held for each batch.
+void locked_add(benchmark::State& state, const Storm* storm) {
+  constexpr size_t kBatch = 1024;
+  auto& events = getEvents(*storm, state.range(0));
+  auto now = std::chrono::system_clock::now();
+  std::chrono::nanoseconds held{0};
+  std::chrono::nanoseconds maxHeld{0};
+  size_t batches = 0;
+  for (auto _ : state) {
+    PendingCollection collection;
+    for (size_t start = 0; start < events.size(); start += kBatch) {
+      auto end = std::min(events.size(), start + kBatch);
+      auto lockStart = std::chrono::steady_clock::now();
+      {
+        auto locked = collection.lock();
+        for (size_t i = start; i < end; ++i) {
+          locked->add(events[i].path, now, events[i].flags);
+        }
+      }
+      auto hold = std::chrono::steady_clock::now() - lockStart;
+      held += hold;
+      maxHeld = std::max<std::chrono::nanoseconds>(maxHeld, hold);
+      ++batches;
+    }
+
+    state.PauseTiming();
+    collection.lock()->clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * events.size());
+  state.counters["lock_hold_us_avg"] =
+      std::chrono::duration<double, std::micro>(held).count() / batches;
+  state.counters["lock_hold_us_max"] =
+      std::chrono::duration<double, std::micro>(maxHeld).count();
+}
+BENCHMARK_CAPTURE(locked_add, unique_files, &kUniqueFiles)->Apply(sizes);
+BENCHMARK_CAPTURE(locked_add, recursive_dirs, &kRecursiveDirs)->Apply(sizes);
+
+// A producer that consolidates each batch itself and enqueues the chain
+// without the lock, and the consumer that merges them in lockAndDrain.
+void enqueue_and_drain(benchmark::State& state, const Storm* storm) {
+  constexpr size_t kBatch = 1024;
+  auto& events = getEvents(*storm, state.range(0));
+  auto now = std::chrono::system_clock::now();
+  std::chrono::nanoseconds drained{0};
+  size_t items = 0;
+  for (auto _ : state) {
+    PendingCollection collection;
+    PendingChanges batch;
+    for (size_t start = 0; start < events.size(); start += kBatch) {
+      auto end = std::min(events.size(), start + kBatch);
+      for (size_t i = start; i < end; ++i) {
+        batch.add(events[i].path, now, events[i].flags);
+      }
+      collection.enqueue(batch.stealItems(), batch.stealSyncs());
+    }
+
+    auto drainStart = std::chrono::steady_clock::now();
+    {
+      auto locked = collection.lockAndDrain();
+      items = locked->getPendingItemCount();
+    }
+    drained += std::chrono::steady_clock::now() - drainStart;
+
+    state.PauseTiming();
+    collection.lock()->clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * events.size());
+  state.counters["items"] = double(items);
+  state.counters["drain_lock_us"] =
+      std::chrono::duration<double, std::micro>(drained).count() /
+      state.iterations();
+}
+BENCHMARK_CAPTURE(enqueue_and_drain, unique_files, &kUniqueFiles)
+    ->Apply(sizes);
+BENCHMARK_CAPTURE(enqueue_and_drain, repeated_files, &kRepeatedFiles)
+    ->Apply(sizes);
+
+// What the IO thread does with a collection once it has taken it.
+void steal_and_walk(benchmark::State& state, const Storm* storm) {
+  auto& events = getEvents(*storm, state.range(0));
+  auto now = std::chrono::system_clock::now();
+  size_t walked = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    PendingChanges changes;
+    for (auto& event : events) {
+      changes.add(event.path, now, event.flags);
+    }
+    state.ResumeTiming();
+
+    walked = 0;
+    auto pending = changes.stealItems();
+    while (pending) {
+      ++walked;
+      pending = std::move(pending->next);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * walked);
+}
+BENCHMARK_CAPTURE(steal_and_walk, unique_files, &kUniqueFiles)->Apply(sizes);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -6,11 +6,14 @@
  */
 
 #include "watchman/PendingCollection.h"
+#include "watchman/Cookie.h"
 #include "watchman/Logging.h"
 
 #include <folly/logging/xlog.h>
 #include <folly/portability/GTest.h>
+#include <algorithm>
 #include <chrono>
+#include <thread>
 
 using namespace watchman;
 
@@ -170,13 +173,24 @@ class NaivePendingCollection {
       }
     }
 
-    for (std::shared_ptr<watchman_pending_fs> p = head_; p; p = p->next) {
+    std::shared_ptr<watchman_pending_fs>* link = &head_;
+    for (auto p = head_; p; link = &p->next, p = p->next) {
       if (p->path == path) {
         // consolidateItem
+        auto priority = priorityOf(*p);
         p->flags.set(
             flags &
             (W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE |
              W_PENDING_IS_DESYNCED));
+        if (flags.contains(W_PENDING_VIA_NOTIFY)) {
+          p->flags.clear(W_PENDING_DIR_UNCHANGED);
+        }
+        if (priorityOf(*p) != priority) {
+          // Move to the head, as if newly added.
+          *link = p->next;
+          p->next = head_;
+          head_ = p;
+        }
         // TODO: should prune here
         return;
       }
@@ -212,10 +226,34 @@ class NaivePendingCollection {
   }
 
   std::shared_ptr<watchman_pending_fs> stealItems() {
-    return std::exchange(head_, nullptr);
+    std::vector<std::shared_ptr<watchman_pending_fs>> items;
+    for (auto p = std::exchange(head_, nullptr); p; p = p->next) {
+      items.push_back(p);
+    }
+    std::stable_sort(items.begin(), items.end(), [](auto& a, auto& b) {
+      return priorityOf(*a) < priorityOf(*b);
+    });
+
+    std::shared_ptr<watchman_pending_fs> chain;
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+      (*it)->next = std::move(chain);
+      chain = std::move(*it);
+    }
+    return chain;
   }
 
  private:
+  // Cookies, then other paths, then crawls.
+  static int priorityOf(const watchman_pending_fs& p) {
+    if (isPossiblyACookie(p.path)) {
+      return 0;
+    }
+    if (p.flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) {
+      return 2;
+    }
+    return 1;
+  }
+
   std::shared_ptr<watchman_pending_fs> head_;
 };
 
@@ -269,6 +307,25 @@ TYPED_TEST(PendingCollectionFixture, same_item_consolidates) {
   EXPECT_EQ(PendingFlags{}, item->flags);
 }
 
+TYPED_TEST(PendingCollectionFixture, dir_unchanged_is_dropped_by_notify) {
+  auto crawl = W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY;
+  this->coll.add(w_string{"foo"}, this->now, crawl | W_PENDING_DIR_UNCHANGED);
+  this->coll.add(w_string{"foo"}, this->now, W_PENDING_RECURSIVE);
+  this->coll.add(w_string{"bar"}, this->now, crawl | W_PENDING_DIR_UNCHANGED);
+  this->coll.add(w_string{"bar"}, this->now, W_PENDING_VIA_NOTIFY);
+
+  auto item = this->coll.stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(w_string{"bar"}, item->path);
+  EXPECT_EQ(crawl, item->flags);
+
+  item = item->next;
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"foo"}, item->path);
+  EXPECT_EQ(crawl | W_PENDING_DIR_UNCHANGED, item->flags);
+}
+
 TYPED_TEST(PendingCollectionFixture, prune_obsoleted_children) {
   this->coll.add(w_string{"foo/bar"}, this->now, 0);
   this->coll.add(w_string{"foo"}, this->now, W_PENDING_RECURSIVE);
@@ -316,14 +373,14 @@ TYPED_TEST(PendingCollectionFixture, unrelated_prefixes_dont_prune) {
   auto item = this->coll.stealItems();
   ASSERT_NE(nullptr, item);
   EXPECT_NE(nullptr, item->next);
-  EXPECT_EQ(w_string{"f"}, item->path);
-  EXPECT_EQ(W_PENDING_RECURSIVE, item->flags);
+  EXPECT_EQ(w_string{"foo/bar"}, item->path);
+  EXPECT_EQ(PendingFlags{}, item->flags);
 
   item = item->next;
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
-  EXPECT_EQ(w_string{"foo/bar"}, item->path);
-  EXPECT_EQ(PendingFlags{}, item->flags);
+  EXPECT_EQ(w_string{"f"}, item->path);
+  EXPECT_EQ(W_PENDING_RECURSIVE, item->flags);
 }
 
 TYPED_TEST(PendingCollectionFixture, queue_crawl_then_notify) {
@@ -350,16 +407,40 @@ TYPED_TEST(PendingCollectionFixture, queue_notify_then_crawl) {
   this->coll.add(
       w_string{"foo"}, this->now, W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE);
 
+  // Crawls are handed out after the paths that the watcher reported.
   auto item = this->coll.stealItems();
   ASSERT_NE(nullptr, item);
   EXPECT_NE(nullptr, item->next);
-  EXPECT_EQ(w_string{"foo"}, item->path);
-  EXPECT_EQ(W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE, item->flags);
+  EXPECT_EQ(w_string{"foo/bar"}, item->path);
+  EXPECT_EQ(W_PENDING_VIA_NOTIFY, item->flags);
 
   item = item->next;
   EXPECT_EQ(nullptr, item->next);
-  EXPECT_EQ(w_string{"foo/bar"}, item->path);
-  EXPECT_EQ(W_PENDING_VIA_NOTIFY, item->flags);
+  EXPECT_EQ(w_string{"foo"}, item->path);
+  EXPECT_EQ(W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE, item->flags);
+}
+
+TYPED_TEST(PendingCollectionFixture, cookies_come_before_changes_and_crawls) {
+  this->coll.add(w_string{"dir"}, this->now, W_PENDING_RECURSIVE);
+  this->coll.add(w_string{"file"}, this->now, W_PENDING_VIA_NOTIFY);
+  this->coll.add(
+      w_string{"root/.watchman-cookie-host-1-2"},
+      this->now,
+      W_PENDING_VIA_NOTIFY);
+  this->coll.add(w_string{"other"}, this->now, W_PENDING_VIA_NOTIFY);
+  this->coll.add(w_string{"more"}, this->now, W_PENDING_VIA_NOTIFY);
+  // Upgrading a change to a crawl moves it to the crawls.
+  this->coll.add(w_string{"other"}, this->now, W_PENDING_RECURSIVE);
+
+  std::vector<w_string> paths;
+  for (auto item = this->coll.stealItems(); item; item = item->next) {
+    paths.push_back(item->path);
+  }
+  EXPECT_EQ(
+      (std::vector<w_string>{
+          "root/.watchman-cookie-host-1-2", "more", "file", "other", "dir"}),
+      paths);
+  EXPECT_EQ(0, this->coll.getPendingItemCount());
 }
 
 TYPED_TEST(PendingCollectionFixture, real_example) {
@@ -394,3 +475,176 @@ TYPED_TEST(PendingCollectionFixture, real_example) {
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
 }
+
+TEST(Pending, bulk_prune_keeps_crawls_and_siblings) {
+  PendingChanges coll;
+  auto now = std::chrono::system_clock::now();
+
+  for (int i = 0; i < 1000; ++i) {
+    coll.add(w_string::build("foo/dir", i / 10, "/file", i), now, 0);
+  }
+  coll.add(w_string{"foo/dir7/crawl"}, now, W_PENDING_CRAWL_ONLY);
+  coll.add(w_string{"foobar/file"}, now, 0);
+  coll.add(w_string{"foo"}, now, W_PENDING_RECURSIVE);
+  EXPECT_EQ(3u, coll.getPendingItemCount());
+
+  // Pruned paths can be added again once the recursive entry is gone.
+  coll.stealItems();
+  coll.add(w_string{"foo/dir7/file70"}, now, 0);
+  EXPECT_EQ(1u, coll.getPendingItemCount());
+
+  auto item = coll.stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"foo/dir7/file70"}, item->path);
+}
+
+TEST(Pending, pre_stat_follows_the_latest_change) {
+  PendingChanges coll;
+  auto now = std::chrono::system_clock::now();
+  auto stat = [](off_t size) {
+    auto st = std::make_unique<FileInformation>();
+    st->size = size;
+    return st;
+  };
+
+  coll.add(w_string{"foo/bar"}, now, W_PENDING_VIA_NOTIFY, stat(10));
+  coll.add(w_string{"foo/bar"}, now, W_PENDING_VIA_NOTIFY, stat(20));
+  coll.add(w_string{"foo/baz"}, now, W_PENDING_VIA_NOTIFY, stat(30));
+  coll.add(w_string{"foo/baz"}, now, W_PENDING_VIA_NOTIFY);
+
+  auto item = coll.stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(w_string{"foo/baz"}, item->path);
+  EXPECT_EQ(nullptr, item->preStat);
+
+  item = item->next;
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"foo/bar"}, item->path);
+  ASSERT_NE(nullptr, item->preStat);
+  EXPECT_EQ(20, item->preStat->size);
+}
+
+TEST(Pending, moves_survive_consolidation_and_merging) {
+  PendingChanges coll;
+  auto now = std::chrono::system_clock::now();
+
+  coll.add(w_string{"root/new"}, now, W_PENDING_VIA_NOTIFY);
+  coll.addMove(w_string{"root/old"}, w_string{"root/new"}, now);
+  coll.add(w_string{"root/new"}, now, W_PENDING_VIA_NOTIFY);
+
+  PendingChanges merged;
+  merged.add(w_string{"root/new"}, now, W_PENDING_VIA_NOTIFY);
+  merged.append(coll.stealItems(), {});
+
+  auto item = merged.stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"root/new"}, item->path);
+  EXPECT_TRUE(item->flags.contains(W_PENDING_MOVED));
+  EXPECT_EQ(w_string{"root/old"}, item->movedFrom);
+}
+
+TEST(Pending, debounce_holds_repeated_changes_until_quiet) {
+  using namespace std::chrono_literals;
+  PendingDebounce debounce{10ms};
+  auto start = PendingDebounce::Clock::now();
+  auto now = std::chrono::system_clock::now();
+  auto change = [&](const char* path) {
+    return std::make_shared<watchman_pending_fs>(
+        w_string{path}, now, W_PENDING_VIA_NOTIFY);
+  };
+
+  // The first report passes through, the next two are held as one.
+  EXPECT_NE(nullptr, debounce.admit(change("out"), false, start));
+  EXPECT_EQ(nullptr, debounce.admit(change("out"), false, start + 2ms));
+  EXPECT_EQ(nullptr, debounce.admit(change("out"), false, start + 4ms));
+  EXPECT_EQ(1u, debounce.getAbsorbedCount());
+  EXPECT_EQ(10ms, debounce.timeUntilRelease(start + 4ms));
+
+  EXPECT_EQ(nullptr, debounce.release(start + 13ms));
+  auto item = debounce.release(start + 14ms);
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"out"}, item->path);
+  EXPECT_TRUE(debounce.empty());
+}
+
+TEST(Pending, debounce_releases_everything_for_a_sync) {
+  using namespace std::chrono_literals;
+  PendingDebounce debounce{10ms};
+  auto start = PendingDebounce::Clock::now();
+  auto now = std::chrono::system_clock::now();
+  auto change = [&](const char* path) {
+    return std::make_shared<watchman_pending_fs>(
+        w_string{path}, now, W_PENDING_VIA_NOTIFY);
+  };
+
+  debounce.admit(change("out"), false, start);
+  EXPECT_EQ(nullptr, debounce.admit(change("out"), false, start + 1ms));
+  EXPECT_FALSE(debounce.empty());
+
+  auto cookie = w_string::build("dir/", kCookiePrefix, "1");
+  auto item = debounce.admit(change(cookie.c_str()), false, start + 2ms);
+  ASSERT_NE(nullptr, item);
+  ASSERT_NE(nullptr, item->next);
+  EXPECT_EQ(nullptr, item->next->next);
+  EXPECT_TRUE(debounce.empty());
+
+  debounce.admit(change("out"), false, start + 3ms);
+  EXPECT_FALSE(debounce.empty());
+  EXPECT_NE(nullptr, debounce.admit(nullptr, true, start + 4ms));
+  EXPECT_TRUE(debounce.empty());
+}
+
+TEST(Pending, enqueued_batches_merge_in_order) {
+  PendingCollection coll;
+  auto now = std::chrono::system_clock::now();
+  auto stat = [](off_t size) {
+    auto st = std::make_unique<FileInformation>();
+    st->size = size;
+    return st;
+  };
+
+  PendingChanges first;
+  first.add(w_string{"foo/bar"}, now, W_PENDING_VIA_NOTIFY, stat(10));
+  coll.enqueue(first.stealItems(), first.stealSyncs());
+
+  std::thread producer{[&] {
+    PendingChanges second;
+    second.add(w_string{"foo/bar"}, now, W_PENDING_VIA_NOTIFY, stat(20));
+    coll.enqueue(second.stealItems(), second.stealSyncs());
+  }};
+  producer.join();
+
+  auto lock = coll.lockAndWait(std::chrono::milliseconds{-1});
+  EXPECT_EQ(1u, lock->getPendingItemCount());
+  auto item = lock->stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"foo/bar"}, item->path);
+  ASSERT_NE(nullptr, item->preStat);
+  EXPECT_EQ(20, item->preStat->size);
+}
+
+TEST(Pending, enqueue_wakes_a_waiting_consumer) {
+  PendingCollection coll;
+  std::thread producer{[&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds{50});
+    PendingChanges changes;
+    changes.add(
+        w_string{"foo"}, std::chrono::system_clock::now(),
+        W_PENDING_VIA_NOTIFY);
+    coll.enqueue(changes.stealItems(), changes.stealSyncs());
+  }};
+
+  // Waits may wake spuriously, so allow a few.
+  uint32_t count = 0;
+  for (int i = 0; i < 100 && count == 0; ++i) {
+    count = coll.lockAndWait(std::chrono::milliseconds{-1})
+                ->getPendingItemCount();
+  }
+  EXPECT_EQ(1u, count);
+  producer.join();
+}
@@ -61,8 +61,9 @@ TEST(Perf, sample_batches_are_limited_if_total_size_exceeds_argv_limit) {
 
   std::vector<std::vector<std::string>> calls;
 
+  // Two samples and their separators
   processSamples(
-      20,
+      26,
       4,
       samples,
       [&](std::vector<std::string> samples) {
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/poll.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "watchman/InMemoryView.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/root/Root.h"
+#include "watchman/test/lib/FakeFileSystem.h"
+
+using namespace watchman;
+
+namespace {
+
+using ConfigOptions = std::vector<std::pair<const char*, json_ref>>;
+
+Configuration getConfiguration(const ConfigOptions& options) {
+  // Statting inline and without a rate limit keeps each pass synchronous.
+  json_ref json = json_object({
+      {"poll_stat_parallelism", json_integer(1)},
+      {"poll_max_stats_per_second", json_integer(0)},
+      {"poll_full_scan_seconds", json_integer(0)},
+  });
+  for (auto& [name, value] : options) {
+    json_object_set(json, name, value);
+  }
+  return Configuration{std::move(json)};
+}
+
+class PollWatcherTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    fs.defineContents({
+        FAKEFS_ROOT "root/a/file.txt",
+        FAKEFS_ROOT "root/b/",
+        FAKEFS_ROOT "other/",
+    });
+  }
+
+  // Crawls the root, which has the crawler start watching each of its dirs.
+  void watch(const ConfigOptions& options = {}) {
+    config = getConfiguration(options);
+    watcher = std::make_shared<PollWatcher>(fs, config);
+    view = std::make_shared<InMemoryView>(fs, root_path, config, watcher);
+    auto& pending = view->unsafeAccessPendingFromWatcher();
+    pending.lock()->ping();
+    root = std::make_shared<Root>(
+        fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+    ASSERT_TRUE(watcher->start(root));
+
+    InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+    EXPECT_EQ(
+        InMemoryView::Continue::Continue,
+        view->stepIoThread(root, state, pending));
+  }
+
+  // Runs one complete pass and returns the paths that it reported.
+  std::vector<w_string> poll() {
+    PendingChanges coll;
+    auto passCount = [&] {
+      return watcher->getDebugInfo().get("pass_count").asInt();
+    };
+    auto passes = passCount();
+    while (passCount() == passes) {
+      EXPECT_FALSE(watcher->consumeNotify(root, coll).cancelSelf);
+    }
+
+    std::vector<w_string> paths;
+    for (auto p = coll.stealItems(); p; p = std::move(p->next)) {
+      paths.push_back(p->path);
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+  }
+
+  // What the filesystem does to a dir when its entries change.
+  void touchDir(const char* path) {
+    fs.updateMetadata(path, [](FileInformation& fi) { ++fi.mtime.tv_sec; });
+  }
+
+  const w_string root_path{FAKEFS_ROOT "root"};
+  FakeFileSystem fs;
+  Configuration config;
+  std::shared_ptr<PollWatcher> watcher;
+  std::shared_ptr<InMemoryView> view;
+  std::shared_ptr<Root> root;
+};
+
+} // namespace
+
+TEST_F(PollWatcherTest, watches_the_crawled_dirs) {
+  watch();
+  EXPECT_EQ(3, watcher->getDebugInfo().get("watched_dir_count").asInt());
+  EXPECT_EQ(std::vector<w_string>{}, poll());
+}
+
+TEST_F(PollWatcherTest, reports_added_files) {
+  watch();
+  fs.touch(FAKEFS_ROOT "root/b/new.txt");
+  touchDir(FAKEFS_ROOT "root/b");
+
+  EXPECT_EQ(std::vector<w_string>{FAKEFS_ROOT "root/b"}, poll());
+  // Until the dir changes again
+  EXPECT_EQ(std::vector<w_string>{}, poll());
+}
+
+TEST_F(PollWatcherTest, reports_modified_files_in_the_sweep) {
+  // Every dir is re-examined over two passes.
+  watch(
+      {{"poll_interval_ms", json_integer(500)},
+       {"poll_full_scan_seconds", json_integer(1)}});
+  fs.updateMetadata(FAKEFS_ROOT "root/a/file.txt", [](FileInformation& fi) {
+    fi.size = 100;
+    ++fi.mtime.tv_sec;
+  });
+
+  auto first = poll();
+  auto second = poll();
+  EXPECT_EQ(
+      1,
+      std::count(first.begin(), first.end(), w_string{FAKEFS_ROOT "root/a"}) +
+          std::count(
+              second.begin(), second.end(), w_string{FAKEFS_ROOT "root/a"}));
+}
+
+TEST_F(PollWatcherTest, reports_deleted_dirs) {
+  watch();
+  fs.removeRecursively(FAKEFS_ROOT "root/b");
+  touchDir(FAKEFS_ROOT "root");
+
+  EXPECT_EQ(
+      (std::vector<w_string>{FAKEFS_ROOT "root", FAKEFS_ROOT "root/b"}),
+      poll());
+  // The crawler has yet to open it again, so it is no longer watched.
+  EXPECT_EQ(2, watcher->getDebugInfo().get("watched_dir_count").asInt());
+  EXPECT_EQ(std::vector<w_string>{}, poll());
+}
+
+TEST_F(PollWatcherTest, reports_renames_out_of_the_root) {
+  watch();
+  fs.rename(FAKEFS_ROOT "root/a/file.txt", FAKEFS_ROOT "other/file.txt");
+  touchDir(FAKEFS_ROOT "root/a");
+  touchDir(FAKEFS_ROOT "other");
+
+  EXPECT_EQ(std::vector<w_string>{FAKEFS_ROOT "root/a"}, poll());
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "watchman/PoolAllocator.h"
+
+using namespace watchman;
+
+namespace {
+struct Node {
+  int value;
+  void* pad[3];
+};
+} // namespace
+
+TEST(PoolAllocatorTest, freed_blocks_are_reused) {
+  PoolAllocator<Node> alloc;
+  auto a = alloc.allocate(1);
+  alloc.deallocate(a, 1);
+  auto b = alloc.allocate(1);
+  EXPECT_EQ(a, b);
+  alloc.deallocate(b, 1);
+}
+
+TEST(PoolAllocatorTest, shared_ptrs_recycle_their_blocks) {
+  auto a = std::allocate_shared<Node>(PoolAllocator<Node>(), Node{1, {}});
+  void* block = a.get();
+  a.reset();
+  auto b = std::allocate_shared<Node>(PoolAllocator<Node>(), Node{2, {}});
+  EXPECT_EQ(block, b.get());
+  EXPECT_EQ(2, b->value);
+}
+
+TEST(PoolAllocatorTest, blocks_flow_between_threads) {
+  std::vector<std::shared_ptr<Node>> nodes;
+  for (int round = 0; round < 3; ++round) {
+    std::thread producer{[&] {
+      for (int i = 0; i < 10000; ++i) {
+        nodes.push_back(
+            std::allocate_shared<Node>(PoolAllocator<Node>(), Node{i, {}}));
+      }
+    }};
+    producer.join();
+    for (int i = 0; i < 10000; ++i) {
+      EXPECT_EQ(i, nodes[i]->value);
+    }
+    nodes.clear();
+  }
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <thread>
+#include "watchman/PubSub.h"
+
+using namespace watchman;
+
+void w_request_shutdown(void) {}
+
+namespace {
+using Pending = std::vector<std::shared_ptr<const Publisher::Item>>;
+}
+
+TEST(PubSub, unbounded) {
+  auto pub = std::make_shared<Publisher>();
+  auto sub = pub->subscribe(nullptr);
+
+  for (int i = 0; i < 100; ++i) {
+    pub->enqueue(json_integer(i));
+  }
+
+  Pending pending;
+  EXPECT_FALSE(sub->getPending(pending));
+  ASSERT_EQ(100, pending.size());
+  EXPECT_EQ(0, pending.front()->payload.asInt());
+  EXPECT_EQ(99, pending.back()->payload.asInt());
+}
+
+TEST(PubSub, bounded_backlog) {
+  auto pub = std::make_shared<Publisher>(4);
+  auto slow = pub->subscribe(nullptr);
+  auto fast = pub->subscribe(nullptr);
+
+  Pending pending;
+  for (int i = 0; i < 10; ++i) {
+    pub->enqueue(json_integer(i));
+    pending.clear();
+    EXPECT_FALSE(fast->getPending(pending));
+    EXPECT_EQ(1, pending.size());
+  }
+
+  // The slow subscriber only gets the newest items, and learns that it
+  // missed the others.
+  pending.clear();
+  EXPECT_TRUE(slow->getPending(pending));
+  ASSERT_EQ(4, pending.size());
+  EXPECT_EQ(6, pending.front()->payload.asInt());
+  EXPECT_EQ(9, pending.back()->payload.asInt());
+
+  // Once caught up, it hears about new items as usual.
+  pub->enqueue(json_integer(10));
+  pending.clear();
+  EXPECT_FALSE(slow->getPending(pending));
+  ASSERT_EQ(1, pending.size());
+  EXPECT_EQ(10, pending.front()->payload.asInt());
+
+  // Items discarded before a subscriber registered are not its concern.
+  auto late = pub->subscribe(nullptr);
+  pending.clear();
+  EXPECT_FALSE(late->getPending(pending));
+}
+
+TEST(PubSub, concurrent_publishers) {
+  constexpr int kThreads = 4;
+  constexpr int kItemsPerThread = 1000;
+  auto pub = std::make_shared<Publisher>(kThreads * kItemsPerThread);
+  auto sub = pub->subscribe(nullptr);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < kItemsPerThread; ++i) {
+        pub->enqueue(json_integer(i));
+      }
+    });
+  }
+
+  // Read while they publish: items must arrive in order, without gaps.
+  Pending pending;
+  uint64_t lastSerial = 0;
+  size_t received = 0;
+  while (received < kThreads * kItemsPerThread) {
+    pending.clear();
+    EXPECT_FALSE(sub->getPending(pending));
+    for (auto& item : pending) {
+      EXPECT_EQ(lastSerial + 1, item->serial);
+      lastSerial = item->serial;
+    }
+    received += pending.size();
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+TEST(PubSub, filtered) {
+  for (size_t backlog : {0, 8}) {
+    auto pub = std::make_shared<Publisher>(backlog);
+    int notified = 0;
+    auto sub = pub->subscribe(
+        [&] { ++notified; },
+        std::nullopt,
+        [](const json_ref& payload) { return payload.asInt() % 2 == 0; });
+
+    // Skipped while there is nothing else to read
+    pub->enqueue(json_integer(1));
+    EXPECT_EQ(0, notified);
+    Pending pending;
+    EXPECT_FALSE(sub->getPending(pending));
+    EXPECT_EQ(0, pending.size());
+
+    pub->enqueue(json_integer(2));
+    EXPECT_EQ(1, notified);
+    // Not skipped, since the subscriber is yet to read 2
+    pub->enqueue(json_integer(3));
+    EXPECT_EQ(2, notified);
+
+    pending.clear();
+    EXPECT_FALSE(sub->getPending(pending));
+    ASSERT_EQ(2, pending.size());
+    EXPECT_EQ(2, pending.front()->payload.asInt());
+    EXPECT_EQ(3, pending.back()->payload.asInt());
+
+    // Many skipped items don't leave it behind
+    for (int i = 0; i < 20; ++i) {
+      pub->enqueue(json_integer(2 * i + 1));
+    }
+    EXPECT_EQ(2, notified);
+    pub->enqueue(json_integer(4));
+    pending.clear();
+    EXPECT_FALSE(sub->getPending(pending));
+    ASSERT_EQ(1, pending.size());
+    EXPECT_EQ(4, pending.front()->payload.asInt());
+  }
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "watchman/QueryAdmission.h"
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+void waitForWaiting(const QueryAdmission& admission, size_t count) {
+  while (admission.waiting() < count) {
+    std::this_thread::sleep_for(1ms);
+  }
+}
+
+} // namespace
+
+TEST(QueryAdmissionTest, no_limit_admits_everything) {
+  QueryAdmission admission{0};
+  auto a = admission.admit(QueryAdmission::Lane::Heavy, 1);
+  auto b = admission.admit(QueryAdmission::Lane::Heavy, 1);
+  EXPECT_TRUE(a);
+  EXPECT_TRUE(b);
+  EXPECT_EQ(2, admission.running());
+}
+
+TEST(QueryAdmissionTest, waiting_past_the_deadline_is_not_admitted) {
+  QueryAdmission admission{1};
+  auto running = admission.admit(QueryAdmission::Lane::Heavy, 1);
+  ASSERT_TRUE(running);
+
+  auto late = admission.admit(
+      QueryAdmission::Lane::Cheap, 2, std::chrono::steady_clock::now() + 10ms);
+  EXPECT_FALSE(late);
+  EXPECT_EQ(0, admission.waiting());
+  EXPECT_EQ(1, admission.running());
+}
+
+TEST(QueryAdmissionTest, cheap_first_then_clients_take_turns) {
+  QueryAdmission admission{1};
+  auto running = admission.admit(QueryAdmission::Lane::Heavy, 1);
+  ASSERT_TRUE(running);
+
+  std::mutex mutex;
+  std::vector<std::string> order;
+  std::vector<std::thread> threads;
+  auto enqueue =
+      [&](QueryAdmission::Lane lane, int64_t client, std::string name) {
+        auto waiting = admission.waiting();
+        threads.emplace_back([&, lane, client, name] {
+          auto ticket = admission.admit(lane, client);
+          std::lock_guard<std::mutex> lock{mutex};
+          order.push_back(name);
+        });
+        waitForWaiting(admission, waiting + 1);
+      };
+  enqueue(QueryAdmission::Lane::Heavy, 1, "1a");
+  enqueue(QueryAdmission::Lane::Heavy, 1, "1b");
+  enqueue(QueryAdmission::Lane::Heavy, 2, "2a");
+  enqueue(QueryAdmission::Lane::Cheap, 3, "3a");
+
+  running = QueryAdmission::Ticket{};
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ((std::vector<std::string>{"3a", "1a", "2a", "1b"}), order);
+  EXPECT_EQ(0, admission.running());
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+
+#include "watchman/root/RootPathTrie.h"
+
+using namespace watchman;
+
+namespace {
+
+w_string_piece enclosing(const RootPathTrie& trie, w_string_piece path) {
+  auto found = trie.findEnclosing(path);
+  return found ? found->piece() : w_string_piece();
+}
+
+} // namespace
+
+TEST(RootPathTrieTest, finds_the_nearest_enclosing_root) {
+  RootPathTrie trie;
+  trie.insert(w_string{"/repo"});
+  trie.insert(w_string{"/repo/sub/project"});
+  EXPECT_EQ(2, trie.size());
+
+  EXPECT_EQ("/repo", enclosing(trie, "/repo"));
+  EXPECT_EQ("/repo", enclosing(trie, "/repo/sub"));
+  EXPECT_EQ("/repo/sub/project", enclosing(trie, "/repo/sub/project"));
+  EXPECT_EQ("/repo/sub/project", enclosing(trie, "/repo/sub/project/a/b"));
+  EXPECT_EQ(nullptr, trie.findEnclosing("/repository"));
+  EXPECT_EQ(nullptr, trie.findEnclosing("/other/repo"));
+  EXPECT_EQ(nullptr, trie.findEnclosing("/"));
+}
+
+TEST(RootPathTrieTest, erase_prunes_only_that_root) {
+  RootPathTrie trie;
+  trie.insert(w_string{"/repo"});
+  trie.insert(w_string{"/repo/sub/project"});
+
+  EXPECT_FALSE(trie.erase("/repo/sub"));
+  EXPECT_TRUE(trie.erase("/repo/sub/project"));
+  EXPECT_FALSE(trie.erase("/repo/sub/project"));
+  EXPECT_EQ(1, trie.size());
+  EXPECT_EQ("/repo", enclosing(trie, "/repo/sub/project/a"));
+
+  EXPECT_TRUE(trie.erase("/repo"));
+  EXPECT_EQ(0, trie.size());
+  EXPECT_EQ(nullptr, trie.findEnclosing("/repo"));
+}
+
+TEST(RootPathTrieTest, the_filesystem_root_encloses_everything) {
+  RootPathTrie trie;
+  trie.insert(w_string{"/"});
+  EXPECT_EQ("/", enclosing(trie, "/"));
+  EXPECT_EQ("/", enclosing(trie, "/any/path"));
+}
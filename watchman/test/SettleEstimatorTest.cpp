@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SettleEstimator.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(SettleEstimator, fixed_period_when_not_adaptive) {
+  SettleEstimator settle;
+  EXPECT_FALSE(settle.enabled());
+  auto start = SettleEstimator::Clock::now();
+
+  settle.noteChanges(start);
+  settle.noteSettled(false);
+  settle.noteChanges(start + 30ms);
+  EXPECT_EQ(20ms, settle.settlePeriod(20ms));
+  EXPECT_EQ(0, settle.getStatus(20ms).premature_settles);
+  EXPECT_FALSE(settle.mustSettle(start + 1h));
+}
+
+TEST(SettleEstimator, grows_with_pauses_between_bursts) {
+  SettleEstimator settle{1000ms};
+  auto now = SettleEstimator::Clock::now();
+
+  // Bursts separated by 100ms pauses, each settling after 20ms
+  for (int i = 0; i < 20; ++i) {
+    settle.noteChanges(now);
+    settle.noteSettled(false);
+    now += 100ms;
+  }
+  auto period = settle.settlePeriod(20ms);
+  EXPECT_GT(period, 150ms);
+  EXPECT_LE(period, 200ms);
+  EXPECT_EQ(19, settle.getStatus(20ms).premature_settles);
+
+  // Never more than the maximum, nor less than the settle period
+  EXPECT_EQ(1000ms, settle.settlePeriod(1000ms));
+  EXPECT_EQ(300ms, settle.settlePeriod(300ms));
+}
+
+TEST(SettleEstimator, shrinks_once_activity_stops) {
+  SettleEstimator settle{1000ms};
+  auto now = SettleEstimator::Clock::now();
+
+  for (int i = 0; i < 20; ++i) {
+    settle.noteChanges(now);
+    settle.noteSettled(false);
+    now += 400ms;
+  }
+  EXPECT_GT(settle.settlePeriod(20ms), 500ms);
+
+  // Pauses longer than the maximum are not part of a burst
+  for (int i = 0; i < 20; ++i) {
+    settle.noteChanges(now);
+    settle.noteSettled(false);
+    now += 5s;
+  }
+  EXPECT_EQ(20ms, settle.settlePeriod(20ms));
+}
+
+TEST(SettleEstimator, changes_without_a_settle_are_not_pauses) {
+  SettleEstimator settle{1000ms};
+  auto now = SettleEstimator::Clock::now();
+
+  for (int i = 0; i < 20; ++i) {
+    settle.noteChanges(now);
+    now += 100ms;
+  }
+  EXPECT_EQ(20ms, settle.settlePeriod(20ms));
+  EXPECT_EQ(0, settle.getStatus(20ms).premature_settles);
+}
+
+TEST(SettleEstimator, forces_a_settle_after_max_wait) {
+  SettleEstimator settle{{}, 500ms};
+  EXPECT_TRUE(settle.enabled());
+  auto start = SettleEstimator::Clock::now();
+
+  settle.noteChanges(start);
+  settle.noteChanges(start + 300ms);
+  EXPECT_FALSE(settle.mustSettle(start + 300ms));
+  settle.noteChanges(start + 500ms);
+  EXPECT_TRUE(settle.mustSettle(start + 500ms));
+
+  // The wait starts over from the next change
+  settle.noteSettled(true);
+  EXPECT_FALSE(settle.mustSettle(start + 600ms));
+  settle.noteChanges(start + 600ms);
+  EXPECT_FALSE(settle.mustSettle(start + 1000ms));
+  EXPECT_TRUE(settle.mustSettle(start + 1100ms));
+  EXPECT_EQ(1, settle.getStatus(20ms).forced_settles);
+
+  // A forced settle doesn't count as a pause
+  EXPECT_EQ(0, settle.getStatus(20ms).premature_settles);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "watchman/SlabAllocator.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+using namespace watchman;
+
+TEST(SlabAllocatorTest, allocations_are_adjacent) {
+  SlabAllocator alloc;
+  auto a = static_cast<char*>(alloc.allocate(40));
+  auto b = static_cast<char*>(alloc.allocate(40));
+  EXPECT_EQ(a + 48, b);
+  EXPECT_EQ(96, alloc.getBytesInUse());
+  EXPECT_EQ(SlabAllocator::kDefaultSlabSize, alloc.getBytesReserved());
+  alloc.deallocate(a, 40);
+  alloc.deallocate(b, 40);
+  EXPECT_EQ(0, alloc.getBytesInUse());
+}
+
+TEST(SlabAllocatorTest, freed_blocks_are_reused) {
+  SlabAllocator alloc;
+  auto a = alloc.allocate(100);
+  alloc.deallocate(a, 100);
+  // Same size class
+  auto b = alloc.allocate(97);
+  EXPECT_EQ(a, b);
+  alloc.deallocate(b, 97);
+}
+
+TEST(SlabAllocatorTest, large_allocations_bypass_slabs) {
+  SlabAllocator alloc;
+  auto p = alloc.allocate(SlabAllocator::kMaxSlabObjectSize + 1);
+  memset(p, 0xff, SlabAllocator::kMaxSlabObjectSize + 1);
+  EXPECT_EQ(SlabAllocator::kMaxSlabObjectSize + 1, alloc.getBytesReserved());
+  alloc.deallocate(p, SlabAllocator::kMaxSlabObjectSize + 1);
+  EXPECT_EQ(0, alloc.getBytesReserved());
+}
+
+TEST(SlabAllocatorTest, released_slabs_are_returned) {
+  SlabAllocator alloc;
+  alloc.deallocate(alloc.allocate(40), 40);
+  alloc.releaseSlabs();
+  EXPECT_EQ(0, alloc.getBytesReserved());
+  // A fresh slab is started.
+  alloc.deallocate(alloc.allocate(40), 40);
+  EXPECT_EQ(SlabAllocator::kDefaultSlabSize, alloc.getBytesReserved());
+}
+
+TEST(SlabAllocatorTest, empty_slabs_are_released) {
+  SlabAllocator alloc{SlabAllocator::kMaxSlabObjectSize};
+  // Four slabs of 64 byte blocks, of which the first two are then freed
+  // along with one block of the third.
+  std::vector<void*> blocks;
+  for (size_t i = 0; i < 4 * SlabAllocator::kMaxSlabObjectSize / 64; ++i) {
+    blocks.push_back(alloc.allocate(64));
+  }
+  EXPECT_EQ(4 * SlabAllocator::kMaxSlabObjectSize, alloc.getBytesReserved());
+  auto perSlab = SlabAllocator::kMaxSlabObjectSize / 64;
+  for (size_t i = 0; i <= 2 * perSlab; ++i) {
+    alloc.deallocate(blocks[i], 64);
+  }
+
+  EXPECT_EQ(2 * SlabAllocator::kMaxSlabObjectSize, alloc.releaseFreeSlabs());
+  EXPECT_EQ(2 * SlabAllocator::kMaxSlabObjectSize, alloc.getBytesReserved());
+  EXPECT_EQ(0, alloc.releaseFreeSlabs());
+
+  // Only the block that was freed from a kept slab is reused.
+  EXPECT_EQ(blocks[2 * perSlab], alloc.allocate(64));
+  alloc.allocate(64);
+  EXPECT_EQ(3 * SlabAllocator::kMaxSlabObjectSize, alloc.getBytesReserved());
+}
+
+TEST(SlabAllocatorTest, huge_page_slabs_are_aligned) {
+  if (!SlabAllocator::supportsHugePages()) {
+    // The option is ignored
+    return;
+  }
+  SlabAllocator alloc{SlabAllocator::kDefaultSlabSize, /*hugePages=*/true};
+  auto p = alloc.allocate(40);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) % SlabAllocator::kHugePageSize);
+  EXPECT_EQ(SlabAllocator::kHugePageSize, alloc.getBytesReserved());
+  memset(p, 0xff, 40);
+  alloc.deallocate(p, 40);
+}
+
+TEST(SlabAllocatorTest, view_nodes_use_the_allocator) {
+  SlabAllocator alloc;
+  {
+    auto root = watchman_dir::make(w_string{"/root"}, nullptr, &alloc);
+    auto child = root->getOrCreateChildDir(w_string{"child"});
+    EXPECT_EQ(child, root->getChildDir("child"));
+    EXPECT_EQ(root.get(), child->parent);
+    EXPECT_EQ(&alloc, child->allocator);
+
+    auto file = watchman_file::make(w_string{"file.txt"}, child);
+    auto* raw = file.get();
+    child->files.emplace(raw->getName(), std::move(file));
+    EXPECT_EQ(raw, child->getChildFile("file.txt"));
+    EXPECT_EQ(w_string_piece("file.txt"), raw->getName());
+    EXPECT_NE(0, alloc.getBytesInUse());
+  }
+  EXPECT_EQ(0, alloc.getBytesInUse());
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/StatxRing.h"
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+
+#ifdef HAVE_IO_URING_STATX
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace watchman;
+
+namespace {
+
+constexpr size_t kFiles = 8;
+
+long realEnter(
+    int fd,
+    unsigned toSubmit,
+    unsigned minComplete,
+    unsigned flags) {
+  return syscall(
+      __NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+class StatxRingTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ring_ = StatxRing::create();
+    if (!ring_) {
+      GTEST_SKIP() << "io_uring statx is not available";
+    }
+    for (size_t i = 0; i < kFiles; ++i) {
+      names_.push_back("file" + std::to_string(i));
+      std::ofstream{(dir_.path() / names_.back()).string()} << i;
+    }
+    dirFd_ = open(dir_.path().string().c_str(), O_RDONLY | O_DIRECTORY);
+    ASSERT_GE(dirFd_, 0);
+  }
+
+  void TearDown() override {
+    if (dirFd_ >= 0) {
+      close(dirFd_);
+    }
+  }
+
+  std::vector<StatxEntry> entries() const {
+    std::vector<StatxEntry> entries(names_.size());
+    for (size_t i = 0; i < names_.size(); ++i) {
+      entries[i].name = names_[i].c_str();
+      entries[i].err = 0;
+    }
+    return entries;
+  }
+
+  // Submits at most firstSubmit requests the first time, then fails once
+  // with EINVAL, then behaves.
+  void failSecondEnter(unsigned firstSubmit) {
+    ring_->setEnterForTesting([this, firstSubmit](
+                                  int fd,
+                                  unsigned toSubmit,
+                                  unsigned minComplete,
+                                  unsigned flags) -> long {
+      if (++calls_ == 2) {
+        errno = EINVAL;
+        return -1;
+      }
+      if (calls_ == 1) {
+        toSubmit = std::min(toSubmit, firstSubmit);
+      }
+      return realEnter(fd, toSubmit, minComplete, flags);
+    });
+  }
+
+  folly::test::TemporaryDirectory dir_;
+  std::vector<std::string> names_;
+  int dirFd_{-1};
+  std::unique_ptr<StatxRing> ring_;
+  int calls_{0};
+};
+
+} // namespace
+
+TEST_F(StatxRingTest, stats_a_batch) {
+  auto batch = entries();
+  ring_->statBatch(dirFd_, batch.data(), batch.size());
+  for (auto& entry : batch) {
+    EXPECT_EQ(0, entry.err) << entry.name;
+    EXPECT_EQ(1u, entry.stx.stx_size) << entry.name;
+  }
+  EXPECT_FALSE(ring_->broken());
+}
+
+TEST_F(StatxRingTest, failed_submit_with_requests_in_flight) {
+  constexpr unsigned kSubmitted = 3;
+  failSecondEnter(kSubmitted);
+
+  // This would wait forever for the requests that were never submitted
+  auto batch = entries();
+  ring_->statBatch(dirFd_, batch.data(), batch.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (i < kSubmitted) {
+      EXPECT_EQ(0, batch[i].err) << "in flight, so reaped " << i;
+    } else {
+      EXPECT_EQ(EIO, batch[i].err) << "left for lstat " << i;
+    }
+  }
+  EXPECT_TRUE(ring_->broken());
+
+  // Had the withdrawn requests been left in the ring, they would be
+  // submitted in place of some of these, which would never complete.
+  auto next = entries();
+  ring_->setEnterForTesting(realEnter);
+  ring_->statBatch(dirFd_, next.data(), next.size());
+  for (auto& entry : next) {
+    EXPECT_EQ(0, entry.err) << entry.name;
+  }
+}
+
+TEST_F(StatxRingTest, failed_submit_with_nothing_in_flight) {
+  ring_->setEnterForTesting([](int, unsigned, unsigned, unsigned) -> long {
+    errno = EINVAL;
+    return -1;
+  });
+  auto batch = entries();
+  ring_->statBatch(dirFd_, batch.data(), batch.size());
+  for (auto& entry : batch) {
+    EXPECT_EQ(EIO, entry.err) << entry.name;
+  }
+  EXPECT_TRUE(ring_->broken());
+}
+#endif
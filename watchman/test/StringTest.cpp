@@ -7,6 +7,8 @@
 
 #include <folly/portability/GTest.h>
 #include <string>
+#include <unordered_set>
+#include "watchman/watchman_hash.h"
 #include "watchman/watchman_string.h"
 
 TEST(String, fmt) {
@@ -233,6 +235,29 @@ TEST(String, string_piece_lowercase_suffix) {
   EXPECT_EQ(sp.asLowerCaseSuffix().size(), 255);
 }
 
+TEST(String, case_folding) {
+  // Long enough to span more than one block of the vectorized kernels, and
+  // with the bytes on either side of the letter ranges.
+  w_string_piece mixed{"@AZ[`az{\x80\xff MainActivity.JAVA@[/"};
+  w_string_piece lower{"@az[`az{\x80\xff mainactivity.java@[/"};
+
+  std::string buf(mixed.size(), 0);
+  mixed.copyLowerCase(buf.data());
+  EXPECT_EQ(w_string_piece(buf), lower);
+  EXPECT_EQ(mixed.asLowerCase(), lower.asWString());
+
+  EXPECT_TRUE(w_string_equal_caseless(mixed, lower));
+  EXPECT_FALSE(w_string_equal_caseless(
+      "@AZ[`az{\x80\xff MainActivity.JAVA@{/", lower));
+  EXPECT_TRUE(mixed.startsWithCaseInsensitive("@az[`AZ{\x80\xff MAIN"));
+  EXPECT_FALSE(mixed.startsWithCaseInsensitive("`az"));
+
+  EXPECT_TRUE(w_string_piece("MainActivity.JAVA").hasSuffix("java"));
+  EXPECT_FALSE(w_string_piece("MainActivity.JAVA").hasSuffix("JAVA"));
+  EXPECT_FALSE(w_string_piece("MainActivity.@AVA").hasSuffix("`ava"));
+  EXPECT_FALSE(w_string_piece("java").hasSuffix("java"));
+}
+
 TEST(String, path_cat) {
   auto str = w_string::pathCat({"foo", ""});
   EXPECT_EQ(str, "foo");
@@ -442,3 +467,30 @@ TEST(String, contains) {
   EXPECT_TRUE(haystack.contains("watchman"));
   EXPECT_FALSE(haystack.contains("watchman2"));
 }
+
+TEST(String, hash_values) {
+  // Strings and pieces of them key the same hash tables, whichever hash
+  // function the build uses.
+  w_string path{"fbcode/watchman/InMemoryView.cpp"};
+  EXPECT_EQ(w_string_hval(path), w_string_piece{path}.hashValue());
+  EXPECT_EQ(
+      std::hash<w_string>{}(path),
+      std::hash<w_string_piece>{}(w_string_piece{path}));
+  EXPECT_EQ(
+      w_hash_bytes(path.data(), path.size(), 0),
+      w_string_piece{path}.stableHashValue());
+
+  // Every length takes a different path through wyhash.
+  std::string key;
+  std::unordered_set<uint64_t> seen;
+  for (size_t len = 0; len <= 100; ++len) {
+    EXPECT_TRUE(seen.insert(w_wyhash_bytes(key.data(), key.size(), 0)).second);
+    EXPECT_NE(
+        w_wyhash_bytes(key.data(), key.size(), 0),
+        w_wyhash_bytes(key.data(), key.size(), 1));
+    key.push_back(char('a' + len % 26));
+  }
+  EXPECT_NE(
+      w_wyhash_bytes("src/main.cpp", 12, 0),
+      w_wyhash_bytes("src/main.cpq", 12, 0));
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <stdexcept>
+
+#include "watchman/ThreadClass.h"
+
+using namespace watchman;
+
+namespace {
+
+ThreadClassPolicy parse(const char* input) {
+  json_error_t jerr;
+  auto value = json_loads(input, 0, &jerr);
+  EXPECT_TRUE(value) << input;
+  return ThreadClassPolicy::parse(*value);
+}
+
+} // namespace
+
+TEST(ThreadClassTest, empty_policy_leaves_thread_alone) {
+  auto policy = parse("{}");
+  EXPECT_FALSE(policy.nice);
+  EXPECT_FALSE(policy.ioPriorityClass);
+  EXPECT_TRUE(policy.cpus.empty());
+}
+
+TEST(ThreadClassTest, parses_every_field) {
+  auto policy = parse(
+      R"({"nice": 10, "ioprio_class": "idle", "ioprio_level": 7,)"
+      R"( "cpus": [0, 2]})");
+  EXPECT_EQ(10, *policy.nice);
+  EXPECT_EQ(IoPriorityClass::Idle, *policy.ioPriorityClass);
+  EXPECT_EQ(7, policy.ioPriorityLevel);
+  EXPECT_EQ((std::vector<unsigned>{0, 2}), policy.cpus);
+
+  EXPECT_EQ(
+      IoPriorityClass::RealTime,
+      *parse(R"({"ioprio_class": "realtime"})").ioPriorityClass);
+  EXPECT_EQ(
+      IoPriorityClass::BestEffort,
+      *parse(R"({"ioprio_class": "best-effort"})").ioPriorityClass);
+}
+
+TEST(ThreadClassTest, rejects_bad_values) {
+  EXPECT_THROW(parse("[]"), std::domain_error);
+  EXPECT_THROW(parse(R"({"nice": 20})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"nice": "low"})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"ioprio_class": "fast"})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"ioprio_level": 8})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"cpus": 1})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"cpus": [-1]})"), std::domain_error);
+}
+
+TEST(ThreadClassTest, every_class_has_a_name) {
+  for (auto cls :
+       {ThreadClass::Notify,
+        ThreadClass::Io,
+        ThreadClass::Accept,
+        ThreadClass::Client,
+        ThreadClass::Worker,
+        ThreadClass::Walker}) {
+    EXPECT_NE("unknown", threadClassName(cls));
+  }
+}
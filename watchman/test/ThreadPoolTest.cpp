@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadPool.h"
+#include <folly/futures/Future.h>
+#include <folly/portability/GTest.h>
+#include <folly/synchronization/Baton.h>
+#include <atomic>
+#include <vector>
+
+using namespace watchman;
+
+TEST(ThreadPool, runs_every_task) {
+  ThreadPool pool;
+  pool.start(4, 1024);
+
+  std::atomic<int> ran{0};
+  std::vector<folly::Future<folly::Unit>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(folly::via(&pool, [&] { ++ran; }));
+  }
+  folly::collectAll(std::move(futures)).get();
+  EXPECT_EQ(100, ran.load());
+}
+
+TEST(ThreadPool, tasks_added_by_tasks_run) {
+  ThreadPool pool;
+  pool.start(2, 1024);
+
+  folly::Baton<> done;
+  pool.add([&] { pool.add([&] { done.post(); }); });
+  EXPECT_TRUE(done.try_wait_for(std::chrono::seconds(10)));
+}
+
+TEST(ThreadPool, background_tasks_are_limited) {
+  ThreadPool pool;
+  pool.start(4, 1024, 1);
+
+  // Occupy the only background place.
+  folly::Baton<> release;
+  folly::Baton<> started;
+  pool.addWithPriority(
+      [&] {
+        started.post();
+        release.wait();
+      },
+      ThreadPool::kBackground);
+  ASSERT_TRUE(started.try_wait_for(std::chrono::seconds(10)));
+
+  std::atomic<bool> secondRan{false};
+  folly::Baton<> secondDone;
+  pool.addWithPriority(
+      [&] {
+        secondRan = true;
+        secondDone.post();
+      },
+      ThreadPool::kBackground);
+
+  // Interactive tasks still have workers to run on.
+  folly::Baton<> interactive;
+  pool.add([&] { interactive.post(); });
+  EXPECT_TRUE(interactive.try_wait_for(std::chrono::seconds(10)));
+  EXPECT_FALSE(secondRan.load());
+
+  release.post();
+  EXPECT_TRUE(secondDone.try_wait_for(std::chrono::seconds(10)));
+}
+
+TEST(ThreadPool, stop_runs_queued_tasks) {
+  std::atomic<int> ran{0};
+  {
+    ThreadPool pool;
+    pool.start(1, 1024);
+    for (int i = 0; i < 10; ++i) {
+      pool.addWithPriority([&] { ++ran; }, ThreadPool::kBackground);
+      pool.add([&] { ++ran; });
+    }
+    pool.stop();
+    EXPECT_THROW(pool.add([] {}), std::runtime_error);
+  }
+  EXPECT_EQ(20, ran.load());
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/TickIndex.h"
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <filesystem>
+#include <fstream>
+
+using namespace watchman;
+
+namespace {
+
+TickIndexFile makeFile(const char* name, ClockTicks ticks, bool exists) {
+  TickIndexFile file;
+  file.name = name;
+  file.otime = ClockStamp{ticks, time_t(1000 + ticks)};
+  file.ctime = ClockStamp{ticks - 1, time_t(999 + ticks)};
+  file.exists = exists;
+  file.stat.mtime = {10, 20};
+  file.stat.ctime = {30, 40};
+  file.stat.size = 1234;
+  file.stat.ino = 5678 + ticks;
+  file.stat.mode = S_IFREG | 0644;
+  file.stat.extraDigest = 0xdeadbeefcafef00d;
+  return file;
+}
+
+} // namespace
+
+TEST(TickIndexTest, round_trip) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "index"});
+
+  TickIndexHeader header;
+  header.rootPath = "/some/root";
+  header.clock.start_time = 123456;
+  header.clock.pid = 42;
+  header.clock.rootNumber = 3;
+  header.clock.lastTicks = 99;
+  header.lastAgeOutTicks = 7;
+  header.rootInode = 11;
+  header.watcherCursor = "journal:1234";
+
+  {
+    TickIndexWriter writer{path, header};
+    writer.addDir("");
+    writer.addFile(makeFile("a", 10, true));
+    writer.addDir("sub/dir");
+    writer.addFile(makeFile("b", 20, false));
+    writer.addFile(makeFile("c", 30, true));
+    writer.commit();
+  }
+
+  TickIndexReader reader{path.c_str()};
+  EXPECT_EQ(header.rootPath, reader.header().rootPath);
+  EXPECT_EQ(123456, reader.header().clock.start_time);
+  EXPECT_EQ(42, reader.header().clock.pid);
+  EXPECT_EQ(3, reader.header().clock.rootNumber);
+  EXPECT_EQ(99, reader.header().clock.lastTicks);
+  EXPECT_EQ(7, reader.header().lastAgeOutTicks);
+  EXPECT_EQ(11, reader.header().rootInode);
+  EXPECT_EQ(w_string{"journal:1234"}, reader.header().watcherCursor);
+
+  ASSERT_EQ(TickIndexReader::Record::Dir, reader.next());
+  EXPECT_EQ(w_string{}, reader.dir());
+  ASSERT_EQ(TickIndexReader::Record::File, reader.next());
+  EXPECT_EQ(w_string{"a"}, reader.file().name);
+  EXPECT_TRUE(reader.file().exists);
+  EXPECT_FALSE(reader.file().stat.differsFrom(makeFile("a", 10, true).stat));
+
+  ASSERT_EQ(TickIndexReader::Record::Dir, reader.next());
+  EXPECT_EQ(w_string{"sub/dir"}, reader.dir());
+  ASSERT_EQ(TickIndexReader::Record::File, reader.next());
+  EXPECT_EQ(w_string{"b"}, reader.file().name);
+  EXPECT_FALSE(reader.file().exists);
+  EXPECT_EQ(20, reader.file().otime.ticks);
+  EXPECT_EQ(1020, reader.file().otime.timestamp);
+  EXPECT_EQ(19, reader.file().ctime.ticks);
+  ASSERT_EQ(TickIndexReader::Record::File, reader.next());
+  EXPECT_EQ(w_string{"c"}, reader.file().name);
+  EXPECT_EQ(5708, reader.file().stat.ino);
+
+  EXPECT_EQ(TickIndexReader::Record::End, reader.next());
+}
+
+TEST(TickIndexTest, uncommitted_index_leaves_previous_in_place) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "index"});
+
+  TickIndexHeader header;
+  header.rootPath = "/first";
+  {
+    TickIndexWriter writer{path, header};
+    writer.commit();
+  }
+
+  header.rootPath = "/second";
+  {
+    TickIndexWriter writer{path, header};
+    writer.addDir("");
+  }
+
+  TickIndexReader reader{path.c_str()};
+  EXPECT_EQ(w_string{"/first"}, reader.header().rootPath);
+  EXPECT_EQ(TickIndexReader::Record::End, reader.next());
+}
+
+TEST(TickIndexTest, rejects_truncated_and_foreign_files) {
+  folly::test::TemporaryDirectory dir;
+  auto path = w_string::pathCat({dir.path().string(), "index"});
+
+  EXPECT_THROW(TickIndexReader{path.c_str()}, std::system_error);
+
+  {
+    std::ofstream out{path.c_str()};
+    out << "not a tick index";
+  }
+  EXPECT_THROW(TickIndexReader{path.c_str()}, std::runtime_error);
+
+  {
+    TickIndexHeader header;
+    header.rootPath = "/root";
+    TickIndexWriter writer{path, header};
+    writer.addDir("");
+    writer.addFile(makeFile("a", 10, true));
+    writer.commit();
+  }
+  // Drop the end marker and part of the file record.
+  auto size = std::filesystem::file_size(path.c_str());
+  std::filesystem::resize_file(path.c_str(), size - 8);
+
+  TickIndexReader reader{path.c_str()};
+  ASSERT_EQ(TickIndexReader::Record::Dir, reader.next());
+  EXPECT_THROW(reader.next(), std::runtime_error);
+}
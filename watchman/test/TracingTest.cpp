@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Tracing.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include <vector>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+// The spans are process-wide, so tests find theirs by root.
+std::vector<json_ref> spansOf(const json_ref& trace, uint32_t rootId) {
+  std::vector<json_ref> spans;
+  for (auto& event : trace.get("traceEvents").array()) {
+    if (event.get("ph").asString() == "X" &&
+        event.get("pid").asInt() == rootId) {
+      spans.push_back(event);
+    }
+  }
+  return spans;
+}
+
+} // namespace
+
+TEST(Tracing, root_ids_are_stable) {
+  auto id = getTraceRootId(w_string{"/tracing/stable"});
+  EXPECT_NE(0, id);
+  EXPECT_EQ(id, getTraceRootId(w_string{"/tracing/stable"}));
+  EXPECT_NE(id, getTraceRootId(w_string{"/tracing/other"}));
+}
+
+TEST(Tracing, spans_are_chrome_complete_events) {
+  auto rootId = getTraceRootId(w_string{"/tracing/events"});
+  auto start = std::chrono::steady_clock::now();
+  setTraceClientId(42);
+  recordSpan("generate", rootId, start, start + 1500us);
+  setTraceClientId(0);
+
+  auto trace = traceToChromeJson(rootId);
+  auto spans = spansOf(trace, rootId);
+  ASSERT_EQ(1, spans.size());
+  EXPECT_EQ(w_string{"generate"}, spans[0].get("name").asString());
+  EXPECT_EQ(1500, spans[0].get("dur").asInt());
+  EXPECT_EQ(42, spans[0].get("args").get("client").asInt());
+
+  bool named = false;
+  for (auto& event : trace.get("traceEvents").array()) {
+    if (event.get("ph").asString() == "M" &&
+        event.get("name").asString() == "process_name" &&
+        event.get("pid").asInt() == rootId) {
+      EXPECT_EQ(
+          w_string{"/tracing/events"},
+          event.get("args").get("name").asString());
+      named = true;
+    }
+  }
+  EXPECT_TRUE(named);
+}
+
+TEST(Tracing, filtering_by_root_keeps_spans_of_no_root) {
+  auto rootId = getTraceRootId(w_string{"/tracing/filtered"});
+  auto otherId = getTraceRootId(w_string{"/tracing/unwanted"});
+  { TraceScope span{"query", rootId}; }
+  { TraceScope span{"query", otherId}; }
+  { TraceScope span{"encode", 0}; }
+
+  auto trace = traceToChromeJson(rootId);
+  EXPECT_EQ(1, spansOf(trace, rootId).size());
+  EXPECT_EQ(0, spansOf(trace, otherId).size());
+  EXPECT_LE(1, spansOf(trace, 0).size());
+}
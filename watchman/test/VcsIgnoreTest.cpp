@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/VcsIgnore.h"
+#include <folly/portability/GTest.h>
+#include <cstring>
+
+using namespace watchman;
+
+namespace {
+
+bool isIgnoredDir(const VcsIgnoreRules& rules, const char* path) {
+  return rules.ignoredPrefix(path) == strlen(path);
+}
+
+} // namespace
+
+TEST(VcsIgnore, gitignore_patterns) {
+  VcsIgnoreRules rules;
+  rules.addGitIgnore(
+      "# build products\n"
+      "buck-out/\n"
+      "/out\n"
+      "*.egg-info\n"
+      "docs/_build\n"
+      "**/node_modules\n"
+      "\n");
+
+  EXPECT_TRUE(isIgnoredDir(rules, "buck-out"));
+  EXPECT_TRUE(isIgnoredDir(rules, "sub/buck-out"));
+  EXPECT_TRUE(isIgnoredDir(rules, "out"));
+  EXPECT_FALSE(isIgnoredDir(rules, "sub/out"));
+  EXPECT_TRUE(isIgnoredDir(rules, "a/b/foo.egg-info"));
+  EXPECT_TRUE(isIgnoredDir(rules, "docs/_build"));
+  EXPECT_FALSE(isIgnoredDir(rules, "other/docs/_build"));
+  EXPECT_TRUE(isIgnoredDir(rules, "node_modules"));
+  EXPECT_TRUE(isIgnoredDir(rules, "web/app/node_modules"));
+  EXPECT_FALSE(isIgnoredDir(rules, "src"));
+  EXPECT_FALSE(isIgnoredDir(rules, "# build products"));
+}
+
+TEST(VcsIgnore, only_the_shallowest_ignored_dir_counts) {
+  VcsIgnoreRules rules;
+  rules.addGitIgnore("node_modules\n");
+
+  EXPECT_EQ(
+      strlen("web/node_modules"), rules.ignoredPrefix("web/node_modules"));
+  EXPECT_EQ(
+      strlen("web/node_modules"),
+      rules.ignoredPrefix("web/node_modules/dep/node_modules"));
+  EXPECT_FALSE(isIgnoredDir(rules, "web/node_modules/dep/node_modules"));
+  EXPECT_EQ(0, rules.ignoredPrefix("web/src"));
+}
+
+TEST(VcsIgnore, later_rules_and_negations_take_precedence) {
+  VcsIgnoreRules rules;
+  rules.addGitIgnore("build*\n!buildtools\n");
+
+  EXPECT_TRUE(isIgnoredDir(rules, "build"));
+  EXPECT_TRUE(isIgnoredDir(rules, "build-debug"));
+  EXPECT_FALSE(isIgnoredDir(rules, "buildtools"));
+
+  // As if .gitignore followed .git/info/exclude.
+  rules.addGitIgnore("!build-debug\n");
+  EXPECT_FALSE(isIgnoredDir(rules, "build-debug"));
+  EXPECT_TRUE(isIgnoredDir(rules, "build"));
+}
+
+TEST(VcsIgnore, hgignore_syntaxes) {
+  VcsIgnoreRules rules;
+  rules.addHgIgnore(
+      "^out/ # regexps by default\n"
+      "\\.cache$\n"
+      "syntax: glob\n"
+      "*.pyc\n"
+      "generated\n"
+      "rootglob:third-party/*/build\n"
+      "path:literal[dir]\n"
+      "re:^tmp\n"
+      "syntax: rootglob\n"
+      "dist\n");
+
+  EXPECT_TRUE(isIgnoredDir(rules, "out"));
+  EXPECT_FALSE(isIgnoredDir(rules, "sub/out"));
+  EXPECT_TRUE(isIgnoredDir(rules, "a/b.cache"));
+  EXPECT_TRUE(isIgnoredDir(rules, "x/y/generated"));
+  EXPECT_TRUE(isIgnoredDir(rules, "z.pyc"));
+  EXPECT_TRUE(isIgnoredDir(rules, "third-party/lib/build"));
+  EXPECT_FALSE(isIgnoredDir(rules, "src/third-party/lib/build"));
+  EXPECT_TRUE(isIgnoredDir(rules, "literal[dir]"));
+  EXPECT_FALSE(isIgnoredDir(rules, "literald"));
+  EXPECT_TRUE(isIgnoredDir(rules, "tmpfiles"));
+  EXPECT_TRUE(isIgnoredDir(rules, "dist"));
+  EXPECT_FALSE(isIgnoredDir(rules, "src/dist"));
+  EXPECT_FALSE(isIgnoredDir(rules, "src"));
+}
+
+TEST(VcsIgnore, invalid_hg_regexps_are_skipped) {
+  VcsIgnoreRules rules;
+  rules.addHgIgnore("(unbalanced\n^ok$\n");
+
+  EXPECT_EQ(1, rules.size());
+  EXPECT_TRUE(isIgnoredDir(rules, "ok"));
+}
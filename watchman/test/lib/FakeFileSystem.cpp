@@ -125,6 +125,7 @@ class FakeDirHandle : public DirHandle {
  public:
   struct FakeDirEntry {
     std::string name;
+    DType dtype{DType::Unknown};
     std::optional<FileInformation> stat;
   };
 
@@ -139,6 +140,7 @@ class FakeDirHandle : public DirHandle {
     auto& e = entries_[idx_++];
     current_.has_stat = e.stat.has_value();
     current_.d_name = e.name.c_str();
+    current_.dtype = e.dtype;
     current_.stat = e.stat ? e.stat.value() : FileInformation{};
     return &current_;
   }
@@ -176,6 +178,7 @@ std::unique_ptr<DirHandle> FakeFileSystem::openDir(
         for (auto& [name, child] : inode.children) {
           FakeDirHandle::FakeDirEntry entry;
           entry.name = name;
+          entry.dtype = child.metadata.dtype();
           if (flags_.includeReadDirStat) {
             entry.stat = child.metadata;
           }
@@ -232,7 +235,6 @@ void FakeFileSystem::addNode(const char* path, const FileInformation& fi) {
 
   auto piece = parseAbsolute(path);
   while (!piece.empty()) {
-    fmt::print("piece = {}\n", piece);
     size_t idx = piece.find('/');
     folly::StringPiece this_level;
     if (idx == folly::StringPiece::npos) {
@@ -291,6 +293,27 @@ void FakeFileSystem::removeRecursively(const char* path) {
   });
 }
 
+void FakeFileSystem::rename(const char* from, const char* to) {
+  auto fromPair = parseAbsoluteBasename(from);
+  auto toPair = parseAbsoluteBasename(to);
+  auto root = root_.wlock();
+  auto node = withPath(*root, fromPair.first, "rename", [&](FakeInode& parent) {
+    auto it = parent.children.find(fromPair.second.str());
+    if (it == parent.children.end()) {
+      throw std::system_error(
+          ENOENT,
+          std::generic_category(),
+          fmt::format("{} does not exist", from));
+    }
+    auto moved = std::move(it->second);
+    parent.children.erase(it);
+    return moved;
+  });
+  withPath(*root, toPair.first, "rename", [&](FakeInode& parent) {
+    parent.children.insert_or_assign(toPair.second.str(), std::move(node));
+  });
+}
+
 FileInformation FakeFileSystem::fakeDir() {
   FileInformation fi{};
   fi.mode = S_IFDIR;
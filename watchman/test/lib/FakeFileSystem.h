@@ -71,6 +71,10 @@ class FakeFileSystem final : public FileSystem {
 
   void removeRecursively(const char* path);
 
+  // Moves the node at from, with everything below it, to to, whose parent
+  // must exist.
+  void rename(const char* from, const char* to);
+
   FileInformation fakeDir();
   FileInformation fakeFile();
 
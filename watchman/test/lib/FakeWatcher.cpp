@@ -10,8 +10,8 @@
 
 namespace watchman {
 
-FakeWatcher::FakeWatcher(FileSystem& fileSystem)
-    : Watcher{"FakeWatcher", 0}, fileSystem_{fileSystem} {}
+FakeWatcher::FakeWatcher(FileSystem& fileSystem, unsigned flags)
+    : Watcher{"FakeWatcher", flags}, fileSystem_{fileSystem} {}
 
 std::unique_ptr<DirHandle> FakeWatcher::startWatchDir(
     const std::shared_ptr<Root>& root,
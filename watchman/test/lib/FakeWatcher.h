@@ -15,7 +15,7 @@ class FileSystem;
 
 class FakeWatcher : public Watcher {
  public:
-  explicit FakeWatcher(FileSystem& fileSystem);
+  explicit FakeWatcher(FileSystem& fileSystem, unsigned flags = 0);
 
   std::unique_ptr<DirHandle> startWatchDir(
       const std::shared_ptr<Root>& root,
@@ -64,52 +64,98 @@ static int dump_indent(
   return 0;
 }
 
+/* Whether a byte can be copied to the output without escaping it */
+static inline bool is_plain_byte(unsigned char c, size_t flags) {
+  return c >= 0x20 && c < 0x80 && c != '\\' && c != '"' &&
+      !((flags & JSON_ESCAPE_SLASH) && c == '/');
+}
+
+/* Whether any of the 8 bytes in word is not plain: a control character,
+ * a backslash, a double quote, a non-ASCII byte, or a slash if those are
+ * escaped. */
+static inline bool has_special_byte(uint64_t word, size_t flags) {
+  constexpr uint64_t ones = ~uint64_t(0) / 255;
+  constexpr uint64_t high_bits = ones * 0x80;
+  /* Non-zero if any byte of x is less than n, for n <= 0x80 */
+#define HAS_BYTE_LESS_THAN(x, n) (((x) - ones * (n)) & ~(x) & high_bits)
+
+  uint64_t special = word & high_bits;
+  special |= HAS_BYTE_LESS_THAN(word, 0x20);
+  special |= HAS_BYTE_LESS_THAN(word ^ (ones * '\\'), 1);
+  special |= HAS_BYTE_LESS_THAN(word ^ (ones * '"'), 1);
+  if (flags & JSON_ESCAPE_SLASH) {
+    special |= HAS_BYTE_LESS_THAN(word ^ (ones * '/'), 1);
+  }
+#undef HAS_BYTE_LESS_THAN
+  return special != 0;
+}
+
+/* Returns the first byte from pos that is not plain, or end. Most strings,
+ * such as file names, are entirely plain, so this checks 8 bytes at a
+ * time. */
+static const char* skip_plain_bytes(
+    const char* pos,
+    const char* end,
+    size_t flags) {
+  while (end - pos >= 8) {
+    uint64_t word;
+    memcpy(&word, pos, sizeof(word));
+    if (has_special_byte(word, flags)) {
+      break;
+    }
+    pos += 8;
+  }
+  while (pos < end && is_plain_byte(*pos, flags)) {
+    ++pos;
+  }
+  return pos;
+}
+
 static int dump_string(
     const char* str,
+    size_t len,
     json_dump_callback_t dump,
     void* data,
     size_t flags) {
-  const char *pos, *end;
-  int32_t codepoint;
+  const char* end = str + len;
+  /* The start of the bytes that are yet to be dumped */
+  const char* pos = str;
+  const char* cur = str;
 
   if (dump("\"", 1, data))
     return -1;
 
-  end = pos = str;
   while (1) {
     const char* text;
     char seq[13];
     int length;
+    int32_t codepoint;
+    int count = 1;
+
+    cur = skip_plain_bytes(cur, end, flags);
+    if (cur == end)
+      break;
 
-    while (*end) {
-      end = utf8_iterate(pos, &codepoint);
-      if (!end) {
+    codepoint = (unsigned char)*cur;
+    if (codepoint > 0x7F) {
+      count = utf8_check_first(*cur);
+      if (count <= 0 || count > end - cur ||
+          !utf8_check_full(cur, count, &codepoint)) {
         return -1;
       }
 
-      /* mandatory escape or control char */
-      if (codepoint == '\\' || codepoint == '"' || codepoint < 0x20)
-        break;
-
-      /* slash */
-      if ((flags & JSON_ESCAPE_SLASH) && codepoint == '/')
-        break;
-
-      /* non-ASCII */
-      if ((flags & JSON_ENSURE_ASCII) && codepoint > 0x7F)
-        break;
-
-      pos = end;
+      /* non-ASCII is only escaped on request */
+      if (!(flags & JSON_ENSURE_ASCII)) {
+        cur += count;
+        continue;
+      }
     }
 
-    if (pos != str) {
-      if (dump(str, pos - str, data))
+    if (cur != pos) {
+      if (dump(pos, cur - pos, data))
         return -1;
     }
 
-    if (end == pos)
-      break;
-
     /* handle \, /, ", and control codes */
     length = 2;
     switch (codepoint) {
@@ -164,12 +210,93 @@ static int dump_string(
     if (dump(text, length, data))
       return -1;
 
-    str = pos = end;
+    cur += count;
+    pos = cur;
+  }
+
+  if (cur != pos) {
+    if (dump(pos, cur - pos, data))
+      return -1;
   }
 
   return dump("\"", 1, data);
 }
 
+static int dump_string(
+    const w_string& str,
+    json_dump_callback_t dump,
+    void* data,
+    size_t flags) {
+  return dump_string(str.data(), str.size(), dump, data, flags);
+}
+
+static int do_dump(
+    const json_ref& json,
+    size_t flags,
+    int depth,
+    json_dump_callback_t dump,
+    void* data);
+
+/* An array with a template may hold each of its objects as an array of
+ * values in the order of the template's keys. Dump such a row as the object
+ * that it stands for. */
+static int dump_template_row(
+    const json_ref& row,
+    const json_ref& templ,
+    size_t flags,
+    int depth,
+    json_dump_callback_t dump,
+    void* data) {
+  auto& values = row.array();
+  auto& keys = templ.array();
+  size_t n = std::min(values.size(), keys.size());
+  const char* separator = (flags & JSON_COMPACT) ? ":" : ": ";
+  int separator_length = (flags & JSON_COMPACT) ? 1 : 2;
+
+  std::vector<size_t> sorted;
+  if (flags & JSON_SORT_KEYS) {
+    sorted.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      sorted[i] = i;
+    }
+    std::sort(sorted.begin(), sorted.end(), [&](size_t a, size_t b) {
+      return json_to_w_string(keys[a]) < json_to_w_string(keys[b]);
+    });
+  }
+
+  if (dump("{", 1, data)) {
+    return -1;
+  }
+  if (n == 0) {
+    return dump("}", 1, data);
+  }
+  if (dump_indent(flags, depth + 1, 0, dump, data)) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    size_t idx = sorted.empty() ? i : sorted[i];
+
+    dump_string(json_to_w_string(keys[idx]), dump, data, flags);
+    if (dump(separator, separator_length, data) ||
+        do_dump(values[idx], flags, depth + 1, dump, data)) {
+      return -1;
+    }
+
+    if (i < n - 1) {
+      if (dump(",", 1, data) || dump_indent(flags, depth + 1, 1, dump, data)) {
+        return -1;
+      }
+    } else {
+      if (dump_indent(flags, depth, 0, dump, data)) {
+        return -1;
+      }
+    }
+  }
+
+  return dump("}", 1, data);
+}
+
 static int do_dump(
     const json_ref& json,
     size_t flags,
@@ -216,10 +343,11 @@ static int do_dump(
     }
 
     case JSON_STRING:
-      return dump_string(json_string_value(json), dump, data, flags);
+      return dump_string(json_to_w_string(json), dump, data, flags);
 
     case JSON_ARRAY: {
       auto& arr = json.array();
+      auto& templ = json_to_array(json.get())->templ;
 
       if (dump("[", 1, data)) {
         return -1;
@@ -231,7 +359,12 @@ static int do_dump(
         return -1;
 
       for (size_t i = 0; i < arr.size(); ++i) {
-        if (do_dump(arr[i], flags, depth + 1, dump, data)) {
+        if (templ && arr[i].isArray()) {
+          if (dump_template_row(
+                  arr[i], *templ, flags, depth + 1, dump, data)) {
+            return -1;
+          }
+        } else if (do_dump(arr[i], flags, depth + 1, dump, data)) {
           return -1;
         }
 
@@ -278,7 +411,7 @@ static int do_dump(
       }
 
       if (flags & JSON_SORT_KEYS) {
-        using Pair = std::pair<const w_string, json_ref>;
+        using Pair = const json_object_map::value_type;
 
         std::vector<Pair*> items;
         items.reserve(object->map.size());
@@ -294,7 +427,7 @@ static int do_dump(
         while (sorted_it != items.end()) {
           auto next = std::next(sorted_it);
 
-          dump_string((*sorted_it)->first.c_str(), dump, data, flags);
+          dump_string((*sorted_it)->first, dump, data, flags);
           if (dump(separator, separator_length, data) ||
               do_dump((*sorted_it)->second, flags, depth + 1, dump, data)) {
             return -1;
@@ -317,7 +450,7 @@ static int do_dump(
         while (it != object->map.end()) {
           auto next = std::next(it);
 
-          dump_string(it->first.c_str(), dump, data, flags);
+          dump_string(it->first, dump, data, flags);
           if (dump(separator, separator_length, data) ||
               do_dump(it->second, flags, depth + 1, dump, data)) {
             return -1;
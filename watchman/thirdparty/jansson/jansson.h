@@ -14,6 +14,7 @@
 #include <atomic>
 #include <cstdlib> /* for size_t */
 #include <map>
+#include <memory>
 #include <optional>
 #include <string>
 #include <type_traits>
@@ -36,6 +37,8 @@ enum json_type : char {
 
 struct json_t {
   json_type type;
+  // From watchman::sampleHeapAllocation
+  uint8_t heapSample{0};
   std::atomic<size_t> refcount;
 
   explicit json_t(json_type type);
@@ -49,6 +52,8 @@ struct json_t {
 #define JSON_INTEGER_FORMAT PRId64
 using json_int_t = int64_t;
 
+class json_object_map;
+
 class json_ref {
   // ref_ is never a null pointer. The moved-from json_ref points to the JSON
   // null singleton.
@@ -147,7 +152,7 @@ class json_ref {
    * Throws domain_error if this is not an object.
    * This is useful for iterating over the object contents, etc.
    */
-  const std::unordered_map<w_string, json_ref>& object() const;
+  const json_object_map& object() const;
 
   /** Returns a reference to the array value at the specified index.
    * Throws out_of_range or domain_error if the index is bad or if
@@ -209,9 +214,77 @@ class json_ref {
   json_int_t asInt() const;
 };
 
+/**
+ * The members of a JSON object, in the order they were first set.
+ *
+ * Most objects have a handful of keys, so they are kept in a flat vector and
+ * searched linearly, which costs a single allocation. Objects that grow past
+ * kIndexThreshold keys also get a hash index of them.
+ */
+class json_object_map {
+ public:
+  using value_type = std::pair<w_string, json_ref>;
+  using iterator = std::vector<value_type>::iterator;
+  using const_iterator = std::vector<value_type>::const_iterator;
+
+  static constexpr size_t kIndexThreshold = 16;
+
+  json_object_map() = default;
+  explicit json_object_map(std::unordered_map<w_string, json_ref> map);
+  json_object_map(const json_object_map& other);
+  json_object_map& operator=(const json_object_map& other);
+  json_object_map(json_object_map&&) noexcept = default;
+  json_object_map& operator=(json_object_map&&) noexcept = default;
+
+  const_iterator begin() const {
+    return items_.begin();
+  }
+  const_iterator end() const {
+    return items_.end();
+  }
+  size_t size() const {
+    return items_.size();
+  }
+  bool empty() const {
+    return items_.empty();
+  }
+  void reserve(size_t n) {
+    items_.reserve(n);
+  }
+
+  const_iterator find(w_string_piece key) const {
+    return items_.begin() + indexOf(key);
+  }
+  iterator find(w_string_piece key) {
+    return items_.begin() + indexOf(key);
+  }
+  size_t count(w_string_piece key) const {
+    return indexOf(key) == items_.size() ? 0 : 1;
+  }
+
+  /**
+   * Throws std::out_of_range if key is not present.
+   */
+  const json_ref& at(w_string_piece key) const;
+
+  void insert_or_assign(w_string key, json_ref value);
+
+ private:
+  // Returns the position of key in items_, or items_.size() if it is not
+  // present.
+  size_t indexOf(w_string_piece key) const;
+  void buildIndex();
+
+  std::vector<value_type> items_;
+  // Keyed by pieces of the keys in items_, whose storage does not move when
+  // items_ does.
+  std::unique_ptr<std::unordered_map<w_string_piece, uint32_t>> index_;
+};
+
 /* construction, destruction, reference counting */
 
 json_ref json_object();
+json_ref json_object(json_object_map values);
 json_ref json_object(std::unordered_map<w_string, json_ref> values);
 json_ref json_object(
     std::initializer_list<std::pair<const char*, json_ref>> values);
@@ -15,12 +15,11 @@
 #include "jansson.h"
 
 struct json_object_t : json_t {
-  std::unordered_map<w_string, json_ref> map;
+  json_object_map map;
 
-  explicit json_object_t(std::unordered_map<w_string, json_ref> values);
+  explicit json_object_t(json_object_map values);
 
-  typename std::unordered_map<w_string, json_ref>::iterator findCString(
-      const char* key);
+  json_object_map::iterator findCString(const char* key);
 };
 
 struct json_array_t : json_t {
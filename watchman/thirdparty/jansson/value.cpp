@@ -16,6 +16,7 @@
 #include <string>
 
 #include "utf.h"
+#include "watchman/HeapProfile.h"
 #include "watchman/watchman_string.h"
 
 namespace {
@@ -86,7 +87,35 @@ json_ref& json_ref::operator=(json_ref&& other) noexcept {
   return *this;
 }
 
-json_t::json_t(json_type type) : type(type), refcount(1) {}
+namespace {
+
+// The values' own sizes, which leave out what their members hold on the heap.
+size_t json_sizeof(json_type type) {
+  switch (type) {
+    case JSON_OBJECT:
+      return sizeof(json_object_t);
+    case JSON_ARRAY:
+      return sizeof(json_array_t);
+    case JSON_STRING:
+      return sizeof(json_string_t);
+    case JSON_INTEGER:
+      return sizeof(json_integer_t);
+    case JSON_REAL:
+      return sizeof(json_real_t);
+    case JSON_TRUE:
+    case JSON_FALSE:
+    case JSON_NULL:
+      break;
+  }
+  return 0;
+}
+
+} // namespace
+
+json_t::json_t(json_type type)
+    : type(type),
+      heapSample(watchman::sampleHeapAllocation(json_sizeof(type))),
+      refcount(1) {}
 
 json_t::json_t(json_type type, json_t::SingletonHack&&)
     : type(type), refcount(-1) {}
@@ -124,27 +153,105 @@ bool json_ref::asBool() const {
 
 /*** object ***/
 
-const std::unordered_map<w_string, json_ref>& json_ref::object() const {
+json_object_map::json_object_map(std::unordered_map<w_string, json_ref> map) {
+  items_.reserve(map.size());
+  for (auto& [key, value] : map) {
+    items_.emplace_back(key, std::move(value));
+  }
+  if (items_.size() > kIndexThreshold) {
+    buildIndex();
+  }
+}
+
+json_object_map::json_object_map(const json_object_map& other)
+    : items_{other.items_} {
+  if (other.index_) {
+    buildIndex();
+  }
+}
+
+json_object_map& json_object_map::operator=(const json_object_map& other) {
+  if (this != &other) {
+    items_ = other.items_;
+    index_.reset();
+    if (other.index_) {
+      buildIndex();
+    }
+  }
+  return *this;
+}
+
+void json_object_map::buildIndex() {
+  index_ = std::make_unique<std::unordered_map<w_string_piece, uint32_t>>();
+  index_->reserve(items_.size());
+  for (size_t i = 0; i < items_.size(); ++i) {
+    index_->emplace(items_[i].first, uint32_t(i));
+  }
+}
+
+size_t json_object_map::indexOf(w_string_piece key) const {
+  if (index_) {
+    auto it = index_->find(key);
+    return it == index_->end() ? items_.size() : it->second;
+  }
+  for (size_t i = 0; i < items_.size(); ++i) {
+    auto& k = items_[i].first;
+    if (k.size() == key.size() &&
+        memcmp(k.data(), key.data(), key.size()) == 0) {
+      return i;
+    }
+  }
+  return items_.size();
+}
+
+const json_ref& json_object_map::at(w_string_piece key) const {
+  auto i = indexOf(key);
+  if (i == items_.size()) {
+    throw std::out_of_range(
+        fmt::format("key '{}' is not present in this json object", key));
+  }
+  return items_[i].second;
+}
+
+void json_object_map::insert_or_assign(w_string key, json_ref value) {
+  auto i = indexOf(key);
+  if (i != items_.size()) {
+    items_[i].second = std::move(value);
+    return;
+  }
+  items_.emplace_back(std::move(key), std::move(value));
+  if (index_) {
+    index_->emplace(items_.back().first, uint32_t(i));
+  } else if (items_.size() > kIndexThreshold) {
+    buildIndex();
+  }
+}
+
+const json_object_map& json_ref::object() const {
   if (type() != JSON_OBJECT) {
     throw std::domain_error("json_ref::object() called for non-object");
   }
   return json_to_object(ref_)->map;
 }
 
-json_object_t::json_object_t(std::unordered_map<w_string, json_ref> values)
+json_object_t::json_object_t(json_object_map values)
     : json_t{JSON_OBJECT}, map{std::move(values)} {}
 
-json_ref json_object(std::unordered_map<w_string, json_ref> values) {
+json_ref json_object(json_object_map values) {
   return json_ref::takeOwnership(new json_object_t(std::move(values)));
 }
 
+json_ref json_object(std::unordered_map<w_string, json_ref> values) {
+  return json_object(json_object_map{std::move(values)});
+}
+
 json_ref json_object(
     std::initializer_list<std::pair<const char*, json_ref>> values) {
-  std::unordered_map<w_string, json_ref> object;
+  json_object_map object;
   object.reserve(values.size());
 
   for (auto& it : values) {
-    object.emplace(w_string{it.first, W_STRING_UNICODE}, it.second);
+    object.insert_or_assign(w_string{it.first, W_STRING_UNICODE}, it.second);
   }
 
   return json_object(std::move(object));
@@ -162,10 +269,8 @@ size_t json_object_size(const json_ref& json) {
   return json_to_object(json.get())->map.size();
 }
 
-typename std::unordered_map<w_string, json_ref>::iterator
-json_object_t::findCString(const char* key) {
-  w_string key_string(key, W_STRING_BYTE);
-  return map.find(key_string);
+json_object_map::iterator json_object_t::findCString(const char* key) {
+  return map.find(w_string_piece{key});
 }
 
 json_ref json_ref::get_default(const char* key, json_ref defval) const {
@@ -480,6 +585,9 @@ json_ref json_null() {
 /*** deletion ***/
 
 void json_ref::json_delete(json_t* json) {
+  if (json->heapSample) {
+    watchman::releaseHeapSample(json->heapSample);
+  }
   switch (json->type) {
     case JSON_OBJECT:
       delete (json_object_t*)json;
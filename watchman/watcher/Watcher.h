@@ -40,6 +40,13 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
 #define WATCHER_HAS_PER_FILE_NOTIFICATIONS 1
   // if the watcher is comprised of multiple watchers
 #define WATCHER_HAS_SPLIT_WATCH 4
+  // if the FileInformation that this watcher attaches to its pending changes
+  // is complete enough for statPath to use in place of an lstat
+#define WATCHER_SUPPLIES_STAT 8
+  // if flushPendingEvents() is a barrier on its own: once its future is
+  // fulfilled, every change made before it was called has been processed,
+  // so syncing needs no cookie file
+#define WATCHER_SYNCS_WITHOUT_COOKIES 16
   unsigned flags;
 
   Watcher(const char* name, unsigned flags);
@@ -100,6 +107,11 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
   struct ConsumeNotifyRet {
     // Should the watch be cancelled?
     bool cancelSelf;
+    // Are more events likely to arrive imminently, for instance because a
+    // read filled the whole buffer? The notify thread may then hold on to
+    // what it has consumed for a little longer, so that the IO thread
+    // receives it as part of a larger batch.
+    bool moreLikely{false};
   };
 
   /**
@@ -112,6 +124,37 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
       const std::shared_ptr<Root>& root,
       PendingChanges& coll) = 0;
 
+  /**
+   * Returns an opaque position in this watcher's event stream that covers
+   * every event consumed so far, or a null string if the watcher can't
+   * replay its events from a position. Called on the notify thread.
+   */
+  virtual w_string getEventCursor() {
+    return nullptr;
+  }
+
+  /**
+   * Called before start() with a cursor returned by getEventCursor() in an
+   * earlier incarnation of the root, asking the watcher to replay the
+   * events that followed it.
+   */
+  virtual void setResumeCursor(const w_string& /*cursor*/) {}
+
+  /**
+   * After start(), returns true if the watcher is replaying the events that
+   * followed the cursor passed to setResumeCursor().
+   */
+  virtual bool resumedFromCursor() const {
+    return false;
+  }
+
+  /**
+   * Hint that a query or subscription just looked at the files below path,
+   * an absolute path inside the root. Called from query threads, so this
+   * must be cheap.
+   */
+  virtual void noteActiveSubtree(const w_string& /*path*/) {}
+
   /**
    * Returns a JSON value containing this watcher's debug state. Intended for
    * inclusion in diagnostics.
@@ -7,6 +7,7 @@
 
 #include <cpptoml.h>
 #include <folly/String.h>
+#include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
 #include <folly/io/async/AsyncSocket.h>
 #include <folly/io/async/EventBase.h>
@@ -19,7 +20,12 @@
 #include <thrift/lib/cpp2/async/RocketClientChannel.h>
 #include <algorithm>
 #include <chrono>
+#include <deque>
+#include <functional>
 #include <iterator>
+#include <map>
+#include <optional>
+#include <string_view>
 #include <thread>
 #include "eden/fs/service/gen-cpp2/StreamingEdenService.h"
 #include "watchman/ChildProcess.h"
@@ -97,18 +103,86 @@ struct NameAndDType {
       : name(name), dtype(dtype) {}
 };
 
+/**
+ * How EdenFileResult::batchFetchProperties splits up its Thrift requests.
+ */
+struct EdenFetchOptions {
+  // The most names sent to EdenFS in one request.
+  size_t batchSize;
+  // The most requests that may be outstanding at once.
+  size_t maxInFlight;
+  // The most glob patterns sent to EdenFS in one request.
+  size_t globBatchSize;
+  // Whether `dir/**` globs are split by the directories under `dir`.
+  bool shardRecursiveGlobs;
+};
+
+/**
+ * Splits `names` into requests of at most options.batchSize names and keeps
+ * up to options.maxInFlight of them outstanding, so that a large result set
+ * costs roughly one round trip per window of requests rather than per
+ * request. `fetch` issues a request for one slice of names. The results are
+ * returned in the order of `names`; if EdenFS answers a request with the
+ * wrong number of results, it is padded or truncated to keep the rest
+ * aligned.
+ */
+template <typename Result, typename Fetch>
+std::vector<Result> fetchInBatches(
+    const EdenFetchOptions& options,
+    const std::vector<std::string>& names,
+    Fetch&& fetch) {
+  folly::DrivableExecutor* executor =
+      folly::EventBaseManager::get()->getEventBase();
+
+  std::vector<Result> results;
+  results.reserve(names.size());
+  std::deque<std::pair<size_t, folly::Future<std::vector<Result>>>> inFlight;
+  size_t next = 0;
+  while (next < names.size() || !inFlight.empty()) {
+    while (next < names.size() && inFlight.size() < options.maxInFlight) {
+      auto end = std::min(names.size(), next + options.batchSize);
+      std::vector<std::string> slice{
+          names.begin() + next, names.begin() + end};
+      inFlight.emplace_back(end - next, fetch(std::move(slice)).via(executor));
+      next = end;
+    }
+
+    auto [expected, future] = std::move(inFlight.front());
+    inFlight.pop_front();
+    auto batch = std::move(future).getVia(executor);
+    if (batch.size() != expected) {
+      log(ERR,
+          "Requested ",
+          expected,
+          " results but Eden returned ",
+          batch.size(),
+          " -- treating the difference as missing");
+      batch.resize(expected);
+    }
+    std::move(batch.begin(), batch.end(), std::back_inserter(results));
+  }
+  return results;
+}
+
 /** This is a helper for settling out subscription events.
  * We have a single instance of the callback object that we schedule
  * each time we get an update from the eden server.  If we are already
  * scheduled we will cancel it and reschedule it.
+ * beforeSettle is called just before the settle is dispatched.
  */
 class SettleCallback : public folly::HHWheelTimer::Callback {
  public:
-  SettleCallback(folly::EventBase* eventBase, std::shared_ptr<Root> root)
-      : eventBase_(eventBase), root_(std::move(root)) {}
+  SettleCallback(
+      folly::EventBase* eventBase,
+      std::shared_ptr<Root> root,
+      std::function<void()> beforeSettle)
+      : eventBase_(eventBase),
+        root_(std::move(root)),
+        beforeSettle_(std::move(beforeSettle)) {}
 
   void timeoutExpired() noexcept override {
     try {
+      beforeSettle_();
       auto settledPayload = json_object({{"settled", json_true()}});
       root_->unilateralResponses->enqueue(std::move(settledPayload));
     } catch (const std::exception& exc) {
@@ -129,6 +203,7 @@ class SettleCallback : public folly::HHWheelTimer::Callback {
  private:
   folly::EventBase* eventBase_;
   std::shared_ptr<Root> root_;
+  std::function<void()> beforeSettle_;
 };
 
 // Resolve the eden socket; On POSIX systems we use the .eden dir that is
@@ -198,17 +273,115 @@ class GetJournalPositionCallback : public folly::HHWheelTimer::Callback {
   std::string mountPoint_;
 };
 
+/**
+ * The SHA-1s that EdenFS returned, by path relative to the mount, kept for
+ * as long as the journal shows that the files haven't changed.
+ *
+ * Before it is consulted, the cache catches up with the journal and forgets
+ * the paths that changed since it last did. A checkout, or a journal that
+ * EdenFS no longer has, makes it forget everything, as the journal doesn't
+ * list the files that a checkout changed.
+ */
+class EdenHashCache {
+ public:
+  explicit EdenHashCache(size_t maxItems)
+      : hashes_{maxItems, std::chrono::milliseconds{0}} {}
+
+  /**
+   * Catches up with the journal of mountPoint. Returns the position that the
+   * cache is current at, to be passed back to insert.
+   */
+  JournalPosition catchUp(
+      StreamingEdenServiceAsyncClient* client,
+      const std::string& mountPoint) {
+    auto position = position_.wlock();
+    JournalPosition current;
+    client->sync_getCurrentJournalPosition(current, mountPoint);
+    if (!position->has_value() ||
+        *(*position)->mountGeneration() != *current.mountGeneration()) {
+      hashes_.clear();
+      *position = std::move(current);
+      return **position;
+    }
+    if (*(*position)->sequenceNumber() == *current.sequenceNumber()) {
+      return **position;
+    }
+
+    try {
+      FileDelta delta;
+      client->sync_getFilesChangedSince(delta, mountPoint, **position);
+      if (!delta.snapshotTransitions()->empty() ||
+          delta.fromPosition()->snapshotHash() !=
+              delta.toPosition()->snapshotHash()) {
+        hashes_.clear();
+      } else {
+        for (auto* paths :
+             {&*delta.changedPaths(),
+              &*delta.createdPaths(),
+              &*delta.removedPaths(),
+              &*delta.uncleanPaths()}) {
+          for (auto& path : *paths) {
+            hashes_.erase(path);
+          }
+        }
+      }
+      *position = *delta.toPosition();
+    } catch (const std::exception& exc) {
+      log(DBG, "forgetting all SHA-1s: ", exc.what(), "\n");
+      hashes_.clear();
+      *position = std::move(current);
+    }
+    return **position;
+  }
+
+  /** The SHA-1 of path, if it is known. */
+  std::optional<std::string> lookup(const std::string& path) {
+    if (auto node = hashes_.get(path)) {
+      return node->value();
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * Remembers hashes, which were fetched after catchUp returned position,
+   * keyed by path. They are dropped if the cache has caught up further in
+   * the meantime, as the files may have changed before they were fetched.
+   */
+  void insert(
+      const JournalPosition& position,
+      std::vector<std::pair<std::string, std::string>>&& hashes) {
+    auto current = position_.rlock();
+    if (!current->has_value() ||
+        *(*current)->mountGeneration() != *position.mountGeneration() ||
+        *(*current)->sequenceNumber() != *position.sequenceNumber()) {
+      return;
+    }
+    for (auto& [path, hash] : hashes) {
+      hashes_.set(path, std::move(hash));
+    }
+  }
+
+ private:
+  LRUCache<std::string, std::string> hashes_;
+  // The changes in the journal up to here have been applied to hashes_
+  folly::Synchronized<std::optional<JournalPosition>> position_;
+};
+
 class EdenFileResult : public FileResult {
  public:
   EdenFileResult(
       const w_string& rootPath,
       std::shared_ptr<apache::thrift::RequestChannel> thriftChannel,
+      std::shared_ptr<const EdenFetchOptions> fetchOptions,
+      std::shared_ptr<EdenHashCache> hashCache,
       const w_string& fullName,
       ClockTicks* ticks = nullptr,
       bool isNew = false,
       DType dtype = DType::Unknown)
       : rootPath_(rootPath),
         thriftChannel_{std::move(thriftChannel)},
+        fetchOptions_{std::move(fetchOptions)},
+        hashCache_{std::move(hashCache)},
         fullName_(fullName),
         dtype_(dtype) {
     otime_.ticks = ctime_.ticks = 0;
@@ -425,6 +598,7 @@ class EdenFileResult : public FileResult {
     auto client = getEdenClient(thriftChannel_);
     loadFileInformation(
         client.get(),
+        *fetchOptions_,
         rootPath_,
         getFileInformationNames,
         getFileInformationFiles,
@@ -433,10 +607,40 @@ class EdenFileResult : public FileResult {
     // TODO: add eden bulk readlink call
     loadSymlinkTargets(client.get(), getSymlinkFiles);
 
+    std::optional<JournalPosition> hashPosition;
+    if (hashCache_ && !getShaFiles.empty()) {
+      try {
+        hashPosition =
+            hashCache_->catchUp(client.get(), std::string{rootPath_.view()});
+      } catch (const std::exception& exc) {
+        log(ERR, "unable to check the SHA-1 cache: ", exc.what(), "\n");
+      }
+    }
+    if (hashPosition) {
+      // Only ask EdenFS for the hashes that aren't cached
+      size_t uncached = 0;
+      for (size_t i = 0; i < getShaFiles.size(); ++i) {
+        if (auto hash = hashCache_->lookup(getShaNames[i])) {
+          getShaFiles[i]->sha1_.emplace();
+          getShaFiles[i]->sha1_->set_sha1(std::move(*hash));
+        } else {
+          if (uncached != i) {
+            getShaFiles[uncached] = getShaFiles[i];
+            getShaNames[uncached] = std::move(getShaNames[i]);
+          }
+          ++uncached;
+        }
+      }
+      getShaFiles.resize(uncached);
+      getShaNames.resize(uncached);
+    }
+
     if (!getShaFiles.empty()) {
-      std::vector<SHA1Result> sha1s;
-      client->sync_getSHA1(
-          sha1s, std::string{rootPath_.view()}, getShaNames, getSyncBehavior());
+      auto sha1s = fetchInBatches<SHA1Result>(
+          *fetchOptions_, getShaNames, [&](std::vector<std::string> names) {
+            return client->semifuture_getSHA1(
+                std::string{rootPath_.view()}, names, getSyncBehavior());
+          });
 
       if (sha1s.size() != getShaFiles.size()) {
         log(ERR,
@@ -446,9 +650,17 @@ class EdenFileResult : public FileResult {
             sha1s.size(),
             " results -- ignoring");
       } else {
+        std::vector<std::pair<std::string, std::string>> fetched;
         auto sha1Iter = sha1s.begin();
-        for (auto& edenFile : getShaFiles) {
-          edenFile->sha1_ = *sha1Iter++;
+        for (size_t i = 0; i < getShaFiles.size(); ++i) {
+          auto& sha1 = *sha1Iter++;
+          if (hashPosition && sha1.getType() == SHA1Result::Type::sha1) {
+            fetched.emplace_back(std::move(getShaNames[i]), sha1.get_sha1());
+          }
+          getShaFiles[i]->sha1_ = std::move(sha1);
+        }
+        if (!fetched.empty()) {
+          hashCache_->insert(*hashPosition, std::move(fetched));
         }
       }
     }
@@ -457,6 +669,9 @@ class EdenFileResult : public FileResult {
  private:
   w_string rootPath_;
   std::shared_ptr<apache::thrift::RequestChannel> thriftChannel_;
+  std::shared_ptr<const EdenFetchOptions> fetchOptions_;
+  // Null when SHA-1s are not cached
+  std::shared_ptr<EdenHashCache> hashCache_;
   w_string fullName_;
   std::optional<FileInformation> stat_;
   std::optional<bool> exists_;
@@ -488,6 +703,7 @@ class EdenFileResult : public FileResult {
 
   static void loadFileInformation(
       StreamingEdenServiceAsyncClient* client,
+      const EdenFetchOptions& options,
       const w_string& rootPath,
       const std::vector<std::string>& names,
       const std::vector<EdenFileResult*>& outFiles,
@@ -520,10 +736,12 @@ class EdenFileResult : public FileResult {
     };
 
     if (onlyEntryInfoNeeded) {
-      std::vector<EntryInformationOrError> info;
       try {
-        client->sync_getEntryInformation(
-            info, std::string{rootPath.view()}, names, getSyncBehavior());
+        auto info = fetchInBatches<EntryInformationOrError>(
+            options, names, [&](std::vector<std::string> slice) {
+              return client->semifuture_getEntryInformation(
+                  std::string{rootPath.view()}, slice, getSyncBehavior());
+            });
         applyResults(info);
         return;
       } catch (const TApplicationException& ex) {
@@ -536,9 +754,11 @@ class EdenFileResult : public FileResult {
       }
     }
 
-    std::vector<FileInformationOrError> info;
-    client->sync_getFileInformation(
-        info, std::string{rootPath.view()}, names, getSyncBehavior());
+    auto info = fetchInBatches<FileInformationOrError>(
+        options, names, [&](std::vector<std::string> slice) {
+          return client->semifuture_getFileInformation(
+              std::string{rootPath.view()}, slice, getSyncBehavior());
+        });
     applyResults(info);
   }
 
@@ -631,53 +851,171 @@ void appendGlobResultToNameAndDTypeVec(
   }
 }
 
-/** Returns the files that match the glob. */
-std::vector<NameAndDType> globNameAndDType(
+namespace {
+
+folly::SemiFuture<Glob> globFiles(
+    StreamingEdenServiceAsyncClient* client,
+    const std::string& mountPoint,
+    std::vector<std::string> globPatterns,
+    bool includeDotfiles) {
+  GlobParams params;
+  params.mountPoint() = mountPoint;
+  params.globs() = std::move(globPatterns);
+  params.includeDotfiles() = includeDotfiles;
+  params.wantDtype() = true;
+  params.sync() = getSyncBehavior();
+  return client->semifuture_globFiles(params);
+}
+
+/**
+ * If the leading components of `pattern` are literal and are followed by a
+ * `**` component, returns those leading components and whatever follows the
+ * `**` component, both without their separating slashes.
+ */
+std::optional<std::pair<std::string, std::string>> splitRecursiveGlob(
+    const std::string& pattern) {
+  size_t start = 0;
+  while (start <= pattern.size()) {
+    auto end = pattern.find('/', start);
+    if (end == std::string::npos) {
+      end = pattern.size();
+    }
+    auto component = std::string_view{pattern}.substr(start, end - start);
+    if (component == "**") {
+      return std::make_pair(
+          start == 0 ? std::string{} : pattern.substr(0, start - 1),
+          end == pattern.size() ? std::string{} : pattern.substr(end + 1));
+    }
+    if (component.find_first_of("*?[]\\") != std::string_view::npos) {
+      return std::nullopt;
+    }
+    start = end + 1;
+  }
+  return std::nullopt;
+}
+
+} // namespace
+
+/**
+ * Evaluates the globs against EdenFS and passes each batch of matches to
+ * `consume` as it arrives.
+ *
+ * A pattern whose leading components are literal and followed by a `**`
+ * component, such as `dir/**`, is split into one request per directory
+ * directly under `dir`, since EdenFS evaluates a single request serially.
+ * The remaining patterns are sent options.globBatchSize at a time, and at
+ * most options.maxInFlight requests are outstanding at once.
+ * A pattern matched by several requests may be reported more than once.
+ */
+template <typename Consume>
+void streamGlobNameAndDType(
     StreamingEdenServiceAsyncClient* client,
     const std::string& mountPoint,
     const std::vector<std::string>& globPatterns,
     bool includeDotfiles,
-    bool splitGlobPattern = false) {
-  // TODO(xavierd): Once the config: "eden_split_glob_pattern" is rolled out
-  // everywhere, remove this code.
-  if (splitGlobPattern && globPatterns.size() > 1) {
-    folly::DrivableExecutor* executor =
-        folly::EventBaseManager::get()->getEventBase();
-
-    std::vector<folly::Future<Glob>> globFutures;
-    globFutures.reserve(globPatterns.size());
-    for (const std::string& globPattern : globPatterns) {
-      GlobParams params;
-      params.mountPoint() = mountPoint;
-      params.globs() = std::vector<std::string>{globPattern};
-      params.includeDotfiles() = includeDotfiles;
-      params.wantDtype() = true;
-      params.sync() = getSyncBehavior();
-
-      globFutures.emplace_back(
-          client->semifuture_globFiles(params).via(executor));
-    }
-
-    std::vector<NameAndDType> allResults;
-    for (folly::Future<Glob>& globFuture : globFutures) {
+    const EdenFetchOptions& options,
+    Consume&& consume) {
+  folly::DrivableExecutor* executor =
+      folly::EventBaseManager::get()->getEventBase();
+
+  std::vector<std::vector<std::string>> requests;
+  std::vector<std::string> unsharded;
+  std::unordered_map<std::string, std::vector<NameAndDType>> listings;
+  for (const auto& pattern : globPatterns) {
+    auto split = options.shardRecursiveGlobs ? splitRecursiveGlob(pattern)
+                                             : std::nullopt;
+    if (!split) {
+      unsharded.push_back(pattern);
+      continue;
+    }
+    const auto& [prefix, suffix] = *split;
+
+    auto it = listings.find(prefix);
+    if (it == listings.end()) {
+      std::vector<NameAndDType> listing;
       appendGlobResultToNameAndDTypeVec(
-          allResults, std::move(globFuture).getVia(executor));
-    }
-    return allResults;
-  } else {
-    GlobParams params;
-    params.mountPoint() = mountPoint;
-    params.globs() = globPatterns;
-    params.includeDotfiles() = includeDotfiles;
-    params.wantDtype() = true;
-    params.sync() = getSyncBehavior();
-
-    Glob glob;
-    client->sync_globFiles(glob, params);
-    std::vector<NameAndDType> result;
-    appendGlobResultToNameAndDTypeVec(result, std::move(glob));
-    return result;
+          listing,
+          globFiles(
+              client,
+              mountPoint,
+              {prefix.empty() ? std::string{"*"} : prefix + "/*"},
+              includeDotfiles)
+              .via(executor)
+              .getVia(executor));
+      it = listings.emplace(prefix, std::move(listing)).first;
+    }
+    const auto& listing = it->second;
+
+    // Without dtypes we can't tell which entries to descend into.
+    if (std::any_of(listing.begin(), listing.end(), [](const auto& entry) {
+          return entry.dtype == DType::Unknown;
+        })) {
+      unsharded.push_back(pattern);
+      continue;
+    }
+
+    if (suffix.empty()) {
+      // The listing is exactly what `**` matches at the top level.
+      consume(std::vector<NameAndDType>{listing});
+    } else {
+      // `**` also matches zero directories.
+      unsharded.push_back(prefix.empty() ? suffix : prefix + "/" + suffix);
+    }
+    for (const auto& entry : listing) {
+      if (entry.dtype != DType::Dir) {
+        continue;
+      }
+      auto shard = escapeGlobSpecialChars(entry.name);
+      shard.append("/**");
+      if (!suffix.empty()) {
+        shard.append("/");
+        shard.append(suffix);
+      }
+      requests.push_back({std::move(shard)});
+    }
   }
+  for (size_t i = 0; i < unsharded.size(); i += options.globBatchSize) {
+    auto end = std::min(unsharded.size(), i + options.globBatchSize);
+    requests.emplace_back(unsharded.begin() + i, unsharded.begin() + end);
+  }
+
+  std::deque<folly::Future<Glob>> inFlight;
+  size_t next = 0;
+  while (next < requests.size() || !inFlight.empty()) {
+    while (next < requests.size() && inFlight.size() < options.maxInFlight) {
+      inFlight.push_back(
+          globFiles(
+              client, mountPoint, std::move(requests[next]), includeDotfiles)
+              .via(executor));
+      ++next;
+    }
+
+    auto glob = std::move(inFlight.front()).getVia(executor);
+    inFlight.pop_front();
+    std::vector<NameAndDType> batch;
+    appendGlobResultToNameAndDTypeVec(batch, std::move(glob));
+    consume(std::move(batch));
+  }
+}
+
+/** Returns the files that match the glob. */
+std::vector<NameAndDType> globNameAndDType(
+    StreamingEdenServiceAsyncClient* client,
+    const std::string& mountPoint,
+    const std::vector<std::string>& globPatterns,
+    bool includeDotfiles,
+    const EdenFetchOptions& options) {
+  std::vector<NameAndDType> result;
+  streamGlobNameAndDType(
+      client,
+      mountPoint,
+      globPatterns,
+      includeDotfiles,
+      options,
+      [&](std::vector<NameAndDType>&& batch) {
+        std::move(batch.begin(), batch.end(), std::back_inserter(result));
+      });
+  return result;
 }
 
 namespace {
@@ -716,17 +1054,38 @@ class EdenView final : public QueryableView {
         thriftChannel_(makeThriftChannel(
             rootPath_,
             config.getInt("eden_retry_connection_count", 3))),
+        fetchOptions_(std::make_shared<EdenFetchOptions>(EdenFetchOptions{
+            size_t(std::max<json_int_t>(
+                1, config.getInt("eden_fetch_batch_size", 2048))),
+            size_t(std::max<json_int_t>(
+                1, config.getInt("eden_fetch_max_inflight", 4))),
+            // TODO(xavierd): Once the config: "eden_split_glob_pattern" is
+            // rolled out everywhere, remove it.
+            config.getBool("eden_split_glob_pattern", false)
+                ? 1
+                : size_t(std::max<json_int_t>(
+                      1, config.getInt("eden_glob_batch_size", 16))),
+            config.getBool("eden_shard_recursive_globs", true)})),
+        hashCache_(makeHashCache(config)),
         mountPoint_(root_path.string()),
-        splitGlobPattern_(config.getBool("eden_split_glob_pattern", false)),
         useStreamingSince_(config.getBool("eden_use_streaming_since", false)),
         thresholdForFreshInstance_(config.getInt(
             "eden_file_count_threshold_for_fresh_instance",
             10000)),
+        snapshotDiffOnJournalLoss_(
+            config.getBool("eden_snapshot_diff_on_journal_loss", false)),
+        prefetchSettledChanges_(
+            config.getBool("eden_prefetch_settled_changes", true)),
         filesChangedBetweenCommits_(
             Configuration(),
             "scm_hg_files_between_commits",
             32,
-            10) {}
+            10),
+        filesChangedSince_(
+            Configuration{config},
+            "eden_files_changed_since",
+            8,
+            0) {}
 
   void timeGenerator(const Query* /*query*/, QueryContext* ctx) const override {
     ctx->generationStarted();
@@ -755,6 +1114,8 @@ class EdenView final : public QueryableView {
       auto file = make_unique<EdenFileResult>(
           rootPath_,
           thriftChannel_,
+          fetchOptions_,
+          hashCache_,
           w_string::pathCat({mountPoint_, item.name}),
           &resultTicks,
           isNew,
@@ -784,7 +1145,8 @@ class EdenView final : public QueryableView {
 
   CookieSync::SyncResult syncToNow(
       const std::shared_ptr<Root>& root,
-      std::chrono::milliseconds timeout) override {
+      std::chrono::milliseconds timeout,
+      const std::vector<w_string>& /*scope*/) override {
     try {
       return sync(root).get(timeout);
     } catch (const folly::FutureTimeout& ex) {
@@ -831,37 +1193,40 @@ class EdenView final : public QueryableView {
     auto client = getEdenClient(thriftChannel_);
 
     auto includeDotfiles = (query->glob_flags & WM_PERIOD) == 0;
-    auto fileInfo = globNameAndDType(
+    streamGlobNameAndDType(
         client.get(),
         mountPoint_,
         globStrings,
         includeDotfiles,
-        splitGlobPattern_);
-
-    // Filter out any ignored files
-    filterOutPaths(fileInfo, ctx);
-
-    for (auto& item : fileInfo) {
-      auto file = make_unique<EdenFileResult>(
-          rootPath_,
-          thriftChannel_,
-          w_string::pathCat({mountPoint_, item.name}),
-          /*ticks=*/nullptr,
-          /*isNew=*/false,
-          item.dtype);
-
-      // The results of a glob are known to exist
-      file->setExists(true);
-
-      // Skip processing directories
-      if (!includeDir && item.dtype == DType::Dir) {
-        continue;
-      }
+        *fetchOptions_,
+        [&](std::vector<NameAndDType>&& fileInfo) {
+          // Filter out any ignored files
+          filterOutPaths(fileInfo, ctx);
+
+          for (auto& item : fileInfo) {
+            auto file = make_unique<EdenFileResult>(
+                rootPath_,
+                thriftChannel_,
+                fetchOptions_,
+                hashCache_,
+                w_string::pathCat({mountPoint_, item.name}),
+                /*ticks=*/nullptr,
+                /*isNew=*/false,
+                item.dtype);
+
+            // The results of a glob are known to exist
+            file->setExists(true);
+
+            // Skip processing directories
+            if (!includeDir && item.dtype == DType::Dir) {
+              continue;
+            }
 
-      w_query_process_file(ctx->query, ctx, std::move(file));
-    }
+            w_query_process_file(ctx->query, ctx, std::move(file));
+          }
 
-    ctx->bumpNumWalked(fileInfo.size());
+          ctx->bumpNumWalked(fileInfo.size());
+        });
   }
 
   // Helper for computing a relative path prefix piece.
@@ -962,6 +1327,7 @@ class EdenView final : public QueryableView {
     auto client = getEdenClient(thriftChannel_);
     JournalPosition position;
     client->sync_getCurrentJournalPosition(position, mountPoint_);
+    rememberSnapshot(position);
     return ClockPosition(
         *position.mountGeneration(), *position.sequenceNumber());
   }
@@ -1012,6 +1378,7 @@ class EdenView final : public QueryableView {
           if (t.hasValue()) {
             try {
               log(DBG, "Got subscription push from eden\n");
+              pushedPosition_ = std::move(t.value());
               if (settleCallback.isScheduled()) {
                 log(DBG, "reschedule settle timeout\n");
                 settleCallback.cancelTimeout();
@@ -1071,8 +1438,26 @@ class EdenView final : public QueryableView {
     };
 
     try {
+      if (prefetchSettledChanges_) {
+        try {
+          JournalPosition position;
+          getEdenClient(thriftChannel_)
+              ->sync_getCurrentJournalPosition(position, mountPoint_);
+          settledPosition_ = std::move(position);
+        } catch (const std::exception& exc) {
+          // Prefetching starts from the first push instead
+          log(ERR,
+              "unable to get EdenFS's journal position: ",
+              exc.what(),
+              "\n");
+        }
+      }
+
       // Prepare the callback
-      SettleCallback settleCallback{&subscriberEventBase_, root};
+      SettleCallback settleCallback{
+          &subscriberEventBase_, root, [this, root] {
+            prefetchSettledChanges(*root);
+          }};
       GetJournalPositionCallback getJournalPositionCallback{
           &subscriberEventBase_, thriftChannel_, mountPoint_};
       // Figure out the correct value for settling
@@ -1094,6 +1479,50 @@ class EdenView final : public QueryableView {
     }
   }
 
+  // Called on the subscriber thread when the subscription stream settles,
+  // before the subscriptions are told. Subscriptions that are caught up all
+  // ask for the changes since the previous settle, so fetch those once here,
+  // from where the stream left off, and have them find the result in
+  // filesChangedSince_ rather than each asking EdenFS again.
+  void prefetchSettledChanges(Root& root) {
+    if (!prefetchSettledChanges_ || !pushedPosition_) {
+      return;
+    }
+    auto pushed = std::move(*pushedPosition_);
+    pushedPosition_.reset();
+
+    if (!settledPosition_ ||
+        *settledPosition_->mountGeneration() != *pushed.mountGeneration() ||
+        !root.unilateralResponses->hasSubscribers()) {
+      settledPosition_ = std::move(pushed);
+      return;
+    }
+
+    try {
+      FileDelta delta;
+      getEdenClient(thriftChannel_)
+          ->sync_getFilesChangedSince(delta, mountPoint_, *settledPosition_);
+      auto key = filesChangedSinceKey(
+          *settledPosition_->mountGeneration(),
+          *settledPosition_->sequenceNumber(),
+          *delta.toPosition()->sequenceNumber());
+      settledPosition_ = *delta.toPosition();
+      log(DBG, "prefetched changes for subscriptions: ", key, "\n");
+      filesChangedSince_.set(key, std::move(delta));
+    } catch (const std::exception& exc) {
+      // The subscriptions will ask for themselves
+      log(ERR, "unable to prefetch settled changes: ", exc.what(), "\n");
+      settledPosition_ = std::move(pushed);
+    }
+  }
+
+  static std::string filesChangedSinceKey(
+      int64_t mountGeneration,
+      ClockTicks from,
+      ClockTicks to) {
+    return fmt::format("{}:{}:{}", mountGeneration, from, to);
+  }
+
   const w_string& getName() const override {
     static w_string name("eden");
     return name;
@@ -1133,7 +1562,8 @@ class EdenView final : public QueryableView {
         client.get(),
         mountPoint_,
         std::vector<std::string>{std::move(globPattern)},
-        includeDotfiles);
+        includeDotfiles,
+        *fetchOptions_);
   }
 
   struct GetAllChangesSinceResult {
@@ -1171,15 +1601,32 @@ class EdenView final : public QueryableView {
     // Query eden to fill in the mountGeneration field.
     JournalPosition position;
     client->sync_getCurrentJournalPosition(position, mountPoint_);
+    auto toSequence = *position.sequenceNumber();
     // dial back to the sequence number from the query
     *position.sequenceNumber() =
         std::get<QuerySince::Clock>(ctx->since.since).ticks;
 
     GetAllChangesSinceResult result;
 
-    // Now we can get the change journal from eden
-    FileDelta delta;
-    client->sync_getFilesChangedSince(delta, mountPoint_, position);
+    // Now we can get the change journal from eden. All the subscriptions on
+    // a mount settle at the same time and ask for the same range, so key the
+    // fetch by both ends of it and let concurrent callers share one request.
+    auto key = filesChangedSinceKey(
+        *position.mountGeneration(), *position.sequenceNumber(), toSequence);
+    FileDelta delta =
+        filesChangedSince_
+            .get(
+                key,
+                [&](auto&&) -> folly::Future<FileDelta> {
+                  // As for filesChangedBetweenCommits_, the SemiFuture must
+                  // be running on an executor as the .get() below drives
+                  // the future that LRUCache hands out.
+                  return client
+                      ->semifuture_getFilesChangedSince(mountPoint_, position)
+                      .via(&getThreadPool());
+                })
+            .get()
+            ->value();
 
     result.createdFileNames.insert(
         delta.createdPaths()->begin(), delta.createdPaths()->end());
@@ -1406,6 +1853,128 @@ class EdenView final : public QueryableView {
     return result;
   }
 
+  /**
+   * Record the commit that was checked out at a journal position that we
+   * handed out as part of a clock, so that the changes since that clock can
+   * still be computed from source control once EdenFS forgot the journal.
+   */
+  void rememberSnapshot(const JournalPosition& position) const {
+    if (!snapshotDiffOnJournalLoss_) {
+      return;
+    }
+    auto snapshots = snapshotAtPosition_.wlock();
+    snapshots->insert_or_assign(
+        std::make_pair(
+            *position.mountGeneration(), *position.sequenceNumber()),
+        *position.snapshotHash());
+    // Sequence numbers only ever grow so the front entries are the oldest.
+    while (snapshots->size() > kMaxRememberedSnapshots) {
+      snapshots->erase(snapshots->begin());
+    }
+  }
+
+  /**
+   * Compute the changes since the query's clock without the EdenFS journal,
+   * by diffing the commit that was checked out back then against the current
+   * one, and adding in the files that are modified in the working copy.
+   *
+   * Files that were modified at the since clock and reverted to their
+   * committed contents since are not reported, which is why this is opt-in.
+   *
+   * Returns std::nullopt when the commit at the since clock is not known.
+   */
+  std::optional<GetAllChangesSinceResult> getAllChangesSinceFromSnapshots(
+      QueryContext* ctx) const {
+    if (!snapshotDiffOnJournalLoss_ || !getSCM()) {
+      return std::nullopt;
+    }
+
+    std::string fromHash;
+    {
+      auto snapshots = snapshotAtPosition_.rlock();
+      auto it = snapshots->find(std::make_pair(
+          int64_t(ctx->clockAtStartOfQuery.position().rootNumber),
+          std::get<QuerySince::Clock>(ctx->since.since).ticks));
+      if (it == snapshots->end()) {
+        return std::nullopt;
+      }
+      fromHash = it->second;
+    }
+
+    auto client = getEdenClient(thriftChannel_);
+    JournalPosition position;
+    client->sync_getCurrentJournalPosition(position, mountPoint_);
+    rememberSnapshot(position);
+    auto toHash = folly::hexlify(*position.snapshotHash());
+
+    GetAllChangesSinceResult result;
+    result.ticks = *position.sequenceNumber();
+
+    std::unordered_set<std::string> mergedFileList;
+    if (fromHash != *position.snapshotHash()) {
+      auto changedBetweenCommits = getFilesChangedBetweenCommits(
+          std::vector<std::string>{folly::hexlify(fromHash), toHash},
+          ctx->query->alwaysIncludeDirectories);
+      for (auto& fileName : changedBetweenCommits.changedFiles) {
+        mergedFileList.insert(std::string{fileName.view()});
+      }
+      for (auto& fileName : changedBetweenCommits.removedFiles) {
+        mergedFileList.insert(std::string{fileName.view()});
+      }
+      for (auto& fileName : changedBetweenCommits.addedFiles) {
+        mergedFileList.insert(std::string{fileName.view()});
+        result.createdFileNames.insert(std::string{fileName.view()});
+      }
+    }
+
+    // Only the files that differ from the current commit need to be looked
+    // at; everything else matches what source control already told us.
+    GetScmStatusParams params;
+    params.mountPoint() = mountPoint_;
+    params.commit() = toHash;
+    params.listIgnored() = false;
+    GetScmStatusResult status;
+    client->sync_getScmStatusV2(status, params);
+    for (const auto& [name, fileStatus] : *status.status()->entries()) {
+      switch (fileStatus) {
+        case ScmFileStatus::ADDED:
+          result.createdFileNames.insert(name);
+          mergedFileList.insert(name);
+          break;
+        case ScmFileStatus::MODIFIED:
+        case ScmFileStatus::REMOVED:
+          mergedFileList.insert(name);
+          break;
+        case ScmFileStatus::IGNORED:
+          break;
+      }
+    }
+
+    log(ERR,
+        "EdenFS journal unavailable since ",
+        std::get<QuerySince::Clock>(ctx->since.since).ticks,
+        "; computed ",
+        mergedFileList.size(),
+        " changed files from commit ",
+        folly::hexlify(fromHash),
+        " to ",
+        toHash,
+        "\n");
+
+    if (thresholdForFreshInstance_ != 0 &&
+        mergedFileList.size() > thresholdForFreshInstance_ &&
+        ctx->query->empty_on_fresh_instance) {
+      ctx->since.set_fresh_instance();
+      result.createdFileNames.clear();
+      return result;
+    }
+
+    for (auto& name : mergedFileList) {
+      result.fileInfo.emplace_back(name);
+    }
+    return result;
+  }
+
   /**
    * Compute and return all the changes that occured since the last call.
    *
@@ -1436,8 +2005,20 @@ class EdenView final : public QueryableView {
       if (*err.errorCode() != ERANGE && *err.errorCode() != EDOM) {
         throw;
       }
-      // mountGeneration differs, or journal was truncated,
-      // so treat this as equivalent to a fresh instance result
+      // mountGeneration differs, or journal was truncated, so fall back to
+      // source control if we can, or treat this as equivalent to a fresh
+      // instance result.
+      try {
+        if (auto result = getAllChangesSinceFromSnapshots(ctx)) {
+          return std::move(*result);
+        }
+      } catch (const std::exception& exc) {
+        log(ERR,
+            "unable to compute changes from source control after losing "
+            "the EdenFS journal: ",
+            exc.what(),
+            "\n");
+      }
       return makeFreshInstance(ctx);
     } catch (const SCMError& err) {
       // Most likely this means a checkout occurred but we encountered
@@ -1552,16 +2133,42 @@ class EdenView final : public QueryableView {
     return res;
   }
 
+  static std::shared_ptr<EdenHashCache> makeHashCache(
+      const Configuration& config) {
+    auto size = config.getInt("eden_sha1_cache_size", 65536);
+    if (size <= 0) {
+      return nullptr;
+    }
+    return std::make_shared<EdenHashCache>(size_t(size));
+  }
+
   w_string rootPath_;
   std::shared_ptr<apache::thrift::RequestChannel> thriftChannel_;
+  std::shared_ptr<const EdenFetchOptions> fetchOptions_;
+  // Null when eden_sha1_cache_size is 0
+  std::shared_ptr<EdenHashCache> hashCache_;
   folly::EventBase subscriberEventBase_;
   std::string mountPoint_;
   folly::SharedPromise<folly::Unit> subscribeReadyPromise_;
-  bool splitGlobPattern_;
   bool useStreamingSince_;
   unsigned int thresholdForFreshInstance_;
+  bool snapshotDiffOnJournalLoss_;
+  bool prefetchSettledChanges_;
+  // The journal positions that the subscription stream last pushed and that
+  // changes were last prefetched up to. Only used by the subscriber thread.
+  std::optional<JournalPosition> pushedPosition_;
+  std::optional<JournalPosition> settledPosition_;
+
+  static constexpr size_t kMaxRememberedSnapshots = 4096;
+  // The commit checked out at the journal positions we handed out, keyed by
+  // (mountGeneration, sequenceNumber).
+  mutable folly::Synchronized<
+      std::map<std::pair<int64_t, ClockTicks>, std::string>>
+      snapshotAtPosition_;
 
   mutable LRUCache<std::string, ScmStatus> filesChangedBetweenCommits_;
+  // Journal deltas keyed by "mountGeneration:from:to".
+  mutable LRUCache<std::string, FileDelta> filesChangedSince_;
 };
 
 #ifdef _WIN32
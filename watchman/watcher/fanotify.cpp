@@ -0,0 +1,596 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <folly/portability/Fcntl.h>
+#include <folly/portability/Unistd.h>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "watchman/Constants.h"
+#include "watchman/FlagMap.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/fs/FSDetect.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+#if defined(HAVE_FANOTIFY_INIT) && defined(HAVE_SYS_FANOTIFY_H)
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+#endif
+
+// FAN_REPORT_DFID_NAME arrived in Linux 5.9; older headers can't describe
+// the events that this watcher relies upon.
+#if defined(HAVE_FANOTIFY_INIT) && defined(HAVE_SYS_FANOTIFY_H) && \
+    defined(FAN_REPORT_DFID_NAME)
+
+using namespace watchman;
+
+#define WATCHMAN_FANOTIFY_MASK                                        \
+  FAN_ATTRIB | FAN_CREATE | FAN_DELETE | FAN_DELETE_SELF | FAN_MODIFY | \
+      FAN_MOVE_SELF | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR
+
+namespace {
+
+const struct flag_map fanflags[] = {
+    {FAN_MODIFY, "FAN_MODIFY"},
+    {FAN_ATTRIB, "FAN_ATTRIB"},
+    {FAN_MOVED_FROM, "FAN_MOVED_FROM"},
+    {FAN_MOVED_TO, "FAN_MOVED_TO"},
+    {FAN_CREATE, "FAN_CREATE"},
+    {FAN_DELETE, "FAN_DELETE"},
+    {FAN_DELETE_SELF, "FAN_DELETE_SELF"},
+    {FAN_MOVE_SELF, "FAN_MOVE_SELF"},
+    {FAN_Q_OVERFLOW, "FAN_Q_OVERFLOW"},
+    {FAN_ONDIR, "FAN_ONDIR"},
+    {0, nullptr},
+};
+
+// Directories outside of the root that are remembered so that events within
+// them can be discarded without resolving their handles again. The marks
+// cover a whole filesystem, so this is bounded and simply discarded when it
+// fills up.
+constexpr size_t kMaxForeignHandles = 64 * 1024;
+
+// The largest event that we ask for: its metadata and a record with the
+// handle of the dir and the name of the entry.
+constexpr size_t kMaxEventSize = sizeof(struct fanotify_event_metadata) +
+    sizeof(struct fanotify_event_info_fid) + sizeof(struct file_handle) +
+    MAX_HANDLE_SZ + (NAME_MAX + 1);
+
+// The handle cache is keyed by the filesystem id followed by the handle type
+// and bytes, which together identify a directory for as long as it exists.
+std::string handleKey(
+    const void* fsid,
+    size_t fsidLen,
+    const struct file_handle* fh) {
+  std::string key;
+  key.reserve(fsidLen + sizeof(fh->handle_type) + fh->handle_bytes);
+  key.append(static_cast<const char*>(fsid), fsidLen);
+  key.append(
+      reinterpret_cast<const char*>(&fh->handle_type),
+      sizeof(fh->handle_type));
+  key.append(reinterpret_cast<const char*>(fh->f_handle), fh->handle_bytes);
+  return key;
+}
+
+std::string fsidKey(const void* fsid, size_t fsidLen) {
+  return std::string(static_cast<const char*>(fsid), fsidLen);
+}
+
+// is_path_prefix only looks at the character that follows the prefix, so
+// check that the prefix is actually there first.
+bool isUnderDir(const w_string& path, const w_string& dir) {
+  return path.piece().startsWith(dir.piece()) && is_path_prefix(path, dir);
+}
+
+} // namespace
+
+/**
+ * Watches a root using a single fanotify mark on each filesystem that the
+ * root spans, rather than one inotify watch per directory. Events identify
+ * the parent directory by file handle, so we keep a cache of handle -> path
+ * that is populated as the crawler opens each directory.
+ *
+ * Marking a filesystem requires CAP_SYS_ADMIN, and resolving handles that are
+ * not yet in the cache requires CAP_DAC_READ_SEARCH.
+ */
+struct FanotifyWatcher : public Watcher {
+  FileDescriptor fanfd;
+  Pipe terminatePipe_;
+  // Written to by flushPendingEvents to wake the notify thread.
+  Pipe flushPipe_;
+  // flushPendingEvents callers waiting for fanfd to be drained.
+  folly::Synchronized<std::vector<folly::Promise<folly::Unit>>>
+      flushRequests_;
+  const w_string rootPath_;
+
+  std::atomic<uint64_t> totalEventsSeen_{0};
+  std::atomic<uint64_t> handleCacheMisses_{0};
+
+  struct maps {
+    /* map of directory handle key to the name of the directory */
+    std::unordered_map<std::string, w_string> handle_to_name;
+    /* handle keys of directories that are known to be outside the root */
+    std::unordered_set<std::string> foreign_handles;
+    /* map of filesystem id to an fd used to resolve handles within it */
+    std::unordered_map<std::string, FileDescriptor> fsid_to_mount_fd;
+  };
+
+  folly::Synchronized<maps> maps;
+
+  alignas(struct fanotify_event_metadata) char buf[64 * 1024];
+
+  FanotifyWatcher(const w_string& root_path, const Configuration& config);
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+
+  folly::SemiFuture<folly::Unit> flushPendingEvents() override;
+
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+ private:
+  // Marks the filesystem that contains dirFd, if it is not already marked,
+  // and returns its fsid key.
+  std::string markFilesystem(int dirFd, const char* path);
+
+  // Returns the path of the directory identified by fh, or a null string if
+  // it is outside of the root or can no longer be resolved.
+  w_string resolveHandle(
+      const std::string& fsid,
+      const std::string& key,
+      struct file_handle* fh);
+
+  // Forget the cached paths of dir and everything beneath it.
+  void forgetDir(const w_string& dir);
+
+  // Processes the len bytes of events read into buf. Returns true if the
+  // watch needs to be cancelled.
+  bool processEvents(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      size_t len);
+
+  // Process a single event and add it to the pending collection if needed.
+  // Returns true if the root directory was removed and the watch needs to be
+  // cancelled.
+  bool processEvent(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      const struct fanotify_event_metadata* meta,
+      std::chrono::system_clock::time_point now);
+};
+
+FanotifyWatcher::FanotifyWatcher(
+    const w_string& root_path,
+    const Configuration& config)
+    : Watcher(
+          "fanotify",
+          WATCHER_HAS_PER_FILE_NOTIFICATIONS | WATCHER_SYNCS_WITHOUT_COOKIES),
+      rootPath_(root_path) {
+  fanfd = FileDescriptor(
+      fanotify_init(
+          FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+          O_RDONLY | O_CLOEXEC | O_LARGEFILE),
+      FileDescriptor::FDType::Generic);
+  if (fanfd.fd() == -1) {
+    throw std::system_error(errno, std::generic_category(), "fanotify_init");
+  }
+
+  auto wlock = maps.wlock();
+  wlock->handle_to_name.reserve(
+      config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
+}
+
+std::string FanotifyWatcher::markFilesystem(int dirFd, const char* path) {
+  struct statfs sfs;
+  if (fstatfs(dirFd, &sfs) != 0) {
+    throw std::system_error(errno, std::generic_category(), "fstatfs");
+  }
+  auto fsid = fsidKey(&sfs.f_fsid, sizeof(sfs.f_fsid));
+
+  auto wlock = maps.wlock();
+  if (wlock->fsid_to_mount_fd.count(fsid)) {
+    return fsid;
+  }
+
+  if (fanotify_mark(
+          fanfd.fd(),
+          FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+          WATCHMAN_FANOTIFY_MASK,
+          AT_FDCWD,
+          path) != 0) {
+    throw std::system_error(errno, std::generic_category(), "fanotify_mark");
+  }
+
+  FileDescriptor mountFd(
+      open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+      "open mount fd",
+      FileDescriptor::FDType::Generic);
+  logf(DBG, "marked filesystem containing {}\n", path);
+  wlock->fsid_to_mount_fd.emplace(fsid, std::move(mountFd));
+  return fsid;
+}
+
+std::unique_ptr<DirHandle> FanotifyWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    const char* path) {
+  // Carry out our very strict opendir first to ensure that we're not
+  // traversing symlinks in the context of this root
+  auto osdir = openDir(path);
+  auto fsid = markFilesystem(osdir->getFd(), path);
+
+  alignas(struct file_handle) char
+      handleBuf[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+  auto fh = reinterpret_cast<struct file_handle*>(handleBuf);
+  fh->handle_bytes = MAX_HANDLE_SZ;
+  int mountId;
+  if (name_to_handle_at(osdir->getFd(), "", fh, &mountId, AT_EMPTY_PATH) !=
+      0) {
+    throw std::system_error(
+        errno, std::generic_category(), "name_to_handle_at");
+  }
+
+  auto key = handleKey(fsid.data(), fsid.size(), fh);
+  {
+    auto wlock = maps.wlock();
+    wlock->foreign_handles.erase(key);
+    wlock->handle_to_name[key] = w_string(path, W_STRING_BYTE);
+  }
+  logf(DBG, "caching handle for {}\n", path);
+
+  return osdir;
+}
+
+w_string FanotifyWatcher::resolveHandle(
+    const std::string& fsid,
+    const std::string& key,
+    struct file_handle* fh) {
+  int mountFd;
+  {
+    auto rlock = maps.rlock();
+    auto it = rlock->handle_to_name.find(key);
+    if (it != rlock->handle_to_name.end()) {
+      return it->second;
+    }
+    if (rlock->foreign_handles.count(key)) {
+      return nullptr;
+    }
+    auto mount = rlock->fsid_to_mount_fd.find(fsid);
+    if (mount == rlock->fsid_to_mount_fd.end()) {
+      return nullptr;
+    }
+    mountFd = mount->second.fd();
+  }
+
+  handleCacheMisses_.fetch_add(1, std::memory_order_relaxed);
+  FileDescriptor dirFd(
+      open_by_handle_at(mountFd, fh, O_PATH | O_CLOEXEC),
+      FileDescriptor::FDType::Generic);
+  if (!dirFd) {
+    // ESTALE means that the directory has since been deleted; its removal
+    // is reported against its parent.
+    logf(DBG, "open_by_handle_at: {}\n", folly::errnoStr(errno));
+    return nullptr;
+  }
+
+  char procPath[64];
+  char target[WATCHMAN_NAME_MAX];
+  snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", dirFd.fd());
+  auto len = readlink(procPath, target, sizeof(target));
+  if (len <= 0 || size_t(len) == sizeof(target)) {
+    return nullptr;
+  }
+  w_string name(target, len, W_STRING_BYTE);
+
+  auto wlock = maps.wlock();
+  if (!isUnderDir(name, rootPath_)) {
+    if (wlock->foreign_handles.size() >= kMaxForeignHandles) {
+      wlock->foreign_handles.clear();
+    }
+    wlock->foreign_handles.insert(key);
+    return nullptr;
+  }
+  wlock->handle_to_name[key] = name;
+  return name;
+}
+
+void FanotifyWatcher::forgetDir(const w_string& dir) {
+  auto wlock = maps.wlock();
+  auto it = wlock->handle_to_name.begin();
+  while (it != wlock->handle_to_name.end()) {
+    if (isUnderDir(it->second, dir)) {
+      it = wlock->handle_to_name.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool FanotifyWatcher::processEvent(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    const struct fanotify_event_metadata* meta,
+    std::chrono::system_clock::time_point now) {
+  char flags_label[128];
+  w_expand_flags(fanflags, meta->mask, flags_label, sizeof(flags_label));
+
+  if (meta->mask & FAN_Q_OVERFLOW) {
+    /* we missed something, will need to re-crawl */
+    root->scheduleRecrawl("FAN_Q_OVERFLOW");
+    return false;
+  }
+
+  auto info = reinterpret_cast<const char*>(meta) + meta->metadata_len;
+  auto end = reinterpret_cast<const char*>(meta) + meta->event_len;
+  while (info + sizeof(struct fanotify_event_info_header) <= end) {
+    auto hdr = reinterpret_cast<const struct fanotify_event_info_header*>(info);
+    if (hdr->len == 0) {
+      break;
+    }
+    info += hdr->len;
+    if (hdr->info_type != FAN_EVENT_INFO_TYPE_DFID_NAME &&
+        hdr->info_type != FAN_EVENT_INFO_TYPE_DFID) {
+      continue;
+    }
+
+    auto fid = reinterpret_cast<const struct fanotify_event_info_fid*>(hdr);
+    auto fh = const_cast<struct file_handle*>(
+        reinterpret_cast<const struct file_handle*>(fid->handle));
+    const char* childName = nullptr;
+    if (hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+      childName = reinterpret_cast<const char*>(fh->f_handle) +
+          fh->handle_bytes;
+      if (strcmp(childName, ".") == 0 || childName[0] == 0) {
+        childName = nullptr;
+      }
+    }
+
+    auto fsid = fsidKey(&fid->fsid, sizeof(fid->fsid));
+    auto key = handleKey(&fid->fsid, sizeof(fid->fsid), fh);
+    auto dir_name = resolveHandle(fsid, key, fh);
+
+    logf(
+        DBG,
+        "notify: mask={:x} {} {}{}{}\n",
+        meta->mask,
+        flags_label,
+        dir_name ? dir_name.view() : "<unresolved>",
+        childName ? "/" : "",
+        childName ? childName : "");
+
+    if (!dir_name) {
+      // Either outside of the root, or deleted before we could resolve it,
+      // in which case its parent will have been notified of the deletion.
+      continue;
+    }
+
+    auto name = childName
+        ? w_string::pathCat({dir_name, w_string_piece(childName)})
+        : dir_name;
+    PendingFlags pending_flags = W_PENDING_VIA_NOTIFY;
+
+    if (meta->mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)) {
+      if (w_string_equal(root->root_path, name)) {
+        logf(
+            ERR,
+            "root dir {} has been (re)moved, canceling watch\n",
+            root->root_path);
+        return true;
+      }
+
+      // We need to examine the parent and potentially crawl down
+      auto pname = name.dirName();
+      logf(DBG, "mask={:x}, focus on parent: {}\n", meta->mask, pname);
+      name = pname;
+    }
+
+    if ((meta->mask & FAN_ONDIR) && childName &&
+        (meta->mask & (FAN_DELETE | FAN_MOVED_FROM))) {
+      // The handles of the dir and its descendants may outlive this path; a
+      // move keeps them valid under the new name, which we'll learn afresh.
+      forgetDir(name);
+    }
+
+    bool dirEntryChanged = meta->mask &
+        (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO);
+    if (dirEntryChanged) {
+      pending_flags.set(W_PENDING_RECURSIVE);
+    }
+
+    logf(
+        DBG,
+        "add_pending for fanotify mask={:x} {}\n",
+        meta->mask,
+        name.c_str());
+    coll.add(name, now, pending_flags);
+
+    if (dirEntryChanged) {
+      // As with inotify, the parent's own metadata changed too; synthesize
+      // an event for it so that the IO thread rescans it.
+      coll.add(name.dirName(), now, W_PENDING_VIA_NOTIFY);
+    }
+  }
+  return false;
+}
+
+Watcher::ConsumeNotifyRet FanotifyWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  // The wakeups are drained before the requests are taken, so that a
+  // request whose wakeup is consumed here is also taken here.
+  char discard[64];
+  while (read(flushPipe_.read.fd(), discard, sizeof(discard)) > 0) {
+  }
+  std::vector<folly::Promise<folly::Unit>> flushes;
+  std::swap(flushes, *flushRequests_.wlock());
+
+  // To fulfill the flushes, fanfd is read until it is empty rather than
+  // just once.
+  bool cancel = false;
+  bool filled = false;
+  do {
+    auto n = read(fanfd.fd(), buf, sizeof(buf));
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        break;
+      }
+      logf(
+          FATAL,
+          "read({}, {}): error {}\n",
+          fanfd.fd(),
+          sizeof(buf),
+          folly::errnoStr(errno));
+    }
+
+    logf(DBG, "fanotify read: returned {}.\n", n);
+    cancel |= processEvents(root, coll, size_t(n));
+    // There was no room for another event, so more are likely queued.
+    filled |= sizeof(buf) - size_t(n) < kMaxEventSize;
+  } while (!flushes.empty() && !cancel);
+
+  for (auto& flush : flushes) {
+    coll.addSync(std::move(flush));
+  }
+  return {cancel, filled};
+}
+
+bool FanotifyWatcher::processEvents(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    size_t len) {
+  auto now = std::chrono::system_clock::now();
+
+  bool cancel = false;
+  size_t eventsSeen = 0;
+  for (auto meta = reinterpret_cast<struct fanotify_event_metadata*>(buf);
+       FAN_EVENT_OK(meta, len);
+       meta = FAN_EVENT_NEXT(meta, len)) {
+    if (meta->vers != FANOTIFY_METADATA_VERSION) {
+      logf(
+          ERR,
+          "fanotify metadata version {} is not {}, recrawling\n",
+          meta->vers,
+          FANOTIFY_METADATA_VERSION);
+      root->scheduleRecrawl("fanotify metadata version mismatch");
+      break;
+    }
+    if (meta->fd >= 0) {
+      // Not expected for handle-reporting groups, but don't leak it.
+      close(meta->fd);
+    }
+
+    cancel |= processEvent(root, coll, meta, now);
+    ++eventsSeen;
+  }
+
+  totalEventsSeen_.fetch_add(eventsSeen, std::memory_order_relaxed);
+  return cancel;
+}
+
+bool FanotifyWatcher::waitNotify(int timeoutms) {
+  struct pollfd pfd[3];
+  pfd[0].fd = fanfd.fd();
+  pfd[0].events = POLLIN;
+  pfd[1].fd = terminatePipe_.read.fd();
+  pfd[1].events = POLLIN;
+  pfd[2].fd = flushPipe_.read.fd();
+  pfd[2].events = POLLIN;
+
+  int n = poll(pfd, std::size(pfd), timeoutms);
+
+  if (n > 0) {
+    if (pfd[1].revents) {
+      // We were signalled via signalThreads
+      return false;
+    }
+    return pfd[0].revents != 0 || pfd[2].revents != 0;
+  }
+  return false;
+}
+
+folly::SemiFuture<folly::Unit> FanotifyWatcher::flushPendingEvents() {
+  // fanotify queues the event for a change before the syscall that made it
+  // returns, so once fanfd has been drained after this call, every change
+  // made before it is in the pending collection, ahead of the promise.
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  flushRequests_.wlock()->push_back(std::move(p));
+  ignore_result(write(flushPipe_.write.fd(), "X", 1));
+  return std::move(f);
+}
+
+void FanotifyWatcher::stopThreads() {
+  ignore_result(write(terminatePipe_.write.fd(), "X", 1));
+}
+
+json_ref FanotifyWatcher::getDebugInfo() {
+  auto rlock = maps.rlock();
+  return json_object({
+      {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"handle_cache_size", json_integer(rlock->handle_to_name.size())},
+      {"handle_cache_misses", json_integer(handleCacheMisses_.load())},
+      {"marked_filesystems", json_integer(rlock->fsid_to_mount_fd.size())},
+  });
+}
+
+void FanotifyWatcher::clearDebugInfo() {
+  totalEventsSeen_.store(0, std::memory_order_release);
+  handleCacheMisses_.store(0, std::memory_order_release);
+}
+
+namespace {
+std::shared_ptr<QueryableView> detectFanotify(
+    const w_string& root_path,
+    const w_string& fstype,
+    const Configuration& config) {
+  if (!config.getBool("prefer_fanotify_watcher", false)) {
+    throw std::runtime_error(
+        "Not using the fanotify watcher as the \"prefer_fanotify_watcher\" "
+        "config isn't set");
+  }
+  if (is_edenfs_fs_type(fstype)) {
+    throw std::runtime_error("cannot watch EdenFS file systems with fanotify");
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem,
+      root_path,
+      config,
+      std::make_shared<FanotifyWatcher>(root_path, config));
+}
+} // namespace
+
+// Favored over inotify when enabled; if fanotify is unavailable (older
+// kernel, or missing privileges) auto-selection falls back to inotify.
+static WatcherRegistry reg("fanotify", detectFanotify, 1);
+
+#endif // FAN_REPORT_DFID_NAME
+
+/* vim:ts=2:sw=2:et:
+ */
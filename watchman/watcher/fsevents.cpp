@@ -6,11 +6,14 @@
  */
 
 #include "watchman/watcher/fsevents.h"
+#include <folly/Conv.h>
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
 #include <condition_variable>
 #include <iterator>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 #include "watchman/Client.h"
 #include "watchman/FlagMap.h"
@@ -253,6 +256,15 @@ void FSEventsWatcher::fse_callback(
 
 propagate:
 
+  // Under bursty load (large callbacks, or a consumer that hasn't caught up
+  // with the previous ones) the same paths tend to repeat; merge their flags
+  // into the first occurrence rather than making the IO thread see each.
+  const bool coalesce = watcher->coalesceMinEvents_ > 0 &&
+      (numEvents >= watcher->coalesceMinEvents_ ||
+       !watcher->items_.lock()->items.empty());
+  std::unordered_map<w_string, size_t> firstIndex;
+  size_t coalesced = 0;
+
   items.reserve(numEvents);
   for (i = 0; i < numEvents; i++) {
     const char* path = paths[i];
@@ -283,19 +295,44 @@ propagate:
       continue;
     }
 
-    items.emplace_back(w_string(path, len), eventFlags[i]);
     if (!stream->lost_sync) {
       stream->last_good = eventIds[i];
     }
+
+    w_string name(path, len);
+    if (coalesce) {
+      auto [it, inserted] = firstIndex.emplace(name, items.size());
+      if (!inserted) {
+        items[it->second].flags |= eventFlags[i];
+        ++coalesced;
+        continue;
+      }
+    }
+    items.emplace_back(std::move(name), eventFlags[i]);
+  }
+  if (coalesced) {
+    watcher->coalescedEvents_.fetch_add(coalesced, std::memory_order_relaxed);
   }
 
+  auto wlock = watcher->items_.lock();
+  if (!stream->lost_sync) {
+    wlock->lastEventId = stream->last_good;
+  }
   if (!items.empty()) {
-    auto wlock = watcher->items_.lock();
     wlock->items.push_back(std::move(items));
     watcher->fseCond_.notify_one();
   }
 }
 
+namespace {
+// A printable form of a journal UUID, for saving alongside event ids.
+std::string journalUuidString(CFUUIDRef uuid) {
+  auto bytes = CFUUIDGetUUIDBytes(uuid);
+  return folly::hexlify(folly::ByteRange(
+      reinterpret_cast<const unsigned char*>(&bytes), sizeof(bytes)));
+}
+} // namespace
+
 static void fse_pipe_callback(CFFileDescriptorRef, CFOptionFlags, void*) {
   logf(DBG, "pipe signalled\n");
   CFRunLoopStop(CFRunLoopGetCurrent());
@@ -347,22 +384,35 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
           "fsevents journal is not available for dev_t=", st.st_dev, "\n");
       return nullptr;
     }
-    // Compare the UUID with that of the current stream
-    if (!watcher->stream_->uuid) {
-      failure_reason = w_string(
-          "fsevents journal was not available for prior stream",
-          W_STRING_UNICODE);
-      return nullptr;
-    }
+    if (!watcher->stream_) {
+      // Resuming from a cursor saved by an earlier incarnation of the root;
+      // its event ids are only meaningful with the same journal.
+      if (journalUuidString(fse_stream->uuid.get()) !=
+          watcher->resumeJournalUuid_) {
+        failure_reason =
+            w_string("fsevents journal UUID is different", W_STRING_UNICODE);
+        return nullptr;
+      }
+    } else {
+      // Compare the UUID with that of the current stream
+      if (!watcher->stream_->uuid) {
+        failure_reason = w_string(
+            "fsevents journal was not available for prior stream",
+            W_STRING_UNICODE);
+        return nullptr;
+      }
 
-    a = CFUUIDGetUUIDBytes(fse_stream->uuid.get());
-    b = CFUUIDGetUUIDBytes(watcher->stream_->uuid.get());
+      a = CFUUIDGetUUIDBytes(fse_stream->uuid.get());
+      b = CFUUIDGetUUIDBytes(watcher->stream_->uuid.get());
 
-    if (memcmp(&a, &b, sizeof(a)) != 0) {
-      failure_reason =
-          w_string("fsevents journal UUID is different", W_STRING_UNICODE);
-      return nullptr;
+      if (memcmp(&a, &b, sizeof(a)) != 0) {
+        failure_reason =
+            w_string("fsevents journal UUID is different", W_STRING_UNICODE);
+        return nullptr;
+      }
     }
+    // If we lose sync before the first event, resync from here.
+    fse_stream->last_good = since;
   }
 
   ctx.info = fse_stream.get();
@@ -400,7 +450,12 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
       path,
       latency);
 
-  flags = kFSEventStreamCreateFlagNoDefer | kFSEventStreamCreateFlagWatchRoot;
+  flags = kFSEventStreamCreateFlagWatchRoot;
+  if (root->config.getBool("fsevents_no_defer", true)) {
+    // Deliver the first event of a burst straight away rather than waiting
+    // out the latency; later events in the burst are still batched.
+    flags |= kFSEventStreamCreateFlagNoDefer;
+  }
   if (watcher->hasFileWatching_) {
     flags |= kFSEventStreamCreateFlagFileEvents;
   }
@@ -498,14 +553,39 @@ void FSEventsWatcher::FSEventsThread(const std::shared_ptr<Root>& root) {
           CFRunLoopGetCurrent(), fdsrc.get(), kCFRunLoopDefaultMode);
     }
 
-    stream_ = fse_stream_make(
-        root, this, kFSEventStreamEventIdSinceNow, root->failure_reason);
+    if (resumeEventId_ && !subdir) {
+      w_string reason;
+      stream_ = fse_stream_make(root, this, resumeEventId_, reason);
+      if (stream_ && !FSEventStreamStart(stream_->stream)) {
+        reason = w_string("FSEventStreamStart failed", W_STRING_UNICODE);
+        stream_.reset();
+      }
+      if (stream_) {
+        resumed_ = true;
+        logf(ERR, "resuming fsevents from event id {}\n", resumeEventId_);
+      } else {
+        logf(
+            ERR,
+            "unable to resume fsevents from event id {}: {}\n",
+            resumeEventId_,
+            reason);
+      }
+    }
+
+    if (!stream_) {
+      stream_ = fse_stream_make(
+          root, this, kFSEventStreamEventIdSinceNow, root->failure_reason);
+    }
     if (!stream_) {
       logf(ERR, "fse_thread failed: fse_stream_make");
       return;
     }
 
-    if (!FSEventStreamStart(stream_->stream)) {
+    if (stream_->uuid) {
+      journalUuid_ = journalUuidString(stream_->uuid.get());
+    }
+
+    if (!resumed_ && !FSEventStreamStart(stream_->stream)) {
       root->failure_reason = w_string::build(
           "FSEventStreamStart failed, look at your log file ",
           logging::log_name,
@@ -536,6 +616,9 @@ FSEventsWatcher::FSEventsWatcher(
       attemptResyncOnDrop_{config.getBool("fsevents_try_resync", false)},
       hasFileWatching_{hasFileWatching},
       enableStreamFlush_{config.getBool("fsevents_enable_stream_flush", true)},
+      scopedDropRecovery_{config.getInt("scoped_overflow_window_ms", 0) > 0},
+      coalesceMinEvents_{size_t(std::max<json_int_t>(
+          0, config.getInt("fsevents_coalesce_min_events", 0)))},
       subdir{std::move(dir)} {
   // TODO: Add ring buffer logging for events in the shared kqueue+fsevents
   // logger.
@@ -688,6 +771,7 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
     auto wlock = items_.lock();
     std::swap(items, wlock->items);
     std::swap(syncs, wlock->syncs);
+    consumedEventId_ = wlock->lastEventId;
   }
 
   auto now = std::chrono::system_clock::now();
@@ -706,8 +790,16 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
           (kFSEventStreamEventFlagUserDropped |
            kFSEventStreamEventFlagKernelDropped)) {
         if (!subdir) {
-          root->scheduleRecrawl(flags_label);
-          break;
+          if (scopedDropRecovery_ &&
+              (item.flags & kFSEventStreamEventFlagMustScanSubDirs) &&
+              item.path.size() > root->root_path.size()) {
+            // FSEvents told us which subtree lost events; it is added below
+            // as recursive and desynced.
+            root->scheduleScopedRecrawl(flags_label, 1);
+          } else {
+            root->scheduleRecrawl(flags_label);
+            break;
+          }
         } else {
           w_assert(
               item.flags & kFSEventStreamEventFlagMustScanSubDirs,
@@ -811,6 +903,32 @@ std::unique_ptr<DirHandle> FSEventsWatcher::startWatchDir(
   return openDir(path);
 }
 
+w_string FSEventsWatcher::getEventCursor() {
+  // Split watches span several streams, so no one event id covers them.
+  if (subdir || journalUuid_.empty() || consumedEventId_ == 0) {
+    return nullptr;
+  }
+  return w_string::build(journalUuid_, ":", consumedEventId_);
+}
+
+void FSEventsWatcher::setResumeCursor(const w_string& cursor) {
+  auto view = cursor.view();
+  auto colon = view.rfind(':');
+  if (colon == std::string_view::npos) {
+    return;
+  }
+  auto eventId = folly::tryTo<FSEventStreamEventId>(view.substr(colon + 1));
+  if (!eventId.hasValue() || *eventId == 0) {
+    return;
+  }
+  resumeJournalUuid_ = std::string{view.substr(0, colon)};
+  resumeEventId_ = *eventId;
+}
+
+bool FSEventsWatcher::resumedFromCursor() const {
+  return resumed_;
+}
+
 json_ref FSEventsWatcher::getDebugInfo() {
   json_ref events = json_null();
   if (ringBuffer_) {
@@ -823,6 +941,7 @@ json_ref FSEventsWatcher::getDebugInfo() {
   return json_object({
       {"events", events},
       {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"coalesced_event_count", json_integer(coalescedEvents_.load())},
   });
 }
 
@@ -831,6 +950,7 @@ void FSEventsWatcher::clearDebugInfo() {
   // totalEventsSeen_ could be stored directly if ringBuffer_ is null, or as the
   // difference between currentHead() - lastClear_ if not null.
   totalEventsSeen_.store(0, std::memory_order_release);
+  coalescedEvents_.store(0, std::memory_order_release);
   if (ringBuffer_) {
     ringBuffer_->clear();
   }
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <optional>
+#include <string>
 #include "watchman/RingBuffer.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/watcher/Watcher.h"
@@ -59,6 +60,10 @@ class FSEventsWatcher : public Watcher {
   void stopThreads() override;
   void FSEventsThread(const std::shared_ptr<Root>& root);
 
+  w_string getEventCursor() override;
+  void setResumeCursor(const w_string& cursor) override;
+  bool resumedFromCursor() const override;
+
   json_ref getDebugInfo() override;
   void clearDebugInfo() override;
 
@@ -90,6 +95,8 @@ class FSEventsWatcher : public Watcher {
     std::vector<std::vector<watchman_fsevent>> items;
     // Sync requests to be inserted into PendingCollection.
     std::vector<folly::Promise<folly::Unit>> syncs;
+    // The id of the last event that fse_callback has seen while in sync.
+    FSEventStreamEventId lastEventId{0};
   };
   folly::Synchronized<Items, std::mutex> items_;
 
@@ -97,10 +104,26 @@ class FSEventsWatcher : public Watcher {
   const bool attemptResyncOnDrop_{false};
   const bool hasFileWatching_{false};
   const bool enableStreamFlush_{true};
+  // Recrawl just the subtree named by a dropped event, if it names one.
+  const bool scopedDropRecovery_{false};
+  // Callbacks with at least this many events, or that arrive while the
+  // consumer still has earlier batches to pick up, merge events for the same
+  // path. Zero disables merging.
+  const size_t coalesceMinEvents_{0};
   std::optional<w_string> subdir{std::nullopt};
 
+  // The journal that stream_ reads from, and the id of the last event that
+  // consumeNotify has taken; together they form the event cursor.
+  std::string journalUuid_;
+  FSEventStreamEventId consumedEventId_{0};
+  // Set by setResumeCursor() before start().
+  std::string resumeJournalUuid_;
+  FSEventStreamEventId resumeEventId_{0};
+  bool resumed_{false};
+
   // Incremented in fse_callback
   std::atomic<size_t> totalEventsSeen_{0};
+  std::atomic<size_t> coalescedEvents_{0};
   /**
    * If not null, holds a fixed-size ring of the last `fsevents_ring_log_size`
    * FSEvents events.
@@ -5,15 +5,22 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/ProducerConsumerQueue.h>
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
 #include <atomic>
+#include <cstring>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 #include "watchman/Constants.h"
 #include "watchman/Errors.h"
 #include "watchman/FlagMap.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/Poison.h"
 #include "watchman/RingBuffer.h"
+#include "watchman/ThreadClass.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/Pipe.h"
@@ -119,6 +126,73 @@ struct InotifyLogEntry {
 };
 static_assert(64 == sizeof(InotifyLogEntry));
 
+/**
+ * The watch descriptors that saw events in the current and previous windows
+ * of `scoped_overflow_window_ms`, so that after the kernel queue overflows we
+ * can recrawl just the dirs that were busy rather than the whole root.
+ */
+struct ActiveDirs {
+  // Beyond this many dirs in a window, recrawl everything instead.
+  static constexpr size_t kMaxDirs = 4096;
+
+  std::chrono::system_clock::time_point windowStart;
+  std::unordered_set<int> current;
+  std::unordered_set<int> previous;
+  bool currentSaturated{false};
+  bool previousSaturated{false};
+
+  void rotate(
+      std::chrono::system_clock::time_point now,
+      std::chrono::milliseconds window) {
+    if (now - windowStart < window) {
+      return;
+    }
+    if (now - windowStart < 2 * window) {
+      previous = std::move(current);
+      previousSaturated = currentSaturated;
+    } else {
+      previous.clear();
+      previousSaturated = false;
+    }
+    current.clear();
+    currentSaturated = false;
+    windowStart = now;
+  }
+
+  void record(
+      int wd,
+      std::chrono::system_clock::time_point now,
+      std::chrono::milliseconds window) {
+    rotate(now, window);
+    if (currentSaturated) {
+      return;
+    }
+    if (current.size() >= kMaxDirs && !current.count(wd)) {
+      currentSaturated = true;
+      current.clear();
+      return;
+    }
+    current.insert(wd);
+  }
+
+  // Returns false if the recent activity can't be scoped.
+  bool usable() const {
+    return !currentSaturated && !previousSaturated &&
+        !(current.empty() && previous.empty());
+  }
+};
+
+// Returns true if ine reports nothing beyond what prev already did: content
+// or metadata changes to the same name in the same dir.
+bool repeatsChange(const inotify_event& prev, const inotify_event& ine) {
+  constexpr uint32_t kChangeMask = IN_MODIFY | IN_ATTRIB;
+  if (ine.wd != prev.wd || ine.wd == -1 || (ine.mask & ~kChangeMask) != 0 ||
+      (prev.mask & ~kChangeMask) != 0 || ine.len == 0 || prev.len == 0) {
+    return false;
+  }
+  return strcmp(ine.name, prev.name) == 0;
+}
+
 } // namespace
 
 struct InotifyWatcher : public Watcher {
@@ -137,22 +211,48 @@ struct InotifyWatcher : public Watcher {
    */
   std::atomic<uint64_t> totalEventsSeen_ = 0;
 
+  /**
+   * Events that were dropped because they repeated the content or metadata
+   * change of the event immediately before them.
+   */
+  std::atomic<uint64_t> coalescedEvents_ = 0;
+
   struct maps {
     /* map of active watch descriptor to name of the corresponding dir */
     std::unordered_map<int, w_string> wd_to_name;
     /* map of inotify cookie to corresponding name */
     std::unordered_map<uint32_t, pending_move> move_map;
+    /* dirs that saw events recently, if scopedOverflowWindow_ is set */
+    ActiveDirs active_dirs;
   };
 
   folly::Synchronized<maps> maps;
 
-  // Make the buffer big enough for 16k entries, which
-  // happens to be the default fs.inotify.max_queued_events
-  char ibuf
-      [WATCHMAN_BATCH_LIMIT * (sizeof(struct inotify_event) + (NAME_MAX + 1))];
+  // Sized by `inotify_read_buffer_size`; the default is big enough for 16k
+  // entries, which happens to be the default fs.inotify.max_queued_events
+  std::vector<char> ibuf;
+
+  // If non-zero, an overflow only recrawls the dirs that saw events within
+  // roughly this long beforehand.
+  const std::chrono::milliseconds scopedOverflowWindow_;
+
+  /**
+   * If `inotify_reader_thread` is enabled, a dedicated thread does nothing
+   * but copy raw event buffers from infd into this queue, and consumeNotify
+   * resolves them. The kernel queue then keeps draining even while we are
+   * busy resolving names and adding them to the pending collection.
+   */
+  std::unique_ptr<folly::ProducerConsumerQueue<std::vector<char>>>
+      readerQueue_;
+  // Written by the reader thread after each buffer it queues.
+  Pipe readerReadyPipe_;
+  // How often the reader thread found readerQueue_ full and had to wait.
+  std::atomic<uint64_t> readerStalls_ = 0;
 
   explicit InotifyWatcher(const Configuration& config);
 
+  bool start(const std::shared_ptr<Root>& root) override;
+
   std::unique_ptr<DirHandle> startWatchDir(
       const std::shared_ptr<Root>& root,
       const char* path) override;
@@ -165,13 +265,31 @@ struct InotifyWatcher : public Watcher {
 
   // Process a single inotify event and add it to the pending collection if
   // needed. Returns true if the root directory was removed and the watch needs
-  // to be cancelled.
+  // to be cancelled. The caller holds the maps lock for the whole batch.
   bool process_inotify_event(
       const std::shared_ptr<Root>& root,
       PendingChanges& coll,
+      struct maps& maps,
       struct inotify_event* ine,
       std::chrono::system_clock::time_point now);
 
+  // Process a buffer of n bytes of events as read from infd. Returns true if
+  // the watch needs to be cancelled.
+  bool processEvents(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      char* buf,
+      size_t n);
+
+  // Whether a read of n bytes filled ibuf, leaving no room for another
+  // event; the kernel then likely has more queued.
+  bool filledBuffer(size_t n) const {
+    return ibuf.size() - n < sizeof(struct inotify_event) + (NAME_MAX + 1);
+  }
+
+  // Body of the reader thread used when readerQueue_ is set.
+  void readerThread();
+
   void stopThreads() override;
 
   json_ref getDebugInfo() override;
@@ -179,7 +297,8 @@ struct InotifyWatcher : public Watcher {
 };
 
 InotifyWatcher::InotifyWatcher(const Configuration& config)
-    : Watcher("inotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
+    : Watcher("inotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS),
+      scopedOverflowWindow_(config.getInt("scoped_overflow_window_ms", 0)) {
 #ifdef HAVE_INOTIFY_INIT1
   infd = FileDescriptor(
       inotify_init1(IN_CLOEXEC), FileDescriptor::FDType::Generic);
@@ -190,12 +309,30 @@ InotifyWatcher::InotifyWatcher(const Configuration& config)
     throw std::system_error(errno, inotify_category(), "inotify_init");
   }
   infd.setCloExec();
+  // consumeNotify drains the queue until the kernel has nothing more for us
+  infd.setNonBlock();
+
+  constexpr size_t kMaxEventSize =
+      sizeof(struct inotify_event) + (NAME_MAX + 1);
+  ibuf.resize(std::max<size_t>(
+      kMaxEventSize,
+      config.getInt(
+          "inotify_read_buffer_size", WATCHMAN_BATCH_LIMIT * kMaxEventSize)));
 
   {
     auto wlock = maps.wlock();
     wlock->wd_to_name.reserve(config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
   }
 
+  if (config.getBool("inotify_reader_thread", false)) {
+    // One slot is always left empty by ProducerConsumerQueue.
+    readerQueue_ =
+        std::make_unique<folly::ProducerConsumerQueue<std::vector<char>>>(
+            std::max<json_int_t>(
+                1, config.getInt("inotify_reader_queue_buffers", 16)) +
+            1);
+  }
+
   json_int_t inotify_ring_log_size = config.getInt("inotify_ring_log_size", 0);
   if (inotify_ring_log_size) {
     ringBuffer_ =
@@ -233,6 +370,7 @@ std::unique_ptr<DirHandle> InotifyWatcher::startWatchDir(
 bool InotifyWatcher::process_inotify_event(
     const std::shared_ptr<Root>& root,
     PendingChanges& coll,
+    struct maps& maps,
     struct inotify_event* ine,
     std::chrono::system_clock::time_point now) {
   char flags_label[128];
@@ -252,32 +390,56 @@ bool InotifyWatcher::process_inotify_event(
 
   if (ine->wd == -1 && (ine->mask & IN_Q_OVERFLOW)) {
     /* we missed something, will need to re-crawl */
-    root->scheduleRecrawl("IN_Q_OVERFLOW");
+    auto& active = maps.active_dirs;
+    if (scopedOverflowWindow_.count() > 0) {
+      active.rotate(now, scopedOverflowWindow_);
+    }
+    if (scopedOverflowWindow_.count() == 0 || !active.usable()) {
+      root->scheduleRecrawl("IN_Q_OVERFLOW");
+      return false;
+    }
+
+    // The dropped events most likely belong to whatever was busy; recrawl
+    // those subtrees, desynced so that cookies are re-synced afterwards.
+    size_t numDirs = 0;
+    for (auto* wds : {&active.current, &active.previous}) {
+      for (int wd : *wds) {
+        auto it = maps.wd_to_name.find(wd);
+        if (it == maps.wd_to_name.end()) {
+          continue;
+        }
+        coll.add(
+            it->second,
+            now,
+            W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE |
+                W_PENDING_IS_DESYNCED);
+        ++numDirs;
+      }
+    }
+    if (numDirs == 0) {
+      root->scheduleRecrawl("IN_Q_OVERFLOW");
+    } else {
+      root->scheduleScopedRecrawl("IN_Q_OVERFLOW", numDirs);
+    }
   } else if (ine->wd != -1) {
+    if (scopedOverflowWindow_.count() > 0) {
+      maps.active_dirs.record(ine->wd, now, scopedOverflowWindow_);
+    }
+
     w_string name;
-    char buf[WATCHMAN_NAME_MAX];
     PendingFlags pending_flags = W_PENDING_VIA_NOTIFY;
     w_string dir_name;
 
     {
-      auto rlock = maps.rlock();
-      auto it = rlock->wd_to_name.find(ine->wd);
-      if (it != rlock->wd_to_name.end()) {
+      auto it = maps.wd_to_name.find(ine->wd);
+      if (it != maps.wd_to_name.end()) {
         dir_name = it->second;
       }
     }
 
     if (dir_name) {
       if (ine->len > 0) {
-        // TODO: What if this truncates?
-        snprintf(
-            buf,
-            sizeof(buf),
-            "%.*s/%s",
-            int(dir_name.size()),
-            dir_name.data(),
-            ine->name);
-        name = w_string(buf, W_STRING_BYTE);
+        name = w_string::pathCat({dir_name, w_string_piece{ine->name}});
       } else {
         name = dir_name;
       }
@@ -288,20 +450,17 @@ bool InotifyWatcher::process_inotify_event(
             (IN_MOVED_FROM | IN_ISDIR)) {
       // record this as a pending move, so that we can automatically
       // watch the target when we get the other side of it.
-      {
-        auto wlock = maps.wlock();
-        wlock->move_map.emplace(ine->cookie, pending_move(now, name));
-      }
+      maps.move_map.emplace(ine->cookie, pending_move(now, name));
 
       log(DBG, "recording move_from ", ine->cookie, " ", name, "\n");
     }
 
     if (ine->len > 0 &&
-        (ine->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_FROM | IN_ISDIR)) {
-      auto wlock = maps.wlock();
-      auto it = wlock->move_map.find(ine->cookie);
-      if (it != wlock->move_map.end()) {
-        auto& old = it->second;
+        (ine->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_TO | IN_ISDIR)) {
+      auto it = maps.move_map.find(ine->cookie);
+      if (it != maps.move_map.end()) {
+        auto old = std::move(it->second);
+        maps.move_map.erase(it);
         int wd =
             inotify_add_watch(infd.fd(), name.c_str(), WATCHMAN_INOTIFY_MASK);
         if (wd == -1) {
@@ -323,8 +482,22 @@ bool InotifyWatcher::process_inotify_event(
           }
         } else {
           logf(DBG, "moved {} -> {}\n", old.name.c_str(), name.c_str());
-          // TODO: assert that there is no entry in wd_to_name
-          wlock->wd_to_name[wd] = name;
+          // The watches follow the dirs, so this is the watch that the dir
+          // already had, and those below it now report their new names.
+          maps.wd_to_name[wd] = name;
+          for (auto& entry : maps.wd_to_name) {
+            auto& dirName = entry.second;
+            if (dirName.size() > old.name.size() &&
+                dirName.piece().startsWith(old.name) &&
+                is_slash(dirName.data()[old.name.size()])) {
+              dirName = w_string::pathCat(
+                  {name,
+                   w_string_piece{
+                       dirName.data() + old.name.size() + 1,
+                       dirName.size() - old.name.size() - 1}});
+            }
+          }
+          coll.addMove(old.name, name, now);
         }
       } else {
         logf(
@@ -379,8 +552,7 @@ bool InotifyWatcher::process_inotify_event(
             ine->mask,
             ine->wd,
             dir_name);
-        auto wlock = maps.wlock();
-        wlock->wd_to_name.erase(ine->wd);
+        maps.wd_to_name.erase(ine->wd);
       }
 
     } else if ((ine->mask & (IN_MOVE_SELF | IN_IGNORED)) == 0) {
@@ -399,37 +571,188 @@ bool InotifyWatcher::process_inotify_event(
   return false;
 }
 
-Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
-    const std::shared_ptr<Root>& root,
-    PendingChanges& coll) {
-  int n = read(infd.fd(), &ibuf, sizeof(ibuf));
-  if (n == -1) {
-    if (errno == EINTR) {
-      return {false};
+bool InotifyWatcher::start(const std::shared_ptr<Root>& root) {
+  if (!readerQueue_) {
+    return true;
+  }
+
+  try {
+    auto self = std::dynamic_pointer_cast<InotifyWatcher>(shared_from_this());
+    std::thread thread([self, root]() {
+      try {
+        self->readerThread();
+      } catch (const std::exception& e) {
+        watchman::log(watchman::ERR, "uncaught exception: ", e.what());
+        root->cancel();
+      }
+    });
+    // We have to detach because the reader thread may wind up being the
+    // last thread to reference the watcher state and cannot join itself.
+    thread.detach();
+    return true;
+  } catch (const std::exception& e) {
+    watchman::log(
+        watchman::ERR, "failed to start inotify reader thread: ", e.what());
+    return false;
+  }
+}
+
+void InotifyWatcher::readerThread() {
+  w_set_thread_name("inotify-reader");
+  applyThreadClassPolicy(ThreadClass::Notify);
+
+  auto terminating = [this] {
+    struct pollfd pfd;
+    pfd.fd = terminatePipe_.read.fd();
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) > 0;
+  };
+
+  std::vector<char> buf;
+  while (true) {
+    struct pollfd pfd[2];
+    pfd[0].fd = infd.fd();
+    pfd[0].events = POLLIN;
+    pfd[1].fd = terminatePipe_.read.fd();
+    pfd[1].events = POLLIN;
+    if (poll(pfd, std::size(pfd), -1) <= 0) {
+      continue;
+    }
+    if (pfd[1].revents) {
+      return;
+    }
+
+    while (true) {
+      buf.resize(ibuf.size());
+      int n = read(infd.fd(), buf.data(), buf.size());
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+        logf(
+            FATAL,
+            "read({}, {}): error {}\n",
+            infd.fd(),
+            buf.size(),
+            folly::errnoStr(errno));
+      }
+      if (n == 0) {
+        break;
+      }
+      buf.resize(n);
+
+      // The resolver has fallen behind; wait for room rather than dropping
+      // events, the kernel will queue them in the meantime.
+      bool stalled = false;
+      while (!readerQueue_->write(std::move(buf))) {
+        if (!stalled) {
+          readerStalls_.fetch_add(1, std::memory_order_relaxed);
+          stalled = true;
+        }
+        if (terminating()) {
+          return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      buf = std::vector<char>();
+      ignore_result(write(readerReadyPipe_.write.fd(), "X", 1));
     }
-    logf(
-        FATAL,
-        "read({}, {}): error {}\n",
-        infd.fd(),
-        sizeof(ibuf),
-        folly::errnoStr(errno));
   }
+}
 
+bool InotifyWatcher::processEvents(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    char* buf,
+    size_t n) {
   logf(DBG, "inotify read: returned {}.\n", n);
   auto now = std::chrono::system_clock::now();
 
-  struct inotify_event* ine;
   bool cancel = false;
   size_t eventsSeen = 0;
-  for (char* iptr = ibuf; iptr < ibuf + n; iptr += sizeof(*ine) + ine->len) {
-    ine = (struct inotify_event*)iptr;
+  size_t eventsCoalesced = 0;
 
-    cancel |= process_inotify_event(root, coll, ine, now);
+  // One lock for the whole buffer rather than one per event.
+  auto wlock = maps.wlock();
+  struct inotify_event* prev = nullptr;
+  struct inotify_event* ine;
+  for (char* iptr = buf; iptr < buf + n; iptr += sizeof(*ine) + ine->len) {
+    ine = (struct inotify_event*)iptr;
     ++eventsSeen;
+
+    if (prev && repeatsChange(*prev, *ine)) {
+      // Writes to a file typically arrive as a run of IN_MODIFY events;
+      // the pending collection would consolidate them anyway, so don't
+      // pay for building their names.
+      if (ringBuffer_) {
+        ringBuffer_->write(InotifyLogEntry{ine});
+      }
+      ++eventsCoalesced;
+      continue;
+    }
+    prev = ine;
+
+    cancel |= process_inotify_event(root, coll, *wlock, ine, now);
   }
 
   // Relaxed because we don't really care exactly when the value is visible.
   totalEventsSeen_.fetch_add(eventsSeen, std::memory_order_relaxed);
+  coalescedEvents_.fetch_add(eventsCoalesced, std::memory_order_relaxed);
+  return cancel;
+}
+
+Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  bool cancel = false;
+  bool filled = false;
+
+  if (readerQueue_) {
+    char discard[64];
+    while (read(readerReadyPipe_.read.fd(), discard, sizeof(discard)) > 0) {
+    }
+    // Stop early once a full batch is pending, as below; waitNotify will
+    // report the remaining buffers straight away.
+    while (!cancel && coll.getPendingItemCount() < WATCHMAN_BATCH_LIMIT) {
+      auto* chunk = readerQueue_->frontPtr();
+      if (!chunk) {
+        break;
+      }
+      cancel |= processEvents(root, coll, chunk->data(), chunk->size());
+      filled |= filledBuffer(chunk->size());
+      readerQueue_->popFront();
+    }
+  }
+
+  // Drain the kernel queue until it is empty, rather than taking one buffer
+  // per wakeup, so that storms don't overflow it. We stop early once a full
+  // batch is pending so that the notify thread can hand it to the IO thread.
+  while (!readerQueue_ && !cancel &&
+         coll.getPendingItemCount() < WATCHMAN_BATCH_LIMIT) {
+    int n = read(infd.fd(), ibuf.data(), ibuf.size());
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      logf(
+          FATAL,
+          "read({}, {}): error {}\n",
+          infd.fd(),
+          ibuf.size(),
+          folly::errnoStr(errno));
+    }
+    if (n == 0) {
+      break;
+    }
+    cancel |= processEvents(root, coll, ibuf.data(), n);
+    filled |= filledBuffer(n);
+  }
 
   // It is possible that we can accumulate a set of pending_move
   // structs in move_map.  This happens when a directory is moved
@@ -445,7 +768,8 @@ Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
     auto it = wlock->move_map.begin();
     while (it != wlock->move_map.end()) {
       auto& pending = it->second;
-      if (now - pending.created > std::chrono::seconds{5}) {
+      if (std::chrono::system_clock::now() - pending.created >
+          std::chrono::seconds{5}) {
         logf(
             DBG,
             "deleting pending move {} (moved outside of watch?)\n",
@@ -457,12 +781,18 @@ Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
     }
   }
 
-  return {cancel};
+  // A full buffer means that events were arriving faster than we read them.
+  return {cancel, filled};
 }
 
 bool InotifyWatcher::waitNotify(int timeoutms) {
+  if (readerQueue_ && !readerQueue_->isEmpty()) {
+    return true;
+  }
+
   struct pollfd pfd[2];
-  pfd[0].fd = infd.fd();
+  // With a reader thread, it owns infd and tells us when it queued events.
+  pfd[0].fd = readerQueue_ ? readerReadyPipe_.read.fd() : infd.fd();
   pfd[0].events = POLLIN;
   pfd[1].fd = terminatePipe_.read.fd();
   pfd[1].events = POLLIN;
@@ -495,6 +825,8 @@ json_ref InotifyWatcher::getDebugInfo() {
   return json_object({
       {"events", events},
       {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"coalesced_event_count", json_integer(coalescedEvents_.load())},
+      {"reader_queue_stalls", json_integer(readerStalls_.load())},
   });
 }
 
@@ -503,6 +835,8 @@ void InotifyWatcher::clearDebugInfo() {
   // totalEventsSeen_ could be stored directly if ringBuffer_ is null, or as the
   // difference between currentHead() - lastClear_ if not null.
   totalEventsSeen_.store(0, std::memory_order_release);
+  coalescedEvents_.store(0, std::memory_order_release);
+  readerStalls_.store(0, std::memory_order_release);
   if (ringBuffer_) {
     ringBuffer_->clear();
   }
@@ -156,6 +156,23 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
   return true;
 }
 
+void KQueueWatcher::stopWatchFile(const w_string& full_name) {
+  auto wlock = maps_.wlock();
+  auto it = wlock->name_to_fd.find(full_name);
+  if (it == wlock->name_to_fd.end()) {
+    return;
+  }
+
+  struct kevent k;
+  int rawFd = it->second.fd();
+  memset(&k, 0, sizeof(k));
+  EV_SET(&k, rawFd, EVFILT_VNODE, EV_DELETE, 0, 0, nullptr);
+  kevent(kq_fd.fd(), &k, 1, nullptr, 0, 0);
+  wlock->fd_to_name.erase(rawFd);
+  wlock->name_to_fd.erase(it);
+  logf(DBG, "stopped kevent watch on {}\n", full_name);
+}
+
 std::unique_ptr<DirHandle> KQueueWatcher::startWatchDir(
     const std::shared_ptr<Root>& root,
     const char* path) {
@@ -46,6 +46,11 @@ struct KQueueWatcher : public Watcher {
 
   bool startWatchFile(struct watchman_file* file) override;
 
+  /**
+   * Remove the watch on the named file, if any, and release its descriptor.
+   */
+  void stopWatchFile(const w_string& full_name);
+
   Watcher::ConsumeNotifyRet consumeNotify(
       const std::shared_ptr<Root>& root,
       PendingChanges& coll) override;
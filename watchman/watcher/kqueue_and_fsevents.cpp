@@ -6,8 +6,11 @@
  */
 
 #include <folly/Synchronized.h>
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <unordered_set>
 #include "watchman/Client.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/root/Root.h"
@@ -81,6 +84,12 @@ class PendingEventsCond {
  *
  * The kqueue watches are used on the root directory and all the files at the
  * root, while the fsevents one is used on the subdirectories.
+ *
+ * When kqueue_fsevents_hot_subtree_ttl is set, files that change below a
+ * subtree that queries or subscriptions have recently looked at are also
+ * given a kqueue watch, up to kqueue_fsevents_max_hot_files of them, so
+ * that the paths clients care about get precise file level notifications.
+ * The watches are released once the subtree has gone unqueried for the ttl.
  */
 class KQueueAndFSEventsWatcher : public Watcher {
  public:
@@ -105,6 +114,10 @@ class KQueueAndFSEventsWatcher : public Watcher {
   bool waitNotify(int timeoutms) override;
   void stopThreads() override;
 
+  void noteActiveSubtree(const w_string& path) override;
+
+  json_ref getDebugInfo() override;
+
   /**
    * Force a recrawl to be injected in the stream. Used in the
    * 'debug-kqueue-and-fsevents-recrawl' command.
@@ -120,14 +133,58 @@ class KQueueAndFSEventsWatcher : public Watcher {
   std::shared_ptr<PendingEventsCond> pendingCondition_;
 
   folly::Synchronized<std::optional<w_string>> injectedRecrawl_;
+
+  struct HotState {
+    // Subtree -> the last time a query or subscription looked at it.
+    std::unordered_map<w_string, std::chrono::steady_clock::time_point>
+        subtrees;
+    // Files below the top level that were given a kqueue watch.
+    std::unordered_set<w_string> files;
+    std::chrono::steady_clock::time_point lastExpiry;
+
+    bool isHot(
+        const w_string& rootPath,
+        w_string path,
+        std::chrono::steady_clock::time_point cutoff) const;
+  };
+
+  /**
+   * Forget the subtrees that haven't been queried within hotTtl_ and release
+   * the kqueue watches on files that are no longer below a hot subtree.
+   */
+  void expireHotSubtrees();
+
+  const w_string rootPath_;
+  const std::chrono::steady_clock::duration hotTtl_;
+  const size_t maxHotFiles_;
+  folly::Synchronized<HotState> hot_;
 };
 
+bool KQueueAndFSEventsWatcher::HotState::isHot(
+    const w_string& rootPath,
+    w_string path,
+    std::chrono::steady_clock::time_point cutoff) const {
+  while (path.size() > rootPath.size()) {
+    auto it = subtrees.find(path);
+    if (it != subtrees.end() && it->second >= cutoff) {
+      return true;
+    }
+    path = path.dirName();
+  }
+  return false;
+}
+
 KQueueAndFSEventsWatcher::KQueueAndFSEventsWatcher(
     const w_string& root_path,
     const Configuration& config)
     : Watcher("kqueue+fsevents", WATCHER_HAS_SPLIT_WATCH),
       kqueueWatcher_(std::make_shared<KQueueWatcher>(root_path, config, false)),
-      pendingCondition_(std::make_shared<PendingEventsCond>()) {}
+      pendingCondition_(std::make_shared<PendingEventsCond>()),
+      rootPath_(root_path),
+      hotTtl_(std::chrono::seconds(
+          config.getInt("kqueue_fsevents_hot_subtree_ttl", 0))),
+      maxHotFiles_(std::max<json_int_t>(
+          0, config.getInt("kqueue_fsevents_max_hot_files", 1024))) {}
 
 namespace {
 bool startThread(
@@ -224,11 +281,76 @@ bool KQueueAndFSEventsWatcher::startWatchFile(struct watchman_file* file) {
     return kqueueWatcher_->startWatchFile(file);
   }
 
-  // FSEvent by default watches all the files recursively, we don't need to do
-  // anything.
+  // FSEvent by default watches all the files recursively, we only add a
+  // kqueue watch for files under the subtrees that clients are looking at.
+  if (hotTtl_.count() == 0) {
+    return true;
+  }
+
+  auto full_name = file->parent->getFullPathToChild(file->getName());
+  auto cutoff = std::chrono::steady_clock::now() - hotTtl_;
+  {
+    auto wlock = hot_.wlock();
+    if (wlock->files.find(full_name) == wlock->files.end()) {
+      if (wlock->files.size() >= maxHotFiles_ ||
+          !wlock->isHot(rootPath_, full_name, cutoff)) {
+        return true;
+      }
+      wlock->files.insert(full_name);
+    }
+  }
+
+  if (!kqueueWatcher_->startWatchFile(file)) {
+    hot_.wlock()->files.erase(full_name);
+  }
+  // FSEvents is still covering the file even if kqueue couldn't.
   return true;
 }
 
+void KQueueAndFSEventsWatcher::noteActiveSubtree(const w_string& path) {
+  if (hotTtl_.count() == 0) {
+    return;
+  }
+  hot_.wlock()->subtrees[path] = std::chrono::steady_clock::now();
+}
+
+void KQueueAndFSEventsWatcher::expireHotSubtrees() {
+  auto now = std::chrono::steady_clock::now();
+  auto cutoff = now - hotTtl_;
+  std::vector<w_string> toStop;
+  {
+    auto wlock = hot_.wlock();
+    if (now - wlock->lastExpiry < std::chrono::seconds(1)) {
+      return;
+    }
+    wlock->lastExpiry = now;
+
+    auto& subtrees = wlock->subtrees;
+    for (auto it = subtrees.begin(); it != subtrees.end();) {
+      it = it->second < cutoff ? subtrees.erase(it) : std::next(it);
+    }
+
+    // Files that kqueue dropped because they were deleted or renamed are
+    // forgotten here too, so that they stop counting against the budget.
+    auto kqMaps = kqueueWatcher_->maps_.rlock();
+    auto& files = wlock->files;
+    for (auto it = files.begin(); it != files.end();) {
+      if (kqMaps->name_to_fd.find(*it) == kqMaps->name_to_fd.end()) {
+        it = files.erase(it);
+      } else if (!wlock->isHot(rootPath_, *it, cutoff)) {
+        toStop.push_back(*it);
+        it = files.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  for (auto& name : toStop) {
+    kqueueWatcher_->stopWatchFile(name);
+  }
+}
+
 Watcher::ConsumeNotifyRet KQueueAndFSEventsWatcher::consumeNotify(
     const std::shared_ptr<Root>& root,
     PendingChanges& coll) {
@@ -250,8 +372,7 @@ Watcher::ConsumeNotifyRet KQueueAndFSEventsWatcher::consumeNotify(
   {
     auto fseventWatches = fseventWatchers_.wlock();
     for (auto& [watchpath, fsevent] : *fseventWatches) {
-      auto [cancelSelf] = fsevent->consumeNotify(root, coll);
-      if (cancelSelf) {
+      if (fsevent->consumeNotify(root, coll).cancelSelf) {
         fsevent->stopThreads();
         root->cookies.removeCookieDir(watchpath);
         fseventWatches->erase(watchpath);
@@ -260,6 +381,10 @@ Watcher::ConsumeNotifyRet KQueueAndFSEventsWatcher::consumeNotify(
     }
   }
 
+  if (hotTtl_.count() != 0) {
+    expireHotSubtrees();
+  }
+
   return kqueueWatcher_->consumeNotify(root, coll);
 }
 
@@ -278,6 +403,14 @@ void KQueueAndFSEventsWatcher::stopThreads() {
   kqueueWatcher_->stopThreads();
 }
 
+json_ref KQueueAndFSEventsWatcher::getDebugInfo() {
+  auto rlock = hot_.rlock();
+  return json_object({
+      {"hot_subtree_count", json_integer(rlock->subtrees.size())},
+      {"hot_file_watch_count", json_integer(rlock->files.size())},
+  });
+}
+
 void KQueueAndFSEventsWatcher::injectRecrawl(w_string path) {
   *injectedRecrawl_.wlock() = path;
   pendingCondition_->notifyOneOrStop();
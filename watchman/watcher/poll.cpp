@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/poll.h"
+#include <folly/futures/Future.h>
+#include <algorithm>
+#include <cstring>
+#include "watchman/InMemoryView.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+namespace watchman {
+
+namespace {
+
+// The most dirs stat'd between two checks of the pending batch size, the
+// rate limit and the stop flag.
+constexpr size_t kDirsPerChunk = 256;
+
+bool timespecEqual(const struct timespec& a, const struct timespec& b) {
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+} // namespace
+
+PollWatcher::PollWatcher(FileSystem& fileSystem, const Configuration& config)
+    : Watcher("poll", WATCHER_SYNCS_WITHOUT_COOKIES),
+      fileSystem_(fileSystem),
+      interval_(std::max<json_int_t>(
+          1, config.getInt("poll_interval_ms", 5000))),
+      fullScanPeriod_(config.getInt("poll_full_scan_seconds", 300)),
+      maxStatsPerSecond_(
+          size_t(config.getInt("poll_max_stats_per_second", 2000))),
+      parallelism_(size_t(
+          std::max<json_int_t>(1, config.getInt("poll_stat_parallelism", 4)))),
+      nextPass_(std::chrono::steady_clock::now() + interval_) {}
+
+bool PollWatcher::start(const std::shared_ptr<Root>& root) {
+  caseSensitive_ = root->case_sensitive;
+  return true;
+}
+
+std::unique_ptr<DirHandle> PollWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    const char* path) {
+  // Take the times first, so that a change made while the crawler reads the
+  // dir is seen again on the next pass rather than missed.
+  auto st = fileSystem_.getFileInformation(path, caseSensitive_);
+  auto osdir = fileSystem_.openDir(path);
+  dirs_.wlock()->insert_or_assign(w_string{path}, DirTimes{st.mtime, st.ctime});
+  return osdir;
+}
+
+folly::SemiFuture<folly::Unit> PollWatcher::flushPendingEvents() {
+  // The cookie file shows up as soon as its dir is polled, which may be
+  // before the rest of the tree is; only a pass that starts after this call
+  // is guaranteed to have seen every change made before it.
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    flushRequests_.push_back(std::move(p));
+  }
+  cond_.notify_all();
+  return std::move(f);
+}
+
+bool PollWatcher::waitNotify(int timeoutms) {
+  if (inPass_) {
+    // Keep consumeNotify going until the pass is done, but end the notify
+    // thread's batch whenever there's something for the IO thread.
+    if (timeoutms == 0 && yieldToIoThread_) {
+      yieldToIoThread_ = false;
+      return false;
+    }
+    return true;
+  }
+
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutms);
+  std::unique_lock<std::mutex> lock{mutex_};
+  while (!stopping_) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= nextPass_ || !flushRequests_.empty()) {
+      return true;
+    }
+    if (now >= deadline) {
+      return false;
+    }
+    cond_.wait_until(lock, std::min(deadline, nextPass_));
+  }
+  return false;
+}
+
+Watcher::ConsumeNotifyRet PollWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  if (!inPass_) {
+    inPass_ = true;
+    passStart_ = std::chrono::steady_clock::now();
+    passStats_ = 0;
+    passCursor_ = w_string{};
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      passFlushes_ = std::move(flushRequests_);
+      flushRequests_.clear();
+    }
+    if (fullScanPeriod_.count() > 0) {
+      // Spread the dirs over the passes that fit in fullScanPeriod_.
+      auto passesPerScan = std::max<int64_t>(
+          1,
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              fullScanPeriod_)
+                  .count() /
+              interval_.count());
+      auto numDirs = dirs_.rlock()->size();
+      sweepRemaining_ = (numDirs + passesPerScan - 1) / passesPerScan;
+    }
+  }
+
+  std::vector<w_string> paths;
+  std::vector<DirTimes> times;
+  {
+    auto dirs = dirs_.rlock();
+    auto it = passCursor_.empty() ? dirs->begin()
+                                  : dirs->upper_bound(passCursor_);
+    for (; it != dirs->end() && paths.size() < kDirsPerChunk; ++it) {
+      paths.push_back(it->first);
+      times.push_back(it->second);
+    }
+  }
+
+  auto now = std::chrono::system_clock::now();
+
+  if (paths.empty()) {
+    // The pass is complete. Any earlier changes are already queued, so the
+    // flushes can be fulfilled once the IO thread has caught up to here.
+    for (auto& flush : passFlushes_) {
+      coll.addSync(std::move(flush));
+    }
+    passFlushes_.clear();
+    if (sweepRemaining_ > 0) {
+      // We ran off the end of the tree; carry on from the top next time.
+      sweepCursor_ = w_string{};
+    }
+    inPass_ = false;
+    auto end = std::chrono::steady_clock::now();
+    nextPass_ = end + interval_;
+    lastPassMs_.store(
+        std::chrono::duration_cast<std::chrono::milliseconds>(end - passStart_)
+            .count(),
+        std::memory_order_relaxed);
+    passes_.fetch_add(1, std::memory_order_relaxed);
+    return {false};
+  }
+
+  auto results = statDirs(paths);
+  passStats_ += paths.size();
+  dirsStatted_.fetch_add(paths.size(), std::memory_order_relaxed);
+
+  bool queued = false;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    auto& path = paths[i];
+    auto& result = results[i];
+
+    if (!result) {
+      if (path == root->root_path) {
+        log(ERR,
+            "root dir ",
+            root->root_path,
+            " can no longer be stat'd, canceling watch\n");
+        return {true};
+      }
+      // Let the crawler find out what happened to it; it's added back if
+      // it is opened again.
+      dirs_.wlock()->erase(path);
+      coll.add(path, now, W_PENDING_VIA_NOTIFY);
+      changedDirs_.fetch_add(1, std::memory_order_relaxed);
+      queued = true;
+      continue;
+    }
+
+    bool changed = !timespecEqual(result->mtime, times[i].mtime) ||
+        !timespecEqual(result->ctime, times[i].ctime);
+    bool sweep = !changed && sweepRemaining_ > 0 &&
+        (sweepCursor_.empty() || sweepCursor_ < path);
+    if (changed) {
+      auto dirs = dirs_.wlock();
+      auto it = dirs->find(path);
+      if (it != dirs->end()) {
+        it->second = DirTimes{result->mtime, result->ctime};
+      }
+      changedDirs_.fetch_add(1, std::memory_order_relaxed);
+    } else if (sweep) {
+      sweepCursor_ = path;
+      --sweepRemaining_;
+      sweptDirs_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      continue;
+    }
+    coll.add(path, now, W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+    queued = true;
+  }
+  passCursor_ = paths.back();
+  yieldToIoThread_ |= queued;
+
+  if (!throttle()) {
+    inPass_ = false;
+  }
+  return {false};
+}
+
+std::vector<std::optional<FileInformation>> PollWatcher::statDirs(
+    const std::vector<w_string>& paths) {
+  std::vector<std::optional<FileInformation>> results(paths.size());
+  auto statStride = [&](size_t first) {
+    for (size_t i = first; i < paths.size(); i += parallelism_) {
+      try {
+        results[i] =
+            fileSystem_.getFileInformation(paths[i].c_str(), caseSensitive_);
+      } catch (const std::system_error&) {
+        // Reported as gone; the crawler deals with the error.
+      }
+    }
+  };
+
+  // Network filesystems are latency bound, so overlap the round trips.
+  auto numStrides = std::min(parallelism_, paths.size());
+  std::vector<size_t> pooled;
+  std::vector<folly::Future<folly::Unit>> strides;
+  for (size_t i = 1; i < numStrides; ++i) {
+    try {
+      strides.push_back(
+          folly::via(&getThreadPool(), [&statStride, i] { statStride(i); }));
+      pooled.push_back(i);
+    } catch (const std::exception&) {
+      // The pool is full or stopping; do that stride here instead.
+      statStride(i);
+    }
+  }
+  statStride(0);
+
+  auto done = folly::collectAll(std::move(strides)).get();
+  for (size_t i = 0; i < done.size(); ++i) {
+    if (done[i].hasException()) {
+      statStride(pooled[i]);
+    }
+  }
+  return results;
+}
+
+bool PollWatcher::throttle() {
+  std::unique_lock<std::mutex> lock{mutex_};
+  if (maxStatsPerSecond_ > 0) {
+    auto due = passStart_ +
+        std::chrono::milliseconds(passStats_ * 1000 / maxStatsPerSecond_);
+    cond_.wait_until(lock, due, [&] { return stopping_; });
+  }
+  return !stopping_;
+}
+
+void PollWatcher::stopThreads() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stopping_ = true;
+  }
+  cond_.notify_all();
+}
+
+json_ref PollWatcher::getDebugInfo() {
+  return json_object({
+      {"watched_dir_count", json_integer(dirs_.rlock()->size())},
+      {"pass_count", json_integer(passes_.load())},
+      {"dir_stat_count", json_integer(dirsStatted_.load())},
+      {"changed_dir_count", json_integer(changedDirs_.load())},
+      {"swept_dir_count", json_integer(sweptDirs_.load())},
+      {"last_pass_ms", json_integer(lastPassMs_.load())},
+  });
+}
+
+void PollWatcher::clearDebugInfo() {
+  passes_.store(0, std::memory_order_release);
+  dirsStatted_.store(0, std::memory_order_release);
+  changedDirs_.store(0, std::memory_order_release);
+  sweptDirs_.store(0, std::memory_order_release);
+}
+
+namespace {
+
+bool fstypeWantsPolling(const w_string& fstype, const Configuration& config) {
+  auto fstypes = config.get("poll_fstypes");
+  if (!fstypes || !fstypes->isArray()) {
+    return false;
+  }
+  for (auto& obj : fstypes->array()) {
+    const char* name = json_string_value(obj);
+    if (name && w_string_equal_cstring(fstype, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::shared_ptr<QueryableView> detectPoll(
+    const w_string& root_path,
+    const w_string& fstype,
+    const Configuration& config) {
+  if (strcmp(config.getString("watcher", "auto"), "poll") != 0 &&
+      !fstypeWantsPolling(fstype, config)) {
+    throw std::runtime_error(
+        "Not using the poll watcher as it wasn't requested and the " +
+        fstype.string() + " filesystem isn't listed in \"poll_fstypes\"");
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem,
+      root_path,
+      config,
+      std::make_shared<PollWatcher>(realFileSystem, config));
+}
+} // namespace
+
+// Favored over everything else for the filesystems it is configured for,
+// since the other watchers would start but miss changes there.
+static WatcherRegistry reg("poll", detectPoll, 10);
+
+} // namespace watchman
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <folly/futures/Promise.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "watchman/fs/FileSystem.h"
+#include "watchman/watcher/Watcher.h"
+
+namespace watchman {
+
+class Configuration;
+
+/**
+ * A watcher for filesystems whose change notifications can't be relied on,
+ * such as NFS and CIFS mounts.
+ *
+ * Every poll_interval_ms it stats each directory that the crawler has
+ * opened. A directory whose mtime or ctime moved has its entries
+ * re-examined, which picks up files that were created, deleted or renamed in
+ * it. Writes to existing files don't touch their directory, so a slice of
+ * the unchanged directories is re-examined on each pass as well, such that
+ * every file is looked at once per poll_full_scan_seconds.
+ */
+class PollWatcher : public Watcher {
+ public:
+  PollWatcher(FileSystem& fileSystem, const Configuration& config);
+
+  bool start(const std::shared_ptr<Root>& root) override;
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      const char* path) override;
+
+  folly::SemiFuture<folly::Unit> flushPendingEvents() override;
+
+  bool waitNotify(int timeoutms) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+ private:
+  struct DirTimes {
+    struct timespec mtime;
+    struct timespec ctime;
+  };
+
+  // Stats paths, using up to parallelism_ threads. A path that can't be
+  // stat'd gets std::nullopt.
+  std::vector<std::optional<FileInformation>> statDirs(
+      const std::vector<w_string>& paths);
+
+  // Sleeps for as long as it takes to keep this pass under
+  // maxStatsPerSecond_. Returns false if the watcher is stopping.
+  bool throttle();
+
+  FileSystem& fileSystem_;
+  const std::chrono::milliseconds interval_;
+  const std::chrono::seconds fullScanPeriod_;
+  const size_t maxStatsPerSecond_;
+  const size_t parallelism_;
+  CaseSensitivity caseSensitive_{CaseSensitivity::Unknown};
+
+  // The dirs that the crawler opened, and their times as of the last look.
+  // Ordered so that a pass can pick up where it left off after yielding.
+  folly::Synchronized<std::map<w_string, DirTimes>> dirs_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stopping_{false};
+  // flushPendingEvents callers waiting for the next complete pass.
+  std::vector<folly::Promise<folly::Unit>> flushRequests_;
+
+  // The state of the current pass; only used by the notify thread.
+  bool inPass_{false};
+  // Set when a chunk queued changes, so that waitNotify(0) hands them to the
+  // IO thread before the pass continues.
+  bool yieldToIoThread_{false};
+  std::chrono::steady_clock::time_point passStart_;
+  std::chrono::steady_clock::time_point nextPass_;
+  size_t passStats_{0};
+  // The last dir that this pass looked at.
+  w_string passCursor_;
+  std::vector<folly::Promise<folly::Unit>> passFlushes_;
+  // The unchanged dirs after sweepCursor_ are re-examined until
+  // sweepRemaining_ runs out; it's topped up at the start of every pass.
+  w_string sweepCursor_;
+  size_t sweepRemaining_{0};
+
+  std::atomic<uint64_t> passes_{0};
+  std::atomic<uint64_t> dirsStatted_{0};
+  std::atomic<uint64_t> changedDirs_{0};
+  std::atomic<uint64_t> sweptDirs_{0};
+  std::atomic<int64_t> lastPassMs_{0};
+};
+
+} // namespace watchman
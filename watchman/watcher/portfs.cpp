@@ -11,6 +11,7 @@
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <memory>
+#include <unordered_set>
 #include "watchman/InMemoryView.h"
 
 #ifdef HAVE_PORT_CREATE
@@ -39,6 +40,12 @@ struct PortFSWatcher : public Watcher {
   std::unique_ptr<watchman_port_file> root_delete_w_port_file;
   bool root_deleted;
 
+  // When set, files are only associated with the port once their parent
+  // directory has reported a change, so that setting up the watch costs
+  // one association per directory rather than per file.
+  bool lazy_file_watches;
+  folly::Synchronized<std::unordered_set<w_string>> changed_dirs;
+
   port_event_t portevents[WATCHMAN_BATCH_LIMIT];
 
   explicit PortFSWatcher(watchman_root* root);
@@ -56,6 +63,13 @@ struct PortFSWatcher : public Watcher {
       PendingCollection::LockedPtr& coll) override;
 
   bool waitNotify(int timeoutms) override;
+  // Queues the first n entries of portevents; returns true if the root
+  // itself went away.
+  bool processEvents(
+      const std::shared_ptr<watchman_root>& root,
+      PendingCollection::LockedPtr& coll,
+      const struct timeval& now,
+      uint_t n);
   void signalThreads() override;
   bool do_watch(
       const w_string& name,
@@ -94,7 +108,9 @@ PortFSWatcher::PortFSWatcher(watchman_root* root)
     : Watcher("portfs", 0),
       port_fd(port_create(), "port_create()"),
       port_delete_fd(port_create(), "port_create()"),
-      root_deleted(false) {
+      root_deleted(false),
+      lazy_file_watches(
+          root->config.getBool("portfs_lazy_file_watches", false)) {
   auto wlock = port_files.wlock();
   wlock->reserve(root->config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
   port_fd.setCloExec();
@@ -174,12 +190,19 @@ bool PortFSWatcher::start(const std::shared_ptr<watchman_root>& root) {
 }
 
 bool PortFSWatcher::startWatchFile(struct watchman_file* file) {
+  if (lazy_file_watches &&
+      changed_dirs.rlock()->count(file->parent->getFullPath()) == 0) {
+    // Nothing has happened in this directory yet; it is enough to watch the
+    // directory itself until it does.
+    return true;
+  }
+
   auto name = file->parent->getFullPathToChild(file->getName());
   if (!name) {
     return false;
   }
 
-  return do_watch(name, file->stat, false);
+  return do_watch(name, file->getFileInformation(), false);
 }
 
 std::unique_ptr<DirHandle> PortFSWatcher::startWatchDir(
@@ -211,38 +234,55 @@ std::unique_ptr<DirHandle> PortFSWatcher::startWatchDir(
 Watcher::ConsumeNotifyRet PortFSWatcher::consumeNotify(
     const std::shared_ptr<watchman_root>& root,
     PendingCollection::LockedPtr& coll) {
-  uint_t i, n;
+  uint_t n, total = 0;
   struct timeval now;
+  struct timespec no_wait = {0, 0};
 
   // root got deleted, cancel the watch
   if (root_deleted) {
     return {false, true};
   }
 
-  errno = 0;
+  gettimeofday(&now, nullptr);
 
-  n = 1;
-  if (port_getn(
-          port_fd.fd(),
-          portevents,
-          sizeof(portevents) / sizeof(portevents[0]),
-          &n,
-          nullptr)) {
-    if (errno == EINTR) {
-      return {false, false};
+  // Keep draining the port without blocking for as long as it hands us full
+  // batches, so that a burst of changes is consumed in one wakeup.
+  do {
+    errno = 0;
+    n = 1;
+    if (port_getn(
+            port_fd.fd(),
+            portevents,
+            sizeof(portevents) / sizeof(portevents[0]),
+            &n,
+            total == 0 ? nullptr : &no_wait) &&
+        errno != ETIME) {
+      // ETIME only means that the port ran dry; n holds what we did get.
+      if (errno == EINTR) {
+        return {total > 0, false};
+      }
+      logf(FATAL, "port_getn: {}\n", folly::errnoStr(errno));
     }
-    logf(FATAL, "port_getn: {}\n", folly::errnoStr(errno));
-  }
 
-  logf(DBG, "port_getn: n={}\n", n);
+    logf(DBG, "port_getn: n={}\n", n);
+    total += n;
 
-  if (n == 0) {
-    return {false, false};
-  }
+    if (processEvents(root, coll, now, n)) {
+      return {false, true};
+    }
+  } while (n == sizeof(portevents) / sizeof(portevents[0]));
+
+  return {total > 0, false};
+}
 
+bool PortFSWatcher::processEvents(
+    const std::shared_ptr<watchman_root>& root,
+    PendingCollection::LockedPtr& coll,
+    const struct timeval& now,
+    uint_t n) {
+  uint_t i;
   auto wlock = port_files.wlock();
 
-  gettimeofday(&now, nullptr);
   for (i = 0; i < n; i++) {
     struct watchman_port_file* f;
     uint32_t pe = portevents[i].portev_events;
@@ -260,19 +300,23 @@ Watcher::ConsumeNotifyRet PortFSWatcher::consumeNotify(
           root->root_path,
           pe,
           flags_label);
-      return {false, true};
+      return true;
     }
     coll->add(
         f->name,
         now,
         (f->is_dir ? W_PENDING_RECURSIVE : 0) | W_PENDING_VIA_NOTIFY);
 
+    if (lazy_file_watches && f->is_dir) {
+      changed_dirs.wlock()->insert(f->name);
+    }
+
     // It was port_dissociate'd implicitly.  We'll re-establish a
     // watch later when portfs_root_start_watch_(file|dir) are called again
     wlock->erase(f->name);
   }
 
-  return {true, false};
+  return false;
 }
 
 bool PortFSWatcher::waitNotify(int timeoutms) {
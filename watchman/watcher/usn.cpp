@@ -0,0 +1,647 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Conv.h>
+#include <folly/ScopeGuard.h>
+#include <folly/Synchronized.h>
+#include <atomic>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "watchman/Constants.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/portability/WinError.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+#ifdef _WIN32
+
+#include <winioctl.h>
+
+using namespace watchman;
+
+namespace {
+
+// Directories outside of the root that are remembered so that records for
+// their children can be discarded without opening them again. The journal
+// covers the whole volume, so this is bounded and simply discarded when it
+// fills up.
+constexpr size_t kMaxForeignDirs = 64 * 1024;
+
+constexpr DWORD kNameChangeReasons = USN_REASON_FILE_CREATE |
+    USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME |
+    USN_REASON_RENAME_NEW_NAME;
+
+bool isUnderDir(const w_string& path, const w_string& dir) {
+  return path.piece().startsWith(dir.piece()) && is_path_prefix(path, dir);
+}
+
+// Returns the NTFS file reference number of the file at path.
+DWORDLONG fileReferenceNumber(const w_string& path) {
+  auto wpath = path.piece().asWideUNC();
+  FileDescriptor handle(
+      intptr_t(CreateFileW(
+          wpath.c_str(),
+          FILE_READ_ATTRIBUTES,
+          FILE_SHARE_READ | FILE_SHARE_DELETE | FILE_SHARE_WRITE,
+          nullptr,
+          OPEN_EXISTING,
+          FILE_FLAG_BACKUP_SEMANTICS,
+          nullptr)),
+      FileDescriptor::FDType::Generic);
+  if (!handle) {
+    throw std::system_error(
+        GetLastError(), std::system_category(), "CreateFileW");
+  }
+  BY_HANDLE_FILE_INFORMATION info;
+  if (!GetFileInformationByHandle((HANDLE)handle.handle(), &info)) {
+    throw std::system_error(
+        GetLastError(), std::system_category(), "GetFileInformationByHandle");
+  }
+  return (DWORDLONG(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+}
+
+} // namespace
+
+/**
+ * Watches an NTFS root by reading the volume's USN change journal. Records
+ * name the parent directory by file reference number, so we keep a cache of
+ * reference number -> path that is populated as the crawler opens each
+ * directory, and resolve the rest by opening them by id.
+ *
+ * The journal is persistent, so a root that is resumed from the tick index
+ * replays the records since its saved position instead of crawling, and a
+ * burst of changes never overflows an in-process buffer; we read at our own
+ * pace. Reading the journal requires administrator privileges.
+ */
+struct UsnWatcher : public Watcher {
+  const w_string rootPath_;
+  FileDescriptor rootHandle_;
+  FileDescriptor volumeHandle_;
+  DWORDLONG rootFrn_{0};
+  DWORDLONG journalId_{0};
+
+  HANDLE ping_{INVALID_HANDLE_VALUE};
+  HANDLE olapEvent_{INVALID_HANDLE_VALUE};
+  OVERLAPPED olap_;
+  bool readInFlight_{false};
+  std::vector<uint8_t> buf_;
+
+  // The position of the next record to read. Only used on the notify
+  // thread.
+  USN nextUsn_{0};
+
+  // Where to resume from, as given to setResumeCursor().
+  std::optional<std::pair<DWORDLONG, USN>> resumeFrom_;
+  bool resumed_{false};
+
+  std::atomic<uint64_t> totalRecordsSeen_{0};
+  std::atomic<uint64_t> frnCacheMisses_{0};
+
+  struct maps {
+    /* map of directory reference number to the name of the directory */
+    std::unordered_map<DWORDLONG, w_string> frn_to_name;
+    /* reference numbers of directories that are known to be outside */
+    std::unordered_set<DWORDLONG> foreign_frns;
+  };
+  folly::Synchronized<maps> maps_;
+
+  UsnWatcher(const w_string& root_path, const Configuration& config);
+  ~UsnWatcher();
+
+  bool start(const std::shared_ptr<Root>& root) override;
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+  void stopThreads() override;
+
+  w_string getEventCursor() override;
+  void setResumeCursor(const w_string& cursor) override;
+  bool resumedFromCursor() const override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+ private:
+  USN_JOURNAL_DATA_V0 queryJournal();
+
+  // Issues an overlapped read of the records that follow nextUsn_.
+  bool issueRead();
+
+  // Returns the path of the directory with the given reference number, or
+  // a null string if it is outside of the root or has been deleted.
+  w_string resolveDir(DWORDLONG frn);
+
+  // Forget the cached paths of dir and everything beneath it.
+  void forgetDir(const w_string& dir);
+
+  // Process a single record and add it to the pending collection if needed.
+  // Returns true if the root directory was removed and the watch needs to be
+  // cancelled.
+  bool processRecord(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      const USN_RECORD_V2* record,
+      std::chrono::system_clock::time_point now);
+};
+
+UsnWatcher::UsnWatcher(const w_string& root_path, const Configuration& config)
+    : Watcher("usn", WATCHER_HAS_PER_FILE_NOTIFICATIONS),
+      rootPath_(root_path),
+      buf_(std::max<json_int_t>(
+          4096, config.getInt("usn_read_buffer_size", 64 * 1024))) {
+  auto wpath = root_path.piece().asWideUNC();
+  rootHandle_ = FileDescriptor(
+      intptr_t(CreateFileW(
+          wpath.c_str(),
+          FILE_READ_ATTRIBUTES,
+          FILE_SHARE_READ | FILE_SHARE_DELETE | FILE_SHARE_WRITE,
+          nullptr,
+          OPEN_EXISTING,
+          FILE_FLAG_BACKUP_SEMANTICS,
+          nullptr)),
+      FileDescriptor::FDType::Generic);
+  if (!rootHandle_) {
+    throw std::runtime_error(
+        std::string("failed to open dir ") + root_path.c_str() + ": " +
+        win32_strerror(GetLastError()));
+  }
+  rootFrn_ = fileReferenceNumber(root_path);
+
+  WCHAR volumePath[MAX_PATH];
+  if (!GetVolumePathNameW(wpath.c_str(), volumePath, MAX_PATH)) {
+    throw std::runtime_error(
+        std::string("GetVolumePathNameW failed: ") +
+        win32_strerror(GetLastError()));
+  }
+  // "C:\" -> "\\.\C:"
+  std::wstring volume = L"\\\\.\\" + std::wstring(volumePath);
+  if (!volume.empty() && volume.back() == L'\\') {
+    volume.pop_back();
+  }
+  volumeHandle_ = FileDescriptor(
+      intptr_t(CreateFileW(
+          volume.c_str(),
+          GENERIC_READ,
+          FILE_SHARE_READ | FILE_SHARE_DELETE | FILE_SHARE_WRITE,
+          nullptr,
+          OPEN_EXISTING,
+          FILE_FLAG_OVERLAPPED,
+          nullptr)),
+      FileDescriptor::FDType::Generic);
+  if (!volumeHandle_) {
+    throw std::runtime_error(
+        std::string("failed to open the volume of ") + root_path.c_str() +
+        ": " + win32_strerror(GetLastError()));
+  }
+
+  // Throws if the volume has no active journal, so that auto-selection
+  // picks the next watcher.
+  journalId_ = queryJournal().UsnJournalID;
+
+  ping_ = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  olapEvent_ = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  if (!ping_ || !olapEvent_) {
+    throw std::runtime_error(
+        std::string("failed to create event: ") +
+        win32_strerror(GetLastError()));
+  }
+
+  maps_.wlock()->frn_to_name.reserve(
+      config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
+}
+
+UsnWatcher::~UsnWatcher() {
+  if (readInFlight_) {
+    // The kernel must be done with the buffer before it is freed.
+    DWORD bytes;
+    CancelIoEx((HANDLE)volumeHandle_.handle(), &olap_);
+    GetOverlappedResult((HANDLE)volumeHandle_.handle(), &olap_, &bytes, TRUE);
+  }
+  if (ping_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(ping_);
+  }
+  if (olapEvent_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(olapEvent_);
+  }
+}
+
+USN_JOURNAL_DATA_V0 UsnWatcher::queryJournal() {
+  USN_JOURNAL_DATA_V0 data;
+  DWORD bytes = 0;
+  OVERLAPPED olap = OVERLAPPED();
+  olap.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  SCOPE_EXIT {
+    CloseHandle(olap.hEvent);
+  };
+  if (!DeviceIoControl(
+          (HANDLE)volumeHandle_.handle(),
+          FSCTL_QUERY_USN_JOURNAL,
+          nullptr,
+          0,
+          &data,
+          sizeof(data),
+          &bytes,
+          &olap) &&
+      (GetLastError() != ERROR_IO_PENDING ||
+       !GetOverlappedResult(
+           (HANDLE)volumeHandle_.handle(), &olap, &bytes, TRUE))) {
+    throw std::runtime_error(
+        std::string("FSCTL_QUERY_USN_JOURNAL failed: ") +
+        win32_strerror(GetLastError()));
+  }
+  return data;
+}
+
+bool UsnWatcher::start(const std::shared_ptr<Root>& root) {
+  USN_JOURNAL_DATA_V0 journal;
+  try {
+    journal = queryJournal();
+  } catch (const std::exception& e) {
+    logf(ERR, "failed to start the usn watcher: {}\n", e.what());
+    return false;
+  }
+  journalId_ = journal.UsnJournalID;
+  nextUsn_ = journal.NextUsn;
+
+  if (resumeFrom_) {
+    auto [journalId, usn] = *resumeFrom_;
+    // The journal may have been recreated, or have discarded the records
+    // since the saved position.
+    if (journalId == journal.UsnJournalID && usn >= journal.FirstUsn &&
+        usn <= journal.NextUsn) {
+      nextUsn_ = usn;
+      resumed_ = true;
+      logf(
+          ERR,
+          "resuming {} from usn {} of journal {}\n",
+          root->root_path,
+          usn,
+          journalId);
+    } else {
+      logf(
+          ERR,
+          "can't resume {} from usn {} of journal {}; the journal is "
+          "{} and starts at {}\n",
+          root->root_path,
+          usn,
+          journalId,
+          journal.UsnJournalID,
+          journal.FirstUsn);
+    }
+  }
+
+  maps_.wlock()->frn_to_name[rootFrn_] = rootPath_;
+  return issueRead();
+}
+
+bool UsnWatcher::issueRead() {
+  READ_USN_JOURNAL_DATA_V0 request = READ_USN_JOURNAL_DATA_V0();
+  request.StartUsn = nextUsn_;
+  request.ReasonMask = USN_REASON_DATA_OVERWRITE | USN_REASON_DATA_EXTEND |
+      USN_REASON_DATA_TRUNCATION | USN_REASON_FILE_CREATE |
+      USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME |
+      USN_REASON_RENAME_NEW_NAME | USN_REASON_BASIC_INFO_CHANGE |
+      USN_REASON_REPARSE_POINT_CHANGE | USN_REASON_HARD_LINK_CHANGE;
+  request.ReturnOnlyOnClose = FALSE;
+  // Complete as soon as there is at least one record, with no timeout.
+  request.Timeout = 0;
+  request.BytesToWaitFor = 1;
+  request.UsnJournalID = journalId_;
+
+  olap_ = OVERLAPPED();
+  olap_.hEvent = olapEvent_;
+  ResetEvent(olapEvent_);
+
+  DWORD bytes = 0;
+  if (!DeviceIoControl(
+          (HANDLE)volumeHandle_.handle(),
+          FSCTL_READ_USN_JOURNAL,
+          &request,
+          sizeof(request),
+          buf_.data(),
+          buf_.size(),
+          &bytes,
+          &olap_) &&
+      GetLastError() != ERROR_IO_PENDING) {
+    logf(
+        ERR,
+        "FSCTL_READ_USN_JOURNAL({}): {}\n",
+        rootPath_,
+        win32_strerror(GetLastError()));
+    return false;
+  }
+  readInFlight_ = true;
+  return true;
+}
+
+std::unique_ptr<DirHandle> UsnWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    const char* path) {
+  auto osdir = openDir(path);
+
+  w_string name{path, W_STRING_BYTE};
+  try {
+    auto frn = fileReferenceNumber(name);
+    auto wlock = maps_.wlock();
+    wlock->foreign_frns.erase(frn);
+    wlock->frn_to_name[frn] = name;
+  } catch (const std::system_error& exc) {
+    // It'll be resolved by id if a record names it.
+    logf(DBG, "no reference number for {}: {}\n", path, exc.what());
+  }
+
+  return osdir;
+}
+
+w_string UsnWatcher::resolveDir(DWORDLONG frn) {
+  {
+    auto rlock = maps_.rlock();
+    auto it = rlock->frn_to_name.find(frn);
+    if (it != rlock->frn_to_name.end()) {
+      return it->second;
+    }
+    if (rlock->foreign_frns.count(frn)) {
+      return nullptr;
+    }
+  }
+
+  frnCacheMisses_.fetch_add(1, std::memory_order_relaxed);
+  FILE_ID_DESCRIPTOR desc = FILE_ID_DESCRIPTOR();
+  desc.dwSize = sizeof(desc);
+  desc.Type = FileIdType;
+  desc.FileId.QuadPart = frn;
+  FileDescriptor dir(
+      intptr_t(OpenFileById(
+          (HANDLE)rootHandle_.handle(),
+          &desc,
+          FILE_READ_ATTRIBUTES,
+          FILE_SHARE_READ | FILE_SHARE_DELETE | FILE_SHARE_WRITE,
+          nullptr,
+          FILE_FLAG_BACKUP_SEMANTICS)),
+      FileDescriptor::FDType::Generic);
+  if (!dir) {
+    // The directory has since been deleted; its removal is reported
+    // against its parent.
+    logf(DBG, "OpenFileById: {}\n", win32_strerror(GetLastError()));
+    return nullptr;
+  }
+
+  w_string name;
+  try {
+    name = dir.getOpenedPath();
+  } catch (const std::system_error& exc) {
+    logf(DBG, "resolving directory {:x}: {}\n", frn, exc.what());
+    return nullptr;
+  }
+
+  auto wlock = maps_.wlock();
+  if (!isUnderDir(name, rootPath_)) {
+    if (wlock->foreign_frns.size() >= kMaxForeignDirs) {
+      wlock->foreign_frns.clear();
+    }
+    wlock->foreign_frns.insert(frn);
+    return nullptr;
+  }
+  wlock->frn_to_name[frn] = name;
+  return name;
+}
+
+void UsnWatcher::forgetDir(const w_string& dir) {
+  auto wlock = maps_.wlock();
+  auto it = wlock->frn_to_name.begin();
+  while (it != wlock->frn_to_name.end()) {
+    if (isUnderDir(it->second, dir)) {
+      it = wlock->frn_to_name.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool UsnWatcher::processRecord(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    const USN_RECORD_V2* record,
+    std::chrono::system_clock::time_point now) {
+  auto reason = record->Reason;
+  bool isDir = record->FileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+
+  if (record->FileReferenceNumber == rootFrn_) {
+    if (reason & (USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME)) {
+      logf(
+          ERR,
+          "root dir {} has been (re)moved, canceling watch\n",
+          root->root_path);
+      return true;
+    }
+    coll.add(root->root_path, now, W_PENDING_VIA_NOTIFY);
+    return false;
+  }
+
+  auto dir_name = resolveDir(record->ParentFileReferenceNumber);
+  if (!dir_name) {
+    // Outside of the root, or a directory that has since been deleted, in
+    // which case its parent has a record of the deletion.
+    return false;
+  }
+
+  w_string name(
+      reinterpret_cast<const WCHAR*>(
+          reinterpret_cast<const char*>(record) + record->FileNameOffset),
+      record->FileNameLength / sizeof(WCHAR));
+  auto full = w_string::pathCat({dir_name, name});
+
+  logf(DBG, "usn: reason={:x} {}\n", reason, full);
+
+  if (root->ignore.isIgnored(full.data(), full.size())) {
+    return false;
+  }
+
+  PendingFlags flags = W_PENDING_VIA_NOTIFY;
+  if (reason & (USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME)) {
+    // As with ReadDirectoryChangesW, the path may be the top of a tree
+    // that is being removed or renamed away.
+    flags.set(W_PENDING_RECURSIVE);
+    if (isDir) {
+      forgetDir(full);
+    }
+  } else if (
+      isDir &&
+      (reason & (USN_REASON_FILE_CREATE | USN_REASON_RENAME_NEW_NAME))) {
+    // A dir that was renamed into place brings its contents with it.
+    flags.set(W_PENDING_RECURSIVE);
+    auto wlock = maps_.wlock();
+    wlock->foreign_frns.erase(record->FileReferenceNumber);
+    wlock->frn_to_name[record->FileReferenceNumber] = full;
+  }
+  coll.add(full, now, flags);
+
+  if (reason & kNameChangeReasons) {
+    // The journal records changes to the entry but not to its parent's
+    // mtime, so synthesize an event for the IO thread to rescan it.
+    coll.add(dir_name, now, W_PENDING_VIA_NOTIFY);
+  }
+  return false;
+}
+
+Watcher::ConsumeNotifyRet UsnWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  if (!readInFlight_) {
+    return {false};
+  }
+
+  DWORD bytes = 0;
+  if (!GetOverlappedResult(
+          (HANDLE)volumeHandle_.handle(), &olap_, &bytes, FALSE)) {
+    DWORD err = GetLastError();
+    if (err == ERROR_IO_INCOMPLETE) {
+      return {false};
+    }
+    readInFlight_ = false;
+
+    if (err == ERROR_JOURNAL_ENTRY_DELETED) {
+      // We fell so far behind that the journal discarded records we hadn't
+      // read yet.
+      root->scheduleRecrawl("USN journal records were discarded");
+      try {
+        nextUsn_ = queryJournal().NextUsn;
+      } catch (const std::exception& e) {
+        logf(ERR, "{}, cancelling watch for {}\n", e.what(), root->root_path);
+        return {true};
+      }
+      return {!issueRead()};
+    }
+
+    logf(
+        ERR,
+        "FSCTL_READ_USN_JOURNAL({}): {:x} {}, cancelling watch\n",
+        root->root_path,
+        err,
+        win32_strerror(err));
+    return {true};
+  }
+  readInFlight_ = false;
+
+  // The output begins with the USN to continue reading from.
+  if (bytes < sizeof(USN)) {
+    return {!issueRead()};
+  }
+  auto now = std::chrono::system_clock::now();
+  bool cancel = false;
+  size_t recordsSeen = 0;
+  size_t offset = sizeof(USN);
+  while (offset + sizeof(USN_RECORD_V2) <= bytes) {
+    auto record = reinterpret_cast<const USN_RECORD_V2*>(buf_.data() + offset);
+    if (record->RecordLength == 0) {
+      break;
+    }
+    if (record->MajorVersion == 2) {
+      cancel |= processRecord(root, coll, record, now);
+      ++recordsSeen;
+    }
+    offset += record->RecordLength;
+  }
+  nextUsn_ = *reinterpret_cast<const USN*>(buf_.data());
+  totalRecordsSeen_.fetch_add(recordsSeen, std::memory_order_relaxed);
+
+  if (cancel) {
+    return {true};
+  }
+  return {!issueRead()};
+}
+
+bool UsnWatcher::waitNotify(int timeoutms) {
+  if (!readInFlight_) {
+    // consumeNotify will report the failure.
+    return true;
+  }
+  HANDLE handles[2] = {olapEvent_, ping_};
+  DWORD status = WaitForMultipleObjects(2, handles, FALSE, timeoutms);
+  return status == WAIT_OBJECT_0;
+}
+
+void UsnWatcher::stopThreads() {
+  SetEvent(ping_);
+}
+
+w_string UsnWatcher::getEventCursor() {
+  return w_string::build(journalId_, ":", nextUsn_);
+}
+
+void UsnWatcher::setResumeCursor(const w_string& cursor) {
+  auto view = cursor.view();
+  auto colon = view.find(':');
+  if (colon == std::string_view::npos) {
+    return;
+  }
+  auto journalId = folly::tryTo<DWORDLONG>(view.substr(0, colon));
+  auto usn = folly::tryTo<USN>(view.substr(colon + 1));
+  if (journalId.hasValue() && usn.hasValue()) {
+    resumeFrom_ = std::make_pair(journalId.value(), usn.value());
+  }
+}
+
+bool UsnWatcher::resumedFromCursor() const {
+  return resumed_;
+}
+
+json_ref UsnWatcher::getDebugInfo() {
+  auto rlock = maps_.rlock();
+  return json_object({
+      {"total_record_count", json_integer(totalRecordsSeen_.load())},
+      {"frn_cache_size", json_integer(rlock->frn_to_name.size())},
+      {"frn_cache_misses", json_integer(frnCacheMisses_.load())},
+  });
+}
+
+void UsnWatcher::clearDebugInfo() {
+  totalRecordsSeen_.store(0, std::memory_order_release);
+  frnCacheMisses_.store(0, std::memory_order_release);
+}
+
+namespace {
+std::shared_ptr<QueryableView> detectUsn(
+    const w_string& root_path,
+    const w_string& fstype,
+    const Configuration& config) {
+  if (!config.getBool("prefer_usn_watcher", false)) {
+    throw std::runtime_error(
+        "Not using the usn watcher as the \"prefer_usn_watcher\" config "
+        "isn't set");
+  }
+  if (fstype != "NTFS") {
+    throw std::runtime_error(
+        "the usn watcher requires NTFS, not " + fstype.string());
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem,
+      root_path,
+      config,
+      std::make_shared<UsnWatcher>(root_path, config));
+}
+} // namespace
+
+// Favored over win32 when enabled; if the journal is unavailable (inactive,
+// or missing privileges) auto-selection falls back to win32.
+static WatcherRegistry reg("usn", detectUsn, 1);
+
+#endif // _WIN32
+
+/* vim:ts=2:sw=2:et:
+ */
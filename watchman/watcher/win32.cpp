@@ -5,9 +5,12 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/ScopeGuard.h>
 #include <folly/Synchronized.h>
 #include "watchman/InMemoryView.h"
 #include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/FileInformation.h"
+#include "watchman/fs/WindowsTime.h"
 #include "watchman/portability/WinError.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/Watcher.h"
@@ -31,16 +34,78 @@ constexpr DWORD kNetworkBufSize = 64 * 1024;
 struct Item {
   w_string path;
   PendingFlags flags;
+  std::unique_ptr<const FileInformation> stat;
 
-  Item(w_string&& path, PendingFlags flags)
-      : path(std::move(path)), flags(flags) {}
+  Item(
+      w_string&& path,
+      PendingFlags flags,
+      std::unique_ptr<const FileInformation> stat = nullptr)
+      : path(std::move(path)), flags(flags), stat(std::move(stat)) {}
 };
 
+/**
+ * One of the ReadDirectoryChanges requests that are kept in flight on the
+ * root. The kernel completes them in the order they were issued, so while
+ * one buffer is being parsed the next one is already receiving changes.
+ */
+struct ChangesRead {
+  std::vector<uint8_t> buf;
+  OVERLAPPED olap;
+  HANDLE event;
+  bool inFlight{false};
+  // Whether the buffer holds FILE_NOTIFY_EXTENDED_INFORMATION records.
+  bool extended{false};
+
+  ChangesRead() : event(CreateEvent(nullptr, TRUE, FALSE, nullptr)) {
+    if (!event) {
+      throw std::runtime_error(
+          std::string("failed to create event: ") +
+          win32_strerror(GetLastError()));
+    }
+  }
+  ChangesRead(const ChangesRead&) = delete;
+  ChangesRead& operator=(const ChangesRead&) = delete;
+
+  ~ChangesRead() {
+    CloseHandle(event);
+  }
+};
+
+/**
+ * The stat information that FILE_NOTIFY_EXTENDED_INFORMATION carries, in the
+ * same form as FileDescriptor::getInfo() would produce it.
+ */
+std::unique_ptr<const FileInformation> statFromNotify(
+    const FILE_NOTIFY_EXTENDED_INFORMATION& notify) {
+  auto st = std::make_unique<FileInformation>(notify.FileAttributes);
+  FILETIME_LARGE_INTEGER_to_timespec(notify.CreationTime, &st->ctime);
+  FILETIME_LARGE_INTEGER_to_timespec(notify.LastAccessTime, &st->atime);
+  FILETIME_LARGE_INTEGER_to_timespec(notify.LastModificationTime, &st->mtime);
+  st->size = notify.FileSize.QuadPart;
+  // The link count isn't reported; nearly every file has just the one.
+  st->nlink = 1;
+  return st;
+}
+
+template <typename Notify, typename Fn>
+void forEachNotify(const uint8_t* buf, Fn&& fn) {
+  auto notify = reinterpret_cast<const Notify*>(buf);
+  while (true) {
+    fn(*notify);
+
+    // Advance to next item
+    if (notify->NextEntryOffset == 0) {
+      break;
+    }
+    notify = reinterpret_cast<const Notify*>(
+        reinterpret_cast<const char*>(notify) + notify->NextEntryOffset);
+  }
+}
+
 } // namespace
 
 struct WinWatcher : public Watcher {
   HANDLE ping{INVALID_HANDLE_VALUE};
-  HANDLE olapEvent{INVALID_HANDLE_VALUE};
   FileDescriptor dir_handle;
 
   std::condition_variable cond;
@@ -64,7 +129,9 @@ struct WinWatcher : public Watcher {
 };
 
 WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
-    : Watcher("win32", WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
+    : Watcher(
+          "win32",
+          WATCHER_HAS_PER_FILE_NOTIFICATIONS | WATCHER_SUPPLIES_STAT) {
   auto wpath = root_path.piece().asWideUNC();
 
   // Create an overlapped handle so that we can avoid blocking forever
@@ -92,21 +159,12 @@ WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
         std::string("failed to create event: ") +
         win32_strerror(GetLastError()));
   }
-  olapEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
-  if (!olapEvent) {
-    throw std::runtime_error(
-        std::string("failed to create event: ") +
-        win32_strerror(GetLastError()));
-  }
 }
 
 WinWatcher::~WinWatcher() {
   if (ping != INVALID_HANDLE_VALUE) {
     CloseHandle(ping);
   }
-  if (olapEvent != INVALID_HANDLE_VALUE) {
-    CloseHandle(olapEvent);
-  }
 }
 
 void WinWatcher::stopThreads() {
@@ -114,10 +172,7 @@ void WinWatcher::stopThreads() {
 }
 
 void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
-  std::vector<uint8_t> buf;
-  auto olap = OVERLAPPED();
-  BOOL initiate_read = true;
-  HANDLE handles[2] = {olapEvent, ping};
+  auto handle = (HANDLE)dir_handle.handle();
   DWORD bytes;
 
   w_set_thread_name("readchange ", root->root_path.view());
@@ -131,32 +186,100 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
 
   DWORD size = root->config.getInt("win32_rdcw_buf_size", 16384);
 
+  // ReadDirectoryChangesExW reports the stat information of each changed
+  // entry, which saves the IO thread from opening the file to stat it.
+  // Filesystems that don't support it get the plain ReadDirectoryChangesW.
+  bool extended = root->config.getBool("win32_rdcw_extended_info", true);
+
+  std::vector<ChangesRead> reads(std::max<json_int_t>(
+      1, root->config.getInt("win32_rdcw_inflight_buffers", 4)));
+  // The oldest read in flight, which is the next one to complete.
+  size_t next = 0;
+
   DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
       FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
       FILE_NOTIFY_CHANGE_LAST_WRITE;
 
-  // Block until winmatch_root_st is waiting for our initialization
-  {
-    auto wlock = changedItems.lock();
+  auto issueRead = [&](ChangesRead& read) {
+    read.buf.resize(size);
+    read.olap = OVERLAPPED();
+    read.olap.hEvent = read.event;
+    ResetEvent(read.event);
 
-    olap.hEvent = olapEvent;
-
-    buf.resize(size);
+    if (extended) {
+      if (ReadDirectoryChangesExW(
+              handle,
+              read.buf.data(),
+              size,
+              TRUE,
+              filter,
+              nullptr,
+              &read.olap,
+              nullptr,
+              ReadDirectoryNotifyExtendedInformation)) {
+        read.inFlight = true;
+        read.extended = true;
+        return true;
+      }
+      DWORD err = GetLastError();
+      logf(
+          ERR,
+          "ReadDirectoryChangesExW: {}, falling back to "
+          "ReadDirectoryChangesW\n",
+          win32_strerror(err));
+      extended = false;
+    }
 
     if (!ReadDirectoryChangesW(
-            (HANDLE)dir_handle.handle(),
-            &buf[0],
+            handle,
+            read.buf.data(),
             size,
             TRUE,
             filter,
             nullptr,
-            &olap,
+            &read.olap,
             nullptr)) {
       DWORD err = GetLastError();
       logf(
           ERR,
           "ReadDirectoryChangesW: failed, cancel watch. {}\n",
           win32_strerror(err));
+      return false;
+    }
+    read.inFlight = true;
+    read.extended = false;
+    return true;
+  };
+
+  auto issueAllReads = [&] {
+    next = 0;
+    for (auto& read : reads) {
+      if (!issueRead(read)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // The kernel must be done with the buffers before they can be freed.
+  auto cancelReads = [&] {
+    CancelIoEx(handle, nullptr);
+    for (auto& read : reads) {
+      if (read.inFlight) {
+        GetOverlappedResult(handle, &read.olap, &bytes, TRUE);
+        read.inFlight = false;
+      }
+    }
+  };
+  SCOPE_EXIT {
+    cancelReads();
+  };
+
+  // Block until winmatch_root_st is waiting for our initialization
+  {
+    auto wlock = changedItems.lock();
+
+    if (!issueAllReads()) {
       root->cancel();
       return;
     }
@@ -167,33 +290,55 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
     logf(DBG, "ReadDirectoryChangesW signalling as init done\n");
     cond.notify_one();
   }
-  initiate_read = false;
 
   std::list<Item> items;
 
+  auto addChange = [&](DWORD action,
+                       const WCHAR* fileName,
+                       DWORD fileNameLength,
+                       std::unique_ptr<const FileInformation> stat) {
+    // FileNameLength is in BYTES, but FileName is WCHAR
+    DWORD n_chars = fileNameLength / sizeof(fileName[0]);
+    w_string name(fileName, n_chars);
+
+    auto full = w_string::pathCat({root->root_path, name});
+
+    if (root->ignore.isIgnored(full.data(), full.size())) {
+      return;
+    }
+
+    // If we have a delete or rename-away it may be part of
+    // a recursive tree remove or rename.  In that situation
+    // the notifications that we'll receive from the OS will
+    // be from the leaves and bubble up to the root of the
+    // delete/rename.  We want to flag those paths for recursive
+    // analysis so that we can prune children from the trie
+    // that is built when we pass this to the pending list
+    // later.  We don't do that here in this thread because
+    // we're trying to minimize latency in this context.
+    bool removed = action == FILE_ACTION_REMOVED ||
+        action == FILE_ACTION_RENAMED_OLD_NAME;
+    items.emplace_back(
+        w_string{full},
+        removed ? W_PENDING_RECURSIVE : PendingFlags{},
+        removed ? nullptr : std::move(stat));
+
+    if (!name.empty() &&
+        (action == FILE_ACTION_ADDED || action == FILE_ACTION_REMOVED ||
+         action == FILE_ACTION_RENAMED_OLD_NAME ||
+         action == FILE_ACTION_RENAMED_NEW_NAME)) {
+      // ReadDirectoryChangesW provides change events when the child
+      // entry list changes, but may not provide a notification for the
+      // parent when its mtime changes. It should be rescanned, so
+      // synthesize an event for the IO thread here.
+      items.emplace_back(full.dirName(), PendingFlags{});
+    }
+  };
+
   // The mutex must not be held when we enter the loop
   while (!root->inner.cancelled) {
-    if (initiate_read) {
-      if (!ReadDirectoryChangesW(
-              (HANDLE)dir_handle.handle(),
-              &buf[0],
-              size,
-              TRUE,
-              filter,
-              nullptr,
-              &olap,
-              nullptr)) {
-        DWORD err = GetLastError();
-        logf(
-            ERR,
-            "ReadDirectoryChangesW: failed, cancel watch. {}\n",
-            win32_strerror(err));
-        root->cancel();
-        break;
-      } else {
-        initiate_read = false;
-      }
-    }
+    auto& read = reads[next];
+    HANDLE handles[2] = {read.event, ping};
 
     watchman::log(watchman::DBG, "waiting for change notifications\n");
     DWORD status = WaitForMultipleObjects(
@@ -211,8 +356,8 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
 
     if (status == WAIT_OBJECT_0) {
       bytes = 0;
-      if (!GetOverlappedResult(
-              (HANDLE)dir_handle.handle(), &olap, &bytes, FALSE)) {
+      read.inFlight = false;
+      if (!GetOverlappedResult(handle, &read.olap, &bytes, FALSE)) {
         DWORD err = GetLastError();
         logf(
             ERR,
@@ -224,14 +369,18 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
         if (err == ERROR_INVALID_PARAMETER && size > kNetworkBufSize) {
           // May be a network buffer related size issue; the docs say that
           // we can hit this when watching a UNC path. Let's downsize and
-          // retry the read just one time
+          // retry the reads just one time
           logf(
               ERR,
               "retrying watch for possible network location {} "
               "with smaller buffer\n",
               root->root_path);
           size = kNetworkBufSize;
-          initiate_read = true;
+          cancelReads();
+          if (!issueAllReads()) {
+            root->cancel();
+            break;
+          }
           continue;
         }
 
@@ -242,57 +391,28 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
           root->cancel();
           break;
         }
+      } else if (bytes == 0) {
+        // The changes didn't fit in the kernel's buffer and were discarded.
+        root->scheduleRecrawl("ReadDirectoryChangesW buffer overflow");
+      } else if (read.extended) {
+        forEachNotify<FILE_NOTIFY_EXTENDED_INFORMATION>(
+            read.buf.data(), [&](const FILE_NOTIFY_EXTENDED_INFORMATION& n) {
+              addChange(
+                  n.Action, n.FileName, n.FileNameLength, statFromNotify(n));
+            });
       } else {
-        PFILE_NOTIFY_INFORMATION notify = (PFILE_NOTIFY_INFORMATION)buf.data();
-
-        while (true) {
-          // FileNameLength is in BYTES, but FileName is WCHAR
-          DWORD n_chars = notify->FileNameLength / sizeof(notify->FileName[0]);
-          w_string name(notify->FileName, n_chars);
-
-          auto full = w_string::pathCat({root->root_path, name});
-
-          if (!root->ignore.isIgnored(full.data(), full.size())) {
-            // If we have a delete or rename-away it may be part of
-            // a recursive tree remove or rename.  In that situation
-            // the notifications that we'll receive from the OS will
-            // be from the leaves and bubble up to the root of the
-            // delete/rename.  We want to flag those paths for recursive
-            // analysis so that we can prune children from the trie
-            // that is built when we pass this to the pending list
-            // later.  We don't do that here in this thread because
-            // we're trying to minimize latency in this context.
-            items.emplace_back(
-                w_string{full},
-                (notify->Action == FILE_ACTION_REMOVED ||
-                 notify->Action == FILE_ACTION_RENAMED_OLD_NAME)
-                    ? W_PENDING_RECURSIVE
-                    : 0);
-
-            if (!name.empty() &&
-                (notify->Action == FILE_ACTION_ADDED ||
-                 notify->Action == FILE_ACTION_REMOVED ||
-                 notify->Action == FILE_ACTION_RENAMED_OLD_NAME ||
-                 notify->Action == FILE_ACTION_RENAMED_NEW_NAME)) {
-              // ReadDirectoryChangesW provides change events when the child
-              // entry list changes, but may not provide a notification for the
-              // parent when its mtime changes. It should be rescanned, so
-              // synthesize an event for the IO thread here.
-              items.emplace_back(full.dirName(), PendingFlags{});
-            }
-          }
-
-          // Advance to next item
-          if (notify->NextEntryOffset == 0) {
-            break;
-          }
-          notify =
-              (PFILE_NOTIFY_INFORMATION)(notify->NextEntryOffset + (char*)notify);
-        }
+        forEachNotify<FILE_NOTIFY_INFORMATION>(
+            read.buf.data(), [&](const FILE_NOTIFY_INFORMATION& n) {
+              addChange(n.Action, n.FileName, n.FileNameLength, nullptr);
+            });
+      }
 
-        ResetEvent(olapEvent);
-        initiate_read = true;
+      // Queue this buffer up behind the ones still in flight.
+      if (!issueRead(read)) {
+        root->cancel();
+        break;
       }
+      next = (next + 1) % reads.size();
     } else if (status == WAIT_OBJECT_0 + 1) {
       logf(ERR, "signalled\n");
       break;
@@ -393,7 +513,11 @@ Watcher::ConsumeNotifyRet WinWatcher::consumeNotify(
         " ",
         item.flags.format(),
         "\n");
-    coll.add(item.path, now, W_PENDING_VIA_NOTIFY | item.flags);
+    coll.add(
+        item.path,
+        now,
+        W_PENDING_VIA_NOTIFY | item.flags,
+        std::move(item.stat));
   }
 
   // The readChangesThread cancels itself.
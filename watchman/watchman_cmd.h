@@ -25,6 +25,10 @@ class UntypedResponse;
 // argument list
 void w_cmd_realpath_root(watchman::Command& command);
 
+// Like w_cmd_realpath_root, for commands that take an array of root dirs as
+// the second parameter. Leaves the arguments alone if there is no array.
+void w_cmd_realpath_roots(watchman::Command& command);
+
 // Try to find a project root that contains the path `resolved`. If found,
 // modify `resolved` to hold the path to the root project and return true.
 // Else, return false.
@@ -6,11 +6,23 @@
  */
 
 #pragma once
+#include <cstdint>
+#include <memory>
 #include <unordered_map>
+#include "watchman/Clock.h"
+#include "watchman/IncrementalHashMap.h"
 #include "watchman/watchman_string.h"
 
+#ifdef WATCHMAN_FLAT_DIR_CHILDREN
+#include <folly/sorted_vector_types.h>
+#endif
+
 struct watchman_file;
 
+namespace watchman {
+class SlabAllocator;
+}
+
 struct watchman_dir {
   /* the name of this dir, relative to its parent
    * for root (parent == nullptr), name is usually an absolute path */
@@ -18,21 +30,165 @@ struct watchman_dir {
   /* the parent dir */
   watchman_dir* parent;
 
-  /* files contained in this dir (keyed by file->name) */
+  /* the allocator that owns the storage for this dir and its files.
+   * May be nullptr, in which case the system allocator is used. */
+  watchman::SlabAllocator* allocator;
+
   struct Deleter {
     void operator()(watchman_file*) const;
   };
-  std::unordered_map<w_string_piece, std::unique_ptr<watchman_file, Deleter>>
-      files;
+  struct DirDeleter {
+    void operator()(watchman_dir*) const;
+  };
+
+  using FilePtr = std::unique_ptr<watchman_file, Deleter>;
+  using DirPtr = std::unique_ptr<watchman_dir, DirDeleter>;
+
+  // Children are keyed by non-owning string pieces that point into the name
+  // stored by the child node itself.
+#ifdef WATCHMAN_FLAT_DIR_CHILDREN
+  // Sorted, contiguous child storage. Lookups are a binary search and
+  // traversals are sequential in memory, at the cost of O(n) insertion and
+  // removal for very large directories.
+  template <typename V>
+  using ChildMap = folly::sorted_vector_map<w_string_piece, V>;
+#else
+  // Rehashes a few buckets at a time once large, so that adding a child to
+  // a dir of hundreds of thousands doesn't stall the IO thread.
+  template <typename V>
+  using ChildMap = watchman::IncrementalHashMap<w_string_piece, V>;
+#endif
+
+  /* the most recently changed file directly contained in this dir.
+   * Files are linked via dirNext in descending change order.
+   * Declared ahead of `files` so that it outlives them during destruction. */
+  watchman_file* latestFile{nullptr};
+
+  /* the most recent otime of any file in this dir or its descendants.
+   * May overestimate after files are aged out, but never underestimates, so
+   * it is safe to use to prune subtrees when answering since queries. */
+  watchman::ClockStamp subtreeLatest{0, 0};
+
+  /* totals over the files that exist, kept only if the view keeps dir
+   * totals. */
+  struct Totals {
+    int64_t files{0};
+    int64_t bytes{0};
+    // Files whose size is not known, because their stat was deferred
+    int64_t unsized{0};
+  };
+  /* over the files directly contained in this dir */
+  Totals ownTotals;
+  /* over the files in this dir and its descendants */
+  Totals subtreeTotals;
+
+  /* files contained in this dir (keyed by file->name) */
+  ChildMap<FilePtr> files;
 
   /* child dirs contained in this dir (keyed by dir->name) */
-  std::unordered_map<w_string_piece, std::unique_ptr<watchman_dir>> dirs;
+  ChildMap<DirPtr> dirs;
+
+  // A child's name as it compares on a filesystem that is not case
+  // sensitive. The hash of the folded name is computed once, so that
+  // lookups neither scan the children nor allocate a lowercased copy.
+  struct FoldedKey {
+    explicit FoldedKey(w_string_piece name);
+
+    w_string_piece name;
+    uint32_t hash;
+  };
+  struct FoldedKeyHash {
+    size_t operator()(const FoldedKey& key) const {
+      return key.hash;
+    }
+  };
+  struct FoldedKeyEqual {
+    bool operator()(const FoldedKey& a, const FoldedKey& b) const {
+      return a.hash == b.hash && w_string_equal_caseless(a.name, b.name);
+    }
+  };
+  // Names that differ only in case can coexist briefly, such as while a
+  // rename that changes the case is being processed.
+  template <typename V>
+  using FoldedMap =
+      std::unordered_multimap<FoldedKey, V, FoldedKeyHash, FoldedKeyEqual>;
+  struct FoldedChildren {
+    FoldedMap<watchman_file*> files;
+    FoldedMap<watchman_dir*> dirs;
+  };
+
+  /* the children keyed by their case-folded names, or nullptr unless
+   * enableCaseFolding was called on this dir or on its parent */
+  std::unique_ptr<FoldedChildren> folded;
 
   // If we think this dir was deleted, we'll avoid recursing
   // to its children when processing deletes.
   bool last_check_existed{true};
 
-  watchman_dir(w_string name, watchman_dir* parent);
+  // Set when ownTotals, or subtreeTotals, may no longer match the files.
+  // A dir whose subtree totals are stale has ancestors whose are stale too.
+  bool ownTotalsStale{false};
+  bool subtreeTotalsStale{false};
+
+  watchman_dir(
+      w_string name,
+      watchman_dir* parent,
+      watchman::SlabAllocator* allocator = nullptr);
+
+  /**
+   * Construct a dir node, drawing its storage from allocator if it is
+   * non-null.
+   */
+  static DirPtr
+  make(w_string name, watchman_dir* parent, watchman::SlabAllocator* allocator);
+
+  /**
+   * Indexes the children of this dir, and of the dirs later created below
+   * it, by their case-folded names too. Must be called before any children
+   * are added.
+   */
+  void enableCaseFolding();
+
+  bool foldsCase() const {
+    return folded != nullptr;
+  }
+
+  /**
+   * Calls fn with each direct child file whose name equals name when case
+   * is folded. Only valid if foldsCase().
+   */
+  template <typename Fn>
+  void forEachChildFileCaseless(w_string_piece name, Fn&& fn) const {
+    auto range = folded->files.equal_range(FoldedKey{name});
+    for (auto it = range.first; it != range.second; ++it) {
+      fn(it->second);
+    }
+  }
+
+  /**
+   * Calls fn with each direct child dir whose name equals name when case
+   * is folded. Only valid if foldsCase().
+   */
+  template <typename Fn>
+  void forEachChildDirCaseless(w_string_piece name, Fn&& fn) const {
+    auto range = folded->dirs.equal_range(FoldedKey{name});
+    for (auto it = range.first; it != range.second; ++it) {
+      fn(it->second);
+    }
+  }
+
+  /**
+   * Adds a file that was just inserted into files to the case-folded index,
+   * if there is one. Child dirs are indexed by getOrCreateChildDir.
+   */
+  void addFoldedChild(watchman_file* file);
+
+  /**
+   * Removes a child from the case-folded index, if there is one, before it
+   * is erased from files or dirs.
+   */
+  void removeFoldedChild(const watchman_file* file);
+  void removeFoldedChild(const watchman_dir* dir);
 
   watchman_dir* getChildDir(w_string_piece name) const;
 
@@ -42,6 +198,24 @@ struct watchman_dir {
    */
   watchman_file* getChildFile(w_string_piece name) const;
 
+  /**
+   * Returns the direct child dir named name, creating it if it does not exist.
+   */
+  watchman_dir* getOrCreateChildDir(const w_string& name);
+
+  /**
+   * Removes the direct child dir named name, and returns it, with everything
+   * below it, to the caller. Returns nullptr if there is no such child.
+   */
+  DirPtr detachChildDir(w_string_piece name);
+
+  /**
+   * Renames child to name and makes it a child of this dir, which must not
+   * already have a child dir of that name. child must have come from
+   * detachChildDir on a dir that draws from the same allocator.
+   */
+  watchman_dir* adoptChildDir(DirPtr child, w_string name);
+
   /**
    * Walk up to the chain of dirs via ->parent to and then produce the full path
    * to this dir.
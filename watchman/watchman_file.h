@@ -8,7 +8,7 @@
 #pragma once
 
 #include "watchman/Clock.h"
-#include "watchman/fs/FileInformation.h"
+#include "watchman/fs/CompactFileInformation.h"
 #include "watchman/watchman_dir.h"
 
 struct watchman_file {
@@ -20,6 +20,11 @@ struct watchman_file {
    * previous file node, or the head of the list. */
   struct watchman_file **prev, *next;
 
+  /* linkage to the files in the same parent dir, ordered by changed time.
+   * dirPrev has the same meaning as prev, but relative to
+   * parent->latestFile. */
+  struct watchman_file **dirPrev, *dirNext;
+
   /* the time we last observed a change to this file */
   watchman::ClockStamp otime;
   /* the time we first observed this file OR the time
@@ -31,10 +36,16 @@ struct watchman_file {
   bool exists;
   /* whether we think this file might not exist */
   bool maybe_deleted;
+  /* whether an ExtendedFileInformation is stored after the name */
+  bool has_extended_stat;
+  /* whether stat only holds the type that readdir reported, because the
+   * file was crawled under crawl_stat_policy "names" and has not been
+   * stat'd since */
+  bool stat_deferred;
 
   /* cache stat results so we can tell if an entry
    * changed */
-  watchman::FileInformation stat;
+  watchman::CompactFileInformation stat;
 
   inline w_string_piece getName() const {
     uint32_t len;
@@ -42,7 +53,37 @@ struct watchman_file {
     return w_string_piece(reinterpret_cast<const char*>(this + 1) + 4, len);
   }
 
+  /**
+   * Returns the retained stat fields that are not part of `stat`, or nullptr
+   * if they were not retained for this file.
+   */
+  const watchman::ExtendedFileInformation* getExtendedStat() const;
+
+  /**
+   * Replaces the stored stat information with info.
+   */
+  void setStat(const watchman::FileInformation& info);
+
+  /**
+   * Returns the stored stat information. Fields that were not retained are
+   * zeroed; check has_extended_stat to tell whether they are meaningful.
+   */
+  watchman::FileInformation getFileInformation() const;
+
+  /**
+   * Returns true if info describes a different file state than the stored
+   * one, comparing the extended stat fields directly if they are retained.
+   */
+  bool statDiffersFrom(const watchman::FileInformation& info) const;
+
+  /**
+   * Returns the number of bytes allocated for this node, including the name
+   * and extended stat that are stored after it.
+   */
+  size_t getAllocationSize() const;
+
   void removeFromFileList();
+  void removeFromDirFileList();
 
   watchman_file() = delete;
   watchman_file(const watchman_file&) = delete;
@@ -51,7 +92,8 @@ struct watchman_file {
 
   static std::unique_ptr<watchman_file, watchman_dir::Deleter> make(
       const w_string& name,
-      watchman_dir* parent);
+      watchman_dir* parent,
+      bool withExtendedStat = true);
 };
 
 void free_file_node(struct watchman_file* file);
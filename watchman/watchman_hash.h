@@ -11,6 +11,11 @@
 /* Bob Jenkins' lookup3.c hash function */
 uint32_t w_hash_bytes(const void* key, size_t length, uint32_t initval);
 
+/* Wang Yi's wyhash, which is several times faster than lookup3 on short
+ * keys.  Used for w_string hash values when WATCHMAN_FAST_STRING_HASH is
+ * defined. */
+uint64_t w_wyhash_bytes(const void* key, size_t length, uint64_t seed);
+
 namespace watchman {
 // This is the Hash128to64 function from Google's cityhash (available
 // under the MIT License).  We use it to reduce multiple 64 bit hashes
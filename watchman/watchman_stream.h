@@ -36,6 +36,14 @@ class Stream {
   virtual bool peerIsOwner() = 0;
   virtual pid_t getPeerProcessID() const = 0;
   virtual const FileDescriptor& getFileDescriptor() const = 0;
+
+  /**
+   * True if the peer is connected over TCP, and so may be on another
+   * machine; such peers are never owners.
+   */
+  virtual bool peerIsRemote() const {
+    return false;
+  }
 };
 
 struct EventPoll {
@@ -171,6 +171,10 @@ class w_string_piece {
   /** Return a lowercased copy of the string */
   w_string asLowerCase(w_string_type_t stringType = W_STRING_BYTE) const;
 
+  /** Write a lowercased copy of the string to dest, which must have room
+   * for size() bytes.  Unlike asLowerCase, this does not allocate. */
+  void copyLowerCase(char* dest) const;
+
   /** Return a lowercased copy of the suffix */
   w_string asLowerCaseSuffix(w_string_type_t stringType = W_STRING_BYTE) const;
 
@@ -227,6 +231,10 @@ class w_string_piece {
   // Compute a hash value for this piece
   uint32_t hashValue() const;
 
+  // Compute a hash value that does not depend on how watchman was built, for
+  // names that outlive the process, such as those of state files.
+  uint32_t stableHashValue() const;
+
 #ifdef _WIN32
   // Returns a wide character representation of the piece
   std::wstring asWideUNC() const;